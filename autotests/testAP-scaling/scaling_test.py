@@ -0,0 +1,77 @@
+#! /usr/bin/python3
+
+import unittest
+import sys, os
+import time
+
+import iwd
+from iwd import IWD
+from iwd import PSKAgent
+from iwd import NetworkType
+import testutil
+
+#
+# Not a pass/fail performance test: associates an increasing number of
+# stations with a single iwd AP and prints how long each connection took
+# so that regressions in the per-station cost of the AP code show up in
+# the test log.
+#
+class Test(unittest.TestCase):
+    def connect_station(self, wd, ap_dev, dev):
+        condition = 'not obj.scanning'
+        wd.wait_for_object_condition(dev, condition)
+
+        ordered_network = dev.get_ordered_network('TestAPScaling',
+                                                  full_scan=True)
+        self.assertEqual(ordered_network.type, NetworkType.psk)
+
+        start = time.time()
+
+        ordered_network.network_object.connect()
+
+        condition = 'obj.state == DeviceState.connected'
+        wd.wait_for_object_condition(dev, condition)
+
+        elapsed = time.time() - start
+
+        testutil.test_iface_operstate(dev.name)
+        testutil.test_ifaces_connected(ap_dev.name, dev.name, group=False)
+
+        return elapsed
+
+    def test_station_count_scaling(self):
+        wd = IWD(True)
+
+        devices = wd.list_devices(9)
+        ap_dev = devices[0]
+        stations = devices[1:]
+
+        ap_dev.start_ap('TestAPScaling', 'Password1')
+
+        psk_agent = PSKAgent('Password1')
+        wd.register_psk_agent(psk_agent)
+
+        try:
+            for n, dev in enumerate(stations, start=1):
+                elapsed = self.connect_station(wd, ap_dev, dev)
+                print('stations: %u connect time: %.3fs' % (n, elapsed))
+
+            for dev in stations:
+                dev.disconnect()
+
+                condition = 'not obj.connected'
+                wd.wait_for_object_condition(dev, condition)
+        finally:
+            wd.unregister_psk_agent(psk_agent)
+            ap_dev.stop_ap()
+
+    @classmethod
+    def setUpClass(cls):
+        pass
+
+    @classmethod
+    def tearDownClass(cls):
+        IWD.clear_storage()
+
+if __name__ == '__main__':
+    unittest.main(exit=True)
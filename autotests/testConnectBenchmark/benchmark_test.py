@@ -0,0 +1,107 @@
+#! /usr/bin/python3
+
+import unittest
+import sys, os
+
+sys.path.append('../util')
+from iwd import IWD
+from iwd import NetworkType
+from hostapd import HostapdCLI
+from benchmark import Benchmark
+import benchmark
+import testutil
+
+class Test(unittest.TestCase):
+    def run_benchmark(self, case, ssid, network_type, warmup=False):
+        wd = IWD(True)
+
+        device = wd.list_devices(1)[0]
+
+        ordered_network = device.get_ordered_network(ssid, full_scan=True)
+
+        self.assertEqual(ordered_network.type, network_type)
+
+        condition = 'not obj.connected'
+        wd.wait_for_object_condition(ordered_network.network_object, condition)
+
+        # Some methods only take their fast path once state from an earlier
+        # connection is cached (e.g. ERP keys for FILS), don't count that one
+        if warmup:
+            benchmark.connect_cycle(wd, device, ordered_network)
+
+        samples = []
+
+        for i in range(self.bench.iterations):
+            samples.append(benchmark.connect_cycle(wd, device,
+                                                    ordered_network))
+
+        self.bench.add(case, samples)
+
+        # Make sure the last iteration did result in a working connection
+        ordered_network.network_object.connect()
+
+        condition = 'obj.state == DeviceState.connected'
+        wd.wait_for_object_condition(device, condition)
+
+        testutil.test_iface_operstate(device.name)
+        testutil.test_ifaces_connected(device.name,
+                                        HostapdCLI(config=ssid + '.conf').ifname)
+
+        device.disconnect()
+
+        condition = 'not obj.connected'
+        wd.wait_for_object_condition(ordered_network.network_object, condition)
+
+    def test_open(self):
+        self.run_benchmark('open', 'ssidOpen', NetworkType.open)
+
+    def test_wpa2_psk(self):
+        self.run_benchmark('wpa2-psk', 'ssidPSK', NetworkType.psk)
+
+    def test_sae_hnp(self):
+        hapd = HostapdCLI(config='ssidSAE.conf')
+        hapd.set_value('sae_pwe', '0')
+        hapd.reload()
+
+        self.run_benchmark('sae-hnp', 'ssidSAE', NetworkType.psk)
+
+    def test_sae_h2e(self):
+        hapd = HostapdCLI(config='ssidSAE.conf')
+        hapd.set_value('sae_pwe', '1')
+        hapd.reload()
+
+        self.run_benchmark('sae-h2e', 'ssidSAE', NetworkType.psk)
+
+    def test_owe(self):
+        self.run_benchmark('owe', 'ssidOWE', NetworkType.open)
+
+    def test_fils(self):
+        self.run_benchmark('fils-sha256', 'ssidFILS', NetworkType.eap,
+                            warmup=True)
+
+    def test_eap_tls(self):
+        IWD.copy_to_storage('EAP-TLS.8021x', name='ssidEAP.8021x')
+
+        self.run_benchmark('eap-tls', 'ssidEAP', NetworkType.eap)
+
+    def test_eap_peap(self):
+        IWD.copy_to_storage('EAP-PEAP.8021x', name='ssidEAP.8021x')
+
+        self.run_benchmark('eap-peap-mschapv2', 'ssidEAP', NetworkType.eap)
+
+    @classmethod
+    def setUpClass(cls):
+        cls.bench = Benchmark('connect')
+
+        IWD.copy_to_storage('ssidPSK.psk')
+        IWD.copy_to_storage('ssidSAE.psk')
+        IWD.copy_to_storage('ssidFILS.8021x')
+
+        os.system('ip link set lo up')
+
+    @classmethod
+    def tearDownClass(cls):
+        IWD.clear_storage()
+
+if __name__ == '__main__':
+    unittest.main(exit=True)
@@ -0,0 +1,345 @@
+#! /usr/bin/python3
+
+import unittest
+import sys, os
+import select
+import struct
+import threading
+import time
+
+sys.path.append('../util')
+import iwd
+from iwd import IWD
+from iwd import NetworkType
+from hwsim import Hwsim
+from hostapd import HostapdCLI
+from benchmark import Benchmark
+from config import ctx
+from gi.repository import GLib
+import testutil
+
+# Link signal (100 * dBm) of the BSS we want iwd on and the one we don't
+SIGNAL_STRONG = -3000
+SIGNAL_WEAK = -8500
+
+# Interval of the data frames sent while roaming to estimate the disruption
+PROBE_INTERVAL = 0.01
+
+# Seconds after the roam completes during which late probe frames are counted
+PROBE_SETTLE = 1
+
+class RoamProbe:
+    '''
+        Sends numbered data frames from the station at a fixed interval and
+        counts the ones delivered to any of the APs.  Frames sent while the
+        station is between BSSes, or before the new keys are installed, are
+        never seen on the AP side and are reported as lost.
+    '''
+    def __init__(self, sta_ifname, ap_ifnames):
+        self._sta_sock, self._sta_addr = testutil.raw_if_socket(sta_ifname)
+        self._ap_socks = [testutil.raw_if_socket(i)[0] for i in ap_ifnames]
+        self._received = set()
+        self._sent = 0
+        self._running = False
+
+    def _frame(self, seq):
+        payload = b'roam-bench' + struct.pack('!I', seq)
+
+        return b''.join([
+            b'\xff\xff\xff\xff\xff\xff',
+            self._sta_addr,
+            struct.pack('!H', testutil.HWSIM_ETHERTYPE),
+            payload,
+            bytes(testutil.HWSIM_PACKETLEN - 14 - len(payload))
+        ])
+
+    def _tx_loop(self):
+        while self._running:
+            self._sta_sock.send(self._frame(self._sent))
+            self._sent += 1
+            time.sleep(PROBE_INTERVAL)
+
+    def _rx_loop(self):
+        while self._running:
+            r, w, x = select.select(self._ap_socks, [], [], 0.1)
+
+            for s in r:
+                data, src = s.recvfrom(testutil.HWSIM_PACKETLEN + 1)
+                if src[4] != self._sta_addr or \
+                        not data[14:].startswith(b'roam-bench'):
+                    continue
+
+                self._received.add(struct.unpack('!I', data[24:28])[0])
+
+    def start(self):
+        self._running = True
+        self._threads = [ threading.Thread(target=self._tx_loop),
+                          threading.Thread(target=self._rx_loop) ]
+
+        for t in self._threads:
+            t.start()
+
+    def stop(self):
+        self._running = False
+
+        for t in self._threads:
+            t.join()
+
+        self._sta_sock.close()
+
+        for s in self._ap_socks:
+            s.close()
+
+        return self._sent, len(self._received)
+
+class RoamTimer:
+    '''
+        Timestamps the StationDebug events and Station state changes of a
+        single roam so that the time to detect the low signal, the roam
+        scan and the transition itself can be reported separately.
+    '''
+    def __init__(self, device):
+        self._events = {}
+        self._loop = GLib.MainLoop()
+        self._error = None
+
+        bus = ctx.get_bus()
+
+        self._matches = [
+            bus.add_signal_receiver(self._properties_changed,
+                                    signal_name='PropertiesChanged',
+                                    dbus_interface=iwd.DBUS_PROPERTIES,
+                                    path=device.device_path),
+            bus.add_signal_receiver(self._debug_event,
+                                    signal_name='Event',
+                                    dbus_interface=iwd.IWD_STATION_DEBUG_INTERFACE,
+                                    path=device.device_path)
+        ]
+
+    def _mark(self, name):
+        if name not in self._events:
+            self._events[name] = time.monotonic()
+
+    def _properties_changed(self, interface, changed, invalidated):
+        if interface != iwd.IWD_STATION_INTERFACE or 'State' not in changed:
+            return
+
+        state = str(changed['State'])
+
+        if state == 'roaming':
+            self._mark('roaming')
+        elif state == 'connected' and 'roaming' in self._events:
+            self._mark('connected')
+            self._loop.quit()
+        elif state != 'connected':
+            self._error = 'unexpected state %s while roaming' % state
+            self._loop.quit()
+
+    def _debug_event(self, event, data):
+        self._mark(str(event))
+
+    def _timeout(self):
+        self._error = 'timeout waiting for the roam to complete'
+        self._loop.quit()
+        return False
+
+    def trigger(self):
+        self._events['trigger'] = time.monotonic()
+
+    def wait(self, timeout=30):
+        source = GLib.timeout_add_seconds(timeout, self._timeout)
+
+        self._loop.run()
+
+        if not self._error:
+            GLib.source_remove(source)
+
+        for match in self._matches:
+            match.remove()
+
+        if self._error:
+            raise Exception(self._error)
+
+    def elapsed_ms(self, start, end):
+        if start not in self._events or end not in self._events:
+            return None
+
+        return round((self._events[end] - self._events[start]) * 1000, 1)
+
+class Test(unittest.TestCase):
+    def set_signals(self, bss_radios, serving):
+        for i, radio in enumerate(bss_radios):
+            signal = SIGNAL_STRONG if i == serving else SIGNAL_WEAK
+            self.hwsim.set_link(self.sta_radio, radio, signal)
+
+    def measure_roam(self, wd, device, bss_hostapd, bss_radios, target):
+        bss_ifnames = [ bss.ifname for bss in bss_hostapd ]
+
+        probe = RoamProbe(device.name, bss_ifnames)
+        timer = RoamTimer(device)
+
+        probe.start()
+
+        # Move the station towards the target BSS, the kernel will report
+        # the low signal on the current BSS and iwd decides to roam
+        timer.trigger()
+        self.set_signals(bss_radios, target)
+
+        try:
+            timer.wait()
+        finally:
+            # Leave time for frames queued behind the handshake
+            wd.wait(PROBE_SETTLE)
+            sent, received = probe.stop()
+
+        self.assertTrue(bss_hostapd[target].list_sta())
+
+        testutil.test_iface_operstate(device.name)
+        testutil.test_ifaces_connected(bss_hostapd[target].ifname, device.name)
+
+        return {
+            'detect_ms': timer.elapsed_ms('trigger', 'roam-scan-triggered'),
+            'scan_ms': timer.elapsed_ms('roam-scan-triggered', 'roaming'),
+            'transition_ms': timer.elapsed_ms('roaming', 'connected'),
+            'total_ms': timer.elapsed_ms('trigger', 'connected'),
+            'frames_sent': sent,
+            'frames_lost': sent - received,
+        }
+
+    def run_benchmark(self, method, ssid, network_type, bss_hostapd,
+                        bss_radios):
+        wd = IWD(True)
+
+        device = wd.list_devices(1)[0]
+
+        self.set_signals(bss_radios, 0)
+
+        ordered_network = device.get_ordered_network(ssid, full_scan=True)
+
+        self.assertEqual(ordered_network.type, network_type)
+
+        condition = 'not obj.connected'
+        wd.wait_for_object_condition(ordered_network.network_object, condition)
+
+        device.connect_bssid(bss_hostapd[0].bssid)
+
+        condition = 'obj.state == DeviceState.connected'
+        wd.wait_for_object_condition(device, condition)
+
+        self.assertTrue(bss_hostapd[0].list_sta())
+
+        iterations = []
+
+        for i in range(self.bench.iterations):
+            # Let the signal average settle before dropping it again
+            wd.wait(2)
+
+            iterations.append(self.measure_roam(wd, device, bss_hostapd,
+                                                bss_radios, (i + 1) % 2))
+
+        device.disconnect()
+
+        condition = 'not obj.connected'
+        wd.wait_for_object_condition(ordered_network.network_object, condition)
+
+        self.bench.add(method, iterations)
+
+    def configure_ft(self, key_mgmt, over_ds):
+        for bss in self.ft_hostapd:
+            bss.set_value('wpa_key_mgmt', key_mgmt)
+            bss.set_value('ft_over_ds', '1' if over_ds else '0')
+            bss.reload()
+            bss.wait_for_event("AP-ENABLED")
+
+    def test_ft_over_air(self):
+        self.configure_ft('FT-PSK', False)
+
+        self.run_benchmark('ft-over-air', 'TestRoamFT', NetworkType.psk,
+                            self.ft_hostapd, self.ft_radios)
+
+    def test_ft_over_ds(self):
+        self.configure_ft('FT-PSK', True)
+
+        # Drop FT Authenticate frames so that only FT-over-DS can succeed
+        self.auth_rule.enabled = True
+
+        self.run_benchmark('ft-over-ds', 'TestRoamFT', NetworkType.psk,
+                            self.ft_hostapd, self.ft_radios)
+
+    def test_reassociation(self):
+        self.configure_ft('WPA-PSK', False)
+
+        self.run_benchmark('reassociation', 'TestRoamFT', NetworkType.psk,
+                            self.ft_hostapd, self.ft_radios)
+
+    def test_preauthentication(self):
+        self.run_benchmark('preauthentication', 'TestRoamPreauth',
+                            NetworkType.eap, self.preauth_hostapd,
+                            self.preauth_radios)
+
+    def tearDown(self):
+        for bss in self.ft_hostapd + self.preauth_hostapd:
+            os.system('ip link set "' + bss.ifname + '" down')
+            os.system('ip link set "' + bss.ifname + '" up')
+
+        self.auth_rule.enabled = False
+
+    @classmethod
+    def setUpClass(cls):
+        # Roams alternate between the two BSSes of each method
+        cls.bench = Benchmark('roam', iterations=3)
+        cls.hwsim = Hwsim()
+
+        IWD.copy_to_storage('TestRoamFT.psk')
+        IWD.copy_to_storage('TestRoamPreauth.8021x')
+
+        os.system('ip link set lo up')
+
+        cls.ft_hostapd = [ HostapdCLI(config='ft-psk-1.conf'),
+                           HostapdCLI(config='ft-psk-2.conf') ]
+        cls.preauth_hostapd = [ HostapdCLI(config='eaptls-preauth-1.conf'),
+                                HostapdCLI(config='eaptls-preauth-2.conf') ]
+
+        cls.ft_radios = [ cls.hwsim.get_radio('rad0'),
+                          cls.hwsim.get_radio('rad1') ]
+        cls.preauth_radios = [ cls.hwsim.get_radio('rad2'),
+                               cls.hwsim.get_radio('rad3') ]
+        cls.sta_radio = cls.hwsim.get_radio('rad4')
+
+        cls.auth_rule = cls.hwsim.rules.create()
+        cls.auth_rule.source = cls.sta_radio.addresses[0]
+        cls.auth_rule.prefix = 'b0'
+        cls.auth_rule.drop = True
+        cls.auth_rule.enabled = False
+
+        # Set interface addresses to those expected by hostapd config files
+        os.system('ip link set dev "' + cls.ft_hostapd[0].ifname + '" down')
+        os.system('ip link set dev "' + cls.ft_hostapd[0].ifname + '" addr 12:00:00:00:00:01 up')
+        os.system('ip link set dev "' + cls.ft_hostapd[1].ifname + '" down')
+        os.system('ip link set dev "' + cls.ft_hostapd[1].ifname + '" addr 12:00:00:00:00:02 up')
+
+        for bss in cls.ft_hostapd:
+            bss.reload()
+            bss.wait_for_event("AP-ENABLED")
+
+        # Fill in the neighbor AP tables so that roam scans are limited to
+        # the other BSS, as they would be on a well configured network
+        for bss_list, ssid in [ (cls.ft_hostapd, 'TestRoamFT'),
+                                (cls.preauth_hostapd, 'TestRoamPreauth') ]:
+            nr = [ ''.join(bss.bssid.split(':')) + '8f00000051%02x060603000000'
+                    % (i + 1) for i, bss in enumerate(bss_list) ]
+
+            bss_list[0].set_neighbor(bss_list[1].bssid, ssid, nr[1])
+            bss_list[1].set_neighbor(bss_list[0].bssid, ssid, nr[0])
+
+    @classmethod
+    def tearDownClass(cls):
+        for bss in cls.ft_radios + cls.preauth_radios:
+            cls.hwsim.remove_link(cls.sta_radio, bss)
+
+        cls.auth_rule.remove()
+
+        IWD.clear_storage()
+
+if __name__ == '__main__':
+    unittest.main(exit=True)
@@ -0,0 +1,173 @@
+#!/usr/bin/python3
+import json
+import time
+from gi.repository import GLib
+
+from config import ctx
+
+# Connection phases reported by StationDiagnostic.GetDiagnostics
+CONNECT_PHASES = [
+    'Scan',
+    'Authentication',
+    'Association',
+    'Handshake',
+    'Netconfig'
+]
+
+def median(values):
+    values = sorted([v for v in values if v is not None])
+
+    if not values:
+        return None
+
+    return values[len(values) // 2]
+
+class Benchmark:
+    '''
+        Collects the samples of a benchmark autotest and reports them.
+
+        Each case (e.g. a security type or a roaming method) is a list of
+        samples, a sample being a dictionary of numeric values.  A summary
+        line is printed for every case added and, if test-runner was
+        started with --bench <file>, the samples are also appended to that
+        file as one JSON object per line so that results of different runs
+        can be compared.
+    '''
+    def __init__(self, name, iterations=5):
+        self.name = name
+
+        if ctx.args.bench_iterations:
+            self.iterations = int(ctx.args.bench_iterations)
+        else:
+            self.iterations = iterations
+
+    def add(self, case, samples):
+        keys = []
+
+        for sample in samples:
+            keys += [k for k in sample.keys() if k not in keys]
+
+        summary = {}
+
+        for key in keys:
+            values = [s.get(key, None) for s in samples]
+            values = [v for v in values if v is not None]
+
+            if not values:
+                summary[key] = None
+                continue
+
+            summary[key] = {
+                'min': min(values),
+                'median': median(values),
+                'max': max(values),
+            }
+
+        record = {
+            'benchmark': self.name,
+            'case': case,
+            'iterations': len(samples),
+            'summary': summary,
+            'samples': samples,
+        }
+
+        print('BENCHMARK %s %s %s' % (self.name, case,
+                json.dumps(dict((k, v['median'] if v else None)
+                                    for k, v in summary.items()))))
+
+        if not ctx.args.bench:
+            return
+
+        with open(ctx.args.bench, 'a') as f:
+            f.write(json.dumps(record, sort_keys=True) + '\n')
+
+def _timed_call(method, *args, timeout=30):
+    '''
+        Calls an asynchronous D-Bus method and returns how long in ms it
+        took for the reply to arrive.  Unlike the wait helpers in iwd.py
+        this runs the main loop until the reply so the measurement is not
+        quantized by polling.
+    '''
+    mainloop = GLib.MainLoop()
+    result = {}
+
+    def reply_handler(*args):
+        result['end'] = time.monotonic()
+        mainloop.quit()
+
+    def error_handler(ex):
+        result['error'] = ex
+        mainloop.quit()
+
+    def timeout_handler():
+        result['error'] = TimeoutError('timeout waiting for D-Bus reply')
+        mainloop.quit()
+        return False
+
+    source = GLib.timeout_add_seconds(timeout, timeout_handler)
+
+    start = time.monotonic()
+    method(*args, reply_handler=reply_handler, error_handler=error_handler,
+            timeout=timeout)
+
+    mainloop.run()
+
+    if 'error' in result:
+        raise result['error']
+
+    GLib.source_remove(source)
+
+    return round((result['end'] - start) * 1000, 1)
+
+# Histogram totals seen after the last connection, per device object path
+_last_counts = {}
+
+def _phase_counts(diagnostics):
+    counts = {}
+
+    for phase in CONNECT_PHASES:
+        histogram = diagnostics.get(phase + 'Histogram', None)
+        counts[phase] = sum(histogram) if histogram is not None else 0
+
+    return counts
+
+def connect_cycle(wd, device, network):
+    '''
+        Connects to 'network', an OrderedNetwork, then disconnects again.
+        Returns the time taken by the Connect and Disconnect calls and the
+        duration of each connection phase as recorded by iwd.  Phases that
+        did not occur in this connection (e.g. no scan preceded it, or
+        no authentication frames for a non-SAE/FT/FILS/OWE network) are
+        None rather than stale values from an earlier connection.
+    '''
+    before = _last_counts.get(device.device_path, _phase_counts({}))
+    net = network.network_object
+    sample = {}
+
+    sample['connect_ms'] = _timed_call(net._iface.Connect)
+
+    condition = 'obj.state == DeviceState.connected'
+    wd.wait_for_object_condition(device, condition)
+
+    diagnostics = device.get_diagnostics()
+    after = _phase_counts(diagnostics)
+    _last_counts[device.device_path] = after
+
+    for phase in CONNECT_PHASES:
+        key = phase.lower() + '_ms'
+
+        # Counts going down means iwd was restarted since the last cycle
+        if after[phase] < before[phase]:
+            before[phase] = 0
+
+        if after[phase] == before[phase]:
+            sample[key] = None
+        else:
+            sample[key] = int(diagnostics[phase + 'Time'])
+
+    sample['disconnect_ms'] = _timed_call(device._station.Disconnect)
+
+    condition = 'not obj.connected'
+    wd.wait_for_object_condition(net, condition)
+
+    return sample
@@ -16,6 +16,7 @@ HWSIM_RULE_INTERFACE =          'net.connman.hwsim.Rule'
 HWSIM_RADIO_MANAGER_INTERFACE = 'net.connman.hwsim.RadioManager'
 HWSIM_RADIO_INTERFACE =         'net.connman.hwsim.Radio'
 HWSIM_INTERFACE_INTERFACE =     'net.connman.hwsim.Interface'
+HWSIM_LINK_MODEL_INTERFACE =    'net.connman.hwsim.LinkModel'
 
 HWSIM_AGENT_MANAGER_PATH =      '/'
 
@@ -369,6 +370,9 @@ class Hwsim(iwd.AsyncOpAbstract):
         self._object_manager_if = dbus.Interface(
                 self._bus.get_object(HWSIM_SERVICE, '/'),
                 iwd.DBUS_OBJECT_MANAGER)
+        self._link_model_if = dbus.Interface(
+                self._bus.get_object(HWSIM_SERVICE, '/'),
+                HWSIM_LINK_MODEL_INTERFACE)
 
         objects = self.object_manager.GetManagedObjects()
 
@@ -395,6 +399,29 @@ class Hwsim(iwd.AsyncOpAbstract):
     def object_manager(self):
         return self._object_manager_if
 
+    def set_link(self, source, destination, signal, latency=0, loss=0.0,
+                    bidirectional=True):
+        '''
+            Set the signal (100 * dBm), latency (ms) and frame loss
+            probability (0.0 - 1.0) of frames from source to destination
+            radio, and back if bidirectional.  Can be called repeatedly
+            to move a station around.
+        '''
+        self._link_model_if.SetLink(source.path, destination.path,
+                                    dbus.Int16(signal), dbus.UInt32(latency),
+                                    dbus.Double(loss))
+
+        if bidirectional:
+            self._link_model_if.SetLink(destination.path, source.path,
+                                    dbus.Int16(signal), dbus.UInt32(latency),
+                                    dbus.Double(loss))
+
+    def remove_link(self, source, destination, bidirectional=True):
+        self._link_model_if.RemoveLink(source.path, destination.path)
+
+        if bidirectional:
+            self._link_model_if.RemoveLink(destination.path, source.path)
+
     @staticmethod
     def _convert_address(address):
         first = int(address[0:2], base=16)
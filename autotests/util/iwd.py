@@ -40,6 +40,7 @@ IWD_P2P_PEER_INTERFACE =        'net.connman.iwd.p2p.Peer'
 IWD_P2P_SERVICE_MANAGER_INTERFACE = 'net.connman.iwd.p2p.ServiceManager'
 IWD_P2P_WFD_INTERFACE =         'net.connman.iwd.p2p.Display'
 IWD_STATION_DEBUG_INTERFACE =   'net.connman.iwd.StationDebug'
+IWD_STATION_DIAGNOSTIC_INTERFACE = 'net.connman.iwd.StationDiagnostic'
 IWD_DPP_INTERFACE =             'net.connman.iwd.DeviceProvisioning'
 
 IWD_AGENT_MANAGER_PATH =        '/net/connman/iwd'
@@ -299,6 +300,7 @@ class Device(IWDDBusAbstract):
     def __init__(self, *args, **kwargs):
         self._wps_manager_if = None
         self._station_if = None
+        self._station_diagnostic_if = None
         self._station_props = None
         self._station_debug_obj = None
         self._dpp_obj = None
@@ -322,6 +324,15 @@ class Device(IWDDBusAbstract):
                                             IWD_STATION_INTERFACE)
         return self._station_if
 
+    @property
+    def _station_diagnostic(self):
+        if self._station_diagnostic_if is None:
+            self._station_diagnostic_if = dbus.Interface(
+                                self._bus.get_object(IWD_SERVICE,
+                                                    self.device_path),
+                                IWD_STATION_DIAGNOSTIC_INTERFACE)
+        return self._station_diagnostic_if
+
     @property
     def _device_provisioning(self):
         if self._properties['Mode'] != 'station':
@@ -479,6 +490,14 @@ class Device(IWDDBusAbstract):
 
         self._wait_for_async_op()
 
+    def get_diagnostics(self):
+        '''Return the StationDiagnostic dictionary of the current
+           connection
+
+           Possible exception: NotConnectedEx
+        '''
+        return self._station_diagnostic.GetDiagnostics()
+
     def get_ordered_networks(self, scan_if_needed = True, full_scan = False, list = []):
         '''Return the list of networks found in the most recent
            scan, sorted by their user interface importance
@@ -72,10 +72,15 @@ static struct l_dbus_message *agent_error(struct l_dbus_message *message,
 {
 	display_error(text);
 
+	/*
+	 * In batch mode the failed method call completes the command, the
+	 * next one must not be started before its reply arrives.
+	 */
 	if (!command_is_interactive_mode()) {
 		command_set_exit_status(EXIT_FAILURE);
 
-		l_main_quit();
+		if (!command_is_batch_mode())
+			l_main_quit();
 	}
 
 	return agent_reply_canceled(message, text);
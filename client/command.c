@@ -26,6 +26,7 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
 #include <ell/ell.h>
@@ -43,6 +44,13 @@ static struct command_noninteractive {
 	int argc;
 } command_noninteractive;
 
+static struct command_batch {
+	bool enabled;
+	bool busy;
+	unsigned int line;
+	unsigned int failures;
+} command_batch;
+
 struct command_option {
 	const char *name;
 	char *value;
@@ -387,7 +395,7 @@ static void execute_cmd(const char *family, const char *entity,
 		goto error;
 
 	if (status == CMD_STATUS_DONE && !interactive_mode) {
-		l_main_quit();
+		command_noninteractive_done();
 
 		return;
 	}
@@ -431,7 +439,7 @@ error:
 failure:
 	exit_status = EXIT_FAILURE;
 
-	l_main_quit();
+	command_noninteractive_done();
 }
 
 static bool match_cmd(const char *family, const char *param,
@@ -518,6 +526,8 @@ static void list_cmd_options(void)
 	display(MARGIN "--%-*s%s\n", 48, COMMAND_OPTION_DONTASK,
 					"Don't ask for missing\n"
 					"\t\t\t\t\t\t    credentials");
+	display(MARGIN "--%-*s%s\n", 48, "batch",
+					"Read commands from stdin");
 	display(MARGIN "--%-*s%s\n", 48, "help", "Display help");
 }
 
@@ -590,7 +600,7 @@ void command_process_prompt(char **argv, int argc)
 		display_error("Invalid command\n");
 		exit_status = EXIT_FAILURE;
 quit:
-		l_main_quit();
+		command_noninteractive_done();
 		return;
 	}
 
@@ -602,8 +612,83 @@ quit:
 	display_error("Invalid command\n");
 }
 
+static void command_batch_next(void *user_data)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+
+	while ((len = getline(&line, &size, stdin)) != -1) {
+		char **argv;
+		int argc;
+
+		command_batch.line++;
+
+		if (len && line[len - 1] == '\n')
+			line[len - 1] = '\0';
+
+		argv = l_parse_args(line, &argc);
+		if (!argv) {
+			display("Line %u: invalid command\n",
+							command_batch.line);
+			command_batch.failures++;
+			continue;
+		}
+
+		if (!argc || argv[0][0] == '#') {
+			l_strfreev(argv);
+			continue;
+		}
+
+		command_batch.busy = true;
+		command_process_prompt(argv, argc);
+		l_strfreev(argv);
+		free(line);
+
+		return;
+	}
+
+	free(line);
+
+	exit_status = command_batch.failures ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	l_main_quit();
+}
+
+/*
+ * Called once the current non-interactive command has completed, either
+ * synchronously or from its D-Bus reply.  In batch mode the connection
+ * and the proxy cache are kept and the next command is read from stdin.
+ */
+void command_noninteractive_done(void)
+{
+	if (!command_batch.enabled) {
+		l_main_quit();
+		return;
+	}
+
+	if (!command_batch.busy)
+		return;
+
+	command_batch.busy = false;
+
+	if (exit_status == EXIT_FAILURE) {
+		display("Line %u: command failed\n", command_batch.line);
+		command_batch.failures++;
+	}
+
+	exit_status = EXIT_SUCCESS;
+
+	l_idle_oneshot(command_batch_next, NULL, NULL);
+}
+
 void command_noninteractive_trigger(void)
 {
+	if (command_batch.enabled) {
+		command_batch_next(NULL);
+		return;
+	}
+
 	if (!command_noninteractive.argc)
 		return;
 
@@ -616,6 +701,11 @@ bool command_is_interactive_mode(void)
 	return interactive_mode;
 }
 
+bool command_is_batch_mode(void)
+{
+	return command_batch.enabled;
+}
+
 void command_set_exit_status(int status)
 {
 	exit_status = status;
@@ -656,6 +746,7 @@ static const struct option command_opts[] = {
 	{ COMMAND_OPTION_PASSWORD,	required_argument, NULL, 'p' },
 	{ COMMAND_OPTION_PASSPHRASE,	required_argument, NULL, 'P' },
 	{ COMMAND_OPTION_DONTASK,	no_argument,	   NULL, 'd' },
+	{ "batch",			no_argument,	   NULL, 'b' },
 	{ "help",			no_argument,	   NULL, 'h' },
 	{ }
 };
@@ -681,7 +772,7 @@ bool command_init(char **argv, int argc)
 	for (;;) {
 		struct command_option *option;
 
-		opt = getopt_long(argc, argv, "u:p:P:dh", command_opts, NULL);
+		opt = getopt_long(argc, argv, "u:p:P:dbh", command_opts, NULL);
 
 		switch (opt) {
 		case 'u':
@@ -714,6 +805,10 @@ bool command_init(char **argv, int argc)
 
 			l_queue_push_tail(command_options, option);
 
+			break;
+		case 'b':
+			command_batch.enabled = true;
+
 			break;
 		case 'h':
 			command_display_help();
@@ -734,6 +829,30 @@ options_parsed:
 	argv += optind;
 	argc -= optind;
 
+	if (command_batch.enabled) {
+		if (argc) {
+			display_error("Commands cannot be combined with "
+					"'--batch', feed them on stdin");
+			exit_status = EXIT_FAILURE;
+
+			return true;
+		}
+
+		/*
+		 * Stdin carries the commands, so the agent cannot prompt for
+		 * missing credentials.
+		 */
+		if (!command_option_get(COMMAND_OPTION_DONTASK, NULL)) {
+			struct command_option *option =
+					l_new(struct command_option, 1);
+
+			option->name = COMMAND_OPTION_DONTASK;
+			l_queue_push_tail(command_options, option);
+		}
+
+		return false;
+	}
+
 	if (argc < 2) {
 		interactive_mode = true;
 		return false;
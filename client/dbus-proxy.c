@@ -320,7 +320,7 @@ static void proxy_callback(struct l_dbus_message *message, void *user_data)
 		return;
 
 quit:
-	l_main_quit();
+	command_noninteractive_done();
 }
 
 bool proxy_property_set(const struct proxy_interface *proxy, const char *name,
@@ -490,6 +490,8 @@ static void properties_changed_callback(struct l_dbus_message *message,
 		return;
 
 	interface_update_properties(proxy, &changed, &invalidated);
+
+	display_refresh_properties_changed();
 }
 
 static bool is_ignorable(const char *interface)
@@ -684,6 +686,8 @@ static void interfaces_added_callback(struct l_dbus_message *message,
 		return;
 
 	proxy_interfaces_update_properties(path, &object);
+
+	display_refresh_properties_changed();
 }
 
 static void interfaces_removed_callback(struct l_dbus_message *message,
@@ -710,6 +714,8 @@ static void interfaces_removed_callback(struct l_dbus_message *message,
 
 		proxy_interface_destroy(proxy);
 	}
+
+	display_refresh_properties_changed();
 }
 
 static void get_managed_objects_callback(struct l_dbus_message *message,
@@ -46,7 +46,6 @@
 static struct l_signal *window_change_signal;
 static struct l_io *io;
 static char dashed_line[LINE_LEN] = { [0 ... LINE_LEN - 2] = '-' };
-static char empty_line[LINE_LEN] = { [0 ... LINE_LEN - 2] = ' ' };
 static struct l_timeout *refresh_timeout;
 static struct saved_input *agent_saved_input;
 
@@ -57,9 +56,13 @@ static struct display_refresh {
 	const struct command *cmd;
 	char **argv;
 	int argc;
-	size_t undo_lines;
+	struct l_queue *lines;
+	struct l_queue *old_lines;
+	const struct l_queue_entry *old_entry;
+	struct saved_input *input;
 	struct l_queue *redo_entries;
 	bool recording;
+	bool redrawing;
 } display_refresh = { .enabled = true };
 
 struct saved_input {
@@ -99,36 +102,100 @@ static void restore_input(struct saved_input *input)
 	l_free(input);
 }
 
-static void display_refresh_undo_lines(void)
+/*
+ * A refresh moves the cursor back to the top of the region drawn by the
+ * previous run and compares each new line against the one already on the
+ * screen.  Only the lines that changed get rewritten, the others are
+ * skipped over, so an idle view costs a few bytes per refresh instead of
+ * a full redraw.
+ */
+static void display_refresh_rewind(void)
 {
-	size_t num_lines = display_refresh.undo_lines;
+	unsigned int num_lines = l_queue_length(display_refresh.lines);
 
-	printf("\033[%dA", (int) num_lines);
+	display_refresh.input = save_input();
 
-	do {
-		printf("%s\n", empty_line);
-	} while (--display_refresh.undo_lines);
+	if (num_lines)
+		printf("\033[%uA", num_lines);
 
-	printf("\033[%dA", (int) num_lines);
+	display_refresh.old_lines = display_refresh.lines;
+	display_refresh.old_entry = l_queue_get_entries(display_refresh.lines);
+	display_refresh.lines = l_queue_new();
+	display_refresh.redrawing = true;
+}
+
+static void display_refresh_print(const char *text)
+{
+	const char *old = NULL;
+	size_t len = strlen(text);
+	bool newline = len && text[len - 1] == '\n';
+
+	if (display_refresh.old_entry) {
+		old = display_refresh.old_entry->data;
+		display_refresh.old_entry = display_refresh.old_entry->next;
+	}
+
+	if (old && newline && !strcmp(old, text))
+		printf("\n");
+	else if (newline)
+		printf("%.*s\033[K\n", (int) len - 1, text);
+	else
+		printf("%s\033[K", text);
+
+	l_queue_push_tail(display_refresh.lines, l_strdup(text));
+}
+
+static void display_refresh_finish(void)
+{
+	unsigned int stale = 0;
+
+	if (!display_refresh.redrawing)
+		return;
+
+	/* Blank out what is left of a longer previous run */
+	for (; display_refresh.old_entry;
+		display_refresh.old_entry = display_refresh.old_entry->next) {
+		printf("\033[K\n");
+		stale++;
+	}
+
+	if (stale)
+		printf("\033[%uA", stale);
+
+	l_queue_destroy(display_refresh.old_lines, l_free);
+	display_refresh.old_lines = NULL;
+	display_refresh.redrawing = false;
+
+	restore_input(l_steal_ptr(display_refresh.input));
 }
 
 static void display_refresh_redo_lines(void)
 {
 	const struct l_queue_entry *entry;
-	struct saved_input *input;
+	struct saved_input *input = NULL;
 
-	input = save_input();
+	if (!display_refresh.redrawing)
+		input = save_input();
 
 	for (entry = l_queue_get_entries(display_refresh.redo_entries); entry;
 							entry = entry->next) {
 		char *line = entry->data;
 
+		if (display_refresh.redrawing) {
+			display_refresh_print(line);
+			continue;
+		}
+
 		printf("%s", line);
 
-		display_refresh.undo_lines++;
+		l_queue_push_tail(display_refresh.lines, l_strdup(line));
 	}
 
-	restore_input(input);
+	if (display_refresh.redrawing)
+		display_refresh_finish();
+	else
+		restore_input(input);
+
 	display_refresh.recording = true;
 
 	l_timeout_modify(refresh_timeout, 1);
@@ -136,6 +203,8 @@ static void display_refresh_redo_lines(void)
 
 void display_refresh_reset(void)
 {
+	display_refresh_finish();
+
 	l_free(display_refresh.family);
 	display_refresh.family = NULL;
 
@@ -148,7 +217,7 @@ void display_refresh_reset(void)
 	display_refresh.argv = NULL;
 	display_refresh.argc = 0;
 
-	display_refresh.undo_lines = 0;
+	l_queue_clear(display_refresh.lines, l_free);
 	display_refresh.recording = false;
 
 	l_queue_clear(display_refresh.redo_entries, l_free);
@@ -161,6 +230,8 @@ void display_refresh_set_cmd(const char *family, const char *entity,
 	int i;
 
 	if (cmd->refreshable) {
+		display_refresh_finish();
+
 		l_free(display_refresh.family);
 		display_refresh.family = l_strdup(family);
 
@@ -178,9 +249,9 @@ void display_refresh_set_cmd(const char *family, const char *entity,
 			display_refresh.argv[i] = l_strdup(argv[i]);
 
 		l_queue_clear(display_refresh.redo_entries, l_free);
+		l_queue_clear(display_refresh.lines, l_free);
 
 		display_refresh.recording = false;
-		display_refresh.undo_lines = 0;
 
 		return;
 	}
@@ -217,7 +288,7 @@ void display_refresh_set_cmd(const char *family, const char *entity,
 						cmd->cmd ? : "", args ? : "");
 
 		l_queue_push_tail(display_refresh.redo_entries, prompt);
-		display_refresh.undo_lines++;
+		l_queue_push_tail(display_refresh.lines, l_strdup(prompt));
 
 		display_refresh.recording = true;
 	} else {
@@ -248,16 +319,19 @@ static void display_refresh_check_feasibility(void)
 
 static void display_refresh_check_applicability(void)
 {
-	if (display_refresh.enabled && display_refresh.cmd)
+	if (display_refresh.enabled && display_refresh.cmd) {
 		display_refresh_redo_lines();
-	else if (display_refresh.cmd)
+		return;
+	}
+
+	display_refresh_finish();
+
+	if (display_refresh.cmd)
 		display_refresh_timeout_set();
 }
 
 static void timeout_callback(struct l_timeout *timeout, void *user_data)
 {
-	struct saved_input *input;
-
 	if (!display_refresh.enabled || !display_refresh.cmd) {
 		if (display_refresh.cmd)
 			display_refresh_timeout_set();
@@ -265,9 +339,9 @@ static void timeout_callback(struct l_timeout *timeout, void *user_data)
 		return;
 	}
 
-	input = save_input();
-	display_refresh_undo_lines();
-	restore_input(input);
+	/* The previous run never completed, e.g. its method call failed */
+	display_refresh_finish();
+	display_refresh_rewind();
 
 	display_refresh.recording = false;
 	display_refresh.cmd->function(display_refresh.entity,
@@ -284,9 +358,30 @@ void display_refresh_timeout_set(void)
 							NULL, NULL);
 }
 
+/*
+ * Called on every property or object change so the view picks it up right
+ * away instead of on the next periodic tick.  Bursts of signals, e.g. from
+ * a scan, are coalesced into a single refresh.
+ */
+void display_refresh_properties_changed(void)
+{
+	if (!display_refresh.enabled || !display_refresh.cmd ||
+				display_refresh.redrawing || !refresh_timeout)
+		return;
+
+	l_timeout_modify_ms(refresh_timeout, 50);
+}
+
 static void display_text(const char *text)
 {
-	struct saved_input *input = save_input();
+	struct saved_input *input;
+
+	if (display_refresh.redrawing) {
+		display_refresh_print(text);
+		goto record;
+	}
+
+	input = save_input();
 
 	printf("%s", text);
 
@@ -295,8 +390,9 @@ static void display_text(const char *text)
 	if (!display_refresh.cmd)
 		return;
 
-	display_refresh.undo_lines++;
+	l_queue_push_tail(display_refresh.lines, l_strdup(text));
 
+record:
 	if (display_refresh.recording)
 		l_queue_push_tail(display_refresh.redo_entries, l_strdup(text));
 }
@@ -650,7 +746,7 @@ void display_agent_prompt_release(const char *label)
 		l_free(text);
 
 		l_queue_push_tail(display_refresh.redo_entries, prompt);
-		display_refresh.undo_lines++;
+		l_queue_push_tail(display_refresh.lines, l_strdup(prompt));
 	}
 
 	rl_erase_empty_line = 1;
@@ -683,6 +779,7 @@ void display_init(void)
 	char *data_path;
 
 	display_refresh.redo_entries = l_queue_new();
+	display_refresh.lines = l_queue_new();
 
 	stifle_history(24);
 
@@ -746,6 +843,8 @@ void display_exit(void)
 	refresh_timeout = NULL;
 
 	l_queue_destroy(display_refresh.redo_entries, l_free);
+	l_queue_destroy(display_refresh.lines, l_free);
+	l_queue_destroy(display_refresh.old_lines, l_free);
 
 	rl_callback_handler_remove();
 
@@ -47,6 +47,7 @@ void display_refresh_reset(void);
 void display_refresh_set_cmd(const char *family, const char *entity,
 					const struct command *cmd,
 					char **argv, int argc);
+void display_refresh_properties_changed(void);
 
 void display_enable_cmd_prompt(void);
 void display_disable_cmd_prompt(void);
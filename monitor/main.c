@@ -32,6 +32,11 @@
 #include <string.h>
 #include <getopt.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <linux/genetlink.h>
 #include <linux/rtnetlink.h>
@@ -43,12 +48,12 @@
 #endif
 
 #include "linux/nl80211.h"
+#include "src/nl80211cmd.h"
+#include "src/util.h"
 #include "monitor/nlmon.h"
 #include "monitor/pcap.h"
 #include "monitor/display.h"
 
-#define MAX_SNAPLEN (1024 * 16)
-
 static struct nlmon *nlmon = NULL;
 static const char *writer_path = NULL;
 static struct l_timeout *timeout = NULL;
@@ -410,8 +415,8 @@ static int analyze_pcap(const char *pathname)
 	const struct l_queue_entry *genl_entry;
 	struct pcap *pcap;
 	struct timeval tv;
-	void *buf;
-	uint32_t snaplen, len, real_len;
+	const uint8_t *buf;
+	uint32_t len, real_len;
 	int exit_status;
 	unsigned long pkt_count = 0;
 	unsigned long pkt_short = 0;
@@ -436,20 +441,10 @@ static int analyze_pcap(const char *pathname)
 		goto done;
 	}
 
-	snaplen = pcap_get_snaplen(pcap);
-	if (snaplen > MAX_SNAPLEN)
-		snaplen = MAX_SNAPLEN;
-
-	buf = malloc(snaplen);
-	if (!buf) {
-		fprintf(stderr, "Failed to allocate packet buffer\n");
-		exit_status = EXIT_FAILURE;
-		goto done;
-	}
-
 	genl_list = l_queue_new();
 
-	while (pcap_read(pcap, &tv, buf, snaplen, &len, &real_len)) {
+	while (pcap_read_ref(pcap, &tv, (const void **) &buf,
+						&len, &real_len)) {
 		struct nlmsghdr *nlmsg;
 		uint32_t aligned_len;
 		uint16_t arphrd_type;
@@ -497,7 +492,8 @@ static int analyze_pcap(const char *pathname)
 
 		aligned_len = NLMSG_ALIGN(len - 16);
 
-		for (nlmsg = buf + 16; NLMSG_OK(nlmsg, aligned_len);
+		for (nlmsg = (struct nlmsghdr *) (buf + 16);
+				NLMSG_OK(nlmsg, aligned_len);
 				nlmsg = NLMSG_NEXT(nlmsg, aligned_len)) {
 			uint16_t type = nlmsg->nlmsg_type;
 
@@ -559,8 +555,6 @@ static int analyze_pcap(const char *pathname)
 
 	l_queue_destroy(genl_list, NULL);
 
-	free(buf);
-
 	exit_status = EXIT_SUCCESS;
 
 done:
@@ -569,74 +563,481 @@ done:
 	return exit_status;
 }
 
+static void process_packet(struct nlmon *nlmon, const struct timeval *tv,
+					const uint8_t *buf, uint32_t len,
+					uint32_t real_len)
+{
+	uint16_t arphrd_type;
+	uint16_t proto_type;
+	uint16_t pkt_type;
+
+	if (len < 16) {
+		printf("Too short packet\n");
+		return;
+	}
+
+	if (len < real_len) {
+		printf("Packet truncated from %u\n", real_len);
+		return;
+	}
+
+	pkt_type = l_get_be16(buf);
+	arphrd_type = l_get_be16(buf + 2);
+	proto_type = l_get_be16(buf + 14);
+
+	switch (arphrd_type) {
+	case ARPHRD_ETHER:
+		switch (proto_type) {
+		case ETH_P_PAE:
+			nlmon_print_pae(nlmon, tv, pkt_type, -1,
+						buf + 16, len - 16);
+			break;
+		}
+		break;
+	case ARPHRD_NETLINK:
+		switch (proto_type) {
+		case NETLINK_ROUTE:
+			nlmon_print_rtnl(nlmon, tv, buf + 16, len - 16);
+			break;
+		case NETLINK_GENERIC:
+			nlmon_print_genl(nlmon, tv, buf + 16, len - 16);
+			break;
+		}
+		break;
+	default:
+		printf("Unsupported ARPHRD %u\n", arphrd_type);
+		break;
+	}
+}
+
 static int process_pcap(struct pcap *pcap, uint16_t id)
 {
 	struct nlmon *nlmon = NULL;
 	struct timeval tv;
-	uint8_t *buf;
-	uint32_t snaplen, len, real_len;
+	const void *buf;
+	uint32_t len, real_len;
 
-	snaplen = pcap_get_snaplen(pcap);
-	if (snaplen > MAX_SNAPLEN)
-		snaplen = MAX_SNAPLEN;
+	nlmon = nlmon_create(id);
+	nlmon_set_filter(nlmon, &config.filter);
 
-	buf = malloc(snaplen);
-	if (!buf) {
-		fprintf(stderr, "Failed to allocate packet buffer\n");
-		return EXIT_FAILURE;
-	}
+	if (config.stats_interval)
+		nlmon_enable_stats(nlmon);
 
-	nlmon = nlmon_create(id);
+	while (pcap_read_ref(pcap, &tv, &buf, &len, &real_len))
+		process_packet(nlmon, &tv, buf, len, real_len);
 
-	while (pcap_read(pcap, &tv, buf, snaplen, &len, &real_len)) {
-		uint16_t arphrd_type;
-		uint16_t proto_type;
-		uint16_t pkt_type;
+	nlmon_print_stats(nlmon);
+	nlmon_destroy(nlmon);
 
-		if (len < 16) {
-			printf("Too short packet\n");
-			continue;
+	return EXIT_SUCCESS;
+}
+
+/*
+ * The index sidecar holds one fixed size entry per pcap record, in file
+ * order, with the fields needed to select records without decoding them.
+ * Timestamps are close enough to monotonic in iwmon traces that a time
+ * window can be located with a binary search over the entries, while
+ * command and interface filters are a linear walk over the table instead
+ * of over the trace itself.
+ */
+#define PCAP_INDEX_MAGIC	0x58444e49	/* "INDX" */
+#define PCAP_INDEX_VERSION	1
+
+struct pcap_index_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t nl80211_id;		/* From nlctrl, 0 if unknown */
+	uint64_t pcap_size;
+	int64_t pcap_mtime;		/* Nanoseconds */
+	uint64_t count;
+} __attribute__ ((packed));
+
+struct pcap_index_entry {
+	uint64_t offset;
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t ifindex;
+	uint16_t arphrd_type;
+	uint16_t proto_type;
+	uint16_t nlmsg_type;
+	uint8_t cmd;
+	uint8_t reserved;
+} __attribute__ ((packed));
+
+struct pcap_index {
+	struct pcap_index_hdr hdr;
+	const struct pcap_index_entry *entries;
+	struct pcap_index_entry *table;	/* When built, not mapped */
+	void *map;
+	size_t map_size;
+};
+
+static struct {
+	bool enabled;
+	uint64_t since;			/* Usecs from the first packet */
+	uint64_t until;
+} window = {
+	.until = UINT64_MAX,
+};
+
+static uint64_t index_entry_time(const struct pcap_index_entry *entry)
+{
+	return (uint64_t) entry->ts_sec * 1000000 + entry->ts_usec;
+}
+
+static uint16_t index_parse_ctrl(const void *data, uint32_t len)
+{
+	const struct genlmsghdr *genlmsg = data;
+	const struct nlattr *nla;
+	uint16_t id = 0;
+	bool nl80211 = false;
+	int attrlen;
+
+	if (len < GENL_HDRLEN || genlmsg->cmd != CTRL_CMD_NEWFAMILY)
+		return 0;
+
+	attrlen = len - GENL_HDRLEN;
+
+	for (nla = data + GENL_HDRLEN; NLA_OK(nla, attrlen);
+					nla = NLA_NEXT(nla, attrlen)) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case CTRL_ATTR_FAMILY_ID:
+			if (NLA_PAYLOAD(nla) == sizeof(uint16_t))
+				id = l_get_u16(NLA_DATA(nla));
+			break;
+		case CTRL_ATTR_FAMILY_NAME:
+			nl80211 = !strncmp(NLA_DATA(nla), NL80211_GENL_NAME,
+						NLA_PAYLOAD(nla));
+			break;
 		}
+	}
 
-		if (len < real_len) {
-			printf("Packet truncated from %u\n", real_len);
+	return nl80211 ? id : 0;
+}
+
+static uint32_t index_parse_ifindex(const void *data, uint32_t len)
+{
+	const struct nlattr *nla;
+	int attrlen;
+
+	if (len < GENL_HDRLEN)
+		return 0;
+
+	attrlen = len - GENL_HDRLEN;
+
+	for (nla = data + GENL_HDRLEN; NLA_OK(nla, attrlen);
+					nla = NLA_NEXT(nla, attrlen)) {
+		if ((nla->nla_type & NLA_TYPE_MASK) != NL80211_ATTR_IFINDEX)
 			continue;
+
+		if (NLA_PAYLOAD(nla) != sizeof(uint32_t))
+			return 0;
+
+		return l_get_u32(NLA_DATA(nla));
+	}
+
+	return 0;
+}
+
+static void index_fill_entry(struct pcap_index *index,
+				struct pcap_index_entry *entry,
+				const uint8_t *buf, uint32_t len)
+{
+	const struct nlmsghdr *nlmsg;
+	uint32_t payload_len;
+
+	if (len < 16)
+		return;
+
+	entry->arphrd_type = l_get_be16(buf + 2);
+	entry->proto_type = l_get_be16(buf + 14);
+
+	if (entry->arphrd_type != ARPHRD_NETLINK ||
+			len < 16 + NLMSG_HDRLEN)
+		return;
+
+	/* Only the first message of a packet is indexed */
+	nlmsg = (const struct nlmsghdr *) (buf + 16);
+	entry->nlmsg_type = nlmsg->nlmsg_type;
+
+	if (entry->proto_type != NETLINK_GENERIC ||
+			nlmsg->nlmsg_type < NLMSG_MIN_TYPE ||
+			nlmsg->nlmsg_len > len - 16 ||
+			nlmsg->nlmsg_len < NLMSG_HDRLEN + GENL_HDRLEN)
+		return;
+
+	payload_len = nlmsg->nlmsg_len - NLMSG_HDRLEN;
+	entry->cmd = ((const struct genlmsghdr *) NLMSG_DATA(nlmsg))->cmd;
+
+	if (nlmsg->nlmsg_type == GENL_ID_CTRL) {
+		uint16_t id = index_parse_ctrl(NLMSG_DATA(nlmsg), payload_len);
+
+		if (id)
+			index->hdr.nl80211_id = id;
+
+		return;
+	}
+
+	entry->ifindex = index_parse_ifindex(NLMSG_DATA(nlmsg), payload_len);
+}
+
+static void index_build(struct pcap_index *index, struct pcap *pcap)
+{
+	size_t size = 0;
+	uint64_t offset;
+	struct timeval tv;
+	const void *buf;
+	uint32_t len;
+
+	for (offset = pcap_get_offset(pcap);
+			pcap_read_ref(pcap, &tv, &buf, &len, NULL);
+			offset = pcap_get_offset(pcap)) {
+		struct pcap_index_entry *entry;
+
+		if (index->hdr.count == size) {
+			size = size ? size * 2 : 4096;
+			index->table = l_realloc(index->table,
+						size * sizeof(*entry));
 		}
 
-		pkt_type = l_get_be16(buf);
-		arphrd_type = l_get_be16(buf + 2);
-		proto_type = l_get_be16(buf + 14);
+		entry = &index->table[index->hdr.count++];
+		memset(entry, 0, sizeof(*entry));
+		entry->offset = offset;
+		entry->ts_sec = tv.tv_sec;
+		entry->ts_usec = tv.tv_usec;
 
-		switch (arphrd_type) {
-		case ARPHRD_ETHER:
-			switch (proto_type) {
-			case ETH_P_PAE:
-				nlmon_print_pae(nlmon, &tv, pkt_type, -1,
-							buf + 16, len - 16);
-				break;
-			}
+		index_fill_entry(index, entry, buf, len);
+	}
+
+	index->entries = index->table;
+}
+
+static void index_save(const struct pcap_index *index, const char *path)
+{
+	struct iovec iov[2];
+	ssize_t written;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+
+	iov[0].iov_base = (void *) &index->hdr;
+	iov[0].iov_len = sizeof(index->hdr);
+	iov[1].iov_base = (void *) index->entries;
+	iov[1].iov_len = index->hdr.count * sizeof(*index->entries);
+
+	written = writev(fd, iov, 2);
+	close(fd);
+
+	if (written != (ssize_t) (iov[0].iov_len + iov[1].iov_len)) {
+		fprintf(stderr, "Failed to write index %s\n", path);
+		unlink(path);
+	}
+}
+
+static bool index_load(struct pcap_index *index, const char *path,
+				const struct pcap_index_hdr *expect)
+{
+	const struct pcap_index_hdr *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return false;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return false;
+
+	hdr = map;
+
+	if (hdr->magic != expect->magic || hdr->version != expect->version ||
+			hdr->pcap_size != expect->pcap_size ||
+			hdr->pcap_mtime != expect->pcap_mtime ||
+			(size_t) st.st_size != sizeof(*hdr) +
+				hdr->count * sizeof(struct pcap_index_entry)) {
+		munmap(map, st.st_size);
+		return false;
+	}
+
+	memcpy(&index->hdr, hdr, sizeof(*hdr));
+	index->entries = map + sizeof(*hdr);
+	index->map = map;
+	index->map_size = st.st_size;
+
+	return true;
+}
+
+static bool index_open(struct pcap_index *index, struct pcap *pcap,
+					const char *pathname)
+{
+	struct pcap_index_hdr expect = {};
+	struct stat st;
+	char *path;
+
+	if (stat(pathname, &st) < 0)
+		return false;
+
+	expect.magic = PCAP_INDEX_MAGIC;
+	expect.version = PCAP_INDEX_VERSION;
+	expect.pcap_size = st.st_size;
+	expect.pcap_mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 +
+							st.st_mtim.tv_nsec;
+
+	path = l_strdup_printf("%s.idx", pathname);
+
+	if (index_load(index, path, &expect))
+		goto done;
+
+	memcpy(&index->hdr, &expect, sizeof(expect));
+
+	index_build(index, pcap);
+	index_save(index, path);
+
+done:
+	l_free(path);
+	return true;
+}
+
+static void index_close(struct pcap_index *index)
+{
+	if (index->map)
+		munmap(index->map, index->map_size);
+
+	l_free(index->table);
+}
+
+static bool index_filter_enabled(void)
+{
+	const struct nlmon_filter *match = &config.filter;
+
+	return window.enabled || match->cmd || match->ifindex || match->eapol;
+}
+
+/*
+ * Preselect the records that may pass the nlmon filter.  Anything the index
+ * can't rule out, such as acks or PAE packets, is left for nlmon to decide.
+ */
+static bool index_entry_match(const struct pcap_index_entry *entry,
+								uint16_t id)
+{
+	const struct nlmon_filter *match = &config.filter;
+
+	if (entry->arphrd_type == ARPHRD_ETHER)
+		return !match->cmd ||
+			match->cmd == NL80211_CMD_CONTROL_PORT_FRAME;
+
+	if (entry->arphrd_type != ARPHRD_NETLINK)
+		return !match->cmd && !match->ifindex && !match->eapol;
+
+	if (entry->proto_type == NETLINK_ROUTE)
+		return !match->cmd && !match->eapol;
+
+	if (entry->nlmsg_type < NLMSG_MIN_TYPE ||
+			entry->nlmsg_type == GENL_ID_CTRL)
+		return true;
+
+	if (entry->nlmsg_type != id)
+		return false;
+
+	if (match->cmd && entry->cmd != match->cmd)
+		return false;
+
+	if (match->eapol && entry->cmd != NL80211_CMD_CONTROL_PORT_FRAME)
+		return false;
+
+	if (match->ifindex && entry->ifindex != match->ifindex)
+		return false;
+
+	return true;
+}
+
+static int process_pcap_filtered(struct pcap *pcap, const char *pathname,
+								uint16_t id)
+{
+	struct pcap_index index = {};
+	struct nlmon *nlmon;
+	uint64_t base, start, end;
+	uint64_t lo, hi;
+	uint64_t i;
+	struct timeval tv;
+	const void *buf;
+	uint32_t len, real_len;
+
+	if (!index_open(&index, pcap, pathname)) {
+		fprintf(stderr, "Failed to index %s\n", pathname);
+		return EXIT_FAILURE;
+	}
+
+	if (!id)
+		id = index.hdr.nl80211_id;
+
+	if (!id && (config.filter.cmd || config.filter.ifindex ||
+						config.filter.eapol)) {
+		fprintf(stderr, "Unknown nl80211 family, use --nl80211\n");
+		index_close(&index);
+		return EXIT_FAILURE;
+	}
+
+	if (!index.hdr.count)
+		goto done;
+
+	base = index_entry_time(&index.entries[0]);
+	start = base + window.since;
+	end = window.until == UINT64_MAX ? UINT64_MAX : base + window.until;
+
+	/* Lower bound of the first entry at or after the window start */
+	lo = 0;
+	hi = index.hdr.count;
+
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+
+		if (index_entry_time(&index.entries[mid]) < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	nlmon = nlmon_create(id);
+	nlmon_set_filter(nlmon, &config.filter);
+
+	if (config.stats_interval)
+		nlmon_enable_stats(nlmon);
+
+	for (i = lo; i < index.hdr.count; i++) {
+		const struct pcap_index_entry *entry = &index.entries[i];
+
+		if (index_entry_time(entry) > end)
 			break;
-		case ARPHRD_NETLINK:
-			switch (proto_type) {
-			case NETLINK_ROUTE:
-				nlmon_print_rtnl(nlmon, &tv,
-							buf + 16, len - 16);
-				break;
-			case NETLINK_GENERIC:
-				nlmon_print_genl(nlmon, &tv,
-							buf + 16, len - 16);
-				break;
-			}
+
+		if (!index_entry_match(entry, id))
+			continue;
+
+		if (!pcap_seek(pcap, entry->offset))
 			break;
-		default:
-			printf("Unsupported ARPHRD %u\n", arphrd_type);
+
+		if (!pcap_read_ref(pcap, &tv, &buf, &len, &real_len))
 			break;
-		}
+
+		process_packet(nlmon, &tv, buf, len, real_len);
 	}
 
+	nlmon_print_stats(nlmon);
 	nlmon_destroy(nlmon);
 
-	free(buf);
+done:
+	index_close(&index);
 
 	return EXIT_SUCCESS;
 }
@@ -658,6 +1059,44 @@ static void signal_handler(uint32_t signo, void *user_data)
 	}
 }
 
+static bool parse_time(const char *str, uint64_t *out)
+{
+	char *end;
+	double secs;
+
+	if (!isdigit(str[0]))
+		return false;
+
+	errno = 0;
+	secs = strtod(str, &end);
+	if (errno || *end != '\0')
+		return false;
+
+	*out = secs * 1000000;
+	return true;
+}
+
+static int parse_command(const char *str)
+{
+	unsigned int cmd;
+
+	if (isdigit(str[0])) {
+		char *end;
+
+		cmd = strtoul(str, &end, 10);
+		if (*end != '\0' || !cmd || cmd > NL80211_CMD_MAX)
+			return -1;
+
+		return cmd;
+	}
+
+	for (cmd = 1; cmd <= NL80211_CMD_MAX; cmd++)
+		if (!strcasecmp(str, nl80211cmd_to_string(cmd)))
+			return cmd;
+
+	return -1;
+}
+
 static void usage(void)
 {
 	printf("iwmon - Wireless monitor\n"
@@ -666,6 +1105,15 @@ static void usage(void)
 	printf("Options:\n"
 		"\t-r, --read <file>      Read netlink PCAP trace file\n"
 		"\t-w, --write <file>     Write netlink PCAP trace file\n"
+		"\t-C, --capture          Only write the trace, don't decode\n"
+		"\t-R, --rotate <MB>      Start a new trace file every <MB>\n"
+		"\t-S, --since <sec>      Skip the first <sec> of the trace\n"
+		"\t-U, --until <sec>      Stop reading after <sec>\n"
+		"\t-c, --command <cmd>    Only show nl80211 command <cmd>\n"
+		"\t-I, --ifindex <index>  Only show messages for <index>\n"
+		"\t-m, --mac <addr>       Only show traffic for <addr>\n"
+		"\t-E, --eapol            Only show EAPoL traffic\n"
+		"\t-t, --stats <sec>      Print a summary every <sec> instead\n"
 		"\t-a, --analyze <file>   Analyze netlink PCAP trace file\n"
 		"\t-i, --interface <dev>  Use specified netlink monitor\n"
 		"\t-n, --nortnl           Don't show RTNL output\n"
@@ -678,6 +1126,15 @@ static void usage(void)
 static const struct option main_options[] = {
 	{ "read",      required_argument, NULL, 'r' },
 	{ "write",     required_argument, NULL, 'w' },
+	{ "capture",   no_argument,       NULL, 'C' },
+	{ "rotate",    required_argument, NULL, 'R' },
+	{ "since",     required_argument, NULL, 'S' },
+	{ "until",     required_argument, NULL, 'U' },
+	{ "command",   required_argument, NULL, 'c' },
+	{ "ifindex",   required_argument, NULL, 'I' },
+	{ "mac",       required_argument, NULL, 'm' },
+	{ "eapol",     no_argument,       NULL, 'E' },
+	{ "stats",     required_argument, NULL, 't' },
 	{ "analyze",   required_argument, NULL, 'a' },
 	{ "nl80211",   required_argument, NULL, 'F' },
 	{ "interface", required_argument, NULL, 'i' },
@@ -699,10 +1156,11 @@ int main(int argc, char *argv[])
 	int exit_status;
 
 	for (;;) {
-		int opt;
+		int opt, cmd;
 
-		opt = getopt_long(argc, argv, "r:w:a:F:i:nvhyse",
-						main_options, NULL);
+		opt = getopt_long(argc, argv,
+					"r:w:CR:S:U:c:I:m:Et:a:F:i:nvhyse",
+					main_options, NULL);
 		if (opt < 0)
 			break;
 
@@ -713,6 +1171,68 @@ int main(int argc, char *argv[])
 		case 'w':
 			writer_path = optarg;
 			break;
+		case 'C':
+			config.capture = true;
+			break;
+		case 'R':
+			if (!isdigit(optarg[0])) {
+				usage();
+				return EXIT_FAILURE;
+			}
+
+			config.rotate_size = strtoull(optarg, NULL, 10) *
+								1024 * 1024;
+			break;
+		case 'S':
+		case 'U':
+			if (!parse_time(optarg, opt == 'S' ? &window.since :
+							&window.until)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+
+			window.enabled = true;
+			break;
+		case 'c':
+			cmd = parse_command(optarg);
+			if (cmd < 0) {
+				fprintf(stderr, "Unknown command %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+
+			config.filter.cmd = cmd;
+			break;
+		case 'I':
+			if (!isdigit(optarg[0])) {
+				usage();
+				return EXIT_FAILURE;
+			}
+
+			config.filter.ifindex = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			if (!util_string_to_address(optarg,
+						config.filter.addr) ||
+					l_memeqzero(config.filter.addr, 6)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'E':
+			config.filter.eapol = true;
+			break;
+		case 't':
+			if (!isdigit(optarg[0])) {
+				usage();
+				return EXIT_FAILURE;
+			}
+
+			config.stats_interval = strtoul(optarg, NULL, 10);
+			if (!config.stats_interval) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
 		case 'a':
 			analyze_path = optarg;
 			break;
@@ -772,6 +1292,16 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (window.enabled && !reader_path) {
+		fprintf(stderr, "Time windows require a trace file to read\n");
+		return EXIT_FAILURE;
+	}
+
+	if ((config.capture || config.rotate_size) && !writer_path) {
+		fprintf(stderr, "Capture and rotate require a trace file\n");
+		return EXIT_FAILURE;
+	}
+
 	if (!l_main_init())
 		return EXIT_FAILURE;
 
@@ -796,7 +1326,10 @@ int main(int argc, char *argv[])
 		if (pcap_get_type(pcap) != PCAP_TYPE_LINUX_SLL) {
 			fprintf(stderr, "Invalid packet format\n");
 			exit_status = EXIT_FAILURE;
-		} else
+		} else if (index_filter_enabled())
+			exit_status = process_pcap_filtered(pcap, reader_path,
+								nl80211_family);
+		else
 			exit_status = process_pcap(pcap, nl80211_family);
 
 		pcap_close(pcap);
@@ -30,6 +30,7 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/time.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <net/ethernet.h>
@@ -69,6 +70,10 @@
 #define COLOR_RESULT		COLOR_MAGENTA
 #define COLOR_EVENT		COLOR_CYAN
 
+#define NLMON_CAPTURE_BUFFER_SIZE	(4 * 1024 * 1024)
+#define NLMON_CAPTURE_RCVBUF_SIZE	(8 * 1024 * 1024)
+#define NLMON_CAPTURE_FLUSH_INTERVAL	1
+
 /* BSS Capabilities */
 #define BSS_CAPABILITY_ESS		(1<<0)
 #define BSS_CAPABILITY_IBSS		(1<<1)
@@ -100,10 +105,17 @@ struct nlmon {
 	struct l_io *pae_io;
 	struct l_queue *req_list;
 	struct pcap *pcap;
+	struct l_timeout *flush_timeout;
+	struct l_timeout *stats_timeout;
+	struct nlmon_stats *stats;
 	bool nortnl;
 	bool nowiphy;
 	bool noscan;
 	bool noies;
+	bool capture;
+	bool filtered;
+	unsigned int stats_interval;
+	struct nlmon_filter filter;
 };
 
 struct nlmon_req {
@@ -112,6 +124,7 @@ struct nlmon_req {
 	uint16_t flags;
 	uint8_t cmd;
 	uint8_t version;
+	bool shown;
 };
 
 typedef void (*attr_func_t) (unsigned int level, const char *label,
@@ -6835,6 +6848,336 @@ static void netlink_str(char *str, size_t size,
 	}
 }
 
+#define NLMON_HISTOGRAM_BUCKETS	14	/* Powers of two, in ms */
+#define NLMON_EAPOL_GAP_MAX	10000000	/* Microseconds */
+
+struct nlmon_histogram {
+	const char *name;
+	unsigned int buckets[NLMON_HISTOGRAM_BUCKETS];
+	unsigned int count;
+	uint64_t total;
+	uint64_t max;
+};
+
+enum nlmon_stat {
+	NLMON_STAT_SCAN,
+	NLMON_STAT_CONNECT,
+	NLMON_STAT_ASSOCIATE,
+	NLMON_STAT_EAPOL,
+	__NLMON_STAT_COUNT,
+};
+
+struct nlmon_iface_stats {
+	uint32_t ifindex;
+	struct timeval scan_start;
+	struct timeval connect_start;
+	struct timeval auth_start;
+	struct timeval eapol_last;
+	unsigned int scans_aborted;
+	unsigned int eapol_frames;
+	unsigned int cqm_rssi_low;
+	unsigned int cqm_rssi_high;
+	unsigned int cqm_beacon_loss;
+	unsigned int cqm_pkt_loss;
+	unsigned int cqm_other;
+};
+
+struct nlmon_stats {
+	struct nlmon_histogram histograms[__NLMON_STAT_COUNT];
+	struct l_hashmap *ifaces;
+	unsigned int messages;
+};
+
+static const char *nlmon_stat_names[] = {
+	[NLMON_STAT_SCAN]	= "Trigger Scan to Results",
+	[NLMON_STAT_CONNECT]	= "Connect",
+	[NLMON_STAT_ASSOCIATE]	= "Authenticate to Associate",
+	[NLMON_STAT_EAPOL]	= "EAPoL Frame Interval",
+};
+
+static struct nlmon_stats *nlmon_stats_new(void)
+{
+	struct nlmon_stats *stats = l_new(struct nlmon_stats, 1);
+	unsigned int i;
+
+	for (i = 0; i < __NLMON_STAT_COUNT; i++)
+		stats->histograms[i].name = nlmon_stat_names[i];
+
+	stats->ifaces = l_hashmap_new();
+
+	return stats;
+}
+
+static void nlmon_stats_free(struct nlmon_stats *stats)
+{
+	if (!stats)
+		return;
+
+	l_hashmap_destroy(stats->ifaces, l_free);
+	l_free(stats);
+}
+
+static struct nlmon_iface_stats *nlmon_stats_iface(struct nlmon_stats *stats,
+							uint32_t ifindex)
+{
+	struct nlmon_iface_stats *iface;
+
+	iface = l_hashmap_lookup(stats->ifaces, L_UINT_TO_PTR(ifindex));
+	if (iface)
+		return iface;
+
+	iface = l_new(struct nlmon_iface_stats, 1);
+	iface->ifindex = ifindex;
+	l_hashmap_insert(stats->ifaces, L_UINT_TO_PTR(ifindex), iface);
+
+	return iface;
+}
+
+static void histogram_add(struct nlmon_histogram *hist, uint64_t usecs)
+{
+	uint64_t msecs = usecs / 1000;
+	unsigned int bucket = 0;
+
+	while (msecs && bucket < NLMON_HISTOGRAM_BUCKETS - 1) {
+		msecs >>= 1;
+		bucket++;
+	}
+
+	hist->buckets[bucket]++;
+	hist->count++;
+	hist->total += usecs;
+
+	if (usecs > hist->max)
+		hist->max = usecs;
+}
+
+/* Records the time since start, if start is set, and clears it */
+static void histogram_add_since(struct nlmon_histogram *hist,
+					struct timeval *start,
+					const struct timeval *tv)
+{
+	int64_t usecs;
+
+	if (!timerisset(start))
+		return;
+
+	usecs = (int64_t) (tv->tv_sec - start->tv_sec) * 1000000 +
+					tv->tv_usec - start->tv_usec;
+	if (usecs >= 0)
+		histogram_add(hist, usecs);
+
+	timerclear(start);
+}
+
+static void nlmon_stats_eapol(struct nlmon_stats *stats,
+					struct nlmon_iface_stats *iface,
+					const struct timeval *tv)
+{
+	int64_t usecs;
+
+	iface->eapol_frames++;
+
+	if (timerisset(&iface->eapol_last)) {
+		usecs = (int64_t) (tv->tv_sec - iface->eapol_last.tv_sec) *
+					1000000 + tv->tv_usec -
+					iface->eapol_last.tv_usec;
+
+		/* Frames further apart belong to separate handshakes */
+		if (usecs >= 0 && usecs < NLMON_EAPOL_GAP_MAX)
+			histogram_add(&stats->histograms[NLMON_STAT_EAPOL],
+									usecs);
+	}
+
+	iface->eapol_last = *tv;
+}
+
+static void nlmon_stats_cqm(struct nlmon_iface_stats *iface,
+					const struct nlattr *cqm)
+{
+	const struct nlattr *nla;
+	int len = NLA_PAYLOAD(cqm);
+
+	for (nla = NLA_DATA(cqm); NLA_OK(nla, len); nla = NLA_NEXT(nla, len)) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case NL80211_ATTR_CQM_RSSI_THRESHOLD_EVENT:
+			if (NLA_PAYLOAD(nla) != 4)
+				break;
+
+			if (l_get_u32(NLA_DATA(nla)) ==
+					NL80211_CQM_RSSI_THRESHOLD_EVENT_LOW)
+				iface->cqm_rssi_low++;
+			else
+				iface->cqm_rssi_high++;
+
+			return;
+		case NL80211_ATTR_CQM_BEACON_LOSS_EVENT:
+			iface->cqm_beacon_loss++;
+			return;
+		case NL80211_ATTR_CQM_PKT_LOSS_EVENT:
+			iface->cqm_pkt_loss++;
+			return;
+		}
+	}
+
+	iface->cqm_other++;
+}
+
+/*
+ * Only the few top level attributes needed to attribute a message to an
+ * interface are looked at, nothing is decoded.
+ */
+static void nlmon_stats_message(struct nlmon *nlmon,
+					const struct timeval *tv,
+					enum msg_type type, uint8_t cmd,
+					const void *data, uint32_t len)
+{
+	struct nlmon_stats *stats = nlmon->stats;
+	struct nlmon_histogram *hist = stats->histograms;
+	struct nlmon_iface_stats *iface;
+	const struct nlattr *nla;
+	const struct nlattr *cqm = NULL;
+	uint32_t ifindex = 0;
+
+	stats->messages++;
+
+	if (!tv || !data)
+		return;
+
+	if (type != MSG_REQUEST && type != MSG_EVENT)
+		return;
+
+	for (nla = data; NLA_OK(nla, len); nla = NLA_NEXT(nla, len)) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case NL80211_ATTR_IFINDEX:
+			if (NLA_PAYLOAD(nla) == 4)
+				ifindex = l_get_u32(NLA_DATA(nla));
+			break;
+		case NL80211_ATTR_CQM:
+			cqm = nla;
+			break;
+		}
+	}
+
+	if (!ifindex)
+		return;
+
+	iface = nlmon_stats_iface(stats, ifindex);
+
+	switch (cmd) {
+	case NL80211_CMD_TRIGGER_SCAN:
+		if (type == MSG_EVENT)
+			iface->scan_start = *tv;
+		break;
+	case NL80211_CMD_NEW_SCAN_RESULTS:
+		if (type == MSG_EVENT)
+			histogram_add_since(&hist[NLMON_STAT_SCAN],
+						&iface->scan_start, tv);
+		break;
+	case NL80211_CMD_SCAN_ABORTED:
+		if (timerisset(&iface->scan_start))
+			iface->scans_aborted++;
+
+		timerclear(&iface->scan_start);
+		break;
+	case NL80211_CMD_CONNECT:
+		if (type == MSG_REQUEST)
+			iface->connect_start = *tv;
+		else
+			histogram_add_since(&hist[NLMON_STAT_CONNECT],
+						&iface->connect_start, tv);
+		break;
+	case NL80211_CMD_AUTHENTICATE:
+		if (type == MSG_REQUEST && !timerisset(&iface->auth_start))
+			iface->auth_start = *tv;
+		break;
+	case NL80211_CMD_ASSOCIATE:
+		if (type == MSG_EVENT)
+			histogram_add_since(&hist[NLMON_STAT_ASSOCIATE],
+						&iface->auth_start, tv);
+		break;
+	case NL80211_CMD_DISCONNECT:
+	case NL80211_CMD_DEAUTHENTICATE:
+		timerclear(&iface->connect_start);
+		timerclear(&iface->auth_start);
+		timerclear(&iface->eapol_last);
+		break;
+	case NL80211_CMD_CONTROL_PORT_FRAME:
+		nlmon_stats_eapol(stats, iface, tv);
+		break;
+	case NL80211_CMD_NOTIFY_CQM:
+		if (cqm)
+			nlmon_stats_cqm(iface, cqm);
+		break;
+	}
+}
+
+static void print_histogram(const struct nlmon_histogram *hist)
+{
+	unsigned int i;
+
+	if (!hist->count) {
+		printf("  %s: none\n", hist->name);
+		return;
+	}
+
+	printf("  %s: %u, avg %" PRIu64 ".%03" PRIu64 " ms, "
+			"max %" PRIu64 ".%03" PRIu64 " ms\n", hist->name,
+			hist->count,
+			hist->total / hist->count / 1000,
+			hist->total / hist->count % 1000,
+			hist->max / 1000, hist->max % 1000);
+
+	for (i = 0; i < NLMON_HISTOGRAM_BUCKETS; i++) {
+		if (!hist->buckets[i])
+			continue;
+
+		if (i == NLMON_HISTOGRAM_BUCKETS - 1)
+			printf("    >= %5u ms %u\n", 1U << (i - 1),
+							hist->buckets[i]);
+		else
+			printf("    < %6u ms %u\n", 1U << i,
+							hist->buckets[i]);
+	}
+}
+
+static void print_iface_stats(const void *key, void *value, void *user_data)
+{
+	const struct nlmon_iface_stats *iface = value;
+
+	printf("  Interface %u: EAPoL frames %u, scans aborted %u\n",
+			iface->ifindex, iface->eapol_frames,
+			iface->scans_aborted);
+	printf("    CQM RSSI low %u, RSSI high %u, beacon loss %u, "
+			"packet loss %u, other %u\n",
+			iface->cqm_rssi_low, iface->cqm_rssi_high,
+			iface->cqm_beacon_loss, iface->cqm_pkt_loss,
+			iface->cqm_other);
+}
+
+void nlmon_print_stats(struct nlmon *nlmon)
+{
+	struct nlmon_stats *stats = nlmon->stats;
+	unsigned int i;
+
+	if (!stats)
+		return;
+
+	printf("Statistics: %u nl80211 messages\n", stats->messages);
+
+	for (i = 0; i < __NLMON_STAT_COUNT; i++)
+		print_histogram(&stats->histograms[i]);
+
+	l_hashmap_foreach(stats->ifaces, print_iface_stats, NULL);
+
+	fflush(stdout);
+}
+
+void nlmon_enable_stats(struct nlmon *nlmon)
+{
+	if (!nlmon->stats)
+		nlmon->stats = nlmon_stats_new();
+}
+
 static void print_message(struct nlmon *nlmon, const struct timeval *tv,
 						enum msg_type type,
 						uint16_t flags, int status,
@@ -6847,6 +7190,11 @@ static void print_message(struct nlmon *nlmon, const struct timeval *tv,
 	const char *cmd_str;
 	bool out = false;
 
+	if (nlmon->stats) {
+		nlmon_stats_message(nlmon, tv, type, cmd, data, len);
+		return;
+	}
+
 	if (nlmon->nowiphy && (cmd == NL80211_CMD_NEW_WIPHY))
 		return;
 
@@ -6960,6 +7308,90 @@ static void store_message(struct nlmon *nlmon, const struct timeval *tv,
 	store_netlink(nlmon, tv, NETLINK_GENERIC, nlmsg);
 }
 
+static bool filter_addr_match(const struct nlmon_filter *filter,
+					const struct nlattr *nla)
+{
+	return NLA_PAYLOAD(nla) == 6 && !memcmp(NLA_DATA(nla), filter->addr, 6);
+}
+
+static bool filter_frame_match(const struct nlmon_filter *filter,
+					const struct nlattr *nla)
+{
+	const uint8_t *frame = NLA_DATA(nla);
+	unsigned int i;
+
+	if (NLA_PAYLOAD(nla) < 24)
+		return false;
+
+	/* Address 1 to 3 of the management frame header */
+	for (i = 4; i <= 16; i += 6)
+		if (!memcmp(frame + i, filter->addr, 6))
+			return true;
+
+	return false;
+}
+
+static bool filter_bss_match(const struct nlmon_filter *filter,
+					const struct nlattr *bss)
+{
+	const struct nlattr *nla;
+	int len = NLA_PAYLOAD(bss);
+
+	for (nla = NLA_DATA(bss); NLA_OK(nla, len); nla = NLA_NEXT(nla, len))
+		if ((nla->nla_type & NLA_TYPE_MASK) == NL80211_BSS_BSSID)
+			return filter_addr_match(filter, nla);
+
+	return false;
+}
+
+/*
+ * Decide whether a message is shown before any of it is decoded.  Only
+ * the top level attributes, and the BSSID of scan results, are looked at.
+ */
+static bool nlmon_filter_genl(struct nlmon *nlmon, uint8_t cmd,
+					const void *data, uint32_t len)
+{
+	const struct nlmon_filter *filter = &nlmon->filter;
+	const struct nlattr *nla;
+	bool ifindex_match = !filter->ifindex;
+	bool addr_match = l_memeqzero(filter->addr, 6);
+
+	if (!nlmon->filtered)
+		return true;
+
+	if (filter->cmd && cmd != filter->cmd)
+		return false;
+
+	if (filter->eapol && cmd != NL80211_CMD_CONTROL_PORT_FRAME)
+		return false;
+
+	for (nla = data; NLA_OK(nla, len) && !(ifindex_match && addr_match);
+						nla = NLA_NEXT(nla, len)) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case NL80211_ATTR_IFINDEX:
+			ifindex_match = NLA_PAYLOAD(nla) == 4 &&
+					l_get_u32(NLA_DATA(nla)) ==
+							filter->ifindex;
+			break;
+		case NL80211_ATTR_MAC:
+		case NL80211_ATTR_PREV_BSSID:
+			if (!addr_match)
+				addr_match = filter_addr_match(filter, nla);
+			break;
+		case NL80211_ATTR_FRAME:
+			if (!addr_match)
+				addr_match = filter_frame_match(filter, nla);
+			break;
+		case NL80211_ATTR_BSS:
+			if (!addr_match)
+				addr_match = filter_bss_match(filter, nla);
+			break;
+		}
+	}
+
+	return ifindex_match && addr_match;
+}
+
 static void nlmon_message(struct nlmon *nlmon, const struct timeval *tv,
 					const struct tpacket_auxdata *tp,
 					const struct nlmsghdr *nlmsg)
@@ -6994,9 +7426,13 @@ static void nlmon_message(struct nlmon *nlmon, const struct timeval *tv,
 			}
 
 			store_message(nlmon, tv, nlmsg);
-			print_message(nlmon, tv, type, nlmsg->nlmsg_flags, status,
+
+			if (req->shown)
+				print_message(nlmon, tv, type,
+						nlmsg->nlmsg_flags, status,
 						req->cmd, req->version,
 						NULL, sizeof(status));
+
 			nlmon_req_free(req);
 		}
 		return;
@@ -7019,10 +7455,17 @@ static void nlmon_message(struct nlmon *nlmon, const struct timeval *tv,
 		req->flags = nlmsg->nlmsg_flags;
 		req->cmd = genlmsg->cmd;
 		req->version = genlmsg->version;
+		req->shown = nlmon_filter_genl(nlmon, genlmsg->cmd,
+					NLMSG_DATA(nlmsg) + GENL_HDRLEN,
+					NLMSG_PAYLOAD(nlmsg, GENL_HDRLEN));
 
 		l_queue_push_tail(nlmon->req_list, req);
 
 		store_message(nlmon, tv, nlmsg);
+
+		if (!req->shown)
+			return;
+
 		print_message(nlmon, tv, MSG_REQUEST, flags, 0,
 					req->cmd, req->version,
 					NLMSG_DATA(nlmsg) + GENL_HDRLEN,
@@ -7046,6 +7489,12 @@ static void nlmon_message(struct nlmon *nlmon, const struct timeval *tv,
 		}
 
 		store_message(nlmon, tv, nlmsg);
+
+		if (!nlmon_filter_genl(nlmon, genlmsg->cmd,
+					NLMSG_DATA(nlmsg) + GENL_HDRLEN,
+					NLMSG_PAYLOAD(nlmsg, GENL_HDRLEN)))
+			return;
+
 		print_message(nlmon, tv, type, nlmsg->nlmsg_flags, 0,
 					genlmsg->cmd, genlmsg->version,
 					NLMSG_DATA(nlmsg) + GENL_HDRLEN,
@@ -7065,12 +7514,20 @@ struct nlmon *nlmon_create(uint16_t id)
 	return nlmon;
 }
 
+void nlmon_set_filter(struct nlmon *nlmon, const struct nlmon_filter *filter)
+{
+	nlmon->filter = *filter;
+	nlmon->filtered = filter->ifindex || filter->cmd || filter->eapol ||
+					!l_memeqzero(filter->addr, 6);
+}
+
 void nlmon_destroy(struct nlmon *nlmon)
 {
 	if (!nlmon)
 		return;
 
 	l_queue_destroy(nlmon->req_list, nlmon_req_free);
+	nlmon_stats_free(nlmon->stats);
 
 	l_free(nlmon);
 }
@@ -7877,6 +8334,44 @@ static void print_rtnl_msg(const struct timeval *tv,
 	}
 }
 
+/*
+ * RTNL messages carry no nl80211 command or station address, so any filter
+ * other than an interface index hides them.
+ */
+static bool nlmon_filter_rtnl(struct nlmon *nlmon,
+					const struct nlmsghdr *nlmsg)
+{
+	const struct nlmon_filter *filter = &nlmon->filter;
+
+	if (!nlmon->filtered)
+		return true;
+
+	if (filter->cmd || filter->eapol || !l_memeqzero(filter->addr, 6))
+		return false;
+
+	switch (nlmsg->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+	case RTM_SETLINK:
+	case RTM_GETLINK:
+		if (NLMSG_PAYLOAD(nlmsg, 0) < sizeof(struct ifinfomsg))
+			return false;
+
+		return ((struct ifinfomsg *) NLMSG_DATA(nlmsg))->ifi_index ==
+						(int) filter->ifindex;
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+	case RTM_GETADDR:
+		if (NLMSG_PAYLOAD(nlmsg, 0) < sizeof(struct ifaddrmsg))
+			return false;
+
+		return ((struct ifaddrmsg *) NLMSG_DATA(nlmsg))->ifa_index ==
+							filter->ifindex;
+	}
+
+	return false;
+}
+
 void nlmon_print_rtnl(struct nlmon *nlmon, const struct timeval *tv,
 					const void *data, uint32_t size)
 {
@@ -7887,6 +8382,9 @@ void nlmon_print_rtnl(struct nlmon *nlmon, const struct timeval *tv,
 
 	for (nlmsg = data; NLMSG_OK(nlmsg, aligned_size);
 				nlmsg = NLMSG_NEXT(nlmsg, aligned_size)) {
+		if (!nlmon_filter_rtnl(nlmon, nlmsg))
+			continue;
+
 		switch (nlmsg->nlmsg_type) {
 		case NLMSG_NOOP:
 		case NLMSG_OVERRUN:
@@ -7928,6 +8426,26 @@ void nlmon_print_genl(struct nlmon *nlmon, const struct timeval *tv,
 	}
 }
 
+/*
+ * Capture only mode stores what a later --read can decode, without keeping
+ * track of requests or decoding anything.
+ */
+static void capture_netlink(struct nlmon *nlmon, const struct timeval *tv,
+				uint16_t proto_type, struct nlmsghdr *nlmsg,
+				int nlmsg_len)
+{
+	for (; NLMSG_OK(nlmsg, nlmsg_len);
+				nlmsg = NLMSG_NEXT(nlmsg, nlmsg_len)) {
+		if (proto_type == NETLINK_GENERIC &&
+				nlmsg->nlmsg_type >= NLMSG_MIN_TYPE &&
+				nlmsg->nlmsg_type != nlmon->id &&
+				nlmsg->nlmsg_type != GENL_ID_CTRL)
+			continue;
+
+		store_netlink(nlmon, tv, proto_type, nlmsg);
+	}
+}
+
 static bool nlmon_receive(struct l_io *io, void *user_data)
 {
 	struct nlmon *nlmon = user_data;
@@ -7995,13 +8513,18 @@ static bool nlmon_receive(struct l_io *io, void *user_data)
 
 	nlmsg_len = bytes_read;
 
+	if (nlmon->capture) {
+		capture_netlink(nlmon, tv, proto_type, iov.iov_base, nlmsg_len);
+		return true;
+	}
+
 	for (nlmsg = iov.iov_base; NLMSG_OK(nlmsg, nlmsg_len);
 				nlmsg = NLMSG_NEXT(nlmsg, nlmsg_len)) {
 		switch (proto_type) {
 		case NETLINK_ROUTE:
 			store_netlink(nlmon, tv, proto_type, nlmsg);
 
-			if (!nlmon->nortnl)
+			if (!nlmon->nortnl && !nlmon->stats)
 				nlmon_print_rtnl(nlmon, tv, nlmsg,
 							nlmsg->nlmsg_len);
 			break;
@@ -8101,6 +8624,22 @@ void nlmon_print_pae(struct nlmon *nlmon, const struct timeval *tv,
 {
 	char extra_str[16];
 
+	if (nlmon->stats) {
+		if (tv && index > 0)
+			nlmon_stats_eapol(nlmon->stats,
+					nlmon_stats_iface(nlmon->stats, index),
+					tv);
+		return;
+	}
+
+	if (nlmon->filtered && nlmon->filter.cmd &&
+			nlmon->filter.cmd != NL80211_CMD_CONTROL_PORT_FRAME)
+		return;
+
+	if (nlmon->filtered && nlmon->filter.ifindex && index >= 0 &&
+			(uint32_t) index != nlmon->filter.ifindex)
+		return;
+
 	update_time_offset(tv);
 
 	sprintf(extra_str, "len %u", size);
@@ -8168,6 +8707,15 @@ static bool pae_receive(struct l_io *io, void *user_data)
 	store_packet(nlmon, tv, sll.sll_pkttype, ARPHRD_ETHER,
 				ntohs(sll.sll_protocol), buf, bytes_read);
 
+	if (nlmon->capture)
+		return true;
+
+	/* Only the peer address of received frames is known */
+	if (nlmon->filtered && !l_memeqzero(nlmon->filter.addr, 6) &&
+			sll.sll_pkttype != PACKET_OUTGOING &&
+			memcmp(sll.sll_addr, nlmon->filter.addr, 6))
+		return true;
+
 	nlmon_print_pae(nlmon, tv, sll.sll_pkttype, sll.sll_ifindex,
 							buf, bytes_read);
 
@@ -8222,6 +8770,45 @@ static struct l_io *open_pae(void)
 	return io;
 }
 
+static void nlmon_flush_timeout(struct l_timeout *timeout, void *user_data)
+{
+	struct nlmon *nlmon = user_data;
+
+	pcap_flush(nlmon->pcap);
+	l_timeout_modify(timeout, NLMON_CAPTURE_FLUSH_INTERVAL);
+}
+
+static void nlmon_stats_timeout(struct l_timeout *timeout, void *user_data)
+{
+	struct nlmon *nlmon = user_data;
+
+	nlmon_print_stats(nlmon);
+	l_timeout_modify(timeout, nlmon->stats_interval);
+}
+
+/*
+ * Capturing is meant to keep up with bursts of scan results.  Give the
+ * socket enough room to ride out a slow disk write.
+ */
+static void nlmon_capture_enable(struct nlmon *nlmon)
+{
+	int fd = l_io_get_fd(nlmon->io);
+	int size = NLMON_CAPTURE_RCVBUF_SIZE;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE,
+					&size, sizeof(size)) < 0 &&
+			setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+					&size, sizeof(size)) < 0)
+		perror("Failed to enlarge monitor receive buffer");
+
+	nlmon->capture = true;
+
+	pcap_set_write_buffer(nlmon->pcap, NLMON_CAPTURE_BUFFER_SIZE);
+	nlmon->flush_timeout = l_timeout_create(NLMON_CAPTURE_FLUSH_INTERVAL,
+						nlmon_flush_timeout,
+						nlmon, NULL);
+}
+
 struct nlmon *nlmon_open(const char *ifname, uint16_t id, const char *pathname,
 				const struct nlmon_config *config)
 {
@@ -8246,6 +8833,8 @@ struct nlmon *nlmon_open(const char *ifname, uint16_t id, const char *pathname,
 			l_io_destroy(io);
 			return NULL;
 		}
+
+		pcap_set_rotate_size(pcap, config->rotate_size);
 	} else
 		pcap = NULL;
 
@@ -8260,6 +8849,18 @@ struct nlmon *nlmon_open(const char *ifname, uint16_t id, const char *pathname,
 	nlmon->nowiphy = config->nowiphy;
 	nlmon->noscan = config->noscan;
 	nlmon->noies = config->noies;
+	nlmon_set_filter(nlmon, &config->filter);
+
+	if (config->capture && pcap)
+		nlmon_capture_enable(nlmon);
+
+	if (config->stats_interval && !nlmon->capture) {
+		nlmon_enable_stats(nlmon);
+		nlmon->stats_interval = config->stats_interval;
+		nlmon->stats_timeout = l_timeout_create(nlmon->stats_interval,
+							nlmon_stats_timeout,
+							nlmon, NULL);
+	}
 
 	l_io_set_read_handler(nlmon->io, nlmon_receive, nlmon, NULL);
 	l_io_set_read_handler(nlmon->pae_io, pae_receive, nlmon, NULL);
@@ -8281,6 +8882,12 @@ void nlmon_close(struct nlmon *nlmon)
 	l_hashmap_destroy(wlan_iface_list, wlan_iface_list_free);
 	wlan_iface_list = NULL;
 
+	l_timeout_remove(nlmon->flush_timeout);
+	l_timeout_remove(nlmon->stats_timeout);
+
+	nlmon_print_stats(nlmon);
+	nlmon_stats_free(nlmon->stats);
+
 	if (nlmon->pcap)
 		pcap_close(nlmon->pcap);
 
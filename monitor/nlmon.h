@@ -25,11 +25,22 @@
 
 struct nlmon;
 
+struct nlmon_filter {
+	uint32_t ifindex;		/* 0 matches any interface */
+	uint8_t cmd;			/* 0 matches any nl80211 command */
+	uint8_t addr[6];		/* All zeros matches any address */
+	bool eapol;
+};
+
 struct nlmon_config {
 	bool nortnl;
 	bool nowiphy;
 	bool noscan;
 	bool noies;
+	bool capture;
+	uint64_t rotate_size;
+	unsigned int stats_interval;
+	struct nlmon_filter filter;
 };
 
 struct nlmon *nlmon_open(const char *ifname, uint16_t id, const char *pathname,
@@ -38,6 +49,9 @@ void nlmon_close(struct nlmon *nlmon);
 
 struct nlmon *nlmon_create(uint16_t id);
 void nlmon_destroy(struct nlmon *nlmon);
+void nlmon_set_filter(struct nlmon *nlmon, const struct nlmon_filter *filter);
+void nlmon_enable_stats(struct nlmon *nlmon);
+void nlmon_print_stats(struct nlmon *nlmon);
 void nlmon_print_rtnl(struct nlmon *nlmon, const struct timeval *tv,
 					const void *data, uint32_t size);
 void nlmon_print_genl(struct nlmon *nlmon, const struct timeval *tv,
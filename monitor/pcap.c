@@ -29,6 +29,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
 #include <sys/types.h>
@@ -55,13 +57,49 @@ struct pcap_pkt {
 } __attribute__ ((packed));
 #define PCAP_PKT_SIZE (sizeof(struct pcap_pkt))
 
+#define PCAP_READ_BUF_MAX (256 * 1024)
+
 struct pcap {
 	int fd;
 	bool closed;
 	uint32_t type;
 	uint32_t snaplen;
+	char *pathname;
+	uint8_t *buf;		/* Packets not yet written out */
+	size_t buf_size;
+	size_t buf_len;
+	uint64_t rotate_size;
+	uint64_t file_size;
+	unsigned int file_index;
+	const uint8_t *map;	/* Whole file when reading */
+	size_t map_size;
+	size_t pos;
 };
 
+/*
+ * Reading large traces through a mapping avoids a pair of read() calls per
+ * packet and lets records be visited in any order.  If the file can't be
+ * mapped, reads fall back to the file descriptor.
+ */
+static void pcap_map(struct pcap *pcap)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(pcap->fd, &st) < 0 || (size_t) st.st_size < PCAP_HDR_SIZE)
+		return;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, pcap->fd, 0);
+	if (map == MAP_FAILED)
+		return;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	pcap->map = map;
+	pcap->map_size = st.st_size;
+	pcap->pos = PCAP_HDR_SIZE;
+}
+
 struct pcap *pcap_open(const char *pathname)
 {
 	struct pcap *pcap;
@@ -102,6 +140,8 @@ struct pcap *pcap_open(const char *pathname)
 	pcap->snaplen = hdr.snaplen;
 	pcap->type = hdr.network;
 
+	pcap_map(pcap);
+
 	return pcap;
 
 failed:
@@ -112,26 +152,19 @@ failed:
 }
 
 
-struct pcap *pcap_create(const char *pathname)
+static int pcap_create_file(struct pcap *pcap, const char *pathname)
 {
-	struct pcap *pcap;
 	struct pcap_hdr hdr;
 	ssize_t len;
+	int fd;
 
-	pcap = l_new(struct pcap, 1);
-
-	pcap->fd = open(pathname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+	fd = open(pathname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
 					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-	if (pcap->fd < 0) {
+	if (fd < 0) {
 		perror("Failed to create PCAP file");
-		l_free(pcap);
-		return NULL;
+		return -1;
 	}
 
-	pcap->closed = false;
-	pcap->snaplen = 0x0000ffff;
-	pcap->type = 0x00000071;
-
 	memset(&hdr, 0, sizeof(hdr));
 	hdr.magic_number = 0xa1b2c3d4;
 	hdr.version_major = 0x0002;
@@ -141,7 +174,7 @@ struct pcap *pcap_create(const char *pathname)
 	hdr.snaplen = pcap->snaplen;
 	hdr.network = pcap->type;
 
-	len = write(pcap->fd, &hdr, PCAP_HDR_SIZE);
+	len = write(fd, &hdr, PCAP_HDR_SIZE);
 	if (len < 0) {
 		perror("Failed to write PCAP header");
 		goto failed;
@@ -152,13 +185,136 @@ struct pcap *pcap_create(const char *pathname)
 		goto failed;
 	}
 
-	return pcap;
+	pcap->file_size = PCAP_HDR_SIZE;
+
+	return fd;
 
 failed:
+	close(fd);
+
+	return -1;
+}
+
+struct pcap *pcap_create(const char *pathname)
+{
+	struct pcap *pcap;
+
+	pcap = l_new(struct pcap, 1);
+
+	pcap->closed = false;
+	pcap->snaplen = 0x0000ffff;
+	pcap->type = 0x00000071;
+
+	pcap->fd = pcap_create_file(pcap, pathname);
+	if (pcap->fd < 0) {
+		l_free(pcap);
+		return NULL;
+	}
+
+	pcap->pathname = l_strdup(pathname);
+
+	return pcap;
+}
+
+/*
+ * Collect packets in memory and write them out in large chunks instead of
+ * issuing a write per packet.  Buffered packets are written when the buffer
+ * fills up, on pcap_flush() and on pcap_close().
+ */
+bool pcap_set_write_buffer(struct pcap *pcap, size_t size)
+{
+	if (!pcap || !pcap_flush(pcap))
+		return false;
+
+	l_free(pcap->buf);
+	pcap->buf = size ? l_malloc(size) : NULL;
+	pcap->buf_size = size;
+	pcap->buf_len = 0;
+
+	return true;
+}
+
+/*
+ * Once a file would grow past size, continue in <pathname>.1, <pathname>.2
+ * and so on.  Each file is a complete trace with its own header.
+ */
+void pcap_set_rotate_size(struct pcap *pcap, uint64_t size)
+{
+	if (!pcap)
+		return;
+
+	pcap->rotate_size = size;
+}
+
+static bool pcap_write_all(struct pcap *pcap, struct iovec *iov, int iovcnt)
+{
+	ssize_t written;
+
+	while (iovcnt) {
+		written = writev(pcap->fd, iov, iovcnt);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+
+			pcap->closed = true;
+			return false;
+		}
+
+		while (iovcnt && (size_t) written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt) {
+			iov->iov_base += written;
+			iov->iov_len -= written;
+		}
+	}
+
+	return true;
+}
+
+bool pcap_flush(struct pcap *pcap)
+{
+	struct iovec iov;
+
+	if (!pcap)
+		return false;
+
+	if (pcap->closed)
+		return false;
+
+	if (!pcap->buf_len)
+		return true;
+
+	iov.iov_base = pcap->buf;
+	iov.iov_len = pcap->buf_len;
+	pcap->buf_len = 0;
+
+	return pcap_write_all(pcap, &iov, 1);
+}
+
+static bool pcap_rotate(struct pcap *pcap)
+{
+	char *pathname;
+
+	if (!pcap_flush(pcap))
+		return false;
+
 	close(pcap->fd);
-	l_free(pcap);
 
-	return NULL;
+	pathname = l_strdup_printf("%s.%u", pcap->pathname,
+					++pcap->file_index);
+	pcap->fd = pcap_create_file(pcap, pathname);
+	l_free(pathname);
+
+	if (pcap->fd < 0) {
+		pcap->closed = true;
+		return false;
+	}
+
+	return true;
 }
 
 void pcap_close(struct pcap *pcap)
@@ -166,9 +322,16 @@ void pcap_close(struct pcap *pcap)
 	if (!pcap)
 		return;
 
+	pcap_flush(pcap);
+
+	if (pcap->map)
+		munmap((void *) pcap->map, pcap->map_size);
+
 	if (pcap->fd >= 0)
 		close(pcap->fd);
 
+	l_free(pcap->buf);
+	l_free(pcap->pathname);
 	l_free(pcap);
 }
 
@@ -188,6 +351,96 @@ uint32_t pcap_get_snaplen(struct pcap *pcap)
 	return pcap->snaplen;
 }
 
+/*
+ * Returns the next record in place when the file is mapped.  Otherwise the
+ * record is read into an internal buffer, holding up to the snapshot length,
+ * that stays valid until the next call.
+ */
+bool pcap_read_ref(struct pcap *pcap, struct timeval *tv,
+			const void **data, uint32_t *len, uint32_t *real_len)
+{
+	struct pcap_pkt pkt;
+	uint32_t avail;
+
+	if (!pcap)
+		return false;
+
+	if (pcap->closed)
+		return false;
+
+	if (!pcap->map) {
+		if (!pcap->buf) {
+			pcap->buf_size = L_MIN(pcap->snaplen,
+						(uint32_t) PCAP_READ_BUF_MAX);
+			pcap->buf = l_malloc(pcap->buf_size);
+		}
+
+		if (data)
+			*data = pcap->buf;
+
+		return pcap_read(pcap, tv, pcap->buf, pcap->buf_size,
+							len, real_len);
+	}
+
+	if (pcap->map_size - pcap->pos < PCAP_PKT_SIZE) {
+		pcap->closed = true;
+		return false;
+	}
+
+	memcpy(&pkt, pcap->map + pcap->pos, PCAP_PKT_SIZE);
+	pcap->pos += PCAP_PKT_SIZE;
+
+	avail = L_MIN(pcap->map_size - pcap->pos, (size_t) pkt.incl_len);
+
+	if (data)
+		*data = pcap->map + pcap->pos;
+
+	pcap->pos += avail;
+
+	if (tv) {
+		tv->tv_sec = pkt.ts_sec;
+		tv->tv_usec = pkt.ts_usec;
+	}
+
+	if (len)
+		*len = avail;
+
+	if (real_len)
+		*real_len = pkt.incl_len;
+
+	return true;
+}
+
+uint64_t pcap_get_offset(struct pcap *pcap)
+{
+	if (!pcap)
+		return 0;
+
+	if (pcap->map)
+		return pcap->pos;
+
+	return lseek(pcap->fd, 0, SEEK_CUR);
+}
+
+/* Offset must be the start of a record, as returned by pcap_get_offset() */
+bool pcap_seek(struct pcap *pcap, uint64_t offset)
+{
+	if (!pcap || offset < PCAP_HDR_SIZE)
+		return false;
+
+	if (pcap->map) {
+		if (offset > pcap->map_size)
+			return false;
+
+		pcap->pos = offset;
+	} else if (lseek(pcap->fd, offset, SEEK_SET) < 0)
+		return false;
+
+	pcap->closed = false;
+
+	return true;
+}
+
 bool pcap_read(struct pcap *pcap, struct timeval *tv,
 		void *data, uint32_t size, uint32_t *len, uint32_t *real_len)
 {
@@ -201,6 +454,22 @@ bool pcap_read(struct pcap *pcap, struct timeval *tv,
 	if (pcap->closed)
 		return false;
 
+	if (pcap->map) {
+		const void *ref;
+		uint32_t avail;
+
+		if (!pcap_read_ref(pcap, tv, &ref, &avail, real_len))
+			return false;
+
+		toread = L_MIN(avail, size);
+		memcpy(data, ref, toread);
+
+		if (len)
+			*len = toread;
+
+		return true;
+	}
+
 	bytes_read = read(pcap->fd, &pkt, PCAP_PKT_SIZE);
 	if (bytes_read != PCAP_PKT_SIZE) {
 		pcap->closed = true;
@@ -245,7 +514,8 @@ bool pcap_write(struct pcap *pcap, const struct timeval *tv,
 {
 	struct iovec iov[3];
 	struct pcap_pkt pkt;
-	ssize_t written;
+	size_t record_len = PCAP_PKT_SIZE + plen + size;
+	unsigned int i;
 
 	if (!pcap)
 		return false;
@@ -253,6 +523,11 @@ bool pcap_write(struct pcap *pcap, const struct timeval *tv,
 	if (pcap->closed)
 		return false;
 
+	if (pcap->rotate_size && pcap->file_size > PCAP_HDR_SIZE &&
+			pcap->file_size + record_len > pcap->rotate_size &&
+			!pcap_rotate(pcap))
+		return false;
+
 	memset(&pkt, 0, sizeof(pkt));
 	if (tv) {
 		pkt.ts_sec = tv->tv_sec;
@@ -268,15 +543,23 @@ bool pcap_write(struct pcap *pcap, const struct timeval *tv,
 	iov[2].iov_base = (void *) data;
 	iov[2].iov_len = size;
 
-	written = writev(pcap->fd, iov, 3);
-	if (written < 0) {
-		pcap->closed = true;
-		return false;
-	}
+	pcap->file_size += record_len;
 
-	if (written < (ssize_t) (PCAP_PKT_SIZE + plen + size)) {
-		pcap->closed = true;
+	if (pcap->buf_len + record_len > pcap->buf_size &&
+			!pcap_flush(pcap))
 		return false;
+
+	/* Unbuffered, or too big to buffer */
+	if (record_len > pcap->buf_size)
+		return pcap_write_all(pcap, iov, 3);
+
+	for (i = 0; i < L_ARRAY_SIZE(iov); i++) {
+		if (!iov[i].iov_len)
+			continue;
+
+		memcpy(pcap->buf + pcap->buf_len, iov[i].iov_base,
+							iov[i].iov_len);
+		pcap->buf_len += iov[i].iov_len;
 	}
 
 	return true;
@@ -34,11 +34,19 @@ struct pcap *pcap_open(const char *pathname);
 struct pcap *pcap_create(const char *pathname);
 void pcap_close(struct pcap *pcap);
 
+bool pcap_set_write_buffer(struct pcap *pcap, size_t size);
+void pcap_set_rotate_size(struct pcap *pcap, uint64_t size);
+bool pcap_flush(struct pcap *pcap);
+
 uint32_t pcap_get_type(struct pcap *pcap);
 uint32_t pcap_get_snaplen(struct pcap *pcap);
 
 bool pcap_read(struct pcap *pcap, struct timeval *tv,
 		void *data, uint32_t size, uint32_t *len, uint32_t *real_len);
+bool pcap_read_ref(struct pcap *pcap, struct timeval *tv,
+			const void **data, uint32_t *len, uint32_t *real_len);
+uint64_t pcap_get_offset(struct pcap *pcap);
+bool pcap_seek(struct pcap *pcap, uint64_t offset);
 
 bool pcap_write(struct pcap *pcap, const struct timeval *tv,
 					const void *phdr, uint32_t plen,
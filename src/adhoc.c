@@ -44,12 +44,20 @@
 #include "src/dbus.h"
 #include "src/nl80211util.h"
 
+/*
+ * Every new peer runs both an authenticator and a supplicant handshake.
+ * When many nodes join at once only ADHOC_MAX_HANDSHAKES peers do so at
+ * a time, the others wait in the order they joined.
+ */
+#define ADHOC_MAX_HANDSHAKES	4
+
 struct adhoc_state {
 	struct netdev *netdev;
 	struct l_genl_family *nl80211;
 	char *ssid;
 	uint8_t pmk[32];
 	struct l_queue *sta_states;
+	struct l_hashmap *sta_index;
 	uint32_t sta_watch_id;
 	uint32_t netdev_watch_id;
 	unsigned int mlme_watch;
@@ -58,6 +66,11 @@ struct adhoc_state {
 	uint32_t group_cipher;
 	uint8_t gtk[CRYPTO_MAX_GTK_LEN];
 	uint8_t gtk_index;
+	uint32_t gtk_query_cmd_id;
+	struct l_queue *gtk_waiting;
+	unsigned int handshakes_active;
+	struct l_queue *handshake_queue;
+	struct l_idle *handshake_idle;
 	bool started : 1;
 	bool open : 1;
 	bool gtk_set : 1;
@@ -70,14 +83,20 @@ struct sta_state {
 	struct handshake_state *hs_sta;
 	struct eapol_sm *sm_a;
 	struct handshake_state *hs_auth;
-	uint32_t gtk_query_cmd_id;
+	uint8_t gtk_rsc[6];
 	bool hs_sta_done : 1;
 	bool hs_auth_done : 1;
 	bool authenticated : 1;
+	bool gtk_waiting : 1;
+	bool have_gtk_rsc : 1;
+	bool handshake_admitted : 1;
+	bool handshake_queued : 1;
 };
 
 static uint32_t netdev_watch;
 
+static void adhoc_handshake_release(struct sta_state *sta);
+
 static void adhoc_sta_free(void *data)
 {
 	struct sta_state *sta = data;
@@ -85,9 +104,10 @@ static void adhoc_sta_free(void *data)
 	if (sta->adhoc->open)
 		goto end;
 
-	if (sta->gtk_query_cmd_id)
-		l_genl_family_cancel(sta->adhoc->nl80211,
-						sta->gtk_query_cmd_id);
+	if (sta->gtk_waiting)
+		l_queue_remove(sta->adhoc->gtk_waiting, sta);
+
+	adhoc_handshake_release(sta);
 
 	if (sta->sm)
 		eapol_sm_free(sta->sm);
@@ -105,18 +125,47 @@ end:
 	l_free(sta);
 }
 
+/* Peers are kept in sta_states for iteration and indexed by address */
+static unsigned int adhoc_sta_addr_hash(const void *key)
+{
+	const uint8_t *addr = key;
+
+	return l_get_le32(addr + 2);
+}
+
+static int adhoc_sta_addr_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, 6);
+}
+
+static struct sta_state *adhoc_sta_find(struct adhoc_state *adhoc,
+					const uint8_t *addr)
+{
+	return l_hashmap_lookup(adhoc->sta_index, addr);
+}
+
+static void adhoc_sta_add(struct adhoc_state *adhoc, struct sta_state *sta)
+{
+	if (!adhoc->sta_index) {
+		adhoc->sta_index = l_hashmap_new();
+		l_hashmap_set_hash_function(adhoc->sta_index,
+						adhoc_sta_addr_hash);
+		l_hashmap_set_compare_function(adhoc->sta_index,
+						adhoc_sta_addr_compare);
+	}
+
+	l_queue_push_tail(adhoc->sta_states, sta);
+	l_hashmap_insert(adhoc->sta_index, sta->addr, sta);
+}
+
 static void adhoc_remove_sta(struct sta_state *sta)
 {
-	if (!l_queue_remove(sta->adhoc->sta_states, sta)) {
+	if (l_hashmap_remove(sta->adhoc->sta_index, sta->addr) != sta) {
 		l_error("station %p was not found", sta);
 		return;
 	}
 
-	if (sta->gtk_query_cmd_id) {
-		l_genl_family_cancel(sta->adhoc->nl80211,
-						sta->gtk_query_cmd_id);
-		sta->gtk_query_cmd_id = 0;
-	}
+	l_queue_remove(sta->adhoc->sta_states, sta);
 
 	/* signal station has been removed */
 	if (sta->authenticated) {
@@ -140,9 +189,24 @@ static void adhoc_reset(struct adhoc_state *adhoc)
 	netdev_station_watch_remove(adhoc->netdev, adhoc->sta_watch_id);
 	adhoc->sta_watch_id = 0;
 
+	if (adhoc->gtk_query_cmd_id) {
+		l_genl_family_cancel(adhoc->nl80211, adhoc->gtk_query_cmd_id);
+		adhoc->gtk_query_cmd_id = 0;
+	}
+
+	l_hashmap_destroy(adhoc->sta_index, NULL);
+	adhoc->sta_index = NULL;
 	l_queue_destroy(adhoc->sta_states, adhoc_sta_free);
 	adhoc->sta_states = NULL;
 
+	l_queue_destroy(adhoc->gtk_waiting, NULL);
+	adhoc->gtk_waiting = NULL;
+	l_queue_destroy(adhoc->handshake_queue, NULL);
+	adhoc->handshake_queue = NULL;
+	l_idle_remove(adhoc->handshake_idle);
+	adhoc->handshake_idle = NULL;
+	adhoc->handshakes_active = 0;
+
 	adhoc->started = false;
 
 	l_dbus_property_changed(dbus_get_bus(), netdev_get_path(adhoc->netdev),
@@ -161,13 +225,6 @@ static void adhoc_set_rsn_info(struct adhoc_state *adhoc,
 	rsn->group_cipher = adhoc->group_cipher;
 }
 
-static bool ap_sta_match_addr(const void *a, const void *b)
-{
-	const struct sta_state *sta = a;
-
-	return !memcmp(sta->addr, b, 6);
-}
-
 static void adhoc_operstate_cb(int error, uint16_t type,
 					const void *data,
 					uint32_t len, void *user_data)
@@ -221,6 +278,7 @@ static void adhoc_handshake_event(struct handshake_state *hs,
 		if ((sta->hs_auth_done && sta->hs_sta_done) &&
 				!sta->authenticated) {
 			sta->authenticated = true;
+			adhoc_handshake_release(sta);
 			l_dbus_property_changed(dbus_get_bus(),
 					netdev_get_path(adhoc->netdev),
 					IWD_ADHOC_INTERFACE, "ConnectedPeers");
@@ -321,6 +379,72 @@ failed:
 	adhoc_remove_sta(sta);
 }
 
+static void adhoc_handshake_start_queued(struct l_idle *idle,
+						void *user_data)
+{
+	struct adhoc_state *adhoc = user_data;
+	struct sta_state *sta;
+
+	l_idle_remove(adhoc->handshake_idle);
+	adhoc->handshake_idle = NULL;
+
+	while (adhoc->handshakes_active < ADHOC_MAX_HANDSHAKES &&
+			(sta = l_queue_pop_head(adhoc->handshake_queue))) {
+		sta->handshake_queued = false;
+		sta->handshake_admitted = true;
+		adhoc->handshakes_active++;
+
+		adhoc_start_rsna(sta, sta->have_gtk_rsc ? sta->gtk_rsc : NULL);
+	}
+}
+
+static void adhoc_handshake_release(struct sta_state *sta)
+{
+	struct adhoc_state *adhoc = sta->adhoc;
+
+	if (sta->handshake_queued) {
+		l_queue_remove(adhoc->handshake_queue, sta);
+		sta->handshake_queued = false;
+	}
+
+	if (!sta->handshake_admitted)
+		return;
+
+	sta->handshake_admitted = false;
+	adhoc->handshakes_active--;
+
+	if (!l_queue_isempty(adhoc->handshake_queue) && !adhoc->handshake_idle)
+		adhoc->handshake_idle = l_idle_create(
+						adhoc_handshake_start_queued,
+						adhoc, NULL);
+}
+
+static void adhoc_handshake_admit(struct sta_state *sta,
+					const uint8_t *gtk_rsc)
+{
+	struct adhoc_state *adhoc = sta->adhoc;
+
+	if (adhoc->handshakes_active < ADHOC_MAX_HANDSHAKES &&
+			l_queue_isempty(adhoc->handshake_queue)) {
+		sta->handshake_admitted = true;
+		adhoc->handshakes_active++;
+		adhoc_start_rsna(sta, gtk_rsc);
+		return;
+	}
+
+	l_debug("Queueing handshakes with "MAC, MAC_STR(sta->addr));
+
+	sta->have_gtk_rsc = gtk_rsc != NULL;
+	if (gtk_rsc)
+		memcpy(sta->gtk_rsc, gtk_rsc, 6);
+
+	if (!adhoc->handshake_queue)
+		adhoc->handshake_queue = l_queue_new();
+
+	l_queue_push_tail(adhoc->handshake_queue, sta);
+	sta->handshake_queued = true;
+}
+
 static void adhoc_gtk_op_cb(struct l_genl_msg *msg, void *user_data)
 {
 	if (l_genl_msg_get_error(msg) < 0) {
@@ -333,22 +457,57 @@ static void adhoc_gtk_op_cb(struct l_genl_msg *msg, void *user_data)
 	}
 }
 
+/*
+ * Peers joining while a GET_KEY is in flight all share its result rather
+ * than each querying the kernel for the same GTK RSC.
+ */
 static void adhoc_gtk_query_cb(struct l_genl_msg *msg, void *user_data)
 {
-	struct sta_state *sta = user_data;
+	struct adhoc_state *adhoc = user_data;
 	const void *gtk_rsc;
+	uint8_t rsc[6];
+	struct sta_state *sta;
 
-	sta->gtk_query_cmd_id = 0;
+	adhoc->gtk_query_cmd_id = 0;
 
 	gtk_rsc = nl80211_parse_get_key_seq(msg);
-	if (!gtk_rsc)
-		goto error;
+	if (gtk_rsc)
+		memcpy(rsc, gtk_rsc, 6);
 
-	adhoc_start_rsna(sta, gtk_rsc);
-	return;
+	while ((sta = l_queue_pop_head(adhoc->gtk_waiting))) {
+		sta->gtk_waiting = false;
 
-error:
-	adhoc_remove_sta(sta);
+		if (gtk_rsc)
+			adhoc_handshake_admit(sta, rsc);
+		else
+			adhoc_remove_sta(sta);
+	}
+}
+
+static bool adhoc_gtk_query(struct sta_state *sta)
+{
+	struct adhoc_state *adhoc = sta->adhoc;
+	struct l_genl_msg *msg;
+
+	if (!adhoc->gtk_query_cmd_id) {
+		msg = nl80211_build_get_key(netdev_get_ifindex(adhoc->netdev),
+					adhoc->gtk_index);
+		adhoc->gtk_query_cmd_id = l_genl_family_send(adhoc->nl80211,
+							msg, adhoc_gtk_query_cb,
+							adhoc, NULL);
+		if (!adhoc->gtk_query_cmd_id) {
+			l_genl_msg_unref(msg);
+			l_error("Issuing GET_KEY failed");
+			return false;
+		}
+	}
+
+	if (!adhoc->gtk_waiting)
+		adhoc->gtk_waiting = l_queue_new();
+
+	l_queue_push_tail(adhoc->gtk_waiting, sta);
+	sta->gtk_waiting = true;
+	return true;
 }
 
 static void adhoc_new_station(struct adhoc_state *adhoc, const uint8_t *mac)
@@ -356,7 +515,7 @@ static void adhoc_new_station(struct adhoc_state *adhoc, const uint8_t *mac)
 	struct sta_state *sta;
 	struct l_genl_msg *msg;
 
-	sta = l_queue_find(adhoc->sta_states, ap_sta_match_addr, mac);
+	sta = adhoc_sta_find(adhoc, mac);
 	if (sta) {
 		l_warn("new station event with already connected STA");
 		return;
@@ -417,7 +576,7 @@ static void adhoc_new_station(struct adhoc_state *adhoc, const uint8_t *mac)
 	memcpy(sta->addr, mac, 6);
 	sta->adhoc = adhoc;
 
-	l_queue_push_tail(adhoc->sta_states, sta);
+	adhoc_sta_add(adhoc, sta);
 
 	l_info("new Station: "MAC" adhoc=%p", MAC_STR(mac), adhoc);
 
@@ -439,28 +598,16 @@ static void adhoc_new_station(struct adhoc_state *adhoc, const uint8_t *mac)
 	}
 
 	if (adhoc->group_cipher == IE_RSN_CIPHER_SUITE_NO_GROUP_TRAFFIC)
-		adhoc_start_rsna(sta, NULL);
-	else {
-		msg = nl80211_build_get_key(netdev_get_ifindex(adhoc->netdev),
-					adhoc->gtk_index);
-		sta->gtk_query_cmd_id = l_genl_family_send(adhoc->nl80211, msg,
-							adhoc_gtk_query_cb,
-							sta, NULL);
-		if (!sta->gtk_query_cmd_id) {
-			l_genl_msg_unref(msg);
-			l_error("Issuing GET_KEY failed");
-
-			adhoc_remove_sta(sta);
-			return;
-		}
-	}
+		adhoc_handshake_admit(sta, NULL);
+	else if (!adhoc_gtk_query(sta))
+		adhoc_remove_sta(sta);
 }
 
 static void adhoc_del_station(struct adhoc_state *adhoc, const uint8_t *mac)
 {
 	struct sta_state *sta;
 
-	sta = l_queue_find(adhoc->sta_states, ap_sta_match_addr, mac);
+	sta = adhoc_sta_find(adhoc, mac);
 	if (!sta) {
 		l_warn("could not find station "MAC" in list", MAC_STR(mac));
 		return;
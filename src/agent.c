@@ -25,8 +25,10 @@
 #endif
 
 #include <errno.h>
+#include <string.h>
 
 #include <ell/ell.h>
+#include "src/missing.h"
 #include "src/dbus.h"
 #include "src/agent.h"
 #include "src/iwd.h"
@@ -34,6 +36,8 @@
 
 static unsigned int next_request_id = 0;
 
+#define AGENT_SECRET_CACHE_TIME	30	/* Seconds */
+
 enum agent_request_type {
 	AGENT_REQUEST_TYPE_PASSPHRASE,
 	AGENT_REQUEST_TYPE_USER_NAME_PASSWD,
@@ -48,6 +52,25 @@ struct agent_request {
 	void *user_callback;
 	struct l_dbus_message *trigger;
 	agent_request_destroy_func_t destroy;
+	const char *method;
+	char *path;
+	char *user;
+	char *cached_value;
+	char *cached_password;
+};
+
+/*
+ * A reply recently returned by the agent, used to answer the same request
+ * again, e.g. when a connection is retried, without another round trip.
+ */
+struct agent_secret {
+	struct agent *agent;
+	const char *method;
+	char *path;
+	char *user;
+	char *value;
+	char *password;
+	struct l_timeout *timeout;
 };
 
 struct agent {
@@ -58,6 +81,9 @@ struct agent {
 	struct l_timeout *timeout;
 	int timeout_secs;
 	struct l_queue *requests;
+	struct l_queue *cached_replies;
+	struct l_idle *cached_reply_idle;
+	struct l_queue *secrets;
 };
 
 static struct l_queue *agents;
@@ -112,11 +138,106 @@ static void send_cancel_request(void *user_data, int reason)
 	l_dbus_send(dbus_get_bus(), message);
 }
 
+static void agent_secret_str_free(char *str)
+{
+	if (!str)
+		return;
+
+	explicit_bzero(str, strlen(str));
+	l_free(str);
+}
+
+static void agent_secret_free(void *data)
+{
+	struct agent_secret *secret = data;
+
+	l_timeout_remove(secret->timeout);
+	l_free(secret->path);
+	l_free(secret->user);
+	agent_secret_str_free(secret->value);
+	agent_secret_str_free(secret->password);
+	l_free(secret);
+}
+
+static void agent_secret_timeout(struct l_timeout *timeout, void *user_data)
+{
+	struct agent_secret *secret = user_data;
+
+	l_queue_remove(secret->agent->secrets, secret);
+	agent_secret_free(secret);
+}
+
+static bool agent_secret_match(const void *a, const void *b)
+{
+	const struct agent_secret *secret = a;
+	const struct agent_request *request = b;
+
+	return !strcmp(secret->method, request->method) &&
+		!strcmp(secret->path, request->path) &&
+		l_streq0(secret->user, request->user);
+}
+
+static void agent_secret_store(struct agent *agent,
+				const struct agent_request *request,
+				const char *value, const char *password)
+{
+	struct agent_secret *secret;
+
+	secret = l_queue_remove_if(agent->secrets, agent_secret_match,
+					request);
+	if (secret)
+		agent_secret_free(secret);
+
+	secret = l_new(struct agent_secret, 1);
+	secret->agent = agent;
+	secret->method = request->method;
+	secret->path = l_strdup(request->path);
+	secret->user = l_strdup(request->user);
+	secret->value = l_strdup(value);
+	secret->password = l_strdup(password);
+	secret->timeout = l_timeout_create(AGENT_SECRET_CACHE_TIME,
+						agent_secret_timeout,
+						secret, NULL);
+
+	l_queue_push_tail(agent->secrets, secret);
+}
+
+static bool agent_secret_match_path(void *data, void *user_data)
+{
+	struct agent_secret *secret = data;
+
+	if (strcmp(secret->path, user_data))
+		return false;
+
+	agent_secret_free(secret);
+	return true;
+}
+
+/*
+ * Drops the replies cached for @path, to be called when they turned out
+ * to be wrong so that the user is asked again.
+ */
+void agent_forget_secrets(const char *path)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(agents); entry; entry = entry->next) {
+		struct agent *agent = entry->data;
+
+		l_queue_foreach_remove(agent->secrets, agent_secret_match_path,
+					(void *) path);
+	}
+}
+
 static void agent_request_free(void *user_data)
 {
 	struct agent_request *request = user_data;
 
 	l_dbus_message_unref(request->message);
+	l_free(request->path);
+	l_free(request->user);
+	agent_secret_str_free(request->cached_value);
+	agent_secret_str_free(request->cached_password);
 
 	if (request->trigger)
 		dbus_pending_reply(&request->trigger,
@@ -128,7 +249,8 @@ static void agent_request_free(void *user_data)
 	l_free(request);
 }
 
-static void passphrase_reply(struct l_dbus_message *reply,
+static void passphrase_reply(struct agent *agent,
+					struct l_dbus_message *reply,
 					struct agent_request *request)
 {
 	const char *error, *text;
@@ -143,12 +265,14 @@ static void passphrase_reply(struct l_dbus_message *reply,
 		goto done;
 
 	result = AGENT_RESULT_OK;
+	agent_secret_store(agent, request, passphrase, NULL);
 
 done:
 	user_callback(result, passphrase, request->trigger, request->user_data);
 }
 
-static void user_name_passwd_reply(struct l_dbus_message *reply,
+static void user_name_passwd_reply(struct agent *agent,
+					struct l_dbus_message *reply,
 					struct agent_request *request)
 {
 	const char *error, *text;
@@ -165,6 +289,7 @@ static void user_name_passwd_reply(struct l_dbus_message *reply,
 		goto done;
 
 	result = AGENT_RESULT_OK;
+	agent_secret_store(agent, request, username, passwd);
 
 done:
 	user_callback(result, username, passwd,
@@ -185,10 +310,10 @@ static void agent_finalize_pending(struct agent *agent,
 
 	switch (pending->type) {
 	case AGENT_REQUEST_TYPE_PASSPHRASE:
-		passphrase_reply(reply, pending);
+		passphrase_reply(agent, reply, pending);
 		break;
 	case AGENT_REQUEST_TYPE_USER_NAME_PASSWD:
-		user_name_passwd_reply(reply, pending);
+		user_name_passwd_reply(agent, reply, pending);
 		break;
 	}
 
@@ -213,6 +338,9 @@ static void agent_free(void *data)
 		l_dbus_cancel(dbus_get_bus(), agent->pending_id);
 
 	l_queue_destroy(agent->requests, agent_request_free);
+	l_idle_remove(agent->cached_reply_idle);
+	l_queue_destroy(agent->cached_replies, agent_request_free);
+	l_queue_destroy(agent->secrets, agent_secret_free);
 
 	if (agent->disconnect_watch)
 		l_dbus_remove_watch(dbus_get_bus(), agent->disconnect_watch);
@@ -274,15 +402,58 @@ static void agent_send_next_request(struct agent *agent)
 	pending->message = NULL;
 }
 
+static void agent_cached_reply(void *user_data)
+{
+	struct agent *agent = user_data;
+	struct agent_request *request;
+
+	l_idle_remove(agent->cached_reply_idle);
+	agent->cached_reply_idle = NULL;
+
+	/* The callbacks may queue or cancel other requests */
+	while ((request = l_queue_pop_head(agent->cached_replies))) {
+		agent_request_passphrase_func_t passphrase_cb;
+		agent_request_user_name_passwd_func_t user_name_passwd_cb;
+
+		l_debug("agent %p request id %u answered from cache", agent,
+				request->id);
+
+		switch (request->type) {
+		case AGENT_REQUEST_TYPE_PASSPHRASE:
+			passphrase_cb = request->user_callback;
+			passphrase_cb(AGENT_RESULT_OK, request->cached_value,
+					request->trigger, request->user_data);
+			break;
+		case AGENT_REQUEST_TYPE_USER_NAME_PASSWD:
+			user_name_passwd_cb = request->user_callback;
+			user_name_passwd_cb(AGENT_RESULT_OK,
+					request->cached_value,
+					request->cached_password,
+					request->trigger, request->user_data);
+			break;
+		}
+
+		if (request->trigger) {
+			l_dbus_message_unref(request->trigger);
+			request->trigger = NULL;
+		}
+
+		agent_request_free(request);
+	}
+}
+
 static unsigned int agent_queue_request(struct agent *agent,
 					enum agent_request_type type,
 					struct l_dbus_message *message,
+					const char *method,
+					const char *path, const char *user,
 					int timeout, void *callback,
 					struct l_dbus_message *trigger,
 					void *user_data,
 					agent_request_destroy_func_t destroy)
 {
 	struct agent_request *request;
+	const struct agent_secret *secret;
 
 	request = l_new(struct agent_request, 1);
 
@@ -293,6 +464,29 @@ static unsigned int agent_queue_request(struct agent *agent,
 	request->user_callback = callback;
 	request->trigger = l_dbus_message_ref(trigger);
 	request->destroy = destroy;
+	request->method = method;
+	request->path = l_strdup(path);
+	request->user = l_strdup(user);
+
+	/*
+	 * Answered asynchronously, as a D-Bus reply would be, since the
+	 * callers only store the request id once this returns
+	 */
+	secret = l_queue_find(agent->secrets, agent_secret_match, request);
+	if (secret) {
+		l_dbus_message_unref(l_steal_ptr(request->message));
+		request->cached_value = l_strdup(secret->value);
+		request->cached_password = l_strdup(secret->password);
+
+		l_queue_push_tail(agent->cached_replies, request);
+
+		if (!agent->cached_reply_idle)
+			agent->cached_reply_idle = l_idle_create(
+							agent_cached_reply,
+							agent, NULL);
+
+		return request->id;
+	}
 
 	agent->timeout_secs = timeout;
 
@@ -373,7 +567,8 @@ unsigned int agent_request_passphrase(const char *path,
 	l_dbus_message_set_arguments(message, "o", path);
 
 	return agent_queue_request(agent, AGENT_REQUEST_TYPE_PASSPHRASE,
-					message, agent_timeout_input_request(),
+					message, "RequestPassphrase", path,
+					NULL, agent_timeout_input_request(),
 					callback, trigger, user_data, destroy);
 }
 
@@ -399,7 +594,9 @@ unsigned int agent_request_pkey_passphrase(const char *path,
 	l_dbus_message_set_arguments(message, "o", path);
 
 	return agent_queue_request(agent, AGENT_REQUEST_TYPE_PASSPHRASE,
-					message, agent_timeout_input_request(),
+					message, "RequestPrivateKeyPassphrase",
+					path, NULL,
+					agent_timeout_input_request(),
 					callback, trigger, user_data, destroy);
 }
 
@@ -425,7 +622,9 @@ unsigned int agent_request_user_name_password(const char *path,
 	l_dbus_message_set_arguments(message, "o", path);
 
 	return agent_queue_request(agent, AGENT_REQUEST_TYPE_USER_NAME_PASSWD,
-					message, agent_timeout_input_request(),
+					message, "RequestUserNameAndPassword",
+					path, NULL,
+					agent_timeout_input_request(),
 					callback, trigger, user_data, destroy);
 }
 
@@ -450,7 +649,9 @@ unsigned int agent_request_user_password(const char *path, const char *user,
 	l_dbus_message_set_arguments(message, "os", path, user ?: "");
 
 	return agent_queue_request(agent, AGENT_REQUEST_TYPE_PASSPHRASE,
-					message, agent_timeout_input_request(),
+					message, "RequestUserPassword", path,
+					user ?: "",
+					agent_timeout_input_request(),
 					callback, trigger, user_data, destroy);
 }
 
@@ -475,6 +676,15 @@ bool agent_request_cancel(unsigned int req_id, int reason)
 							L_UINT_TO_PTR(req_id));
 		if (request)
 			break;
+
+		/* Nothing was sent to the agent for a cached reply */
+		request = l_queue_remove_if(agent->cached_replies,
+						find_request,
+						L_UINT_TO_PTR(req_id));
+		if (request) {
+			agent_request_free(request);
+			return true;
+		}
 	}
 
 	if (!request)
@@ -524,6 +734,8 @@ static struct agent *agent_create(struct l_dbus *dbus, const char *name,
 	agent->owner = l_strdup(name);
 	agent->path = l_strdup(path);
 	agent->requests = l_queue_new();
+	agent->cached_replies = l_queue_new();
+	agent->secrets = l_queue_new();
 	agent->disconnect_watch = l_dbus_add_disconnect_watch(dbus, name,
 							agent_disconnect,
 							agent, NULL);
@@ -59,3 +59,4 @@ unsigned int agent_request_user_password(const char *path, const char *user,
 				struct l_dbus_message *trigger, void *user_data,
 				agent_request_destroy_func_t destroy);
 bool agent_request_cancel(unsigned int req_id, int reason);
+void agent_forget_secrets(const char *path);
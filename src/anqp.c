@@ -250,7 +250,7 @@ uint32_t anqp_request(uint64_t wdev_id, const uint8_t *addr,
 
 	l_debug("Sending ANQP request to "MAC, MAC_STR(bss->addr));
 
-	request->id = frame_xchg_start(request->wdev_id, iov,
+	request->id = frame_xchg_start_pipelined(request->wdev_id, iov,
 				request->frequency, 0, 300, 0,
 				ANQP_GROUP, anqp_frame_timeout, request, NULL,
 				&anqp_frame_prefix, anqp_response_frame_event,
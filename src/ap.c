@@ -25,6 +25,7 @@
 #endif
 
 #include <errno.h>
+#include <time.h>
 #include <linux/if_ether.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -58,6 +59,45 @@
 #include "src/storage.h"
 #include "src/diagnostic.h"
 #include "src/band.h"
+#include "src/sae.h"
+#include "src/auth-proto.h"
+
+#define MEMACCT_MODULE MEMACCT_AP
+#include "src/memacct.h"
+
+/*
+ * SAE commits are processed one at a time from an idle callback so that a
+ * burst of stations can't monopolize the event loop.  Past the threshold,
+ * new commits need an anti-clogging token; past the limit they're dropped
+ * and left for the station to retransmit.
+ */
+#define AP_SAE_ANTI_CLOGGING_THRESHOLD	5
+#define AP_SAE_MAX_PENDING		32
+#define AP_SAE_TOKEN_LEN		32
+
+#define AP_GTK_REKEY_BURST		8
+#define AP_GTK_REKEY_BURST_INTERVAL_MS	20
+
+#define AP_LEASES_SYNC_DELAY		5
+
+#define AP_DEFAULT_MAX_HANDSHAKES	8
+
+/* The non-overlapping 2.4GHz channels considered by ap_acs_start */
+static const uint8_t ap_acs_channels[] = { 1, 6, 11 };
+#define AP_ACS_DEFAULT_CHANNEL		6
+
+struct ap_neighbor {
+	uint8_t addr[6];
+	uint8_t oper_class;
+	uint8_t channel;
+};
+
+/* A MAC address list from the profile, indexed for the per-frame checks */
+struct ap_mac_list {
+	uint8_t *addrs;
+	unsigned int num;
+	struct l_hashmap *index;
+};
 
 struct ap_state {
 	struct netdev *netdev;
@@ -69,9 +109,11 @@ struct ap_state {
 	char ssid[33];
 	char passphrase[64];
 	uint8_t psk[32];
+	struct crypto_psk_work *psk_work;
 	uint8_t channel;
-	uint8_t *authorized_macs;
-	unsigned int authorized_macs_num;
+	struct ap_mac_list authorized_macs;
+	struct ap_mac_list allowed_macs;
+	struct ap_mac_list denied_macs;
 	char wsc_name[33];
 	struct wsc_primary_device_type wsc_primary_device_type;
 
@@ -81,29 +123,95 @@ struct ap_state {
 	struct l_uintset *rates;
 	uint32_t start_stop_cmd_id;
 	uint32_t mlme_watch;
+	uint32_t acs_scan_id;
+	uint32_t acs_survey_cmd_id;
+	uint32_t acs_cost[L_ARRAY_SIZE(ap_acs_channels)];
 	uint8_t gtk[CRYPTO_MAX_GTK_LEN];
 	uint8_t gtk_index;
+	uint32_t gtk_rekey_interval;
+	struct l_timeout *gtk_rekey_timeout;
+	struct l_timeout *gtk_rekey_burst_timeout;
+	struct l_queue *gtk_rekey_queue;
+	unsigned int gtk_rekey_pending;
+	uint8_t gtk_rekey_old_index;
+	uint8_t gtk_rekey_kde[CRYPTO_MAX_GTK_LEN + 8 +
+					CRYPTO_MAX_IGTK_LEN + 14];
+	uint8_t igtk[CRYPTO_MAX_IGTK_LEN];
+	uint8_t igtk_index;
+	uint8_t igtk_rekey_old_index;
 	struct l_queue *wsc_pbc_probes;
+	struct l_hashmap *wsc_pbc_index;
+	struct l_timeout *wsc_pbc_expire_timeout;
 	struct l_timeout *wsc_pbc_timeout;
 	uint16_t wsc_dpid;
 	uint8_t wsc_uuid_r[16];
+	uint8_t *probe_resp_tmpl;
+	size_t probe_resp_tmpl_len;
 
 	uint16_t last_aid;
 	struct l_queue *sta_states;
+	struct l_hashmap *sta_index;
+
+	struct l_queue *sae_work;
+	struct l_idle *sae_work_idle;
+	uint8_t sae_token_key[32];
+
+	unsigned int max_handshakes;
+	unsigned int handshakes_active;
+	struct l_queue *handshake_queue;
+	struct l_idle *handshake_idle;
 
 	struct l_dhcp_server *netconfig_dhcp;
 	struct l_rtnl_address *netconfig_addr4;
+	char *lease_group;
+	struct l_hashmap *leases;
+	struct l_timeout *leases_sync_timeout;
 	uint32_t rtnl_add_cmd;
 	uint32_t rtnl_get_gateway4_mac_cmd;
 	uint32_t rtnl_get_dns4_mac_cmd;
 	uint8_t netconfig_gateway4_mac[6];
 	uint8_t netconfig_dns4_mac[6];
 
+	struct ap_neighbor *steer_neighbors;
+	unsigned int steer_neighbors_num;
+	int steer_min_rssi;
+	unsigned int steer_max_stations;
+	struct l_timeout *acct_timeout;
+	uint64_t acct_poll_time;
+	uint64_t acct_airtime;
+	uint16_t bss_load_stations;
+	uint8_t bss_load_utilization;
+	uint8_t btm_dialog_token;
+
 	bool started : 1;
 	bool gtk_set : 1;
+	bool gtk_rekey_active : 1;
 	bool netconfig_set_addr4 : 1;
 	bool in_event : 1;
 	bool free_pending : 1;
+	bool sae_enabled : 1;
+	bool mfpc : 1;
+	bool probe_resp_offload : 1;
+	bool acct_polling : 1;
+	bool acs_measured : 1;
+};
+
+/* Last station dump counters and the rolling estimates derived from them */
+struct ap_sta_acct {
+	uint64_t time;
+	uint64_t airtime;
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+	uint32_t tx_packets;
+	uint32_t tx_retries;
+	uint32_t airtime_share;	/* Per mille of the elapsed time */
+	uint32_t rx_kbps;
+	uint32_t tx_kbps;
+	uint32_t retry_rate;	/* Retries per thousand packets */
+	bool have_airtime : 1;
+	bool have_rx : 1;
+	bool have_tx : 1;
+	bool have_retries : 1;
 };
 
 struct sta_state {
@@ -128,6 +236,33 @@ struct sta_state {
 	bool wsc_v2;
 	struct l_dhcp_lease *ip_alloc_lease;
 	bool ip_alloc_sent;
+	struct auth_proto *sae;
+	struct handshake_state *sae_hs;
+	bool sae_accepted;
+	bool gtk_rekey_pending;
+	bool bss_transition;
+	bool have_steer_rssi;
+	int8_t steer_rssi;
+	uint64_t steer_time;
+	struct ap_sta_acct acct;
+	bool handshake_admitted;
+	bool handshake_queued;
+	bool have_gtk_rsc;
+	uint8_t gtk_rsc[6];
+	bool mfp;
+	uint8_t igtk_ipn[6];
+};
+
+struct ap_sae_work {
+	struct sta_state *sta;
+	size_t frame_len;
+	uint8_t frame[];
+};
+
+struct ap_lease {
+	uint8_t mac[6];
+	uint32_t address;
+	uint64_t expires;
 };
 
 struct ap_wsc_pbc_probe_record {
@@ -137,11 +272,337 @@ struct ap_wsc_pbc_probe_record {
 };
 
 static char **global_addr4_strs;
+static unsigned int global_addr4_prefix_len;
+static struct l_settings *lease_db;
 static uint32_t netdev_watch;
 static struct l_netlink *rtnl;
+static struct l_genl_family *nl80211;
+static struct l_queue *extra_bss_list;
+
+static struct l_genl_msg *ap_build_cmd_del_key(struct ap_state *ap,
+						uint8_t key_index)
+{
+	uint32_t ifindex = netdev_get_ifindex(ap->netdev);
+	struct l_genl_msg *msg;
+
+	msg = l_genl_msg_new_sized(NL80211_CMD_DEL_KEY, 128);
+
+	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &ifindex);
+	l_genl_msg_enter_nested(msg, NL80211_ATTR_KEY);
+	l_genl_msg_append_attr(msg, NL80211_KEY_IDX, 1, &key_index);
+	l_genl_msg_leave_nested(msg);
+
+	return msg;
+}
+
+static void ap_gtk_op_cb(struct l_genl_msg *msg, void *user_data)
+{
+	if (l_genl_msg_get_error(msg) < 0) {
+		uint8_t cmd = l_genl_msg_get_command(msg);
+		const char *cmd_name =
+			cmd == NL80211_CMD_NEW_KEY ? "NEW_KEY" :
+			cmd == NL80211_CMD_SET_KEY ? "SET_KEY" :
+			"DEL_KEY";
+
+		l_error("%s failed for the GTK: %i",
+			cmd_name, l_genl_msg_get_error(msg));
+	}
+}
+
+static bool ap_install_igtk(struct ap_state *ap, uint8_t key_index,
+				const uint8_t *igtk)
+{
+	uint32_t ifindex = netdev_get_ifindex(ap->netdev);
+	struct l_genl_msg *msg;
+
+	msg = nl80211_build_new_key_group(ifindex, CRYPTO_CIPHER_BIP,
+						key_index, igtk, 16,
+						NULL, 0, NULL);
+	if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing NEW_KEY for the IGTK failed");
+		return false;
+	}
+
+	return true;
+}
+
+static bool ap_set_igtk_default(struct ap_state *ap)
+{
+	struct l_genl_msg *msg;
+
+	msg = nl80211_build_set_mgmt_key(netdev_get_ifindex(ap->netdev),
+						ap->igtk_index);
+	if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing SET_KEY for the IGTK failed");
+		return false;
+	}
+
+	return true;
+}
+
+static void ap_gtk_rekey_check_done(struct ap_state *ap)
+{
+	uint32_t ifindex = netdev_get_ifindex(ap->netdev);
+	struct l_genl_msg *msg;
+
+	if (!ap->gtk_rekey_active || ap->gtk_rekey_pending ||
+			!l_queue_isempty(ap->gtk_rekey_queue))
+		return;
+
+	ap->gtk_rekey_active = false;
+
+	l_debug("GTK %u delivered to all stations", ap->gtk_index);
+
+	/*
+	 * Only start transmitting with the new GTK once every station has
+	 * acknowledged it, then the old key can go.
+	 */
+	msg = nl80211_build_set_key(ifindex, ap->gtk_index);
+	if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing SET_KEY failed");
+		return;
+	}
+
+	msg = ap_build_cmd_del_key(ap, ap->gtk_rekey_old_index);
+	if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing DEL_KEY failed");
+	}
+
+	if (!ap->mfpc || !ap_set_igtk_default(ap))
+		return;
+
+	msg = ap_build_cmd_del_key(ap, ap->igtk_rekey_old_index);
+	if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing DEL_KEY failed");
+	}
+}
+
+static void ap_gtk_rekey_send_burst(struct ap_state *ap);
+
+static void ap_gtk_rekey_burst_cb(struct l_timeout *timeout, void *user_data)
+{
+	struct ap_state *ap = user_data;
+
+	ap_gtk_rekey_send_burst(ap);
+}
+
+/*
+ * Start the Group Key Handshakes AP_GTK_REKEY_BURST stations at a time so
+ * that a rekey with many associated stations doesn't flood the medium and
+ * our own event loop with EAPoL-Key frames at once.
+ */
+static void ap_gtk_rekey_send_burst(struct ap_state *ap)
+{
+	static const uint8_t zero_rsc[6];
+	unsigned int sent = 0;
+	struct sta_state *sta;
+
+	while (sent < AP_GTK_REKEY_BURST &&
+			(sta = l_queue_pop_head(ap->gtk_rekey_queue))) {
+		size_t kde_len = ap->gtk_rekey_kde[1] + 2;
+
+		handshake_state_set_gtk(sta->hs, ap->gtk, ap->gtk_index,
+					zero_rsc);
+
+		/* The IGTK KDE follows the GTK KDE, only for MFP stations */
+		if (sta->hs->mfp) {
+			handshake_state_set_igtk(sta->hs, ap->igtk,
+						ap->igtk_index, zero_rsc);
+			kde_len += ap->gtk_rekey_kde[kde_len + 1] + 2;
+		}
+
+		if (!eapol_start_group_handshake(sta->sm, ap->gtk_rekey_kde,
+						kde_len, zero_rsc))
+			continue;
+
+		sta->gtk_rekey_pending = true;
+		ap->gtk_rekey_pending++;
+		sent++;
+	}
+
+	if (l_queue_isempty(ap->gtk_rekey_queue)) {
+		l_timeout_remove(l_steal_ptr(ap->gtk_rekey_burst_timeout));
+		ap_gtk_rekey_check_done(ap);
+		return;
+	}
+
+	if (ap->gtk_rekey_burst_timeout)
+		l_timeout_modify_ms(ap->gtk_rekey_burst_timeout,
+					AP_GTK_REKEY_BURST_INTERVAL_MS);
+	else
+		ap->gtk_rekey_burst_timeout = l_timeout_create_ms(
+					AP_GTK_REKEY_BURST_INTERVAL_MS,
+					ap_gtk_rekey_burst_cb, ap, NULL);
+}
+
+static void ap_gtk_rekey_add_sta(struct ap_state *ap, struct sta_state *sta)
+{
+	if (!ap->gtk_rekey_queue)
+		ap->gtk_rekey_queue = l_queue_new();
+
+	l_queue_push_tail(ap->gtk_rekey_queue, sta);
+
+	if (!ap->gtk_rekey_burst_timeout)
+		ap_gtk_rekey_send_burst(ap);
+}
+
+/* Called when the STA acked the new GTK or is going away */
+static void ap_gtk_rekey_sta_done(struct sta_state *sta)
+{
+	struct ap_state *ap = sta->ap;
+
+	if (sta->gtk_rekey_pending) {
+		sta->gtk_rekey_pending = false;
+		ap->gtk_rekey_pending--;
+	} else if (!l_queue_remove(ap->gtk_rekey_queue, sta))
+		return;
+
+	ap_gtk_rekey_check_done(ap);
+}
+
+static void ap_gtk_rekey_start(struct ap_state *ap)
+{
+	enum crypto_cipher group_cipher =
+		ie_rsn_cipher_suite_to_cipher(ap->group_cipher);
+	int gtk_len = crypto_cipher_key_len(group_cipher);
+	uint8_t new_index = ap->gtk_index == 1 ? 2 : 1;
+	uint8_t new_igtk_index = ap->igtk_index == 4 ? 5 : 4;
+	uint8_t gtk[CRYPTO_MAX_GTK_LEN];
+	uint8_t igtk[16];
+	static const uint8_t zero_ipn[6];
+	const struct l_queue_entry *entry;
+	struct l_genl_msg *msg;
+
+	/* Both new keys start with a zero Tx counter, no need to query */
+	if (ap->mfpc) {
+		l_getrandom(igtk, sizeof(igtk));
+
+		if (!ap_install_igtk(ap, new_igtk_index, igtk)) {
+			explicit_bzero(igtk, sizeof(igtk));
+			return;
+		}
+	}
+
+	l_getrandom(gtk, gtk_len);
+
+	/* Install for now without making it the default Tx key */
+	msg = nl80211_build_new_key_group(netdev_get_ifindex(ap->netdev),
+						group_cipher, new_index,
+						gtk, gtk_len, NULL, 0, NULL);
+	if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing NEW_KEY failed");
+		explicit_bzero(gtk, sizeof(gtk));
+		explicit_bzero(igtk, sizeof(igtk));
+		return;
+	}
+
+	ap->gtk_rekey_old_index = ap->gtk_index;
+	ap->gtk_index = new_index;
+	memcpy(ap->gtk, gtk, gtk_len);
+	explicit_bzero(gtk, sizeof(gtk));
+	ap->gtk_rekey_active = true;
+
+	/* Same plaintext KDE for everyone, build it once */
+	handshake_util_build_gtk_kde(group_cipher, ap->gtk, ap->gtk_index,
+					ap->gtk_rekey_kde);
+
+	if (ap->mfpc) {
+		ap->igtk_rekey_old_index = ap->igtk_index;
+		ap->igtk_index = new_igtk_index;
+		memcpy(ap->igtk, igtk, sizeof(igtk));
+		explicit_bzero(igtk, sizeof(igtk));
+
+		handshake_util_build_igtk_kde(CRYPTO_CIPHER_BIP, ap->igtk,
+					ap->igtk_index, zero_ipn,
+					ap->gtk_rekey_kde +
+					ap->gtk_rekey_kde[1] + 2);
+	}
+
+	l_debug("Distributing GTK %u", ap->gtk_index);
+
+	if (!ap->gtk_rekey_queue)
+		ap->gtk_rekey_queue = l_queue_new();
+
+	for (entry = l_queue_get_entries(ap->sta_states); entry;
+			entry = entry->next) {
+		struct sta_state *sta = entry->data;
+
+		if (!sta->rsna || !sta->sm)
+			continue;
+
+		l_queue_push_tail(ap->gtk_rekey_queue, sta);
+	}
+
+	ap_gtk_rekey_send_burst(ap);
+}
+
+static void ap_gtk_rekey_timeout_cb(struct l_timeout *timeout,
+					void *user_data)
+{
+	struct ap_state *ap = user_data;
+
+	l_timeout_modify(timeout, ap->gtk_rekey_interval);
+
+	/* Still waiting for some stations to ack the previous GTK */
+	if (ap->gtk_rekey_active)
+		return;
+
+	ap_gtk_rekey_start(ap);
+}
+
+static void ap_gtk_rekey_cancel(struct ap_state *ap)
+{
+	const struct l_queue_entry *entry;
+	struct l_genl_msg *msg;
+
+	l_timeout_remove(l_steal_ptr(ap->gtk_rekey_timeout));
+	l_timeout_remove(l_steal_ptr(ap->gtk_rekey_burst_timeout));
+	l_queue_destroy(l_steal_ptr(ap->gtk_rekey_queue), NULL);
+
+	for (entry = l_queue_get_entries(ap->sta_states); entry;
+			entry = entry->next) {
+		struct sta_state *sta = entry->data;
+
+		sta->gtk_rekey_pending = false;
+	}
+
+	ap->gtk_rekey_pending = 0;
+	explicit_bzero(ap->gtk_rekey_kde, sizeof(ap->gtk_rekey_kde));
+
+	if (!ap->gtk_rekey_active)
+		return;
+
+	ap->gtk_rekey_active = false;
+
+	msg = ap_build_cmd_del_key(ap, ap->gtk_rekey_old_index);
+	if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing DEL_KEY failed");
+	}
+
+	if (!ap->mfpc)
+		return;
+
+	msg = ap_build_cmd_del_key(ap, ap->igtk_rekey_old_index);
+	if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing DEL_KEY failed");
+	}
+}
+
+static void ap_handshake_release(struct sta_state *sta);
 
 static void ap_stop_handshake(struct sta_state *sta)
 {
+	ap_gtk_rekey_sta_done(sta);
+	ap_handshake_release(sta);
+
 	if (sta->sm) {
 		eapol_sm_free(sta->sm);
 		sta->sm = NULL;
@@ -170,6 +631,32 @@ static void ap_stop_handshake_work(struct l_idle *idle, void *user_data)
 	ap_stop_handshake(sta);
 }
 
+static bool ap_sae_work_match_sta(void *data, void *user_data)
+{
+	struct ap_sae_work *work = data;
+
+	if (work->sta != user_data)
+		return false;
+
+	l_free(work);
+	return true;
+}
+
+static void ap_sae_free(struct sta_state *sta)
+{
+	l_queue_foreach_remove(sta->ap->sae_work, ap_sae_work_match_sta, sta);
+
+	if (sta->sae) {
+		auth_proto_free(sta->sae);
+		sta->sae = NULL;
+	}
+
+	if (sta->sae_hs) {
+		handshake_state_free(sta->sae_hs);
+		sta->sae_hs = NULL;
+	}
+}
+
 static void ap_sta_free(void *data)
 {
 	struct sta_state *sta = data;
@@ -191,10 +678,76 @@ static void ap_sta_free(void *data)
 						sta->ip_alloc_lease);
 
 	ap_stop_handshake(sta);
+	ap_sae_free(sta);
 
 	l_free(sta);
 }
 
+static void ap_leases_free(struct ap_state *ap);
+
+static unsigned int ap_sta_addr_hash(const void *key);
+static int ap_sta_addr_compare(const void *a, const void *b);
+
+static void ap_mac_list_clear(struct ap_mac_list *list)
+{
+	l_hashmap_destroy(l_steal_ptr(list->index), NULL);
+	l_free(l_steal_ptr(list->addrs));
+	list->num = 0;
+}
+
+static bool ap_mac_list_contains(const struct ap_mac_list *list,
+					const uint8_t *addr)
+{
+	return list->index && l_hashmap_lookup(list->index, addr);
+}
+
+static int ap_mac_list_load(struct ap_mac_list *list,
+				const struct l_settings *config,
+				const char *group, const char *key)
+{
+	_auto_(l_strv_free) char **strvval = NULL;
+	unsigned int i;
+
+	if (!l_settings_get_value(config, group, key))
+		return 0;
+
+	strvval = l_settings_get_string_list(config, group, key, ',');
+	if (!strvval) {
+		l_error("AP [%s].%s list format wrong", group, key);
+		return -EINVAL;
+	}
+
+	list->num = l_strv_length(strvval);
+	list->addrs = l_malloc(list->num * 6);
+	list->index = l_hashmap_new();
+	l_hashmap_set_hash_function(list->index, ap_sta_addr_hash);
+	l_hashmap_set_compare_function(list->index, ap_sta_addr_compare);
+
+	for (i = 0; strvval[i]; i++) {
+		uint8_t *addr = list->addrs + i * 6;
+
+		if (!util_string_to_address(strvval[i], addr)) {
+			l_error("AP [%s].%s bad MAC format: %s", group, key,
+				strvval[i]);
+			return -EINVAL;
+		}
+
+		l_hashmap_insert(list->index, addr, addr);
+	}
+
+	return 0;
+}
+
+/* [Security].DeniedMACs always wins, AllowedMACs applies if not empty */
+static bool ap_mac_allowed(struct ap_state *ap, const uint8_t *addr)
+{
+	if (ap_mac_list_contains(&ap->denied_macs, addr))
+		return false;
+
+	return !ap->allowed_macs.num ||
+		ap_mac_list_contains(&ap->allowed_macs, addr);
+}
+
 static void ap_reset(struct ap_state *ap)
 {
 	struct netdev *netdev = ap->netdev;
@@ -202,11 +755,17 @@ static void ap_reset(struct ap_state *ap)
 	explicit_bzero(ap->passphrase, sizeof(ap->passphrase));
 	explicit_bzero(ap->psk, sizeof(ap->psk));
 
-	if (ap->authorized_macs_num) {
-		l_free(ap->authorized_macs);
-		ap->authorized_macs_num = 0;
+	if (ap->psk_work) {
+		crypto_psk_work_cancel(ap->psk_work);
+		ap->psk_work = NULL;
 	}
 
+	ap_mac_list_clear(&ap->authorized_macs);
+	ap_mac_list_clear(&ap->allowed_macs);
+	ap_mac_list_clear(&ap->denied_macs);
+
+	l_free(l_steal_ptr(ap->probe_resp_tmpl));
+
 	if (ap->mlme_watch) {
 		l_genl_family_unregister(ap->nl80211, ap->mlme_watch);
 		ap->mlme_watch = 0;
@@ -219,6 +778,19 @@ static void ap_reset(struct ap_state *ap)
 		ap->start_stop_cmd_id = 0;
 	}
 
+	if (ap->acs_scan_id) {
+		scan_cancel(netdev_get_wdev_id(netdev), ap->acs_scan_id);
+		ap->acs_scan_id = 0;
+	}
+
+	if (ap->acs_survey_cmd_id) {
+		uint32_t id = ap->acs_survey_cmd_id;
+
+		/* Cleared first so that ap_acs_survey_done ignores this */
+		ap->acs_survey_cmd_id = 0;
+		l_genl_family_cancel(ap->nl80211, id);
+	}
+
 	if (ap->rtnl_add_cmd) {
 		l_netlink_cancel(rtnl, ap->rtnl_add_cmd);
 		ap->rtnl_add_cmd = 0;
@@ -234,14 +806,38 @@ static void ap_reset(struct ap_state *ap)
 		ap->rtnl_get_dns4_mac_cmd = 0;
 	}
 
+	l_idle_remove(l_steal_ptr(ap->sae_work_idle));
+	l_queue_destroy(l_steal_ptr(ap->sae_work), l_free);
+	ap_gtk_rekey_cancel(ap);
+	l_hashmap_destroy(l_steal_ptr(ap->sta_index), NULL);
 	l_queue_destroy(l_steal_ptr(ap->sta_states), ap_sta_free);
+	l_idle_remove(l_steal_ptr(ap->handshake_idle));
+	l_queue_destroy(l_steal_ptr(ap->handshake_queue), NULL);
+	ap->handshakes_active = 0;
+	explicit_bzero(ap->sae_token_key, sizeof(ap->sae_token_key));
+	explicit_bzero(ap->igtk, sizeof(ap->igtk));
 
 	if (ap->rates)
 		l_uintset_free(l_steal_ptr(ap->rates));
 
+	l_timeout_remove(l_steal_ptr(ap->wsc_pbc_expire_timeout));
+	l_hashmap_destroy(l_steal_ptr(ap->wsc_pbc_index), NULL);
 	l_queue_destroy(l_steal_ptr(ap->wsc_pbc_probes), l_free);
 	l_timeout_remove(ap->wsc_pbc_timeout);
 
+	l_timeout_remove(l_steal_ptr(ap->acct_timeout));
+
+	if (ap->acct_polling) {
+		ap->acct_polling = false;
+		netdev_get_station_cancel(netdev, ap);
+	}
+
+	ap->acct_poll_time = 0;
+	ap->acct_airtime = 0;
+
+	l_free(l_steal_ptr(ap->steer_neighbors));
+	ap->steer_neighbors_num = 0;
+
 	ap->started = false;
 
 	/* Delete IP if one was set by IWD */
@@ -251,118 +847,443 @@ static void ap_reset(struct ap_state *ap)
 		ap->netconfig_set_addr4 = false;
 	}
 
+	ap_leases_free(ap);
 	l_rtnl_address_free(l_steal_ptr(ap->netconfig_addr4));
 
-	if (ap->netconfig_dhcp) {
-		l_dhcp_server_destroy(ap->netconfig_dhcp);
-		ap->netconfig_dhcp = NULL;
+	if (ap->netconfig_dhcp) {
+		l_dhcp_server_destroy(ap->netconfig_dhcp);
+		ap->netconfig_dhcp = NULL;
+	}
+}
+
+static bool ap_event_done(struct ap_state *ap, bool prev_in_event)
+{
+	ap->in_event = prev_in_event;
+
+	if (!prev_in_event && ap->free_pending) {
+		l_genl_family_free(ap->nl80211);
+		l_free(ap);
+		return true;
+	}
+
+	return ap->free_pending;
+}
+
+/*
+ * Returns true if the AP is considered freed and the caller must avoid
+ * accessing @ap.
+ */
+static bool ap_event(struct ap_state *ap, enum ap_event_type event,
+			const void *event_data)
+{
+	bool prev = ap->in_event;
+
+	if (ap->free_pending)
+		return true;
+
+	ap->in_event = true;
+	ap->ops->handle_event(event, event_data, ap->user_data);
+	return ap_event_done(ap, prev);
+}
+
+static void ap_del_station(struct sta_state *sta, uint16_t reason,
+				bool disassociate)
+{
+	struct ap_state *ap = sta->ap;
+	struct ap_event_station_removed_data event_data;
+	bool send_event = false;
+
+	netdev_del_station(ap->netdev, sta->addr, reason, disassociate);
+	sta->associated = false;
+
+	if (sta->rsna) {
+		if (ap->ops->handle_event) {
+			memset(&event_data, 0, sizeof(event_data));
+			event_data.mac = sta->addr;
+			event_data.reason = reason;
+			send_event = true;
+		}
+
+		sta->rsna = false;
+	}
+
+	if (sta->assoc_resp_cmd_id) {
+		l_genl_family_cancel(ap->nl80211, sta->assoc_resp_cmd_id);
+		sta->assoc_resp_cmd_id = 0;
+	}
+
+	if (sta->gtk_query_cmd_id) {
+		l_genl_family_cancel(ap->nl80211, sta->gtk_query_cmd_id);
+		sta->gtk_query_cmd_id = 0;
+	}
+
+	ap_stop_handshake(sta);
+
+	/*
+	 * If the event handler tears the AP down, we've made sure above that
+	 * a subsequent ap_sta_free(sta) has no need to access sta->ap.
+	 */
+	if (send_event)
+		if (ap_event(ap, AP_EVENT_STATION_REMOVED, &event_data))
+			return;
+
+	/*
+	 * Expire any DHCP leases owned by this client when it disconnects to
+	 * make it harder for somebody to DoS the IP pool.  If the client
+	 * comes back and the lease is still in the expired leases list they
+	 * will get their IP back.
+	 */
+	if (ap->netconfig_dhcp) {
+		bool prev = ap->in_event;
+
+		/*
+		 * If the LEASE_EXPIRED event in ap_dhcp_event_cb triggers an
+		 * ap_free(), delay cleanup to avoid destroying the DHCP
+		 * server midway through l_dhcp_server_expire_by_mac().
+		 */
+		ap->in_event = true;
+
+		sta->ip_alloc_lease = NULL;
+		l_dhcp_server_expire_by_mac(ap->netconfig_dhcp, sta->addr);
+
+		ap_event_done(ap, prev);
+	}
+}
+
+/*
+ * The station list is kept in an l_queue for ordered iteration and is
+ * additionally indexed by MAC in sta_index so that the per-frame lookups
+ * don't need to walk every associated station.
+ */
+static unsigned int ap_sta_addr_hash(const void *key)
+{
+	const uint8_t *addr = key;
+
+	return l_get_le32(addr + 2);
+}
+
+static int ap_sta_addr_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, 6);
+}
+
+static struct sta_state *ap_sta_find(struct ap_state *ap, const uint8_t *addr)
+{
+	return l_hashmap_lookup(ap->sta_index, addr);
+}
+
+static void ap_sta_add(struct ap_state *ap, struct sta_state *sta)
+{
+	if (!ap->sta_states)
+		ap->sta_states = l_queue_new();
+
+	if (!ap->sta_index) {
+		ap->sta_index = l_hashmap_new();
+		l_hashmap_set_hash_function(ap->sta_index, ap_sta_addr_hash);
+		l_hashmap_set_compare_function(ap->sta_index,
+						ap_sta_addr_compare);
+	}
+
+	l_queue_push_tail(ap->sta_states, sta);
+	l_hashmap_insert(ap->sta_index, sta->addr, sta);
+}
+
+static struct sta_state *ap_sta_remove(struct ap_state *ap,
+					const uint8_t *addr)
+{
+	struct sta_state *sta = l_hashmap_remove(ap->sta_index, addr);
+
+	if (sta)
+		l_queue_remove(ap->sta_states, sta);
+
+	return sta;
+}
+
+/*
+ * The DHCP leases handed out by each AP are remembered in lease_db, one
+ * group per SSID, so that a restarted AP can reuse its subnet and offer
+ * every returning client the address it may still be using.  While the
+ * AP runs the leases are kept in a hashmap indexed by the client MAC and
+ * only written back to storage after AP_LEASES_SYNC_DELAY seconds so
+ * that a burst of leases results in a single write.
+ */
+static void ap_leases_save_entry(const void *key, void *value,
+					void *user_data)
+{
+	const struct ap_lease *lease = value;
+	struct ap_state *ap = user_data;
+	struct in_addr ia = { .s_addr = lease->address };
+	char mac_str[13];
+	char value_str[INET_ADDRSTRLEN + 21];
+
+	if (lease->expires <= (uint64_t) time(NULL))
+		return;
+
+	snprintf(mac_str, sizeof(mac_str), "%02x%02x%02x%02x%02x%02x",
+			lease->mac[0], lease->mac[1], lease->mac[2],
+			lease->mac[3], lease->mac[4], lease->mac[5]);
+	snprintf(value_str, sizeof(value_str), "%s,%" PRIu64,
+			inet_ntoa(ia), lease->expires);
+	l_settings_set_value(lease_db, ap->lease_group, mac_str, value_str);
+}
+
+static void ap_leases_sync(struct ap_state *ap)
+{
+	char addr_str[INET_ADDRSTRLEN];
+
+	l_timeout_remove(l_steal_ptr(ap->leases_sync_timeout));
+
+	if (!lease_db)
+		lease_db = l_settings_new();
+
+	l_settings_remove_group(lease_db, ap->lease_group);
+
+	if (ap->netconfig_addr4 &&
+			l_rtnl_address_get_address(ap->netconfig_addr4,
+							addr_str)) {
+		l_settings_set_string(lease_db, ap->lease_group, "Address",
+					addr_str);
+		l_settings_set_uint(lease_db, ap->lease_group, "PrefixLength",
+			l_rtnl_address_get_prefix_length(ap->netconfig_addr4));
+	}
+
+	l_hashmap_foreach(ap->leases, ap_leases_save_entry, ap);
+	storage_ap_leases_sync(lease_db);
+}
+
+static void ap_leases_sync_cb(struct l_timeout *timeout, void *user_data)
+{
+	struct ap_state *ap = user_data;
+
+	ap_leases_sync(ap);
+}
+
+static void ap_leases_update(struct ap_state *ap,
+				const struct l_dhcp_lease *dhcp_lease)
+{
+	const uint8_t *mac = l_dhcp_lease_get_mac(dhcp_lease);
+	struct ap_lease *lease;
+
+	if (!ap->leases || !mac)
+		return;
+
+	lease = l_hashmap_lookup(ap->leases, mac);
+	if (!lease) {
+		lease = l_new(struct ap_lease, 1);
+		memcpy(lease->mac, mac, 6);
+		l_hashmap_insert(ap->leases, lease->mac, lease);
+	}
+
+	lease->address = l_dhcp_lease_get_address_u32(dhcp_lease);
+	lease->expires = (uint64_t) time(NULL) +
+				l_dhcp_lease_get_lifetime(dhcp_lease);
+
+	if (!ap->leases_sync_timeout)
+		ap->leases_sync_timeout = l_timeout_create(AP_LEASES_SYNC_DELAY,
+							ap_leases_sync_cb,
+							ap, NULL);
+}
+
+/* Parses the "<IP>,<expiry time>" format used for each client */
+static bool ap_leases_parse(const char *value, uint32_t *out_address,
+				uint64_t *out_expires)
+{
+	char addr_str[INET_ADDRSTRLEN];
+	const char *comma = strchr(value, ',');
+	struct in_addr ia;
+	char *endp;
+
+	if (!comma || comma == value || comma - value >= INET_ADDRSTRLEN)
+		return false;
+
+	l_strlcpy(addr_str, value, comma - value + 1);
+
+	if (inet_pton(AF_INET, addr_str, &ia) != 1)
+		return false;
+
+	*out_expires = strtoull(comma + 1, &endp, 10);
+	if (*endp != '\0')
+		return false;
+
+	*out_address = ia.s_addr;
+	return true;
+}
+
+/*
+ * Drop the expired client entries and the groups of the APs that no
+ * longer have any valid lease, P2P GOs use a new SSID for every group.
+ */
+static void ap_lease_db_prune(void)
+{
+	char **groups = l_settings_get_groups(lease_db);
+	uint64_t now = time(NULL);
+	char **group;
+
+	for (group = groups; group && *group; group++) {
+		char **keys = l_settings_get_keys(lease_db, *group);
+		unsigned int n_leases = 0;
+		char **key;
+
+		for (key = keys; key && *key; key++) {
+			L_AUTO_FREE_VAR(char *, value) = NULL;
+			uint32_t address;
+			uint64_t expires;
+
+			if (!strcmp(*key, "Address") ||
+					!strcmp(*key, "PrefixLength"))
+				continue;
+
+			value = l_settings_get_string(lease_db, *group, *key);
+
+			if (value && ap_leases_parse(value, &address,
+							&expires) &&
+					expires > now)
+				n_leases++;
+			else
+				l_settings_remove_key(lease_db, *group, *key);
+		}
+
+		l_strv_free(keys);
+
+		if (!n_leases)
+			l_settings_remove_group(lease_db, *group);
 	}
+
+	l_strv_free(groups);
 }
 
-static bool ap_event_done(struct ap_state *ap, bool prev_in_event)
+static void ap_leases_load(struct ap_state *ap)
 {
-	ap->in_event = prev_in_event;
+	char **keys;
+	char **key;
+	uint64_t now = time(NULL);
 
-	if (!prev_in_event && ap->free_pending) {
-		l_genl_family_free(ap->nl80211);
-		l_free(ap);
-		return true;
+	ap->lease_group = l_util_hexstring((const uint8_t *) ap->ssid,
+						strlen(ap->ssid));
+	ap->leases = l_hashmap_new();
+	l_hashmap_set_hash_function(ap->leases, ap_sta_addr_hash);
+	l_hashmap_set_compare_function(ap->leases, ap_sta_addr_compare);
+
+	if (!lease_db)
+		return;
+
+	keys = l_settings_get_keys(lease_db, ap->lease_group);
+	if (!keys)
+		return;
+
+	for (key = keys; *key; key++) {
+		L_AUTO_FREE_VAR(char *, value) = NULL;
+		L_AUTO_FREE_VAR(uint8_t *, mac) = NULL;
+		struct ap_lease *lease;
+		size_t mac_len;
+		uint32_t address;
+		uint64_t expires;
+
+		if (strlen(*key) != 12)
+			continue;
+
+		mac = l_util_from_hexstring(*key, &mac_len);
+		value = l_settings_get_string(lease_db, ap->lease_group, *key);
+		if (!mac || mac_len != 6 || !value)
+			continue;
+
+		if (!ap_leases_parse(value, &address, &expires) ||
+				expires <= now)
+			continue;
+
+		lease = l_new(struct ap_lease, 1);
+		memcpy(lease->mac, mac, 6);
+		lease->address = address;
+		lease->expires = expires;
+
+		l_hashmap_insert(ap->leases, lease->mac, lease);
 	}
 
-	return ap->free_pending;
+	l_strv_free(keys);
 }
 
 /*
- * Returns true if the AP is considered freed and the caller must avoid
- * accessing @ap.
+ * Returns the address last used by the AP with this SSID if it's still
+ * located within @addr_str_list.
  */
-static bool ap_event(struct ap_state *ap, enum ap_event_type event,
-			const void *event_data)
+static char *ap_leases_get_subnet(struct ap_state *ap,
+					const char **addr_str_list,
+					uint8_t prefix_len)
 {
-	bool prev = ap->in_event;
-
-	if (ap->free_pending)
-		return true;
-
-	ap->in_event = true;
-	ap->ops->handle_event(event, event_data, ap->user_data);
-	return ap_event_done(ap, prev);
-}
+	L_AUTO_FREE_VAR(char *, addr_str) = NULL;
+	unsigned int saved_prefix_len;
+	struct in_addr ia;
+	uint32_t addr;
 
-static void ap_del_station(struct sta_state *sta, uint16_t reason,
-				bool disassociate)
-{
-	struct ap_state *ap = sta->ap;
-	struct ap_event_station_removed_data event_data;
-	bool send_event = false;
+	if (!lease_db || !l_settings_get_uint(lease_db, ap->lease_group,
+						"PrefixLength",
+						&saved_prefix_len) ||
+			saved_prefix_len != prefix_len)
+		return NULL;
 
-	netdev_del_station(ap->netdev, sta->addr, reason, disassociate);
-	sta->associated = false;
+	addr_str = l_settings_get_string(lease_db, ap->lease_group, "Address");
+	if (!addr_str || inet_pton(AF_INET, addr_str, &ia) != 1)
+		return NULL;
 
-	if (sta->rsna) {
-		if (ap->ops->handle_event) {
-			memset(&event_data, 0, sizeof(event_data));
-			event_data.mac = sta->addr;
-			event_data.reason = reason;
-			send_event = true;
-		}
+	addr = ntohl(ia.s_addr);
 
-		sta->rsna = false;
-	}
+	for (; *addr_str_list; addr_str_list++) {
+		uint32_t start;
+		uint32_t end;
+		uint8_t spec_prefix_len;
 
-	if (sta->assoc_resp_cmd_id) {
-		l_genl_family_cancel(ap->nl80211, sta->assoc_resp_cmd_id);
-		sta->assoc_resp_cmd_id = 0;
-	}
+		if (!util_ip_prefix_tohl(*addr_str_list, &spec_prefix_len,
+						&start, &end, NULL))
+			continue;
 
-	if (sta->gtk_query_cmd_id) {
-		l_genl_family_cancel(ap->nl80211, sta->gtk_query_cmd_id);
-		sta->gtk_query_cmd_id = 0;
+		/* start and end exclude the network and broadcast address */
+		if (spec_prefix_len <= prefix_len &&
+				addr >= start && addr <= end)
+			return l_steal_ptr(addr_str);
 	}
 
-	ap_stop_handshake(sta);
-
-	/*
-	 * If the event handler tears the AP down, we've made sure above that
-	 * a subsequent ap_sta_free(sta) has no need to access sta->ap.
-	 */
-	if (send_event)
-		if (ap_event(ap, AP_EVENT_STATION_REMOVED, &event_data))
-			return;
-
-	/*
-	 * Expire any DHCP leases owned by this client when it disconnects to
-	 * make it harder for somebody to DoS the IP pool.  If the client
-	 * comes back and the lease is still in the expired leases list they
-	 * will get their IP back.
-	 */
-	if (ap->netconfig_dhcp) {
-		bool prev = ap->in_event;
+	return NULL;
+}
 
-		/*
-		 * If the LEASE_EXPIRED event in ap_dhcp_event_cb triggers an
-		 * ap_free(), delay cleanup to avoid destroying the DHCP
-		 * server midway through l_dhcp_server_expire_by_mac().
-		 */
-		ap->in_event = true;
+/*
+ * Reserve the remembered addresses in a freshly started DHCP server so
+ * that returning clients get the same IP back.
+ */
+static void ap_leases_restore_entry(const void *key, void *value,
+					void *user_data)
+{
+	const struct ap_lease *lease = value;
+	struct ap_state *ap = user_data;
+	struct l_dhcp_lease *dhcp_lease;
 
-		sta->ip_alloc_lease = NULL;
-		l_dhcp_server_expire_by_mac(ap->netconfig_dhcp, sta->addr);
+	dhcp_lease = l_dhcp_server_discover(ap->netconfig_dhcp, lease->address,
+						NULL, lease->mac);
+	if (!dhcp_lease)
+		return;
 
-		ap_event_done(ap, prev);
+	if (l_dhcp_lease_get_address_u32(dhcp_lease) != lease->address) {
+		l_dhcp_server_lease_remove(ap->netconfig_dhcp, dhcp_lease);
+		return;
 	}
+
+	l_dhcp_server_request(ap->netconfig_dhcp, dhcp_lease);
 }
 
-static bool ap_sta_match_addr(const void *a, const void *b)
+static void ap_leases_free(struct ap_state *ap)
 {
-	const struct sta_state *sta = a;
+	if (!ap->leases)
+		return;
+
+	if (ap->leases_sync_timeout)
+		ap_leases_sync(ap);
 
-	return !memcmp(sta->addr, b, 6);
+	l_hashmap_destroy(l_steal_ptr(ap->leases), l_free);
+	l_free(l_steal_ptr(ap->lease_group));
 }
 
 static void ap_remove_sta(struct sta_state *sta)
 {
-	if (!l_queue_remove(sta->ap->sta_states, sta)) {
+	if (ap_sta_remove(sta->ap, sta->addr) != sta) {
 		l_error("tried to remove station that doesn't exist");
 		return;
 	}
@@ -390,6 +1311,11 @@ static void ap_new_rsna(struct sta_state *sta)
 	l_debug("STA "MAC" authenticated", MAC_STR(sta->addr));
 
 	sta->rsna = true;
+	ap_handshake_release(sta);
+
+	/* Got the previous GTK in message 3 while a rekey was in progress */
+	if (ap->gtk_set && sta->hs->gtk_index != ap->gtk_index)
+		ap_gtk_rekey_add_sta(ap, sta);
 
 	event_data.mac = sta->addr;
 	event_data.assoc_ies = sta->assoc_ies;
@@ -436,8 +1362,22 @@ static void ap_set_rsn_info(struct ap_state *ap, struct ie_rsn_info *rsn)
 {
 	memset(rsn, 0, sizeof(*rsn));
 	rsn->akm_suites = IE_RSN_AKM_SUITE_PSK;
+
+	if (ap->sae_enabled)
+		rsn->akm_suites |= IE_RSN_AKM_SUITE_SAE_SHA256;
+
 	rsn->pairwise_ciphers = ap->ciphers;
 	rsn->group_cipher = ap->group_cipher;
+
+	/*
+	 * WPA3 Specification version 3, Section 2.3: an AP enabling SAE sets
+	 * MFPC, and also MFPR if SAE is the only AKM offered.
+	 */
+	if (ap->mfpc) {
+		rsn->mfpc = true;
+		rsn->mfpr = !(rsn->akm_suites & IE_RSN_AKM_SUITE_PSK);
+		rsn->group_management_cipher = IE_RSN_CIPHER_SUITE_BIP;
+	}
 }
 
 static void ap_wsc_exit_pbc(struct ap_state *ap)
@@ -452,35 +1392,58 @@ static void ap_wsc_exit_pbc(struct ap_state *ap)
 	ap_event(ap, AP_EVENT_PBC_MODE_EXIT, NULL);
 }
 
-struct ap_pbc_record_expiry_data {
-	uint64_t min_time;
-	const uint8_t *mac;
-};
+#define AP_WSC_PBC_MONITOR_TIME	120
+#define AP_WSC_PBC_WALK_TIME	120
 
-static bool ap_wsc_pbc_record_expire(void *data, void *user_data)
+static void ap_wsc_pbc_record_remove(struct ap_state *ap,
+				struct ap_wsc_pbc_probe_record *record)
 {
-	struct ap_wsc_pbc_probe_record *record = data;
-	const struct ap_pbc_record_expiry_data *expiry_data = user_data;
+	l_hashmap_remove(ap->wsc_pbc_index, record->mac);
+	l_queue_remove(ap->wsc_pbc_probes, record);
+	l_free(record);
+}
 
-	if (record->timestamp > expiry_data->min_time &&
-			memcmp(record->mac, expiry_data->mac, 6))
-		return false;
+static void ap_wsc_pbc_remove_addr(struct ap_state *ap, const uint8_t *addr)
+{
+	struct ap_wsc_pbc_probe_record *record =
+		l_hashmap_lookup(ap->wsc_pbc_index, addr);
 
-	l_free(record);
-	return true;
+	if (record)
+		ap_wsc_pbc_record_remove(ap, record);
 }
 
-#define AP_WSC_PBC_MONITOR_TIME	120
-#define AP_WSC_PBC_WALK_TIME	120
+/*
+ * Records are queued in arrival order so a single timer, re-armed for the
+ * oldest record, expires them once they're older than PBC Monitor Time.
+ */
+static void ap_wsc_pbc_expire_cb(struct l_timeout *timeout, void *user_data)
+{
+	struct ap_state *ap = user_data;
+	uint64_t now = l_time_now();
+	struct ap_wsc_pbc_probe_record *record;
+
+	while ((record = l_queue_peek_head(ap->wsc_pbc_probes))) {
+		uint64_t expiry = record->timestamp +
+				AP_WSC_PBC_MONITOR_TIME * L_USEC_PER_SEC;
+
+		if (expiry > now) {
+			l_timeout_modify_ms(timeout,
+					(expiry - now) / L_USEC_PER_MSEC + 1);
+			return;
+		}
+
+		ap_wsc_pbc_record_remove(ap, record);
+	}
+
+	l_timeout_remove(l_steal_ptr(ap->wsc_pbc_expire_timeout));
+}
 
 static void ap_process_wsc_probe_req(struct ap_state *ap, const uint8_t *from,
 					const uint8_t *wsc_data,
 					size_t wsc_data_len)
 {
 	struct wsc_probe_request req;
-	struct ap_pbc_record_expiry_data expiry_data;
 	struct ap_wsc_pbc_probe_record *record;
-	uint64_t now;
 	bool empty;
 	uint8_t first_sta_addr[6] = {};
 	const struct l_queue_entry *entry;
@@ -499,29 +1462,37 @@ static void ap_process_wsc_probe_req(struct ap_state *ap, const uint8_t *from,
 	if (record)
 		memcpy(first_sta_addr, record->mac, 6);
 
-	now = l_time_now();
-
 	/*
-	 * Expire entries older than PBC Monitor Time.  While there also drop
-	 * older entries from the same Enrollee that sent us this new Probe
-	 * Request.  It's unclear whether we should also match by the UUID-E.
+	 * Entries older than PBC Monitor Time are expired by
+	 * ap_wsc_pbc_expire_cb.  Drop the older entry from the same Enrollee
+	 * that sent us this new Probe Request.  It's unclear whether we
+	 * should also match by the UUID-E.
 	 */
-	expiry_data.min_time = now - AP_WSC_PBC_MONITOR_TIME * 1000000;
-	expiry_data.mac = from;
-	l_queue_foreach_remove(ap->wsc_pbc_probes, ap_wsc_pbc_record_expire,
-				&expiry_data);
+	ap_wsc_pbc_remove_addr(ap, from);
 
 	empty = l_queue_isempty(ap->wsc_pbc_probes);
 
-	if (!ap->wsc_pbc_probes)
+	if (!ap->wsc_pbc_probes) {
 		ap->wsc_pbc_probes = l_queue_new();
+		ap->wsc_pbc_index = l_hashmap_new();
+		l_hashmap_set_hash_function(ap->wsc_pbc_index,
+						ap_sta_addr_hash);
+		l_hashmap_set_compare_function(ap->wsc_pbc_index,
+						ap_sta_addr_compare);
+	}
 
 	/* Add new record */
 	record = l_new(struct ap_wsc_pbc_probe_record, 1);
 	memcpy(record->mac, from, 6);
 	memcpy(record->uuid_e, req.uuid_e, sizeof(record->uuid_e));
-	record->timestamp = now;
+	record->timestamp = l_time_now();
 	l_queue_push_tail(ap->wsc_pbc_probes, record);
+	l_hashmap_insert(ap->wsc_pbc_index, record->mac, record);
+
+	if (!ap->wsc_pbc_expire_timeout)
+		ap->wsc_pbc_expire_timeout = l_timeout_create(
+						AP_WSC_PBC_MONITOR_TIME,
+						ap_wsc_pbc_expire_cb, ap, NULL);
 
 	/*
 	 * If queue was non-empty and we've added one more record then we
@@ -585,7 +1556,7 @@ static void ap_process_wsc_probe_req(struct ap_state *ap, const uint8_t *from,
 static void ap_write_authorized_macs(struct ap_state *ap,
 					size_t out_len, uint8_t *out)
 {
-	size_t len = ap->authorized_macs_num * 6;
+	size_t len = ap->authorized_macs.num * 6;
 
 	if (!len)
 		return;
@@ -593,7 +1564,7 @@ static void ap_write_authorized_macs(struct ap_state *ap,
 	if (len > out_len)
 		len = out_len;
 
-	memcpy(out, ap->authorized_macs, len);
+	memcpy(out, ap->authorized_macs.addrs, len);
 }
 
 static size_t ap_get_wsc_ie_len(struct ap_state *ap,
@@ -618,27 +1589,14 @@ static size_t ap_write_wsc_ie(struct ap_state *ap,
 
 	/* WSC IE */
 	if (type == MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE) {
-		const uint8_t *from = client_frame->address_2;
 		struct wsc_probe_response wsc_pr = {};
-		const struct mmpdu_probe_request *req =
-			mmpdu_body(client_frame);
-		size_t req_ies_len = (void *) client_frame + client_frame_len -
-			(void *) req->ies;
-		ssize_t req_wsc_data_size;
 
 		/*
-		 * Process the client Probe Request WSC IE first as it may
-		 * cause us to exit "active PBC mode" and that will be
-		 * immediately reflected in our Probe Response WSC IE.
+		 * Nothing here depends on the Probe Request so that the
+		 * result can be cached in ap->probe_resp_tmpl.  The client's
+		 * WSC IE is processed by ap_probe_req_cb before the template
+		 * is used.
 		 */
-		wsc_data = ie_tlv_extract_wsc_payload(req->ies, req_ies_len,
-							&req_wsc_data_size);
-		if (wsc_data) {
-			ap_process_wsc_probe_req(ap, from, wsc_data,
-							req_wsc_data_size);
-			l_free(wsc_data);
-		}
-
 		wsc_pr.version2 = true;
 		wsc_pr.state = WSC_STATE_CONFIGURED;
 
@@ -683,8 +1641,7 @@ static size_t ap_write_wsc_ie(struct ap_state *ap,
 			MPDU_MANAGEMENT_SUBTYPE_REASSOCIATION_RESPONSE)) {
 		const uint8_t *from = client_frame->address_2;
 		struct wsc_association_response wsc_resp = {};
-		struct sta_state *sta =
-			l_queue_find(ap->sta_states, ap_sta_match_addr, from);
+		struct sta_state *sta = ap_sta_find(ap, from);
 
 		if (!sta || sta->assoc_rsne)
 			return 0;
@@ -755,6 +1712,38 @@ static size_t ap_write_extra_ies(struct ap_state *ap,
 	return len;
 }
 
+/*
+ * With client steering enabled, advertise our load to the stations, which
+ * can then prefer the less loaded BSSes of the ESS, 802.11-2020 9.4.2.27.
+ */
+static size_t ap_write_bss_load_ie(struct ap_state *ap, uint8_t *out_buf)
+{
+	if (!ap->steer_neighbors_num)
+		return 0;
+
+	out_buf[0] = IE_TYPE_BSS_LOAD;
+	out_buf[1] = 5;
+	l_put_le16(ap->bss_load_stations, out_buf + 2);
+	out_buf[4] = ap->bss_load_utilization;
+	l_put_le16(0, out_buf + 5); /* Available Admission Capacity */
+
+	return 7;
+}
+
+/* BSS Transition support, needed for stations to accept our requests */
+static size_t ap_write_ext_capa_ie(struct ap_state *ap, uint8_t *out_buf)
+{
+	if (!ap->steer_neighbors_num)
+		return 0;
+
+	out_buf[0] = IE_TYPE_EXTENDED_CAPABILITIES;
+	out_buf[1] = 3;
+	memset(out_buf + 2, 0, 3);
+	set_bit(out_buf + 2, 19);
+
+	return 5;
+}
+
 /*
  * Build a Beacon frame or a Probe Response frame's header and body until
  * the TIM IE.  Except for the optional TIM IE which is inserted by the
@@ -839,16 +1828,77 @@ static size_t ap_build_beacon_pr_tail(struct ap_state *ap,
 
 	/* TODO: Country IE between TIM IE and RSNE */
 
+	len = ap_write_bss_load_ie(ap, out_buf);
+
 	/* RSNE */
 	ap_set_rsn_info(ap, &rsn);
-	if (!ie_build_rsne(&rsn, out_buf))
+	if (!ie_build_rsne(&rsn, out_buf + len))
 		return 0;
-	len = 2 + out_buf[1];
+	len += 2 + out_buf[len + 1];
 
+	len += ap_write_ext_capa_ie(ap, out_buf + len);
 	len += ap_write_extra_ies(ap, stype, req, req_len, out_buf + len);
 	return len;
 }
 
+/*
+ * Build the parts of the Probe Response that only change together with
+ * the Beacon, i.e. everything except the DA and the ap_ops extra IEs.
+ */
+static bool ap_build_probe_resp_tmpl(struct ap_state *ap)
+{
+	static const uint8_t bcast_addr[6] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+	};
+	size_t buf_len = 512 + ap_get_wsc_ie_len(ap,
+					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
+					NULL, 0);
+	uint8_t *buf = l_malloc(buf_len);
+	size_t len;
+	struct ie_rsn_info rsn;
+
+	len = ap_build_beacon_pr_head(ap,
+					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
+					bcast_addr, buf, buf_len);
+	len += ap_write_bss_load_ie(ap, buf + len);
+
+	ap_set_rsn_info(ap, &rsn);
+	if (!ie_build_rsne(&rsn, buf + len)) {
+		l_free(buf);
+		return false;
+	}
+
+	len += 2 + buf[len + 1];
+	len += ap_write_ext_capa_ie(ap, buf + len);
+	len += ap_write_wsc_ie(ap, MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
+				NULL, 0, buf + len);
+
+	ap->probe_resp_tmpl = buf;
+	ap->probe_resp_tmpl_len = len;
+	return true;
+}
+
+/*
+ * With Probe Response offload the driver gets the template at START_AP and
+ * SET_BEACON time.  It fills in the DA itself and expects it zeroed.
+ */
+static void ap_append_probe_resp_tmpl(struct ap_state *ap,
+					struct l_genl_msg *cmd)
+{
+	struct mmpdu_header *hdr;
+
+	if (!ap->probe_resp_offload)
+		return;
+
+	if (!ap->probe_resp_tmpl && !ap_build_probe_resp_tmpl(ap))
+		return;
+
+	hdr = (struct mmpdu_header *) ap->probe_resp_tmpl;
+	memset(hdr->address_1, 0, 6);
+	l_genl_msg_append_attr(cmd, NL80211_ATTR_PROBE_RESP,
+				ap->probe_resp_tmpl_len, ap->probe_resp_tmpl);
+}
+
 static void ap_set_beacon_cb(struct l_genl_msg *msg, void *user_data)
 {
 	int error = l_genl_msg_get_error(msg);
@@ -871,6 +1921,9 @@ void ap_update_beacon(struct ap_state *ap)
 		0xff, 0xff, 0xff, 0xff, 0xff, 0xff
 	};
 
+	/* Anything that changes the Beacon also changes the Probe Response */
+	l_free(l_steal_ptr(ap->probe_resp_tmpl));
+
 	if (L_WARN_ON(!ap->started))
 		return;
 
@@ -889,6 +1942,7 @@ void ap_update_beacon(struct ap_state *ap)
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_IE, 0, "");
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_IE_PROBE_RESP, 0, "");
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_IE_ASSOC_RESP, 0, "");
+	ap_append_probe_resp_tmpl(ap, cmd);
 
 	if (l_genl_family_send(ap->nl80211, cmd, ap_set_beacon_cb, NULL, NULL))
 		return;
@@ -897,21 +1951,29 @@ void ap_update_beacon(struct ap_state *ap)
 	l_error("Issuing SET_BEACON failed");
 }
 
+static uint32_t ap_send_mgmt_framev(struct ap_state *ap, struct iovec *iov,
+					frame_xchg_cb_t callback,
+					void *user_data)
+{
+	uint32_t ch_freq = band_channel_to_freq(ap->channel, BAND_FREQ_2_4_GHZ);
+	uint64_t wdev_id = netdev_get_wdev_id(ap->netdev);
+
+	return frame_xchg_start(wdev_id, iov, ch_freq, 0, 0, 0, 0,
+					callback, user_data, NULL, NULL);
+}
+
 static uint32_t ap_send_mgmt_frame(struct ap_state *ap,
 					const struct mmpdu_header *frame,
 					size_t frame_len,
 					frame_xchg_cb_t callback,
 					void *user_data)
 {
-	uint32_t ch_freq = band_channel_to_freq(ap->channel, BAND_FREQ_2_4_GHZ);
-	uint64_t wdev_id = netdev_get_wdev_id(ap->netdev);
 	struct iovec iov[2];
 
 	iov[0].iov_base = (void *) frame;
 	iov[0].iov_len = frame_len;
 	iov[1].iov_base = NULL;
-	return frame_xchg_start(wdev_id, iov, ch_freq, 0, 0, 0, 0,
-					callback, user_data, NULL, NULL);
+	return ap_send_mgmt_framev(ap, iov, callback, user_data);
 }
 
 #define IP4_FROM_STR(str)						\
@@ -944,6 +2006,10 @@ static void ap_start_handshake(struct sta_state *sta, bool use_eapol_start,
 		handshake_state_set_gtk(sta->hs, sta->ap->gtk,
 					sta->ap->gtk_index, gtk_rsc);
 
+	if (sta->hs->mfp)
+		handshake_state_set_igtk(sta->hs, ap->igtk, ap->igtk_index,
+						sta->igtk_ipn);
+
 	if (ap->netconfig_dhcp)
 		sta->hs->support_ip_allocation = true;
 
@@ -968,14 +2034,18 @@ error:
 
 static bool ap_sta_get_dhcp4_lease(struct sta_state *sta)
 {
+	const struct ap_lease *lease;
+
 	if (sta->ip_alloc_lease)
 		return true;
 
 	if (!sta->ap->netconfig_dhcp)
 		return false;
 
+	lease = l_hashmap_lookup(sta->ap->leases, sta->addr);
 	sta->ip_alloc_lease = l_dhcp_server_discover(sta->ap->netconfig_dhcp,
-							0, NULL, sta->addr);
+						lease ? lease->address : 0,
+						NULL, sta->addr);
 	if (!sta->ip_alloc_lease) {
 		l_error("l_dhcp_server_discover() failed, see IWD_DHCP_DEBUG "
 			"output");
@@ -1016,6 +2086,9 @@ static void ap_handshake_event(struct handshake_state *hs,
 
 		ap_new_rsna(sta);
 		break;
+	case HANDSHAKE_EVENT_GROUP_REKEY_COMPLETE:
+		ap_gtk_rekey_sta_done(sta);
+		break;
 	case HANDSHAKE_EVENT_FAILED:
 		netdev_handshake_failed(hs, va_arg(args, int));
 		/* fall through */
@@ -1045,15 +2118,108 @@ static void ap_handshake_event(struct handshake_state *hs,
 	va_end(args);
 }
 
-static void ap_start_rsna(struct sta_state *sta, const uint8_t *gtk_rsc)
+static void ap_start_rsna(struct sta_state *sta, const uint8_t *gtk_rsc)
+{
+	/* this handshake setup assumes PSK network */
+	sta->hs = netdev_handshake_state_new(sta->ap->netdev);
+	handshake_state_set_authenticator(sta->hs, true);
+	handshake_state_set_event_func(sta->hs, ap_handshake_event, sta);
+	handshake_state_set_supplicant_ie(sta->hs, sta->assoc_rsne);
+	/* Only use MFP if both sides are capable, not just the station */
+	sta->hs->mfp = sta->mfp;
+	if (IE_AKM_IS_SAE(sta->hs->akm_suite) && sta->sae_hs)
+		handshake_state_set_pmk(sta->hs, sta->sae_hs->pmk, 32);
+	else
+		handshake_state_set_pmk(sta->hs, sta->ap->psk, 32);
+
+	ap_start_handshake(sta, false, gtk_rsc);
+}
+
+/*
+ * After an AP restart every client comes back at once.  To keep the
+ * daemon responsive and avoid starving clients halfway through their
+ * 4-Way Handshake, at most max_handshakes run at a time.  The others
+ * wait their turn in association order and new associations get refused
+ * once the backlog is AP_HANDSHAKE_BACKLOG times the limit.
+ */
+#define AP_HANDSHAKE_BACKLOG	4
+
+static void ap_handshake_start_queued(struct l_idle *idle, void *user_data)
+{
+	struct ap_state *ap = user_data;
+	struct sta_state *sta;
+
+	l_idle_remove(l_steal_ptr(ap->handshake_idle));
+
+	while (ap->handshakes_active < ap->max_handshakes &&
+			(sta = l_queue_pop_head(ap->handshake_queue))) {
+		sta->handshake_queued = false;
+		sta->handshake_admitted = true;
+		ap->handshakes_active++;
+
+		ap_start_rsna(sta, sta->have_gtk_rsc ? sta->gtk_rsc : NULL);
+	}
+}
+
+static void ap_handshake_release(struct sta_state *sta)
+{
+	struct ap_state *ap = sta->ap;
+
+	if (sta->handshake_queued) {
+		l_queue_remove(ap->handshake_queue, sta);
+		sta->handshake_queued = false;
+	}
+
+	if (!sta->handshake_admitted)
+		return;
+
+	sta->handshake_admitted = false;
+	ap->handshakes_active--;
+
+	/* Start the next one from a clean stack */
+	if (!l_queue_isempty(ap->handshake_queue) && !ap->handshake_idle)
+		ap->handshake_idle = l_idle_create(ap_handshake_start_queued,
+							ap, NULL);
+}
+
+static void ap_handshake_admit(struct sta_state *sta, const uint8_t *gtk_rsc)
+{
+	struct ap_state *ap = sta->ap;
+
+	if (!ap->max_handshakes) {
+		ap_start_rsna(sta, gtk_rsc);
+		return;
+	}
+
+	if (ap->handshakes_active < ap->max_handshakes &&
+			l_queue_isempty(ap->handshake_queue)) {
+		sta->handshake_admitted = true;
+		ap->handshakes_active++;
+		ap_start_rsna(sta, gtk_rsc);
+		return;
+	}
+
+	l_debug("Queueing handshake with "MAC", %u active", MAC_STR(sta->addr),
+		ap->handshakes_active);
+
+	sta->have_gtk_rsc = gtk_rsc != NULL;
+	if (gtk_rsc)
+		memcpy(sta->gtk_rsc, gtk_rsc, 6);
+
+	if (!ap->handshake_queue)
+		ap->handshake_queue = l_queue_new();
+
+	l_queue_push_tail(ap->handshake_queue, sta);
+	sta->handshake_queued = true;
+}
+
+static bool ap_handshake_backlog_full(struct ap_state *ap)
 {
-	/* this handshake setup assumes PSK network */
-	sta->hs = netdev_handshake_state_new(sta->ap->netdev);
-	handshake_state_set_authenticator(sta->hs, true);
-	handshake_state_set_event_func(sta->hs, ap_handshake_event, sta);
-	handshake_state_set_supplicant_ie(sta->hs, sta->assoc_rsne);
-	handshake_state_set_pmk(sta->hs, sta->ap->psk, 32);
-	ap_start_handshake(sta, false, gtk_rsc);
+	if (!ap->max_handshakes)
+		return false;
+
+	return l_queue_length(ap->handshake_queue) >=
+				ap->max_handshakes * AP_HANDSHAKE_BACKLOG;
 }
 
 static void ap_gtk_query_cb(struct l_genl_msg *msg, void *user_data)
@@ -1073,13 +2239,58 @@ static void ap_gtk_query_cb(struct l_genl_msg *msg, void *user_data)
 		gtk_rsc = zero_gtk_rsc;
 	}
 
-	ap_start_rsna(sta, gtk_rsc);
+	ap_handshake_admit(sta, gtk_rsc);
 	return;
 
 error:
 	ap_del_station(sta, MMPDU_REASON_CODE_UNSPECIFIED, true);
 }
 
+static bool ap_query_group_key(struct sta_state *sta, uint8_t key_index,
+				l_genl_msg_func_t cb)
+{
+	struct ap_state *ap = sta->ap;
+	struct l_genl_msg *msg;
+
+	msg = nl80211_build_get_key(netdev_get_ifindex(ap->netdev), key_index);
+	sta->gtk_query_cmd_id = l_genl_family_send(ap->nl80211, msg, cb,
+							sta, NULL);
+	if (!sta->gtk_query_cmd_id) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing GET_KEY failed");
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * For MFP stations the current IPN of the IGTK is queried first, the same
+ * way as the GTK RSC, then the GTK query follows as for everyone else.
+ */
+static void ap_igtk_query_cb(struct l_genl_msg *msg, void *user_data)
+{
+	struct sta_state *sta = user_data;
+	const void *ipn;
+
+	sta->gtk_query_cmd_id = 0;
+
+	if (l_genl_msg_get_error(msg) < 0)
+		goto error;
+
+	ipn = nl80211_parse_get_key_seq(msg);
+	if (ipn)
+		memcpy(sta->igtk_ipn, ipn, 6);
+	else
+		memset(sta->igtk_ipn, 0, 6);
+
+	if (ap_query_group_key(sta, sta->ap->gtk_index, ap_gtk_query_cb))
+		return;
+
+error:
+	ap_del_station(sta, MMPDU_REASON_CODE_UNSPECIFIED, true);
+}
+
 static void ap_stop_handshake_schedule(struct sta_state *sta)
 {
 	if (sta->stop_handshake_work)
@@ -1095,7 +2306,6 @@ static void ap_wsc_handshake_event(struct handshake_state *hs,
 	struct sta_state *sta = user_data;
 	va_list args;
 	struct ap_event_registration_success_data event_data;
-	struct ap_pbc_record_expiry_data expiry_data;
 
 	va_start(args, user_data);
 
@@ -1127,11 +2337,7 @@ static void ap_wsc_handshake_event(struct handshake_state *hs,
 		 * are removed from the Monitor Time check the next time the
 		 * Registrar's PBC button is pressed."
 		 */
-		expiry_data.min_time = 0;
-		expiry_data.mac = sta->addr;
-		l_queue_foreach_remove(sta->ap->wsc_pbc_probes,
-					ap_wsc_pbc_record_expire,
-					&expiry_data);
+		ap_wsc_pbc_remove_addr(sta->ap, sta->addr);
 
 		event_data.mac = sta->addr;
 		ap_event(sta->ap, AP_EVENT_REGISTRATION_SUCCESS, &event_data);
@@ -1186,21 +2392,6 @@ static void ap_start_eap_wsc(struct sta_state *sta)
 	ap_start_handshake(sta, wait_for_eapol_start, NULL);
 }
 
-static struct l_genl_msg *ap_build_cmd_del_key(struct ap_state *ap)
-{
-	uint32_t ifindex = netdev_get_ifindex(ap->netdev);
-	struct l_genl_msg *msg;
-
-	msg = l_genl_msg_new_sized(NL80211_CMD_DEL_KEY, 128);
-
-	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &ifindex);
-	l_genl_msg_enter_nested(msg, NL80211_ATTR_KEY);
-	l_genl_msg_append_attr(msg, NL80211_KEY_IDX, 1, &ap->gtk_index);
-	l_genl_msg_leave_nested(msg);
-
-	return msg;
-}
-
 static struct l_genl_msg *ap_build_cmd_new_station(struct sta_state *sta)
 {
 	struct l_genl_msg *msg;
@@ -1218,6 +2409,9 @@ static struct l_genl_msg *ap_build_cmd_new_station(struct sta_state *sta)
 			(1 << NL80211_STA_FLAG_ASSOCIATED),
 	};
 
+	if (sta->mfp)
+		flags.set |= 1 << NL80211_STA_FLAG_MFP;
+
 	msg = l_genl_msg_new_sized(NL80211_CMD_NEW_STATION, 300);
 
 	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &ifindex);
@@ -1227,20 +2421,6 @@ static struct l_genl_msg *ap_build_cmd_new_station(struct sta_state *sta)
 	return msg;
 }
 
-static void ap_gtk_op_cb(struct l_genl_msg *msg, void *user_data)
-{
-	if (l_genl_msg_get_error(msg) < 0) {
-		uint8_t cmd = l_genl_msg_get_command(msg);
-		const char *cmd_name =
-			cmd == NL80211_CMD_NEW_KEY ? "NEW_KEY" :
-			cmd == NL80211_CMD_SET_KEY ? "SET_KEY" :
-			"DEL_KEY";
-
-		l_error("%s failed for the GTK: %i",
-			cmd_name, l_genl_msg_get_error(msg));
-	}
-}
-
 static void ap_associate_sta_cb(struct l_genl_msg *msg, void *user_data)
 {
 	struct sta_state *sta = user_data;
@@ -1317,27 +2497,36 @@ static void ap_associate_sta_cb(struct l_genl_msg *msg, void *user_data)
 			goto error;
 		}
 
+		/* The IGTK, if MFP is enabled, is created together with it */
+		if (ap->mfpc) {
+			l_getrandom(ap->igtk, 16);
+			ap->igtk_index = 4;
+
+			if (!ap_install_igtk(ap, ap->igtk_index, ap->igtk) ||
+					!ap_set_igtk_default(ap))
+				goto error;
+		}
+
 		/*
 		 * Set the flag now because any new associating STA will
 		 * just use NL80211_CMD_GET_KEY from now.
 		 */
 		ap->gtk_set = true;
+
+		if (ap->gtk_rekey_interval)
+			ap->gtk_rekey_timeout = l_timeout_create(
+						ap->gtk_rekey_interval,
+						ap_gtk_rekey_timeout_cb,
+						ap, NULL);
 	}
 
 	if (ap->group_cipher == IE_RSN_CIPHER_SUITE_NO_GROUP_TRAFFIC)
-		ap_start_rsna(sta, NULL);
-	else {
-		msg = nl80211_build_get_key(netdev_get_ifindex(ap->netdev),
-					ap->gtk_index);
-		sta->gtk_query_cmd_id = l_genl_family_send(ap->nl80211, msg,
-								ap_gtk_query_cb,
-								sta, NULL);
-		if (!sta->gtk_query_cmd_id) {
-			l_genl_msg_unref(msg);
-			l_error("Issuing GET_KEY failed");
+		ap_handshake_admit(sta, NULL);
+	else if (sta->mfp) {
+		if (!ap_query_group_key(sta, ap->igtk_index, ap_igtk_query_cb))
 			goto error;
-		}
-	}
+	} else if (!ap_query_group_key(sta, ap->gtk_index, ap_gtk_query_cb))
+		goto error;
 
 	return;
 
@@ -1639,11 +2828,14 @@ static void ap_assoc_reassoc(struct sta_state *sta, bool reassoc,
 	_auto_(l_uintset_free) struct l_uintset *rates = NULL;
 	struct ie_rsn_info rsn_info;
 	int err;
+	struct ie_index index;
 	struct ie_tlv_iter iter;
 	_auto_(l_free) uint8_t *wsc_data = NULL;
 	ssize_t wsc_data_len;
 	bool fils_ip_req = false;
 	struct ie_fils_ip_addr_request_info fils_ip_req_info;
+	bool bss_transition = false;
+	bool mfp = false;
 
 	if (sta->assoc_resp_cmd_id)
 		return;
@@ -1653,55 +2845,61 @@ static void ap_assoc_reassoc(struct sta_state *sta, bool reassoc,
 		goto unsupported;
 	}
 
-	wsc_data = ie_tlv_extract_wsc_payload(ies, ies_len, &wsc_data_len);
+	if (!sta->associated && ap_handshake_backlog_full(ap)) {
+		l_debug("Handshake backlog full, refusing "MAC,
+			MAC_STR(sta->addr));
+		err = MMPDU_STATUS_CODE_DENIED_NO_MORE_STAS;
+		goto unsupported;
+	}
 
-	ie_tlv_iter_init(&iter, ies, ies_len);
+	ie_index_init(&index, ies, ies_len);
 
-	while (ie_tlv_iter_next(&iter))
-		switch (ie_tlv_iter_get_tag(&iter)) {
-		case IE_TYPE_SSID:
-			ssid = (const char *) ie_tlv_iter_get_data(&iter);
-			ssid_len = ie_tlv_iter_get_length(&iter);
-			break;
+	wsc_data = ie_index_extract_wsc_payload(&index, &wsc_data_len);
 
-		case IE_TYPE_SUPPORTED_RATES:
-		case IE_TYPE_EXTENDED_SUPPORTED_RATES:
-			if (ap_parse_supported_rates(&iter, &rates) < 0) {
-				err = MMPDU_REASON_CODE_INVALID_IE;
-				goto bad_frame;
-			}
+	if (ie_index_get(&index, IE_TYPE_SSID, &iter)) {
+		ssid = (const char *) ie_tlv_iter_get_data(&iter);
+		ssid_len = ie_tlv_iter_get_length(&iter);
+	}
 
-			break;
+	if (ie_index_get(&index, IE_TYPE_SUPPORTED_RATES, &iter) &&
+			ap_parse_supported_rates(&iter, &rates) < 0) {
+		err = MMPDU_REASON_CODE_INVALID_IE;
+		goto bad_frame;
+	}
 
-		case IE_TYPE_RSN:
-			/*
-			 * WSC v2.0.5 Section 8.2:
-			 * "Note that during the WSC association [...] the
-			 * RSN IE and the WPA IE are irrelevant and shall be
-			 * ignored by both the station and AP."
-			 */
-			if (wsc_data)
-				break;
+	if (ie_index_get(&index, IE_TYPE_EXTENDED_SUPPORTED_RATES, &iter) &&
+			ap_parse_supported_rates(&iter, &rates) < 0) {
+		err = MMPDU_REASON_CODE_INVALID_IE;
+		goto bad_frame;
+	}
 
-			if (ie_parse_rsne(&iter, &rsn_info) < 0) {
-				err = MMPDU_REASON_CODE_INVALID_IE;
-				goto bad_frame;
-			}
+	/*
+	 * WSC v2.0.5 Section 8.2:
+	 * "Note that during the WSC association [...] the
+	 * RSN IE and the WPA IE are irrelevant and shall be
+	 * ignored by both the station and AP."
+	 */
+	if (!wsc_data && ie_index_get(&index, IE_TYPE_RSN, &iter)) {
+		if (ie_parse_rsne(&iter, &rsn_info) < 0) {
+			err = MMPDU_REASON_CODE_INVALID_IE;
+			goto bad_frame;
+		}
 
-			rsn = (const uint8_t *) ie_tlv_iter_get_data(&iter) - 2;
-			break;
+		rsn = (const uint8_t *) ie_tlv_iter_get_data(&iter) - 2;
+	}
 
-		case IE_TYPE_FILS_IP_ADDRESS:
-			if (fils_ip_req || ie_parse_fils_ip_addr_request(&iter,
-						&fils_ip_req_info) < 0) {
-				l_debug("Can't parse FILS IP Address Assignment"
-					" IE, ignoring it");
-				break;
-			}
+	if (ie_index_get(&index, IE_TYPE_EXTENDED_CAPABILITIES, &iter) &&
+			ie_tlv_iter_get_length(&iter) >= 3)
+		bss_transition = test_bit(ie_tlv_iter_get_data(&iter), 19);
 
+	if (ie_index_get(&index, IE_TYPE_FILS_IP_ADDRESS, &iter)) {
+		if (ie_parse_fils_ip_addr_request(&iter,
+						&fils_ip_req_info) < 0)
+			l_debug("Can't parse FILS IP Address Assignment"
+				" IE, ignoring it");
+		else
 			fils_ip_req = true;
-			break;
-		}
+	}
 
 	if (!rates || !ssid || (!wsc_data && !rsn) ||
 			ssid_len != strlen(ap->ssid) ||
@@ -1788,7 +2986,13 @@ static void ap_assoc_reassoc(struct sta_state *sta, bool reassoc,
 			goto unsupported;
 		}
 
-		if (rsn_info.akm_suites != IE_RSN_AKM_SUITE_PSK) {
+		if (rsn_info.akm_suites == IE_RSN_AKM_SUITE_SAE_SHA256) {
+			/* The PMK only exists once SAE has been accepted */
+			if (!ap->sae_enabled || !sta->sae_accepted) {
+				err = MMPDU_REASON_CODE_INVALID_AKMP;
+				goto unsupported;
+			}
+		} else if (rsn_info.akm_suites != IE_RSN_AKM_SUITE_PSK) {
 			err = MMPDU_REASON_CODE_INVALID_AKMP;
 			goto unsupported;
 		}
@@ -1797,6 +3001,26 @@ static void ap_assoc_reassoc(struct sta_state *sta, bool reassoc,
 			err = MMPDU_REASON_CODE_INVALID_GROUP_CIPHER;
 			goto unsupported;
 		}
+
+		/*
+		 * 802.11-2020 Section 12.6.3: refuse a station requiring MFP
+		 * we don't offer.  WPA3 Specification version 3, Section 2.3
+		 * requires MFP to be negotiated whenever SAE is used.
+		 */
+		if ((rsn_info.mfpr && !ap->mfpc) ||
+				(IE_AKM_IS_SAE(rsn_info.akm_suites) &&
+					!rsn_info.mfpc)) {
+			err = MMPDU_REASON_CODE_INVALID_RSN_IE_CAP;
+			goto unsupported;
+		}
+
+		mfp = ap->mfpc && rsn_info.mfpc;
+
+		if (mfp && rsn_info.group_management_cipher !=
+				IE_RSN_CIPHER_SUITE_BIP) {
+			err = MMPDU_REASON_CODE_CIPHER_SUITE_REJECTED;
+			goto unsupported;
+		}
 	}
 
 	/* 802.11-2016 11.3.5.3 j) */
@@ -1817,6 +3041,8 @@ static void ap_assoc_reassoc(struct sta_state *sta, bool reassoc,
 
 	sta->capability = *capability;
 	sta->listen_interval = listen_interval;
+	sta->bss_transition = bss_transition;
+	sta->mfp = mfp;
 
 	if (sta->rates)
 		l_uintset_free(sta->rates);
@@ -1885,7 +3111,7 @@ static void ap_assoc_req_cb(const struct mmpdu_header *hdr, const void *body,
 			memcmp(hdr->address_3, bssid, 6))
 		return;
 
-	sta = l_queue_find(ap->sta_states, ap_sta_match_addr, from);
+	sta = ap_sta_find(ap, from);
 	if (!sta) {
 		if (!ap_assoc_resp(ap, NULL, from,
 				MMPDU_REASON_CODE_STA_REQ_ASSOC_WITHOUT_AUTH,
@@ -1919,7 +3145,7 @@ static void ap_reassoc_req_cb(const struct mmpdu_header *hdr, const void *body,
 			memcmp(hdr->address_3, bssid, 6))
 		return;
 
-	sta = l_queue_find(ap->sta_states, ap_sta_match_addr, from);
+	sta = ap_sta_find(ap, from);
 	if (!sta) {
 		err = MMPDU_REASON_CODE_STA_REQ_ASSOC_WITHOUT_AUTH;
 		goto bad_frame;
@@ -1957,6 +3183,24 @@ static void ap_probe_resp_cb(int err, void *user_data)
  * Parse Probe Request according to 802.11-2016 9.3.3.10 and act according
  * to 802.11-2016 11.1.4.3
  */
+static void ap_probe_req_process_wsc(struct ap_state *ap,
+					const struct mmpdu_header *hdr,
+					const struct mmpdu_probe_request *req,
+					size_t body_len)
+{
+	uint8_t *wsc_data;
+	ssize_t wsc_data_size;
+
+	wsc_data = ie_tlv_extract_wsc_payload(req->ies,
+						body_len - sizeof(*req),
+						&wsc_data_size);
+	if (!wsc_data)
+		return;
+
+	ap_process_wsc_probe_req(ap, hdr->address_2, wsc_data, wsc_data_size);
+	l_free(wsc_data);
+}
+
 static void ap_probe_req_cb(const struct mmpdu_header *hdr, const void *body,
 				size_t body_len, int rssi, void *user_data)
 {
@@ -1969,12 +3213,18 @@ static void ap_probe_req_cb(const struct mmpdu_header *hdr, const void *body,
 	struct ie_tlv_iter iter;
 	const uint8_t *bssid = netdev_get_address(ap->netdev);
 	bool match = false;
-	uint32_t resp_len;
-	uint8_t *resp;
+	const struct mmpdu_header *client_frame = hdr;
+	size_t client_frame_len = body + body_len - (void *) hdr;
+	L_AUTO_FREE_VAR(uint8_t *, extra_ies) = NULL;
+	size_t extra_ies_len = 0;
+	struct iovec iov[3];
 
 	l_info("AP Probe Request from %s",
 		util_address_to_string(hdr->address_2));
 
+	if (!ap_mac_allowed(ap, hdr->address_2))
+		return;
+
 	ie_tlv_iter_init(&iter, req->ies, body_len - sizeof(*req));
 
 	while (ie_tlv_iter_next(&iter))
@@ -2042,21 +3292,52 @@ static void ap_probe_req_cb(const struct mmpdu_header *hdr, const void *body,
 	if (!match)
 		return;
 
-	resp_len = 512 + ap_get_extra_ies_len(ap,
-					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
-					hdr, body + body_len - (void *) hdr);
-	resp = l_new(uint8_t, resp_len);
-	len = ap_build_beacon_pr_head(ap,
+	/*
+	 * Process the client Probe Request WSC IE first as it may cause us
+	 * to exit "active PBC mode" and that will be immediately reflected
+	 * in our Probe Response WSC IE since the template is dropped by
+	 * ap_update_beacon().
+	 */
+	ap_probe_req_process_wsc(ap, hdr, req, body_len);
+
+	/* The driver replies using the template from ap_update_beacon() */
+	if (ap->probe_resp_offload)
+		return;
+
+	if (!ap->probe_resp_tmpl && !ap_build_probe_resp_tmpl(ap))
+		return;
+
+	/* The DA is the only field in our part of the frame that varies */
+	memcpy(((struct mmpdu_header *) ap->probe_resp_tmpl)->address_1,
+		hdr->address_2, 6);
+
+	iov[0].iov_base = ap->probe_resp_tmpl;
+	iov[0].iov_len = ap->probe_resp_tmpl_len;
+	iov[1].iov_base = NULL;
+
+	/*
+	 * The P2P and WFD IEs depend on the contents of the Probe Request
+	 * so let the ap_ops user append them to the cached frame each time.
+	 */
+	if (ap->ops->write_extra_ies) {
+		len = ap->ops->get_extra_ies_len(
 					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
-					hdr->address_2, resp, resp_len);
-	len += ap_build_beacon_pr_tail(ap,
+					client_frame, client_frame_len,
+					ap->user_data);
+		extra_ies = l_malloc(len);
+		extra_ies_len = ap->ops->write_extra_ies(
 					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
-					hdr, body + body_len - (void *) hdr,
-					resp + len);
+					client_frame, client_frame_len,
+					extra_ies, ap->user_data);
+	}
+
+	if (extra_ies_len) {
+		iov[1].iov_base = extra_ies;
+		iov[1].iov_len = extra_ies_len;
+		iov[2].iov_base = NULL;
+	}
 
-	ap_send_mgmt_frame(ap, (struct mmpdu_header *) resp, len,
-				ap_probe_resp_cb, NULL);
-	l_free(resp);
+	ap_send_mgmt_framev(ap, iov, ap_probe_resp_cb, NULL);
 }
 
 /* 802.11-2016 9.3.3.5 (frame format), 802.11-2016 11.3.5.9 (MLME/SME) */
@@ -2076,7 +3357,7 @@ static void ap_disassoc_cb(const struct mmpdu_header *hdr, const void *body,
 			memcmp(hdr->address_3, bssid, 6))
 		return;
 
-	sta = l_queue_find(ap->sta_states, ap_sta_match_addr, hdr->address_2);
+	sta = ap_sta_find(ap, hdr->address_2);
 
 	if (sta && sta->assoc_resp_cmd_id) {
 		l_genl_family_cancel(ap->nl80211, sta->assoc_resp_cmd_id);
@@ -2128,6 +3409,228 @@ static void ap_auth_reply(struct ap_state *ap, const uint8_t *dest,
 				ap_auth_reply_cb, NULL);
 }
 
+static void ap_sae_send(struct ap_state *ap, const uint8_t *dest,
+				const uint8_t *body, size_t body_len)
+{
+	const uint8_t *addr = netdev_get_address(ap->netdev);
+	size_t len = sizeof(struct mmpdu_header) + 2 + body_len;
+	_auto_(l_free) uint8_t *mpdu_buf = l_malloc(len);
+	struct mmpdu_header *mpdu = (struct mmpdu_header *) mpdu_buf;
+	uint8_t *ptr;
+
+	memset(mpdu, 0, sizeof(*mpdu));
+
+	/* Header */
+	mpdu->fc.protocol_version = 0;
+	mpdu->fc.type = MPDU_TYPE_MANAGEMENT;
+	mpdu->fc.subtype = MPDU_MANAGEMENT_SUBTYPE_AUTHENTICATION;
+	memcpy(mpdu->address_1, dest, 6);	/* DA */
+	memcpy(mpdu->address_2, addr, 6);	/* SA */
+	memcpy(mpdu->address_3, addr, 6);	/* BSSID */
+
+	/* SAE hands us everything after the Algorithm Number */
+	ptr = (uint8_t *) mmpdu_body(mpdu);
+	l_put_le16(MMPDU_AUTH_ALGO_SAE, ptr);
+	memcpy(ptr + 2, body, body_len);
+
+	ap_send_mgmt_frame(ap, mpdu, ptr + 2 + body_len - mpdu_buf,
+				ap_auth_reply_cb, NULL);
+}
+
+static void ap_sae_tx_auth(const uint8_t *data, size_t len, void *user_data)
+{
+	struct sta_state *sta = user_data;
+
+	ap_sae_send(sta->ap, sta->addr, data, len);
+}
+
+static void ap_sae_tx_assoc(void *user_data)
+{
+	struct sta_state *sta = user_data;
+
+	l_debug("SAE with %s accepted", util_address_to_string(sta->addr));
+
+	sta->sae_accepted = true;
+}
+
+static void ap_sae_token(struct ap_state *ap, const uint8_t *addr,
+				uint8_t *out_token)
+{
+	hmac_sha256(ap->sae_token_key, sizeof(ap->sae_token_key), addr, 6,
+			out_token, AP_SAE_TOKEN_LEN);
+}
+
+static void ap_sae_request_token(struct ap_state *ap, const uint8_t *dest,
+					uint16_t group)
+{
+	uint8_t body[6 + AP_SAE_TOKEN_LEN];
+
+	l_put_le16(1, body);
+	l_put_le16(MMPDU_STATUS_CODE_ANTI_CLOGGING_TOKEN_REQ, body + 2);
+	l_put_le16(group, body + 4);
+	ap_sae_token(ap, dest, body + 6);
+
+	ap_sae_send(ap, dest, body, sizeof(body));
+}
+
+/*
+ * Check whether the Commit carries the anti-clogging token we handed out to
+ * this station.  The token is stripped before the frame is given to the SAE
+ * state machine which has no notion of tokens on the authenticator side.
+ */
+static bool ap_sae_find_token(struct ap_state *ap, const uint8_t *from,
+				const uint8_t *commit, size_t commit_len)
+{
+	const struct l_ecc_curve *curve;
+	uint8_t token[AP_SAE_TOKEN_LEN];
+	size_t nbytes;
+
+	if (commit_len < 2)
+		return false;
+
+	curve = l_ecc_curve_from_ike_group(l_get_le16(commit));
+	if (!curve)
+		return false;
+
+	/* Group, Token, Scalar, Element */
+	nbytes = l_ecc_curve_get_scalar_bytes(curve);
+	if (commit_len != 2 + AP_SAE_TOKEN_LEN + nbytes * 3)
+		return false;
+
+	ap_sae_token(ap, from, token);
+
+	return !l_secure_memcmp(commit + 2, token, AP_SAE_TOKEN_LEN);
+}
+
+static void ap_sae_work_idle(struct l_idle *idle, void *user_data)
+{
+	struct ap_state *ap = user_data;
+	struct ap_sae_work *work = l_queue_pop_head(ap->sae_work);
+	struct sta_state *sta;
+	int r;
+
+	if (l_queue_isempty(ap->sae_work))
+		l_idle_remove(l_steal_ptr(ap->sae_work_idle));
+
+	if (!work)
+		return;
+
+	sta = work->sta;
+
+	/* Our own Commit goes out before we process theirs */
+	if (!sta->sae) {
+		sta->sae = sae_sm_new(sta->sae_hs, ap_sae_tx_auth,
+					ap_sae_tx_assoc, sta);
+
+		if (!auth_proto_start(sta->sae)) {
+			r = -EPROTO;
+			goto done;
+		}
+	}
+
+	r = auth_proto_rx_authenticate(sta->sae, work->frame, work->frame_len);
+
+done:
+	l_free(work);
+
+	if (r == 0 || r == -EAGAIN || r == -ENOMSG || r == -EBADMSG)
+		return;
+
+	l_debug("SAE with %s failed: %i", util_address_to_string(sta->addr),
+			r);
+
+	if (sta->associated)
+		ap_sae_free(sta);
+	else
+		ap_remove_sta(sta);
+}
+
+static void ap_sae_auth(struct ap_state *ap, const struct mmpdu_header *hdr,
+			const struct mmpdu_authentication *auth,
+			size_t body_len)
+{
+	const uint8_t *from = hdr->address_2;
+	uint16_t trans = L_LE16_TO_CPU(auth->transaction_sequence);
+	size_t hdr_len = (const uint8_t *) auth->ies - (const uint8_t *) hdr;
+	size_t ies_len = body_len - ((const uint8_t *) auth->ies -
+					(const uint8_t *) auth);
+	struct sta_state *sta = ap_sta_find(ap, from);
+	unsigned int depth = l_queue_length(ap->sae_work);
+	struct ap_sae_work *work;
+	size_t skip = 0;
+
+	switch (trans) {
+	case 1:
+		if (depth >= AP_SAE_MAX_PENDING) {
+			l_debug("SAE queue full, dropping commit from %s",
+				util_address_to_string(from));
+			return;
+		}
+
+		if (!L_LE16_TO_CPU(auth->status) &&
+				ap_sae_find_token(ap, from, auth->ies, ies_len))
+			skip = AP_SAE_TOKEN_LEN;
+
+		if (!skip && depth >= AP_SAE_ANTI_CLOGGING_THRESHOLD &&
+				ies_len >= 2) {
+			ap_sae_request_token(ap, from, l_get_le16(auth->ies));
+			return;
+		}
+
+		/* A new Commit after acceptance restarts the exchange */
+		if (sta && sta->sae_accepted) {
+			ap_sae_free(sta);
+			sta->sae_accepted = false;
+		}
+
+		if (!sta) {
+			sta = l_new(struct sta_state, 1);
+			memcpy(sta->addr, from, 6);
+			sta->ap = ap;
+
+			ap_sta_add(ap, sta);
+		}
+
+		break;
+	case 2:
+		if (!sta || !sta->sae_hs)
+			return;
+
+		break;
+	default:
+		return;
+	}
+
+	if (!sta->sae_hs) {
+		sta->sae_hs = netdev_handshake_state_new(ap->netdev);
+		handshake_state_set_authenticator(sta->sae_hs, true);
+		handshake_state_set_supplicant_address(sta->sae_hs, from);
+		handshake_state_set_authenticator_address(sta->sae_hs,
+					netdev_get_address(ap->netdev));
+		handshake_state_set_passphrase(sta->sae_hs, ap->passphrase);
+	}
+
+	/* Copy the frame without the anti-clogging token, if any */
+	work = l_malloc(sizeof(struct ap_sae_work) + hdr_len + ies_len - skip);
+	work->sta = sta;
+	work->frame_len = hdr_len + ies_len - skip;
+
+	if (skip) {
+		memcpy(work->frame, hdr, hdr_len + 2);
+		memcpy(work->frame + hdr_len + 2, auth->ies + 2 + skip,
+			ies_len - 2 - skip);
+	} else
+		memcpy(work->frame, hdr, hdr_len + ies_len);
+
+	if (!ap->sae_work)
+		ap->sae_work = l_queue_new();
+
+	l_queue_push_tail(ap->sae_work, work);
+
+	if (!ap->sae_work_idle)
+		ap->sae_work_idle = l_idle_create(ap_sae_work_idle, ap, NULL);
+}
+
 /*
  * 802.11-2016 9.3.3.12 (frame format), 802.11-2016 11.3.4.3 and
  * 802.11-2016 12.3.3.2 (MLME/SME)
@@ -2147,21 +3650,19 @@ static void ap_auth_cb(const struct mmpdu_header *hdr, const void *body,
 			memcmp(hdr->address_3, bssid, 6))
 		return;
 
-	if (ap->authorized_macs_num) {
-		unsigned int i;
-
-		for (i = 0; i < ap->authorized_macs_num; i++)
-			if (!memcmp(from, ap->authorized_macs + i * 6,
-					6))
-				break;
+	if (!ap_mac_allowed(ap, from) || (ap->authorized_macs.num &&
+			!ap_mac_list_contains(&ap->authorized_macs, from))) {
+		ap_auth_reply(ap, from, MMPDU_REASON_CODE_UNSPECIFIED);
+		return;
+	}
 
-		if (i == ap->authorized_macs_num) {
-			ap_auth_reply(ap, from, MMPDU_REASON_CODE_UNSPECIFIED);
-			return;
-		}
+	if (ap->sae_enabled &&
+			L_LE16_TO_CPU(auth->algorithm) == MMPDU_AUTH_ALGO_SAE) {
+		ap_sae_auth(ap, hdr, auth, body_len);
+		return;
 	}
 
-	/* Only Open System authentication implemented here */
+	/* Otherwise only Open System authentication is implemented */
 	if (L_LE16_TO_CPU(auth->algorithm) !=
 			MMPDU_AUTH_ALGO_OPEN_SYSTEM) {
 		ap_auth_reply(ap, from, MMPDU_REASON_CODE_UNSPECIFIED);
@@ -2173,7 +3674,7 @@ static void ap_auth_cb(const struct mmpdu_header *hdr, const void *body,
 		return;
 	}
 
-	sta = l_queue_find(ap->sta_states, ap_sta_match_addr, from);
+	sta = ap_sta_find(ap, from);
 
 	/*
 	 * Figure 11-13 in 802.11-2016 11.3.2 shows a transition from
@@ -2197,10 +3698,7 @@ static void ap_auth_cb(const struct mmpdu_header *hdr, const void *body,
 	memcpy(sta->addr, from, 6);
 	sta->ap = ap;
 
-	if (!ap->sta_states)
-		ap->sta_states = l_queue_new();
-
-	l_queue_push_tail(ap->sta_states, sta);
+	ap_sta_add(ap, sta);
 
 	/*
 	 * Nothing to do here netlink-wise as we can't receive any data
@@ -2233,6 +3731,318 @@ static void ap_deauth_cb(const struct mmpdu_header *hdr, const void *body,
 				L_LE16_TO_CPU(deauth->reason_code));
 }
 
+/*
+ * Client steering, enabled by [Steering].Neighbors.  On every station
+ * accounting poll, see below, the airtime share of the associated
+ * stations is advertised as the channel utilization in the BSS Load
+ * element, along with the station count.  Stations below
+ * [Steering].MinRSSI, and the weakest one while more than
+ * [Steering].MaxStations are associated, are sent a BSS Transition
+ * Management Request listing the neighbor BSSes.  Which neighbor to pick
+ * is left to the station, whose ranking can use the neighbors' own BSS
+ * Load elements.  A station is asked at most once per AP_STEER_BACKOFF.
+ */
+#define AP_STEER_BACKOFF		(60 * L_USEC_PER_SEC)
+#define AP_STEER_DEFAULT_MIN_RSSI	-75
+#define AP_STEER_UTILIZATION_DELTA	13	/* ~5% of 255 */
+
+static void ap_btm_request_cb(int err, void *user_data)
+{
+	if (err)
+		l_debug("BSS Transition Request not delivered: %s (%i)",
+			strerror(-err), -err);
+}
+
+static void ap_send_bss_transition_request(struct ap_state *ap,
+						struct sta_state *sta)
+{
+	const uint8_t *addr = netdev_get_address(ap->netdev);
+	size_t len = sizeof(struct mmpdu_header) + 7 +
+			ap->steer_neighbors_num * 18;
+	_auto_(l_free) uint8_t *mpdu_buf = l_malloc(len);
+	struct mmpdu_header *mpdu = (struct mmpdu_header *) mpdu_buf;
+	uint8_t *ptr;
+	unsigned int i;
+
+	memset(mpdu, 0, sizeof(*mpdu));
+
+	/* Header */
+	mpdu->fc.protocol_version = 0;
+	mpdu->fc.type = MPDU_TYPE_MANAGEMENT;
+	mpdu->fc.subtype = MPDU_MANAGEMENT_SUBTYPE_ACTION;
+	memcpy(mpdu->address_1, sta->addr, 6);	/* DA */
+	memcpy(mpdu->address_2, addr, 6);	/* SA */
+	memcpy(mpdu->address_3, addr, 6);	/* BSSID */
+
+	ptr = (uint8_t *) mmpdu_body(mpdu);
+	*ptr++ = 0x0a; /* Category: WNM */
+	*ptr++ = 0x07; /* WNM Action: BSS Transition Management Request */
+
+	if (!++ap->btm_dialog_token)
+		ap->btm_dialog_token = 1;
+
+	*ptr++ = ap->btm_dialog_token;
+	*ptr++ = 0x01; /* Request Mode: Preferred Candidate List Included */
+	l_put_le16(0, ptr); /* Disassociation Timer */
+	ptr += 2;
+	*ptr++ = 255; /* Validity Interval in TBTTs */
+
+	/* 802.11-2020 9.4.2.36 Neighbor Report elements */
+	for (i = 0; i < ap->steer_neighbors_num; i++) {
+		const struct ap_neighbor *n = &ap->steer_neighbors[i];
+
+		*ptr++ = IE_TYPE_NEIGHBOR_REPORT;
+		*ptr++ = 16;
+		memcpy(ptr, n->addr, 6);
+		ptr += 6;
+		/* BSSID Information: AP reachable, same security */
+		l_put_le32(0x00000007, ptr);
+		ptr += 4;
+		*ptr++ = n->oper_class;
+		*ptr++ = n->channel;
+		*ptr++ = 0; /* PHY Type */
+		/* BSS Transition Candidate Preference subelement */
+		*ptr++ = 3;
+		*ptr++ = 1;
+		*ptr++ = 255;
+	}
+
+	l_debug("Steering %s, RSSI %i", util_address_to_string(sta->addr),
+		sta->steer_rssi);
+
+	sta->steer_time = l_time_now();
+	ap_send_mgmt_frame(ap, mpdu, ptr - mpdu_buf, ap_btm_request_cb, NULL);
+}
+
+static bool ap_sta_steerable(struct sta_state *sta, uint64_t now)
+{
+	if (!sta->associated || !sta->bss_transition || !sta->have_steer_rssi)
+		return false;
+
+	return !sta->steer_time ||
+		l_time_after(now, sta->steer_time + AP_STEER_BACKOFF);
+}
+
+static void ap_steer_update_load(struct ap_state *ap, uint16_t stations,
+					uint64_t now)
+{
+	uint64_t elapsed = now - ap->acct_poll_time;
+	uint64_t utilization = 0;
+	int delta;
+
+	if (ap->acct_poll_time && elapsed)
+		utilization = ap->acct_airtime * 255 / elapsed;
+
+	if (utilization > 255)
+		utilization = 255;
+
+	delta = (int) utilization - ap->bss_load_utilization;
+
+	if (stations == ap->bss_load_stations &&
+			delta < AP_STEER_UTILIZATION_DELTA &&
+			delta > -AP_STEER_UTILIZATION_DELTA)
+		return;
+
+	ap->bss_load_stations = stations;
+	ap->bss_load_utilization = utilization;
+	ap_update_beacon(ap);
+}
+
+static void ap_steer_stations(struct ap_state *ap, uint64_t now)
+{
+	const struct l_queue_entry *entry;
+	struct sta_state *weakest = NULL;
+	uint16_t stations = 0;
+
+	for (entry = l_queue_get_entries(ap->sta_states); entry;
+						entry = entry->next) {
+		struct sta_state *sta = entry->data;
+
+		if (!sta->associated)
+			continue;
+
+		stations++;
+
+		if (!ap_sta_steerable(sta, now))
+			continue;
+
+		if (sta->steer_rssi < ap->steer_min_rssi) {
+			ap_send_bss_transition_request(ap, sta);
+			continue;
+		}
+
+		if (!weakest || sta->steer_rssi < weakest->steer_rssi)
+			weakest = sta;
+	}
+
+	if (ap->steer_max_stations && stations > ap->steer_max_stations &&
+			weakest)
+		ap_send_bss_transition_request(ap, weakest);
+
+	ap_steer_update_load(ap, stations, now);
+}
+
+/*
+ * Station accounting.  Every AP_ACCT_INTERVAL all stations are fetched
+ * with a single station dump.  The counter deltas since the previous dump
+ * give each station's airtime share, rx and tx throughput and tx retry
+ * rate, smoothed as an exponentially weighted moving average.  The
+ * estimates are reported by GetDiagnostics and the RSSI and airtime feed
+ * the client steering above.
+ */
+#define AP_ACCT_INTERVAL	10	/* Seconds */
+
+/* avg = 3/4 avg + 1/4 sample */
+static uint32_t ap_acct_average(uint32_t avg, uint64_t sample, bool first)
+{
+	if (sample > UINT32_MAX)
+		sample = UINT32_MAX;
+
+	if (first)
+		return sample;
+
+	return ((uint64_t) avg * 3 + sample) / 4;
+}
+
+static uint64_t ap_acct_delta(uint64_t prev, uint64_t cur)
+{
+	/* The counters restart when the station reconnects */
+	return cur >= prev ? cur - prev : 0;
+}
+
+static void ap_acct_station_cb(const struct diagnostic_station_info *info,
+				void *user_data)
+{
+	struct ap_state *ap = user_data;
+	struct sta_state *sta;
+	struct ap_sta_acct *acct;
+	uint64_t now = l_time_now();
+	uint64_t elapsed;
+	uint64_t delta;
+
+	if (!info)
+		return;
+
+	sta = ap_sta_find(ap, info->addr);
+	if (!sta || !sta->associated)
+		return;
+
+	if (info->have_avg_rssi || info->have_cur_rssi) {
+		sta->steer_rssi = info->have_avg_rssi ? info->avg_rssi :
+							info->cur_rssi;
+		sta->have_steer_rssi = true;
+	}
+
+	acct = &sta->acct;
+	elapsed = acct->time ? l_time_diff(acct->time, now) : 0;
+
+	/* The first sample only sets the baseline */
+	if (!elapsed)
+		goto done;
+
+	if (info->have_airtime) {
+		delta = ap_acct_delta(acct->airtime, info->airtime);
+		ap->acct_airtime += delta;
+		acct->airtime_share = ap_acct_average(acct->airtime_share,
+						delta * 1000 / elapsed,
+						!acct->have_airtime);
+		acct->have_airtime = true;
+	}
+
+	/* Bytes per us times 8000 gives kbit/s */
+	if (info->have_rx_bytes) {
+		delta = ap_acct_delta(acct->rx_bytes, info->rx_bytes);
+		acct->rx_kbps = ap_acct_average(acct->rx_kbps,
+						delta * 8000 / elapsed,
+						!acct->have_rx);
+		acct->have_rx = true;
+	}
+
+	if (info->have_tx_bytes) {
+		delta = ap_acct_delta(acct->tx_bytes, info->tx_bytes);
+		acct->tx_kbps = ap_acct_average(acct->tx_kbps,
+						delta * 8000 / elapsed,
+						!acct->have_tx);
+		acct->have_tx = true;
+	}
+
+	if (info->have_tx_packets && info->have_tx_retries) {
+		uint64_t packets = ap_acct_delta(acct->tx_packets,
+							info->tx_packets);
+
+		delta = ap_acct_delta(acct->tx_retries, info->tx_retries);
+
+		if (packets) {
+			acct->retry_rate = ap_acct_average(acct->retry_rate,
+							delta * 1000 / packets,
+							!acct->have_retries);
+			acct->have_retries = true;
+		}
+	}
+
+done:
+	acct->time = now;
+	acct->airtime = info->airtime;
+	acct->rx_bytes = info->rx_bytes;
+	acct->tx_bytes = info->tx_bytes;
+	acct->tx_packets = info->tx_packets;
+	acct->tx_retries = info->tx_retries;
+}
+
+static void ap_acct_poll_done(void *user_data)
+{
+	struct ap_state *ap = user_data;
+	uint64_t now = l_time_now();
+
+	/* Cancelled by ap_reset */
+	if (!ap->acct_polling)
+		return;
+
+	ap->acct_polling = false;
+
+	if (ap->steer_neighbors_num)
+		ap_steer_stations(ap, now);
+
+	ap->acct_poll_time = now;
+	ap->acct_airtime = 0;
+}
+
+static void ap_acct_timeout_cb(struct l_timeout *timeout, void *user_data)
+{
+	struct ap_state *ap = user_data;
+
+	l_timeout_modify(timeout, AP_ACCT_INTERVAL);
+
+	if (ap->acct_polling || l_queue_isempty(ap->sta_states))
+		return;
+
+	ap->acct_polling = true;
+
+	if (netdev_get_all_stations(ap->netdev, ap_acct_station_cb, ap,
+					ap_acct_poll_done) < 0)
+		ap->acct_polling = false;
+}
+
+static void ap_acct_to_dict(const struct ap_sta_acct *acct,
+				struct l_dbus_message_builder *builder)
+{
+	if (acct->have_airtime)
+		dbus_append_dict_basic(builder, "AirtimeShare", 'u',
+					&acct->airtime_share);
+
+	if (acct->have_rx)
+		dbus_append_dict_basic(builder, "RxThroughput", 'u',
+					&acct->rx_kbps);
+
+	if (acct->have_tx)
+		dbus_append_dict_basic(builder, "TxThroughput", 'u',
+					&acct->tx_kbps);
+
+	if (acct->have_retries)
+		dbus_append_dict_basic(builder, "TxRetryRate", 'u',
+					&acct->retry_rate);
+}
+
 static void do_debug(const char *str, void *user_data)
 {
 	const char *prefix = user_data;
@@ -2260,6 +4070,7 @@ static void ap_dhcp_event_cb(struct l_dhcp_server *server,
 
 	switch (event) {
 	case L_DHCP_SERVER_EVENT_NEW_LEASE:
+		ap_leases_update(ap, lease);
 		ap_event(ap, AP_EVENT_DHCP_NEW_LEASE, lease);
 		break;
 
@@ -2291,6 +4102,8 @@ static void ap_start_cb(struct l_genl_msg *msg, void *user_data)
 			return;
 		}
 
+		l_hashmap_foreach(ap->leases, ap_leases_restore_entry, ap);
+
 		if (!l_dhcp_server_set_event_handler(ap->netconfig_dhcp,
 							ap_dhcp_event_cb,
 							ap, NULL)) {
@@ -2301,6 +4114,10 @@ static void ap_start_cb(struct l_genl_msg *msg, void *user_data)
 	}
 
 	ap->started = true;
+
+	ap->acct_timeout = l_timeout_create(AP_ACCT_INTERVAL,
+						ap_acct_timeout_cb, ap, NULL);
+
 	ap_event(ap, AP_EVENT_STARTED, NULL);
 }
 
@@ -2323,7 +4140,7 @@ static struct l_genl_msg *ap_build_cmd_start_ap(struct ap_state *ap)
 	uint32_t nl_ciphers[nl_ciphers_cnt];
 	uint32_t group_nl_cipher =
 		ie_rsn_cipher_suite_to_cipher(ap->group_cipher);
-	uint32_t nl_akm = CRYPTO_AKM_PSK;
+	uint32_t nl_akm[2] = { CRYPTO_AKM_PSK, CRYPTO_AKM_SAE_SHA256 };
 	uint32_t wpa_version = NL80211_WPA_VERSION_2;
 	uint32_t auth_type = NL80211_AUTHTYPE_OPEN_SYSTEM;
 	uint32_t ch_freq = band_channel_to_freq(ap->channel, BAND_FREQ_2_4_GHZ);
@@ -2356,6 +4173,7 @@ static struct l_genl_msg *ap_build_cmd_start_ap(struct ap_state *ap)
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_IE, 0, "");
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_IE_PROBE_RESP, 0, "");
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_IE_ASSOC_RESP, 0, "");
+	ap_append_probe_resp_tmpl(ap, cmd);
 
 	/* START_AP attrs */
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_BEACON_INTERVAL, 4,
@@ -2371,7 +4189,8 @@ static struct l_genl_msg *ap_build_cmd_start_ap(struct ap_state *ap)
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_CIPHER_SUITE_GROUP, 4,
 				&group_nl_cipher);
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_WPA_VERSIONS, 4, &wpa_version);
-	l_genl_msg_append_attr(cmd, NL80211_ATTR_AKM_SUITES, 4, &nl_akm);
+	l_genl_msg_append_attr(cmd, NL80211_ATTR_AKM_SUITES,
+				ap->sae_enabled ? 8 : 4, nl_akm);
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_AUTH_TYPE, 4, &auth_type);
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_WIPHY_FREQ, 4, &ch_freq);
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_CHANNEL_WIDTH, 4, &ch_width);
@@ -2407,6 +4226,13 @@ static bool ap_start_send(struct ap_state *ap)
 	return true;
 }
 
+/* START_AP waits for the PSK, the IPv4 address and the channel */
+static bool ap_start_ready(struct ap_state *ap)
+{
+	return !ap->psk_work && !ap->rtnl_add_cmd && !ap->acs_scan_id &&
+		!ap->acs_survey_cmd_id;
+}
+
 static void ap_ifaddr4_added_cb(int error, uint16_t type, const void *data,
 				uint32_t len, void *user_data)
 {
@@ -2420,10 +4246,213 @@ static void ap_ifaddr4_added_cb(int error, uint16_t type, const void *data,
 		return;
 	}
 
+	if (!ap_start_ready(ap))
+		return;
+
+	if (!ap_start_send(ap))
+		ap_start_failed(ap, -EIO);
+}
+
+static void ap_psk_ready_cb(int err, const uint8_t *psk, void *user_data)
+{
+	struct ap_state *ap = user_data;
+
+	ap->psk_work = NULL;
+
+	if (err < 0) {
+		ap_start_failed(ap, err);
+		return;
+	}
+
+	memcpy(ap->psk, psk, 32);
+
+	if (!ap_start_ready(ap))
+		return;
+
+	if (!ap_start_send(ap))
+		ap_start_failed(ap, -EIO);
+}
+
+/*
+ * Automatic channel selection.  A passive scan counts the BSSes on and
+ * around each candidate channel and weighs them by their advertised BSS
+ * Load, then the survey adds how busy the radio found each channel.  The
+ * candidate with the lowest cost wins.
+ */
+static void ap_acs_done(struct ap_state *ap)
+{
+	unsigned int i;
+	unsigned int best = 0;
+
+	if (ap->acs_measured) {
+		for (i = 1; i < L_ARRAY_SIZE(ap_acs_channels); i++)
+			if (ap->acs_cost[i] < ap->acs_cost[best])
+				best = i;
+
+		ap->channel = ap_acs_channels[best];
+	} else
+		ap->channel = AP_ACS_DEFAULT_CHANNEL;
+
+	for (i = 0; i < L_ARRAY_SIZE(ap_acs_channels); i++)
+		l_debug("Channel %u cost %u", ap_acs_channels[i],
+			ap->acs_cost[i]);
+
+	l_debug("Selected channel %u", ap->channel);
+
+	if (!ap_start_ready(ap))
+		return;
+
 	if (!ap_start_send(ap))
 		ap_start_failed(ap, -EIO);
 }
 
+static void ap_acs_survey_cb(struct l_genl_msg *msg, void *user_data)
+{
+	struct ap_state *ap = user_data;
+	struct l_genl_attr attr;
+	struct l_genl_attr nested;
+	uint16_t type;
+	uint16_t len;
+	const void *data;
+	uint32_t freq = 0;
+	uint64_t time = 0;
+	uint64_t busy = 0;
+	uint8_t channel;
+	unsigned int i;
+
+	if (!l_genl_attr_init(&attr, msg))
+		return;
+
+	while (l_genl_attr_next(&attr, &type, &len, &data)) {
+		if (type != NL80211_ATTR_SURVEY_INFO)
+			continue;
+
+		if (!l_genl_attr_recurse(&attr, &nested))
+			return;
+
+		while (l_genl_attr_next(&nested, &type, &len, &data)) {
+			switch (type) {
+			case NL80211_SURVEY_INFO_FREQUENCY:
+				if (len == 4)
+					freq = l_get_u32(data);
+				break;
+			case NL80211_SURVEY_INFO_TIME:
+				if (len == 8)
+					time = l_get_u64(data);
+				break;
+			case NL80211_SURVEY_INFO_TIME_BUSY:
+				if (len == 8)
+					busy = l_get_u64(data);
+				break;
+			}
+		}
+	}
+
+	if (!freq || !time || busy > time)
+		return;
+
+	channel = band_freq_to_channel(freq, NULL);
+
+	for (i = 0; i < L_ARRAY_SIZE(ap_acs_channels); i++) {
+		if (ap_acs_channels[i] != channel ||
+				freq != band_channel_to_freq(channel,
+							BAND_FREQ_2_4_GHZ))
+			continue;
+
+		/* Busy time in 1/1000ths, same scale as one loaded BSS */
+		ap->acs_cost[i] += busy * 1000 / time;
+		ap->acs_measured = true;
+	}
+}
+
+static void ap_acs_survey_done(void *user_data)
+{
+	struct ap_state *ap = user_data;
+
+	/* Cancelled by ap_reset */
+	if (!ap->acs_survey_cmd_id)
+		return;
+
+	ap->acs_survey_cmd_id = 0;
+	ap_acs_done(ap);
+}
+
+static bool ap_acs_scan_notify(int err, struct l_queue *bss_list,
+				const struct scan_freq_set *freqs,
+				void *user_data)
+{
+	struct ap_state *ap = user_data;
+	const struct l_queue_entry *entry;
+	struct l_genl_msg *msg;
+	uint32_t ifindex = netdev_get_ifindex(ap->netdev);
+
+	ap->acs_scan_id = 0;
+
+	if (err)
+		l_debug("ACS scan failed: %i", err);
+	else
+		ap->acs_measured = true;
+
+	for (entry = l_queue_get_entries(bss_list); entry;
+			entry = entry->next) {
+		const struct scan_bss *bss = entry->data;
+		enum band_freq band;
+		uint8_t channel = band_freq_to_channel(bss->frequency, &band);
+		unsigned int i;
+
+		if (band != BAND_FREQ_2_4_GHZ)
+			continue;
+
+		/* 2.4GHz channels overlap up to 4 channels away */
+		for (i = 0; i < L_ARRAY_SIZE(ap_acs_channels); i++) {
+			uint8_t d = channel > ap_acs_channels[i] ?
+					channel - ap_acs_channels[i] :
+					ap_acs_channels[i] - channel;
+
+			if (d > 4)
+				continue;
+
+			ap->acs_cost[i] += (5 - d) *
+				(200 + bss->utilization * 800 / 255) / 5;
+		}
+	}
+
+	msg = l_genl_msg_new_sized(NL80211_CMD_GET_SURVEY, 16);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &ifindex);
+
+	ap->acs_survey_cmd_id = l_genl_family_dump(ap->nl80211, msg,
+							ap_acs_survey_cb, ap,
+							ap_acs_survey_done);
+	if (!ap->acs_survey_cmd_id) {
+		l_genl_msg_unref(msg);
+		ap_acs_done(ap);
+	}
+
+	return false;
+}
+
+static bool ap_acs_start(struct ap_state *ap)
+{
+	const struct scan_freq_set *supported =
+		wiphy_get_supported_freqs(netdev_get_wiphy(ap->netdev));
+	struct scan_freq_set *freqs = scan_freq_set_new();
+	uint8_t channel;
+
+	for (channel = 1; channel <= 13; channel++) {
+		uint32_t freq = band_channel_to_freq(channel,
+							BAND_FREQ_2_4_GHZ);
+
+		if (scan_freq_set_contains(supported, freq))
+			scan_freq_set_add(freqs, freq);
+	}
+
+	ap->acs_scan_id = scan_passive(netdev_get_wdev_id(ap->netdev), freqs,
+					NULL, ap_acs_scan_notify, ap, NULL);
+	scan_freq_set_free(freqs);
+
+	return ap->acs_scan_id != 0;
+}
+
 static bool ap_parse_new_station_ies(const void *data, uint16_t len,
 					uint8_t **rsn_out,
 					struct l_uintset **rates_out)
@@ -2510,7 +4539,7 @@ static void ap_handle_new_station(struct ap_state *ap, struct l_genl_msg *msg)
 	 * Softmac's should already have a station created. The above check
 	 * may also fail for softmac cards.
 	 */
-	sta = l_queue_find(ap->sta_states, ap_sta_match_addr, mac);
+	sta = ap_sta_find(ap, mac);
 	if (sta)
 		goto cleanup;
 
@@ -2520,12 +4549,9 @@ static void ap_handle_new_station(struct ap_state *ap, struct l_genl_msg *msg)
 	sta->assoc_rsne = assoc_rsne;
 	sta->aid = ++ap->last_aid;
 
-	sta->associated = true;
-
-	if (!ap->sta_states)
-		ap->sta_states = l_queue_new();
-
-	l_queue_push_tail(ap->sta_states, sta);
+	sta->associated = true;
+
+	ap_sta_add(ap, sta);
 
 	msg = nl80211_build_set_station_unauthorized(
 					netdev_get_ifindex(ap->netdev), mac);
@@ -2713,8 +4739,6 @@ static void ap_query_macs(struct ap_state *ap, const char *addr_str,
 	}
 }
 
-#define AP_DEFAULT_IPV4_PREFIX_LEN 28
-
 static int ap_setup_netconfig4(struct ap_state *ap, const char **addr_str_list,
 				uint8_t prefix_len, const char *gateway_str,
 				const char **ip_range,
@@ -2741,6 +4765,8 @@ static int ap_setup_netconfig4(struct ap_state *ap, const char **addr_str_list,
 		l_dhcp_server_set_debug(dhcp, do_debug,
 					"[DHCPv4 SERV] ", NULL);
 
+	ap_leases_load(ap);
+
 	/*
 	 * The address pool specified for this AP (if any) has the priority,
 	 * next is the address currently set on the interface (if any) and
@@ -2748,7 +4774,7 @@ static int ap_setup_netconfig4(struct ap_state *ap, const char **addr_str_list,
 	 */
 	if (addr_str_list) {
 		if (!prefix_len)
-			prefix_len = AP_DEFAULT_IPV4_PREFIX_LEN;
+			prefix_len = global_addr4_prefix_len;
 
 		ret = ip_pool_select_addr4(addr_str_list, prefix_len,
 						&new_addr);
@@ -2767,11 +4793,27 @@ static int ap_setup_netconfig4(struct ap_state *ap, const char **addr_str_list,
 		new_addr = l_rtnl_address_new(addr_str_buf, prefix_len);
 		ret = 0;
 	} else {
+		L_AUTO_FREE_VAR(char *, saved_addr_str) = NULL;
+
 		if (!prefix_len)
-			prefix_len = AP_DEFAULT_IPV4_PREFIX_LEN;
+			prefix_len = global_addr4_prefix_len;
+
+		/* Prefer the subnet used the last time, if still available */
+		saved_addr_str = ap_leases_get_subnet(ap,
+					(const char **) global_addr4_strs,
+					prefix_len);
+
+		if (saved_addr_str) {
+			const char *saved[] = { saved_addr_str, NULL };
 
-		ret = ip_pool_select_addr4((const char **) global_addr4_strs,
-						prefix_len, &new_addr);
+			ret = ip_pool_select_addr4(saved, prefix_len,
+							&new_addr);
+		}
+
+		if (!saved_addr_str || ret)
+			ret = ip_pool_select_addr4(
+					(const char **) global_addr4_strs,
+					prefix_len, &new_addr);
 	}
 
 	if (ret)
@@ -2909,7 +4951,7 @@ static int ap_load_ipv4(struct ap_state *ap, const struct l_settings *config)
 	if (l_settings_get_value(config, "IPv4", "IPRange")) {
 		int i;
 		uint32_t netmask;
-		uint8_t tmp_len = prefix_len ?: AP_DEFAULT_IPV4_PREFIX_LEN;
+		uint8_t tmp_len = prefix_len ?: global_addr4_prefix_len;
 
 		ip_range = l_settings_get_string_list(config, "IPv4",
 							"IPRange", ',');
@@ -2986,7 +5028,6 @@ static bool ap_load_psk(struct ap_state *ap, const struct l_settings *config)
 {
 	L_AUTO_FREE_VAR(char *, passphrase) =
 		l_settings_get_string(config, "Security", "Passphrase");
-	int err;
 
 	if (passphrase) {
 		if (strlen(passphrase) > 63) {
@@ -3021,18 +5062,120 @@ static bool ap_load_psk(struct ap_state *ap, const struct l_settings *config)
 		return false;
 	}
 
-	err = crypto_psk_from_passphrase(passphrase, (uint8_t *) ap->ssid,
-						strlen(ap->ssid), ap->psk);
-	if (err < 0) {
+	/* Derived off the main loop, the AP is started once it's done */
+	ap->psk_work = crypto_psk_from_passphrase_async(passphrase,
+						(uint8_t *) ap->ssid,
+						strlen(ap->ssid),
+						ap_psk_ready_cb, ap);
+	if (!ap->psk_work) {
 		l_error("AP couldn't generate the PSK from given "
-			"[Security].Passphrase value: %s (%i)",
-			strerror(-err), -err);
+			"[Security].Passphrase value");
 		return false;
 	}
 
 	return true;
 }
 
+/* Global operating class of a 2.4 or 5 GHz channel, 802.11-2020 Table E-4 */
+static uint8_t ap_channel_to_oper_class(unsigned int channel)
+{
+	if (channel >= 1 && channel <= 13)
+		return 81;
+
+	if (channel == 14)
+		return 82;
+
+	if (channel >= 36 && channel <= 48)
+		return 115;
+
+	if (channel >= 52 && channel <= 64)
+		return 118;
+
+	if (channel >= 100 && channel <= 144)
+		return 121;
+
+	if (channel >= 149 && channel <= 161)
+		return 124;
+
+	if (channel >= 165 && channel <= 177)
+		return 125;
+
+	return 0;
+}
+
+static int ap_load_steering(struct ap_state *ap,
+				const struct l_settings *config)
+{
+	char **strvval;
+	unsigned int i;
+	int intval;
+
+	if (!l_settings_get_value(config, "Steering", "Neighbors"))
+		return 0;
+
+	strvval = l_settings_get_string_list(config, "Steering", "Neighbors",
+						',');
+	if (!strvval || !strvval[0]) {
+		l_error("AP [Steering].Neighbors list format wrong");
+		l_strfreev(strvval);
+		return -EINVAL;
+	}
+
+	ap->steer_neighbors_num = l_strv_length(strvval);
+	ap->steer_neighbors = l_new(struct ap_neighbor,
+					ap->steer_neighbors_num);
+
+	for (i = 0; strvval[i]; i++) {
+		struct ap_neighbor *n = &ap->steer_neighbors[i];
+		char *channel = strchr(strvval[i], '/');
+		char *endp;
+		unsigned long ulval;
+
+		if (!channel)
+			goto bad_neighbor;
+
+		*channel++ = '\0';
+		ulval = strtoul(channel, &endp, 10);
+
+		if (!util_string_to_address(strvval[i], n->addr) || *endp ||
+				endp == channel || ulval > 255)
+			goto bad_neighbor;
+
+		n->channel = ulval;
+		n->oper_class = ap_channel_to_oper_class(n->channel);
+		if (!n->oper_class)
+			goto bad_neighbor;
+	}
+
+	l_strfreev(strvval);
+
+	if (l_settings_get_value(config, "Steering", "MinRSSI")) {
+		if (!l_settings_get_int(config, "Steering", "MinRSSI",
+						&intval) ||
+				intval < -100 || intval > -1) {
+			l_error("AP [Steering].MinRSSI not a valid value");
+			return -EINVAL;
+		}
+
+		ap->steer_min_rssi = intval;
+	} else
+		ap->steer_min_rssi = AP_STEER_DEFAULT_MIN_RSSI;
+
+	if (l_settings_get_value(config, "Steering", "MaxStations") &&
+			!l_settings_get_uint(config, "Steering", "MaxStations",
+						&ap->steer_max_stations)) {
+		l_error("AP [Steering].MaxStations not a valid integer");
+		return -EINVAL;
+	}
+
+	return 0;
+
+bad_neighbor:
+	l_error("Bad [Steering].Neighbors entry: %s", strvval[i]);
+	l_strfreev(strvval);
+	return -EINVAL;
+}
+
 static int ap_load_config(struct ap_state *ap, const struct l_settings *config,
 				bool *out_cck_rates)
 {
@@ -3059,6 +5202,50 @@ static int ap_load_config(struct ap_state *ap, const struct l_settings *config,
 	if (!ap_load_psk(ap, config))
 		return -EINVAL;
 
+	if (l_settings_get_value(config, "Security", "EnableSAE")) {
+		bool boolval;
+
+		if (!l_settings_get_bool(config, "Security", "EnableSAE",
+						&boolval)) {
+			l_error("AP [Security].EnableSAE not a valid boolean");
+			return -EINVAL;
+		}
+
+		if (boolval && !ap->passphrase[0]) {
+			l_error("AP [Security].EnableSAE requires "
+				"[Security].Passphrase");
+			return -EINVAL;
+		}
+
+		ap->sae_enabled = boolval;
+	}
+
+	if (ap->sae_enabled)
+		l_getrandom(ap->sae_token_key, sizeof(ap->sae_token_key));
+
+	if (l_settings_get_value(config, "Security", "GroupRekeyInterval")) {
+		unsigned int uintval;
+
+		if (!l_settings_get_uint(config, "Security",
+						"GroupRekeyInterval", &uintval)) {
+			l_error("AP [Security].GroupRekeyInterval not a valid "
+				"integer");
+			return -EINVAL;
+		}
+
+		ap->gtk_rekey_interval = uintval;
+	}
+
+	ap->max_handshakes = AP_DEFAULT_MAX_HANDSHAKES;
+
+	if (l_settings_get_value(config, "General", "MaxHandshakes") &&
+			!l_settings_get_uint(config, "General",
+						"MaxHandshakes",
+						&ap->max_handshakes)) {
+		l_error("AP [General].MaxHandshakes not a valid integer");
+		return -EINVAL;
+	}
+
 	/*
 	 * This looks at the network configuration settings in @config and
 	 * relevant global settings and if it determines that netconfig is to
@@ -3069,7 +5256,8 @@ static int ap_load_config(struct ap_state *ap, const struct l_settings *config,
 	if (err)
 		return err;
 
-	if (l_settings_has_key(config, "General", "Channel")) {
+	strval = l_settings_get_string(config, "General", "Channel");
+	if (strval && strcmp(strval, "auto")) {
 		unsigned int uintval;
 
 		if (!l_settings_get_uint(config, "General", "Channel",
@@ -3082,8 +5270,10 @@ static int ap_load_config(struct ap_state *ap, const struct l_settings *config,
 
 		ap->channel = uintval;
 	} else
-		/* TODO: Start a Get Survey to decide the channel */
-		ap->channel = 6;
+		/* Picked by ap_acs_start once the AP is starting */
+		ap->channel = 0;
+
+	l_free(l_steal_ptr(strval));
 
 	strval = l_settings_get_string(config, "WSC", "DeviceName");
 	if (strval) {
@@ -3121,31 +5311,20 @@ static int ap_load_config(struct ap_state *ap, const struct l_settings *config,
 		ap->wsc_primary_device_type.subcategory = 1;
 	}
 
-	if (l_settings_get_value(config, "WSC", "AuthorizedMACs")) {
-		char **strvval;
-		unsigned int i;
-
-		strvval = l_settings_get_string_list(config, "WSC",
-							"AuthorizedMACs", ',');
-		if (!strvval) {
-			l_error("AP Authorized MACs list format wrong");
-			return -EINVAL;
-		}
-
-		ap->authorized_macs_num = l_strv_length(strvval);
-		ap->authorized_macs = l_malloc(ap->authorized_macs_num * 6);
+	err = ap_mac_list_load(&ap->authorized_macs, config, "WSC",
+				"AuthorizedMACs");
+	if (err)
+		return err;
 
-		for (i = 0; strvval[i]; i++)
-			if (!util_string_to_address(strvval[i],
-						ap->authorized_macs + i * 6)) {
-				l_error("Bad authorized MAC format: %s",
-					strvval[i]);
-				l_strfreev(strvval);
-				return -EINVAL;
-			}
+	err = ap_mac_list_load(&ap->allowed_macs, config, "Security",
+				"AllowedMACs");
+	if (err)
+		return err;
 
-		l_strfreev(strvval);
-	}
+	err = ap_mac_list_load(&ap->denied_macs, config, "Security",
+				"DeniedMACs");
+	if (err)
+		return err;
 
 	if (l_settings_get_value(config, "General", "NoCCKRates")) {
 		bool boolval;
@@ -3161,7 +5340,7 @@ static int ap_load_config(struct ap_state *ap, const struct l_settings *config,
 	} else
 		*out_cck_rates = true;
 
-	return 0;
+	return ap_load_steering(ap, config);
 }
 
 /*
@@ -3201,6 +5380,17 @@ struct ap_state *ap_start(struct netdev *netdev, struct l_settings *config,
 	if (err)
 		goto error;
 
+	/*
+	 * Let the driver answer Probe Requests on its own if it can.  Our
+	 * Probe Response always carries a WSC IE so we need the driver to
+	 * still pass up the WSC Probe Requests for the PBC overlap
+	 * detection.  The P2P IEs depend on the Probe Request contents and
+	 * are built by ops->write_extra_ies so P2P GOs are not offloaded.
+	 */
+	ap->probe_resp_offload = !ops->write_extra_ies &&
+		(wiphy_get_probe_resp_offload(wiphy) &
+			NL80211_PROBE_RESP_OFFLOAD_SUPPORT_WPS2);
+
 	err = -EINVAL;
 
 	/* TODO: Add all ciphers supported by wiphy */
@@ -3208,6 +5398,19 @@ struct ap_state *ap_start(struct netdev *netdev, struct l_settings *config,
 	ap->group_cipher = wiphy_select_cipher(wiphy, 0xffff);
 	ap->beacon_interval = 100;
 
+	/* WPA3 Specification version 3, Section 2.3: SAE implies MFP */
+	if (ap->sae_enabled) {
+		if (ap->group_cipher == IE_RSN_CIPHER_SUITE_NO_GROUP_TRAFFIC ||
+				!wiphy_select_cipher(wiphy,
+						IE_RSN_CIPHER_SUITE_BIP)) {
+			l_error("AP [Security].EnableSAE requires MFP support");
+			err = -ENOTSUP;
+			goto error;
+		}
+
+		ap->mfpc = true;
+	}
+
 	wsc_uuid_from_addr(netdev_get_address(netdev), ap->wsc_uuid_r);
 
 	ap->rates = l_uintset_new(200);
@@ -3263,6 +5466,12 @@ struct ap_state *ap_start(struct netdev *netdev, struct l_settings *config,
 	if (!ap->mlme_watch)
 		l_error("Registering for MLME notification failed");
 
+	if (!ap->channel && !ap_acs_start(ap)) {
+		l_warn("Can't scan for the AP channel, using %u",
+			AP_ACS_DEFAULT_CHANNEL);
+		ap->channel = AP_ACS_DEFAULT_CHANNEL;
+	}
+
 	if (ap->netconfig_set_addr4) {
 		ap->rtnl_add_cmd = l_rtnl_ifaddr_add(rtnl,
 						netdev_get_ifindex(netdev),
@@ -3276,7 +5485,7 @@ struct ap_state *ap_start(struct netdev *netdev, struct l_settings *config,
 		return ap;
 	}
 
-	if (ap_start_send(ap)) {
+	if (!ap_start_ready(ap) || ap_start_send(ap)) {
 		if (err_out)
 			*err_out = 0;
 
@@ -3350,7 +5559,7 @@ void ap_shutdown(struct ap_state *ap, ap_stopped_func_t stopped_func,
 	if (ap->gtk_set) {
 		ap->gtk_set = false;
 
-		cmd = ap_build_cmd_del_key(ap);
+		cmd = ap_build_cmd_del_key(ap, ap->gtk_index);
 		if (!cmd) {
 			l_error("ap_build_cmd_del_key failed");
 			goto free_ap;
@@ -3362,6 +5571,17 @@ void ap_shutdown(struct ap_state *ap, ap_stopped_func_t stopped_func,
 			l_error("Issuing DEL_KEY failed");
 			goto free_ap;
 		}
+
+		if (ap->mfpc) {
+			cmd = ap_build_cmd_del_key(ap, ap->igtk_index);
+
+			if (!l_genl_family_send(ap->nl80211, cmd, ap_gtk_op_cb,
+						NULL, NULL)) {
+				l_genl_msg_unref(cmd);
+				l_error("Issuing DEL_KEY failed");
+				goto free_ap;
+			}
+		}
 	}
 
 	cmd = ap_build_cmd_stop_ap(ap);
@@ -3412,7 +5632,7 @@ bool ap_station_disconnect(struct ap_state *ap, const uint8_t *mac,
 	if (!ap->started)
 		return false;
 
-	sta = l_queue_remove_if(ap->sta_states, ap_sta_match_addr, mac);
+	sta = ap_sta_remove(ap, mac);
 	if (!sta)
 		return false;
 
@@ -3469,8 +5689,171 @@ struct ap_if_data {
 	struct netdev *netdev;
 	struct ap_state *ap;
 	struct l_dbus_message *pending;
+	char **extra_ssids;
+	struct l_queue *extra_bss;
+};
+
+/*
+ * The BSSes listed in [General].ExtraSSIDs of a profile each get their own
+ * AP interface, created on the same wiphy once the primary BSS has started
+ * and then started with their own profile on the primary's channel.  The
+ * radio beacons for all of them, while every BSS keeps its own station
+ * table, keys and subnet from the shared address pool.
+ */
+#define AP_MAX_EXTRA_BSS	7
+
+struct ap_extra_bss {
+	struct ap_if_data *primary;
+	char ssid[33];
+	uint8_t addr[6];
+	struct netdev *netdev;
+	uint32_t new_intf_cmd_id;
+	bool started : 1;
 };
 
+static void ap_extra_bss_free(void *data)
+{
+	struct ap_extra_bss *extra = data;
+
+	l_queue_remove(extra_bss_list, extra);
+
+	if (extra->new_intf_cmd_id)
+		l_genl_family_cancel(nl80211, extra->new_intf_cmd_id);
+
+	if (extra->netdev) {
+		struct l_genl_msg *msg;
+		uint64_t wdev_id = netdev_get_wdev_id(extra->netdev);
+
+		msg = l_genl_msg_new(NL80211_CMD_DEL_INTERFACE);
+		l_genl_msg_append_attr(msg, NL80211_ATTR_WDEV, 8, &wdev_id);
+
+		if (!l_genl_family_send(nl80211, msg, NULL, NULL, NULL)) {
+			l_genl_msg_unref(msg);
+			l_error("Sending DEL_INTERFACE for %s failed",
+				netdev_get_name(extra->netdev));
+		}
+
+		netdev_destroy(extra->netdev);
+	}
+
+	l_free(extra);
+}
+
+static void ap_extra_bss_stop_all(struct ap_if_data *ap_if)
+{
+	l_strv_free(l_steal_ptr(ap_if->extra_ssids));
+	l_queue_destroy(l_steal_ptr(ap_if->extra_bss), ap_extra_bss_free);
+}
+
+static void ap_extra_bss_remove(struct ap_extra_bss *extra)
+{
+	l_queue_remove(extra->primary->extra_bss, extra);
+	ap_extra_bss_free(extra);
+}
+
+static void ap_extra_bss_new_interface_cb(struct l_genl_msg *msg,
+						void *user_data)
+{
+	struct ap_extra_bss *extra = user_data;
+
+	extra->new_intf_cmd_id = 0;
+
+	if (l_genl_msg_get_error(msg) < 0) {
+		l_error("NEW_INTERFACE for %s failed: %s", extra->ssid,
+			strerror(-l_genl_msg_get_error(msg)));
+		ap_extra_bss_remove(extra);
+		return;
+	}
+
+	/* Started by ap_extra_bss_netdev_up once the interface is up */
+	extra->netdev = netdev_create_from_genl(msg, extra->addr);
+	if (!extra->netdev)
+		ap_extra_bss_remove(extra);
+}
+
+static void ap_extra_bss_create(struct ap_if_data *ap_if, const char *ssid,
+				unsigned int num)
+{
+	uint64_t wdev_id = netdev_get_wdev_id(ap_if->netdev);
+	uint32_t wiphy_id = wdev_id >> 32;
+	uint32_t iftype = NL80211_IFTYPE_AP;
+	const uint8_t *primary_addr = netdev_get_address(ap_if->netdev);
+	struct ap_extra_bss *extra;
+	struct l_genl_msg *msg;
+	char ifname[IFNAMSIZ];
+	int len;
+
+	if (strlen(ssid) > 32) {
+		l_error("AP [General].ExtraSSIDs entry too long: %s", ssid);
+		return;
+	}
+
+	/*
+	 * Only the last byte of the address is bumped, don't let it wrap
+	 * around into the address of another interface.
+	 */
+	if (primary_addr[5] + num > 0xff) {
+		l_error("No free address for the %s extra BSS", ssid);
+		return;
+	}
+
+	len = snprintf(ifname, sizeof(ifname), "wlan%u-ap%u", wiphy_id, num);
+	if (len < 0 || (size_t) len >= sizeof(ifname)) {
+		l_error("Interface name for the %s extra BSS too long", ssid);
+		return;
+	}
+
+	extra = l_new(struct ap_extra_bss, 1);
+	extra->primary = ap_if;
+	strcpy(extra->ssid, ssid);
+
+	/* Locally administered addresses next to the primary BSSID */
+	memcpy(extra->addr, primary_addr, 6);
+	extra->addr[0] |= 0x02;
+	extra->addr[5] += num;
+
+	l_debug("creating %s for %s", ifname, ssid);
+
+	msg = l_genl_msg_new(NL80211_CMD_NEW_INTERFACE);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WIPHY, 4, &wiphy_id);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_IFTYPE, 4, &iftype);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_IFNAME,
+				strlen(ifname) + 1, ifname);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_SOCKET_OWNER, 0, "");
+
+	extra->new_intf_cmd_id = l_genl_family_send(nl80211, msg,
+					ap_extra_bss_new_interface_cb, extra,
+					NULL);
+	if (!extra->new_intf_cmd_id) {
+		l_genl_msg_unref(msg);
+		l_error("Error sending NEW_INTERFACE for %s", ifname);
+		l_free(extra);
+		return;
+	}
+
+	if (!ap_if->extra_bss)
+		ap_if->extra_bss = l_queue_new();
+
+	l_queue_push_tail(ap_if->extra_bss, extra);
+	l_queue_push_tail(extra_bss_list, extra);
+}
+
+static void ap_extra_bss_create_all(struct ap_if_data *ap_if)
+{
+	_auto_(l_strv_free) char **ssids = l_steal_ptr(ap_if->extra_ssids);
+	unsigned int i;
+
+	for (i = 0; ssids && ssids[i]; i++) {
+		if (i == AP_MAX_EXTRA_BSS) {
+			l_warn("Only %u ExtraSSIDs supported",
+				AP_MAX_EXTRA_BSS);
+			break;
+		}
+
+		ap_extra_bss_create(ap_if, ssids[i], i + 1);
+	}
+}
+
 static void ap_if_event_func(enum ap_event_type type, const void *event_data,
 				void *user_data)
 {
@@ -3482,8 +5865,14 @@ static void ap_if_event_func(enum ap_event_type type, const void *event_data,
 	{
 		const struct ap_event_start_failed_data *data = event_data;
 
-		if (L_WARN_ON(!ap_if->pending))
+		/* An extra BSS, started without a D-Bus request */
+		if (!ap_if->pending) {
+			l_error("AP on %s failed to start: %s",
+				netdev_get_name(ap_if->netdev),
+				strerror(-data->error));
+			ap_if->ap = NULL;
 			break;
+		}
 
 		reply = dbus_error_from_errno(data->error, ap_if->pending);
 		dbus_pending_reply(&ap_if->pending, reply);
@@ -3492,16 +5881,17 @@ static void ap_if_event_func(enum ap_event_type type, const void *event_data,
 	}
 
 	case AP_EVENT_STARTED:
-		if (L_WARN_ON(!ap_if->pending))
-			break;
-
 		l_dbus_object_add_interface(dbus_get_bus(),
 						netdev_get_path(ap_if->netdev),
 						IWD_AP_DIAGNOSTIC_INTERFACE,
 						ap_if);
 
-		reply = l_dbus_message_new_method_return(ap_if->pending);
-		dbus_pending_reply(&ap_if->pending, reply);
+		if (ap_if->pending) {
+			reply = l_dbus_message_new_method_return(
+							ap_if->pending);
+			dbus_pending_reply(&ap_if->pending, reply);
+		}
+
 		l_dbus_property_changed(dbus_get_bus(),
 					netdev_get_path(ap_if->netdev),
 					IWD_AP_INTERFACE, "Started");
@@ -3513,9 +5903,13 @@ static void ap_if_event_func(enum ap_event_type type, const void *event_data,
 					netdev_get_ifindex(ap_if->netdev),
 					IF_LINK_MODE_DEFAULT, IF_OPER_UP,
 					NULL, NULL, NULL);
+
+		ap_extra_bss_create_all(ap_if);
 		break;
 
 	case AP_EVENT_STOPPING:
+		ap_extra_bss_stop_all(ap_if);
+
 		l_dbus_object_remove_interface(dbus_get_bus(),
 						netdev_get_path(ap_if->netdev),
 						IWD_AP_DIAGNOSTIC_INTERFACE);
@@ -3625,6 +6019,28 @@ static struct l_dbus_message *ap_dbus_stop(struct l_dbus *dbus,
 	return NULL;
 }
 
+static struct l_settings *ap_load_profile(const char *ssid)
+{
+	struct l_settings *config = l_settings_new();
+	char *config_path = storage_get_path("ap/%s.ap", ssid);
+	bool loaded = l_settings_load_from_file(config, config_path);
+
+	l_free(config_path);
+
+	if (!loaded) {
+		l_settings_free(config);
+		return NULL;
+	}
+
+	/*
+	 * Since [General].SSID is not an allowed setting for a profile on
+	 * disk, we're free to potentially overwrite it with the SSID that
+	 * the DBus user asked for.
+	 */
+	l_settings_set_string(config, "General", "SSID", ssid);
+	return config;
+}
+
 static struct l_dbus_message *ap_dbus_start_profile(struct l_dbus *dbus,
 						struct l_dbus_message *message,
 						void *user_data)
@@ -3632,7 +6048,6 @@ static struct l_dbus_message *ap_dbus_start_profile(struct l_dbus *dbus,
 	struct ap_if_data *ap_if = user_data;
 	const char *ssid;
 	_auto_(l_settings_free) struct l_settings *config = NULL;
-	char *config_path;
 	int err;
 
 	if (ap_if->ap && ap_if->ap->started)
@@ -3644,25 +6059,20 @@ static struct l_dbus_message *ap_dbus_start_profile(struct l_dbus *dbus,
 	if (!l_dbus_message_get_arguments(message, "s", &ssid))
 		return dbus_error_invalid_args(message);
 
-	config = l_settings_new();
-	config_path = storage_get_path("ap/%s.ap", ssid);
-	err = l_settings_load_from_file(config, config_path) ? 0 : -EIO;
-	l_free(config_path);
-
-	if (err)
+	config = ap_load_profile(ssid);
+	if (!config) {
+		err = -EIO;
 		goto error;
-
-	/*
-	 * Since [General].SSID is not an allowed setting for a profile on
-	 * disk, we're free to potentially overwrite it with the SSID that
-	 * the DBus user asked for.
-	 */
-	l_settings_set_string(config, "General", "SSID", ssid);
+	}
 
 	ap_if->ap = ap_start(ap_if->netdev, config, &ap_dbus_ops, &err, ap_if);
 	if (!ap_if->ap)
 		goto error;
 
+	l_strv_free(ap_if->extra_ssids);
+	ap_if->extra_ssids = l_settings_get_string_list(config, "General",
+							"ExtraSSIDs", ',');
+
 	ap_if->pending = l_dbus_message_ref(message);
 	return NULL;
 
@@ -3725,6 +6135,8 @@ static void ap_destroy_interface(void *user_data)
 		dbus_pending_reply(&ap_if->pending, reply);
 	}
 
+	ap_extra_bss_stop_all(ap_if);
+
 	if (ap_if->ap)
 		ap_free(ap_if->ap);
 
@@ -3732,6 +6144,7 @@ static void ap_destroy_interface(void *user_data)
 }
 
 struct diagnostic_data {
+	struct ap_state *ap;
 	struct l_dbus_message *pending;
 	struct l_dbus_message_builder *builder;
 };
@@ -3740,6 +6153,7 @@ static void ap_get_station_cb(const struct diagnostic_station_info *info,
 				void *user_data)
 {
 	struct diagnostic_data *data = user_data;
+	struct sta_state *sta;
 
 	/* First station info */
 	if (!data->builder) {
@@ -3757,6 +6171,10 @@ static void ap_get_station_cb(const struct diagnostic_station_info *info,
 
 	diagnostic_info_to_dict(info, data->builder);
 
+	sta = ap_sta_find(data->ap, info->addr);
+	if (sta)
+		ap_acct_to_dict(&sta->acct, data->builder);
+
 	l_dbus_message_builder_leave_array(data->builder);
 }
 
@@ -3790,6 +6208,7 @@ static struct l_dbus_message *ap_dbus_get_diagnostics(struct l_dbus *dbus,
 	int ret;
 
 	data = l_new(struct diagnostic_data, 1);
+	data->ap = ap_if->ap;
 	data->pending = l_dbus_message_ref(message);
 
 	ret = netdev_get_all_stations(ap_if->ap->netdev, ap_get_station_cb,
@@ -3838,6 +6257,64 @@ static void ap_remove_interface(struct netdev *netdev)
 			netdev_get_path(netdev), IWD_AP_INTERFACE);
 }
 
+static bool ap_extra_bss_match_netdev(const void *a, const void *b)
+{
+	const struct ap_extra_bss *extra = a;
+
+	return extra->netdev == b;
+}
+
+static void ap_extra_bss_netdev_up(struct netdev *netdev)
+{
+	struct ap_extra_bss *extra = l_queue_find(extra_bss_list,
+						ap_extra_bss_match_netdev,
+						netdev);
+	_auto_(l_settings_free) struct l_settings *config = NULL;
+	struct ap_state *primary;
+	struct ap_if_data *ap_if;
+	int err;
+
+	if (!extra || extra->started)
+		return;
+
+	primary = extra->primary->ap;
+	ap_if = l_dbus_object_get_data(dbus_get_bus(), netdev_get_path(netdev),
+					IWD_AP_INTERFACE);
+	if (!primary || !ap_if || ap_if->ap)
+		return;
+
+	extra->started = true;
+
+	config = ap_load_profile(extra->ssid);
+	if (!config) {
+		l_error("Can't load AP profile for %s", extra->ssid);
+		return;
+	}
+
+	/* A single radio, every BSS has to beacon on the same channel */
+	l_settings_set_uint(config, "General", "Channel", primary->channel);
+	l_settings_remove_key(config, "General", "ExtraSSIDs");
+
+	ap_if->ap = ap_start(netdev, config, &ap_dbus_ops, &err, ap_if);
+	if (!ap_if->ap)
+		l_error("Starting AP %s failed: %s", extra->ssid,
+			strerror(-err));
+}
+
+static void ap_extra_bss_netdev_del(struct netdev *netdev)
+{
+	struct ap_extra_bss *extra = l_queue_find(extra_bss_list,
+						ap_extra_bss_match_netdev,
+						netdev);
+
+	if (!extra)
+		return;
+
+	/* Already gone, don't delete it again */
+	extra->netdev = NULL;
+	ap_extra_bss_remove(extra);
+}
+
 static void ap_netdev_watch(struct netdev *netdev,
 				enum netdev_watch_event event, void *userdata)
 {
@@ -3845,12 +6322,17 @@ static void ap_netdev_watch(struct netdev *netdev,
 	case NETDEV_WATCH_EVENT_UP:
 	case NETDEV_WATCH_EVENT_NEW:
 		if (netdev_get_iftype(netdev) == NETDEV_IFTYPE_AP &&
-				netdev_get_is_up(netdev))
+				netdev_get_is_up(netdev)) {
 			ap_add_interface(netdev);
+			ap_extra_bss_netdev_up(netdev);
+		}
 		break;
 	case NETDEV_WATCH_EVENT_DOWN:
+		ap_remove_interface(netdev);
+		break;
 	case NETDEV_WATCH_EVENT_DEL:
 		ap_remove_interface(netdev);
+		ap_extra_bss_netdev_del(netdev);
 		break;
 	default:
 		break;
@@ -3862,6 +6344,8 @@ static int ap_init(void)
 	const struct l_settings *settings = iwd_get_config();
 
 	netdev_watch = netdev_watch_add(ap_netdev_watch, NULL, NULL);
+	nl80211 = l_genl_family_new(iwd_get_genl(), NL80211_GENL_NAME);
+	extra_bss_list = l_queue_new();
 
 	l_dbus_register_interface(dbus_get_bus(), IWD_AP_INTERFACE,
 			ap_setup_interface, ap_destroy_interface, false);
@@ -3906,6 +6390,21 @@ static int ap_init(void)
 		if (!global_addr4_strs)
 			global_addr4_strs =
 				l_strv_append(NULL, "192.168.0.0/16");
+
+		if (!l_settings_get_uint(settings, "IPv4",
+						"APSubnetPrefixLength",
+						&global_addr4_prefix_len))
+			global_addr4_prefix_len = 28;
+		else if (global_addr4_prefix_len < 8 ||
+				global_addr4_prefix_len > 30) {
+			l_error("[IPv4].APSubnetPrefixLength must be between "
+				"8 and 30, using 28");
+			global_addr4_prefix_len = 28;
+		}
+
+		lease_db = storage_ap_leases_load();
+		if (lease_db)
+			ap_lease_db_prune();
 	}
 
 	rtnl = iwd_get_rtnl();
@@ -3918,7 +6417,11 @@ static void ap_exit(void)
 	netdev_watch_remove(netdev_watch);
 	l_dbus_unregister_interface(dbus_get_bus(), IWD_AP_INTERFACE);
 
+	l_queue_destroy(extra_bss_list, NULL);
+	l_genl_family_free(nl80211);
+
 	l_strv_free(global_addr4_strs);
+	l_settings_free(lease_db);
 }
 
 IWD_MODULE(ap, ap_init, ap_exit)
@@ -465,6 +465,256 @@ try_vht80:
 	return -ENETUNREACH;
 }
 
+/*
+ * HE (802.11ax) data rates for a single spatial stream using a 0.8 us guard
+ * interval, obtained the same way as ht_vht_rates above except that the HE
+ * symbol is 4 times as long (Tdft = 12.8 us):
+ *
+ * Nsd is [234, 468, 980, 1960] for 20/40/80/160 Mhz respectively
+ * Nbpscs additionally includes 10 for 1024QAM (MCS 10 & 11)
+ *
+ * rfactors = [ 1/2, 1/2, 3/4, 1/2, 3/4, 2/3, 3/4, 5/6, 3/4, 5/6, 3/4, 5/6 ]
+ * nbpscs = [1, 2, 2, 4, 4, 6, 6, 6, 8, 8, 10, 10 ]
+ * nsds = [234, 468, 980, 1960]
+ *
+ * for nsd in nsds:
+ *	rates = []
+ *	for i in range(0, 12):
+ *		data_rate = (nsd * rfactors[i] * nbpscs[i]) / 0.0136
+ *		rates.append(int(data_rate) * 1000)
+ */
+static const uint64_t he_rates[4][12] = {
+	[OFDM_CHANNEL_WIDTH_20MHZ] = {
+		8602000ULL, 17205000ULL, 25808000ULL, 34411000ULL,
+		51617000ULL, 68823000ULL, 77426000ULL, 86029000ULL,
+		103235000ULL, 114705000ULL, 129044000ULL, 143382000ULL, },
+	[OFDM_CHANNEL_WIDTH_40MHZ] = {
+		17205000ULL, 34411000ULL, 51617000ULL, 68823000ULL,
+		103235000ULL, 137647000ULL, 154852000ULL, 172058000ULL,
+		206470000ULL, 229411000ULL, 258088000ULL, 286764000ULL, },
+	[OFDM_CHANNEL_WIDTH_80MHZ] = {
+		36029000ULL, 72058000ULL, 108088000ULL, 144117000ULL,
+		216176000ULL, 288235000ULL, 324264000ULL, 360294000ULL,
+		432352000ULL, 480392000ULL, 540441000ULL, 600490000ULL, },
+	[OFDM_CHANNEL_WIDTH_160MHZ] = {
+		72058000ULL, 144117000ULL, 216176000ULL, 288235000ULL,
+		432352000ULL, 576470000ULL, 648529000ULL, 720588000ULL,
+		864705000ULL, 960784000ULL, 1080882000ULL, 1200980000ULL,
+	}
+};
+
+/*
+ * Base RSSI values for 20MHz HE, the same as ht_vht_base_rssi with two more
+ * entries for 1024QAM.
+ */
+static const int32_t he_base_rssi[] = {
+	-82, -79, -77, -74, -70, -66, -65, -64, -59, -57, -54, -52
+};
+
+static bool find_best_mcs_he(uint8_t max_index, enum ofdm_channel_width width,
+				int32_t rssi, uint8_t nss,
+				uint64_t *out_data_rate)
+{
+	int32_t width_adjust = width * 3;
+	int i;
+
+	for (i = max_index; i >= 0; i--) {
+		if (rssi < he_base_rssi[i] + width_adjust)
+			continue;
+
+		*out_data_rate = he_rates[width][i] * nss;
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Find the highest NSS and the highest MCS supported at that NSS which both
+ * our RX HE-MCS map and the peer's TX HE-MCS map have in common.
+ */
+static bool find_he_nss_mcs(const uint8_t *rx_map, const uint8_t *tx_map,
+				uint8_t *out_nss, uint8_t *out_max_mcs)
+{
+	int bitoffset;
+
+	for (bitoffset = 14; bitoffset >= 0; bitoffset -= 2) {
+		uint8_t rx_val = bit_field(rx_map[bitoffset / 8],
+							bitoffset % 8, 2);
+		uint8_t tx_val = bit_field(tx_map[bitoffset / 8],
+							bitoffset % 8, 2);
+
+		/*
+		 * 0 indicates support for MCS 0-7
+		 * 1 indicates support for MCS 0-9
+		 * 2 indicates support for MCS 0-11
+		 * 3 indicates no support
+		 */
+		if (rx_val == 3 || tx_val == 3)
+			continue;
+
+		*out_max_mcs = minsize(rx_val, tx_val) * 2 + 7;
+		*out_nss = bitoffset / 2 + 1;
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Work out the BSS operating width from (in order of preference) the 6 GHz
+ * Operation Information or VHT Operation Information carried in the HE
+ * Operation element, the VHT Operation element and the HT Operation element.
+ */
+static enum ofdm_channel_width band_he_bss_width(const uint8_t *heo,
+						const uint8_t *vhto,
+						const uint8_t *hto)
+{
+	const uint8_t *end = heo + heo[1] + 2;
+	const uint8_t *opt = heo + 9;
+	const uint8_t *vht_info = NULL;
+	uint8_t channel_offset;
+
+	/* HE Operation Parameters: VHT Operation Information Present */
+	if (test_bit(heo + 3, 14)) {
+		if (opt + 3 <= end)
+			vht_info = opt;
+
+		opt += 3;
+	}
+
+	/* Co-Hosted BSS */
+	if (test_bit(heo + 3, 15))
+		opt += 1;
+
+	/* 6 GHz Operation Information Present */
+	if (test_bit(heo + 3, 17) && opt + 5 <= end) {
+		switch (bit_field(opt[1], 0, 2)) {
+		case 0:
+			return OFDM_CHANNEL_WIDTH_20MHZ;
+		case 1:
+			return OFDM_CHANNEL_WIDTH_40MHZ;
+		case 2:
+			return OFDM_CHANNEL_WIDTH_80MHZ;
+		default:
+			return OFDM_CHANNEL_WIDTH_160MHZ;
+		}
+	}
+
+	if (!vht_info && vhto)
+		vht_info = vhto + 2;
+
+	if (vht_info) {
+		if (vht_info[0] == 2 || vht_info[0] == 3 ||
+				(vht_info[0] == 1 && vht_info[2]))
+			return OFDM_CHANNEL_WIDTH_160MHZ;
+
+		if (vht_info[0] == 1)
+			return OFDM_CHANNEL_WIDTH_80MHZ;
+	}
+
+	if (!hto)
+		return OFDM_CHANNEL_WIDTH_20MHZ;
+
+	channel_offset = bit_field(hto[3], 0, 2);
+	if (test_bit(hto + 3, 2) &&
+			(channel_offset == 1 || channel_offset == 3))
+		return OFDM_CHANNEL_WIDTH_40MHZ;
+
+	return OFDM_CHANNEL_WIDTH_20MHZ;
+}
+
+/*
+ * Supported Channel Width Set of the HE PHY Capabilities: B1 is 40 MHz on
+ * 2.4 GHz, B2 is 40 & 80 MHz on 5/6 GHz and B3 is 160 MHz on 5/6 GHz.
+ */
+static bool he_width_supported(const uint8_t *own_phy, const uint8_t *peer_phy,
+				enum ofdm_channel_width width)
+{
+	switch (width) {
+	case OFDM_CHANNEL_WIDTH_20MHZ:
+		return true;
+	case OFDM_CHANNEL_WIDTH_40MHZ:
+		if (test_bit(own_phy, 1) && test_bit(peer_phy, 1))
+			return true;
+
+		/* fall through */
+	case OFDM_CHANNEL_WIDTH_80MHZ:
+		return test_bit(own_phy, 2) && test_bit(peer_phy, 2);
+	case OFDM_CHANNEL_WIDTH_160MHZ:
+		return test_bit(own_phy, 3) && test_bit(peer_phy, 3);
+	}
+
+	return false;
+}
+
+/*
+ * IEEE 802.11ax - Section 9.4.2.248 HE Capabilities element
+ *
+ * @hec and @heo point to the start of the HE Capabilities and HE Operation
+ * elements (i.e. the Element ID), @vhto and @hto are optional and only used
+ * to find the operating width of 2.4/5 GHz BSSes.  On 6 GHz only the HE
+ * elements are present.
+ *
+ * As with VHT the widest usable channel is assumed to give the best rate.
+ * The 0.8 us guard interval is always used since, unlike SGI, HE does not
+ * advertise it as a capability.
+ */
+int band_estimate_he_rx_rate(const struct band *band,
+				const uint8_t *hec, const uint8_t *heo,
+				const uint8_t *vhto, const uint8_t *hto,
+				int32_t rssi, uint64_t *out_data_rate)
+{
+	const uint8_t *phy;
+	const uint8_t *tx_maps;
+	size_t maps_len = 4;
+	int width;
+
+	if (!band->he_supported)
+		return -ENOTSUP;
+
+	if (!hec || !heo)
+		return -ENOTSUP;
+
+	/* Element ID Extension + MAC + PHY capabilities + <= 80 MHz maps */
+	if (hec[1] < 22 || heo[1] < 7)
+		return -EBADMSG;
+
+	phy = hec + 9;
+	tx_maps = hec + 20;
+
+	/* 160 MHz and 80+80 MHz maps follow if the widths are supported */
+	if (test_bit(phy, 3))
+		maps_len += 4;
+
+	if (test_bit(phy, 4))
+		maps_len += 4;
+
+	if (hec[1] < 18 + maps_len)
+		return -EBADMSG;
+
+	for (width = band_he_bss_width(heo, vhto, hto);
+			width >= OFDM_CHANNEL_WIDTH_20MHZ; width--) {
+		/* Each map set is RX followed by TX, 2 bytes each */
+		size_t offset = width == OFDM_CHANNEL_WIDTH_160MHZ ? 4 : 0;
+		uint8_t nss;
+		uint8_t max_mcs;
+
+		if (!he_width_supported(band->he_phy_capa, phy, width))
+			continue;
+
+		if (!find_he_nss_mcs(band->he_mcs_set + offset,
+					tx_maps + offset + 2, &nss, &max_mcs))
+			continue;
+
+		if (find_best_mcs_he(max_mcs, width, rssi, nss,
+					out_data_rate))
+			return 0;
+	}
+
+	return -ENETUNREACH;
+}
+
 static int band_channel_info_get_bandwidth(const struct band_chandef *info)
 {
 	switch (info->channel_width) {
@@ -682,18 +932,31 @@ static const struct operating_class_info e4_operating_classes[] = {
 	}
 };
 
+/*
+ * Position + 1 of each class in e4_operating_classes, 0 if not listed.
+ * Must be kept in sync with the table above.
+ */
+static const uint8_t e4_opclass_index[256] = {
+	[81] = 1, [82] = 2, [83] = 3, [84] = 4,
+	[115] = 5, [116] = 6, [117] = 7, [118] = 8, [119] = 9, [120] = 10,
+	[121] = 11, [122] = 12, [123] = 13, [124] = 14, [125] = 15,
+	[126] = 16, [127] = 17, [128] = 18, [129] = 19, [130] = 20,
+	[131] = 21, [132] = 22, [133] = 23, [134] = 24, [135] = 25,
+	[136] = 26,
+};
+
 static const struct operating_class_info *e4_find_opclass(uint32_t opclass)
 {
-	unsigned int i;
+	uint8_t index;
 
-	for (i = 0; i < L_ARRAY_SIZE(e4_operating_classes); i++) {
-		if (e4_operating_classes[i].operating_class != opclass)
-			continue;
+	if (opclass >= L_ARRAY_SIZE(e4_opclass_index))
+		return NULL;
 
-		return &e4_operating_classes[i];
-	}
+	index = e4_opclass_index[opclass];
+	if (!index)
+		return NULL;
 
-	return NULL;
+	return &e4_operating_classes[index - 1];
 }
 
 static int e4_channel_to_frequency(const struct operating_class_info *info,
@@ -974,106 +1237,131 @@ int oci_from_chandef(const struct band_chandef *own, uint8_t oci[static 3])
 	return -ENOENT;
 }
 
-uint8_t band_freq_to_channel(uint32_t freq, enum band_freq *out_band)
-{
-	uint32_t channel = 0;
-
-	if (freq >= 2412 && freq <= 2484) {
-		if (freq == 2484)
-			channel = 14;
-		else {
-			channel = freq - 2407;
-
-			if (channel % 5)
-				return 0;
+/*
+ * Helpers to expand a table whose entries are a constant expression of
+ * their index, so that the lookup tables below are built at compile time
+ * from the same arithmetic as the band plans.
+ */
+#define TABLE_REP2(m, i) m(i) m((i) + 1)
+#define TABLE_REP4(m, i) TABLE_REP2(m, i) TABLE_REP2(m, (i) + 2)
+#define TABLE_REP8(m, i) TABLE_REP4(m, i) TABLE_REP4(m, (i) + 4)
+#define TABLE_REP16(m, i) TABLE_REP8(m, i) TABLE_REP8(m, (i) + 8)
+#define TABLE_REP32(m, i) TABLE_REP16(m, i) TABLE_REP16(m, (i) + 16)
+#define TABLE_REP64(m, i) TABLE_REP32(m, i) TABLE_REP32(m, (i) + 32)
+#define TABLE_REP128(m, i) TABLE_REP64(m, i) TABLE_REP64(m, (i) + 64)
+#define TABLE_REP256(m, i) TABLE_REP128(m, i) TABLE_REP128(m, (i) + 128)
+#define TABLE_REP512(m, i) TABLE_REP256(m, i) TABLE_REP256(m, (i) + 256)
 
-			channel /= 5;
-		}
+/*
+ * 2.4GHz channels, indexed by the offset from 2412 MHz.  2477 and 2482
+ * are off the band plan but have always been mapped on the 2407 MHz
+ * raster.
+ */
+static const uint8_t band_2_4ghz_channel[] = {
+	[0] = 1, [5] = 2, [10] = 3, [15] = 4, [20] = 5, [25] = 6, [30] = 7,
+	[35] = 8, [40] = 9, [45] = 10, [50] = 11, [55] = 12, [60] = 13,
+	[65] = 14, [70] = 15, [72] = 14,
+};
 
-		if (out_band)
-			*out_band = BAND_FREQ_2_4_GHZ;
+/*
+ * 4.9, 5 and 6GHz channels, these are all on a 5 MHz raster starting
+ * at 4905 MHz.  Channel 0 means the frequency isn't a valid channel.
+ */
+#define BAND_HIGH_FREQ_BASE 4905
+#define BAND_HIGH_FREQ(i) (BAND_HIGH_FREQ_BASE + (i) * 5)
 
-		return channel;
-	}
+#define BAND_HIGH_CHANNEL(f)						\
+	((f) < 5000 ? ((f) - 4000) / 5 :				\
+	 (f) < 5900 ? ((f) - 5000) / 5 :				\
+	 (f) == 5935 ? 2 :						\
+	 (f) > 5950 && (f) <= 7115 ? ((f) - 5950) / 5 : 0)
 
-	if (freq >= 5005 && freq < 5900) {
-		if (freq % 5)
-			return 0;
+#define BAND_HIGH_BAND(f)						\
+	(!BAND_HIGH_CHANNEL(f) ? 0 :					\
+	 (f) < 5900 ? BAND_FREQ_5_GHZ : BAND_FREQ_6_GHZ)
 
-		channel = (freq - 5000) / 5;
+#define BAND_HIGH_ENTRY(i)						\
+	{ BAND_HIGH_CHANNEL(BAND_HIGH_FREQ(i)),				\
+		BAND_HIGH_BAND(BAND_HIGH_FREQ(i)) },
 
-		if (out_band)
-			*out_band = BAND_FREQ_5_GHZ;
+static const struct {
+	uint8_t channel;
+	uint8_t band;
+} band_high_channel[512] = {
+	TABLE_REP512(BAND_HIGH_ENTRY, 0)
+};
 
-		return channel;
-	}
+uint8_t band_freq_to_channel(uint32_t freq, enum band_freq *out_band)
+{
+	uint32_t index;
+	uint8_t channel;
 
-	if (freq >= 4905 && freq < 5000) {
-		if (freq % 5)
+	if (freq >= 2412 && freq - 2412 < L_ARRAY_SIZE(band_2_4ghz_channel)) {
+		channel = band_2_4ghz_channel[freq - 2412];
+		if (!channel)
 			return 0;
 
-		channel = (freq - 4000) / 5;
-
 		if (out_band)
-			*out_band = BAND_FREQ_5_GHZ;
+			*out_band = BAND_FREQ_2_4_GHZ;
 
 		return channel;
 	}
 
-	if (freq > 5950 && freq <= 7115) {
-		if (freq % 5)
-			return 0;
-
-		channel = (freq - 5950) / 5;
-
-		if (out_band)
-			*out_band = BAND_FREQ_6_GHZ;
+	if (freq < BAND_HIGH_FREQ_BASE || freq % 5)
+		return 0;
 
-		return channel;
-	}
+	index = (freq - BAND_HIGH_FREQ_BASE) / 5;
+	if (index >= L_ARRAY_SIZE(band_high_channel))
+		return 0;
 
-	if (freq == 5935) {
-		if (out_band)
-			*out_band = BAND_FREQ_6_GHZ;
+	channel = band_high_channel[index].channel;
+	if (!channel)
+		return 0;
 
-		return 2;
-	}
+	if (out_band)
+		*out_band = band_high_channel[index].band;
 
-	return 0;
+	return channel;
 }
 
-uint32_t band_channel_to_freq(uint8_t channel, enum band_freq band)
-{
-	if (band == BAND_FREQ_2_4_GHZ) {
-		if (channel >= 1 && channel <= 13)
-			return 2407 + 5 * channel;
-
-		if (channel == 14)
-			return 2484;
-	}
+static const uint16_t band_2_4ghz_freq[] = {
+	[1] = 2412, [2] = 2417, [3] = 2422, [4] = 2427, [5] = 2432,
+	[6] = 2437, [7] = 2442, [8] = 2447, [9] = 2452, [10] = 2457,
+	[11] = 2462, [12] = 2467, [13] = 2472, [14] = 2484,
+};
 
-	if (band == BAND_FREQ_5_GHZ) {
-		if (channel >= 1 && channel <= 179)
-			return 5000 + 5 * channel;
+#define BAND_5GHZ_FREQ(c)						\
+	((c) >= 1 && (c) <= 179 ? 5000 + 5 * (c) :			\
+	 (c) >= 181 && (c) <= 199 ? 4000 + 5 * (c) : 0),
 
-		if (channel >= 181 && channel <= 199)
-			return 4000 + 5 * channel;
-	}
+static const uint16_t band_5ghz_freq[256] = {
+	TABLE_REP256(BAND_5GHZ_FREQ, 0)
+};
 
-	if (band == BAND_FREQ_6_GHZ) {
-		/* operating class 136 */
-		if (channel == 2)
-			return 5935;
+/*
+ * Channel 2 is operating class 136, the others increment by 4 starting
+ * with 1 for operating classes 131 - 135
+ */
+#define BAND_6GHZ_FREQ(c)						\
+	((c) == 2 ? 5935 :						\
+	 (c) % 4 == 1 && (c) <= 233 ? 5950 + 5 * (c) : 0),
 
-		/* Channels increment by 4, starting with 1 */
-		if (channel % 4 != 1)
-			return 0;
+static const uint16_t band_6ghz_freq[256] = {
+	TABLE_REP256(BAND_6GHZ_FREQ, 0)
+};
 
-		if (channel < 1 || channel > 233)
+uint32_t band_channel_to_freq(uint8_t channel, enum band_freq band)
+{
+	switch (band) {
+	case BAND_FREQ_2_4_GHZ:
+		if (channel >= L_ARRAY_SIZE(band_2_4ghz_freq))
 			return 0;
 
-		/* operating classes 131, 132, 133, 134, 135 */
-		return 5950 + 5 * channel;
+		return band_2_4ghz_freq[channel];
+	case BAND_FREQ_5_GHZ:
+		return band_5ghz_freq[channel];
+	case BAND_FREQ_6_GHZ:
+		return band_6ghz_freq[channel];
 	}
 
 	return 0;
@@ -50,6 +50,9 @@ struct band_chandef {
 };
 
 struct band {
+	uint8_t he_mcs_set[12];
+	uint8_t he_phy_capa[11];
+	bool he_supported : 1;
 	uint8_t vht_mcs_set[8];
 	uint8_t vht_capabilities[4];
 	bool vht_supported : 1;
@@ -66,6 +69,10 @@ bool band_ofdm_rate(uint8_t index, enum ofdm_channel_width width,
 			int32_t rssi, uint8_t nss, bool sgi,
 			uint64_t *data_rate);
 
+int band_estimate_he_rx_rate(const struct band *band,
+				const uint8_t *hec, const uint8_t *heo,
+				const uint8_t *vhto, const uint8_t *hto,
+				int32_t rssi, uint64_t *out_data_rate);
 int band_estimate_vht_rx_rate(const struct band *band,
 				const uint8_t *vhtc, const uint8_t *vhto,
 				const uint8_t *htc, const uint8_t *hto,
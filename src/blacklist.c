@@ -43,147 +43,321 @@
 /* The maximum amount of time a BSS can be blacklisted for */
 #define BLACKLIST_DEFAULT_MAX_TIMEOUT	86400
 
+/*
+ * Timeouts for the softer reason classes.  Being kicked by an AP or failing
+ * to roam to it says less about the BSS than a failed connection, so these
+ * start (and top out) much lower.
+ */
+#define BLACKLIST_AP_DISCONNECT_TIMEOUT		10
+#define BLACKLIST_AP_DISCONNECT_MAX_TIMEOUT	600
+#define BLACKLIST_ROAM_FAILED_TIMEOUT		30
+#define BLACKLIST_ROAM_FAILED_MAX_TIMEOUT	3600
+
+/*
+ * Expired entries are not cleaned up on lookup.  Instead every entry sits in
+ * a slot of a timer wheel which is advanced once per tick; an entry whose
+ * next decay lies more than one revolution away is skipped 'rounds' times.
+ */
+#define BLACKLIST_WHEEL_SLOTS	64
+#define BLACKLIST_WHEEL_TICK	10
+
 static uint64_t blacklist_multiplier;
-static uint64_t blacklist_initial_timeout;
-static uint64_t blacklist_max_timeout;
+
+struct blacklist_class {
+	uint64_t initial_timeout;
+	uint64_t max_timeout;
+};
+
+static struct blacklist_class classes[__BLACKLIST_REASON_COUNT];
+
+struct blacklist_strikes {
+	uint64_t expire_time;
+	uint64_t decay_time;
+	uint64_t timeout;
+	unsigned int count;
+};
 
 struct blacklist_entry {
 	uint8_t addr[6];
-	uint64_t added_time;
-	uint64_t expire_time;
+	struct blacklist_strikes strikes[__BLACKLIST_REASON_COUNT];
+	unsigned int slot;
+	unsigned int rounds;
+	bool scheduled : 1;
 };
 
-static struct l_queue *blacklist;
+static struct l_hashmap *blacklist;
+static struct l_queue *wheel[BLACKLIST_WHEEL_SLOTS];
+static unsigned int wheel_pos;
+static struct l_timeout *wheel_timeout;
 
-static bool check_if_expired(void *data, void *user_data)
+static unsigned int blacklist_addr_hash(const void *key)
 {
-	struct blacklist_entry *entry = data;
-	uint64_t now = l_get_u64(user_data);
+	const uint8_t *addr = key;
 
-	if (l_time_diff(now, entry->added_time) > blacklist_max_timeout) {
-		l_debug("Removing entry "MAC" on prune", MAC_STR(entry->addr));
-		l_free(entry);
-		return true;
-	}
+	/*
+	 * The OUI part of the address is the same for most APs of a network,
+	 * only hash the NIC specific bytes 3-5.
+	 */
+	return addr[3] << 16 | addr[4] << 8 | addr[5];
+}
 
-	return false;
+static int blacklist_addr_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, 6);
 }
 
-static void blacklist_prune(void)
+static void blacklist_unschedule(struct blacklist_entry *entry)
 {
-	uint64_t now = l_time_now();
+	if (!entry->scheduled)
+		return;
 
-	l_queue_foreach_remove(blacklist, check_if_expired, &now);
+	l_queue_remove(wheel[entry->slot], entry);
+	entry->scheduled = false;
 }
 
-static bool match_addr(const void *a, const void *b)
+static void blacklist_wheel_tick(struct l_timeout *timeout, void *user_data);
+
+static void blacklist_schedule(struct blacklist_entry *entry, uint64_t now)
 {
-	const struct blacklist_entry *entry = a;
-	const uint8_t *addr = b;
+	uint64_t next = 0;
+	uint64_t ticks;
+	unsigned int i;
 
-	if (!memcmp(entry->addr, addr, 6))
-		return true;
+	blacklist_unschedule(entry);
 
-	return false;
+	for (i = 0; i < __BLACKLIST_REASON_COUNT; i++) {
+		struct blacklist_strikes *s = &entry->strikes[i];
+
+		if (!s->count)
+			continue;
+
+		if (!next || l_time_before(s->decay_time, next))
+			next = s->decay_time;
+	}
+
+	if (!next)
+		return;
+
+	ticks = l_time_after(next, now) ? l_time_diff(now, next) : 0;
+	ticks = ticks / (BLACKLIST_WHEEL_TICK * L_USEC_PER_SEC) + 1;
+
+	entry->slot = (wheel_pos + ticks) % BLACKLIST_WHEEL_SLOTS;
+	entry->rounds = (ticks - 1) / BLACKLIST_WHEEL_SLOTS;
+	entry->scheduled = true;
+	l_queue_push_tail(wheel[entry->slot], entry);
+
+	if (!wheel_timeout)
+		wheel_timeout = l_timeout_create(BLACKLIST_WHEEL_TICK,
+						blacklist_wheel_tick,
+						NULL, NULL);
+}
+
+/*
+ * Each strike is forgotten one timeout after the blacklisting ended, and the
+ * timeout steps back down by the multiplier, so a BSS that behaves again
+ * gradually returns to the initial timeout rather than staying at the maximum.
+ */
+static bool blacklist_decay(struct blacklist_entry *entry, uint64_t now)
+{
+	bool active = false;
+	unsigned int i;
+
+	for (i = 0; i < __BLACKLIST_REASON_COUNT; i++) {
+		struct blacklist_strikes *s = &entry->strikes[i];
+
+		if (!s->count)
+			continue;
+
+		if (l_time_before(now, s->decay_time)) {
+			active = true;
+			continue;
+		}
+
+		if (--s->count) {
+			s->timeout /= blacklist_multiplier;
+
+			if (s->timeout < classes[i].initial_timeout)
+				s->timeout = classes[i].initial_timeout;
+
+			s->decay_time = l_time_offset(now, s->timeout);
+			active = true;
+		}
+	}
+
+	return active;
 }
 
-void blacklist_add_bss(const uint8_t *addr)
+static void blacklist_wheel_tick(struct l_timeout *timeout, void *user_data)
 {
+	uint64_t now = l_time_now();
+	struct l_queue *due;
 	struct blacklist_entry *entry;
 
-	blacklist_prune();
+	wheel_pos = (wheel_pos + 1) % BLACKLIST_WHEEL_SLOTS;
 
-	entry = l_queue_find(blacklist, match_addr, addr);
+	due = wheel[wheel_pos];
+	wheel[wheel_pos] = l_queue_new();
+
+	while ((entry = l_queue_pop_head(due))) {
+		if (entry->rounds) {
+			entry->rounds--;
+			l_queue_push_tail(wheel[wheel_pos], entry);
+			continue;
+		}
+
+		entry->scheduled = false;
+
+		if (blacklist_decay(entry, now)) {
+			blacklist_schedule(entry, now);
+			continue;
+		}
+
+		l_debug("Removing entry "MAC" after decay",
+				MAC_STR(entry->addr));
+		l_hashmap_remove(blacklist, entry->addr);
+		l_free(entry);
+	}
 
-	if (entry) {
-		uint64_t offset = l_time_diff(entry->added_time,
-							entry->expire_time);
+	l_queue_destroy(due, NULL);
 
-		offset *= blacklist_multiplier;
+	if (l_hashmap_isempty(blacklist)) {
+		l_timeout_remove(wheel_timeout);
+		wheel_timeout = NULL;
+		return;
+	}
 
-		if (offset > blacklist_max_timeout)
-			offset = blacklist_max_timeout;
+	l_timeout_modify(timeout, BLACKLIST_WHEEL_TICK);
+}
 
-		entry->expire_time = l_time_offset(entry->added_time, offset);
+void blacklist_add_bss(const uint8_t *addr, enum blacklist_reason reason)
+{
+	struct blacklist_entry *entry;
+	struct blacklist_strikes *s;
+	uint64_t now = l_time_now();
 
+	if (L_WARN_ON(reason >= __BLACKLIST_REASON_COUNT))
 		return;
+
+	entry = l_hashmap_lookup(blacklist, addr);
+	if (!entry) {
+		entry = l_new(struct blacklist_entry, 1);
+		memcpy(entry->addr, addr, 6);
+		l_hashmap_insert(blacklist, entry->addr, entry);
 	}
 
-	entry = l_new(struct blacklist_entry, 1);
+	s = &entry->strikes[reason];
+
+	if (s->count) {
+		s->timeout *= blacklist_multiplier;
+
+		if (s->timeout > classes[reason].max_timeout)
+			s->timeout = classes[reason].max_timeout;
+	} else
+		s->timeout = classes[reason].initial_timeout;
 
-	entry->added_time = l_time_now();
-	entry->expire_time = l_time_offset(entry->added_time,
-						blacklist_initial_timeout);
-	memcpy(entry->addr, addr, 6);
+	s->count++;
+	s->expire_time = l_time_offset(now, s->timeout);
+	s->decay_time = l_time_offset(s->expire_time, s->timeout);
 
-	l_queue_push_tail(blacklist, entry);
+	blacklist_schedule(entry, now);
 }
 
 bool blacklist_contains_bss(const uint8_t *addr)
 {
-	bool ret;
-	uint64_t time_now;
 	struct blacklist_entry *entry;
+	uint64_t time_now;
+	unsigned int i;
 
-	blacklist_prune();
-
-	entry = l_queue_find(blacklist, match_addr, addr);
-
+	entry = l_hashmap_lookup(blacklist, addr);
 	if (!entry)
 		return false;
 
 	time_now = l_time_now();
 
-	ret = l_time_after(time_now, entry->expire_time) ? false : true;
+	for (i = 0; i < __BLACKLIST_REASON_COUNT; i++) {
+		struct blacklist_strikes *s = &entry->strikes[i];
+
+		if (s->count && l_time_before(time_now, s->expire_time))
+			return true;
+	}
 
-	return ret;
+	return false;
 }
 
 void blacklist_remove_bss(const uint8_t *addr)
 {
 	struct blacklist_entry *entry;
 
-	blacklist_prune();
-
-	entry = l_queue_remove_if(blacklist, match_addr, addr);
-
+	entry = l_hashmap_remove(blacklist, addr);
 	if (!entry)
 		return;
 
+	blacklist_unschedule(entry);
 	l_free(entry);
 }
 
 static int blacklist_init(void)
 {
 	const struct l_settings *config = iwd_get_config();
+	struct blacklist_class *connect =
+				&classes[BLACKLIST_REASON_CONNECT_FAILED];
+	unsigned int i;
 
 	if (!l_settings_get_uint64(config, "Blacklist", "InitialTimeout",
-					&blacklist_initial_timeout))
-		blacklist_initial_timeout = BLACKLIST_DEFAULT_TIMEOUT;
-
-	/* For easier user configuration the timeout values are in seconds */
-	blacklist_initial_timeout *= 1000000;
+					&connect->initial_timeout))
+		connect->initial_timeout = BLACKLIST_DEFAULT_TIMEOUT;
 
 	if (!l_settings_get_uint64(config, "Blacklist",
 					"Multiplier",
 					&blacklist_multiplier))
 		blacklist_multiplier = BLACKLIST_DEFAULT_MULTIPLIER;
 
+	if (!blacklist_multiplier)
+		blacklist_multiplier = 1;
+
 	if (!l_settings_get_uint64(config, "Blacklist",
 					"MaximumTimeout",
-					&blacklist_max_timeout))
-		blacklist_max_timeout = BLACKLIST_DEFAULT_MAX_TIMEOUT;
+					&connect->max_timeout))
+		connect->max_timeout = BLACKLIST_DEFAULT_MAX_TIMEOUT;
+
+	classes[BLACKLIST_REASON_AP_DISCONNECT].initial_timeout =
+					BLACKLIST_AP_DISCONNECT_TIMEOUT;
+	classes[BLACKLIST_REASON_AP_DISCONNECT].max_timeout =
+					BLACKLIST_AP_DISCONNECT_MAX_TIMEOUT;
+	classes[BLACKLIST_REASON_ROAM_FAILED].initial_timeout =
+					BLACKLIST_ROAM_FAILED_TIMEOUT;
+	classes[BLACKLIST_REASON_ROAM_FAILED].max_timeout =
+					BLACKLIST_ROAM_FAILED_MAX_TIMEOUT;
+
+	/* For easier user configuration the timeout values are in seconds */
+	for (i = 0; i < __BLACKLIST_REASON_COUNT; i++) {
+		classes[i].initial_timeout *= L_USEC_PER_SEC;
+		classes[i].max_timeout *= L_USEC_PER_SEC;
+	}
 
-	blacklist_max_timeout *= 1000000;
+	blacklist = l_hashmap_new();
+	l_hashmap_set_hash_function(blacklist, blacklist_addr_hash);
+	l_hashmap_set_compare_function(blacklist, blacklist_addr_compare);
 
-	blacklist = l_queue_new();
+	for (i = 0; i < BLACKLIST_WHEEL_SLOTS; i++)
+		wheel[i] = l_queue_new();
 
 	return 0;
 }
 
 static void blacklist_exit(void)
 {
-	l_queue_destroy(blacklist, l_free);
+	unsigned int i;
+
+	l_timeout_remove(wheel_timeout);
+	wheel_timeout = NULL;
+
+	for (i = 0; i < BLACKLIST_WHEEL_SLOTS; i++) {
+		l_queue_destroy(wheel[i], NULL);
+		wheel[i] = NULL;
+	}
+
+	l_hashmap_destroy(blacklist, l_free);
 }
 
 IWD_MODULE(blacklist, blacklist_init, blacklist_exit)
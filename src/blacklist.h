@@ -20,6 +20,16 @@
  *
  */
 
-void blacklist_add_bss(const uint8_t *addr);
+enum blacklist_reason {
+	/* Authentication or association with the BSS failed */
+	BLACKLIST_REASON_CONNECT_FAILED,
+	/* The BSS deauthenticated or disassociated us while connected */
+	BLACKLIST_REASON_AP_DISCONNECT,
+	/* A roam to the BSS failed */
+	BLACKLIST_REASON_ROAM_FAILED,
+	__BLACKLIST_REASON_COUNT,
+};
+
+void blacklist_add_bss(const uint8_t *addr, enum blacklist_reason reason);
 bool blacklist_contains_bss(const uint8_t *addr);
 void blacklist_remove_bss(const uint8_t *addr);
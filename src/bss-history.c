@@ -0,0 +1,335 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <time.h>
+
+#include <ell/ell.h>
+
+#include "src/bss-history.h"
+#include "src/util.h"
+#include "src/iwd.h"
+#include "src/module.h"
+#include "src/storage.h"
+#include "src/scan.h"
+
+/*
+ * Connection quality history of the BSSes we've been connected to, or tried
+ * to connect to.  Used to adjust the BSS rank so that BSSes that look good in
+ * the scan results but keep failing, or perform badly once connected, end up
+ * being preferred less.
+ */
+
+/* Least recently seen entries are dropped beyond this */
+#define BSS_HISTORY_MAX_ENTRIES		256
+
+/* Entries not seen for this long are dropped on load, in seconds */
+#define BSS_HISTORY_MAX_AGE		(30 * 86400)
+
+/* Counters are halved once their sum reaches this to favor recent events */
+#define BSS_HISTORY_MAX_EVENTS		32
+
+/* Connected time at which the full stability bonus is given, in seconds */
+#define BSS_HISTORY_STABLE_TIME		(10 * 3600)
+
+struct bss_history {
+	uint8_t addr[6];
+	uint32_t connects;
+	uint32_t connect_failures;
+	uint32_t roams;
+	uint32_t roam_failures;
+	uint64_t connected_time;	/* Seconds */
+	uint32_t throughput;		/* kbit/s, moving average */
+	uint64_t last_seen;		/* Wall-clock seconds */
+	uint64_t session_start;		/* l_time_now(), 0 if not connected */
+};
+
+static struct l_hashmap *history;
+
+static unsigned int bss_history_addr_hash(const void *key)
+{
+	const uint8_t *addr = key;
+
+	return l_get_le32(addr + 2);
+}
+
+static int bss_history_addr_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, 6);
+}
+
+struct oldest_data {
+	struct bss_history *oldest;
+};
+
+static void find_oldest(const void *key, void *value, void *user_data)
+{
+	struct bss_history *entry = value;
+	struct oldest_data *data = user_data;
+
+	if (entry->session_start)
+		return;
+
+	if (!data->oldest || entry->last_seen < data->oldest->last_seen)
+		data->oldest = entry;
+}
+
+static struct bss_history *bss_history_get(const uint8_t *addr)
+{
+	struct bss_history *entry = l_hashmap_lookup(history, addr);
+
+	if (entry)
+		goto done;
+
+	if (l_hashmap_size(history) >= BSS_HISTORY_MAX_ENTRIES) {
+		struct oldest_data data = { NULL };
+
+		l_hashmap_foreach(history, find_oldest, &data);
+
+		if (data.oldest) {
+			l_hashmap_remove(history, data.oldest->addr);
+			l_free(data.oldest);
+		}
+	}
+
+	entry = l_new(struct bss_history, 1);
+	memcpy(entry->addr, addr, 6);
+	l_hashmap_insert(history, entry->addr, entry);
+
+done:
+	entry->last_seen = time(NULL);
+	return entry;
+}
+
+static void bss_history_decay(struct bss_history *entry)
+{
+	if (entry->connects + entry->connect_failures + entry->roams +
+			entry->roam_failures < BSS_HISTORY_MAX_EVENTS)
+		return;
+
+	entry->connects /= 2;
+	entry->connect_failures /= 2;
+	entry->roams /= 2;
+	entry->roam_failures /= 2;
+}
+
+static void bss_history_save_entry(const void *key, void *value,
+					void *user_data)
+{
+	struct bss_history *entry = value;
+	struct l_settings *settings = user_data;
+	const char *group = util_address_to_string(entry->addr);
+
+	l_settings_set_uint(settings, group, "Connects", entry->connects);
+	l_settings_set_uint(settings, group, "ConnectFailures",
+				entry->connect_failures);
+	l_settings_set_uint(settings, group, "Roams", entry->roams);
+	l_settings_set_uint(settings, group, "RoamFailures",
+				entry->roam_failures);
+	l_settings_set_uint64(settings, group, "ConnectedTime",
+				entry->connected_time);
+	l_settings_set_uint(settings, group, "Throughput", entry->throughput);
+	l_settings_set_uint64(settings, group, "LastSeen", entry->last_seen);
+}
+
+static void bss_history_sync(void)
+{
+	struct l_settings *settings = l_settings_new();
+
+	l_hashmap_foreach(history, bss_history_save_entry, settings);
+	storage_bss_history_sync(settings);
+	l_settings_free(settings);
+}
+
+static void bss_history_load(void)
+{
+	struct l_settings *settings = storage_bss_history_load();
+	char **groups;
+	unsigned int i;
+	uint64_t now = time(NULL);
+
+	if (!settings)
+		return;
+
+	groups = l_settings_get_groups(settings);
+
+	for (i = 0; groups[i]; i++) {
+		struct bss_history *entry;
+		uint8_t addr[6];
+		uint64_t last_seen;
+
+		if (!util_string_to_address(groups[i], addr))
+			continue;
+
+		if (!l_settings_get_uint64(settings, groups[i], "LastSeen",
+						&last_seen) ||
+				last_seen + BSS_HISTORY_MAX_AGE < now)
+			continue;
+
+		if (l_hashmap_size(history) >= BSS_HISTORY_MAX_ENTRIES)
+			break;
+
+		entry = l_new(struct bss_history, 1);
+		memcpy(entry->addr, addr, 6);
+		entry->last_seen = last_seen;
+
+		l_settings_get_uint(settings, groups[i], "Connects",
+					&entry->connects);
+		l_settings_get_uint(settings, groups[i], "ConnectFailures",
+					&entry->connect_failures);
+		l_settings_get_uint(settings, groups[i], "Roams",
+					&entry->roams);
+		l_settings_get_uint(settings, groups[i], "RoamFailures",
+					&entry->roam_failures);
+		l_settings_get_uint64(settings, groups[i], "ConnectedTime",
+					&entry->connected_time);
+		l_settings_get_uint(settings, groups[i], "Throughput",
+					&entry->throughput);
+
+		l_hashmap_insert(history, entry->addr, entry);
+	}
+
+	l_strv_free(groups);
+	l_settings_free(settings);
+}
+
+void bss_history_connect_failed(const uint8_t *addr)
+{
+	struct bss_history *entry = bss_history_get(addr);
+
+	entry->connect_failures++;
+	bss_history_decay(entry);
+	bss_history_sync();
+}
+
+void bss_history_session_start(const uint8_t *addr, bool roamed)
+{
+	struct bss_history *entry = bss_history_get(addr);
+
+	if (roamed)
+		entry->roams++;
+	else
+		entry->connects++;
+
+	bss_history_decay(entry);
+	entry->session_start = l_time_now();
+}
+
+void bss_history_session_end(const uint8_t *addr)
+{
+	struct bss_history *entry = l_hashmap_lookup(history, addr);
+
+	if (!entry || !entry->session_start)
+		return;
+
+	entry->connected_time += l_time_to_secs(l_time_diff(
+						entry->session_start,
+						l_time_now()));
+	entry->session_start = 0;
+	entry->last_seen = time(NULL);
+
+	bss_history_sync();
+}
+
+void bss_history_roam_failed(const uint8_t *addr)
+{
+	struct bss_history *entry = bss_history_get(addr);
+
+	entry->roam_failures++;
+	bss_history_decay(entry);
+	bss_history_sync();
+}
+
+void bss_history_throughput(const uint8_t *addr, uint32_t kbps)
+{
+	struct bss_history *entry = l_hashmap_lookup(history, addr);
+
+	if (!entry)
+		return;
+
+	if (!entry->throughput)
+		entry->throughput = kbps;
+	else
+		entry->throughput = (entry->throughput * 3 + kbps) / 4;
+}
+
+double bss_history_rank_factor(const struct scan_bss *bss)
+{
+	struct bss_history *entry = l_hashmap_lookup(history, bss->addr);
+	double factor = 1.0;
+	uint32_t attempts;
+
+	if (!entry)
+		return factor;
+
+	/* Down to half the rank for a BSS we always fail to connect to */
+	attempts = entry->connects + entry->connect_failures;
+	if (attempts)
+		factor *= 1.0 - 0.5 * entry->connect_failures / attempts;
+
+	attempts = entry->roams + entry->roam_failures;
+	if (attempts)
+		factor *= 1.0 - 0.3 * entry->roam_failures / attempts;
+
+	/*
+	 * Between 0.8 and 1.2 depending on how much of the advertised rate
+	 * we actually got last time
+	 */
+	if (entry->throughput && bss->data_rate) {
+		double ratio = entry->throughput * 1000.0 / bss->data_rate;
+
+		factor *= 0.8 + 0.4 * (ratio > 1.0 ? 1.0 : ratio);
+	}
+
+	/* Up to 10% more for BSSes that already served us for long */
+	if (entry->connected_time >= BSS_HISTORY_STABLE_TIME)
+		factor *= 1.1;
+	else
+		factor *= 1.0 + 0.1 * entry->connected_time /
+						BSS_HISTORY_STABLE_TIME;
+
+	return factor;
+}
+
+static int bss_history_init(void)
+{
+	history = l_hashmap_new();
+	l_hashmap_set_hash_function(history, bss_history_addr_hash);
+	l_hashmap_set_compare_function(history, bss_history_addr_compare);
+
+	bss_history_load();
+
+	return 0;
+}
+
+static void bss_history_exit(void)
+{
+	bss_history_sync();
+
+	l_hashmap_destroy(history, l_free);
+	history = NULL;
+}
+
+IWD_MODULE(bss_history, bss_history_init, bss_history_exit)
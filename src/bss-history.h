@@ -0,0 +1,30 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct scan_bss;
+
+void bss_history_connect_failed(const uint8_t *addr);
+void bss_history_session_start(const uint8_t *addr, bool roamed);
+void bss_history_session_end(const uint8_t *addr);
+void bss_history_roam_failed(const uint8_t *addr);
+void bss_history_throughput(const uint8_t *addr, uint32_t kbps);
+double bss_history_rank_factor(const struct scan_bss *bss);
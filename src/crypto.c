@@ -28,6 +28,7 @@
 
 #include <stdbool.h>
 #include <string.h>
+#include <limits.h>
 #include <errno.h>
 #include <linux/if_ether.h>
 
@@ -36,6 +37,7 @@
 #include "ell/useful.h"
 #include "src/missing.h"
 #include "src/crypto.h"
+#include "src/softcrypto.h"
 
 #define ARC4_MIN_KEY_SIZE	1
 #define ARC4_MAX_KEY_SIZE	256
@@ -71,20 +73,175 @@ size_t crypto_dh5_prime_size = sizeof(crypto_dh5_prime);
 const unsigned char crypto_dh5_generator[] = { 0x2 };
 size_t crypto_dh5_generator_size = sizeof(crypto_dh5_generator);
 
+/*
+ * Thin wrappers over the l_checksum / l_cipher objects used by the key
+ * derivation functions below.  When built with --enable-soft-crypto the
+ * SHA1/SHA256/SHA384 HMACs and AES are computed in-process instead, which
+ * avoids the AF_ALG socket setup and round trips on every handshake.
+ */
+struct crypto_hmac {
+	struct l_checksum *checksum;
+#ifdef HAVE_SOFT_CRYPTO
+	struct soft_hmac soft;
+#endif
+};
+
+static bool crypto_hmac_init(struct crypto_hmac *hmac,
+				enum l_checksum_type type,
+				const void *key, size_t key_len)
+{
+#ifdef HAVE_SOFT_CRYPTO
+	hmac->checksum = NULL;
+
+	if (soft_hmac_init(&hmac->soft, type, key, key_len))
+		return true;
+#endif
+
+	hmac->checksum = l_checksum_new_hmac(type, key, key_len);
+
+	return hmac->checksum != NULL;
+}
+
+static bool crypto_hmac_updatev(struct crypto_hmac *hmac,
+				const struct iovec *iov, size_t iov_len)
+{
+#ifdef HAVE_SOFT_CRYPTO
+	if (!hmac->checksum) {
+		soft_hmac_updatev(&hmac->soft, iov, iov_len);
+		return true;
+	}
+#endif
+
+	return l_checksum_updatev(hmac->checksum, iov, iov_len);
+}
+
+static ssize_t crypto_hmac_get_digest(struct crypto_hmac *hmac,
+					void *out, size_t len)
+{
+#ifdef HAVE_SOFT_CRYPTO
+	if (!hmac->checksum)
+		return soft_hmac_final(&hmac->soft, out, len);
+#endif
+
+	return l_checksum_get_digest(hmac->checksum, out, len);
+}
+
+static void crypto_hmac_reset(struct crypto_hmac *hmac)
+{
+#ifdef HAVE_SOFT_CRYPTO
+	if (!hmac->checksum) {
+		soft_hmac_reset(&hmac->soft);
+		return;
+	}
+#endif
+
+	l_checksum_reset(hmac->checksum);
+}
+
+static void crypto_hmac_free(struct crypto_hmac *hmac)
+{
+#ifdef HAVE_SOFT_CRYPTO
+	soft_hmac_clear(&hmac->soft);
+#endif
+
+	l_checksum_free(hmac->checksum);
+}
+
+static bool crypto_hashv(enum l_checksum_type type, const struct iovec *iov,
+				size_t iov_len, void *out, size_t len)
+{
+	struct l_checksum *sha;
+#ifdef HAVE_SOFT_CRYPTO
+	struct soft_hash hash;
+
+	if (soft_hash_init(&hash, type)) {
+		soft_hash_updatev(&hash, iov, iov_len);
+		soft_hash_final(&hash, out, len);
+		soft_hash_clear(&hash);
+		return true;
+	}
+#endif
+
+	sha = l_checksum_new(type);
+	if (!sha)
+		return false;
+
+	l_checksum_updatev(sha, iov, iov_len);
+	l_checksum_get_digest(sha, out, len);
+	l_checksum_free(sha);
+
+	return true;
+}
+
+struct crypto_aes {
+	struct l_cipher *cipher;
+#ifdef HAVE_SOFT_CRYPTO
+	struct soft_aes soft;
+#endif
+};
+
+static bool crypto_aes_init(struct crypto_aes *aes,
+				const void *key, size_t key_len)
+{
+#ifdef HAVE_SOFT_CRYPTO
+	aes->cipher = NULL;
+
+	if (soft_aes_init(&aes->soft, key, key_len))
+		return true;
+#endif
+
+	aes->cipher = l_cipher_new(L_CIPHER_AES, key, key_len);
+
+	return aes->cipher != NULL;
+}
+
+static bool crypto_aes_encrypt(struct crypto_aes *aes, void *block)
+{
+#ifdef HAVE_SOFT_CRYPTO
+	if (!aes->cipher) {
+		soft_aes_encrypt(&aes->soft, block, block);
+		return true;
+	}
+#endif
+
+	return l_cipher_encrypt(aes->cipher, block, block, 16);
+}
+
+static bool crypto_aes_decrypt(struct crypto_aes *aes, void *block)
+{
+#ifdef HAVE_SOFT_CRYPTO
+	if (!aes->cipher) {
+		soft_aes_decrypt(&aes->soft, block, block);
+		return true;
+	}
+#endif
+
+	return l_cipher_decrypt(aes->cipher, block, block, 16);
+}
+
+static void crypto_aes_free(struct crypto_aes *aes)
+{
+#ifdef HAVE_SOFT_CRYPTO
+	soft_aes_clear(&aes->soft);
+#endif
+
+	l_cipher_free(aes->cipher);
+}
+
 static bool hmac_common(enum l_checksum_type type,
 			const void *key, size_t key_len,
 			const void *data, size_t data_len,
 			void *output, size_t size)
 {
-	struct l_checksum *hmac;
+	struct crypto_hmac hmac;
+	struct iovec iov = { .iov_base = (void *) data, .iov_len = data_len };
 
-	hmac = l_checksum_new_hmac(type, key, key_len);
-	if (!hmac)
+	if (!crypto_hmac_init(&hmac, type, key, key_len))
 		return false;
 
-	l_checksum_update(hmac, data, data_len);
-	l_checksum_get_digest(hmac, output, size);
-	l_checksum_free(hmac);
+	crypto_hmac_updatev(&hmac, &iov, 1);
+	crypto_hmac_get_digest(&hmac, output, size);
+	crypto_hmac_free(&hmac);
 
 	return true;
 }
@@ -122,6 +279,11 @@ bool cmac_aes(const void *key, size_t key_len,
 {
 	struct l_checksum *cmac_aes;
 
+#ifdef HAVE_SOFT_CRYPTO
+	if (soft_cmac_aes(key, key_len, data, data_len, output, size))
+		return true;
+#endif
+
 	cmac_aes = l_checksum_new_cmac_aes(key, key_len);
 	if (!cmac_aes)
 		return false;
@@ -151,11 +313,10 @@ bool aes_unwrap(const uint8_t *kek, size_t kek_len, const uint8_t *in, size_t le
 	uint64_t *r;
 	size_t n = (len - 8) >> 3;
 	int i, j;
-	struct l_cipher *cipher;
+	struct crypto_aes aes;
 	uint64_t t = n * 6;
 
-	cipher = l_cipher_new(L_CIPHER_AES, kek, kek_len);
-	if (!cipher)
+	if (!crypto_aes_init(&aes, kek, kek_len))
 		return false;
 
 	/* Set up */
@@ -170,7 +331,7 @@ bool aes_unwrap(const uint8_t *kek, size_t kek_len, const uint8_t *in, size_t le
 			b[0] ^= L_CPU_TO_BE64(t);
 			b[1] = L_GET_UNALIGNED(r);
 
-			if (!l_cipher_decrypt(cipher, b, b, 16)) {
+			if (!crypto_aes_decrypt(&aes, b)) {
 				b[0] = 0;
 				goto done;
 			}
@@ -181,7 +342,7 @@ bool aes_unwrap(const uint8_t *kek, size_t kek_len, const uint8_t *in, size_t le
 	}
 
 done:
-	l_cipher_free(cipher);
+	crypto_aes_free(&aes);
 	explicit_bzero(&b[1], 8);
 
 	/* Check IV */
@@ -209,10 +370,9 @@ bool aes_wrap(const uint8_t *kek, const uint8_t *in, size_t len, uint8_t *out)
 	size_t n = len >> 3;
 	unsigned int i, j;
 	uint32_t t = 1;
-	struct l_cipher *cipher;
+	struct crypto_aes aes;
 
-	cipher = l_cipher_new(L_CIPHER_AES, kek, 16);
-	if (!cipher)
+	if (!crypto_aes_init(&aes, kek, 16))
 		return false;
 
 	memmove(r, in, len);
@@ -220,7 +380,7 @@ bool aes_wrap(const uint8_t *kek, const uint8_t *in, size_t len, uint8_t *out)
 	for (j = 0; j < 6; j++) {
 		for (i = 0; i < n; i++, t++) {
 			b[1] = L_GET_UNALIGNED(r + i);
-			l_cipher_encrypt(cipher, b, b, 16);
+			crypto_aes_encrypt(&aes, b);
 			L_PUT_UNALIGNED(b[1], r + i);
 			b[0] ^= L_CPU_TO_BE64(t);
 		}
@@ -228,7 +388,7 @@ bool aes_wrap(const uint8_t *kek, const uint8_t *in, size_t len, uint8_t *out)
 
 	L_PUT_UNALIGNED(b[0], r - 1);
 
-	l_cipher_free(cipher);
+	crypto_aes_free(&aes);
 
 	return true;
 }
@@ -319,15 +479,57 @@ static bool s2v(struct l_checksum *cmac, struct iovec *iov, size_t iov_len,
 	return true;
 }
 
+struct aes_siv_key {
+	struct l_checksum *cmac;
+	struct l_cipher *ctr;
+};
+
 /*
- * RFC 5297 Section 2.6 - SIV Encrypt
+ * The key is split into two equal halves, K1 is used for S2V and K2 is
+ * used for CTR.  Both are set up once here so that callers encrypting or
+ * decrypting repeatedly with the same key don't pay for the CMAC and CTR
+ * setup on each operation.
  */
-bool aes_siv_encrypt(const void *key, size_t key_len, const void *in,
-			size_t in_len, struct iovec *ad, size_t num_ad,
-			void *out)
+struct aes_siv_key *aes_siv_key_new(const void *key, size_t key_len)
 {
+	struct aes_siv_key *siv;
 	struct l_checksum *cmac;
 	struct l_cipher *ctr;
+
+	cmac = l_checksum_new_cmac_aes(key, key_len / 2);
+	if (!cmac)
+		return NULL;
+
+	ctr = l_cipher_new(L_CIPHER_AES_CTR, key + (key_len / 2), key_len / 2);
+	if (!ctr) {
+		l_checksum_free(cmac);
+		return NULL;
+	}
+
+	siv = l_new(struct aes_siv_key, 1);
+	siv->cmac = cmac;
+	siv->ctr = ctr;
+
+	return siv;
+}
+
+void aes_siv_key_free(struct aes_siv_key *siv)
+{
+	if (!siv)
+		return;
+
+	l_checksum_free(siv->cmac);
+	l_cipher_free(siv->ctr);
+	l_free(siv);
+}
+
+/*
+ * RFC 5297 Section 2.6 - SIV Encrypt
+ */
+bool aes_siv_key_encrypt(struct aes_siv_key *siv, const void *in,
+				size_t in_len, struct iovec *ad, size_t num_ad,
+				void *out)
+{
 	struct iovec iov[num_ad + 1];
 	uint8_t v[16];
 
@@ -338,51 +540,29 @@ bool aes_siv_encrypt(const void *key, size_t key_len, const void *in,
 	iov[num_ad].iov_len = in_len;
 	num_ad++;
 
-	/*
-	 * key is split into two equal halves... K1 is used for S2V and K2 is
-	 * used for CTR
-	 */
-	cmac = l_checksum_new_cmac_aes(key, key_len / 2);
-	if (!cmac)
-		return false;
-
-	if (!s2v(cmac, iov, num_ad, v)) {
-		l_checksum_free(cmac);
+	if (!s2v(siv->cmac, iov, num_ad, v))
 		return false;
-	}
-
-	l_checksum_free(cmac);
 
 	memcpy(out, v, 16);
 
 	v[8] &= 0x7f;
 	v[12] &= 0x7f;
 
-	ctr = l_cipher_new(L_CIPHER_AES_CTR, key + (key_len / 2), key_len / 2);
-	if (!ctr)
+	if (!l_cipher_set_iv(siv->ctr, v, 16))
 		return false;
 
-	if (!l_cipher_set_iv(ctr, v, 16))
-		goto free_ctr;
-
-	if (!l_cipher_encrypt(ctr, in, out + 16, in_len))
-		goto free_ctr;
-
-	l_cipher_free(ctr);
-
-	return true;
-
-free_ctr:
-	l_cipher_free(ctr);
-	return false;
+	return l_cipher_encrypt(siv->ctr, in, out + 16, in_len);
 }
 
-bool aes_siv_decrypt(const void *key, size_t key_len, const void *in,
-			size_t in_len, struct iovec *ad, size_t num_ad,
-			void *out)
+/*
+ * RFC 5297 Section 2.7 - SIV Decrypt
+ *
+ * The plaintext may be decrypted in place by passing in + 16 as out.
+ */
+bool aes_siv_key_decrypt(struct aes_siv_key *siv, const void *in,
+				size_t in_len, struct iovec *ad, size_t num_ad,
+				void *out)
 {
-	struct l_checksum *cmac;
-	struct l_cipher *ctr;
 	struct iovec iov[num_ad + 1];
 	uint8_t iv[16];
 	uint8_t v[16];
@@ -405,38 +585,52 @@ bool aes_siv_decrypt(const void *key, size_t key_len, const void *in,
 	iv[8] &= 0x7f;
 	iv[12] &= 0x7f;
 
-	ctr = l_cipher_new(L_CIPHER_AES_CTR, key + (key_len / 2), key_len / 2);
-	if (!ctr)
+	if (!l_cipher_set_iv(siv->ctr, iv, 16))
 		return false;
 
-	if (!l_cipher_set_iv(ctr, iv, 16))
-		goto free_ctr;
-
-	if (!l_cipher_decrypt(ctr, in + 16, out, in_len - 16))
-		goto free_ctr;
-
-	l_cipher_free(ctr);
+	if (!l_cipher_decrypt(siv->ctr, in + 16, out, in_len - 16))
+		return false;
 
 check_cmac:
-	cmac = l_checksum_new_cmac_aes(key, key_len / 2);
-	if (!cmac)
+	if (!s2v(siv->cmac, iov, num_ad, v))
 		return false;
 
-	if (!s2v(cmac, iov, num_ad, v)) {
-		l_checksum_free(cmac);
+	if (memcmp(v, in, 16))
 		return false;
-	}
 
-	l_checksum_free(cmac);
+	return true;
+}
+
+bool aes_siv_encrypt(const void *key, size_t key_len, const void *in,
+			size_t in_len, struct iovec *ad, size_t num_ad,
+			void *out)
+{
+	struct aes_siv_key *siv = aes_siv_key_new(key, key_len);
+	bool r;
 
-	if (memcmp(v, in, 16))
+	if (!siv)
 		return false;
 
-	return true;
+	r = aes_siv_key_encrypt(siv, in, in_len, ad, num_ad, out);
+	aes_siv_key_free(siv);
 
-free_ctr:
-	l_cipher_free(ctr);
-	return false;
+	return r;
+}
+
+bool aes_siv_decrypt(const void *key, size_t key_len, const void *in,
+			size_t in_len, struct iovec *ad, size_t num_ad,
+			void *out)
+{
+	struct aes_siv_key *siv = aes_siv_key_new(key, key_len);
+	bool r;
+
+	if (!siv)
+		return false;
+
+	r = aes_siv_key_decrypt(siv, in, in_len, ad, num_ad, out);
+	aes_siv_key_free(siv);
+
+	return r;
 }
 
 #define SWAP(a, b) do { int _t = a; a = b; b = _t; } while (0)
@@ -577,11 +771,426 @@ int crypto_psk_from_passphrase(const char *passphrase,
 	return 0;
 }
 
+/*
+ * Multi-buffer PBKDF2-HMAC-SHA1 used to derive several PSKs at once.
+ * Each lane of a vector holds the state of a different derivation so
+ * that SIMD units (SSE2, NEON) run one SHA1 compression for all lanes at
+ * the same time.  Without vector support this degrades to a single lane
+ * which is still faster than going through the kernel for each of the
+ * 16384 compressions since the HMAC pad states are computed only once.
+ */
+#if defined(__SSE2__) || defined(__ARM_NEON) || defined(__ALTIVEC__)
+#define SHA1_LANES 4
+typedef uint32_t sha1_vec_t __attribute__((vector_size(16)));
+#else
+#define SHA1_LANES 1
+typedef uint32_t sha1_vec_t;
+#endif
+
+union sha1_lanes {
+	sha1_vec_t v;
+	uint32_t lane[SHA1_LANES];
+};
+
+#define SHA1_ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static const uint32_t sha1_iv[5] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+};
+
+static inline sha1_vec_t sha1_vec_set1(uint32_t x)
+{
+	union sha1_lanes l;
+	unsigned int i;
+
+	for (i = 0; i < SHA1_LANES; i++)
+		l.lane[i] = x;
+
+	return l.v;
+}
+
+static void sha1_compress_mb(sha1_vec_t state[5], sha1_vec_t w[16])
+{
+	sha1_vec_t a = state[0];
+	sha1_vec_t b = state[1];
+	sha1_vec_t c = state[2];
+	sha1_vec_t d = state[3];
+	sha1_vec_t e = state[4];
+	sha1_vec_t f, k, tmp;
+	unsigned int t;
+
+	for (t = 0; t < 80; t++) {
+		if (t >= 16)
+			w[t & 15] = SHA1_ROL(w[(t + 13) & 15] ^
+					w[(t + 8) & 15] ^ w[(t + 2) & 15] ^
+					w[t & 15], 1);
+
+		if (t < 20) {
+			f = (b & c) | (~b & d);
+			k = sha1_vec_set1(0x5a827999);
+		} else if (t < 40) {
+			f = b ^ c ^ d;
+			k = sha1_vec_set1(0x6ed9eba1);
+		} else if (t < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = sha1_vec_set1(0x8f1bbcdc);
+		} else {
+			f = b ^ c ^ d;
+			k = sha1_vec_set1(0xca62c1d6);
+		}
+
+		tmp = SHA1_ROL(a, 5) + f + e + k + w[t & 15];
+		e = d;
+		d = c;
+		c = SHA1_ROL(b, 30);
+		b = a;
+		a = tmp;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+/* Loads one 64 byte block per lane as big endian words */
+static void sha1_load_blocks(sha1_vec_t w[16],
+				const uint8_t blocks[SHA1_LANES][64])
+{
+	union sha1_lanes l;
+	unsigned int i, j;
+
+	for (i = 0; i < 16; i++) {
+		for (j = 0; j < SHA1_LANES; j++)
+			l.lane[j] = l_get_be32(blocks[j] + i * 4);
+
+		w[i] = l.v;
+	}
+}
+
+/*
+ * Hash a 20 byte message, the previous PBKDF2 U value or an inner digest,
+ * on top of an HMAC pad state.  With the 64 byte key block already
+ * absorbed this is always a single padded block.
+ */
+static void sha1_mb_20(const sha1_vec_t init[5], sha1_vec_t inout[5])
+{
+	sha1_vec_t w[16];
+	sha1_vec_t state[5];
+	unsigned int i;
+
+	for (i = 0; i < 5; i++) {
+		w[i] = inout[i];
+		state[i] = init[i];
+	}
+
+	w[5] = sha1_vec_set1(0x80000000);
+
+	for (i = 6; i < 15; i++)
+		w[i] = sha1_vec_set1(0);
+
+	w[15] = sha1_vec_set1((64 + 20) * 8);
+	sha1_compress_mb(state, w);
+
+	for (i = 0; i < 5; i++)
+		inout[i] = state[i];
+}
+
+static void psk_pbkdf2_mb(struct crypto_psk_request *reqs[SHA1_LANES])
+{
+	uint8_t blocks[SHA1_LANES][64];
+	sha1_vec_t istate[5], ostate[5];
+	sha1_vec_t w[16];
+	sha1_vec_t u[5], t[5];
+	union sha1_lanes l;
+	unsigned int block, iter, i, j;
+	size_t len;
+
+	/* HMAC inner and outer pad states, keys are at most 63 bytes */
+	for (j = 0; j < SHA1_LANES; j++) {
+		memset(blocks[j], 0, 64);
+		memcpy(blocks[j], reqs[j]->passphrase,
+					strlen(reqs[j]->passphrase));
+
+		for (i = 0; i < 64; i++)
+			blocks[j][i] ^= 0x36;
+	}
+
+	sha1_load_blocks(w, blocks);
+
+	for (i = 0; i < 5; i++)
+		istate[i] = sha1_vec_set1(sha1_iv[i]);
+
+	sha1_compress_mb(istate, w);
+
+	for (j = 0; j < SHA1_LANES; j++)
+		for (i = 0; i < 64; i++)
+			blocks[j][i] ^= 0x36 ^ 0x5c;
+
+	sha1_load_blocks(w, blocks);
+
+	for (i = 0; i < 5; i++)
+		ostate[i] = sha1_vec_set1(sha1_iv[i]);
+
+	sha1_compress_mb(ostate, w);
+
+	/* 32 byte PSK needs two 20 byte PBKDF2 blocks */
+	for (block = 1; block <= 2; block++) {
+		/* U1 = HMAC(P, S || INT(block)) */
+		for (j = 0; j < SHA1_LANES; j++) {
+			len = reqs[j]->ssid_len;
+
+			memset(blocks[j], 0, 64);
+			memcpy(blocks[j], reqs[j]->ssid, len);
+			l_put_be32(block, blocks[j] + len);
+			blocks[j][len + 4] = 0x80;
+			l_put_be64((64 + len + 4) * 8, blocks[j] + 56);
+		}
+
+		sha1_load_blocks(w, blocks);
+
+		for (i = 0; i < 5; i++)
+			u[i] = istate[i];
+
+		sha1_compress_mb(u, w);
+		sha1_mb_20(ostate, u);
+
+		for (i = 0; i < 5; i++)
+			t[i] = u[i];
+
+		/* Ui = HMAC(P, Ui-1) */
+		for (iter = 1; iter < 4096; iter++) {
+			sha1_mb_20(istate, u);
+			sha1_mb_20(ostate, u);
+
+			for (i = 0; i < 5; i++)
+				t[i] ^= u[i];
+		}
+
+		for (i = 0; i < 5; i++) {
+			l.v = t[i];
+
+			for (j = 0; j < SHA1_LANES; j++) {
+				size_t off = (block - 1) * 20 + i * 4;
+
+				if (off >= 32)
+					continue;
+
+				l_put_be32(l.lane[j], reqs[j]->psk + off);
+			}
+		}
+	}
+
+	explicit_bzero(blocks, sizeof(blocks));
+	explicit_bzero(istate, sizeof(istate));
+	explicit_bzero(ostate, sizeof(ostate));
+	explicit_bzero(w, sizeof(w));
+	explicit_bzero(u, sizeof(u));
+	explicit_bzero(t, sizeof(t));
+}
+
+/*
+ * Derive the PSKs for several passphrase / SSID pairs at once, the result
+ * of each derivation is stored in its request with the same error codes
+ * as crypto_psk_from_passphrase.
+ */
+void crypto_psk_from_passphrase_batch(struct crypto_psk_request *reqs,
+					unsigned int num_reqs)
+{
+	struct crypto_psk_request *lanes[SHA1_LANES];
+	struct crypto_psk_request dummy;
+	unsigned int n = 0;
+	unsigned int i;
+
+	for (i = 0; i < num_reqs; i++) {
+		struct crypto_psk_request *req = &reqs[i];
+
+		if (!req->passphrase || !req->ssid)
+			req->result = -EINVAL;
+		else if (!crypto_passphrase_is_valid(req->passphrase) ||
+				req->ssid_len == 0 || req->ssid_len > 32)
+			req->result = -ERANGE;
+		else
+			req->result = 0;
+
+		if (req->result < 0)
+			continue;
+
+		lanes[n++] = req;
+
+		if (n < SHA1_LANES)
+			continue;
+
+		psk_pbkdf2_mb(lanes);
+		n = 0;
+	}
+
+	if (!n)
+		return;
+
+	/* Fill the unused lanes with a copy whose output is discarded */
+	dummy = *lanes[0];
+
+	for (i = n; i < SHA1_LANES; i++)
+		lanes[i] = &dummy;
+
+	psk_pbkdf2_mb(lanes);
+	explicit_bzero(dummy.psk, sizeof(dummy.psk));
+}
+
+/*
+ * Derivation of the PSK takes 2 x 4096 HMAC-SHA1 operations, which can
+ * take tens of milliseconds on slower hardware.  Spread them over several
+ * main loop iterations so that other events can be processed in between.
+ */
+#define PSK_ITERATIONS		4096
+#define PSK_ITERATIONS_PER_SLICE	512
+
+struct crypto_psk_work {
+	struct l_checksum *hmac;
+	struct l_idle *idle;
+	uint8_t ssid[32];
+	size_t ssid_len;
+	uint8_t u[20];
+	uint8_t t[20];
+	uint8_t psk[40];
+	unsigned int block;
+	unsigned int iteration;
+	crypto_psk_func_t func;
+	void *user_data;
+};
+
+static void psk_work_free(struct crypto_psk_work *work)
+{
+	l_idle_remove(work->idle);
+	l_checksum_free(work->hmac);
+	explicit_bzero(work, sizeof(*work));
+	l_free(work);
+}
+
+/* Returns true once both PBKDF2 blocks have been computed */
+static bool psk_work_step(struct crypto_psk_work *work,
+				unsigned int iterations)
+{
+	unsigned int i;
+
+	while (iterations--) {
+		l_checksum_reset(work->hmac);
+
+		if (!work->iteration) {
+			uint8_t block[4];
+
+			l_put_be32(work->block, block);
+			l_checksum_update(work->hmac, work->ssid,
+						work->ssid_len);
+			l_checksum_update(work->hmac, block, 4);
+			l_checksum_get_digest(work->hmac, work->u, 20);
+			memcpy(work->t, work->u, 20);
+		} else {
+			l_checksum_update(work->hmac, work->u, 20);
+			l_checksum_get_digest(work->hmac, work->u, 20);
+
+			for (i = 0; i < 20; i++)
+				work->t[i] ^= work->u[i];
+		}
+
+		if (++work->iteration < PSK_ITERATIONS)
+			continue;
+
+		memcpy(work->psk + (work->block - 1) * 20, work->t, 20);
+		work->block += 1;
+		work->iteration = 0;
+
+		if (work->block > 2)
+			return true;
+	}
+
+	return false;
+}
+
+static void psk_work_complete(struct crypto_psk_work *work)
+{
+	crypto_psk_func_t func = work->func;
+	void *user_data = work->user_data;
+	uint8_t psk[32];
+
+	/* Free first so that the callback may start new work */
+	memcpy(psk, work->psk, sizeof(psk));
+	psk_work_free(work);
+
+	func(0, psk, user_data);
+	explicit_bzero(psk, sizeof(psk));
+}
+
+static void psk_work_idle(struct l_idle *idle, void *user_data)
+{
+	struct crypto_psk_work *work = user_data;
+
+	if (psk_work_step(work, PSK_ITERATIONS_PER_SLICE))
+		psk_work_complete(work);
+}
+
+/*
+ * Same as crypto_psk_from_passphrase but computed from the main loop in
+ * slices, @func is called with the result unless the work is canceled
+ * first.  Returns NULL if the parameters are invalid.
+ */
+struct crypto_psk_work *crypto_psk_from_passphrase_async(
+				const char *passphrase,
+				const unsigned char *ssid, size_t ssid_len,
+				crypto_psk_func_t func, void *user_data)
+{
+	struct crypto_psk_work *work;
+
+	if (!passphrase || !ssid || !func)
+		return NULL;
+
+	if (!crypto_passphrase_is_valid(passphrase))
+		return NULL;
+
+	if (ssid_len == 0 || ssid_len > 32)
+		return NULL;
+
+	work = l_new(struct crypto_psk_work, 1);
+	work->hmac = l_checksum_new_hmac(L_CHECKSUM_SHA1, passphrase,
+						strlen(passphrase));
+	if (!work->hmac) {
+		l_free(work);
+		return NULL;
+	}
+
+	memcpy(work->ssid, ssid, ssid_len);
+	work->ssid_len = ssid_len;
+	work->block = 1;
+	work->func = func;
+	work->user_data = user_data;
+	work->idle = l_idle_create(psk_work_idle, work, NULL);
+	if (!work->idle) {
+		psk_work_free(work);
+		return NULL;
+	}
+
+	return work;
+}
+
+/* Compute whatever is left right away, e.g. when the PSK is needed now */
+void crypto_psk_work_finish(struct crypto_psk_work *work)
+{
+	psk_work_step(work, UINT_MAX);
+	psk_work_complete(work);
+}
+
+void crypto_psk_work_cancel(struct crypto_psk_work *work)
+{
+	psk_work_free(work);
+}
+
 bool prf_sha1(const void *key, size_t key_len,
 		const void *prefix, size_t prefix_len,
 		const void *data, size_t data_len, void *output, size_t size)
 {
-	struct l_checksum *hmac;
+	struct crypto_hmac hmac;
 	unsigned int i, offset = 0;
 	unsigned char empty = '\0';
 	unsigned char counter;
@@ -592,8 +1201,7 @@ bool prf_sha1(const void *key, size_t key_len,
 		[3] = { .iov_base = &counter, .iov_len = 1 },
 	};
 
-	hmac = l_checksum_new_hmac(L_CHECKSUM_SHA1, key, key_len);
-	if (!hmac)
+	if (!crypto_hmac_init(&hmac, L_CHECKSUM_SHA1, key, key_len))
 		return false;
 
 	/* PRF processes in 160-bit chunks (20 bytes) */
@@ -605,13 +1213,13 @@ bool prf_sha1(const void *key, size_t key_len,
 		else
 			len = size - offset;
 
-		l_checksum_updatev(hmac, iov, 4);
-		l_checksum_get_digest(hmac, output + offset, len);
+		crypto_hmac_updatev(&hmac, iov, 4);
+		crypto_hmac_get_digest(&hmac, output + offset, len);
 
 		offset += len;
 	}
 
-	l_checksum_free(hmac);
+	crypto_hmac_free(&hmac);
 
 	return true;
 }
@@ -627,7 +1235,7 @@ bool prf_plus(enum l_checksum_type type, const void *key, size_t key_len,
 	uint8_t count = 1;
 	uint8_t *out_ptr = out;
 	va_list va;
-	struct l_checksum *hmac;
+	struct crypto_hmac hmac;
 	ssize_t ret;
 	size_t i;
 
@@ -650,22 +1258,21 @@ bool prf_plus(enum l_checksum_type type, const void *key, size_t key_len,
 	iov[n_extra + 2].iov_base = &count;
 	iov[n_extra + 2].iov_len = 1;
 
-	hmac = l_checksum_new_hmac(type, key, key_len);
-	if (!hmac)
+	if (!crypto_hmac_init(&hmac, type, key, key_len))
 		return false;
 
 	while (out_len > 0) {
 		iov[0].iov_base = t;
 		iov[0].iov_len = t_len;
 
-		if (!l_checksum_updatev(hmac, iov, n_extra + 3)) {
-			l_checksum_free(hmac);
+		if (!crypto_hmac_updatev(&hmac, iov, n_extra + 3)) {
+			crypto_hmac_free(&hmac);
 			return false;
 		}
 
-		ret = l_checksum_get_digest(hmac, out_ptr, out_len);
+		ret = crypto_hmac_get_digest(&hmac, out_ptr, out_len);
 		if (ret < 0) {
-			l_checksum_free(hmac);
+			crypto_hmac_free(&hmac);
 			return false;
 		}
 
@@ -681,10 +1288,10 @@ bool prf_plus(enum l_checksum_type type, const void *key, size_t key_len,
 		out_ptr += ret;
 
 		if (out_len)
-			l_checksum_reset(hmac);
+			crypto_hmac_reset(&hmac);
 	}
 
-	l_checksum_free(hmac);
+	crypto_hmac_free(&hmac);
 
 	return true;
 }
@@ -710,7 +1317,7 @@ bool prf_plus_sha1(const void *key, size_t key_len,
 
 	static const uint8_t SHA1_MAC_LEN = 20;
 	static const uint8_t nil_bytes[2] = { 0, 0 };
-	struct l_checksum *hmac;
+	struct crypto_hmac hmac;
 	uint8_t t[SHA1_MAC_LEN];
 	uint8_t counter;
 	struct iovec iov[5] = {
@@ -721,8 +1328,7 @@ bool prf_plus_sha1(const void *key, size_t key_len,
 		[4] = { .iov_base = (void *) nil_bytes, .iov_len = 2 },
 	};
 
-	hmac = l_checksum_new_hmac(L_CHECKSUM_SHA1, key, key_len);
-	if (!hmac)
+	if (!crypto_hmac_init(&hmac, L_CHECKSUM_SHA1, key, key_len))
 		return false;
 
 	/* PRF processes in 160-bit chunks (20 bytes) */
@@ -734,8 +1340,8 @@ bool prf_plus_sha1(const void *key, size_t key_len,
 		else
 			len = size;
 
-		l_checksum_updatev(hmac, iov, 5);
-		l_checksum_get_digest(hmac, t, len);
+		crypto_hmac_updatev(&hmac, iov, 5);
+		crypto_hmac_get_digest(&hmac, t, len);
 
 		memcpy(output, t, len);
 
@@ -748,7 +1354,7 @@ bool prf_plus_sha1(const void *key, size_t key_len,
 		iov[0].iov_len = len;
 	}
 
-	l_checksum_free(hmac);
+	crypto_hmac_free(&hmac);
 
 	return true;
 }
@@ -758,7 +1364,7 @@ bool crypto_kdf(enum l_checksum_type type, const void *key, size_t key_len,
 		const void *prefix, size_t prefix_len,
 		const void *data, size_t data_len, void *output, size_t size)
 {
-	struct l_checksum *hmac;
+	struct crypto_hmac hmac;
 	unsigned int i, offset = 0;
 	unsigned int counter;
 	unsigned int chunk_size;
@@ -772,8 +1378,7 @@ bool crypto_kdf(enum l_checksum_type type, const void *key, size_t key_len,
 		[3] = { .iov_base = length_le, .iov_len = 2 },
 	};
 
-	hmac = l_checksum_new_hmac(type, key, key_len);
-	if (!hmac)
+	if (!crypto_hmac_init(&hmac, type, key, key_len))
 		return false;
 
 	chunk_size = l_checksum_digest_length(type);
@@ -792,13 +1397,13 @@ bool crypto_kdf(enum l_checksum_type type, const void *key, size_t key_len,
 
 		l_put_le16(counter, counter_le);
 
-		l_checksum_updatev(hmac, iov, 4);
-		l_checksum_get_digest(hmac, output + offset, len);
+		crypto_hmac_updatev(&hmac, iov, 4);
+		crypto_hmac_get_digest(&hmac, output + offset, len);
 
 		offset += len;
 	}
 
-	l_checksum_free(hmac);
+	crypto_hmac_free(&hmac);
 
 	return true;
 }
@@ -828,7 +1433,7 @@ bool hkdf_extract(enum l_checksum_type type, const void *key,
 				size_t key_len, uint8_t num_args,
 				void *out, ...)
 {
-	struct l_checksum *hmac;
+	struct crypto_hmac hmac;
 	struct iovec iov[num_args];
 	const uint8_t zero_key[64] = { 0 };
 	size_t dlen = l_checksum_digest_length(type);
@@ -841,8 +1446,7 @@ bool hkdf_extract(enum l_checksum_type type, const void *key,
 	if (dlen <= 0)
 		return false;
 
-	hmac = l_checksum_new_hmac(type, k, k_len);
-	if (!hmac)
+	if (!crypto_hmac_init(&hmac, type, k, k_len))
 		return false;
 
 	va_start(va, out);
@@ -852,14 +1456,14 @@ bool hkdf_extract(enum l_checksum_type type, const void *key,
 		iov[i].iov_len = va_arg(va, size_t);
 	}
 
-	if (!l_checksum_updatev(hmac, iov, num_args)) {
-		l_checksum_free(hmac);
+	if (!crypto_hmac_updatev(&hmac, iov, num_args)) {
+		crypto_hmac_free(&hmac);
 		va_end(va);
 		return false;
 	}
 
-	ret = l_checksum_get_digest(hmac, out, dlen);
-	l_checksum_free(hmac);
+	ret = crypto_hmac_get_digest(&hmac, out, dlen);
+	crypto_hmac_free(&hmac);
 
 	va_end(va);
 	return (ret == (int) dlen);
@@ -952,7 +1556,6 @@ bool crypto_derive_pmk_r0(const uint8_t *xxkey, size_t xxkey_len,
 	size_t pos = 0;
 	uint8_t output[64];
 	size_t offset = sha384 ? 48 : 32;
-	struct l_checksum *sha;
 	bool r = false;
 	struct iovec iov[2] = {
 		[0] = { .iov_base = "FT-R0N", .iov_len = 6 },
@@ -985,15 +1588,10 @@ bool crypto_derive_pmk_r0(const uint8_t *xxkey, size_t xxkey_len,
 			goto exit;
 	}
 
-	sha = l_checksum_new((sha384) ? L_CHECKSUM_SHA384 : L_CHECKSUM_SHA256);
-	if (!sha)
+	if (!crypto_hashv(sha384 ? L_CHECKSUM_SHA384 : L_CHECKSUM_SHA256,
+				iov, 2, out_pmk_r0_name, 16))
 		goto exit;
 
-	l_checksum_updatev(sha, iov, 2);
-	l_checksum_get_digest(sha, out_pmk_r0_name, 16);
-
-	l_checksum_free(sha);
-
 	memcpy(out_pmk_r0, output, offset);
 
 	r = true;
@@ -1013,7 +1611,6 @@ bool crypto_derive_pmk_r1(const uint8_t *pmk_r0,
 				uint8_t *out_pmk_r1_name)
 {
 	uint8_t context[2 * ETH_ALEN];
-	struct l_checksum *sha;
 	bool r = false;
 	struct iovec iov[3] = {
 		[0] = { .iov_base = "FT-R1N", .iov_len = 6 },
@@ -1035,17 +1632,12 @@ bool crypto_derive_pmk_r1(const uint8_t *pmk_r0,
 			goto exit;
 	}
 
-	sha = l_checksum_new((sha384) ? L_CHECKSUM_SHA384 : L_CHECKSUM_SHA256);
-	if (!sha) {
+	if (!crypto_hashv(sha384 ? L_CHECKSUM_SHA384 : L_CHECKSUM_SHA256,
+				iov, 3, out_pmk_r1_name, 16)) {
 		explicit_bzero(out_pmk_r1, 48);
 		goto exit;
 	}
 
-	l_checksum_updatev(sha, iov, 3);
-	l_checksum_get_digest(sha, out_pmk_r1_name, 16);
-
-	l_checksum_free(sha);
-
 	r = true;
 
 exit:
@@ -1062,7 +1654,6 @@ bool crypto_derive_ft_ptk(const uint8_t *pmk_r1, const uint8_t *pmk_r1_name,
 				uint8_t *out_ptk_name)
 {
 	uint8_t context[ETH_ALEN * 2 + 64];
-	struct l_checksum *sha;
 	bool r = false;
 	struct iovec iov[3] = {
 		[0] = { .iov_base = (uint8_t *) pmk_r1_name, .iov_len = 16 },
@@ -1088,17 +1679,12 @@ bool crypto_derive_ft_ptk(const uint8_t *pmk_r1, const uint8_t *pmk_r1_name,
 			goto exit;
 	}
 
-	sha = l_checksum_new((sha384) ? L_CHECKSUM_SHA384 : L_CHECKSUM_SHA256);
-	if (!sha) {
+	if (!crypto_hashv(sha384 ? L_CHECKSUM_SHA384 : L_CHECKSUM_SHA256,
+				iov, 3, out_ptk_name, 16)) {
 		explicit_bzero(out_ptk, ptk_len);
 		goto exit;
 	}
 
-	l_checksum_updatev(sha, iov, 3);
-	l_checksum_get_digest(sha, out_ptk_name, 16);
-
-	l_checksum_free(sha);
-
 	r = true;
 
 exit:
@@ -1200,6 +1786,203 @@ struct l_ecc_point *crypto_derive_sae_pt_ecc(unsigned int group,
 	return l_steal_ptr(pt);
 }
 
+/*
+ * Deriving the H2E PT requires two hash-to-curve operations per group.
+ * Keep recently derived PTs around, keyed by SSID, a hash of the
+ * password and the group, so that a PT can be prepared from an idle
+ * callback ahead of time and is only computed once per credential.
+ */
+#define SAE_PT_CACHE_SIZE 16
+
+struct sae_pt_entry {
+	char ssid[33];
+	uint8_t password_hash[32];
+	unsigned int group;
+	char *password;		/* Only set while the derivation is pending */
+	struct l_ecc_point *pt;
+};
+
+static struct l_queue *sae_pt_cache;
+static struct l_queue *sae_pt_pending;
+static struct l_idle *sae_pt_idle;
+
+static void sae_pt_entry_free(void *data)
+{
+	struct sae_pt_entry *entry = data;
+
+	if (entry->password) {
+		explicit_bzero(entry->password, strlen(entry->password));
+		l_free(entry->password);
+	}
+
+	l_ecc_point_free(entry->pt);
+	l_free(entry);
+}
+
+static bool sae_pt_entry_init(struct sae_pt_entry *entry, unsigned int group,
+				const char *ssid, const char *password)
+{
+	struct l_checksum *sha;
+
+	if (strlen(ssid) >= sizeof(entry->ssid))
+		return false;
+
+	memset(entry, 0, sizeof(*entry));
+
+	sha = l_checksum_new(L_CHECKSUM_SHA256);
+	if (!sha)
+		return false;
+
+	l_checksum_update(sha, password, strlen(password));
+	l_checksum_get_digest(sha, entry->password_hash,
+				sizeof(entry->password_hash));
+	l_checksum_free(sha);
+
+	strcpy(entry->ssid, ssid);
+	entry->group = group;
+
+	return true;
+}
+
+static bool sae_pt_entry_match(const void *a, const void *b)
+{
+	const struct sae_pt_entry *entry = a;
+	const struct sae_pt_entry *key = b;
+
+	return entry->group == key->group && !strcmp(entry->ssid, key->ssid) &&
+		!memcmp(entry->password_hash, key->password_hash,
+					sizeof(key->password_hash));
+}
+
+static void sae_pt_cache_insert(struct sae_pt_entry *entry)
+{
+	if (!sae_pt_cache)
+		sae_pt_cache = l_queue_new();
+
+	if (l_queue_length(sae_pt_cache) >= SAE_PT_CACHE_SIZE)
+		sae_pt_entry_free(l_queue_pop_tail(sae_pt_cache));
+
+	l_queue_push_head(sae_pt_cache, entry);
+}
+
+static void sae_pt_entry_derive(struct sae_pt_entry *entry)
+{
+	entry->pt = crypto_derive_sae_pt_ecc(entry->group, entry->ssid,
+						entry->password, NULL);
+
+	explicit_bzero(entry->password, strlen(entry->password));
+	l_free(entry->password);
+	entry->password = NULL;
+}
+
+static void sae_pt_idle_func(struct l_idle *idle, void *user_data)
+{
+	struct sae_pt_entry *entry = l_queue_pop_head(sae_pt_pending);
+
+	if (entry) {
+		sae_pt_entry_derive(entry);
+
+		if (entry->pt)
+			sae_pt_cache_insert(entry);
+		else
+			sae_pt_entry_free(entry);
+	}
+
+	if (!l_queue_isempty(sae_pt_pending))
+		return;
+
+	l_idle_remove(sae_pt_idle);
+	sae_pt_idle = NULL;
+}
+
+/*
+ * Returns a new copy of the PT for the given credentials, from the cache
+ * if possible.  A pending precompute for the same key is completed
+ * synchronously.
+ */
+struct l_ecc_point *crypto_sae_pt_cache_get(unsigned int group,
+						const char *ssid,
+						const char *password)
+{
+	struct sae_pt_entry key;
+	struct sae_pt_entry *entry;
+
+	if (!ssid || !password)
+		return NULL;
+
+	if (!sae_pt_entry_init(&key, group, ssid, password))
+		return crypto_derive_sae_pt_ecc(group, ssid, password, NULL);
+
+	entry = l_queue_remove_if(sae_pt_cache, sae_pt_entry_match, &key);
+	if (entry)
+		goto done;
+
+	entry = l_queue_remove_if(sae_pt_pending, sae_pt_entry_match, &key);
+	if (!entry) {
+		entry = l_memdup(&key, sizeof(key));
+		entry->password = l_strdup(password);
+	}
+
+	sae_pt_entry_derive(entry);
+
+	if (!entry->pt) {
+		sae_pt_entry_free(entry);
+		return NULL;
+	}
+
+done:
+	sae_pt_cache_insert(entry);
+	return l_ecc_point_clone(entry->pt);
+}
+
+/*
+ * Schedule the derivation of the PT for the given credentials from an
+ * idle callback.  Returns false if the PT is already cached or pending.
+ */
+bool crypto_sae_pt_precompute(unsigned int group, const char *ssid,
+				const char *password)
+{
+	struct sae_pt_entry key;
+	struct sae_pt_entry *entry;
+
+	if (!ssid || !password || !l_ecc_curve_from_ike_group(group))
+		return false;
+
+	if (!sae_pt_entry_init(&key, group, ssid, password))
+		return false;
+
+	if (l_queue_find(sae_pt_cache, sae_pt_entry_match, &key) ||
+			l_queue_find(sae_pt_pending, sae_pt_entry_match, &key))
+		return false;
+
+	if (!sae_pt_idle) {
+		sae_pt_idle = l_idle_create(sae_pt_idle_func, NULL, NULL);
+		if (!sae_pt_idle)
+			return false;
+	}
+
+	if (!sae_pt_pending)
+		sae_pt_pending = l_queue_new();
+
+	entry = l_memdup(&key, sizeof(key));
+	entry->password = l_strdup(password);
+	l_queue_push_tail(sae_pt_pending, entry);
+
+	return true;
+}
+
+void crypto_sae_pt_cache_flush(void)
+{
+	l_idle_remove(sae_pt_idle);
+	sae_pt_idle = NULL;
+
+	l_queue_destroy(sae_pt_pending, sae_pt_entry_free);
+	sae_pt_pending = NULL;
+
+	l_queue_destroy(sae_pt_cache, sae_pt_entry_free);
+	sae_pt_cache = NULL;
+}
+
 struct l_ecc_point *crypto_derive_sae_pwe_from_pt_ecc(const uint8_t *mac1,
 						const uint8_t *mac2,
 						const struct l_ecc_point *pt)
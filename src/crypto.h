@@ -83,6 +83,16 @@ bool aes_wrap(const uint8_t *kek, const uint8_t *in, size_t len, uint8_t *out);
 bool arc4_skip(const uint8_t *key, size_t key_len, size_t skip,
 		const uint8_t *in, size_t len, uint8_t *out);
 
+struct aes_siv_key;
+
+struct aes_siv_key *aes_siv_key_new(const void *key, size_t key_len);
+void aes_siv_key_free(struct aes_siv_key *siv);
+bool aes_siv_key_encrypt(struct aes_siv_key *siv, const void *in,
+				size_t in_len, struct iovec *ad, size_t num_ad,
+				void *out);
+bool aes_siv_key_decrypt(struct aes_siv_key *siv, const void *in,
+				size_t in_len, struct iovec *ad, size_t num_ad,
+				void *out);
 bool aes_siv_encrypt(const void *key, size_t key_len, const void *in,
 			size_t in_len, struct iovec *ad, size_t num_ad,
 			void *out);
@@ -99,6 +109,29 @@ int crypto_psk_from_passphrase(const char *passphrase,
 				const unsigned char *ssid, size_t ssid_len,
 				unsigned char *out_psk);
 
+struct crypto_psk_request {
+	const char *passphrase;
+	const unsigned char *ssid;
+	size_t ssid_len;
+	unsigned char psk[32];
+	int result;
+};
+
+void crypto_psk_from_passphrase_batch(struct crypto_psk_request *reqs,
+					unsigned int num_reqs);
+
+struct crypto_psk_work;
+
+typedef void (*crypto_psk_func_t)(int err, const uint8_t *psk,
+					void *user_data);
+
+struct crypto_psk_work *crypto_psk_from_passphrase_async(
+				const char *passphrase,
+				const unsigned char *ssid, size_t ssid_len,
+				crypto_psk_func_t func, void *user_data);
+void crypto_psk_work_finish(struct crypto_psk_work *work);
+void crypto_psk_work_cancel(struct crypto_psk_work *work);
+
 bool crypto_kdf(enum l_checksum_type type, const void *key, size_t key_len,
 		const void *prefix, size_t prefix_len,
 		const void *data, size_t data_len, void *output, size_t size);
@@ -163,6 +196,12 @@ struct l_ecc_point *crypto_derive_sae_pt_ecc(unsigned int group,
 						const char *ssid,
 						const char *password,
 						const char *identifier);
+struct l_ecc_point *crypto_sae_pt_cache_get(unsigned int group,
+						const char *ssid,
+						const char *password);
+bool crypto_sae_pt_precompute(unsigned int group, const char *ssid,
+				const char *password);
+void crypto_sae_pt_cache_flush(void);
 struct l_ecc_point *crypto_derive_sae_pwe_from_pt_ecc(const uint8_t *mac1,
 						const uint8_t *mac2,
 						const struct l_ecc_point *pt);
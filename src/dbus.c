@@ -204,6 +204,31 @@ bool dbus_append_dict_basic(struct l_dbus_message_builder *builder,
 	return true;
 }
 
+/*
+ * Adds an interface and org.freedesktop.DBus.Properties to an object.  The
+ * object manager queues its signals until the main loop goes idle, so the
+ * two interfaces are announced in a single InterfacesAdded signal and an
+ * object removed before then isn't announced at all.  Objects added in a
+ * burst, e.g. the networks found by a scan, are thus sent out together
+ * from one idle callback, one signal per object as the ObjectManager
+ * interface requires.
+ */
+bool dbus_object_add_interfaces(const char *path, const char *interface,
+				void *user_data)
+{
+	if (!l_dbus_object_add_interface(g_dbus, path, interface, user_data)) {
+		l_info("Unable to register %s interface", interface);
+		return false;
+	}
+
+	if (!l_dbus_object_add_interface(g_dbus, path,
+					L_DBUS_INTERFACE_PROPERTIES, user_data))
+		l_info("Unable to register %s interface",
+						L_DBUS_INTERFACE_PROPERTIES);
+
+	return true;
+}
+
 struct l_dbus *dbus_get_bus(void)
 {
 	return g_dbus;
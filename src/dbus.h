@@ -33,6 +33,7 @@
 #define IWD_WSC_INTERFACE "net.connman.iwd.SimpleConfiguration"
 #define IWD_KNOWN_NETWORK_INTERFACE "net.connman.iwd.KnownNetwork"
 #define IWD_SIGNAL_AGENT_INTERFACE "net.connman.iwd.SignalLevelAgent"
+#define IWD_TELEMETRY_AGENT_INTERFACE "net.connman.iwd.TelemetryAgent"
 #define IWD_AP_INTERFACE "net.connman.iwd.AccessPoint"
 #define IWD_ADHOC_INTERFACE "net.connman.iwd.AdHoc"
 #define IWD_STATION_INTERFACE "net.connman.iwd.Station"
@@ -44,15 +45,20 @@
 #define IWD_AP_DIAGNOSTIC_INTERFACE "net.connman.iwd.AccessPointDiagnostic"
 #define IWD_STATION_DEBUG_INTERFACE "net.connman.iwd.StationDebug"
 #define IWD_DPP_INTERFACE "net.connman.iwd.DeviceProvisioning"
+#define IWD_KNOWN_NETWORK_MANAGER_INTERFACE "net.connman.iwd.KnownNetworkManager"
 
 #define IWD_BASE_PATH "/net/connman/iwd"
 #define IWD_AGENT_MANAGER_PATH IWD_BASE_PATH
 #define IWD_P2P_SERVICE_MANAGER_PATH IWD_BASE_PATH
+#define IWD_KNOWN_NETWORK_MANAGER_PATH IWD_BASE_PATH
 
 struct l_dbus;
 
 struct l_dbus *dbus_get_bus(void);
 
+bool dbus_object_add_interfaces(const char *path, const char *interface,
+				void *user_data);
+
 void dbus_pending_reply(struct l_dbus_message **msg,
 				struct l_dbus_message *reply);
 bool dbus_append_dict_basic(struct l_dbus_message_builder *builder,
@@ -24,11 +24,15 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
+#include <string.h>
+
 #include <ell/ell.h>
 
 #include "src/diagnostic.h"
 #include "src/dbus.h"
 #include "src/ie.h"
+#include "src/util.h"
 
 /*
  * Appends values from diagnostic_station_info into a DBus dictionary. This
@@ -110,9 +114,187 @@ bool diagnostic_info_to_dict(const struct diagnostic_station_info *info,
 		dbus_append_dict_basic(builder, "ExpectedThroughput", 'u',
 					&info->expected_throughput);
 
+	if (info->have_tx_retries)
+		dbus_append_dict_basic(builder, "TxRetries", 'u',
+					&info->tx_retries);
+
+	if (info->have_tx_failed)
+		dbus_append_dict_basic(builder, "TxFailed", 'u',
+					&info->tx_failed);
+
+	if (info->have_beacon_loss)
+		dbus_append_dict_basic(builder, "BeaconLoss", 'u',
+					&info->beacon_loss);
+
 	return true;
 }
 
+void diagnostic_latency_add(struct diagnostic_latency *latency,
+				uint64_t usecs)
+{
+	static const uint32_t bounds[] = { DIAGNOSTIC_LATENCY_BOUNDS };
+	uint64_t ms = usecs / L_USEC_PER_MSEC;
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(bounds); i++)
+		if (ms < bounds[i])
+			break;
+
+	latency->buckets[i]++;
+	latency->last_ms = ms > UINT32_MAX ? UINT32_MAX : ms;
+	latency->have_last = true;
+}
+
+/*
+ * Appends '<name>Time', the last measured duration in ms, and
+ * '<name>Histogram', the count of measurements per bucket, if anything
+ * has been recorded so far.
+ */
+bool diagnostic_latency_to_dict(const struct diagnostic_latency *latency,
+				const char *name,
+				struct l_dbus_message_builder *builder)
+{
+	char key[64];
+	unsigned int i;
+
+	if (!latency->have_last)
+		return true;
+
+	snprintf(key, sizeof(key), "%sTime", name);
+	dbus_append_dict_basic(builder, key, 'u', &latency->last_ms);
+
+	snprintf(key, sizeof(key), "%sHistogram", name);
+
+	l_dbus_message_builder_enter_dict(builder, "sv");
+	l_dbus_message_builder_append_basic(builder, 's', key);
+	l_dbus_message_builder_enter_variant(builder, "au");
+	l_dbus_message_builder_enter_array(builder, "u");
+
+	for (i = 0; i < DIAGNOSTIC_LATENCY_BUCKETS; i++)
+		l_dbus_message_builder_append_basic(builder, 'u',
+							&latency->buckets[i]);
+
+	l_dbus_message_builder_leave_array(builder);
+	l_dbus_message_builder_leave_variant(builder);
+	l_dbus_message_builder_leave_dict(builder);
+
+	return true;
+}
+
+/*
+ * Returns the slot for a new roam attempt, overwriting the oldest one once
+ * the trace is full.
+ */
+struct diagnostic_roam *diagnostic_roam_trace_add(
+					struct diagnostic_roam_trace *trace)
+{
+	struct diagnostic_roam *roam = &trace->roams[trace->next];
+
+	memset(roam, 0, sizeof(*roam));
+	roam->start_time = l_time_now();
+
+	trace->next = (trace->next + 1) % DIAGNOSTIC_ROAM_TRACE_SIZE;
+
+	if (trace->count < DIAGNOSTIC_ROAM_TRACE_SIZE)
+		trace->count++;
+
+	return roam;
+}
+
+/* Keeps the DIAGNOSTIC_ROAM_MAX_CANDIDATES best ranked, best first */
+void diagnostic_roam_add_candidate(struct diagnostic_roam *roam,
+					const uint8_t *addr, int16_t rssi,
+					uint32_t rank)
+{
+	unsigned int i = roam->n_candidates;
+
+	if (i == DIAGNOSTIC_ROAM_MAX_CANDIDATES) {
+		if (rank <= roam->candidates[i - 1].rank)
+			return;
+
+		i -= 1;
+	} else
+		roam->n_candidates++;
+
+	for (; i > 0 && roam->candidates[i - 1].rank < rank; i--)
+		roam->candidates[i] = roam->candidates[i - 1];
+
+	memcpy(roam->candidates[i].addr, addr, 6);
+	roam->candidates[i].rssi = rssi;
+	roam->candidates[i].rank = rank;
+}
+
+static void diagnostic_roam_to_dict(const struct diagnostic_roam *roam,
+					uint64_t now,
+					struct l_dbus_message_builder *builder)
+{
+	uint32_t age = l_time_to_secs(l_time_diff(roam->start_time, now));
+	unsigned int i;
+
+	l_dbus_message_builder_enter_array(builder, "{sv}");
+
+	dbus_append_dict_basic(builder, "Age", 'u', &age);
+	dbus_append_dict_basic(builder, "Trigger", 's', roam->trigger);
+	dbus_append_dict_basic(builder, "From", 's',
+				util_address_to_string(roam->from));
+	dbus_append_dict_basic(builder, "RSSI", 'n', &roam->rssi);
+
+	l_dbus_message_builder_enter_dict(builder, "sv");
+	l_dbus_message_builder_append_basic(builder, 's', "Candidates");
+	l_dbus_message_builder_enter_variant(builder, "a(snu)");
+	l_dbus_message_builder_enter_array(builder, "(snu)");
+
+	for (i = 0; i < roam->n_candidates; i++) {
+		const struct diagnostic_roam_candidate *c =
+							&roam->candidates[i];
+
+		l_dbus_message_builder_enter_struct(builder, "snu");
+		l_dbus_message_builder_append_basic(builder, 's',
+					util_address_to_string(c->addr));
+		l_dbus_message_builder_append_basic(builder, 'n', &c->rssi);
+		l_dbus_message_builder_append_basic(builder, 'u', &c->rank);
+		l_dbus_message_builder_leave_struct(builder);
+	}
+
+	l_dbus_message_builder_leave_array(builder);
+	l_dbus_message_builder_leave_variant(builder);
+	l_dbus_message_builder_leave_dict(builder);
+
+	if (roam->have_target)
+		dbus_append_dict_basic(builder, "Target", 's',
+					util_address_to_string(roam->target));
+
+	if (roam->method)
+		dbus_append_dict_basic(builder, "Method", 's', roam->method);
+
+	if (roam->result) {
+		dbus_append_dict_basic(builder, "Result", 's', roam->result);
+		dbus_append_dict_basic(builder, "Duration", 'u',
+					&roam->duration_ms);
+	}
+
+	l_dbus_message_builder_leave_array(builder);
+}
+
+/* Appends the trace as an array of dictionaries, oldest roam first */
+void diagnostic_roam_trace_to_dbus(const struct diagnostic_roam_trace *trace,
+					struct l_dbus_message_builder *builder)
+{
+	uint64_t now = l_time_now();
+	unsigned int first = (trace->next + DIAGNOSTIC_ROAM_TRACE_SIZE -
+				trace->count) % DIAGNOSTIC_ROAM_TRACE_SIZE;
+	unsigned int i;
+
+	l_dbus_message_builder_enter_array(builder, "a{sv}");
+
+	for (i = 0; i < trace->count; i++)
+		diagnostic_roam_to_dict(&trace->roams[(first + i) %
+						DIAGNOSTIC_ROAM_TRACE_SIZE],
+					now, builder);
+
+	l_dbus_message_builder_leave_array(builder);
+}
+
 const char *diagnostic_akm_suite_to_security(enum ie_rsn_akm_suite akm,
 						bool wpa)
 {
@@ -42,6 +42,16 @@ struct diagnostic_station_info {
 	uint8_t tx_mcs;
 
 	uint32_t expected_throughput;
+	uint32_t tx_retries;
+	uint32_t tx_failed;
+	uint32_t beacon_loss;
+
+	/* Total rx and tx PPDU duration in us */
+	uint64_t airtime;
+
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+	uint32_t tx_packets;
 
 	bool have_cur_rssi : 1;
 	bool have_avg_rssi : 1;
@@ -50,10 +60,73 @@ struct diagnostic_station_info {
 	bool have_rx_bitrate : 1;
 	bool have_tx_bitrate : 1;
 	bool have_expected_throughput : 1;
+	bool have_tx_retries : 1;
+	bool have_tx_failed : 1;
+	bool have_beacon_loss : 1;
+	bool have_airtime : 1;
+	bool have_rx_bytes : 1;
+	bool have_tx_bytes : 1;
+	bool have_tx_packets : 1;
+};
+
+/* Upper bounds in ms, the last bucket counts everything above */
+#define DIAGNOSTIC_LATENCY_BOUNDS 10, 25, 50, 100, 250, 500, 1000, 2500
+#define DIAGNOSTIC_LATENCY_BUCKETS 9
+
+struct diagnostic_latency {
+	uint32_t last_ms;
+	uint32_t buckets[DIAGNOSTIC_LATENCY_BUCKETS];
+	bool have_last : 1;
+};
+
+#define DIAGNOSTIC_ROAM_TRACE_SIZE 16
+#define DIAGNOSTIC_ROAM_MAX_CANDIDATES 8
+
+struct diagnostic_roam_candidate {
+	uint8_t addr[6];
+	int16_t rssi;
+	uint32_t rank;
+};
+
+/* A single roam attempt, from the trigger until it succeeded or failed */
+struct diagnostic_roam {
+	uint64_t start_time;
+	uint32_t duration_ms;
+	const char *trigger;
+	const char *method;
+	const char *result;
+	uint8_t from[6];
+	uint8_t target[6];
+	int16_t rssi;
+	struct diagnostic_roam_candidate
+				candidates[DIAGNOSTIC_ROAM_MAX_CANDIDATES];
+	unsigned int n_candidates;
+	bool have_target : 1;
+};
+
+/* Ring buffer of the DIAGNOSTIC_ROAM_TRACE_SIZE most recent roams */
+struct diagnostic_roam_trace {
+	struct diagnostic_roam roams[DIAGNOSTIC_ROAM_TRACE_SIZE];
+	unsigned int next;
+	unsigned int count;
 };
 
 bool diagnostic_info_to_dict(const struct diagnostic_station_info *info,
 				struct l_dbus_message_builder *builder);
 
+void diagnostic_latency_add(struct diagnostic_latency *latency,
+				uint64_t usecs);
+bool diagnostic_latency_to_dict(const struct diagnostic_latency *latency,
+				const char *name,
+				struct l_dbus_message_builder *builder);
+
+struct diagnostic_roam *diagnostic_roam_trace_add(
+					struct diagnostic_roam_trace *trace);
+void diagnostic_roam_add_candidate(struct diagnostic_roam *roam,
+					const uint8_t *addr, int16_t rssi,
+					uint32_t rank);
+void diagnostic_roam_trace_to_dbus(const struct diagnostic_roam_trace *trace,
+					struct l_dbus_message_builder *builder);
+
 const char *diagnostic_akm_suite_to_security(enum ie_rsn_akm_suite suite,
 						bool wpa);
@@ -1116,3 +1116,96 @@ void dpp_free_uri_info(struct dpp_uri_info *info)
 
 	l_free(info);
 }
+
+struct dpp_key_pair {
+	struct l_ecc_scalar *private;
+	struct l_ecc_point *public;
+};
+
+struct dpp_key_pool {
+	const struct l_ecc_curve *curve;
+	unsigned int size;
+	unsigned int count;
+	struct dpp_key_pair pairs[];
+};
+
+/*
+ * Protocol keys are ephemeral but don't depend on the peer, so they can be
+ * generated while idle and taken from the pool when a frame needs them.
+ */
+struct dpp_key_pool *dpp_key_pool_new(const struct l_ecc_curve *curve,
+					unsigned int size)
+{
+	struct dpp_key_pool *pool;
+
+	if (!curve || !size)
+		return NULL;
+
+	pool = l_malloc(sizeof(*pool) + size * sizeof(struct dpp_key_pair));
+	pool->curve = curve;
+	pool->size = size;
+	pool->count = 0;
+
+	return pool;
+}
+
+/* Generates one key pair, returns true if the pool has room for more */
+bool dpp_key_pool_refill(struct dpp_key_pool *pool)
+{
+	struct dpp_key_pair *pair;
+
+	if (pool->count == pool->size)
+		return false;
+
+	pair = &pool->pairs[pool->count];
+
+	if (!l_ecdh_generate_key_pair(pool->curve, &pair->private,
+					&pair->public))
+		return false;
+
+	pool->count++;
+
+	return pool->count < pool->size;
+}
+
+/*
+ * Hands out a pre-generated key pair, falling back to generating one if the
+ * pool is empty.  The caller owns the keys returned.
+ */
+bool dpp_key_pool_get(struct dpp_key_pool *pool,
+			struct l_ecc_scalar **out_private,
+			struct l_ecc_point **out_public)
+{
+	struct dpp_key_pair *pair;
+
+	if (!pool->count)
+		return l_ecdh_generate_key_pair(pool->curve, out_private,
+						out_public);
+
+	pair = &pool->pairs[--pool->count];
+
+	*out_private = pair->private;
+	*out_public = pair->public;
+
+	return true;
+}
+
+unsigned int dpp_key_pool_count(const struct dpp_key_pool *pool)
+{
+	return pool->count;
+}
+
+void dpp_key_pool_free(struct dpp_key_pool *pool)
+{
+	unsigned int i;
+
+	if (!pool)
+		return;
+
+	for (i = 0; i < pool->count; i++) {
+		l_ecc_scalar_free(pool->pairs[i].private);
+		l_ecc_point_free(pool->pairs[i].public);
+	}
+
+	l_free(pool);
+}
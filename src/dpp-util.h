@@ -19,8 +19,10 @@
  *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  *
  */
+struct l_ecc_curve;
 struct l_ecc_point;
 struct l_ecc_scalar;
+struct dpp_key_pool;
 enum ie_rsn_akm_suite;
 struct scan_freq_set;
 
@@ -181,3 +183,12 @@ struct l_ecc_point *dpp_point_from_asn1(const uint8_t *asn1, size_t len);
 
 struct dpp_uri_info *dpp_parse_uri(const char *uri);
 void dpp_free_uri_info(struct dpp_uri_info *info);
+
+struct dpp_key_pool *dpp_key_pool_new(const struct l_ecc_curve *curve,
+					unsigned int size);
+bool dpp_key_pool_refill(struct dpp_key_pool *pool);
+bool dpp_key_pool_get(struct dpp_key_pool *pool,
+			struct l_ecc_scalar **out_private,
+			struct l_ecc_point **out_public);
+unsigned int dpp_key_pool_count(const struct dpp_key_pool *pool);
+void dpp_key_pool_free(struct dpp_key_pool *pool);
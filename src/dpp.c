@@ -54,7 +54,14 @@
 #include "src/handshake.h"
 #include "src/nl80211util.h"
 
+#define MEMACCT_MODULE MEMACCT_DPP
+#include "src/memacct.h"
+
 #define DPP_FRAME_MAX_RETRIES 5
+#define DPP_PRESENCE_MAX_SCAN_CHANNELS 4
+#define DPP_PRESENCE_SHORT_DWELL 500
+#define DPP_MAX_CONFIGURATOR_SESSIONS 32
+#define DPP_PROTO_KEY_POOL_SIZE 4
 
 static uint32_t netdev_watch;
 static struct l_genl_family *nl80211;
@@ -62,6 +69,10 @@ static uint8_t broadcast[] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
 static struct l_queue *dpp_list;
 static uint32_t mlme_watch;
 static uint32_t unicast_watch;
+static bool dpp_rank_presence;
+static unsigned int dpp_max_sessions;
+static struct dpp_key_pool *proto_key_pool;
+static struct l_idle *proto_key_idle;
 
 static uint8_t dpp_prefix[] = { 0x04, 0x09, 0x50, 0x6f, 0x9a, 0x1a, 0x01 };
 
@@ -90,6 +101,9 @@ struct dpp_sm {
 	size_t peer_asn1_len;
 	uint8_t own_boot_hash[32];
 	uint8_t peer_boot_hash[32];
+	/* Presence Announcement hashes, SHA256("chirp" | asn1) */
+	uint8_t own_chirp_hash[32];
+	uint8_t peer_chirp_hash[32];
 	const struct l_ecc_curve *curve;
 	size_t key_len;
 	size_t nonce_len;
@@ -110,6 +124,8 @@ struct dpp_sm {
 	uint32_t current_freq;
 	uint32_t new_freq;
 	struct scan_freq_set *presence_list;
+	/* Presence channels with an AP advertising Configurator Connectivity */
+	struct scan_freq_set *configurator_freqs;
 
 	uint32_t offchannel_id;
 
@@ -138,12 +154,29 @@ struct dpp_sm {
 	uint32_t connect_scan_id;
 	uint64_t frame_cookie;
 	uint8_t frame_retry;
+	uint32_t frame_send_id;
 
 	struct l_dbus_message *pending;
 
+	/*
+	 * A responder configurator serving several enrollees at once keeps a
+	 * session per enrollee, keyed by the enrollee address.  Sessions
+	 * borrow the bootstrapping keys and the configuration of the parent.
+	 */
+	struct dpp_sm *parent;
+	struct l_hashmap *sessions;
+	struct l_queue *auth_requests;
+	struct l_idle *auth_request_idle;
+
 	bool mcast_support : 1;
 };
 
+struct dpp_auth_request {
+	uint8_t addr[6];
+	size_t body_len;
+	uint8_t body[];
+};
+
 static void dpp_free_auth_data(struct dpp_sm *dpp)
 {
 	if (dpp->own_proto_public) {
@@ -172,8 +205,60 @@ static void dpp_free_auth_data(struct dpp_sm *dpp)
 	}
 }
 
+static void dpp_session_free(void *data)
+{
+	struct dpp_sm *session = data;
+
+	if (session->frame_send_id)
+		l_genl_family_cancel(nl80211, session->frame_send_id);
+
+	l_timeout_remove(session->timeout);
+
+	explicit_bzero(session->r_nonce, session->nonce_len);
+	explicit_bzero(session->i_nonce, session->nonce_len);
+	explicit_bzero(session->e_nonce, session->nonce_len);
+	explicit_bzero(session->ke, session->key_len);
+	explicit_bzero(session->k1, session->key_len);
+	explicit_bzero(session->k2, session->key_len);
+	explicit_bzero(session->auth_tag, session->key_len);
+
+	dpp_free_auth_data(session);
+	l_free(session);
+}
+
+static void dpp_session_idle_free(void *user_data)
+{
+	dpp_session_free(user_data);
+}
+
+/*
+ * Sessions finish from within their own frame handlers, so only take them
+ * out of the table here and free them once the handler has returned.
+ */
+static void dpp_session_finished(struct dpp_sm *session)
+{
+	l_debug("DPP session with "MAC" done", MAC_STR(session->auth_addr));
+
+	l_hashmap_remove(session->parent->sessions, session->auth_addr);
+	session->state = DPP_STATE_NOTHING;
+
+	l_timeout_remove(l_steal_ptr(session->timeout));
+	l_idle_oneshot(dpp_session_idle_free, session, NULL);
+}
+
 static void dpp_reset(struct dpp_sm *dpp)
 {
+	if (dpp->parent) {
+		if (dpp->state != DPP_STATE_NOTHING)
+			dpp_session_finished(dpp);
+
+		return;
+	}
+
+	l_idle_remove(l_steal_ptr(dpp->auth_request_idle));
+	l_queue_destroy(l_steal_ptr(dpp->auth_requests), l_free);
+	l_hashmap_destroy(l_steal_ptr(dpp->sessions), dpp_session_free);
+
 	if (dpp->uri) {
 		l_free(dpp->uri);
 		dpp->uri = NULL;
@@ -184,6 +269,11 @@ static void dpp_reset(struct dpp_sm *dpp)
 		dpp->freqs = NULL;
 	}
 
+	if (dpp->configurator_freqs) {
+		scan_freq_set_free(dpp->configurator_freqs);
+		dpp->configurator_freqs = NULL;
+	}
+
 	if (dpp->offchannel_id) {
 		offchannel_cancel(dpp->wdev_id, dpp->offchannel_id);
 		dpp->offchannel_id = 0;
@@ -229,6 +319,11 @@ static void dpp_free(struct dpp_sm *dpp)
 {
 	dpp_reset(dpp);
 
+	if (dpp->frame_send_id) {
+		l_genl_family_cancel(nl80211, dpp->frame_send_id);
+		dpp->frame_send_id = 0;
+	}
+
 	if (dpp->own_asn1) {
 		l_free(dpp->own_asn1);
 		dpp->own_asn1 = NULL;
@@ -247,10 +342,31 @@ static void dpp_free(struct dpp_sm *dpp)
 	l_free(dpp);
 }
 
+static void dpp_proto_key_idle(struct l_idle *idle, void *user_data)
+{
+	if (!dpp_key_pool_refill(proto_key_pool))
+		l_idle_remove(l_steal_ptr(proto_key_idle));
+}
+
+/*
+ * Take the protocol key pair from the pool and top the pool back up once
+ * the frame in progress is out of the way.
+ */
+static void dpp_generate_proto_keys(struct dpp_sm *dpp)
+{
+	dpp_key_pool_get(proto_key_pool, &dpp->proto_private,
+				&dpp->own_proto_public);
+
+	if (!proto_key_idle)
+		proto_key_idle = l_idle_create(dpp_proto_key_idle, NULL, NULL);
+}
+
 static void dpp_send_frame_cb(struct l_genl_msg *msg, void *user_data)
 {
 	struct dpp_sm *dpp = user_data;
 
+	dpp->frame_send_id = 0;
+
 	if (l_genl_msg_get_error(msg) < 0) {
 		l_error("Error sending frame");
 		return;
@@ -275,7 +391,9 @@ static void dpp_send_frame(struct dpp_sm *dpp,
 
 	l_debug("Sending frame on frequency %u", freq);
 
-	if (!l_genl_family_send(nl80211, msg, dpp_send_frame_cb, dpp, NULL)) {
+	dpp->frame_send_id = l_genl_family_send(nl80211, msg,
+						dpp_send_frame_cb, dpp, NULL);
+	if (!dpp->frame_send_id) {
 		l_error("Could not send CMD_FRAME");
 		l_genl_msg_unref(msg);
 	}
@@ -805,6 +923,12 @@ static void dpp_handle_config_request_frame(const struct mmpdu_header *frame,
 	_auto_(l_free) char *tech = NULL;
 	_auto_(l_free) char *role = NULL;
 
+	if (dpp->sessions) {
+		dpp = l_hashmap_lookup(dpp->sessions, frame->address_2);
+		if (!dpp)
+			return;
+	}
+
 	if (dpp->state != DPP_STATE_AUTHENTICATING) {
 		l_debug("Configuration request in wrong state");
 		return;
@@ -1271,7 +1395,6 @@ static void dpp_presence_announce(struct dpp_sm *dpp)
 	struct netdev *netdev = dpp->netdev;
 	uint8_t hdr[32];
 	uint8_t attrs[32 + 4];
-	uint8_t hash[32];
 	uint8_t *ptr = attrs;
 	const uint8_t *addr = netdev_get_address(netdev);
 	struct iovec iov[2];
@@ -1280,10 +1403,8 @@ static void dpp_presence_announce(struct dpp_sm *dpp)
 					DPP_FRAME_PRESENCE_ANNOUNCEMENT, hdr);
 	iov[0].iov_base = hdr;
 
-	dpp_hash(L_CHECKSUM_SHA256, hash, 2, "chirp", strlen("chirp"),
-			dpp->own_asn1, dpp->own_asn1_len);
-
-	ptr += dpp_append_attr(ptr, DPP_ATTR_RESPONDER_BOOT_KEY_HASH, hash, 32);
+	ptr += dpp_append_attr(ptr, DPP_ATTR_RESPONDER_BOOT_KEY_HASH,
+				dpp->own_chirp_hash, 32);
 
 	iov[1].iov_base = attrs;
 	iov[1].iov_len = ptr - attrs;
@@ -1462,9 +1583,19 @@ static void dpp_start_offchannel(struct dpp_sm *dpp, uint32_t freq)
 	 * the previous offchannel work is cancelled (i.e. destroy() has been
 	 * called).
 	 */
-	uint32_t id = offchannel_start(netdev_get_wdev_id(dpp->netdev),
-				freq, dpp->dwell, dpp_roc_started,
-				dpp, dpp_presence_timeout);
+	uint32_t dwell = dpp->dwell;
+	uint32_t id;
+
+	/*
+	 * If we know which channels have a Configurator nearby only dwell
+	 * briefly on the rest.
+	 */
+	if (dpp->state == DPP_STATE_PRESENCE && dpp->configurator_freqs &&
+			!scan_freq_set_contains(dpp->configurator_freqs, freq))
+		dwell = L_MIN(dwell, DPP_PRESENCE_SHORT_DWELL);
+
+	id = offchannel_start(netdev_get_wdev_id(dpp->netdev), freq, dwell,
+				dpp_roc_started, dpp, dpp_presence_timeout);
 
 	if (dpp->offchannel_id)
 		offchannel_cancel(dpp->wdev_id, dpp->offchannel_id);
@@ -1888,7 +2019,6 @@ static void dpp_handle_presence_announcement(struct dpp_sm *dpp,
 	const uint8_t *data;
 	const void *r_boot = NULL;
 	size_t r_boot_len = 0;
-	uint8_t hash[32];
 
 	l_debug("Presence announcement "MAC, MAC_STR(from));
 
@@ -1931,11 +2061,8 @@ static void dpp_handle_presence_announcement(struct dpp_sm *dpp,
 		return;
 	}
 
-	/* Hash what we have for the peer and check its our enrollee */
-	dpp_hash(L_CHECKSUM_SHA256, hash, 2, "chirp", strlen("chirp"),
-			dpp->peer_asn1, dpp->peer_asn1_len);
-
-	if (memcmp(hash, r_boot, sizeof(hash))) {
+	/* Check the hash is the one of our enrollee */
+	if (memcmp(dpp->peer_chirp_hash, r_boot, 32)) {
 		l_debug("Peers boot hash did not match");
 		return;
 	}
@@ -1997,6 +2124,148 @@ static void dpp_handle_frame(struct dpp_sm *dpp,
 	}
 }
 
+static unsigned int dpp_addr_hash(const void *key)
+{
+	const uint8_t *addr = key;
+
+	return l_get_le32(addr + 2);
+}
+
+static int dpp_addr_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, 6);
+}
+
+struct dpp_cookie_search {
+	uint64_t cookie;
+	struct dpp_sm *session;
+};
+
+static void dpp_session_match_cookie(const void *key, void *value,
+					void *user_data)
+{
+	struct dpp_sm *session = value;
+	struct dpp_cookie_search *search = user_data;
+
+	if (session->frame_cookie == search->cookie)
+		search->session = session;
+}
+
+static bool dpp_auth_request_match(const void *a, const void *b)
+{
+	const struct dpp_auth_request *req = a;
+
+	return !memcmp(req->addr, b, 6);
+}
+
+static struct dpp_sm *dpp_session_new(struct dpp_sm *dpp, const uint8_t *addr)
+{
+	struct dpp_sm *session = l_new(struct dpp_sm, 1);
+
+	session->parent = dpp;
+	session->netdev = dpp->netdev;
+	session->wdev_id = dpp->wdev_id;
+	session->role = dpp->role;
+	memcpy(session->own_boot_hash, dpp->own_boot_hash, 32);
+	session->curve = dpp->curve;
+	session->key_len = dpp->key_len;
+	session->nonce_len = dpp->nonce_len;
+	session->boot_private = dpp->boot_private;
+	session->boot_public = dpp->boot_public;
+	session->current_freq = dpp->current_freq;
+	session->config = dpp->config;
+	session->mcast_support = dpp->mcast_support;
+	session->state = DPP_STATE_PRESENCE;
+	memcpy(session->auth_addr, addr, 6);
+
+	dpp_generate_proto_keys(session);
+
+	return session;
+}
+
+/*
+ * Each Authentication Request costs a protocol key generation and three ECDH
+ * operations.  Handle one request per main loop iteration so a burst of
+ * enrollees can't stall the other sessions or the rest of the daemon.
+ */
+static void dpp_auth_request_idle(struct l_idle *idle, void *user_data)
+{
+	struct dpp_sm *dpp = user_data;
+	_auto_(l_free) struct dpp_auth_request *req =
+					l_queue_pop_head(dpp->auth_requests);
+	struct dpp_sm *session;
+
+	if (l_queue_isempty(dpp->auth_requests))
+		l_idle_remove(l_steal_ptr(dpp->auth_request_idle));
+
+	if (!req)
+		return;
+
+	session = dpp_session_new(dpp, req->addr);
+	l_hashmap_insert(dpp->sessions, session->auth_addr, session);
+
+	l_debug("DPP session with "MAC" started (%u active)",
+			MAC_STR(req->addr), l_hashmap_size(dpp->sessions));
+
+	authenticate_request(session, req->addr, req->body, req->body_len);
+
+	/*
+	 * A peer failing authentication keeps its table entry, and is ignored,
+	 * until the session times out.
+	 */
+	if (session->state != DPP_STATE_AUTHENTICATING)
+		dpp_reset_protocol_timer(session);
+}
+
+static void dpp_sessions_handle_frame(struct dpp_sm *dpp,
+					const struct mmpdu_header *frame,
+					const void *body, size_t body_len)
+{
+	const uint8_t *from = frame->address_2;
+	struct dpp_sm *session;
+	struct dpp_auth_request *req;
+	unsigned int pending;
+	bool auth_request;
+
+	if (body_len < 8)
+		return;
+
+	auth_request = l_get_u8(body + 7) == DPP_FRAME_AUTHENTICATION_REQUEST;
+
+	session = l_hashmap_lookup(dpp->sessions, from);
+	if (session) {
+		if (!auth_request)
+			dpp_handle_frame(session, frame, body, body_len);
+
+		return;
+	}
+
+	if (!auth_request || util_is_broadcast_address(from))
+		return;
+
+	if (l_queue_find(dpp->auth_requests, dpp_auth_request_match, from))
+		return;
+
+	pending = l_hashmap_size(dpp->sessions) +
+			l_queue_length(dpp->auth_requests);
+	if (pending >= dpp_max_sessions) {
+		l_debug("Too many DPP sessions, dropping request from "MAC,
+				MAC_STR(from));
+		return;
+	}
+
+	req = l_malloc(sizeof(*req) + body_len);
+	memcpy(req->addr, from, 6);
+	req->body_len = body_len;
+	memcpy(req->body, body, body_len);
+
+	l_queue_push_tail(dpp->auth_requests, req);
+
+	if (!dpp->auth_request_idle)
+		dpp->auth_request_idle = l_idle_create(dpp_auth_request_idle,
+							dpp, NULL);
+}
+
 static bool match_wdev(const void *a, const void *b)
 {
 	const struct dpp_sm *dpp = a;
@@ -2028,6 +2297,16 @@ static void dpp_mlme_notify(struct l_genl_msg *msg, void *user_data)
 	if (!dpp)
 		return;
 
+	if (dpp->sessions) {
+		struct dpp_cookie_search search = { .cookie = cookie };
+
+		l_hashmap_foreach(dpp->sessions, dpp_session_match_cookie,
+					&search);
+		dpp = search.session;
+		if (!dpp)
+			return;
+	}
+
 	if (dpp->state <= DPP_STATE_PRESENCE)
 		return;
 
@@ -2109,6 +2388,11 @@ static void dpp_unicast_notify(struct l_genl_msg *msg, void *user_data)
 			memcmp(body, dpp_prefix, sizeof(dpp_prefix)) != 0)
 		return;
 
+	if (dpp->sessions) {
+		dpp_sessions_handle_frame(dpp, mpdu, body, body_len);
+		return;
+	}
+
 	dpp_handle_frame(dpp, mpdu, body, body_len);
 }
 
@@ -2167,6 +2451,9 @@ static void dpp_create(struct netdev *netdev)
 
 	dpp_hash(L_CHECKSUM_SHA256, dpp->own_boot_hash, 1,
 			dpp->own_asn1, dpp->own_asn1_len);
+	dpp_hash(L_CHECKSUM_SHA256, dpp->own_chirp_hash, 2,
+			"chirp", strlen("chirp"),
+			dpp->own_asn1, dpp->own_asn1_len);
 
 	l_dbus_object_add_interface(dbus, netdev_get_path(netdev),
 					IWD_DPP_INTERFACE, dpp);
@@ -2239,6 +2526,116 @@ static uint32_t *dpp_add_default_channels(struct dpp_sm *dpp, size_t *len_out)
 	return scan_freq_set_to_fixed_array(dpp->presence_list, len_out);
 }
 
+struct dpp_presence_channel {
+	uint32_t freq;
+	unsigned int configurators;
+	unsigned int aps;
+};
+
+static bool dpp_presence_channel_match(const void *a, const void *b)
+{
+	const struct dpp_presence_channel *channel = a;
+
+	return channel->freq == L_PTR_TO_UINT(b);
+}
+
+static int dpp_presence_channel_compare(const void *a, const void *b,
+					void *user_data)
+{
+	const struct dpp_presence_channel *new_channel = a;
+	const struct dpp_presence_channel *channel = b;
+
+	if (channel->configurators != new_channel->configurators)
+		return channel->configurators > new_channel->configurators ?
+			1 : -1;
+
+	return channel->aps > new_channel->aps ? 1 : -1;
+}
+
+static bool dpp_freq_in_list(const uint32_t *freqs, size_t len,
+				uint32_t freq)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (freqs[i] == freq)
+			return true;
+
+	return false;
+}
+
+/*
+ * EasyConnect 2.0 - 6.2.2: besides the default channels, announce our
+ * presence on the channels of the APs from the last scan.  Channels with
+ * APs advertising the Configurator Connectivity element go first, then
+ * those with the most APs.
+ */
+static uint32_t *dpp_rank_presence_channels(struct dpp_sm *dpp,
+						size_t *len_out)
+{
+	struct station *station = station_find(netdev_get_ifindex(dpp->netdev));
+	struct l_queue *bss_list = station ? station_get_bss_list(station) :
+						NULL;
+	struct l_queue *channels = l_queue_new();
+	const struct l_queue_entry *entry;
+	uint32_t *defaults;
+	size_t n_defaults;
+	uint32_t *freqs;
+	size_t len = 0;
+	size_t i;
+
+	for (entry = l_queue_get_entries(bss_list); entry;
+			entry = entry->next) {
+		const struct scan_bss *bss = entry->data;
+		struct dpp_presence_channel *channel;
+
+		channel = l_queue_find(channels, dpp_presence_channel_match,
+					L_UINT_TO_PTR(bss->frequency));
+		if (!channel) {
+			channel = l_new(struct dpp_presence_channel, 1);
+			channel->freq = bss->frequency;
+			l_queue_push_tail(channels, channel);
+		}
+
+		channel->aps++;
+
+		if (!bss->dpp_configurator)
+			continue;
+
+		channel->configurators++;
+
+		if (!dpp->configurator_freqs)
+			dpp->configurator_freqs = scan_freq_set_new();
+
+		scan_freq_set_add(dpp->configurator_freqs, bss->frequency);
+	}
+
+	l_queue_sort(channels, dpp_presence_channel_compare, NULL);
+
+	defaults = dpp_add_default_channels(dpp, &n_defaults);
+	freqs = l_new(uint32_t, DPP_PRESENCE_MAX_SCAN_CHANNELS + n_defaults);
+
+	for (entry = l_queue_get_entries(channels);
+			entry && len < DPP_PRESENCE_MAX_SCAN_CHANNELS;
+			entry = entry->next) {
+		const struct dpp_presence_channel *channel = entry->data;
+
+		l_debug("Presence channel %u, %u APs, %u Configurators",
+			channel->freq, channel->aps, channel->configurators);
+		freqs[len++] = channel->freq;
+	}
+
+	for (i = 0; i < n_defaults; i++)
+		if (!dpp_freq_in_list(freqs, len, defaults[i]))
+			freqs[len++] = defaults[i];
+
+	l_free(defaults);
+	l_queue_destroy(channels, l_free);
+
+	*len_out = len;
+	return freqs;
+}
+
 /*
  * TODO: There is an entire procedure defined in the spec where you increase
  * the ROC timeout with each unsuccessful iteration of channels, wait on channel
@@ -2274,6 +2671,8 @@ static struct l_dbus_message *dpp_dbus_start_enrollee(struct l_dbus *dbus,
 {
 	struct dpp_sm *dpp = user_data;
 	uint32_t freq = band_channel_to_freq(6, BAND_FREQ_2_4_GHZ);
+	_auto_(l_free) uint32_t *freqs = NULL;
+	size_t freqs_len = 1;
 	struct station *station = station_find(netdev_get_ifindex(dpp->netdev));
 
 	if (dpp->state != DPP_STATE_NOTHING)
@@ -2289,26 +2688,30 @@ static struct l_dbus_message *dpp_dbus_start_enrollee(struct l_dbus *dbus,
 	} else if (!station)
 		l_debug("No station device, continuing anyways...");
 
+	/*
+	 * Going off spec here by default. Select a single channel to send
+	 * presence announcements on. This will be advertised in the URI.
+	 * Optionally announce on channels ranked by the last scan instead.
+	 */
+	if (dpp_rank_presence)
+		freqs = dpp_rank_presence_channels(dpp, &freqs_len);
+	else
+		freqs = l_memdup(&freq, sizeof(freq));
+
 	dpp->uri = dpp_generate_uri(dpp->own_asn1, dpp->own_asn1_len, 2,
-					netdev_get_address(dpp->netdev), &freq,
-					1, NULL, NULL);
+					netdev_get_address(dpp->netdev), freqs,
+					freqs_len, NULL, NULL);
 
 	dpp->state = DPP_STATE_PRESENCE;
 	dpp->role = DPP_CAPABILITY_ENROLLEE;
 
-	l_ecdh_generate_key_pair(dpp->curve, &dpp->proto_private,
-					&dpp->own_proto_public);
+	dpp_generate_proto_keys(dpp);
 
 	l_debug("DPP Start Enrollee: %s", dpp->uri);
 
 	dpp->pending = l_dbus_message_ref(message);
 
-	/*
-	 * Going off spec here. Select a single channel to send presence
-	 * announcements on. This will be advertised in the URI. The full
-	 * presence procedure can be implemented if it is ever needed.
-	 */
-	dpp_start_presence(dpp, &freq, 1);
+	dpp_start_presence(dpp, freqs, freqs_len);
 
 	scan_periodic_stop(dpp->wdev_id);
 
@@ -2364,6 +2767,9 @@ static bool dpp_configurator_start_presence(struct dpp_sm *dpp, const char *uri)
 
 	dpp_hash(L_CHECKSUM_SHA256, dpp->peer_boot_hash, 1, dpp->peer_asn1,
 			dpp->peer_asn1_len);
+	dpp_hash(L_CHECKSUM_SHA256, dpp->peer_chirp_hash, 2,
+			"chirp", strlen("chirp"),
+			dpp->peer_asn1, dpp->peer_asn1_len);
 
 	dpp_start_presence(dpp, freqs, freqs_len);
 
@@ -2407,8 +2813,7 @@ static struct l_dbus_message *dpp_start_configurator_common(
 	if (dpp->state != DPP_STATE_NOTHING)
 		return dbus_error_busy(message);
 
-	l_ecdh_generate_key_pair(dpp->curve, &dpp->proto_private,
-					&dpp->own_proto_public);
+	dpp_generate_proto_keys(dpp);
 
 	dpp->state = DPP_STATE_PRESENCE;
 
@@ -2427,9 +2832,19 @@ static struct l_dbus_message *dpp_start_configurator_common(
 
 		if (!dpp->mcast_support)
 			dpp->state = DPP_STATE_AUTHENTICATING;
-	} else
+	} else {
 		dpp->current_freq = bss->frequency;
 
+		if (dpp_max_sessions > 1) {
+			dpp->sessions = l_hashmap_new();
+			l_hashmap_set_hash_function(dpp->sessions,
+							dpp_addr_hash);
+			l_hashmap_set_compare_function(dpp->sessions,
+							dpp_addr_compare);
+			dpp->auth_requests = l_queue_new();
+		}
+	}
+
 	dpp->uri = dpp_generate_uri(dpp->own_asn1, dpp->own_asn1_len, 2,
 					netdev_get_address(dpp->netdev),
 					&bss->frequency, 1, NULL, NULL);
@@ -2517,6 +2932,25 @@ static int dpp_init(void)
 						dpp_unicast_notify,
 						NULL, NULL);
 
+	if (!l_settings_get_bool(iwd_get_config(), "DPP",
+					"RankPresenceChannels",
+					&dpp_rank_presence))
+		dpp_rank_presence = false;
+
+	if (!l_settings_get_uint(iwd_get_config(), "DPP",
+					"MaxConfiguratorSessions",
+					&dpp_max_sessions))
+		dpp_max_sessions = 1;
+
+	if (!dpp_max_sessions)
+		dpp_max_sessions = 1;
+	else if (dpp_max_sessions > DPP_MAX_CONFIGURATOR_SESSIONS)
+		dpp_max_sessions = DPP_MAX_CONFIGURATOR_SESSIONS;
+
+	proto_key_pool = dpp_key_pool_new(l_ecc_curve_from_ike_group(19),
+						DPP_PROTO_KEY_POOL_SIZE);
+	proto_key_idle = l_idle_create(dpp_proto_key_idle, NULL, NULL);
+
 	dpp_list = l_queue_new();
 
 	return 0;
@@ -2539,6 +2973,9 @@ static void dpp_exit(void)
 	nl80211 = NULL;
 
 	l_queue_destroy(dpp_list, (l_queue_destroy_func_t) dpp_free);
+
+	l_idle_remove(l_steal_ptr(proto_key_idle));
+	dpp_key_pool_free(l_steal_ptr(proto_key_pool));
 }
 
 IWD_MODULE(dpp, dpp_init, dpp_exit);
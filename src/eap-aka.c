@@ -29,6 +29,7 @@
 #include <errno.h>
 #include <ell/ell.h>
 
+#include "ell/useful.h"
 #include "src/missing.h"
 #include "src/eap.h"
 #include "src/eap-private.h"
@@ -105,8 +106,13 @@ struct eap_aka_handle {
 	uint8_t *chal_pkt;
 	uint32_t pkt_len;
 
+	/* State for fast re-authentication, if available */
+	struct eap_sim_reauth *reauth;
+	char *next_reauth_id;
+
 	struct iwd_sim_auth *auth;
 	unsigned int auth_watch;
+	int auth_req;
 };
 
 static void eap_aka_clear_secrets(struct eap_aka_handle *aka)
@@ -123,12 +129,18 @@ static void eap_aka_free(struct eap_state *eap)
 {
 	struct eap_aka_handle *aka = eap_get_data(eap);
 
-	if (aka->auth)
+	if (aka->auth) {
+		if (aka->auth_req > 0)
+			sim_auth_cancel_request(aka->auth, aka->auth_req);
+
 		sim_auth_unregistered_watch_remove(aka->auth, aka->auth_watch);
+	}
 
 	eap_aka_clear_secrets(aka);
+	eap_sim_reauth_free(aka->reauth);
 
 	l_free(aka->identity);
+	l_free(aka->next_reauth_id);
 	l_free(aka->kdf_in);
 	l_free(aka);
 
@@ -180,6 +192,20 @@ static void eap_aka_finish(struct eap_state *eap)
 	eap_method_success(eap);
 	eap_set_key_material(eap, aka->msk, 32, aka->emsk, 32, NULL, 0,
 					session_id, sizeof(session_id));
+
+	if (aka->next_reauth_id) {
+		struct eap_sim_reauth *reauth = l_new(struct eap_sim_reauth, 1);
+
+		reauth->type = aka->type;
+		reauth->permanent_id = l_strdup(aka->identity);
+		reauth->reauth_id = l_steal_ptr(aka->next_reauth_id);
+		memcpy(reauth->mk, aka->mk, sizeof(aka->mk));
+		memcpy(reauth->k_encr, aka->k_encr, sizeof(aka->k_encr));
+		memcpy(reauth->k_aut, aka->k_aut, sizeof(aka->k_aut));
+		memcpy(reauth->k_re, aka->k_re, sizeof(aka->k_re));
+
+		eap_sim_reauth_store(reauth);
+	}
 }
 
 static void check_milenage_cb(const uint8_t *res, const uint8_t *ck,
@@ -191,6 +217,9 @@ static void check_milenage_cb(const uint8_t *res, const uint8_t *ck,
 	size_t resp_len = aka->protected ? 44 : 40;
 	uint8_t response[EAP_SIM_ROUND(resp_len + 4)];
 	uint8_t *pos = response;
+	struct eap_sim_encr_attrs encr;
+
+	aka->auth_req = 0;
 
 	if (auts) {
 		/*
@@ -262,6 +291,16 @@ static void check_milenage_cb(const uint8_t *res, const uint8_t *ck,
 		goto chal_error;
 	}
 
+	/* AT_ENCR_DATA carries the identity for fast re-authentication */
+	if (!eap_sim_decrypt_attributes(aka->k_encr, aka->chal_pkt,
+					aka->pkt_len, &encr)) {
+		l_error("AT_ENCR_DATA was malformed");
+		goto chal_error;
+	}
+
+	l_free(aka->next_reauth_id);
+	aka->next_reauth_id = encr.next_reauth_id;
+
 	aka->state = EAP_AKA_STATE_CHALLENGE;
 
 	pos += eap_sim_build_header(eap, aka->type, EAP_AKA_ST_CHALLENGE,
@@ -451,8 +490,9 @@ static void handle_challenge(struct eap_state *eap, const uint8_t *pkt,
 	/* Keep RAND for session ID derivation */
 	memcpy(aka->rand, rand, EAP_SIM_RAND_LEN);
 
-	if (sim_auth_check_milenage(aka->auth, rand, autn, check_milenage_cb,
-			eap) < 0) {
+	aka->auth_req = sim_auth_check_milenage(aka->auth, rand, autn,
+						check_milenage_cb, eap);
+	if (aka->auth_req < 0) {
 		l_free(aka->chal_pkt);
 		aka->chal_pkt = NULL;
 		goto chal_error;
@@ -464,6 +504,48 @@ chal_error:
 	eap_sim_client_error(eap, aka->type, EAP_SIM_ERROR_PROCESS);
 }
 
+/*
+ * Handles Re-authentication subtype
+ */
+static void handle_reauth(struct eap_state *eap, const uint8_t *pkt,
+		size_t len)
+{
+	struct eap_aka_handle *aka = eap_get_data(eap);
+	uint8_t session_id[1 + EAP_SIM_NONCE_S_LEN + EAP_SIM_MAC_LEN];
+	int r;
+
+	if (aka->state != EAP_AKA_STATE_UNCONNECTED || !aka->reauth) {
+		l_error("invalid packet for EAP-AKA state");
+		goto reauth_error;
+	}
+
+	r = eap_sim_reauth_process(eap, aka->reauth, pkt, len, aka->msk,
+					aka->emsk, session_id);
+	if (r == -ERANGE) {
+		/* The server is expected to start a full authentication */
+		eap_sim_reauth_free(l_steal_ptr(aka->reauth));
+		return;
+	}
+
+	if (r < 0)
+		goto reauth_error;
+
+	eap_method_success(eap);
+	eap_set_key_material(eap, aka->msk, 32, aka->emsk, 32, NULL, 0,
+					session_id, sizeof(session_id));
+
+	aka->state = EAP_AKA_STATE_SUCCESS;
+
+	/* Without a new identity the next connection uses full auth */
+	if (aka->reauth->reauth_id)
+		eap_sim_reauth_store(l_steal_ptr(aka->reauth));
+
+	return;
+
+reauth_error:
+	eap_sim_client_error(eap, aka->type, EAP_SIM_ERROR_PROCESS);
+}
+
 /*
  * Handles Notification subtype
  */
@@ -574,6 +656,16 @@ static void handle_identity(struct eap_state *eap, const uint8_t *pkt,
 	}
 
 	aka->state = EAP_AKA_STATE_IDENTITY;
+
+	/*
+	 * The server did not accept the re-authentication identity, the
+	 * keys belonging to it are of no further use.
+	 */
+	if (aka->reauth) {
+		l_debug("Fast re-authentication not accepted");
+		eap_sim_reauth_free(l_steal_ptr(aka->reauth));
+	}
+
 	/*
 	 * Build response packet
 	 */
@@ -609,6 +701,10 @@ static void eap_aka_handle_request(struct eap_state *eap,
 		handle_notification(eap, pkt, len);
 		break;
 
+	case EAP_SIM_ST_REAUTHENTICATION:
+		handle_reauth(eap, pkt, len);
+		break;
+
 	default:
 		l_error("unknown EAP-SIM subtype: %u", pkt[0]);
 		goto req_error;
@@ -624,6 +720,9 @@ static const char *eap_aka_get_identity(struct eap_state *eap)
 {
 	struct eap_aka_handle *aka = eap_get_data(eap);
 
+	if (aka->reauth)
+		return aka->reauth->reauth_id;
+
 	return aka->identity;
 }
 
@@ -632,6 +731,9 @@ static void auth_destroyed(void *data)
 	struct eap_state *eap = data;
 	struct eap_aka_handle *aka = eap_get_data(eap);
 
+	/* Dropped along with the provider */
+	aka->auth_req = 0;
+
 	/*
 	 * If AKA was already successful we can return. Also if the state
 	 * has been set to ERROR, then eap_method_error has already been called,
@@ -695,6 +797,7 @@ static bool eap_aka_common_load_settings(struct eap_state *eap,
 			auth_destroyed, eap);
 	aka->identity = l_strdup_printf("%c%s", id_prefix,
 			iwd_sim_auth_get_nai(aka->auth));
+	aka->reauth = eap_sim_reauth_take(aka->type, aka->identity);
 
 	return true;
 }
@@ -733,6 +836,8 @@ static bool eap_aka_reset_state(struct eap_state *eap)
 	aka->kdf_in = NULL;
 	l_free(aka->chal_pkt);
 	aka->chal_pkt = NULL;
+	l_free(aka->next_reauth_id);
+	aka->next_reauth_id = NULL;
 
 	eap_aka_clear_secrets(aka);
 	memset(aka->autn, 0, sizeof(aka->autn));
@@ -774,6 +879,7 @@ static void eap_aka_exit(void)
 {
 	l_debug("");
 	eap_unregister_method(&eap_aka);
+	eap_sim_reauth_flush();
 }
 
 static int eap_aka_prime_init(void)
@@ -786,6 +892,7 @@ static void eap_aka_prime_exit(void)
 {
 	l_debug("");
 	eap_unregister_method(&eap_aka_prime);
+	eap_sim_reauth_flush();
 }
 
 EAP_METHOD_BUILTIN(eap_aka, eap_aka_init, eap_aka_exit);
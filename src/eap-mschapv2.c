@@ -464,22 +464,31 @@ static int eap_mschapv2_check_settings(struct l_settings *settings,
 	password_hash = l_settings_get_bytes(settings, "Security",
 						setting, &hash_len);
 
+	if (password_hash && hash_len != 16) {
+		l_error("Property %s is not a 16-byte hexstring", setting);
+		r = -EINVAL;
+		goto cleanup;
+	}
+
+	/*
+	 * Both are present once eap_mschapv2_load_settings has replaced the
+	 * password with its hash and the password secret was set again for
+	 * a new attempt, accept the pair as long as the two agree.
+	 */
 	if (password && password_hash) {
+		if (mschap_nt_password_hash(password, hash) &&
+				!memcmp(hash, password_hash, 16))
+			goto cleanup;
+
 		l_error("Exactly one of (%s, %s) must be present",
 			setting, setting2);
 		r = -EEXIST;
 		goto cleanup;
 	}
 
-	if (password_hash) {
-		if (hash_len != 16) {
-			l_error("Property %s is not a 16-byte hexstring",
-				setting);
-			return -EINVAL;
-		}
-
+	if (password_hash)
 		return 0;
-	} else if (password)
+	else if (password)
 		goto validate;
 
 	secret = l_queue_find(secrets, eap_secret_info_match, setting2);
@@ -497,7 +506,10 @@ validate:
 		r = -EINVAL;
 
 cleanup:
-	explicit_bzero(password, strlen(password));
+	if (password)
+		explicit_bzero(password, strlen(password));
+
+	explicit_bzero(hash, sizeof(hash));
 	return r;
 }
 
@@ -525,6 +537,18 @@ static bool eap_mschapv2_load_settings(struct eap_state *eap,
 	if (password) {
 		set_password_from_string(state, password);
 		explicit_bzero(password, strlen(password));
+
+		/*
+		 * Keep only the NT hash in the loaded settings so that later
+		 * attempts on this network skip re-hashing and the plaintext
+		 * isn't held for the lifetime of the connection.  These are
+		 * never written back, known network profiles are re-read
+		 * from disk before any sync.
+		 */
+		l_settings_remove_key(settings, "Security", setting);
+		snprintf(setting, sizeof(setting), "%sPassword-Hash", prefix);
+		l_settings_set_bytes(settings, "Security", setting,
+					state->password_hash, 16);
 	} else {
 		size_t hash_len;
 		uint8_t *hash;
@@ -94,14 +94,16 @@ static bool kdf(uint8_t *key, size_t key_len, const char *label,
 	uint16_t ibuf, i = 1;
 	uint16_t L = L_CPU_TO_BE16(olen * 8);
 	size_t len = 0;
+	bool r = false;
+
+	/* The key is the same for every block, only set it up once */
+	hmac = l_checksum_new_hmac(L_CHECKSUM_SHA256, key, key_len);
+	if (!hmac)
+		return false;
 
 	while (len < olen) {
 		int iov_pos = 0;
 
-		hmac = l_checksum_new_hmac(L_CHECKSUM_SHA256, key, key_len);
-		if (!hmac)
-			return false;
-
 		/* PRF(key, K(i - 1) | i | label | L) */
 		if (i > 1) {
 			iov[iov_pos].iov_base = out + len - 32;
@@ -116,21 +118,144 @@ static bool kdf(uint8_t *key, size_t key_len, const char *label,
 		iov[iov_pos].iov_base = &L;
 		iov[iov_pos++].iov_len = 2;
 
-		if (!l_checksum_updatev(hmac, iov, iov_pos)) {
-			l_checksum_free(hmac);
-			return false;
-		}
+		if (!l_checksum_updatev(hmac, iov, iov_pos))
+			goto done;
 
 		l_checksum_get_digest(hmac, out + len, minsize(olen - len, 32));
-		l_checksum_free(hmac);
+		l_checksum_reset(hmac);
 
 		len += 32;
 		i++;
 	}
 
+	r = true;
+
+done:
+	l_checksum_free(hmac);
+	return r;
+}
+
+/*
+ * State shared by all hunting-and-pecking iterations.  Everything that does
+ * not depend on the counter is set up once, an iteration then only costs
+ * the two hashes, one scalar for the candidate and a single Legendre symbol.
+ */
+struct eap_pwd_pwe_ctx {
+	const struct l_ecc_curve *curve;
+	uint8_t prime[L_ECC_SCALAR_MAX_BYTES];
+	size_t prime_len;
+	struct l_ecc_scalar *qr;
+	struct l_ecc_scalar *qnr;
+	uint8_t qnr_bin[L_ECC_SCALAR_MAX_BYTES];
+	struct l_ecc_scalar *y_sqr;
+	struct l_ecc_scalar *num;
+};
+
+static struct l_ecc_scalar *eap_pwd_new_residue(
+					const struct l_ecc_curve *curve,
+					bool residue)
+{
+	struct l_ecc_scalar *s = l_ecc_scalar_new_random(curve);
+
+	while (l_ecc_scalar_legendre(s) != ((residue) ? -1 : 1)) {
+		l_ecc_scalar_free(s);
+		s = l_ecc_scalar_new_random(curve);
+	}
+
+	return s;
+}
+
+static bool eap_pwd_pwe_ctx_init(struct eap_pwd_pwe_ctx *ctx,
+					const struct l_ecc_curve *curve)
+{
+	struct l_ecc_scalar *p = l_ecc_curve_get_prime(curve);
+	ssize_t len;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->curve = curve;
+
+	len = l_ecc_scalar_get_data(p, ctx->prime, sizeof(ctx->prime));
+	l_ecc_scalar_free(p);
+
+	if (len <= 0)
+		return false;
+
+	ctx->prime_len = len;
+
+	ctx->qr = eap_pwd_new_residue(curve, true);
+	ctx->qnr = eap_pwd_new_residue(curve, false);
+	l_ecc_scalar_get_data(ctx->qnr, ctx->qnr_bin, sizeof(ctx->qnr_bin));
+
+	ctx->y_sqr = l_ecc_scalar_new(curve, NULL, 0);
+	ctx->num = l_ecc_scalar_new(curve, NULL, 0);
+
 	return true;
 }
 
+static void eap_pwd_pwe_ctx_free(struct eap_pwd_pwe_ctx *ctx)
+{
+	l_ecc_scalar_free(ctx->qr);
+	l_ecc_scalar_free(ctx->qnr);
+	l_ecc_scalar_free(ctx->y_sqr);
+	l_ecc_scalar_free(ctx->num);
+	explicit_bzero(ctx->qnr_bin, sizeof(ctx->qnr_bin));
+}
+
+/*
+ * Turns the binary pwd-value into a scalar.  A value >= p is not a valid
+ * x-coordinate, but to keep the control flow smooth it is replaced by the
+ * quadratic non-residue so that the residue test below simply fails.
+ */
+static struct l_ecc_scalar *eap_pwd_value(struct eap_pwd_pwe_ctx *ctx,
+						uint8_t *value)
+{
+	int is_in_range;
+
+	is_in_range = l_secure_memcmp(value, ctx->prime, ctx->prime_len);
+	is_in_range = util_secure_fill_with_msb(is_in_range);
+
+	util_secure_select((uint8_t) is_in_range, value, ctx->qnr_bin,
+						value, L_ECC_SCALAR_MAX_BYTES);
+
+	return l_ecc_scalar_new(ctx->curve, value, L_ECC_SCALAR_MAX_BYTES);
+}
+
+/*
+ * Checks whether x^3 + ax + b is a quadratic residue, i.e. whether value is
+ * the x-coordinate of a point on the curve.  The test is blinded with a
+ * random r and either qr or qnr so that the Legendre symbol computation
+ * does not leak anything about the candidate.
+ */
+static uint8_t eap_pwd_is_quadratic_residue(struct eap_pwd_pwe_ctx *ctx,
+						struct l_ecc_scalar *value)
+{
+	uint64_t rbuf[L_ECC_MAX_DIGITS];
+	struct l_ecc_scalar *r = l_ecc_scalar_new_random(ctx->curve);
+	struct l_ecc_scalar *blind;
+	int expected;
+	ssize_t bytes;
+	uint8_t odd;
+
+	l_ecc_scalar_sum_x(ctx->y_sqr, value);
+
+	l_ecc_scalar_multiply(ctx->num, ctx->y_sqr, r);
+	l_ecc_scalar_multiply(ctx->num, ctx->num, r);
+
+	bytes = l_ecc_scalar_get_data(r, rbuf, sizeof(rbuf));
+	l_ecc_scalar_free(r);
+
+	if (bytes <= 0)
+		return 0;
+
+	odd = rbuf[bytes / 8 - 1] & 1;
+	blind = odd ? ctx->qr : ctx->qnr;
+	expected = odd ? -1 : 1;
+
+	l_ecc_scalar_multiply(ctx->num, ctx->num, blind);
+
+	return l_ecc_scalar_legendre(ctx->num) == expected;
+}
+
 static bool eap_pwd_reset_state(struct eap_state *eap)
 {
 	struct eap_pwd_handle *pwd = eap_get_data(eap);
@@ -238,13 +363,18 @@ static void eap_pwd_handle_id(struct eap_state *eap,
 	uint8_t rand_fn;
 	uint8_t prf;
 	uint32_t token;
-	uint8_t counter = 0;
+	uint8_t counter;
 	uint8_t resp[15 + strlen(pwd->identity)];
 	uint8_t *pos;
 	uint8_t pwd_seed[32];
-	uint8_t pwd_value[L_ECC_SCALAR_MAX_BYTES];	/* used as X value */
+	uint8_t x[L_ECC_SCALAR_MAX_BYTES];
+	uint8_t x_cand[L_ECC_SCALAR_MAX_BYTES];
+	struct l_ecc_scalar *pwd_value;
+	struct eap_pwd_pwe_ctx ctx;
+	uint8_t found = 0;
+	uint8_t is_residue;
+	uint8_t is_odd = 0;
 	size_t nbytes;
-	bool found = false;
 
 	/*
 	 * Group desc (2) + Random func (1) + prf (1) + token (4) + prep (1) +
@@ -301,11 +431,17 @@ static void eap_pwd_handle_id(struct eap_state *eap,
 
 	nbytes = l_ecc_curve_get_scalar_bytes(pwd->curve);
 
-	while (counter < 20) {
-		struct l_ecc_point *pwe = NULL;
-
-		counter++;
+	if (!eap_pwd_pwe_ctx_init(&ctx, pwd->curve)) {
+		eap_pwd_pwe_ctx_free(&ctx);
+		goto error;
+	}
 
+	/*
+	 * Always run all iterations and only test candidates for being on the
+	 * curve, the point itself is recovered once the loop is done.  This
+	 * keeps the time taken independent of the password.
+	 */
+	for (counter = 1; counter <= 20; counter++) {
 		/* pwd-seed = H(token|peer-ID|server-ID|password|counter) */
 		hkdf_extract(L_CHECKSUM_SHA256, NULL, 0, 5, pwd_seed, &token, 4,
 				pwd->identity, strlen(pwd->identity), pkt + 9,
@@ -316,31 +452,41 @@ static void eap_pwd_handle_id(struct eap_state *eap,
 		 * pwd-value = KDF(pwd-seed, "EAP-pwd Hunting And Pecking",
 		 *                 len(p))
 		 */
+		memset(x_cand, 0, sizeof(x_cand));
 		kdf(pwd_seed, 32, "EAP-pwd Hunting And Pecking",
 				strlen("EAP-pwd Hunting And Pecking"),
-				pwd_value, nbytes);
+				x_cand, nbytes);
 
-		if (!(pwd_seed[31] & 1))
-			pwe = l_ecc_point_from_data(pwd->curve,
-					L_ECC_POINT_TYPE_COMPRESSED_BIT1,
-					pwd_value, nbytes);
-		else
-			pwe = l_ecc_point_from_data(pwd->curve,
-					L_ECC_POINT_TYPE_COMPRESSED_BIT0,
-					pwd_value, nbytes);
-
-		if (!pwe)
-			continue;
-
-		if (!found) {
-			found = true;
-			pwd->pwe = pwe;
-		} else
-			l_ecc_point_free(pwe);
+		pwd_value = eap_pwd_value(&ctx, x_cand);
+		is_residue = pwd_value ?
+			eap_pwd_is_quadratic_residue(&ctx, pwd_value) : 0;
+
+		/* Keep the first valid candidate and its y parity */
+		util_secure_select(found, x, x_cand, x, sizeof(x));
+		is_odd = util_secure_select_byte(found, is_odd,
+							pwd_seed[31] & 0x01);
+		found |= is_residue * 0xff;
+
+		l_ecc_scalar_free(pwd_value);
 	}
 
+	eap_pwd_pwe_ctx_free(&ctx);
 	explicit_bzero(pwd_seed, sizeof(pwd_seed));
-	explicit_bzero(pwd_value, sizeof(pwd_value));
+	explicit_bzero(x_cand, sizeof(x_cand));
+
+	/* An odd seed selects the even y and vice versa, see RFC 5931 */
+	if (found)
+		pwd->pwe = l_ecc_point_from_data(pwd->curve, is_odd ?
+					L_ECC_POINT_TYPE_COMPRESSED_BIT0 :
+					L_ECC_POINT_TYPE_COMPRESSED_BIT1,
+					x, nbytes);
+
+	explicit_bzero(x, sizeof(x));
+
+	if (!pwd->pwe) {
+		l_error("failed to derive the password element");
+		goto error;
+	}
 
 	pos = resp + 5; /* header */
 	*pos++ = EAP_PWD_EXCH_ID;
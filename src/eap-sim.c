@@ -30,6 +30,7 @@
 #include <alloca.h>
 #include <ell/ell.h>
 
+#include "ell/useful.h"
 #include "src/missing.h"
 #include "src/eap.h"
 #include "src/eap-private.h"
@@ -41,15 +42,14 @@
 /*
  * EAP-SIM authentication protocol.
  *
- * Open Items:
- *    - Fast Re-authentication. In order to implement this, the higher level
- *      EAP code would need to know/retrieve a fast re-authentication identity
- *      that it would send in the EAP-Start packet. This ID is provided by
- *      the server during the challenge in full authentication. EAP-SIM does
- *      save this ID, but there is no mechanism to provide it to the upper
- *      level EAP system. Once this is done the server will recognize the
- *      ID and send a SIM/Re-authentication request.
+ * Fast re-authentication: the re-authentication identity received during a
+ * full authentication is kept in memory together with the keys, and offered
+ * as the EAP identity on the next connection.  If the server recognizes it a
+ * SIM/Re-authentication request follows which is answered without running
+ * the GSM algorithm on the SIM.  Otherwise the server asks for the permanent
+ * identity and a full authentication is done.
  *
+ * Open Items:
  *    - Version validation. Perhaps a real SIM card will provide a version
  *      of EAP-SIM that it supports? Currently we accept any version the
  *      server provides.
@@ -114,7 +114,7 @@ struct eap_sim_handle {
 	/* Save RANDS from AT_RAND attribute for session ID derivation */
 	uint8_t rands[EAP_SIM_RAND_LEN * 3];
 
-	/* Flag set if AT_ANY_ID_REQ was present */
+	/* Flag set if AT_ANY_ID_REQ or another identity request was present */
 	bool any_id_req : 1;
 
 	/* Flag to indicate protected status indications */
@@ -123,8 +123,13 @@ struct eap_sim_handle {
 	uint8_t *chal_pkt;
 	uint32_t pkt_len;
 
+	/* State for fast re-authentication, if available */
+	struct eap_sim_reauth *reauth;
+	char *next_reauth_id;
+
 	struct iwd_sim_auth *auth;
 	unsigned int auth_watch;
+	int auth_req;
 };
 
 static void eap_sim_clear_secrets(struct eap_sim_handle *sim)
@@ -140,12 +145,18 @@ static void eap_sim_free(struct eap_state *eap)
 {
 	struct eap_sim_handle *sim = eap_get_data(eap);
 
-	if (sim->auth)
+	if (sim->auth) {
+		if (sim->auth_req > 0)
+			sim_auth_cancel_request(sim->auth, sim->auth_req);
+
 		sim_auth_unregistered_watch_remove(sim->auth, sim->auth_watch);
+	}
 
 	eap_sim_clear_secrets(sim);
+	eap_sim_reauth_free(sim->reauth);
 
 	l_free(sim->identity);
+	l_free(sim->next_reauth_id);
 	l_free(sim->vlist);
 	l_free(sim);
 
@@ -252,8 +263,11 @@ static void handle_start(struct eap_state *eap, const uint8_t *pkt,
 		case EAP_SIM_AT_PERMANENT_ID_REQ:
 		case EAP_SIM_AT_FULLAUTH_ID_REQ:
 			/*
-			 * TODO: Server requesting permanent ID/pseudonym
+			 * Pseudonyms are not used so the permanent identity
+			 * satisfies both requests.
 			 */
+			sim->any_id_req = true;
+
 			break;
 
 		default:
@@ -265,6 +279,15 @@ static void handle_start(struct eap_state *eap, const uint8_t *pkt,
 
 	sim->state = EAP_SIM_STATE_START;
 
+	/*
+	 * The server did not accept the re-authentication identity, the
+	 * keys belonging to it are of no further use.
+	 */
+	if (sim->reauth) {
+		l_debug("Fast re-authentication not accepted");
+		eap_sim_reauth_free(l_steal_ptr(sim->reauth));
+	}
+
 	/* header + AT_NONCE + AT_SELECTED_VERSION */
 	resp_len = (8) + (20) + (4);
 	if (sim->any_id_req) {
@@ -312,6 +335,19 @@ static void eap_sim_finish(struct eap_state *eap)
 	eap_method_success(eap);
 	eap_set_key_material(eap, sim->msk, 32, sim->emsk, 32, NULL, 0,
 					session_id, sizeof(session_id));
+
+	if (sim->next_reauth_id) {
+		struct eap_sim_reauth *reauth = l_new(struct eap_sim_reauth, 1);
+
+		reauth->type = EAP_TYPE_SIM;
+		reauth->permanent_id = l_strdup(sim->identity);
+		reauth->reauth_id = l_steal_ptr(sim->next_reauth_id);
+		memcpy(reauth->mk, sim->mk, sizeof(sim->mk));
+		memcpy(reauth->k_encr, sim->k_encr, sizeof(sim->k_encr));
+		memcpy(reauth->k_aut, sim->k_aut, sizeof(sim->k_aut));
+
+		eap_sim_reauth_store(reauth);
+	}
 }
 
 static void gsm_callback(const uint8_t *sres, const uint8_t *kc,
@@ -324,15 +360,26 @@ static void gsm_callback(const uint8_t *sres, const uint8_t *kc,
 	uint8_t *pos = response;
 	uint8_t prng_buf[160];
 	uint8_t *mac_pos;
+	struct eap_sim_encr_attrs encr;
+	const char *identity;
 	bool r;
 
+	sim->auth_req = 0;
+
 	if (!sres || !kc)
 		goto chal_error;
 
 	if (sim->protected)
 		resp_len += 4;
 
-	if (!derive_master_key(sim->identity, kc, sim->nonce, sim->vlist,
+	/*
+	 * RFC 4186 Section 7: Identity is the one from the last AT_IDENTITY
+	 * sent or, if none was sent, from the EAP-Response/Identity
+	 */
+	identity = sim->any_id_req ? sim->identity :
+					eap_get_identity(eap) ?: sim->identity;
+
+	if (!derive_master_key(identity, kc, sim->nonce, sim->vlist,
 			sim->vlist_len, sim->selected_version, sim->mk)) {
 		l_error("error deriving master key");
 		goto chal_fatal;
@@ -358,12 +405,15 @@ static void gsm_callback(const uint8_t *sres, const uint8_t *kc,
 
 	sim->state = EAP_SIM_STATE_CHALLENGE;
 
-	/*
-	 * TODO: When/If fast re-authentication is supported, the AT_ENCR_DATA
-	 *       attribute would be decrypted here. Currently there is no need
-	 *       or reason to do this without support for fast
-	 *       re-authentication.
-	 */
+	/* AT_ENCR_DATA carries the identity for fast re-authentication */
+	if (!eap_sim_decrypt_attributes(sim->k_encr, sim->chal_pkt,
+					sim->pkt_len, &encr)) {
+		l_error("AT_ENCR_DATA was malformed");
+		goto chal_error;
+	}
+
+	l_free(sim->next_reauth_id);
+	sim->next_reauth_id = encr.next_reauth_id;
 
 	/* build response packet */
 	pos += eap_sim_build_header(eap, EAP_TYPE_SIM, EAP_SIM_ST_CHALLENGE,
@@ -480,7 +530,9 @@ static void handle_challenge(struct eap_state *eap, const uint8_t *pkt,
 	sim->chal_pkt = l_memdup(pkt, len);
 	sim->pkt_len = len;
 
-	if (sim_auth_run_gsm(sim->auth, sim->rands, 3, gsm_callback, eap) < 0) {
+	sim->auth_req = sim_auth_run_gsm(sim->auth, sim->rands, 3,
+						gsm_callback, eap);
+	if (sim->auth_req < 0) {
 		l_free(sim->chal_pkt);
 		sim->chal_pkt = NULL;
 		goto chal_error;
@@ -492,6 +544,48 @@ chal_error:
 	eap_sim_client_error(eap, EAP_TYPE_SIM, code);
 }
 
+/*
+ * Handles EAP-SIM Re-authentication subtype
+ */
+static void handle_reauth(struct eap_state *eap, const uint8_t *pkt,
+		size_t len)
+{
+	struct eap_sim_handle *sim = eap_get_data(eap);
+	uint8_t session_id[1 + EAP_SIM_NONCE_S_LEN + EAP_SIM_MAC_LEN];
+	int r;
+
+	if (sim->state != EAP_SIM_STATE_UNCONNECTED || !sim->reauth) {
+		l_error("invalid packet for EAP-SIM state");
+		goto reauth_error;
+	}
+
+	r = eap_sim_reauth_process(eap, sim->reauth, pkt, len, sim->msk,
+					sim->emsk, session_id);
+	if (r == -ERANGE) {
+		/* The server is expected to start a full authentication */
+		eap_sim_reauth_free(l_steal_ptr(sim->reauth));
+		return;
+	}
+
+	if (r < 0)
+		goto reauth_error;
+
+	eap_method_success(eap);
+	eap_set_key_material(eap, sim->msk, 32, sim->emsk, 32, NULL, 0,
+					session_id, sizeof(session_id));
+
+	sim->state = EAP_SIM_STATE_SUCCESS;
+
+	/* Without a new identity the next connection uses full auth */
+	if (sim->reauth->reauth_id)
+		eap_sim_reauth_store(l_steal_ptr(sim->reauth));
+
+	return;
+
+reauth_error:
+	eap_sim_client_error(eap, EAP_TYPE_SIM, EAP_SIM_ERROR_PROCESS);
+}
+
 /*
  * Handles EAP-SIM Notification subtype
  */
@@ -606,6 +700,9 @@ static void eap_sim_handle_request(struct eap_state *eap,
 	case EAP_SIM_ST_NOTIFICATION:
 		handle_notification(eap, pkt, len);
 		break;
+	case EAP_SIM_ST_REAUTHENTICATION:
+		handle_reauth(eap, pkt, len);
+		break;
 	default:
 		l_error("unknown EAP-SIM subtype: %u", pkt[0]);
 		goto req_error;
@@ -621,6 +718,9 @@ static const char *eap_sim_get_identity(struct eap_state *eap)
 {
 	struct eap_sim_handle *sim = eap_get_data(eap);
 
+	if (sim->reauth)
+		return sim->reauth->reauth_id;
+
 	return sim->identity;
 }
 
@@ -629,6 +729,9 @@ static void auth_destroyed(void *data)
 	struct eap_state *eap = data;
 	struct eap_sim_handle *sim = eap_get_data(eap);
 
+	/* Dropped along with the provider */
+	sim->auth_req = 0;
+
 	/*
 	 * If AKA was already successful we can return. Also if the state
 	 * has been set to ERROR, then eap_method_error has already been called,
@@ -675,6 +778,9 @@ static bool eap_sim_reset_state(struct eap_state *eap)
 	sim->vlist = NULL;
 	l_free(sim->chal_pkt);
 	sim->chal_pkt = NULL;
+	l_free(sim->next_reauth_id);
+	sim->next_reauth_id = NULL;
+	sim->any_id_req = false;
 
 	memset(sim->nonce, 0, sizeof(sim->nonce));
 	eap_sim_clear_secrets(sim);
@@ -707,6 +813,7 @@ static bool eap_sim_load_settings(struct eap_state *eap,
 	 */
 	sim->identity = l_strdup_printf("%c%s", '1',
 			iwd_sim_auth_get_nai(sim->auth));
+	sim->reauth = eap_sim_reauth_take(EAP_TYPE_SIM, sim->identity);
 
 	return true;
 }
@@ -733,6 +840,7 @@ static void eap_sim_exit(void)
 {
 	l_debug("");
 	eap_unregister_method(&eap_sim);
+	eap_sim_reauth_flush();
 }
 
 EAP_METHOD_BUILTIN(eap_sim, eap_sim_init, eap_sim_exit)
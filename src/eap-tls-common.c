@@ -26,20 +26,28 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <string.h>
 #include <ell/ell.h>
 
+#include "ell/useful.h"
 #include "src/missing.h"
 #include "src/eap.h"
 #include "src/eap-private.h"
 #include "src/eap-tls-common.h"
 
+/*
+ * The headroom is space reserved in front of the data, the outgoing PDU
+ * buffer uses it to build the EAP headers in place.
+ */
 struct databuf {
 	uint8_t *data;
 	size_t len;
 	size_t capacity;
+	size_t headroom;
 };
 
-static struct databuf *databuf_new(size_t capacity)
+static struct databuf *databuf_new_with_headroom(size_t capacity,
+							size_t headroom)
 {
 	struct databuf *databuf;
 
@@ -47,12 +55,18 @@ static struct databuf *databuf_new(size_t capacity)
 		return NULL;
 
 	databuf = l_new(struct databuf, 1);
-	databuf->data = l_malloc(capacity);
+	databuf->data = (uint8_t *) l_malloc(headroom + capacity) + headroom;
 	databuf->capacity = capacity;
+	databuf->headroom = headroom;
 
 	return databuf;
 }
 
+static struct databuf *databuf_new(size_t capacity)
+{
+	return databuf_new_with_headroom(capacity, 0);
+}
+
 static void databuf_append(struct databuf *databuf, const uint8_t *data,
 								size_t data_len)
 {
@@ -64,8 +78,11 @@ static void databuf_append(struct databuf *databuf, const uint8_t *data,
 	new_len = databuf->len + data_len;
 
 	if (new_len > databuf->capacity) {
+		uint8_t *head = databuf->data - databuf->headroom;
+
 		databuf->capacity = new_len * 2;
-		databuf->data = l_realloc(databuf->data, databuf->capacity);
+		head = l_realloc(head, databuf->headroom + databuf->capacity);
+		databuf->data = head + databuf->headroom;
 	}
 
 	memcpy(databuf->data + databuf->len, data, data_len);
@@ -78,12 +95,31 @@ static void databuf_free(struct databuf *databuf)
 	if (!databuf)
 		return;
 
-	l_free(databuf->data);
+	l_free(databuf->data - databuf->headroom);
 	l_free(databuf);
 }
 
 #define EAP_TLS_PDU_MAX_LEN 65536
 
+/*
+ * Room for the largest header sent in front of the TLS data: the EAP
+ * header with the Expanded Type fields and the TLS Message Length.
+ */
+#define EAP_TLS_TX_HEADROOM (EAP_TLS_HEADER_LEN + 7 + 4)
+#define EAP_TLS_TX_MIN_CAPACITY 4096
+
+/*
+ * RFC 3748 Section 3.1: the minimum EAP MTU.  The upper bound follows
+ * from the maximum RADIUS packet length (RFC 2865 Section 3) since the
+ * authenticator has to relay each of our packets to the server.
+ */
+#define EAP_TLS_FRAGMENT_SIZE_MIN 1020
+#define EAP_TLS_FRAGMENT_SIZE_MAX 4096
+
+#define EAP_TLS_SESSION_LIFETIME (24 * 3600 * L_USEC_PER_SEC)
+
+#define CA_CERT_CACHE_MAX 16
+
 #define EAP_TLS_HEADER_LEN  6
 
 #define EAP_TLS_HEADER_OCTET_FLAGS 5
@@ -113,6 +149,9 @@ struct eap_tls_state {
 
 	bool expecting_frag_ack:1;
 	bool tunnel_ready:1;
+	bool mtu_probe_failed:1;
+
+	size_t base_mtu;
 
 	struct l_queue *ca_cert;
 	struct l_certchain *client_cert;
@@ -123,6 +162,86 @@ struct eap_tls_state {
 	void *variant_data;
 };
 
+/*
+ * The TLS sessions established with each network, identified by the EAP
+ * peer ID, are cached so that reconnections can use an abbreviated
+ * handshake.  The cache is kept in memory and, if load and sync ops are
+ * set, loaded on first use and written back whenever l_tls updates it.
+ */
+static struct l_settings *eap_tls_session_cache;
+static eap_tls_session_cache_load_func_t eap_tls_session_cache_load;
+static eap_tls_session_cache_sync_func_t eap_tls_session_cache_sync;
+static struct l_hashmap *ca_cert_cache;
+
+static void eap_tls_session_cache_update(void *user_data)
+{
+	if (eap_tls_session_cache_sync)
+		eap_tls_session_cache_sync(eap_tls_session_cache);
+}
+
+void eap_tls_set_session_cache_ops(eap_tls_session_cache_load_func_t load,
+					eap_tls_session_cache_sync_func_t sync)
+{
+	l_settings_free(eap_tls_session_cache);
+	eap_tls_session_cache = NULL;
+
+	eap_tls_session_cache_load = load;
+	eap_tls_session_cache_sync = sync;
+}
+
+struct cert_cache_entry {
+	uint64_t mtime;
+	struct l_queue *certs;
+};
+
+static void cert_cache_entry_free(void *data)
+{
+	struct cert_cache_entry *entry = data;
+
+	l_queue_destroy(entry->certs, (l_queue_destroy_func_t) l_cert_free);
+	l_free(entry);
+}
+
+void __eap_tls_common_exit(void)
+{
+	l_settings_free(eap_tls_session_cache);
+	eap_tls_session_cache = NULL;
+
+	l_hashmap_destroy(ca_cert_cache, cert_cache_entry_free);
+	ca_cert_cache = NULL;
+}
+
+/*
+ * Drops the cached sessions of a network, e.g. when its profile changes,
+ * so that the next connection does a full handshake with the current
+ * certificate settings.
+ */
+void eap_tls_forget_peer(const char *peer_id)
+{
+	char **groups;
+	char **i;
+	size_t len = strlen(peer_id);
+	bool changed = false;
+
+	if (!eap_tls_session_cache)
+		return;
+
+	groups = l_settings_get_groups(eap_tls_session_cache);
+
+	for (i = groups; *i; i++) {
+		if (strncmp(*i, peer_id, len) || (*i)[len] != '-')
+			continue;
+
+		l_settings_remove_group(eap_tls_session_cache, *i);
+		changed = true;
+	}
+
+	l_strv_free(groups);
+
+	if (changed)
+		eap_tls_session_cache_update(NULL);
+}
+
 static void __eap_tls_common_state_reset(struct eap_tls_state *eap_tls)
 {
 	eap_tls->version_negotiated = EAP_TLS_VERSION_NOT_NEGOTIATED;
@@ -209,8 +328,17 @@ static void eap_tls_tunnel_data_send(const uint8_t *data, size_t data_len,
 	struct eap_state *eap = user_data;
 	struct eap_tls_state *eap_tls = eap_get_data(eap);
 
-	if (!eap_tls->tx_pdu_buf)
-		eap_tls->tx_pdu_buf = databuf_new(data_len);
+	/*
+	 * The buffer is kept for the whole authentication, sized so that a
+	 * typical handshake flight fits without growing it.
+	 */
+	if (!eap_tls->tx_pdu_buf) {
+		size_t capacity = L_MAX(data_len,
+					(size_t) EAP_TLS_TX_MIN_CAPACITY);
+
+		eap_tls->tx_pdu_buf = databuf_new_with_headroom(capacity,
+							EAP_TLS_TX_HEADROOM);
+	}
 
 	databuf_append(eap_tls->tx_pdu_buf, data, data_len);
 }
@@ -299,39 +427,47 @@ static bool eap_tls_validate_version(struct eap_state *eap,
 	return true;
 }
 
+/*
+ * The fragments are sent straight from the outgoing PDU buffer, the
+ * header is written in front of the fragment data, into the headroom for
+ * the first one and over the tail of the previous, already acknowledged,
+ * fragment for the following ones.
+ */
 static void eap_tls_send_fragment(struct eap_state *eap)
 {
 	struct eap_tls_state *eap_tls = eap_get_data(eap);
 	size_t mtu = eap_get_mtu(eap);
-	uint8_t buf[mtu];
+	uint8_t *data = eap_tls->tx_pdu_buf->data + eap_tls->tx_frag_offset;
 	size_t len = eap_tls->tx_pdu_buf->len - eap_tls->tx_frag_offset;
 	size_t header_len = EAP_TLS_HEADER_LEN;
 	uint8_t position = 0;
+	uint8_t flags = eap_tls->version_negotiated;
+	uint8_t *buf;
 
 	if (eap_get_method_type(eap) == EAP_TYPE_EXPANDED) {
 		header_len += 7;
 		position += 7;
 	}
 
-	buf[EAP_TLS_HEADER_OCTET_FLAGS + position] =
-						eap_tls->version_negotiated;
-
 	if (len > mtu - EAP_TLS_HEADER_LEN - position) {
 		len = mtu - EAP_TLS_HEADER_LEN - position;
-		buf[EAP_TLS_HEADER_OCTET_FLAGS + position] |= EAP_TLS_FLAG_M;
+		flags |= EAP_TLS_FLAG_M;
 		eap_tls->expecting_frag_ack = true;
 	}
 
 	if (!eap_tls->tx_frag_offset) {
-		buf[EAP_TLS_HEADER_OCTET_FLAGS + position] |= EAP_TLS_FLAG_L;
-		l_put_be32(eap_tls->tx_pdu_buf->len,
-				&buf[EAP_TLS_HEADER_OCTET_FRAG_LEN + position]);
+		flags |= EAP_TLS_FLAG_L;
 		len -= 4;
 		header_len += 4;
 	}
 
-	memcpy(buf + header_len,
-		eap_tls->tx_pdu_buf->data + eap_tls->tx_frag_offset, len);
+	buf = data - header_len;
+	buf[EAP_TLS_HEADER_OCTET_FLAGS + position] = flags;
+
+	if (flags & EAP_TLS_FLAG_L)
+		l_put_be32(eap_tls->tx_pdu_buf->len,
+				&buf[EAP_TLS_HEADER_OCTET_FRAG_LEN + position]);
+
 	eap_method_respond(eap, buf, header_len + len);
 
 	eap_tls->tx_frag_last_len = len;
@@ -355,46 +491,41 @@ static bool needs_workaround(struct eap_state *eap)
 			!eap_tls->tunnel_ready;
 }
 
-static void eap_tls_send_response(struct eap_state *eap,
-					const uint8_t *pdu, size_t pdu_len)
+static void eap_tls_send_response(struct eap_state *eap)
 {
 	struct eap_tls_state *eap_tls = eap_get_data(eap);
+	size_t pdu_len = eap_tls->tx_pdu_buf->len;
 	size_t msg_len = EAP_TLS_HEADER_LEN + pdu_len;
 	bool set_tls_msg_len = needs_workaround(eap);
 
+	eap_tls->tx_frag_offset = 0;
 	msg_len += set_tls_msg_len ? 4 : 0;
 
 	if (msg_len <= eap_get_mtu(eap)) {
 		uint8_t *buf;
 		uint8_t extra = 0;
+		uint8_t flags = eap_tls->version_negotiated;
 
 		if (eap_get_method_type(eap) == EAP_TYPE_EXPANDED) {
 			extra += 7;
 			msg_len += 7;
 		}
 
-		buf = l_malloc(msg_len);
-
-		buf[EAP_TLS_HEADER_OCTET_FLAGS + extra] =
-						eap_tls->version_negotiated;
+		/* Build the header in the headroom in front of the PDU */
+		buf = eap_tls->tx_pdu_buf->data + pdu_len - msg_len;
 
 		if (set_tls_msg_len) {
-			buf[extra + EAP_TLS_HEADER_OCTET_FLAGS] |=
-								EAP_TLS_FLAG_L;
+			flags |= EAP_TLS_FLAG_L;
 			l_put_be32(pdu_len,
 				   &buf[extra + EAP_TLS_HEADER_OCTET_FRAG_LEN]);
-
-			extra += 4;
 		}
 
-		memcpy(buf + EAP_TLS_HEADER_LEN + extra, pdu, pdu_len);
+		buf[EAP_TLS_HEADER_OCTET_FLAGS + extra] = flags;
 
 		eap_method_respond(eap, buf, msg_len);
-		l_free(buf);
 		return;
 	}
 
-	eap_tls->tx_frag_offset = 0;
 	eap_tls_send_fragment(eap);
 }
 
@@ -626,6 +757,19 @@ static bool eap_tls_tunnel_init(struct eap_state *eap)
 	if (eap_tls->domain_mask)
 		l_tls_set_domain_mask(eap_tls->tunnel, eap_tls->domain_mask);
 
+	if (eap_get_peer_id(eap)) {
+		if (!eap_tls_session_cache && eap_tls_session_cache_load)
+			eap_tls_session_cache = eap_tls_session_cache_load();
+
+		if (!eap_tls_session_cache)
+			eap_tls_session_cache = l_settings_new();
+
+		l_tls_set_session_cache(eap_tls->tunnel, eap_tls_session_cache,
+					eap_get_peer_id(eap),
+					EAP_TLS_SESSION_LIFETIME, 0,
+					eap_tls_session_cache_update, NULL);
+	}
+
 	if (!l_tls_start(eap_tls->tunnel)) {
 		l_error("%s: Failed to start the TLS client",
 						eap_get_method_name(eap));
@@ -654,6 +798,31 @@ static void eap_tls_handle_phase2_payload(struct eap_state *eap,
 		l_tls_close(eap_tls->tunnel);
 }
 
+/*
+ * There is no MTU negotiation in EAP but a request from the authenticator
+ * shows that frames of its size make it through the path, so start
+ * sending fragments of up to the same size.  If a response sent after
+ * growing the fragment size goes unanswered, the retransmit handler goes
+ * back to the configured size for the rest of the authentication.
+ */
+static void eap_tls_probe_mtu(struct eap_state *eap, size_t len)
+{
+	struct eap_tls_state *eap_tls = eap_get_data(eap);
+	size_t pkt_len = len + EAP_TLS_HEADER_LEN - 1;
+
+	if (eap_get_method_type(eap) == EAP_TYPE_EXPANDED)
+		pkt_len += 7;
+
+	if (eap_tls->mtu_probe_failed || pkt_len <= eap_get_mtu(eap))
+		return;
+
+	pkt_len = L_MIN(pkt_len, (size_t) EAP_TLS_FRAGMENT_SIZE_MAX);
+
+	l_debug("%s: fragment size %zu -> %zu", eap_get_method_name(eap),
+			eap_get_mtu(eap), pkt_len);
+	eap_set_mtu(eap, pkt_len);
+}
+
 void eap_tls_common_handle_request(struct eap_state *eap,
 					const uint8_t *pkt, size_t len)
 {
@@ -677,6 +846,8 @@ void eap_tls_common_handle_request(struct eap_state *eap,
 		goto error;
 	}
 
+	eap_tls_probe_mtu(eap, len);
+
 	pkt += 1;
 	len -= 1;
 
@@ -728,8 +899,7 @@ proceed:
 		 * tx_pdu_buf is used for the re-transmission and needs to be
 		 * cleared on a new request.
 		*/
-		databuf_free(eap_tls->tx_pdu_buf);
-		eap_tls->tx_pdu_buf = NULL;
+		eap_tls->tx_pdu_buf->len = 0;
 	}
 
 	if (flags_version & EAP_TLS_FLAG_S) {
@@ -758,15 +928,14 @@ proceed:
 		eap_tls->rx_pdu_buf = NULL;
 	}
 
-	if (!eap_tls->tx_pdu_buf) {
+	if (!eap_tls->tx_pdu_buf || !eap_tls->tx_pdu_buf->len) {
 		if (eap_tls->phase2_failed)
 			goto error;
 
 		return;
 	}
 
-	eap_tls_send_response(eap, eap_tls->tx_pdu_buf->data,
-						eap_tls->tx_pdu_buf->len);
+	eap_tls_send_response(eap);
 
 	if (eap_tls->phase2_failed)
 		goto error;
@@ -810,11 +979,17 @@ void eap_tls_common_handle_retransmit(struct eap_state *eap,
 						!eap_tls->tx_pdu_buf->len)
 		goto error;
 
+	if (eap_get_mtu(eap) > eap_tls->base_mtu) {
+		l_debug("%s: no reply to a larger fragment, reverting to %zu",
+				eap_get_method_name(eap), eap_tls->base_mtu);
+		eap_set_mtu(eap, eap_tls->base_mtu);
+		eap_tls->mtu_probe_failed = true;
+	}
+
 	if (EAP_TLS_HEADER_LEN + eap_tls->tx_pdu_buf->len > eap_get_mtu(eap))
 		eap_tls_send_fragment(eap);
 	else
-		eap_tls_send_response(eap, eap_tls->tx_pdu_buf->data,
-						eap_tls->tx_pdu_buf->len);
+		eap_tls_send_response(eap);
 
 	return;
 
@@ -852,19 +1027,90 @@ static bool is_embedded(const char *str)
 	return false;
 }
 
+/*
+ * Parsed CA certificate lists are cached, keyed by the file path or by
+ * the embedded PEM data itself, so that connecting to a network doesn't
+ * read and decode the same files again each time.  l_tls takes ownership
+ * of the list it is given so each caller gets a copy, built from the DER
+ * data of the cached certificates.  A file entry is only used as long as
+ * the file's mtime hasn't changed.
+ */
+static struct l_queue *cert_list_copy(struct l_queue *certs)
+{
+	const struct l_queue_entry *entry;
+	struct l_queue *copy = l_queue_new();
+
+	for (entry = l_queue_get_entries(certs); entry; entry = entry->next) {
+		const uint8_t *der;
+		size_t der_len;
+		struct l_cert *cert;
+
+		der = l_cert_get_der_data(entry->data, &der_len);
+		cert = l_cert_new_from_der(der, der_len);
+		if (!cert) {
+			l_queue_destroy(copy,
+					(l_queue_destroy_func_t) l_cert_free);
+			return NULL;
+		}
+
+		l_queue_push_tail(copy, cert);
+	}
+
+	return copy;
+}
+
 static struct l_queue *eap_tls_load_ca_cert(struct l_settings *settings,
 						const char *value)
 {
-	const char *pem;
+	const char *pem = NULL;
+	const char *key = value;
+	uint64_t mtime = 0;
+	struct cert_cache_entry *entry;
+	struct l_queue *certs;
+
+	if (is_embedded(value)) {
+		pem = load_embedded_pem(settings, value);
+		if (!pem)
+			return NULL;
+
+		key = pem;
+	} else {
+		mtime = l_path_get_mtime(value);
+	}
 
-	if (!is_embedded(value))
-		return l_pem_load_certificate_list(value);
+	if (!ca_cert_cache)
+		ca_cert_cache = l_hashmap_string_new();
 
-	pem = load_embedded_pem(settings, value);
-	if (!pem)
+	entry = l_hashmap_lookup(ca_cert_cache, key);
+	if (entry && entry->mtime == mtime)
+		return cert_list_copy(entry->certs);
+
+	if (pem)
+		certs = l_pem_load_certificate_list_from_data(pem, strlen(pem));
+	else
+		certs = l_pem_load_certificate_list(value);
+
+	if (!certs)
 		return NULL;
 
-	return l_pem_load_certificate_list_from_data(pem, strlen(pem));
+	if (!entry && l_hashmap_size(ca_cert_cache) >= CA_CERT_CACHE_MAX)
+		l_hashmap_destroy(l_steal_ptr(ca_cert_cache),
+					cert_cache_entry_free);
+
+	if (!ca_cert_cache)
+		ca_cert_cache = l_hashmap_string_new();
+
+	entry = l_new(struct cert_cache_entry, 1);
+	entry->mtime = mtime;
+	entry->certs = cert_list_copy(certs);
+
+	if (!entry->certs)
+		l_free(entry);
+	else
+		l_hashmap_replace(ca_cert_cache, key, entry,
+					cert_cache_entry_free);
+
+	return certs;
 }
 
 struct l_certchain *eap_tls_load_client_cert(struct l_settings *settings,
@@ -948,6 +1194,21 @@ int eap_tls_common_settings_check(struct l_settings *settings,
 		have_cacerts = true;
 	}
 
+	snprintf(setting_key, sizeof(setting_key), "%sFragmentSize", prefix);
+	if (l_settings_has_key(settings, "Security", setting_key)) {
+		unsigned int fragment_size;
+
+		if (!l_settings_get_uint(settings, "Security", setting_key,
+						&fragment_size) ||
+				fragment_size < EAP_TLS_FRAGMENT_SIZE_MIN ||
+				fragment_size > EAP_TLS_FRAGMENT_SIZE_MAX) {
+			l_error("%s must be between %u and %u", setting_key,
+					EAP_TLS_FRAGMENT_SIZE_MIN,
+					EAP_TLS_FRAGMENT_SIZE_MAX);
+			return -EINVAL;
+		}
+	}
+
 	/*
 	 * Require CACert if ServerDomainMask is present.  If the server
 	 * certificate is not being checked against any trusted certificates
@@ -974,6 +1235,7 @@ bool eap_tls_common_settings_load(struct eap_state *eap,
 	struct eap_tls_state *eap_tls;
 	char setting_key[72];
 	char *domain_mask_str;
+	unsigned int fragment_size;
 
 	L_AUTO_FREE_VAR(char *, value) = NULL;
 
@@ -1003,6 +1265,15 @@ bool eap_tls_common_settings_load(struct eap_state *eap,
 		l_free(domain_mask_str);
 	}
 
+	snprintf(setting_key, sizeof(setting_key), "%sFragmentSize", prefix);
+	if (l_settings_get_uint(settings, "Security", setting_key,
+					&fragment_size) &&
+			fragment_size >= EAP_TLS_FRAGMENT_SIZE_MIN &&
+			fragment_size <= EAP_TLS_FRAGMENT_SIZE_MAX)
+		eap_set_mtu(eap, fragment_size);
+
+	eap_tls->base_mtu = eap_get_mtu(eap);
+
 	eap_set_data(eap, eap_tls);
 
 	return true;
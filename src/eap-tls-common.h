@@ -37,6 +37,15 @@ struct eap_tls_variant_ops {
 	void (*destroy)(void *variant_data);
 };
 
+typedef struct l_settings *(*eap_tls_session_cache_load_func_t)(void);
+typedef void (*eap_tls_session_cache_sync_func_t)(
+					const struct l_settings *cache);
+
+void eap_tls_set_session_cache_ops(eap_tls_session_cache_load_func_t load,
+					eap_tls_session_cache_sync_func_t sync);
+void eap_tls_forget_peer(const char *peer_id);
+void __eap_tls_common_exit(void);
+
 bool eap_tls_common_state_reset(struct eap_state *eap);
 void eap_tls_common_state_free(struct eap_state *eap);
 
@@ -35,6 +35,7 @@
 #include "src/util.h"
 #include "src/eap.h"
 #include "src/eap-private.h"
+#include "src/eap-tls-common.h"
 #include "src/iwd.h"
 
 static uint32_t default_mtu;
@@ -58,6 +59,7 @@ struct eap_state {
 	struct eap_method *method;
 	char *identity;
 	char *identity_setting;
+	char *peer_id;
 	bool authenticator;
 
 	int last_id;
@@ -155,6 +157,7 @@ void eap_free(struct eap_state *eap)
 	eap_free_common(eap);
 	l_timeout_remove(eap->complete_timeout);
 
+	l_free(eap->peer_id);
 	l_free(eap);
 }
 
@@ -174,6 +177,22 @@ const char *eap_get_identity(struct eap_state *eap)
 	return eap->identity;
 }
 
+/*
+ * Identifies the network being authenticated to for the methods that keep
+ * per-network state across authentications, such as the TLS sessions for
+ * resumption.
+ */
+void eap_set_peer_id(struct eap_state *eap, const char *peer_id)
+{
+	l_free(eap->peer_id);
+	eap->peer_id = l_strdup(peer_id);
+}
+
+const char *eap_get_peer_id(struct eap_state *eap)
+{
+	return eap->peer_id;
+}
+
 static void eap_send_packet(struct eap_state *eap, enum eap_code code,
 				uint8_t id, uint8_t *buf, size_t len)
 {
@@ -1009,6 +1028,7 @@ int eap_init(void)
 void eap_exit(void)
 {
 	__eap_method_disable(__start___eap, __stop___eap);
+	__eap_tls_common_exit();
 	l_queue_destroy(eap_methods, NULL);
 }
 
@@ -44,11 +44,16 @@
 #include "src/erp.h"
 #include "src/iwd.h"
 #include "src/band.h"
+#include "src/profile.h"
+
+#define MEMACCT_MODULE MEMACCT_EAPOL
+#include "src/memacct.h"
 
 static struct l_queue *state_machines;
 static struct l_queue *preauths;
 static struct watchlist frame_watches;
 static uint32_t eapol_4way_handshake_time = 2;
+static uint32_t eapol_ptk_rekey_interval;
 
 static eapol_rekey_offload_func_t rekey_offload = NULL;
 
@@ -89,125 +94,193 @@ static bool eapol_aes_siv_encrypt(const uint8_t *kek, size_t kek_len,
  *
  * The input struct eapol_key *frame should have a zero-d MIC field
  */
-bool eapol_calculate_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
-				const struct eapol_key *frame, uint8_t *mic,
-				size_t mic_len)
+static struct l_checksum *eapol_mic_checksum_new(enum ie_rsn_akm_suite akm,
+							const uint8_t *kck,
+							uint8_t version,
+							size_t mic_len)
 {
-	size_t frame_len = EAPOL_FRAME_LEN(mic_len) +
-					EAPOL_KEY_DATA_LEN(frame, mic_len);
-
-	switch (frame->key_descriptor_version) {
+	switch (version) {
 	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_MD5_ARC4:
-		return hmac_md5(kck, 16, frame, frame_len, mic, mic_len);
+		return l_checksum_new_hmac(L_CHECKSUM_MD5, kck, 16);
 	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_SHA1_AES:
-		return hmac_sha1(kck, 16, frame, frame_len, mic, mic_len);
+		return l_checksum_new_hmac(L_CHECKSUM_SHA1, kck, 16);
 	case EAPOL_KEY_DESCRIPTOR_VERSION_AES_128_CMAC_AES:
-		return cmac_aes(kck, 16, frame, frame_len, mic, mic_len);
+		return l_checksum_new_cmac_aes(kck, 16);
 	case EAPOL_KEY_DESCRIPTOR_VERSION_AKM_DEFINED:
 		switch (akm) {
 		case IE_RSN_AKM_SUITE_SAE_SHA256:
 		case IE_RSN_AKM_SUITE_FT_OVER_SAE_SHA256:
 		case IE_RSN_AKM_SUITE_OSEN:
-			return cmac_aes(kck, 16, frame, frame_len,
-						mic, mic_len);
+			return l_checksum_new_cmac_aes(kck, 16);
 		case IE_RSN_AKM_SUITE_OWE:
 			switch (mic_len) {
 			case 16:
-				return hmac_sha256(kck, mic_len, frame,
-						frame_len, mic,
-						mic_len);
+				return l_checksum_new_hmac(L_CHECKSUM_SHA256,
+								kck, 16);
 			case 24:
-				return hmac_sha384(kck, 24, frame, frame_len,
-						mic, mic_len);
+				return l_checksum_new_hmac(L_CHECKSUM_SHA384,
+								kck, 24);
+			case 32:
+				return l_checksum_new_hmac(L_CHECKSUM_SHA512,
+								kck, 32);
+			default:
+				l_error("Invalid MIC length of %zu for OWE",
+						mic_len);
+				return NULL;
 			}
-
-			/* fall through */
 		default:
-			return false;
+			return NULL;
 		}
 	default:
-		return false;
+		return NULL;
 	}
 }
 
-bool eapol_verify_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
-			const struct eapol_key *frame, size_t mic_len)
+/* Digest over the frame with the MIC field taken as zero */
+static bool eapol_mic_digest(struct l_checksum *checksum,
+				const struct eapol_key *frame,
+				uint8_t *mic, size_t mic_len)
 {
-	uint8_t mic[MIC_MAXLEN];
 	struct iovec iov[3];
-	struct l_checksum *checksum = NULL;
 
 	iov[0].iov_base = (void *) frame;
 	iov[0].iov_len = offsetof(struct eapol_key, key_data);
 
-	memset(mic, 0, sizeof(mic));
+	memset(mic, 0, mic_len);
 	iov[1].iov_base = mic;
 	iov[1].iov_len = mic_len;
 
 	iov[2].iov_base = (void *) EAPOL_KEY_DATA(frame, mic_len) - 2;
 	iov[2].iov_len = EAPOL_KEY_DATA_LEN(frame, mic_len) + 2;
 
-	switch (frame->key_descriptor_version) {
-	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_MD5_ARC4:
-		checksum = l_checksum_new_hmac(L_CHECKSUM_MD5, kck, 16);
-		break;
-	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_SHA1_AES:
-		checksum = l_checksum_new_hmac(L_CHECKSUM_SHA1, kck, 16);
-		break;
-	case EAPOL_KEY_DESCRIPTOR_VERSION_AES_128_CMAC_AES:
-		checksum = l_checksum_new_cmac_aes(kck, 16);
-		break;
-	case EAPOL_KEY_DESCRIPTOR_VERSION_AKM_DEFINED:
-		switch (akm) {
-		case IE_RSN_AKM_SUITE_SAE_SHA256:
-		case IE_RSN_AKM_SUITE_FT_OVER_SAE_SHA256:
-		case IE_RSN_AKM_SUITE_OSEN:
-			checksum = l_checksum_new_cmac_aes(kck, 16);
-			break;
-		case IE_RSN_AKM_SUITE_OWE:
-			switch (mic_len) {
-			case 16:
-				checksum = l_checksum_new_hmac(
-							L_CHECKSUM_SHA256,
-							kck, 16);
-				break;
-			case 24:
-				checksum = l_checksum_new_hmac(
-							L_CHECKSUM_SHA384,
-							kck, 24);
-				break;
-			case 32:
-				checksum = l_checksum_new_hmac(
-							L_CHECKSUM_SHA512,
-							kck, 32);
-				break;
-			default:
-				l_error("Invalid MIC length of %zu for OWE",
-						mic_len);
-				return false;
-			}
+	if (!l_checksum_updatev(checksum, iov, 3))
+		return false;
 
-			break;
-		default:
-			return false;
-		}
+	return l_checksum_get_digest(checksum, mic, mic_len) == (ssize_t) mic_len;
+}
 
-		break;
-	default:
+bool eapol_calculate_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
+				const struct eapol_key *frame, uint8_t *mic,
+				size_t mic_len)
+{
+	struct l_checksum *checksum;
+	uint8_t digest[MIC_MAXLEN];
+	bool r;
+
+	checksum = eapol_mic_checksum_new(akm, kck,
+					frame->key_descriptor_version, mic_len);
+	if (!checksum)
 		return false;
-	}
 
-	if (checksum == NULL)
+	r = eapol_mic_digest(checksum, frame, digest, mic_len);
+	l_checksum_free(checksum);
+
+	if (r)
+		memcpy(mic, digest, mic_len);
+
+	return r;
+}
+
+bool eapol_verify_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
+			const struct eapol_key *frame, size_t mic_len)
+{
+	struct l_checksum *checksum;
+	uint8_t mic[MIC_MAXLEN];
+	bool r;
+
+	checksum = eapol_mic_checksum_new(akm, kck,
+					frame->key_descriptor_version, mic_len);
+	if (!checksum)
 		return false;
 
-	l_checksum_updatev(checksum, iov, 3);
-	l_checksum_get_digest(checksum, mic, mic_len);
+	r = eapol_mic_digest(checksum, frame, mic, mic_len);
 	l_checksum_free(checksum);
 
-	if (!memcmp(frame->key_data, mic, mic_len))
-		return true;
+	return r && !memcmp(frame->key_data, mic, mic_len);
+}
 
-	return false;
+/*
+ * Same as above but keeps the checksum around in the handshake_state so
+ * that all key frames of a session protected by the same KCK reuse one
+ * kernel context instead of creating a new one per frame.
+ */
+static struct l_checksum *eapol_mic_checksum_get(struct handshake_state *hs,
+						const uint8_t *kck,
+						uint8_t version,
+						size_t mic_len)
+{
+	size_t kck_len = handshake_state_get_kck_len(hs);
+
+	if (!kck_len || kck_len > sizeof(hs->mic_kck))
+		return eapol_mic_checksum_new(hs->akm_suite, kck, version,
+						mic_len);
+
+	if (hs->mic_checksum && hs->mic_version == version &&
+			hs->mic_len == mic_len &&
+			!memcmp(hs->mic_kck, kck, kck_len)) {
+		l_checksum_reset(hs->mic_checksum);
+		return hs->mic_checksum;
+	}
+
+	l_checksum_free(hs->mic_checksum);
+	hs->mic_checksum = eapol_mic_checksum_new(hs->akm_suite, kck, version,
+							mic_len);
+	if (!hs->mic_checksum)
+		return NULL;
+
+	memcpy(hs->mic_kck, kck, kck_len);
+	hs->mic_version = version;
+	hs->mic_len = mic_len;
+
+	return hs->mic_checksum;
+}
+
+static void eapol_mic_checksum_put(struct handshake_state *hs,
+					struct l_checksum *checksum)
+{
+	if (checksum != hs->mic_checksum)
+		l_checksum_free(checksum);
+}
+
+static bool eapol_sm_calculate_mic(struct handshake_state *hs,
+					const uint8_t *kck,
+					const struct eapol_key *frame,
+					uint8_t *mic, size_t mic_len)
+{
+	struct l_checksum *checksum;
+	uint8_t digest[MIC_MAXLEN];
+	bool r;
+
+	checksum = eapol_mic_checksum_get(hs, kck,
+					frame->key_descriptor_version, mic_len);
+	if (!checksum)
+		return false;
+
+	r = eapol_mic_digest(checksum, frame, digest, mic_len);
+	eapol_mic_checksum_put(hs, checksum);
+
+	if (r)
+		memcpy(mic, digest, mic_len);
+
+	return r;
+}
+
+static bool eapol_sm_verify_mic(struct handshake_state *hs, const uint8_t *kck,
+				const struct eapol_key *frame, size_t mic_len)
+{
+	struct l_checksum *checksum;
+	uint8_t mic[MIC_MAXLEN];
+	bool r;
+
+	checksum = eapol_mic_checksum_get(hs, kck,
+					frame->key_descriptor_version, mic_len);
+	if (!checksum)
+		return false;
+
+	r = eapol_mic_digest(checksum, frame, mic, mic_len);
+	eapol_mic_checksum_put(hs, checksum);
+
+	return r && !memcmp(frame->key_data, mic, mic_len);
 }
 
 /*
@@ -241,14 +314,19 @@ static size_t eapol_get_mic_length(enum ie_rsn_akm_suite akm, size_t pmk_len)
 	}
 }
 
-uint8_t *eapol_decrypt_key_data(enum ie_rsn_akm_suite akm, const uint8_t *kek,
-				const struct eapol_key *frame,
+/*
+ * Decrypt the Key Data of @frame into the caller provided @buf, which must
+ * be at least EAPOL_KEY_DATA_LEN(frame, mic_len) bytes long.  This avoids a
+ * heap allocation per received EAPoL-Key frame.  On failure the contents of
+ * @buf are undefined and should be wiped by the caller.
+ */
+bool eapol_decrypt_key_data_buf(enum ie_rsn_akm_suite akm, const uint8_t *kek,
+				const struct eapol_key *frame, uint8_t *buf,
 				size_t *decrypted_size, size_t mic_len)
 {
 	size_t key_data_len = EAPOL_KEY_DATA_LEN(frame, mic_len);
 	const uint8_t *key_data = EAPOL_KEY_DATA(frame, mic_len);
 	size_t expected_len;
-	uint8_t *buf;
 	size_t kek_len;
 
 	switch (frame->key_descriptor_version) {
@@ -288,11 +366,9 @@ uint8_t *eapol_decrypt_key_data(enum ie_rsn_akm_suite akm, const uint8_t *kek,
 		expected_len = key_data_len - 8;
 		break;
 	default:
-		return NULL;
+		return false;
 	}
 
-	buf = l_new(uint8_t, expected_len);
-
 	switch (frame->key_descriptor_version) {
 	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_MD5_ARC4:
 	{
@@ -371,9 +447,24 @@ uint8_t *eapol_decrypt_key_data(enum ie_rsn_akm_suite akm, const uint8_t *kek,
 	if (decrypted_size)
 		*decrypted_size = expected_len;
 
-	return buf;
+	return true;
 
 error:
+	return false;
+}
+
+uint8_t *eapol_decrypt_key_data(enum ie_rsn_akm_suite akm, const uint8_t *kek,
+				const struct eapol_key *frame,
+				size_t *decrypted_size, size_t mic_len)
+{
+	size_t key_data_len = EAPOL_KEY_DATA_LEN(frame, mic_len);
+	uint8_t *buf = l_new(uint8_t, key_data_len);
+
+	if (eapol_decrypt_key_data_buf(akm, kek, frame, buf, decrypted_size,
+					mic_len))
+		return buf;
+
+	explicit_bzero(buf, key_data_len);
 	l_free(buf);
 	return NULL;
 }
@@ -843,6 +934,9 @@ struct eapol_sm {
 	void *user_data;
 	struct l_timeout *timeout;
 	struct l_timeout *eapol_start_timeout;
+	struct l_timeout *ptk_rekey_timeout;
+	uint64_t request_counter;
+	enum eapol_key_descriptor_version key_descriptor_version;
 	unsigned int frame_retry;
 	uint16_t listen_interval;
 	bool have_replay:1;
@@ -859,8 +953,15 @@ struct eapol_sm {
 	uint8_t installed_gtk[CRYPTO_MAX_GTK_LEN];
 	uint8_t installed_igtk_len;
 	uint8_t installed_igtk[CRYPTO_MAX_IGTK_LEN];
+	uint8_t installed_bigtk_len;
+	uint8_t installed_bigtk[CRYPTO_MAX_IGTK_LEN];
 	unsigned int mic_len;
 	bool rekey : 1;
+	bool group_handshake : 1;
+	uint8_t group_key_data[CRYPTO_MAX_GTK_LEN + 8 +
+					CRYPTO_MAX_IGTK_LEN + 14];
+	uint8_t group_key_data_len;
+	uint8_t group_key_rsc[6];
 };
 
 static void eapol_sm_destroy(void *value)
@@ -869,6 +970,7 @@ static void eapol_sm_destroy(void *value)
 
 	l_timeout_remove(sm->timeout);
 	l_timeout_remove(sm->eapol_start_timeout);
+	l_timeout_remove(sm->ptk_rekey_timeout);
 
 	if (sm->eap)
 		eap_free(sm->eap);
@@ -881,6 +983,9 @@ static void eapol_sm_destroy(void *value)
 	explicit_bzero(sm->installed_gtk, sizeof(sm->installed_gtk));
 	sm->installed_igtk_len = 0;
 	explicit_bzero(sm->installed_igtk, sizeof(sm->installed_igtk));
+	sm->installed_bigtk_len = 0;
+	explicit_bzero(sm->installed_bigtk, sizeof(sm->installed_bigtk));
+	explicit_bzero(sm->group_key_data, sizeof(sm->group_key_data));
 
 	l_free(sm);
 }
@@ -945,6 +1050,98 @@ static void eapol_timeout(struct l_timeout *timeout, void *user_data)
 	handshake_failed(sm, MMPDU_REASON_CODE_4WAY_HANDSHAKE_TIMEOUT);
 }
 
+/*
+ * Hands the current KEK, KCK and replay counter to the firmware so that
+ * it can answer Group Key Handshakes on its own while the host sleeps.
+ * The offload only carries 128 bit keys, other AKMs are left to the host.
+ */
+static void eapol_sm_rekey_offload(struct eapol_sm *sm)
+{
+	struct handshake_state *hs = sm->handshake;
+
+	if (!rekey_offload)
+		return;
+
+	if (handshake_state_get_kek_len(hs) != 16 ||
+			handshake_state_get_kck_len(hs) != 16)
+		return;
+
+	rekey_offload(hs->ifindex, handshake_state_get_kek(hs),
+			handshake_state_get_kck(hs), sm->replay_counter,
+			sm->user_data);
+}
+
+/* 802.11-2020 Section 12.7.2: EAPOL-Key Request for a new PTK */
+static void eapol_send_ptk_request(struct eapol_sm *sm)
+{
+	struct handshake_state *hs = sm->handshake;
+	_auto_(l_free) struct eapol_key *ek = NULL;
+	uint8_t nonce[32];
+	uint8_t mic[MIC_MAXLEN];
+
+	memset(nonce, 0, sizeof(nonce));
+
+	/*
+	 * The Authenticator only accepts requests with a Key Replay Counter
+	 * above that of the previous request, so they use a counter of
+	 * their own
+	 */
+	ek = eapol_create_common(sm->protocol_version,
+					sm->key_descriptor_version, true,
+					++sm->request_counter, nonce, 0, NULL,
+					1, false, sm->mic_len);
+	ek->request = true;
+
+	if (!eapol_sm_calculate_mic(hs, handshake_state_get_kck(hs), ek,
+					mic, sm->mic_len)) {
+		l_debug("MIC Calculation failed");
+		return;
+	}
+
+	memcpy(EAPOL_KEY_MIC(ek), mic, sm->mic_len);
+	eapol_sm_write(sm, (struct eapol_frame *) ek, false);
+}
+
+static void eapol_ptk_rekey_timeout(struct l_timeout *timeout,
+					void *user_data)
+{
+	struct eapol_sm *sm = user_data;
+
+	l_debug("ifindex=%u", sm->handshake->ifindex);
+
+	eapol_send_ptk_request(sm);
+
+	/* Asked again later if the Authenticator ignores the request */
+	l_timeout_modify(timeout, eapol_ptk_rekey_interval);
+}
+
+/*
+ * With Extended Key ID the new PTK is installed for RX only under the
+ * other Key ID before switching TX over to it, so there is no window in
+ * which data frames are dropped.  In that case ask the Authenticator for
+ * a PTK rekey every PairwiseRekeyInterval seconds instead of waiting for
+ * it to start one.  Restarted each time a PTK is installed.
+ */
+static void eapol_sm_schedule_ptk_rekey(struct eapol_sm *sm)
+{
+	struct handshake_state *hs = sm->handshake;
+
+	if (!eapol_ptk_rekey_interval || hs->authenticator ||
+			!hs->ext_key_id_capable || hs->no_rekey ||
+			!sm->mic_len)
+		return;
+
+	if (sm->ptk_rekey_timeout) {
+		l_timeout_modify(sm->ptk_rekey_timeout,
+					eapol_ptk_rekey_interval);
+		return;
+	}
+
+	sm->ptk_rekey_timeout = l_timeout_create(eapol_ptk_rekey_interval,
+						eapol_ptk_rekey_timeout,
+						sm, NULL);
+}
+
 static void eapol_install_gtk(struct eapol_sm *sm, uint8_t gtk_key_index,
 					const uint8_t *gtk, size_t gtk_len,
 					const uint8_t *rsc)
@@ -980,6 +1177,20 @@ static void eapol_install_igtk(struct eapol_sm *sm, uint16_t igtk_key_index,
 	sm->installed_igtk_len = igtk_len - 6;
 }
 
+static void eapol_install_bigtk(struct eapol_sm *sm, uint16_t bigtk_key_index,
+					const uint8_t *bigtk, size_t bigtk_len)
+{
+	/* Same as for the IGTK, never reinstall the current BIGTK */
+	if (sm->installed_bigtk_len == bigtk_len - 6 &&
+			!memcmp(sm->installed_bigtk, bigtk + 6, bigtk_len - 6))
+		return;
+
+	handshake_state_install_bigtk(sm->handshake, bigtk_key_index,
+					bigtk + 6, bigtk_len - 6, bigtk);
+	memcpy(sm->installed_bigtk, bigtk + 6, bigtk_len - 6);
+	sm->installed_bigtk_len = bigtk_len - 6;
+}
+
 static void __send_eapol_start(struct eapol_sm *sm, bool noencrypt)
 {
 	uint8_t buf[sizeof(struct eapol_frame)];
@@ -1249,12 +1460,14 @@ static void eapol_handle_ptk_1_of_4(struct eapol_sm *sm,
 	}
 
 	if (IE_AKM_IS_FT(sm->handshake->akm_suite)) {
+		struct handshake_ft *kh = handshake_state_get_ft(sm->handshake);
+
 		/*
 		 * Rebuild the RSNE to include the PMKR1Name and append
 		 * MDE + FTE.
 		 */
 		rsn_info.num_pmkids = 1;
-		rsn_info.pmkids = sm->handshake->pmk_r1_name;
+		rsn_info.pmkids = kh->pmk_r1_name;
 
 		ie_build_rsne(&rsn_info, ies);
 		ies_len = ies[1] + 2;
@@ -1300,7 +1513,7 @@ static void eapol_handle_ptk_1_of_4(struct eapol_sm *sm,
 	kck = handshake_state_get_kck(sm->handshake);
 
 	if (sm->mic_len) {
-		if (!eapol_calculate_mic(sm->handshake->akm_suite, kck,
+		if (!eapol_sm_calculate_mic(sm->handshake, kck,
 				step2, mic, sm->mic_len)) {
 			l_info("MIC calculation failed. "
 				"Ensure Kernel Crypto is available.");
@@ -1349,6 +1562,8 @@ static void eapol_send_ptk_3_of_4(struct eapol_sm *sm)
 				sm->handshake->pairwise_cipher);
 	enum crypto_cipher group_cipher = ie_rsn_cipher_suite_to_cipher(
 				sm->handshake->group_cipher);
+	enum crypto_cipher group_mgmt_cipher = ie_rsn_cipher_suite_to_cipher(
+				sm->handshake->group_management_cipher);
 	const uint8_t *kck;
 	const uint8_t *kek;
 
@@ -1389,6 +1604,17 @@ static void eapol_send_ptk_3_of_4(struct eapol_sm *sm)
 		key_data_len += gtk_kde[1] + 2;
 	}
 
+	if (sm->handshake->mfp && group_mgmt_cipher) {
+		uint8_t *igtk_kde = key_data_buf + key_data_len;
+
+		handshake_util_build_igtk_kde(group_mgmt_cipher,
+						sm->handshake->igtk,
+						sm->handshake->igtk_index,
+						sm->handshake->igtk_ipn,
+						igtk_kde);
+		key_data_len += igtk_kde[1] + 2;
+	}
+
 	if (sm->handshake->support_ip_allocation &&
 			!sm->handshake->client_ip_addr) {
 		handshake_event(sm->handshake, HANDSHAKE_EVENT_P2P_IP_REQUEST);
@@ -1434,7 +1660,7 @@ static void eapol_send_ptk_3_of_4(struct eapol_sm *sm)
 
 	kck = handshake_state_get_kck(sm->handshake);
 
-	if (!eapol_calculate_mic(sm->handshake->akm_suite, kck, ek,
+	if (!eapol_sm_calculate_mic(sm->handshake, kck, ek,
 			EAPOL_KEY_MIC(ek), sm->mic_len))
 		return;
 
@@ -1461,6 +1687,110 @@ static void eapol_ptk_3_of_4_retry(struct l_timeout *timeout,
 	l_debug("attempt %i", sm->frame_retry);
 }
 
+#define EAPOL_GROUP_UPDATE_COUNT 3
+
+/* 802.11-2016 Section 12.7.7.2 */
+static void eapol_send_gtk_1_of_2(struct eapol_sm *sm)
+{
+	uint8_t frame_buf[512];
+	uint8_t key_data_buf[sizeof(sm->group_key_data) + 16];
+	struct eapol_key *ek = (struct eapol_key *) frame_buf;
+	const uint8_t *kck;
+	const uint8_t *kek;
+	int key_data_len;
+
+	sm->replay_counter++;
+
+	memset(ek, 0, EAPOL_FRAME_LEN(sm->mic_len));
+	ek->header.protocol_version = sm->protocol_version;
+	ek->header.packet_type = 0x3;
+	ek->descriptor_type = EAPOL_DESCRIPTOR_TYPE_80211;
+	/* Must be HMAC-SHA1-128 + AES when using CCMP with PSK or 8021X */
+	ek->key_descriptor_version = EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_SHA1_AES;
+	ek->key_ack = true;
+	ek->key_mic = true;
+	ek->secure = true;
+	ek->encrypted_key_data = true;
+	ek->key_replay_counter = L_CPU_TO_BE64(sm->replay_counter);
+	memcpy(ek->key_rsc, sm->group_key_rsc, 6);
+
+	/*
+	 * The GTK KDE is the same for every station, only the KEK used to
+	 * wrap it differs.
+	 */
+	memcpy(key_data_buf, sm->group_key_data, sm->group_key_data_len);
+
+	kek = handshake_state_get_kek(sm->handshake);
+	key_data_len = eapol_encrypt_key_data(kek, key_data_buf,
+						sm->group_key_data_len, ek,
+						sm->mic_len);
+	explicit_bzero(key_data_buf, sizeof(key_data_buf));
+
+	if (key_data_len < 0)
+		return;
+
+	ek->header.packet_len = L_CPU_TO_BE16(EAPOL_FRAME_LEN(sm->mic_len) +
+				key_data_len - 4);
+
+	kck = handshake_state_get_kck(sm->handshake);
+
+	if (!eapol_sm_calculate_mic(sm->handshake, kck, ek,
+			EAPOL_KEY_MIC(ek), sm->mic_len))
+		return;
+
+	l_debug("STA: "MAC" retries=%u", MAC_STR(sm->handshake->spa),
+			sm->frame_retry);
+
+	eapol_sm_write(sm, (struct eapol_frame *) ek, false);
+}
+
+static void eapol_gtk_1_of_2_retry(struct l_timeout *timeout,
+						void *user_data)
+{
+	struct eapol_sm *sm = user_data;
+
+	if (sm->frame_retry >= EAPOL_GROUP_UPDATE_COUNT) {
+		handshake_failed(sm,
+				MMPDU_REASON_CODE_GROUP_KEY_HANDSHAKE_TIMEOUT);
+		return;
+	}
+
+	eapol_send_gtk_1_of_2(sm);
+
+	eapol_set_key_timeout(sm, eapol_gtk_1_of_2_retry);
+}
+
+/*
+ * Start a Group Key Handshake with an authenticated supplicant.  @gtk_kde
+ * is the plaintext GTK KDE, as built by handshake_util_build_gtk_kde(),
+ * and @rsc the starting RSC of the new GTK.  Both are copied so that the
+ * caller can build them once for all of its stations.
+ * HANDSHAKE_EVENT_GROUP_REKEY_COMPLETE is emitted when message 2 arrives.
+ * If it doesn't, HANDSHAKE_EVENT_FAILED is emitted after the retries and
+ * the state machine is freed.
+ */
+bool eapol_start_group_handshake(struct eapol_sm *sm, const uint8_t *gtk_kde,
+					size_t gtk_kde_len, const uint8_t *rsc)
+{
+	if (L_WARN_ON(!sm->handshake->authenticator))
+		return false;
+
+	if (!sm->handshake->ptk_complete)
+		return false;
+
+	if (gtk_kde_len > sizeof(sm->group_key_data))
+		return false;
+
+	memcpy(sm->group_key_data, gtk_kde, gtk_kde_len);
+	sm->group_key_data_len = gtk_kde_len;
+	memcpy(sm->group_key_rsc, rsc, 6);
+	sm->group_handshake = true;
+	sm->frame_retry = 0;
+
+	eapol_gtk_1_of_2_retry(NULL, sm);
+	return true;
+}
+
 static const uint8_t *eapol_find_rsne(const uint8_t *data, size_t data_len,
 				const uint8_t **optional)
 {
@@ -1536,7 +1866,7 @@ static void eapol_handle_ptk_2_of_4(struct eapol_sm *sm,
 
 	kck = handshake_state_get_kck(sm->handshake);
 
-	if (!eapol_verify_mic(sm->handshake->akm_suite, kck, ek,
+	if (!eapol_sm_verify_mic(sm->handshake, kck, ek,
 					sm->mic_len))
 		return;
 
@@ -1661,6 +1991,8 @@ static void eapol_handle_ptk_3_of_4(struct eapol_sm *sm,
 	size_t gtk_len;
 	const uint8_t *igtk = NULL;
 	size_t igtk_len;
+	const uint8_t *bigtk = NULL;
+	size_t bigtk_len;
 	const uint8_t *key_id = NULL;
 	size_t key_id_len;
 	const uint8_t *rsne;
@@ -1670,6 +2002,7 @@ static void eapol_handle_ptk_3_of_4(struct eapol_sm *sm,
 	size_t transition_disable_len;
 	uint8_t gtk_key_index;
 	uint16_t igtk_key_index;
+	uint16_t bigtk_key_index;
 	const uint8_t *oci;
 	size_t oci_len;
 	int r;
@@ -1735,7 +2068,8 @@ static void eapol_handle_ptk_3_of_4(struct eapol_sm *sm,
 			 IE_RSN_AKM_SUITE_FT_USING_PSK |
 			 IE_RSN_AKM_SUITE_FT_OVER_SAE_SHA256)) {
 		if (rsn_info.num_pmkids != 1 || memcmp(rsn_info.pmkids,
-						hs->pmk_r1_name, 16))
+					handshake_state_get_ft(hs)->pmk_r1_name,
+					16))
 			goto error_ie_different;
 
 		if (eapol_ie_matches(decrypted_key_data,
@@ -1866,6 +2200,16 @@ static void eapol_handle_ptk_3_of_4(struct eapol_sm *sm,
 		igtk_key_index = l_get_le16(igtk);
 		igtk += 2;
 		igtk_len -= 2;
+
+		/* Only sent when we advertised Beacon Protection */
+		bigtk = handshake_util_find_bigtk_kde(decrypted_key_data,
+							decrypted_key_data_size,
+							&bigtk_len);
+		if (bigtk) {
+			bigtk_key_index = l_get_le16(bigtk);
+			bigtk += 2;
+			bigtk_len -= 2;
+		}
 	}
 
 	key_id = handshake_util_find_kde(HANDSHAKE_KDE_KEY_ID,
@@ -1954,6 +2298,7 @@ retransmit:
 	 */
 	sm->replay_counter = L_BE64_TO_CPU(ek->key_replay_counter);
 	sm->have_replay = true;
+	sm->key_descriptor_version = ek->key_descriptor_version;
 
 	step4 = eapol_create_ptk_4_of_4(sm->protocol_version,
 					ek->key_descriptor_version,
@@ -1964,7 +2309,7 @@ retransmit:
 	kek = handshake_state_get_kek(hs);
 
 	if (sm->mic_len) {
-		if (!eapol_calculate_mic(hs->akm_suite, kck,
+		if (!eapol_sm_calculate_mic(hs, kck,
 						step4, mic, sm->mic_len)) {
 			l_debug("MIC Calculation failed");
 			handshake_failed(sm, MMPDU_REASON_CODE_UNSPECIFIED);
@@ -1996,6 +2341,9 @@ retransmit:
 	if (igtk)
 		eapol_install_igtk(sm, igtk_key_index, igtk, igtk_len);
 
+	if (bigtk)
+		eapol_install_bigtk(sm, bigtk_key_index, bigtk, bigtk_len);
+
 	/*
 	 * Only install if this is the first 3/4 message (not retransmitting)
 	 * and a rekey. Initial associations don't need the special RX -> TX
@@ -2005,6 +2353,7 @@ retransmit:
 		handshake_state_install_ext_ptk(hs, hs->active_tk_index,
 						(struct eapol_frame *) step4,
 						ETH_P_PAE, unencrypted);
+		eapol_sm_schedule_ptk_rekey(sm);
 
 		return;
 	}
@@ -2015,10 +2364,8 @@ retransmit:
 		return;
 
 	handshake_state_install_ptk(hs);
-
-	if (rekey_offload)
-		rekey_offload(hs->ifindex, kek, kck,
-				sm->replay_counter, sm->user_data);
+	eapol_sm_rekey_offload(sm);
+	eapol_sm_schedule_ptk_rekey(sm);
 
 	l_timeout_remove(sm->timeout);
 	sm->timeout = NULL;
@@ -2045,7 +2392,7 @@ static void eapol_handle_ptk_4_of_4(struct eapol_sm *sm,
 
 	kck = handshake_state_get_kck(sm->handshake);
 
-	if (!eapol_verify_mic(sm->handshake->akm_suite, kck, ek,
+	if (!eapol_sm_verify_mic(sm->handshake, kck, ek,
 				sm->mic_len))
 		return;
 
@@ -2063,6 +2410,36 @@ static void eapol_handle_ptk_4_of_4(struct eapol_sm *sm,
 	sm->handshake->ptk_complete = true;
 }
 
+static void eapol_handle_gtk_2_of_2(struct eapol_sm *sm,
+					const struct eapol_key *ek)
+{
+	const uint8_t *kck;
+
+	l_debug("ifindex=%u", sm->handshake->ifindex);
+
+	if (!sm->group_handshake)
+		return;
+
+	if (!eapol_verify_gtk_2_of_2(ek, false))
+		return;
+
+	if (L_BE64_TO_CPU(ek->key_replay_counter) != sm->replay_counter)
+		return;
+
+	kck = handshake_state_get_kck(sm->handshake);
+
+	if (!eapol_sm_verify_mic(sm->handshake, kck, ek, sm->mic_len))
+		return;
+
+	l_timeout_remove(sm->timeout);
+	sm->timeout = NULL;
+
+	sm->group_handshake = false;
+	explicit_bzero(sm->group_key_data, sizeof(sm->group_key_data));
+
+	handshake_event(sm->handshake, HANDSHAKE_EVENT_GROUP_REKEY_COMPLETE);
+}
+
 static void eapol_handle_gtk_1_of_2(struct eapol_sm *sm,
 					const struct eapol_key *ek,
 					const uint8_t *decrypted_key_data,
@@ -2079,6 +2456,9 @@ static void eapol_handle_gtk_1_of_2(struct eapol_sm *sm,
 	const uint8_t *igtk;
 	size_t igtk_len;
 	uint16_t igtk_key_index;
+	const uint8_t *bigtk = NULL;
+	size_t bigtk_len;
+	uint16_t bigtk_key_index;
 	const uint8_t *oci;
 	size_t oci_len;
 	uint8_t ies[1024];
@@ -2138,6 +2518,15 @@ static void eapol_handle_gtk_1_of_2(struct eapol_sm *sm,
 		igtk_key_index = l_get_le16(igtk);
 		igtk += 2;
 		igtk_len -= 2;
+
+		bigtk = handshake_util_find_bigtk_kde(decrypted_key_data,
+							decrypted_key_data_size,
+							&bigtk_len);
+		if (bigtk) {
+			bigtk_key_index = l_get_le16(bigtk);
+			bigtk += 2;
+			bigtk_len -= 2;
+		}
 	} else
 		igtk = NULL;
 
@@ -2181,7 +2570,7 @@ static void eapol_handle_gtk_1_of_2(struct eapol_sm *sm,
 	kck = handshake_state_get_kck(hs);
 
 	if (sm->mic_len) {
-		if (!eapol_calculate_mic(hs->akm_suite, kck,
+		if (!eapol_sm_calculate_mic(hs, kck,
 						step2, mic, sm->mic_len)) {
 			l_debug("MIC calculation failed");
 			l_free(step2);
@@ -2208,6 +2597,12 @@ static void eapol_handle_gtk_1_of_2(struct eapol_sm *sm,
 
 	if (igtk)
 		eapol_install_igtk(sm, igtk_key_index, igtk, igtk_len);
+
+	if (bigtk)
+		eapol_install_bigtk(sm, bigtk_key_index, bigtk, bigtk_len);
+
+	/* Keep the firmware from accepting this rekey again */
+	eapol_sm_rekey_offload(sm);
 }
 
 static struct eapol_sm *eapol_find_sm(uint32_t ifindex, const uint8_t *aa)
@@ -2238,6 +2633,7 @@ static void eapol_key_handle(struct eapol_sm *sm,
 	const struct eapol_key *ek;
 	const uint8_t *kck;
 	const uint8_t *kek;
+	uint8_t key_data_buf[IEEE80211_MAX_DATA_LEN];
 	uint8_t *decrypted_key_data = NULL;
 	size_t key_data_len = 0;
 	uint64_t replay_counter;
@@ -2297,7 +2693,7 @@ static void eapol_key_handle(struct eapol_sm *sm,
 		if (!sm->handshake->have_snonce)
 			return;
 
-		if (!eapol_verify_mic(sm->handshake->akm_suite, kck, ek,
+		if (!eapol_sm_verify_mic(sm->handshake, kck, ek,
 					sm->mic_len))
 			return;
 	}
@@ -2311,13 +2707,19 @@ static void eapol_key_handle(struct eapol_sm *sm,
 		if (sm->mic_len && !sm->handshake->have_snonce)
 			return;
 
+		/* Can't be larger than the MSDU it arrived in */
+		if (EAPOL_KEY_DATA_LEN(ek, sm->mic_len) > sizeof(key_data_buf))
+			return;
+
 		kek = handshake_state_get_kek(sm->handshake);
+		decrypted_key_data = key_data_buf;
 
-		decrypted_key_data = eapol_decrypt_key_data(
-					sm->handshake->akm_suite, kek,
-					ek, &key_data_len, sm->mic_len);
-		if (!decrypted_key_data)
-			return;
+		if (!eapol_decrypt_key_data_buf(sm->handshake->akm_suite, kek,
+						ek, decrypted_key_data,
+						&key_data_len, sm->mic_len)) {
+			key_data_len = EAPOL_KEY_DATA_LEN(ek, sm->mic_len);
+			goto done;
+		}
 	} else
 		key_data_len = EAPOL_KEY_DATA_LEN(ek, sm->mic_len);
 
@@ -2354,8 +2756,6 @@ static void eapol_key_handle(struct eapol_sm *sm,
 done:
 	if (decrypted_key_data)
 		explicit_bzero(decrypted_key_data, key_data_len);
-
-	l_free(decrypted_key_data);
 }
 
 /* This respresentes the eapMsg message in 802.1X Figure 8-1 */
@@ -2529,6 +2929,11 @@ static void eapol_auth_key_handle(struct eapol_sm *sm,
 	if (!sm->handshake->have_anonce)
 		return; /* Not expecting an EAPoL-Key yet */
 
+	if (!ek->key_type) {
+		eapol_handle_gtk_2_of_2(sm, ek);
+		return;
+	}
+
 	key_data_len = EAPOL_KEY_DATA_LEN(ek, sm->mic_len);
 	if (key_data_len != 0)
 		eapol_handle_ptk_2_of_4(sm, ek);
@@ -2542,6 +2947,7 @@ static void eapol_rx_auth_packet(uint16_t proto, const uint8_t *from,
 				void *user_data)
 {
 	struct eapol_sm *sm = user_data;
+	PROFILE_CALLBACK();
 
 	if (proto != ETH_P_PAE || memcmp(from, sm->handshake->spa, 6))
 		return;
@@ -2593,6 +2999,7 @@ static void eapol_rx_packet(uint16_t proto, const uint8_t *from,
 				void *user_data)
 {
 	struct eapol_sm *sm = user_data;
+	PROFILE_CALLBACK();
 
 	if (proto != ETH_P_PAE || memcmp(from, sm->handshake->aa, 6))
 		return;
@@ -2736,6 +3143,14 @@ bool eapol_start(struct eapol_sm *sm)
 
 		eap_set_key_material_func(sm->eap, eapol_eap_results_cb);
 		eap_set_event_func(sm->eap, eapol_eap_event_cb);
+
+		if (sm->handshake->ssid_len) {
+			_auto_(l_free) char *peer_id = l_util_hexstring(
+						sm->handshake->ssid,
+						sm->handshake->ssid_len);
+
+			eap_set_peer_id(sm->eap, peer_id);
+		}
 	}
 
 	sm->started = true;
@@ -2756,6 +3171,13 @@ bool eapol_start(struct eapol_sm *sm)
 	sm->mic_len = eapol_get_mic_length(sm->handshake->akm_suite,
 						sm->handshake->pmk_len);
 
+	/*
+	 * Without a 4-Way Handshake, e.g. after FT, the keys already derived
+	 * are the ones the firmware needs for offloaded rekeys
+	 */
+	if (!sm->handshake->authenticator && !sm->require_handshake)
+		eapol_sm_rekey_offload(sm);
+
 	/* Process any frames received early due to scheduling */
 	if (sm->early_frame) {
 		eapol_rx_packet(ETH_P_PAE, sm->handshake->aa,
@@ -3063,6 +3485,10 @@ void __eapol_set_config(struct l_settings *config)
 	if (!l_settings_get_uint(config, "EAPoL",
 			"MaxHandshakeTime", &eapol_4way_handshake_time))
 		eapol_4way_handshake_time = 5;
+
+	if (!l_settings_get_uint(config, "EAPoL", "PairwiseRekeyInterval",
+					&eapol_ptk_rekey_interval))
+		eapol_ptk_rekey_interval = 0;
 }
 
 int eapol_init(void)
@@ -64,6 +64,9 @@ bool eapol_verify_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
 uint8_t *eapol_decrypt_key_data(enum ie_rsn_akm_suite akm, const uint8_t *kek,
 				const struct eapol_key *frame,
 				size_t *decrypted_size, size_t mic_len);
+bool eapol_decrypt_key_data_buf(enum ie_rsn_akm_suite akm, const uint8_t *kek,
+				const struct eapol_key *frame, uint8_t *buf,
+				size_t *decrypted_size, size_t mic_len);
 
 bool eapol_verify_ptk_1_of_4(const struct eapol_key *ek, size_t mic_len);
 bool eapol_verify_ptk_2_of_4(const struct eapol_key *ek);
@@ -127,6 +130,8 @@ void eapol_sm_set_user_data(struct eapol_sm *sm, void *user_data);
 
 void eapol_register(struct eapol_sm *sm);
 bool eapol_start(struct eapol_sm *sm);
+bool eapol_start_group_handshake(struct eapol_sm *sm, const uint8_t *gtk_kde,
+					size_t gtk_kde_len, const uint8_t *rsc);
 
 struct preauth_sm *eapol_preauth_start(const uint8_t *aa,
 					const struct handshake_state *hs,
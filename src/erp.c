@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 
 #include <ell/ell.h>
 
@@ -100,7 +101,11 @@ struct erp_tlv_iter {
 	const unsigned char *data;
 };
 
-static struct l_queue *key_cache;
+/* Keyed by SSID, only the most recent entry for each network is kept */
+static struct l_hashmap *key_cache;
+static bool key_cache_loaded;
+static erp_cache_load_func_t erp_cache_load;
+static erp_cache_sync_func_t erp_cache_sync;
 
 static void erp_tlv_iter_init(struct erp_tlv_iter *iter,
 				const unsigned char *tlv, unsigned int len)
@@ -151,6 +156,10 @@ static void erp_cache_entry_destroy(void *data)
 		l_error("ERP entry still has a reference on cleanup!");
 
 	l_free(entry->id);
+
+	if (entry->emsk)
+		explicit_bzero(entry->emsk, entry->emsk_len);
+
 	l_free(entry->emsk);
 	l_free(entry->session_id);
 	l_free(entry->ssid);
@@ -158,87 +167,221 @@ static void erp_cache_entry_destroy(void *data)
 	l_free(entry);
 }
 
-void erp_cache_add(const char *id, const void *session_id,
-			size_t session_len, const void *emsk, size_t emsk_len,
-			const char *ssid)
+/*
+ * Entries are unlinked from key_cache as soon as they become invalid, if
+ * a reference is still held they are freed by the last erp_cache_put.
+ */
+static void erp_cache_entry_release(struct erp_cache_entry *entry)
 {
-	struct erp_cache_entry *entry;
+	if (entry->ref) {
+		entry->invalid = true;
+		return;
+	}
 
-	if (!unlikely(id || session_id || emsk))
+	erp_cache_entry_destroy(entry);
+}
+
+static bool erp_cache_entry_expired(const struct erp_cache_entry *entry)
+{
+	return l_time_after(l_time_now(), entry->expire_time);
+}
+
+static void erp_cache_save_entry(const void *key, void *value,
+					void *user_data)
+{
+	struct erp_cache_entry *entry = value;
+	struct l_settings *settings = user_data;
+	_auto_(l_free) char *group = NULL;
+	uint64_t remaining;
+
+	if (erp_cache_entry_expired(entry))
 		return;
 
-	entry = l_new(struct erp_cache_entry, 1);
+	/*
+	 * The expiry is kept as boottime internally, store it as wall clock
+	 * time so that it survives a reboot.
+	 */
+	remaining = l_time_diff(l_time_now(), entry->expire_time);
 
-	entry->id = l_strdup(id);
-	entry->emsk = l_memdup(emsk, emsk_len);
-	entry->emsk_len = emsk_len;
-	entry->session_id = l_memdup(session_id, session_len);
-	entry->session_len = session_len;
-	entry->ssid = l_strdup(ssid);
-	entry->expire_time = l_time_offset(l_time_now(),
-					ERP_DEFAULT_KEY_LIFETIME_US);
+	group = l_util_hexstring(entry->ssid, strlen(entry->ssid));
 
-	l_queue_push_head(key_cache, entry);
+	l_settings_set_string(settings, group, "Identity", entry->id);
+	l_settings_set_bytes(settings, group, "SessionId", entry->session_id,
+				entry->session_len);
+	l_settings_set_bytes(settings, group, "EMSK", entry->emsk,
+				entry->emsk_len);
+	l_settings_set_uint64(settings, group, "Expires",
+				time(NULL) + l_time_to_secs(remaining));
 }
 
-static struct erp_cache_entry *find_keycache(const char *id, const char *ssid)
+static void erp_cache_update(void)
 {
-	const struct l_queue_entry *entry;
+	_auto_(l_settings_free) struct l_settings *settings = NULL;
+
+	if (!erp_cache_sync)
+		return;
+
+	settings = l_settings_new();
+	l_hashmap_foreach(key_cache, erp_cache_save_entry, settings);
+	erp_cache_sync(settings);
+}
+
+static struct erp_cache_entry *erp_cache_entry_load(
+						struct l_settings *settings,
+						const char *group)
+{
+	struct erp_cache_entry *entry;
+	_auto_(l_free) uint8_t *ssid = NULL;
+	size_t ssid_len;
+	uint64_t expires;
+	time_t now = time(NULL);
+
+	ssid = l_util_from_hexstring(group, &ssid_len);
+	if (!ssid || !ssid_len || ssid_len > 32 ||
+			memchr(ssid, 0, ssid_len))
+		return NULL;
 
-	if (!id && !ssid)
+	if (!l_settings_get_uint64(settings, group, "Expires", &expires) ||
+			expires <= (uint64_t) now)
 		return NULL;
 
-	for (entry = l_queue_get_entries(key_cache); entry;
-			entry = entry->next) {
-		struct erp_cache_entry *cache = entry->data;
+	entry = l_new(struct erp_cache_entry, 1);
+	entry->ssid = l_strndup((const char *) ssid, ssid_len);
+	entry->id = l_settings_get_string(settings, group, "Identity");
+	entry->session_id = l_settings_get_bytes(settings, group, "SessionId",
+							&entry->session_len);
+	entry->emsk = l_settings_get_bytes(settings, group, "EMSK",
+							&entry->emsk_len);
+	entry->expire_time = l_time_offset(l_time_now(),
+					(expires - now) * L_USEC_PER_SEC);
 
-		if (cache->invalid)
-			continue;
+	/* All keys are derived with the EMSK length and must fit in 64 */
+	if (!entry->id || !entry->session_id || !entry->session_len ||
+			!entry->emsk || !entry->emsk_len ||
+			entry->emsk_len > 64) {
+		erp_cache_entry_destroy(entry);
+		return NULL;
+	}
+
+	return entry;
+}
+
+static void erp_cache_load_once(void)
+{
+	_auto_(l_settings_free) struct l_settings *settings = NULL;
+	_auto_(l_strv_free) char **groups = NULL;
+	char **i;
+
+	if (key_cache_loaded || !erp_cache_load)
+		return;
+
+	key_cache_loaded = true;
 
-		if (l_time_after(l_time_now(), cache->expire_time)) {
-			if (!cache->ref) {
-				l_queue_remove(key_cache, cache);
-				erp_cache_entry_destroy(cache);
-			} else
-				cache->invalid = true;
+	settings = erp_cache_load();
+	if (!settings)
+		return;
+
+	groups = l_settings_get_groups(settings);
 
+	for (i = groups; *i; i++) {
+		struct erp_cache_entry *entry =
+				erp_cache_entry_load(settings, *i);
+		void *old = NULL;
+
+		if (!entry)
 			continue;
-		}
 
-		if (id && !strcmp(cache->id, id))
-			return cache;
+		if (!l_hashmap_replace(key_cache, entry->ssid, entry, &old)) {
+			erp_cache_entry_destroy(entry);
+			continue;
+		}
 
-		if (ssid && !strcmp(cache->ssid, ssid))
-			return cache;
+		if (old)
+			erp_cache_entry_release(old);
 	}
+}
 
-	return NULL;
+void erp_set_cache_ops(erp_cache_load_func_t load, erp_cache_sync_func_t sync)
+{
+	erp_cache_load = load;
+	erp_cache_sync = sync;
+	key_cache_loaded = false;
 }
 
-void erp_cache_remove(const char *id)
+void erp_cache_add(const char *id, const void *session_id,
+			size_t session_len, const void *emsk, size_t emsk_len,
+			const char *ssid)
 {
-	struct erp_cache_entry *entry = find_keycache(id, NULL);
+	struct erp_cache_entry *entry;
+	void *old = NULL;
 
-	if (!entry)
+	if (!unlikely(id || session_id || emsk))
 		return;
 
-	if (entry->ref) {
-		entry->invalid = true;
+	erp_cache_load_once();
+
+	entry = l_new(struct erp_cache_entry, 1);
+
+	entry->id = l_strdup(id);
+	entry->emsk = l_memdup(emsk, emsk_len);
+	entry->emsk_len = emsk_len;
+	entry->session_id = l_memdup(session_id, session_len);
+	entry->session_len = session_len;
+	entry->ssid = l_strdup(ssid);
+	entry->expire_time = l_time_offset(l_time_now(),
+					ERP_DEFAULT_KEY_LIFETIME_US);
+
+	/* Only the most recent keys for a network are of any use */
+	if (!l_hashmap_replace(key_cache, entry->ssid, entry, &old)) {
+		erp_cache_entry_destroy(entry);
 		return;
 	}
 
-	l_queue_remove(key_cache, entry);
+	if (old)
+		erp_cache_entry_release(old);
 
-	erp_cache_entry_destroy(entry);
+	erp_cache_update();
+}
+
+static bool erp_cache_remove_id(const void *key, void *value,
+				void *user_data)
+{
+	struct erp_cache_entry *entry = value;
+	const char *id = user_data;
+
+	if (strcmp(entry->id, id))
+		return false;
+
+	erp_cache_entry_release(entry);
+	return true;
+}
+
+void erp_cache_remove(const char *id)
+{
+	erp_cache_load_once();
+
+	if (l_hashmap_foreach_remove(key_cache, erp_cache_remove_id,
+					(void *) id))
+		erp_cache_update();
 }
 
 struct erp_cache_entry *erp_cache_get(const char *ssid)
 {
-	struct erp_cache_entry *cache = find_keycache(NULL, ssid);
+	struct erp_cache_entry *cache;
 
+	erp_cache_load_once();
+
+	cache = l_hashmap_lookup(key_cache, ssid);
 	if (!cache)
 		return NULL;
 
+	if (erp_cache_entry_expired(cache)) {
+		l_hashmap_remove(key_cache, ssid);
+		erp_cache_entry_release(cache);
+		erp_cache_update();
+		return NULL;
+	}
+
 	cache->ref++;
 
 	return cache;
@@ -256,9 +399,9 @@ void erp_cache_put(struct erp_cache_entry *cache)
 
 	/*
 	 * Cache entry marked as invalid, either it expired or something
-	 * attempted to remove it. Either way, it can now be removed.
+	 * attempted to remove it.  It is no longer in key_cache and can now
+	 * be freed.
 	 */
-	l_queue_remove(key_cache, cache);
 	erp_cache_entry_destroy(cache);
 }
 
@@ -402,6 +545,7 @@ int erp_rx_packet(struct erp_state *erp, const uint8_t *pkt, size_t len)
 	enum eap_erp_cryptosuite cs;
 	uint8_t hash[16];
 	const uint8_t *nai = NULL;
+	uint32_t rrk_lifetime = 0;
 	uint8_t type;
 	uint16_t seq;
 	uint16_t length;
@@ -428,8 +572,8 @@ int erp_rx_packet(struct erp_state *erp, const uint8_t *pkt, size_t len)
 		goto eap_failed;
 
 	/*
-	 * TODO: Parse B and L bits. L bit indicates rRK lifetime, but our ERP
-	 * cache does not yet support this.
+	 * TODO: Parse the B bit.  The L bit only signals that the lifetime
+	 * TVs are present, these are simply looked for below.
 	 */
 
 	seq = l_get_be16(pkt + 6);
@@ -468,6 +612,9 @@ int erp_rx_packet(struct erp_state *erp, const uint8_t *pkt, size_t len)
 
 			nai = iter.data;
 			break;
+		case ERP_TV_RRK_LIFETIME:
+			rrk_lifetime = l_get_be32(iter.data);
+			break;
 		default:
 			break;
 		}
@@ -502,6 +649,16 @@ int erp_rx_packet(struct erp_state *erp, const uint8_t *pkt, size_t len)
 				&length, sizeof(length)))
 		goto eap_failed;
 
+	/*
+	 * RFC 6696 Section 5.3.3: the rRK lifetime tells how long the cached
+	 * keys can be used for further re-authentications
+	 */
+	if (rrk_lifetime && !erp->cache->invalid) {
+		erp->cache->expire_time = l_time_offset(l_time_now(),
+					rrk_lifetime * L_USEC_PER_SEC);
+		erp_cache_update();
+	}
+
 	return 0;
 
 eap_failed:
@@ -518,14 +675,15 @@ const void *erp_get_rmsk(struct erp_state *erp, size_t *rmsk_len)
 
 static int erp_init(void)
 {
-	key_cache = l_queue_new();
+	key_cache = l_hashmap_string_new();
 
 	return 0;
 }
 
 static void erp_exit(void)
 {
-	l_queue_destroy(key_cache, erp_cache_entry_destroy);
+	l_hashmap_destroy(key_cache, erp_cache_entry_destroy);
+	key_cache = NULL;
 }
 
 IWD_MODULE(erp, erp_init, erp_exit)
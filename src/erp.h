@@ -20,6 +20,7 @@
  *
  */
 
+struct l_settings;
 struct erp_state;
 struct erp_cache_entry;
 
@@ -47,6 +48,11 @@ void erp_cache_add(const char *id, const void *session_id, size_t session_len,
 
 void erp_cache_remove(const char *id);
 
+typedef struct l_settings *(*erp_cache_load_func_t)(void);
+typedef void (*erp_cache_sync_func_t)(const struct l_settings *cache);
+
+void erp_set_cache_ops(erp_cache_load_func_t load, erp_cache_sync_func_t sync);
+
 struct erp_cache_entry *erp_cache_get(const char *ssid);
 void erp_cache_put(struct erp_cache_entry *cache);
 
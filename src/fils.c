@@ -295,7 +295,7 @@ static int fils_derive_key_data(struct fils_sm *fils)
 			return -EPROTO;
 
 		rsn_info.num_pmkids = 1;
-		rsn_info.pmkids = fils->hs->pmk_r1_name;
+		rsn_info.pmkids = handshake_state_get_ft(fils->hs)->pmk_r1_name;
 
 		rsne = alloca(256);
 		ie_build_rsne(&rsn_info, rsne);
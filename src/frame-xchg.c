@@ -43,6 +43,7 @@
 #include "src/netdev.h"
 #include "src/frame-xchg.h"
 #include "src/wiphy.h"
+#include "src/profile.h"
 
 #ifndef SOL_NETLINK
 #define SOL_NETLINK 270
@@ -70,6 +71,12 @@ struct watch_group {
 	uint32_t nl_seq;
 	struct l_queue *write_queue;
 	struct watchlist watches;
+	/*
+	 * Index of the items in watches by frame type and the first byte of
+	 * the prefix, see frame_watch_key().  Each value is an l_queue of
+	 * struct frame_watch in the same order as in watches.
+	 */
+	struct l_hashmap *index;
 };
 
 struct frame_watch {
@@ -91,6 +98,7 @@ struct wdev_info {
 static struct l_queue *wdevs;
 
 struct frame_xchg_data {
+	uint32_t id;
 	uint64_t wdev_id;
 	uint32_t freq;
 	struct mmpdu_header *tx_mpdu;
@@ -118,6 +126,18 @@ struct frame_xchg_data {
 	struct wiphy_radio_work_item work;
 	bool no_cck_rates;
 	unsigned int tx_cmd_id;
+	/*
+	 * Pipelined exchanges on the same wdev, frequency and watch group
+	 * share the radio work of the first one, the leader, and run
+	 * concurrently with it.  The leader keeps the radio work until
+	 * its own exchange and all of the followers' exchanges are done.
+	 */
+	bool pipelined;
+	bool follower;
+	bool starting;
+	bool finished;
+	struct frame_xchg_data *leader;
+	struct l_queue *followers;
 };
 
 struct frame_xchg_watch_data {
@@ -126,6 +146,7 @@ struct frame_xchg_watch_data {
 };
 
 static struct l_queue *frame_xchgs;
+static uint32_t frame_xchg_ids;
 static struct l_genl_family *nl80211;
 static uint32_t nl80211_id;
 
@@ -136,13 +157,9 @@ struct frame_prefix_info {
 	uint64_t wdev_id;
 };
 
-static bool frame_watch_match_prefix(const void *a, const void *b)
+static bool frame_watch_match_prefix(const struct frame_watch *watch,
+					const struct frame_prefix_info *info)
 {
-	const struct watchlist_item *item = a;
-	const struct frame_watch *watch =
-		l_container_of(item, struct frame_watch, super);
-	const struct frame_prefix_info *info = b;
-
 	return watch->frame_type == info->frame_type &&
 		watch->prefix_len <= info->body_len &&
 		(watch->prefix_len == 0 ||
@@ -150,6 +167,130 @@ static bool frame_watch_match_prefix(const void *a, const void *b)
 		info->wdev_id == watch->wdev_id;
 }
 
+/*
+ * Watches are indexed by the frame type and by the first prefix byte, or
+ * by the frame type alone for watches with no prefix.  A received frame
+ * can then only match the watches from two buckets.  The key is never 0.
+ */
+static unsigned int frame_watch_key(uint16_t frame_type,
+					const uint8_t *prefix, size_t prefix_len)
+{
+	return (frame_type << 16) | (prefix_len ? 0x100 | prefix[0] : 0x200);
+}
+
+static void frame_watch_index_add(struct watch_group *group,
+					struct frame_watch *watch)
+{
+	unsigned int key = frame_watch_key(watch->frame_type, watch->prefix,
+						watch->prefix_len);
+	struct l_queue *bucket = l_hashmap_lookup(group->index,
+							L_UINT_TO_PTR(key));
+
+	if (!bucket) {
+		bucket = l_queue_new();
+		l_hashmap_insert(group->index, L_UINT_TO_PTR(key), bucket);
+	}
+
+	l_queue_push_tail(bucket, watch);
+}
+
+static void frame_watch_index_remove(struct watch_group *group,
+					struct frame_watch *watch)
+{
+	unsigned int key = frame_watch_key(watch->frame_type, watch->prefix,
+						watch->prefix_len);
+	struct l_queue *bucket = l_hashmap_lookup(group->index,
+							L_UINT_TO_PTR(key));
+
+	if (!l_queue_remove(bucket, watch) || !l_queue_isempty(bucket))
+		return;
+
+	l_hashmap_remove(group->index, L_UINT_TO_PTR(key));
+	l_queue_destroy(bucket, NULL);
+}
+
+static void frame_watch_index_destroy(void *data)
+{
+	l_queue_destroy(data, NULL);
+}
+
+/*
+ * Equivalent to WATCHLIST_NOTIFY_MATCHES on group->watches but only walks
+ * the two index buckets the frame can match.  The buckets are merged by
+ * the items' positions in the watchlist, which only get compacted outside
+ * of the notify loops, so the callbacks run in the same order as when
+ * walking the whole watchlist.  Stale items have their ID set to 0.
+ */
+static void frame_watch_dispatch(struct watch_group *group,
+					const struct frame_prefix_info *info,
+					const struct mmpdu_header *mpdu,
+					int rssi)
+{
+	struct watchlist *watchlist = &group->watches;
+	unsigned int key_any = frame_watch_key(info->frame_type, NULL, 0);
+	unsigned int key_byte = frame_watch_key(info->frame_type, info->body,
+						info->body_len);
+	const struct l_queue_entry *a = l_queue_get_entries(
+			l_hashmap_lookup(group->index, L_UINT_TO_PTR(key_any)));
+	const struct l_queue_entry *b = NULL;
+	bool validated = false;
+
+	if (info->body_len)
+		b = l_queue_get_entries(l_hashmap_lookup(group->index,
+						L_UINT_TO_PTR(key_byte)));
+
+	watchlist->in_notify = true;
+
+	while (a || b) {
+		struct frame_watch *watch;
+		frame_watch_cb_t cb;
+
+		if (!b || (a && ((struct frame_watch *) a->data)->super.pos <
+				((struct frame_watch *) b->data)->super.pos)) {
+			watch = a->data;
+			a = a->next;
+		} else {
+			watch = b->data;
+			b = b->next;
+		}
+
+		if (watch->super.id == 0)
+			continue;
+
+		if (!frame_watch_match_prefix(watch, info))
+			continue;
+
+		/*
+		 * Only the header was checked on reception, run the full
+		 * validation once a watch actually wants the frame.
+		 */
+		if (!validated) {
+			if (!mpdu_validate((const uint8_t *) mpdu,
+						info->body + info->body_len -
+						(const uint8_t *) mpdu)) {
+				l_warn("Frame didn't validate as MMPDU");
+				break;
+			}
+
+			validated = true;
+		}
+
+		cb = watch->super.notify;
+		cb(mpdu, info->body, info->body_len, rssi,
+			watch->super.notify_data);
+
+		if (watchlist->pending_destroy)
+			break;
+	}
+
+	watchlist->in_notify = false;
+
+	if (watchlist->pending_destroy)
+		watchlist_destroy(watchlist);
+	else if (watchlist->stale_items)
+		__watchlist_prune_stale(watchlist);
+}
+
 static void frame_watch_unicast_notify(struct l_genl_msg *msg, void *user_data)
 {
 	struct watch_group *group = user_data;
@@ -162,6 +303,7 @@ static void frame_watch_unicast_notify(struct l_genl_msg *msg, void *user_data)
 	const uint8_t *body;
 	struct frame_prefix_info info;
 	int rssi = 0;	/* No-RSSI flag value */
+	PROFILE_CALLBACK();
 
 	if (l_genl_msg_get_command(msg) != NL80211_CMD_FRAME)
 		return;
@@ -186,7 +328,7 @@ static void frame_watch_unicast_notify(struct l_genl_msg *msg, void *user_data)
 			break;
 
 		case NL80211_ATTR_FRAME:
-			mpdu = mpdu_validate(data, len);
+			mpdu = mpdu_validate_header(data, len);
 			if (!mpdu) {
 				l_warn("Frame didn't validate as MMPDU");
 				return;
@@ -231,13 +373,13 @@ static void frame_watch_unicast_notify(struct l_genl_msg *msg, void *user_data)
 	info.body_len = (const uint8_t *) mpdu + frame_len - body;
 	info.wdev_id = *wdev_id;
 
-	WATCHLIST_NOTIFY_MATCHES(&group->watches, frame_watch_match_prefix,
-					&info, frame_watch_cb_t, mpdu,
-					info.body, info.body_len, rssi);
+	frame_watch_dispatch(group, &info, mpdu, rssi);
 
 	/* Has frame_watch_group_destroy been called inside a frame CB? */
-	if (group->watches.pending_destroy)
+	if (group->watches.pending_destroy) {
+		l_hashmap_destroy(group->index, frame_watch_index_destroy);
 		l_free(group);
+	}
 }
 
 static void frame_watch_group_destroy(void *data)
@@ -261,6 +403,7 @@ static void frame_watch_group_destroy(void *data)
 	if (group->watches.in_notify)
 		return;
 
+	l_hashmap_destroy(group->index, frame_watch_index_destroy);
 	l_free(group);
 }
 
@@ -269,6 +412,7 @@ static void frame_watch_free(struct watchlist_item *item)
 	struct frame_watch *watch =
 		l_container_of(item, struct frame_watch, super);
 
+	frame_watch_index_remove(watch->group, watch);
 	l_free(watch->prefix);
 	l_free(watch);
 }
@@ -392,6 +536,7 @@ static struct watch_group *frame_watch_group_new(uint64_t wdev_id, uint32_t id)
 	group->id = id;
 	group->wdev_id = wdev_id;
 	watchlist_init(&group->watches, &frame_watch_ops);
+	group->index = l_hashmap_new();
 
 	if (id == 0) {
 		group->unicast_watch_id = l_genl_add_unicast_watch(
@@ -507,9 +652,9 @@ struct frame_duplicate_info {
 	bool registered : 1;
 };
 
-static bool frame_watch_check_duplicate(void *data, void *user_data)
+static bool frame_watch_check_duplicate(struct watchlist_item *super,
+						void *user_data)
 {
-	struct watchlist_item *super = data;
 	struct frame_watch *watch =
 		l_container_of(super, struct frame_watch, super);
 	struct frame_duplicate_info *info = user_data;
@@ -564,8 +709,7 @@ drop:
 	 * be cleaned up afterwards
 	 */
 	if (watch->group->watches.in_notify) {
-		super->id = 0;
-		watch->group->watches.stale_items = true;
+		watchlist_mark_stale(&watch->group->watches, super);
 		return false;
 	}
 
@@ -589,8 +733,8 @@ bool frame_watch_add(uint64_t wdev_id, uint32_t group_id, uint16_t frame_type,
 	if (!group)
 		return false;
 
-	l_queue_foreach_remove(group->watches.items,
-				frame_watch_check_duplicate, &info);
+	watchlist_foreach_remove(&group->watches, frame_watch_check_duplicate,
+					&info);
 
 	if (info.duplicate)
 		return true;
@@ -603,6 +747,7 @@ bool frame_watch_add(uint64_t wdev_id, uint32_t group_id, uint16_t frame_type,
 	watch->group = group;
 	watchlist_link(&group->watches, &watch->super, handler, user_data,
 			destroy);
+	frame_watch_index_add(group, watch);
 
 	if (info.registered)
 		return true;
@@ -639,10 +784,11 @@ bool frame_watch_group_remove(uint64_t wdev_id, uint32_t group_id)
 	return true;
 }
 
-static bool frame_watch_item_remove_wdev(void *data, void *user_data)
+static bool frame_watch_item_remove_wdev(struct watchlist_item *item,
+						void *user_data)
 {
 	struct frame_watch *watch =
-		l_container_of(data, struct frame_watch, super);
+		l_container_of(item, struct frame_watch, super);
 	const uint64_t *wdev_id = user_data;
 
 	if (watch->wdev_id != *wdev_id)
@@ -668,12 +814,8 @@ static bool frame_watch_group_remove_wdev(void *data, void *user_data)
 	if (group->id != 0)
 		return false;
 
-	/*
-	 * Have to be careful here because we're messing with watchlist
-	 * internals.
-	 */
-	l_queue_foreach_remove(group->watches.items,
-				frame_watch_item_remove_wdev, user_data);
+	watchlist_foreach_remove(&group->watches,
+					frame_watch_item_remove_wdev, user_data);
 	return false;
 }
 
@@ -689,10 +831,11 @@ struct frame_watch_handler_check_info {
 	void *user_data;
 };
 
-static bool frame_watch_item_remove_by_handler(void *data, void *user_data)
+static bool frame_watch_item_remove_by_handler(struct watchlist_item *item,
+						void *user_data)
 {
 	struct frame_watch *watch =
-		l_container_of(data, struct frame_watch, super);
+		l_container_of(item, struct frame_watch, super);
 	struct frame_watch_handler_check_info *info = user_data;
 
 	if (watch->wdev_id != info->wdev_id ||
@@ -737,7 +880,7 @@ static bool frame_watch_remove_by_handler(uint64_t wdev_id, uint32_t group_id,
 	if (!group)
 		return false;
 
-	return l_queue_foreach_remove(group->watches.items,
+	return watchlist_foreach_remove(&group->watches,
 					frame_watch_item_remove_by_handler,
 					&handler_info) > 0;
 }
@@ -789,6 +932,13 @@ static void frame_xchg_reset(struct frame_xchg_data *fx)
 					frame_xchg_resp_cb, fx);
 }
 
+static void frame_xchg_detach_follower(void *data)
+{
+	struct frame_xchg_data *follower = data;
+
+	follower->leader = NULL;
+}
+
 static void frame_xchg_destroy(struct wiphy_radio_work_item *item)
 {
 	struct frame_xchg_data *fx = l_container_of(item,
@@ -798,9 +948,63 @@ static void frame_xchg_destroy(struct wiphy_radio_work_item *item)
 		fx->destroy(fx->user_data);
 
 	frame_xchg_reset(fx);
+
+	/* Only if the radio work was dropped from under us */
+	l_queue_destroy(fx->followers, frame_xchg_detach_follower);
 	l_free(fx);
 }
 
+static void frame_xchg_follower_done(struct frame_xchg_data *fx)
+{
+	struct frame_xchg_data *leader = fx->leader;
+
+	if (leader)
+		l_queue_remove(leader->followers, fx);
+
+	frame_xchg_destroy(&fx->work);
+
+	if (!leader)
+		return;
+
+	/*
+	 * If the leader is still starting the followers up,
+	 * frame_xchg_work_start takes care of releasing the work.
+	 */
+	if (leader->finished && !leader->starting &&
+			l_queue_isempty(leader->followers))
+		wiphy_radio_work_done(wiphy_find_by_wdev(leader->wdev_id),
+					leader->work.id);
+}
+
+/*
+ * Called for an exchange that has already been removed from frame_xchgs,
+ * to give up its resources.  A leader whose followers are still running
+ * only releases its own state and the radio work is released by the
+ * last follower.
+ */
+static void frame_xchg_release(struct frame_xchg_data *fx)
+{
+	if (fx->follower) {
+		frame_xchg_follower_done(fx);
+		return;
+	}
+
+	if (l_queue_isempty(fx->followers)) {
+		wiphy_radio_work_done(wiphy_find_by_wdev(fx->wdev_id),
+					fx->work.id);
+		return;
+	}
+
+	if (fx->destroy) {
+		fx->destroy(fx->user_data);
+		fx->destroy = NULL;
+	}
+
+	frame_xchg_reset(fx);
+	fx->cb = NULL;
+	fx->finished = true;
+}
+
 static void frame_xchg_done(struct frame_xchg_data *fx, int err)
 {
 	l_queue_remove(frame_xchgs, fx);
@@ -808,7 +1012,7 @@ static void frame_xchg_done(struct frame_xchg_data *fx, int err)
 	if (fx->cb)
 		fx->cb(err, fx->user_data);
 
-	wiphy_radio_work_done(wiphy_find_by_wdev(fx->wdev_id), fx->work.id);
+	frame_xchg_release(fx);
 }
 
 static void frame_xchg_timeout_destroy(void *user_data)
@@ -976,8 +1180,9 @@ static bool frame_xchg_tx_retry(struct wiphy_radio_work_item *item)
 	if (!fx->tx_cmd_id) {
 		l_error("Error sending frame");
 		l_genl_msg_unref(msg);
+		/* frame_xchg_done has already released the radio work */
 		frame_xchg_done(fx, -EIO);
-		return true;
+		return false;
 	}
 
 	fx->tx_acked = false;
@@ -1075,7 +1280,32 @@ static bool frame_xchg_match_running(const void *a, const void *b)
 	const struct frame_xchg_data *fx = a;
 	const uint64_t *wdev_id = b;
 
-	return fx->retry_cnt > 0 && fx->wdev_id == *wdev_id;
+	return fx->retry_cnt > 0 && !fx->have_cookie &&
+		fx->wdev_id == *wdev_id;
+}
+
+struct frame_xchg_cookie_info {
+	uint64_t wdev_id;
+	uint64_t cookie;
+};
+
+static bool frame_xchg_match_cookie(const void *a, const void *b)
+{
+	const struct frame_xchg_data *fx = a;
+	const struct frame_xchg_cookie_info *info = b;
+
+	return fx->have_cookie && fx->cookie == info->cookie &&
+		fx->wdev_id == info->wdev_id;
+}
+
+static bool frame_xchg_match_leader(const void *a, const void *b)
+{
+	const struct frame_xchg_data *fx = a;
+	const struct frame_xchg_data *new = b;
+
+	return fx->pipelined && !fx->follower &&
+		fx->wdev_id == new->wdev_id && fx->freq == new->freq &&
+		fx->group_id == new->group_id;
 }
 
 /*
@@ -1110,9 +1340,41 @@ uint32_t frame_xchg_start(uint64_t wdev_id, struct iovec *frame, uint32_t freq,
 	return id;
 }
 
+static bool frame_xchg_work_start(struct wiphy_radio_work_item *item)
+{
+	struct frame_xchg_data *fx = l_container_of(item,
+						struct frame_xchg_data, work);
+	const struct l_queue_entry *entry = l_queue_get_entries(fx->followers);
+
+	/*
+	 * Start the followers that were queued up behind this exchange
+	 * while it was waiting for the radio.  A follower failing right
+	 * away removes its own entry so grab the next one first.
+	 */
+	fx->starting = true;
+
+	while (entry) {
+		struct frame_xchg_data *follower = entry->data;
+
+		entry = entry->next;
+
+		if (!follower->retry_cnt)
+			frame_xchg_tx_retry(&follower->work);
+	}
+
+	fx->starting = false;
+
+	if (!fx->finished)
+		return frame_xchg_tx_retry(item);
+
+	/* The leader was cancelled before the radio work started */
+	return l_queue_isempty(fx->followers);
+}
+
 static const struct wiphy_radio_work_item_ops work_ops = {
-	.do_work = frame_xchg_tx_retry,
+	.do_work = frame_xchg_work_start,
 	.destroy = frame_xchg_destroy,
+	.type = WIPHY_WORK_TYPE_FRAME_XCHG,
 };
 
 static bool frame_xchg_wdev_match(const void *a, const void *b)
@@ -1123,13 +1385,15 @@ static bool frame_xchg_wdev_match(const void *a, const void *b)
 	return wdev->id == *id;
 }
 
-uint32_t frame_xchg_startv(uint64_t wdev_id, struct iovec *frame, uint32_t freq,
-			unsigned int retry_interval, unsigned int resp_timeout,
-			unsigned int retries_on_ack, uint32_t group_id,
+static uint32_t frame_xchg_start_common(uint64_t wdev_id, struct iovec *frame,
+			uint32_t freq, unsigned int retry_interval,
+			unsigned int resp_timeout, unsigned int retries_on_ack,
+			uint32_t group_id, bool pipelined,
 			frame_xchg_cb_t cb, void *user_data,
 			frame_xchg_destroy_func_t destroy, va_list resp_args)
 {
 	struct frame_xchg_data *fx;
+	struct frame_xchg_data *leader;
 	size_t frame_len;
 	struct iovec *iov;
 	uint8_t *ptr;
@@ -1204,17 +1468,76 @@ uint32_t frame_xchg_startv(uint64_t wdev_id, struct iovec *frame, uint32_t freq,
 	}
 
 	fx->retry_cnt = 0;
+	fx->id = ++frame_xchg_ids;
+	fx->pipelined = pipelined;
+
+	leader = pipelined ? l_queue_find(frame_xchgs, frame_xchg_match_leader,
+						fx) : NULL;
 
 	l_queue_push_tail(frame_xchgs, fx);
 
+	if (leader) {
+		fx->follower = true;
+		fx->leader = leader;
+
+		if (!leader->followers)
+			leader->followers = l_queue_new();
+
+		l_queue_push_tail(leader->followers, fx);
+
+		/* Otherwise started from frame_xchg_work_start */
+		if (wiphy_radio_work_is_running(wiphy_find_by_wdev(wdev_id),
+						leader->work.id) == 1)
+			frame_xchg_tx_retry(&fx->work);
+
+		return fx->id;
+	}
+
 	/*
 	 * TODO: Assume any offchannel frames are a high priority (0). This may
 	 * need to be re-examined in the future if other operations (e.g.
 	 * wait on channel) are introduced.
 	 */
-	return wiphy_radio_work_insert(wiphy_find_by_wdev(wdev_id),
-					&fx->work, WIPHY_WORK_PRIORITY_FRAME,
-					&work_ops);
+	wiphy_radio_work_insert(wiphy_find_by_wdev(wdev_id), &fx->work,
+				WIPHY_WORK_PRIORITY_FRAME, &work_ops);
+	return fx->id;
+}
+
+uint32_t frame_xchg_startv(uint64_t wdev_id, struct iovec *frame, uint32_t freq,
+			unsigned int retry_interval, unsigned int resp_timeout,
+			unsigned int retries_on_ack, uint32_t group_id,
+			frame_xchg_cb_t cb, void *user_data,
+			frame_xchg_destroy_func_t destroy, va_list resp_args)
+{
+	return frame_xchg_start_common(wdev_id, frame, freq, retry_interval,
+					resp_timeout, retries_on_ack, group_id,
+					false, cb, user_data, destroy,
+					resp_args);
+}
+
+/*
+ * Same as frame_xchg_start but the exchange may run concurrently with
+ * other pipelined exchanges on the same wdev, frequency and group instead
+ * of waiting for them to finish.  Each exchange keeps its own retry and
+ * response timeouts and the responses are told apart by the peer address
+ * like for frame_xchg_start, so the exchanges must have different
+ * destinations.
+ */
+uint32_t frame_xchg_start_pipelined(uint64_t wdev_id, struct iovec *frame,
+			uint32_t freq, unsigned int retry_interval,
+			unsigned int resp_timeout, unsigned int retries_on_ack,
+			uint32_t group_id, frame_xchg_cb_t cb, void *user_data,
+			frame_xchg_destroy_func_t destroy, ...)
+{
+	uint32_t id;
+	va_list args;
+
+	va_start(args, destroy);
+	id = frame_xchg_start_common(wdev_id, frame, freq, retry_interval,
+					resp_timeout, retries_on_ack, group_id,
+					true, cb, user_data, destroy, args);
+	va_end(args);
+	return id;
 }
 
 static bool frame_xchg_cancel_by_wdev(void *data, void *user_data)
@@ -1225,7 +1548,7 @@ static bool frame_xchg_cancel_by_wdev(void *data, void *user_data)
 	if (fx->wdev_id != *wdev_id)
 		return false;
 
-	wiphy_radio_work_done(wiphy_find_by_wdev(fx->wdev_id), fx->work.id);
+	frame_xchg_release(fx);
 	return true;
 }
 
@@ -1240,7 +1563,7 @@ static bool frame_xchg_match_id(const void *a, const void *b)
 	const struct frame_xchg_data *fx = a;
 	const uint32_t *id = b;
 
-	return fx->work.id == *id;
+	return fx->id == *id;
 }
 
 void frame_xchg_cancel(uint32_t id)
@@ -1251,7 +1574,7 @@ void frame_xchg_cancel(uint32_t id)
 	if (!fx)
 		return;
 
-	wiphy_radio_work_done(wiphy_find_by_wdev(fx->wdev_id), id);
+	frame_xchg_release(fx);
 }
 
 static void frame_xchg_mlme_notify(struct l_genl_msg *msg, void *user_data)
@@ -1261,6 +1584,8 @@ static void frame_xchg_mlme_notify(struct l_genl_msg *msg, void *user_data)
 	uint64_t cookie;
 	bool ack;
 	uint8_t cmd = l_genl_msg_get_command(msg);
+	struct frame_xchg_cookie_info cookie_info;
+	PROFILE_CALLBACK();
 
 	switch (cmd) {
 	case NL80211_CMD_FRAME_TX_STATUS:
@@ -1270,8 +1595,20 @@ static void frame_xchg_mlme_notify(struct l_genl_msg *msg, void *user_data)
 					NL80211_ATTR_UNSPEC) < 0)
 			return;
 
-		fx = l_queue_find(frame_xchgs, frame_xchg_match_running,
-					&wdev_id);
+		cookie_info.wdev_id = wdev_id;
+		cookie_info.cookie = cookie;
+
+		/*
+		 * With pipelined exchanges more than one frame may be in
+		 * flight, find the one this status is for by the cookie.
+		 * Fall back to the first one still waiting for its cookie
+		 * to handle statuses received before the Tx callback.
+		 */
+		fx = l_queue_find(frame_xchgs, frame_xchg_match_cookie,
+					&cookie_info);
+		if (!fx)
+			fx = l_queue_find(frame_xchgs, frame_xchg_match_running,
+						&wdev_id);
 		if (!fx)
 			return;
 
@@ -1391,7 +1728,7 @@ static void destroy_xchg_data(void *user_data)
 {
 	struct frame_xchg_data *fx = user_data;
 
-	wiphy_radio_work_done(wiphy_find_by_wdev(fx->wdev_id), fx->work.id);
+	frame_xchg_release(fx);
 }
 
 static void frame_xchg_exit(void)
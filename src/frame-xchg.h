@@ -53,5 +53,10 @@ uint32_t frame_xchg_startv(uint64_t wdev_id, struct iovec *frame, uint32_t freq,
 			unsigned int retries_on_ack, uint32_t group_id,
 			frame_xchg_cb_t cb, void *user_data,
 			frame_xchg_destroy_func_t destroy, va_list resp_args);
+uint32_t frame_xchg_start_pipelined(uint64_t wdev_id, struct iovec *frame,
+			uint32_t freq, unsigned int retry_interval,
+			unsigned int resp_timeout, unsigned int retries_on_ack,
+			uint32_t group_id, frame_xchg_cb_t cb, void *user_data,
+			frame_xchg_destroy_func_t destroy, ...);
 void frame_xchg_stop_wdev(uint64_t wdev_id);
 void frame_xchg_cancel(uint32_t id);
@@ -212,6 +212,7 @@ static int ft_tx_reassociate(struct ft_sm *ft)
 	struct iovec iov[3];
 	int iov_elems = 0;
 	struct handshake_state *hs = ft->hs;
+	struct handshake_ft *kh = handshake_state_get_ft(hs);
 	uint32_t kck_len = handshake_state_get_kck_len(hs);
 	bool is_rsn = hs->supplicant_ie != NULL;
 	uint8_t *rsne = NULL;
@@ -236,7 +237,7 @@ static int ft_tx_reassociate(struct ft_sm *ft)
 			goto error;
 
 		rsn_info.num_pmkids = 1;
-		rsn_info.pmkids = hs->pmk_r1_name;
+		rsn_info.pmkids = kh->pmk_r1_name;
 
 		/* Always set OCVC false for FT-over-DS */
 		if (ft->over_ds)
@@ -274,9 +275,9 @@ static int ft_tx_reassociate(struct ft_sm *ft)
 		memset(&ft_info, 0, sizeof(ft_info));
 
 		ft_info.mic_element_count = 3;
-		memcpy(ft_info.r0khid, hs->r0khid, hs->r0khid_len);
-		ft_info.r0khid_len = hs->r0khid_len;
-		memcpy(ft_info.r1khid, hs->r1khid, 6);
+		memcpy(ft_info.r0khid, kh->r0khid, kh->r0khid_len);
+		ft_info.r0khid_len = kh->r0khid_len;
+		memcpy(ft_info.r1khid, kh->r1khid, 6);
 		ft_info.r1khid_present = true;
 		memcpy(ft_info.anonce, hs->anonce, 32);
 		memcpy(ft_info.snonce, hs->snonce, 32);
@@ -395,7 +396,9 @@ static int ft_parse_ies(struct handshake_state *hs,
 	is_rsn = hs->supplicant_ie != NULL;
 
 	if (is_rsn) {
-		if (!ft_verify_rsne(rsne, hs->pmk_r0_name, authenticator_ie))
+		struct handshake_ft *kh = handshake_state_get_ft(hs);
+
+		if (!ft_verify_rsne(rsne, kh->pmk_r0_name, authenticator_ie))
 			goto ft_error;
 	} else if (rsne)
 		goto ft_error;
@@ -435,6 +438,7 @@ static bool ft_parse_fte(struct handshake_state *hs,
 	 *   of this sequence.
 	 * - All other fields shall be set to 0."
 	 */
+	struct handshake_ft *kh = handshake_state_get_ft(hs);
 	uint8_t zeros[24] = {};
 	uint32_t kck_len = handshake_state_get_kck_len(hs);
 
@@ -449,9 +453,9 @@ static bool ft_parse_fte(struct handshake_state *hs,
 			memcmp(ft_info->mic, zeros, kck_len))
 		return false;
 
-	if (hs->r0khid_len != ft_info->r0khid_len ||
-			memcmp(hs->r0khid, ft_info->r0khid,
-				hs->r0khid_len) ||
+	if (kh->r0khid_len != ft_info->r0khid_len ||
+			memcmp(kh->r0khid, ft_info->r0khid,
+				kh->r0khid_len) ||
 			!ft_info->r1khid_present)
 		return false;
 
@@ -664,6 +668,7 @@ static int ft_rx_associate(struct auth_proto *ap, const uint8_t *frame,
 {
 	struct ft_sm *ft = l_container_of(ap, struct ft_sm, ap);
 	struct handshake_state *hs = ft->hs;
+	struct handshake_ft *kh = handshake_state_get_ft(hs);
 	uint32_t kck_len = handshake_state_get_kck_len(hs);
 	const uint8_t *rsne = NULL;
 	const uint8_t *mde = NULL;
@@ -700,7 +705,7 @@ static int ft_rx_associate(struct auth_proto *ap, const uint8_t *frame,
 			return -EBADMSG;
 
 		if (msg4_rsne.num_pmkids != 1 ||
-				memcmp(msg4_rsne.pmkids, hs->pmk_r1_name, 16))
+				memcmp(msg4_rsne.pmkids, kh->pmk_r1_name, 16))
 			return -EBADMSG;
 
 		if (!handshake_util_ap_ie_matches(&msg4_rsne,
@@ -748,11 +753,11 @@ static int ft_rx_associate(struct auth_proto *ap, const uint8_t *frame,
 				memcmp(ft_info.mic, mic, kck_len))
 			return -EBADMSG;
 
-		if (hs->r0khid_len != ft_info.r0khid_len ||
-				memcmp(hs->r0khid, ft_info.r0khid,
-					hs->r0khid_len) ||
+		if (kh->r0khid_len != ft_info.r0khid_len ||
+				memcmp(kh->r0khid, ft_info.r0khid,
+					kh->r0khid_len) ||
 				!ft_info.r1khid_present ||
-				memcmp(hs->r1khid, ft_info.r1khid, 6))
+				memcmp(kh->r1khid, ft_info.r1khid, 6))
 			return -EBADMSG;
 
 		if (memcmp(ft_info.anonce, hs->anonce, 32))
@@ -821,6 +826,7 @@ bool ft_build_authenticate_ies(struct handshake_state *hs, bool ocvc,
 				const uint8_t *new_snonce, uint8_t *buf,
 				size_t *len)
 {
+	struct handshake_ft *kh = handshake_state_get_ft(hs);
 	uint32_t kck_len = handshake_state_get_kck_len(hs);
 	bool is_rsn = hs->supplicant_ie != NULL;
 	uint8_t *ptr = buf;
@@ -845,7 +851,7 @@ bool ft_build_authenticate_ies(struct handshake_state *hs, bool ocvc,
 			return false;
 
 		rsn_info.num_pmkids = 1;
-		rsn_info.pmkids = hs->pmk_r0_name;
+		rsn_info.pmkids = kh->pmk_r0_name;
 		rsn_info.ocvc = ocvc;
 
 		ie_build_rsne(&rsn_info, ptr);
@@ -873,8 +879,8 @@ bool ft_build_authenticate_ies(struct handshake_state *hs, bool ocvc,
 
 		memset(&ft_info, 0, sizeof(ft_info));
 
-		memcpy(ft_info.r0khid, hs->r0khid, hs->r0khid_len);
-		ft_info.r0khid_len = hs->r0khid_len;
+		memcpy(ft_info.r0khid, kh->r0khid, kh->r0khid_len);
+		ft_info.r0khid_len = kh->r0khid_len;
 
 		memcpy(ft_info.snonce, new_snonce, 32);
 
@@ -42,6 +42,7 @@
 #include "src/util.h"
 #include "src/handshake.h"
 #include "src/erp.h"
+#include "src/pmksa.h"
 #include "src/band.h"
 
 static inline unsigned int n_ecc_groups(void)
@@ -76,6 +77,7 @@ static handshake_get_nonce_func_t get_nonce = handshake_get_nonce;
 static handshake_install_tk_func_t install_tk = NULL;
 static handshake_install_gtk_func_t install_gtk = NULL;
 static handshake_install_igtk_func_t install_igtk = NULL;
+static handshake_install_igtk_func_t install_bigtk = NULL;
 static handshake_install_ext_tk_func_t install_ext_tk = NULL;
 
 void __handshake_set_get_nonce_func(handshake_get_nonce_func_t func)
@@ -98,6 +100,11 @@ void __handshake_set_install_igtk_func(handshake_install_igtk_func_t func)
 	install_igtk = func;
 }
 
+void __handshake_set_install_bigtk_func(handshake_install_igtk_func_t func)
+{
+	install_bigtk = func;
+}
+
 void __handshake_set_install_ext_tk_func(handshake_install_ext_tk_func_t func)
 {
 	install_ext_tk = func;
@@ -125,8 +132,16 @@ void handshake_state_free(struct handshake_state *s)
 	if (s->erp_cache)
 		erp_cache_put(s->erp_cache);
 
+	if (s->pmksa)
+		pmksa_free(s->pmksa);
+
 	l_free(s->chandef);
 
+	if (s->ft) {
+		explicit_bzero(s->ft, sizeof(*s->ft));
+		l_free(s->ft);
+	}
+
 	if (s->passphrase) {
 		explicit_bzero(s->passphrase, strlen(s->passphrase));
 		l_free(s->passphrase);
@@ -141,16 +156,43 @@ void handshake_state_free(struct handshake_state *s)
 		l_free(s->ecc_sae_pts);
 	}
 
+	l_checksum_free(s->mic_checksum);
+
 	explicit_bzero(s, sizeof(*s));
 
 	if (destroy)
 		destroy(s);
 }
 
+/* Forget the cached PMK-R0 and any PMK-R1s derived from it */
+static void handshake_state_flush_ft_keys(struct handshake_state *s)
+{
+	s->have_pmk_r0 = false;
+
+	if (!s->ft)
+		return;
+
+	explicit_bzero(s->ft->pmk_r1_cache, sizeof(s->ft->pmk_r1_cache));
+	s->ft->pmk_r1_cache_next = 0;
+}
+
+/*
+ * Most connections never use FT, so the key hierarchy is only allocated
+ * the first time it is needed and stays until the handshake is freed
+ */
+struct handshake_ft *handshake_state_get_ft(struct handshake_state *s)
+{
+	if (!s->ft)
+		s->ft = l_new(struct handshake_ft, 1);
+
+	return s->ft;
+}
+
 void handshake_state_set_supplicant_address(struct handshake_state *s,
 						const uint8_t *spa)
 {
 	memcpy(s->spa, spa, sizeof(s->spa));
+	handshake_state_flush_ft_keys(s);
 }
 
 void handshake_state_set_authenticator_address(struct handshake_state *s,
@@ -170,6 +212,14 @@ void handshake_state_set_pmk(struct handshake_state *s, const uint8_t *pmk,
 	memcpy(s->pmk, pmk, pmk_len);
 	s->pmk_len = pmk_len;
 	s->have_pmk = true;
+	handshake_state_flush_ft_keys(s);
+
+	/* A fresh PMK, e.g. from a full EAP run, replaces the cached PMKSA */
+	if (s->pmksa) {
+		pmksa_free(s->pmksa);
+		s->pmksa = NULL;
+		s->have_pmkid = false;
+	}
 }
 
 void handshake_state_set_ptk(struct handshake_state *s, const uint8_t *ptk,
@@ -296,6 +346,7 @@ void handshake_state_set_ssid(struct handshake_state *s, const uint8_t *ssid,
 {
 	memcpy(s->ssid, ssid, ssid_len);
 	s->ssid_len = ssid_len;
+	handshake_state_flush_ft_keys(s);
 }
 
 void handshake_state_set_mde(struct handshake_state *s, const uint8_t *mde)
@@ -339,10 +390,12 @@ void handshake_state_set_kh_ids(struct handshake_state *s,
 				const uint8_t *r0khid, size_t r0khid_len,
 				const uint8_t *r1khid)
 {
-	memcpy(s->r0khid, r0khid, r0khid_len);
-	s->r0khid_len = r0khid_len;
+	struct handshake_ft *ft = handshake_state_get_ft(s);
 
-	memcpy(s->r1khid, r1khid, 6);
+	memcpy(ft->r0khid, r0khid, r0khid_len);
+	ft->r0khid_len = r0khid_len;
+
+	memcpy(ft->r1khid, r1khid, 6);
 }
 
 void handshake_state_set_event_func(struct handshake_state *s,
@@ -368,8 +421,11 @@ void handshake_state_set_fils_ft(struct handshake_state *s,
 					const uint8_t *fils_ft,
 					size_t fils_ft_len)
 {
-	memcpy(s->fils_ft, fils_ft, fils_ft_len);
-	s->fils_ft_len = fils_ft_len;
+	struct handshake_ft *ft = handshake_state_get_ft(s);
+
+	memcpy(ft->fils_ft, fils_ft, fils_ft_len);
+	ft->fils_ft_len = fils_ft_len;
+	handshake_state_flush_ft_keys(s);
 }
 
 /*
@@ -494,6 +550,128 @@ static bool handshake_get_key_sizes(struct handshake_state *s, size_t *ptk_size,
 	return true;
 }
 
+static bool handshake_state_derive_pmk_r0(struct handshake_state *s)
+{
+	uint16_t mdid;
+	const uint8_t *xxkey = s->pmk;
+	size_t xxkey_len = 32;
+	bool sha384 = (s->akm_suite & IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA384);
+	struct handshake_ft *ft = handshake_state_get_ft(s);
+
+	if (!s->mde || ie_parse_mobility_domain_from_data(s->mde,
+						s->mde[1] + 2,
+						&mdid, NULL, NULL) < 0)
+		return false;
+
+	/*
+	 * PMK-R0 only depends on the initial mobility domain association,
+	 * so it stays valid across FT roams to other R1KHs
+	 */
+	if (s->have_pmk_r0 && ft->pmk_r0_mdid == mdid &&
+			ft->pmk_r0_akm == s->akm_suite &&
+			ft->pmk_r0_khid_len == ft->r0khid_len &&
+			!memcmp(ft->pmk_r0_khid, ft->r0khid, ft->r0khid_len))
+		return true;
+
+	handshake_state_flush_ft_keys(s);
+
+	/*
+	 * In a Fast Transition initial mobility domain association
+	 * the PMK maps to the XXKey, except with EAP:
+	 * 802.11-2016 12.7.1.7.3:
+	 *    "If the AKM negotiated is 00-0F-AC:3, then [...] XXKey
+	 *    shall be the second 256 bits of the MSK (which is
+	 *    derived from the IEEE 802.1X authentication), i.e.,
+	 *    XXKey = L(MSK, 256, 256)."
+	 */
+	if (s->akm_suite == IE_RSN_AKM_SUITE_FT_OVER_8021X)
+		xxkey = s->pmk + 32;
+	else if (s->akm_suite & (IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA256 |
+				IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA384)) {
+		xxkey = ft->fils_ft;
+		xxkey_len = ft->fils_ft_len;
+	}
+
+	if (!crypto_derive_pmk_r0(xxkey, xxkey_len, s->ssid,
+					s->ssid_len, mdid,
+					ft->r0khid, ft->r0khid_len,
+					s->spa, sha384,
+					ft->pmk_r0, ft->pmk_r0_name))
+		return false;
+
+	memcpy(ft->pmk_r0_khid, ft->r0khid, ft->r0khid_len);
+	ft->pmk_r0_khid_len = ft->r0khid_len;
+	ft->pmk_r0_mdid = mdid;
+	ft->pmk_r0_akm = s->akm_suite;
+	s->have_pmk_r0 = true;
+
+	return true;
+}
+
+/*
+ * Look up the PMK-R1 for @r1khid, deriving and caching it if necessary.
+ * The cache holds the most recently derived HANDSHAKE_PMK_R1_CACHE_SIZE
+ * entries.  @out_pmk_r1 and @out_pmk_r1_name can be NULL.
+ */
+static bool handshake_state_get_pmk_r1(struct handshake_state *s,
+					const uint8_t *r1khid,
+					uint8_t *out_pmk_r1,
+					uint8_t *out_pmk_r1_name)
+{
+	bool sha384 = (s->akm_suite & IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA384);
+	struct handshake_ft *ft = handshake_state_get_ft(s);
+	struct handshake_pmk_r1 *entry;
+	unsigned int i;
+
+	if (!handshake_state_derive_pmk_r0(s))
+		return false;
+
+	for (i = 0; i < HANDSHAKE_PMK_R1_CACHE_SIZE; i++) {
+		entry = &ft->pmk_r1_cache[i];
+
+		if (entry->valid && !memcmp(entry->r1khid, r1khid, 6))
+			goto done;
+	}
+
+	entry = &ft->pmk_r1_cache[ft->pmk_r1_cache_next];
+	ft->pmk_r1_cache_next = (ft->pmk_r1_cache_next + 1) %
+					HANDSHAKE_PMK_R1_CACHE_SIZE;
+
+	if (!crypto_derive_pmk_r1(ft->pmk_r0, r1khid, s->spa,
+					ft->pmk_r0_name, sha384,
+					entry->pmk_r1, entry->pmk_r1_name)) {
+		entry->valid = false;
+		return false;
+	}
+
+	memcpy(entry->r1khid, r1khid, 6);
+	entry->valid = true;
+
+done:
+	if (out_pmk_r1) {
+		memcpy(out_pmk_r1, entry->pmk_r1, sizeof(entry->pmk_r1));
+		memcpy(out_pmk_r1_name, entry->pmk_r1_name,
+					sizeof(entry->pmk_r1_name));
+	}
+
+	return true;
+}
+
+/*
+ * Speculatively derive the PMK-R1 for a likely FT roam target so that only
+ * the PTK derivation, which needs the nonces, is left once the FT
+ * Authentication response arrives.  Only possible once the initial
+ * mobility domain association has produced a PMK-R0.
+ */
+bool handshake_state_precompute_pmk_r1(struct handshake_state *s,
+					const uint8_t *r1khid)
+{
+	if (!IE_AKM_IS_FT(s->akm_suite) || !s->have_pmk_r0)
+		return false;
+
+	return handshake_state_get_pmk_r1(s, r1khid, NULL, NULL);
+}
+
 bool handshake_state_derive_ptk(struct handshake_state *s)
 {
 	size_t ptk_size;
@@ -544,46 +722,16 @@ bool handshake_state_derive_ptk(struct handshake_state *s)
 				IE_RSN_AKM_SUITE_FT_OVER_SAE_SHA256 |
 				IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA256 |
 				IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA384)) {
-		uint16_t mdid;
 		uint8_t ptk_name[16];
-		const uint8_t *xxkey = s->pmk;
-		size_t xxkey_len = 32;
 		bool sha384 = (s->akm_suite &
 					IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA384);
+		struct handshake_ft *ft = handshake_state_get_ft(s);
 
-		/*
-		 * In a Fast Transition initial mobility domain association
-		 * the PMK maps to the XXKey, except with EAP:
-		 * 802.11-2016 12.7.1.7.3:
-		 *    "If the AKM negotiated is 00-0F-AC:3, then [...] XXKey
-		 *    shall be the second 256 bits of the MSK (which is
-		 *    derived from the IEEE 802.1X authentication), i.e.,
-		 *    XXKey = L(MSK, 256, 256)."
-		 */
-		if (s->akm_suite == IE_RSN_AKM_SUITE_FT_OVER_8021X)
-			xxkey = s->pmk + 32;
-		else if (s->akm_suite & (IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA256 |
-				IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA384)) {
-			xxkey = s->fils_ft;
-			xxkey_len = s->fils_ft_len;
-		}
-
-		ie_parse_mobility_domain_from_data(s->mde, s->mde[1] + 2,
-							&mdid, NULL, NULL);
-
-		if (!crypto_derive_pmk_r0(xxkey, xxkey_len, s->ssid,
-						s->ssid_len, mdid,
-						s->r0khid, s->r0khid_len,
-						s->spa, sha384,
-						s->pmk_r0, s->pmk_r0_name))
+		if (!handshake_state_get_pmk_r1(s, ft->r1khid, ft->pmk_r1,
+							ft->pmk_r1_name))
 			return false;
 
-		if (!crypto_derive_pmk_r1(s->pmk_r0, s->r1khid, s->spa,
-						s->pmk_r0_name, sha384,
-						s->pmk_r1, s->pmk_r1_name))
-			return false;
-
-		if (!crypto_derive_ft_ptk(s->pmk_r1, s->pmk_r1_name, s->aa,
+		if (!crypto_derive_ft_ptk(ft->pmk_r1, ft->pmk_r1_name, s->aa,
 						s->spa, s->snonce, s->anonce,
 						sha384, s->ptk, ptk_size,
 						ptk_name))
@@ -722,6 +870,22 @@ void handshake_state_install_igtk(struct handshake_state *s,
 	}
 }
 
+/* The BIGTK uses the same BIP cipher as the IGTK, 802.11-2020 12.5.4 */
+void handshake_state_install_bigtk(struct handshake_state *s,
+					uint16_t bigtk_key_index,
+					const uint8_t *bigtk, size_t bigtk_len,
+					const uint8_t *bipn)
+{
+	if (install_bigtk) {
+		uint32_t cipher =
+			ie_rsn_cipher_suite_to_cipher(
+						s->group_management_cipher);
+
+		install_bigtk(s, bigtk_key_index, bigtk, bigtk_len,
+				bipn, 6, cipher);
+	}
+}
+
 void handshake_state_override_pairwise_cipher(struct handshake_state *s,
 					enum ie_rsn_cipher_suite pairwise)
 {
@@ -734,6 +898,60 @@ void handshake_state_set_pmkid(struct handshake_state *s, const uint8_t *pmkid)
 	s->have_pmkid = true;
 }
 
+/*
+ * Use a PMKSA taken from the cache for this connection.  The handshake
+ * takes ownership, the PMKSA is returned to the cache by
+ * handshake_state_cache_pmksa once the connection succeeds.
+ */
+void handshake_state_set_pmksa(struct handshake_state *s,
+				struct pmksa *pmksa)
+{
+	handshake_state_set_pmk(s, pmksa->pmk, pmksa->pmk_len);
+	handshake_state_set_pmkid(s, pmksa->pmkid);
+	s->pmksa = pmksa;
+}
+
+/*
+ * Called once a connection has been established.  For AKMs that allow
+ * PMKSA caching, put the PMKSA used (or newly created) into the cache so
+ * it can be used for reconnecting to the same BSS.
+ */
+void handshake_state_cache_pmksa(struct handshake_state *s)
+{
+	struct pmksa *pmksa = l_steal_ptr(s->pmksa);
+
+	if (pmksa) {
+		pmksa_cache_put(pmksa);
+		return;
+	}
+
+	if (!(s->akm_suite & (IE_RSN_AKM_SUITE_8021X |
+				IE_RSN_AKM_SUITE_8021X_SHA256 |
+				IE_RSN_AKM_SUITE_SAE_SHA256)))
+		return;
+
+	if (!s->have_pmk || s->pmk_len > sizeof(pmksa->pmk))
+		return;
+
+	pmksa = l_new(struct pmksa, 1);
+
+	if (!handshake_state_get_pmkid(s, pmksa->pmkid)) {
+		pmksa_free(pmksa);
+		return;
+	}
+
+	pmksa->expiration = l_time_offset(l_time_now(), pmksa_lifetime());
+	memcpy(pmksa->spa, s->spa, 6);
+	memcpy(pmksa->aa, s->aa, 6);
+	memcpy(pmksa->ssid, s->ssid, s->ssid_len);
+	pmksa->ssid_len = s->ssid_len;
+	pmksa->akm = s->akm_suite;
+	memcpy(pmksa->pmk, s->pmk, s->pmk_len);
+	pmksa->pmk_len = s->pmk_len;
+
+	pmksa_cache_put(pmksa);
+}
+
 bool handshake_state_get_pmkid(struct handshake_state *s, uint8_t *out_pmkid)
 {
 	bool use_sha256;
@@ -780,6 +998,21 @@ void handshake_state_set_gtk(struct handshake_state *s, const uint8_t *key,
 	memcpy(s->gtk_rsc, rsc, 6);
 }
 
+void handshake_state_set_igtk(struct handshake_state *s, const uint8_t *key,
+				unsigned int key_index, const uint8_t *ipn)
+{
+	enum crypto_cipher cipher =
+		ie_rsn_cipher_suite_to_cipher(s->group_management_cipher);
+	int key_len = crypto_cipher_key_len(cipher);
+
+	if (!key_len)
+		return;
+
+	memcpy(s->igtk, key, key_len);
+	s->igtk_index = key_index;
+	memcpy(s->igtk_ipn, ipn, 6);
+}
+
 /*
  * This function performs a match of the RSN/WPA IE obtained from the scan
  * results vs the RSN/WPA IE obtained as part of the 4-way handshake.  If they
@@ -939,6 +1172,33 @@ const uint8_t *handshake_util_find_igtk_kde(const uint8_t *data,
 	return igtk;
 }
 
+const uint8_t *handshake_util_find_bigtk_kde(const uint8_t *data,
+						size_t data_len,
+						size_t *out_bigtk_len)
+{
+	size_t bigtk_len;
+	const uint8_t *bigtk = handshake_util_find_kde(HANDSHAKE_KDE_BIGTK,
+						data, data_len, &bigtk_len);
+
+	if (!bigtk)
+		return NULL;
+
+	/*
+	 * Account for KeyId and BIPN
+	 * See 802.11-2020, Figure 12-59
+	 */
+	if (bigtk_len < CRYPTO_MIN_IGTK_LEN + 8)
+		return NULL;
+
+	if (bigtk_len > CRYPTO_MAX_IGTK_LEN + 8)
+		return NULL;
+
+	if (out_bigtk_len)
+		*out_bigtk_len = bigtk_len;
+
+	return bigtk;
+}
+
 const uint8_t *handshake_util_find_pmkid_kde(const uint8_t *data,
 						size_t data_len)
 {
@@ -969,6 +1229,25 @@ void handshake_util_build_gtk_kde(enum crypto_cipher cipher, const uint8_t *key,
 	memcpy(to, key, key_len);
 }
 
+/* Defined in 802.11-2016 12.7.2 j), Figure 12-42 */
+void handshake_util_build_igtk_kde(enum crypto_cipher cipher,
+					const uint8_t *key,
+					unsigned int key_index,
+					const uint8_t *ipn, uint8_t *to)
+{
+	size_t key_len = crypto_cipher_key_len(cipher);
+
+	*to++ = IE_TYPE_VENDOR_SPECIFIC;
+	*to++ = 12 + key_len;
+	l_put_be32(HANDSHAKE_KDE_IGTK, to);
+	to += 4;
+	l_put_le16(key_index, to);
+	to += 2;
+	memcpy(to, ipn, 6);
+	to += 6;
+	memcpy(to, key, key_len);
+}
+
 static const uint8_t *handshake_state_get_ft_fils_kek(struct handshake_state *s,
 						size_t *len)
 {
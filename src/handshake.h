@@ -28,6 +28,7 @@
 struct handshake_state;
 enum crypto_cipher;
 struct eapol_frame;
+struct pmksa;
 
 enum handshake_kde {
 	/* 802.11-2020 Table 12-9 in section 12.7.2 */
@@ -60,6 +61,7 @@ enum handshake_event {
 	HANDSHAKE_EVENT_EAP_NOTIFY,
 	HANDSHAKE_EVENT_TRANSITION_DISABLE,
 	HANDSHAKE_EVENT_P2P_IP_REQUEST,
+	HANDSHAKE_EVENT_GROUP_REKEY_COMPLETE,
 };
 
 typedef void (*handshake_event_func_t)(struct handshake_state *hs,
@@ -90,8 +92,41 @@ void __handshake_set_get_nonce_func(handshake_get_nonce_func_t func);
 void __handshake_set_install_tk_func(handshake_install_tk_func_t func);
 void __handshake_set_install_gtk_func(handshake_install_gtk_func_t func);
 void __handshake_set_install_igtk_func(handshake_install_igtk_func_t func);
+void __handshake_set_install_bigtk_func(handshake_install_igtk_func_t func);
 void __handshake_set_install_ext_tk_func(handshake_install_ext_tk_func_t func);
 
+/* Number of speculatively derived PMK-R1s kept for expected FT roams */
+#define HANDSHAKE_PMK_R1_CACHE_SIZE 3
+
+struct handshake_pmk_r1 {
+	uint8_t r1khid[6];
+	uint8_t pmk_r1[48];
+	uint8_t pmk_r1_name[16];
+	bool valid;
+};
+
+/*
+ * Fast Transition key hierarchy, only allocated for the connections that
+ * end up needing it, see handshake_state_get_ft()
+ */
+struct handshake_ft {
+	uint8_t pmk_r0[48];
+	uint8_t pmk_r0_name[16];
+	uint8_t pmk_r1[48];
+	uint8_t pmk_r1_name[16];
+	struct handshake_pmk_r1 pmk_r1_cache[HANDSHAKE_PMK_R1_CACHE_SIZE];
+	unsigned int pmk_r1_cache_next;
+	uint8_t pmk_r0_khid[48];
+	size_t pmk_r0_khid_len;
+	uint16_t pmk_r0_mdid;
+	enum ie_rsn_akm_suite pmk_r0_akm;
+	uint8_t fils_ft[48];
+	uint8_t fils_ft_len;
+	uint8_t r0khid[48];
+	size_t r0khid_len;
+	uint8_t r1khid[6];
+};
+
 struct handshake_state {
 	uint32_t ifindex;
 	uint8_t spa[6];
@@ -113,15 +148,14 @@ struct handshake_state {
 	uint8_t snonce[32];
 	uint8_t anonce[32];
 	uint8_t ptk[136];
-	uint8_t pmk_r0[48];
-	uint8_t pmk_r0_name[16];
-	uint8_t pmk_r1[48];
-	uint8_t pmk_r1_name[16];
+	struct handshake_ft *ft;
 	uint8_t pmkid[16];
-	uint8_t fils_ft[48];
-	uint8_t fils_ft_len;
 	struct l_settings *settings_8021x;
 	struct l_ecc_point **ecc_sae_pts;
+	struct l_checksum *mic_checksum;	/* Cached EAPoL-Key MIC context */
+	uint8_t mic_kck[32];
+	uint8_t mic_version;
+	size_t mic_len;
 	bool have_snonce : 1;
 	bool ptk_complete : 1;
 	bool wpa_ie : 1;
@@ -137,18 +171,20 @@ struct handshake_state {
 	bool authenticator_ocvc : 1;
 	bool supplicant_ocvc : 1;
 	bool ext_key_id_capable : 1;
+	bool have_pmk_r0 : 1;
 	uint8_t ssid[32];
 	size_t ssid_len;
 	char *passphrase;
-	uint8_t r0khid[48];
-	size_t r0khid_len;
-	uint8_t r1khid[6];
 	uint8_t gtk[32];
 	uint8_t gtk_rsc[6];
 	uint8_t proto_version : 2;
 	unsigned int gtk_index;
+	uint8_t igtk[32];
+	uint8_t igtk_ipn[6];
+	unsigned int igtk_index;
 	uint8_t active_tk_index;
 	struct erp_cache_entry *erp_cache;
+	struct pmksa *pmksa;
 	bool support_ip_allocation : 1;
 	uint32_t client_ip_addr;
 	uint32_t subnet_mask;
@@ -241,7 +277,13 @@ void handshake_state_new_anonce(struct handshake_state *s);
 void handshake_state_set_anonce(struct handshake_state *s,
 				const uint8_t *anonce);
 void handshake_state_set_pmkid(struct handshake_state *s, const uint8_t *pmkid);
+void handshake_state_set_pmksa(struct handshake_state *s,
+				struct pmksa *pmksa);
+void handshake_state_cache_pmksa(struct handshake_state *s);
 bool handshake_state_derive_ptk(struct handshake_state *s);
+struct handshake_ft *handshake_state_get_ft(struct handshake_state *s);
+bool handshake_state_precompute_pmk_r1(struct handshake_state *s,
+					const uint8_t *r1khid);
 size_t handshake_state_get_ptk_size(struct handshake_state *s);
 size_t handshake_state_get_kck_len(struct handshake_state *s);
 const uint8_t *handshake_state_get_kck(struct handshake_state *s);
@@ -264,6 +306,11 @@ void handshake_state_install_igtk(struct handshake_state *s,
 					const uint8_t *igtk, size_t igtk_len,
 					const uint8_t *ipn);
 
+void handshake_state_install_bigtk(struct handshake_state *s,
+					uint16_t bigtk_key_index,
+					const uint8_t *bigtk, size_t bigtk_len,
+					const uint8_t *bipn);
+
 void handshake_state_override_pairwise_cipher(struct handshake_state *s,
 					enum ie_rsn_cipher_suite pairwise);
 
@@ -274,6 +321,8 @@ bool handshake_decode_fte_key(struct handshake_state *s, const uint8_t *wrapped,
 
 void handshake_state_set_gtk(struct handshake_state *s, const uint8_t *key,
 				unsigned int key_index, const uint8_t *rsc);
+void handshake_state_set_igtk(struct handshake_state *s, const uint8_t *key,
+				unsigned int key_index, const uint8_t *ipn);
 
 void handshake_state_set_chandef(struct handshake_state *s,
 					struct band_chandef *chandef);
@@ -290,7 +339,13 @@ const uint8_t *handshake_util_find_gtk_kde(const uint8_t *data, size_t data_len,
 					size_t *out_gtk_len);
 const uint8_t *handshake_util_find_igtk_kde(const uint8_t *data,
 					size_t data_len, size_t *out_igtk_len);
+const uint8_t *handshake_util_find_bigtk_kde(const uint8_t *data,
+					size_t data_len, size_t *out_bigtk_len);
 const uint8_t *handshake_util_find_pmkid_kde(const uint8_t *data,
 					size_t data_len);
 void handshake_util_build_gtk_kde(enum crypto_cipher cipher, const uint8_t *key,
 					unsigned int key_index, uint8_t *to);
+void handshake_util_build_igtk_kde(enum crypto_cipher cipher,
+					const uint8_t *key,
+					unsigned int key_index,
+					const uint8_t *ipn, uint8_t *to);
@@ -30,6 +30,7 @@
 
 #include <ell/ell.h>
 
+#include "ell/useful.h"
 #include "src/iwd.h"
 #include "src/module.h"
 #include "src/common.h"
@@ -39,10 +40,31 @@
 #include "src/knownnetworks.h"
 #include "src/storage.h"
 #include "src/scan.h"
+#include "src/hotspot.h"
 
 static struct l_dir_watch *hs20_dir_watch;
 static struct l_queue *hs20_settings;
 
+/*
+ * The profiles indexed by NAI realm, HESSID and Roaming Consortium OI so
+ * that scan results and ANQP responses are matched without going through
+ * every profile.  Each key maps to the profiles using it, oldest first.
+ * As with known_networks_find_hotspot the profile added first wins.
+ */
+static struct l_hashmap *hs20_realm_index;
+static struct l_hashmap *hs20_hessid_index;
+static struct l_hashmap *hs20_oi_index;
+static unsigned int hs20_next_seq;
+static struct l_hashmap *hs20_dir_events;
+static struct l_timeout *hs20_dir_events_timeout;
+
+#define HS20_DIR_WATCH_DELAY_MS	500
+
+enum {
+	HS20_DIR_EVENT_ATTRIB = 1,
+	HS20_DIR_EVENT_RELOAD,
+};
+
 struct hs20_config {
 	struct network_info super;
 	char *filename;
@@ -52,6 +74,7 @@ struct hs20_config {
 	size_t rc_len;
 	char *object_path;
 	char *name;
+	unsigned int seq;
 };
 
 static bool match_filename(const void *a, const void *b)
@@ -65,11 +88,134 @@ static bool match_filename(const void *a, const void *b)
 	return false;
 }
 
+static const char *hs20_oi_key(const uint8_t *oi, size_t oi_len,
+				char *buf)
+{
+	size_t i;
+
+	for (i = 0; i < oi_len; i++)
+		sprintf(buf + i * 2, "%02x", oi[i]);
+
+	return buf;
+}
+
+static void hs20_index_add(struct l_hashmap *index, const char *key,
+				struct hs20_config *config)
+{
+	struct l_queue *configs = l_hashmap_lookup(index, key);
+
+	if (!configs) {
+		configs = l_queue_new();
+		l_hashmap_insert(index, key, configs);
+	}
+
+	l_queue_push_tail(configs, config);
+}
+
+static void hs20_index_remove(struct l_hashmap *index, const char *key,
+				struct hs20_config *config)
+{
+	struct l_queue *configs = l_hashmap_lookup(index, key);
+
+	if (!configs)
+		return;
+
+	l_queue_remove(configs, config);
+
+	if (!l_queue_isempty(configs))
+		return;
+
+	l_hashmap_remove(index, key);
+	l_queue_destroy(configs, NULL);
+}
+
+static void hs20_index_entry_free(void *data)
+{
+	l_queue_destroy(data, NULL);
+}
+
+/* Returns whichever of best and the oldest profile under key came first */
+static struct hs20_config *hs20_index_lookup(struct l_hashmap *index,
+						const char *key,
+						struct hs20_config *best)
+{
+	struct hs20_config *config =
+			l_queue_peek_head(l_hashmap_lookup(index, key));
+
+	if (config && (!best || config->seq < best->seq))
+		return config;
+
+	return best;
+}
+
+static void hs20_config_index(struct hs20_config *config, bool add)
+{
+	void (*op)(struct l_hashmap *, const char *, struct hs20_config *) =
+				add ? hs20_index_add : hs20_index_remove;
+	char oi_buf[11];
+	char **realm;
+
+	for (realm = config->nai_realms; realm && *realm; realm++)
+		op(hs20_realm_index, *realm, config);
+
+	if (!l_memeqzero(config->hessid, 6))
+		op(hs20_hessid_index, util_address_to_string(config->hessid),
+			config);
+
+	if (config->rc)
+		op(hs20_oi_index, hs20_oi_key(config->rc, config->rc_len,
+						oi_buf), config);
+}
+
+struct network_info *hotspot_find_by_nai_realms(const char **nai_realms)
+{
+	struct hs20_config *best = NULL;
+
+	for (; nai_realms && *nai_realms; nai_realms++)
+		best = hs20_index_lookup(hs20_realm_index, *nai_realms, best);
+
+	return best ? &best->super : NULL;
+}
+
+struct network_info *hotspot_find_by_bss(const struct scan_bss *bss)
+{
+	struct hs20_config *best = NULL;
+	const uint8_t *oi[3];
+	size_t oi_len[3];
+	char oi_buf[11];
+	unsigned int i;
+
+	if (!l_memeqzero(bss->hessid, 6))
+		best = hs20_index_lookup(hs20_hessid_index,
+					util_address_to_string(bss->hessid),
+					best);
+
+	if (!bss->rc_ie || ie_parse_roaming_consortium_from_data(bss->rc_ie,
+						bss->rc_ie[1] + 2, NULL,
+						&oi[0], &oi_len[0],
+						&oi[1], &oi_len[1],
+						&oi[2], &oi_len[2]) < 0)
+		goto done;
+
+	for (i = 0; i < L_ARRAY_SIZE(oi); i++) {
+		if (!oi[i] || (oi_len[i] != 3 && oi_len[i] != 5))
+			continue;
+
+		best = hs20_index_lookup(hs20_oi_index,
+					hs20_oi_key(oi[i], oi_len[i], oi_buf),
+					best);
+	}
+
+done:
+	return best ? &best->super : NULL;
+}
+
 static void hs20_config_free(void *user_data)
 {
 	struct hs20_config *config = user_data;
 
 	l_queue_remove(hs20_settings, config);
+	hs20_config_index(config, false);
 
 	l_strv_free(config->nai_realms);
 	l_free(config->rc);
@@ -236,7 +382,7 @@ static const uint8_t *hotspot_match_roaming_consortium(
 		return rc2;
 	}
 
-	if (rc3 && rc1_len == config->rc_len &&
+	if (rc3 && rc3_len == config->rc_len &&
 				!memcmp(rc3, config->rc, rc3_len)) {
 		if (rc_len_out)
 			*rc_len_out = rc3_len;
@@ -390,7 +536,9 @@ static struct hs20_config *hs20_config_new(struct l_settings *settings,
 	config->name = name;
 	config->filename = l_strdup(filename);
 	config->super.ops = &hotspot_ops;
+	config->seq = hs20_next_seq++;
 
+	hs20_config_index(config, true);
 	known_networks_add(&config->super);
 
 	return config;
@@ -404,86 +552,113 @@ free_values:
 	return NULL;
 }
 
-static void hs20_dir_watch_cb(const char *filename,
-				enum l_dir_watch_event event,
-				void *user_data)
+/*
+ * As in knownnetworks.c the watch events are coalesced per file and the
+ * files of a burst are reconciled once, HS20_DIR_WATCH_DELAY_MS after
+ * the first event, against their final state on disk.
+ */
+static void hs20_reconcile_file(const void *key, void *value,
+					void *user_data)
 {
+	const char *filename = key;
+	unsigned int event = L_PTR_TO_UINT(value);
 	struct l_settings *new;
-	uint64_t connected_time;
 	struct hs20_config *hs20;
 	struct network_config config;
 
 	L_AUTO_FREE_VAR(char *, full_path) = NULL;
 
-	/*
-	 * Ignore notifications for the actual directory, we can't do
-	 * anything about some of them anyway.  Only react to
-	 * notifications for files in the storage directory.
-	 */
-	if (!filename)
+	full_path = storage_get_hotspot_path("%s", filename);
+	hs20 = l_queue_find(hs20_settings, match_filename, full_path);
+
+	if (event == HS20_DIR_EVENT_ATTRIB) {
+		if (hs20)
+			known_network_set_connected_time(&hs20->super,
+						l_path_get_mtime(full_path));
+
 		return;
+	}
 
-	full_path = storage_get_hotspot_path("%s", filename);
+	new = l_settings_new();
 
-	switch (event) {
-	case L_DIR_WATCH_EVENT_CREATED:
-		new = l_settings_new();
+	if (!l_settings_load_from_file(new, full_path)) {
+		l_settings_free(new);
 
-		if (!l_settings_load_from_file(new, full_path)) {
-			l_settings_free(new);
-			return;
+		/* File removed or no longer readable */
+		if (hs20) {
+			l_queue_remove(hs20_settings, hs20);
+			known_networks_remove(&hs20->super);
 		}
 
-		__network_config_parse(new, full_path, &config);
+		return;
+	}
 
-		hs20 = hs20_config_new(new, full_path, &config);
-		l_settings_free(new);
+	__network_config_parse(new, full_path, &config);
 
-		if (!hs20)
-			return;
+	if (hs20) {
+		known_network_update(&hs20->super, &config);
 
-		l_queue_push_head(hs20_settings, hs20);
-		break;
-	case L_DIR_WATCH_EVENT_REMOVED:
-		hs20 = l_queue_remove_if(hs20_settings, match_filename,
-						full_path);
-		if (!hs20)
-			return;
+		/* TODO: Update hotspot specific settings */
+	} else {
+		hs20 = hs20_config_new(new, full_path, &config);
+		if (hs20)
+			l_queue_push_head(hs20_settings, hs20);
+	}
 
-		known_networks_remove(&hs20->super);
-		break;
-	case L_DIR_WATCH_EVENT_MODIFIED:
-		hs20 = l_queue_find(hs20_settings, match_filename, full_path);
-		if (!hs20)
-			return;
+	l_settings_free(new);
+}
 
-		new = l_settings_new();
+static void hs20_dir_watch_timeout(struct l_timeout *timeout, void *user_data)
+{
+	struct l_hashmap *events = l_steal_ptr(hs20_dir_events);
 
-		if (!l_settings_load_from_file(new, full_path)) {
-			l_settings_free(new);
-			return;
-		}
+	l_timeout_remove(l_steal_ptr(hs20_dir_events_timeout));
 
-		__network_config_parse(new, full_path, &config);
-		known_network_update(&hs20->super, &config);
+	l_hashmap_foreach(events, hs20_reconcile_file, NULL);
+	l_hashmap_destroy(events, NULL);
+}
 
-		/* TODO: Update hotspot specific settings */
+static void hs20_dir_watch_cb(const char *filename,
+				enum l_dir_watch_event event,
+				void *user_data)
+{
+	unsigned int type;
 
-		l_settings_free(new);
+	/*
+	 * Ignore notifications for the actual directory, we can't do
+	 * anything about some of them anyway.  Only react to
+	 * notifications for files in the storage directory.
+	 */
+	if (!filename)
+		return;
 
-		break;
-	case L_DIR_WATCH_EVENT_ACCESSED:
+	switch (event) {
+	case L_DIR_WATCH_EVENT_CREATED:
+	case L_DIR_WATCH_EVENT_REMOVED:
+	case L_DIR_WATCH_EVENT_MODIFIED:
+		type = HS20_DIR_EVENT_RELOAD;
 		break;
 	case L_DIR_WATCH_EVENT_ATTRIB:
-		hs20 = l_queue_find(hs20_settings, match_filename, full_path);
-		if (!hs20)
-			return;
-
-		connected_time = l_path_get_mtime(full_path);
-		known_network_set_connected_time(&hs20->super,
-							connected_time);
+		type = HS20_DIR_EVENT_ATTRIB;
 		break;
+	default:
+		return;
 	}
+
+	if (!hs20_dir_events)
+		hs20_dir_events = l_hashmap_string_new();
+
+	if (L_PTR_TO_UINT(l_hashmap_lookup(hs20_dir_events, filename)) >= type)
+		return;
+
+	l_hashmap_replace(hs20_dir_events, filename, L_UINT_TO_PTR(type),
+				NULL);
+
+	if (!hs20_dir_events_timeout)
+		hs20_dir_events_timeout = l_timeout_create_ms(
+						HS20_DIR_WATCH_DELAY_MS,
+						hs20_dir_watch_timeout,
+						NULL, NULL);
 }
 
 static void hs20_dir_watch_destroy(void *user_data)
@@ -503,6 +678,9 @@ static int hotspot_init(void)
 		return -ENOENT;
 
 	hs20_settings = l_queue_new();
+	hs20_realm_index = l_hashmap_string_new();
+	hs20_hessid_index = l_hashmap_string_new();
+	hs20_oi_index = l_hashmap_string_new();
 
 	while ((dirent = readdir(dir))) {
 		struct hs20_config *hs20;
@@ -546,9 +724,19 @@ next:
 static void hotspot_exit(void)
 {
 	l_dir_watch_destroy(hs20_dir_watch);
+	l_timeout_remove(l_steal_ptr(hs20_dir_events_timeout));
+	l_hashmap_destroy(hs20_dir_events, NULL);
+	hs20_dir_events = NULL;
 
 	l_queue_destroy(hs20_settings, NULL);
 	hs20_settings = NULL;
+
+	l_hashmap_destroy(hs20_realm_index, hs20_index_entry_free);
+	hs20_realm_index = NULL;
+	l_hashmap_destroy(hs20_hessid_index, hs20_index_entry_free);
+	hs20_hessid_index = NULL;
+	l_hashmap_destroy(hs20_oi_index, hs20_index_entry_free);
+	hs20_oi_index = NULL;
 }
 
 IWD_MODULE(hotspot, hotspot_init, hotspot_exit)
@@ -219,6 +219,175 @@ void *ie_tlv_extract_wfd_payload(const unsigned char *ies, size_t len,
 					ies, len, true, out_len);
 }
 
+/*
+ * Index a buffer in one pass.  Only the first element with a given tag is
+ * recorded, later ones can still be reached by continuing the iterator
+ * returned by ie_index_get().  Vendor specific elements are the exception:
+ * all of them are recorded, up to IE_INDEX_MAX_VENDOR, since several
+ * vendor payloads are extracted from the same buffer.
+ */
+void ie_index_init(struct ie_index *index, const unsigned char *ies,
+			unsigned int len)
+{
+	struct ie_tlv_iter iter;
+
+	ie_index_reset(index, ies, len);
+	ie_tlv_iter_init(&iter, ies, index->len);
+
+	while (ie_tlv_iter_next(&iter))
+		ie_index_add(index, &iter);
+}
+
+/*
+ * Callers already walking the buffer can build the index as they go with
+ * ie_index_reset() followed by ie_index_add() for each element.
+ */
+void ie_index_reset(struct ie_index *index, const unsigned char *ies,
+			unsigned int len)
+{
+	memset(index, 0, sizeof(*index));
+	index->ies = ies;
+	index->len = L_MIN(len, (unsigned int) UINT16_MAX);
+}
+
+void ie_index_add(struct ie_index *index, const struct ie_tlv_iter *iter)
+{
+	unsigned int tag = ie_tlv_iter_get_tag(iter);
+	unsigned int offset = iter->data - index->ies - (tag >= 256 ? 3 : 2);
+
+	if (tag >= L_ARRAY_SIZE(index->first) || offset >= index->len)
+		return;
+
+	if (!index->first[tag])
+		index->first[tag] = offset + 1;
+
+	if (tag != IE_TYPE_VENDOR_SPECIFIC)
+		return;
+
+	if (index->n_vendor == IE_INDEX_MAX_VENDOR) {
+		index->vendor_overflow = true;
+		return;
+	}
+
+	index->vendor[index->n_vendor++] = offset;
+}
+
+/*
+ * Points @iter at the first element with @tag.  On success the element is
+ * the iterator's current one and ie_tlv_iter_next() moves on to the
+ * elements following it.
+ */
+bool ie_index_get(const struct ie_index *index, unsigned int tag,
+			struct ie_tlv_iter *iter)
+{
+	unsigned int offset;
+
+	if (tag >= L_ARRAY_SIZE(index->first) || !index->first[tag])
+		return false;
+
+	offset = index->first[tag] - 1;
+
+	ie_tlv_iter_init(iter, index->ies + offset, index->len - offset);
+
+	return ie_tlv_iter_next(iter);
+}
+
+static bool ie_index_vendor_match(const unsigned char *ie,
+					const unsigned char oui[],
+					unsigned char type)
+{
+	return ie[1] >= 4 && !memcmp(ie + 2, oui, 3) && ie[5] == type;
+}
+
+bool ie_index_has_vendor(const struct ie_index *index,
+				const unsigned char oui[], unsigned char type)
+{
+	unsigned int i;
+
+	if (index->vendor_overflow)
+		return index->first[IE_TYPE_VENDOR_SPECIFIC] != 0;
+
+	for (i = 0; i < index->n_vendor; i++)
+		if (ie_index_vendor_match(index->ies + index->vendor[i],
+						oui, type))
+			return true;
+
+	return false;
+}
+
+/* Same as ie_tlv_vendor_ie_concat but only visits the vendor elements */
+static void *ie_index_vendor_ie_concat(const struct ie_index *index,
+					const unsigned char oui[],
+					unsigned char type,
+					bool empty_ok,
+					ssize_t *out_len)
+{
+	unsigned int concat_len = 0;
+	unsigned char *ret;
+	bool ie_found = false;
+	unsigned int i;
+
+	if (index->vendor_overflow)
+		return ie_tlv_vendor_ie_concat(oui, type, index->ies,
+						index->len, empty_ok, out_len);
+
+	for (i = 0; i < index->n_vendor; i++) {
+		const unsigned char *ie = index->ies + index->vendor[i];
+
+		if (!ie_index_vendor_match(ie, oui, type))
+			continue;
+
+		concat_len += ie[1] - 4;
+		ie_found = true;
+	}
+
+	if (concat_len == 0) {
+		if (out_len)
+			*out_len = (ie_found && empty_ok) ? 0 : -ENOENT;
+
+		return NULL;
+	}
+
+	ret = l_malloc(concat_len);
+	concat_len = 0;
+
+	for (i = 0; i < index->n_vendor; i++) {
+		const unsigned char *ie = index->ies + index->vendor[i];
+
+		if (!ie_index_vendor_match(ie, oui, type))
+			continue;
+
+		memcpy(ret + concat_len, ie + 6, ie[1] - 4);
+		concat_len += ie[1] - 4;
+	}
+
+	if (out_len)
+		*out_len = concat_len;
+
+	return ret;
+}
+
+void *ie_index_extract_wsc_payload(const struct ie_index *index,
+							ssize_t *out_len)
+{
+	return ie_index_vendor_ie_concat(index, microsoft_oui, 0x04,
+						false, out_len);
+}
+
+void *ie_index_extract_p2p_payload(const struct ie_index *index,
+							ssize_t *out_len)
+{
+	return ie_index_vendor_ie_concat(index, wifi_alliance_oui, 0x09,
+						true, out_len);
+}
+
+void *ie_index_extract_wfd_payload(const struct ie_index *index,
+							ssize_t *out_len)
+{
+	return ie_index_vendor_ie_concat(index, wifi_alliance_oui, 0x0a,
+						true, out_len);
+}
+
 /*
  * Encapsulate & Fragment data into Vendor IE with a given OUI + type
  *
@@ -1939,6 +2108,109 @@ int ie_parse_neighbor_report(struct ie_tlv_iter *iter,
 	return 0;
 }
 
+/*
+ * 802.11ax-2021 Section 9.4.2.170.  Calls func for each TBTT Information
+ * field until it returns false.  Neighbor AP Information fields with a
+ * reserved TBTT Information Field Type are skipped.
+ */
+int ie_parse_reduced_neighbor_report(struct ie_tlv_iter *iter,
+					ie_rnr_func_t func, void *user_data)
+{
+	unsigned int len = ie_tlv_iter_get_length(iter);
+	const uint8_t *data = ie_tlv_iter_get_data(iter);
+
+	while (len) {
+		struct ie_rnr_info info;
+		uint8_t type;
+		unsigned int count;
+		unsigned int tbtt_len;
+		unsigned int i;
+
+		if (len < 4)
+			return -EINVAL;
+
+		type = bit_field(data[0], 0, 2);
+		count = bit_field(data[0], 4, 4) + 1;
+		tbtt_len = data[1];
+
+		if (len - 4 < count * tbtt_len)
+			return -EINVAL;
+
+		memset(&info, 0, sizeof(info));
+		info.oper_class = data[2];
+		info.channel_num = data[3];
+
+		data += 4;
+		len -= 4;
+
+		/* Anything but 0 is reserved, but the length is still valid */
+		if (type != 0 || !tbtt_len) {
+			data += count * tbtt_len;
+			len -= count * tbtt_len;
+			continue;
+		}
+
+		for (i = 0; i < count; i++, data += tbtt_len, len -= tbtt_len) {
+			const uint8_t *field = data + 1;
+
+			info.bssid_present = false;
+			info.short_ssid_present = false;
+			info.bss_params_present = false;
+
+			/*
+			 * Table 9-319b: the Neighbor AP TBTT Offset is always
+			 * present, the length tells which of the BSSID,
+			 * Short-SSID and BSS Parameters follow.
+			 */
+			switch (tbtt_len) {
+			case 1:
+				break;
+			case 2:
+				info.bss_params_present = true;
+				break;
+			case 5:
+			case 6:
+				info.short_ssid_present = true;
+				info.bss_params_present = tbtt_len == 6;
+				break;
+			case 7:
+			case 8:
+			case 9:
+				info.bssid_present = true;
+				info.bss_params_present = tbtt_len >= 8;
+				break;
+			default:
+				/* 11 and up, possibly with later fields */
+				if (tbtt_len < 11)
+					break;
+
+				info.bssid_present = true;
+				info.short_ssid_present = true;
+				info.bss_params_present = tbtt_len >= 12;
+				break;
+			}
+
+			if (info.bssid_present) {
+				memcpy(info.bssid, field, 6);
+				field += 6;
+			}
+
+			if (info.short_ssid_present) {
+				info.short_ssid = l_get_le32(field);
+				field += 4;
+			}
+
+			if (info.bss_params_present)
+				info.bss_params = *field;
+
+			if (!func(&info, user_data))
+				return 0;
+		}
+	}
+
+	return 0;
+}
+
 int ie_parse_roaming_consortium(struct ie_tlv_iter *iter, size_t *num_anqp_out,
 				const uint8_t **oi1_out, size_t *oi1_len_out,
 				const uint8_t **oi2_out, size_t *oi2_len_out,
@@ -274,6 +274,8 @@ enum ie_type {
 	IE_TYPE_OWE_DH_PARAM                         = 256 + 32,
 	IE_TYPE_PASSWORD_IDENTIFIER                  = 256 + 33,
 	IE_TYPE_GLK_GCR_PARAMETER_SET                = 256 + 34,
+	IE_TYPE_HE_CAPABILITIES                      = 256 + 35,
+	IE_TYPE_HE_OPERATION                         = 256 + 36,
 	IE_TYPE_VENDOR_SPECIFIC_REQUEST              = 256 + 44,
 	IE_TYPE_MAX_CHANNEL_SWITCH_TIME              = 256 + 52,
 	IE_TYPE_ESTIMATED_SERVICE_PARAMETERS_OUT     = 256 + 53,
@@ -282,6 +284,7 @@ enum ie_type {
 	IE_TYPE_SUPPLEMENTAL_CLASS_2_CAPABILITIES    = 256 + 90,
 	IE_TYPE_REJECTED_GROUPS                      = 256 + 92,
 	IE_TYPE_ANTI_CLOGGING_TOKEN_CONTAINER        = 256 + 93,
+	IE_TYPE_MULTI_LINK                           = 256 + 107,
 };
 
 /*
@@ -366,6 +369,23 @@ struct ie_tlv_iter {
 	const unsigned char *data;
 };
 
+/*
+ * Offsets of the elements found in a single pass over an IE buffer, so
+ * that several elements can be looked up without walking it each time.
+ * Extension elements are indexed as 256 + Element ID Extension, same as
+ * the tags returned by ie_tlv_iter_get_tag().
+ */
+#define IE_INDEX_MAX_VENDOR 16
+
+struct ie_index {
+	const unsigned char *ies;
+	unsigned int len;
+	uint16_t first[512];	/* 1 + offset of first element, 0 if none */
+	uint16_t vendor[IE_INDEX_MAX_VENDOR];
+	unsigned int n_vendor;
+	bool vendor_overflow;
+};
+
 #define MAX_BUILDER_SIZE (8 * 1024)
 
 struct ie_tlv_builder {
@@ -465,6 +485,32 @@ struct ie_neighbor_report_info {
 	bool bss_transition_pref_present : 1;
 };
 
+/* 802.11ax-2021 Table 9-319a: BSS Parameters subfield */
+enum ie_rnr_bss_params {
+	IE_RNR_BSS_PARAMS_OCT_RECOMMENDED = 0x01,
+	IE_RNR_BSS_PARAMS_SAME_SSID = 0x02,
+	IE_RNR_BSS_PARAMS_MULTIPLE_BSSID = 0x04,
+	IE_RNR_BSS_PARAMS_TRANSMITTED_BSSID = 0x08,
+	IE_RNR_BSS_PARAMS_ESS_COLOCATED = 0x10,
+	IE_RNR_BSS_PARAMS_UNSOLICITED_PROBE_RESP = 0x20,
+	IE_RNR_BSS_PARAMS_COLOCATED_AP = 0x40,
+};
+
+/* A TBTT Information field of a Reduced Neighbor Report */
+struct ie_rnr_info {
+	uint8_t oper_class;
+	uint8_t channel_num;
+	uint8_t bssid[6];
+	uint32_t short_ssid;
+	uint8_t bss_params;
+	bool bssid_present : 1;
+	bool short_ssid_present : 1;
+	bool bss_params_present : 1;
+};
+
+typedef bool (*ie_rnr_func_t)(const struct ie_rnr_info *info,
+					void *user_data);
+
 struct ie_fils_ip_addr_request_info {
 	bool ipv4 : 1;
 	uint32_t ipv4_requested_addr;		/* Zero if none */
@@ -526,6 +572,22 @@ static inline const unsigned char *ie_tlv_iter_get_data(
 	return iter->data;
 }
 
+void ie_index_init(struct ie_index *index, const unsigned char *ies,
+			unsigned int len);
+void ie_index_reset(struct ie_index *index, const unsigned char *ies,
+			unsigned int len);
+void ie_index_add(struct ie_index *index, const struct ie_tlv_iter *iter);
+bool ie_index_get(const struct ie_index *index, unsigned int tag,
+			struct ie_tlv_iter *iter);
+bool ie_index_has_vendor(const struct ie_index *index,
+				const unsigned char oui[], unsigned char type);
+void *ie_index_extract_wsc_payload(const struct ie_index *index,
+							ssize_t *out_len);
+void *ie_index_extract_p2p_payload(const struct ie_index *index,
+							ssize_t *out_len);
+void *ie_index_extract_wfd_payload(const struct ie_index *index,
+							ssize_t *out_len);
+
 void *ie_tlv_extract_wsc_payload(const uint8_t *ies, size_t len,
 							ssize_t *out_len);
 void *ie_tlv_encapsulate_wsc_payload(const uint8_t *data, size_t len,
@@ -596,6 +658,8 @@ bool ie_build_fast_bss_transition(const struct ie_ft_info *info,
 
 int ie_parse_neighbor_report(struct ie_tlv_iter *iter,
 				struct ie_neighbor_report_info *info);
+int ie_parse_reduced_neighbor_report(struct ie_tlv_iter *iter,
+					ie_rnr_func_t func, void *user_data);
 
 int ie_parse_osen_from_data(const uint8_t *data, size_t len,
 				struct ie_rsn_info *info);
@@ -25,6 +25,8 @@
 #endif
 
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -37,25 +39,171 @@
 #include "src/netconfig.h"
 #include "src/ip-pool.h"
 
+/*
+ * Addresses in use on the system, sorted by the start of their subnet.
+ * Each record also carries the highest subnet end among itself and all
+ * the records before it, its value never decreases along the array so a
+ * binary search finds the first subnet that could intersect with a given
+ * range, without having to walk the subnets entirely below that range.
+ */
 struct ip_pool_addr4_record {
 	uint32_t ifindex;
 	struct l_rtnl_address *addr;
+	uint32_t start;		/* Host byte order */
+	uint32_t end;		/* Exclusive */
+	uint32_t max_end;
 };
 
 struct ip_pool_addr4_range {
 	uint32_t start;
 	uint32_t end;
+	const char *str;
 };
 
-static struct l_queue *used_addr4_list;
+static struct ip_pool_addr4_record *used_addr4;
+static unsigned int used_addr4_len;
+static unsigned int used_addr4_size;
 static struct l_netlink *rtnl;
 
-static int ip_pool_addr4_range_compare(const void *a, const void *b,
-					void *user_data)
+static bool ip_pool_addr4_subnet(const struct l_rtnl_address *addr,
+					uint32_t *out_start, uint32_t *out_end)
+{
+	char addr_str[INET_ADDRSTRLEN];
+	uint8_t prefix_len = l_rtnl_address_get_prefix_length(addr);
+	struct in_addr ia;
+	uint32_t size;
+
+	if (l_rtnl_address_get_family(addr) != AF_INET ||
+			!l_rtnl_address_get_address(addr, addr_str) ||
+			prefix_len < 1 || prefix_len > 32 ||
+			inet_pton(AF_INET, addr_str, &ia) != 1)
+		return false;
+
+	size = 1U << (32 - prefix_len);
+	*out_start = ntohl(ia.s_addr) & ~(size - 1);
+	*out_end = *out_start + size;
+	return true;
+}
+
+/* Index of the first record with a start address >= @start */
+static unsigned int ip_pool_used_find_start(uint32_t start)
+{
+	unsigned int lo = 0;
+	unsigned int hi = used_addr4_len;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (used_addr4[mid].start < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Index of the first record that may intersect with addresses >= @addr */
+static unsigned int ip_pool_used_find_end(uint32_t addr)
+{
+	unsigned int lo = 0;
+	unsigned int hi = used_addr4_len;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (used_addr4[mid].max_end <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void ip_pool_used_update_max_end(unsigned int from)
+{
+	unsigned int i;
+
+	for (i = from; i < used_addr4_len; i++) {
+		uint32_t prev = i ? used_addr4[i - 1].max_end : 0;
+
+		used_addr4[i].max_end = L_MAX(prev, used_addr4[i].end);
+	}
+}
+
+static void ip_pool_used_add(uint32_t ifindex, struct l_rtnl_address *addr)
+{
+	struct ip_pool_addr4_record *rec;
+	uint32_t start;
+	uint32_t end;
+	unsigned int i;
+
+	if (!ip_pool_addr4_subnet(addr, &start, &end)) {
+		l_rtnl_address_free(addr);
+		return;
+	}
+
+	if (used_addr4_len == used_addr4_size) {
+		used_addr4_size = used_addr4_size ? used_addr4_size * 2 : 16;
+		used_addr4 = l_realloc(used_addr4,
+					used_addr4_size * sizeof(*used_addr4));
+	}
+
+	i = ip_pool_used_find_start(start);
+	memmove(used_addr4 + i + 1, used_addr4 + i,
+		(used_addr4_len - i) * sizeof(*used_addr4));
+	used_addr4_len++;
+
+	rec = &used_addr4[i];
+	rec->ifindex = ifindex;
+	rec->addr = addr;
+	rec->start = start;
+	rec->end = end;
+	ip_pool_used_update_max_end(i);
+}
+
+static void ip_pool_used_remove(uint32_t ifindex,
+				const struct l_rtnl_address *addr)
+{
+	char addr_str[INET_ADDRSTRLEN];
+	uint32_t start;
+	uint32_t end;
+	unsigned int i;
+
+	if (!ip_pool_addr4_subnet(addr, &start, &end) ||
+			!l_rtnl_address_get_address(addr, addr_str))
+		return;
+
+	for (i = ip_pool_used_find_start(start);
+			i < used_addr4_len && used_addr4[i].start == start;
+			i++) {
+		struct ip_pool_addr4_record *rec = &used_addr4[i];
+		char rec_addr_str[INET_ADDRSTRLEN];
+
+		if (rec->ifindex != ifindex || rec->end != end ||
+				!l_rtnl_address_get_address(rec->addr,
+								rec_addr_str) ||
+				strcmp(addr_str, rec_addr_str))
+			continue;
+
+		l_rtnl_address_free(rec->addr);
+		used_addr4_len--;
+		memmove(rec, rec + 1,
+			(used_addr4_len - i) * sizeof(*used_addr4));
+		ip_pool_used_update_max_end(i);
+		return;
+	}
+}
+
+static int ip_pool_addr4_range_compare(const void *a, const void *b)
 {
 	const struct ip_pool_addr4_range *range_a = a;
 	const struct ip_pool_addr4_range *range_b = b;
 
+	if (range_a->start == range_b->start)
+		return 0;
+
 	return range_a->start > range_b->start ? 1 : -1;
 }
 
@@ -64,59 +212,62 @@ static int ip_pool_addr4_range_compare(const void *a, const void *b,
  * at least one full subnet and don't intersect with any subnets already in
  * use.  This may result in the input range being split into multiple ranges
  * of different sizes or being skipped altogether.
- * All inputs must be rounded to the subnet boundary and the @used queue
- * sorted by the subnet start address.
+ * All inputs must be rounded to the subnet boundary.  The subnets in use
+ * are rounded to the same boundary on the fly.
  */
 static void ip_pool_append_range(struct l_queue *to,
 					const struct ip_pool_addr4_range *range,
-					struct l_queue *used, const char *str)
+					uint32_t subnet_size)
 {
-	const struct l_queue_entry *entry = l_queue_get_entries(used);
-	const struct ip_pool_addr4_range *used_range =
-		entry ? entry->data : NULL;
+	uint32_t subnet_mask = ~(subnet_size - 1);
 	uint32_t start = range->start;
+	unsigned int i = ip_pool_used_find_end(start);
 	bool print = true;
 
 	while (range->end > start) {
-		while (used_range && used_range->end <= start) {
-			entry = entry->next;
-			used_range = entry ? entry->data : NULL;
+		uint32_t used_start = 0;
+		uint32_t used_end = 0;
+
+		for (; i < used_addr4_len; i++) {
+			used_start = used_addr4[i].start & subnet_mask;
+			used_end = (used_addr4[i].end + subnet_size - 1) &
+				subnet_mask;
+
+			if (used_end > start)
+				break;
 		}
 
 		/* No more used ranges that intersect with @start/@range->end */
-		if (!used_range || range->end <= used_range->start) {
+		if (i == used_addr4_len || range->end <= used_start) {
 			struct ip_pool_addr4_range *sub =
 				l_new(struct ip_pool_addr4_range, 1);
 
 			sub->start = start;
 			sub->end = range->end;
 			l_queue_push_tail(to, sub);
-			l_queue_insert(used, l_memdup(sub, sizeof(*sub)),
-					ip_pool_addr4_range_compare, NULL);
 			return;
 		}
 
 		if (print) {
 			l_debug("Address spec %s intersects with at least one "
 				"subnet already in use on the system or "
-				"specified in the settings", str);
+				"specified in the settings", range->str);
 			print = false;
 		}
 
-		/* Now we know @used_range is non-NULL and intersects */
-		if (start < used_range->start) {
+		/* Now we know the used range intersects */
+		if (start < used_start) {
 			struct ip_pool_addr4_range *sub =
 				l_new(struct ip_pool_addr4_range, 1);
 
 			sub->start = start;
-			sub->end = used_range->start;
+			sub->end = used_start;
 			l_queue_push_tail(to, sub);
-			l_queue_insert(used, l_memdup(sub, sizeof(*sub)),
-					ip_pool_addr4_range_compare, NULL);
 		}
 
 		/* Skip to the start of the next subnet */
-		start = used_range->end;
+		start = used_end;
+		i++;
 	}
 }
 
@@ -133,12 +284,13 @@ int ip_pool_select_addr4(const char **addr_str_list, uint8_t subnet_prefix_len,
 	uint32_t total = 0;
 	uint32_t selected;
 	unsigned int i;
+	unsigned int n_specs = 0;
 	uint32_t subnet_size = 1 << (32 - subnet_prefix_len);
 	uint32_t host_mask = subnet_size - 1;
 	uint32_t subnet_mask = ~host_mask;
 	uint32_t host_addr = 0;
 	struct l_queue *ranges = l_queue_new();
-	struct l_queue *used = l_queue_new();
+	struct ip_pool_addr4_range *specs = NULL;
 	struct in_addr ia;
 	const struct l_queue_entry *entry;
 	int err = -EINVAL;
@@ -147,32 +299,6 @@ int ip_pool_select_addr4(const char **addr_str_list, uint8_t subnet_prefix_len,
 	if (!addr_str_list || !addr_str_list[0])
 		goto cleanup;
 
-	/* Build a sorted list of used/unavailable subnets */
-	for (entry = l_queue_get_entries(used_addr4_list);
-			entry; entry = entry->next) {
-		const struct ip_pool_addr4_record *rec = entry->data;
-		struct ip_pool_addr4_range *range;
-		char addr_str[INET_ADDRSTRLEN];
-		uint8_t used_prefix_len =
-			l_rtnl_address_get_prefix_length(rec->addr);
-		uint32_t used_subnet_size;
-
-		if (l_rtnl_address_get_family(rec->addr) != AF_INET ||
-				!l_rtnl_address_get_address(rec->addr,
-								addr_str) ||
-				used_prefix_len < 1 ||
-				inet_pton(AF_INET, addr_str, &ia) != 1)
-			continue;
-
-		used_subnet_size = 1 << (32 - used_prefix_len);
-
-		range = l_new(struct ip_pool_addr4_range, 1);
-		range->start = ntohl(ia.s_addr) & subnet_mask;
-		range->end = (range->start + used_subnet_size + subnet_size -
-				1) & subnet_mask;
-		l_queue_insert(used, range, ip_pool_addr4_range_compare, NULL);
-	}
-
 	/* Build the list of available subnets */
 
 	/* Check for the static IP syntax: Address=<IP> */
@@ -183,12 +309,16 @@ int ip_pool_select_addr4(const char **addr_str_list, uint8_t subnet_prefix_len,
 		host_addr = ntohl(ia.s_addr);
 		range.start = host_addr & subnet_mask;
 		range.end = range.start + subnet_size;
-		ip_pool_append_range(ranges, &range, used, *addr_str_list);
+		range.str = *addr_str_list;
+		ip_pool_append_range(ranges, &range, subnet_size);
 		goto check_avail;
 	}
 
+	specs = l_new(struct ip_pool_addr4_range,
+			l_strv_length((char **) addr_str_list));
+
 	for (i = 0; addr_str_list[i]; i++) {
-		struct ip_pool_addr4_range range;
+		struct ip_pool_addr4_range *range = &specs[n_specs];
 		uint32_t addr;
 		uint8_t addr_prefix;
 
@@ -206,9 +336,27 @@ int ip_pool_select_addr4(const char **addr_str_list, uint8_t subnet_prefix_len,
 			continue;
 		}
 
-		range.start = addr & subnet_mask;
-		range.end = range.start + (1 << (32 - addr_prefix));
-		ip_pool_append_range(ranges, &range, used, addr_str_list[i]);
+		range->start = addr & subnet_mask;
+		range->end = range->start + (1 << (32 - addr_prefix));
+		range->str = addr_str_list[i];
+		n_specs++;
+	}
+
+	/*
+	 * Merge overlapping address specs so that no subnet is counted twice
+	 * when selecting one at random.
+	 */
+	qsort(specs, n_specs, sizeof(*specs), ip_pool_addr4_range_compare);
+
+	for (i = 0; i < n_specs; i++) {
+		struct ip_pool_addr4_range range = specs[i];
+
+		while (i + 1 < n_specs && specs[i + 1].start < range.end) {
+			i++;
+			range.end = L_MAX(range.end, specs[i].end);
+		}
+
+		ip_pool_append_range(ranges, &range, subnet_size);
 	}
 
 check_avail:
@@ -260,53 +408,19 @@ done:
 
 cleanup:
 	l_queue_destroy(ranges, l_free);
-	l_queue_destroy(used, l_free);
+	l_free(specs);
 	return err;
 }
 
-static void ip_pool_addr4_record_free(void *data)
-{
-	struct ip_pool_addr4_record *rec = data;
-
-	l_rtnl_address_free(rec->addr);
-	l_free(rec);
-}
-
-static bool ip_pool_addr4_match_ifindex(const void *a, const void *b)
-{
-	const struct ip_pool_addr4_record *addr = a;
-
-	return addr->ifindex == L_PTR_TO_UINT(b);
-}
-
 struct l_rtnl_address *ip_pool_get_addr4(uint32_t ifindex)
 {
-	const struct ip_pool_addr4_record *rec =
-		l_queue_find(used_addr4_list, ip_pool_addr4_match_ifindex,
-				L_UINT_TO_PTR(ifindex));
-
-	return rec ? l_rtnl_address_clone(rec->addr) : 0;
-}
-
-static bool ip_pool_addr4_match_free(void *data, void *user_data)
-{
-	const struct ip_pool_addr4_record *a = data;
-	const struct ip_pool_addr4_record *b = user_data;
-	char a_addr_str[INET_ADDRSTRLEN];
-	char b_addr_str[INET_ADDRSTRLEN];
-
-	if (a->ifindex != b->ifindex ||
-			l_rtnl_address_get_prefix_length(a->addr) !=
-			l_rtnl_address_get_prefix_length(b->addr))
-		return false;
+	unsigned int i;
 
-	if (!l_rtnl_address_get_address(a->addr, a_addr_str) ||
-			!l_rtnl_address_get_address(b->addr, b_addr_str) ||
-			strcmp(a_addr_str, b_addr_str))
-		return false;
+	for (i = 0; i < used_addr4_len; i++)
+		if (used_addr4[i].ifindex == ifindex)
+			return l_rtnl_address_clone(used_addr4[i].addr);
 
-	ip_pool_addr4_record_free(data);
-	return true;
+	return NULL;
 }
 
 static void ip_pool_addr_notify(uint16_t type, const void *data, uint32_t len,
@@ -324,22 +438,10 @@ static void ip_pool_addr_notify(uint16_t type, const void *data, uint32_t len,
 	if (!addr)
 		return;
 
-	if (type == RTM_NEWADDR) {
-		struct ip_pool_addr4_record *rec;
-
-		rec = l_new(struct ip_pool_addr4_record, 1);
-		rec->ifindex = ifa->ifa_index;
-		rec->addr = l_steal_ptr(addr);
-		l_queue_push_tail(used_addr4_list, rec);
-	} else if (type == RTM_DELADDR) {
-		struct ip_pool_addr4_record rec;
-
-		rec.ifindex = ifa->ifa_index;
-		rec.addr = addr;
-
-		l_queue_foreach_remove(used_addr4_list,
-					ip_pool_addr4_match_free, &rec);
-	}
+	if (type == RTM_NEWADDR)
+		ip_pool_used_add(ifa->ifa_index, l_steal_ptr(addr));
+	else if (type == RTM_DELADDR)
+		ip_pool_used_remove(ifa->ifa_index, addr);
 
 	l_rtnl_address_free(addr);
 }
@@ -374,14 +476,20 @@ static int ip_pool_init(void)
 		return -EIO;
 	}
 
-	used_addr4_list = l_queue_new();
 	return 0;
 }
 
 static void ip_pool_exit(void)
 {
-	l_queue_destroy(used_addr4_list, ip_pool_addr4_record_free);
-	used_addr4_list = NULL;
+	unsigned int i;
+
+	for (i = 0; i < used_addr4_len; i++)
+		l_rtnl_address_free(used_addr4[i].addr);
+
+	l_free(used_addr4);
+	used_addr4 = NULL;
+	used_addr4_len = 0;
+	used_addr4_size = 0;
 }
 
 IWD_MODULE(ip_pool, ip_pool_init, ip_pool_exit)
@@ -42,3 +42,7 @@ const char *iwd_get_iface_blacklist(void);
 const char *iwd_get_phy_whitelist(void);
 const char *iwd_get_phy_blacklist(void);
 bool iwd_is_developer_mode(void);
+
+void iwd_startup_trace(const char *format, ...)
+			__attribute__((format(printf, 1, 2)));
+void iwd_startup_trace_end(void);
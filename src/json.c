@@ -32,7 +32,7 @@
 
 #include "shared/jsmn.h"
 
-/* Max number of tokens supported. Increase if larger objects are expected */
+/* Initial number of tokens, grown as needed for larger objects */
 #define JSON_DEFAULT_TOKENS 60
 
 #define TOK_LEN(token) ((token)->end - (token)->start)
@@ -52,34 +52,17 @@ struct json_contents {
 	const char *json;
 	size_t json_len;
 	jsmntok_t *tokens;
+	int *ends;		/* Index past the last token of each subtree */
 	int tokens_len;
-	jsmn_parser *p;
+	jsmn_parser p;
 };
 
-static jsmntok_t *next_key_in_parent(struct json_iter *iter, jsmntok_t *current)
-{
-	int parent = current->parent;
-
-	/* iterate the list and stop on the first token with the same parent */
-	while (++current < ITER_END(iter)) {
-		if (current->parent == parent)
-			return current;
-	}
-
-	return NULL;
-}
-
 static int count_tokens_in_container(struct json_iter *iter,
 							jsmntok_t *container)
 {
 	int idx = container - iter->contents->tokens;
-	jsmntok_t *contents;
 
-	for (contents = ++container; contents < ITER_END(iter); contents++)
-		if (contents->parent < idx)
-			break;
-
-	return contents - container;
+	return iter->contents->ends[idx] - idx - 1;
 }
 
 static void iter_recurse(struct json_iter *iter, jsmntok_t *token,
@@ -105,20 +88,48 @@ static void iter_recurse(struct json_iter *iter, jsmntok_t *token,
 struct json_contents *json_contents_new(const char *json, size_t json_len)
 {
 	struct json_contents *c = l_new(struct json_contents, 1);
+	unsigned int n_tokens = JSON_DEFAULT_TOKENS;
+	int i;
 
 	c->json = json;
 	c->json_len = json_len;
-	c->p = l_new(jsmn_parser, 1);
-	c->tokens = l_new(jsmntok_t, JSON_DEFAULT_TOKENS);
+	c->tokens = l_new(jsmntok_t, n_tokens);
+
+	jsmn_init(&c->p);
+
+	/*
+	 * jsmn resumes where it ran out of tokens, so the string is only
+	 * scanned once however large it is.
+	 */
+	while ((c->tokens_len = jsmn_parse(&c->p, c->json, c->json_len,
+					c->tokens, n_tokens)) ==
+					JSMN_ERROR_NOMEM) {
+		n_tokens *= 2;
+		c->tokens = l_realloc(c->tokens, n_tokens * sizeof(jsmntok_t));
+	}
 
-	jsmn_init(c->p);
-	c->tokens_len = jsmn_parse(c->p, c->json, c->json_len,
-					c->tokens, JSON_DEFAULT_TOKENS);
 	if (c->tokens_len < 0) {
 		json_contents_free(c);
 		return NULL;
 	}
 
+	/*
+	 * Children always follow their parent, so walking backwards gives
+	 * every subtree's extent in one pass.  Skipping over a value or a
+	 * container is then O(1).
+	 */
+	c->ends = l_new(int, c->tokens_len);
+
+	for (i = c->tokens_len - 1; i >= 0; i--) {
+		int parent = c->tokens[i].parent;
+
+		if (c->ends[i] < i + 1)
+			c->ends[i] = i + 1;
+
+		if (parent >= 0 && c->ends[parent] < c->ends[i])
+			c->ends[parent] = c->ends[i];
+	}
+
 	return c;
 }
 
@@ -131,7 +142,7 @@ void json_iter_init(struct json_iter *iter, struct json_contents *c)
 
 void json_contents_free(struct json_contents *c)
 {
-	l_free(c->p);
+	l_free(c->ends);
 	l_free(c->tokens);
 	l_free(c);
 }
@@ -192,8 +203,6 @@ bool json_iter_parse(struct json_iter *iter, enum json_type type, ...)
 {
 	struct json_contents *c = iter->contents;
 	va_list va;
-	int i;
-	int num = c->tokens->size;
 	jsmntok_t *next;
 	struct l_queue *args;
 
@@ -235,12 +244,12 @@ bool json_iter_parse(struct json_iter *iter, enum json_type type, ...)
 		/* First key */
 		next = c->tokens + iter->start + 1;
 
-		/* Iterate over this objects keys */
-		for (i = 0; i < num; i++) {
+		/* Iterate over this objects keys, stepping over each value */
+		while (next < ITER_END(iter)) {
 			ptr = TOK_PTR(c->json, next);
 			len = TOK_LEN(next);
 
-			if (next + 1 > ITER_END(iter))
+			if (next + 1 >= ITER_END(iter))
 				goto error;
 
 			if (strlen(key) == len && !memcmp(ptr, key, len)) {
@@ -252,9 +261,7 @@ bool json_iter_parse(struct json_iter *iter, enum json_type type, ...)
 				break;
 			}
 
-			next = next_key_in_parent(iter, next);
-			if (!next)
-				break;
+			next = c->tokens + c->ends[next + 1 - c->tokens];
 		}
 
 		if (flag == JSON_FLAG_MANDATORY && !v)
@@ -31,6 +31,7 @@
 #include <unistd.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <ell/ell.h>
 
@@ -45,12 +46,34 @@
 #include "src/scan.h"
 #include "src/util.h"
 #include "src/watchlist.h"
+#include "src/eap-tls-common.h"
+#include "src/crypto.h"
 
 static struct l_queue *known_networks;
+static struct l_hashmap *known_networks_index;
+static struct l_queue *known_hotspots;
 static size_t num_known_hidden_networks;
 static struct l_dir_watch *storage_dir_watch;
 static struct watchlist known_network_watches;
 static struct l_settings *known_freqs;
+static struct l_timeout *known_freqs_sync_timeout;
+static struct l_queue *pending_networks;
+static struct l_hashmap *storage_dir_events;
+static struct l_timeout *storage_dir_events_timeout;
+static unsigned int offset_generation = 1;
+static bool offsets_valid;
+
+#define KNOWN_FREQS_SYNC_DELAY		30
+/* Neighbor reports older than this, in seconds, are not used */
+#define KNOWN_NEIGHBORS_TTL		(24 * 60 * 60)
+#define KNOWN_NETWORKS_WATCH_DELAY_MS	500
+/* PSKs derived per main loop iteration while importing profiles */
+#define KNOWN_NETWORKS_IMPORT_PSK_BATCH	8
+
+enum {
+	STORAGE_DIR_EVENT_ATTRIB = 1,
+	STORAGE_DIR_EVENT_RELOAD,
+};
 
 void __network_config_parse(const struct l_settings *settings,
 					const char *full_path,
@@ -144,6 +167,7 @@ static void network_info_free(void *data)
 	struct network_info *network = data;
 
 	l_queue_destroy(network->known_frequencies, l_free);
+	scan_freq_set_free(network->neighbor_freqs);
 
 	network->ops->free(network);
 }
@@ -182,46 +206,66 @@ static const char *known_network_get_path(const struct network_info *network)
 	return path;
 }
 
+static void known_network_offsets_invalidate(void)
+{
+	offsets_valid = false;
+	offset_generation++;
+}
+
 /*
  * Finds the position n of this network_info in the list of known networks
  * sorted by connected_time.  E.g. an offset of 0 means the most recently
  * used network.  Only networks with seen_count > 0 are considered.  E.g.
  * only networks that appear in scan results on at least one wifi card.
  *
+ * The offsets of all entries are computed in one pass and kept until the
+ * list order or the set of seen networks changes, ranking every network
+ * of a scan is then O(1) per network.
+ *
  * Returns -ENOENT if the entry couldn't be found.
  */
 int known_network_offset(const struct network_info *target)
 {
 	const struct l_queue_entry *entry;
-	const struct network_info *info;
+	struct network_info *info;
 	int n = 0;
 
-	for (entry = l_queue_get_entries(known_networks); entry;
-						entry = entry->next) {
-		info = entry->data;
-		if (target == info)
-			return n;
+	if (!offsets_valid) {
+		for (entry = l_queue_get_entries(known_networks); entry;
+							entry = entry->next) {
+			info = entry->data;
+			info->offset = n;
+			info->offset_generation = offset_generation;
 
-		if (info->seen_count)
-			n += 1;
+			if (info->seen_count)
+				n += 1;
+		}
+
+		offsets_valid = true;
 	}
 
-	return -ENOENT;
+	if (target->offset_generation != offset_generation)
+		return -ENOENT;
+
+	return target->offset;
 }
 
-static void known_network_register_dbus(struct network_info *network)
+void known_network_seen(struct network_info *info)
 {
-	const char *path = known_network_get_path(network);
+	if (!info->seen_count++)
+		known_network_offsets_invalidate();
+}
 
-	if (!l_dbus_object_add_interface(dbus_get_bus(), path,
-					IWD_KNOWN_NETWORK_INTERFACE, network))
-		l_info("Unable to register %s interface",
-						IWD_KNOWN_NETWORK_INTERFACE);
+void known_network_unseen(struct network_info *info)
+{
+	if (!--info->seen_count)
+		known_network_offsets_invalidate();
+}
 
-	if (!l_dbus_object_add_interface(dbus_get_bus(), path,
-					L_DBUS_INTERFACE_PROPERTIES, network))
-		l_info("Unable to register %s interface",
-						L_DBUS_INTERFACE_PROPERTIES);
+static void known_network_register_dbus(struct network_info *network)
+{
+	dbus_object_add_interfaces(known_network_get_path(network),
+					IWD_KNOWN_NETWORK_INTERFACE, network);
 }
 
 static void known_network_set_autoconnect(struct network_info *network,
@@ -394,6 +438,139 @@ struct scan_freq_set *network_info_get_roam_frequencies(
 	return freqs;
 }
 
+static bool known_network_neighbors_valid(const struct network_info *info,
+						const uint16_t *mdid)
+{
+	uint64_t now = time(NULL);
+
+	if (!info->neighbor_freqs)
+		return false;
+
+	if (info->neighbor_time > now ||
+			now - info->neighbor_time > KNOWN_NEIGHBORS_TTL)
+		return false;
+
+	/* The report belongs to the Mobility Domain it was received in */
+	if (!!mdid != info->neighbor_has_mdid)
+		return false;
+
+	return !mdid || *mdid == info->neighbor_mdid;
+}
+
+/*
+ * Returns a copy of the frequencies from the last neighbor report
+ * received on this network, if it isn't older than KNOWN_NEIGHBORS_TTL
+ * and was received in the same Mobility Domain, so that a roam can scan
+ * those right away after a reconnection.
+ */
+struct scan_freq_set *known_network_get_neighbor_frequencies(
+					const struct network_info *info,
+					const uint16_t *mdid)
+{
+	struct scan_freq_set *freqs;
+
+	if (!info || !known_network_neighbors_valid(info, mdid))
+		return NULL;
+
+	freqs = scan_freq_set_new();
+	scan_freq_set_merge(freqs, info->neighbor_freqs);
+
+	return freqs;
+}
+
+static void neighbor_freq_to_string(uint32_t freq, void *user_data)
+{
+	struct l_string *str = user_data;
+
+	l_string_append_printf(str, " %u", freq);
+}
+
+/*
+ * Writes the neighbor report to the network's group of the frequency
+ * file, returns whether anything changed.
+ */
+static bool known_network_neighbors_to_settings(struct network_info *info,
+						const char *group)
+{
+	struct l_string *str;
+	_auto_(l_free) char *freqs = NULL;
+	uint64_t stored;
+
+	if (!info->neighbor_freqs)
+		return false;
+
+	if (l_settings_get_uint64(known_freqs, group, "neighbors_time",
+					&stored) &&
+			stored == info->neighbor_time)
+		return false;
+
+	str = l_string_new(64);
+	scan_freq_set_foreach(info->neighbor_freqs, neighbor_freq_to_string,
+				str);
+	freqs = l_string_unwrap(str);
+
+	l_settings_set_value(known_freqs, group, "neighbors", freqs);
+	l_settings_set_uint64(known_freqs, group, "neighbors_time",
+				info->neighbor_time);
+
+	if (info->neighbor_has_mdid)
+		l_settings_set_uint(known_freqs, group, "neighbors_mdid",
+					info->neighbor_mdid);
+	else
+		l_settings_remove_key(known_freqs, group, "neighbors_mdid");
+
+	return true;
+}
+
+static void known_network_neighbors_from_settings(struct network_info *info,
+							const char *group)
+{
+	_auto_(l_free) char *list = NULL;
+	struct scan_freq_set *freqs;
+	uint64_t time;
+	unsigned int mdid;
+	char *str;
+
+	list = l_settings_get_string(known_freqs, group, "neighbors");
+	if (!list)
+		return;
+
+	if (!l_settings_get_uint64(known_freqs, group, "neighbors_time",
+					&time))
+		return;
+
+	freqs = scan_freq_set_new();
+
+	for (str = list; *str != '\0';) {
+		unsigned long freq;
+
+		errno = 0;
+		freq = strtoul(str, &str, 10);
+
+		if (errno == ERANGE || !freq || freq > 7200 ||
+				(*str != ' ' && *str != '\0')) {
+			scan_freq_set_free(freqs);
+			return;
+		}
+
+		scan_freq_set_add(freqs, freq);
+	}
+
+	if (scan_freq_set_isempty(freqs)) {
+		scan_freq_set_free(freqs);
+		return;
+	}
+
+	info->neighbor_freqs = freqs;
+	info->neighbor_time = time;
+
+	if (l_settings_get_uint(known_freqs, group, "neighbors_mdid", &mdid) &&
+			mdid <= UINT16_MAX) {
+		info->neighbor_mdid = mdid;
+		info->neighbor_has_mdid = true;
+	}
+}
+
 bool network_info_match_hessid(const struct network_info *info,
 				const uint8_t *hessid)
 {
@@ -440,32 +617,69 @@ void known_network_set_connected_time(struct network_info *network,
 
 	l_queue_remove(known_networks, network);
 	l_queue_insert(known_networks, network, connected_time_compare, NULL);
+	known_network_offsets_invalidate();
+}
+
+static void known_network_set_hidden(struct network_info *network,
+					bool is_hidden)
+{
+	if (network->config.is_hidden == is_hidden)
+		return;
+
+	if (is_hidden)
+		num_known_hidden_networks++;
+	else
+		num_known_hidden_networks--;
+
+	network->config.is_hidden = is_hidden;
+
+	l_dbus_property_changed(dbus_get_bus(),
+				known_network_get_path(network),
+				IWD_KNOWN_NETWORK_INTERFACE, "Hidden");
 }
 
 void known_network_update(struct network_info *network,
 					struct network_config *new)
 {
-	struct network_config *old = &network->config;
-
 	known_network_set_connected_time(network, new->connected_time);
+	known_network_set_hidden(network, new->is_hidden);
+	known_network_set_autoconnect(network, new->is_autoconnectable);
 
-	if (old->is_hidden != new->is_hidden) {
-		if (old->is_hidden && !new->is_hidden)
-			num_known_hidden_networks--;
-		else if (!old->is_hidden && new->is_hidden)
-			num_known_hidden_networks++;
-
-		l_dbus_property_changed(dbus_get_bus(),
-					known_network_get_path(network),
-					IWD_KNOWN_NETWORK_INTERFACE,
-					"Hidden");
+	memcpy(&network->config, new, sizeof(struct network_config));
 
-		old->is_hidden = new->is_hidden;
+	if (network->config_pending) {
+		network->config_pending = false;
+		l_queue_remove(pending_networks, network);
 	}
+}
 
-	known_network_set_autoconnect(network, new->is_autoconnectable);
+/*
+ * The profiles found in the storage directory at startup are only indexed
+ * by name, along with their Hidden and AutoConnect settings which scans
+ * need for every profile, see storage_network_peek_flags.  They are
+ * parsed, and decrypted if needed, when a scan result matches them or
+ * D-Bus asks for them.  Until then the rest of the settings are defaults.
+ */
+static bool known_network_load(struct network_info *network)
+{
+	struct l_settings *settings;
+	struct network_config config;
+	L_AUTO_FREE_VAR(char *, full_path) = NULL;
 
-	memcpy(&network->config, new, sizeof(struct network_config));
+	if (!network->config_pending)
+		return true;
+
+	settings = storage_network_open(network->type, network->ssid);
+	if (!settings)
+		return false;
+
+	full_path = storage_get_network_file_path(network->type,
+							network->ssid);
+	__network_config_parse(settings, full_path, &config);
+	l_settings_free(settings);
+
+	known_network_update(network, &config);
+	return true;
 }
 
 bool known_networks_foreach(known_networks_foreach_func_t function,
@@ -481,34 +695,70 @@ bool known_networks_foreach(known_networks_foreach_func_t function,
 	return !entry;
 }
 
+struct network_info *known_networks_find_hotspot(
+					known_networks_foreach_func_t match,
+					void *user_data)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(known_hotspots); entry;
+			entry = entry->next)
+		if (match(entry->data, user_data))
+			return entry->data;
+
+	return NULL;
+}
+
 bool known_networks_has_hidden(void)
 {
 	return num_known_hidden_networks ? true : false;
 }
 
-static bool network_info_match(const void *a, const void *b)
+/*
+ * known_networks stays sorted by connected_time for iteration while the
+ * SSID based profiles are additionally indexed by (SSID, security) in
+ * known_networks_index and the hotspot profiles are kept in
+ * known_hotspots so that matching scan results against them doesn't need
+ * to walk every known network.
+ */
+static unsigned int network_info_hash(const void *key)
+{
+	const struct network_info *info = key;
+
+	return l_str_hash(info->ssid) * 31 + info->type;
+}
+
+static int network_info_compare(const void *a, const void *b)
 {
 	const struct network_info *ni_a = a;
 	const struct network_info *ni_b = b;
 
 	if (ni_a->type != ni_b->type)
-		return false;
+		return ni_a->type < ni_b->type ? -1 : 1;
 
-	if (strcmp(ni_a->ssid, ni_b->ssid))
-		return false;
-
-	return true;
+	return strcmp(ni_a->ssid, ni_b->ssid);
 }
 
-struct network_info *known_networks_find(const char *ssid,
-						enum security security)
+static struct network_info *known_networks_lookup(const char *ssid,
+							enum security security)
 {
 	struct network_info query;
 
 	query.type = security;
 	strcpy(query.ssid, ssid);
 
-	return l_queue_find(known_networks, network_info_match, &query);
+	return l_hashmap_lookup(known_networks_index, &query);
+}
+
+struct network_info *known_networks_find(const char *ssid,
+						enum security security)
+{
+	struct network_info *network = known_networks_lookup(ssid, security);
+
+	if (network && !known_network_load(network))
+		return NULL;
+
+	return network;
 }
 
 struct scan_freq_set *known_networks_get_recent_frequencies(
@@ -627,7 +877,10 @@ static bool known_network_property_get_hidden(struct l_dbus *dbus,
 					void *user_data)
 {
 	struct network_info *network = user_data;
-	bool is_hidden = network->config.is_hidden;
+	bool is_hidden;
+
+	known_network_load(network);
+	is_hidden = network->config.is_hidden;
 
 	l_dbus_message_builder_append_basic(builder, 'b', &is_hidden);
 
@@ -640,7 +893,10 @@ static bool known_network_property_get_autoconnect(struct l_dbus *dbus,
 					void *user_data)
 {
 	struct network_info *network = user_data;
-	bool autoconnect = network->config.is_autoconnectable;
+	bool autoconnect;
+
+	known_network_load(network);
+	autoconnect = network->config.is_autoconnectable;
 
 	l_dbus_message_builder_append_basic(builder, 'b', &autoconnect);
 
@@ -661,6 +917,8 @@ static struct l_dbus_message *known_network_property_set_autoconnect(
 	if (!l_dbus_message_iter_get_variant(new_value, "b", &autoconnect))
 		return dbus_error_invalid_args(message);
 
+	known_network_load(network);
+
 	if (network->config.is_autoconnectable == autoconnect)
 		return l_dbus_message_new_method_return(message);
 
@@ -719,12 +977,64 @@ static void setup_known_network_interface(struct l_dbus_interface *interface)
 				NULL);
 }
 
+/*
+ * The frequency file is rewritten as a whole so the updates, which happen
+ * on every connection and roam, are only written out once no sync was
+ * requested for KNOWN_FREQS_SYNC_DELAY seconds and at exit.
+ */
+static void known_frequencies_sync_cb(struct l_timeout *timeout,
+					void *user_data)
+{
+	l_timeout_remove(l_steal_ptr(known_freqs_sync_timeout));
+	storage_known_frequencies_sync(known_freqs);
+}
+
+static void known_frequencies_schedule_sync(void)
+{
+	if (known_freqs_sync_timeout) {
+		l_timeout_modify(known_freqs_sync_timeout,
+					KNOWN_FREQS_SYNC_DELAY);
+		return;
+	}
+
+	known_freqs_sync_timeout = l_timeout_create(KNOWN_FREQS_SYNC_DELAY,
+						known_frequencies_sync_cb,
+						NULL, NULL);
+}
+
+/*
+ * The cached TLS sessions were established using the previous contents
+ * of the profile, e.g. the CA certificate, so they must not be resumed
+ * once it changes or goes away.
+ */
+static void known_network_forget_tls_sessions(struct network_info *network)
+{
+	_auto_(l_free) char *peer_id = NULL;
+
+	if (network->is_hotspot || network->type != SECURITY_8021X)
+		return;
+
+	peer_id = l_util_hexstring((const uint8_t *) network->ssid,
+					strlen(network->ssid));
+	eap_tls_forget_peer(peer_id);
+}
+
 void known_networks_remove(struct network_info *network)
 {
+	known_network_forget_tls_sessions(network);
+
 	if (network->config.is_hidden)
 		num_known_hidden_networks--;
 
 	l_queue_remove(known_networks, network);
+	l_queue_remove(pending_networks, network);
+	known_network_offsets_invalidate();
+
+	if (network->is_hotspot)
+		l_queue_remove(known_hotspots, network);
+	else
+		l_hashmap_remove(known_networks_index, network);
+
 	l_dbus_unregister_object(dbus_get_bus(),
 					known_network_get_path(network));
 
@@ -737,7 +1047,7 @@ void known_networks_remove(struct network_info *network)
 
 		l_uuid_to_string(network->uuid, uuid, sizeof(uuid));
 		l_settings_remove_group(known_freqs, uuid);
-		storage_known_frequencies_sync(known_freqs);
+		known_frequencies_schedule_sync();
 	}
 
 	network_info_free(network);
@@ -746,6 +1056,13 @@ void known_networks_remove(struct network_info *network)
 void known_networks_add(struct network_info *network)
 {
 	l_queue_insert(known_networks, network, connected_time_compare, NULL);
+	known_network_offsets_invalidate();
+
+	if (network->is_hotspot)
+		l_queue_push_tail(known_hotspots, network);
+	else
+		l_hashmap_insert(known_networks_index, network, network);
+
 	known_network_register_dbus(network);
 
 	WATCHLIST_NOTIFY(&known_network_watches,
@@ -753,27 +1070,408 @@ void known_networks_add(struct network_info *network)
 				KNOWN_NETWORKS_EVENT_ADDED, network);
 }
 
-static void known_network_new(const char *ssid, enum security security,
-					struct network_config *config)
+static struct network_info *known_network_new_pending(const char *ssid,
+							enum security security)
+{
+	struct network_info *network;
+	struct network_config config;
+	bool is_hidden = false;
+	bool is_autoconnectable = true;
+	L_AUTO_FREE_VAR(char *, full_path) = NULL;
+
+	/* Unreadable profile */
+	if (!storage_network_peek_flags(security, ssid, &is_hidden,
+					&is_autoconnectable))
+		return NULL;
+
+	full_path = storage_get_network_file_path(security, ssid);
+
+	memset(&config, 0, sizeof(config));
+	config.connected_time = l_path_get_mtime(full_path);
+	config.is_hidden = is_hidden;
+	config.is_autoconnectable = is_autoconnectable;
+
+	network = l_new(struct network_info, 1);
+	__network_info_init(network, ssid, security, &config);
+	network->ops = &known_network_ops;
+	network->config_pending = true;
+	l_queue_push_tail(pending_networks, network);
+	known_networks_add(network);
+
+	return network;
+}
+
+/*
+ * Import() adds or replaces a batch of profiles at once.  Every profile is
+ * validated before anything is changed, the known networks are then
+ * registered together and the files written out by the storage write
+ * batching, instead of waiting for the directory watch to pick up each
+ * file.  PSKs of profiles only carrying a Passphrase are derived first, a
+ * batch at a time from an idle callback, so that the first connection to
+ * each of them doesn't have to.
+ */
+struct known_network_import {
+	char ssid[33];
+	enum security security;
+	struct l_settings *settings;
+};
+
+struct known_network_import_work {
+	struct l_dbus_message *message;
+	struct l_queue *imports;
+	const struct l_queue_entry *next;
+	struct l_idle *idle;
+};
+
+static struct known_network_import_work *import_work;
+
+static void known_network_import_free(void *data)
 {
+	struct known_network_import *import = data;
+
+	l_settings_free(import->settings);
+	l_free(import);
+}
+
+static bool known_network_import_match(const void *a, const void *b)
+{
+	const struct known_network_import *import = a;
+	const struct known_network_import *other = b;
+
+	return import->security == other->security &&
+		!strcmp(import->ssid, other->ssid);
+}
+
+static bool known_network_import_psk_valid(struct l_settings *settings)
+{
+	_auto_(l_free) char *passphrase = NULL;
+	const char *psk;
+	uint8_t *decoded;
+	size_t len;
+
+	/* Already encrypted with the system key, can't be checked */
+	if (l_settings_has_key(settings, "Security", "EncryptedSecurity"))
+		return true;
+
+	passphrase = l_settings_get_string(settings, "Security",
+						"Passphrase");
+	if (passphrase) {
+		bool valid = crypto_passphrase_is_valid(passphrase);
+
+		explicit_bzero(passphrase, strlen(passphrase));
+		return valid;
+	}
+
+	psk = l_settings_get_value(settings, "Security", "PreSharedKey");
+	if (!psk)
+		return false;
+
+	decoded = l_util_from_hexstring(psk, &len);
+	if (!decoded)
+		return false;
+
+	explicit_bzero(decoded, len);
+	l_free(decoded);
+
+	return len == 32;
+}
+
+static struct known_network_import *known_network_import_parse(
+						const char *ssid,
+						const char *type,
+						const char *contents)
+{
+	struct known_network_import *import;
+	size_t ssid_len = strlen(ssid);
+	bool valid;
+
+	if (ssid_len < 1 || ssid_len > 32 || !l_utf8_validate(ssid,
+							ssid_len, NULL))
+		return NULL;
+
+	import = l_new(struct known_network_import, 1);
+	strcpy(import->ssid, ssid);
+	import->settings = l_settings_new();
+
+	if (!security_from_str(type, &import->security) ||
+			!l_settings_load_from_data(import->settings, contents,
+							strlen(contents)))
+		goto invalid;
+
+	switch (import->security) {
+	case SECURITY_NONE:
+		valid = true;
+		break;
+	case SECURITY_PSK:
+		valid = known_network_import_psk_valid(import->settings);
+		break;
+	case SECURITY_8021X:
+		valid = l_settings_has_key(import->settings, "Security",
+						"EAP-Method") ||
+			l_settings_has_key(import->settings, "Security",
+						"EncryptedSecurity");
+		break;
+	default:
+		valid = false;
+		break;
+	}
+
+	if (valid)
+		return import;
+
+invalid:
+	known_network_import_free(import);
+	return NULL;
+}
+
+static void known_network_import_apply(void *data, void *user_data)
+{
+	struct known_network_import *import = data;
 	struct network_info *network;
+	struct network_config config;
+	L_AUTO_FREE_VAR(char *, full_path) = NULL;
+
+	full_path = storage_get_network_file_path(import->security,
+							import->ssid);
+	__network_config_parse(import->settings, full_path, &config);
+
+	storage_network_sync(import->security, import->ssid,
+				import->settings);
+
+	network = known_networks_lookup(import->ssid, import->security);
+	if (network) {
+		known_network_forget_tls_sessions(network);
+		known_network_update(network, &config);
+		return;
+	}
 
 	network = l_new(struct network_info, 1);
-	__network_info_init(network, ssid, security, config);
+	__network_info_init(network, import->ssid, import->security, &config);
 	network->ops = &known_network_ops;
 	known_networks_add(network);
 }
 
+static bool known_network_import_needs_psk(
+				const struct known_network_import *import)
+{
+	return import->security == SECURITY_PSK &&
+		l_settings_has_key(import->settings, "Security",
+					"Passphrase") &&
+		!l_settings_has_key(import->settings, "Security",
+					"PreSharedKey") &&
+		!l_settings_has_key(import->settings, "Security",
+					"EncryptedSecurity");
+}
+
+static void known_network_import_work_free(
+				struct known_network_import_work *work)
+{
+	l_idle_remove(work->idle);
+	l_queue_destroy(work->imports, known_network_import_free);
+
+	if (work->message)
+		l_dbus_message_unref(work->message);
+
+	l_free(work);
+}
+
+static void known_network_import_derive_psks(struct l_idle *idle,
+						void *user_data)
+{
+	struct known_network_import_work *work = user_data;
+	struct crypto_psk_request reqs[KNOWN_NETWORKS_IMPORT_PSK_BATCH];
+	struct known_network_import *batch[KNOWN_NETWORKS_IMPORT_PSK_BATCH];
+	char *passphrases[KNOWN_NETWORKS_IMPORT_PSK_BATCH];
+	struct l_dbus_message *reply;
+	unsigned int n = 0;
+	unsigned int i;
+
+	for (; work->next && n < L_ARRAY_SIZE(reqs);
+					work->next = work->next->next) {
+		struct known_network_import *import = work->next->data;
+
+		if (!known_network_import_needs_psk(import))
+			continue;
+
+		passphrases[n] = l_settings_get_string(import->settings,
+							"Security",
+							"Passphrase");
+		reqs[n].passphrase = passphrases[n];
+		reqs[n].ssid = (const unsigned char *) import->ssid;
+		reqs[n].ssid_len = strlen(import->ssid);
+		batch[n++] = import;
+	}
+
+	crypto_psk_from_passphrase_batch(reqs, n);
+
+	for (i = 0; i < n; i++) {
+		explicit_bzero(passphrases[i], strlen(passphrases[i]));
+		l_free(passphrases[i]);
+
+		/* Left for the first connection to derive instead */
+		if (reqs[i].result == 0) {
+			_auto_(l_free) char *hex =
+					l_util_hexstring(reqs[i].psk, 32);
+
+			l_settings_set_value(batch[i]->settings, "Security",
+						"PreSharedKey", hex);
+			explicit_bzero(hex, strlen(hex));
+		}
+
+		explicit_bzero(reqs[i].psk, sizeof(reqs[i].psk));
+	}
+
+	if (work->next)
+		return;
+
+	l_debug("Importing %u profiles", l_queue_length(work->imports));
+
+	l_queue_foreach(work->imports, known_network_import_apply, NULL);
+
+	reply = l_dbus_message_new_method_return(work->message);
+	dbus_pending_reply(&work->message, reply);
+
+	import_work = NULL;
+	known_network_import_work_free(work);
+}
+
+static struct l_dbus_message *known_networks_import(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct l_queue *imports;
+	struct l_dbus_message_iter iter;
+	const char *ssid;
+	const char *type;
+	const char *contents;
+
+	if (import_work)
+		return dbus_error_busy(message);
+
+	if (!l_dbus_message_get_arguments(message, "a(sss)", &iter))
+		return dbus_error_invalid_args(message);
+
+	imports = l_queue_new();
+
+	while (l_dbus_message_iter_next_entry(&iter, &ssid, &type,
+						&contents)) {
+		struct known_network_import *import;
+
+		import = known_network_import_parse(ssid, type, contents);
+		if (!import) {
+			l_debug("Invalid profile for %s (%s)", ssid, type);
+			goto invalid;
+		}
+
+		if (l_queue_find(imports, known_network_import_match,
+					import)) {
+			known_network_import_free(import);
+			goto invalid;
+		}
+
+		l_queue_push_tail(imports, import);
+	}
+
+	import_work = l_new(struct known_network_import_work, 1);
+	import_work->message = l_dbus_message_ref(message);
+	import_work->imports = imports;
+	import_work->next = l_queue_get_entries(imports);
+	import_work->idle = l_idle_create(known_network_import_derive_psks,
+						import_work, NULL);
+
+	return NULL;
+
+invalid:
+	l_queue_destroy(imports, known_network_import_free);
+	return dbus_error_invalid_args(message);
+}
+
+static void setup_known_network_manager_interface(
+					struct l_dbus_interface *interface)
+{
+	l_dbus_interface_method(interface, "Import", 0,
+				known_networks_import, "", "a(sss)",
+				"profiles");
+}
+
+static void known_network_mark_pending(struct network_info *network)
+{
+	if (network->config_pending)
+		return;
+
+	network->config_pending = true;
+	l_queue_push_tail(pending_networks, network);
+}
+
+/*
+ * Directory watch events are only recorded, per file, and reconciled
+ * against the known networks once KNOWN_NETWORKS_WATCH_DELAY_MS after
+ * the first event of a burst.  A file that needs re-reading has its
+ * Hidden and AutoConnect settings refreshed and is otherwise parsed again
+ * lazily.  The network is dropped if the profile is gone or unreadable.
+ */
+static void known_networks_reconcile_file(const void *key, void *value,
+						void *user_data)
+{
+	const char *filename = key;
+	unsigned int event = L_PTR_TO_UINT(value);
+	const char *ssid;
+	enum security security;
+	struct network_info *network;
+	bool is_hidden = false;
+	bool is_autoconnectable = true;
+	L_AUTO_FREE_VAR(char *, full_path) = NULL;
+
+	ssid = storage_network_ssid_from_path(filename, &security);
+	network = known_networks_lookup(ssid, security);
+
+	if (event == STORAGE_DIR_EVENT_ATTRIB) {
+		if (!network)
+			return;
+
+		full_path = storage_get_network_file_path(security, ssid);
+		known_network_set_connected_time(network,
+						l_path_get_mtime(full_path));
+		return;
+	}
+
+	if (!network) {
+		if (storage_is_file(filename))
+			known_network_new_pending(ssid, security);
+
+		return;
+	}
+
+	known_network_forget_tls_sessions(network);
+
+	if (!storage_network_peek_flags(security, ssid, &is_hidden,
+					&is_autoconnectable)) {
+		known_networks_remove(network);
+		return;
+	}
+
+	known_network_set_hidden(network, is_hidden);
+	known_network_set_autoconnect(network, is_autoconnectable);
+	known_network_mark_pending(network);
+}
+
+static void known_networks_watch_timeout(struct l_timeout *timeout,
+						void *user_data)
+{
+	struct l_hashmap *events = l_steal_ptr(storage_dir_events);
+
+	l_timeout_remove(l_steal_ptr(storage_dir_events_timeout));
+
+	l_hashmap_foreach(events, known_networks_reconcile_file, NULL);
+	l_hashmap_destroy(events, NULL);
+}
+
 static void known_networks_watch_cb(const char *filename,
 					enum l_dir_watch_event event,
 					void *user_data)
 {
-	const char *ssid;
-	L_AUTO_FREE_VAR(char *, full_path) = NULL;
 	enum security security;
-	struct network_info *network_before;
-	struct l_settings *settings;
-	uint64_t connected_time;
+	unsigned int type;
 
 	/*
 	 * Ignore notifications for the actual directory, we can't do
@@ -783,14 +1481,9 @@ static void known_networks_watch_cb(const char *filename,
 	if (!filename)
 		return;
 
-	ssid = storage_network_ssid_from_path(filename, &security);
-	if (!ssid)
+	if (!storage_network_ssid_from_path(filename, &security))
 		return;
 
-	network_before = known_networks_find(ssid, security);
-
-	full_path = storage_get_network_file_path(security, ssid);
-
 	switch (event) {
 	case L_DIR_WATCH_EVENT_CREATED:
 	case L_DIR_WATCH_EVENT_REMOVED:
@@ -802,34 +1495,31 @@ static void known_networks_watch_cb(const char *filename,
 		 * created, permissions granted, syntax fixed, etc.)
 		 * so we always need to re-read the file.
 		 */
-		settings = storage_network_open(security, ssid);
-
-		if (settings) {
-			struct network_config config;
-
-			__network_config_parse(settings, full_path, &config);
-
-			if (network_before)
-				known_network_update(network_before, &config);
-			else
-				known_network_new(ssid, security, &config);
-		} else if (network_before)
-			known_networks_remove(network_before);
-
-		l_settings_free(settings);
-
-		break;
-	case L_DIR_WATCH_EVENT_ACCESSED:
+		type = STORAGE_DIR_EVENT_RELOAD;
 		break;
 	case L_DIR_WATCH_EVENT_ATTRIB:
-		if (network_before) {
-			connected_time = l_path_get_mtime(full_path);
-			known_network_set_connected_time(network_before,
-								connected_time);
-		}
-
+		type = STORAGE_DIR_EVENT_ATTRIB;
 		break;
+	default:
+		return;
 	}
+
+	if (!storage_dir_events)
+		storage_dir_events = l_hashmap_string_new();
+
+	/* A re-read also picks up the new connected time */
+	if (L_PTR_TO_UINT(l_hashmap_lookup(storage_dir_events,
+						filename)) >= type)
+		return;
+
+	l_hashmap_replace(storage_dir_events, filename, L_UINT_TO_PTR(type),
+				NULL);
+
+	if (!storage_dir_events_timeout)
+		storage_dir_events_timeout = l_timeout_create_ms(
+					KNOWN_NETWORKS_WATCH_DELAY_MS,
+					known_networks_watch_timeout,
+					NULL, NULL);
 }
 
 static void known_networks_watch_destroy(void *user_data)
@@ -895,48 +1585,24 @@ static char *known_frequencies_to_string(struct l_queue *known_frequencies)
 	return l_string_unwrap(str);
 }
 
-struct hotspot_search {
-	struct network_info *info;
-	const char *path;
-};
-
 static bool match_hotspot_path(const struct network_info *info, void *user_data)
 {
-	struct hotspot_search *search = user_data;
-	char *path;
-
-	if (!info->is_hotspot)
-		return true;
-
-	path = info->ops->get_file_path(info);
+	const char *path = user_data;
+	L_AUTO_FREE_VAR(char *, info_path) = info->ops->get_file_path(info);
 
-	if (!strcmp(path, search->path)) {
-		l_free(path);
-		search->info = (struct network_info *)info;
-		return false;
-	}
-
-	l_free(path);
-
-	return true;
+	return !strcmp(info_path, path);
 }
 
 static struct network_info *find_network_info_from_path(const char *path)
 {
 	enum security security;
-	struct hotspot_search search;
 	const char *ssid = storage_network_ssid_from_path(path, &security);
 
 	if (ssid)
-		return known_networks_find(ssid, security);
-
-	search.info = NULL;
-	search.path = path;
+		return known_networks_lookup(ssid, security);
 
 	/* Try hotspot */
-	known_networks_foreach(match_hotspot_path, &search);
-
-	return search.info;
+	return known_networks_find_hotspot(match_hotspot_path, (void *) path);
 }
 
 static int known_network_frequencies_load(void)
@@ -987,6 +1653,7 @@ static int known_network_frequencies_load(void)
 
 		network_info_set_uuid(info, uuid);
 		info->known_frequencies = known_frequencies;
+		known_network_neighbors_from_settings(info, groups[i]);
 
 		continue;
 
@@ -1020,12 +1687,57 @@ void known_network_frequency_sync(struct network_info *info)
 
 	l_uuid_to_string(network_info_get_uuid(info), group, sizeof(group));
 
-	l_settings_set_value(known_freqs, group, "name", file_path);
-	l_settings_set_value(known_freqs, group, "list", freq_list_str);
+	/* Nothing to write if neither the path nor the list changed */
+	if (!l_streq0(l_settings_get_value(known_freqs, group, "name"),
+							file_path) ||
+			!l_streq0(l_settings_get_value(known_freqs, group,
+							"list"),
+							freq_list_str)) {
+		l_settings_set_value(known_freqs, group, "name", file_path);
+		l_settings_set_value(known_freqs, group, "list",
+					freq_list_str);
+		known_network_neighbors_to_settings(info, group);
+		known_frequencies_schedule_sync();
+	} else if (known_network_neighbors_to_settings(info, group))
+		known_frequencies_schedule_sync();
+
 	l_free(file_path);
 	l_free(freq_list_str);
+}
 
-	storage_known_frequencies_sync(known_freqs);
+/*
+ * Remembers the frequencies of a neighbor report received on this
+ * network, along with the Mobility Domain it applies to, if any.
+ */
+void known_network_set_neighbor_frequencies(struct network_info *info,
+					const struct scan_freq_set *freqs,
+					const uint16_t *mdid)
+{
+	char group[37];
+
+	if (!info || !freqs || scan_freq_set_isempty(freqs))
+		return;
+
+	/* A new report replaces the previous one entirely */
+	scan_freq_set_free(info->neighbor_freqs);
+	info->neighbor_freqs = scan_freq_set_new();
+	scan_freq_set_merge(info->neighbor_freqs, freqs);
+
+	info->neighbor_time = time(NULL);
+	info->neighbor_has_mdid = mdid != NULL;
+	info->neighbor_mdid = mdid ? *mdid : 0;
+
+	/* Written out with the known frequencies once the network has some */
+	if (!known_freqs || !info->known_frequencies)
+		return;
+
+	l_uuid_to_string(network_info_get_uuid(info), group, sizeof(group));
+
+	if (!l_settings_has_group(known_freqs, group))
+		return;
+
+	if (known_network_neighbors_to_settings(info, group))
+		known_frequencies_schedule_sync();
 }
 
 uint32_t known_networks_watch_add(known_networks_watch_func_t func,
@@ -1056,20 +1768,33 @@ static int known_networks_init(void)
 		return -EPERM;
 	}
 
+	if (!l_dbus_register_interface(dbus,
+					IWD_KNOWN_NETWORK_MANAGER_INTERFACE,
+					setup_known_network_manager_interface,
+					NULL, false))
+		l_info("Unable to register %s interface",
+				IWD_KNOWN_NETWORK_MANAGER_INTERFACE);
+
 	dir = opendir(storage_dir);
 	if (!dir) {
 		l_info("Unable to open %s: %s", storage_dir, strerror(errno));
+		l_dbus_unregister_interface(dbus,
+					IWD_KNOWN_NETWORK_MANAGER_INTERFACE);
 		l_dbus_unregister_interface(dbus, IWD_KNOWN_NETWORK_INTERFACE);
 		return -ENOENT;
 	}
 
 	known_networks = l_queue_new();
+	known_networks_index = l_hashmap_new();
+	l_hashmap_set_hash_function(known_networks_index, network_info_hash);
+	l_hashmap_set_compare_function(known_networks_index,
+					network_info_compare);
+	known_hotspots = l_queue_new();
+	pending_networks = l_queue_new();
 
 	while ((dirent = readdir(dir))) {
 		const char *ssid;
 		enum security security;
-		struct l_settings *settings;
-		L_AUTO_FREE_VAR(char *, full_path) = NULL;
 
 		if (dirent->d_type == DT_UNKNOWN) {
 			if (!storage_is_file(dirent->d_name))
@@ -1084,18 +1809,7 @@ static int known_networks_init(void)
 		if (!ssid)
 			continue;
 
-		settings = storage_network_open(security, ssid);
-
-		full_path = storage_get_network_file_path(security, ssid);
-
-		if (settings) {
-			struct network_config config;
-
-			__network_config_parse(settings, full_path, &config);
-			known_network_new(ssid, security, &config);
-		}
-
-		l_settings_free(settings);
+		known_network_new_pending(ssid, security);
 	}
 
 	closedir(dir);
@@ -1105,6 +1819,13 @@ static int known_networks_init(void)
 						known_networks_watch_destroy);
 	watchlist_init(&known_network_watches, NULL);
 
+	if (!l_dbus_object_add_interface(dbus, IWD_KNOWN_NETWORK_MANAGER_PATH,
+					IWD_KNOWN_NETWORK_MANAGER_INTERFACE,
+					NULL))
+		l_info("Unable to add %s at %s",
+				IWD_KNOWN_NETWORK_MANAGER_INTERFACE,
+				IWD_KNOWN_NETWORK_MANAGER_PATH);
+
 	return 0;
 }
 
@@ -1113,10 +1834,26 @@ static void known_networks_exit(void)
 	struct l_dbus *dbus = dbus_get_bus();
 
 	l_dir_watch_destroy(storage_dir_watch);
+	l_timeout_remove(l_steal_ptr(storage_dir_events_timeout));
+	l_hashmap_destroy(storage_dir_events, NULL);
+	storage_dir_events = NULL;
+
+	if (import_work)
+		known_network_import_work_free(l_steal_ptr(import_work));
+
+	l_queue_destroy(pending_networks, NULL);
+	pending_networks = NULL;
+	l_hashmap_destroy(known_networks_index, NULL);
+	known_networks_index = NULL;
+	l_queue_destroy(known_hotspots, NULL);
+	known_hotspots = NULL;
 
 	l_queue_destroy(known_networks, network_info_free);
 	known_networks = NULL;
 
+	l_dbus_object_remove_interface(dbus, IWD_KNOWN_NETWORK_MANAGER_PATH,
+					IWD_KNOWN_NETWORK_MANAGER_INTERFACE);
+	l_dbus_unregister_interface(dbus, IWD_KNOWN_NETWORK_MANAGER_INTERFACE);
 	l_dbus_unregister_interface(dbus, IWD_KNOWN_NETWORK_INTERFACE);
 
 	watchlist_destroy(&known_network_watches);
@@ -1126,7 +1863,11 @@ IWD_MODULE(known_networks, known_networks_init, known_networks_exit)
 
 static void known_frequencies_exit(void)
 {
+	if (known_freqs_sync_timeout)
+		known_frequencies_sync_cb(known_freqs_sync_timeout, NULL);
+
 	l_settings_free(known_freqs);
+	known_freqs = NULL;
 }
 
 /*
@@ -78,10 +78,17 @@ struct network_info {
 	char ssid[33];
 	enum security type;
 	struct l_queue *known_frequencies;
+	struct scan_freq_set *neighbor_freqs;	/* Last neighbor report */
+	uint64_t neighbor_time;		/* Reception time, seconds */
+	uint16_t neighbor_mdid;
+	bool neighbor_has_mdid:1;
 	int seen_count;			/* Ref count for network.info */
+	int offset;			/* Cached known_network_offset */
+	unsigned int offset_generation;
 	uint8_t uuid[16];
 	bool is_hotspot:1;
 	bool has_uuid:1;
+	bool config_pending:1;		/* Profile not parsed yet */
 	struct network_config config;
 };
 
@@ -105,8 +112,13 @@ void __network_info_init(struct network_info *info,
 				struct network_config *config);
 
 int known_network_offset(const struct network_info *target);
+void known_network_seen(struct network_info *info);
+void known_network_unseen(struct network_info *info);
 bool known_networks_foreach(known_networks_foreach_func_t function,
 				void *user_data);
+struct network_info *known_networks_find_hotspot(
+					known_networks_foreach_func_t match,
+					void *user_data);
 bool known_networks_has_hidden(void);
 struct network_info *known_networks_find(const char *ssid,
 						enum security security);
@@ -115,6 +127,12 @@ struct scan_freq_set *known_networks_get_recent_frequencies(
 						uint8_t num_networks_tosearch);
 int known_network_add_frequency(struct network_info *info, uint32_t frequency);
 void known_network_frequency_sync(struct network_info *info);
+void known_network_set_neighbor_frequencies(struct network_info *info,
+					const struct scan_freq_set *freqs,
+					const uint16_t *mdid);
+struct scan_freq_set *known_network_get_neighbor_frequencies(
+					const struct network_info *info,
+					const uint16_t *mdid);
 
 uint32_t known_networks_watch_add(known_networks_watch_func_t func,
 					void *user_data,
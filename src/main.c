@@ -25,6 +25,8 @@
 #endif
 
 #include <stdio.h>
+#include <stdarg.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <getopt.h>
@@ -45,6 +47,8 @@
 #include "src/dbus.h"
 #include "src/eap.h"
 #include "src/eapol.h"
+#include "src/eap-tls-common.h"
+#include "src/erp.h"
 #include "src/rfkill.h"
 #include "src/storage.h"
 #include "src/anqp.h"
@@ -65,6 +69,9 @@ static const char *debugopt;
 static bool developeropt;
 static bool terminating;
 static bool nl80211_complete;
+static bool dbus_name_acquired;
+static bool modules_started;
+static uint64_t startup_time;
 
 static void main_loop_quit(struct l_timeout *timeout, void *user_data)
 {
@@ -78,7 +85,7 @@ static void iwd_shutdown(void)
 
 	terminating = true;
 
-	if (!nl80211_complete) {
+	if (!modules_started) {
 		l_main_quit();
 		return;
 	}
@@ -140,6 +147,35 @@ bool iwd_is_developer_mode(void)
 	return developeropt;
 }
 
+/*
+ * With IWD_STARTUP_TRACE set the main startup steps are logged along
+ * with the time elapsed since the daemon started, until the first scan
+ * results come in.
+ */
+void iwd_startup_trace(const char *format, ...)
+{
+	va_list args;
+	uint64_t elapsed;
+	_auto_(l_free) char *event = NULL;
+
+	if (!startup_time)
+		return;
+
+	va_start(args, format);
+	event = l_strdup_vprintf(format, args);
+	va_end(args);
+
+	elapsed = l_time_diff(startup_time, l_time_now());
+	l_info("startup: +%" PRIu64 ".%03" PRIu64 " ms %s",
+		elapsed / 1000, elapsed % 1000, event);
+}
+
+void iwd_startup_trace_end(void)
+{
+	iwd_startup_trace("complete");
+	startup_time = 0;
+}
+
 static void usage(void)
 {
 	printf("iwd - Wireless daemon\n"
@@ -175,17 +211,34 @@ static void do_debug(const char *str, void *user_data)
 	l_info("%s%s", prefix, str);
 }
 
-static void nl80211_appeared(const struct l_genl_family_info *info,
-							void *user_data)
+/*
+ * The nl80211 family lookup and the D-Bus name request are independent
+ * round trips so both are started right away and the modules are only
+ * initialized once both have completed.
+ */
+static void iwd_modules_start(void)
 {
-	l_debug("Found nl80211 interface");
+	if (!nl80211_complete || !dbus_name_acquired || modules_started)
+		return;
 
-	nl80211_complete = true;
+	modules_started = true;
 
 	if (iwd_modules_init() < 0) {
 		l_main_quit();
 		return;
 	}
+
+	iwd_startup_trace("modules initialized");
+}
+
+static void nl80211_appeared(const struct l_genl_family_info *info,
+							void *user_data)
+{
+	l_debug("Found nl80211 interface");
+
+	nl80211_complete = true;
+	iwd_startup_trace("nl80211 family found");
+	iwd_modules_start();
 }
 
 static void request_name_callback(struct l_dbus *dbus, bool success,
@@ -209,9 +262,9 @@ static void request_name_callback(struct l_dbus *dbus, bool success,
 			IWD_DAEMON_INTERFACE, L_DBUS_INTERFACE_PROPERTIES,
 			IWD_BASE_PATH);
 
-	/* TODO: Always request nl80211 for now, ignoring auto-loading */
-	l_genl_request_family(genl, NL80211_GENL_NAME, nl80211_appeared,
-				NULL, NULL);
+	dbus_name_acquired = true;
+	iwd_startup_trace("D-Bus name acquired");
+	iwd_modules_start();
 	return;
 
 fail_exit:
@@ -468,8 +521,13 @@ int main(int argc, char *argv[])
 	struct l_dbus *dbus;
 	const char *config_dir;
 	char **config_dirs;
+	bool persist_tls_sessions;
+	bool persist_erp_keys;
 	int i;
 
+	if (getenv("IWD_STARTUP_TRACE"))
+		startup_time = l_time_now();
+
 	for (;;) {
 		int opt;
 
@@ -561,11 +619,25 @@ int main(int argc, char *argv[])
 	__eapol_set_config(iwd_config);
 	__eap_set_config(iwd_config);
 
+	if (l_settings_get_bool(iwd_config, "EAP", "PersistTLSSessions",
+					&persist_tls_sessions) &&
+			persist_tls_sessions)
+		eap_tls_set_session_cache_ops(storage_eap_tls_cache_load,
+						storage_eap_tls_cache_sync);
+
+	if (l_settings_get_bool(iwd_config, "EAP", "PersistERPKeys",
+					&persist_erp_keys) &&
+			persist_erp_keys)
+		erp_set_cache_ops(storage_erp_cache_load,
+					storage_erp_cache_sync);
+
 	exit_status = EXIT_FAILURE;
 
 	if (!storage_create_dirs())
 		goto failed_dirs;
 
+	iwd_startup_trace("configuration loaded");
+
 	genl = l_genl_new();
 	if (!genl) {
 		l_error("Failed to open generic netlink socket");
@@ -575,6 +647,10 @@ int main(int argc, char *argv[])
 	if (getenv("IWD_GENL_DEBUG"))
 		l_genl_set_debug(genl, do_debug, "[GENL] ", NULL);
 
+	/* TODO: Always request nl80211 for now, ignoring auto-loading */
+	l_genl_request_family(genl, NL80211_GENL_NAME, nl80211_appeared,
+				NULL, NULL);
+
 	rtnl = l_netlink_new(NETLINK_ROUTE);
 	if (!rtnl) {
 		l_error("Failed to open route netlink socket");
@@ -67,10 +67,23 @@ struct wiphy_setup_state {
 };
 
 static struct l_queue *pending_wiphys;
+/* pending_wiphys indexed by wiphy id, looked up for every dump message */
+static struct l_hashmap *pending_index;
+
+static void manager_pending_add(struct wiphy_setup_state *state)
+{
+	l_queue_push_tail(pending_wiphys, state);
+	l_hashmap_replace(pending_index, L_UINT_TO_PTR(state->id), state,
+				NULL);
+}
 
 static void wiphy_setup_state_free(void *data)
 {
 	struct wiphy_setup_state *state = data;
+	void *key = L_UINT_TO_PTR(state->id);
+
+	if (l_hashmap_lookup(pending_index, key) == state)
+		l_hashmap_remove(pending_index, key);
 
 	l_queue_destroy(state->default_interfaces,
 				(l_queue_destroy_func_t) l_genl_msg_unref);
@@ -427,18 +440,9 @@ delete_interface:
 	state->pending_cmd_count++;
 }
 
-static bool manager_wiphy_state_match(const void *a, const void *b)
-{
-	const struct wiphy_setup_state *state = a;
-	uint32_t id = L_PTR_TO_UINT(b);
-
-	return (state->id == id);
-}
-
 static struct wiphy_setup_state *manager_find_pending(uint32_t id)
 {
-	return l_queue_find(pending_wiphys, manager_wiphy_state_match,
-				L_UINT_TO_PTR(id));
+	return l_hashmap_lookup(pending_index, L_UINT_TO_PTR(id));
 }
 
 static uint32_t manager_parse_wiphy_id(struct l_genl_msg *msg)
@@ -515,6 +519,7 @@ static bool manager_check_create_interfaces(void *data, void *user_data)
 static void manager_interface_dump_done(void *user_data)
 {
 	l_debug("");
+	iwd_startup_trace("interface dump done");
 
 	l_queue_foreach_remove(pending_wiphys,
 				manager_check_create_interfaces, NULL);
@@ -551,8 +556,9 @@ static void manager_wiphy_dump_callback(struct l_genl_msg *msg, void *user_data)
 	state->wiphy = wiphy;
 
 	l_debug("New wiphy %s added (%d)", name, id);
+	iwd_startup_trace("wiphy %s found", name);
 
-	l_queue_push_tail(pending_wiphys, state);
+	manager_pending_add(state);
 
 done:
 	wiphy_update_from_genl(wiphy, msg);
@@ -600,6 +606,7 @@ static void manager_wiphy_dump_done(void *user_data)
 	const struct l_queue_entry *e;
 
 	l_debug("");
+	iwd_startup_trace("wiphy dump done");
 
 	for (e = l_queue_get_entries(pending_wiphys); e; e = e->next)
 		manager_filtered_wiphy_dump_done(e->data);
@@ -721,7 +728,7 @@ static void manager_config_notify(struct l_genl_msg *msg, void *user_data)
 			return;
 		}
 
-		l_queue_push_tail(pending_wiphys, state);
+		manager_pending_add(state);
 		return;
 	}
 
@@ -819,6 +826,7 @@ static int manager_init(void)
 		blacklist_filter = l_strsplit(if_blacklist, ',');
 
 	pending_wiphys = l_queue_new();
+	pending_index = l_hashmap_new();
 
 	if (!l_genl_family_register(nl80211, "config", manager_config_notify,
 					NULL, NULL)) {
@@ -868,6 +876,8 @@ static int manager_init(void)
 error:
 	l_queue_destroy(pending_wiphys, NULL);
 	pending_wiphys = NULL;
+	l_hashmap_destroy(pending_index, NULL);
+	pending_index = NULL;
 
 	l_genl_family_free(nl80211);
 	nl80211 = NULL;
@@ -882,6 +892,8 @@ static void manager_exit(void)
 
 	l_queue_destroy(pending_wiphys, wiphy_setup_state_free);
 	pending_wiphys = NULL;
+	l_hashmap_destroy(pending_index, NULL);
+	pending_index = NULL;
 
 	l_genl_family_free(nl80211);
 	nl80211 = NULL;
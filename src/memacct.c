@@ -0,0 +1,249 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <malloc.h>
+#include <inttypes.h>
+
+#include <ell/ell.h>
+
+#include "src/module.h"
+#include "src/memacct.h"
+
+struct memacct_stats {
+	uint64_t live_bytes;
+	uint64_t live_allocs;
+	uint64_t peak_bytes;
+	uint64_t total_allocs;
+};
+
+/*
+ * Live tagged blocks, an open addressing table with linear probing.  It
+ * is kept on the libc heap since it is updated from within l_free.
+ */
+struct memacct_entry {
+	const void *ptr;
+	uint32_t size;
+	uint32_t module;
+};
+
+static const char *module_names[__MEMACCT_MODULE_MAX] = {
+	[MEMACCT_SCAN] = "scan",
+	[MEMACCT_STATION] = "station",
+	[MEMACCT_NETWORK] = "network",
+	[MEMACCT_EAPOL] = "eapol",
+	[MEMACCT_AP] = "ap",
+	[MEMACCT_P2P] = "p2p",
+	[MEMACCT_DPP] = "dpp",
+};
+
+static struct memacct_stats stats[__MEMACCT_MODULE_MAX];
+static uint64_t total_live_bytes;
+static uint64_t total_peak_bytes;
+static struct memacct_entry *table;
+static size_t table_size;
+static size_t table_used;
+static struct l_signal *report_signal;
+
+void __wrap_l_free(void *ptr);
+void __real_l_free(void *ptr);
+
+static size_t entry_slot(const void *ptr, size_t size)
+{
+	uint64_t h = (uintptr_t) ptr >> 4;
+
+	return (h * 0x9e3779b97f4a7c15ULL) >> 32 & (size - 1);
+}
+
+static bool table_grow(void)
+{
+	size_t old_size = table_size;
+	struct memacct_entry *old = table;
+	size_t new_size = old_size ? old_size * 2 : 1024;
+	size_t i;
+
+	table = calloc(new_size, sizeof(struct memacct_entry));
+	if (!table) {
+		table = old;
+		return false;
+	}
+
+	table_size = new_size;
+
+	for (i = 0; i < old_size; i++) {
+		size_t slot;
+
+		if (!old[i].ptr)
+			continue;
+
+		slot = entry_slot(old[i].ptr, table_size);
+
+		while (table[slot].ptr)
+			slot = (slot + 1) & (table_size - 1);
+
+		table[slot] = old[i];
+	}
+
+	free(old);
+	return true;
+}
+
+static void entry_remove(const void *ptr)
+{
+	struct memacct_stats *s;
+	size_t slot;
+	size_t next;
+
+	if (!table_used)
+		return;
+
+	slot = entry_slot(ptr, table_size);
+
+	while (table[slot].ptr != ptr) {
+		if (!table[slot].ptr)
+			return;
+
+		slot = (slot + 1) & (table_size - 1);
+	}
+
+	s = &stats[table[slot].module];
+	s->live_bytes -= table[slot].size;
+	s->live_allocs -= 1;
+	total_live_bytes -= table[slot].size;
+	table_used -= 1;
+
+	/* Shift back the entries that probed past the freed slot */
+	for (next = (slot + 1) & (table_size - 1); table[next].ptr;
+			next = (next + 1) & (table_size - 1)) {
+		size_t home = entry_slot(table[next].ptr, table_size);
+
+		if (((next - home) & (table_size - 1)) <
+				((next - slot) & (table_size - 1)))
+			continue;
+
+		table[slot] = table[next];
+		slot = next;
+	}
+
+	table[slot].ptr = NULL;
+}
+
+void *memacct_track(enum memacct_module module, void *ptr)
+{
+	struct memacct_stats *s = &stats[module];
+	size_t size;
+	size_t slot;
+
+	if (!ptr)
+		return NULL;
+
+	if ((table_used + 1) * 2 > table_size && !table_grow())
+		return ptr;
+
+	size = malloc_usable_size(ptr);
+	slot = entry_slot(ptr, table_size);
+
+	while (table[slot].ptr)
+		slot = (slot + 1) & (table_size - 1);
+
+	table[slot].ptr = ptr;
+	table[slot].size = size;
+	table[slot].module = module;
+	table_used += 1;
+
+	s->live_bytes += size;
+	s->live_allocs += 1;
+	s->total_allocs += 1;
+
+	if (s->live_bytes > s->peak_bytes)
+		s->peak_bytes = s->live_bytes;
+
+	total_live_bytes += size;
+
+	if (total_live_bytes > total_peak_bytes)
+		total_peak_bytes = total_live_bytes;
+
+	return ptr;
+}
+
+void *memacct_realloc(enum memacct_module module, void *ptr, size_t size)
+{
+	/* The old block is released without going through l_free */
+	if (ptr)
+		entry_remove(ptr);
+
+	return memacct_track(module, l_realloc(ptr, size));
+}
+
+void __wrap_l_free(void *ptr)
+{
+	if (ptr)
+		entry_remove(ptr);
+
+	__real_l_free(ptr);
+}
+
+void memacct_report(void)
+{
+	unsigned int i;
+
+	l_info("memory: %-8s %12s %10s %12s %12s", "module", "live bytes",
+		"allocs", "peak bytes", "total allocs");
+
+	for (i = 0; i < __MEMACCT_MODULE_MAX; i++)
+		l_info("memory: %-8s %12" PRIu64 " %10" PRIu64 " %12" PRIu64
+			" %12" PRIu64, module_names[i], stats[i].live_bytes,
+			stats[i].live_allocs, stats[i].peak_bytes,
+			stats[i].total_allocs);
+
+	l_info("memory: %-8s %12" PRIu64 " %10zu %12" PRIu64, "total",
+		total_live_bytes, table_used, total_peak_bytes);
+}
+
+static void report_signal_cb(void *user_data)
+{
+	memacct_report();
+}
+
+static int memacct_init(void)
+{
+	report_signal = l_signal_create(SIGUSR1, report_signal_cb, NULL,
+					NULL);
+	if (!report_signal)
+		l_warn("Unable to handle SIGUSR1, no memory reports");
+
+	return 0;
+}
+
+static void memacct_exit(void)
+{
+	l_signal_remove(report_signal);
+	report_signal = NULL;
+}
+
+IWD_MODULE(memacct, memacct_init, memacct_exit)
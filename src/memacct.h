@@ -0,0 +1,64 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Per module heap accounting, built with --enable-mem-accounting.  A
+ * module opts in by defining MEMACCT_MODULE before including this header,
+ * after <ell/ell.h>, so that its l_new, l_malloc, l_realloc, l_memdup and
+ * l_strdup* calls are tagged with that module.  Frees are caught through
+ * a link time wrapper of l_free wherever they happen.  Without the build
+ * option this header has no effect.
+ */
+
+#ifdef HAVE_MEM_ACCOUNTING
+
+#include <stddef.h>
+
+enum memacct_module {
+	MEMACCT_SCAN,
+	MEMACCT_STATION,
+	MEMACCT_NETWORK,
+	MEMACCT_EAPOL,
+	MEMACCT_AP,
+	MEMACCT_P2P,
+	MEMACCT_DPP,
+	__MEMACCT_MODULE_MAX,
+};
+
+void *memacct_track(enum memacct_module module, void *ptr);
+void *memacct_realloc(enum memacct_module module, void *ptr, size_t size);
+
+void memacct_report(void);
+
+#ifdef MEMACCT_MODULE
+#define l_malloc(size) memacct_track(MEMACCT_MODULE, l_malloc(size))
+#define l_realloc(ptr, size) memacct_realloc(MEMACCT_MODULE, ptr, size)
+#define l_memdup(mem, size) memacct_track(MEMACCT_MODULE, l_memdup(mem, size))
+#define l_strdup(str) \
+	((char *) memacct_track(MEMACCT_MODULE, l_strdup(str)))
+#define l_strndup(str, max) \
+	((char *) memacct_track(MEMACCT_MODULE, l_strndup(str, max)))
+#define l_strdup_printf(...) \
+	((char *) memacct_track(MEMACCT_MODULE, l_strdup_printf(__VA_ARGS__)))
+#endif
+
+#endif
@@ -25,6 +25,8 @@
 #endif
 
 #include <errno.h>
+#include <stdlib.h>
+#include <inttypes.h>
 #include <ell/ell.h>
 
 #include "src/module.h"
@@ -102,6 +104,7 @@ int iwd_modules_init(void)
 	size_t n_modules;
 	size_t n_deps;
 	size_t offset;
+	bool trace = getenv("IWD_STARTUP_TRACE");
 	int r;
 
 	l_debug("");
@@ -148,9 +151,15 @@ int iwd_modules_init(void)
 	sorted = NULL;
 
 	for (i = 0; i < n_modules; i++) {
+		uint64_t start = trace ? l_time_now() : 0;
+
 		desc = modules_sorted[i];
 		r = desc->init();
 
+		if (trace)
+			l_info("startup: module %s init took %" PRIu64 " us",
+				desc->name, l_time_diff(start, l_time_now()));
+
 		if (r < 0) {
 			l_error("Module %s failed to start: %d", desc->name, r);
 			return r;
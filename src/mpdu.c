@@ -787,6 +787,28 @@ const struct mmpdu_header *mpdu_validate(const uint8_t *frame, int len)
 	}
 }
 
+/*
+ * Only checks that this is a management frame with a complete header, so
+ * that the addresses and mmpdu_body() can be used.  The frame body is not
+ * looked at, callers must still run mpdu_validate() before parsing it.
+ */
+const struct mmpdu_header *mpdu_validate_header(const uint8_t *frame, int len)
+{
+	const struct mmpdu_header *mmpdu = (const struct mmpdu_header *) frame;
+	int offset = 2;
+
+	if (!frame || len < 2)
+		return NULL;
+
+	if (mmpdu->fc.type != MPDU_TYPE_MANAGEMENT)
+		return NULL;
+
+	if (!validate_mgmt_header(mmpdu, len, &offset))
+		return NULL;
+
+	return mmpdu;
+}
+
 size_t mmpdu_header_len(const struct mmpdu_header *mmpdu)
 {
 	return mmpdu->fc.order == 0 ? 24 : 28;
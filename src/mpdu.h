@@ -410,6 +410,7 @@ struct mmpdu_deauthentication {
 } __attribute__ ((packed));
 
 const struct mmpdu_header *mpdu_validate(const uint8_t *frame, int len);
+const struct mmpdu_header *mpdu_validate_header(const uint8_t *frame, int len);
 const void *mmpdu_body(const struct mmpdu_header *mpdu);
 size_t mmpdu_header_len(const struct mmpdu_header *mmpdu);
 
@@ -32,6 +32,7 @@
 #include <linux/rtnetlink.h>
 #include <limits.h>
 #include <string.h>
+#include <time.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -51,6 +52,36 @@
 #include "src/ie.h"
 #include "src/netconfig.h"
 #include "src/sysfs.h"
+#include "src/storage.h"
+
+/* Last DHCPv4 lease granted on a network, addresses in network order */
+struct netconfig_lease {
+	uint32_t address;
+	uint8_t prefix_len;
+	uint32_t gateway;
+	uint32_t server_id;
+	uint64_t expires;
+};
+
+struct netconfig_rtnl_cmd {
+	struct netconfig_rtnl_batch *batch;
+	const char *what;
+	uint32_t id;
+	int error;
+};
+
+/*
+ * RTNL requests configuring one address family, their results are
+ * collected so that the family is either fully configured or failed.
+ */
+struct netconfig_rtnl_batch {
+	struct netconfig *netconfig;
+	uint8_t family;
+	struct netconfig_rtnl_cmd cmds[3];
+	unsigned int n_cmds;
+	unsigned int n_pending;
+	bool failed : 1;
+};
 
 struct netconfig {
 	uint32_t ifindex;
@@ -73,6 +104,13 @@ struct netconfig {
 
 	const struct l_settings *active_settings;
 
+	char *lease_id;
+	struct netconfig_lease cached_lease;
+	bool v4_optimistic : 1;
+	bool v4_skip_probes : 1;
+	bool v4_ready : 1;
+	bool v6_ready : 1;
+
 	netconfig_notify_func_t notify;
 	void *user_data;
 
@@ -80,21 +118,36 @@ struct netconfig {
 
 	struct l_acd *acd;
 
-	uint32_t addr4_add_cmd_id;
-	uint32_t addr6_add_cmd_id;
-	uint32_t route4_add_gateway_cmd_id;
-	uint32_t route6_add_cmd_id;
+	struct netconfig_rtnl_batch batch4;
+	struct netconfig_rtnl_batch batch6;
 };
 
 static struct l_netlink *rtnl;
 static struct l_queue *netconfig_list;
 
+/*
+ * DHCPv4 leases of the known networks, one group per network and only
+ * kept until the lease expires.
+ */
+static struct l_settings *lease_cache;
+
 /*
  * Routing priority offset, configurable in main.conf. The route with lower
  * priority offset is preferred.
  */
 static uint32_t ROUTE_PRIORITY_OFFSET;
 static bool ipv6_enabled;
+static bool optimistic_dhcp;
+static bool fast_dad;
+static bool fils_fast_path;
+
+/* Address families that must be configured before signaling CONNECTED */
+static enum {
+	READINESS_IPV4,
+	READINESS_IPV6,
+	READINESS_ANY,
+	READINESS_ALL,
+} readiness_policy;
 
 static void do_debug(const char *str, void *user_data)
 {
@@ -126,6 +179,7 @@ static void netconfig_free(void *data)
 	l_dhcp_client_destroy(netconfig->dhcp_client);
 	l_dhcp6_client_destroy(netconfig->dhcp6_client);
 
+	l_free(netconfig->lease_id);
 	l_free(netconfig);
 }
 
@@ -237,10 +291,15 @@ static char **netconfig_get_dns_list(struct netconfig *netconfig, int af,
 		}
 
 		lease = l_dhcp_client_get_lease(netconfig->dhcp_client);
-		if (!lease)
-			return NULL;
+		if (lease)
+			return l_dhcp_lease_get_dns(lease);
+
+		if (netconfig->v4_optimistic)
+			return l_settings_get_string_list(lease_cache,
+							netconfig->lease_id,
+							"DNS", ' ');
 
-		return l_dhcp_lease_get_dns(lease);
+		return NULL;
 	} else {
 		const struct l_dhcp6_lease *lease;
 
@@ -501,10 +560,15 @@ static char *netconfig_ipv4_get_gateway(struct netconfig *netconfig,
 		}
 
 		lease = l_dhcp_client_get_lease(netconfig->dhcp_client);
-		if (!lease)
-			return NULL;
+		if (lease)
+			return l_dhcp_lease_get_gateway(lease);
 
-		return l_dhcp_lease_get_gateway(lease);
+		if (netconfig->v4_optimistic &&
+				netconfig->cached_lease.gateway)
+			return netconfig_ipv4_to_string(
+					netconfig->cached_lease.gateway);
+
+		return NULL;
 	}
 
 	return NULL;
@@ -793,51 +857,166 @@ static void netconfig_ifaddr_ipv6_cmd_cb(int error, uint16_t type,
 	netconfig_ifaddr_ipv6_notify(type, data, len, user_data);
 }
 
-static void netconfig_route_generic_cb(int error, uint16_t type,
-					const void *data, uint32_t len,
-					void *user_data)
+static void netconfig_family_ready(struct netconfig *netconfig, int af)
 {
-	if (error) {
-		l_error("netconfig: Failed to add route. Error %d: %s",
-						error, strerror(-error));
+	bool v6_enabled = netconfig->rtm_v6_protocol != RTPROT_UNSPEC;
+	bool ready;
+
+	if (af == AF_INET)
+		netconfig->v4_ready = true;
+	else
+		netconfig->v6_ready = true;
+
+	if (!netconfig->notify)
+		return;
+
+	switch (readiness_policy) {
+	case READINESS_IPV6:
+		if (v6_enabled) {
+			ready = netconfig->v6_ready;
+			break;
+		}
+
+		/* Fall through. */
+	case READINESS_IPV4:
+		ready = netconfig->v4_ready;
+		break;
+	case READINESS_ANY:
+		ready = netconfig->v4_ready || netconfig->v6_ready;
+		break;
+	case READINESS_ALL:
+		ready = netconfig->v4_ready &&
+			(netconfig->v6_ready || !v6_enabled);
+		break;
+	default:
+		ready = false;
+	}
+
+	if (!ready)
 		return;
+
+	l_debug("IPv4 %s, IPv6 %s", netconfig->v4_ready ? "ready" : "pending",
+		!v6_enabled ? "disabled" :
+		netconfig->v6_ready ? "ready" : "pending");
+
+	netconfig->notify(NETCONFIG_EVENT_CONNECTED, netconfig->user_data);
+	netconfig->notify = NULL;
+}
+
+static void netconfig_batch_cancel(struct netconfig_rtnl_batch *batch)
+{
+	unsigned int i;
+
+	for (i = 0; i < batch->n_cmds; i++) {
+		if (!batch->cmds[i].id)
+			continue;
+
+		l_netlink_cancel(rtnl, batch->cmds[i].id);
+		batch->cmds[i].id = 0;
 	}
+
+	batch->n_cmds = 0;
+	batch->n_pending = 0;
 }
 
-static void netconfig_route_add_cmd_cb(int error, uint16_t type,
-						const void *data, uint32_t len,
-						void *user_data)
+static void netconfig_batch_start(struct netconfig_rtnl_batch *batch,
+					struct netconfig *netconfig,
+					uint8_t family)
 {
-	struct netconfig *netconfig = user_data;
+	netconfig_batch_cancel(batch);
+	batch->netconfig = netconfig;
+	batch->family = family;
+	batch->failed = false;
+}
 
-	netconfig->route4_add_gateway_cmd_id = 0;
+static void netconfig_batch_done(struct netconfig_rtnl_batch *batch)
+{
+	unsigned int i;
 
-	if (error) {
-		l_error("netconfig: Failed to add route. Error %d: %s",
-						error, strerror(-error));
-		return;
+	for (i = 0; i < batch->n_cmds; i++) {
+		struct netconfig_rtnl_cmd *cmd = &batch->cmds[i];
+
+		if (!cmd->error)
+			continue;
+
+		l_error("netconfig: Failed to add %s. Error %d: %s",
+				cmd->what, cmd->error, strerror(-cmd->error));
+		batch->failed = true;
 	}
 
-	if (!netconfig->notify)
+	batch->n_cmds = 0;
+
+	if (batch->failed)
 		return;
 
-	netconfig->notify(NETCONFIG_EVENT_CONNECTED, netconfig->user_data);
-	netconfig->notify = NULL;
+	netconfig_family_ready(batch->netconfig, batch->family);
 }
 
-static void netconfig_route6_add_cb(int error, uint16_t type,
+static void netconfig_batch_cmd_cb(int error, uint16_t type,
 					const void *data, uint32_t len,
 					void *user_data)
 {
-	struct netconfig *netconfig = user_data;
+	struct netconfig_rtnl_cmd *cmd = user_data;
+	struct netconfig_rtnl_batch *batch = cmd->batch;
 
-	netconfig->route6_add_cmd_id = 0;
+	cmd->id = 0;
 
-	if (error) {
-		l_error("netconfig: Failed to add route. Error %d: %s",
-						error, strerror(-error));
+	/* Leftovers of a previous connection are as good as new entries */
+	cmd->error = error == -EEXIST ? 0 : error;
+
+	if (--batch->n_pending)
 		return;
+
+	netconfig_batch_done(batch);
+}
+
+/*
+ * Reserve a slot for a request whose result is aggregated with the other
+ * requests of the batch, the slot is passed as user_data to the l_rtnl
+ * call along with netconfig_batch_cmd_cb and the resulting id is then
+ * given to netconfig_batch_sent().
+ */
+static struct netconfig_rtnl_cmd *netconfig_batch_next(
+					struct netconfig_rtnl_batch *batch,
+					const char *what)
+{
+	struct netconfig_rtnl_cmd *cmd;
+
+	if (L_WARN_ON(batch->n_cmds == L_ARRAY_SIZE(batch->cmds)))
+		return NULL;
+
+	cmd = &batch->cmds[batch->n_cmds++];
+	cmd->batch = batch;
+	cmd->what = what;
+	cmd->error = 0;
+	cmd->id = 0;
+
+	return cmd;
+}
+
+static bool netconfig_batch_sent(struct netconfig_rtnl_cmd *cmd, uint32_t id)
+{
+	if (!id) {
+		l_error("netconfig: Failed to send %s request", cmd->what);
+		cmd->batch->failed = true;
+		return false;
 	}
+
+	cmd->id = id;
+	cmd->batch->n_pending++;
+	return true;
+}
+
+/*
+ * Only once every request has been queued does the batch complete, this
+ * way a reply arriving early can't signal a partially configured family.
+ */
+static void netconfig_batch_commit(struct netconfig_rtnl_batch *batch)
+{
+	if (batch->n_pending)
+		return;
+
+	netconfig_batch_done(batch);
 }
 
 static bool netconfig_ipv4_subnet_route_install(struct netconfig *netconfig)
@@ -847,6 +1026,7 @@ static bool netconfig_ipv4_subnet_route_install(struct netconfig *netconfig)
 	char network[INET_ADDRSTRLEN];
 	unsigned int prefix_len =
 		l_rtnl_address_get_prefix_length(netconfig->v4_address);
+	struct netconfig_rtnl_cmd *cmd;
 
 	if (!l_rtnl_address_get_address(netconfig->v4_address, ip) ||
 			inet_pton(AF_INET, ip, &in_addr) < 1)
@@ -858,16 +1038,16 @@ static bool netconfig_ipv4_subnet_route_install(struct netconfig *netconfig)
 	if (!inet_ntop(AF_INET, &in_addr, network, INET_ADDRSTRLEN))
 		return false;
 
-	if (!l_rtnl_route4_add_connected(rtnl, netconfig->ifindex,
-						prefix_len, network, ip,
-						netconfig->rtm_protocol,
-						netconfig_route_generic_cb,
-						netconfig, NULL)) {
-		l_error("netconfig: Failed to add subnet route.");
+	cmd = netconfig_batch_next(&netconfig->batch4, "subnet route");
+	if (!cmd)
 		return false;
-	}
 
-	return true;
+	return netconfig_batch_sent(cmd,
+			l_rtnl_route4_add_connected(rtnl, netconfig->ifindex,
+						prefix_len, network, ip,
+						netconfig->rtm_protocol,
+						netconfig_batch_cmd_cb,
+						cmd, NULL));
 }
 
 static bool netconfig_ipv4_gateway_route_install(struct netconfig *netconfig)
@@ -876,19 +1056,13 @@ static bool netconfig_ipv4_gateway_route_install(struct netconfig *netconfig)
 	const uint8_t *gateway_mac = NULL;
 	struct in_addr in_addr;
 	char ip[INET_ADDRSTRLEN];
+	struct netconfig_rtnl_cmd *cmd;
 
 	gateway = netconfig_ipv4_get_gateway(netconfig, &gateway_mac);
 	if (!gateway) {
 		l_debug("No gateway obtained from %s.",
 				netconfig->rtm_protocol == RTPROT_STATIC ?
 				"setting file" : "DHCPv4 lease");
-
-		if (netconfig->notify) {
-			netconfig->notify(NETCONFIG_EVENT_CONNECTED,
-						netconfig->user_data);
-			netconfig->notify = NULL;
-		}
-
 		return true;
 	}
 
@@ -896,18 +1070,18 @@ static bool netconfig_ipv4_gateway_route_install(struct netconfig *netconfig)
 			inet_pton(AF_INET, ip, &in_addr) < 1)
 		return false;
 
-	netconfig->route4_add_gateway_cmd_id =
-		l_rtnl_route4_add_gateway(rtnl, netconfig->ifindex, gateway, ip,
+	cmd = netconfig_batch_next(&netconfig->batch4, "default route");
+	if (!cmd)
+		return false;
+
+	if (!netconfig_batch_sent(cmd,
+			l_rtnl_route4_add_gateway(rtnl, netconfig->ifindex,
+						gateway, ip,
 						ROUTE_PRIORITY_OFFSET,
 						netconfig->rtm_protocol,
-						netconfig_route_add_cmd_cb,
-						netconfig, NULL);
-	if (!netconfig->route4_add_gateway_cmd_id) {
-		l_error("netconfig: Failed to add route for: %s gateway.",
-								gateway);
-
+						netconfig_batch_cmd_cb,
+						cmd, NULL)))
 		return false;
-	}
 
 	/*
 	 * Attempt to use the gateway MAC address received from the AP by
@@ -927,56 +1101,64 @@ static bool netconfig_ipv4_gateway_route_install(struct netconfig *netconfig)
 	return true;
 }
 
-static void netconfig_ipv4_ifaddr_add_cmd_cb(int error, uint16_t type,
-						const void *data, uint32_t len,
-						void *user_data)
+/*
+ * The kernel handles the requests sent on the RTNL socket in order, so the
+ * address and the routes using it are queued back to back as one batch
+ * instead of waiting for each request to be acknowledged.  The family is
+ * configured once the whole batch has succeeded.
+ */
+static void netconfig_ipv4_install(struct netconfig *netconfig)
 {
-	struct netconfig *netconfig = user_data;
+	struct netconfig_rtnl_batch *batch = &netconfig->batch4;
+	struct netconfig_rtnl_cmd *cmd;
 
-	netconfig->addr4_add_cmd_id = 0;
+	netconfig_batch_start(batch, netconfig, AF_INET);
 
-	if (error && error != -EEXIST) {
-		l_error("netconfig: Failed to add IP address. "
-				"Error %d: %s", error, strerror(-error));
+	cmd = netconfig_batch_next(batch, "IP address");
+	if (!netconfig_batch_sent(cmd, l_rtnl_ifaddr_add(rtnl,
+						netconfig->ifindex,
+						netconfig->v4_address,
+						netconfig_batch_cmd_cb,
+						cmd, NULL)))
 		return;
-	}
 
 	netconfig_gateway_to_arp(netconfig);
 
-	if (!netconfig_ipv4_subnet_route_install(netconfig) ||
-			!netconfig_ipv4_gateway_route_install(netconfig))
-		return;
+	if (netconfig_ipv4_subnet_route_install(netconfig))
+		netconfig_ipv4_gateway_route_install(netconfig);
+
+	netconfig_batch_commit(batch);
 
 	netconfig_set_dns(netconfig);
 	netconfig_set_domains(netconfig);
 }
 
-static void netconfig_ipv6_ifaddr_add_cmd_cb(int error, uint16_t type,
-						const void *data, uint32_t len,
-						void *user_data)
+static void netconfig_ipv6_install(struct netconfig *netconfig)
 {
-	struct netconfig *netconfig = user_data;
+	struct netconfig_rtnl_batch *batch = &netconfig->batch6;
+	struct netconfig_rtnl_cmd *cmd;
 	struct l_rtnl_route *gateway;
 	const uint8_t *gateway_mac;
 
-	netconfig->addr6_add_cmd_id = 0;
+	netconfig_batch_start(batch, netconfig, AF_INET6);
 
-	if (error && error != -EEXIST) {
-		l_error("netconfig: Failed to add IPv6 address. "
-				"Error %d: %s", error, strerror(-error));
+	cmd = netconfig_batch_next(batch, "IPv6 address");
+	if (!netconfig_batch_sent(cmd, l_rtnl_ifaddr_add(rtnl,
+						netconfig->ifindex,
+						netconfig->v6_address,
+						netconfig_batch_cmd_cb,
+						cmd, NULL)))
 		return;
-	}
 
 	gateway = netconfig_get_static6_gateway(netconfig,
 						&netconfig->v6_gateway_str,
 						&gateway_mac);
 	if (gateway) {
-		netconfig->route6_add_cmd_id = l_rtnl_route_add(rtnl,
-							netconfig->ifindex,
-							gateway,
-							netconfig_route6_add_cb,
-							netconfig, NULL);
-		L_WARN_ON(unlikely(!netconfig->route6_add_cmd_id));
+		cmd = netconfig_batch_next(batch, "IPv6 default route");
+		netconfig_batch_sent(cmd, l_rtnl_route_add(rtnl,
+						netconfig->ifindex, gateway,
+						netconfig_batch_cmd_cb,
+						cmd, NULL));
 		l_rtnl_route_free(gateway);
 
 		if (gateway_mac && !l_rtnl_neighbor_set_hwaddr(rtnl,
@@ -988,6 +1170,8 @@ static void netconfig_ipv6_ifaddr_add_cmd_cb(int error, uint16_t type,
 			l_debug("l_rtnl_neighbor_set_hwaddr failed");
 	}
 
+	netconfig_batch_commit(batch);
+
 	netconfig_set_dns(netconfig);
 	netconfig_set_domains(netconfig);
 }
@@ -1012,6 +1196,166 @@ static void netconfig_ifaddr_del_cmd_cb(int error, uint16_t type,
 				"Error %d: %s", error, strerror(-error));
 }
 
+static bool netconfig_lease_get_address(const char *group, const char *key,
+						uint32_t *out)
+{
+	_auto_(l_free) char *str = l_settings_get_string(lease_cache, group,
+								key);
+	struct in_addr in_addr;
+
+	if (!str || inet_pton(AF_INET, str, &in_addr) != 1)
+		return false;
+
+	*out = in_addr.s_addr;
+	return true;
+}
+
+static void netconfig_lease_save(struct netconfig *netconfig)
+{
+	const struct l_dhcp_lease *lease =
+			l_dhcp_client_get_lease(netconfig->dhcp_client);
+	const char *id = netconfig->lease_id;
+	_auto_(l_free) char *address = NULL;
+	_auto_(l_free) char *server_id = NULL;
+	_auto_(l_free) char *gateway = NULL;
+	_auto_(l_strv_free) char **dns = NULL;
+	uint64_t expires;
+
+	if (!id || !lease)
+		return;
+
+	address = l_dhcp_lease_get_address(lease);
+	server_id = l_dhcp_lease_get_server_id(lease);
+	if (!address || !server_id)
+		return;
+
+	gateway = l_dhcp_lease_get_gateway(lease);
+	dns = l_dhcp_lease_get_dns(lease);
+	expires = (uint64_t) time(NULL) + l_dhcp_lease_get_lifetime(lease);
+
+	l_settings_remove_group(lease_cache, id);
+	l_settings_set_string(lease_cache, id, "Address", address);
+	l_settings_set_uint(lease_cache, id, "PrefixLength",
+				l_dhcp_lease_get_prefix_length(lease));
+	l_settings_set_string(lease_cache, id, "ServerIdentifier", server_id);
+
+	if (gateway)
+		l_settings_set_string(lease_cache, id, "Gateway", gateway);
+
+	if (dns)
+		l_settings_set_string_list(lease_cache, id, "DNS", dns, ' ');
+
+	l_settings_set_uint64(lease_cache, id, "Expires", expires);
+	storage_dhcp_leases_sync(lease_cache);
+}
+
+static void netconfig_lease_forget(struct netconfig *netconfig)
+{
+	memset(&netconfig->cached_lease, 0, sizeof(netconfig->cached_lease));
+
+	if (!netconfig->lease_id ||
+			!l_settings_remove_group(lease_cache,
+							netconfig->lease_id))
+		return;
+
+	storage_dhcp_leases_sync(lease_cache);
+}
+
+/*
+ * The DHCP exchange has completed while the cached address is in use.
+ * Returns true if the lease matches what is already configured, otherwise
+ * the cached address is removed so that the new one can be installed.
+ */
+static bool netconfig_ipv4_optimistic_confirm(struct netconfig *netconfig,
+					const struct l_rtnl_address *address,
+					bool gateway_changed)
+{
+	char old_ip[INET_ADDRSTRLEN];
+	char new_ip[INET_ADDRSTRLEN];
+
+	netconfig->v4_optimistic = false;
+
+	if (!gateway_changed && address &&
+			l_rtnl_address_get_address(netconfig->v4_address,
+							old_ip) &&
+			l_rtnl_address_get_address(address, new_ip) &&
+			!strcmp(old_ip, new_ip) &&
+			l_rtnl_address_get_prefix_length(
+						netconfig->v4_address) ==
+			l_rtnl_address_get_prefix_length(address)) {
+		l_debug("Cached DHCPv4 lease confirmed");
+		return true;
+	}
+
+	l_debug("DHCPv4 lease differs from the cached lease, reconfiguring");
+	L_WARN_ON(!l_rtnl_ifaddr_delete(rtnl, netconfig->ifindex,
+					netconfig->v4_address,
+					netconfig_ifaddr_del_cmd_cb,
+					netconfig, NULL));
+	return false;
+}
+
+static void netconfig_ipv4_dhcp_acd_event(enum l_acd_event event,
+						void *user_data)
+{
+	struct netconfig *netconfig = user_data;
+
+	switch (event) {
+	case L_ACD_EVENT_AVAILABLE:
+		return;
+	case L_ACD_EVENT_CONFLICT:
+	case L_ACD_EVENT_LOST:
+		break;
+	}
+
+	l_error("netconfig: DHCPv4 address conflict, restarting DHCP");
+
+	l_acd_destroy(l_steal_ptr(netconfig->acd));
+	L_WARN_ON(!l_rtnl_ifaddr_delete(rtnl, netconfig->ifindex,
+					netconfig->v4_address,
+					netconfig_ifaddr_del_cmd_cb,
+					netconfig, NULL));
+	l_rtnl_address_free(l_steal_ptr(netconfig->v4_address));
+	netconfig->v4_optimistic = false;
+	netconfig_lease_forget(netconfig);
+
+	l_dhcp_client_stop(netconfig->dhcp_client);
+
+	if (!l_dhcp_client_start(netconfig->dhcp_client))
+		l_error("netconfig: Failed to re-start DHCPv4 client "
+				"for interface %u", netconfig->ifindex);
+}
+
+/*
+ * With [Network].EnableFastDAD the dynamic addresses are used at once and
+ * ACD is only started afterwards, skipping the probes, to announce and
+ * defend the address.  A conflict detected later still drops the address
+ * and restarts DHCP.
+ */
+static void netconfig_ipv4_acd_watch(struct netconfig *netconfig)
+{
+	char ip[INET_ADDRSTRLEN];
+
+	if (!fast_dad || !netconfig->v4_address ||
+			!l_rtnl_address_get_address(netconfig->v4_address, ip))
+		return;
+
+	l_acd_destroy(netconfig->acd);
+
+	netconfig->acd = l_acd_new(netconfig->ifindex);
+	l_acd_set_event_handler(netconfig->acd, netconfig_ipv4_dhcp_acd_event,
+				netconfig, NULL);
+	l_acd_set_skip_probes(netconfig->acd, true);
+
+	if (getenv("IWD_ACD_DEBUG"))
+		l_acd_set_debug(netconfig->acd, do_debug, "[ACD] ", NULL);
+
+	if (!l_acd_start(netconfig->acd, ip)) {
+		l_error("failed to start ACD, continuing anyways");
+		l_acd_destroy(l_steal_ptr(netconfig->acd));
+	}
+}
+
 static void netconfig_ipv4_dhcp_event_handler(struct l_dhcp_client *client,
 						enum l_dhcp_client_event event,
 						void *userdata)
@@ -1031,6 +1375,7 @@ static void netconfig_ipv4_dhcp_event_handler(struct l_dhcp_client *client,
 	{
 		char *gateway_str;
 		struct l_rtnl_address *address;
+		bool gateway_changed = false;
 
 		gateway_str = netconfig_ipv4_get_gateway(netconfig, NULL);
 		if (l_streq0(netconfig->v4_gateway_str, gateway_str))
@@ -1038,9 +1383,27 @@ static void netconfig_ipv4_dhcp_event_handler(struct l_dhcp_client *client,
 		else {
 			l_free(netconfig->v4_gateway_str);
 			netconfig->v4_gateway_str = gateway_str;
+			gateway_changed = true;
 		}
 
 		address = netconfig_get_dhcp4_address(netconfig);
+
+		if (netconfig->v4_optimistic &&
+				netconfig_ipv4_optimistic_confirm(netconfig,
+							address,
+							gateway_changed)) {
+			l_rtnl_address_free(address);
+
+			netconfig_dns_list_update(netconfig, AF_INET);
+			netconfig_domains_update(netconfig, AF_INET);
+			netconfig_set_dns(netconfig);
+			netconfig_set_domains(netconfig);
+
+			netconfig_lease_save(netconfig);
+			netconfig_ipv4_acd_watch(netconfig);
+			break;
+		}
+
 		l_rtnl_address_free(netconfig->v4_address);
 		netconfig->v4_address = address;
 
@@ -1053,14 +1416,13 @@ static void netconfig_ipv4_dhcp_event_handler(struct l_dhcp_client *client,
 		netconfig_dns_list_update(netconfig, AF_INET);
 		netconfig_domains_update(netconfig, AF_INET);
 
-		L_WARN_ON(!(netconfig->addr4_add_cmd_id =
-				l_rtnl_ifaddr_add(rtnl, netconfig->ifindex,
-					netconfig->v4_address,
-					netconfig_ipv4_ifaddr_add_cmd_cb,
-					netconfig, NULL)));
+		netconfig_ipv4_install(netconfig);
+		netconfig_lease_save(netconfig);
+		netconfig_ipv4_acd_watch(netconfig);
 		break;
 	}
 	case L_DHCP_CLIENT_EVENT_LEASE_RENEWED:
+		netconfig_lease_save(netconfig);
 		break;
 	case L_DHCP_CLIENT_EVENT_LEASE_EXPIRED:
 		L_WARN_ON(!l_rtnl_ifaddr_delete(rtnl, netconfig->ifindex,
@@ -1073,6 +1435,23 @@ static void netconfig_ipv4_dhcp_event_handler(struct l_dhcp_client *client,
 
 		/* Fall through. */
 	case L_DHCP_CLIENT_EVENT_NO_LEASE:
+		l_acd_destroy(l_steal_ptr(netconfig->acd));
+
+		if (netconfig->v4_optimistic) {
+			l_debug("Cached DHCPv4 lease not confirmed");
+			netconfig->v4_optimistic = false;
+			L_WARN_ON(!l_rtnl_ifaddr_delete(rtnl,
+					netconfig->ifindex,
+					netconfig->v4_address,
+					netconfig_ifaddr_del_cmd_cb,
+					netconfig, NULL));
+			l_rtnl_address_free(netconfig->v4_address);
+			netconfig->v4_address = NULL;
+			l_free(l_steal_ptr(netconfig->v4_gateway_str));
+		}
+
+		netconfig_lease_forget(netconfig);
+
 		/*
 		 * The requested address is no longer available, try to restart
 		 * the client.
@@ -1126,6 +1505,7 @@ static void netconfig_dhcp6_event_handler(struct l_dhcp6_client *client,
 		netconfig_domains_update(netconfig, AF_INET6);
 		netconfig_set_dns(netconfig);
 		netconfig_set_domains(netconfig);
+		netconfig_family_ready(netconfig, AF_INET6);
 		break;
 	}
 	case L_DHCP6_CLIENT_EVENT_LEASE_EXPIRED:
@@ -1170,6 +1550,8 @@ static void netconfig_reset_v4(struct netconfig *netconfig)
 
 		l_dhcp_client_stop(netconfig->dhcp_client);
 		netconfig->rtm_protocol = 0;
+		netconfig->v4_optimistic = false;
+		netconfig->v4_ready = false;
 
 		l_acd_destroy(netconfig->acd);
 		netconfig->acd = NULL;
@@ -1186,11 +1568,10 @@ static void netconfig_ipv4_acd_event(enum l_acd_event event, void *user_data)
 
 	switch (event) {
 	case L_ACD_EVENT_AVAILABLE:
-		L_WARN_ON(!(netconfig->addr4_add_cmd_id =
-				l_rtnl_ifaddr_add(rtnl, netconfig->ifindex,
-					netconfig->v4_address,
-					netconfig_ipv4_ifaddr_add_cmd_cb,
-					netconfig, NULL)));
+		/* Already installed in the fast mode */
+		if (!netconfig->v4_skip_probes)
+			netconfig_ipv4_install(netconfig);
+
 		return;
 	case L_ACD_EVENT_CONFLICT:
 		/*
@@ -1213,11 +1594,44 @@ static void netconfig_ipv4_acd_event(enum l_acd_event event, void *user_data)
 	}
 }
 
+/*
+ * Install the address, routes and DNS servers of the cached lease right
+ * away, the DHCP client then confirms or corrects them in the background.
+ */
+static void netconfig_ipv4_optimistic_install(struct netconfig *netconfig)
+{
+	const struct netconfig_lease *lease = &netconfig->cached_lease;
+	_auto_(l_free) char *addr_str =
+				netconfig_ipv4_to_string(lease->address);
+
+	if (unlikely(!addr_str))
+		return;
+
+	netconfig->v4_address = l_rtnl_address_new(addr_str,
+						lease->prefix_len ?: 24);
+	if (L_WARN_ON(!netconfig->v4_address))
+		return;
+
+	l_rtnl_address_set_noprefixroute(netconfig->v4_address, true);
+	netconfig->v4_optimistic = true;
+
+	l_debug("Using cached DHCPv4 address %s until confirmed", addr_str);
+
+	netconfig->v4_gateway_str = netconfig_ipv4_get_gateway(netconfig, NULL);
+	netconfig_dns_list_update(netconfig, AF_INET);
+	netconfig_domains_update(netconfig, AF_INET);
+
+	netconfig_ipv4_install(netconfig);
+	netconfig_ipv4_acd_watch(netconfig);
+}
+
 static bool netconfig_ipv4_select_and_install(struct netconfig *netconfig)
 {
 	struct netdev *netdev = netdev_find(netconfig->ifindex);
 	bool set_address = (netconfig->rtm_protocol == RTPROT_STATIC);
 
+	netconfig->v4_skip_probes = fast_dad;
+
 	if (netconfig_use_fils_addr(netconfig, AF_INET)) {
 		L_AUTO_FREE_VAR(char *, addr_str) = netconfig_ipv4_to_string(
 					netconfig->fils_override->ipv4_addr);
@@ -1234,6 +1648,14 @@ static bool netconfig_ipv4_select_and_install(struct netconfig *netconfig)
 		l_rtnl_address_set_noprefixroute(netconfig->v4_address, true);
 		set_address = true;
 
+		/*
+		 * The AP has allocated this address for us, in the fast path
+		 * it is used as soon as the association completes so that the
+		 * connection is ready once the address and routes are set.
+		 */
+		if (fils_fast_path)
+			netconfig->v4_skip_probes = true;
+
 		/*
 		 * TODO: If netconfig->fils_override->ipv4_lifetime is set,
 		 * start a timeout to renew the address using FILS IP Address
@@ -1262,21 +1684,25 @@ static bool netconfig_ipv4_select_and_install(struct netconfig *netconfig)
 			l_acd_set_debug(netconfig->acd, do_debug,
 					"[ACD] ", NULL);
 
+		/* Announce and defend only, the address is used right away */
+		if (netconfig->v4_skip_probes)
+			l_acd_set_skip_probes(netconfig->acd, true);
+
 		if (!l_acd_start(netconfig->acd, ip)) {
 			l_error("failed to start ACD, continuing anyways");
 			l_acd_destroy(netconfig->acd);
 			netconfig->acd = NULL;
 
-			L_WARN_ON(!(netconfig->addr4_add_cmd_id =
-				l_rtnl_ifaddr_add(rtnl, netconfig->ifindex,
-					netconfig->v4_address,
-					netconfig_ipv4_ifaddr_add_cmd_cb,
-					netconfig, NULL)));
-		}
+			netconfig_ipv4_install(netconfig);
+		} else if (netconfig->v4_skip_probes)
+			netconfig_ipv4_install(netconfig);
 
 		return true;
 	}
 
+	if (optimistic_dhcp && netconfig->cached_lease.address)
+		netconfig_ipv4_optimistic_install(netconfig);
+
 	l_dhcp_client_set_address(netconfig->dhcp_client, ARPHRD_ETHER,
 					netdev_get_address(netdev), ETH_ALEN);
 
@@ -1299,6 +1725,17 @@ static bool netconfig_ipv6_select_and_install(struct netconfig *netconfig)
 
 	sysfs_write_ipv6_setting(netdev_get_name(netdev), "disable_ipv6", "0");
 
+	/*
+	 * Let the addresses be used while the kernel's DAD is still in
+	 * progress, unless a conflict is found.
+	 */
+	if (fast_dad) {
+		sysfs_write_ipv6_setting(netdev_get_name(netdev),
+						"optimistic_dad", "1");
+		sysfs_write_ipv6_setting(netdev_get_name(netdev),
+						"use_optimistic", "1");
+	}
+
 	if (netconfig_use_fils_addr(netconfig, AF_INET6)) {
 		uint8_t prefix_len = netconfig->fils_override->ipv6_prefix_len;
 		L_AUTO_FREE_VAR(char *, addr_str) = netconfig_ipv6_to_string(
@@ -1325,11 +1762,7 @@ static bool netconfig_ipv6_select_and_install(struct netconfig *netconfig)
 	if (netconfig->v6_address) {
 		netconfig_dns_list_update(netconfig, AF_INET6);
 
-		L_WARN_ON(!(netconfig->addr6_add_cmd_id =
-			l_rtnl_ifaddr_add(rtnl, netconfig->ifindex,
-					netconfig->v6_address,
-					netconfig_ipv6_ifaddr_add_cmd_cb,
-					netconfig, NULL)));
+		netconfig_ipv6_install(netconfig);
 		return true;
 	}
 
@@ -1498,7 +1931,66 @@ bool netconfig_configure(struct netconfig *netconfig,
 	return true;
 }
 
-bool netconfig_reconfigure(struct netconfig *netconfig, bool set_arp_gw)
+/*
+ * A FILS IP Address Assignment response was received while moving to
+ * another BSS of the same network.  It is only used if the current IPv4
+ * address was itself assigned through FILS, otherwise the DHCP lease stays
+ * in use.  Nothing is reinstalled unless the AP assigned a new address.
+ */
+static void netconfig_fils_ip_update(struct netconfig *netconfig,
+			const struct ie_fils_ip_addr_response_info *info)
+{
+	_auto_(l_free) char *addr_str = NULL;
+	const struct ie_fils_ip_addr_response_info *old;
+
+	if (!netconfig_use_fils_addr(netconfig, AF_INET) || !info->ipv4_addr)
+		return;
+
+	old = netconfig->fils_override;
+
+	if (old->ipv4_addr == info->ipv4_addr &&
+			old->ipv4_prefix_len == info->ipv4_prefix_len) {
+		l_free(netconfig->fils_override);
+		netconfig->fils_override = l_memdup(info, sizeof(*info));
+
+		if (netconfig_dns_list_update(netconfig, AF_INET))
+			netconfig_set_dns(netconfig);
+
+		return;
+	}
+
+	addr_str = netconfig_ipv4_to_string(info->ipv4_addr);
+	if (unlikely(!addr_str))
+		return;
+
+	l_debug("FILS assigned a new address %s, reconfiguring", addr_str);
+
+	l_free(netconfig->fils_override);
+	netconfig->fils_override = l_memdup(info, sizeof(*info));
+
+	l_acd_destroy(netconfig->acd);
+	netconfig->acd = NULL;
+
+	netconfig_remove_v4_address(netconfig);
+	l_free(l_steal_ptr(netconfig->v4_gateway_str));
+
+	netconfig->v4_address = l_rtnl_address_new(addr_str,
+							info->ipv4_prefix_len);
+	if (L_WARN_ON(!netconfig->v4_address))
+		return;
+
+	l_rtnl_address_set_noprefixroute(netconfig->v4_address, true);
+	netconfig_dns_list_update(netconfig, AF_INET);
+	netconfig_ipv4_install(netconfig);
+}
+
+/*
+ * Called when the connection moved to another BSS of the same network.
+ * The addresses and routes are kept as they are so that traffic isn't
+ * interrupted.
+ */
+bool netconfig_reconfigure(struct netconfig *netconfig, bool set_arp_gw,
+			const struct ie_fils_ip_addr_response_info *fils)
 {
 	/*
 	 * Starting with kernel 4.20, ARP cache is flushed when the netdev
@@ -1510,6 +2002,9 @@ bool netconfig_reconfigure(struct netconfig *netconfig, bool set_arp_gw)
 	if (set_arp_gw)
 		netconfig_gateway_to_arp(netconfig);
 
+	if (fils)
+		netconfig_fils_ip_update(netconfig, fils);
+
 	if (netconfig->rtm_protocol == RTPROT_DHCP) {
 		/* TODO l_dhcp_client sending a DHCP inform request */
 	}
@@ -1525,25 +2020,8 @@ bool netconfig_reset(struct netconfig *netconfig)
 {
 	struct netdev *netdev = netdev_find(netconfig->ifindex);
 
-	if (netconfig->route4_add_gateway_cmd_id) {
-		l_netlink_cancel(rtnl, netconfig->route4_add_gateway_cmd_id);
-		netconfig->route4_add_gateway_cmd_id = 0;
-	}
-
-	if (netconfig->route6_add_cmd_id) {
-		l_netlink_cancel(rtnl, netconfig->route6_add_cmd_id);
-		netconfig->route6_add_cmd_id = 0;
-	}
-
-	if (netconfig->addr4_add_cmd_id) {
-		l_netlink_cancel(rtnl, netconfig->addr4_add_cmd_id);
-		netconfig->addr4_add_cmd_id = 0;
-	}
-
-	if (netconfig->addr6_add_cmd_id) {
-		l_netlink_cancel(rtnl, netconfig->addr6_add_cmd_id);
-		netconfig->addr6_add_cmd_id = 0;
-	}
+	netconfig_batch_cancel(&netconfig->batch4);
+	netconfig_batch_cancel(&netconfig->batch6);
 
 	if (netconfig->rtm_protocol || netconfig->rtm_v6_protocol)
 		resolve_revert(netconfig->resolve);
@@ -1559,6 +2037,7 @@ bool netconfig_reset(struct netconfig *netconfig)
 
 		l_dhcp6_client_stop(netconfig->dhcp6_client);
 		netconfig->rtm_v6_protocol = 0;
+		netconfig->v6_ready = false;
 
 		sysfs_write_ipv6_setting(netdev_get_name(netdev),
 						"disable_ipv6", "1");
@@ -1569,6 +2048,8 @@ bool netconfig_reset(struct netconfig *netconfig)
 	}
 
 	l_free(l_steal_ptr(netconfig->fils_override));
+	l_free(l_steal_ptr(netconfig->lease_id));
+	memset(&netconfig->cached_lease, 0, sizeof(netconfig->cached_lease));
 
 	return true;
 }
@@ -1602,6 +2083,10 @@ bool netconfig_get_fils_ip_req(struct netconfig *netconfig,
 
 	memset(info, 0, sizeof(*info));
 	info->ipv4 = (netconfig->rtm_protocol == RTPROT_DHCP);
+
+	if (info->ipv4)
+		info->ipv4_requested_addr = netconfig->cached_lease.address;
+
 	info->ipv6 = (netconfig->rtm_v6_protocol == RTPROT_DHCP);
 	info->dns = (info->ipv4 && !netconfig->dns4_overrides) ||
 		(info->ipv6 && !netconfig->dns6_overrides);
@@ -1616,6 +2101,49 @@ void netconfig_handle_fils_ip_resp(struct netconfig *netconfig,
 	netconfig->fils_override = l_memdup(info, sizeof(*info));
 }
 
+/*
+ * Select the known network whose DHCPv4 lease gets cached.  Must be
+ * called after netconfig_load_settings() for the same network, a NULL
+ * id disables the lease cache for this connection.
+ */
+void netconfig_set_lease_id(struct netconfig *netconfig, const char *id)
+{
+	struct netconfig_lease *lease = &netconfig->cached_lease;
+	unsigned int prefix_len;
+
+	l_free(netconfig->lease_id);
+	netconfig->lease_id = l_strdup(id);
+	memset(lease, 0, sizeof(*lease));
+
+	if (!id || netconfig->rtm_protocol != RTPROT_DHCP)
+		return;
+
+	if (!l_settings_get_uint64(lease_cache, id, "Expires",
+					&lease->expires) ||
+			lease->expires <= (uint64_t) time(NULL))
+		goto invalid;
+
+	if (!netconfig_lease_get_address(id, "Address", &lease->address) ||
+			!netconfig_lease_get_address(id, "ServerIdentifier",
+							&lease->server_id))
+		goto invalid;
+
+	if (!l_settings_get_uint(lease_cache, id, "PrefixLength",
+					&prefix_len) || prefix_len > 30)
+		goto invalid;
+
+	lease->prefix_len = prefix_len;
+
+	/* The gateway is optional */
+	netconfig_lease_get_address(id, "Gateway", &lease->gateway);
+
+	l_debug("Found a cached DHCPv4 lease for %s", id);
+	return;
+
+invalid:
+	memset(lease, 0, sizeof(*lease));
+}
+
 struct netconfig *netconfig_new(uint32_t ifindex)
 {
 	struct netdev *netdev = netdev_find(ifindex);
@@ -1691,9 +2219,38 @@ bool netconfig_enabled(void)
 					&enabled) && enabled;
 }
 
+static void netconfig_lease_cache_load(void)
+{
+	char **groups;
+	unsigned int i;
+	uint64_t now = time(NULL);
+
+	lease_cache = storage_dhcp_leases_load();
+	if (!lease_cache) {
+		lease_cache = l_settings_new();
+		return;
+	}
+
+	/* Drop the leases that have expired while we weren't running */
+	groups = l_settings_get_groups(lease_cache);
+
+	for (i = 0; groups[i]; i++) {
+		uint64_t expires;
+
+		if (l_settings_get_uint64(lease_cache, groups[i], "Expires",
+						&expires) && expires > now)
+			continue;
+
+		l_settings_remove_group(lease_cache, groups[i]);
+	}
+
+	l_strv_free(groups);
+}
+
 static int netconfig_init(void)
 {
 	uint32_t r;
+	_auto_(l_free) char *readiness = NULL;
 
 	if (netconfig_list)
 		return -EALREADY;
@@ -1740,6 +2297,36 @@ static int netconfig_init(void)
 					&ipv6_enabled))
 		ipv6_enabled = false;
 
+	if (!l_settings_get_bool(iwd_get_config(), "Network",
+					"EnableOptimisticDHCP",
+					&optimistic_dhcp))
+		optimistic_dhcp = false;
+
+	if (!l_settings_get_bool(iwd_get_config(), "Network", "EnableFastDAD",
+					&fast_dad))
+		fast_dad = false;
+
+	if (!l_settings_get_bool(iwd_get_config(), "EAP", "EnableFILSFastPath",
+					&fils_fast_path))
+		fils_fast_path = false;
+
+	readiness = l_settings_get_string(iwd_get_config(), "Network",
+						"ReadinessPolicy");
+	if (!readiness || !strcmp(readiness, "ipv4"))
+		readiness_policy = READINESS_IPV4;
+	else if (!strcmp(readiness, "ipv6"))
+		readiness_policy = READINESS_IPV6;
+	else if (!strcmp(readiness, "any"))
+		readiness_policy = READINESS_ANY;
+	else if (!strcmp(readiness, "all"))
+		readiness_policy = READINESS_ALL;
+	else {
+		l_warn("netconfig: Invalid [Network].ReadinessPolicy value: "
+				"%s, using ipv4", readiness);
+		readiness_policy = READINESS_IPV4;
+	}
+
+	netconfig_lease_cache_load();
 	netconfig_list = l_queue_new();
 
 	return 0;
@@ -1758,6 +2345,9 @@ static void netconfig_exit(void)
 	rtnl = NULL;
 
 	l_queue_destroy(netconfig_list, netconfig_free);
+
+	l_settings_free(lease_cache);
+	lease_cache = NULL;
 }
 
 IWD_MODULE(netconfig, netconfig_init, netconfig_exit)
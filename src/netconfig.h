@@ -36,8 +36,10 @@ bool netconfig_load_settings(struct netconfig *netconfig,
 bool netconfig_configure(struct netconfig *netconfig,
 				netconfig_notify_func_t notify,
 				void *user_data);
-bool netconfig_reconfigure(struct netconfig *netconfig, bool set_arp_gw);
+bool netconfig_reconfigure(struct netconfig *netconfig, bool set_arp_gw,
+			const struct ie_fils_ip_addr_response_info *fils);
 bool netconfig_reset(struct netconfig *netconfig);
+void netconfig_set_lease_id(struct netconfig *netconfig, const char *id);
 char *netconfig_get_dhcp_server_ipv4(struct netconfig *netconfig);
 bool netconfig_get_fils_ip_req(struct netconfig *netconfig,
 				struct ie_fils_ip_addr_request_info *info);
@@ -24,6 +24,7 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <alloca.h>
 #include <stdio.h>
@@ -36,6 +37,7 @@
 #include <linux/filter.h>
 #include <sys/socket.h>
 #include <errno.h>
+#include <limits.h>
 
 #include <ell/ell.h>
 
@@ -65,6 +67,8 @@
 #include "src/frame-xchg.h"
 #include "src/diagnostic.h"
 #include "src/band.h"
+#include "src/pmksa.h"
+#include "src/profile.h"
 
 #ifndef ENOTSUPP
 #define ENOTSUPP 524
@@ -85,20 +89,40 @@ struct netdev_handshake_state {
 	uint32_t pairwise_new_key_cmd_id;
 	uint32_t group_new_key_cmd_id;
 	uint32_t group_management_new_key_cmd_id;
+	uint32_t beacon_new_key_cmd_id;
 	uint32_t set_station_cmd_id;
 	uint32_t set_pmk_cmd_id;
 	uint32_t pairwise_set_key_tx_cmd_id;
 	bool ptk_installed;
 	bool gtk_installed;
 	bool igtk_installed;
+	bool bigtk_installed;
 	bool complete;
 	struct netdev *netdev;
 	enum connection_type type;
 };
 
+/*
+ * Pool of FT-over-DS authenticated targets.  At most NETDEV_FT_DS_POOL_SIZE
+ * targets are kept.  Each is re-authenticated every
+ * NETDEV_FT_DS_REFRESH_INTERVAL so the state on the target AP doesn't time
+ * out before it can be used, up to NETDEV_FT_DS_MAX_REFRESHES times.
+ */
+#define NETDEV_FT_DS_POOL_SIZE		4
+#define NETDEV_FT_DS_REFRESH_INTERVAL	30	/* Seconds */
+#define NETDEV_FT_DS_MAX_REFRESHES	10
+
+/* 802.11-2020 9.4.2.94: up to 21 DSCP Exceptions followed by 8 ranges */
+#define QOS_MAP_MAX_EXCEPTIONS	21
+#define QOS_MAP_RANGES_LEN	16
+#define QOS_MAP_MAX_LEN	(QOS_MAP_MAX_EXCEPTIONS * 2 + QOS_MAP_RANGES_LEN)
+
 struct netdev_ft_over_ds_info {
 	struct ft_ds_info super;
 	struct netdev *netdev;
+	uint64_t time_stamp;
+	uint32_t cmd_id;
+	unsigned int refreshes;
 
 	bool parsed : 1;
 };
@@ -129,6 +153,7 @@ struct netdev {
 	struct auth_proto *ap;
 	struct owe_sm *owe_sm;
 	struct handshake_state *handshake;
+	struct netdev_connect_times connect_times;
 	uint32_t connect_cmd_id;
 	uint32_t disconnect_cmd_id;
 	uint32_t join_adhoc_cmd_id;
@@ -136,6 +161,10 @@ struct netdev {
 	uint32_t set_interface_cmd_id;
 	uint32_t rekey_offload_cmd_id;
 	uint32_t qos_map_cmd_id;
+	uint8_t qos_map[QOS_MAP_MAX_LEN];
+	uint8_t qos_map_len;
+	uint8_t dscp_policy[QOS_MAP_MAX_EXCEPTIONS * 2];
+	uint8_t dscp_policy_len;
 	uint32_t mac_change_cmd_id;
 	uint32_t get_oci_cmd_id;
 	enum netdev_result result;
@@ -145,13 +174,16 @@ struct netdev {
 	struct l_timeout *sa_query_delay;
 	struct l_timeout *group_handshake_timeout;
 	uint16_t sa_query_id;
+	uint64_t sa_query_tat;
 	uint8_t prev_snonce[32];
 	int8_t rssi_levels[16];
 	uint8_t rssi_levels_num;
 	uint8_t cur_rssi_level_idx;
 	int8_t cur_rssi;
+	double rssi_avg;
+	double rssi_slope;
+	uint64_t rssi_sample_time;
 	struct l_timeout *rssi_poll_timeout;
-	uint32_t rssi_poll_cmd_id;
 	uint8_t set_mac_once[6];
 
 	struct scan_bss *fw_roam_bss;
@@ -162,9 +194,14 @@ struct netdev {
 	netdev_destroy_func_t set_powered_destroy;
 
 	uint32_t get_station_cmd_id;
-	netdev_get_station_cb_t get_station_cb;
-	void *get_station_data;
-	netdev_destroy_func_t get_station_destroy;
+	struct netdev_station_cmd *station_cmd;
+	struct l_queue *station_requests;
+	struct l_idle *station_idle;
+	struct netdev_station_infos *station_cache;
+	uint64_t station_cache_time;
+	uint8_t station_cache_addr[6];
+	bool station_cache_dump : 1;
+	struct l_queue *oci_cache;
 
 	struct l_idle *disconnect_idle;
 
@@ -177,6 +214,7 @@ struct netdev {
 	struct wiphy_radio_work_item work;
 
 	struct l_queue *ft_ds_list;
+	struct l_timeout *ft_ds_refresh_timeout;
 
 	struct netdev_ext_key_info *ext_key_info;
 
@@ -186,7 +224,10 @@ struct netdev {
 	bool rekey_offload_support : 1;
 	bool pae_over_nl80211 : 1;
 	bool in_ft : 1;
+	bool fw_roam_pending : 1;
+	bool fw_port_authorized : 1;
 	bool cur_rssi_low : 1;
+	bool rssi_trend_low : 1;
 	bool use_4addr : 1;
 	bool ignore_connect_event : 1;
 	bool expect_connect_failure : 1;
@@ -195,6 +236,7 @@ struct netdev {
 	bool retry_auth : 1;
 	bool in_reassoc : 1;
 	bool privacy : 1;
+	bool qos_map_applied : 1;
 };
 
 struct netdev_preauth_state {
@@ -211,10 +253,40 @@ struct netdev_watch {
 
 static struct l_netlink *rtnl = NULL;
 static struct l_genl_family *nl80211;
+
+/* Threshold RSSI for roaming to trigger, configurable in main.conf */
+static int LOW_SIGNAL_THRESHOLD;
+static int LOW_SIGNAL_THRESHOLD_5GHZ;
+
+/* How far ahead to extrapolate the RSSI trend, 0 if disabled */
+static unsigned int RSSI_PREDICTION_TIME;
 static struct l_queue *netdev_list;
+/* netdev_list indexed by ifindex for netdev_find */
+static struct l_hashmap *netdev_index;
 static struct watchlist netdev_watches;
 static bool mac_per_ssid;
 
+/*
+ * For drivers without EAPoL over NL80211, frames are read from the PAE
+ * socket up to NETDEV_PAE_BATCH at a time into a buffer pool shared by all
+ * netdevs.  Frames sent on the same netdev while a batch is processed, such
+ * as an AP answering a burst of 4-Way Handshakes, are queued in the TX pool
+ * and written with a single sendmmsg once the whole batch was handled.
+ */
+#define NETDEV_PAE_BATCH	8
+
+struct netdev_pae_pool {
+	uint8_t frames[NETDEV_PAE_BATCH][IEEE80211_MAX_DATA_LEN];
+	struct sockaddr_ll addrs[NETDEV_PAE_BATCH];
+	struct iovec iov[NETDEV_PAE_BATCH];
+	struct mmsghdr msgs[NETDEV_PAE_BATCH];
+};
+
+static struct netdev_pae_pool *pae_rx_pool;
+static struct netdev_pae_pool *pae_tx_pool;
+static struct netdev *pae_tx_netdev;
+static unsigned int pae_tx_count;
+
 static unsigned int iov_ie_append(struct iovec *iov,
 					unsigned int n_iov, unsigned int c,
 					const uint8_t *ie)
@@ -325,6 +397,11 @@ static void netdev_handshake_state_cancel_rekey(
 					nhs->group_management_new_key_cmd_id);
 		nhs->group_management_new_key_cmd_id = 0;
 	}
+
+	if (nhs->beacon_new_key_cmd_id) {
+		l_genl_family_cancel(nl80211, nhs->beacon_new_key_cmd_id);
+		nhs->beacon_new_key_cmd_id = 0;
+	}
 }
 
 static void netdev_handshake_state_cancel_all(
@@ -373,7 +450,7 @@ struct handshake_state *netdev_handshake_state_new(struct netdev *netdev)
 
 	nhs->netdev = netdev;
 	/*
-	 * Since GTK/IGTK are optional (NO_GROUP_TRAFFIC), we set them as
+	 * Since GTK/IGTK/BIGTK are optional (NO_GROUP_TRAFFIC), we set them as
 	 * 'installed' upon initialization. If/When the gtk/igtk callback is
 	 * called they will get set to false until we have received a successful
 	 * callback from nl80211. From these callbacks we can check that all
@@ -382,6 +459,7 @@ struct handshake_state *netdev_handshake_state_new(struct netdev *netdev)
 	 */
 	nhs->gtk_installed = true;
 	nhs->igtk_installed = true;
+	nhs->bigtk_installed = true;
 
 	return &nhs->super;
 }
@@ -438,6 +516,12 @@ struct handshake_state *netdev_get_handshake(struct netdev *netdev)
 	return netdev->handshake;
 }
 
+const struct netdev_connect_times *netdev_get_connect_times(
+						struct netdev *netdev)
+{
+	return &netdev->connect_times;
+}
+
 const char *netdev_get_path(struct netdev *netdev)
 {
 	static char path[256];
@@ -624,6 +708,70 @@ static bool netdev_parse_sta_info(struct l_genl_attr *attr,
 			info->expected_throughput = l_get_u32(data);
 			info->have_expected_throughput = true;
 
+			break;
+
+		case NL80211_STA_INFO_TX_RETRIES:
+			if (len != 4)
+				return false;
+
+			info->tx_retries = l_get_u32(data);
+			info->have_tx_retries = true;
+
+			break;
+
+		case NL80211_STA_INFO_TX_FAILED:
+			if (len != 4)
+				return false;
+
+			info->tx_failed = l_get_u32(data);
+			info->have_tx_failed = true;
+
+			break;
+
+		case NL80211_STA_INFO_BEACON_LOSS:
+			if (len != 4)
+				return false;
+
+			info->beacon_loss = l_get_u32(data);
+			info->have_beacon_loss = true;
+
+			break;
+
+		case NL80211_STA_INFO_RX_DURATION:
+		case NL80211_STA_INFO_TX_DURATION:
+			if (len != 8)
+				return false;
+
+			info->airtime += l_get_u64(data);
+			info->have_airtime = true;
+
+			break;
+
+		case NL80211_STA_INFO_RX_BYTES64:
+			if (len != 8)
+				return false;
+
+			info->rx_bytes = l_get_u64(data);
+			info->have_rx_bytes = true;
+
+			break;
+
+		case NL80211_STA_INFO_TX_BYTES64:
+			if (len != 8)
+				return false;
+
+			info->tx_bytes = l_get_u64(data);
+			info->have_tx_bytes = true;
+
+			break;
+
+		case NL80211_STA_INFO_TX_PACKETS:
+			if (len != 4)
+				return false;
+
+			info->tx_packets = l_get_u32(data);
+			info->have_tx_packets = true;
+
 			break;
 		}
 	}
@@ -631,6 +779,78 @@ static bool netdev_parse_sta_info(struct l_genl_attr *attr,
 	return true;
 }
 
+#define RSSI_TREND_ALPHA	0.3
+#define RSSI_TREND_BETA		0.2
+#define RSSI_TREND_HYSTERESIS	3	/* dBm */
+#define RSSI_TREND_POLL_INTERVAL	2	/* Seconds */
+#define RSSI_POLL_INTERVAL_MIN		1	/* Seconds */
+#define RSSI_POLL_INTERVAL_MAX		10	/* Seconds */
+#define RSSI_POLL_DBM_PER_SEC		2
+
+/*
+ * Double exponential smoothing of the RSSI samples giving a level and a
+ * slope in dBm per second.  NETDEV_EVENT_RSSI_TREND_LOW is emitted once when
+ * the level extrapolated RSSI_PREDICTION_TIME seconds ahead drops below the
+ * roam threshold while the current RSSI is still above it, so that the roam
+ * can be prepared before the CQM low threshold event fires.
+ */
+static void netdev_rssi_trend_update(struct netdev *netdev, int rssi)
+{
+	int threshold = netdev->frequency > 4000 ? LOW_SIGNAL_THRESHOLD_5GHZ :
+						LOW_SIGNAL_THRESHOLD;
+	uint64_t now = l_time_now();
+	double dt;
+	double prev;
+	double predicted;
+
+	if (!RSSI_PREDICTION_TIME)
+		return;
+
+	if (!netdev->rssi_sample_time) {
+		netdev->rssi_avg = rssi;
+		netdev->rssi_slope = 0;
+		netdev->rssi_sample_time = now;
+		return;
+	}
+
+	dt = (double) l_time_diff(netdev->rssi_sample_time, now) /
+							L_USEC_PER_SEC;
+	/* A CQM event right after a poll doesn't tell us much */
+	if (dt < 0.5)
+		return;
+
+	netdev->rssi_sample_time = now;
+
+	prev = netdev->rssi_avg;
+	netdev->rssi_avg = RSSI_TREND_ALPHA * rssi + (1 - RSSI_TREND_ALPHA) *
+					(prev + netdev->rssi_slope * dt);
+	netdev->rssi_slope = RSSI_TREND_BETA * (netdev->rssi_avg - prev) / dt +
+				(1 - RSSI_TREND_BETA) * netdev->rssi_slope;
+
+	predicted = netdev->rssi_avg +
+			netdev->rssi_slope * RSSI_PREDICTION_TIME;
+
+	if (netdev->rssi_trend_low) {
+		if (predicted >= threshold + RSSI_TREND_HYSTERESIS)
+			netdev->rssi_trend_low = false;
+
+		return;
+	}
+
+	if (netdev->cur_rssi_low || netdev->rssi_slope >= 0 ||
+			predicted >= threshold)
+		return;
+
+	l_debug("RSSI %d, trend %.1f dBm/s, predicted %.1f in %us", rssi,
+			netdev->rssi_slope, predicted, RSSI_PREDICTION_TIME);
+
+	netdev->rssi_trend_low = true;
+
+	if (netdev->event_filter)
+		netdev->event_filter(netdev, NETDEV_EVENT_RSSI_TREND_LOW,
+					NULL, netdev->user_data);
+}
+
 static void netdev_set_rssi_level_idx(struct netdev *netdev)
 {
 	uint8_t new_level;
@@ -642,40 +862,69 @@ static void netdev_set_rssi_level_idx(struct netdev *netdev)
 	netdev->cur_rssi_level_idx = new_level;
 }
 
-static void netdev_rssi_poll_cb(struct l_genl_msg *msg, void *user_data)
+/*
+ * The RSSI only matters when it crosses one of the thresholds polled for,
+ * the client-supplied levels and, for the trend estimate, the roam
+ * threshold.  Poll every second next to a threshold and more rarely the
+ * further away the RSSI is from all of them, assuming it doesn't move by
+ * more than RSSI_POLL_DBM_PER_SEC, or faster than the trend says it does.
+ */
+static unsigned int netdev_rssi_poll_interval(struct netdev *netdev,
+						bool have_rssi)
 {
-	struct netdev *netdev = user_data;
-	struct l_genl_attr attr, nested;
-	uint16_t type, len;
-	const void *data;
-	bool found;
-	struct diagnostic_station_info info;
-	uint8_t prev_rssi_level_idx = netdev->cur_rssi_level_idx;
+	bool poll_levels = !wiphy_has_ext_feature(netdev->wiphy,
+					NL80211_EXT_FEATURE_CQM_RSSI_LIST);
+	int distance = INT_MAX;
+	unsigned int interval;
+	unsigned int i;
 
-	netdev->rssi_poll_cmd_id = 0;
+	if (!have_rssi)
+		return RSSI_PREDICTION_TIME ? RSSI_TREND_POLL_INTERVAL : 6;
 
-	if (!l_genl_attr_init(&attr, msg))
-		goto done;
+	for (i = 0; poll_levels && i < netdev->rssi_levels_num; i++)
+		distance = L_MIN(distance,
+				abs(netdev->cur_rssi - netdev->rssi_levels[i]));
 
-	found = false;
-	while (l_genl_attr_next(&attr, &type, &len, &data)) {
-		if (type != NL80211_ATTR_STA_INFO)
-			continue;
+	if (RSSI_PREDICTION_TIME) {
+		int threshold = netdev->frequency > 4000 ?
+				LOW_SIGNAL_THRESHOLD_5GHZ :
+				LOW_SIGNAL_THRESHOLD;
 
-		if (!l_genl_attr_recurse(&attr, &nested))
-			goto done;
+		distance = L_MIN(distance, abs(netdev->cur_rssi - threshold));
+	}
 
-		if (!netdev_parse_sta_info(&nested, &info))
-			goto done;
+	if (distance == INT_MAX)
+		return RSSI_POLL_INTERVAL_MAX;
 
-		found = true;
-		break;
-	}
+	interval = distance / RSSI_POLL_DBM_PER_SEC;
+
+	/* At least twice before the threshold is reached at this slope */
+	if (RSSI_PREDICTION_TIME && netdev->rssi_slope < 0 &&
+			distance / -netdev->rssi_slope / 2 < interval)
+		interval = distance / -netdev->rssi_slope / 2;
+
+	return L_MAX(L_MIN(interval, RSSI_POLL_INTERVAL_MAX),
+			RSSI_POLL_INTERVAL_MIN);
+}
+
+static void netdev_rssi_poll_cb(const struct diagnostic_station_info *info,
+				void *user_data)
+{
+	struct netdev *netdev = user_data;
+	uint8_t prev_rssi_level_idx = netdev->cur_rssi_level_idx;
+	bool have_rssi = false;
+
+	/* Polling was stopped while the request was queued */
+	if (!netdev->rssi_poll_timeout)
+		return;
 
-	if (!found || !info.have_cur_rssi)
+	if (!info || !info->have_cur_rssi)
 		goto done;
 
-	netdev->cur_rssi = info.cur_rssi;
+	netdev->cur_rssi = info->cur_rssi;
+	have_rssi = true;
+
+	netdev_rssi_trend_update(netdev, info->cur_rssi);
 
 	/*
 	 * Note we don't have to handle LOW_SIGNAL_THRESHOLD here.  The
@@ -691,32 +940,30 @@ static void netdev_rssi_poll_cb(struct l_genl_msg *msg, void *user_data)
 
 done:
 	/* Rearm timer */
-	l_timeout_modify(netdev->rssi_poll_timeout, 6);
+	l_timeout_modify(netdev->rssi_poll_timeout,
+				netdev_rssi_poll_interval(netdev, have_rssi));
 }
 
 static void netdev_rssi_poll(struct l_timeout *timeout, void *user_data)
 {
 	struct netdev *netdev = user_data;
-	struct l_genl_msg *msg;
-
-	msg = l_genl_msg_new_sized(NL80211_CMD_GET_STATION, 64);
-	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &netdev->index);
-	l_genl_msg_append_attr(msg, NL80211_ATTR_MAC, ETH_ALEN,
-							netdev->handshake->aa);
 
-	netdev->rssi_poll_cmd_id = l_genl_family_send(nl80211, msg,
-							netdev_rssi_poll_cb,
-							netdev, NULL);
+	netdev_get_station(netdev, netdev->handshake->aa,
+				netdev_rssi_poll_cb, netdev, NULL);
 }
 
-/* To be called whenever operational or rssi_levels_num are updated */
+/*
+ * To be called whenever operational or rssi_levels_num are updated.  Polling
+ * is needed for the RSSI levels if the driver can't monitor a list of CQM
+ * thresholds, and always for the RSSI trend estimate.
+ */
 static void netdev_rssi_polling_update(struct netdev *netdev)
 {
-	if (wiphy_has_ext_feature(netdev->wiphy,
-					NL80211_EXT_FEATURE_CQM_RSSI_LIST))
-		return;
+	bool poll_levels = netdev->rssi_levels_num > 0 &&
+				!wiphy_has_ext_feature(netdev->wiphy,
+					NL80211_EXT_FEATURE_CQM_RSSI_LIST);
 
-	if (netdev->operational && netdev->rssi_levels_num > 0) {
+	if (netdev->operational && (poll_levels || RSSI_PREDICTION_TIME)) {
 		if (netdev->rssi_poll_timeout)
 			return;
 
@@ -728,11 +975,6 @@ static void netdev_rssi_polling_update(struct netdev *netdev)
 
 		l_timeout_remove(netdev->rssi_poll_timeout);
 		netdev->rssi_poll_timeout = NULL;
-
-		if (netdev->rssi_poll_cmd_id) {
-			l_genl_family_cancel(nl80211, netdev->rssi_poll_cmd_id);
-			netdev->rssi_poll_cmd_id = 0;
-		}
 	}
 }
 
@@ -751,9 +993,21 @@ static void netdev_ft_ds_entry_free(void *data)
 {
 	struct netdev_ft_over_ds_info *info = data;
 
+	if (info->cmd_id)
+		l_genl_family_cancel(nl80211, info->cmd_id);
+
 	ft_ds_info_free(&info->super);
 }
 
+static void netdev_ft_ds_list_flush(struct netdev *netdev)
+{
+	l_timeout_remove(netdev->ft_ds_refresh_timeout);
+	netdev->ft_ds_refresh_timeout = NULL;
+
+	l_queue_destroy(netdev->ft_ds_list, netdev_ft_ds_entry_free);
+	netdev->ft_ds_list = NULL;
+}
+
 static void netdev_connect_free(struct netdev *netdev)
 {
 	if (netdev->work.id)
@@ -803,6 +1057,9 @@ static void netdev_connect_free(struct netdev *netdev)
 		netdev->sa_query_delay = NULL;
 	}
 
+	netdev->sa_query_tat = 0;
+	netdev->qos_map_len = 0;
+
 	if (netdev->group_handshake_timeout) {
 		l_timeout_remove(netdev->group_handshake_timeout);
 		netdev->group_handshake_timeout = NULL;
@@ -817,10 +1074,14 @@ static void netdev_connect_free(struct netdev *netdev)
 	netdev->result = NETDEV_RESULT_OK;
 	netdev->last_code = 0;
 	netdev->in_ft = false;
+	netdev->fw_roam_pending = false;
+	netdev->fw_port_authorized = false;
 	netdev->in_reassoc = false;
 	netdev->ignore_connect_event = false;
 	netdev->expect_connect_failure = false;
 	netdev->cur_rssi_low = false;
+	netdev->rssi_trend_low = false;
+	netdev->rssi_sample_time = 0;
 	netdev->privacy = false;
 
 	if (netdev->connect_cmd) {
@@ -843,10 +1104,7 @@ static void netdev_connect_free(struct netdev *netdev)
 		netdev->get_oci_cmd_id = 0;
 	}
 
-	if (netdev->ft_ds_list) {
-		l_queue_destroy(netdev->ft_ds_list, netdev_ft_ds_entry_free);
-		netdev->ft_ds_list = NULL;
-	}
+	netdev_ft_ds_list_flush(netdev);
 }
 
 static void netdev_connect_failed(struct netdev *netdev,
@@ -881,6 +1139,361 @@ static void netdev_disconnect_cb(struct l_genl_msg *msg, void *user_data)
 	netdev_connect_failed(netdev, netdev->result, netdev->last_code);
 }
 
+/*
+ * GET_STATION requests from the RSSI poll, station diagnostics, telemetry
+ * and AP diagnostics are queued and answered from the most recent reply for
+ * up to NETDEV_STATION_CACHE_TTL.  Requests for the same station, or for a
+ * dump of all stations, made while a command is in flight share that
+ * command's reply.  Only one command is outstanding at a time.
+ */
+#define NETDEV_STATION_CACHE_TTL	(500 * L_USEC_PER_MSEC)
+
+struct netdev_station_request {
+	uint8_t addr[6];
+	bool dump : 1;
+	bool sent : 1;
+	netdev_get_station_cb_t cb;
+	void *user_data;
+	netdev_destroy_func_t destroy;
+};
+
+/*
+ * The parsed reply, one entry per station kept in a single buffer so
+ * that a dump doesn't allocate for every station.  Callbacks only borrow
+ * the entries for their duration.
+ */
+#define NETDEV_STATION_INFOS_MIN	4
+
+struct netdev_station_infos {
+	unsigned int n_infos;
+	unsigned int size;
+	struct diagnostic_station_info infos[];
+};
+
+struct netdev_station_cmd {
+	struct netdev *netdev;
+	uint8_t addr[6];
+	bool dump : 1;
+	bool failed : 1;
+	struct netdev_station_infos *infos;
+};
+
+static struct netdev_station_infos *netdev_station_infos_new(void)
+{
+	struct netdev_station_infos *infos;
+
+	infos = l_malloc(sizeof(*infos) + NETDEV_STATION_INFOS_MIN *
+					sizeof(struct diagnostic_station_info));
+	infos->n_infos = 0;
+	infos->size = NETDEV_STATION_INFOS_MIN;
+
+	return infos;
+}
+
+static struct diagnostic_station_info *netdev_station_infos_add(
+					struct netdev_station_infos **infos)
+{
+	struct netdev_station_infos *p = *infos;
+
+	if (p->n_infos == p->size) {
+		p->size *= 2;
+		p = l_realloc(p, sizeof(*p) + p->size *
+					sizeof(struct diagnostic_station_info));
+		*infos = p;
+	}
+
+	memset(&p->infos[p->n_infos], 0, sizeof(p->infos[0]));
+
+	return &p->infos[p->n_infos++];
+}
+
+static void netdev_station_request_free(void *data)
+{
+	struct netdev_station_request *req = data;
+
+	if (req->destroy)
+		req->destroy(req->user_data);
+
+	l_free(req);
+}
+
+static const struct diagnostic_station_info *netdev_station_infos_find(
+				const struct netdev_station_infos *infos,
+				const uint8_t *addr)
+{
+	unsigned int i;
+
+	for (i = 0; i < infos->n_infos; i++)
+		if (!memcmp(infos->infos[i].addr, addr, 6))
+			return &infos->infos[i];
+
+	return NULL;
+}
+
+static bool netdev_station_cache_fresh(struct netdev *netdev)
+{
+	return netdev->station_cache && l_time_before(l_time_now(),
+					netdev->station_cache_time +
+					NETDEV_STATION_CACHE_TTL);
+}
+
+/* A cached dump can answer requests for single stations too */
+static bool netdev_station_cache_serves(struct netdev *netdev,
+				const struct netdev_station_request *req)
+{
+	if (netdev->station_cache_dump)
+		return true;
+
+	return !req->dump && !memcmp(netdev->station_cache_addr,
+							req->addr, 6);
+}
+
+static void netdev_station_request_reply(struct netdev_station_request *req,
+				const struct netdev_station_infos *infos)
+{
+	unsigned int i;
+
+	if (!req->cb)
+		return;
+
+	if (!infos) {
+		req->cb(NULL, req->user_data);
+		return;
+	}
+
+	if (req->dump) {
+		for (i = 0; i < infos->n_infos; i++)
+			req->cb(&infos->infos[i], req->user_data);
+
+		return;
+	}
+
+	req->cb(netdev_station_infos_find(infos, req->addr), req->user_data);
+}
+
+static void netdev_station_cmd_cb(struct l_genl_msg *msg, void *user_data)
+{
+	struct netdev_station_cmd *cmd = user_data;
+	struct l_genl_attr attr, nested;
+	uint16_t type, len;
+	const void *data;
+	struct diagnostic_station_info *info;
+
+	if (l_genl_msg_get_error(msg) < 0 || !l_genl_attr_init(&attr, msg))
+		goto parse_error;
+
+	info = netdev_station_infos_add(&cmd->infos);
+
+	while (l_genl_attr_next(&attr, &type, &len, &data)) {
+		switch (type) {
+		case NL80211_ATTR_STA_INFO:
+			if (!l_genl_attr_recurse(&attr, &nested))
+				goto parse_error;
+
+			if (!netdev_parse_sta_info(&nested, info))
+				goto parse_error;
+
+			break;
+
+		case NL80211_ATTR_MAC:
+			if (len != 6)
+				goto parse_error;
+
+			memcpy(info->addr, data, 6);
+
+			break;
+		}
+	}
+
+	return;
+
+parse_error:
+	cmd->failed = true;
+}
+
+static bool netdev_station_request_sent(const void *data,
+						const void *user_data)
+{
+	const struct netdev_station_request *req = data;
+
+	return req->sent;
+}
+
+static bool netdev_station_request_cached(const void *data,
+						const void *user_data)
+{
+	const struct netdev_station_request *req = data;
+	struct netdev *netdev = (struct netdev *) user_data;
+
+	return netdev_station_cache_serves(netdev, req);
+}
+
+/*
+ * Detach the matching requests before calling back, so that callbacks can
+ * make new requests.
+ */
+static void netdev_station_requests_reply(struct netdev *netdev,
+				l_queue_match_func_t match,
+				const struct netdev_station_infos *infos)
+{
+	struct l_queue *done = l_queue_new();
+	struct netdev_station_request *req;
+
+	while ((req = l_queue_remove_if(netdev->station_requests,
+							match, netdev)))
+		l_queue_push_tail(done, req);
+
+	while ((req = l_queue_pop_head(done))) {
+		netdev_station_request_reply(req, infos);
+		netdev_station_request_free(req);
+	}
+
+	l_queue_destroy(done, NULL);
+}
+
+static void netdev_station_cmd_destroy(void *user_data);
+
+static bool netdev_station_cmd_send(struct netdev *netdev,
+				const struct netdev_station_request *first)
+{
+	struct netdev_station_cmd *cmd;
+	struct l_genl_msg *msg;
+
+	cmd = l_new(struct netdev_station_cmd, 1);
+	cmd->netdev = netdev;
+	cmd->dump = first->dump;
+	memcpy(cmd->addr, first->addr, 6);
+	cmd->infos = netdev_station_infos_new();
+
+	msg = l_genl_msg_new_sized(NL80211_CMD_GET_STATION, 64);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &netdev->index);
+
+	if (cmd->dump)
+		netdev->get_station_cmd_id = l_genl_family_dump(nl80211, msg,
+						netdev_station_cmd_cb, cmd,
+						netdev_station_cmd_destroy);
+	else {
+		l_genl_msg_append_attr(msg, NL80211_ATTR_MAC, ETH_ALEN,
+							cmd->addr);
+		netdev->get_station_cmd_id = l_genl_family_send(nl80211, msg,
+						netdev_station_cmd_cb, cmd,
+						netdev_station_cmd_destroy);
+	}
+
+	if (!netdev->get_station_cmd_id) {
+		l_genl_msg_unref(msg);
+		l_free(cmd->infos);
+		l_free(cmd);
+		return false;
+	}
+
+	netdev->station_cmd = cmd;
+	return true;
+}
+
+static void netdev_station_requests_process(struct netdev *netdev)
+{
+	const struct l_queue_entry *entry;
+	const struct netdev_station_request *first;
+
+	if (netdev->get_station_cmd_id)
+		return;
+
+	if (netdev_station_cache_fresh(netdev))
+		netdev_station_requests_reply(netdev,
+					netdev_station_request_cached,
+					netdev->station_cache);
+
+	first = l_queue_peek_head(netdev->station_requests);
+	if (!first)
+		return;
+
+	/* Every request for the same station or dump shares the command */
+	for (entry = l_queue_get_entries(netdev->station_requests); entry;
+							entry = entry->next) {
+		struct netdev_station_request *req = entry->data;
+
+		req->sent = req->dump == first->dump && (req->dump ||
+					!memcmp(req->addr, first->addr, 6));
+	}
+
+	if (!netdev_station_cmd_send(netdev, first))
+		netdev_station_requests_reply(netdev,
+					netdev_station_request_sent, NULL);
+}
+
+/* Called once the reply, or every part of a dump, has been received */
+static void netdev_station_cmd_destroy(void *user_data)
+{
+	struct netdev_station_cmd *cmd = user_data;
+	struct netdev *netdev = cmd->netdev;
+
+	if (netdev) {
+		netdev->get_station_cmd_id = 0;
+		netdev->station_cmd = NULL;
+
+		if (!cmd->failed) {
+			l_free(netdev->station_cache);
+			netdev->station_cache = l_steal_ptr(cmd->infos);
+			netdev->station_cache_time = l_time_now();
+			netdev->station_cache_dump = cmd->dump;
+			memcpy(netdev->station_cache_addr, cmd->addr, 6);
+		} else
+			netdev_station_requests_reply(netdev,
+						netdev_station_request_sent,
+						NULL);
+	}
+
+	l_free(cmd->infos);
+	l_free(cmd);
+
+	if (netdev)
+		netdev_station_requests_process(netdev);
+}
+
+static void netdev_station_idle(struct l_idle *idle, void *user_data)
+{
+	struct netdev *netdev = user_data;
+
+	l_idle_remove(l_steal_ptr(netdev->station_idle));
+	netdev_station_requests_process(netdev);
+}
+
+static int netdev_station_request_add(struct netdev *netdev,
+					const uint8_t *mac,
+					netdev_get_station_cb_t cb,
+					void *user_data,
+					netdev_destroy_func_t destroy)
+{
+	struct netdev_station_request *req;
+
+	req = l_new(struct netdev_station_request, 1);
+	req->dump = !mac;
+	req->cb = cb;
+	req->user_data = user_data;
+	req->destroy = destroy;
+
+	if (mac)
+		memcpy(req->addr, mac, 6);
+
+	l_queue_push_tail(netdev->station_requests, req);
+
+	/* Replies, even cached ones, are always delivered asynchronously */
+	if (!netdev->get_station_cmd_id && !netdev->station_idle)
+		netdev->station_idle = l_idle_create(netdev_station_idle,
+							netdev, NULL);
+
+	return 0;
+}
+
+int netdev_get_station(struct netdev *netdev, const uint8_t *mac,
+			netdev_get_station_cb_t cb, void *user_data,
+			netdev_destroy_func_t destroy)
+{
+	return netdev_station_request_add(netdev, mac, cb, user_data,
+						destroy);
+}
+
 static void netdev_free(void *data)
 {
 	struct netdev *netdev = data;
@@ -949,18 +1562,22 @@ static void netdev_free(void *data)
 		netdev->mac_change_cmd_id = 0;
 	}
 
+	l_idle_remove(netdev->station_idle);
+
 	if (netdev->get_station_cmd_id) {
+		netdev->station_cmd->netdev = NULL;
 		l_genl_family_cancel(nl80211, netdev->get_station_cmd_id);
 		netdev->get_station_cmd_id = 0;
 	}
 
+	l_queue_destroy(netdev->station_requests, netdev_station_request_free);
+	l_free(netdev->station_cache);
+	l_queue_destroy(netdev->oci_cache, l_free);
+
 	if (netdev->fw_roam_bss)
 		scan_bss_free(netdev->fw_roam_bss);
 
-	if (netdev->ft_ds_list) {
-		l_queue_destroy(netdev->ft_ds_list, netdev_ft_ds_entry_free);
-		netdev->ft_ds_list = NULL;
-	}
+	netdev_ft_ds_list_flush(netdev);
 
 	scan_wdev_remove(netdev->wdev_id);
 
@@ -990,13 +1607,9 @@ static bool netdev_match(const void *a, const void *b)
 
 struct netdev *netdev_find(int ifindex)
 {
-	return l_queue_find(netdev_list, netdev_match, L_UINT_TO_PTR(ifindex));
+	return l_hashmap_lookup(netdev_index, L_UINT_TO_PTR(ifindex));
 }
 
-/* Threshold RSSI for roaming to trigger, configurable in main.conf */
-static int LOW_SIGNAL_THRESHOLD;
-static int LOW_SIGNAL_THRESHOLD_5GHZ;
-
 static void netdev_cqm_event_rssi_threshold(struct netdev *netdev,
 						uint32_t rssi_event)
 {
@@ -1046,6 +1659,8 @@ static void netdev_cqm_event_rssi_value(struct netdev *netdev, int rssi_val)
 	if (!netdev->event_filter)
 		return;
 
+	netdev_rssi_trend_update(netdev, rssi_val);
+
 	new_rssi_low = rssi_val < threshold;
 	if (netdev->cur_rssi_low != new_rssi_low) {
 		int event = new_rssi_low ?
@@ -1142,7 +1757,8 @@ static void netdev_rekey_offload_event(struct l_genl_msg *msg,
 				return;
 			}
 
-			replay_ctr = *((uint64_t *) data);
+			/* Same byte order as the EAPoL-Key field */
+			replay_ctr = l_get_be64(data);
 			__eapol_update_replay_counter(netdev->index,
 							netdev->addr,
 							netdev->handshake->aa,
@@ -1384,6 +2000,11 @@ static void netdev_connect_ok(struct netdev *netdev)
 					L_UINT_TO_PTR(netdev->index), NULL);
 
 	netdev->operational = true;
+	netdev->fw_port_authorized = false;
+	netdev->connect_times.completed = l_time_now();
+
+	if (netdev->handshake)
+		handshake_state_cache_pmksa(netdev->handshake);
 
 	if (netdev->fw_roam_bss) {
 		if (netdev->event_filter)
@@ -1396,10 +2017,7 @@ static void netdev_connect_ok(struct netdev *netdev)
 		netdev->fw_roam_bss = NULL;
 	}
 
-	if (netdev->ft_ds_list) {
-		l_queue_destroy(netdev->ft_ds_list, netdev_ft_ds_entry_free);
-		netdev->ft_ds_list = NULL;
-	}
+	netdev_ft_ds_list_flush(netdev);
 
 	if (netdev->connect_cb) {
 		netdev->connect_cb(netdev, NETDEV_RESULT_OK, NULL,
@@ -1421,11 +2039,12 @@ static void netdev_setting_keys_failed(struct netdev_handshake_state *nhs,
 
 	/*
 	 * Something went wrong with our sequence:
-	 * 1. new_key(ptk)
-	 * 2. new_key(gtk) [optional]
-	 * 3. new_key(igtk) [optional]
-	 * 4. rekey offload [optional]
+	 * 1. new_key(gtk) [optional]
+	 * 2. new_key(igtk) [optional]
+	 * 3. new_key(bigtk) [optional]
+	 * 4. new_key(ptk)
 	 * 5. set_station
+	 * 6. rekey offload [optional]
 	 *
 	 * Cancel all pending commands, then de-authenticate
 	 */
@@ -1480,7 +2099,7 @@ static void netdev_setting_keys_failed(struct netdev_handshake_state *nhs,
 static void try_handshake_complete(struct netdev_handshake_state *nhs)
 {
 	if (nhs->ptk_installed && nhs->gtk_installed && nhs->igtk_installed &&
-			!nhs->complete) {
+			nhs->bigtk_installed && !nhs->complete) {
 		nhs->complete = true;
 
 		if (handshake_event(&nhs->super, HANDSHAKE_EVENT_COMPLETE))
@@ -1499,7 +2118,13 @@ static void netdev_set_station_cb(struct l_genl_msg *msg, void *user_data)
 	int err;
 
 	nhs->set_station_cmd_id = 0;
-	nhs->ptk_installed = true;
+
+	/*
+	 * When pipelined behind the pairwise NEW_KEY, the PTK only counts
+	 * as installed once both replies have come back successfully.
+	 */
+	if (!nhs->pairwise_new_key_cmd_id)
+		nhs->ptk_installed = true;
 
 	if (netdev->type == NL80211_IFTYPE_STATION && !netdev->connected)
 		return;
@@ -1569,6 +2194,29 @@ static void netdev_new_group_management_key_cb(struct l_genl_msg *msg,
 	try_handshake_complete(nhs);
 }
 
+static void netdev_new_beacon_key_cb(struct l_genl_msg *msg, void *data)
+{
+	struct netdev_handshake_state *nhs = data;
+	struct netdev *netdev = nhs->netdev;
+	int err = l_genl_msg_get_error(msg);
+
+	nhs->beacon_new_key_cmd_id = 0;
+
+	if (err < 0) {
+		const char *ext_error = l_genl_msg_get_extended_error(msg);
+
+		l_error("New Key for Beacon failed for ifindex: %d:%s",
+				netdev->index,
+				ext_error ? ext_error : strerror(-err));
+
+		netdev_setting_keys_failed(nhs, err);
+		return;
+	}
+
+	nhs->bigtk_installed = true;
+	try_handshake_complete(nhs);
+}
+
 static bool netdev_copy_tk(uint8_t *tk_buf, const uint8_t *tk,
 				uint32_t cipher, bool authenticator)
 {
@@ -1726,6 +2374,67 @@ static void netdev_set_igtk(struct handshake_state *hs, uint16_t key_index,
 	netdev_setting_keys_failed(nhs, -EIO);
 }
 
+static void netdev_set_bigtk(struct handshake_state *hs, uint16_t key_index,
+				const uint8_t *bigtk, uint8_t bigtk_len,
+				const uint8_t *bipn, uint8_t bipn_len,
+				uint32_t cipher)
+{
+	struct netdev_handshake_state *nhs =
+		l_container_of(hs, struct netdev_handshake_state, super);
+	uint8_t bigtk_buf[16];
+	struct netdev *netdev = nhs->netdev;
+	struct l_genl_msg *msg;
+
+	/*
+	 * The AP only includes the BIGTK if we advertised Beacon Protection,
+	 * which requires driver support.  Treat it as optional regardless.
+	 */
+	if (!wiphy_has_ext_feature(netdev->wiphy,
+				NL80211_EXT_FEATURE_BEACON_PROTECTION_CLIENT)) {
+		l_debug("Beacon protection not supported, ignoring BIGTK");
+		return;
+	}
+
+	if (key_index != 6 && key_index != 7) {
+		l_warn("Invalid BIGTK key index (%04hx), ignoring", key_index);
+		return;
+	}
+
+	nhs->bigtk_installed = false;
+
+	l_debug("%d", netdev->index);
+
+	if (crypto_cipher_key_len(cipher) != bigtk_len) {
+		l_error("Unexpected key length: %d", bigtk_len);
+		netdev_setting_keys_failed(nhs, -ERANGE);
+		return;
+	}
+
+	switch (cipher) {
+	case CRYPTO_CIPHER_BIP:
+		memcpy(bigtk_buf, bigtk, 16);
+		break;
+	default:
+		l_error("Unexpected cipher: %x", cipher);
+		netdev_setting_keys_failed(nhs, -ENOENT);
+		return;
+	}
+
+	msg = nl80211_build_new_key_group(netdev->index, cipher, key_index,
+					bigtk_buf, bigtk_len, bipn, bipn_len,
+					NULL);
+
+	nhs->beacon_new_key_cmd_id =
+			l_genl_family_send(nl80211, msg,
+				netdev_new_beacon_key_cb, nhs, NULL);
+
+	if (nhs->beacon_new_key_cmd_id > 0)
+		return;
+
+	l_genl_msg_unref(msg);
+	netdev_setting_keys_failed(nhs, -EIO);
+}
+
 static struct l_genl_msg *netdev_build_cmd_set_key_tx(struct netdev *netdev)
 {
 	uint8_t key_mode = NL80211_KEY_SET_TX;
@@ -1781,6 +2490,33 @@ error:
 	netdev_setting_keys_failed(nhs, err);
 }
 
+static void netdev_new_pairwise_key_pipelined_cb(struct l_genl_msg *msg,
+							void *data)
+{
+	struct netdev_handshake_state *nhs = data;
+	struct netdev *netdev = nhs->netdev;
+	int err = l_genl_msg_get_error(msg);
+
+	nhs->pairwise_new_key_cmd_id = 0;
+
+	if (err < 0) {
+		const char *ext_error = l_genl_msg_get_extended_error(msg);
+
+		l_error("New Key for Pairwise Key failed for ifindex: %d:%s",
+				netdev->index,
+				ext_error ? ext_error : strerror(-err));
+		netdev_setting_keys_failed(nhs, err);
+		return;
+	}
+
+	/* SET_STATION still outstanding, its callback will finish up */
+	if (nhs->set_station_cmd_id)
+		return;
+
+	nhs->ptk_installed = true;
+	try_handshake_complete(nhs);
+}
+
 static struct l_genl_msg *netdev_build_control_port_frame(struct netdev *netdev,
 							const uint8_t *to,
 							uint16_t proto,
@@ -1820,6 +2556,32 @@ static void netdev_control_port_frame_cb(struct l_genl_msg *msg,
 			ext_error ? ext_error : strerror(-err));
 }
 
+static void netdev_pae_tx_flush(void)
+{
+	unsigned int sent = 0;
+	int fd;
+	int r;
+
+	if (!pae_tx_count)
+		return;
+
+	fd = l_io_get_fd(pae_tx_netdev->pae_io);
+
+	while (sent < pae_tx_count) {
+		r = sendmmsg(fd, pae_tx_pool->msgs + sent,
+				pae_tx_count - sent, 0);
+		if (r < 0) {
+			l_error("EAPoL write socket: %s", strerror(errno));
+			/* Drop the failed frame, try the rest */
+			r = 1;
+		}
+
+		sent += r;
+	}
+
+	pae_tx_count = 0;
+}
+
 static int netdev_control_port_write_pae(struct netdev *netdev,
 						const uint8_t *dest,
 						uint16_t proto,
@@ -1839,6 +2601,26 @@ static int netdev_control_port_write_pae(struct netdev *netdev,
 	sll.sll_halen = ETH_ALEN;
 	memcpy(sll.sll_addr, dest, ETH_ALEN);
 
+	if (netdev == pae_tx_netdev && frame_size <= IEEE80211_MAX_DATA_LEN) {
+		struct mmsghdr *mmsg;
+
+		if (pae_tx_count == NETDEV_PAE_BATCH)
+			netdev_pae_tx_flush();
+
+		mmsg = &pae_tx_pool->msgs[pae_tx_count];
+		memcpy(pae_tx_pool->frames[pae_tx_count], ef, frame_size);
+		pae_tx_pool->addrs[pae_tx_count] = sll;
+		pae_tx_pool->iov[pae_tx_count].iov_len = frame_size;
+		mmsg->msg_hdr.msg_namelen = sizeof(sll);
+		pae_tx_count++;
+
+		return frame_size;
+	}
+
+	/* Keep the order if an oversized frame is sent mid batch */
+	if (netdev == pae_tx_netdev)
+		netdev_pae_tx_flush();
+
 	r = sendto(fd, ef, frame_size, 0,
 			(struct sockaddr *) &sll, sizeof(sll));
 	if (r < 0)
@@ -2066,11 +2848,27 @@ static void netdev_set_tk(struct handshake_state *hs, uint8_t key_index,
 						crypto_cipher_key_len(cipher),
 						key_index);
 	nhs->pairwise_new_key_cmd_id =
-		l_genl_family_send(nl80211, msg, netdev_new_pairwise_key_cb,
-						nhs, NULL);
-	if (nhs->pairwise_new_key_cmd_id > 0)
+		l_genl_family_send(nl80211, msg,
+					netdev_new_pairwise_key_pipelined_cb,
+					nhs, NULL);
+	if (!nhs->pairwise_new_key_cmd_id)
+		goto send_failed;
+
+	/*
+	 * Don't wait for the NEW_KEY reply before authorizing the station.
+	 * nl80211 handles the requests in the order they were sent, so the
+	 * key is in place by the time SET_STATION is processed.  If NEW_KEY
+	 * fails the connection is torn down from its callback anyway.
+	 */
+	msg = nl80211_build_set_station_authorized(netdev->index, addr);
+
+	nhs->set_station_cmd_id =
+		l_genl_family_send(nl80211, msg, netdev_set_station_cb,
+					nhs, NULL);
+	if (nhs->set_station_cmd_id > 0)
 		return;
 
+send_failed:
 	err = -EIO;
 	l_genl_msg_unref(msg);
 invalid_key:
@@ -2159,6 +2957,10 @@ static void netdev_set_pmk_cb(struct l_genl_msg *msg, void *user_data)
 		return;
 	}
 
+	/* A re-authentication after the firmware already authorized us */
+	if (netdev->operational)
+		return;
+
 	if (handshake_event(netdev->handshake, HANDSHAKE_EVENT_SETTING_KEYS))
 		return;
 
@@ -2195,6 +2997,78 @@ static void netdev_set_pmk(struct handshake_state *hs, const uint8_t *pmk,
 	}
 }
 
+/*
+ * Operating channels of recently used BSSes, learned from GET_INTERFACE and
+ * channel switch events.  Reassociating to one of these on the same
+ * frequency can start the 4-Way Handshake with a known OCI instead of
+ * waiting on another GET_INTERFACE round trip.  Entries are dropped after
+ * NETDEV_OCI_CACHE_TTL or when a handshake with that BSS fails.
+ */
+#define NETDEV_OCI_CACHE_SIZE	4
+#define NETDEV_OCI_CACHE_TTL	(300 * L_USEC_PER_SEC)
+
+struct netdev_oci_entry {
+	uint8_t addr[6];
+	uint64_t time;
+	struct band_chandef chandef;
+};
+
+static bool netdev_oci_entry_match(const void *a, const void *b)
+{
+	const struct netdev_oci_entry *entry = a;
+
+	return !memcmp(entry->addr, b, 6);
+}
+
+static void netdev_oci_cache_store(struct netdev *netdev, const uint8_t *addr,
+					const struct band_chandef *chandef)
+{
+	struct netdev_oci_entry *entry;
+
+	if (!netdev->oci_cache)
+		netdev->oci_cache = l_queue_new();
+
+	entry = l_queue_remove_if(netdev->oci_cache, netdev_oci_entry_match,
+					addr);
+	if (!entry) {
+		if (l_queue_length(netdev->oci_cache) >= NETDEV_OCI_CACHE_SIZE)
+			l_free(l_queue_pop_head(netdev->oci_cache));
+
+		entry = l_new(struct netdev_oci_entry, 1);
+		memcpy(entry->addr, addr, 6);
+	}
+
+	entry->time = l_time_now();
+	entry->chandef = *chandef;
+	l_queue_push_tail(netdev->oci_cache, entry);
+}
+
+static void netdev_oci_cache_forget(struct netdev *netdev, const uint8_t *addr)
+{
+	l_free(l_queue_remove_if(netdev->oci_cache, netdev_oci_entry_match,
+					addr));
+}
+
+static const struct band_chandef *netdev_oci_cache_find(struct netdev *netdev,
+							const uint8_t *addr)
+{
+	struct netdev_oci_entry *entry = l_queue_find(netdev->oci_cache,
+							netdev_oci_entry_match,
+							addr);
+
+	if (!entry)
+		return NULL;
+
+	if (entry->chandef.frequency != netdev->frequency ||
+			l_time_after(l_time_now(),
+					entry->time + NETDEV_OCI_CACHE_TTL)) {
+		netdev_oci_cache_forget(netdev, addr);
+		return NULL;
+	}
+
+	return &entry->chandef;
+}
+
 void netdev_handshake_failed(struct handshake_state *hs, uint16_t reason_code)
 {
 	struct netdev_handshake_state *nhs =
@@ -2210,6 +3084,10 @@ void netdev_handshake_failed(struct handshake_state *hs, uint16_t reason_code)
 	netdev->result = NETDEV_RESULT_HANDSHAKE_FAILED;
 	netdev->last_code = reason_code;
 
+	/* The cached OCI may be why the AP rejected us */
+	if (!hs->authenticator)
+		netdev_oci_cache_forget(netdev, hs->aa);
+
 	switch (netdev->type) {
 	case NL80211_IFTYPE_STATION:
 	case NL80211_IFTYPE_P2P_CLIENT:
@@ -2257,6 +3135,9 @@ static struct l_genl_msg *netdev_build_cmd_replay_counter(struct netdev *netdev,
 							uint64_t replay_ctr)
 {
 	struct l_genl_msg *msg;
+	uint8_t replay_ctr_be[NL80211_REPLAY_CTR_LEN];
+
+	l_put_be64(replay_ctr, replay_ctr_be);
 
 	msg = l_genl_msg_new_sized(NL80211_CMD_SET_REKEY_OFFLOAD, 512);
 
@@ -2268,7 +3149,7 @@ static struct l_genl_msg *netdev_build_cmd_replay_counter(struct netdev *netdev,
 	l_genl_msg_append_attr(msg, NL80211_REKEY_DATA_KCK,
 					NL80211_KCK_LEN, kck);
 	l_genl_msg_append_attr(msg, NL80211_REKEY_DATA_REPLAY_CTR,
-			NL80211_REPLAY_CTR_LEN, &replay_ctr);
+			NL80211_REPLAY_CTR_LEN, replay_ctr_be);
 
 	l_genl_msg_leave_nested(msg);
 
@@ -2317,6 +3198,64 @@ static void netdev_qos_map_cb(struct l_genl_msg *msg, void *user_data)
 			ext_error ? ext_error : strerror(-err));
 }
 
+static bool netdev_dscp_policy_has(struct netdev *netdev, uint8_t dscp)
+{
+	unsigned int i;
+
+	for (i = 0; i < netdev->dscp_policy_len; i += 2)
+		if (netdev->dscp_policy[i] == dscp)
+			return true;
+
+	return false;
+}
+
+/*
+ * Builds the QoS Map Set (802.11-2020 9.4.2.94) to be used by the kernel.
+ * The DSCP policy set locally takes precedence over the exceptions sent
+ * by the AP while the AP's ranges are kept.  Without a map from the AP
+ * the ranges match the kernel's default of using the top three DSCP bits
+ * as the UP.
+ */
+static size_t netdev_build_qos_map(struct netdev *netdev, uint8_t *out)
+{
+	size_t ap_exceptions_len = 0;
+	size_t len;
+	size_t i;
+
+	if (!netdev->qos_map_len && !netdev->dscp_policy_len)
+		return 0;
+
+	memcpy(out, netdev->dscp_policy, netdev->dscp_policy_len);
+	len = netdev->dscp_policy_len;
+
+	if (netdev->qos_map_len)
+		ap_exceptions_len = netdev->qos_map_len - QOS_MAP_RANGES_LEN;
+
+	for (i = 0; i < ap_exceptions_len; i += 2) {
+		if (len == QOS_MAP_MAX_EXCEPTIONS * 2)
+			break;
+
+		if (netdev_dscp_policy_has(netdev, netdev->qos_map[i]))
+			continue;
+
+		out[len++] = netdev->qos_map[i];
+		out[len++] = netdev->qos_map[i + 1];
+	}
+
+	if (netdev->qos_map_len) {
+		memcpy(out + len, netdev->qos_map + ap_exceptions_len,
+			QOS_MAP_RANGES_LEN);
+		return len + QOS_MAP_RANGES_LEN;
+	}
+
+	for (i = 0; i < 8; i++) {
+		out[len++] = i << 3;
+		out[len++] = (i << 3) | 7;
+	}
+
+	return len;
+}
+
 /*
  * TODO: Fix this in the kernel:
  *
@@ -2328,31 +3267,133 @@ static void netdev_qos_map_cb(struct l_genl_msg *msg, void *user_data)
  * frame comes in and not require userspace to forward it back... but that's a
  * battle for another day.
  */
-static void netdev_send_qos_map_set(struct netdev *netdev,
-					const uint8_t *qos_set, size_t qos_len)
+static void netdev_apply_qos_map(struct netdev *netdev)
 {
+	uint8_t qos_map[QOS_MAP_MAX_LEN];
+	size_t qos_len = netdev_build_qos_map(netdev, qos_map);
 	struct l_genl_msg *msg;
 
-	if (!wiphy_supports_qos_set_map(netdev->wiphy)) {
-		l_warn("AP sent QoS Map, but capability was not advertised!");
+	if (!qos_len && !netdev->qos_map_applied)
 		return;
-	}
 
-	/*
-	 * Since this IE comes in on either a management frame or during
-	 * Association response we could have potentially already set this.
-	 */
+	/* A newer map replaces one that is still on its way to the kernel */
 	if (netdev->qos_map_cmd_id)
-		return;
+		l_genl_family_cancel(nl80211, netdev->qos_map_cmd_id);
 
 	msg = l_genl_msg_new_sized(NL80211_CMD_SET_QOS_MAP, 128 + qos_len);
 
 	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &netdev->index);
-	l_genl_msg_append_attr(msg, NL80211_ATTR_QOS_MAP, qos_len, qos_set);
+
+	/* Without a map the kernel drops the one it has */
+	if (qos_len)
+		l_genl_msg_append_attr(msg, NL80211_ATTR_QOS_MAP, qos_len,
+					qos_map);
 
 	netdev->qos_map_cmd_id = l_genl_family_send(nl80211, msg,
 						netdev_qos_map_cb,
 						netdev, NULL);
+	netdev->qos_map_applied = qos_len != 0;
+
+	if (netdev->event_filter)
+		netdev->event_filter(netdev, NETDEV_EVENT_QOS_MAP_CHANGED,
+					NULL, netdev->user_data);
+}
+
+/* Takes the QoS Map Set element body from the AP, NULL if it sent none */
+static void netdev_set_ap_qos_map(struct netdev *netdev,
+					const uint8_t *qos_set, size_t qos_len)
+{
+	if (!wiphy_supports_qos_set_map(netdev->wiphy)) {
+		if (qos_set)
+			l_warn("AP sent QoS Map, but capability was not "
+				"advertised!");
+
+		return;
+	}
+
+	if (qos_set && (qos_len < QOS_MAP_RANGES_LEN ||
+				qos_len > QOS_MAP_MAX_LEN || qos_len & 1)) {
+		l_debug("Ignoring invalid QoS Map of length %zu", qos_len);
+		return;
+	}
+
+	netdev->qos_map_len = qos_set ? qos_len : 0;
+
+	if (qos_set)
+		memcpy(netdev->qos_map, qos_set, qos_len);
+
+	netdev_apply_qos_map(netdev);
+}
+
+int netdev_set_dscp_policy(struct netdev *netdev, const uint8_t *policy,
+				size_t len)
+{
+	size_t i;
+	size_t j;
+
+	if (!wiphy_supports_qos_set_map(netdev->wiphy))
+		return -ENOTSUP;
+
+	if (len > sizeof(netdev->dscp_policy) || len & 1)
+		return -EINVAL;
+
+	for (i = 0; i < len; i += 2) {
+		if (policy[i] > 63 || policy[i + 1] > 7)
+			return -EINVAL;
+
+		for (j = 0; j < i; j += 2)
+			if (policy[j] == policy[i])
+				return -EINVAL;
+	}
+
+	memcpy(netdev->dscp_policy, policy, len);
+	netdev->dscp_policy_len = len;
+
+	if (netdev->connected)
+		netdev_apply_qos_map(netdev);
+
+	return 0;
+}
+
+/*
+ * Fills in the User Priority the kernel uses for each of the 64 DSCP
+ * values on the current connection.
+ */
+bool netdev_get_dscp_map(struct netdev *netdev, uint8_t *map)
+{
+	uint8_t qos_map[QOS_MAP_MAX_LEN];
+	size_t qos_len = 0;
+	const uint8_t *ranges;
+	unsigned int dscp;
+	unsigned int i;
+
+	if (!netdev->connected)
+		return false;
+
+	if (netdev->qos_map_applied)
+		qos_len = netdev_build_qos_map(netdev, qos_map);
+
+	for (dscp = 0; dscp < 64; dscp++)
+		map[dscp] = dscp >> 3;
+
+	if (!qos_len)
+		return true;
+
+	ranges = qos_map + qos_len - QOS_MAP_RANGES_LEN;
+
+	/* As with the exceptions the first matching range wins */
+	for (dscp = 0; dscp < 64; dscp++)
+		for (i = 8; i > 0; i--)
+			if (dscp >= ranges[i * 2 - 2] &&
+					dscp <= ranges[i * 2 - 1])
+				map[dscp] = i - 1;
+
+	/* Exceptions take precedence, the earliest one wins */
+	for (i = qos_len - QOS_MAP_RANGES_LEN; i > 0; i -= 2)
+		if (qos_map[i - 2] < 64)
+			map[qos_map[i - 2]] = qos_map[i - 1];
+
+	return true;
 }
 
 static void netdev_get_oci_cb(struct l_genl_msg *msg, void *user_data)
@@ -2381,6 +3422,7 @@ static void netdev_get_oci_cb(struct l_genl_msg *msg, void *user_data)
 			chandef->frequency, chandef->channel_width,
 			chandef->center1_frequency, chandef->center2_frequency);
 
+	netdev_oci_cache_store(netdev, netdev->handshake->aa, chandef);
 	handshake_state_set_chandef(netdev->handshake, l_steal_ptr(chandef));
 
 done:
@@ -2467,6 +3509,7 @@ static void parse_request_ies(struct netdev *netdev, const uint8_t *ies,
 static void netdev_driver_connected(struct netdev *netdev)
 {
 	netdev->connected = true;
+	netdev->connect_times.associated = l_time_now();
 
 	if (netdev->event_filter)
 		netdev->event_filter(netdev, NETDEV_EVENT_ASSOCIATING, NULL,
@@ -2537,7 +3580,7 @@ static struct l_genl_msg *netdev_build_cmd_connect(struct netdev *netdev,
 {
 	struct netdev_handshake_state *nhs =
 		l_container_of(hs, struct netdev_handshake_state, super);
-	uint32_t auth_type = IE_AKM_IS_SAE(hs->akm_suite) ?
+	uint32_t auth_type = IE_AKM_IS_SAE(hs->akm_suite) && !hs->pmksa ?
 					NL80211_AUTHTYPE_SAE :
 					NL80211_AUTHTYPE_OPEN_SYSTEM;
 	enum mpdu_management_subtype subtype = prev_bssid ?
@@ -2897,15 +3940,27 @@ process_resp_ies:
 			}
 		}
 
-		if (qos_set)
-			netdev_send_qos_map_set(netdev, qos_set, qos_len);
+		netdev_set_ap_qos_map(netdev, qos_set, qos_len);
 	}
 
 	if (netdev->sm) {
 		if (!hs->chandef) {
-			if (netdev_get_oci(netdev) < 0)
+			const struct band_chandef *chandef =
+					netdev_oci_cache_find(netdev, hs->aa);
+
+			if (chandef) {
+				l_debug("Using cached OCI, freq: %u",
+						chandef->frequency);
+				handshake_state_set_chandef(hs,
+						l_memdup(chandef,
+							sizeof(*chandef)));
+			} else if (netdev_get_oci(netdev) < 0)
 				goto deauth;
-		} else if (!eapol_start(netdev->sm))
+			else
+				return;
+		}
+
+		if (!eapol_start(netdev->sm))
 			goto deauth;
 
 		return;
@@ -3122,8 +4177,10 @@ static void netdev_authenticate_event(struct l_genl_msg *msg,
 		ret = auth_proto_rx_authenticate(netdev->ap, frame, frame_len);
 
 		/* We have sent another CMD_AUTHENTICATE / CMD_ASSOCIATE */
-		if (ret == 0 || ret == -EAGAIN)
+		if (ret == 0 || ret == -EAGAIN) {
+			netdev->connect_times.authenticated = l_time_now();
 			return;
+		}
 
 		retry = kernel_will_retry_auth(status_code,
 				L_CPU_TO_LE16(auth->algorithm),
@@ -3638,6 +4695,43 @@ static void netdev_mac_power_up_cb(int error, uint16_t type,
 	}
 }
 
+static void netdev_mac_power_down_cb(int error, uint16_t type,
+					const void *data, uint32_t len,
+					void *user_data);
+
+static void netdev_mac_live_change_cb(int error, uint16_t type,
+					const void *data, uint32_t len,
+					void *user_data)
+{
+	struct rtnl_data *req = user_data;
+	struct netdev *netdev = req->netdev;
+
+	netdev->mac_change_cmd_id = 0;
+
+	if (error) {
+		l_debug("Live address change on %u failed: %s, power cycling",
+				netdev->index, strerror(-error));
+
+		netdev->mac_change_cmd_id = l_rtnl_set_powered(rtnl,
+					netdev->index, false,
+					netdev_mac_power_down_cb, req,
+					netdev_mac_destroy);
+		if (!netdev->mac_change_cmd_id) {
+			netdev_mac_change_failed(netdev, req, -EIO);
+			return;
+		}
+
+		req->ref++;
+		return;
+	}
+
+	if (netdev_begin_connection(netdev) < 0) {
+		l_error("Failed to connect after changing MAC");
+		netdev_connect_failed(netdev, NETDEV_RESULT_ASSOCIATION_FAILED,
+				MMPDU_STATUS_CODE_UNSPECIFIED);
+	}
+}
+
 static void netdev_mac_power_down_cb(int error, uint16_t type,
 					const void *data, uint32_t len,
 					void *user_data)
@@ -3715,9 +4809,24 @@ static int netdev_start_powered_mac_change(struct netdev *netdev)
 	req->ref++;
 	memcpy(req->addr, new_addr, sizeof(req->addr));
 
-	netdev->mac_change_cmd_id = l_rtnl_set_powered(rtnl, netdev->index,
-					false, netdev_mac_power_down_cb,
-					req, netdev_mac_destroy);
+	/*
+	 * Avoid the down/up cycle if the address can be changed while
+	 * running.  Scans and other radio work can't be in progress since
+	 * this runs as the connection's radio work item.
+	 */
+	if (wiphy_has_ext_feature(netdev->wiphy,
+				NL80211_EXT_FEATURE_POWERED_ADDR_CHANGE)) {
+		l_debug("Setting generated address on ifindex: %d to: "MAC,
+					netdev->index, MAC_STR(new_addr));
+		netdev->mac_change_cmd_id = l_rtnl_set_mac(rtnl, netdev->index,
+					req->addr, false,
+					netdev_mac_live_change_cb, req,
+					netdev_mac_destroy);
+	} else
+		netdev->mac_change_cmd_id = l_rtnl_set_powered(rtnl,
+					netdev->index, false,
+					netdev_mac_power_down_cb, req,
+					netdev_mac_destroy);
 
 	if (!netdev->mac_change_cmd_id) {
 		l_free(req);
@@ -3864,6 +4973,7 @@ static void netdev_connection_work_destroy(struct wiphy_radio_work_item *item)
 static const struct wiphy_radio_work_item_ops connect_work_ops = {
 	.do_work = netdev_connection_work_ready,
 	.destroy = netdev_connection_work_destroy,
+	.type = WIPHY_WORK_TYPE_CONNECT,
 };
 
 static int netdev_handshake_state_setup_connection_type(
@@ -3957,6 +5067,70 @@ offload_1x:
 	return 0;
 }
 
+static void netdev_pmksa_driver_cb(struct l_genl_msg *msg, void *user_data)
+{
+	int err = l_genl_msg_get_error(msg);
+
+	if (err < 0)
+		l_debug("PMKSA offload command failed: %s (%d)",
+				strerror(-err), -err);
+}
+
+/*
+ * Drivers doing the SME in firmware need the PMKSA entries themselves in
+ * order to offer them on (re)association or firmware roams
+ */
+static void netdev_pmksa_driver_send(uint8_t cmd, const struct pmksa *pmksa)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(netdev_list); entry;
+						entry = entry->next) {
+		struct netdev *netdev = entry->data;
+		struct l_genl_msg *msg;
+
+		if (wiphy_supports_cmds_auth_assoc(netdev->wiphy))
+			continue;
+
+		if (pmksa && memcmp(netdev->addr, pmksa->spa, 6))
+			continue;
+
+		msg = l_genl_msg_new(cmd);
+		l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX,
+					4, &netdev->index);
+
+		if (pmksa) {
+			l_genl_msg_append_attr(msg, NL80211_ATTR_MAC,
+						6, pmksa->aa);
+			l_genl_msg_append_attr(msg, NL80211_ATTR_PMKID,
+						16, pmksa->pmkid);
+		}
+
+		if (pmksa && cmd == NL80211_CMD_SET_PMKSA)
+			l_genl_msg_append_attr(msg, NL80211_ATTR_PMK,
+						pmksa->pmk_len, pmksa->pmk);
+
+		if (!l_genl_family_send(nl80211, msg, netdev_pmksa_driver_cb,
+						NULL, NULL))
+			l_genl_msg_unref(msg);
+	}
+}
+
+static void netdev_pmksa_driver_add(const struct pmksa *pmksa)
+{
+	netdev_pmksa_driver_send(NL80211_CMD_SET_PMKSA, pmksa);
+}
+
+static void netdev_pmksa_driver_remove(const struct pmksa *pmksa)
+{
+	netdev_pmksa_driver_send(NL80211_CMD_DEL_PMKSA, pmksa);
+}
+
+static void netdev_pmksa_driver_flush(void)
+{
+	netdev_pmksa_driver_send(NL80211_CMD_FLUSH_PMKSA, NULL);
+}
+
 static void netdev_connect_common(struct netdev *netdev,
 					struct scan_bss *bss,
 					struct scan_bss *prev_bss,
@@ -3977,6 +5151,9 @@ static void netdev_connect_common(struct netdev *netdev,
 	netdev->privacy = bss->capability & IE_BSS_CAP_PRIVACY;
 	handshake_state_set_authenticator_address(hs, bss->addr);
 
+	memset(&netdev->connect_times, 0, sizeof(netdev->connect_times));
+	netdev->connect_times.start = l_time_now();
+
 	if (!is_rsn)
 		goto build_cmd_connect;
 
@@ -3986,6 +5163,14 @@ static void netdev_connect_common(struct netdev *netdev,
 	switch (hs->akm_suite) {
 	case IE_RSN_AKM_SUITE_SAE_SHA256:
 	case IE_RSN_AKM_SUITE_FT_OVER_SAE_SHA256:
+		/*
+		 * With a cached PMKSA, Open System authentication is used and
+		 * the PMKID in the RSNE identifies the PMK (802.11-2020
+		 * 12.6.10.3)
+		 */
+		if (hs->pmksa)
+			goto build_cmd_connect;
+
 		netdev->ap = sae_sm_new(hs, netdev_sae_tx_authenticate,
 						netdev_sae_tx_associate,
 						netdev);
@@ -4460,6 +5645,7 @@ static void prepare_ft(struct netdev *netdev, const struct scan_bss *target_bss)
 	nhs->ptk_installed = false;
 	nhs->gtk_installed = true;
 	nhs->igtk_installed = true;
+	nhs->bigtk_installed = true;
 
 	if (nhs->group_new_key_cmd_id) {
 		l_genl_family_cancel(nl80211, nhs->group_new_key_cmd_id);
@@ -4490,7 +5676,7 @@ static void netdev_ft_over_ds_auth_failed(struct netdev_ft_over_ds_info *info,
 						uint16_t status)
 {
 	l_queue_remove(info->netdev->ft_ds_list, info);
-	ft_ds_info_free(&info->super);
+	netdev_ft_ds_entry_free(info);
 }
 
 struct ft_ds_finder {
@@ -4577,7 +5763,7 @@ static void netdev_qos_map_frame_event(const struct mmpdu_header *hdr,
 	if (l_get_u8(body + 2) != IE_TYPE_QOS_MAP_SET)
 		return;
 
-	netdev_send_qos_map_set(netdev, body + 4, body_len - 4);
+	netdev_set_ap_qos_map(netdev, body + 4, body_len - 4);
 }
 
 static bool netdev_ft_work_ready(struct wiphy_radio_work_item *item)
@@ -4598,6 +5784,7 @@ static bool netdev_ft_work_ready(struct wiphy_radio_work_item *item)
 
 static const struct wiphy_radio_work_item_ops ft_work_ops = {
 	.do_work = netdev_ft_work_ready,
+	.type = WIPHY_WORK_TYPE_FT,
 };
 
 int netdev_fast_transition(struct netdev *netdev,
@@ -4647,59 +5834,164 @@ int netdev_fast_transition_over_ds(struct netdev *netdev,
 			l_get_le16(target_bss->mde))
 		return -EINVAL;
 
-	finder.spa = netdev->addr;
-	finder.aa = target_bss->addr;
+	finder.spa = netdev->addr;
+	finder.aa = target_bss->addr;
+
+	info = l_queue_find(netdev->ft_ds_list, match_ft_ds_info, &finder);
+
+	if (!info || !info->parsed)
+		return -ENOENT;
+
+	prepare_ft(netdev, target_bss);
+
+	ft_over_ds_prepare_handshake(&info->super, netdev->handshake);
+
+	netdev->connect_cb = cb;
+
+	netdev->ap = ft_over_ds_sm_new(netdev->handshake,
+					netdev_ft_tx_associate,
+					netdev);
+	memcpy(netdev->ap->prev_bssid, orig_bss->addr, ETH_ALEN);
+
+	wiphy_radio_work_insert(netdev->wiphy, &netdev->work,
+				WIPHY_WORK_PRIORITY_CONNECT, &ft_work_ops);
+
+	return 0;
+}
+
+static void netdev_ft_request_cb(struct l_genl_msg *msg, void *user_data)
+{
+	struct netdev_ft_over_ds_info *info = user_data;
+
+	info->cmd_id = 0;
+
+	if (l_genl_msg_get_error(msg) < 0) {
+		l_error("Could not send CMD_FRAME for FT-over-DS");
+		netdev_ft_over_ds_auth_failed(info,
+					MMPDU_STATUS_CODE_UNSPECIFIED);
+	}
+}
+
+static void netdev_ft_ds_info_free(struct ft_ds_info *ft)
+{
+	struct netdev_ft_over_ds_info *info = l_container_of(ft,
+					struct netdev_ft_over_ds_info, super);
+
+	l_free(info);
+}
+
+/* (Re)authenticate with the target, invalidating any previous response */
+static int netdev_ft_over_ds_send_request(struct netdev *netdev,
+					struct netdev_ft_over_ds_info *info)
+{
+	uint8_t ft_req[14];
+	struct handshake_state *hs = netdev->handshake;
+	struct iovec iovs[5];
+	uint8_t buf[512];
+	size_t len;
+
+	info->parsed = false;
+
+	if (info->super.fte) {
+		l_free(info->super.fte);
+		info->super.fte = NULL;
+	}
+
+	l_getrandom(info->super.snonce, 32);
+
+	ft_req[0] = 6; /* FT category */
+	ft_req[1] = 1; /* FT Request action */
+	memcpy(ft_req + 2, netdev->addr, 6);
+	memcpy(ft_req + 8, info->super.aa, 6);
 
-	info = l_queue_find(netdev->ft_ds_list, match_ft_ds_info, &finder);
+	iovs[0].iov_base = ft_req;
+	iovs[0].iov_len = sizeof(ft_req);
 
-	if (!info || !info->parsed)
-		return -ENOENT;
+	if (!ft_build_authenticate_ies(hs, false, info->super.snonce,
+						buf, &len))
+		return -EIO;
 
-	prepare_ft(netdev, target_bss);
+	iovs[1].iov_base = buf;
+	iovs[1].iov_len = len;
 
-	ft_over_ds_prepare_handshake(&info->super, netdev->handshake);
+	iovs[2].iov_base = NULL;
 
-	netdev->connect_cb = cb;
+	if (info->cmd_id)
+		l_genl_family_cancel(nl80211, info->cmd_id);
 
-	netdev->ap = ft_over_ds_sm_new(netdev->handshake,
-					netdev_ft_tx_associate,
-					netdev);
-	memcpy(netdev->ap->prev_bssid, orig_bss->addr, ETH_ALEN);
+	info->cmd_id = netdev_send_action_framev(netdev, hs->aa, iovs, 2,
+						netdev->frequency,
+						netdev_ft_request_cb,
+						info);
+	if (!info->cmd_id)
+		return -EIO;
 
-	wiphy_radio_work_insert(netdev->wiphy, &netdev->work,
-				WIPHY_WORK_PRIORITY_CONNECT, &ft_work_ops);
+	info->time_stamp = l_time_now();
 
 	return 0;
 }
 
-static void netdev_ft_request_cb(struct l_genl_msg *msg, void *user_data)
+static void netdev_ft_ds_refresh(struct l_timeout *timeout, void *user_data)
 {
-	struct netdev_ft_over_ds_info *info = user_data;
+	struct netdev *netdev = user_data;
+	const struct l_queue_entry *entry;
+	uint64_t now = l_time_now();
+	uint64_t min_age = NETDEV_FT_DS_REFRESH_INTERVAL * L_USEC_PER_SEC / 2;
+	struct l_queue *expired = NULL;
+	struct netdev_ft_over_ds_info *info;
 
-	if (l_genl_msg_get_error(msg) < 0) {
-		l_error("Could not send CMD_FRAME for FT-over-DS");
-		netdev_ft_over_ds_auth_failed(info,
-					MMPDU_STATUS_CODE_UNSPECIFIED);
+	for (entry = l_queue_get_entries(netdev->ft_ds_list); entry;
+						entry = entry->next) {
+		info = entry->data;
+
+		/* Added since the last refresh */
+		if (l_time_diff(info->time_stamp, now) < min_age)
+			continue;
+
+		/* No response to the last request, or unused for too long */
+		if (!info->parsed ||
+				info->refreshes >= NETDEV_FT_DS_MAX_REFRESHES ||
+				netdev_ft_over_ds_send_request(netdev,
+								info) < 0) {
+			if (!expired)
+				expired = l_queue_new();
+
+			l_queue_push_tail(expired, info);
+			continue;
+		}
+
+		info->refreshes++;
 	}
-}
 
-static void netdev_ft_ds_info_free(struct ft_ds_info *ft)
-{
-	struct netdev_ft_over_ds_info *info = l_container_of(ft,
-					struct netdev_ft_over_ds_info, super);
+	while ((info = l_queue_pop_head(expired))) {
+		l_debug("FT-over-DS target "MAC" dropped",
+				MAC_STR(info->super.aa));
+		l_queue_remove(netdev->ft_ds_list, info);
+		netdev_ft_ds_entry_free(info);
+	}
 
-	l_free(info);
+	l_queue_destroy(expired, NULL);
+
+	if (l_queue_isempty(netdev->ft_ds_list)) {
+		l_timeout_remove(netdev->ft_ds_refresh_timeout);
+		netdev->ft_ds_refresh_timeout = NULL;
+		return;
+	}
+
+	l_timeout_modify(timeout, NETDEV_FT_DS_REFRESH_INTERVAL);
 }
 
+/*
+ * Returns 0 if the target is already in the pool, and -ENOSPC if the pool
+ * is full.  Callers are expected to go through their candidates in order of
+ * preference.
+ */
 int netdev_fast_transition_over_ds_action(struct netdev *netdev,
 					const struct scan_bss *target_bss)
 {
 	struct netdev_ft_over_ds_info *info;
-	uint8_t ft_req[14];
 	struct handshake_state *hs = netdev->handshake;
-	struct iovec iovs[5];
-	uint8_t buf[512];
-	size_t len;
+	struct ft_ds_finder finder;
 
 	if (!netdev->operational)
 		return -ENOTCONN;
@@ -4709,6 +6001,15 @@ int netdev_fast_transition_over_ds_action(struct netdev *netdev,
 			l_get_le16(target_bss->mde))
 		return -EINVAL;
 
+	finder.spa = hs->spa;
+	finder.aa = target_bss->addr;
+
+	if (l_queue_find(netdev->ft_ds_list, match_ft_ds_info, &finder))
+		return 0;
+
+	if (l_queue_length(netdev->ft_ds_list) >= NETDEV_FT_DS_POOL_SIZE)
+		return -ENOSPC;
+
 	l_debug("");
 
 	info = l_new(struct netdev_ft_over_ds_info, 1);
@@ -4722,41 +6023,25 @@ int netdev_fast_transition_over_ds_action(struct netdev *netdev,
 		info->super.authenticator_ie = l_memdup(target_bss->rsne,
 						target_bss->rsne[1] + 2);
 
-	l_getrandom(info->super.snonce, 32);
 	info->super.free = netdev_ft_ds_info_free;
 
-	ft_req[0] = 6; /* FT category */
-	ft_req[1] = 1; /* FT Request action */
-	memcpy(ft_req + 2, netdev->addr, 6);
-	memcpy(ft_req + 8, info->super.aa, 6);
-
-	iovs[0].iov_base = ft_req;
-	iovs[0].iov_len = sizeof(ft_req);
-
-	if (!ft_build_authenticate_ies(hs, false, info->super.snonce,
-						buf, &len))
-		goto failed;
-
-	iovs[1].iov_base = buf;
-	iovs[1].iov_len = len;
-
-	iovs[2].iov_base = NULL;
+	if (netdev_ft_over_ds_send_request(netdev, info) < 0) {
+		ft_ds_info_free(&info->super);
+		return -EIO;
+	}
 
 	if (!netdev->ft_ds_list)
 		netdev->ft_ds_list = l_queue_new();
 
 	l_queue_push_head(netdev->ft_ds_list, info);
 
-	netdev_send_action_framev(netdev, netdev->handshake->aa, iovs, 2,
-					netdev->frequency,
-					netdev_ft_request_cb,
-					info);
+	if (!netdev->ft_ds_refresh_timeout)
+		netdev->ft_ds_refresh_timeout = l_timeout_create(
+						NETDEV_FT_DS_REFRESH_INTERVAL,
+						netdev_ft_ds_refresh,
+						netdev, NULL);
 
 	return 0;
-
-failed:
-	l_free(info);
-	return -EIO;
 }
 
 static void netdev_preauth_cb(const uint8_t *pmk, void *user_data)
@@ -4856,6 +6141,46 @@ int netdev_neighbor_report_req(struct netdev *netdev,
 	return 0;
 }
 
+static void netdev_bss_transition_response_cb(struct l_genl_msg *msg,
+						void *user_data)
+{
+	int err = l_genl_msg_get_error(msg);
+
+	if (err < 0)
+		l_debug("Sending BSS Transition Response failed: %s (%d)",
+				strerror(-err), -err);
+}
+
+/*
+ * 802.11-2020 9.6.13.10: the Target BSSID is only included when the
+ * transition was accepted.  No candidate list is sent back.
+ */
+int netdev_bss_transition_response(struct netdev *netdev, uint8_t dialog_token,
+					uint8_t status, const uint8_t *target)
+{
+	uint8_t frame[11];
+
+	if (!netdev->connected)
+		return -ENOTCONN;
+
+	frame[0] = 0x0a; /* Category: WNM */
+	frame[1] = 0x08; /* WNM Action: BSS Transition Management Response */
+	frame[2] = dialog_token;
+	frame[3] = status;
+	frame[4] = 0; /* BSS Termination Delay */
+
+	if (target)
+		memcpy(frame + 5, target, 6);
+
+	if (!netdev_send_action_frame(netdev, netdev->handshake->aa, frame,
+					target ? 11 : 5, netdev->frequency,
+					netdev_bss_transition_response_cb,
+					netdev))
+		return -EIO;
+
+	return 0;
+}
+
 static void netdev_neighbor_report_frame_event(const struct mmpdu_header *hdr,
 					const void *body, size_t body_len,
 					int rssi, void *user_data)
@@ -4912,6 +6237,7 @@ static void netdev_sa_query_timeout(struct l_timeout *timeout,
 {
 	struct netdev *netdev = user_data;
 	struct l_genl_msg *msg;
+	PROFILE_CALLBACK();
 
 	l_info("SA Query timed out, connection is invalid.  Disconnecting...");
 
@@ -4989,6 +6315,7 @@ static void netdev_sa_query_req_frame_event(const struct mmpdu_header *hdr,
 	struct netdev *netdev = user_data;
 	bool ocvc = netdev->handshake->supplicant_ocvc &&
 					netdev->handshake->authenticator_ocvc;
+	PROFILE_CALLBACK();
 
 	if (body_len < 4) {
 		l_debug("SA Query request too short");
@@ -5069,6 +6396,7 @@ static void netdev_sa_query_resp_frame_event(const struct mmpdu_header *hdr,
 	struct netdev *netdev = user_data;
 	const uint8_t *ptr = body;
 	const uint8_t *oci;
+	PROFILE_CALLBACK();
 
 	if (!netdev->connected)
 		return;
@@ -5135,6 +6463,29 @@ keep_alive:
 	netdev->sa_query_timeout = NULL;
 }
 
+/*
+ * Unprotected Deauthentication / Disassociation frames can be spoofed by
+ * anyone in range, and only one SA Query is ever outstanding.  Once each
+ * query is answered the next spoofed frame would start another, so
+ * queries are further limited to a burst of SA_QUERY_BURST and then one
+ * per SA_QUERY_INTERVAL.  A genuine AP keeps sending such frames until it
+ * is answered and is still caught by a later query.
+ */
+#define SA_QUERY_BURST		3
+#define SA_QUERY_INTERVAL	(5 * L_USEC_PER_SEC)
+
+static bool netdev_sa_query_allowed(struct netdev *netdev)
+{
+	uint64_t now = l_time_now();
+	uint64_t tat = L_MAX(netdev->sa_query_tat, now);
+
+	if (tat - now > (SA_QUERY_BURST - 1) * SA_QUERY_INTERVAL)
+		return false;
+
+	netdev->sa_query_tat = tat + SA_QUERY_INTERVAL;
+	return true;
+}
+
 static void netdev_unprot_disconnect_event(struct l_genl_msg *msg,
 		struct netdev *netdev)
 {
@@ -5188,6 +6539,11 @@ static void netdev_unprot_disconnect_event(struct l_genl_msg *msg,
 		return;
 	}
 
+	if (!netdev_sa_query_allowed(netdev)) {
+		l_debug("SA Query rate limited, ignoring");
+		return;
+	}
+
 	netdev_send_sa_query_request(netdev);
 }
 
@@ -5264,6 +6620,8 @@ static bool netdev_get_fw_scan_cb(int err, struct l_queue *bss_list,
 	struct netdev *netdev = user_data;
 	struct scan_bss *bss = NULL;
 
+	netdev->fw_roam_pending = false;
+
 	/*
 	 * If we happened to be disconnected prior to  GET_SCAN coming back
 	 * just bail out now. This disconnect should already have been handled.
@@ -5292,7 +6650,7 @@ static bool netdev_get_fw_scan_cb(int err, struct l_queue *bss_list,
 
 	handshake_state_set_authenticator_ie(netdev->handshake, bss->rsne);
 
-	if (is_offload(netdev->handshake)) {
+	if (is_offload(netdev->handshake) || netdev->fw_port_authorized) {
 		netdev_connect_ok(netdev);
 		return false;
 	}
@@ -5356,6 +6714,8 @@ static void netdev_roam_event(struct l_genl_msg *msg, struct netdev *netdev)
 		goto failed;
 	}
 
+	netdev->fw_port_authorized = false;
+
 	/* Handshake completed in firmware, just get the roamed BSS */
 	if (is_offload(netdev->handshake))
 		goto get_fw_scan;
@@ -5365,6 +6725,7 @@ static void netdev_roam_event(struct l_genl_msg *msg, struct netdev *netdev)
 	nhs->ptk_installed = false;
 	nhs->gtk_installed = true;
 	nhs->igtk_installed = true;
+	nhs->bigtk_installed = true;
 	netdev->handshake->ptk_complete = false;
 
 get_fw_scan:
@@ -5374,6 +6735,8 @@ get_fw_scan:
 					netdev, NULL))
 		goto failed;
 
+	netdev->fw_roam_pending = true;
+
 	if (netdev->event_filter)
 		netdev->event_filter(netdev, NETDEV_EVENT_ROAMING,
 					NULL, netdev->user_data);
@@ -5386,6 +6749,35 @@ failed:
 
 }
 
+/*
+ * With 802.1X offload the firmware may complete the 4-Way (or FT) handshake
+ * on its own, using a PMKSA or PMK-R0 it already holds, in which case no
+ * EAP takes place.  Most commonly this follows a firmware roam.
+ */
+static void netdev_port_authorized_event(struct l_genl_msg *msg,
+						struct netdev *netdev)
+{
+	struct netdev_handshake_state *nhs;
+
+	if (!netdev->connected || netdev->operational || !netdev->handshake)
+		return;
+
+	nhs = l_container_of(netdev->handshake,
+				struct netdev_handshake_state, super);
+	if (nhs->type != CONNECTION_TYPE_8021X_OFFLOAD)
+		return;
+
+	l_debug("");
+
+	/* Still waiting for the roamed BSS, it completes the roam */
+	if (netdev->fw_roam_pending) {
+		netdev->fw_port_authorized = true;
+		return;
+	}
+
+	netdev_connect_ok(netdev);
+}
+
 static void netdev_send_sa_query_delay(struct l_timeout *timeout,
 					void *user_data)
 {
@@ -5412,6 +6804,11 @@ static void netdev_channel_switch_event(struct l_genl_msg *msg,
 
 	l_debug("Channel switch event, frequency: %u", netdev->frequency);
 
+	/* AP and P2P GO interfaces switch without a handshake to follow */
+	if (!netdev->handshake)
+		goto notify;
+
+	netdev_oci_cache_store(netdev, netdev->handshake->aa, chandef);
 	handshake_state_set_chandef(netdev->handshake, l_steal_ptr(chandef));
 
 	/*
@@ -5422,13 +6819,17 @@ static void netdev_channel_switch_event(struct l_genl_msg *msg,
 	 * shall wait a random delay uniformly-distributed in the range between
 	 * zero and 5000us, and then initiate the SA query procedure"
 	 */
-	if (netdev->handshake->supplicant_ocvc &&
-					netdev->handshake->authenticator_ocvc)
+	if (netdev->connected && netdev->handshake->supplicant_ocvc &&
+					netdev->handshake->authenticator_ocvc) {
+		/* Back to back switches only need the last one validated */
+		l_timeout_remove(netdev->sa_query_delay);
 		netdev->sa_query_delay = l_timeout_create_ms(
 						l_getrandom_uint32() % 5,
 						netdev_send_sa_query_delay,
 						netdev, NULL);
+	}
 
+notify:
 	if (!netdev->event_filter)
 		return;
 
@@ -5440,6 +6841,7 @@ static void netdev_mlme_notify(struct l_genl_msg *msg, void *user_data)
 {
 	struct netdev *netdev = NULL;
 	uint8_t cmd;
+	PROFILE_CALLBACK();
 
 	cmd = l_genl_msg_get_command(msg);
 	l_debug("MLME notification %s(%u)", nl80211cmd_to_string(cmd), cmd);
@@ -5461,6 +6863,9 @@ static void netdev_mlme_notify(struct l_genl_msg *msg, void *user_data)
 	case NL80211_CMD_ROAM:
 		netdev_roam_event(msg, netdev);
 		break;
+	case NL80211_CMD_PORT_AUTHORIZED:
+		netdev_port_authorized_event(msg, netdev);
+		break;
 	case NL80211_CMD_CH_SWITCH_NOTIFY:
 		netdev_channel_switch_event(msg, netdev);
 		break;
@@ -5493,32 +6898,71 @@ static void netdev_pae_destroy(void *user_data)
 {
 	struct netdev *netdev = user_data;
 
+	/* Destroyed while handling a batch, nowhere to send the queue */
+	if (pae_tx_netdev == netdev) {
+		pae_tx_netdev = NULL;
+		pae_tx_count = 0;
+	}
+
 	netdev->pae_io = NULL;
 }
 
+static struct netdev_pae_pool *netdev_pae_pool_new(void)
+{
+	struct netdev_pae_pool *pool = l_new(struct netdev_pae_pool, 1);
+	unsigned int i;
+
+	for (i = 0; i < NETDEV_PAE_BATCH; i++) {
+		pool->iov[i].iov_base = pool->frames[i];
+		pool->iov[i].iov_len = sizeof(pool->frames[i]);
+		pool->msgs[i].msg_hdr.msg_iov = &pool->iov[i];
+		pool->msgs[i].msg_hdr.msg_iovlen = 1;
+		pool->msgs[i].msg_hdr.msg_name = &pool->addrs[i];
+		pool->msgs[i].msg_hdr.msg_namelen = sizeof(pool->addrs[i]);
+	}
+
+	return pool;
+}
+
 static bool netdev_pae_read(struct l_io *io, void *user_data)
 {
+	struct netdev *netdev = user_data;
 	int fd = l_io_get_fd(io);
-	struct sockaddr_ll sll;
-	socklen_t sll_len;
-	ssize_t bytes;
-	uint8_t frame[IEEE80211_MAX_DATA_LEN];
+	unsigned int i;
+	int n;
 
-	memset(&sll, 0, sizeof(sll));
-	sll_len = sizeof(sll);
+	for (i = 0; i < NETDEV_PAE_BATCH; i++)
+		pae_rx_pool->msgs[i].msg_hdr.msg_namelen =
+					sizeof(pae_rx_pool->addrs[i]);
+
+	n = recvmmsg(fd, pae_rx_pool->msgs, NETDEV_PAE_BATCH, MSG_DONTWAIT,
+			NULL);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return true;
 
-	bytes = recvfrom(fd, frame, sizeof(frame), 0,
-				(struct sockaddr *) &sll, &sll_len);
-	if (bytes <= 0) {
 		l_error("EAPoL read socket: %s", strerror(errno));
 		return false;
 	}
 
-	if (sll.sll_halen != ETH_ALEN)
-		return true;
+	pae_tx_netdev = netdev;
+
+	for (i = 0; i < (unsigned int) n; i++) {
+		const struct sockaddr_ll *sll = &pae_rx_pool->addrs[i];
+		size_t len = pae_rx_pool->msgs[i].msg_len;
+
+		if (!len || sll->sll_halen != ETH_ALEN)
+			continue;
+
+		__eapol_rx_packet(sll->sll_ifindex, sll->sll_addr,
+					ntohs(sll->sll_protocol),
+					pae_rx_pool->frames[i], len, false);
+	}
+
+	if (pae_tx_netdev)
+		netdev_pae_tx_flush();
 
-	__eapol_rx_packet(sll.sll_ifindex, sll.sll_addr,
-				ntohs(sll.sll_protocol), frame, bytes, false);
+	pae_tx_netdev = NULL;
 
 	return true;
 }
@@ -5582,6 +7026,7 @@ static void netdev_unicast_notify(struct l_genl_msg *msg, void *user_data)
 	uint16_t type, len;
 	const void *data;
 	uint8_t cmd;
+	PROFILE_CALLBACK();
 
 	cmd = l_genl_msg_get_command(msg);
 	if (!cmd)
@@ -5652,87 +7097,97 @@ done:
 	return 0;
 }
 
-static void netdev_get_station_cb(struct l_genl_msg *msg, void *user_data)
+static void netdev_set_wowlan_cb(struct l_genl_msg *msg, void *user_data)
 {
-	struct netdev *netdev = user_data;
-	struct l_genl_attr attr, nested;
-	uint16_t type, len;
-	const void *data;
-	struct diagnostic_station_info info;
+	int err = l_genl_msg_get_error(msg);
+	const char *ext_error;
 
-	netdev->get_station_cmd_id = 0;
+	if (err >= 0)
+		return;
 
-	if (!l_genl_attr_init(&attr, msg))
-		goto parse_error;
+	ext_error = l_genl_msg_get_extended_error(msg);
+	l_error("CMD_SET_WOWLAN failed: %s",
+			ext_error ? ext_error : strerror(-err));
+}
 
-	memset(&info, 0, sizeof(info));
+/*
+ * Sets the wake triggers, a mask of 1 << NL80211_WOWLAN_TRIG_*, that the
+ * kernel arms for the wiphy on system suspend.  An empty mask disables
+ * WoWLAN.  Only the magic packet, disconnect, GTK rekey failure and
+ * net-detect triggers are handled, net-detect matching the known networks.
+ */
+int netdev_set_wowlan(struct netdev *netdev, uint32_t triggers)
+{
+	static const enum nl80211_wowlan_triggers flags[] = {
+		NL80211_WOWLAN_TRIG_DISCONNECT,
+		NL80211_WOWLAN_TRIG_MAGIC_PKT,
+		NL80211_WOWLAN_TRIG_GTK_REKEY_FAILURE,
+	};
+	uint32_t wiphy_id = wiphy_get_id(netdev->wiphy);
+	struct l_genl_msg *msg;
+	unsigned int i;
 
-	while (l_genl_attr_next(&attr, &type, &len, &data)) {
-		switch (type) {
-		case NL80211_ATTR_STA_INFO:
-			if (!l_genl_attr_recurse(&attr, &nested))
-				goto parse_error;
+	l_debug("ifindex: %d, triggers: %08x", netdev->index, triggers);
 
-			if (!netdev_parse_sta_info(&nested, &info))
-				goto parse_error;
+	msg = l_genl_msg_new_sized(NL80211_CMD_SET_WOWLAN, 64 +
+					scan_net_detect_size(netdev->wiphy));
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WIPHY, 4, &wiphy_id);
 
-			break;
+	if (triggers) {
+		l_genl_msg_enter_nested(msg, NL80211_ATTR_WOWLAN_TRIGGERS);
 
-		case NL80211_ATTR_MAC:
-			if (len != 6)
-				goto parse_error;
+		for (i = 0; i < L_ARRAY_SIZE(flags); i++)
+			if (triggers & (1U << flags[i]))
+				l_genl_msg_append_attr(msg, flags[i], 0, NULL);
 
-			memcpy(info.addr, data, 6);
+		if (triggers & (1U << NL80211_WOWLAN_TRIG_NET_DETECT) &&
+				!scan_build_net_detect(netdev->wiphy, msg))
+			l_debug("No net-detect, known networks can't be "
+				"matched");
 
-			break;
-		}
+		l_genl_msg_leave_nested(msg);
 	}
 
-	if (netdev->get_station_cb)
-		netdev->get_station_cb(&info, netdev->get_station_data);
-
-	return;
+	if (!l_genl_family_send(nl80211, msg, netdev_set_wowlan_cb,
+				NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		return -EIO;
+	}
 
-parse_error:
-	if (netdev->get_station_cb)
-		netdev->get_station_cb(NULL, netdev->get_station_data);
+	return 0;
 }
 
-static void netdev_get_station_destroy(void *user_data)
+static void netdev_set_power_save_cb(struct l_genl_msg *msg, void *user_data)
 {
-	struct netdev *netdev = user_data;
+	int err = l_genl_msg_get_error(msg);
+	const char *ext_error;
 
-	netdev->get_station_cmd_id = 0;
+	if (err >= 0)
+		return;
 
-	if (netdev->get_station_destroy)
-		netdev->get_station_destroy(netdev->get_station_data);
+	ext_error = l_genl_msg_get_extended_error(msg);
+	l_error("CMD_SET_POWER_SAVE failed: %s",
+			ext_error ? ext_error : strerror(-err));
 }
 
-int netdev_get_station(struct netdev *netdev, const uint8_t *mac,
-			netdev_get_station_cb_t cb, void *user_data,
-			netdev_destroy_func_t destroy)
+int netdev_set_power_save(struct netdev *netdev, bool enabled)
 {
+	uint32_t ps_state = enabled ? NL80211_PS_ENABLED : NL80211_PS_DISABLED;
 	struct l_genl_msg *msg;
 
-	if (netdev->get_station_cmd_id)
-		return -EBUSY;
+	l_debug("ifindex: %d, power save: %s", netdev->index,
+			enabled ? "on" : "off");
 
-	msg = l_genl_msg_new_sized(NL80211_CMD_GET_STATION, 64);
+	msg = l_genl_msg_new_sized(NL80211_CMD_SET_POWER_SAVE, 64);
 	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &netdev->index);
-	l_genl_msg_append_attr(msg, NL80211_ATTR_MAC, ETH_ALEN, mac);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_PS_STATE, 4, &ps_state);
 
-	netdev->get_station_cmd_id = l_genl_family_send(nl80211, msg,
-						netdev_get_station_cb, netdev,
-						netdev_get_station_destroy);
-	if (!netdev->get_station_cmd_id) {
+	if (!l_genl_family_send(nl80211, msg, netdev_set_power_save_cb,
+				NULL, NULL)) {
 		l_genl_msg_unref(msg);
 		return -EIO;
 	}
 
-	netdev->get_station_cb = cb;
-	netdev->get_station_data = user_data;
-	netdev->get_station_destroy = destroy;
-
 	return 0;
 }
 
@@ -5750,27 +7205,26 @@ int netdev_get_current_station(struct netdev *netdev,
 int netdev_get_all_stations(struct netdev *netdev, netdev_get_station_cb_t cb,
 				void *user_data, netdev_destroy_func_t destroy)
 {
-	struct l_genl_msg *msg;
-
-	if (netdev->get_station_cmd_id)
-		return -EBUSY;
+	return netdev_station_request_add(netdev, NULL, cb, user_data,
+						destroy);
+}
 
-	msg = l_genl_msg_new_sized(NL80211_CMD_GET_STATION, 64);
-	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &netdev->index);
+static bool netdev_station_request_match_data(void *data, void *user_data)
+{
+	struct netdev_station_request *req = data;
 
-	netdev->get_station_cmd_id = l_genl_family_dump(nl80211, msg,
-						netdev_get_station_cb, netdev,
-						netdev_get_station_destroy);
-	if (!netdev->get_station_cmd_id) {
-		l_genl_msg_unref(msg);
-		return -EIO;
-	}
+	if (req->user_data != user_data)
+		return false;
 
-	netdev->get_station_cb = cb;
-	netdev->get_station_data = user_data;
-	netdev->get_station_destroy = destroy;
+	netdev_station_request_free(req);
+	return true;
+}
 
-	return 0;
+/* Drops the requests made with @user_data, calling their destroy */
+void netdev_get_station_cancel(struct netdev *netdev, void *user_data)
+{
+	l_queue_foreach_remove(netdev->station_requests,
+				netdev_station_request_match_data, user_data);
 }
 
 static void netdev_add_station_frame_watches(struct netdev *netdev)
@@ -6237,6 +7691,8 @@ static void netdev_dellink_notify(const struct ifinfomsg *ifi, int bytes)
 	if (!netdev)
 		return;
 
+	l_hashmap_remove(netdev_index, L_UINT_TO_PTR(netdev->index));
+
 	netdev_free(netdev);
 }
 
@@ -6269,6 +7725,7 @@ static void netdev_initial_up_cb(int error, uint16_t type, const void *data,
 	netdev_set_4addr(netdev, netdev->use_4addr, NULL, NULL, NULL);
 
 	l_debug("Interface %i initialized", netdev->index);
+	iwd_startup_trace("netdev %s up", netdev->name);
 
 	scan_wdev_add(netdev->wdev_id);
 
@@ -6472,17 +7929,26 @@ struct netdev *netdev_create_from_genl(struct l_genl_msg *msg,
 		memcpy(netdev->set_mac_once, set_mac, 6);
 
 	if (pae_io) {
+		if (!pae_rx_pool) {
+			pae_rx_pool = netdev_pae_pool_new();
+			pae_tx_pool = netdev_pae_pool_new();
+		}
+
 		netdev->pae_io = pae_io;
 		l_io_set_read_handler(netdev->pae_io, netdev_pae_read, netdev,
 							netdev_pae_destroy);
 	}
 
 	watchlist_init(&netdev->station_watches, NULL);
+	netdev->station_requests = l_queue_new();
 
 	l_queue_push_tail(netdev_list, netdev);
+	l_hashmap_replace(netdev_index, L_UINT_TO_PTR(netdev->index), netdev,
+				NULL);
 
 	l_debug("Created interface %s[%d %" PRIx64 "]", netdev->name,
 		netdev->index, netdev->wdev_id);
+	iwd_startup_trace("netdev %s created", netdev->name);
 
 	/* Query interface flags */
 	bufsize = NLMSG_ALIGN(sizeof(struct ifinfomsg));
@@ -6507,6 +7973,8 @@ bool netdev_destroy(struct netdev *netdev)
 	if (!l_queue_remove(netdev_list, netdev))
 		return false;
 
+	l_hashmap_remove(netdev_index, L_UINT_TO_PTR(netdev->index));
+
 	netdev_free(netdev);
 	return true;
 }
@@ -6516,6 +7984,7 @@ static void netdev_link_notify(uint16_t type, const void *data, uint32_t len,
 {
 	const struct ifinfomsg *ifi = data;
 	unsigned int bytes;
+	PROFILE_CALLBACK();
 
 	if (ifi->ifi_type != ARPHRD_ETHER)
 		return;
@@ -6587,6 +8056,10 @@ static int netdev_init(void)
 					&LOW_SIGNAL_THRESHOLD_5GHZ))
 		LOW_SIGNAL_THRESHOLD_5GHZ = -76;
 
+	if (!l_settings_get_uint(settings, "General", "RoamPredictionTime",
+					&RSSI_PREDICTION_TIME))
+		RSSI_PREDICTION_TIME = 0;
+
 	rand_addr_str = l_settings_get_value(settings, "General",
 						"AddressRandomization");
 	if (rand_addr_str && !strcmp(rand_addr_str, "network"))
@@ -6594,16 +8067,22 @@ static int netdev_init(void)
 
 	watchlist_init(&netdev_watches, NULL);
 	netdev_list = l_queue_new();
+	netdev_index = l_hashmap_new();
 
 	__handshake_set_install_tk_func(netdev_set_tk);
 	__handshake_set_install_gtk_func(netdev_set_gtk);
 	__handshake_set_install_igtk_func(netdev_set_igtk);
+	__handshake_set_install_bigtk_func(netdev_set_bigtk);
 	__handshake_set_install_ext_tk_func(netdev_set_ext_tk);
 
 	__eapol_set_rekey_offload_func(netdev_set_rekey_offload);
 	__eapol_set_tx_packet_func(netdev_control_port_frame);
 	__eapol_set_install_pmk_func(netdev_set_pmk);
 
+	__pmksa_set_driver_callbacks(netdev_pmksa_driver_add,
+					netdev_pmksa_driver_remove,
+					netdev_pmksa_driver_flush);
+
 	unicast_watch = l_genl_add_unicast_watch(genl, NL80211_GENL_NAME,
 						netdev_unicast_notify,
 						NULL, NULL);
@@ -6639,9 +8118,18 @@ static void netdev_exit(void)
 
 	l_genl_remove_unicast_watch(genl, unicast_watch);
 
+	__pmksa_set_driver_callbacks(NULL, NULL, NULL);
+
 	watchlist_destroy(&netdev_watches);
 	l_queue_destroy(netdev_list, netdev_free);
 	netdev_list = NULL;
+	l_hashmap_destroy(netdev_index, NULL);
+	netdev_index = NULL;
+
+	l_free(pae_rx_pool);
+	pae_rx_pool = NULL;
+	l_free(pae_tx_pool);
+	pae_tx_pool = NULL;
 
 	l_genl_family_free(nl80211);
 	nl80211 = NULL;
@@ -6659,8 +8147,11 @@ void netdev_shutdown(void)
 	l_queue_foreach(netdev_list, netdev_shutdown_one, NULL);
 
 	while ((netdev = l_queue_peek_head(netdev_list))) {
+		int ifindex = netdev->index;
+
 		netdev_free(netdev);
 		l_queue_pop_head(netdev_list);
+		l_hashmap_remove(netdev_index, L_UINT_TO_PTR(ifindex));
 	}
 }
 
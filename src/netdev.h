@@ -49,6 +49,8 @@ enum netdev_event {
 	NETDEV_EVENT_RSSI_THRESHOLD_LOW,
 	NETDEV_EVENT_RSSI_THRESHOLD_HIGH,
 	NETDEV_EVENT_RSSI_LEVEL_NOTIFY,
+	NETDEV_EVENT_RSSI_TREND_LOW,
+	NETDEV_EVENT_QOS_MAP_CHANGED,
 };
 
 enum netdev_watch_event {
@@ -99,6 +101,8 @@ typedef void (*netdev_connect_cb_t)(struct netdev *netdev,
  * NETDEV_EVENT_RSSI_THRESHOLD_LOW - unused
  * NETDEV_EVENT_RSSI_THRESHOLD_HIGH - unused
  * NETDEV_EVENT_RSSI_LEVEL_NOTIFY - rssi level index (uint8_t)
+ * NETDEV_EVENT_RSSI_TREND_LOW - unused
+ * NETDEV_EVENT_QOS_MAP_CHANGED - unused
  */
 typedef void (*netdev_event_func_t)(struct netdev *netdev,
 					enum netdev_event event,
@@ -124,6 +128,19 @@ typedef void (*netdev_get_station_cb_t)(
 				const struct diagnostic_station_info *info,
 				void *user_data);
 
+/*
+ * Monotonic timestamps (l_time_now) of the last connection attempt, zero
+ * if the phase has not been reached.  'authenticated' is only set when
+ * authentication is driven by iwd (SAE, FT, FILS, OWE), otherwise it is
+ * part of the association phase.
+ */
+struct netdev_connect_times {
+	uint64_t start;
+	uint64_t authenticated;
+	uint64_t associated;
+	uint64_t completed;
+};
+
 const char *netdev_iftype_to_string(uint32_t iftype);
 
 typedef void (*netdev_ft_over_ds_cb_t)(struct netdev *netdev,
@@ -148,6 +165,8 @@ const char *netdev_get_path(struct netdev *netdev);
 
 struct handshake_state *netdev_handshake_state_new(struct netdev *netdev);
 struct handshake_state *netdev_get_handshake(struct netdev *netdev);
+const struct netdev_connect_times *netdev_get_connect_times(
+						struct netdev *netdev);
 
 int netdev_connect(struct netdev *netdev, struct scan_bss *bss,
 				struct handshake_state *hs,
@@ -191,9 +210,16 @@ int netdev_set_powered(struct netdev *netdev, bool powered,
 
 int netdev_neighbor_report_req(struct netdev *netdev,
 				netdev_neighbor_report_cb_t cb);
+int netdev_bss_transition_response(struct netdev *netdev, uint8_t dialog_token,
+					uint8_t status, const uint8_t *target);
 
 int netdev_set_rssi_report_levels(struct netdev *netdev, const int8_t *levels,
 					size_t levels_num);
+int netdev_set_wowlan(struct netdev *netdev, uint32_t triggers);
+int netdev_set_power_save(struct netdev *netdev, bool enabled);
+int netdev_set_dscp_policy(struct netdev *netdev, const uint8_t *policy,
+				size_t len);
+bool netdev_get_dscp_map(struct netdev *netdev, uint8_t *map);
 
 int netdev_get_station(struct netdev *netdev, const uint8_t *mac,
 			netdev_get_station_cb_t cb, void *user_data,
@@ -203,6 +229,7 @@ int netdev_get_current_station(struct netdev *netdev,
 			netdev_destroy_func_t destroy);
 int netdev_get_all_stations(struct netdev *netdev, netdev_get_station_cb_t cb,
 				void *user_data, netdev_destroy_func_t destroy);
+void netdev_get_station_cancel(struct netdev *netdev, void *user_data);
 
 void netdev_handshake_failed(struct handshake_state *hs, uint16_t reason_code);
 
@@ -35,6 +35,8 @@
 
 #include "ell/useful.h"
 
+#include "linux/nl80211.h"
+
 #include "src/missing.h"
 #include "src/module.h"
 #include "src/ie.h"
@@ -55,11 +57,17 @@
 #include "src/util.h"
 #include "src/erp.h"
 #include "src/handshake.h"
+#include "src/profile.h"
+#include "src/hotspot.h"
+
+#define MEMACCT_MODULE MEMACCT_NETWORK
+#include "src/memacct.h"
 
 #define SAE_PT_SETTING "SAE-PT-Group%u"
 
 static uint32_t known_networks_watch;
 static uint32_t event_watch;
+static bool fils_fast_path;
 
 struct network {
 	char ssid[33];
@@ -90,6 +98,17 @@ struct network {
 	/* Holds DBus Connect() message if it comes in before ANQP finishes */
 	struct l_dbus_message *connect_after_anqp;
 	struct l_dbus_message *connect_after_owe_hidden;
+	/* Holds DBus Connect() message while the PSK is being derived */
+	struct l_dbus_message *connect_after_psk;
+	struct crypto_psk_work *psk_work;
+	/* 802.1X settings checked ahead of a connection, see prefetch below */
+	struct l_idle *prefetch_idle;
+	struct l_queue *prefetch_missing;
+	int prefetch_result;
+	bool have_prefetch:1;
+	bool have_sae_pt_precompute:1;
+	/* Negotiated security IEs, see network_rsn_cache_lookup */
+	struct l_queue *rsn_cache;
 };
 
 static bool network_settings_load(struct network *network)
@@ -105,6 +124,15 @@ static bool network_settings_load(struct network *network)
 
 static void network_reset_psk(struct network *network)
 {
+	if (network->psk_work) {
+		crypto_psk_work_cancel(network->psk_work);
+		network->psk_work = NULL;
+	}
+
+	if (network->connect_after_psk)
+		dbus_pending_reply(&network->connect_after_psk,
+				dbus_error_aborted(network->connect_after_psk));
+
 	if (network->psk)
 		explicit_bzero(network->psk, 32);
 
@@ -132,8 +160,20 @@ static void network_reset_passphrase(struct network *network)
 	}
 }
 
+static void network_prefetch_reset(struct network *network)
+{
+	l_idle_remove(network->prefetch_idle);
+	network->prefetch_idle = NULL;
+
+	l_queue_destroy(network->prefetch_missing, eap_secret_info_free);
+	network->prefetch_missing = NULL;
+	network->have_prefetch = false;
+}
+
 static void network_settings_close(struct network *network)
 {
+	network_prefetch_reset(network);
+
 	if (!network->settings)
 		return;
 
@@ -256,7 +296,7 @@ struct network *network_create(struct station *station, const char *ssid,
 
 	network->info = known_networks_find(ssid, security);
 	if (network->info)
-		network->info->seen_count++;
+		known_network_seen(network->info);
 
 	network->bss_list = l_queue_new();
 	network->blacklist = l_queue_new();
@@ -308,8 +348,8 @@ static struct l_ecc_point *network_generate_sae_pt(struct network *network,
 
 	l_debug("Generating PT for Group %u", group);
 
-	pt = crypto_derive_sae_pt_ecc(group, network->ssid,
-						network->passphrase, NULL);
+	pt = crypto_sae_pt_cache_get(group, network->ssid,
+						network->passphrase);
 	if (!pt)
 		l_warn("SAE PT generation for Group %u failed", group);
 
@@ -397,6 +437,70 @@ struct station *network_get_station(const struct network *network)
 	return network->station;
 }
 
+/*
+ * Validating the 802.1X settings, e.g. loading the certificates, and
+ * finding the secrets that will have to be requested from the agent is done
+ * when a known network first shows up in the scan results.  A later
+ * Connect() can then go straight to the agent request.  Nothing is asked
+ * from the agent ahead of time, the user is not prompted for a network
+ * they may never connect to.  The prefetched result is used once, and
+ * dropped whenever the settings or the set of secrets change.
+ */
+static void network_prefetch_8021x(struct l_idle *idle, void *user_data)
+{
+	struct network *network = user_data;
+
+	l_idle_remove(network->prefetch_idle);
+	network->prefetch_idle = NULL;
+
+	if (network->agent_request || network->have_prefetch)
+		return;
+
+	/* Already being connected to, the check has just been done */
+	if (station_get_connected_network(network->station) == network)
+		return;
+
+	if (!network_settings_load(network))
+		return;
+
+	network->prefetch_result = eap_check_settings(network->settings,
+						network->secrets, "EAP-", true,
+						&network->prefetch_missing);
+	network->have_prefetch = true;
+
+	l_debug("%s: prefetched 802.1X settings: %i, %u secrets missing",
+			network->ssid, network->prefetch_result,
+			l_queue_length(network->prefetch_missing));
+}
+
+static void network_prefetch_schedule(struct network *network)
+{
+	if (network_get_security(network) != SECURITY_8021X || !network->info)
+		return;
+
+	if (network->prefetch_idle || network->have_prefetch)
+		return;
+
+	network->prefetch_idle = l_idle_create(network_prefetch_8021x,
+						network, NULL);
+}
+
+static int network_check_8021x(struct network *network,
+				struct l_queue **out_missing)
+{
+	int r;
+
+	if (!network->have_prefetch)
+		return eap_check_settings(network->settings, network->secrets,
+						"EAP-", true, out_missing);
+
+	r = network->prefetch_result;
+	*out_missing = l_steal_ptr(network->prefetch_missing);
+	network->have_prefetch = false;
+
+	return r;
+}
+
 static bool network_set_8021x_secrets(struct network *network)
 {
 	const struct l_queue_entry *entry;
@@ -722,28 +826,139 @@ const struct network_info *network_get_info(const struct network *network)
 	return network->info;
 }
 
+static void add_rnr_frequency(uint32_t freq, void *user_data)
+{
+	struct network_info *info = user_data;
+
+	known_network_add_frequency(info, freq);
+}
+
+/*
+ * Besides the BSS's own frequency, remember the 6GHz channels of the APs
+ * of the same network it advertises in its RNR so that quick scans probe
+ * them directly.  The BSS's frequency is added last to stay the most
+ * recent one.
+ */
+static void network_add_bss_frequencies(struct network_info *info,
+					const struct scan_bss *bss)
+{
+	if (bss->rnr_6ghz_freqs)
+		scan_freq_set_foreach(bss->rnr_6ghz_freqs, add_rnr_frequency,
+					info);
+
+	known_network_add_frequency(info, bss->frequency);
+}
+
 static void add_known_frequency(void *data, void *user_data)
 {
 	struct scan_bss *bss = data;
 	struct network_info *info = user_data;
 
-	known_network_add_frequency(info, bss->frequency);
+	network_add_bss_frequencies(info, bss);
 }
 
-void network_set_info(struct network *network, struct network_info *info)
+/*
+ * The AKM and cipher selection for a BSS only depends on the BSS's own
+ * security IE and on settings and capabilities that are fixed for the
+ * lifetime of the network object.  APs of the same ESS usually advertise
+ * identical IEs, so the result is kept to save repeating the selection
+ * and IE building on every connect attempt and roam.
+ */
+#define NETWORK_RSN_CACHE_SIZE 4
+
+struct network_rsn_cache_entry {
+	uint8_t *ap_ie;
+	bool mde_present;
+	struct ie_rsn_info info;
+	uint8_t *supplicant_ie;
+};
+
+static void network_rsn_cache_entry_free(void *data)
 {
-	if (info) {
-		network->info = info;
-		network->info->seen_count++;
+	struct network_rsn_cache_entry *entry = data;
 
-		l_queue_foreach(network->bss_list, add_known_frequency, info);
-	} else {
-		network->info->seen_count--;
-		network->info = NULL;
+	l_free(entry->ap_ie);
+	l_free(entry->supplicant_ie);
+	l_free(entry);
+}
+
+static void network_rsn_cache_flush(struct network *network)
+{
+	l_queue_destroy(network->rsn_cache, network_rsn_cache_entry_free);
+	network->rsn_cache = NULL;
+}
+
+static struct network_rsn_cache_entry *network_rsn_cache_find(
+						struct network *network,
+						const uint8_t *ap_ie,
+						bool mde_present)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(network->rsn_cache); entry;
+			entry = entry->next) {
+		struct network_rsn_cache_entry *cached = entry->data;
+
+		if (cached->mde_present != mde_present)
+			continue;
+
+		if (cached->ap_ie[1] != ap_ie[1])
+			continue;
+
+		if (!memcmp(cached->ap_ie, ap_ie, ap_ie[1] + 2))
+			return cached;
 	}
 
-	l_dbus_property_changed(dbus_get_bus(), network_get_path(network),
-					IWD_NETWORK_INTERFACE, "KnownNetwork");
+	return NULL;
+}
+
+/*
+ * Looks up the security parameters negotiated earlier with an AP
+ * advertising @ap_ie.  The returned supplicant IE carries no PMKIDs and
+ * remains valid until the next call into the cache.
+ */
+bool network_rsn_cache_lookup(struct network *network, const uint8_t *ap_ie,
+				bool mde_present, struct ie_rsn_info *out_info,
+				const uint8_t **out_supplicant_ie)
+{
+	struct network_rsn_cache_entry *cached;
+
+	cached = network_rsn_cache_find(network, ap_ie, mde_present);
+	if (!cached)
+		return false;
+
+	memcpy(out_info, &cached->info, sizeof(*out_info));
+	*out_supplicant_ie = cached->supplicant_ie;
+
+	return true;
+}
+
+void network_rsn_cache_add(struct network *network, const uint8_t *ap_ie,
+				bool mde_present,
+				const struct ie_rsn_info *info,
+				const uint8_t *supplicant_ie)
+{
+	struct network_rsn_cache_entry *cached;
+
+	if (network_rsn_cache_find(network, ap_ie, mde_present))
+		return;
+
+	if (!network->rsn_cache)
+		network->rsn_cache = l_queue_new();
+
+	if (l_queue_length(network->rsn_cache) >= NETWORK_RSN_CACHE_SIZE)
+		network_rsn_cache_entry_free(
+				l_queue_pop_head(network->rsn_cache));
+
+	cached = l_new(struct network_rsn_cache_entry, 1);
+	cached->ap_ie = l_memdup(ap_ie, ap_ie[1] + 2);
+	cached->mde_present = mde_present;
+	memcpy(&cached->info, info, sizeof(cached->info));
+	cached->info.num_pmkids = 0;
+	cached->info.pmkids = NULL;
+	cached->supplicant_ie = l_memdup(supplicant_ie, supplicant_ie[1] + 2);
+
+	l_queue_push_tail(network->rsn_cache, cached);
 }
 
 static inline bool __bss_is_sae(const struct scan_bss *bss,
@@ -765,6 +980,80 @@ static bool bss_is_sae(const struct scan_bss *bss)
 	return __bss_is_sae(bss, &rsn);
 }
 
+/*
+ * For freshly provisioned profiles the PT is not yet stored, prepare it
+ * in the background once a scan shows an H2E capable SAE BSS for the
+ * network, so that the first H2E connection doesn't have to derive it on
+ * the critical path.
+ */
+static void network_precompute_sae_pt(struct network *network,
+					const struct scan_bss *bss)
+{
+	_auto_(l_settings_free) struct l_settings *settings = NULL;
+	_auto_(l_free) char *passphrase = NULL;
+	static const unsigned int groups[] = { 19, 20 };
+	struct network_info *info = network->info;
+	unsigned int i;
+
+	if (network->have_sae_pt_precompute || !info || info->is_hotspot ||
+			info->type != SECURITY_PSK)
+		return;
+
+	if (!bss_is_sae(bss) || !ie_rsnxe_capable(bss->rsnxe,
+							IE_RSNX_SAE_H2E))
+		return;
+
+	network->have_sae_pt_precompute = true;
+
+	settings = network_info_open_settings(info);
+	if (!settings)
+		return;
+
+	passphrase = l_settings_get_string(settings, "Security", "Passphrase");
+	if (!passphrase)
+		return;
+
+	for (i = 0; i < L_ARRAY_SIZE(groups); i++) {
+		_auto_(l_free) char *key =
+				l_strdup_printf(SAE_PT_SETTING, groups[i]);
+
+		if (l_settings_has_key(settings, "Security", key))
+			continue;
+
+		if (crypto_sae_pt_precompute(groups[i], info->ssid, passphrase))
+			l_debug("Precomputing PT for Group %u", groups[i]);
+	}
+
+	explicit_bzero(passphrase, strlen(passphrase));
+}
+
+void network_set_info(struct network *network, struct network_info *info)
+{
+	const struct l_queue_entry *entry;
+
+	if (info) {
+		network->info = info;
+		known_network_seen(info);
+
+		l_queue_foreach(network->bss_list, add_known_frequency, info);
+
+		for (entry = l_queue_get_entries(network->bss_list); entry &&
+				!network->have_sae_pt_precompute;
+				entry = entry->next)
+			network_precompute_sae_pt(network, entry->data);
+	} else {
+		known_network_unseen(network->info);
+		network->info = NULL;
+		network->have_sae_pt_precompute = false;
+		network_prefetch_reset(network);
+	}
+
+	network_rsn_cache_flush(network);
+
+	l_dbus_property_changed(dbus_get_bus(), network_get_path(network),
+					IWD_NETWORK_INTERFACE, "KnownNetwork");
+}
+
 int network_can_connect_bss(struct network *network, const struct scan_bss *bss)
 {
 	struct station *station = network->station;
@@ -905,8 +1194,7 @@ int network_autoconnect(struct network *network, struct scan_bss *bss)
 	{
 		struct l_queue *missing_secrets = NULL;
 
-		ret = eap_check_settings(network->settings, network->secrets,
-					"EAP-", true, &missing_secrets);
+		ret = network_check_8021x(network, &missing_secrets);
 		if (ret < 0)
 			goto close_settings;
 
@@ -935,6 +1223,60 @@ close_settings:
 	return ret;
 }
 
+/*
+ * Runs the checks network_autoconnect() would fail on, without starting a
+ * connection, so that autoconnect candidates bound to fail can be dropped
+ * before one of them is tried.  Settings stay loaded and the 802.1X check
+ * is kept as a prefetched result, network_autoconnect() then reuses both.
+ */
+int network_autoconnect_precheck(struct network *network,
+					struct scan_bss *bss)
+{
+	struct network_info *info = network->info;
+	int ret;
+
+	if (network->agent_request)
+		return -EALREADY;
+
+	if (network->ask_passphrase)
+		return -ENOKEY;
+
+	if (!info)
+		return -ENOENT;
+
+	if (!info->config.is_autoconnectable)
+		return -EPERM;
+
+	switch (network_get_security(network)) {
+	case SECURITY_PSK:
+		if (!network_settings_load(network))
+			return -ENOKEY;
+
+		ret = network_load_psk(network, bss_is_sae(bss));
+		break;
+	case SECURITY_8021X:
+		network_prefetch_8021x(NULL, network);
+
+		if (!network->have_prefetch)
+			return network->settings ? 0 : -ENOKEY;
+
+		ret = network->prefetch_result;
+		if (!ret && !l_queue_isempty(network->prefetch_missing))
+			ret = -ENOKEY;
+
+		break;
+	case SECURITY_NONE:
+		return network_settings_load(network) ? 0 : -ENOKEY;
+	default:
+		return -ENOTSUP;
+	}
+
+	if (ret < 0)
+		network_settings_close(network);
+
+	return ret;
+}
+
 void network_connect_failed(struct network *network, bool in_handshake)
 {
 	/*
@@ -946,6 +1288,12 @@ void network_connect_failed(struct network *network, bool in_handshake)
 		network->ask_passphrase = true;
 	}
 
+	/* The secrets given by the agent may have been the problem */
+	if (in_handshake)
+		agent_forget_secrets(network->object_path);
+
+	network_prefetch_reset(network);
+
 	l_queue_destroy(network->secrets, eap_secret_info_free);
 	network->secrets = NULL;
 }
@@ -986,24 +1334,34 @@ static bool match_hotspot_network(const struct network_info *info,
 
 bool network_bss_add(struct network *network, struct scan_bss *bss)
 {
+	struct network_info *info;
+
 	if (!l_queue_insert(network->bss_list, bss, scan_bss_rank_compare,
 									NULL))
 		return false;
 
 	if (network->info)
-		known_network_add_frequency(network->info, bss->frequency);
+		network_add_bss_frequencies(network->info, bss);
 
 	/* Done if BSS is not HS20 or we already have network_info set */
 	if (!bss->hs20_capable)
-		return true;
+		goto done;
 
 	network->is_hs20 = true;
 
 	if (network->info)
-		return true;
+		goto done;
 
 	/* Set the network_info to a matching hotspot entry, if found */
-	known_networks_foreach(match_hotspot_network, network);
+	info = hotspot_find_by_bss(bss);
+	if (info)
+		network_set_info(network, info);
+
+done:
+	if (l_queue_length(network->bss_list) == 1)
+		network_prefetch_schedule(network);
+
+	network_precompute_sae_pt(network, bss);
 
 	return true;
 }
@@ -1028,7 +1386,7 @@ bool network_bss_update(struct network *network, struct scan_bss *bss)
 
 	/* Sync frequency for already known networks */
 	if (network->info) {
-		known_network_add_frequency(network->info, bss->frequency);
+		network_add_bss_frequencies(network->info, bss);
 		known_network_frequency_sync(network->info);
 	}
 
@@ -1042,8 +1400,7 @@ bool network_bss_list_isempty(struct network *network)
 
 void network_bss_list_clear(struct network *network)
 {
-	l_queue_destroy(network->bss_list, NULL);
-	network->bss_list = l_queue_new();
+	l_queue_clear(network->bss_list, NULL);
 }
 
 struct scan_bss *network_bss_list_pop(struct network *network)
@@ -1110,12 +1467,64 @@ const struct l_queue_entry *network_bss_list_get_entries(
 	return l_queue_get_entries(network->bss_list);
 }
 
+/*
+ * With [EAP].EnableFILSFastPath, an 802.1X network with ERP keys cached
+ * connects to its best FILS capable BSS if there is one that isn't
+ * blacklisted, FILS then skips the full EAP exchange.
+ */
+static struct scan_bss *network_bss_select_fils(struct network *network)
+{
+	struct wiphy *wiphy = station_get_wiphy(network->station);
+	const struct l_queue_entry *bss_entry;
+	struct erp_cache_entry *erp_cache;
+
+	if (!fils_fast_path || network->security != SECURITY_8021X)
+		return NULL;
+
+	if (!wiphy_has_feature(wiphy, NL80211_EXT_FEATURE_FILS_STA))
+		return NULL;
+
+	erp_cache = network_get_erp_cache(network);
+	if (!erp_cache)
+		return NULL;
+
+	erp_cache_put(erp_cache);
+
+	for (bss_entry = l_queue_get_entries(network->bss_list); bss_entry;
+			bss_entry = bss_entry->next) {
+		struct scan_bss *bss = bss_entry->data;
+		struct ie_rsn_info rsn;
+
+		memset(&rsn, 0, sizeof(rsn));
+		scan_bss_get_rsn_info(bss, &rsn);
+
+		if (!(rsn.akm_suites & (IE_RSN_AKM_SUITE_FILS_SHA256 |
+					IE_RSN_AKM_SUITE_FILS_SHA384)))
+			continue;
+
+		if (network_can_connect_bss(network, bss) < 0)
+			continue;
+
+		if (l_queue_find(network->blacklist, match_bss, bss) ||
+				blacklist_contains_bss(bss->addr))
+			continue;
+
+		return bss;
+	}
+
+	return NULL;
+}
+
 struct scan_bss *network_bss_select(struct network *network,
 						bool fallback_to_blacklist)
 {
 	struct l_queue *bss_list = network->bss_list;
 	const struct l_queue_entry *bss_entry;
-	struct scan_bss *candidate = NULL;
+	struct scan_bss *candidate;
+
+	candidate = network_bss_select_fils(network);
+	if (candidate)
+		return candidate;
 
 	for (bss_entry = l_queue_get_entries(bss_list); bss_entry;
 			bss_entry = bss_entry->next) {
@@ -1164,6 +1573,40 @@ struct scan_bss *network_bss_select(struct network *network,
 	return NULL;
 }
 
+static void network_psk_derived(int err, const uint8_t *psk, void *user_data)
+{
+	struct network *network = user_data;
+	struct l_dbus_message *message = network->connect_after_psk;
+	struct scan_bss *bss;
+
+	network->psk_work = NULL;
+	network->connect_after_psk = NULL;
+
+	if (err < 0) {
+		l_error("PSK generation failed: %s.", strerror(-err));
+		dbus_pending_reply(&message, dbus_error_failed(message));
+		goto err;
+	}
+
+	network->psk = l_memdup(psk, 32);
+	network->sync_settings = true;
+
+	bss = network_bss_select(network, true);
+
+	/* Did all good BSSes go away while we waited */
+	if (!bss) {
+		dbus_pending_reply(&message, dbus_error_failed(message));
+		goto err;
+	}
+
+	station_connect_network(network->station, network, bss, message);
+	l_dbus_message_unref(message);
+	return;
+
+err:
+	network_settings_close(network);
+}
+
 static void passphrase_callback(enum agent_result result,
 				const char *passphrase,
 				struct l_dbus_message *message,
@@ -1205,6 +1648,22 @@ static void passphrase_callback(enum agent_result result,
 		goto err;
 	}
 
+	/*
+	 * SAE uses the passphrase directly, otherwise derive the PSK off
+	 * the main loop before connecting.
+	 */
+	if (!bss_is_sae(bss)) {
+		network->psk_work = crypto_psk_from_passphrase_async(
+					network->passphrase,
+					(unsigned char *) network->ssid,
+					strlen(network->ssid),
+					network_psk_derived, network);
+		if (network->psk_work) {
+			network->connect_after_psk = message;
+			return;
+		}
+	}
+
 	station_connect_network(station, network, bss, message);
 	l_dbus_message_unref(message);
 	return;
@@ -1468,8 +1927,7 @@ static struct l_dbus_message *network_connect_8021x(struct network *network,
 
 	l_debug("");
 
-	r = eap_check_settings(network->settings, network->secrets, "EAP-",
-				true, &missing_secrets);
+	r = network_check_8021x(network, &missing_secrets);
 	if (r) {
 		if (r == -EUNATCH)
 			reply = dbus_error_not_available(message);
@@ -1570,6 +2028,7 @@ static struct l_dbus_message *network_connect(struct l_dbus *dbus,
 	struct network *network = user_data;
 	struct station *station = network->station;
 	struct scan_bss *bss;
+	PROFILE_CALLBACK();
 
 	l_debug("");
 
@@ -1719,17 +2178,8 @@ static bool network_property_get_known_network(struct l_dbus *dbus,
 
 bool network_register(struct network *network, const char *path)
 {
-	if (!l_dbus_object_add_interface(dbus_get_bus(), path,
-					IWD_NETWORK_INTERFACE, network)) {
-		l_info("Unable to register %s interface",
-						IWD_NETWORK_INTERFACE);
+	if (!dbus_object_add_interfaces(path, IWD_NETWORK_INTERFACE, network))
 		return false;
-	}
-
-	if (!l_dbus_object_add_interface(dbus_get_bus(), path,
-					L_DBUS_INTERFACE_PROPERTIES, network))
-		l_info("Unable to register %s interface",
-						L_DBUS_INTERFACE_PROPERTIES);
 
 	network->object_path = l_strdup(path);
 
@@ -1762,14 +2212,17 @@ void network_remove(struct network *network, int reason)
 	if (network->object_path)
 		network_unregister(network, reason);
 
+	network_prefetch_reset(network);
+
 	l_queue_destroy(network->secrets, eap_secret_info_free);
 	network->secrets = NULL;
 
 	if (network->info)
-		network->info->seen_count -= 1;
+		known_network_unseen(network->info);
 
 	l_queue_destroy(network->bss_list, NULL);
 	l_queue_destroy(network->blacklist, NULL);
+	l_queue_destroy(network->rsn_cache, network_rsn_cache_entry_free);
 
 	if (network->nai_realms)
 		l_strv_free(network->nai_realms);
@@ -1788,7 +2241,7 @@ int network_rank_compare(const void *a, const void *b, void *user)
 	return (network->rank > new_network->rank) ? 1 : -1;
 }
 
-void network_rank_update(struct network *network, bool connected)
+static int network_compute_rank(struct network *network, bool connected)
 {
 	static const double RANK_RSNE_FACTOR = 1.2;
 	static const double RANK_WPA_FACTOR = 1.0;
@@ -1800,6 +2253,7 @@ void network_rank_update(struct network *network, bool connected)
 	 */
 	struct scan_bss *best_bss = l_queue_peek_head(network->bss_list);
 	struct network_info *info = network->info;
+	int rank;
 
 	/*
 	 * The rank should separate networks into four groups that use
@@ -1813,15 +2267,11 @@ void network_rank_update(struct network *network, bool connected)
 	 * Within the 2nd group the last connection time is the main factor,
 	 * for the other two groups it's the BSS rank - mainly signal strength.
 	 */
-	if (connected) {
-		network->rank = INT_MAX;
-		return;
-	}
+	if (connected)
+		return INT_MAX;
 
-	if (!info) { /* Not known, assign negative rank */
-		network->rank = (int) best_bss->rank - USHRT_MAX;
-		return;
-	}
+	if (!info) /* Not known, assign negative rank */
+		return (int) best_bss->rank - USHRT_MAX;
 
 	if (info->config.connected_time != 0) {
 		int n = known_network_offset(info);
@@ -1831,24 +2281,41 @@ void network_rank_update(struct network *network, bool connected)
 		if (n >= (int) L_ARRAY_SIZE(rankmod_table))
 			n = L_ARRAY_SIZE(rankmod_table) - 1;
 
-		network->rank = rankmod_table[n] * best_bss->rank + USHRT_MAX;
+		rank = rankmod_table[n] * best_bss->rank + USHRT_MAX;
 	} else
-		network->rank = best_bss->rank;
+		rank = best_bss->rank;
 
 	/*
 	 * Prefer RSNE first, WPA second.  Open networks are much less
 	 * desirable.
 	 */
 	if (best_bss->rsne)
-		network->rank *= RANK_RSNE_FACTOR;
+		rank *= RANK_RSNE_FACTOR;
 	else if (best_bss->wpa)
-		network->rank *= RANK_WPA_FACTOR;
+		rank *= RANK_WPA_FACTOR;
 	else
-		network->rank *= RANK_OPEN_FACTOR;
+		rank *= RANK_OPEN_FACTOR;
 
 	/* We prefer networks with CAP PRIVACY */
 	if (!(best_bss->capability & IE_BSS_CAP_PRIVACY))
-		network->rank *= RANK_NO_PRIVACY_FACTOR;
+		rank *= RANK_NO_PRIVACY_FACTOR;
+
+	return rank;
+}
+
+/*
+ * Returns true if the rank of the network has changed and its position in
+ * any ordered network list needs to be updated.
+ */
+bool network_rank_update(struct network *network, bool connected)
+{
+	int rank = network_compute_rank(network, connected);
+
+	if (rank == network->rank)
+		return false;
+
+	network->rank = rank;
+	return true;
 }
 
 static void network_unset_hotspot(struct network *network, void *user_data)
@@ -2025,6 +2492,10 @@ static int network_init(void)
 
 	event_watch = station_add_event_watch(event_watch_changed, NULL, NULL);
 
+	if (!l_settings_get_bool(iwd_get_config(), "EAP", "EnableFILSFastPath",
+					&fils_fast_path))
+		fils_fast_path = false;
+
 	return 0;
 }
 
@@ -2036,6 +2507,8 @@ static void network_exit(void)
 	station_remove_event_watch(event_watch);
 	event_watch = 0;
 
+	crypto_sae_pt_cache_flush();
+
 	l_dbus_unregister_interface(dbus_get_bus(), IWD_NETWORK_INTERFACE);
 }
 
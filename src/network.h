@@ -30,6 +30,7 @@ struct network;
 struct scan_bss;
 struct handshake_state;
 struct erp_cache_entry;
+struct ie_rsn_info;
 
 void network_connected(struct network *network);
 void network_disconnected(struct network *network);
@@ -62,6 +63,8 @@ void network_set_info(struct network *network, struct network_info *info);
 int network_can_connect_bss(struct network *network,
 						const struct scan_bss *bss);
 int network_autoconnect(struct network *network, struct scan_bss *bss);
+int network_autoconnect_precheck(struct network *network,
+					struct scan_bss *bss);
 void network_connect_failed(struct network *network, bool in_handshake);
 bool network_bss_add(struct network *network, struct scan_bss *bss);
 bool network_bss_update(struct network *network, struct scan_bss *bss);
@@ -78,7 +81,7 @@ bool network_register(struct network *network, const char *path);
 void network_remove(struct network *network, int reason);
 
 int network_rank_compare(const void *a, const void *b, void *user);
-void network_rank_update(struct network *network, bool connected);
+bool network_rank_update(struct network *network, bool connected);
 
 struct l_dbus_message *network_connect_new_hidden_network(
 						struct network *network,
@@ -88,6 +91,14 @@ void network_blacklist_add(struct network *network, struct scan_bss *bss);
 
 struct erp_cache_entry *network_get_erp_cache(struct network *network);
 
+bool network_rsn_cache_lookup(struct network *network, const uint8_t *ap_ie,
+				bool mde_present, struct ie_rsn_info *out_info,
+				const uint8_t **out_supplicant_ie);
+void network_rsn_cache_add(struct network *network, const uint8_t *ap_ie,
+				bool mde_present,
+				const struct ie_rsn_info *info,
+				const uint8_t *supplicant_ie);
+
 const struct l_queue_entry *network_bss_list_get_entries(
 						struct network *network);
 
@@ -357,6 +357,23 @@ struct l_genl_msg *nl80211_build_set_key(uint32_t ifindex, uint8_t key_index)
 	return msg;
 }
 
+struct l_genl_msg *nl80211_build_set_mgmt_key(uint32_t ifindex,
+						uint8_t key_index)
+{
+	struct l_genl_msg *msg;
+
+	msg = l_genl_msg_new_sized(NL80211_CMD_SET_KEY, 128);
+
+	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &ifindex);
+
+	l_genl_msg_enter_nested(msg, NL80211_ATTR_KEY);
+	l_genl_msg_append_attr(msg, NL80211_KEY_IDX, 1, &key_index);
+	l_genl_msg_append_attr(msg, NL80211_KEY_DEFAULT_MGMT, 0, NULL);
+	l_genl_msg_leave_nested(msg);
+
+	return msg;
+}
+
 struct l_genl_msg *nl80211_build_get_key(uint32_t ifindex, uint8_t key_index)
 {
 	struct l_genl_msg *msg;
@@ -424,6 +441,8 @@ struct l_genl_msg *nl80211_build_cmd_frame(uint32_t ifindex,
 	struct iovec iovs[iov_len + 1];
 	const uint16_t frame_type = 0x00d0;
 	uint8_t action_frame[24];
+	size_t frame_len = sizeof(action_frame);
+	size_t i;
 
 	memset(action_frame, 0, 24);
 
@@ -436,7 +455,10 @@ struct l_genl_msg *nl80211_build_cmd_frame(uint32_t ifindex,
 	iovs[0].iov_len = sizeof(action_frame);
 	memcpy(iovs + 1, iov, sizeof(*iov) * iov_len);
 
-	msg = l_genl_msg_new_sized(NL80211_CMD_FRAME, 128 + 512);
+	for (i = 0; i < iov_len; i++)
+		frame_len += iov[i].iov_len;
+
+	msg = l_genl_msg_new_sized(NL80211_CMD_FRAME, 128 + frame_len);
 
 	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &ifindex);
 	l_genl_msg_append_attr(msg, NL80211_ATTR_WIPHY_FREQ, 4, &freq);
@@ -148,6 +148,7 @@ static void offchannel_work_destroy(struct wiphy_radio_work_item *item)
 static const struct wiphy_radio_work_item_ops offchannel_work_ops = {
 	.do_work = offchannel_work_ready,
 	.destroy = offchannel_work_destroy,
+	.type = WIPHY_WORK_TYPE_OFFCHANNEL,
 };
 
 uint32_t offchannel_start(uint64_t wdev_id, uint32_t freq, uint32_t duration,
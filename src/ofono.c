@@ -48,10 +48,12 @@
  *    and NAI
  * 4. Create simauth provider for modem if the above succeeds
  *
- * These steps are chained, as to avoid the complexity of concurrent method
- * calls. Once the chain of methods has completed, a new simauth provider is
- * created for the modem. Only then will the EAP methods be able to run the
- * authentication algorithms ofono provides.
+ * The NAI and the applications are requested at the same time.  Once both
+ * replies are in, a new simauth provider is created for the modem.  Only then
+ * will the EAP methods be able to run the authentication algorithms ofono
+ * provides.  Several authentication requests can be outstanding on a modem,
+ * e.g. for EAP sessions on different interfaces, each one is tracked by its
+ * D-Bus serial which also serves as the simauth transaction ID.
  *
  * If at any time the above conditions change e.g. SimAuthentication disappears,
  * ofono disappears, the modem simauth provider will unregister itself from
@@ -69,8 +71,7 @@ struct sa_data {
 	char *umts_app_path;
 	char *ims_app_path;
 
-	struct user_cb *pending;
-	uint32_t serial;
+	struct l_queue *requests;
 };
 
 struct ofono_modem {
@@ -80,14 +81,25 @@ struct ofono_modem {
 	uint32_t props_serial;
 	uint32_t apps_serial;
 
+	/* Discovery results, kept until both replies have been received */
+	char *nai;
+	char *umts_app_path;
+	char *ims_app_path;
+
 	bool sim_auth_found : 1;
+	bool props_done : 1;
+	bool apps_done : 1;
+	bool sim_supported : 1;
+	bool aka_supported : 1;
 
 	struct iwd_sim_auth *auth;
 };
 
 struct user_cb {
+	struct sa_data *sa_data;
 	void *cb;
 	void *data;
+	uint32_t serial;
 	bool is_gsm : 1;
 };
 
@@ -96,10 +108,12 @@ static uint32_t modem_add_watch;
 static uint32_t modem_removed_watch;
 static struct l_queue *modems;
 
-static struct user_cb *new_cb(void *func, void *data, bool is_gsm)
+static struct user_cb *new_cb(struct sa_data *sa_data, void *func,
+				void *data, bool is_gsm)
 {
 	struct user_cb *cbd = l_new(struct user_cb, 1);
 
+	cbd->sa_data = sa_data;
 	cbd->cb = func;
 	cbd->data = data;
 	cbd->is_gsm = is_gsm;
@@ -109,11 +123,36 @@ static struct user_cb *new_cb(void *func, void *data, bool is_gsm)
 
 static void free_cb(void *ptr)
 {
-	struct sa_data *sa_data = ptr;
+	struct user_cb *cbd = ptr;
 
-	l_free(sa_data->pending);
-	sa_data->pending = NULL;
-	sa_data->serial = 0;
+	l_queue_remove(cbd->sa_data->requests, cbd);
+	l_free(cbd);
+}
+
+static bool match_cb_serial(const void *a, const void *b)
+{
+	const struct user_cb *cbd = a;
+
+	return cbd->serial == L_PTR_TO_UINT(b);
+}
+
+static int send_request(struct sa_data *sa_data,
+			struct l_dbus_message *message,
+			l_dbus_message_func_t reply_func, void *func,
+			void *data, bool is_gsm)
+{
+	struct user_cb *cbd = new_cb(sa_data, func, data, is_gsm);
+
+	cbd->serial = l_dbus_send_with_reply(dbus_get_bus(), message,
+						reply_func, cbd, free_cb);
+	if (!cbd->serial) {
+		l_free(cbd);
+		return -EIO;
+	}
+
+	l_queue_push_tail(sa_data->requests, cbd);
+
+	return cbd->serial;
 }
 
 /*
@@ -156,8 +195,7 @@ static bool append_byte_array(struct l_dbus_message_builder *builder,
 
 static void ims_auth_cb(struct l_dbus_message *reply, void *user_data)
 {
-	struct sa_data *sa_data = user_data;
-	struct user_cb *cbd = sa_data->pending;
+	struct user_cb *cbd = user_data;
 	sim_auth_check_milenage_cb_t cb = cbd->cb;
 	struct l_dbus_message_iter properties;
 	struct l_dbus_message_iter value;
@@ -205,8 +243,7 @@ end:
 
 static void gsm_auth_cb(struct l_dbus_message *reply, void *user_data)
 {
-	struct sa_data *sa_data = user_data;
-	struct user_cb *cbd = sa_data->pending;
+	struct user_cb *cbd = user_data;
 	sim_auth_run_gsm_cb_t cb = cbd->cb;
 	struct l_dbus_message_iter array;
 	struct l_dbus_message_iter val;
@@ -265,13 +302,7 @@ static int ofono_sim_auth_run_gsm(struct iwd_sim_auth *auth,
 		return -EINVAL;
 	}
 
-	if (sa_data->pending) {
-		l_debug("Modem already has outstanding auth request");
-		return -EBUSY;
-	}
-
-	sa_data->pending = new_cb(cb, data, true);
-
+	/* All the RANDs of the round are run by the SIM in one request */
 	message = l_dbus_message_new_method_call(dbus, "org.ofono",
 			sa_data->umts_app_path, OFONO_USIM_APPLICATION_IFACE,
 			"GsmAuthenticate");
@@ -292,19 +323,12 @@ static int ofono_sim_auth_run_gsm(struct iwd_sim_auth *auth,
 	if (!l_dbus_message_builder_finalize(builder))
 		goto error;
 
-	sa_data->serial = l_dbus_send_with_reply(dbus, message, gsm_auth_cb,
-			sa_data, free_cb);
-	if (!sa_data->serial)
-		goto error;
-
 	l_dbus_message_builder_destroy(builder);
 
-	return 0;
+	return send_request(sa_data, message, gsm_auth_cb, cb, data, true);
 
 error:
 	l_dbus_message_builder_destroy(builder);
-	l_free(sa_data->pending);
-	sa_data->pending = NULL;
 
 	return -EIO;
 }
@@ -321,13 +345,6 @@ static int ofono_sim_auth_check_milenage(struct iwd_sim_auth *auth,
 	struct l_dbus_message *message;
 	struct l_dbus_message_builder *builder;
 
-	if (sa_data->pending) {
-		l_debug("Modem already has outstanding auth request");
-		return -EBUSY;
-	}
-
-	sa_data->pending = new_cb(cb, data, false);
-
 	/*
 	 * If ISIM is not available, run on USIM application
 	 */
@@ -353,19 +370,12 @@ static int ofono_sim_auth_check_milenage(struct iwd_sim_auth *auth,
 	if (!l_dbus_message_builder_finalize(builder))
 		goto error;
 
-	sa_data->serial = l_dbus_send_with_reply(dbus, message, ims_auth_cb,
-			sa_data, free_cb);
-	if (!sa_data->serial)
-		goto error;
-
 	l_dbus_message_builder_destroy(builder);
 
-	return 0;
+	return send_request(sa_data, message, ims_auth_cb, cb, data, false);
 
 error:
 	l_dbus_message_builder_destroy(builder);
-	l_free(sa_data->pending);
-	sa_data->pending = NULL;
 
 	return -EIO;
 }
@@ -373,35 +383,29 @@ error:
 static void ofono_sim_auth_cancel_request(struct iwd_sim_auth *auth, int id)
 {
 	struct sa_data *sa_data = iwd_sim_auth_get_data(auth);
+	struct user_cb *cbd;
 
-	if (sa_data->pending) {
-		l_dbus_cancel(dbus_get_bus(), sa_data->serial);
-		sa_data->pending = NULL;
-	}
+	cbd = l_queue_remove_if(sa_data->requests, match_cb_serial,
+					L_UINT_TO_PTR(id));
+	if (cbd)
+		l_dbus_cancel(dbus_get_bus(), cbd->serial);
 }
 
 static void ofono_sim_auth_remove(struct iwd_sim_auth *auth)
 {
 	struct sa_data *sa_data = iwd_sim_auth_get_data(auth);
+	struct user_cb *cbd;
 
 	l_debug("removing auth data %p", sa_data);
 
-	if (sa_data->pending) {
-		struct user_cb *cbd = sa_data->pending;
-
-		if (cbd->is_gsm) {
-			sim_auth_run_gsm_cb_t cb = cbd->cb;
-
-			cb(NULL, NULL, cbd->data);
-		} else {
-			sim_auth_check_milenage_cb_t cb = cbd->cb;
-
-			cb(NULL, NULL, NULL, NULL, cbd->data);
-		}
-
-		l_dbus_cancel(dbus_get_bus(), sa_data->serial);
-	}
+	/*
+	 * The users have been told through the unregistered watch, the
+	 * outstanding requests are dropped without calling back.
+	 */
+	while ((cbd = l_queue_pop_head(sa_data->requests)))
+		l_dbus_cancel(dbus_get_bus(), cbd->serial);
 
+	l_queue_destroy(sa_data->requests, NULL);
 	l_free(sa_data->ims_app_path);
 	l_free(sa_data->umts_app_path);
 	l_free(sa_data);
@@ -415,6 +419,29 @@ static struct iwd_sim_auth_driver ofono_driver = {
 		.remove = ofono_sim_auth_remove
 };
 
+static void modem_discovery_reset(struct ofono_modem *modem)
+{
+	struct l_dbus *dbus = dbus_get_bus();
+
+	if (modem->apps_serial)
+		l_dbus_cancel(dbus, modem->apps_serial);
+
+	if (modem->props_serial)
+		l_dbus_cancel(dbus, modem->props_serial);
+
+	modem->apps_serial = 0;
+	modem->props_serial = 0;
+
+	l_free(l_steal_ptr(modem->nai));
+	l_free(l_steal_ptr(modem->umts_app_path));
+	l_free(l_steal_ptr(modem->ims_app_path));
+
+	modem->props_done = false;
+	modem->apps_done = false;
+	modem->sim_supported = false;
+	modem->aka_supported = false;
+}
+
 static void modem_destroy(void *data)
 {
 	struct l_dbus *dbus = dbus_get_bus();
@@ -430,27 +457,56 @@ static void modem_destroy(void *data)
 
 	l_debug("removing modem %s", modem->path);
 
-	if (modem->apps_serial)
-		l_dbus_cancel(dbus, modem->apps_serial);
-
-	if (modem->props_serial)
-		l_dbus_cancel(dbus, modem->props_serial);
+	modem_discovery_reset(modem);
 
 	l_free(modem->path);
 	l_dbus_remove_watch(dbus, modem->props_watch);
 	l_free(modem);
 }
 
+/* Creates the simauth provider once both discovery replies are in */
+static void modem_discovery_done(struct ofono_modem *modem)
+{
+	struct sa_data *sa_data;
+
+	if (!modem->props_done || !modem->apps_done)
+		return;
+
+	if (!modem->umts_app_path && !modem->ims_app_path) {
+		/* non supported type */
+		l_debug("unsupported modem auth capabilities");
+		modem_discovery_reset(modem);
+		return;
+	}
+
+	sa_data = l_new(struct sa_data, 1);
+	sa_data->umts_app_path = l_steal_ptr(modem->umts_app_path);
+	sa_data->ims_app_path = l_steal_ptr(modem->ims_app_path);
+	sa_data->requests = l_queue_new();
+
+	modem->auth = iwd_sim_auth_create(&ofono_driver);
+
+	iwd_sim_auth_set_data(modem->auth, sa_data);
+	iwd_sim_auth_set_nai(modem->auth, modem->nai);
+	iwd_sim_auth_set_capabilities(modem->auth, modem->sim_supported,
+					modem->aka_supported);
+
+	iwd_sim_auth_register(modem->auth);
+
+	l_debug("modem %s successfully loaded, sim=%u, aka=%u",
+			modem->path, modem->sim_supported,
+			modem->aka_supported);
+
+	modem_discovery_reset(modem);
+}
+
 static void get_auth_apps_cb(struct l_dbus_message *reply,
 		void *user_data)
 {
 	struct ofono_modem *modem = user_data;
-	struct sa_data *sa_data = iwd_sim_auth_get_data(modem->auth);
 	struct l_dbus_message_iter array;
 	struct l_dbus_message_iter dict;
 	struct l_dbus_message_iter variant;
-	bool sim_supported = false;
-	bool aka_supported = false;
 
 	const char *path;
 
@@ -478,32 +534,24 @@ static void get_auth_apps_cb(struct l_dbus_message *reply,
 				goto error;
 
 			if (!strcmp(type, "Umts")) {
-				sa_data->umts_app_path = l_strdup(path);
-				sim_supported = true;
-				aka_supported = true;
+				l_free(modem->umts_app_path);
+				modem->umts_app_path = l_strdup(path);
+				modem->sim_supported = true;
+				modem->aka_supported = true;
 			} else if (!strcmp(type, "Ims")) {
-				sa_data->ims_app_path = l_strdup(path);
-				aka_supported = true;
+				l_free(modem->ims_app_path);
+				modem->ims_app_path = l_strdup(path);
+				modem->aka_supported = true;
 			}
 		}
 	}
 
-	if (sa_data->umts_app_path || sa_data->ims_app_path) {
-		iwd_sim_auth_set_capabilities(modem->auth, sim_supported,
-				aka_supported);
-
-		iwd_sim_auth_register(modem->auth);
-
-		l_debug("modem %s successfully loaded, sim=%u, aka=%u",
-				modem->path, sim_supported, aka_supported);
-		return;
-	}
-
-	/* non supported type */
-	l_debug("unsupported modem auth capabilities");
+	modem->apps_done = true;
+	modem_discovery_done(modem);
+	return;
 
 error:
-	iwd_sim_auth_remove(modem->auth);
+	modem_discovery_reset(modem);
 }
 
 static void get_applications(struct ofono_modem *modem)
@@ -542,29 +590,22 @@ static void get_auth_props_cb(struct l_dbus_message *reply,
 
 	while (l_dbus_message_iter_next_entry(&array, &key, &variant)) {
 		if (!strcmp(key, "NetworkAccessIdentity")) {
-			struct sa_data *sa_data;
 			const char *id;
 
 			if (!l_dbus_message_iter_get_variant(&variant,
 					"s", &id))
 				goto error;
 
-			modem->auth = iwd_sim_auth_create(&ofono_driver);
-
-			sa_data = l_new(struct sa_data, 1);
-
-			iwd_sim_auth_set_data(modem->auth, sa_data);
-			iwd_sim_auth_set_nai(modem->auth, id);
-
-			get_applications(modem);
+			modem->nai = l_strdup(id);
+			modem->props_done = true;
+			modem_discovery_done(modem);
 
 			return;
 		}
 	}
 
 error:
-	if (modem->auth)
-		iwd_sim_auth_remove(modem->auth);
+	modem_discovery_reset(modem);
 }
 
 static void get_properties(struct ofono_modem *modem)
@@ -602,6 +643,7 @@ static void parse_interfaces(struct l_dbus_message_iter *prop,
 			modem->sim_auth_found = true;
 
 			get_properties(modem);
+			get_applications(modem);
 
 			return;
 		}
@@ -611,7 +653,9 @@ static void parse_interfaces(struct l_dbus_message_iter *prop,
 	if (modem->sim_auth_found) {
 		/* Remove auth provider, this will free the sa_data object */
 		if (modem->auth)
-			iwd_sim_auth_remove(modem->auth);
+			iwd_sim_auth_remove(l_steal_ptr(modem->auth));
+
+		modem_discovery_reset(modem);
 
 		/* put modem back into a 'discovery' state */
 		modem->sim_auth_found = false;
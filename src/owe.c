@@ -26,12 +26,21 @@
 
 #include <ell/ell.h>
 
+#include "src/module.h"
 #include "src/crypto.h"
 #include "src/ie.h"
 #include "src/handshake.h"
 #include "src/owe.h"
 #include "src/mpdu.h"
 #include "src/auth-proto.h"
+#include "src/dpp-util.h"
+
+#define OWE_KEY_POOL_SIZE 2
+
+/* The groups owe_compute_keys() can handle */
+static const unsigned int key_pool_groups[] = { 19, 20 };
+static struct dpp_key_pool *key_pools[L_ARRAY_SIZE(key_pool_groups)];
+static struct l_idle *key_pool_idle;
 
 struct owe_sm {
 	struct handshake_state *hs;
@@ -43,6 +52,65 @@ struct owe_sm {
 	const unsigned int *ecc_groups;
 };
 
+static struct dpp_key_pool *owe_key_pool_find(unsigned int group)
+{
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(key_pool_groups); i++)
+		if (key_pool_groups[i] == group)
+			return key_pools[i];
+
+	return NULL;
+}
+
+/* Generates one key pair per iteration until every pool is full */
+static void owe_key_pool_idle(struct l_idle *idle, void *user_data)
+{
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(key_pools); i++) {
+		unsigned int count;
+
+		if (!key_pools[i])
+			continue;
+
+		count = dpp_key_pool_count(key_pools[i]);
+		if (count == OWE_KEY_POOL_SIZE)
+			continue;
+
+		dpp_key_pool_refill(key_pools[i]);
+
+		if (dpp_key_pool_count(key_pools[i]) > count)
+			return;
+
+		break;
+	}
+
+	l_idle_remove(l_steal_ptr(key_pool_idle));
+}
+
+/*
+ * The OWE key pair doesn't depend on the AP, take it from the pool of the
+ * group so that no key is generated while the association is pending, and
+ * top the pool back up once the main loop is idle.
+ */
+static bool owe_generate_key_pair(struct owe_sm *owe)
+{
+	struct dpp_key_pool *pool = owe_key_pool_find(owe->group);
+
+	if (!pool)
+		return l_ecdh_generate_key_pair(owe->curve, &owe->private,
+						&owe->public_key);
+
+	if (!dpp_key_pool_get(pool, &owe->private, &owe->public_key))
+		return false;
+
+	if (!key_pool_idle)
+		key_pool_idle = l_idle_create(owe_key_pool_idle, NULL, NULL);
+
+	return true;
+}
+
 static bool owe_reset(struct owe_sm *owe)
 {
 	/*
@@ -60,11 +128,7 @@ static bool owe_reset(struct owe_sm *owe)
 	if (owe->public_key)
 		l_ecc_point_free(owe->public_key);
 
-	if (!l_ecdh_generate_key_pair(owe->curve, &owe->private,
-					&owe->public_key))
-		return false;
-
-	return true;
+	return owe_generate_key_pair(owe);
 }
 
 void owe_sm_free(struct owe_sm *owe)
@@ -230,3 +294,39 @@ struct owe_sm *owe_sm_new(struct handshake_state *hs)
 
 	return owe;
 }
+
+static int owe_init(void)
+{
+	const unsigned int *groups = l_ecc_supported_ike_groups();
+	unsigned int i;
+	unsigned int j;
+
+	for (i = 0; i < L_ARRAY_SIZE(key_pool_groups); i++) {
+		for (j = 0; groups[j]; j++)
+			if (groups[j] == key_pool_groups[i])
+				break;
+
+		if (!groups[j])
+			continue;
+
+		key_pools[i] = dpp_key_pool_new(
+				l_ecc_curve_from_ike_group(key_pool_groups[i]),
+				OWE_KEY_POOL_SIZE);
+	}
+
+	key_pool_idle = l_idle_create(owe_key_pool_idle, NULL, NULL);
+
+	return 0;
+}
+
+static void owe_exit(void)
+{
+	unsigned int i;
+
+	l_idle_remove(l_steal_ptr(key_pool_idle));
+
+	for (i = 0; i < L_ARRAY_SIZE(key_pools); i++)
+		dpp_key_pool_free(l_steal_ptr(key_pools[i]));
+}
+
+IWD_MODULE(owe, owe_init, owe_exit)
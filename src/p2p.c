@@ -62,6 +62,12 @@
 #include "src/ap.h"
 #include "src/p2p.h"
 #include "src/band.h"
+#include "src/station.h"
+#include "src/sysfs.h"
+#include "src/storage.h"
+
+#define MEMACCT_MODULE MEMACCT_P2P
+#include "src/memacct.h"
 
 struct p2p_device {
 	uint64_t wdev_id;
@@ -84,10 +90,16 @@ struct p2p_device {
 	uint32_t scan_id;
 	unsigned int chans_per_scan;
 	unsigned int scan_chan_idx;
+	/* When peers were last seen on each 2.4GHz channel */
+	uint64_t chan_seen_ts[15];
+	uint64_t sta_packets;
+	uint64_t sta_packets_ts;
 	uint64_t roc_cookie;
 	unsigned int listen_duration;
 	struct l_queue *discovery_users;
 	struct l_queue *peer_list;
+	struct l_hashmap *peer_index;
+	unsigned int scan_seq;
 	unsigned int next_tie_breaker;
 
 	struct p2p_peer *conn_peer;
@@ -115,6 +127,8 @@ struct p2p_device {
 	uint8_t conn_go_dialog_token;
 	unsigned int conn_go_scan_retry;
 	uint32_t conn_go_oper_freq;
+	uint8_t conn_oper_class;
+	uint8_t conn_oper_channel;
 	uint8_t conn_peer_interface_addr[6];
 	struct p2p_capability_attr conn_peer_capability;
 	struct p2p_device_info_attr conn_peer_dev_info;
@@ -124,6 +138,7 @@ struct p2p_device {
 
 	bool enabled : 1;
 	bool have_roc_cookie : 1;
+	bool station_busy : 1;
 	/*
 	 * We need to track @disconnecting because while a connect action is
 	 * always triggered by a DBus message, meaning that @pending_message
@@ -135,6 +150,10 @@ struct p2p_device {
 	bool is_go : 1;
 	bool conn_go_tie_breaker : 1;
 	bool conn_peer_added : 1;
+	/* Save the group credentials once connected */
+	bool conn_persistent : 1;
+	/* Reinvoking a stored persistent group, no WSC */
+	bool conn_reinvoke : 1;
 };
 
 struct p2p_discovery_user {
@@ -146,6 +165,10 @@ struct p2p_discovery_user {
 struct p2p_peer {
 	struct scan_bss *bss;
 	struct p2p_device *dev;
+	/* Source address of the frames we index the peer by */
+	uint8_t addr[6];
+	/* Value of dev->scan_seq when last seen */
+	unsigned int seen_seq;
 	struct wsc_dbus wsc;
 	char *name;
 	struct wsc_primary_device_type primary_device_type;
@@ -176,6 +199,19 @@ static unsigned int p2p_dhcp_timeout_val;
 static struct l_settings *p2p_dhcp_settings;
 static struct p2p_wfd_properties *p2p_own_wfd;
 static unsigned int p2p_wfd_disconnect_watch;
+static bool p2p_persistent_groups_enabled;
+static struct l_queue *p2p_persistent_groups;
+
+#define P2P_PERSISTENT_GROUPS_MAX 16
+
+struct p2p_persistent_group {
+	/* P2P Device Address of the other member */
+	uint8_t peer_addr[6];
+	struct p2p_group_id_attr group_id;
+	uint8_t psk[32];
+	/* Whether we were the GO */
+	bool is_go;
+};
 
 /*
  * For now we only scan the common 2.4GHz channels, to be replaced with
@@ -239,12 +275,16 @@ static inline bool p2p_peer_operational(struct p2p_peer *peer)
 		 (peer->dev->is_go && peer->dev->conn_peer_added));
 }
 
-static bool p2p_peer_match(const void *a, const void *b)
+static unsigned int p2p_peer_addr_hash(const void *key)
 {
-	const struct p2p_peer *peer = a;
-	const uint8_t *addr = b;
+	const uint8_t *addr = key;
+
+	return l_get_le32(addr + 2);
+}
 
-	return !memcmp(peer->bss->addr, addr, 6);
+static int p2p_peer_addr_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, 6);
 }
 
 static const char *p2p_peer_get_path(const struct p2p_peer *peer)
@@ -282,6 +322,21 @@ static void p2p_peer_put(void *user_data)
 	p2p_peer_free(peer);
 }
 
+static void p2p_device_peer_remove(struct p2p_device *dev,
+					struct p2p_peer *peer)
+{
+	l_hashmap_remove(dev->peer_index, peer->addr);
+	p2p_peer_put(peer);
+}
+
+static void p2p_device_peers_destroy(struct p2p_device *dev)
+{
+	l_hashmap_destroy(dev->peer_index, NULL);
+	dev->peer_index = NULL;
+	l_queue_destroy(dev->peer_list, p2p_peer_put);
+	dev->peer_list = NULL;
+}
+
 static void p2p_device_discovery_start(struct p2p_device *dev);
 static void p2p_device_discovery_stop(struct p2p_device *dev);
 
@@ -727,8 +782,7 @@ static void p2p_connection_reset(struct p2p_device *dev)
 		 * have been removed except this one.  Now it's safe to
 		 * drop this peer from the scan results too.
 		 */
-		l_queue_destroy(dev->peer_list, p2p_peer_put);
-		dev->peer_list = NULL;
+		p2p_device_peers_destroy(dev);
 	}
 
 	if (dev->conn_own_wfd) {
@@ -742,6 +796,10 @@ static void p2p_connection_reset(struct p2p_device *dev)
 	explicit_bzero(dev->conn_psk, 32);
 	dev->conn_retry_count = 0;
 	dev->is_go = false;
+	dev->conn_persistent = false;
+	dev->conn_reinvoke = false;
+	dev->conn_oper_class = 0;
+	dev->conn_oper_channel = 0;
 
 	if (dev->enabled && !dev->start_stop_cmd_id &&
 			!l_queue_isempty(dev->discovery_users))
@@ -845,6 +903,15 @@ static const struct frame_xchg_prefix p2p_frame_go_neg_confirm = {
 	.len = 7,
 };
 
+static const struct frame_xchg_prefix p2p_frame_invitation_resp = {
+	/* Management -> Public Action -> P2P -> Invitation Response */
+	.data = (uint8_t []) {
+		0x04, 0x09, 0x50, 0x6f, 0x9a, 0x09,
+		P2P_ACTION_INVITATION_RESP
+	},
+	.len = 7,
+};
+
 static const struct frame_xchg_prefix p2p_frame_pd_resp = {
 	/* Management -> Public Action -> P2P -> Provision Discovery Response */
 	.data = (uint8_t []) {
@@ -854,10 +921,145 @@ static const struct frame_xchg_prefix p2p_frame_pd_resp = {
 	.len = 7,
 };
 
+static bool p2p_persistent_group_match(const void *a, const void *b)
+{
+	const struct p2p_persistent_group *group = a;
+
+	return !memcmp(group->peer_addr, b, 6);
+}
+
+static void p2p_persistent_group_free(void *data)
+{
+	struct p2p_persistent_group *group = data;
+
+	explicit_bzero(group->psk, sizeof(group->psk));
+	l_free(group);
+}
+
+static void p2p_persistent_groups_sync(void)
+{
+	_auto_(l_settings_free) struct l_settings *settings =
+		l_settings_new();
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(p2p_persistent_groups); entry;
+			entry = entry->next) {
+		const struct p2p_persistent_group *group = entry->data;
+		_auto_(l_free) char *name = l_util_hexstring(group->peer_addr,
+								6);
+
+		l_settings_set_string(settings, name, "GroupOwner",
+				util_address_to_string(
+					group->group_id.device_addr));
+		l_settings_set_string(settings, name, "SSID",
+					group->group_id.ssid);
+		l_settings_set_bytes(settings, name, "PreSharedKey",
+					group->psk, 32);
+		l_settings_set_bool(settings, name, "OwnGroup", group->is_go);
+	}
+
+	storage_p2p_groups_sync(settings);
+}
+
+static void p2p_persistent_groups_load(void)
+{
+	_auto_(l_settings_free) struct l_settings *settings =
+		storage_p2p_groups_load();
+	_auto_(l_strv_free) char **groups = NULL;
+	char **name;
+
+	p2p_persistent_groups = l_queue_new();
+
+	if (!settings)
+		return;
+
+	groups = l_settings_get_groups(settings);
+
+	for (name = groups; *name; name++) {
+		_auto_(l_free) uint8_t *addr = NULL;
+		_auto_(l_free) char *go = NULL;
+		_auto_(l_free) char *ssid = NULL;
+		_auto_(l_free) uint8_t *psk = NULL;
+		size_t len;
+		struct p2p_persistent_group *group;
+
+		addr = l_util_from_hexstring(*name, &len);
+		if (!addr || len != 6)
+			continue;
+
+		go = l_settings_get_string(settings, *name, "GroupOwner");
+		ssid = l_settings_get_string(settings, *name, "SSID");
+		psk = l_settings_get_bytes(settings, *name, "PreSharedKey",
+						&len);
+		if (!go || !ssid || strlen(ssid) > 32 || !psk || len != 32)
+			goto next;
+
+		group = l_new(struct p2p_persistent_group, 1);
+		memcpy(group->peer_addr, addr, 6);
+		l_strlcpy(group->group_id.ssid, ssid,
+				sizeof(group->group_id.ssid));
+		memcpy(group->psk, psk, 32);
+
+		if (!util_string_to_address(go, group->group_id.device_addr) ||
+				!l_settings_get_bool(settings, *name,
+							"OwnGroup",
+							&group->is_go)) {
+			p2p_persistent_group_free(group);
+			goto next;
+		}
+
+		l_queue_push_tail(p2p_persistent_groups, group);
+next:
+		if (psk)
+			explicit_bzero(psk, len);
+	}
+}
+
+static void p2p_persistent_group_forget(const uint8_t *peer_addr)
+{
+	struct p2p_persistent_group *group =
+		l_queue_remove_if(p2p_persistent_groups,
+					p2p_persistent_group_match, peer_addr);
+
+	if (!group)
+		return;
+
+	p2p_persistent_group_free(group);
+	p2p_persistent_groups_sync();
+}
+
+static void p2p_persistent_group_save(struct p2p_device *dev)
+{
+	struct p2p_persistent_group *group;
+
+	group = l_queue_remove_if(p2p_persistent_groups,
+					p2p_persistent_group_match,
+					dev->conn_peer->device_addr);
+	if (!group)
+		group = l_new(struct p2p_persistent_group, 1);
+
+	memcpy(group->peer_addr, dev->conn_peer->device_addr, 6);
+	group->group_id = dev->go_group_id;
+	memcpy(group->psk, dev->conn_psk, 32);
+	group->is_go = dev->is_go;
+
+	/* Most recently used last */
+	l_queue_push_tail(p2p_persistent_groups, group);
+
+	if (l_queue_length(p2p_persistent_groups) > P2P_PERSISTENT_GROUPS_MAX)
+		p2p_persistent_group_free(
+				l_queue_pop_head(p2p_persistent_groups));
+
+	p2p_persistent_groups_sync();
+}
+
 static void p2p_peer_connect_done(struct p2p_device *dev)
 {
 	struct p2p_peer *peer = dev->conn_peer;
 
+	if (dev->conn_persistent)
+		p2p_persistent_group_save(dev);
+
 	if (!dev->is_go) {
 		/* We can free anything potentially needed for a retry */
 		scan_bss_free(dev->conn_wsc_bss);
@@ -896,7 +1098,10 @@ static void p2p_group_event(enum ap_event_type type, const void *event_data,
 		break;
 
 	case AP_EVENT_STARTED:
-		ap_push_button(dev->group);
+		/* The client already has the credentials when reinvoking */
+		if (!dev->conn_reinvoke)
+			ap_push_button(dev->group);
+
 		break;
 
 	case AP_EVENT_STATION_ADDED:
@@ -1222,9 +1427,29 @@ static void p2p_dhcp_timeout_destroy(void *user_data)
 	dev->conn_dhcp_timeout = NULL;
 }
 
+/*
+ * ap.c can only start a GO on 2.4GHz so if the station is on another
+ * band our preferred Operating Channel is only a hint for the peer in
+ * case it becomes the GO, and our own group stays on the Listen Channel.
+ */
+static void p2p_device_get_go_channel(struct p2p_device *dev,
+					struct p2p_channel_attr *out)
+{
+	memcpy(out->country, dev->listen_country, 3);
+
+	if (dev->conn_oper_class == 81) {
+		out->oper_class = dev->conn_oper_class;
+		out->channel_num = dev->conn_oper_channel;
+	} else {
+		out->oper_class = dev->listen_oper_class;
+		out->channel_num = dev->listen_channel;
+	}
+}
+
 static void p2p_group_start(struct p2p_device *dev)
 {
 	struct l_settings *config = l_settings_new();
+	struct p2p_channel_attr go_channel;
 	uint8_t psk[32];
 	char *macs[2] = {};
 	const struct wsc_primary_device_type *pdt =
@@ -1238,18 +1463,25 @@ static void p2p_group_start(struct p2p_device *dev)
 		pdt->subcategory;
 
 	l_settings_set_string(config, "General", "SSID", dev->go_group_id.ssid);
-	l_settings_set_uint(config, "General", "Channel", dev->listen_channel);
+	p2p_device_get_go_channel(dev, &go_channel);
+	l_settings_set_uint(config, "General", "Channel",
+				go_channel.channel_num);
 	l_settings_set_bool(config, "General", "NoCCKRates", true);
 	l_settings_set_string(config, "WSC", "DeviceName",
 				dev->device_info.device_name);
 	l_settings_set_uint64(config, "WSC", "PrimaryDeviceType", pdt_uint);
+
 	/*
 	 * Section 3.1.4.4: "It shall only allow association by the
 	 * P2P Device that it is currently in Group Formation with."
+	 * There's no Group Formation when reinvoking a persistent group.
 	 */
-	macs[0] = (char *) util_address_to_string(
+	if (!dev->conn_reinvoke) {
+		macs[0] = (char *) util_address_to_string(
 						dev->conn_peer_interface_addr);
-	l_settings_set_string_list(config, "WSC", "AuthorizedMACs", macs, ',');
+		l_settings_set_string_list(config, "WSC", "AuthorizedMACs",
+						macs, ',');
+	}
 
 	/*
 	 * Section 3.2.1: "The Credentials for a P2P Group issued to a
@@ -1261,9 +1493,12 @@ static void p2p_group_start(struct p2p_device *dev)
 	 * PSKs and don't currently respect the requirement to maintain
 	 * a passphrase.  We have no practical use for the passphrase and
 	 * it's a little costlier to generate for the same cryptographic
-	 * strength as the PSK.
+	 * strength as the PSK.  A reinvoked persistent group keeps its
+	 * original PSK.
 	 */
-	if (!l_getrandom(psk, 32)) {
+	if (dev->conn_reinvoke)
+		memcpy(psk, dev->conn_psk, 32);
+	else if (!l_getrandom(psk, 32)) {
 		l_error("l_getrandom() failed");
 		l_settings_free(config);
 		p2p_connect_failed(dev);
@@ -1272,13 +1507,22 @@ static void p2p_group_start(struct p2p_device *dev)
 
 	l_settings_set_bytes(config, "Security", "PreSharedKey", psk, 32);
 
+	/* Keep the PSK until connected in case the group is persisted */
+	memcpy(dev->conn_psk, psk, 32);
+	explicit_bzero(psk, 32);
+
 	/* Enable netconfig, set maximum usable DHCP lease time */
 	l_settings_set_uint(config, "IPv4", "LeaseTime", 0x7fffffff);
 
 	dev->capability.group_caps |= P2P_GROUP_CAP_GO;
-	dev->capability.group_caps |= P2P_GROUP_CAP_GROUP_FORMATION;
 	dev->capability.group_caps |= P2P_GROUP_CAP_IP_ALLOCATION;
 
+	if (!dev->conn_reinvoke)
+		dev->capability.group_caps |= P2P_GROUP_CAP_GROUP_FORMATION;
+
+	if (dev->conn_persistent)
+		dev->capability.group_caps |= P2P_GROUP_CAP_PERSISTENT_GROUP;
+
 	dev->group = ap_start(dev->conn_netdev, config, &p2p_go_ops, NULL, dev);
 	l_settings_free(config);
 
@@ -1705,6 +1949,8 @@ static void p2p_device_netdev_notify(struct netdev *netdev,
 
 		if (dev->is_go)
 			p2p_group_start(dev);
+		else if (dev->conn_reinvoke)
+			p2p_try_connect_group(dev);
 		else
 			p2p_provision_connect(dev);
 
@@ -1850,13 +2096,39 @@ static bool p2p_provision_scan_notify(int err, struct l_queue *bss_list,
 			l_debug("SSID matched but BSSID didn't match the GO's "
 				"intended interface addr, proceeding anyway");
 
+		if (dev->conn_reinvoke) {
+			/*
+			 * We already hold the credentials of a reinvoked
+			 * persistent group so none of the WSC state below
+			 * matters, only check that this is the same group.
+			 */
+			if (!bss->p2p_info)
+				continue;
+
+			if (bss->source_frame == SCAN_BSS_PROBE_RESP)
+				group_id =
+					bss->p2p_info->device_info.device_addr;
+			else if (bss->source_frame == SCAN_BSS_BEACON)
+				group_id = bss->p2p_info->device_id;
+			else
+				continue;
+
+			capability = &bss->p2p_info->capability;
+
+			if (memcmp(group_id, dev->go_group_id.device_addr, 6) ||
+					!bss->rsne)
+				continue;
+
+			goto found;
+		}
+
 		if (!bss->wsc) {
 			l_error("SSID matched but no valid WSC IE");
 			continue;
 		}
 
 		if (bss->source_frame == SCAN_BSS_PROBE_RESP) {
-			if (!bss->p2p_probe_resp_info) {
+			if (!bss->p2p_info) {
 				l_error("SSID matched but no valid P2P IE");
 				continue;
 			}
@@ -1868,14 +2140,13 @@ static bool p2p_provision_scan_notify(int err, struct l_queue *bss_list,
 				continue;
 			}
 
-			group_id = bss->p2p_probe_resp_info->
-				device_info.device_addr;
+			group_id = bss->p2p_info->device_info.device_addr;
 			selected_reg = wsc_probe_info.selected_registrar;
-			capability = &bss->p2p_probe_resp_info->capability;
+			capability = &bss->p2p_info->capability;
 			device_password_id = wsc_probe_info.device_password_id;
 			amacs = wsc_probe_info.authorized_macs;
 		} else if (bss->source_frame == SCAN_BSS_BEACON) {
-			if (!bss->p2p_beacon_info) {
+			if (!bss->p2p_info) {
 				l_error("SSID matched but no valid P2P IE");
 				continue;
 			}
@@ -1887,9 +2158,9 @@ static bool p2p_provision_scan_notify(int err, struct l_queue *bss_list,
 				continue;
 			}
 
-			group_id = bss->p2p_beacon_info->device_addr;
+			group_id = bss->p2p_info->device_id;
 			selected_reg = wsc_beacon_info.selected_registrar;
-			capability = &bss->p2p_beacon_info->capability;
+			capability = &bss->p2p_info->capability;
 			device_password_id = wsc_beacon_info.device_password_id;
 			amacs = wsc_beacon_info.authorized_macs;
 		} else
@@ -1951,6 +2222,7 @@ static bool p2p_provision_scan_notify(int err, struct l_queue *bss_list,
 			}
 		}
 
+found:
 		l_debug("GO found in the scan results");
 
 		dev->conn_wsc_bss = bss;
@@ -2111,6 +2383,30 @@ static void p2p_add_freq_func(uint32_t freq, void *user_data)
 	channel_entry->channels[channel_entry->n_channels++] = channel;
 }
 
+/* Move our preferred Operating Channel to the front of its entry */
+static void p2p_channel_entry_prefer(struct p2p_device *dev,
+					struct p2p_channel_entries *entry)
+{
+	int i;
+
+	if (entry->oper_class != dev->conn_oper_class)
+		return;
+
+	for (i = 0; i < entry->n_channels; i++)
+		if (entry->channels[i] == dev->conn_oper_channel)
+			break;
+
+	if (i == entry->n_channels)
+		return;
+
+	memmove(entry->channels + 1, entry->channels, i);
+	entry->channels[0] = dev->conn_oper_channel;
+}
+
+/*
+ * The Channel List is a set but list our preferred Operating Channel
+ * first as some GOs pick the first channel in common.
+ */
 static void p2p_device_fill_channel_list(struct p2p_device *dev,
 					struct p2p_channel_list_attr *attr)
 {
@@ -2126,6 +2422,7 @@ static void p2p_device_fill_channel_list(struct p2p_device *dev,
 	channel_entry->n_channels = 0;
 	scan_freq_set_foreach(wiphy_get_supported_freqs(dev->wiphy),
 				p2p_add_freq_func, channel_entry);
+	p2p_channel_entry_prefer(dev, channel_entry);
 	l_queue_push_tail(attr->channel_entries, channel_entry);
 	total_channels = channel_entry->n_channels;
 
@@ -2138,11 +2435,113 @@ static void p2p_device_fill_channel_list(struct p2p_device *dev,
 	channel_entry->n_channels = 0;
 	scan_freq_set_foreach(wiphy_get_supported_freqs(dev->wiphy),
 				p2p_add_freq_func, channel_entry);
+	p2p_channel_entry_prefer(dev, channel_entry);
 
 	if (total_channels + channel_entry->n_channels > MAX_CHANNELS)
 		channel_entry->n_channels = MAX_CHANNELS - total_channels;
 
-	l_queue_push_tail(attr->channel_entries, channel_entry);
+	if (dev->conn_oper_class == 115)
+		l_queue_push_head(attr->channel_entries, channel_entry);
+	else
+		l_queue_push_tail(attr->channel_entries, channel_entry);
+}
+
+struct p2p_station_freq_data {
+	struct p2p_device *dev;
+	uint32_t freq;
+};
+
+static void p2p_station_freq_find(struct station *station, void *user_data)
+{
+	struct p2p_station_freq_data *data = user_data;
+	struct netdev *netdev = station_get_netdev(station);
+	struct scan_bss *bss = station_get_connected_bss(station);
+
+	if (!data->freq && bss && netdev_get_wiphy(netdev) == data->dev->wiphy)
+		data->freq = bss->frequency;
+}
+
+/*
+ * Pick our preferred Operating Channel for the group.  If a station on
+ * the same radio is connected use its channel so that a single channel
+ * serves both links instead of the firmware time-slicing between two
+ * channels.  Otherwise stay on our Listen Channel.
+ */
+static void p2p_device_select_oper_channel(struct p2p_device *dev)
+{
+	struct p2p_station_freq_data data = { .dev = dev };
+	enum band_freq band;
+	uint8_t channel;
+
+	dev->conn_oper_class = dev->listen_oper_class;
+	dev->conn_oper_channel = dev->listen_channel;
+
+	station_foreach(p2p_station_freq_find, &data);
+
+	if (!data.freq || !scan_freq_set_contains(
+				wiphy_get_supported_freqs(dev->wiphy),
+				data.freq))
+		return;
+
+	channel = band_freq_to_channel(data.freq, &band);
+
+	/* Only the Operating Classes we put in our Channel List */
+	if (band == BAND_FREQ_2_4_GHZ && channel <= 13)
+		dev->conn_oper_class = 81;
+	else if (band == BAND_FREQ_5_GHZ)
+		dev->conn_oper_class = 115;
+	else
+		return;
+
+	dev->conn_oper_channel = channel;
+	l_debug("Preferring the station's channel %u", channel);
+}
+
+static bool p2p_channel_list_contains(const struct p2p_channel_list_attr *list,
+					const struct p2p_channel_attr *channel)
+{
+	const struct l_queue_entry *entry;
+	int i;
+
+	for (entry = l_queue_get_entries(list->channel_entries); entry;
+			entry = entry->next) {
+		const struct p2p_channel_entries *entries = entry->data;
+
+		if (entries->oper_class != channel->oper_class)
+			continue;
+
+		for (i = 0; i < entries->n_channels; i++)
+			if (entries->channels[i] == channel->channel_num)
+				return true;
+	}
+
+	return false;
+}
+
+/*
+ * Check that the Operating Channel we'd use as the GO is in the set
+ * supported by the peer, falling back from the station's channel to our
+ * Listen Channel if needed.
+ */
+static bool p2p_device_check_go_channel(struct p2p_device *dev,
+				const struct p2p_channel_list_attr *list,
+				struct p2p_channel_attr *out)
+{
+	p2p_device_get_go_channel(dev, out);
+
+	if (p2p_channel_list_contains(list, out))
+		return true;
+
+	if (out->oper_class == dev->listen_oper_class &&
+			out->channel_num == dev->listen_channel)
+		return false;
+
+	l_debug("Station's channel not supported by the peer");
+	dev->conn_oper_class = dev->listen_oper_class;
+	dev->conn_oper_channel = dev->listen_channel;
+	p2p_device_get_go_channel(dev, out);
+
+	return p2p_channel_list_contains(list, out);
 }
 
 static bool p2p_go_negotiation_confirm_cb(const struct mmpdu_header *mpdu,
@@ -2205,12 +2604,16 @@ static bool p2p_go_negotiation_confirm_cb(const struct mmpdu_header *mpdu,
 	 */
 
 	if (dev->is_go) {
+		struct p2p_channel_attr go_channel;
+
+		p2p_device_get_go_channel(dev, &go_channel);
+
 		if (memcmp(info.operating_channel.country,
-				dev->listen_country, 3) ||
+				go_channel.country, 3) ||
 				info.operating_channel.oper_class !=
-				dev->listen_oper_class ||
+				go_channel.oper_class ||
 				info.operating_channel.channel_num !=
-				dev->listen_channel) {
+				go_channel.channel_num) {
 			l_error("Bad operating channel in GO Negotiation "
 				"Confirmation");
 			p2p_connect_failed(dev);
@@ -2309,7 +2712,7 @@ static void p2p_device_go_negotiation_req_cb(const struct mmpdu_header *mpdu,
 			 !l_memeqzero(mpdu->address_3, 6)))
 		return;
 
-	peer = l_queue_find(dev->peer_list, p2p_peer_match, mpdu->address_2);
+	peer = l_hashmap_lookup(dev->peer_index, mpdu->address_2);
 	if (!peer)
 		return;
 
@@ -2339,8 +2742,17 @@ static void p2p_device_go_negotiation_req_cb(const struct mmpdu_header *mpdu,
 	dev->is_go = P2P_GO_INTENT * 2 + dev->conn_go_tie_breaker >
 		req_info.go_intent * 2;
 
+	/*
+	 * Section 3.1.4.2.1: the Persistent P2P Group bit signals that the
+	 * sender wants the group to be persistent.  Remember the group once
+	 * connected if both sides support it.
+	 */
+	dev->conn_persistent = p2p_persistent_groups_enabled &&
+		(req_info.capability.group_caps &
+		 P2P_GROUP_CAP_PERSISTENT_GROUP);
+
 	if ((req_info.capability.group_caps & P2P_GROUP_CAP_PERSISTENT_GROUP) &&
-			!dev->is_go) {
+			!dev->is_go && !dev->conn_persistent) {
 		if (peer->wsc.pending_connect) {
 			struct l_dbus_message *reply =
 				dbus_error_not_supported(
@@ -2370,9 +2782,7 @@ static void p2p_device_go_negotiation_req_cb(const struct mmpdu_header *mpdu,
 	}
 
 	if (dev->is_go) {
-		const struct l_queue_entry *entry;
-		const struct p2p_channel_entries *entries;
-		int i;
+		struct p2p_channel_attr go_channel;
 
 		/*
 		 * Section 3.1.4.2.1: "The Channel List attribute shall
@@ -2392,33 +2802,12 @@ static void p2p_device_go_negotiation_req_cb(const struct mmpdu_header *mpdu,
 		 * Response which in turn are the subset of those in the
 		 * Request.  So effectively the list in the Request limits
 		 * the peer's set of supported operating channels both as the
-		 * GO and the Client.  Check that our listen channel is in
+		 * GO and the Client.  Check that our Operating Channel is in
 		 * that set.
-		 * TODO: if it's not, look for a different channel.
 		 */
-		for (entry = l_queue_get_entries(
-					req_info.channel_list.channel_entries);
-				entry; entry = entry->next) {
-			entries = entry->data;
-
-			if (entries->oper_class == dev->listen_oper_class)
-				break;
-		}
-
-		if (!entry) {
-			l_error("Our Operating Class not listed in "
-				"the GO Negotiation Request");
-			p2p_connect_failed(dev);
-			status = P2P_STATUS_FAIL_NO_COMMON_CHANNELS;
-			goto p2p_free;
-		}
-
-		for (i = 0; i < entries->n_channels; i++)
-			if (entries->channels[i] == dev->listen_channel)
-				break;
-
-		if (i == entries->n_channels) {
-			l_error("Our listen channel not listed in "
+		if (!p2p_device_check_go_channel(dev, &req_info.channel_list,
+							&go_channel)) {
+			l_error("Our Operating Channel not listed in "
 				"the GO Negotiation Request");
 			p2p_connect_failed(dev);
 			status = P2P_STATUS_FAIL_NO_COMMON_CHANNELS;
@@ -2466,16 +2855,20 @@ respond:
 			l_malloc(sizeof(struct p2p_channel_entries) + 1);
 
 		resp_info.capability = dev->capability;
-		memcpy(resp_info.operating_channel.country,
-			dev->listen_country, 3);
-		resp_info.operating_channel.oper_class = dev->listen_oper_class;
-		resp_info.operating_channel.channel_num = dev->listen_channel;
+
+		if (dev->conn_persistent)
+			resp_info.capability.group_caps |=
+				P2P_GROUP_CAP_PERSISTENT_GROUP;
+
+		p2p_device_get_go_channel(dev, &resp_info.operating_channel);
 		memcpy(&resp_info.group_id, &dev->go_group_id,
 			sizeof(struct p2p_group_id_attr));
 
-		channel_entries->oper_class = dev->listen_oper_class;
+		channel_entries->oper_class =
+			resp_info.operating_channel.oper_class;
 		channel_entries->n_channels = 1;
-		channel_entries->channels[0] = dev->listen_channel;
+		channel_entries->channels[0] =
+			resp_info.operating_channel.channel_num;
 		l_queue_push_tail(channel_list, channel_entries);
 
 		memcpy(resp_info.channel_list.country, dev->listen_country, 3);
@@ -2653,8 +3046,12 @@ static bool p2p_go_negotiation_resp_cb(const struct mmpdu_header *mpdu,
 	dev->is_go = P2P_GO_INTENT * 2 + dev->conn_go_tie_breaker >
 		resp_info.go_intent * 2;
 
+	dev->conn_persistent = p2p_persistent_groups_enabled &&
+		(resp_info.capability.group_caps &
+		 P2P_GROUP_CAP_PERSISTENT_GROUP);
+
 	if ((resp_info.capability.group_caps & P2P_GROUP_CAP_PERSISTENT_GROUP)
-			&& !dev->is_go) {
+			&& !dev->is_go && !dev->conn_persistent) {
 		l_error("Persistent groups not supported");
 		p2p_connect_failed(dev);
 		goto p2p_free;
@@ -2673,37 +3070,12 @@ static bool p2p_go_negotiation_resp_cb(const struct mmpdu_header *mpdu,
 	}
 
 	if (dev->is_go) {
-		const struct l_queue_entry *entry;
-		const struct p2p_channel_entries *entries;
-		int i;
-
-		/*
-		 * Check that our listen channel is in the set supported by the
-		 * Client.
-		 * TODO: if it's not, look for a different channel.
-		 */
-		for (entry = l_queue_get_entries(
-					resp_info.channel_list.channel_entries);
-				entry; entry = entry->next) {
-			entries = entry->data;
-
-			if (entries->oper_class == dev->listen_oper_class)
-				break;
-		}
+		struct p2p_channel_attr go_channel;
 
-		if (!entry) {
-			l_error("Our Operating Class not listed in "
-				"the GO Negotiation Response");
-			p2p_connect_failed(dev);
-			goto p2p_free;
-		}
-
-		for (i = 0; i < entries->n_channels; i++)
-			if (entries->channels[i] == dev->listen_channel)
-				break;
-
-		if (i == entries->n_channels) {
-			l_error("Our listen channel not listed in "
+		/* Check that our channel is supported by the Client */
+		if (!p2p_device_check_go_channel(dev, &resp_info.channel_list,
+							&go_channel)) {
+			l_error("Our Operating Channel not listed in "
 				"the GO Negotiation Response");
 			p2p_connect_failed(dev);
 			goto p2p_free;
@@ -2730,17 +3102,21 @@ static bool p2p_go_negotiation_resp_cb(const struct mmpdu_header *mpdu,
 		dev->conn_config_delay =
 			resp_info.config_timeout.client_config_timeout * 10;
 
-		channel_entries->oper_class = dev->listen_oper_class;
+		p2p_device_get_go_channel(dev, &confirm_info.operating_channel);
+		channel_entries->oper_class =
+			confirm_info.operating_channel.oper_class;
 		channel_entries->n_channels = 1;
-		channel_entries->channels[0] = dev->listen_channel;
+		channel_entries->channels[0] =
+			confirm_info.operating_channel.channel_num;
 		l_queue_push_tail(channel_list, channel_entries);
 
 		/* Build and send the GO Negotiation Confirmation */
 		confirm_info.capability = dev->capability;
-		memcpy(confirm_info.operating_channel.country,
-			dev->listen_country, 3);
-		confirm_info.operating_channel.oper_class = dev->listen_oper_class;
-		confirm_info.operating_channel.channel_num = dev->listen_channel;
+
+		if (dev->conn_persistent)
+			confirm_info.capability.group_caps |=
+				P2P_GROUP_CAP_PERSISTENT_GROUP;
+
 		memcpy(confirm_info.channel_list.country, dev->listen_country, 3);
 		confirm_info.channel_list.channel_entries = channel_list;
 		memcpy(&confirm_info.group_id, &dev->go_group_id,
@@ -2844,6 +3220,10 @@ static void p2p_start_go_negotiation(struct p2p_device *dev)
 	info.dialog_token = 1;
 	info.capability = dev->capability;
 	info.go_intent = P2P_GO_INTENT;
+
+	if (p2p_persistent_groups_enabled)
+		info.capability.group_caps |= P2P_GROUP_CAP_PERSISTENT_GROUP;
+
 	info.go_tie_breaker = dev->conn_go_tie_breaker;
 	info.config_timeout.go_config_timeout = 50;	/* 500ms */
 	info.config_timeout.client_config_timeout = 50;	/* 500ms */
@@ -2859,8 +3239,8 @@ static void p2p_start_go_negotiation(struct p2p_device *dev)
 	 */
 	p2p_device_fill_channel_list(dev, &info.channel_list);
 	memcpy(info.operating_channel.country, dev->listen_country, 3);
-	info.operating_channel.oper_class = dev->listen_oper_class;
-	info.operating_channel.channel_num = dev->listen_channel;
+	info.operating_channel.oper_class = dev->conn_oper_class;
+	info.operating_channel.channel_num = dev->conn_oper_channel;
 	info.device_info = dev->device_info;
 	info.device_password_id = dev->conn_password_id;
 
@@ -3036,25 +3416,207 @@ static void p2p_start_provision_discovery(struct p2p_device *dev)
 	l_free(req_body);
 }
 
+static void p2p_invitation_fallback(struct p2p_device *dev)
+{
+	l_debug("Falling back to GO Negotiation");
+
+	dev->is_go = false;
+	dev->conn_reinvoke = false;
+	dev->conn_persistent = false;
+	memset(&dev->go_group_id, 0, sizeof(dev->go_group_id));
+	explicit_bzero(dev->conn_psk, 32);
+	p2p_start_go_negotiation(dev);
+}
+
+static bool p2p_invitation_resp_cb(const struct mmpdu_header *mpdu,
+					const void *body, size_t body_len,
+					int rssi, struct p2p_device *dev)
+{
+	struct p2p_invitation_resp info;
+	enum band_freq band;
+	int r;
+
+	l_debug("");
+
+	if (!dev->conn_peer)
+		return true;
+
+	if (body_len < 8) {
+		l_error("Invitation Response frame too short");
+		p2p_connect_failed(dev);
+		return true;
+	}
+
+	r = p2p_parse_invitation_resp(body + 7, body_len - 7, &info);
+	if (r < 0) {
+		l_error("Invitation Response parse error %s (%i)",
+			strerror(-r), -r);
+		p2p_connect_failed(dev);
+		return true;
+	}
+
+	if (info.dialog_token != 3) {
+		l_error("Invitation Response dialog token doesn't match");
+		p2p_connect_failed(dev);
+		goto p2p_free;
+	}
+
+	if (info.status != P2P_STATUS_SUCCESS) {
+		l_debug("Invitation Response status %i", info.status);
+
+		/* The peer no longer has the group, don't try it again */
+		if (info.status == P2P_STATUS_FAIL_UNKNOWN_P2P_GROUP)
+			p2p_persistent_group_forget(
+					dev->conn_peer->device_addr);
+
+		p2p_invitation_fallback(dev);
+		goto p2p_free;
+	}
+
+	/* Check whether WFD IE is required, validate it if present */
+	if (!p2p_device_validate_conn_wfd(dev, info.wfd, info.wfd_size)) {
+		p2p_connect_failed(dev);
+		goto p2p_free;
+	}
+
+	if (dev->is_go) {
+		/* Bring the group up on the Operating Channel we proposed */
+		p2p_device_interface_create(dev);
+		goto p2p_free;
+	}
+
+	band = band_oper_class_to_band(
+			(const uint8_t *) info.operating_channel.country,
+			info.operating_channel.oper_class);
+	dev->conn_go_oper_freq = band_channel_to_freq(
+					info.operating_channel.channel_num,
+					band);
+	if (!dev->conn_go_oper_freq) {
+		l_error("Bad operating channel in Invitation Response");
+		p2p_connect_failed(dev);
+		goto p2p_free;
+	}
+
+	memcpy(dev->conn_peer_interface_addr, info.group_bssid, 6);
+
+	/*
+	 * Give the GO the time it asked for to restart the group and go
+	 * straight to the scan for it, there's no provisioning phase.
+	 */
+	dev->conn_config_delay = info.config_timeout.go_config_timeout * 10;
+	dev->conn_peer_config_timeout = l_timeout_create_ms(
+						dev->conn_config_delay,
+						p2p_config_timeout, dev,
+						p2p_config_timeout_destroy);
+
+p2p_free:
+	p2p_clear_invitation_resp(&info);
+	return true;
+}
+
+static void p2p_invitation_req_done(int error, void *user_data)
+{
+	struct p2p_device *dev = user_data;
+
+	if (error)
+		l_error("Sending the Invitation Request failed: %s (%i)",
+			strerror(-error), -error);
+	else
+		l_error("No Invitation Response after Request ACKed");
+
+	p2p_invitation_fallback(dev);
+}
+
+/*
+ * Reinvoke a persistent group we've formed with the peer before.  This
+ * skips both the GO Negotiation and the WSC provisioning since both
+ * sides already know the group's role assignment and credentials.
+ */
+static void p2p_start_invitation(struct p2p_device *dev,
+				const struct p2p_persistent_group *group)
+{
+	struct p2p_invitation_req info = {};
+	uint8_t *req_body;
+	size_t req_len;
+	uint8_t wfd_ie[32];
+	struct iovec iov[16];
+	int iov_len = 0;
+
+	l_debug("Reinvoking persistent group %s", group->group_id.ssid);
+
+	dev->is_go = group->is_go;
+	dev->conn_reinvoke = true;
+	dev->conn_persistent = true;
+	dev->go_group_id = group->group_id;
+	memcpy(dev->conn_psk, group->psk, 32);
+
+	/* The same dialog token scheme as GO Negotiation and PD */
+	info.dialog_token = 3;
+	info.config_timeout.go_config_timeout = 50;	/* 500ms */
+	info.config_timeout.client_config_timeout = 50;	/* 500ms */
+	info.reinvoke_persistent_group = true;
+
+	/*
+	 * Section 3.1.5.1: the Operating Channel and P2P Group BSSID are
+	 * only included by the P2P Device that is going to be the GO.
+	 */
+	if (dev->is_go) {
+		p2p_device_get_go_channel(dev, &info.operating_channel);
+		memcpy(info.group_bssid, dev->conn_addr, 6);
+	}
+
+	p2p_device_fill_channel_list(dev, &info.channel_list);
+	info.group_id = group->group_id;
+	info.device_info = dev->device_info;
+
+	if (dev->conn_own_wfd) {
+		info.wfd = wfd_ie;
+		info.wfd_size = p2p_build_wfd_ie(dev->conn_own_wfd,
+							NULL, wfd_ie);
+	}
+
+	req_body = p2p_build_invitation_req(&info, &req_len);
+	info.wfd = NULL;
+	p2p_clear_invitation_req(&info);
+
+	if (!req_body) {
+		p2p_connect_failed(dev);
+		return;
+	}
+
+	iov[iov_len].iov_base = req_body;
+	iov[iov_len].iov_len = req_len;
+	iov_len++;
+
+	iov[iov_len].iov_base = NULL;
+
+	p2p_peer_frame_xchg(dev->conn_peer, iov, dev->conn_peer->device_addr,
+				100, 600, 256, false, FRAME_GROUP_CONNECT,
+				p2p_invitation_req_done,
+				&p2p_frame_invitation_resp,
+				p2p_invitation_resp_cb, NULL);
+	l_free(req_body);
+}
+
 static bool p2p_peer_get_info(struct p2p_peer *peer,
 				uint16_t *wsc_config_methods,
 				struct p2p_capability_attr **capability)
 {
 	struct wsc_probe_request wsc_info;
 
+	if (!peer->bss->p2p_info)
+		return false;
+
 	switch (peer->bss->source_frame) {
 	case SCAN_BSS_PROBE_RESP:
-		if (!peer->bss->p2p_probe_resp_info)
-			return false;
-
 		if (wsc_config_methods)
-			*wsc_config_methods = peer->bss->p2p_probe_resp_info->
+			*wsc_config_methods = peer->bss->p2p_info->
 				device_info.wsc_config_methods;
 
-		*capability = &peer->bss->p2p_probe_resp_info->capability;
+		*capability = &peer->bss->p2p_info->capability;
 		return true;
 	case SCAN_BSS_PROBE_REQ:
-		if (!peer->bss->p2p_probe_req_info || !peer->bss->wsc)
+		if (!peer->bss->wsc)
 			return false;
 
 		if (wsc_parse_probe_request(peer->bss->wsc, peer->bss->wsc_size,
@@ -3064,10 +3626,10 @@ static bool p2p_peer_get_info(struct p2p_peer *peer,
 		if (wsc_config_methods)
 			*wsc_config_methods = wsc_info.config_methods;
 
-		*capability = &peer->bss->p2p_probe_req_info->capability;
+		*capability = &peer->bss->p2p_info->capability;
 		return true;
 	case SCAN_BSS_BEACON:
-		if (!peer->bss->p2p_beacon_info || !peer->bss->wsc)
+		if (!peer->bss->wsc)
 			return false;
 
 		if (wsc_parse_probe_request(peer->bss->wsc, peer->bss->wsc_size,
@@ -3077,7 +3639,7 @@ static bool p2p_peer_get_info(struct p2p_peer *peer,
 		if (wsc_config_methods)
 			*wsc_config_methods = wsc_info.config_methods;
 
-		*capability = &peer->bss->p2p_beacon_info->capability;
+		*capability = &peer->bss->p2p_info->capability;
 		break;
 	}
 
@@ -3091,6 +3653,7 @@ static void p2p_peer_connect(struct p2p_peer *peer, const char *pin)
 	struct p2p_capability_attr *capability;
 	struct l_dbus_message *message = peer->wsc.pending_connect;
 	struct l_dbus_message *reply;
+	const struct p2p_persistent_group *group;
 
 	if (dev->conn_peer) {
 		reply = dbus_error_busy(message);
@@ -3156,6 +3719,7 @@ static void p2p_peer_connect(struct p2p_peer *peer, const char *pin)
 
 	/* Generate the interface address for our P2P-Client connection */
 	wiphy_generate_random_address(dev->wiphy, dev->conn_addr);
+	p2p_device_select_oper_channel(dev);
 
 	dev->conn_peer = peer; /* No ref counting so just set the pointer */
 	dev->conn_pin = l_strdup(pin);
@@ -3186,14 +3750,32 @@ static void p2p_peer_connect(struct p2p_peer *peer, const char *pin)
 	}
 
 	/*
-	 * Step 2, if peer is already a GO then send the Provision Discovery
-	 * before doing WSC.  If it's not then do Provision Discovery
-	 * optionally as seems to be required by some implementations, and
-	 * start GO negotiation following that.
+	 * Step 2, if we've formed a persistent group with this peer before,
+	 * either join it directly if the peer is already running it or
+	 * reinvoke it.  Otherwise, if peer is already a GO then send the
+	 * Provision Discovery before doing WSC.  If it's not then do
+	 * Provision Discovery optionally as seems to be required by some
+	 * implementations, and start GO negotiation following that.
 	 * TODO: Add a AlwaysUsePD config setting.
 	 */
-	if (dev->conn_peer->group)
+	group = l_queue_find(p2p_persistent_groups, p2p_persistent_group_match,
+				peer->device_addr);
+
+	if (group && peer->group && !group->is_go &&
+			strlen(group->group_id.ssid) == peer->bss->ssid_len &&
+			!memcmp(group->group_id.ssid, peer->bss->ssid,
+				peer->bss->ssid_len)) {
+		dev->conn_reinvoke = true;
+		dev->conn_persistent = true;
+		dev->go_group_id = group->group_id;
+		memcpy(dev->conn_psk, group->psk, 32);
+		dev->conn_go_oper_freq = peer->bss->frequency;
+		memset(dev->conn_peer_interface_addr, 0, 6);
+		p2p_start_client_provision(dev);
+	} else if (dev->conn_peer->group)
 		p2p_start_provision_discovery(dev);
+	else if (group)
+		p2p_start_invitation(dev, group);
 	else
 		p2p_start_go_negotiation(dev);
 
@@ -3275,12 +3857,28 @@ send_reply:
 }
 
 #define SCAN_INTERVAL_MAX	3
+#define SCAN_INTERVAL_MAX_BUSY	5
 #define SCAN_INTERVAL_STEP	1
 #define CHANS_PER_SCAN_INITIAL	2
 #define CHANS_PER_SCAN		2
+#define CHANS_PER_SCAN_BUSY	1
+#define LISTEN_DURATION_BUSY	500
+#define PEER_MAX_AGE		(30 * L_USEC_PER_SEC)
+/* Station packet rate above which we favor its traffic over discovery */
+#define STATION_BUSY_PPS	100
 
 static bool p2p_device_scan_start(struct p2p_device *dev);
 static void p2p_device_roc_start(struct p2p_device *dev);
+static void p2p_scan_timeout_destroy(void *user_data);
+
+static void p2p_device_pause_timeout(struct l_timeout *timeout,
+					void *user_data)
+{
+	struct p2p_device *dev = user_data;
+
+	l_timeout_remove(dev->scan_timeout);
+	p2p_device_scan_start(dev);
+}
 
 static void p2p_device_roc_timeout(struct l_timeout *timeout, void *user_data)
 {
@@ -3288,17 +3886,29 @@ static void p2p_device_roc_timeout(struct l_timeout *timeout, void *user_data)
 
 	l_timeout_remove(dev->scan_timeout);
 
-	if (time(NULL) < dev->next_scan_ts) {
-		/*
-		 * dev->scan_timeout destroy function will have been called
-		 * by now so it won't overwrite the new timeout set by
-		 * p2p_device_roc_start.
-		 */
-		p2p_device_roc_start(dev);
+	if (time(NULL) >= dev->next_scan_ts) {
+		p2p_device_scan_start(dev);
 		return;
 	}
 
-	p2p_device_scan_start(dev);
+	/*
+	 * dev->scan_timeout destroy function will have been called by now
+	 * so it won't overwrite the new timeout set below.
+	 *
+	 * If the station interface on this radio is carrying traffic, one
+	 * short Listen State per Find iteration is enough to satisfy
+	 * 3.1.2.1.1, stay on the station's channel until the next scan.
+	 */
+	if (dev->station_busy) {
+		unsigned int ms = (dev->next_scan_ts - time(NULL)) * 1000;
+
+		dev->scan_timeout = l_timeout_create_ms(ms,
+						p2p_device_pause_timeout, dev,
+						p2p_scan_timeout_destroy);
+		return;
+	}
+
+	p2p_device_roc_start(dev);
 }
 
 static void p2p_device_roc_cancel(struct p2p_device *dev)
@@ -3393,6 +4003,9 @@ static void p2p_device_roc_start(struct p2p_device *dev)
 	if (duration > 1000)
 		duration = 1000;
 
+	if (dev->station_busy && duration > LISTEN_DURATION_BUSY)
+		duration = LISTEN_DURATION_BUSY;
+
 	/*
 	 * Be on our listen channel, even if we're still in the 120s
 	 * waiting period after a locally-initiated GO Negotiation and
@@ -3609,60 +4222,109 @@ static bool p2p_device_peer_add(struct p2p_device *dev, struct p2p_peer *peer)
 			wfd.available)
 		p2p_peer_update_wfd(peer, &wfd);
 
+	if (!dev->peer_list) {
+		dev->peer_list = l_queue_new();
+		dev->peer_index = l_hashmap_new();
+		l_hashmap_set_hash_function(dev->peer_index,
+						p2p_peer_addr_hash);
+		l_hashmap_set_compare_function(dev->peer_index,
+						p2p_peer_addr_compare);
+	}
+
+	memcpy(peer->addr, peer->bss->addr, 6);
+	peer->seen_seq = dev->scan_seq;
 	l_queue_push_tail(dev->peer_list, peer);
+	l_hashmap_insert(dev->peer_index, peer->addr, peer);
 
 	return true;
 }
 
-struct p2p_peer_move_data {
-	struct l_queue *new_list;
-	struct p2p_peer *conn_peer;
+struct p2p_peer_expire_data {
+	struct p2p_device *dev;
 	uint64_t now;
 };
 
-static bool p2p_peer_move_recent(void *data, void *user_data)
+static bool p2p_peer_expire(void *data, void *user_data)
 {
 	struct p2p_peer *peer = data;
-	struct p2p_peer_move_data *move_data = user_data;
+	struct p2p_peer_expire_data *expire_data = user_data;
+	struct p2p_device *dev = expire_data->dev;
 
-	if (move_data->now > peer->bss->time_stamp + 30 * L_USEC_PER_SEC &&
-			peer != move_data->conn_peer)
-		return false;	/* Old, keep on the list */
+	/* Seen in the latest results, recently seen or currently connected */
+	if (peer->seen_seq == dev->scan_seq || peer == dev->conn_peer ||
+			expire_data->now <=
+			peer->bss->time_stamp + PEER_MAX_AGE)
+		return false;
 
-	/* Recently seen or currently connected, move to the new list */
-	l_queue_push_tail(move_data->new_list, peer);
+	p2p_device_peer_remove(dev, peer);
 	return true;
 }
 
-static bool p2p_peer_update_existing(struct scan_bss *bss,
-					struct l_queue *old_list,
-					struct l_queue *new_list)
+static bool p2p_peer_update_existing(struct p2p_device *dev,
+				struct scan_bss *bss, const char *name,
+				const struct wsc_primary_device_type *pdt,
+				bool group)
 {
 	struct p2p_peer *peer;
 	struct p2p_wfd_properties wfd;
+	const uint8_t *device_addr;
+	bool addr_changed;
 
-	peer = l_queue_remove_if(old_list, p2p_peer_match, bss->addr);
+	peer = l_hashmap_lookup(dev->peer_index, bss->addr);
 	if (!peer)
 		return false;
 
 	/*
-	 * We've seen this peer already, only update the scan_bss object
-	 * and WFD state.  We can update peer->bss even if
+	 * We've seen this peer already, update the scan_bss object and the
+	 * state derived from it in place.  We can update peer->bss even if
 	 * peer == peer->dev->conn_peer because its .bss is not used by
 	 * .conn_netdev or .conn_enrollee.  .conn_wsc_bss is used for
 	 * both connections and it doesn't come from the discovery scan
 	 * results.
-	 * Some property changes may need to be notified here.
+	 * Only emit property changes for values that actually differ so
+	 * that a crowded channel doesn't flood D-Bus on every scan.
 	 */
 
-	if (peer->device_addr == peer->bss->addr)
-		peer->device_addr = bss->addr;
+	if (peer->device_addr == peer->bss->addr ||
+			bss->source_frame != SCAN_BSS_PROBE_RESP ||
+			!bss->p2p_info)
+		device_addr = bss->addr;
 	else
-		peer->device_addr =
-			bss->p2p_probe_resp_info->device_info.device_addr;
+		device_addr = bss->p2p_info->device_info.device_addr;
+
+	addr_changed = memcmp(peer->device_addr, device_addr, 6);
+	peer->device_addr = device_addr;
 
 	scan_bss_free(peer->bss);
 	peer->bss = bss;
+	peer->seen_seq = dev->scan_seq;
+	peer->group = group;
+
+	if (addr_changed)
+		l_dbus_property_changed(dbus_get_bus(),
+					p2p_peer_get_path(peer),
+					IWD_P2P_PEER_INTERFACE, "Address");
+
+	if (strcmp(peer->name, name) && strlen(name) &&
+			l_utf8_validate(name, strlen(name), NULL)) {
+		l_free(peer->name);
+		peer->name = l_strdup(name);
+		l_dbus_property_changed(dbus_get_bus(),
+					p2p_peer_get_path(peer),
+					IWD_P2P_PEER_INTERFACE, "Name");
+	}
+
+	if (memcmp(&peer->primary_device_type, pdt, sizeof(*pdt))) {
+		peer->primary_device_type = *pdt;
+		l_dbus_property_changed(dbus_get_bus(),
+					p2p_peer_get_path(peer),
+					IWD_P2P_PEER_INTERFACE,
+					"DeviceCategory");
+		l_dbus_property_changed(dbus_get_bus(),
+					p2p_peer_get_path(peer),
+					IWD_P2P_PEER_INTERFACE,
+					"DeviceSubcategory");
+	}
 
 	if (p2p_own_wfd && p2p_extract_wfd_properties(bss->wfd, bss->wfd_size,
 							&wfd) &&
@@ -3671,73 +4333,134 @@ static bool p2p_peer_update_existing(struct scan_bss *bss,
 	else if (peer->wfd)
 		p2p_peer_update_wfd(peer, NULL);
 
-	l_queue_push_tail(new_list, peer);
 	return true;
 }
 
+struct p2p_station_load {
+	struct p2p_device *dev;
+	uint64_t packets;
+};
+
+static void p2p_station_load_add(struct station *station, void *user_data)
+{
+	struct p2p_station_load *load = user_data;
+	struct netdev *netdev = station_get_netdev(station);
+	const char *ifname = netdev_get_name(netdev);
+	uint64_t rx;
+	uint64_t tx;
+
+	if (netdev_get_wiphy(netdev) != load->dev->wiphy ||
+			station_get_state(station) != STATION_STATE_CONNECTED)
+		return;
+
+	if (sysfs_read_netdev_statistic(ifname, "rx_packets", &rx) < 0 ||
+			sysfs_read_netdev_statistic(ifname, "tx_packets",
+							&tx) < 0)
+		return;
+
+	load->packets += rx + tx;
+}
+
+/*
+ * Sample the packet counters of the stations sharing our radio once per
+ * Find iteration.  Each Listen or Search State takes the radio off the
+ * station's operating channel so back off while there's traffic.
+ */
+static void p2p_device_update_station_load(struct p2p_device *dev)
+{
+	struct p2p_station_load load = { .dev = dev };
+	uint64_t now = l_time_now();
+	uint64_t elapsed = l_time_diff(dev->sta_packets_ts, now);
+
+	station_foreach(p2p_station_load_add, &load);
+
+	dev->station_busy = dev->sta_packets_ts && elapsed &&
+		load.packets > dev->sta_packets &&
+		(load.packets - dev->sta_packets) * L_USEC_PER_SEC >
+		STATION_BUSY_PPS * elapsed;
+
+	if (dev->station_busy)
+		l_debug("Station traffic, backing off P2P discovery");
+
+	dev->sta_packets = load.packets;
+	dev->sta_packets_ts = now;
+}
+
+static void p2p_device_note_peer_channel(struct p2p_device *dev,
+						uint32_t freq, uint64_t now)
+{
+	enum band_freq band;
+	uint8_t chan = band_freq_to_channel(freq, &band);
+
+	if (chan && band == BAND_FREQ_2_4_GHZ &&
+			chan < L_ARRAY_SIZE(dev->chan_seen_ts))
+		dev->chan_seen_ts[chan] = now;
+}
+
 static bool p2p_scan_notify(int err, struct l_queue *bss_list,
 				const struct scan_freq_set *freqs,
 				void *user_data)
 {
 	struct p2p_device *dev = user_data;
 	const struct l_queue_entry *entry;
-	struct l_queue *old_peer_list = dev->peer_list;
-	struct p2p_peer_move_data move_data;
+	struct p2p_peer_expire_data expire_data;
+	unsigned int max_interval;
 
 	if (err) {
 		l_debug("P2P scan failed: %s (%i)", strerror(-err), -err);
 		goto schedule;
 	}
 
-	dev->peer_list = l_queue_new();
+	dev->scan_seq++;
+	expire_data.dev = dev;
+	expire_data.now = l_time_now();
 
 	for (entry = l_queue_get_entries(bss_list); entry;
 			entry = entry->next) {
 		struct scan_bss *bss = entry->data;
+		struct p2p_device_info_attr *info;
 		struct p2p_peer *peer;
+		bool group;
 
 		if (bss->source_frame != SCAN_BSS_PROBE_RESP ||
-				!bss->p2p_probe_resp_info) {
+				!bss->p2p_info) {
 			scan_bss_free(bss);
 			continue;
 		}
 
-		if (p2p_peer_update_existing(bss, old_peer_list,
-						dev->peer_list))
+		info = &bss->p2p_info->device_info;
+		group = !!(bss->p2p_info->capability.group_caps &
+				P2P_GROUP_CAP_GO);
+		p2p_device_note_peer_channel(dev, bss->frequency,
+						expire_data.now);
+
+		if (p2p_peer_update_existing(dev, bss, info->device_name,
+						&info->primary_device_type,
+						group))
 			continue;
 
 		peer = l_new(struct p2p_peer, 1);
 		peer->dev = dev;
 		peer->bss = bss;
-		peer->name = l_strdup(bss->p2p_probe_resp_info->
-						device_info.device_name);
-		peer->primary_device_type =
-			bss->p2p_probe_resp_info->device_info.primary_device_type;
-		peer->group =
-			!!(bss->p2p_probe_resp_info->capability.group_caps &
-			   P2P_GROUP_CAP_GO);
+		peer->name = l_strdup(info->device_name);
+		peer->primary_device_type = info->primary_device_type;
+		peer->group = group;
 		/*
 		 * Both P2P Devices and GOs can send Probe Responses so the
 		 * frame's source address may not necessarily be the Device
 		 * Address, use what's in the obligatory Device Info.
 		 */
-		peer->device_addr =
-			bss->p2p_probe_resp_info->device_info.device_addr;
+		peer->device_addr = info->device_addr;
 
 		if (!p2p_device_peer_add(dev, peer))
 			p2p_peer_free(peer);
 	}
 
 	/*
-	 * old_peer_list now only contains peers not present in the new
-	 * results.  Move any peers seen in the last 30 secs to the new
-	 * dev->peer_list and unref only the remaining peers.
+	 * Peers not present in the new results stay on dev->peer_list if
+	 * seen in the last 30 secs, unref only the remaining peers.
 	 */
-	move_data.new_list = dev->peer_list;
-	move_data.conn_peer = dev->conn_peer;
-	move_data.now = l_time_now();
-	l_queue_foreach_remove(old_peer_list, p2p_peer_move_recent, &move_data);
-	l_queue_destroy(old_peer_list, p2p_peer_put);
+	l_queue_foreach_remove(dev->peer_list, p2p_peer_expire, &expire_data);
 	l_queue_destroy(bss_list, NULL);
 
 schedule:
@@ -3761,8 +4484,14 @@ schedule:
 	 *
 	 * The Search State duration is implementation dependent.
 	 */
-	if (dev->scan_interval < SCAN_INTERVAL_MAX)
+	p2p_device_update_station_load(dev);
+	max_interval = dev->station_busy ?
+		SCAN_INTERVAL_MAX_BUSY : SCAN_INTERVAL_MAX;
+
+	if (dev->scan_interval < max_interval)
 		dev->scan_interval += SCAN_INTERVAL_STEP;
+	else
+		dev->scan_interval = max_interval;
 
 	dev->next_scan_ts = time(NULL) + dev->scan_interval;
 
@@ -3775,6 +4504,8 @@ static bool p2p_device_scan_start(struct p2p_device *dev)
 	struct scan_parameters params = {};
 	uint8_t buf[256];
 	unsigned int i;
+	unsigned int chans_per_scan;
+	uint64_t now;
 
 	wiphy_get_reg_domain_country(dev->wiphy, (char *) dev->listen_country);
 	dev->listen_country[2] = 4;	/* Table E-4 */
@@ -3817,6 +4548,14 @@ static bool p2p_device_scan_start(struct p2p_device *dev)
 		scan_freq_set_add(params.freqs, freq);
 	}
 
+	/*
+	 * If we're only waiting for the peer we're connecting to, to restart
+	 * the GO Negotiation, that will happen from its Search State on our
+	 * Listen Channel.  Keep our own Search State to the social channels.
+	 */
+	if (dev->conn_peer)
+		goto scan;
+
 	/*
 	 * Instead of doing a single Scan Phase at the beginning of the Device
 	 * Discovery and then strictly a Find Phase loop as defined in the
@@ -3824,9 +4563,27 @@ static bool p2p_device_scan_start(struct p2p_device *dev)
 	 * channels, slowly going through a few channels at a time in each
 	 * Scan State iteration.  Scan dev->chans_per_scan channels each time,
 	 * use dev->scan_chan_idx to keep track of which channels we've
-	 * visited recently.
+	 * visited recently.  Channels where peers were seen recently are
+	 * scanned every time so that the information on those peers stays
+	 * fresh.
 	 */
-	for (i = 0; i < dev->chans_per_scan; i++) {
+	now = l_time_now();
+
+	for (i = 0; i < L_ARRAY_SIZE(channels_scan_2_4_other); i++) {
+		int chan = channels_scan_2_4_other[i];
+
+		if (!dev->chan_seen_ts[chan] ||
+				now > dev->chan_seen_ts[chan] + PEER_MAX_AGE)
+			continue;
+
+		scan_freq_set_add(params.freqs,
+				band_channel_to_freq(chan, BAND_FREQ_2_4_GHZ));
+	}
+
+	chans_per_scan = dev->station_busy ?
+		CHANS_PER_SCAN_BUSY : dev->chans_per_scan;
+
+	for (i = 0; i < chans_per_scan; i++) {
 		int idx = dev->scan_chan_idx++;
 		int chan = channels_scan_2_4_other[idx];
 		uint32_t freq = band_channel_to_freq(chan, BAND_FREQ_2_4_GHZ);
@@ -3844,6 +4601,7 @@ static bool p2p_device_scan_start(struct p2p_device *dev)
 		scan_freq_set_add(params.freqs, freq);
 	}
 
+scan:
 	dev->scan_id = scan_active_full(dev->wdev_id, &params, NULL,
 					p2p_scan_notify, dev, p2p_scan_destroy);
 	scan_freq_set_free(params.freqs);
@@ -4015,7 +4773,7 @@ static void p2p_device_probe_cb(const struct mmpdu_header *mpdu,
 {
 	struct p2p_device *dev = user_data;
 	struct p2p_peer *peer;
-	struct p2p_probe_req p2p_info;
+	struct p2p_discovery_info p2p_info;
 	struct wsc_probe_request wsc_info;
 	int r;
 	uint8_t *wsc_payload;
@@ -4056,7 +4814,7 @@ static void p2p_device_probe_cb(const struct mmpdu_header *mpdu,
 			return;
 	}
 
-	r = p2p_parse_probe_req(body, body_len, &p2p_info);
+	r = p2p_parse_discovery_info(body, body_len, &p2p_info);
 	if (r < 0) {
 		if (r == -ENOENT)	/* Not a P2P Probe Req, ignore */
 			return;
@@ -4083,23 +4841,26 @@ static void p2p_device_probe_cb(const struct mmpdu_header *mpdu,
 	else if (p2p_info.operating_channel.country[0])
 		channel = &p2p_info.operating_channel;
 	else
-		goto p2p_free;
+		return;
 
 	band = band_oper_class_to_band((const uint8_t *) channel->country,
 					channel->oper_class);
 	frequency = band_channel_to_freq(channel->channel_num, band);
 	if (!frequency)
-		goto p2p_free;
+		return;
 
 	bss = scan_bss_new_from_probe_req(mpdu, body, body_len, frequency,
 						rssi);
 	if (!bss)
-		goto p2p_free;
+		return;
 
 	bss->time_stamp = l_time_now();
 
-	if (p2p_peer_update_existing(bss, dev->peer_list, dev->peer_list))
-		goto p2p_free;
+	if (p2p_peer_update_existing(dev, bss, wsc_info.device_name,
+					&wsc_info.primary_device_type,
+					!!(p2p_info.capability.group_caps &
+					   P2P_GROUP_CAP_GO)))
+		return;
 
 	peer = l_new(struct p2p_peer, 1);
 	peer->dev = dev;
@@ -4115,9 +4876,6 @@ static void p2p_device_probe_cb(const struct mmpdu_header *mpdu,
 	 */
 	peer->device_addr = bss->addr;
 
-	if (!dev->peer_list)
-		dev->peer_list = l_queue_new();
-
 	if (!p2p_device_peer_add(dev, peer))
 		p2p_peer_free(peer);
 
@@ -4126,9 +4884,6 @@ static void p2p_device_probe_cb(const struct mmpdu_header *mpdu,
 	 * reply with a Probe Response -- not useful in our current usage
 	 * scenarios but required by the spec.
 	 */
-
-p2p_free:
-	p2p_clear_probe_req(&p2p_info);
 }
 
 static void p2p_device_discovery_start(struct p2p_device *dev)
@@ -4139,6 +4894,8 @@ static void p2p_device_discovery_start(struct p2p_device *dev)
 	dev->scan_interval = 1;
 	dev->chans_per_scan = CHANS_PER_SCAN_INITIAL;
 	dev->scan_chan_idx = 0;
+	dev->sta_packets_ts = 0;
+	dev->station_busy = false;
 
 	/*
 	 * 3.1.2.1.1: "The Listen Channel shall be chosen at the beginning of
@@ -4213,12 +4970,15 @@ static void p2p_device_enable_destroy(void *user_data)
 	dev->start_stop_cmd_id = 0;
 }
 
-static bool p2p_peer_remove_disconnected(void *peer, void *conn_peer)
+static bool p2p_peer_remove_disconnected(void *data, void *user_data)
 {
-	if (peer == conn_peer)
+	struct p2p_peer *peer = data;
+	struct p2p_device *dev = user_data;
+
+	if (peer == dev->conn_peer)
 		return false;
 
-	p2p_peer_put(peer);
+	p2p_device_peer_remove(dev, peer);
 	return true;
 }
 
@@ -4263,10 +5023,9 @@ static void p2p_device_start_stop(struct p2p_device *dev,
 		if (dev->conn_peer && !dev->conn_netdev && !dev->conn_wsc_bss)
 			p2p_connect_failed(dev);
 
-		if (!dev->conn_peer) {
-			l_queue_destroy(dev->peer_list, p2p_peer_put);
-			dev->peer_list = NULL;
-		} else
+		if (!dev->conn_peer)
+			p2p_device_peers_destroy(dev);
+		else
 			/*
 			 * If the connection already depends on its own
 			 * netdev only, we can let it continue until the user
@@ -4274,7 +5033,7 @@ static void p2p_device_start_stop(struct p2p_device *dev,
 			 */
 			l_queue_foreach_remove(dev->peer_list,
 						p2p_peer_remove_disconnected,
-						dev->conn_peer);
+						dev);
 	}
 }
 
@@ -4449,7 +5208,7 @@ static void p2p_device_free(void *user_data)
 	p2p_device_discovery_stop(dev);
 	p2p_connection_reset(dev);
 	l_dbus_unregister_object(dbus_get_bus(), p2p_device_get_path(dev));
-	l_queue_destroy(dev->peer_list, p2p_peer_put);
+	p2p_device_peers_destroy(dev);
 	l_queue_destroy(dev->discovery_users, p2p_discovery_user_free);
 	l_genl_family_free(dev->nl80211); /* Cancels dev->start_stop_cmd_id */
 	scan_wdev_remove(dev->wdev_id);
@@ -5172,6 +5931,13 @@ static int p2p_init(void)
 					&p2p_dhcp_timeout_val))
 		p2p_dhcp_timeout_val = 20;	/* 20s default */
 
+	if (!l_settings_get_bool(iwd_get_config(), "P2P", "PersistentGroups",
+					&p2p_persistent_groups_enabled))
+		p2p_persistent_groups_enabled = true;
+
+	if (p2p_persistent_groups_enabled)
+		p2p_persistent_groups_load();
+
 	return 0;
 }
 
@@ -5187,6 +5953,8 @@ static void p2p_exit(void)
 	p2p_device_list = NULL;
 	l_settings_free(p2p_dhcp_settings);
 	p2p_dhcp_settings = NULL;
+	l_queue_destroy(p2p_persistent_groups, p2p_persistent_group_free);
+	p2p_persistent_groups = NULL;
 }
 
 IWD_MODULE(p2p, p2p_init, p2p_exit)
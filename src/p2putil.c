@@ -846,6 +846,161 @@ int p2p_parse_probe_resp(const uint8_t *pdu, size_t len,
 	return r;
 }
 
+/* Section 4.1.15 without the Secondary Device Type List */
+static bool extract_p2p_device_info_view(const uint8_t *attr, size_t len,
+					struct p2p_device_info_attr *out)
+{
+	struct wsc_primary_device_type device_type;
+	int name_len;
+	int i;
+	int types_num;
+
+	if (len < 21)
+		return false;
+
+	if (wsc_parse_primary_device_type(attr + 8, 8,
+					&out->primary_device_type) < 0)
+		return false;
+
+	types_num = attr[16];
+	if (len < 17u + types_num * 8 + 4)
+		return false;
+
+	if (l_get_be16(attr + 17 + types_num * 8) != WSC_ATTR_DEVICE_NAME)
+		return false;
+
+	name_len = l_get_be16(attr + 17 + types_num * 8 + 2);
+	if (len < 17u + types_num * 8 + 4 + name_len || name_len > 32)
+		return false;
+
+	for (i = 0; i < types_num; i++)
+		if (wsc_parse_primary_device_type(attr + 17 + i * 8, 8,
+							&device_type) < 0)
+			return false;
+
+	memcpy(out->device_addr, attr + 0, 6);
+	out->wsc_config_methods = l_get_be16(attr + 6);
+	memcpy(out->device_name, attr + 17 + types_num * 8 + 4, name_len);
+	out->device_name[name_len] = '\0';
+
+	return true;
+}
+
+/*
+ * Parse only the attributes used to track peers during discovery, for
+ * any of the Beacon, Probe Request or Probe Response frames, pointing
+ * the attribute iterator straight at the IE data.  Other attributes are
+ * skipped rather than rejected, the caller distinguishes the frame
+ * formats by which of the Device ID and Device Info are present.
+ *
+ * Only if the P2P IE is fragmented over multiple IEs (Section 8.2) do
+ * we fall back to copying the concatenated payload.
+ */
+int p2p_parse_discovery_info(const uint8_t *pdu, size_t len,
+				struct p2p_discovery_info *out)
+{
+	struct p2p_discovery_info d = {};
+	struct ie_tlv_iter ie_iter;
+	struct p2p_attr_iter iter;
+	const uint8_t *p2p_data = NULL;
+	size_t p2p_len = 0;
+	uint8_t *concat = NULL;
+	unsigned int p2p_ies = 0;
+	bool have_capability = false;
+	bool have_listen_channel = false;
+	bool have_operating_channel = false;
+	int r = 0;
+
+	ie_tlv_iter_init(&ie_iter, pdu, len);
+
+	while (ie_tlv_iter_next(&ie_iter)) {
+		const uint8_t *data = ie_tlv_iter_get_data(&ie_iter);
+		unsigned int ie_len = ie_tlv_iter_get_length(&ie_iter);
+
+		if (ie_tlv_iter_get_tag(&ie_iter) != IE_TYPE_VENDOR_SPECIFIC ||
+				ie_len < 4)
+			continue;
+
+		if (memcmp(data, wifi_alliance_oui, 3) || data[3] != 0x09)
+			continue;
+
+		p2p_data = data + 4;
+		p2p_len = ie_len - 4;
+		p2p_ies++;
+	}
+
+	if (!p2p_ies)
+		return -ENOENT;
+
+	if (p2p_ies > 1) {
+		ssize_t concat_len;
+
+		concat = ie_tlv_extract_p2p_payload(pdu, len, &concat_len);
+		if (concat_len < 0)
+			return concat_len;
+
+		p2p_data = concat;
+		p2p_len = concat_len;
+	}
+
+	p2p_attr_iter_init(&iter, p2p_data, p2p_len);
+
+	while (p2p_attr_iter_next(&iter)) {
+		const uint8_t *attr = p2p_attr_iter_get_data(&iter);
+		size_t attr_len = p2p_attr_iter_get_length(&iter);
+		bool *have;
+		bool ok;
+
+		switch (p2p_attr_iter_get_type(&iter)) {
+		case P2P_ATTR_P2P_CAPABILITY:
+			have = &have_capability;
+			ok = extract_p2p_capability(attr, attr_len,
+							&d.capability);
+			break;
+		case P2P_ATTR_P2P_DEVICE_ID:
+			have = &d.have_device_id;
+			ok = extract_p2p_addr(attr, attr_len, d.device_id);
+			break;
+		case P2P_ATTR_P2P_DEVICE_INFO:
+			have = &d.have_device_info;
+			ok = extract_p2p_device_info_view(attr, attr_len,
+							&d.device_info);
+			break;
+		case P2P_ATTR_LISTEN_CHANNEL:
+			have = &have_listen_channel;
+			ok = extract_p2p_channel(attr, attr_len,
+							&d.listen_channel);
+			break;
+		case P2P_ATTR_OPERATING_CHANNEL:
+			have = &have_operating_channel;
+			ok = extract_p2p_channel(attr, attr_len,
+							&d.operating_channel);
+			break;
+		default:
+			continue;
+		}
+
+		if (*have || !ok) {
+			r = -EBADMSG;
+			goto done;
+		}
+
+		*have = true;
+	}
+
+	/* The P2P Capability attribute is required in all three frames */
+	if (!have_capability) {
+		r = -EINVAL;
+		goto done;
+	}
+
+	memcpy(out, &d, sizeof(d));
+
+done:
+	l_free(concat);
+	return r;
+}
+
 /* Section 4.2.4 */
 int p2p_parse_association_req(const uint8_t *pdu, size_t len,
 				struct p2p_association_req *out)
@@ -344,6 +344,22 @@ struct p2p_probe_resp {
 	struct l_queue *advertised_svcs;
 };
 
+/*
+ * The subset of the Beacon, Probe Request and Probe Response P2P IE
+ * attributes needed to track peers during discovery.  Filled in by
+ * p2p_parse_discovery_info() without allocating, device_info's
+ * secondary_device_types is always NULL.
+ */
+struct p2p_discovery_info {
+	struct p2p_capability_attr capability;
+	uint8_t device_id[6];
+	struct p2p_device_info_attr device_info;
+	struct p2p_channel_attr listen_channel;
+	struct p2p_channel_attr operating_channel;
+	bool have_device_id;
+	bool have_device_info;
+};
+
 struct p2p_association_req {
 	struct p2p_capability_attr capability;
 	struct p2p_extended_listen_timing_attr listen_availability;
@@ -509,6 +525,8 @@ int p2p_parse_probe_req(const uint8_t *pdu, size_t len,
 			struct p2p_probe_req *out);
 int p2p_parse_probe_resp(const uint8_t *pdu, size_t len,
 				struct p2p_probe_resp *out);
+int p2p_parse_discovery_info(const uint8_t *pdu, size_t len,
+				struct p2p_discovery_info *out);
 int p2p_parse_association_req(const uint8_t *pdu, size_t len,
 				struct p2p_association_req *out);
 int p2p_parse_association_resp(const uint8_t *pdu, size_t len,
@@ -0,0 +1,315 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <ell/ell.h>
+
+#include "ell/useful.h"
+#include "src/missing.h"
+#include "src/module.h"
+#include "src/ie.h"
+#include "src/crypto.h"
+#include "src/pmksa.h"
+
+/* dot11RSNAConfigPMKLifetime default, 43200 seconds */
+#define PMKSA_DEFAULT_LIFETIME_US (43200ULL * L_USEC_PER_SEC)
+#define PMKSA_CACHE_SIZE 64
+
+/* Kept sorted by expiration time, soonest first */
+static struct l_queue *cache;
+static struct l_timeout *expire_timeout;
+
+static pmksa_cache_add_func_t driver_add;
+static pmksa_cache_remove_func_t driver_remove;
+static pmksa_cache_flush_func_t driver_flush;
+
+void pmksa_free(struct pmksa *pmksa)
+{
+	explicit_bzero(pmksa, sizeof(*pmksa));
+	l_free(pmksa);
+}
+
+static void pmksa_free_entry(void *data)
+{
+	pmksa_free(data);
+}
+
+static void pmksa_cache_entry_destroy(void *data)
+{
+	struct pmksa *pmksa = data;
+
+	if (driver_remove)
+		driver_remove(pmksa);
+
+	pmksa_free(pmksa);
+}
+
+static int pmksa_expiration_compare(const void *a, const void *b,
+					void *user_data)
+{
+	const struct pmksa *new = a;
+	const struct pmksa *cur = b;
+
+	return new->expiration < cur->expiration ? -1 : 1;
+}
+
+static void pmksa_expire_timeout(struct l_timeout *timeout, void *user_data);
+
+static void pmksa_expire_timeout_rearm(void)
+{
+	const struct pmksa *head = l_queue_peek_head(cache);
+	uint64_t now = l_time_now();
+	uint64_t delay_ms;
+
+	if (!head) {
+		l_timeout_remove(expire_timeout);
+		expire_timeout = NULL;
+		return;
+	}
+
+	if (l_time_after(head->expiration, now))
+		delay_ms = l_time_diff(now, head->expiration) /
+				L_USEC_PER_MSEC + 1;
+	else
+		delay_ms = 1;
+
+	if (expire_timeout)
+		l_timeout_modify_ms(expire_timeout, delay_ms);
+	else
+		expire_timeout = l_timeout_create_ms(delay_ms,
+							pmksa_expire_timeout,
+							NULL, NULL);
+}
+
+static void pmksa_expire_timeout(struct l_timeout *timeout, void *user_data)
+{
+	pmksa_cache_expire(l_time_now());
+}
+
+/*
+ * Looks up the PMKSA for the given supplicant / authenticator pair, SSID and
+ * one of the AKMs in @akm.  On success the entry is removed from the cache
+ * and returned to the caller, who should either hand it back with
+ * pmksa_cache_put() once it has been used successfully or free it with
+ * pmksa_free().
+ */
+struct pmksa *pmksa_cache_get(const uint8_t spa[static 6],
+				const uint8_t aa[static 6],
+				const uint8_t *ssid, size_t ssid_len,
+				uint32_t akm)
+{
+	const struct l_queue_entry *entry;
+	uint64_t now = l_time_now();
+
+	for (entry = l_queue_get_entries(cache); entry; entry = entry->next) {
+		struct pmksa *pmksa = entry->data;
+
+		if (!l_time_after(pmksa->expiration, now))
+			continue;
+
+		if (memcmp(pmksa->spa, spa, 6) || memcmp(pmksa->aa, aa, 6))
+			continue;
+
+		if (pmksa->ssid_len != ssid_len ||
+				memcmp(pmksa->ssid, ssid, ssid_len))
+			continue;
+
+		if (!(pmksa->akm & akm))
+			continue;
+
+		/*
+		 * The driver copy is left in place, fullmac devices need it
+		 * for the upcoming connection
+		 */
+		l_queue_remove(cache, pmksa);
+		pmksa_expire_timeout_rearm();
+
+		return pmksa;
+	}
+
+	return NULL;
+}
+
+/*
+ * Opportunistic Key Caching: with 802.1X the PMK is not bound to the BSS
+ * it was established with, so an ESS whose APs share the PMKSAs can accept
+ * it from any of its BSSes.  Looks up a PMKSA for the same supplicant, SSID
+ * and one of the AKMs in @akm established with any other BSS and returns a
+ * copy of it bound to @aa, with the PMKID recalculated for the new
+ * authenticator address.  Unlike pmksa_cache_get() the cache is left
+ * untouched, the copy is owned by the caller.
+ */
+struct pmksa *pmksa_cache_derive(const uint8_t spa[static 6],
+					const uint8_t aa[static 6],
+					const uint8_t *ssid, size_t ssid_len,
+					uint32_t akm)
+{
+	const struct l_queue_entry *entry;
+	const struct pmksa *best = NULL;
+	uint64_t now = l_time_now();
+	struct pmksa *pmksa;
+	bool use_sha256;
+
+	akm &= IE_RSN_AKM_SUITE_8021X | IE_RSN_AKM_SUITE_8021X_SHA256;
+
+	for (entry = l_queue_get_entries(cache); entry; entry = entry->next) {
+		const struct pmksa *cur = entry->data;
+
+		if (!l_time_after(cur->expiration, now))
+			continue;
+
+		if (memcmp(cur->spa, spa, 6) || !memcmp(cur->aa, aa, 6))
+			continue;
+
+		if (cur->ssid_len != ssid_len ||
+				memcmp(cur->ssid, ssid, ssid_len))
+			continue;
+
+		if (!(cur->akm & akm))
+			continue;
+
+		/* The cache is sorted by expiration, keep the newest match */
+		best = cur;
+	}
+
+	if (!best)
+		return NULL;
+
+	pmksa = l_memdup(best, sizeof(*best));
+	memcpy(pmksa->aa, aa, 6);
+	use_sha256 = pmksa->akm & IE_RSN_AKM_SUITE_8021X_SHA256;
+
+	if (!crypto_derive_pmkid(pmksa->pmk, pmksa->spa, pmksa->aa,
+					pmksa->pmkid, use_sha256)) {
+		pmksa_free(pmksa);
+		return NULL;
+	}
+
+	return pmksa;
+}
+
+static bool pmksa_match_key(const void *a, const void *b)
+{
+	const struct pmksa *cur = a;
+	const struct pmksa *new = b;
+
+	return !memcmp(cur->spa, new->spa, 6) &&
+		!memcmp(cur->aa, new->aa, 6) &&
+		cur->ssid_len == new->ssid_len &&
+		!memcmp(cur->ssid, new->ssid, cur->ssid_len) &&
+		cur->akm == new->akm;
+}
+
+/*
+ * Inserts @pmksa into the cache, taking ownership.  Any existing entry for
+ * the same BSSID, SSID and AKM is replaced.  If the cache is full, the entry
+ * closest to expiring is dropped.
+ */
+int pmksa_cache_put(struct pmksa *pmksa)
+{
+	struct pmksa *old;
+
+	if (!cache)
+		cache = l_queue_new();
+
+	old = l_queue_remove_if(cache, pmksa_match_key, pmksa);
+	if (old)
+		pmksa_cache_entry_destroy(old);
+
+	if (l_queue_length(cache) >= PMKSA_CACHE_SIZE)
+		pmksa_cache_entry_destroy(l_queue_pop_head(cache));
+
+	l_queue_insert(cache, pmksa, pmksa_expiration_compare, NULL);
+
+	if (driver_add)
+		driver_add(pmksa);
+
+	pmksa_expire_timeout_rearm();
+
+	return 0;
+}
+
+/* Removes all entries expiring at or before @cutoff */
+int pmksa_cache_expire(uint64_t cutoff)
+{
+	struct pmksa *pmksa;
+	int n = 0;
+
+	while ((pmksa = l_queue_peek_head(cache)) &&
+			!l_time_after(pmksa->expiration, cutoff)) {
+		l_queue_pop_head(cache);
+		pmksa_cache_entry_destroy(pmksa);
+		n += 1;
+	}
+
+	pmksa_expire_timeout_rearm();
+
+	return n;
+}
+
+static void pmksa_cache_destroy(void)
+{
+	l_timeout_remove(expire_timeout);
+	expire_timeout = NULL;
+
+	l_queue_destroy(cache, pmksa_free_entry);
+	cache = NULL;
+}
+
+int pmksa_cache_flush(void)
+{
+	pmksa_cache_destroy();
+
+	if (driver_flush)
+		driver_flush();
+
+	return 0;
+}
+
+uint64_t pmksa_lifetime(void)
+{
+	return PMKSA_DEFAULT_LIFETIME_US;
+}
+
+void __pmksa_set_driver_callbacks(pmksa_cache_add_func_t add,
+					pmksa_cache_remove_func_t remove,
+					pmksa_cache_flush_func_t flush)
+{
+	driver_add = add;
+	driver_remove = remove;
+	driver_flush = flush;
+}
+
+static int pmksa_init(void)
+{
+	return 0;
+}
+
+static void pmksa_exit(void)
+{
+	pmksa_cache_destroy();
+}
+
+IWD_MODULE(pmksa, pmksa_init, pmksa_exit)
@@ -0,0 +1,244 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <inttypes.h>
+
+#include <ell/ell.h>
+
+#include "src/module.h"
+#include "src/profile.h"
+
+#define PROFILE_DEFAULT_THRESHOLD_MS	20
+#define PROFILE_TICK_MS			100
+
+bool profile_enabled;
+
+static struct profile_site *sites;
+static unsigned int n_sites;
+static uint64_t threshold_us;
+
+/* Main loop responsiveness, sampled through a periodic timeout */
+static struct l_timeout *tick;
+static uint64_t tick_last;
+static uint64_t stall_count;
+static uint64_t stall_max_us;
+static uint32_t stall_buckets[PROFILE_BUCKETS];
+
+/* The longest callback run since the last tick */
+static struct profile_site *window_site;
+static uint64_t window_us;
+
+static struct l_signal *report_signal;
+
+static void profile_bucket_add(uint32_t *buckets, uint64_t us)
+{
+	static const uint32_t bounds[] = { PROFILE_BOUNDS };
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(bounds); i++)
+		if (us < bounds[i])
+			break;
+
+	buckets[i]++;
+}
+
+void profile_site_record(struct profile_site *site, uint64_t start)
+{
+	uint64_t us = l_time_diff(start, l_time_now());
+
+	if (!site->calls++) {
+		site->next = sites;
+		sites = site;
+		n_sites++;
+	}
+
+	site->total_us += us;
+
+	if (us > site->max_us)
+		site->max_us = us;
+
+	profile_bucket_add(site->buckets, us);
+
+	if (us > window_us) {
+		window_us = us;
+		window_site = site;
+	}
+
+	if (us >= threshold_us)
+		l_warn("profile: slow callback %s took %" PRIu64 " us",
+			site->name, us);
+}
+
+static void profile_tick(struct l_timeout *timeout, void *user_data)
+{
+	uint64_t now = l_time_now();
+	uint64_t elapsed = l_time_diff(tick_last, now);
+	uint64_t late_us = 0;
+
+	if (elapsed > PROFILE_TICK_MS * L_USEC_PER_MSEC)
+		late_us = elapsed - PROFILE_TICK_MS * L_USEC_PER_MSEC;
+
+	profile_bucket_add(stall_buckets, late_us);
+
+	if (late_us >= threshold_us) {
+		stall_count++;
+
+		if (late_us > stall_max_us)
+			stall_max_us = late_us;
+
+		l_warn("profile: main loop stalled for %" PRIu64 " us, "
+			"longest callback %s (%" PRIu64 " us)", late_us,
+			window_site ? window_site->name : "(none)",
+			window_us);
+	}
+
+	window_site = NULL;
+	window_us = 0;
+	tick_last = now;
+	l_timeout_modify_ms(timeout, PROFILE_TICK_MS);
+}
+
+static void profile_format_buckets(const uint32_t *buckets, char *buf,
+					size_t len)
+{
+	static const uint32_t bounds[] = { PROFILE_BOUNDS };
+	size_t pos = 0;
+	unsigned int i;
+
+	for (i = 0; i < PROFILE_BUCKETS && pos < len; i++) {
+		if (i < L_ARRAY_SIZE(bounds))
+			pos += snprintf(buf + pos, len - pos, " <%u:%u",
+					bounds[i], buckets[i]);
+		else
+			pos += snprintf(buf + pos, len - pos, " >=%u:%u",
+					bounds[i - 1], buckets[i]);
+	}
+}
+
+static int profile_site_compare(const void *a, const void *b)
+{
+	const struct profile_site *sa = *(const struct profile_site **) a;
+	const struct profile_site *sb = *(const struct profile_site **) b;
+
+	if (sa->max_us != sb->max_us)
+		return sa->max_us < sb->max_us ? 1 : -1;
+
+	return 0;
+}
+
+/*
+ * Logs every callback seen so far, slowest first, with its histogram in
+ * us followed by the main loop stall histogram.
+ */
+static void profile_report(void)
+{
+	_auto_(l_free) struct profile_site **sorted = NULL;
+	struct profile_site *site;
+	char buf[256];
+	unsigned int i = 0;
+
+	l_info("profile: %u callbacks seen, %" PRIu64 " loop stalls over "
+		"%" PRIu64 " us, longest %" PRIu64 " us", n_sites,
+		stall_count, threshold_us, stall_max_us);
+
+	profile_format_buckets(stall_buckets, buf, sizeof(buf));
+	l_info("profile: loop latency us%s", buf);
+
+	if (!n_sites)
+		return;
+
+	sorted = l_new(struct profile_site *, n_sites);
+
+	for (site = sites; site; site = site->next)
+		sorted[i++] = site;
+
+	qsort(sorted, n_sites, sizeof(*sorted), profile_site_compare);
+
+	for (i = 0; i < n_sites; i++) {
+		site = sorted[i];
+
+		l_info("profile: %s calls %" PRIu64 " total %" PRIu64
+			" us mean %" PRIu64 " us max %" PRIu64 " us",
+			site->name, site->calls, site->total_us,
+			site->total_us / site->calls, site->max_us);
+
+		profile_format_buckets(site->buckets, buf, sizeof(buf));
+		l_info("profile: %s us%s", site->name, buf);
+	}
+}
+
+static void report_signal_cb(void *user_data)
+{
+	profile_report();
+}
+
+static int profile_init(void)
+{
+	const char *env = getenv("IWD_PROFILE");
+	unsigned long threshold_ms;
+
+	if (!env)
+		return 0;
+
+	threshold_ms = strtoul(env, NULL, 10);
+	if (!threshold_ms)
+		threshold_ms = PROFILE_DEFAULT_THRESHOLD_MS;
+
+	threshold_us = threshold_ms * L_USEC_PER_MSEC;
+
+	tick = l_timeout_create_ms(PROFILE_TICK_MS, profile_tick, NULL, NULL);
+	tick_last = l_time_now();
+
+	report_signal = l_signal_create(SIGUSR2, report_signal_cb, NULL,
+					NULL);
+
+	profile_enabled = true;
+
+	l_info("profile: enabled, threshold %lu ms", threshold_ms);
+
+	return 0;
+}
+
+static void profile_exit(void)
+{
+	if (!profile_enabled)
+		return;
+
+	profile_report();
+
+	profile_enabled = false;
+
+	l_timeout_remove(tick);
+	tick = NULL;
+
+	l_signal_remove(report_signal);
+	report_signal = NULL;
+}
+
+IWD_MODULE(profile, profile_init, profile_exit)
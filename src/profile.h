@@ -0,0 +1,74 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Upper bounds in us, the last bucket counts everything above */
+#define PROFILE_BOUNDS 10, 50, 100, 500, 1000, 5000, 10000, 50000, 100000
+#define PROFILE_BUCKETS 10
+
+struct profile_site {
+	const char *name;
+	uint64_t calls;
+	uint64_t total_us;
+	uint64_t max_us;
+	uint32_t buckets[PROFILE_BUCKETS];
+	struct profile_site *next;
+};
+
+struct profile_scope {
+	struct profile_site *site;
+	uint64_t start;
+};
+
+extern bool profile_enabled;
+
+void profile_site_record(struct profile_site *site, uint64_t start);
+
+static inline struct profile_scope profile_scope_begin(
+						struct profile_site *site)
+{
+	struct profile_scope scope = { NULL, 0 };
+
+	if (profile_enabled) {
+		scope.site = site;
+		scope.start = l_time_now();
+	}
+
+	return scope;
+}
+
+static inline void profile_scope_end(struct profile_scope *scope)
+{
+	if (scope->site)
+		profile_site_record(scope->site, scope->start);
+}
+
+/*
+ * Placed at the end of a callback's declarations, times the rest of the
+ * function under the function's name.  Nested profiled callbacks are
+ * included in the outer one's time.  Costs a single branch unless iwd
+ * was started with IWD_PROFILE.
+ */
+#define PROFILE_CALLBACK()						\
+	static struct profile_site __profile_site = { .name = __func__ };\
+	struct profile_scope __profile_scope				\
+		__attribute__((cleanup(profile_scope_end))) =		\
+				profile_scope_begin(&__profile_site)
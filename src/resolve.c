@@ -37,6 +37,7 @@
 #include "src/dbus.h"
 #include "src/netconfig.h"
 #include "src/resolve.h"
+#include "src/storage.h"
 
 struct resolve_ops {
 	void (*set_dns)(struct resolve *resolve, char **dns_list);
@@ -116,13 +117,36 @@ struct resolve_method_ops {
 
 struct systemd_method_state {
 	uint32_t service_watch;
+	unsigned int generation;
 	bool is_ready:1;
+	bool no_default_route:1;
 };
 
 struct systemd_method_state systemd_state;
 
+/*
+ * The DNS servers, the search domains and the default route flag of a
+ * link are sent together from an idle callback so that all the changes
+ * made while netconfig processes one event go out as one batch.  Each of
+ * the calls is skipped if its payload is the same as that of the last
+ * call that didn't fail.
+ */
+struct systemd_call {
+	struct systemd *sd;
+	const char *type;
+	uint32_t serial;
+	char *sent;
+};
+
 struct systemd {
 	struct resolve super;
+	char **dns_list;
+	char **domain_list;
+	unsigned int generation;
+	struct systemd_call dns_call;
+	struct systemd_call domains_call;
+	struct systemd_call default_route_call;
+	struct l_idle *update_idle;
 };
 
 static void systemd_link_generic_reply(struct l_dbus_message *message,
@@ -139,6 +163,58 @@ static void systemd_link_generic_reply(struct l_dbus_message *message,
 							type, name, text);
 }
 
+static void systemd_call_reply(struct l_dbus_message *message,
+				void *user_data)
+{
+	struct systemd_call *call = user_data;
+	const char *name;
+	const char *text;
+
+	call->serial = 0;
+
+	if (!l_dbus_message_get_error(message, &name, &text))
+		return;
+
+	/* Resend on the next update */
+	l_free(l_steal_ptr(call->sent));
+
+	if (call == &call->sd->default_route_call && !strcmp(name,
+				"org.freedesktop.DBus.Error.UnknownMethod")) {
+		l_debug("SetLinkDefaultRoute not supported");
+		systemd_state.no_default_route = true;
+		return;
+	}
+
+	l_error("resolve-systemd: Failed to modify the %s entries. %s: %s",
+						call->type, name, text);
+}
+
+static void systemd_call_cancel(struct systemd_call *call)
+{
+	if (call->serial) {
+		l_dbus_cancel(dbus_get_bus(), call->serial);
+		call->serial = 0;
+	}
+
+	l_free(l_steal_ptr(call->sent));
+}
+
+static void systemd_call_send(struct systemd_call *call,
+				struct l_dbus_message *message, char *payload)
+{
+	if (call->serial)
+		l_dbus_cancel(dbus_get_bus(), call->serial);
+
+	call->serial = l_dbus_send_with_reply(dbus_get_bus(), message,
+						systemd_call_reply, call, NULL);
+
+	l_free(call->sent);
+	call->sent = payload;
+
+	if (!call->serial)
+		l_free(l_steal_ptr(call->sent));
+}
+
 static bool systemd_builder_add_dns(struct l_dbus_message_builder *builder,
 							const char *dns)
 {
@@ -169,16 +245,12 @@ static bool systemd_builder_add_dns(struct l_dbus_message_builder *builder,
 	return true;
 }
 
-static void resolve_systemd_set_dns(struct resolve *resolve, char **dns_list)
+static struct l_dbus_message *systemd_build_dns(uint32_t ifindex,
+							char **dns_list)
 {
 	struct l_dbus_message_builder *builder;
 	struct l_dbus_message *message;
 
-	l_debug("ifindex: %u", resolve->ifindex);
-
-	if (L_WARN_ON(!systemd_state.is_ready))
-		return;
-
 	message = l_dbus_message_new_method_call(dbus_get_bus(),
 					SYSTEMD_RESOLVED_SERVICE,
 					SYSTEMD_RESOLVED_MANAGER_PATH,
@@ -186,15 +258,15 @@ static void resolve_systemd_set_dns(struct resolve *resolve, char **dns_list)
 					"SetLinkDNS");
 
 	if (!message)
-		return;
+		return NULL;
 
 	builder = l_dbus_message_builder_new(message);
 	if (!builder) {
 		l_dbus_message_unref(message);
-		return;
+		return NULL;
 	}
 
-	l_dbus_message_builder_append_basic(builder, 'i', &resolve->ifindex);
+	l_dbus_message_builder_append_basic(builder, 'i', &ifindex);
 
 	l_dbus_message_builder_enter_array(builder, "(iay)");
 
@@ -209,7 +281,7 @@ static void resolve_systemd_set_dns(struct resolve *resolve, char **dns_list)
 		l_dbus_message_builder_destroy(builder);
 		l_dbus_message_unref(message);
 
-		return;
+		return NULL;
 	}
 
 	l_dbus_message_builder_leave_array(builder);
@@ -217,22 +289,16 @@ static void resolve_systemd_set_dns(struct resolve *resolve, char **dns_list)
 	l_dbus_message_builder_finalize(builder);
 	l_dbus_message_builder_destroy(builder);
 
-	l_dbus_send_with_reply(dbus_get_bus(), message,
-				systemd_link_generic_reply, "DNS", NULL);
+	return message;
 }
 
-static void resolve_systemd_set_domains(struct resolve *resolve,
-						char **domain_list)
+static struct l_dbus_message *systemd_build_domains(uint32_t ifindex,
+							char **domain_list)
 {
 	struct l_dbus_message *message;
 	struct l_dbus_message_builder *builder;
 	bool f = false;
 
-	l_debug("ifindex: %u", resolve->ifindex);
-
-	if (L_WARN_ON(!systemd_state.is_ready))
-		return;
-
 	message = l_dbus_message_new_method_call(dbus_get_bus(),
 					SYSTEMD_RESOLVED_SERVICE,
 					SYSTEMD_RESOLVED_MANAGER_PATH,
@@ -240,15 +306,15 @@ static void resolve_systemd_set_domains(struct resolve *resolve,
 					"SetLinkDomains");
 
 	if (!message)
-		return;
+		return NULL;
 
 	builder = l_dbus_message_builder_new(message);
 	if (!builder) {
 		l_dbus_message_unref(message);
-		return;
+		return NULL;
 	}
 
-	l_dbus_message_builder_append_basic(builder, 'i', &resolve->ifindex);
+	l_dbus_message_builder_append_basic(builder, 'i', &ifindex);
 	l_dbus_message_builder_enter_array(builder, "(sb)");
 
 	for (; *domain_list; domain_list++) {
@@ -263,8 +329,135 @@ static void resolve_systemd_set_domains(struct resolve *resolve,
 	l_dbus_message_builder_finalize(builder);
 	l_dbus_message_builder_destroy(builder);
 
-	l_dbus_send_with_reply(dbus_get_bus(), message,
-				systemd_link_generic_reply, "domains", NULL);
+	return message;
+}
+
+static void systemd_update_dns(struct systemd *sd)
+{
+	struct l_dbus_message *message;
+	char *payload;
+
+	if (!sd->dns_list)
+		return;
+
+	payload = l_strjoinv(sd->dns_list, ' ');
+
+	if (l_streq0(payload, sd->dns_call.sent)) {
+		l_free(payload);
+		return;
+	}
+
+	message = systemd_build_dns(sd->super.ifindex, sd->dns_list);
+	if (!message) {
+		l_free(payload);
+		return;
+	}
+
+	systemd_call_send(&sd->dns_call, message, payload);
+}
+
+static void systemd_update_domains(struct systemd *sd)
+{
+	struct l_dbus_message *message;
+	char *payload;
+
+	if (!sd->domain_list)
+		return;
+
+	payload = l_strjoinv(sd->domain_list, ' ');
+
+	if (l_streq0(payload, sd->domains_call.sent)) {
+		l_free(payload);
+		return;
+	}
+
+	message = systemd_build_domains(sd->super.ifindex, sd->domain_list);
+	if (!message) {
+		l_free(payload);
+		return;
+	}
+
+	systemd_call_send(&sd->domains_call, message, payload);
+}
+
+static void systemd_update_default_route(struct systemd *sd)
+{
+	struct l_dbus_message *message;
+
+	/* Only a link with DNS servers is used for the default route */
+	if (!sd->dns_list || systemd_state.no_default_route ||
+			sd->default_route_call.sent)
+		return;
+
+	message = l_dbus_message_new_method_call(dbus_get_bus(),
+					SYSTEMD_RESOLVED_SERVICE,
+					SYSTEMD_RESOLVED_MANAGER_PATH,
+					SYSTEMD_RESOLVED_MANAGER_INTERFACE,
+					"SetLinkDefaultRoute");
+	if (!message)
+		return;
+
+	l_dbus_message_set_arguments(message, "ib", sd->super.ifindex, true);
+	systemd_call_send(&sd->default_route_call, message, l_strdup("true"));
+}
+
+static void systemd_update(struct l_idle *idle, void *user_data)
+{
+	struct systemd *sd = user_data;
+
+	l_idle_remove(l_steal_ptr(sd->update_idle));
+
+	if (!systemd_state.is_ready)
+		return;
+
+	/* systemd-resolved was restarted, everything needs to be resent */
+	if (sd->generation != systemd_state.generation) {
+		systemd_call_cancel(&sd->dns_call);
+		systemd_call_cancel(&sd->domains_call);
+		systemd_call_cancel(&sd->default_route_call);
+		sd->generation = systemd_state.generation;
+	}
+
+	systemd_update_dns(sd);
+	systemd_update_domains(sd);
+	systemd_update_default_route(sd);
+}
+
+static void systemd_schedule_update(struct systemd *sd)
+{
+	if (sd->update_idle)
+		return;
+
+	sd->update_idle = l_idle_create(systemd_update, sd, NULL);
+}
+
+static void resolve_systemd_set_dns(struct resolve *resolve, char **dns_list)
+{
+	struct systemd *sd = l_container_of(resolve, struct systemd, super);
+
+	l_debug("ifindex: %u", resolve->ifindex);
+
+	if (L_WARN_ON(!systemd_state.is_ready))
+		return;
+
+	l_strv_free(sd->dns_list);
+	sd->dns_list = l_strv_copy(dns_list);
+	systemd_schedule_update(sd);
+}
+
+static void resolve_systemd_set_domains(struct resolve *resolve,
+						char **domain_list)
+{
+	struct systemd *sd = l_container_of(resolve, struct systemd, super);
+
+	l_debug("ifindex: %u", resolve->ifindex);
+
+	if (L_WARN_ON(!systemd_state.is_ready))
+		return;
+
+	l_strv_free(sd->domain_list);
+	sd->domain_list = l_strv_copy(domain_list);
+	systemd_schedule_update(sd);
 }
 
 static void resolve_systemd_set_mdns(struct resolve *resolve, const char *mdns)
@@ -291,12 +484,25 @@ static void resolve_systemd_set_mdns(struct resolve *resolve, const char *mdns)
 				"MulticastDNS", NULL);
 }
 
+static void systemd_link_reset(struct systemd *sd)
+{
+	l_idle_remove(l_steal_ptr(sd->update_idle));
+	systemd_call_cancel(&sd->dns_call);
+	systemd_call_cancel(&sd->domains_call);
+	systemd_call_cancel(&sd->default_route_call);
+	l_strv_free(l_steal_ptr(sd->dns_list));
+	l_strv_free(l_steal_ptr(sd->domain_list));
+}
+
 static void resolve_systemd_revert(struct resolve *resolve)
 {
+	struct systemd *sd = l_container_of(resolve, struct systemd, super);
 	struct l_dbus_message *message;
 
 	l_debug("ifindex: %u", resolve->ifindex);
 
+	systemd_link_reset(sd);
+
 	if (L_WARN_ON(!systemd_state.is_ready))
 		return;
 
@@ -317,6 +523,7 @@ static void resolve_systemd_destroy(struct resolve *resolve)
 {
 	struct systemd *sd = l_container_of(resolve, struct systemd, super);
 
+	systemd_link_reset(sd);
 	l_free(sd);
 }
 
@@ -331,6 +538,8 @@ static const struct resolve_ops systemd_ops = {
 static void systemd_appeared(struct l_dbus *dbus, void *user_data)
 {
 	systemd_state.is_ready = true;
+	systemd_state.no_default_route = false;
+	systemd_state.generation++;
 }
 
 static void systemd_disappeared(struct l_dbus *dbus, void *user_data)
@@ -361,6 +570,13 @@ static struct resolve *resolve_systemd_alloc(uint32_t ifindex)
 	struct systemd *sd = l_new(struct systemd, 1);
 
 	_resolve_init(&sd->super, ifindex, &systemd_ops);
+	sd->generation = systemd_state.generation;
+	sd->dns_call.sd = sd;
+	sd->dns_call.type = "DNS";
+	sd->domains_call.sd = sd;
+	sd->domains_call.type = "domains";
+	sd->default_route_call.sd = sd;
+	sd->default_route_call.type = "default route";
 
 	return &sd->super;
 }
@@ -411,70 +627,116 @@ static bool resolvconf_invoke(const char *ifname, const char *type,
 	return !error;
 }
 
+/*
+ * Changes to the DNS servers and the search domains of a link tend to come
+ * in bursts, e.g. during a DHCP exchange or a roam, so they're recorded
+ * and only applied once no further change arrived for
+ * RESOLVCONF_UPDATE_DELAY_MS.  Both the resolvconf and the file backends
+ * then compare the result against what was last applied and skip the
+ * update if nothing changed.
+ */
+#define RESOLVCONF_UPDATE_DELAY_MS	100
+
 struct resolvconf {
 	struct resolve super;
-	bool have_domain : 1;
-	bool have_dns : 1;
 	char *ifname;
+	char **dns_list;
+	char **domain_list;
+	char *applied_dns;
+	char *applied_domain;
+	struct l_timeout *update_timeout;
 };
 
-static void resolve_resolvconf_set_dns(struct resolve *resolve, char **dns_list)
+static char *resolvconf_format(char **list, const char *prefix)
 {
-	struct resolvconf *rc =
-			l_container_of(resolve, struct resolvconf, super);
 	struct l_string *content;
-	L_AUTO_FREE_VAR(char *, str) = NULL;
 
-	if (L_WARN_ON(!resolvconf_path))
-		return;
+	if (!list || !list[0])
+		return NULL;
+
+	content = l_string_new(0);
+
+	for (; *list; list++)
+		l_string_append_printf(content, "%s %s\n", prefix, *list);
 
-	if (!dns_list || !dns_list[0]) {
-		if (rc->have_dns)
-			resolvconf_invoke(rc->ifname, "dns", NULL);
+	return l_string_unwrap(content);
+}
 
-		rc->have_dns = false;
+static void resolvconf_set_list(char ***dst, char **list)
+{
+	l_strv_free(*dst);
+	*dst = list && list[0] ? l_strv_copy(list) : NULL;
+}
+
+static void resolvconf_apply(struct resolvconf *rc, const char *type,
+				char **list, const char *prefix,
+				char **applied)
+{
+	L_AUTO_FREE_VAR(char *, str) = resolvconf_format(list, prefix);
+
+	if (l_streq0(str, *applied))
+		return;
+
+	if (!str) {
+		resolvconf_invoke(rc->ifname, type, NULL);
+		l_free(l_steal_ptr(*applied));
 		return;
 	}
 
-	content = l_string_new(0);
+	if (resolvconf_invoke(rc->ifname, type, str)) {
+		l_free(*applied);
+		*applied = l_steal_ptr(str);
+	}
+}
 
-	for (; *dns_list; dns_list++)
-		l_string_append_printf(content, "nameserver %s\n", *dns_list);
+static void resolvconf_update_cb(struct l_timeout *timeout, void *user_data)
+{
+	struct resolvconf *rc = user_data;
 
-	str = l_string_unwrap(content);
+	l_timeout_remove(l_steal_ptr(rc->update_timeout));
 
-	if (resolvconf_invoke(rc->ifname, "dns", str))
-		rc->have_dns = true;
+	resolvconf_apply(rc, "dns", rc->dns_list, "nameserver",
+				&rc->applied_dns);
+	resolvconf_apply(rc, "domain", rc->domain_list, "search",
+				&rc->applied_domain);
 }
 
-static void resolve_resolvconf_set_domains(struct resolve *resolve,
-							char **domain_list)
+static void resolvconf_schedule_update(struct resolvconf *rc)
+{
+	if (rc->update_timeout) {
+		l_timeout_modify_ms(rc->update_timeout,
+					RESOLVCONF_UPDATE_DELAY_MS);
+		return;
+	}
+
+	rc->update_timeout = l_timeout_create_ms(RESOLVCONF_UPDATE_DELAY_MS,
+							resolvconf_update_cb,
+							rc, NULL);
+}
+
+static void resolve_resolvconf_set_dns(struct resolve *resolve, char **dns_list)
 {
 	struct resolvconf *rc =
 			l_container_of(resolve, struct resolvconf, super);
-	struct l_string *content;
-	L_AUTO_FREE_VAR(char *, str) = NULL;
 
 	if (L_WARN_ON(!resolvconf_path))
 		return;
 
-	if (!domain_list || !domain_list[0]) {
-		if (rc->have_domain)
-			resolvconf_invoke(rc->ifname, "domain", NULL);
-
-		rc->have_domain = false;
-		return;
-	}
-
-	content = l_string_new(0);
+	resolvconf_set_list(&rc->dns_list, dns_list);
+	resolvconf_schedule_update(rc);
+}
 
-	for (; *domain_list; domain_list++)
-		l_string_append_printf(content, "search %s\n", *domain_list);
+static void resolve_resolvconf_set_domains(struct resolve *resolve,
+							char **domain_list)
+{
+	struct resolvconf *rc =
+			l_container_of(resolve, struct resolvconf, super);
 
-	str = l_string_unwrap(content);
+	if (L_WARN_ON(!resolvconf_path))
+		return;
 
-	if (resolvconf_invoke(rc->ifname, "domain", str))
-		rc->have_domain = true;
+	resolvconf_set_list(&rc->domain_list, domain_list);
+	resolvconf_schedule_update(rc);
 }
 
 static void resolve_resolvconf_revert(struct resolve *resolve)
@@ -482,14 +744,29 @@ static void resolve_resolvconf_revert(struct resolve *resolve)
 	struct resolvconf *rc =
 			l_container_of(resolve, struct resolvconf, super);
 
-	if (rc->have_dns)
+	l_timeout_remove(l_steal_ptr(rc->update_timeout));
+	resolvconf_set_list(&rc->dns_list, NULL);
+	resolvconf_set_list(&rc->domain_list, NULL);
+
+	if (rc->applied_dns)
 		resolvconf_invoke(rc->ifname, "dns", NULL);
 
-	if (rc->have_domain)
+	if (rc->applied_domain)
 		resolvconf_invoke(rc->ifname, "domain", NULL);
 
-	rc->have_dns = false;
-	rc->have_domain = false;
+	l_free(l_steal_ptr(rc->applied_dns));
+	l_free(l_steal_ptr(rc->applied_domain));
+}
+
+static void resolvconf_free(struct resolvconf *rc)
+{
+	l_timeout_remove(rc->update_timeout);
+	l_strv_free(rc->dns_list);
+	l_strv_free(rc->domain_list);
+	l_free(rc->applied_dns);
+	l_free(rc->applied_domain);
+	l_free(rc->ifname);
+	l_free(rc);
 }
 
 static void resolve_resolvconf_destroy(struct resolve *resolve)
@@ -497,8 +774,7 @@ static void resolve_resolvconf_destroy(struct resolve *resolve)
 	struct resolvconf *rc =
 			l_container_of(resolve, struct resolvconf, super);
 
-	l_free(rc->ifname);
-	l_free(rc);
+	resolvconf_free(rc);
 }
 
 static struct resolve_ops resolvconf_ops = {
@@ -539,17 +815,23 @@ static void resolve_resolvconf_exit(void)
 	resolvconf_path = NULL;
 }
 
-static struct resolve *resolve_resolvconf_alloc(uint32_t ifindex)
+static struct resolvconf *resolvconf_new(uint32_t ifindex,
+						const struct resolve_ops *ops)
 {
 	struct resolvconf *rc = l_new(struct resolvconf, 1);
 
-	_resolve_init(&rc->super, ifindex, &resolvconf_ops);
+	_resolve_init(&rc->super, ifindex, ops);
 
 	rc->ifname = l_net_get_name(ifindex);
 	if (!rc->ifname)
 		rc->ifname = l_strdup_printf("%u", ifindex);
 
-	return &rc->super;
+	return rc;
+}
+
+static struct resolve *resolve_resolvconf_alloc(uint32_t ifindex)
+{
+	return &resolvconf_new(ifindex, &resolvconf_ops)->super;
 }
 
 static const struct resolve_method_ops resolve_method_resolvconf_ops = {
@@ -558,6 +840,196 @@ static const struct resolve_method_ops resolve_method_resolvconf_ops = {
 	.alloc = resolve_resolvconf_alloc,
 };
 
+/*
+ * The file backend writes the DNS configuration of all links directly to
+ * a resolv.conf(5) style file, [Network].ResolvConfFile, without
+ * spawning any helper.  The update of the whole file is coalesced the
+ * same way as the per-link resolvconf updates.
+ */
+#define RESOLV_CONF_DEFAULT_FILE	"/etc/resolv.conf"
+
+static char *resolvfile_path;
+static char *resolvfile_content;
+static struct l_queue *resolvfile_links;
+static struct l_timeout *resolvfile_timeout;
+
+static char *resolvfile_build(void)
+{
+	const struct l_queue_entry *entry;
+	struct l_string *content;
+	bool have_search = false;
+	bool empty = true;
+
+	content = l_string_new(256);
+	l_string_append(content, "# Generated by iwd\n");
+
+	for (entry = l_queue_get_entries(resolvfile_links); entry;
+			entry = entry->next) {
+		const struct resolvconf *rc = entry->data;
+		char **domain;
+
+		for (domain = rc->domain_list; domain && *domain; domain++) {
+			l_string_append(content, have_search ? " " : "search ");
+			l_string_append(content, *domain);
+			have_search = true;
+		}
+	}
+
+	if (have_search) {
+		l_string_append_c(content, '\n');
+		empty = false;
+	}
+
+	for (entry = l_queue_get_entries(resolvfile_links); entry;
+			entry = entry->next) {
+		const struct resolvconf *rc = entry->data;
+		char **dns;
+
+		for (dns = rc->dns_list; dns && *dns; dns++) {
+			l_string_append_printf(content, "nameserver %s\n",
+						*dns);
+			empty = false;
+		}
+	}
+
+	/* Don't touch the file until there's something to write */
+	if (empty && !resolvfile_content) {
+		l_free(l_string_unwrap(content));
+		return NULL;
+	}
+
+	return l_string_unwrap(content);
+}
+
+static void resolvfile_write(void)
+{
+	L_AUTO_FREE_VAR(char *, content) = resolvfile_build();
+
+	l_timeout_remove(l_steal_ptr(resolvfile_timeout));
+
+	if (!content || l_streq0(content, resolvfile_content))
+		return;
+
+	if (write_file(content, strlen(content), false, "%s",
+			resolvfile_path) < 0) {
+		l_error("resolve: Failed to write %s (%s).", resolvfile_path,
+				strerror(errno));
+		return;
+	}
+
+	l_free(resolvfile_content);
+	resolvfile_content = l_steal_ptr(content);
+}
+
+static void resolvfile_update_cb(struct l_timeout *timeout, void *user_data)
+{
+	resolvfile_write();
+}
+
+static void resolvfile_schedule_update(void)
+{
+	if (resolvfile_timeout) {
+		l_timeout_modify_ms(resolvfile_timeout,
+					RESOLVCONF_UPDATE_DELAY_MS);
+		return;
+	}
+
+	resolvfile_timeout = l_timeout_create_ms(RESOLVCONF_UPDATE_DELAY_MS,
+							resolvfile_update_cb,
+							NULL, NULL);
+}
+
+static void resolve_file_set_dns(struct resolve *resolve, char **dns_list)
+{
+	struct resolvconf *rc =
+			l_container_of(resolve, struct resolvconf, super);
+
+	resolvconf_set_list(&rc->dns_list, dns_list);
+	resolvfile_schedule_update();
+}
+
+static void resolve_file_set_domains(struct resolve *resolve,
+						char **domain_list)
+{
+	struct resolvconf *rc =
+			l_container_of(resolve, struct resolvconf, super);
+
+	resolvconf_set_list(&rc->domain_list, domain_list);
+	resolvfile_schedule_update();
+}
+
+static void resolve_file_revert(struct resolve *resolve)
+{
+	struct resolvconf *rc =
+			l_container_of(resolve, struct resolvconf, super);
+
+	if (!rc->dns_list && !rc->domain_list)
+		return;
+
+	resolvconf_set_list(&rc->dns_list, NULL);
+	resolvconf_set_list(&rc->domain_list, NULL);
+	resolvfile_schedule_update();
+}
+
+static void resolve_file_destroy(struct resolve *resolve)
+{
+	struct resolvconf *rc =
+			l_container_of(resolve, struct resolvconf, super);
+
+	if (rc->dns_list || rc->domain_list)
+		resolvfile_schedule_update();
+
+	l_queue_remove(resolvfile_links, rc);
+	resolvconf_free(rc);
+}
+
+static struct resolve_ops resolvfile_ops = {
+	.set_dns = resolve_file_set_dns,
+	.set_domains = resolve_file_set_domains,
+	.revert = resolve_file_revert,
+	.destroy = resolve_file_destroy,
+};
+
+static int resolve_file_init(void)
+{
+	const char *path = l_settings_get_value(iwd_get_config(), "Network",
+						"ResolvConfFile");
+
+	resolvfile_path = l_strdup(path ?: RESOLV_CONF_DEFAULT_FILE);
+	resolvfile_links = l_queue_new();
+
+	l_debug("Writing DNS configuration to %s", resolvfile_path);
+	return 0;
+}
+
+static void resolve_file_exit(void)
+{
+	if (resolvfile_timeout)
+		resolvfile_write();
+
+	l_queue_destroy(resolvfile_links, NULL);
+	resolvfile_links = NULL;
+	l_free(resolvfile_path);
+	resolvfile_path = NULL;
+	l_free(resolvfile_content);
+	resolvfile_content = NULL;
+}
+
+static struct resolve *resolve_file_alloc(uint32_t ifindex)
+{
+	struct resolvconf *rc = resolvconf_new(ifindex, &resolvfile_ops);
+
+	l_queue_push_tail(resolvfile_links, rc);
+
+	return &rc->super;
+}
+
+static const struct resolve_method_ops resolve_method_file_ops = {
+	.init = resolve_file_init,
+	.exit = resolve_file_exit,
+	.alloc = resolve_file_alloc,
+};
+
 static const struct resolve_method_ops *configured_method;
 
 struct resolve *resolve_new(uint32_t ifindex)
@@ -574,6 +1046,7 @@ static const struct {
 } resolve_method_ops_list[] = {
 	{ "systemd", &resolve_method_systemd_ops },
 	{ "resolvconf", &resolve_method_resolvconf_ops },
+	{ "file", &resolve_method_file_ops },
 	{ }
 };
 
@@ -96,32 +96,65 @@ enum rrm_phy_type {
 	RRM_PHY_TYPE_TVHT	= 10,
 };
 
+/* Cached beacon table entries older than this are refreshed from station */
+#define TABLE_LIFETIME_US		(1 * L_USEC_PER_SEC)
+
+/* Largest Radio Measurement Report frame body built */
+#define MAX_REPORT_FRAME_LEN		1024
+
 struct rrm_request_info {
-	uint8_t dialog_token;	/* dialog token in Radio Measurement Request */
 	uint8_t mtoken;		/* token in measurement request element */
 	uint8_t mode;
 	uint8_t type;		/* request type (only beacon supported) */
+	uint8_t reject;		/* REPORT_REJECT_* if not measured */
 };
 
 struct rrm_beacon_req_info {
 	struct rrm_request_info info;
 	uint8_t oper_class;
 	uint8_t channel;	/* The single channel provided in request */
+	uint8_t measurement_mode;
 	uint16_t duration;
+	uint32_t frequency;	/* 0 for all channels */
 	uint8_t bssid[6];	/* Request filtered by BSSID */
 	char ssid[33];		/* Request filtered by SSID */
 	bool has_ssid;
+};
+
+/*
+ * The measurement requests of one Radio Measurement Request frame.  All
+ * scan based requests are served by a single scan and all the reports go
+ * back in a single Radio Measurement Report frame.
+ */
+struct rrm_measurement {
+	uint8_t dialog_token;
+	struct l_queue *requests;
 	uint32_t scan_id;
 	uint64_t scan_start_time;
 };
 
+/* What is needed of a BSS to report it, kept beyond the scan results */
+struct rrm_table_entry {
+	uint8_t addr[6];
+	uint8_t ssid[32];
+	uint8_t ssid_len;
+	uint8_t phy_type;
+	uint8_t rcpi;
+	uint32_t frequency;
+	uint32_t parent_tsf;
+};
+
 /* Per-netdev state */
 struct rrm_state {
 	struct station *station;
 	uint32_t watch_id;
 	uint32_t ifindex;
 	uint64_t wdev_id;
-	struct rrm_request_info *pending;
+	struct rrm_measurement *pending;
+
+	/* Beacon table, served to table mode requests */
+	struct l_queue *table;
+	uint64_t table_time;
 
 	uint64_t last_request;
 };
@@ -156,6 +189,12 @@ static void rrm_info_destroy(void *data)
 	l_free(beacon);
 }
 
+static void rrm_measurement_free(struct rrm_measurement *measurement)
+{
+	l_queue_destroy(measurement->requests, rrm_info_destroy);
+	l_free(measurement);
+}
+
 static uint8_t rrm_phy_type(struct scan_bss *bss)
 {
 	if (bss->vht_capable)
@@ -208,28 +247,6 @@ static bool rrm_send_response(struct rrm_state *rrm,
 	return true;
 }
 
-static void rrm_reject_measurement_request(struct rrm_state *rrm,
-						uint8_t mode)
-{
-	struct rrm_request_info *info = rrm->pending;
-	uint8_t frame[8];
-
-	frame[0] = 0x05; /* Category: Radio Measurement */
-	frame[1] = 0x01; /* Action: Radio Measurement Report */
-	frame[2] = info->dialog_token;
-	frame[3] = IE_TYPE_MEASUREMENT_REPORT;
-	frame[4] = 3;
-	frame[5] = info->mtoken;
-	frame[6] = mode;
-	frame[7] = info->type;
-
-	if (!rrm_send_response(rrm, frame, sizeof(frame)))
-		l_error("failed to send rejection");
-
-	rrm_info_destroy(info);
-	rrm->pending = NULL;
-}
-
 static void rrm_build_measurement_report(struct rrm_request_info *info,
 				const void *report, size_t report_len,
 				uint8_t *to)
@@ -237,7 +254,7 @@ static void rrm_build_measurement_report(struct rrm_request_info *info,
 	*to++ = IE_TYPE_MEASUREMENT_REPORT;
 	*to++ = 3 + report_len;
 	*to++ = info->mtoken;
-	*to++ = 0;
+	*to++ = info->reject;
 	*to++ = info->type;
 
 	if (report)
@@ -255,6 +272,86 @@ static uint8_t mdb_to_rcpi(int32_t mdb)
 		return 220;
 }
 
+static void rrm_table_entry_set(struct rrm_table_entry *entry,
+				struct scan_bss *bss)
+{
+	memcpy(entry->addr, bss->addr, 6);
+	memcpy(entry->ssid, bss->ssid, bss->ssid_len);
+	entry->ssid_len = bss->ssid_len;
+	entry->phy_type = rrm_phy_type(bss);
+	entry->rcpi = mdb_to_rcpi(bss->signal_strength);
+	entry->frequency = bss->frequency;
+	entry->parent_tsf = bss->parent_tsf;
+}
+
+static bool rrm_table_entry_match_addr(const void *a, const void *b)
+{
+	const struct rrm_table_entry *entry = a;
+
+	return !memcmp(entry->addr, b, 6);
+}
+
+/*
+ * Adds or refreshes the table entries of the BSSes in bss_list and
+ * returns them in a new queue, in the same order.
+ */
+static struct l_queue *rrm_table_update(struct rrm_state *rrm,
+					struct l_queue *bss_list)
+{
+	struct l_queue *entries = l_queue_new();
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(bss_list); entry;
+						entry = entry->next) {
+		struct scan_bss *bss = entry->data;
+		struct rrm_table_entry *t;
+
+		t = l_queue_find(rrm->table, rrm_table_entry_match_addr,
+					bss->addr);
+		if (!t) {
+			t = l_new(struct rrm_table_entry, 1);
+			l_queue_push_tail(rrm->table, t);
+		}
+
+		rrm_table_entry_set(t, bss);
+		l_queue_push_tail(entries, t);
+	}
+
+	return entries;
+}
+
+/*
+ * The table is rebuilt from the station's scan results at most once per
+ * TABLE_LIFETIME_US so that bursts of table requests don't each walk
+ * and convert the whole BSS list.  Results of our own measurement scans
+ * are merged in as they arrive.
+ */
+static bool rrm_table_refresh(struct rrm_state *rrm)
+{
+	struct l_queue *bss_list;
+	uint64_t now = l_time_now();
+
+	if (rrm->table_time &&
+			l_time_diff(rrm->table_time, now) < TABLE_LIFETIME_US)
+		return true;
+
+	bss_list = station_get_bss_list(rrm->station);
+	if (!bss_list)
+		return false;
+
+	l_queue_clear(rrm->table, l_free);
+	l_queue_destroy(rrm_table_update(rrm, bss_list), NULL);
+	rrm->table_time = now;
+
+	return true;
+}
+
+static void rrm_table_clear(struct rrm_state *rrm)
+{
+	l_queue_clear(rrm->table, l_free);
+	rrm->table_time = 0;
+}
+
 /*
  * 802.11-2016 11.11.9.1 Beacon report
  *
@@ -273,17 +370,18 @@ static uint8_t mdb_to_rcpi(int32_t mdb)
  * zero for all cases (table, passive, active).
  */
 static size_t build_report_for_bss(struct rrm_beacon_req_info *beacon,
-					struct scan_bss *bss,
+					uint64_t scan_start_time,
+					struct rrm_table_entry *bss,
 					uint8_t *to)
 {
 	struct rrm_beacon_report *report = (struct rrm_beacon_report *) to;
 
 	report->oper_class = beacon->oper_class;
 	report->channel = band_freq_to_channel(bss->frequency, NULL);
-	report->scan_start_time = L_CPU_TO_LE64(beacon->scan_start_time);
+	report->scan_start_time = L_CPU_TO_LE64(scan_start_time);
 	report->duration = L_CPU_TO_LE16(beacon->duration);
-	report->frame_info = rrm_phy_type(bss);
-	report->rcpi = mdb_to_rcpi(bss->signal_strength);
+	report->frame_info = bss->phy_type;
+	report->rcpi = bss->rcpi;
 
 	/* RSNI not available (could get this from GET_SURVEY) */
 	report->rsni = 255;
@@ -309,86 +407,122 @@ static size_t build_report_for_bss(struct rrm_beacon_req_info *beacon,
 }
 
 static bool bss_in_request_range(struct rrm_beacon_req_info *beacon,
-					struct scan_bss *bss)
+					struct rrm_table_entry *bss)
 {
-	uint8_t channel = band_freq_to_channel(bss->frequency, NULL);
-
-	/* Must be a table measurement */
-	if (beacon->channel == 0 || beacon->channel == 255)
+	/* Table measurement for all channels */
+	if (!beacon->frequency)
 		return true;
 
-	if (beacon->channel == channel)
-		return true;
+	return beacon->frequency == bss->frequency;
+}
+
+static bool bss_matches_request(struct rrm_beacon_req_info *beacon,
+					struct rrm_table_entry *bss)
+{
+	/* If request included a specific BSSID match only this BSS */
+	if (!util_is_broadcast_address(beacon->bssid) &&
+			memcmp(bss->addr, beacon->bssid, 6))
+		return false;
+
+	/* If request was for a certain SSID, match only this SSID */
+	if (beacon->has_ssid && (strlen(beacon->ssid) != bss->ssid_len ||
+				memcmp(beacon->ssid, bss->ssid, bss->ssid_len)))
+		return false;
 
-	return false;
+	/*
+	 * The results of a scan cover all the channels of the frame's
+	 * requests and the kernel may have returned cached results, so
+	 * sort out any non-matching frequencies before building the report
+	 */
+	return bss_in_request_range(beacon, bss);
 }
 
+/*
+ * Sends the reports for all the requests of the pending measurement, in
+ * the order they were requested.  Scan based requests are answered from
+ * 'measured', the table entries of this measurement's scan results.
+ */
 static bool rrm_report_beacon_results(struct rrm_state *rrm,
-					struct l_queue *bss_list)
+					struct l_queue *measured)
 {
-	struct rrm_beacon_req_info *beacon = l_container_of(rrm->pending,
-						struct rrm_beacon_req_info,
-						info);
-	bool wildcard = util_is_broadcast_address(beacon->bssid);
-	const struct l_queue_entry *entry;
-	uint8_t frame[512];
+	struct rrm_measurement *measurement = rrm->pending;
+	const struct l_queue_entry *r;
+	uint8_t frame[MAX_REPORT_FRAME_LEN];
 	uint8_t *ptr = frame;
+	const uint8_t *end = frame + sizeof(frame);
+	bool ret;
 
 	*ptr++ = 0x05; /* Category: Radio Measurement */
 	*ptr++ = 0x01; /* Action: Radio Measurement Report */
-	*ptr++ = beacon->info.dialog_token;
+	*ptr++ = measurement->dialog_token;
 
-	for (entry = l_queue_get_entries(bss_list); entry;
-							entry = entry->next) {
-		struct scan_bss *bss = entry->data;
-		uint8_t report[257];
-		size_t report_len;
+	for (r = l_queue_get_entries(measurement->requests); r; r = r->next) {
+		struct rrm_beacon_req_info *beacon = r->data;
+		struct l_queue *list = measured;
+		uint64_t scan_start_time = measurement->scan_start_time;
+		const struct l_queue_entry *entry;
 
-		/* If request included a specific BSSID match only this BSS */
-		if (!wildcard && memcmp(bss->addr, beacon->bssid, 6) != 0)
-			continue;
+		if (beacon->info.reject) {
+			if (end - ptr < 5)
+				break;
 
-		/* If request was for a certain SSID, match only this SSID */
-		if (beacon->has_ssid && strncmp(beacon->ssid,
-							(const char *)bss->ssid,
-							sizeof(bss->ssid)) != 0)
+			rrm_build_measurement_report(&beacon->info, NULL, 0,
+							ptr);
+			ptr += 5;
 			continue;
+		}
 
-		/*
-		 * The kernel may have returned a cached scan, so we have to
-		 * sort out any non-matching frequencies before building the
-		 * report
-		 */
-		if (!bss_in_request_range(beacon, bss))
-			continue;
+		if (beacon->measurement_mode == RRM_BEACON_REQ_MODE_TABLE) {
+			list = rrm->table;
+			scan_start_time = 0;
+		}
+
+		for (entry = l_queue_get_entries(list); entry;
+							entry = entry->next) {
+			struct rrm_table_entry *bss = entry->data;
+			uint8_t report[257];
+			size_t report_len;
+
+			if (!bss_matches_request(beacon, bss))
+				continue;
+
+			if ((size_t) (end - ptr) <
+					5 + sizeof(struct rrm_beacon_report)) {
+				l_debug("Report frame full, dropping BSSes");
+				break;
+			}
 
-		report_len = build_report_for_bss(beacon, bss, report);
+			report_len = build_report_for_bss(beacon,
+							scan_start_time,
+							bss, report);
 
-		rrm_build_measurement_report(&beacon->info, report,
-						report_len, ptr);
+			rrm_build_measurement_report(&beacon->info, report,
+							report_len, ptr);
 
-		ptr += report_len + 5;
+			ptr += report_len + 5;
+		}
 	}
 
-	rrm_info_destroy(&beacon->info);
+	ret = rrm_send_response(rrm, frame, ptr - frame);
+
+	rrm_measurement_free(measurement);
 	rrm->pending = NULL;
 
-	return rrm_send_response(rrm, frame, ptr - frame);
+	return ret;
 }
 
-static void rrm_handle_beacon_table(struct rrm_state *rrm,
-					struct rrm_beacon_req_info *beacon)
+static void rrm_reject_scan_requests(struct rrm_state *rrm, uint8_t mode)
 {
-	struct l_queue *bss_list;
+	const struct l_queue_entry *entry;
 
-	bss_list = station_get_bss_list(rrm->station);
-	if (!bss_list) {
-		rrm_reject_measurement_request(rrm, REPORT_REJECT_INCAPABLE);
-		return;
-	}
+	for (entry = l_queue_get_entries(rrm->pending->requests); entry;
+							entry = entry->next) {
+		struct rrm_beacon_req_info *beacon = entry->data;
 
-	if (!rrm_report_beacon_results(rrm, bss_list))
-		l_error("Error reporting beacon table results");
+		if (!beacon->info.reject && beacon->measurement_mode !=
+						RRM_BEACON_REQ_MODE_TABLE)
+			beacon->info.reject = mode;
+	}
 }
 
 static bool rrm_scan_results(int err, struct l_queue *bss_list,
@@ -396,70 +530,106 @@ static bool rrm_scan_results(int err, struct l_queue *bss_list,
 				void *userdata)
 {
 	struct rrm_state *rrm = userdata;
-	struct rrm_beacon_req_info *beacon = l_container_of(rrm->pending,
-						struct rrm_beacon_req_info,
-						info);
+	struct l_queue *measured;
 
-	beacon->scan_id = 0;
+	rrm->pending->scan_id = 0;
 
 	l_debug("RRM scan results for %u APs", l_queue_length(bss_list));
 
-	rrm_report_beacon_results(rrm, bss_list);
-	/* We aren't saving this BSS list */
-	return false;
+	if (err < 0)
+		rrm_reject_scan_requests(rrm, REPORT_REJECT_INCAPABLE);
+
+	measured = rrm_table_update(rrm, bss_list);
+	rrm_report_beacon_results(rrm, measured);
+	l_queue_destroy(measured, NULL);
+
+	if (!rrm->station)
+		return false;
+
+	/* The measured BSSes are also useful as roam candidates */
+	station_roam_candidates_update(rrm->station, bss_list);
+	return true;
 }
 
 static void rrm_scan_triggered(int err, void *userdata)
 {
 	struct rrm_state *rrm = userdata;
-	struct rrm_beacon_req_info *beacon = l_container_of(rrm->pending,
-						struct rrm_beacon_req_info,
-						info);
+	struct rrm_measurement *measurement = rrm->pending;
 
 	if (err < 0) {
 		l_error("Could not start RRM scan");
-		rrm_reject_measurement_request(rrm, REPORT_REJECT_INCAPABLE);
+		measurement->scan_id = 0;
+		rrm_reject_scan_requests(rrm, REPORT_REJECT_INCAPABLE);
+		rrm_report_beacon_results(rrm, NULL);
 		return;
 	}
 
-	beacon->scan_start_time = scan_get_triggered_time(rrm->wdev_id,
-							beacon->scan_id);
+	measurement->scan_start_time = scan_get_triggered_time(rrm->wdev_id,
+							measurement->scan_id);
 }
 
-static void rrm_handle_beacon_scan(struct rrm_state *rrm,
-					struct rrm_beacon_req_info *beacon,
-					bool passive)
+/*
+ * Starts a single scan covering the channels of all the passive and
+ * active requests of the measurement.  The scan is passive if any of the
+ * requests is, a STA must not transmit on a channel it was asked to only
+ * listen on, and lasts as long as the longest requested duration.
+ * Returns false if there is nothing to scan.
+ */
+static bool rrm_start_beacon_scan(struct rrm_state *rrm)
 {
+	struct rrm_measurement *measurement = rrm->pending;
 	struct scan_freq_set *freqs = scan_freq_set_new();
 	struct scan_parameters params = {
 		.freqs = freqs,
 		.flush = true,
-		.duration = beacon->duration,
-		.duration_mandatory = test_bit(&beacon->info.mode, 4),
 	};
-	enum band_freq band = band_oper_class_to_band(NULL, beacon->oper_class);
-	uint32_t freq;
+	const struct l_queue_entry *entry;
+	bool passive = false;
+	bool need_scan = false;
+
+	for (entry = l_queue_get_entries(measurement->requests); entry;
+							entry = entry->next) {
+		struct rrm_beacon_req_info *beacon = entry->data;
+
+		if (beacon->info.reject || beacon->measurement_mode ==
+						RRM_BEACON_REQ_MODE_TABLE)
+			continue;
+
+		scan_freq_set_add(freqs, beacon->frequency);
+		need_scan = true;
 
-	freq = band_channel_to_freq(beacon->channel, band);
-	scan_freq_set_add(freqs, freq);
+		if (beacon->measurement_mode == RRM_BEACON_REQ_MODE_PASSIVE)
+			passive = true;
+
+		if (beacon->duration > params.duration)
+			params.duration = beacon->duration;
+
+		if (test_bit(&beacon->info.mode, 4))
+			params.duration_mandatory = true;
+	}
+
+	if (!need_scan) {
+		scan_freq_set_free(freqs);
+		return false;
+	}
 
 	if (passive)
-		beacon->scan_id = scan_passive_full(rrm->wdev_id, &params,
+		measurement->scan_id = scan_passive_full(rrm->wdev_id, &params,
 						rrm_scan_triggered,
 						rrm_scan_results, rrm,
 						NULL);
 	else
-		beacon->scan_id = scan_active_full(rrm->wdev_id, &params,
+		measurement->scan_id = scan_active_full(rrm->wdev_id, &params,
 						rrm_scan_triggered,
 						rrm_scan_results, rrm,
 						NULL);
 
 	scan_freq_set_free(freqs);
 
-	if (beacon->scan_id == 0) {
-		rrm_info_destroy(&beacon->info);
-		rrm->pending = NULL;
-	}
+	if (!measurement->scan_id)
+		rrm_reject_scan_requests(rrm, REPORT_REJECT_INCAPABLE);
+
+	return measurement->scan_id != 0;
 }
 
 static bool rrm_verify_beacon_request(const uint8_t *request, size_t len)
@@ -492,12 +662,15 @@ static bool rrm_verify_beacon_request(const uint8_t *request, size_t len)
 	return true;
 }
 
-static void rrm_handle_beacon_request(struct rrm_state *rrm,
-					uint8_t dialog_token,
+/*
+ * Parses a Beacon measurement request into 'beacon'.  Returns the
+ * REPORT_REJECT_* reason if it can't be served.
+ */
+static uint8_t rrm_parse_beacon_request(struct rrm_state *rrm,
+					struct rrm_beacon_req_info *beacon,
 					const uint8_t *request, size_t len)
 {
 	struct wiphy *wiphy = station_get_wiphy(rrm->station);
-	struct rrm_beacon_req_info *beacon;
 	struct ie_tlv_iter iter;
 	/*
 	 * 802.11-2016 - Table 9-90
@@ -506,15 +679,8 @@ static void rrm_handle_beacon_request(struct rrm_state *rrm,
 	 *  Detail subelement is not included in a Beacon request)"
 	 */
 	uint8_t detail = REPORT_DETAIL_NO_FIELDS_OR_ELEMS;
+	enum band_freq band;
 
-	beacon = l_new(struct rrm_beacon_req_info, 1);
-
-	beacon->info.dialog_token = dialog_token;
-	beacon->info.mtoken = request[0];
-	beacon->info.mode = request[1];
-	beacon->info.type = request[2];
-
-	rrm->pending = &beacon->info;
 	/*
 	 * 802.11-2016 11.11.8
 	 *
@@ -526,7 +692,7 @@ static void rrm_handle_beacon_request(struct rrm_state *rrm,
 	 * reporting, so decline any request to do so.
 	 */
 	if (test_bit(&beacon->info.mode, 1))
-		goto reject_refused;
+		return REPORT_REJECT_REFUSED;
 
 	/*
 	 * Some drivers (non mac80211) do not allow setting a duration/mandatory
@@ -536,18 +702,19 @@ static void rrm_handle_beacon_request(struct rrm_state *rrm,
 	 */
 	if (!wiphy_has_ext_feature(wiphy, NL80211_EXT_FEATURE_SET_SCAN_DWELL)
 			&& test_bit(&beacon->info.mode, 4))
-		goto reject_incapable;
+		return REPORT_REJECT_INCAPABLE;
 
 	/* advance to beacon request */
 	request += 3;
 	len -= 3;
 
 	if (!rrm_verify_beacon_request(request, len))
-		goto reject_refused;
+		return REPORT_REJECT_REFUSED;
 
 	beacon->oper_class = request[0];
 	beacon->channel = request[1];
 	beacon->duration = l_get_le16(request + 4);
+	beacon->measurement_mode = request[6];
 	memcpy(beacon->bssid, request + 7, 6);
 
 	ie_tlv_iter_init(&iter, request + 13, len - 13);
@@ -573,7 +740,7 @@ static void rrm_handle_beacon_request(struct rrm_state *rrm,
 		case RRM_BEACON_REQ_SUBELEM_ID_REPORTING_DETAIL:
 			if (length < 1) {
 				l_error("Invalid length in reporting detail");
-				goto reject_refused;
+				return REPORT_REJECT_REFUSED;
 			}
 
 			detail = l_get_u8(data);
@@ -581,7 +748,7 @@ static void rrm_handle_beacon_request(struct rrm_state *rrm,
 		case RRM_BEACON_REQ_SUBELEM_ID_BEACON_REPORTING:
 			if (length < 2) {
 				l_error("Invalid length in Beacon Reporting");
-				goto reject_refused;
+				return REPORT_REJECT_REFUSED;
 			}
 
 			/*
@@ -601,14 +768,16 @@ static void rrm_handle_beacon_request(struct rrm_state *rrm,
 			 * supported we can reject this request now.
 			 */
 			if (l_get_u8(data) != 0)
-				goto reject_incapable;
+				return REPORT_REJECT_INCAPABLE;
 
 			break;
 		case RRM_BEACON_REQ_SUBELEM_ID_AP_CHAN_REPORT:
 			/*
-			 * Only supporting single channel requests
+			 * Only supporting single channel requests, APs
+			 * wanting several channels send several requests,
+			 * which are scanned together.
 			 */
-			goto reject_incapable;
+			return REPORT_REJECT_INCAPABLE;
 		}
 	}
 
@@ -622,45 +791,67 @@ static void rrm_handle_beacon_request(struct rrm_state *rrm,
 	 */
 	if (detail != REPORT_DETAIL_NO_FIELDS_OR_ELEMS) {
 		l_debug("Unsupported report detail");
-		goto reject_incapable;
+		return REPORT_REJECT_INCAPABLE;
 	}
 
+	band = band_oper_class_to_band(NULL, beacon->oper_class);
+
 	/* Mode */
-	switch (request[6]) {
+	switch (beacon->measurement_mode) {
 	case RRM_BEACON_REQ_MODE_PASSIVE:
-		rrm_handle_beacon_scan(rrm, beacon, true);
-		return;
 	case RRM_BEACON_REQ_MODE_ACTIVE:
-		rrm_handle_beacon_scan(rrm, beacon, false);
-		return;
+		beacon->frequency = band_channel_to_freq(beacon->channel,
+								band);
+		if (!beacon->frequency)
+			return REPORT_REJECT_REFUSED;
+
+		return 0;
 	case RRM_BEACON_REQ_MODE_TABLE:
-		rrm_handle_beacon_table(rrm, beacon);
-		return;
+		if (beacon->channel != 0 && beacon->channel != 255)
+			beacon->frequency = band_channel_to_freq(
+							beacon->channel, band);
+
+		if (!rrm_table_refresh(rrm))
+			return REPORT_REJECT_INCAPABLE;
+
+		return 0;
 	default:
-		l_error("Unknown beacon mode %u", request[6]);
-		/* fall through to refused */
+		l_error("Unknown beacon mode %u", beacon->measurement_mode);
+		return REPORT_REJECT_REFUSED;
 	}
+}
+
+static void rrm_add_request(struct rrm_state *rrm,
+				const uint8_t *request, size_t len)
+{
+	struct rrm_beacon_req_info *beacon;
 
-reject_refused:
-	rrm_reject_measurement_request(rrm, REPORT_REJECT_REFUSED);
-	return;
+	beacon = l_new(struct rrm_beacon_req_info, 1);
 
-reject_incapable:
-	rrm_reject_measurement_request(rrm, REPORT_REJECT_INCAPABLE);
+	beacon->info.mtoken = request[0];
+	beacon->info.mode = request[1];
+	beacon->info.type = request[2];
+
+	switch (beacon->info.type) {
+	case 5: /* beacon */
+		beacon->info.reject = rrm_parse_beacon_request(rrm, beacon,
+								request, len);
+		break;
+	default:
+		beacon->info.reject = REPORT_REJECT_INCAPABLE;
+		break;
+	}
+
+	l_queue_push_tail(rrm->pending->requests, beacon);
 }
 
 static void rrm_cancel_pending(struct rrm_state *rrm)
 {
 	if (rrm->pending) {
-		struct rrm_beacon_req_info *beacon;
-
-		beacon = l_container_of(rrm->pending,
-						struct rrm_beacon_req_info,
-						info);
-		if (beacon->scan_id)
-			scan_cancel(rrm->wdev_id, beacon->scan_id);
+		if (rrm->pending->scan_id)
+			scan_cancel(rrm->wdev_id, rrm->pending->scan_id);
 
-		rrm_info_destroy(rrm->pending);
+		rrm_measurement_free(rrm->pending);
 		rrm->pending = NULL;
 	}
 }
@@ -673,6 +864,7 @@ static void rrm_station_watch_cb(enum station_state state, void *userdata)
 	case STATION_STATE_DISCONNECTING:
 	case STATION_STATE_DISCONNECTED:
 		rrm_cancel_pending(rrm);
+		rrm_table_clear(rrm);
 		break;
 	default:
 		return;
@@ -686,6 +878,7 @@ static void rrm_station_watch_destroy(void *user_data)
 	l_debug("");
 
 	rrm_cancel_pending(rrm);
+	rrm_table_clear(rrm);
 	rrm->watch_id = 0;
 	rrm->station = NULL;
 }
@@ -696,7 +889,6 @@ static void rrm_frame_watch_cb(const struct mmpdu_header *mpdu,
 {
 	struct rrm_state *rrm = user_data;
 	const uint8_t *request = body;
-	uint8_t dialog_token;
 	struct ie_tlv_iter iter;
 	struct scan_bss *bss;
 
@@ -746,11 +938,13 @@ static void rrm_frame_watch_cb(const struct mmpdu_header *mpdu,
 		return;
 	}
 
-	dialog_token = request[2];
-
 	/* Update time regardless of success */
 	rrm->last_request = l_time_now();
 
+	rrm->pending = l_new(struct rrm_measurement, 1);
+	rrm->pending->dialog_token = request[2];
+	rrm->pending->requests = l_queue_new();
+
 	ie_tlv_iter_init(&iter, request + 5, body_len - 5);
 
 	while (ie_tlv_iter_next(&iter)) {
@@ -764,17 +958,26 @@ static void rrm_frame_watch_cb(const struct mmpdu_header *mpdu,
 		req_len = ie_tlv_iter_get_length(&iter);
 
 		if (req_len < 3)
-			return;
+			continue;
 
-		switch (req[2]) {
-		case 5: /* beacon */
-			rrm_handle_beacon_request(rrm, dialog_token, req,
-							req_len);
-			break;
-		default:
-			return;
-		}
+		rrm_add_request(rrm, req, req_len);
 	}
+
+	if (l_queue_isempty(rrm->pending->requests)) {
+		rrm_measurement_free(rrm->pending);
+		rrm->pending = NULL;
+		return;
+	}
+
+	l_debug("%u measurement requests",
+			l_queue_length(rrm->pending->requests));
+
+	/* The reports are sent once the scan, if any, completes */
+	if (rrm_start_beacon_scan(rrm))
+		return;
+
+	if (!rrm_report_beacon_results(rrm, NULL))
+		l_error("Error reporting beacon results");
 }
 
 static void rrm_state_destroy(void *data)
@@ -783,6 +986,7 @@ static void rrm_state_destroy(void *data)
 
 	l_warn("RRM states still exist on exit!");
 
+	l_queue_destroy(rrm->table, l_free);
 	l_free(rrm);
 }
 
@@ -804,6 +1008,7 @@ static struct rrm_state *rrm_new_state(struct netdev *netdev)
 	rrm = l_new(struct rrm_state, 1);
 
 	rrm->last_request = l_time_now();
+	rrm->table = l_queue_new();
 	rrm->ifindex = netdev_get_ifindex(netdev);
 	rrm->wdev_id = netdev_get_wdev_id(netdev);
 
@@ -848,6 +1053,7 @@ static void rrm_netdev_watch(struct netdev *netdev,
 				station_remove_state_watch(rrm->station,
 								rrm->watch_id);
 
+			l_queue_destroy(rrm->table, l_free);
 			l_free(rrm);
 		}
 
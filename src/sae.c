@@ -218,33 +218,46 @@ static bool sae_pwd_seed(const uint8_t *addr1, const uint8_t *addr2,
 					&counter, (size_t) 1);
 }
 
+/*
+ * State shared by all hunting-and-pecking iterations.  Everything that does
+ * not depend on the counter is set up once so that an iteration only costs
+ * the KDF, one scalar for the candidate, one random blinding value and a
+ * single Legendre symbol.
+ */
+struct sae_pwe_ctx {
+	const struct l_ecc_curve *curve;
+	uint8_t prime[L_ECC_SCALAR_MAX_BYTES];
+	size_t prime_len;
+	struct l_ecc_scalar *qr;
+	struct l_ecc_scalar *qnr;
+	uint8_t qnr_bin[L_ECC_SCALAR_MAX_BYTES];
+	struct l_ecc_scalar *y_sqr;
+	struct l_ecc_scalar *num;
+};
+
 /*
  * Computes KDF-256(pwd_seed, "SAE Hunting and Pecking", p). If the output is
  * greater than p, the output is set to qnr, a quadratic non-residue.
  * Since this happens with very low probability, using the same qnr is fine.
+ * The resulting candidate is also returned in binary form in out.
  */
-static struct l_ecc_scalar *sae_pwd_value(const struct l_ecc_curve *curve,
-						uint8_t *pwd_seed, uint8_t *qnr)
+static struct l_ecc_scalar *sae_pwd_value(struct sae_pwe_ctx *ctx,
+						uint8_t *pwd_seed, uint8_t *out)
 {
-	uint8_t pwd_value[L_ECC_SCALAR_MAX_BYTES];
-	uint8_t prime[L_ECC_SCALAR_MAX_BYTES];
-	ssize_t len;
 	int is_in_range;
-	struct l_ecc_scalar *p = l_ecc_curve_get_prime(curve);
 
-	len = l_ecc_scalar_get_data(p, prime, sizeof(prime));
-	l_ecc_scalar_free(p);
+	memset(out, 0, L_ECC_SCALAR_MAX_BYTES);
 
 	if (!kdf_sha256(pwd_seed, 32, "SAE Hunting and Pecking",
-			strlen("SAE Hunting and Pecking"), prime, len,
-			pwd_value, len))
+			strlen("SAE Hunting and Pecking"), ctx->prime,
+			ctx->prime_len, out, ctx->prime_len))
 		return NULL;
 
 	/*
 	 * If pwd_value >= prime, this iteration should fail. We need a smooth
 	 * control flow, so we need to continue anyway.
 	 */
-	is_in_range = l_secure_memcmp(pwd_value, prime, len);
+	is_in_range = l_secure_memcmp(out, ctx->prime, ctx->prime_len);
 	/*
 	 * We only consider is_in_range == -1 as valid, meaning the value of the
 	 * MSB defines the mask.
@@ -257,10 +270,10 @@ static struct l_ecc_scalar *sae_pwd_value(const struct l_ecc_curve *curve,
 	 * to avoid control flow dependencies, we replace pwd_value by a dummy
 	 * quadratic non residue if we generate a value >= prime.
 	 */
-	util_secure_select((uint8_t) is_in_range, pwd_value, qnr,
-						pwd_value, sizeof(pwd_value));
+	util_secure_select((uint8_t) is_in_range, out, ctx->qnr_bin,
+						out, L_ECC_SCALAR_MAX_BYTES);
 
-	return l_ecc_scalar_new(curve, pwd_value, sizeof(pwd_value));
+	return l_ecc_scalar_new(ctx->curve, out, L_ECC_SCALAR_MAX_BYTES);
 }
 
 /* IEEE 802.11-2016 - Section 12.4.2 Assumptions on SAE */
@@ -345,51 +358,77 @@ static struct l_ecc_scalar *sae_new_residue(const struct l_ecc_curve *curve,
 	return s;
 }
 
-static uint8_t sae_is_quadradic_residue(const struct l_ecc_curve *curve,
-						struct l_ecc_scalar *value,
-						struct l_ecc_scalar *qr,
-						struct l_ecc_scalar *qnr)
+static bool sae_pwe_ctx_init(struct sae_pwe_ctx *ctx,
+				const struct l_ecc_curve *curve)
 {
-	uint64_t rbuf[L_ECC_MAX_DIGITS];
-	struct l_ecc_scalar *y_sqr = l_ecc_scalar_new(curve, NULL, 0);
-	struct l_ecc_scalar *r = l_ecc_scalar_new_random(curve);
-	struct l_ecc_scalar *num = l_ecc_scalar_new(curve, NULL, 0);
-	size_t bytes;
+	struct l_ecc_scalar *p = l_ecc_curve_get_prime(curve);
+	ssize_t len;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->curve = curve;
+
+	len = l_ecc_scalar_get_data(p, ctx->prime, sizeof(ctx->prime));
+	l_ecc_scalar_free(p);
 
-	l_ecc_scalar_sum_x(y_sqr, value);
+	if (len <= 0)
+		return false;
+
+	ctx->prime_len = len;
+
+	/* create qr/qnr prior to beginning hunting-and-pecking loop */
+	ctx->qr = sae_new_residue(curve, true);
+	ctx->qnr = sae_new_residue(curve, false);
+	l_ecc_scalar_get_data(ctx->qnr, ctx->qnr_bin, sizeof(ctx->qnr_bin));
 
-	l_ecc_scalar_multiply(num, y_sqr, r);
-	l_ecc_scalar_multiply(num, num, r);
+	ctx->y_sqr = l_ecc_scalar_new(curve, NULL, 0);
+	ctx->num = l_ecc_scalar_new(curve, NULL, 0);
 
-	l_ecc_scalar_free(y_sqr);
+	return true;
+}
+
+static void sae_pwe_ctx_free(struct sae_pwe_ctx *ctx)
+{
+	l_ecc_scalar_free(ctx->qr);
+	l_ecc_scalar_free(ctx->qnr);
+	l_ecc_scalar_free(ctx->y_sqr);
+	l_ecc_scalar_free(ctx->num);
+	explicit_bzero(ctx->qnr_bin, sizeof(ctx->qnr_bin));
+}
+
+static uint8_t sae_is_quadradic_residue(struct sae_pwe_ctx *ctx,
+						struct l_ecc_scalar *value)
+{
+	uint64_t rbuf[L_ECC_MAX_DIGITS];
+	struct l_ecc_scalar *r = l_ecc_scalar_new_random(ctx->curve);
+	struct l_ecc_scalar *blind;
+	int expected;
+	ssize_t bytes;
+	uint8_t odd;
+
+	l_ecc_scalar_sum_x(ctx->y_sqr, value);
+
+	l_ecc_scalar_multiply(ctx->num, ctx->y_sqr, r);
+	l_ecc_scalar_multiply(ctx->num, ctx->num, r);
 
 	bytes = l_ecc_scalar_get_data(r, rbuf, sizeof(rbuf));
 	l_ecc_scalar_free(r);
 
-	if (bytes <= 0) {
-		l_ecc_scalar_free(num);
+	if (bytes <= 0)
 		return 0;
-	}
 
-	if (rbuf[bytes / 8 - 1] & 1) {
-		l_ecc_scalar_multiply(num, num, qr);
-
-		if (l_ecc_scalar_legendre(num) == -1) {
-			l_ecc_scalar_free(num);
-			return 1;
-		}
-	} else {
-		l_ecc_scalar_multiply(num, num, qnr);
-
-		if (l_ecc_scalar_legendre(num) == 1) {
-			l_ecc_scalar_free(num);
-			return 1;
-		}
-	}
+	/*
+	 * Blind with either qr or qnr depending on the random value, the
+	 * expected Legendre symbol flips accordingly.  Only the choice of the
+	 * operand depends on r, so a single Legendre symbol is computed on
+	 * either path.
+	 */
+	odd = rbuf[bytes / 8 - 1] & 1;
+	blind = odd ? ctx->qr : ctx->qnr;
+	expected = odd ? -1 : 1;
 
-	l_ecc_scalar_free(num);
+	l_ecc_scalar_multiply(ctx->num, ctx->num, blind);
 
-	return 0;
+	return l_ecc_scalar_legendre(ctx->num) == expected;
 }
 
 /*
@@ -412,16 +451,14 @@ static struct l_ecc_point *sae_compute_pwe(const struct l_ecc_curve *curve,
 	uint8_t *dummy;
 	uint8_t *base;
 	size_t base_len;
-	struct l_ecc_scalar *qr;
-	struct l_ecc_scalar *qnr;
-	uint8_t qnr_bin[L_ECC_SCALAR_MAX_BYTES] = {0};
+	struct sae_pwe_ctx ctx;
 	struct l_ecc_point *pwe;
 	unsigned int bytes = l_ecc_curve_get_scalar_bytes(curve);
 
-	/* create qr/qnr prior to beginning hunting-and-pecking loop */
-	qr = sae_new_residue(curve, true);
-	qnr = sae_new_residue(curve, false);
-	l_ecc_scalar_get_data(qnr, qnr_bin, sizeof(qnr_bin));
+	if (!sae_pwe_ctx_init(&ctx, curve)) {
+		sae_pwe_ctx_free(&ctx);
+		return NULL;
+	}
 
 	/*
 	 * Allocate memory for the base, and set a random dummy to be used in
@@ -456,17 +493,16 @@ static struct l_ecc_point *sae_compute_pwe(const struct l_ecc_curve *curve,
 		/*
 		 * The case pwd_value > prime is handled inside, so that
 		 * execution can continue whatever the result is, without
-		 * changing the outcome.
+		 * changing the outcome.  The binary candidate is produced
+		 * alongside, so no conversion back from the scalar is needed.
 		 */
-		pwd_value = sae_pwd_value(curve, pwd_seed, qnr_bin);
+		pwd_value = sae_pwd_value(&ctx, pwd_seed, x_cand);
 
 		/*
-		 * Check if the candidate is a valid x-coordinate on our curve,
-		 * and convert it from scalar to binary.
+		 * Check if the candidate is a valid x-coordinate on our curve.
 		 */
-		is_residue = sae_is_quadradic_residue(curve, pwd_value,
-								qr, qnr);
-		l_ecc_scalar_get_data(pwd_value, x_cand, sizeof(x_cand));
+		is_residue = pwd_value ?
+				sae_is_quadradic_residue(&ctx, pwd_value) : 0;
 
 		/*
 		 * If we already found the point, we overwrite x with itself.
@@ -487,8 +523,8 @@ static struct l_ecc_point *sae_compute_pwe(const struct l_ecc_curve *curve,
 		l_ecc_scalar_free(pwd_value);
 	}
 
-	l_ecc_scalar_free(qr);
-	l_ecc_scalar_free(qnr);
+	sae_pwe_ctx_free(&ctx);
+	explicit_bzero(x_cand, sizeof(x_cand));
 	l_free(dummy);
 	l_free(base);
 
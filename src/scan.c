@@ -40,6 +40,7 @@
 #include "src/iwd.h"
 #include "src/module.h"
 #include "src/wiphy.h"
+#include "src/netdev.h"
 #include "src/ie.h"
 #include "src/common.h"
 #include "src/network.h"
@@ -50,14 +51,52 @@
 #include "src/p2putil.h"
 #include "src/mpdu.h"
 #include "src/band.h"
+#include "src/bss-history.h"
 #include "src/scan.h"
+#include "src/profile.h"
+
+#define MEMACCT_MODULE MEMACCT_SCAN
+#include "src/memacct.h"
 
 /* User configurable options */
 static double RANK_5G_FACTOR;
 static uint32_t SCAN_MAX_INTERVAL;
 static uint32_t SCAN_INIT_INTERVAL;
+static bool SCHED_SCAN_ENABLED;
+static int SCHED_SCAN_RSSI_THRESHOLD;
 
 static struct l_queue *scan_contexts;
+static struct l_hashmap *scan_context_index;
+
+/*
+ * Periodic scans create and destroy hundreds of scan_bss objects on every
+ * cycle, recycle a bounded number of them instead of going through the
+ * allocator each time.
+ */
+#define SCAN_BSS_POOL_SIZE 256
+static struct scan_bss *bss_pool[SCAN_BSS_POOL_SIZE];
+static unsigned int bss_pool_len;
+static bool bss_pool_enabled;
+static uint32_t bss_pool_hits;
+static uint32_t bss_pool_misses;
+
+/*
+ * cfg80211 keeps a single BSS table per wiphy, so results of a scan
+ * triggered on one wdev are visible to every other wdev on the same
+ * wiphy.  Remember when each wiphy last completed a scan and which
+ * frequencies it covered so that consumers can dump the existing table
+ * instead of triggering yet another scan.  Kept well below the 30 second
+ * cfg80211 BSS expiry.
+ */
+#define SCAN_CACHE_MAX_AGE (10 * L_USEC_PER_SEC)
+
+struct scan_cache {
+	uint32_t wiphy_id;
+	uint64_t time_stamp;
+	struct scan_freq_set *freqs;
+};
+
+static struct l_queue *scan_caches;
 
 static struct l_genl_family *nl80211;
 
@@ -70,13 +109,19 @@ struct scan_periodic {
 	scan_notify_func_t callback;
 	void *userdata;
 	uint32_t id;
+	/* Non-zero while START_SCHED_SCAN is still running */
+	unsigned int sched_cmd_id;
+	/* STOP_SCHED_SCANs we sent whose STOPPED event is still due */
+	unsigned int sched_stops;
 	bool needs_active_scan:1;
+	bool sched:1;	/* Offloaded as a scheduled scan */
 };
 
 struct scan_request {
 	struct scan_context *sc;
 	scan_trigger_func_t trigger;
 	scan_notify_func_t callback;
+	scan_bss_func_t bss_callback;
 	void *userdata;
 	scan_destroy_func_t destroy;
 	bool canceled : 1; /* Is scan_cancel being called on this request? */
@@ -94,7 +139,20 @@ struct scan_request {
 	 */
 	bool triggered : 1;
 	bool in_callback : 1; /* Scan request complete, re-entrancy guard */
+	bool in_bss_callback : 1; /* Streaming a BSS, re-entrancy guard */
+	bool coalescable : 1; /* Plain scan others may piggyback on */
 	struct l_queue *cmds;
+	/* Frequencies of a coalescable request, NULL if all supported */
+	struct scan_freq_set *freqs;
+	/*
+	 * A pending request compatible with an earlier queued one is served
+	 * by the results of that 'leader' instead of triggering its own
+	 * scan.  Should the leader go away before its GET_SCAN completes,
+	 * the followers are detached and scan on their own.
+	 */
+	struct scan_request *leader;
+	struct l_queue *followers;
+	struct l_queue *coalesced_bss_list;
 	/* The time the current scan was started. Reported in TRIGGER_SCAN */
 	uint64_t start_time_tsf;
 	struct wiphy_radio_work_item work;
@@ -133,6 +191,38 @@ struct scan_results {
 static bool start_next_scan_request(struct wiphy_radio_work_item *item);
 static void scan_periodic_rearm(struct scan_context *sc);
 
+static struct scan_bss *scan_bss_alloc(void)
+{
+	struct scan_bss *bss;
+
+	if (!bss_pool_len) {
+		bss_pool_misses++;
+		return l_new(struct scan_bss, 1);
+	}
+
+	bss_pool_hits++;
+	bss = bss_pool[--bss_pool_len];
+	memset(bss, 0, sizeof(*bss));
+
+	return bss;
+}
+
+static void scan_bss_release(struct scan_bss *bss)
+{
+	if (!bss_pool_enabled || bss_pool_len == SCAN_BSS_POOL_SIZE) {
+		l_free(bss);
+		return;
+	}
+
+	bss_pool[bss_pool_len++] = bss;
+}
+
+static void scan_bss_pool_drain(void)
+{
+	while (bss_pool_len)
+		l_free(bss_pool[--bss_pool_len]);
+}
+
 static bool scan_context_match(const void *a, const void *b)
 {
 	const struct scan_context *sc = a;
@@ -141,6 +231,79 @@ static bool scan_context_match(const void *a, const void *b)
 	return sc->wdev_id == *wdev_id;
 }
 
+/* Every scan event and request looks its context up by the wdev id */
+static unsigned int scan_wdev_id_hash(const void *key)
+{
+	uint64_t wdev_id = *(const uint64_t *) key;
+
+	return (unsigned int) (wdev_id ^ (wdev_id >> 32));
+}
+
+static int scan_wdev_id_compare(const void *a, const void *b)
+{
+	uint64_t wdev_a = *(const uint64_t *) a;
+	uint64_t wdev_b = *(const uint64_t *) b;
+
+	if (wdev_a == wdev_b)
+		return 0;
+
+	return wdev_a < wdev_b ? -1 : 1;
+}
+
+static struct scan_context *scan_context_find(uint64_t wdev_id)
+{
+	return l_hashmap_lookup(scan_context_index, &wdev_id);
+}
+
+static bool scan_context_wiphy_match(const void *a, const void *b)
+{
+	const struct scan_context *sc = a;
+
+	return sc->wiphy == b;
+}
+
+static bool scan_cache_match(const void *a, const void *b)
+{
+	const struct scan_cache *cache = a;
+	uint32_t wiphy_id = L_PTR_TO_UINT(b);
+
+	return cache->wiphy_id == wiphy_id;
+}
+
+static void scan_cache_free(void *data)
+{
+	struct scan_cache *cache = data;
+
+	scan_freq_set_free(cache->freqs);
+	l_free(cache);
+}
+
+static void scan_cache_update(struct scan_context *sc, uint64_t time_stamp,
+				const struct scan_freq_set *freqs)
+{
+	uint32_t wiphy_id = wiphy_get_id(sc->wiphy);
+	struct scan_cache *cache;
+
+	cache = l_queue_find(scan_caches, scan_cache_match,
+					L_UINT_TO_PTR(wiphy_id));
+	if (!cache) {
+		cache = l_new(struct scan_cache, 1);
+		cache->wiphy_id = wiphy_id;
+		cache->freqs = scan_freq_set_new();
+		l_queue_push_tail(scan_caches, cache);
+	}
+
+	/*
+	 * Only extend the set if the previous scan is still fresh, this
+	 * keeps the oldest entry covered under twice the maximum age.
+	 */
+	if (time_stamp - cache->time_stamp > SCAN_CACHE_MAX_AGE)
+		scan_freq_set_subtract(cache->freqs, cache->freqs);
+
+	scan_freq_set_merge(cache->freqs, freqs);
+	cache->time_stamp = time_stamp;
+}
+
 static bool scan_request_match(const void *a, const void *b)
 {
 	const struct scan_request *sr = a;
@@ -149,16 +312,39 @@ static bool scan_request_match(const void *a, const void *b)
 	return sr->work.id == id;
 }
 
+static void scan_request_detach(struct scan_request *sr)
+{
+	if (sr->leader) {
+		l_queue_remove(sr->leader->followers, sr);
+		sr->leader = NULL;
+	}
+
+	l_queue_destroy(sr->coalesced_bss_list,
+				(l_queue_destroy_func_t) scan_bss_free);
+	sr->coalesced_bss_list = NULL;
+}
+
 static void scan_request_free(struct wiphy_radio_work_item *item)
 {
 	struct scan_request *sr = l_container_of(item, struct scan_request,
 							work);
+	struct scan_request *follower;
+
+	scan_request_detach(sr);
+
+	while ((follower = l_queue_peek_head(sr->followers)))
+		scan_request_detach(follower);
+
+	l_queue_destroy(sr->followers, NULL);
 
 	if (sr->destroy)
 		sr->destroy(sr->userdata);
 
 	l_queue_destroy(sr->cmds, (l_queue_destroy_func_t) l_genl_msg_unref);
 
+	if (sr->freqs)
+		scan_freq_set_free(sr->freqs);
+
 	l_free(sr);
 }
 
@@ -220,6 +406,9 @@ static void scan_context_free(struct scan_context *sc)
 	if (sc->get_fw_scan_cmd_id && nl80211)
 		l_genl_family_cancel(nl80211, sc->get_fw_scan_cmd_id);
 
+	if (sc->sp.sched_cmd_id && nl80211)
+		l_genl_family_cancel(nl80211, sc->sp.sched_cmd_id);
+
 	l_free(sc);
 }
 
@@ -227,6 +416,8 @@ static void scan_request_triggered(struct l_genl_msg *msg, void *userdata)
 {
 	struct scan_context *sc = userdata;
 	struct scan_request *sr = l_queue_peek_head(sc->requests);
+	const struct l_queue_entry *entry;
+	const struct l_queue_entry *next;
 	int err;
 
 	sc->start_cmd_id = 0;
@@ -251,9 +442,12 @@ static void scan_request_triggered(struct l_genl_msg *msg, void *userdata)
 	l_debug("%s scan triggered for wdev %" PRIx64,
 		sr->passive ? "Passive" : "Active", sc->wdev_id);
 
+	/*
+	 * The command stays at the head of the queue until its results are
+	 * in so that it can be re-sent if the request gets preempted.
+	 */
 	sr->triggered = true;
 	sr->started = true;
-	l_genl_msg_unref(l_queue_pop_head(sr->cmds));
 
 	if (sr->trigger) {
 		sr->trigger(0, sr->userdata);
@@ -264,6 +458,19 @@ static void scan_request_triggered(struct l_genl_msg *msg, void *userdata)
 		 */
 		sr->trigger = NULL;
 	}
+
+	for (entry = l_queue_get_entries(sr->followers); entry;
+							entry = next) {
+		struct scan_request *follower = entry->data;
+
+		next = entry->next;
+
+		if (!follower->trigger)
+			continue;
+
+		follower->trigger(0, follower->userdata);
+		follower->trigger = NULL;
+	}
 }
 
 struct scan_freq_append_data {
@@ -345,6 +552,35 @@ static bool scan_mac_address_randomization_is_disabled(void)
 	return disabled;
 }
 
+/*
+ * Upper bound on the size of a TRIGGER_SCAN built by scan_build_cmd(),
+ * including the SSIDs appended by scan_cmds_add(), so that the message
+ * buffer is allocated once instead of being regrown by every attribute.
+ */
+static size_t scan_build_cmd_size(struct scan_context *sc,
+					const struct scan_parameters *params)
+{
+	/* WDEV, MAC, MAC_MASK, SCAN_FLAGS, SUPP_RATES and durations */
+	size_t size = 128;
+	const uint8_t *ext_capa;
+
+	/* Attribute headers are 4 bytes, payloads are padded to 4 bytes */
+	if (wiphy_get_max_scan_ie_len(sc->wiphy)) {
+		ext_capa = wiphy_get_extended_capabilities(sc->wiphy,
+							NL80211_IFTYPE_STATION);
+		size += 4 + align_len(ext_capa[1] + 2 + 3 +
+						params->extra_ie_size, 4);
+	}
+
+	if (params->freqs)
+		size += 4 + 8 * scan_freq_set_count(params->freqs);
+
+	/* Nested SCAN_SSIDS, the wildcard SSID and hidden or direct SSIDs */
+	size += 8 + wiphy_get_max_num_ssids_per_scan(sc->wiphy) * (4 + 32);
+
+	return size;
+}
+
 static struct l_genl_msg *scan_build_cmd(struct scan_context *sc,
 					bool ignore_flush_flag, bool is_passive,
 					const struct scan_parameters *params)
@@ -352,7 +588,8 @@ static struct l_genl_msg *scan_build_cmd(struct scan_context *sc,
 	struct l_genl_msg *msg;
 	uint32_t flags = 0;
 
-	msg = l_genl_msg_new(NL80211_CMD_TRIGGER_SCAN);
+	msg = l_genl_msg_new_sized(NL80211_CMD_TRIGGER_SCAN,
+					scan_build_cmd_size(sc, params));
 
 	l_genl_msg_append_attr(msg, NL80211_ATTR_WDEV, 8, &sc->wdev_id);
 
@@ -390,6 +627,17 @@ static struct l_genl_msg *scan_build_cmd(struct scan_context *sc,
 					NL80211_EXT_FEATURE_SCAN_RANDOM_SN))
 		flags |= NL80211_SCAN_FLAG_RANDOM_SN;
 
+	/*
+	 * On full scans let the kernel use the RNRs seen on 2.4 and 5GHz to
+	 * probe only the 6GHz channels with colocated APs, on top of the
+	 * PSCs, instead of sweeping every 6GHz channel.  Not used with an
+	 * explicit channel list since that would drop the non-PSC channels
+	 * with no colocated AP known.
+	 */
+	if (!params->freqs && (wiphy_get_supported_bands(sc->wiphy) &
+							BAND_FREQ_6_GHZ))
+		flags |= NL80211_SCAN_FLAG_COLOCATED_6GHZ;
+
 	if (flags)
 		l_genl_msg_append_attr(msg, NL80211_ATTR_SCAN_FLAGS, 4, &flags);
 
@@ -455,7 +703,8 @@ struct l_genl_msg *scan_build_trigger_scan_bss(uint32_t ifindex,
 						const uint8_t *ssid,
 						uint32_t ssid_len)
 {
-	struct l_genl_msg *msg = l_genl_msg_new(NL80211_CMD_TRIGGER_SCAN);
+	struct l_genl_msg *msg = l_genl_msg_new_sized(NL80211_CMD_TRIGGER_SCAN,
+							64 + ssid_len);
 	uint32_t flags = 0;
 
 	l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &ifindex);
@@ -478,58 +727,151 @@ struct l_genl_msg *scan_build_trigger_scan_bss(uint32_t ifindex,
 	return msg;
 }
 
+/*
+ * Hidden networks are probed for by SSID.  Those never seen before go
+ * into the full channel trigger(s) along with the wildcard SSID, while
+ * those with known frequencies are packed, max_scan_ssids at a time,
+ * into triggers restricted to the channels they were last seen on.
+ */
+struct scan_hidden_ssid {
+	const char *ssid;
+	struct scan_freq_set *freqs;
+};
+
+struct scan_hidden_batch {
+	struct scan_freq_set *freqs;
+	uint8_t num_ssids;
+	const char *ssids[];
+};
+
 struct scan_cmds_add_data {
-	struct scan_context *sc;
-	const struct scan_parameters *params;
-	struct l_queue *cmds;
-	struct l_genl_msg **cmd;
-	uint8_t max_ssids_per_scan;
-	uint8_t num_ssids_can_append;
+	const struct scan_freq_set *constraint;
+	struct l_queue *untargeted;
+	struct l_queue *targeted;
 };
 
+static void scan_hidden_ssid_free(void *data)
+{
+	struct scan_hidden_ssid *hidden = data;
+
+	if (hidden->freqs)
+		scan_freq_set_free(hidden->freqs);
+
+	l_free(hidden);
+}
+
 static bool scan_cmds_add_hidden(const struct network_info *network,
 					void *user_data)
 {
 	struct scan_cmds_add_data *data = user_data;
+	struct scan_hidden_ssid *hidden;
+	const struct l_queue_entry *entry;
 
 	if (!network->config.is_hidden)
 		return true;
 
-	l_genl_msg_append_attr(*data->cmd, NL80211_ATTR_SSID,
-				strlen(network->ssid), network->ssid);
-	data->num_ssids_can_append--;
+	hidden = l_new(struct scan_hidden_ssid, 1);
+	hidden->ssid = network->ssid;
+
+	if (l_queue_isempty(network->known_frequencies)) {
+		l_queue_push_tail(data->untargeted, hidden);
+		return true;
+	}
 
-	if (!data->num_ssids_can_append) {
-		l_genl_msg_leave_nested(*data->cmd);
-		l_queue_push_tail(data->cmds, *data->cmd);
+	hidden->freqs = scan_freq_set_new();
 
-		data->num_ssids_can_append = data->max_ssids_per_scan;
+	for (entry = l_queue_get_entries(network->known_frequencies); entry;
+			entry = entry->next) {
+		const struct known_frequency *kn = entry->data;
 
-		/*
-		 * Create a consecutive scan trigger in the batch of scans.
-		 * The 'flush' flag is ignored, this allows to get the results
-		 * of all scans in the batch after the last scan is finished.
-		 */
-		*data->cmd = scan_build_cmd(data->sc, true, false,
-								data->params);
-		l_genl_msg_enter_nested(*data->cmd, NL80211_ATTR_SCAN_SSIDS);
+		scan_freq_set_add(hidden->freqs, kn->frequency);
+	}
+
+	if (data->constraint)
+		scan_freq_set_constrain(hidden->freqs, data->constraint);
+
+	/* Never seen on any of the channels being scanned */
+	if (scan_freq_set_isempty(hidden->freqs)) {
+		scan_hidden_ssid_free(hidden);
+		return true;
 	}
 
+	l_queue_push_tail(data->targeted, hidden);
 	return true;
 }
 
+static unsigned int scan_hidden_batch_cost(struct scan_hidden_batch *batch,
+					const struct scan_hidden_ssid *hidden)
+{
+	struct scan_freq_set *added = scan_freq_set_new();
+	unsigned int count;
+
+	scan_freq_set_merge(added, hidden->freqs);
+	scan_freq_set_subtract(added, batch->freqs);
+	count = scan_freq_set_count(added);
+	scan_freq_set_free(added);
+
+	return count;
+}
+
+/*
+ * Each SSID joins the batch with room whose channel list it grows the
+ * least, so that SSIDs seen on the same channels share a trigger.
+ */
+static struct l_queue *scan_hidden_batches_build(struct l_queue *targeted,
+							uint8_t max_ssids)
+{
+	struct l_queue *batches = l_queue_new();
+	struct scan_hidden_ssid *hidden;
+
+	while ((hidden = l_queue_pop_head(targeted))) {
+		const struct l_queue_entry *entry;
+		struct scan_hidden_batch *best = NULL;
+		unsigned int best_cost = UINT_MAX;
+
+		for (entry = l_queue_get_entries(batches); entry;
+				entry = entry->next) {
+			struct scan_hidden_batch *batch = entry->data;
+			unsigned int cost;
+
+			if (batch->num_ssids >= max_ssids)
+				continue;
+
+			cost = scan_hidden_batch_cost(batch, hidden);
+			if (cost < best_cost) {
+				best = batch;
+				best_cost = cost;
+			}
+		}
+
+		if (!best) {
+			best = l_malloc(sizeof(struct scan_hidden_batch) +
+					sizeof(const char *) * max_ssids);
+			best->freqs = scan_freq_set_new();
+			best->num_ssids = 0;
+			l_queue_push_tail(batches, best);
+		}
+
+		scan_freq_set_merge(best->freqs, hidden->freqs);
+		best->ssids[best->num_ssids++] = hidden->ssid;
+		scan_hidden_ssid_free(hidden);
+	}
+
+	return batches;
+}
+
 static void scan_cmds_add(struct l_queue *cmds, struct scan_context *sc,
 				bool passive,
 				const struct scan_parameters *params)
 {
 	struct l_genl_msg *cmd;
-	struct scan_cmds_add_data data = {
-		sc,
-		params,
-		cmds,
-		&cmd,
-		wiphy_get_max_num_ssids_per_scan(sc->wiphy),
-	};
+	struct scan_cmds_add_data data;
+	struct scan_hidden_ssid *hidden;
+	struct scan_hidden_batch *batch;
+	struct l_queue *batches;
+	uint8_t max_ssids;
+	uint8_t room;
+	unsigned int i;
 
 	cmd = scan_build_cmd(sc, false, passive, params);
 
@@ -551,12 +893,77 @@ static void scan_cmds_add(struct l_queue *cmds, struct scan_context *sc,
 		return;
 	}
 
-	data.num_ssids_can_append = data.max_ssids_per_scan;
+	max_ssids = wiphy_get_max_num_ssids_per_scan(sc->wiphy);
+	if (!max_ssids)
+		max_ssids = 1;
+
+	data.constraint = params->freqs;
+	data.untargeted = l_queue_new();
+	data.targeted = l_queue_new();
 	known_networks_foreach(scan_cmds_add_hidden, &data);
 
+	room = max_ssids;
+
+	while ((hidden = l_queue_pop_head(data.untargeted))) {
+		l_genl_msg_append_attr(cmd, NL80211_ATTR_SSID,
+					strlen(hidden->ssid), hidden->ssid);
+		scan_hidden_ssid_free(hidden);
+
+		if (--room)
+			continue;
+
+		l_genl_msg_leave_nested(cmd);
+		l_queue_push_tail(cmds, cmd);
+
+		/*
+		 * Create a consecutive scan trigger in the batch of scans.
+		 * The 'flush' flag is ignored, this allows to get the results
+		 * of all scans in the batch after the last scan is finished.
+		 */
+		cmd = scan_build_cmd(sc, true, false, params);
+		l_genl_msg_enter_nested(cmd, NL80211_ATTR_SCAN_SSIDS);
+		room = max_ssids;
+	}
+
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_SSID, 0, NULL);
+	room--;
+
+	/* Spare room in the full channel trigger costs no extra dwell time */
+	while (room && (hidden = l_queue_pop_head(data.targeted))) {
+		l_genl_msg_append_attr(cmd, NL80211_ATTR_SSID,
+					strlen(hidden->ssid), hidden->ssid);
+		scan_hidden_ssid_free(hidden);
+		room--;
+	}
+
 	l_genl_msg_leave_nested(cmd);
 	l_queue_push_tail(cmds, cmd);
+
+	batches = scan_hidden_batches_build(data.targeted, max_ssids);
+
+	while ((batch = l_queue_pop_head(batches))) {
+		struct scan_parameters batch_params = *params;
+
+		batch_params.freqs = batch->freqs;
+
+		cmd = scan_build_cmd(sc, true, false, &batch_params);
+		l_genl_msg_enter_nested(cmd, NL80211_ATTR_SCAN_SSIDS);
+
+		for (i = 0; i < batch->num_ssids; i++)
+			l_genl_msg_append_attr(cmd, NL80211_ATTR_SSID,
+						strlen(batch->ssids[i]),
+						batch->ssids[i]);
+
+		l_genl_msg_leave_nested(cmd);
+		l_queue_push_tail(cmds, cmd);
+
+		scan_freq_set_free(batch->freqs);
+		l_free(batch);
+	}
+
+	l_queue_destroy(batches, NULL);
+	l_queue_destroy(data.untargeted, NULL);
+	l_queue_destroy(data.targeted, NULL);
 }
 
 static int scan_request_send_trigger(struct scan_context *sc,
@@ -581,9 +988,55 @@ static int scan_request_send_trigger(struct scan_context *sc,
 	return -EIO;
 }
 
+/*
+ * Called when more urgent radio work, such as a connection or roam, is
+ * queued while this request is running.  A scan that is still waiting
+ * for the radio is simply put back, one in progress is aborted and its
+ * current command re-sent when the request runs again.  Once GET_SCAN
+ * is pending the radio is no longer in use, let it complete.
+ */
+static bool scan_request_preempt(struct wiphy_radio_work_item *item)
+{
+	struct scan_request *sr = l_container_of(item,
+						struct scan_request, work);
+	struct scan_context *sc = sr->sc;
+	struct l_genl_msg *msg;
+
+	if (sr->in_callback || sr->canceled || sc->start_cmd_id ||
+			sc->get_scan_cmd_id)
+		return false;
+
+	if (!sr->triggered) {
+		l_debug("Preempting pending scan for wdev %" PRIx64,
+				sc->wdev_id);
+		return true;
+	}
+
+	msg = l_genl_msg_new_sized(NL80211_CMD_ABORT_SCAN, 16);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WDEV, 8, &sc->wdev_id);
+
+	if (!l_genl_family_send(nl80211, msg, NULL, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		return false;
+	}
+
+	l_debug("Aborting scan for wdev %" PRIx64 " to make way for"
+			" more urgent work", sc->wdev_id);
+
+	/*
+	 * The resulting SCAN_ABORTED is then treated like an external
+	 * scan being aborted since this request is no longer running.
+	 */
+	sr->triggered = false;
+
+	return true;
+}
+
 static const struct wiphy_radio_work_item_ops work_ops = {
 	.do_work = start_next_scan_request,
 	.destroy = scan_request_free,
+	.preempt = scan_request_preempt,
+	.type = WIPHY_WORK_TYPE_SCAN,
 };
 
 static struct scan_request *scan_request_new(struct scan_context *sc,
@@ -607,6 +1060,71 @@ static struct scan_request *scan_request_new(struct scan_context *sc,
 	return sr;
 }
 
+static bool scan_params_coalescable(const struct scan_parameters *params)
+{
+	return !params->extra_ie && !params->ssid && !params->source_mac &&
+		!params->duration && !params->flush && !params->no_cck_rates;
+}
+
+static bool scan_freqs_covered(const struct scan_freq_set *freqs,
+				const struct scan_freq_set *by)
+{
+	struct scan_freq_set *missing;
+	bool covered;
+
+	if (!by)
+		return true;
+
+	if (!freqs)
+		return false;
+
+	missing = scan_freq_set_new();
+	scan_freq_set_merge(missing, freqs);
+	scan_freq_set_subtract(missing, by);
+	covered = scan_freq_set_isempty(missing);
+	scan_freq_set_free(missing);
+
+	return covered;
+}
+
+/*
+ * Find a pending request that will run before one with @priority and
+ * whose scan is a superset of it: an active scan covers a passive one,
+ * and every frequency must be included.
+ */
+static struct scan_request *scan_find_leader(struct scan_context *sc,
+						bool passive,
+						const struct scan_freq_set *freqs,
+						int priority)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(sc->requests); entry;
+							entry = entry->next) {
+		struct scan_request *sr = entry->data;
+
+		if (!sr->coalescable || sr->leader)
+			continue;
+
+		if (sr->started || sr->triggered || sr->canceled ||
+				!sr->callback)
+			continue;
+
+		if (sr->passive && !passive)
+			continue;
+
+		if (sr->work.priority > priority)
+			continue;
+
+		if (!scan_freqs_covered(freqs, sr->freqs))
+			continue;
+
+		return sr;
+	}
+
+	return NULL;
+}
+
 static uint32_t scan_common(uint64_t wdev_id, bool passive,
 				const struct scan_parameters *params,
 				int priority,
@@ -616,8 +1134,10 @@ static uint32_t scan_common(uint64_t wdev_id, bool passive,
 {
 	struct scan_context *sc;
 	struct scan_request *sr;
+	struct scan_request *leader = NULL;
+	uint32_t id;
 
-	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	sc = scan_context_find(wdev_id);
 
 	if (!sc)
 		return 0;
@@ -626,10 +1146,35 @@ static uint32_t scan_common(uint64_t wdev_id, bool passive,
 
 	scan_cmds_add(sr->cmds, sc, passive, params);
 
+	if (scan_params_coalescable(params)) {
+		sr->coalescable = true;
+
+		if (params->freqs) {
+			sr->freqs = scan_freq_set_new();
+			scan_freq_set_merge(sr->freqs, params->freqs);
+		}
+
+		leader = scan_find_leader(sc, passive, sr->freqs, priority);
+	}
+
 	l_queue_push_tail(sc->requests, sr);
 
-	return wiphy_radio_work_insert(sc->wiphy, &sr->work,
+	id = wiphy_radio_work_insert(sc->wiphy, &sr->work,
 					priority, &work_ops);
+
+	/* The work item may have already been started above */
+	if (leader && !sr->started && !sr->triggered) {
+		l_debug("Coalescing scan request %u into %u", id,
+							leader->work.id);
+
+		if (!leader->followers)
+			leader->followers = l_queue_new();
+
+		sr->leader = leader;
+		l_queue_push_tail(leader->followers, sr);
+	}
+
+	return id;
 }
 
 uint32_t scan_passive(uint64_t wdev_id, struct scan_freq_set *freqs,
@@ -739,7 +1284,7 @@ uint32_t scan_owe_hidden(uint64_t wdev_id, struct l_queue *list,
 	struct scan_bss *bss;
 	bool ignore_flush = false;
 
-	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	sc = scan_context_find(wdev_id);
 
 	if (!sc)
 		return 0;
@@ -822,7 +1367,7 @@ bool scan_cancel(uint64_t wdev_id, uint32_t id)
 
 	l_debug("Trying to cancel scan id %u for wdev %" PRIx64, id, wdev_id);
 
-	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	sc = scan_context_find(wdev_id);
 	if (!sc)
 		return false;
 
@@ -834,6 +1379,16 @@ bool scan_cancel(uint64_t wdev_id, uint32_t id)
 	if (sr->in_callback)
 		goto call_destroy;
 
+	/*
+	 * We're in the middle of the GET_SCAN dump, let it run to completion
+	 * but don't deliver anything else to the caller
+	 */
+	if (sr->in_bss_callback) {
+		sr->callback = NULL;
+		sr->bss_callback = NULL;
+		goto call_destroy;
+	}
+
 	/* If already triggered, just zero out the callback */
 	if (sr->triggered) {
 		l_debug("Scan has been triggered, wait for it to complete");
@@ -882,6 +1437,31 @@ call_destroy:
 	return true;
 }
 
+/*
+ * Registers a callback invoked for each BSS as soon as it is parsed out of
+ * the GET_SCAN dump, before the complete result list is delivered through
+ * the request's notify callback.  The scan_bss object is only borrowed for
+ * the duration of the callback, the final bss_list still contains it.
+ */
+bool scan_set_bss_callback(uint64_t wdev_id, uint32_t id,
+				scan_bss_func_t bss_callback)
+{
+	struct scan_context *sc;
+	struct scan_request *sr;
+
+	sc = scan_context_find(wdev_id);
+	if (!sc)
+		return false;
+
+	sr = l_queue_find(sc->requests, scan_request_match, L_UINT_TO_PTR(id));
+	if (!sr || sr->canceled)
+		return false;
+
+	sr->bss_callback = bss_callback;
+
+	return true;
+}
+
 static void scan_periodic_triggered(int err, void *user_data)
 {
 	struct scan_context *sc = user_data;
@@ -918,11 +1498,34 @@ static void scan_periodic_destroy(void *user_data)
 	sc->sp.id = 0;
 }
 
+static bool scan_periodic_cached_notify(int err, struct l_queue *bss_list,
+					const struct scan_freq_set *freqs,
+					void *user_data)
+{
+	struct scan_context *sc = user_data;
+
+	if (sc->sp.callback)
+		return sc->sp.callback(err, bss_list, freqs, sc->sp.userdata);
+
+	return false;
+}
+
 static bool scan_periodic_queue(struct scan_context *sc)
 {
 	struct scan_parameters params = {};
 	struct scan_request *sr;
 
+	/*
+	 * Another wdev on this wiphy has just scanned everything we would,
+	 * reuse its results and wait for the next interval.
+	 */
+	if (!sc->sp.needs_active_scan && scan_get_cached_results(sc->wdev_id, NULL,
+						scan_periodic_cached_notify,
+						sc, NULL)) {
+		scan_periodic_rearm(sc);
+		return true;
+	}
+
 	if (scan_active_is_enabled() || (sc->sp.needs_active_scan && known_networks_has_hidden())) {
 		params.randomize_mac_addr_hint = true;
 
@@ -957,7 +1560,316 @@ static bool scan_periodic_is_disabled(void)
 								&disabled))
 		return false;
 
-	return disabled;
+	return disabled;
+}
+
+struct scan_sched_data {
+	struct l_genl_msg *msg;
+	uint32_t max_match_sets;
+	uint8_t max_ssids;
+	unsigned int num_match_sets;
+	unsigned int num_ssids;
+	bool unmatchable:1;
+};
+
+static bool scan_sched_add_ssid(const struct network_info *network,
+					void *user_data)
+{
+	struct scan_sched_data *data = user_data;
+
+	if (!network->config.is_hidden || !network->config.is_autoconnectable)
+		return true;
+
+	if (data->num_ssids >= data->max_ssids) {
+		data->unmatchable = true;
+		return false;
+	}
+
+	data->num_ssids++;
+
+	if (data->msg)
+		l_genl_msg_append_attr(data->msg, data->num_ssids,
+					strlen(network->ssid), network->ssid);
+
+	return true;
+}
+
+static bool scan_sched_add_match_set(const struct network_info *network,
+					void *user_data)
+{
+	struct scan_sched_data *data = user_data;
+	int32_t rssi = SCHED_SCAN_RSSI_THRESHOLD;
+
+	if (!network->config.is_autoconnectable)
+		return true;
+
+	/* Hotspot networks are matched by their IEs, not their SSID */
+	if (network->is_hotspot ||
+			data->num_match_sets >= data->max_match_sets) {
+		data->unmatchable = true;
+		return false;
+	}
+
+	data->num_match_sets++;
+
+	if (!data->msg)
+		return true;
+
+	l_genl_msg_enter_nested(data->msg, data->num_match_sets);
+	l_genl_msg_append_attr(data->msg, NL80211_SCHED_SCAN_MATCH_ATTR_SSID,
+				strlen(network->ssid), network->ssid);
+	l_genl_msg_append_attr(data->msg, NL80211_SCHED_SCAN_MATCH_ATTR_RSSI,
+				4, &rssi);
+	l_genl_msg_leave_nested(data->msg);
+
+	return true;
+}
+
+/*
+ * Follows the same back-off as the host driven periodic scan, ending
+ * with a plan that repeats at SCAN_MAX_INTERVAL forever.
+ */
+static void scan_sched_build_plans(struct wiphy *wiphy,
+					struct l_genl_msg *msg)
+{
+	uint32_t max_plans;
+	uint32_t max_interval;
+	uint32_t max_iterations;
+	uint32_t interval = SCAN_INIT_INTERVAL;
+	uint32_t iterations = 1;	/* Each back-off step runs once */
+	uint32_t n = 0;
+
+	wiphy_get_sched_scan_plan_limits(wiphy, &max_plans,
+						&max_interval, &max_iterations);
+
+	/* Net-detect may be supported without scan plans, in ms then */
+	if (!max_plans) {
+		interval = SCAN_MAX_INTERVAL * 1000;
+		l_genl_msg_append_attr(msg, NL80211_ATTR_SCHED_SCAN_INTERVAL,
+					4, &interval);
+		return;
+	}
+
+	l_genl_msg_enter_nested(msg, NL80211_ATTR_SCHED_SCAN_PLANS);
+
+	while (n + 1 < max_plans && interval &&
+			interval < SCAN_MAX_INTERVAL &&
+			(!max_interval || interval <= max_interval) &&
+			iterations <= max_iterations) {
+		l_genl_msg_enter_nested(msg, ++n);
+		l_genl_msg_append_attr(msg, NL80211_SCHED_SCAN_PLAN_INTERVAL,
+					4, &interval);
+		l_genl_msg_append_attr(msg, NL80211_SCHED_SCAN_PLAN_ITERATIONS,
+					4, &iterations);
+		l_genl_msg_leave_nested(msg);
+
+		interval *= 2;
+	}
+
+	interval = SCAN_MAX_INTERVAL;
+
+	if (max_interval && interval > max_interval)
+		interval = max_interval;
+
+	if (!interval)
+		interval = 1;
+
+	l_genl_msg_enter_nested(msg, ++n);
+	l_genl_msg_append_attr(msg, NL80211_SCHED_SCAN_PLAN_INTERVAL,
+				4, &interval);
+	l_genl_msg_leave_nested(msg);
+
+	l_genl_msg_leave_nested(msg);
+}
+
+/*
+ * Whether every autoconnectable known network can be matched by SSID.
+ * This is not possible, for example, due to Hotspot networks, more
+ * networks than the device has match sets or more hidden networks than
+ * it can probe for.
+ */
+static bool scan_sched_matchable(struct wiphy *wiphy, uint32_t max_match_sets)
+{
+	struct scan_sched_data data = {};
+
+	data.max_match_sets = max_match_sets;
+	data.max_ssids = wiphy_get_max_num_sched_ssids(wiphy);
+
+	known_networks_foreach(scan_sched_add_ssid, &data);
+	known_networks_foreach(scan_sched_add_match_set, &data);
+
+	return !data.unmatchable && data.num_match_sets;
+}
+
+/* Appends the attributes of a scheduled scan for the known networks */
+static void scan_sched_build_attrs(struct wiphy *wiphy,
+					struct l_genl_msg *msg,
+					uint32_t max_match_sets,
+					uint32_t random_mac_feature)
+{
+	struct scan_sched_data data = {};
+	uint32_t flags = 0;
+
+	data.msg = msg;
+	data.max_match_sets = max_match_sets;
+	data.max_ssids = wiphy_get_max_num_sched_ssids(wiphy);
+
+	/* Probe for hidden networks, the scan is passive if none are added */
+	l_genl_msg_enter_nested(msg, NL80211_ATTR_SCAN_SSIDS);
+	known_networks_foreach(scan_sched_add_ssid, &data);
+
+	/* The wildcard SSID */
+	if (scan_active_is_enabled() && data.num_ssids < data.max_ssids)
+		l_genl_msg_append_attr(msg, ++data.num_ssids, 0, NULL);
+
+	l_genl_msg_leave_nested(msg);
+
+	if (data.num_ssids && wiphy_has_feature(wiphy, random_mac_feature) &&
+			!scan_mac_address_randomization_is_disabled())
+		flags |= NL80211_SCAN_FLAG_RANDOM_ADDR;
+
+	l_genl_msg_enter_nested(msg, NL80211_ATTR_SCHED_SCAN_MATCH);
+	known_networks_foreach(scan_sched_add_match_set, &data);
+	l_genl_msg_leave_nested(msg);
+
+	if (flags)
+		l_genl_msg_append_attr(msg, NL80211_ATTR_SCAN_FLAGS, 4, &flags);
+
+	scan_sched_build_plans(wiphy, msg);
+}
+
+static size_t scan_sched_attrs_size(struct wiphy *wiphy,
+					uint32_t max_match_sets)
+{
+	return 128 + max_match_sets * 56 +
+			wiphy_get_max_num_sched_ssids(wiphy) * 36;
+}
+
+static struct l_genl_msg *scan_sched_build_cmd(struct scan_context *sc)
+{
+	uint32_t max_match_sets = wiphy_get_max_match_sets(sc->wiphy);
+	struct l_genl_msg *msg;
+
+	if (!scan_sched_matchable(sc->wiphy, max_match_sets))
+		return NULL;
+
+	msg = l_genl_msg_new_sized(NL80211_CMD_START_SCHED_SCAN,
+				scan_sched_attrs_size(sc->wiphy,
+							max_match_sets));
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WDEV, 8, &sc->wdev_id);
+	scan_sched_build_attrs(sc->wiphy, msg, max_match_sets,
+				NL80211_FEATURE_SCHED_SCAN_RANDOM_MAC_ADDR);
+
+	return msg;
+}
+
+size_t scan_net_detect_size(struct wiphy *wiphy)
+{
+	return scan_sched_attrs_size(wiphy,
+				wiphy_get_wowlan_max_nd_match_sets(wiphy));
+}
+
+/*
+ * Appends the WoWLAN net-detect trigger, a scheduled scan run by the
+ * firmware while suspended that wakes the host once a known network is
+ * found.
+ */
+bool scan_build_net_detect(struct wiphy *wiphy, struct l_genl_msg *msg)
+{
+	uint32_t max_match_sets = wiphy_get_wowlan_max_nd_match_sets(wiphy);
+
+	if (!max_match_sets || !scan_sched_matchable(wiphy, max_match_sets))
+		return false;
+
+	l_genl_msg_enter_nested(msg, NL80211_WOWLAN_TRIG_NET_DETECT);
+	scan_sched_build_attrs(wiphy, msg, max_match_sets,
+				NL80211_FEATURE_ND_RANDOM_MAC_ADDR);
+	l_genl_msg_leave_nested(msg);
+
+	return true;
+}
+
+static void scan_sched_started(struct l_genl_msg *msg, void *user_data)
+{
+	struct scan_context *sc = user_data;
+	int err = l_genl_msg_get_error(msg);
+
+	sc->sp.sched_cmd_id = 0;
+
+	if (err < 0) {
+		l_debug("Scheduled scan failed for wdev %" PRIx64 ": %s(%d), "
+			"falling back to periodic scan", sc->wdev_id,
+			strerror(-err), -err);
+
+		sc->sp.sched = false;
+		scan_periodic_queue(sc);
+		return;
+	}
+
+	l_debug("Scheduled scan started for wdev %" PRIx64, sc->wdev_id);
+}
+
+static bool scan_sched_start(struct scan_context *sc)
+{
+	struct l_genl_msg *msg;
+
+	if (!SCHED_SCAN_ENABLED || !wiphy_supports_sched_scan(sc->wiphy))
+		return false;
+
+	msg = scan_sched_build_cmd(sc);
+	if (!msg)
+		return false;
+
+	sc->sp.sched_cmd_id = l_genl_family_send(nl80211, msg,
+							scan_sched_started,
+							sc, NULL);
+	if (!sc->sp.sched_cmd_id) {
+		l_genl_msg_unref(msg);
+		return false;
+	}
+
+	sc->sp.sched = true;
+
+	return true;
+}
+
+static void scan_sched_stop_cb(struct l_genl_msg *msg, void *user_data)
+{
+	const uint64_t *wdev_id = user_data;
+	struct scan_context *sc;
+
+	if (l_genl_msg_get_error(msg) >= 0)
+		return;
+
+	/* Nothing was running, so there won't be a STOPPED event either */
+	sc = scan_context_find(*wdev_id);
+	if (sc && sc->sp.sched_stops)
+		sc->sp.sched_stops--;
+}
+
+static void scan_sched_stop(struct scan_context *sc)
+{
+	struct l_genl_msg *msg;
+
+	if (sc->sp.sched_cmd_id) {
+		l_genl_family_cancel(nl80211, sc->sp.sched_cmd_id);
+		sc->sp.sched_cmd_id = 0;
+	}
+
+	sc->sp.sched = false;
+
+	/* Also sent if the start was canceled, it may have been processed */
+	msg = l_genl_msg_new_sized(NL80211_CMD_STOP_SCHED_SCAN, 16);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WDEV, 8, &sc->wdev_id);
+
+	if (!l_genl_family_send(nl80211, msg, scan_sched_stop_cb,
+				l_memdup(&sc->wdev_id, sizeof(sc->wdev_id)),
+				l_free)) {
+		l_genl_msg_unref(msg);
+		return;
+	}
+
+	sc->sp.sched_stops++;
 }
 
 void scan_periodic_start(uint64_t wdev_id, scan_trigger_func_t trigger,
@@ -968,7 +1880,7 @@ void scan_periodic_start(uint64_t wdev_id, scan_trigger_func_t trigger,
 	if (scan_periodic_is_disabled())
 		return;
 
-	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	sc = scan_context_find(wdev_id);
 
 	if (!sc) {
 		l_error("%s called without scan_wdev_add", __func__);
@@ -985,6 +1897,10 @@ void scan_periodic_start(uint64_t wdev_id, scan_trigger_func_t trigger,
 	sc->sp.callback = func;
 	sc->sp.userdata = userdata;
 
+	/* Let the firmware scan and only wake us up for a known network */
+	if (scan_sched_start(sc))
+		return;
+
 	/* If nothing queued, start the first periodic scan */
 	scan_periodic_queue(sc);
 }
@@ -993,7 +1909,7 @@ bool scan_periodic_stop(uint64_t wdev_id)
 {
 	struct scan_context *sc;
 
-	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	sc = scan_context_find(wdev_id);
 
 	if (!sc)
 		return false;
@@ -1003,6 +1919,9 @@ bool scan_periodic_stop(uint64_t wdev_id)
 
 	l_debug("Stopping periodic scan for wdev %" PRIx64, wdev_id);
 
+	if (sc->sp.sched)
+		scan_sched_stop(sc);
+
 	if (sc->sp.timeout)
 		l_timeout_remove(sc->sp.timeout);
 
@@ -1025,7 +1944,7 @@ uint64_t scan_get_triggered_time(uint64_t wdev_id, uint32_t id)
 	struct scan_context *sc;
 	struct scan_request *sr;
 
-	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	sc = scan_context_find(wdev_id);
 	if (!sc)
 		return 0;
 
@@ -1084,6 +2003,10 @@ static bool start_next_scan_request(struct wiphy_radio_work_item *item)
 						struct scan_request, work);
 	struct scan_context *sc = sr->sc;
 
+	/* Leader is gone or got reordered behind us, scan on our own */
+	if (sr->leader)
+		scan_request_detach(sr);
+
 	if (sc->state != SCAN_STATE_NOT_RUNNING)
 		return false;
 
@@ -1103,12 +2026,12 @@ static void scan_parse_vendor_specific(struct scan_bss *bss, const void *data,
 	bool dgaf_disable;
 
 	if (!bss->wpa && is_ie_wpa_ie(data, len)) {
-		bss->wpa = l_memdup(data - 2, len + 2);
+		bss->wpa = (uint8_t *) data - 2;
 		return;
 	}
 
 	if (!bss->osen && is_ie_wfa_ie(data, len, IE_WFA_OI_OSEN)) {
-		bss->osen = l_memdup(data - 2, len + 2);
+		bss->osen = (uint8_t *) data - 2;
 		return;
 	}
 
@@ -1201,16 +2124,87 @@ static bool scan_parse_advertisement_protocol(struct scan_bss *bss,
 	return true;
 }
 
-static bool scan_parse_bss_information_elements(struct scan_bss *bss,
+/*
+ * Copies the RSN, RSNX, WPA, OSEN and Roaming Consortium elements into a
+ * single allocation owned by the BSS.  On entry these bss members point into
+ * the element data being parsed, on return they point into bss->ies.
+ */
+static void scan_bss_store_ies(struct scan_bss *bss)
+{
+	uint8_t **ies[] = {
+		&bss->rsne, &bss->rsnxe, &bss->wpa, &bss->osen, &bss->rc_ie,
+	};
+	size_t total = 0;
+	unsigned int i;
+	uint8_t *pos;
+
+	for (i = 0; i < L_ARRAY_SIZE(ies); i++)
+		if (*ies[i])
+			total += (*ies[i])[1] + 2;
+
+	if (!total)
+		return;
+
+	bss->ies = pos = l_malloc(total);
+
+	for (i = 0; i < L_ARRAY_SIZE(ies); i++) {
+		size_t ie_len;
+
+		if (!*ies[i])
+			continue;
+
+		ie_len = (*ies[i])[1] + 2;
+		memcpy(pos, *ies[i], ie_len);
+		*ies[i] = pos;
+		pos += ie_len;
+	}
+}
+
+static bool scan_bss_add_rnr(const struct ie_rnr_info *info, void *user_data)
+{
+	struct scan_bss *bss = user_data;
+	uint32_t freq;
+
+	/*
+	 * Only keep the 6GHz APs advertising the same SSID, these are the
+	 * candidate BSSes of the same network to be probed directly.
+	 */
+	if (!info->bss_params_present ||
+			!(info->bss_params & IE_RNR_BSS_PARAMS_SAME_SSID))
+		return true;
+
+	if (band_oper_class_to_band(NULL, info->oper_class) !=
+			BAND_FREQ_6_GHZ)
+		return true;
+
+	freq = band_channel_to_freq(info->channel_num, BAND_FREQ_6_GHZ);
+	if (!freq)
+		return true;
+
+	if (!bss->rnr_6ghz_freqs)
+		bss->rnr_6ghz_freqs = scan_freq_set_new();
+
+	scan_freq_set_add(bss->rnr_6ghz_freqs, freq);
+
+	return true;
+}
+
+bool scan_parse_bss_information_elements(struct scan_bss *bss,
 					const void *data, uint16_t len)
 {
 	struct ie_tlv_iter iter;
+	struct ie_index index;
 	bool have_ssid = false;
+	struct p2p_discovery_info p2p_info;
+	bool valid = false;
 
+	ie_index_reset(&index, data, len);
 	ie_tlv_iter_init(&iter, data, len);
 
 	while (ie_tlv_iter_next(&iter)) {
-		uint8_t tag = ie_tlv_iter_get_tag(&iter);
+		unsigned int tag = ie_tlv_iter_get_tag(&iter);
+
+		ie_index_add(&index, &iter);
 
 		switch (tag) {
 		case IE_TYPE_SSID:
@@ -1223,13 +2217,11 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 			break;
 		case IE_TYPE_RSN:
 			if (!bss->rsne)
-				bss->rsne = l_memdup(iter.data - 2,
-								iter.len + 2);
+				bss->rsne = (uint8_t *) iter.data - 2;
 			break;
 		case IE_TYPE_RSNX:
 			if (!bss->rsnxe)
-				bss->rsnxe = l_memdup(iter.data - 2,
-								iter.len + 2);
+				bss->rsnxe = (uint8_t *) iter.data - 2;
 			break;
 		case IE_TYPE_BSS_LOAD:
 			if (ie_parse_bss_load(&iter, NULL, &bss->utilization,
@@ -1250,6 +2242,10 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 			}
 
 			break;
+		case IE_TYPE_REDUCED_NEIGHBOR_REPORT:
+			ie_parse_reduced_neighbor_report(&iter,
+							scan_bss_add_rnr, bss);
+			break;
 		case IE_TYPE_RM_ENABLED_CAPABILITIES:
 			if (iter.len != 5)
 				break;
@@ -1275,6 +2271,21 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 		case IE_TYPE_VHT_CAPABILITIES:
 			bss->vht_capable = true;
 			break;
+		case IE_TYPE_MULTI_LINK:
+			/*
+			 * Basic Multi-Link element: Multi-Link Control (Type 0),
+			 * Common Info Length, then the AP MLD MAC Address
+			 * (IEEE 802.11be - 9.4.2.312.2)
+			 */
+			if (bss->mlo_capable || iter.len < 9 ||
+					bit_field(iter.data[0], 0, 3) != 0 ||
+					iter.data[2] < 7)
+				break;
+
+			memcpy(bss->mld_addr, iter.data + 3, 6);
+			bss->mlo_capable = true;
+			l_debug("AP MLD: "MAC, MAC_STR(bss->mld_addr));
+			break;
 		case IE_TYPE_ADVERTISEMENT_PROTOCOL:
 			if (iter.len < 2)
 				return false;
@@ -1297,7 +2308,7 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 			if (iter.len < 2)
 				return false;
 
-			bss->rc_ie = l_memdup(iter.data - 2, iter.len + 2);
+			bss->rc_ie = (uint8_t *) iter.data - 2;
 
 			break;
 
@@ -1320,31 +2331,16 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 		}
 	}
 
-	bss->wsc = ie_tlv_extract_wsc_payload(data, len, &bss->wsc_size);
-
-	switch (bss->source_frame) {
-	case SCAN_BSS_PROBE_RESP:
-		bss->p2p_probe_resp_info = l_new(struct p2p_probe_resp, 1);
-
-		if (p2p_parse_probe_resp(data, len, bss->p2p_probe_resp_info) ==
-				0)
-			break;
-
-		l_free(bss->p2p_probe_resp_info);
-		bss->p2p_probe_resp_info = NULL;
-		break;
-	case SCAN_BSS_PROBE_REQ:
-		bss->p2p_probe_req_info = l_new(struct p2p_probe_req, 1);
+	scan_bss_store_ies(bss);
 
-		if (p2p_parse_probe_req(data, len, bss->p2p_probe_req_info) ==
-				0)
-			break;
+	/*
+	 * The vendor payloads are extracted from the vendor elements recorded
+	 * above, and the P2P parser is skipped for the common non-P2P BSS.
+	 */
+	bss->wsc = ie_index_extract_wsc_payload(&index, &bss->wsc_size);
 
-		l_free(bss->p2p_probe_req_info);
-		bss->p2p_probe_req_info = NULL;
-		break;
-	case SCAN_BSS_BEACON:
-	{
+	if (ie_index_has_vendor(&index, wifi_alliance_oui, 0x09) &&
+			p2p_parse_discovery_info(data, len, &p2p_info) == 0) {
 		/*
 		 * Beacon and Probe Response P2P IE subelement formats are
 		 * mutually incompatible and can help us distinguish one frame
@@ -1353,33 +2349,30 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 		 * this, no critical code should depend on the
 		 * bss->source_frame information being right.
 		 */
-		struct p2p_beacon info;
-		int r;
+		if (bss->source_frame == SCAN_BSS_BEACON &&
+				p2p_info.have_device_info &&
+				!p2p_info.have_device_id)
+			bss->source_frame = SCAN_BSS_PROBE_RESP;
 
-		r = p2p_parse_beacon(data, len, &info);
-		if (r == 0) {
-			bss->p2p_beacon_info = l_memdup(&info, sizeof(info));
+		switch (bss->source_frame) {
+		case SCAN_BSS_PROBE_RESP:
+			valid = p2p_info.have_device_info &&
+				!p2p_info.have_device_id;
 			break;
-		}
-
-		if (r == -ENOENT)
+		case SCAN_BSS_PROBE_REQ:
+			valid = true;
 			break;
-
-		bss->p2p_probe_resp_info = l_new(struct p2p_probe_resp, 1);
-
-		if (p2p_parse_probe_resp(data, len, bss->p2p_probe_resp_info) ==
-				0) {
-			bss->source_frame = SCAN_BSS_PROBE_RESP;
+		case SCAN_BSS_BEACON:
+			valid = p2p_info.have_device_id &&
+				!p2p_info.have_device_info;
 			break;
 		}
 
-		l_free(bss->p2p_probe_resp_info);
-		bss->p2p_probe_resp_info = NULL;
-		break;
-	}
+		if (valid)
+			bss->p2p_info = l_memdup(&p2p_info, sizeof(p2p_info));
 	}
 
-	bss->wfd = ie_tlv_extract_wfd_payload(data, len, &bss->wfd_size);
+	bss->wfd = ie_index_extract_wfd_payload(&index, &bss->wfd_size);
 
 	return have_ssid;
 }
@@ -1400,9 +2393,9 @@ static int32_t signal_unspec_to_mbm(uint8_t strength)
 	return ((int32_t)strength * 100) - 10000;
 }
 
-static struct scan_bss *scan_parse_attr_bss(struct l_genl_attr *attr,
-						struct wiphy *wiphy,
-						uint32_t *out_seen_ms_ago)
+struct scan_bss *scan_parse_attr_bss(struct l_genl_attr *attr,
+					struct wiphy *wiphy,
+					uint32_t *out_seen_ms_ago)
 {
 	uint16_t type, len;
 	const void *data;
@@ -1412,7 +2405,7 @@ static struct scan_bss *scan_parse_attr_bss(struct l_genl_attr *attr,
 	const uint8_t *beacon_ies = NULL;
 	size_t beacon_ies_len;
 
-	bss = l_new(struct scan_bss, 1);
+	bss = scan_bss_alloc();
 	bss->utilization = 127;
 	bss->source_frame = SCAN_BSS_BEACON;
 
@@ -1562,16 +2555,16 @@ static struct scan_bss *scan_parse_result(struct l_genl_msg *msg,
 	return bss;
 }
 
-static void scan_bss_compute_rank(struct scan_bss *bss)
+void scan_bss_compute_rank(struct scan_bss *bss)
 {
 	static const double RANK_HIGH_UTILIZATION_FACTOR = 0.8;
 	static const double RANK_LOW_UTILIZATION_FACTOR = 1.2;
 	double rank;
 	uint32_t irank;
 	/*
-	 * Maximum rate is 2340Mbps (VHT)
+	 * Maximum rate is 4804Mbps (HE, 160Mhz, 4 spatial streams)
 	 */
-	double max_rate = 2340000000;
+	double max_rate = 4804000000;
 
 	rank = (double)bss->data_rate / max_rate * USHRT_MAX;
 
@@ -1585,6 +2578,9 @@ static void scan_bss_compute_rank(struct scan_bss *bss)
 	else if (bss->utilization <= 63)
 		rank *= RANK_LOW_UTILIZATION_FACTOR;
 
+	/* Account for how the BSS performed when we actually used it */
+	rank *= bss_history_rank_factor(bss);
+
 	irank = rank;
 
 	if (irank > USHRT_MAX)
@@ -1601,7 +2597,7 @@ struct scan_bss *scan_bss_new_from_probe_req(const struct mmpdu_header *mpdu,
 {
 	struct scan_bss *bss;
 
-	bss = l_new(struct scan_bss, 1);
+	bss = scan_bss_alloc();
 	memcpy(bss->addr, mpdu->address_2, 6);
 	bss->utilization = 127;
 	bss->source_frame = SCAN_BSS_PROBE_REQ;
@@ -1620,40 +2616,14 @@ fail:
 
 void scan_bss_free(struct scan_bss *bss)
 {
-	l_free(bss->rsne);
-	l_free(bss->rsnxe);
-	l_free(bss->wpa);
+	l_free(bss->ies);
 	l_free(bss->wsc);
-	l_free(bss->osen);
-	l_free(bss->rc_ie);
 	l_free(bss->wfd);
 	l_free(bss->owe_trans);
 
-	switch (bss->source_frame) {
-	case SCAN_BSS_PROBE_RESP:
-		if (!bss->p2p_probe_resp_info)
-			break;
-
-		p2p_clear_probe_resp(bss->p2p_probe_resp_info);
-		l_free(bss->p2p_probe_resp_info);
-		break;
-	case SCAN_BSS_PROBE_REQ:
-		if (!bss->p2p_probe_req_info)
-			break;
-
-		p2p_clear_probe_req(bss->p2p_probe_req_info);
-		l_free(bss->p2p_probe_req_info);
-		break;
-	case SCAN_BSS_BEACON:
-		if (!bss->p2p_beacon_info)
-			break;
-
-		p2p_clear_beacon(bss->p2p_beacon_info);
-		l_free(bss->p2p_beacon_info);
-		break;
-	}
-
-	l_free(bss);
+	l_free(bss->p2p_info);
+	scan_freq_set_free(bss->rnr_6ghz_freqs);
+	scan_bss_release(bss);
 }
 
 int scan_bss_get_rsn_info(const struct scan_bss *bss, struct ie_rsn_info *info)
@@ -1692,6 +2662,60 @@ int scan_bss_get_rsn_info(const struct scan_bss *bss, struct ie_rsn_info *info)
 	return 0;
 }
 
+int scan_bss_get_security(const struct scan_bss *bss,
+				enum security *out_security)
+{
+	struct ie_rsn_info info;
+	int r;
+
+	r = scan_bss_get_rsn_info(bss, &info);
+	if (r < 0) {
+		if (r != -ENOENT)
+			return r;
+
+		*out_security = security_determine(bss->capability, NULL);
+	} else
+		*out_security = security_determine(bss->capability, &info);
+
+	return 0;
+}
+
+/*
+ * Roam candidate selection, shared by station and tools/roam-replay so
+ * that the replay follows the same decisions.  A BSS is a candidate if it
+ * is part of the ESS we're connected to, with the same security.
+ */
+bool scan_bss_roam_in_ess(const struct scan_bss *bss, const uint8_t *ssid,
+				size_t ssid_len, enum security security)
+{
+	enum security bss_security;
+
+	if (bss->ssid_len != ssid_len || memcmp(bss->ssid, ssid, ssid_len))
+		return false;
+
+	if (scan_bss_get_security(bss, &bss_security) < 0)
+		return false;
+
+	return bss_security == security;
+}
+
+/*
+ * BSSes come already ranked with their initial association preference rank
+ * value.  We only need to add preference for BSSes that are within the FT
+ * Mobility Domain @mdid of the current connection, if any, so as to favor
+ * Fast Roaming.
+ */
+double scan_bss_roam_rank(const struct scan_bss *bss, const uint8_t *mdid)
+{
+	static const double RANK_FT_FACTOR = 1.3;
+	double rank = bss->rank;
+
+	if (mdid && bss->mde_present && !memcmp(bss->mde, mdid, 2))
+		rank *= RANK_FT_FACTOR;
+
+	return rank;
+}
+
 int scan_bss_rank_compare(const void *a, const void *b, void *user_data)
 {
 	const struct scan_bss *new_bss = a, *bss = b;
@@ -1703,6 +2727,38 @@ int scan_bss_rank_compare(const void *a, const void *b, void *user_data)
 	return (bss->rank > new_bss->rank) ? 1 : -1;
 }
 
+/*
+ * Each requester owns the scan_bss objects it is handed, so followers get
+ * their own copy parsed from the same GET_SCAN message.
+ */
+static void scan_results_add_coalesced(struct scan_results *results,
+					struct l_genl_msg *msg)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(results->sr->followers); entry;
+							entry = entry->next) {
+		struct scan_request *follower = entry->data;
+		struct scan_bss *bss;
+		uint32_t seen_ms_ago = 0;
+
+		bss = scan_parse_result(msg, results->sc->wiphy, &seen_ms_ago);
+		if (!bss)
+			return;
+
+		if (!bss->time_stamp)
+			bss->time_stamp = results->time_stamp -
+					seen_ms_ago * L_USEC_PER_MSEC;
+
+		scan_bss_compute_rank(bss);
+
+		if (!follower->coalesced_bss_list)
+			follower->coalesced_bss_list = l_queue_new();
+
+		l_queue_push_tail(follower->coalesced_bss_list, bss);
+	}
+}
+
 static void get_scan_callback(struct l_genl_msg *msg, void *user_data)
 {
 	struct scan_results *results = user_data;
@@ -1710,6 +2766,7 @@ static void get_scan_callback(struct l_genl_msg *msg, void *user_data)
 	struct scan_bss *bss;
 	uint64_t wdev_id;
 	uint32_t seen_ms_ago = 0;
+	PROFILE_CALLBACK();
 
 	l_debug("get_scan_callback");
 
@@ -1731,7 +2788,20 @@ static void get_scan_callback(struct l_genl_msg *msg, void *user_data)
 					seen_ms_ago * L_USEC_PER_MSEC;
 
 	scan_bss_compute_rank(bss);
-	l_queue_insert(results->bss_list, bss, scan_bss_rank_compare, NULL);
+
+	/* Sorted by rank once the dump is complete */
+	l_queue_push_tail(results->bss_list, bss);
+
+	if (results->sr && !results->sr->canceled)
+		scan_results_add_coalesced(results, msg);
+
+	if (!results->sr || !results->sr->bss_callback ||
+			results->sr->canceled)
+		return;
+
+	results->sr->in_bss_callback = true;
+	results->sr->bss_callback(bss, results->sr->userdata);
+	results->sr->in_bss_callback = false;
 }
 
 static void discover_hidden_network_bsses(struct scan_context *sc,
@@ -1762,6 +2832,12 @@ static void scan_finished(struct scan_context *sc,
 	if (bss_list)
 		discover_hidden_network_bsses(sc, bss_list);
 
+	if (!err) {
+		iwd_startup_trace("first scan finished on wdev %" PRIx64,
+					sc->wdev_id);
+		iwd_startup_trace_end();
+	}
+
 	if (sr)
 		sr->in_callback = true;
 
@@ -1786,15 +2862,54 @@ static void scan_finished(struct scan_context *sc,
 	wiphy_radio_work_done(sc->wiphy, sr->work.id);
 }
 
+static void scan_finished_coalesced(struct scan_context *sc,
+					struct scan_request *sr,
+					const struct scan_freq_set *freqs)
+{
+	struct scan_request *follower;
+
+	/*
+	 * A follower's callback may cancel the leader, defer that the same
+	 * way as during the GET_SCAN dump itself.
+	 */
+	sr->in_bss_callback = true;
+
+	while ((follower = l_queue_pop_head(sr->followers))) {
+		struct l_queue *bss_list = follower->coalesced_bss_list;
+
+		follower->leader = NULL;
+		follower->coalesced_bss_list = NULL;
+
+		if (!bss_list)
+			bss_list = l_queue_new();
+
+		l_queue_sort(bss_list, scan_bss_rank_compare, NULL);
+		scan_finished(sc, 0, bss_list, freqs, follower);
+	}
+
+	sr->in_bss_callback = false;
+}
+
 static void get_scan_done(void *user)
 {
 	struct scan_results *results = user;
 	struct scan_context *sc = results->sc;
+	PROFILE_CALLBACK();
 
-	l_debug("get_scan_done");
+	l_debug("get_scan_done, scan_bss pool hits: %u misses: %u",
+				bss_pool_hits, bss_pool_misses);
 
 	sc->get_scan_cmd_id = 0;
 
+	l_queue_sort(results->bss_list, scan_bss_rank_compare, NULL);
+
+	if (results->freqs)
+		scan_cache_update(sc, results->time_stamp, results->freqs);
+
+	/* On cancellation the dump is cut short, followers scan themselves */
+	if (results->sr && !results->sr->canceled)
+		scan_finished_coalesced(sc, results->sr, results->freqs);
+
 	if (!results->sr || !results->sr->canceled)
 		scan_finished(sc, 0, results->bss_list,
 						results->freqs, results->sr);
@@ -1849,6 +2964,72 @@ static void scan_parse_new_scan_results(struct l_genl_msg *msg,
 	}
 }
 
+static void scan_sched_notify(struct l_genl_msg *msg, uint8_t cmd)
+{
+	uint32_t ifindex;
+	struct netdev *netdev;
+	uint64_t wdev_id;
+	struct scan_context *sc;
+	struct scan_results *results;
+	struct l_genl_msg *scan_msg;
+
+	/* Scheduled scan events only carry the ifindex */
+	if (nl80211_parse_attrs(msg, NL80211_ATTR_IFINDEX, &ifindex,
+					NL80211_ATTR_UNSPEC) < 0)
+		return;
+
+	netdev = netdev_find(ifindex);
+	if (!netdev)
+		return;
+
+	wdev_id = netdev_get_wdev_id(netdev);
+
+	sc = scan_context_find(wdev_id);
+	if (!sc)
+		return;
+
+	/*
+	 * The event for a scheduled scan we stopped ourselves may arrive
+	 * after a new one was started, don't take it for the new one.
+	 */
+	if (cmd == NL80211_CMD_SCHED_SCAN_STOPPED && sc->sp.sched_stops) {
+		sc->sp.sched_stops--;
+		return;
+	}
+
+	if (!sc->sp.sched)
+		return;
+
+	l_debug("Scan notification %s(%u)", nl80211cmd_to_string(cmd), cmd);
+
+	switch (cmd) {
+	case NL80211_CMD_SCHED_SCAN_RESULTS:
+		/* A dump already running will include these results */
+		if (sc->get_scan_cmd_id)
+			break;
+
+		results = l_new(struct scan_results, 1);
+		results->sc = sc;
+		results->time_stamp = l_time_now();
+		results->bss_list = l_queue_new();
+
+		scan_msg = l_genl_msg_new_sized(NL80211_CMD_GET_SCAN, 8);
+		l_genl_msg_append_attr(scan_msg, NL80211_ATTR_WDEV, 8,
+					&sc->wdev_id);
+		sc->get_scan_cmd_id = l_genl_family_dump(nl80211, scan_msg,
+							get_scan_callback,
+							results, get_scan_done);
+		break;
+	case NL80211_CMD_SCHED_SCAN_STOPPED:
+		l_debug("Scheduled scan stopped by the driver, falling back "
+			"to periodic scan");
+
+		sc->sp.sched = false;
+		scan_periodic_rearm(sc);
+		break;
+	}
+}
+
 static void scan_notify(struct l_genl_msg *msg, void *user_data)
 {
 	struct l_genl_attr attr;
@@ -1861,15 +3042,23 @@ static void scan_notify(struct l_genl_msg *msg, void *user_data)
 	bool active_scan = false;
 	uint64_t start_time_tsf = 0;
 	struct scan_request *sr;
+	PROFILE_CALLBACK();
 
 	cmd = l_genl_msg_get_command(msg);
 
+	switch (cmd) {
+	case NL80211_CMD_SCHED_SCAN_RESULTS:
+	case NL80211_CMD_SCHED_SCAN_STOPPED:
+		scan_sched_notify(msg, cmd);
+		return;
+	}
+
 	if (nl80211_parse_attrs(msg, NL80211_ATTR_WDEV, &wdev_id,
 					NL80211_ATTR_WIPHY, &wiphy_id,
 					NL80211_ATTR_UNSPEC) < 0)
 		return;
 
-	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	sc = scan_context_find(wdev_id);
 	if (!sc)
 		return;
 
@@ -1909,6 +3098,8 @@ static void scan_notify(struct l_genl_msg *msg, void *user_data)
 		if (sr && sr->triggered) {
 			sr->triggered = false;
 
+			l_genl_msg_unref(l_queue_pop_head(sr->cmds));
+
 			if (!sr->callback) {
 				scan_finished(sc, -ECANCELED, NULL, NULL, sr);
 				break;
@@ -2036,14 +3227,19 @@ static void get_fw_scan_done(void *userdata)
 
 	sc->get_fw_scan_cmd_id = 0;
 
+	l_queue_sort(results->bss_list, scan_bss_rank_compare, NULL);
+
 	if (sr->callback)
-		new_owner = sr->callback(err, results->bss_list, NULL,
-						sr->userdata);
+		new_owner = sr->callback(err, results->bss_list,
+						results->freqs, sr->userdata);
 
 	if (!new_owner)
 		l_queue_destroy(results->bss_list,
 				(l_queue_destroy_func_t) scan_bss_free);
 
+	if (results->freqs)
+		scan_freq_set_free(results->freqs);
+
 	if (sr->destroy)
 		sr->destroy(sr->userdata);
 
@@ -2051,17 +3247,14 @@ static void get_fw_scan_done(void *userdata)
 	l_free(results);
 }
 
-bool scan_get_firmware_scan(uint64_t wdev_id, scan_notify_func_t notify,
-				void *userdata, scan_destroy_func_t destroy)
+static bool scan_get_results(struct scan_context *sc,
+				struct scan_freq_set *freqs,
+				scan_notify_func_t notify, void *userdata,
+				scan_destroy_func_t destroy)
 {
 	struct l_genl_msg *scan_msg;
 	struct scan_results *results;
 	struct scan_request *sr;
-	struct scan_context *sc = l_queue_find(scan_contexts,
-						scan_context_match, &wdev_id);
-
-	if (!sc)
-		return false;
 
 	sr = l_new(struct scan_request, 1);
 	sr->callback = notify;
@@ -2072,6 +3265,7 @@ bool scan_get_firmware_scan(uint64_t wdev_id, scan_notify_func_t notify,
 	results->sc = sc;
 	results->time_stamp = l_time_now();
 	results->bss_list = l_queue_new();
+	results->freqs = freqs;
 	results->sr = sr;
 
 	scan_msg = l_genl_msg_new_sized(NL80211_CMD_GET_SCAN, 8);
@@ -2084,6 +3278,10 @@ bool scan_get_firmware_scan(uint64_t wdev_id, scan_notify_func_t notify,
 	if (!sc->get_fw_scan_cmd_id) {
 		l_queue_destroy(results->bss_list,
 				(l_queue_destroy_func_t) scan_bss_free);
+
+		if (results->freqs)
+			scan_freq_set_free(results->freqs);
+
 		l_free(results);
 		l_free(sr);
 		return false;
@@ -2092,11 +3290,86 @@ bool scan_get_firmware_scan(uint64_t wdev_id, scan_notify_func_t notify,
 	return true;
 }
 
+bool scan_get_firmware_scan(uint64_t wdev_id, scan_notify_func_t notify,
+				void *userdata, scan_destroy_func_t destroy)
+{
+	struct scan_context *sc = scan_context_find(wdev_id);
+
+	if (!sc)
+		return false;
+
+	return scan_get_results(sc, NULL, notify, userdata, destroy);
+}
+
+static struct scan_cache *scan_cache_lookup(struct scan_context *sc,
+					const struct scan_freq_set *freqs)
+{
+	struct scan_cache *cache;
+	struct scan_freq_set *missing;
+	bool covered;
+
+	cache = l_queue_find(scan_caches, scan_cache_match,
+				L_UINT_TO_PTR(wiphy_get_id(sc->wiphy)));
+	if (!cache)
+		return NULL;
+
+	if (l_time_now() - cache->time_stamp > SCAN_CACHE_MAX_AGE)
+		return NULL;
+
+	if (!freqs)
+		freqs = wiphy_get_supported_freqs(sc->wiphy);
+
+	missing = scan_freq_set_new();
+	scan_freq_set_merge(missing, freqs);
+	scan_freq_set_subtract(missing, cache->freqs);
+	covered = scan_freq_set_isempty(missing);
+	scan_freq_set_free(missing);
+
+	return covered ? cache : NULL;
+}
+
+/*
+ * Report the BSS table already held by the kernel for this wdev's wiphy
+ * if a scan covering @freqs (all supported frequencies if NULL) completed
+ * recently on any wdev of the same wiphy.  The results are not filtered
+ * by frequency, the set reported to @notify is the one actually covered
+ * by the cache.  Returns false if the caller should trigger a scan
+ * instead.
+ */
+bool scan_get_cached_results(uint64_t wdev_id,
+				const struct scan_freq_set *freqs,
+				scan_notify_func_t notify, void *userdata,
+				scan_destroy_func_t destroy)
+{
+	struct scan_context *sc = scan_context_find(wdev_id);
+	struct scan_cache *cache;
+	struct scan_freq_set *cached_freqs;
+
+	if (!sc)
+		return false;
+
+	/* The BSS table is about to change, wait for the new results */
+	if (sc->state != SCAN_STATE_NOT_RUNNING || sc->get_scan_cmd_id ||
+			sc->get_fw_scan_cmd_id)
+		return false;
+
+	cache = scan_cache_lookup(sc, freqs);
+	if (!cache)
+		return false;
+
+	l_debug("Using cached scan results for wdev %" PRIx64, wdev_id);
+
+	cached_freqs = scan_freq_set_new();
+	scan_freq_set_merge(cached_freqs, cache->freqs);
+
+	return scan_get_results(sc, cached_freqs, notify, userdata, destroy);
+}
+
 bool scan_wdev_add(uint64_t wdev_id)
 {
 	struct scan_context *sc;
 
-	if (l_queue_find(scan_contexts, scan_context_match, &wdev_id))
+	if (scan_context_find(wdev_id))
 		return false;
 
 	sc = scan_context_new(wdev_id);
@@ -2104,6 +3377,7 @@ bool scan_wdev_add(uint64_t wdev_id)
 		return false;
 
 	l_queue_push_head(scan_contexts, sc);
+	l_hashmap_insert(scan_context_index, &sc->wdev_id, sc);
 
 	if (l_queue_length(scan_contexts) > 1)
 		goto done;
@@ -2124,7 +3398,20 @@ bool scan_wdev_remove(uint64_t wdev_id)
 	if (!sc)
 		return false;
 
+	l_hashmap_remove(scan_context_index, &sc->wdev_id);
+
 	l_info("Removing scan context for wdev %" PRIx64, wdev_id);
+
+	if (!l_queue_find(scan_contexts, scan_context_wiphy_match,
+							sc->wiphy)) {
+		struct scan_cache *cache = l_queue_remove_if(scan_caches,
+				scan_cache_match,
+				L_UINT_TO_PTR(wiphy_get_id(sc->wiphy)));
+
+		if (cache)
+			scan_cache_free(cache);
+	}
+
 	scan_context_free(sc);
 
 	if (l_queue_isempty(scan_contexts)) {
@@ -2140,6 +3427,13 @@ static int scan_init(void)
 	const struct l_settings *config = iwd_get_config();
 
 	scan_contexts = l_queue_new();
+	scan_caches = l_queue_new();
+
+	scan_context_index = l_hashmap_new();
+	l_hashmap_set_hash_function(scan_context_index, scan_wdev_id_hash);
+	l_hashmap_set_compare_function(scan_context_index,
+					scan_wdev_id_compare);
+	bss_pool_enabled = true;
 
 	if (!l_settings_get_double(config, "Rank", "BandModifier5Ghz",
 					&RANK_5G_FACTOR))
@@ -2159,14 +3453,32 @@ static int scan_init(void)
 	if (SCAN_MAX_INTERVAL > UINT16_MAX)
 		SCAN_MAX_INTERVAL = UINT16_MAX;
 
+	if (!l_settings_get_bool(config, "Scan", "EnableScheduledScan",
+					&SCHED_SCAN_ENABLED))
+		SCHED_SCAN_ENABLED = false;
+
+	if (!l_settings_get_int(config, "Scan", "ScheduledScanRSSIThreshold",
+					&SCHED_SCAN_RSSI_THRESHOLD))
+		SCHED_SCAN_RSSI_THRESHOLD = -80;
+
 	return 0;
 }
 
 static void scan_exit(void)
 {
+	l_hashmap_destroy(scan_context_index, NULL);
+	scan_context_index = NULL;
+
 	l_queue_destroy(scan_contexts,
 				(l_queue_destroy_func_t) scan_context_free);
 	scan_contexts = NULL;
+
+	l_queue_destroy(scan_caches, scan_cache_free);
+	scan_caches = NULL;
+
+	bss_pool_enabled = false;
+	scan_bss_pool_drain();
+
 	l_genl_family_free(nl80211);
 	nl80211 = NULL;
 }
@@ -23,11 +23,11 @@
 struct scan_freq_set;
 struct ie_rsn_info;
 struct ie_owe_transition_info;
-struct p2p_probe_resp;
-struct p2p_probe_req;
-struct p2p_beacon;
+struct p2p_discovery_info;
 struct mmpdu_header;
 struct wiphy;
+struct l_genl_attr;
+enum security;
 
 enum scan_state {
 	SCAN_STATE_NOT_RUNNING,
@@ -46,6 +46,7 @@ struct scan_bss {
 	uint32_t frequency;
 	int32_t signal_strength;
 	uint16_t capability;
+	uint8_t *ies;		/* Storage for rsne, rsnxe, wpa, osen, rc_ie */
 	uint8_t *rsne;
 	uint8_t *rsnxe;
 	uint8_t *wpa;
@@ -53,11 +54,7 @@ struct scan_bss {
 	uint8_t *wsc;		/* Concatenated WSC IEs */
 	ssize_t wsc_size;	/* Size of Concatenated WSC IEs */
 	enum scan_bss_frame_type source_frame;
-	union {
-		struct p2p_probe_resp *p2p_probe_resp_info;
-		struct p2p_probe_req *p2p_probe_req_info;
-		struct p2p_beacon *p2p_beacon_info;
-	};
+	struct p2p_discovery_info *p2p_info;
 	struct ie_owe_transition_info *owe_trans;
 	uint8_t mde[3];
 	uint8_t ssid[32];
@@ -68,11 +65,14 @@ struct scan_bss {
 	uint64_t time_stamp;
 	uint64_t data_rate;
 	uint8_t hessid[6];
+	uint8_t mld_addr[6];	/* AP MLD address if MLO is advertised */
 	uint8_t *rc_ie;		/* Roaming consortium IE */
 	uint8_t hs20_version;
 	uint64_t parent_tsf;
 	uint8_t *wfd;		/* Concatenated WFD IEs */
 	ssize_t wfd_size;	/* Size of Concatenated WFD IEs */
+	/* 6GHz channels of APs in the same ESS, from the RNR */
+	struct scan_freq_set *rnr_6ghz_freqs;
 	bool mde_present : 1;
 	bool cc_present : 1;
 	bool cap_rm_neighbor_report : 1;
@@ -86,6 +86,7 @@ struct scan_bss {
 	uint8_t cost_level : 3;
 	uint8_t cost_flags : 4;
 	bool dpp_configurator : 1;
+	bool mlo_capable : 1;
 };
 
 struct scan_parameters {
@@ -107,6 +108,7 @@ typedef void (*scan_trigger_func_t)(int, void *);
 typedef bool (*scan_notify_func_t)(int err, struct l_queue *bss_list,
 					const struct scan_freq_set *freqs,
 					void *userdata);
+typedef void (*scan_bss_func_t)(const struct scan_bss *bss, void *userdata);
 typedef void (*scan_destroy_func_t)(void *userdata);
 
 static inline int scan_bss_addr_cmp(const struct scan_bss *a1,
@@ -147,21 +149,42 @@ uint32_t scan_owe_hidden(uint64_t wdev_id, struct l_queue *list,
 			scan_trigger_func_t trigger, scan_notify_func_t notify,
 			void *userdata, scan_destroy_func_t destroy);
 bool scan_cancel(uint64_t wdev_id, uint32_t id);
+bool scan_set_bss_callback(uint64_t wdev_id, uint32_t id,
+				scan_bss_func_t bss_callback);
 
 bool scan_active_is_enabled(void);
 void scan_periodic_start(uint64_t wdev_id, scan_trigger_func_t trigger,
 				scan_notify_func_t func, void *userdata);
 bool scan_periodic_stop(uint64_t wdev_id);
 
+size_t scan_net_detect_size(struct wiphy *wiphy);
+bool scan_build_net_detect(struct wiphy *wiphy, struct l_genl_msg *msg);
+
 uint64_t scan_get_triggered_time(uint64_t wdev_id, uint32_t id);
 
 bool scan_get_firmware_scan(uint64_t wdev_id, scan_notify_func_t notify,
 				void *userdata, scan_destroy_func_t destroy);
+bool scan_get_cached_results(uint64_t wdev_id,
+				const struct scan_freq_set *freqs,
+				scan_notify_func_t notify, void *userdata,
+				scan_destroy_func_t destroy);
 
 void scan_bss_free(struct scan_bss *bss);
+bool scan_parse_bss_information_elements(struct scan_bss *bss,
+					const void *data, uint16_t len);
+struct scan_bss *scan_parse_attr_bss(struct l_genl_attr *attr,
+					struct wiphy *wiphy,
+					uint32_t *out_seen_ms_ago);
 int scan_bss_rank_compare(const void *a, const void *b, void *user);
+void scan_bss_compute_rank(struct scan_bss *bss);
 
 int scan_bss_get_rsn_info(const struct scan_bss *bss, struct ie_rsn_info *info);
+int scan_bss_get_security(const struct scan_bss *bss,
+				enum security *out_security);
+
+bool scan_bss_roam_in_ess(const struct scan_bss *bss, const uint8_t *ssid,
+				size_t ssid_len, enum security security);
+double scan_bss_roam_rank(const struct scan_bss *bss, const uint8_t *mdid);
 
 struct scan_bss *scan_bss_new_from_probe_req(const struct mmpdu_header *mpdu,
 						const uint8_t *body,
@@ -42,7 +42,6 @@ struct iwd_sim_auth {
 	bool aka_supported : 1;
 	bool sim_supported : 1;
 	char *nai;
-	int pending;
 	struct watchlist auth_watchers;
 };
 
@@ -99,9 +98,6 @@ static void destroy_provider(void *data)
 
 void iwd_sim_auth_remove(struct iwd_sim_auth *auth)
 {
-	if (auth->driver && auth->driver->cancel_request)
-		auth->driver->cancel_request(auth, auth->pending);
-
 	WATCHLIST_NOTIFY_NO_ARGS(&auth->auth_watchers,
 			sim_auth_unregistered_cb_t);
 
@@ -155,11 +151,7 @@ int sim_auth_check_milenage(struct iwd_sim_auth *auth,
 	if (!auth->aka_supported)
 		return -1;
 
-	/* save ID in case simauth is destroyed */
-	auth->pending = auth->driver->check_milenage(auth, rand, autn,
-			cb, data);
-
-	return auth->pending;
+	return auth->driver->check_milenage(auth, rand, autn, cb, data);
 }
 
 int sim_auth_run_gsm(struct iwd_sim_auth *auth, const uint8_t *rands,
@@ -168,10 +160,7 @@ int sim_auth_run_gsm(struct iwd_sim_auth *auth, const uint8_t *rands,
 	if (!auth->sim_supported)
 		return -1;
 
-	/* save ID in case simauth is destroyed */
-	auth->pending = auth->driver->run_gsm(auth, rands, num_rands, cb, data);
-
-	return auth->pending;
+	return auth->driver->run_gsm(auth, rands, num_rands, cb, data);
 }
 
 void sim_auth_cancel_request(struct iwd_sim_auth *auth, int id)
@@ -66,6 +66,12 @@ typedef void (*sim_auth_check_milenage_cb_t)(const uint8_t *res,
 typedef void (*sim_auth_run_gsm_cb_t)(const uint8_t *sres,
 		const uint8_t *kc, void *user_data);
 
+/*
+ * A driver may have several requests outstanding at once, each identified by
+ * the positive ID returned from check_milenage or run_gsm.  The remove
+ * callback must drop any request still pending without calling back, the
+ * users are notified through the unregistered watch instead.
+ */
 struct iwd_sim_auth_driver {
 	const char *name;
 	int (*check_milenage)(struct iwd_sim_auth *auth, const uint8_t *rand,
@@ -29,6 +29,7 @@
 #include <errno.h>
 #include <ell/ell.h>
 
+#include "ell/useful.h"
 #include "src/missing.h"
 #include "src/eap-private.h"
 #include "src/crypto.h"
@@ -503,3 +504,479 @@ const void *eap_sim_tlv_iter_get_data(struct eap_sim_tlv_iter *iter)
 {
 	return iter->data;
 }
+
+static bool eap_sim_crypt_data(const uint8_t *k_encr, const uint8_t *iv,
+				const uint8_t *in, uint8_t *out, size_t len,
+				bool encrypt)
+{
+	struct l_cipher *cipher;
+	bool r;
+
+	cipher = l_cipher_new(L_CIPHER_AES_CBC, k_encr, EAP_SIM_K_ENCR_LEN);
+	if (!cipher)
+		return false;
+
+	if (!l_cipher_set_iv(cipher, iv, EAP_SIM_IV_LEN)) {
+		l_cipher_free(cipher);
+		return false;
+	}
+
+	if (encrypt)
+		r = l_cipher_encrypt(cipher, in, out, len);
+	else
+		r = l_cipher_decrypt(cipher, in, out, len);
+
+	l_cipher_free(cipher);
+	return r;
+}
+
+bool eap_sim_decrypt_attributes(const uint8_t *k_encr, const uint8_t *pkt,
+		size_t len, struct eap_sim_encr_attrs *out)
+{
+	struct eap_sim_tlv_iter iter;
+	const uint8_t *iv = NULL;
+	const uint8_t *encr = NULL;
+	uint16_t encr_len = 0;
+	uint8_t plain[1020];
+	bool r = false;
+
+	memset(out, 0, sizeof(*out));
+
+	if (len < 3)
+		return false;
+
+	eap_sim_tlv_iter_init(&iter, pkt + 3, len - 3);
+
+	while (eap_sim_tlv_iter_next(&iter)) {
+		const uint8_t *contents = eap_sim_tlv_iter_get_data(&iter);
+		uint16_t length = eap_sim_tlv_iter_get_length(&iter);
+
+		switch (eap_sim_tlv_iter_get_type(&iter)) {
+		case EAP_SIM_AT_IV:
+			if (length != EAP_SIM_IV_LEN + 2)
+				return false;
+
+			iv = contents + 2;
+			break;
+		case EAP_SIM_AT_ENCR_DATA:
+			if (length < 2 + 16 || (length - 2) % 16)
+				return false;
+
+			encr = contents + 2;
+			encr_len = length - 2;
+			break;
+		}
+	}
+
+	if (!encr)
+		return true;
+
+	if (!iv)
+		return false;
+
+	if (!eap_sim_crypt_data(k_encr, iv, encr, plain, encr_len, false))
+		goto done;
+
+	eap_sim_tlv_iter_init(&iter, plain, encr_len);
+
+	while (eap_sim_tlv_iter_next(&iter)) {
+		const uint8_t *contents = eap_sim_tlv_iter_get_data(&iter);
+		uint16_t length = eap_sim_tlv_iter_get_length(&iter);
+		uint16_t id_len;
+
+		switch (eap_sim_tlv_iter_get_type(&iter)) {
+		case EAP_SIM_AT_COUNTER:
+			if (length < 2)
+				goto done;
+
+			out->counter = l_get_be16(contents);
+			out->have_counter = true;
+			break;
+		case EAP_SIM_AT_NONCE_S:
+			if (length < EAP_SIM_NONCE_S_LEN + 2)
+				goto done;
+
+			memcpy(out->nonce_s, contents + 2, EAP_SIM_NONCE_S_LEN);
+			out->have_nonce_s = true;
+			break;
+		case EAP_SIM_AT_NEXT_REAUTH_ID:
+			if (length < 2)
+				goto done;
+
+			id_len = l_get_be16(contents);
+			if (!id_len || id_len > length - 2)
+				goto done;
+
+			l_free(out->next_reauth_id);
+			out->next_reauth_id = l_strndup(
+					(const char *) contents + 2, id_len);
+			break;
+		case EAP_SIM_AT_NEXT_PSEUDONYM:
+		case EAP_SIM_AT_PADDING:
+			break;
+		default:
+			/* Non-skippable attributes are below 128 */
+			if (eap_sim_tlv_iter_get_type(&iter) < 128) {
+				l_error("attribute %u not allowed in "
+					"AT_ENCR_DATA",
+					eap_sim_tlv_iter_get_type(&iter));
+				goto done;
+			}
+
+			break;
+		}
+	}
+
+	r = true;
+
+done:
+	explicit_bzero(plain, sizeof(plain));
+
+	if (!r) {
+		l_free(out->next_reauth_id);
+		memset(out, 0, sizeof(*out));
+	}
+
+	return r;
+}
+
+static struct l_queue *reauth_cache;
+
+void eap_sim_reauth_free(struct eap_sim_reauth *reauth)
+{
+	if (!reauth)
+		return;
+
+	l_free(reauth->permanent_id);
+	l_free(reauth->reauth_id);
+	explicit_bzero(reauth, sizeof(*reauth));
+	l_free(reauth);
+}
+
+static void reauth_destroy(void *data)
+{
+	eap_sim_reauth_free(data);
+}
+
+struct reauth_match {
+	enum eap_type type;
+	const char *permanent_id;
+};
+
+static bool reauth_match(const void *a, const void *b)
+{
+	const struct eap_sim_reauth *reauth = a;
+	const struct reauth_match *match = b;
+
+	return reauth->type == match->type &&
+			!strcmp(reauth->permanent_id, match->permanent_id);
+}
+
+struct eap_sim_reauth *eap_sim_reauth_take(enum eap_type type,
+					const char *permanent_id)
+{
+	struct reauth_match match = { type, permanent_id };
+
+	return l_queue_remove_if(reauth_cache, reauth_match, &match);
+}
+
+void eap_sim_reauth_store(struct eap_sim_reauth *reauth)
+{
+	if (!reauth_cache)
+		reauth_cache = l_queue_new();
+
+	eap_sim_reauth_free(eap_sim_reauth_take(reauth->type,
+							reauth->permanent_id));
+	l_queue_push_tail(reauth_cache, reauth);
+}
+
+void eap_sim_reauth_flush(void)
+{
+	l_queue_destroy(reauth_cache, reauth_destroy);
+	reauth_cache = NULL;
+}
+
+/*
+ * RFC 4186 Section 7 / RFC 4187 Section 7
+ *
+ * XKEY' = SHA1(Identity|counter|NONCE_S| MK)
+ * MSK and EMSK are the first 128 bytes of PRF(XKEY')
+ */
+static bool eap_sim_derive_reauth_keys(const char *identity, uint16_t counter,
+					const uint8_t *nonce_s,
+					const uint8_t *mk,
+					uint8_t *msk, uint8_t *emsk)
+{
+	struct l_checksum *checksum = l_checksum_new(L_CHECKSUM_SHA1);
+	struct iovec iov[4];
+	uint8_t xkey[EAP_SIM_MK_LEN];
+	uint8_t prng_buf[160];
+	bool r;
+
+	if (!checksum)
+		return false;
+
+	counter = L_CPU_TO_BE16(counter);
+
+	iov[0].iov_base = (void *) identity;
+	iov[0].iov_len = strlen(identity);
+	iov[1].iov_base = &counter;
+	iov[1].iov_len = 2;
+	iov[2].iov_base = (void *) nonce_s;
+	iov[2].iov_len = EAP_SIM_NONCE_S_LEN;
+	iov[3].iov_base = (void *) mk;
+	iov[3].iov_len = EAP_SIM_MK_LEN;
+
+	r = l_checksum_updatev(checksum, iov, 4) &&
+		l_checksum_get_digest(checksum, xkey, sizeof(xkey)) ==
+							sizeof(xkey);
+	l_checksum_free(checksum);
+
+	if (!r)
+		return false;
+
+	eap_sim_fips_prf(xkey, sizeof(xkey), prng_buf, sizeof(prng_buf));
+	explicit_bzero(xkey, sizeof(xkey));
+
+	memcpy(msk, prng_buf, EAP_SIM_MSK_LEN);
+	memcpy(emsk, prng_buf + EAP_SIM_MSK_LEN, EAP_SIM_EMSK_LEN);
+	explicit_bzero(prng_buf, sizeof(prng_buf));
+
+	return true;
+}
+
+/*
+ * RFC 5448 Section 3.3
+ *
+ * MK = PRF'(K_re,"EAP-AKA' re-auth"|Identity|counter|NONCE_S)
+ *      MSK  = MK[0..511]
+ *      EMSK = MK[512..1023]
+ */
+static bool eap_aka_prime_derive_reauth_keys(const char *identity,
+					uint16_t counter,
+					const uint8_t *nonce_s,
+					const uint8_t *k_re,
+					uint8_t *msk, uint8_t *emsk)
+{
+	struct l_checksum *hmac;
+	struct iovec iov[6];
+	uint8_t out[EAP_SIM_MSK_LEN + EAP_SIM_EMSK_LEN];
+	uint8_t *pos = out;
+	uint8_t i = 0x01;
+
+	hmac = l_checksum_new_hmac(L_CHECKSUM_SHA256, k_re, EAP_AKA_K_RE_LEN);
+	if (!hmac)
+		return false;
+
+	counter = L_CPU_TO_BE16(counter);
+
+	/* T(n - 1), empty for the first iteration */
+	iov[0].iov_base = out;
+	iov[0].iov_len = 0;
+	iov[1].iov_base = (void *) "EAP-AKA' re-auth";
+	iov[1].iov_len = strlen("EAP-AKA' re-auth");
+	iov[2].iov_base = (void *) identity;
+	iov[2].iov_len = strlen(identity);
+	iov[3].iov_base = &counter;
+	iov[3].iov_len = 2;
+	iov[4].iov_base = (void *) nonce_s;
+	iov[4].iov_len = EAP_SIM_NONCE_S_LEN;
+	iov[5].iov_base = &i;
+	iov[5].iov_len = 1;
+
+	while (pos < out + sizeof(out)) {
+		l_checksum_reset(hmac);
+		l_checksum_updatev(hmac, iov, 6);
+		l_checksum_get_digest(hmac, pos, 32);
+
+		iov[0].iov_base = pos;
+		iov[0].iov_len = 32;
+		pos += 32;
+		i++;
+	}
+
+	l_checksum_free(hmac);
+
+	memcpy(msk, out, EAP_SIM_MSK_LEN);
+	memcpy(emsk, out + EAP_SIM_MSK_LEN, EAP_SIM_EMSK_LEN);
+	explicit_bzero(out, sizeof(out));
+
+	return true;
+}
+
+/*
+ * Response: AT_IV, AT_ENCR_DATA containing AT_COUNTER (and optionally
+ * AT_COUNTER_TOO_SMALL) padded to a single AES block, and AT_MAC computed
+ * over the packet followed by NONCE_S.
+ */
+static bool eap_sim_reauth_respond(struct eap_state *eap,
+					const struct eap_sim_reauth *reauth,
+					uint16_t counter, bool too_small,
+					const uint8_t *nonce_s)
+{
+	uint8_t response[8 + 20 + 20 + 20 + EAP_SIM_NONCE_S_LEN];
+	size_t resp_len = sizeof(response) - EAP_SIM_NONCE_S_LEN;
+	uint8_t plain[16];
+	uint8_t iv[EAP_SIM_IV_LEN];
+	uint8_t *encr_pos;
+	uint8_t *mac_pos;
+	uint8_t *pos = plain;
+	bool r;
+
+	counter = L_CPU_TO_BE16(counter);
+
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_COUNTER, EAP_SIM_PAD_NONE,
+					(uint8_t *) &counter, 2);
+
+	if (too_small)
+		pos += eap_sim_add_attribute(pos, EAP_SIM_AT_COUNTER_TOO_SMALL,
+						EAP_SIM_PAD_NONE, NULL, 2);
+
+	eap_sim_add_attribute(pos, EAP_SIM_AT_PADDING, EAP_SIM_PAD_NONE, NULL,
+				plain + sizeof(plain) - pos - 2);
+
+	l_getrandom(iv, sizeof(iv));
+
+	pos = response;
+	pos += eap_sim_build_header(eap, reauth->type,
+					EAP_SIM_ST_REAUTHENTICATION, pos,
+					resp_len);
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_IV, EAP_SIM_PAD_ZERO,
+					iv, sizeof(iv));
+	encr_pos = pos + 4;
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_ENCR_DATA,
+					EAP_SIM_PAD_ZERO, NULL, sizeof(plain));
+	mac_pos = pos + 4;
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_MAC, EAP_SIM_PAD_NONE,
+					NULL, EAP_SIM_MAC_LEN);
+
+	r = eap_sim_crypt_data(reauth->k_encr, iv, plain, encr_pos,
+				sizeof(plain), true);
+	explicit_bzero(plain, sizeof(plain));
+
+	if (!r)
+		return false;
+
+	/* append NONCE_S for MAC derivation */
+	memcpy(pos, nonce_s, EAP_SIM_NONCE_S_LEN);
+
+	if (!eap_sim_derive_mac(reauth->type, response, sizeof(response),
+				reauth->k_aut, mac_pos))
+		return false;
+
+	eap_method_respond(eap, response, resp_len);
+
+	return true;
+}
+
+int eap_sim_reauth_process(struct eap_state *eap,
+		struct eap_sim_reauth *reauth, const uint8_t *pkt, size_t len,
+		uint8_t *msk, uint8_t *emsk, uint8_t *session_id)
+{
+	struct eap_sim_tlv_iter iter;
+	struct eap_sim_encr_attrs encr;
+	const uint8_t *mac = NULL;
+	bool r;
+
+	if (len < 3)
+		return -EINVAL;
+
+	eap_sim_tlv_iter_init(&iter, pkt + 3, len - 3);
+
+	while (eap_sim_tlv_iter_next(&iter)) {
+		const uint8_t *contents = eap_sim_tlv_iter_get_data(&iter);
+		uint16_t length = eap_sim_tlv_iter_get_length(&iter);
+
+		switch (eap_sim_tlv_iter_get_type(&iter)) {
+		case EAP_SIM_AT_MAC:
+			if (length < EAP_SIM_MAC_LEN + 2)
+				return -EINVAL;
+
+			mac = contents + 2;
+			break;
+		case EAP_SIM_AT_IV:
+		case EAP_SIM_AT_ENCR_DATA:
+		case EAP_SIM_AT_CHECKCODE:
+		/*
+		 * AT_RESULT_IND is only honoured if the peer asks for it too.
+		 * It is never included in the response, so the exchange ends
+		 * right after it without the extra protected Notification
+		 * round trip.
+		 */
+		case EAP_SIM_AT_RESULT_IND:
+			break;
+		default:
+			if (eap_sim_tlv_iter_get_type(&iter) < 128) {
+				l_error("attribute %u not allowed in "
+					"Re-authentication",
+					eap_sim_tlv_iter_get_type(&iter));
+				return -EINVAL;
+			}
+
+			break;
+		}
+	}
+
+	if (!mac) {
+		l_error("Re-authentication did not contain AT_MAC");
+		return -EINVAL;
+	}
+
+	if (!eap_sim_verify_mac(eap, reauth->type, pkt, len, reauth->k_aut,
+				NULL, 0))
+		return -EBADMSG;
+
+	if (!eap_sim_decrypt_attributes(reauth->k_encr, pkt, len, &encr))
+		return -EINVAL;
+
+	if (!encr.have_counter || !encr.have_nonce_s) {
+		l_error("AT_COUNTER or AT_NONCE_S were not found");
+		r = false;
+		goto done;
+	}
+
+	/* The counter must be greater than any value used so far */
+	if (encr.counter <= reauth->counter) {
+		l_error("Re-authentication counter %u is not fresh",
+				encr.counter);
+		eap_sim_reauth_respond(eap, reauth, encr.counter, true,
+					encr.nonce_s);
+		l_free(encr.next_reauth_id);
+		explicit_bzero(&encr, sizeof(encr));
+		return -ERANGE;
+	}
+
+	if (reauth->type == EAP_TYPE_AKA_PRIME)
+		r = eap_aka_prime_derive_reauth_keys(reauth->reauth_id,
+							encr.counter,
+							encr.nonce_s,
+							reauth->k_re,
+							msk, emsk);
+	else
+		r = eap_sim_derive_reauth_keys(reauth->reauth_id,
+						encr.counter, encr.nonce_s,
+						reauth->mk, msk, emsk);
+
+	if (!r)
+		goto done;
+
+	r = eap_sim_reauth_respond(eap, reauth, encr.counter, false,
+					encr.nonce_s);
+	if (!r)
+		goto done;
+
+	/* RFC 5247, Section 3: Method-Id = NONCE_S || MAC */
+	session_id[0] = reauth->type;
+	memcpy(session_id + 1, encr.nonce_s, EAP_SIM_NONCE_S_LEN);
+	memcpy(session_id + 1 + EAP_SIM_NONCE_S_LEN, mac, EAP_SIM_MAC_LEN);
+
+	reauth->counter = encr.counter;
+	l_free(reauth->reauth_id);
+	reauth->reauth_id = l_steal_ptr(encr.next_reauth_id);
+
+done:
+	l_free(encr.next_reauth_id);
+	explicit_bzero(&encr, sizeof(encr));
+
+	return r ? 0 : -EIO;
+}
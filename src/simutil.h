@@ -35,6 +35,7 @@
 #define EAP_AKA_K_RE_LEN	32
 #define EAP_AKA_IK_LEN		16
 #define EAP_AKA_CK_LEN		16
+#define EAP_SIM_NONCE_S_LEN	16
 
 /*
  * Possible pad types for EAP-SIM/EAP-AKA attributes
@@ -81,6 +82,7 @@ enum eap_sim_at {
 	EAP_SIM_AT_SELECTED_VERSION	= 0x10,
 	EAP_SIM_AT_FULLAUTH_ID_REQ	= 0x11,
 	EAP_SIM_AT_COUNTER		= 0x13,
+	EAP_SIM_AT_COUNTER_TOO_SMALL	= 0x14,
 	EAP_SIM_AT_NONCE_S		= 0x15,
 	EAP_SIM_AT_CLIENT_ERROR_CODE	= 0x16,
 	EAP_SIM_AT_KDF_INPUT		= 0x17,
@@ -94,6 +96,12 @@ enum eap_sim_at {
 	EAP_SIM_AT_BIDDING		= 0x88
 };
 
+/*
+ * RFC 4186 / RFC 4187 Section 11, the Re-authentication subtype has the same
+ * value for both EAP-SIM and EAP-AKA
+ */
+#define EAP_SIM_ST_REAUTHENTICATION	0x0d
+
 /*
  * Possible client error's
  */
@@ -279,3 +287,80 @@ uint8_t eap_sim_tlv_iter_get_type(struct eap_sim_tlv_iter *iter);
 uint16_t eap_sim_tlv_iter_get_length(struct eap_sim_tlv_iter *iter);
 
 const void *eap_sim_tlv_iter_get_data(struct eap_sim_tlv_iter *iter);
+
+/*
+ * Values from AT_ENCR_DATA, only those used by the fast re-authentication
+ * support are kept.
+ */
+struct eap_sim_encr_attrs {
+	bool have_counter : 1;
+	bool have_nonce_s : 1;
+	uint16_t counter;
+	uint8_t nonce_s[EAP_SIM_NONCE_S_LEN];
+	char *next_reauth_id;
+};
+
+/*
+ * Find AT_IV and AT_ENCR_DATA in a SIM/AKA packet, decrypt the data and parse
+ * the encrypted attributes.  The packet MAC must have been verified first.
+ *
+ * k_encr - encryption key (K_encr)
+ * pkt - should point to the start of the EAP-SIM packet (the subtype)
+ * len - length of pkt
+ * out - parsed attributes, next_reauth_id must be freed by the caller
+ *
+ * Returns false if the attributes were malformed.  If the packet carried no
+ * encrypted data, true is returned and out is left empty.
+ */
+bool eap_sim_decrypt_attributes(const uint8_t *k_encr, const uint8_t *pkt,
+		size_t len, struct eap_sim_encr_attrs *out);
+
+/*
+ * State kept between a full authentication and the following fast
+ * re-authentications, RFC 4186 / RFC 4187 Section 5.  K_aut and K_encr (and
+ * K_re for AKA') from the full authentication are reused as is.
+ */
+struct eap_sim_reauth {
+	enum eap_type type;
+	char *permanent_id;
+	char *reauth_id;
+	uint16_t counter;
+	uint8_t mk[EAP_SIM_MK_LEN];
+	uint8_t k_encr[EAP_SIM_K_ENCR_LEN];
+	uint8_t k_aut[EAP_AKA_PRIME_K_AUT_LEN];
+	uint8_t k_re[EAP_AKA_K_RE_LEN];
+};
+
+void eap_sim_reauth_free(struct eap_sim_reauth *reauth);
+
+/*
+ * Take the re-authentication state for a permanent identity out of the
+ * cache.  The state is single use, it is only stored again once a new
+ * re-authentication identity was received.
+ */
+struct eap_sim_reauth *eap_sim_reauth_take(enum eap_type type,
+					const char *permanent_id);
+
+/* Store a re-authentication state, the cache takes ownership */
+void eap_sim_reauth_store(struct eap_sim_reauth *reauth);
+
+void eap_sim_reauth_flush(void);
+
+/*
+ * Process a SIM/AKA Re-authentication request and send the response.
+ *
+ * eap - eap_state
+ * reauth - state from the previous authentication, updated with the new
+ *          counter and next re-authentication identity on success
+ * pkt - should point to the start of the EAP-SIM packet
+ * len - length of pkt
+ * msk/emsk - Output: the new MSK and EMSK
+ * session_id - Output: Method-Id | NONCE_S | MAC, 33 bytes
+ *
+ * Returns 0 on success.  -ERANGE is returned if the counter was not fresh,
+ * in which case a response, but no keys, was sent.  Any other error should
+ * be answered with a client error.
+ */
+int eap_sim_reauth_process(struct eap_state *eap,
+		struct eap_sim_reauth *reauth, const uint8_t *pkt, size_t len,
+		uint8_t *msk, uint8_t *emsk, uint8_t *session_id);
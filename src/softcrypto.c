@@ -0,0 +1,807 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <sys/uio.h>
+
+#include <ell/ell.h>
+
+#include "src/missing.h"
+#include "src/softcrypto.h"
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint64_t sha512_k[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+	0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+	0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+	0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+	0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+	0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+	0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+	0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+	0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+	0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+	0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+	0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+	0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+	0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+	0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+	0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+	0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+	0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+	0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+	0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+	0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+static void sha1_compress(uint32_t *h, const uint8_t *block)
+{
+	uint32_t w[80];
+	uint32_t a, b, c, d, e, f, k, tmp;
+	unsigned int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = l_get_be32(block + i * 4);
+
+	for (i = 16; i < 80; i++)
+		w[i] = ROL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	a = h[0];
+	b = h[1];
+	c = h[2];
+	d = h[3];
+	e = h[4];
+
+	for (i = 0; i < 80; i++) {
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+
+		tmp = ROL32(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROL32(b, 30);
+		b = a;
+		a = tmp;
+	}
+
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+	h[4] += e;
+
+	explicit_bzero(w, sizeof(w));
+}
+
+static void sha256_compress(uint32_t *h, const uint8_t *block)
+{
+	uint32_t w[64];
+	uint32_t s[8];
+	uint32_t t1, t2;
+	unsigned int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = l_get_be32(block + i * 4);
+
+	for (i = 16; i < 64; i++) {
+		uint32_t s0 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^
+				(w[i - 15] >> 3);
+		uint32_t s1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^
+				(w[i - 2] >> 10);
+
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	memcpy(s, h, sizeof(s));
+
+	for (i = 0; i < 64; i++) {
+		t1 = s[7] + (ROR32(s[4], 6) ^ ROR32(s[4], 11) ^
+				ROR32(s[4], 25)) +
+			((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i];
+		t2 = (ROR32(s[0], 2) ^ ROR32(s[0], 13) ^ ROR32(s[0], 22)) +
+			((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+
+		memmove(s + 1, s, 7 * sizeof(uint32_t));
+		s[4] += t1;
+		s[0] = t1 + t2;
+	}
+
+	for (i = 0; i < 8; i++)
+		h[i] += s[i];
+
+	explicit_bzero(w, sizeof(w));
+	explicit_bzero(s, sizeof(s));
+}
+
+static void sha512_compress(uint64_t *h, const uint8_t *block)
+{
+	uint64_t w[80];
+	uint64_t s[8];
+	uint64_t t1, t2;
+	unsigned int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = l_get_be64(block + i * 8);
+
+	for (i = 16; i < 80; i++) {
+		uint64_t s0 = ROR64(w[i - 15], 1) ^ ROR64(w[i - 15], 8) ^
+				(w[i - 15] >> 7);
+		uint64_t s1 = ROR64(w[i - 2], 19) ^ ROR64(w[i - 2], 61) ^
+				(w[i - 2] >> 6);
+
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	memcpy(s, h, sizeof(s));
+
+	for (i = 0; i < 80; i++) {
+		t1 = s[7] + (ROR64(s[4], 14) ^ ROR64(s[4], 18) ^
+				ROR64(s[4], 41)) +
+			((s[4] & s[5]) ^ (~s[4] & s[6])) + sha512_k[i] + w[i];
+		t2 = (ROR64(s[0], 28) ^ ROR64(s[0], 34) ^ ROR64(s[0], 39)) +
+			((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+
+		memmove(s + 1, s, 7 * sizeof(uint64_t));
+		s[4] += t1;
+		s[0] = t1 + t2;
+	}
+
+	for (i = 0; i < 8; i++)
+		h[i] += s[i];
+
+	explicit_bzero(w, sizeof(w));
+	explicit_bzero(s, sizeof(s));
+}
+
+static size_t soft_hash_block_size(enum l_checksum_type type)
+{
+	return type == L_CHECKSUM_SHA384 ? 128 : 64;
+}
+
+static size_t soft_hash_digest_size(enum l_checksum_type type)
+{
+	switch (type) {
+	case L_CHECKSUM_SHA1:
+		return 20;
+	case L_CHECKSUM_SHA256:
+		return 32;
+	case L_CHECKSUM_SHA384:
+		return 48;
+	default:
+		return 0;
+	}
+}
+
+static void soft_hash_compress(struct soft_hash *hash, const uint8_t *block)
+{
+	switch (hash->type) {
+	case L_CHECKSUM_SHA1:
+		sha1_compress(hash->state.h32, block);
+		break;
+	case L_CHECKSUM_SHA256:
+		sha256_compress(hash->state.h32, block);
+		break;
+	case L_CHECKSUM_SHA384:
+		sha512_compress(hash->state.h64, block);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Returns false for hash types not provided in-process */
+bool soft_hash_init(struct soft_hash *hash, enum l_checksum_type type)
+{
+	static const uint32_t sha1_h[5] = {
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+	};
+	static const uint32_t sha256_h[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	static const uint64_t sha384_h[8] = {
+		0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL,
+		0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+		0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL,
+		0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL,
+	};
+
+	switch (type) {
+	case L_CHECKSUM_SHA1:
+		memcpy(hash->state.h32, sha1_h, sizeof(sha1_h));
+		break;
+	case L_CHECKSUM_SHA256:
+		memcpy(hash->state.h32, sha256_h, sizeof(sha256_h));
+		break;
+	case L_CHECKSUM_SHA384:
+		memcpy(hash->state.h64, sha384_h, sizeof(sha384_h));
+		break;
+	default:
+		return false;
+	}
+
+	hash->type = type;
+	hash->len = 0;
+	hash->block_len = 0;
+
+	return true;
+}
+
+void soft_hash_update(struct soft_hash *hash, const void *data, size_t len)
+{
+	size_t block_size = soft_hash_block_size(hash->type);
+	const uint8_t *p = data;
+
+	hash->len += len;
+
+	if (hash->block_len) {
+		size_t n = block_size - hash->block_len;
+
+		if (n > len)
+			n = len;
+
+		memcpy(hash->block + hash->block_len, p, n);
+		hash->block_len += n;
+		p += n;
+		len -= n;
+
+		if (hash->block_len < block_size)
+			return;
+
+		soft_hash_compress(hash, hash->block);
+		hash->block_len = 0;
+	}
+
+	while (len >= block_size) {
+		soft_hash_compress(hash, p);
+		p += block_size;
+		len -= block_size;
+	}
+
+	memcpy(hash->block, p, len);
+	hash->block_len = len;
+}
+
+void soft_hash_updatev(struct soft_hash *hash, const struct iovec *iov,
+			size_t iov_len)
+{
+	size_t i;
+
+	for (i = 0; i < iov_len; i++)
+		soft_hash_update(hash, iov[i].iov_base, iov[i].iov_len);
+}
+
+/*
+ * Finalizes the hash and copies up to @out_len bytes of the digest into
+ * @out.  The context must be re-initialized before it can be used again.
+ * Returns the number of bytes written.
+ */
+size_t soft_hash_final(struct soft_hash *hash, void *out, size_t out_len)
+{
+	size_t block_size = soft_hash_block_size(hash->type);
+	size_t len_size = block_size / 8;
+	size_t digest_size = soft_hash_digest_size(hash->type);
+	uint8_t digest[48];
+	uint64_t bits = hash->len * 8;
+	size_t i;
+
+	hash->block[hash->block_len++] = 0x80;
+
+	if (hash->block_len > block_size - len_size) {
+		memset(hash->block + hash->block_len, 0,
+				block_size - hash->block_len);
+		soft_hash_compress(hash, hash->block);
+		hash->block_len = 0;
+	}
+
+	memset(hash->block + hash->block_len, 0,
+			block_size - 8 - hash->block_len);
+	l_put_be64(bits, hash->block + block_size - 8);
+	soft_hash_compress(hash, hash->block);
+
+	if (hash->type == L_CHECKSUM_SHA384)
+		for (i = 0; i < digest_size / 8; i++)
+			l_put_be64(hash->state.h64[i], digest + i * 8);
+	else
+		for (i = 0; i < digest_size / 4; i++)
+			l_put_be32(hash->state.h32[i], digest + i * 4);
+
+	if (out_len > digest_size)
+		out_len = digest_size;
+
+	memcpy(out, digest, out_len);
+	explicit_bzero(digest, sizeof(digest));
+
+	return out_len;
+}
+
+void soft_hash_clear(struct soft_hash *hash)
+{
+	explicit_bzero(hash, sizeof(*hash));
+}
+
+bool soft_hmac_init(struct soft_hmac *hmac, enum l_checksum_type type,
+			const void *key, size_t key_len)
+{
+	uint8_t pad[128];
+	uint8_t key_hash[48];
+	size_t block_size;
+	size_t i;
+
+	if (!soft_hash_init(&hmac->inner, type))
+		return false;
+
+	block_size = soft_hash_block_size(type);
+
+	if (key_len > block_size) {
+		soft_hash_update(&hmac->inner, key, key_len);
+		key_len = soft_hash_final(&hmac->inner, key_hash,
+						sizeof(key_hash));
+		key = key_hash;
+		soft_hash_init(&hmac->inner, type);
+	}
+
+	memset(pad, 0, block_size);
+	memcpy(pad, key, key_len);
+
+	for (i = 0; i < block_size; i++)
+		pad[i] ^= 0x36;
+
+	soft_hash_update(&hmac->inner, pad, block_size);
+
+	for (i = 0; i < block_size; i++)
+		pad[i] ^= 0x36 ^ 0x5c;
+
+	soft_hash_init(&hmac->outer, type);
+	soft_hash_update(&hmac->outer, pad, block_size);
+
+	explicit_bzero(pad, sizeof(pad));
+	explicit_bzero(key_hash, sizeof(key_hash));
+
+	hmac->ctx = hmac->inner;
+
+	return true;
+}
+
+void soft_hmac_reset(struct soft_hmac *hmac)
+{
+	hmac->ctx = hmac->inner;
+}
+
+void soft_hmac_update(struct soft_hmac *hmac, const void *data, size_t len)
+{
+	soft_hash_update(&hmac->ctx, data, len);
+}
+
+void soft_hmac_updatev(struct soft_hmac *hmac, const struct iovec *iov,
+			size_t iov_len)
+{
+	soft_hash_updatev(&hmac->ctx, iov, iov_len);
+}
+
+/*
+ * Like l_checksum_get_digest, the context is implicitly reset so that the
+ * same key can be used for the next message without re-deriving the pads.
+ */
+size_t soft_hmac_final(struct soft_hmac *hmac, void *out, size_t out_len)
+{
+	uint8_t digest[48];
+	size_t len;
+
+	len = soft_hash_final(&hmac->ctx, digest, sizeof(digest));
+
+	hmac->ctx = hmac->outer;
+	soft_hash_update(&hmac->ctx, digest, len);
+	len = soft_hash_final(&hmac->ctx, out, out_len);
+
+	hmac->ctx = hmac->inner;
+	explicit_bzero(digest, sizeof(digest));
+
+	return len;
+}
+
+void soft_hmac_clear(struct soft_hmac *hmac)
+{
+	explicit_bzero(hmac, sizeof(*hmac));
+}
+
+/*
+ * The AES implementation below handles key material (the KEK and KCK) and
+ * must not leak it through the cache, so it doesn't use any lookup tables
+ * or branches that depend on secret data.  SubBytes is computed rather
+ * than looked up: the state is bitsliced into eight 16-bit planes, plane i
+ * holding bit i of every byte, and the S-box is evaluated for all bytes
+ * at once as the GF(2^8) inverse (x^254) followed by the affine transform,
+ * see FIPS 197 Section 5.1.1.
+ */
+static inline uint8_t aes_xtime(uint8_t x)
+{
+	return (x << 1) ^ (0x1b & -(x >> 7));
+}
+
+/* Bitsliced multiplication in GF(2^8) modulo x^8 + x^4 + x^3 + x + 1 */
+static void aes_gf_mul(uint16_t *r, const uint16_t *a, const uint16_t *b)
+{
+	uint16_t p[15] = { 0 };
+	unsigned int i, j;
+
+	for (i = 0; i < 8; i++)
+		for (j = 0; j < 8; j++)
+			p[i + j] ^= a[i] & b[j];
+
+	for (i = 14; i >= 8; i--) {
+		p[i - 4] ^= p[i];
+		p[i - 5] ^= p[i];
+		p[i - 7] ^= p[i];
+		p[i - 8] ^= p[i];
+	}
+
+	memcpy(r, p, 8 * sizeof(uint16_t));
+	explicit_bzero(p, sizeof(p));
+}
+
+/* x^254 == x^-1, with 0 mapping to 0 as required by the S-box */
+static void aes_gf_inv(uint16_t *x)
+{
+	uint16_t x2[8], x3[8], x12[8], t[8];
+	unsigned int i;
+
+	aes_gf_mul(x2, x, x);
+	aes_gf_mul(x3, x2, x);
+	aes_gf_mul(t, x3, x3);
+	aes_gf_mul(x12, t, t);
+	aes_gf_mul(t, x12, x3);
+
+	for (i = 0; i < 4; i++)
+		aes_gf_mul(t, t, t);
+
+	aes_gf_mul(t, t, x12);
+	aes_gf_mul(x, t, x2);
+
+	explicit_bzero(x2, sizeof(x2));
+	explicit_bzero(x3, sizeof(x3));
+	explicit_bzero(x12, sizeof(x12));
+	explicit_bzero(t, sizeof(t));
+}
+
+/* SubBytes or InvSubBytes on up to 16 bytes */
+static void aes_sub_bytes(uint8_t *s, unsigned int len, bool inverse)
+{
+	uint16_t x[8] = { 0 };
+	uint16_t t[8];
+	unsigned int i, j;
+
+	for (j = 0; j < len; j++)
+		for (i = 0; i < 8; i++)
+			x[i] |= ((s[j] >> i) & 1) << j;
+
+	if (inverse) {
+		for (i = 0; i < 8; i++)
+			t[i] = x[(i + 2) % 8] ^ x[(i + 5) % 8] ^
+				x[(i + 7) % 8] ^ -((0x05 >> i) & 1);
+
+		memcpy(x, t, sizeof(x));
+		aes_gf_inv(x);
+	} else {
+		aes_gf_inv(x);
+
+		for (i = 0; i < 8; i++)
+			t[i] = x[i] ^ x[(i + 4) % 8] ^ x[(i + 5) % 8] ^
+				x[(i + 6) % 8] ^ x[(i + 7) % 8] ^
+				-((0x63 >> i) & 1);
+
+		memcpy(x, t, sizeof(x));
+	}
+
+	for (j = 0; j < len; j++) {
+		s[j] = 0;
+
+		for (i = 0; i < 8; i++)
+			s[j] |= ((x[i] >> j) & 1) << i;
+	}
+
+	explicit_bzero(x, sizeof(x));
+	explicit_bzero(t, sizeof(t));
+}
+
+static uint32_t aes_sub_word(uint32_t w)
+{
+	uint8_t b[4];
+
+	l_put_be32(w, b);
+	aes_sub_bytes(b, 4, false);
+	w = l_get_be32(b);
+	explicit_bzero(b, sizeof(b));
+
+	return w;
+}
+
+/* FIPS 197, Section 5.2 Key Expansion */
+bool soft_aes_init(struct soft_aes *aes, const void *key, size_t key_len)
+{
+	unsigned int nk = key_len / 4;
+	unsigned int i;
+	uint8_t rcon = 0x01;
+
+	if (key_len != 16 && key_len != 24 && key_len != 32)
+		return false;
+
+	aes->rounds = nk + 6;
+
+	for (i = 0; i < nk; i++)
+		aes->rk[i] = l_get_be32((const uint8_t *) key + i * 4);
+
+	for (i = nk; i < 4 * (aes->rounds + 1); i++) {
+		uint32_t tmp = aes->rk[i - 1];
+
+		if (i % nk == 0) {
+			tmp = aes_sub_word((tmp << 8) | (tmp >> 24)) ^
+				((uint32_t) rcon << 24);
+			rcon = aes_xtime(rcon);
+		} else if (nk > 6 && i % nk == 4)
+			tmp = aes_sub_word(tmp);
+
+		aes->rk[i] = aes->rk[i - nk] ^ tmp;
+	}
+
+	return true;
+}
+
+static void aes_add_round_key(uint8_t *s, const uint32_t *rk)
+{
+	unsigned int i;
+
+	for (i = 0; i < 4; i++) {
+		s[i * 4] ^= rk[i] >> 24;
+		s[i * 4 + 1] ^= rk[i] >> 16;
+		s[i * 4 + 2] ^= rk[i] >> 8;
+		s[i * 4 + 3] ^= rk[i];
+	}
+}
+
+/* ShiftRows (dir 1) or InvShiftRows (dir 3), state is stored by column */
+static void aes_shift_rows(uint8_t *s, unsigned int dir)
+{
+	uint8_t t[16];
+	unsigned int c, r;
+
+	for (c = 0; c < 4; c++)
+		for (r = 0; r < 4; r++)
+			t[c * 4 + r] = s[((c + dir * r) % 4) * 4 + r];
+
+	memcpy(s, t, 16);
+	explicit_bzero(t, sizeof(t));
+}
+
+static void aes_mix_columns(uint8_t *s)
+{
+	unsigned int c;
+
+	for (c = 0; c < 4; c++) {
+		uint8_t *col = s + c * 4;
+		uint8_t a0 = col[0], a1 = col[1], a2 = col[2], a3 = col[3];
+		uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+
+		col[0] ^= all ^ aes_xtime(a0 ^ a1);
+		col[1] ^= all ^ aes_xtime(a1 ^ a2);
+		col[2] ^= all ^ aes_xtime(a2 ^ a3);
+		col[3] ^= all ^ aes_xtime(a3 ^ a0);
+	}
+}
+
+static void aes_inv_mix_columns(uint8_t *s)
+{
+	unsigned int c;
+
+	/*
+	 * InvMixColumns is MixColumns preceded by multiplying each column
+	 * with {04}x^2 + {05}, see "The Design of Rijndael" Section 4.1.3
+	 */
+	for (c = 0; c < 4; c++) {
+		uint8_t *col = s + c * 4;
+		uint8_t u = aes_xtime(aes_xtime(col[0] ^ col[2]));
+		uint8_t v = aes_xtime(aes_xtime(col[1] ^ col[3]));
+
+		col[0] ^= u;
+		col[1] ^= v;
+		col[2] ^= u;
+		col[3] ^= v;
+	}
+
+	aes_mix_columns(s);
+}
+
+void soft_aes_encrypt(const struct soft_aes *aes, const uint8_t in[16],
+			uint8_t out[16])
+{
+	uint8_t s[16];
+	unsigned int round;
+
+	memcpy(s, in, 16);
+	aes_add_round_key(s, aes->rk);
+
+	for (round = 1; round < aes->rounds; round++) {
+		aes_sub_bytes(s, 16, false);
+		aes_shift_rows(s, 1);
+		aes_mix_columns(s);
+		aes_add_round_key(s, aes->rk + round * 4);
+	}
+
+	aes_sub_bytes(s, 16, false);
+	aes_shift_rows(s, 1);
+	aes_add_round_key(s, aes->rk + aes->rounds * 4);
+
+	memcpy(out, s, 16);
+	explicit_bzero(s, sizeof(s));
+}
+
+void soft_aes_decrypt(const struct soft_aes *aes, const uint8_t in[16],
+			uint8_t out[16])
+{
+	uint8_t s[16];
+	unsigned int round;
+
+	memcpy(s, in, 16);
+	aes_add_round_key(s, aes->rk + aes->rounds * 4);
+
+	for (round = aes->rounds - 1; round > 0; round--) {
+		aes_shift_rows(s, 3);
+		aes_sub_bytes(s, 16, true);
+		aes_add_round_key(s, aes->rk + round * 4);
+		aes_inv_mix_columns(s);
+	}
+
+	aes_shift_rows(s, 3);
+	aes_sub_bytes(s, 16, true);
+	aes_add_round_key(s, aes->rk);
+
+	memcpy(out, s, 16);
+	explicit_bzero(s, sizeof(s));
+}
+
+void soft_aes_clear(struct soft_aes *aes)
+{
+	explicit_bzero(aes, sizeof(*aes));
+}
+
+/* RFC 4493 Section 2.3 - Subkey generation */
+static void cmac_subkey(uint8_t *k)
+{
+	uint8_t carry = k[0] & 0x80;
+	unsigned int i;
+
+	for (i = 0; i < 15; i++)
+		k[i] = (k[i] << 1) | (k[i + 1] >> 7);
+
+	k[15] <<= 1;
+
+	if (carry)
+		k[15] ^= 0x87;
+}
+
+/* RFC 4493 Section 2.4 - MAC generation */
+bool soft_cmac_aes(const void *key, size_t key_len,
+			const void *data, size_t data_len,
+			void *out, size_t out_len)
+{
+	struct soft_aes aes;
+	uint8_t k[16] = { 0 };
+	uint8_t x[16] = { 0 };
+	const uint8_t *p = data;
+	size_t i;
+
+	if (!soft_aes_init(&aes, key, key_len))
+		return false;
+
+	soft_aes_encrypt(&aes, k, k);
+	cmac_subkey(k);
+
+	while (data_len > 16) {
+		for (i = 0; i < 16; i++)
+			x[i] ^= p[i];
+
+		soft_aes_encrypt(&aes, x, x);
+		p += 16;
+		data_len -= 16;
+	}
+
+	/* Last block: complete blocks use K1, padded blocks use K2 */
+	if (data_len < 16) {
+		cmac_subkey(k);
+		x[data_len] ^= 0x80;
+	}
+
+	for (i = 0; i < data_len; i++)
+		x[i] ^= p[i];
+
+	for (i = 0; i < 16; i++)
+		x[i] ^= k[i];
+
+	soft_aes_encrypt(&aes, x, x);
+
+	if (out_len > 16)
+		out_len = 16;
+
+	memcpy(out, x, out_len);
+
+	soft_aes_clear(&aes);
+	explicit_bzero(k, sizeof(k));
+	explicit_bzero(x, sizeof(x));
+
+	return true;
+}
@@ -0,0 +1,84 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct iovec;
+
+/*
+ * In-process implementations of the primitives used on the handshake hot
+ * path (SHA1/SHA256/SHA384, HMAC, AES and CMAC-AES).  These avoid the
+ * per-operation socket round trips of the kernel (AF_ALG) backed l_checksum
+ * and l_cipher objects.  The contexts live on the caller's stack and must
+ * be cleared with the corresponding *_clear function once done.
+ */
+
+struct soft_hash {
+	enum l_checksum_type type;
+	union {
+		uint32_t h32[8];
+		uint64_t h64[8];
+	} state;
+	uint64_t len;
+	uint8_t block[128];
+	size_t block_len;
+};
+
+bool soft_hash_init(struct soft_hash *hash, enum l_checksum_type type);
+void soft_hash_update(struct soft_hash *hash, const void *data, size_t len);
+void soft_hash_updatev(struct soft_hash *hash, const struct iovec *iov,
+			size_t iov_len);
+size_t soft_hash_final(struct soft_hash *hash, void *out, size_t out_len);
+void soft_hash_clear(struct soft_hash *hash);
+
+struct soft_hmac {
+	struct soft_hash inner;
+	struct soft_hash outer;
+	struct soft_hash ctx;
+};
+
+bool soft_hmac_init(struct soft_hmac *hmac, enum l_checksum_type type,
+			const void *key, size_t key_len);
+void soft_hmac_reset(struct soft_hmac *hmac);
+void soft_hmac_update(struct soft_hmac *hmac, const void *data, size_t len);
+void soft_hmac_updatev(struct soft_hmac *hmac, const struct iovec *iov,
+			size_t iov_len);
+size_t soft_hmac_final(struct soft_hmac *hmac, void *out, size_t out_len);
+void soft_hmac_clear(struct soft_hmac *hmac);
+
+struct soft_aes {
+	uint32_t rk[60];
+	unsigned int rounds;
+};
+
+bool soft_aes_init(struct soft_aes *aes, const void *key, size_t key_len);
+void soft_aes_encrypt(const struct soft_aes *aes, const uint8_t in[16],
+			uint8_t out[16]);
+void soft_aes_decrypt(const struct soft_aes *aes, const uint8_t in[16],
+			uint8_t out[16]);
+void soft_aes_clear(struct soft_aes *aes);
+
+bool soft_cmac_aes(const void *key, size_t key_len,
+			const void *data, size_t data_len,
+			void *out, size_t out_len);
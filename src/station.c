@@ -35,6 +35,9 @@
 #include <ell/ell.h>
 
 #include "ell/useful.h"
+
+#include "linux/nl80211.h"
+
 #include "src/util.h"
 #include "src/iwd.h"
 #include "src/module.h"
@@ -50,8 +53,10 @@
 #include "src/handshake.h"
 #include "src/station.h"
 #include "src/blacklist.h"
+#include "src/bss-history.h"
 #include "src/mpdu.h"
 #include "src/erp.h"
+#include "src/pmksa.h"
 #include "src/netconfig.h"
 #include "src/anqp.h"
 #include "src/anqputil.h"
@@ -59,12 +64,26 @@
 #include "src/frame-xchg.h"
 #include "src/sysfs.h"
 #include "src/band.h"
+#include "src/profile.h"
+#include "src/hotspot.h"
+
+#define MEMACCT_MODULE MEMACCT_STATION
+#include "src/memacct.h"
 
 static struct l_queue *station_list;
 static uint32_t netdev_watch;
 static uint32_t mfp_setting;
 static uint32_t roam_retry_interval;
+static uint32_t roam_candidate_scan_interval;
+static uint32_t roam_scan_slice_size;
+static uint32_t roam_scan_slice_gap;
+static uint32_t fast_reconnect_max_age;
 static bool anqp_disabled;
+static bool okc_disabled;
+static bool wowlan_enabled;
+static bool power_save_managed;
+static struct l_queue *anqp_cache;
+static struct l_queue *fast_reconnect_cache;
 static bool supports_arp_evict_nocarrier;
 static bool supports_ndisc_evict_nocarrier;
 static struct watchlist event_watches;
@@ -78,19 +97,23 @@ struct station {
 	struct network *connect_pending_network;
 	struct l_queue *autoconnect_list;
 	struct l_queue *bss_list;
+	struct l_hashmap *bss_index;
 	struct l_queue *hidden_bss_list_sorted;
 	struct l_hashmap *networks;
 	struct l_queue *networks_sorted;
+	uint32_t networks_seq;
 	struct l_dbus_message *connect_pending;
 	struct l_dbus_message *hidden_pending;
 	struct l_dbus_message *disconnect_pending;
 	struct l_dbus_message *scan_pending;
 	struct l_dbus_message *get_station_pending;
 	struct signal_agent *signal_agent;
+	struct telemetry_agent *telemetry_agent;
 	uint32_t dbus_scan_id;
 	uint32_t quick_scan_id;
 	uint32_t hidden_network_scan_id;
 	struct l_queue *owe_hidden_scan_ids;
+	struct l_queue *owe_pairs;
 
 	/* Roaming related members */
 	struct timespec roam_min_time;
@@ -98,6 +121,21 @@ struct station {
 	uint32_t roam_scan_id;
 	uint8_t preauth_bssid[6];
 
+	/* BSS whose connection is being accounted in bss-history */
+	uint8_t history_addr[6];
+	struct l_timeout *history_timeout;
+
+	/* Recent roam attempts, exported through GetRoamHistory */
+	struct diagnostic_roam_trace roam_trace;
+	struct diagnostic_roam *roam_current;
+
+	/* Roam scan split into slices, see station_roam_scan */
+	uint32_t *roam_slice_freqs;
+	size_t roam_slice_freqs_len;
+	unsigned int roam_slice_idx;
+	struct l_queue *roam_slice_results;
+	struct l_timeout *roam_slice_timeout;
+
 	struct wiphy *wiphy;
 	struct netdev *netdev;
 
@@ -105,26 +143,110 @@ struct station {
 
 	struct netconfig *netconfig;
 
+	/* Connection latency per phase, see station_connect_latency_update */
+	uint64_t scan_start;
+	uint64_t last_scan_duration;
+	uint64_t netconfig_start;
+	struct diagnostic_latency scan_latency;
+	struct diagnostic_latency auth_latency;
+	struct diagnostic_latency assoc_latency;
+	struct diagnostic_latency handshake_latency;
+	struct diagnostic_latency netconfig_latency;
+
 	/* Set of frequencies to scan first when attempting a roam */
 	struct scan_freq_set *roam_freqs;
 
+	/* FT roam candidates whose PMK-R1 is derived ahead of time */
+	uint8_t ft_candidates[HANDSHAKE_PMK_R1_CACHE_SIZE][6];
+	unsigned int n_ft_candidates;
+	struct l_idle *ft_precompute_idle;
+
+	/* Roam candidates learned in the background while connected */
+	struct l_queue *roam_candidates;
+	struct l_timeout *roam_candidate_timeout;
+	uint32_t roam_candidate_scan_id;
+	unsigned int roam_candidate_freq_idx;
+
+	/* Last connected BSS, tried directly before the quick scan */
+	uint8_t fast_reconnect_addr[6];
+	uint64_t fast_reconnect_time;
+	struct l_idle *fast_reconnect_idle;
+
 	/* Frequencies split into subsets by priority */
 	struct scan_freq_set *scan_freqs_order[3];
 	unsigned int dbus_scan_subset_idx;
 
+	/* WoWLAN triggers last configured, 1 << NL80211_WOWLAN_TRIG_* */
+	uint32_t wowlan_triggers;
+
+	/* Dialog token of the BSS Transition Request still to be answered */
+	uint8_t btm_dialog_token;
+
 	bool preparing_roam : 1;
 	bool roam_scan_full : 1;
 	bool signal_low : 1;
 	bool ap_directed_roaming : 1;
+	bool btm_response_pending : 1;
+	bool roam_predicted : 1;
 	bool scanning : 1;
+	bool radio_budget : 1;
 	bool autoconnect : 1;
 	bool autoconnect_can_start : 1;
+	bool networks_reorder : 1;
+	bool netconfig_keep : 1;
+	bool power_save_set : 1;
+	bool power_save : 1;
+};
+
+/* BSS of a connection lost while its station went away, see station_free */
+struct fast_reconnect_entry {
+	uint32_t ifindex;
+	struct scan_bss *bss;
+	uint64_t time;
+};
+
+/*
+ * An Open to OWE transition pairing confirmed by a directed probe.  The
+ * hidden OWE BSS keeps beaconing with an empty SSID so without this the
+ * pairing is probed again after every scan.
+ */
+struct owe_pair_entry {
+	uint8_t open_addr[6];
+	uint8_t owe_addr[6];
+	uint8_t owe_ssid[32];
+	size_t owe_ssid_len;
+	uint64_t time;
 };
 
+#define OWE_PAIR_MAX_AGE (10 * 60 * L_USEC_PER_SEC)
+#define OWE_PAIR_MAX_ENTRIES 16
+
 struct anqp_entry {
 	struct station *station;
 	struct network *network;
 	uint32_t pending;
+	uint8_t key[6];
+	struct l_queue *networks;	/* Other networks waiting on key */
+};
+
+/*
+ * BSSes from the background scans are only used for a roam decision if seen
+ * in the last ROAM_CANDIDATE_MAX_AGE, older results trigger a normal scan.
+ */
+#define ROAM_CANDIDATE_MAX_AGE	(120 * L_USEC_PER_SEC)
+
+/*
+ * ANQP responses are cached for a while, keyed by the HESSID if the BSS
+ * advertises one, or by the BSSID otherwise.  The NAI Realm list is kept
+ * rather than the resulting network_info so that changes to the Known
+ * Networks are still taken into account.
+ */
+#define ANQP_CACHE_LIFETIME	(15 * 60)	/* Seconds */
+
+struct anqp_cache_entry {
+	uint8_t key[6];
+	uint64_t expiry;
+	char **realms;
 };
 
 struct wiphy *station_get_wiphy(struct station *station)
@@ -184,6 +306,12 @@ static void station_property_set_scanning(struct station *station,
 
 	station->scanning = scanning;
 
+	if (scanning)
+		station->scan_start = l_time_now();
+	else
+		station->last_scan_duration = l_time_now() -
+							station->scan_start;
+
 	l_dbus_property_changed(dbus_get_bus(),
 				netdev_get_path(station->netdev),
 					IWD_STATION_INTERFACE, "Scanning");
@@ -191,6 +319,8 @@ static void station_property_set_scanning(struct station *station,
 
 static void station_enter_state(struct station *station,
 						enum station_state state);
+static void station_telemetry_start(struct station *station);
+static void station_telemetry_stop(struct station *station);
 
 static void network_add_foreach(struct network *network, void *user_data)
 {
@@ -200,6 +330,41 @@ static void network_add_foreach(struct network *network, void *user_data)
 				network_rank_compare, NULL);
 }
 
+/*
+ * Only the best few candidates are checked ahead, each check loads the
+ * network's settings and the rest are unlikely to be reached.
+ */
+#define AUTOCONNECT_PRECHECK_MAX	3
+
+static void station_autoconnect_precheck(struct station *station)
+{
+	const struct l_queue_entry *entry =
+			l_queue_get_entries(station->autoconnect_list);
+	unsigned int checked = 0;
+
+	while (entry && checked < AUTOCONNECT_PRECHECK_MAX) {
+		struct network *network = entry->data;
+		struct scan_bss *bss = network_bss_select(network, false);
+		int r;
+
+		entry = entry->next;
+
+		/* Skipped by station_autoconnect_next anyway */
+		if (!bss)
+			continue;
+
+		checked++;
+
+		r = network_autoconnect_precheck(network, bss);
+		if (!r)
+			continue;
+
+		l_debug("autoconnect: dropping SSID: %s: %s (%d)",
+				network_get_ssid(network), strerror(-r), r);
+		l_queue_remove(station->autoconnect_list, network);
+	}
+}
+
 static int station_autoconnect_next(struct station *station)
 {
 	struct network *network;
@@ -267,6 +432,7 @@ static void station_autoconnect_start(struct station *station)
 
 	station->autoconnect_list = l_queue_new();
 	station_network_foreach(station, network_add_foreach, station);
+	station_autoconnect_precheck(station);
 	station_autoconnect_next(station);
 	station->autoconnect_can_start = false;
 }
@@ -293,11 +459,9 @@ static bool process_network(const void *key, void *data, void *user_data)
 	if (!network_bss_list_isempty(network)) {
 		bool connected = network == station->connected_network;
 
-		/* Build the network list ordered by rank */
-		network_rank_update(network, connected);
-
-		l_queue_insert(station->networks_sorted, network,
-				network_rank_compare, NULL);
+		/* Only networks whose rank changed require reordering */
+		if (network_rank_update(network, connected))
+			station->networks_reorder = true;
 
 		return false;
 	}
@@ -305,11 +469,45 @@ static bool process_network(const void *key, void *data, void *user_data)
 	/* Drop networks that have no more BSSs in range */
 	l_debug("No remaining BSSs for SSID: %s -- Removing network",
 			network_get_ssid(network));
+	l_queue_remove(station->networks_sorted, network);
 	network_remove(network, -ERANGE);
 
 	return true;
 }
 
+static void network_add_sorted(const void *key, void *value, void *user_data)
+{
+	struct station *station = user_data;
+
+	l_queue_push_tail(station->networks_sorted, value);
+}
+
+/*
+ * Update the ordered network list after the networks were processed.  The
+ * list is only rebuilt if networks were added to station->networks since it
+ * was last built, and only re-sorted if the rank of a network changed.
+ * Signal strengths were refreshed either way so the sequence number that
+ * GetFilteredNetworks callers compare against is always bumped.
+ */
+static void station_update_networks_sorted(struct station *station)
+{
+	station->networks_seq++;
+
+	if (l_queue_length(station->networks_sorted) !=
+				l_hashmap_size(station->networks)) {
+		l_queue_clear(station->networks_sorted, NULL);
+		l_hashmap_foreach(station->networks, network_add_sorted,
+					station);
+		station->networks_reorder = true;
+	}
+
+	if (!station->networks_reorder)
+		return;
+
+	l_queue_sort(station->networks_sorted, network_rank_compare, NULL);
+	station->networks_reorder = false;
+}
+
 static const char *iwd_network_get_path(struct station *station,
 					const char *ssid,
 					enum security security)
@@ -350,19 +548,7 @@ static int station_parse_bss_security(struct station *station,
 				struct scan_bss *bss,
 				enum security *security_out)
 {
-	struct ie_rsn_info info;
-	int r;
-
-	r = scan_bss_get_rsn_info(bss, &info);
-	if (r < 0) {
-		if (r != -ENOENT)
-			return r;
-
-		*security_out = security_determine(bss->capability, NULL);
-	} else
-		*security_out = security_determine(bss->capability, &info);
-
-	return 0;
+	return scan_bss_get_security(bss, security_out);
 }
 
 /*
@@ -462,21 +648,100 @@ static struct network *station_add_seen_bss(struct station *station,
 	return network;
 }
 
-static bool bss_match(const void *a, const void *b)
+/*
+ * scan_bss objects are indexed by BSSID + SSID.  The hash only covers the
+ * BSSID since the SSID of an entry can be cleared in place when a network
+ * is forgotten, see station_hide_network.  A lookup key with ssid_len set
+ * to BSS_INDEX_ANY_SSID finds an entry with the BSSID and any SSID.
+ */
+#define BSS_INDEX_ANY_SSID	UINT8_MAX
+
+static unsigned int bss_hash(const void *key)
+{
+	const struct scan_bss *bss = key;
+
+	return l_get_le32(bss->addr + 2);
+}
+
+static int bss_compare(const void *a, const void *b)
 {
 	const struct scan_bss *bss_a = a;
 	const struct scan_bss *bss_b = b;
+	int r;
 
-	if (memcmp(bss_a->addr, bss_b->addr, sizeof(bss_a->addr)))
-		return false;
+	r = memcmp(bss_a->addr, bss_b->addr, sizeof(bss_a->addr));
+	if (r)
+		return r;
+
+	if (bss_a->ssid_len == BSS_INDEX_ANY_SSID ||
+			bss_b->ssid_len == BSS_INDEX_ANY_SSID)
+		return 0;
 
 	if (bss_a->ssid_len != bss_b->ssid_len)
-		return false;
+		return bss_a->ssid_len - bss_b->ssid_len;
+
+	return memcmp(bss_a->ssid, bss_b->ssid, bss_a->ssid_len);
+}
+
+static struct l_hashmap *bss_index_new(void)
+{
+	struct l_hashmap *index = l_hashmap_new();
+
+	l_hashmap_set_hash_function(index, bss_hash);
+	l_hashmap_set_compare_function(index, bss_compare);
+
+	return index;
+}
+
+static void bss_index_remove(struct l_hashmap *index, struct scan_bss *bss)
+{
+	/* Only drop the entry if it refers to this exact object */
+	if (l_hashmap_lookup(index, bss) == bss)
+		l_hashmap_remove(index, bss);
+}
 
-	return !memcmp(bss_a->ssid, bss_b->ssid, bss_a->ssid_len);
+static bool bss_match_bssid(const void *a, const void *b)
+{
+	const struct scan_bss *bss = a;
+	const uint8_t *bssid = b;
+
+	return !memcmp(bss->addr, bssid, sizeof(bss->addr));
+}
+
+static struct scan_bss *station_bss_find_by_addr(struct station *station,
+							const uint8_t *addr)
+{
+	struct scan_bss key;
+
+	memcpy(key.addr, addr, sizeof(key.addr));
+	key.ssid_len = BSS_INDEX_ANY_SSID;
+
+	return l_hashmap_lookup(station->bss_index, &key);
+}
+
+static void station_bss_list_add(struct station *station,
+					struct scan_bss *bss)
+{
+	l_queue_push_tail(station->bss_list, bss);
+	l_hashmap_replace(station->bss_index, bss, bss, NULL);
+}
+
+static struct scan_bss *station_bss_list_remove(struct station *station,
+						const uint8_t *addr)
+{
+	struct scan_bss *bss = station_bss_find_by_addr(station, addr);
+
+	if (!bss)
+		return NULL;
+
+	l_queue_remove(station->bss_list, bss);
+	l_hashmap_remove(station->bss_index, bss);
+
+	return bss;
 }
 
 struct bss_expiration_data {
+	struct l_hashmap *index;
 	struct scan_bss *connected_bss;
 	uint64_t now;
 	const struct scan_freq_set *freqs;
@@ -501,6 +766,7 @@ static bool bss_free_if_expired(void *data, void *user_data)
 			bss->time_stamp + SCAN_RESULT_BSS_RETENTION_TIME))
 		return false;
 
+	bss_index_remove(expiration_data->index, bss);
 	bss_free(bss);
 
 	return true;
@@ -510,6 +776,7 @@ static void station_bss_list_remove_expired_bsses(struct station *station,
 					const struct scan_freq_set *freqs)
 {
 	struct bss_expiration_data data = {
+		.index = station->bss_index,
 		.now = l_time_now(),
 		.connected_bss = station->connected_bss,
 		.freqs = freqs,
@@ -518,23 +785,83 @@ static void station_bss_list_remove_expired_bsses(struct station *station,
 	l_queue_foreach_remove(station->bss_list, bss_free_if_expired, &data);
 }
 
-struct nai_search {
-	struct network *network;
-	const char **realms;
-};
+static void station_anqp_apply_realms(struct network *network,
+					char **realms)
+{
+	struct network_info *info;
+
+	if (!realms || network_get_info(network))
+		return;
+
+	info = hotspot_find_by_nai_realms((const char **) realms);
+	if (info)
+		network_set_info(network, info);
+}
 
-static bool match_nai_realms(const struct network_info *info, void *user_data)
+static const uint8_t *station_anqp_key(const struct scan_bss *bss)
 {
-	struct nai_search *search = user_data;
+	if (!l_memeqzero(bss->hessid, 6))
+		return bss->hessid;
 
-	if (!network_info_match_nai_realm(info, search->realms))
-		return false;
+	return bss->addr;
+}
+
+static void anqp_cache_entry_free(void *data)
+{
+	struct anqp_cache_entry *cached = data;
+
+	l_strv_free(cached->realms);
+	l_free(cached);
+}
+
+static bool anqp_cache_entry_expired(void *data, void *user_data)
+{
+	struct anqp_cache_entry *cached = data;
+	const uint64_t *now = user_data;
 
-	network_set_info(search->network, (struct network_info *) info);
+	if (l_time_after(cached->expiry, *now))
+		return false;
 
+	anqp_cache_entry_free(cached);
 	return true;
 }
 
+static bool anqp_cache_entry_match(const void *a, const void *b)
+{
+	const struct anqp_cache_entry *cached = a;
+
+	return !memcmp(cached->key, b, 6);
+}
+
+static struct anqp_cache_entry *anqp_cache_lookup(const uint8_t *key)
+{
+	uint64_t now = l_time_now();
+
+	l_queue_foreach_remove(anqp_cache, anqp_cache_entry_expired, &now);
+
+	return l_queue_find(anqp_cache, anqp_cache_entry_match, key);
+}
+
+static void anqp_cache_add(const uint8_t *key, char **realms)
+{
+	struct anqp_cache_entry *cached;
+
+	cached = l_queue_remove_if(anqp_cache, anqp_cache_entry_match, key);
+	if (cached)
+		anqp_cache_entry_free(cached);
+
+	cached = l_new(struct anqp_cache_entry, 1);
+	memcpy(cached->key, key, 6);
+	cached->expiry = l_time_offset(l_time_now(),
+					ANQP_CACHE_LIFETIME * L_USEC_PER_SEC);
+	cached->realms = realms;
+
+	if (!anqp_cache)
+		anqp_cache = l_queue_new();
+
+	l_queue_push_tail(anqp_cache, cached);
+}
+
 static bool match_pending(const void *a, const void *b)
 {
 	const struct anqp_entry *entry = a;
@@ -542,6 +869,31 @@ static bool match_pending(const void *a, const void *b)
 	return entry->pending != 0;
 }
 
+static bool match_pending_key(const void *a, const void *b)
+{
+	const struct anqp_entry *entry = a;
+
+	return entry->pending && !memcmp(entry->key, b, 6);
+}
+
+static bool match_pending_network(const void *a, const void *b)
+{
+	const struct anqp_entry *entry = a;
+	const struct l_queue_entry *e;
+
+	if (!entry->pending)
+		return false;
+
+	if (entry->network == b)
+		return true;
+
+	for (e = l_queue_get_entries(entry->networks); e; e = e->next)
+		if (e->data == b)
+			return true;
+
+	return false;
+}
+
 static void remove_anqp(void *data)
 {
 	struct anqp_entry *entry = data;
@@ -549,16 +901,22 @@ static void remove_anqp(void *data)
 	if (entry->pending)
 		anqp_cancel(entry->pending);
 
+	l_queue_destroy(entry->networks, NULL);
 	l_free(entry);
 }
 
 static bool anqp_entry_foreach(void *data, void *user_data)
 {
 	struct anqp_entry *e = data;
+	struct network *network;
 
 	WATCHLIST_NOTIFY(&event_watches, station_event_watch_func_t,
 				STATION_EVENT_ANQP_FINISHED, e->network);
 
+	while ((network = l_queue_pop_head(e->networks)))
+		WATCHLIST_NOTIFY(&event_watches, station_event_watch_func_t,
+					STATION_EVENT_ANQP_FINISHED, network);
+
 	remove_anqp(e);
 
 	return true;
@@ -576,7 +934,7 @@ static void station_anqp_response_cb(enum anqp_result result,
 	uint16_t len;
 	const void *data;
 	char **realms = NULL;
-	struct nai_search search;
+	const struct l_queue_entry *e;
 
 	l_debug("");
 
@@ -603,15 +961,13 @@ static void station_anqp_response_cb(enum anqp_result result,
 		}
 	}
 
-	if (!realms)
-		goto request_done;
-
-	search.network = network;
-	search.realms = (const char **)realms;
+	station_anqp_apply_realms(network, realms);
 
-	known_networks_foreach(match_nai_realms, &search);
+	for (e = l_queue_get_entries(entry->networks); e; e = e->next)
+		station_anqp_apply_realms(e->data, realms);
 
-	l_strv_free(realms);
+	/* Also remember APs with no matching realms to avoid re-querying */
+	anqp_cache_add(entry->key, realms);
 
 request_done:
 	entry->pending = 0;
@@ -632,6 +988,8 @@ static bool station_start_anqp(struct station *station, struct network *network,
 	uint8_t anqp[256];
 	uint8_t *ptr = anqp;
 	struct anqp_entry *entry;
+	const uint8_t *key = station_anqp_key(bss);
+	struct anqp_cache_entry *cached;
 
 	if (!bss->hs20_capable)
 		return false;
@@ -645,9 +1003,34 @@ static bool station_start_anqp(struct station *station, struct network *network,
 		return false;
 	}
 
+	cached = anqp_cache_lookup(key);
+	if (cached) {
+		l_debug("Using cached ANQP data for "MAC, MAC_STR(key));
+		station_anqp_apply_realms(network, cached->realms);
+		return false;
+	}
+
+	/* Only query one BSS per network and per HESSID */
+	if (l_queue_find(station->anqp_pending, match_pending_network,
+				network))
+		return false;
+
+	entry = l_queue_find(station->anqp_pending, match_pending_key, key);
+	if (entry) {
+		if (!entry->networks)
+			entry->networks = l_queue_new();
+
+		l_queue_push_tail(entry->networks, network);
+
+		WATCHLIST_NOTIFY(&event_watches, station_event_watch_func_t,
+					STATION_EVENT_ANQP_STARTED, network);
+		return true;
+	}
+
 	entry = l_new(struct anqp_entry, 1);
 	entry->station = station;
 	entry->network = network;
+	memcpy(entry->key, key, 6);
 
 	l_put_le16(ANQP_QUERY_LIST, ptr);
 	ptr += 2;
@@ -727,6 +1110,127 @@ static bool network_has_open_pair(struct network *network, struct scan_bss *owe)
 	return false;
 }
 
+static bool owe_pair_match_open(const void *a, const void *b)
+{
+	const struct owe_pair_entry *pair = a;
+
+	return !memcmp(pair->open_addr, b, 6);
+}
+
+static void station_owe_pair_save(struct station *station,
+					const struct scan_bss *owe)
+{
+	struct owe_pair_entry *pair;
+
+	if (!station->owe_pairs)
+		station->owe_pairs = l_queue_new();
+
+	pair = l_queue_remove_if(station->owe_pairs, owe_pair_match_open,
+					owe->owe_trans->bssid);
+	if (!pair) {
+		if (l_queue_length(station->owe_pairs) >= OWE_PAIR_MAX_ENTRIES)
+			l_free(l_queue_pop_head(station->owe_pairs));
+
+		pair = l_new(struct owe_pair_entry, 1);
+		memcpy(pair->open_addr, owe->owe_trans->bssid, 6);
+	}
+
+	memcpy(pair->owe_addr, owe->addr, 6);
+	memcpy(pair->owe_ssid, owe->ssid, owe->ssid_len);
+	pair->owe_ssid_len = owe->ssid_len;
+	pair->time = l_time_now();
+
+	l_queue_push_tail(station->owe_pairs, pair);
+}
+
+static struct scan_bss *station_find_hidden_owe(struct station *station,
+						const struct scan_bss *open)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(station->hidden_bss_list_sorted);
+						entry; entry = entry->next) {
+		struct scan_bss *bss = entry->data;
+		struct ie_owe_transition_info *info = bss->owe_trans;
+
+		if (memcmp(bss->addr, open->owe_trans->bssid, 6))
+			continue;
+
+		if (!bss->rsne || !info)
+			return NULL;
+
+		/* The hidden BSS must still point back at the open one */
+		if (memcmp(info->bssid, open->addr, 6) ||
+				info->ssid_len != open->ssid_len ||
+				memcmp(info->ssid, open->ssid, open->ssid_len))
+			return NULL;
+
+		return bss;
+	}
+
+	return NULL;
+}
+
+/*
+ * Resolve the OWE BSS paired with @open straight from the current scan
+ * results if the same pairing was confirmed recently, in which case there
+ * is no need for another directed probe.
+ */
+static bool station_owe_pair_resolve(struct station *station,
+					struct network *network,
+					struct scan_bss *open)
+{
+	struct ie_owe_transition_info *info = open->owe_trans;
+	struct owe_pair_entry *pair;
+	struct scan_bss *owe;
+	const struct l_queue_entry *entry;
+
+	pair = l_queue_find(station->owe_pairs, owe_pair_match_open,
+				open->addr);
+	if (!pair)
+		return false;
+
+	if (l_time_diff(pair->time, l_time_now()) >= OWE_PAIR_MAX_AGE ||
+			memcmp(pair->owe_addr, info->bssid, 6) ||
+			pair->owe_ssid_len != info->ssid_len ||
+			memcmp(pair->owe_ssid, info->ssid, info->ssid_len)) {
+		l_queue_remove(station->owe_pairs, pair);
+		l_free(pair);
+		return false;
+	}
+
+	owe = station_find_hidden_owe(station, open);
+	if (!owe)
+		return false;
+
+	/* An entry with the revealed SSID is still around, let it be */
+	for (entry = l_queue_get_entries(station->bss_list); entry;
+						entry = entry->next) {
+		struct scan_bss *bss = entry->data;
+
+		if (!memcmp(bss->addr, owe->addr, 6) &&
+				bss->ssid_len == pair->owe_ssid_len &&
+				!memcmp(bss->ssid, pair->owe_ssid,
+						pair->owe_ssid_len))
+			return false;
+	}
+
+	/* The SSID is part of the index key, see bss_hash */
+	bss_index_remove(station->bss_index, owe);
+	memcpy(owe->ssid, pair->owe_ssid, pair->owe_ssid_len);
+	owe->ssid_len = pair->owe_ssid_len;
+	l_hashmap_replace(station->bss_index, owe, owe, NULL);
+
+	l_queue_remove(station->hidden_bss_list_sorted, owe);
+
+	l_debug("Adding cached OWE transition network "MAC" to %s",
+			MAC_STR(owe->addr), network_get_ssid(network));
+
+	network_bss_add(network, owe);
+
+	return true;
+}
+
 static bool station_owe_transition_results(int err, struct l_queue *bss_list,
 					const struct scan_freq_set *freqs,
 					void *userdata)
@@ -758,8 +1262,9 @@ static bool station_owe_transition_results(int err, struct l_queue *bss_list,
 		l_debug("Adding OWE transition network "MAC" to %s",
 				MAC_STR(bss->addr), network_get_ssid(network));
 
-		l_queue_push_tail(station->bss_list, bss);
+		station_bss_list_add(station, bss);
 		network_bss_add(network, bss);
+		station_owe_pair_save(station, bss);
 
 		continue;
 
@@ -826,6 +1331,9 @@ static void foreach_add_owe_scan(struct network *network, void *data)
 		if (network_bss_find_by_addr(network, open->owe_trans->bssid))
 			continue;
 
+		if (station_owe_pair_resolve(station, network, open))
+			continue;
+
 		if (!list)
 			list = l_queue_new();
 
@@ -874,22 +1382,142 @@ static bool bss_free_if_ssid_not_utf8(void *data, void *user_data)
 	return true;
 }
 
-/*
- * Used when scan results were obtained; either from scan running
- * inside station module or scans running in other state machines, e.g. wsc
- */
-void station_set_scan_results(struct station *station,
-					struct l_queue *new_bss_list,
-					const struct scan_freq_set *freqs,
-					bool trigger_autoconnect)
+/* What clients were last told about a network, keyed by its object path */
+struct network_snapshot {
+	int16_t signal;
+	unsigned int bss_count;
+};
+
+static unsigned int network_bss_count(struct network *network)
 {
-	const struct l_queue_entry *bss_entry;
-	struct network *network;
+	const struct l_queue_entry *entry;
+	unsigned int count = 0;
 
-	l_queue_foreach_remove(new_bss_list, bss_free_if_ssid_not_utf8, NULL);
+	for (entry = network_bss_list_get_entries(network); entry;
+						entry = entry->next)
+		count++;
+
+	return count;
+}
+
+static void network_snapshot_add(const void *key, void *data,
+					void *user_data)
+{
+	struct network *network = data;
+	struct l_hashmap *snapshot = user_data;
+	struct network_snapshot *s = l_new(struct network_snapshot, 1);
+
+	s->signal = network_get_signal_strength(network);
+	s->bss_count = network_bss_count(network);
+
+	l_hashmap_insert(snapshot, key, s);
+}
+
+static void station_append_network(struct l_dbus_message_builder *builder,
+					const struct network *network);
+
+static void network_snapshot_append_removed(const void *key, void *data,
+						void *user_data)
+{
+	struct l_dbus_message_builder *builder = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'o', key);
+}
+
+/*
+ * Compare the networks against the snapshot taken before the scan results
+ * were processed and signal the difference, so that clients don't need to
+ * call GetOrderedNetworks after every scan.  A network is reported as
+ * changed if its signal strength or number of BSSs changed.
+ */
+static void station_emit_networks_changed(struct station *station,
+						struct l_hashmap *snapshot)
+{
+	struct l_queue *added = NULL;
+	struct l_queue *changed = NULL;
+	const struct l_queue_entry *entry;
+	struct l_dbus_message *signal;
+	struct l_dbus_message_builder *builder;
+
+	for (entry = l_queue_get_entries(station->networks_sorted); entry;
+						entry = entry->next) {
+		struct network *network = entry->data;
+		struct network_snapshot *s;
+
+		s = l_hashmap_remove(snapshot, network_get_path(network));
+		if (!s) {
+			if (!added)
+				added = l_queue_new();
+
+			l_queue_push_tail(added, network);
+			continue;
+		}
+
+		if (s->signal != network_get_signal_strength(network) ||
+				s->bss_count != network_bss_count(network)) {
+			if (!changed)
+				changed = l_queue_new();
+
+			l_queue_push_tail(changed, network);
+		}
+
+		l_free(s);
+	}
+
+	if (!added && !changed && l_hashmap_isempty(snapshot))
+		return;
+
+	signal = l_dbus_message_new_signal(dbus_get_bus(),
+					netdev_get_path(station->netdev),
+					IWD_STATION_INTERFACE,
+					"NetworksChanged");
+	builder = l_dbus_message_builder_new(signal);
+
+	l_dbus_message_builder_enter_array(builder, "(on)");
+
+	for (entry = l_queue_get_entries(added); entry; entry = entry->next)
+		station_append_network(builder, entry->data);
+
+	l_dbus_message_builder_leave_array(builder);
+	l_dbus_message_builder_enter_array(builder, "(on)");
+
+	for (entry = l_queue_get_entries(changed); entry; entry = entry->next)
+		station_append_network(builder, entry->data);
+
+	l_dbus_message_builder_leave_array(builder);
+	l_dbus_message_builder_enter_array(builder, "o");
+	l_hashmap_foreach(snapshot, network_snapshot_append_removed, builder);
+	l_dbus_message_builder_leave_array(builder);
+
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	l_dbus_send(dbus_get_bus(), signal);
+
+	l_queue_destroy(added, NULL);
+	l_queue_destroy(changed, NULL);
+}
+
+/*
+ * Used when scan results were obtained; either from scan running
+ * inside station module or scans running in other state machines, e.g. wsc
+ */
+void station_set_scan_results(struct station *station,
+					struct l_queue *new_bss_list,
+					const struct scan_freq_set *freqs,
+					bool trigger_autoconnect)
+{
+	const struct l_queue_entry *bss_entry;
+	struct l_hashmap *new_bss_index;
+	struct l_hashmap *snapshot = l_hashmap_string_new();
+
+	l_queue_foreach_remove(new_bss_list, bss_free_if_ssid_not_utf8, NULL);
+
+	l_hashmap_foreach(station->networks, network_snapshot_add, snapshot);
 
-	while ((network = l_queue_pop_head(station->networks_sorted)))
-		network_bss_list_clear(network);
+	for (bss_entry = l_queue_get_entries(station->networks_sorted);
+					bss_entry; bss_entry = bss_entry->next)
+		network_bss_list_clear(bss_entry->data);
 
 	l_queue_clear(station->hidden_bss_list_sorted, NULL);
 
@@ -898,12 +1526,19 @@ void station_set_scan_results(struct station *station,
 
 	station_bss_list_remove_expired_bsses(station, freqs);
 
+	new_bss_index = bss_index_new();
+
+	for (bss_entry = l_queue_get_entries(new_bss_list); bss_entry;
+						bss_entry = bss_entry->next)
+		l_hashmap_replace(new_bss_index, bss_entry->data,
+					bss_entry->data, NULL);
+
 	for (bss_entry = l_queue_get_entries(station->bss_list); bss_entry;
 						bss_entry = bss_entry->next) {
 		struct scan_bss *old_bss = bss_entry->data;
 		struct scan_bss *new_bss;
 
-		new_bss = l_queue_find(new_bss_list, bss_match, old_bss);
+		new_bss = l_hashmap_lookup(new_bss_index, old_bss);
 		if (new_bss) {
 			if (old_bss == station->connected_bss)
 				station->connected_bss = new_bss;
@@ -919,9 +1554,11 @@ void station_set_scan_results(struct station *station,
 		}
 
 		l_queue_push_tail(new_bss_list, old_bss);
+		l_hashmap_insert(new_bss_index, old_bss, old_bss);
 	}
 
 	l_queue_destroy(station->bss_list, NULL);
+	l_hashmap_destroy(station->bss_index, NULL);
 
 	for (bss_entry = l_queue_get_entries(new_bss_list); bss_entry;
 						bss_entry = bss_entry->next) {
@@ -939,8 +1576,13 @@ void station_set_scan_results(struct station *station,
 	}
 
 	station->bss_list = new_bss_list;
+	station->bss_index = new_bss_index;
 
 	l_hashmap_foreach_remove(station->networks, process_network, station);
+	station_update_networks_sorted(station);
+
+	station_emit_networks_changed(station, snapshot);
+	l_hashmap_destroy(snapshot, l_free);
 
 	station->autoconnect_can_start = trigger_autoconnect;
 	station_autoconnect_start(station);
@@ -987,6 +1629,7 @@ static void station_handshake_event(struct handshake_state *hs,
 	case HANDSHAKE_EVENT_SETTING_KEYS_FAILED:
 	case HANDSHAKE_EVENT_EAP_NOTIFY:
 	case HANDSHAKE_EVENT_P2P_IP_REQUEST:
+	case HANDSHAKE_EVENT_GROUP_REKEY_COMPLETE:
 		/*
 		 * currently we don't care about any other events. The
 		 * netdev_connect_cb will notify us when the connection is
@@ -998,6 +1641,22 @@ static void station_handshake_event(struct handshake_state *hs,
 	va_end(args);
 }
 
+static bool station_build_security_ie(struct scan_bss *bss,
+					const struct ie_rsn_info *info,
+					uint8_t *to)
+{
+	if (bss->rsne)
+		return ie_build_rsne(info, to);
+
+	if (bss->wpa)
+		return ie_build_wpa(info, to);
+
+	if (bss->osen)
+		return ie_build_osen(info, to);
+
+	return false;
+}
+
 static int station_build_handshake_rsn(struct handshake_state *hs,
 					struct wiphy *wiphy,
 					struct network *network,
@@ -1007,14 +1666,35 @@ static int station_build_handshake_rsn(struct handshake_state *hs,
 	enum security security = network_get_security(network);
 	bool add_mde = false;
 	struct erp_cache_entry *erp_cache = NULL;
+	struct pmksa *pmksa = NULL;
 	struct ie_rsn_info bss_info;
 	uint8_t rsne_buf[256];
 	struct ie_rsn_info info;
 	uint8_t *ap_ie;
+	const uint8_t *supplicant_ie = NULL;
 	bool disable_ocv;
 
 	memset(&info, 0, sizeof(info));
 
+	/* RSN takes priority */
+	if (bss->rsne)
+		ap_ie = bss->rsne;
+	else if (bss->wpa)
+		ap_ie = bss->wpa;
+	else if (bss->osen)
+		ap_ie = bss->osen;
+	else
+		ap_ie = NULL;
+
+	/*
+	 * A previous connection to an AP advertising the same IE already
+	 * went through the selection below.  FILS capable APs are never
+	 * cached since the selection also depends on the ERP cache.
+	 */
+	if (ap_ie && network_rsn_cache_lookup(network, ap_ie, bss->mde_present,
+						&info, &supplicant_ie))
+		goto check_pmksa;
+
 	memset(&bss_info, 0, sizeof(bss_info));
 	scan_bss_get_rsn_info(bss, &bss_info);
 
@@ -1117,25 +1797,63 @@ build_ie:
 			info.pairwise_ciphers == IE_RSN_CIPHER_SUITE_CCMP)
 		info.extended_key_id = true;
 
-	/* RSN takes priority */
-	if (bss->rsne) {
-		ap_ie = bss->rsne;
-		ie_build_rsne(&info, rsne_buf);
-	} else if (bss->wpa) {
-		ap_ie = bss->wpa;
-		ie_build_wpa(&info, rsne_buf);
-	} else if (bss->osen) {
-		ap_ie = bss->osen;
-		ie_build_osen(&info, rsne_buf);
-	} else
+	if (!ap_ie || !station_build_security_ie(bss, &info, rsne_buf))
 		goto not_supported;
 
+	supplicant_ie = rsne_buf;
+
+	if (!hs->support_fils)
+		network_rsn_cache_add(network, ap_ie, bss->mde_present,
+					&info, supplicant_ie);
+
+check_pmksa:
+	/*
+	 * Offer a cached PMKSA for this BSS if there is one.  This lets
+	 * 802.1X skip the EAP exchange and SAE the Commit/Confirm exchange.
+	 * FT uses the PMKR0Name instead.
+	 */
+	if (bss->rsne && (info.akm_suites & (IE_RSN_AKM_SUITE_8021X |
+					IE_RSN_AKM_SUITE_8021X_SHA256 |
+					IE_RSN_AKM_SUITE_SAE_SHA256)))
+		pmksa = pmksa_cache_get(hs->spa, bss->addr, bss->ssid,
+						bss->ssid_len,
+						info.akm_suites);
+
+	/*
+	 * Without a PMKSA for this BSS try Opportunistic Key Caching with
+	 * the PMK established with another BSS of the ESS.  An AP without
+	 * OKC support simply starts the EAP exchange.
+	 */
+	if (!pmksa && bss->rsne && !okc_disabled &&
+			(info.akm_suites & (IE_RSN_AKM_SUITE_8021X |
+					IE_RSN_AKM_SUITE_8021X_SHA256))) {
+		pmksa = pmksa_cache_derive(hs->spa, bss->addr, bss->ssid,
+						bss->ssid_len,
+						info.akm_suites);
+		if (pmksa)
+			l_debug("Derived OKC PMKID for "MAC,
+				MAC_STR(bss->addr));
+	}
+
+	/* The PMKID is part of the IE so it has to be built again */
+	if (pmksa) {
+		info.num_pmkids = 1;
+		info.pmkids = pmksa->pmkid;
+		ie_build_rsne(&info, rsne_buf);
+		supplicant_ie = rsne_buf;
+	}
+
 	if (!handshake_state_set_authenticator_ie(hs, ap_ie))
 		goto not_supported;
 
-	if (!handshake_state_set_supplicant_ie(hs, rsne_buf))
+	if (!handshake_state_set_supplicant_ie(hs, supplicant_ie))
 		goto not_supported;
 
+	if (pmksa) {
+		l_debug("Using cached PMKSA for "MAC, MAC_STR(bss->addr));
+		handshake_state_set_pmksa(hs, l_steal_ptr(pmksa));
+	}
+
 	if (IE_AKM_IS_FT(info.akm_suites))
 		add_mde = true;
 
@@ -1174,6 +1892,9 @@ not_supported:
 	if (erp_cache)
 		erp_cache_put(erp_cache);
 
+	if (pmksa)
+		pmksa_free(pmksa);
+
 	return -ENOTSUP;
 }
 
@@ -1192,6 +1913,13 @@ static struct handshake_state *station_handshake_setup(struct station *station,
 
 	handshake_state_set_event_func(hs, station_handshake_event, station);
 
+	/*
+	 * Needed for the PMKSA lookup.  Netdev updates this if the address
+	 * gets randomized before connecting.
+	 */
+	handshake_state_set_supplicant_address(hs,
+					netdev_get_address(station->netdev));
+
 	if (station_build_handshake_rsn(hs, wiphy, network, bss) < 0)
 		goto not_supported;
 
@@ -1267,6 +1995,37 @@ static bool station_needs_hidden_network_scan(struct station *station)
 	return !l_queue_isempty(station->hidden_bss_list_sorted);
 }
 
+/*
+ * Called for each BSS while the GET_SCAN dump is still running.  Matching
+ * a new network against the known networks may have to load and decrypt
+ * its profile, get that done for each BSS as it arrives so that only the
+ * cheap part is left once station_set_scan_results gets the whole list.
+ */
+static void station_scan_bss_seen(const struct scan_bss *bss, void *userdata)
+{
+	struct station *station = userdata;
+	enum security security;
+	char ssid[33];
+
+	if (util_ssid_is_hidden(bss->ssid_len, bss->ssid) ||
+			!util_ssid_is_utf8(bss->ssid_len, bss->ssid) ||
+			!(bss->capability & IE_BSS_CAP_ESS))
+		return;
+
+	if (station_parse_bss_security(station, (struct scan_bss *) bss,
+					&security) < 0)
+		return;
+
+	memcpy(ssid, bss->ssid, bss->ssid_len);
+	ssid[bss->ssid_len] = '\0';
+
+	if (l_hashmap_lookup(station->networks,
+				iwd_network_get_path(station, ssid, security)))
+		return;
+
+	known_networks_find(ssid, security);
+}
+
 static uint32_t station_scan_trigger(struct station *station,
 					struct scan_freq_set *freqs,
 					scan_trigger_func_t triggered,
@@ -1275,6 +2034,7 @@ static uint32_t station_scan_trigger(struct station *station,
 {
 	uint64_t id = netdev_get_wdev_id(station->netdev);
 	struct scan_parameters params;
+	uint32_t scan_id;
 
 	memset(&params, 0, sizeof(params));
 	params.flush = true;
@@ -1287,12 +2047,16 @@ static uint32_t station_scan_trigger(struct station *station,
 		if (!station->connected_bss)
 			params.randomize_mac_addr_hint = true;
 
-		return scan_active_full(id, &params, triggered, notify,
-					station, destroy);
-	}
+		scan_id = scan_active_full(id, &params, triggered, notify,
+						station, destroy);
+	} else
+		scan_id = scan_passive_full(id, &params, triggered, notify,
+						station, destroy);
+
+	if (scan_id)
+		scan_set_bss_callback(id, scan_id, station_scan_bss_seen);
 
-	return scan_passive_full(id, &params, triggered, notify,
-					station, destroy);
+	return scan_id;
 }
 
 static bool station_quick_scan_results(int err, struct l_queue *bss_list,
@@ -1375,6 +2139,178 @@ static int station_quick_scan_trigger(struct station *station)
 	return 0;
 }
 
+static bool fast_reconnect_entry_match(const void *a, const void *b)
+{
+	const struct fast_reconnect_entry *entry = a;
+
+	return entry->ifindex == L_PTR_TO_UINT(b);
+}
+
+static void fast_reconnect_entry_free(void *data)
+{
+	struct fast_reconnect_entry *entry = data;
+
+	scan_bss_free(entry->bss);
+	l_free(entry);
+}
+
+static bool station_fast_reconnect_fresh(uint64_t time)
+{
+	if (!fast_reconnect_max_age)
+		return false;
+
+	return l_time_diff(time, l_time_now()) <
+				fast_reconnect_max_age * L_USEC_PER_SEC;
+}
+
+static struct scan_bss *station_fast_reconnect_bss(struct station *station)
+{
+	const struct l_queue_entry *entry;
+
+	if (l_memeqzero(station->fast_reconnect_addr, 6))
+		return NULL;
+
+	for (entry = l_queue_get_entries(station->bss_list); entry;
+						entry = entry->next) {
+		struct scan_bss *bss = entry->data;
+
+		if (!memcmp(bss->addr, station->fast_reconnect_addr, 6))
+			return bss;
+	}
+
+	return NULL;
+}
+
+/*
+ * Remember the BSS we were connected to when the connection is lost for a
+ * reason not related to the BSS itself, e.g. the kernel disconnecting on
+ * suspend or the interface going down.  The next autoconnect then tries it
+ * straight away instead of waiting for a scan.
+ */
+static void station_fast_reconnect_save(struct station *station)
+{
+	if (!fast_reconnect_max_age || !station->connected_bss)
+		return;
+
+	memcpy(station->fast_reconnect_addr, station->connected_bss->addr, 6);
+	station->fast_reconnect_time = l_time_now();
+}
+
+/* Keep the BSS around for the station created once the interface is back */
+static void station_fast_reconnect_stash(struct station *station)
+{
+	uint32_t ifindex = netdev_get_ifindex(station->netdev);
+	struct fast_reconnect_entry *entry;
+	struct scan_bss *bss;
+
+	if (station->state == STATION_STATE_CONNECTED)
+		station_fast_reconnect_save(station);
+
+	bss = station_fast_reconnect_bss(station);
+	if (!bss)
+		return;
+
+	entry = l_queue_remove_if(fast_reconnect_cache,
+					fast_reconnect_entry_match,
+					L_UINT_TO_PTR(ifindex));
+	if (entry)
+		fast_reconnect_entry_free(entry);
+
+	entry = l_new(struct fast_reconnect_entry, 1);
+	entry->ifindex = ifindex;
+	entry->bss = bss;
+	entry->time = station->fast_reconnect_time;
+
+	l_queue_remove(station->bss_list, bss);
+	l_hashmap_remove(station->bss_index, bss);
+
+	if (station->connected_bss == bss)
+		station->connected_bss = NULL;
+
+	if (!fast_reconnect_cache)
+		fast_reconnect_cache = l_queue_new();
+
+	l_queue_push_tail(fast_reconnect_cache, entry);
+}
+
+/* Seed a freshly created station with the BSS stashed by its predecessor */
+static void station_fast_reconnect_restore(struct station *station)
+{
+	uint32_t ifindex = netdev_get_ifindex(station->netdev);
+	struct fast_reconnect_entry *entry;
+	struct scan_freq_set *freqs;
+	struct l_queue *bss_list;
+
+	entry = l_queue_remove_if(fast_reconnect_cache,
+					fast_reconnect_entry_match,
+					L_UINT_TO_PTR(ifindex));
+	if (!entry)
+		return;
+
+	if (!station_fast_reconnect_fresh(entry->time)) {
+		fast_reconnect_entry_free(entry);
+		return;
+	}
+
+	memcpy(station->fast_reconnect_addr, entry->bss->addr, 6);
+	station->fast_reconnect_time = entry->time;
+
+	bss_list = l_queue_new();
+	l_queue_push_tail(bss_list, l_steal_ptr(entry->bss));
+	l_free(entry);
+
+	freqs = scan_freq_set_new();
+	station_set_scan_results(station, bss_list, freqs, false);
+	scan_freq_set_free(freqs);
+}
+
+static void station_fast_reconnect(struct l_idle *idle, void *user_data)
+{
+	struct station *station = user_data;
+	struct scan_bss *bss = station_fast_reconnect_bss(station);
+	struct network *network = NULL;
+	enum security security;
+	char ssid[33];
+	int r;
+
+	l_idle_remove(station->fast_reconnect_idle);
+	station->fast_reconnect_idle = NULL;
+
+	/* Only a single attempt, the quick scan takes over if it fails */
+	memset(station->fast_reconnect_addr, 0, 6);
+
+	if (station->state != STATION_STATE_AUTOCONNECT_QUICK)
+		return;
+
+	if (!station_fast_reconnect_fresh(station->fast_reconnect_time) ||
+			(bss && blacklist_contains_bss(bss->addr)))
+		bss = NULL;
+
+	if (bss && !station_parse_bss_security(station, bss, &security)) {
+		memcpy(ssid, bss->ssid, bss->ssid_len);
+		ssid[bss->ssid_len] = '\0';
+		network = station_network_find(station, ssid, security);
+	}
+
+	if (network) {
+		l_debug("Fast reconnect to %s",
+				util_address_to_string(bss->addr));
+
+		r = network_autoconnect(network, bss);
+		if (!r) {
+			station_enter_state(station,
+						STATION_STATE_CONNECTING_AUTO);
+			return;
+		}
+
+		l_debug("fast reconnect: network_autoconnect: %s (%d)",
+							strerror(-r), r);
+	}
+
+	if (station_quick_scan_trigger(station) < 0)
+		station_enter_state(station, STATION_STATE_AUTOCONNECT_FULL);
+}
+
 static const char *station_state_to_string(enum station_state state)
 {
 	switch (state) {
@@ -1437,38 +2373,168 @@ static void station_set_drop_unicast_l2_multicast(struct station *station,
 				"drop_unicast_in_l2_multicast", v);
 }
 
-static void station_enter_state(struct station *station,
-						enum station_state state)
+static uint32_t station_wowlan_trigger(struct station *station,
+					enum nl80211_wowlan_triggers trigger)
 {
-	uint64_t id = netdev_get_wdev_id(station->netdev);
-	struct l_dbus *dbus = dbus_get_bus();
-	bool disconnected;
-
-	l_debug("Old State: %s, new state: %s",
-			station_state_to_string(station->state),
-			station_state_to_string(state));
+	if (!wiphy_supports_wowlan_trigger(station->wiphy, trigger))
+		return 0;
 
-	disconnected = !station_is_busy(station);
+	return 1U << trigger;
+}
 
-	if ((disconnected && state > STATION_STATE_AUTOCONNECT_FULL) ||
-			(!disconnected && state != station->state))
-		l_dbus_property_changed(dbus, netdev_get_path(station->netdev),
-					IWD_STATION_INTERFACE, "State");
+/*
+ * The triggers only take effect once the system suspends.  While
+ * connected the link is kept up with group rekeys offloaded, waking on
+ * a magic packet, on losing the connection or on a failed rekey.  While
+ * autoconnecting the firmware looks for known networks instead.
+ */
+static void station_wowlan_update(struct station *station)
+{
+	uint32_t triggers;
 
-	station->state = state;
+	if (!wowlan_enabled)
+		return;
 
-	switch (state) {
+	switch (station->state) {
+	case STATION_STATE_CONNECTED:
+		triggers = station_wowlan_trigger(station,
+					NL80211_WOWLAN_TRIG_MAGIC_PKT) |
+			station_wowlan_trigger(station,
+					NL80211_WOWLAN_TRIG_DISCONNECT) |
+			station_wowlan_trigger(station,
+					NL80211_WOWLAN_TRIG_GTK_REKEY_FAILURE);
+		break;
 	case STATION_STATE_AUTOCONNECT_QUICK:
-		if (!station_quick_scan_trigger(station))
-			break;
-
-		station->state = STATION_STATE_AUTOCONNECT_FULL;
-		/* Fall through */
 	case STATION_STATE_AUTOCONNECT_FULL:
-		scan_periodic_start(id, periodic_scan_trigger,
-					new_scan_results, station);
+		triggers = station_wowlan_trigger(station,
+					NL80211_WOWLAN_TRIG_NET_DETECT);
 		break;
-	case STATION_STATE_CONNECTING:
+	case STATION_STATE_DISCONNECTED:
+		triggers = 0;
+		break;
+	default:
+		/* Transient states keep the previous triggers */
+		return;
+	}
+
+	if (triggers == station->wowlan_triggers)
+		return;
+
+	if (netdev_set_wowlan(station->netdev, triggers) < 0)
+		return;
+
+	station->wowlan_triggers = triggers;
+}
+
+/*
+ * Power save is turned off while connecting, which includes the EAPoL
+ * and DHCP exchanges, and while roaming so that these complete sooner.
+ * Otherwise it is turned on unless the connected network's
+ * [Settings].PowerSave says otherwise.
+ */
+static void station_power_save_update(struct station *station)
+{
+	struct l_settings *settings;
+	bool enabled = true;
+
+	if (!power_save_managed)
+		return;
+
+	switch (station->state) {
+	case STATION_STATE_CONNECTING:
+	case STATION_STATE_CONNECTING_AUTO:
+	case STATION_STATE_ROAMING:
+		enabled = false;
+		break;
+	case STATION_STATE_CONNECTED:
+		settings = network_get_settings(station->connected_network);
+
+		if (settings && !l_settings_get_bool(settings, "Settings",
+							"PowerSave", &enabled))
+			enabled = true;
+
+		break;
+	case STATION_STATE_DISCONNECTING:
+		return;
+	default:
+		break;
+	}
+
+	if (station->power_save_set && station->power_save == enabled)
+		return;
+
+	if (netdev_set_power_save(station->netdev, enabled) < 0)
+		return;
+
+	station->power_save_set = true;
+	station->power_save = enabled;
+}
+
+static void station_roam_candidates_start(struct station *station);
+
+/*
+ * Keeps the scans within the wiphy's duty cycle budget while connected
+ * with a good signal.  Roam scans once the signal is low are not held
+ * back.
+ */
+static void station_radio_budget_update(struct station *station,
+					bool enforce)
+{
+	if (station->radio_budget == enforce)
+		return;
+
+	station->radio_budget = enforce;
+	wiphy_radio_work_set_budget(station->wiphy, enforce);
+}
+
+static void station_enter_state(struct station *station,
+						enum station_state state)
+{
+	uint64_t id = netdev_get_wdev_id(station->netdev);
+	struct l_dbus *dbus = dbus_get_bus();
+	bool disconnected;
+
+	l_debug("Old State: %s, new state: %s",
+			station_state_to_string(station->state),
+			station_state_to_string(state));
+
+	disconnected = !station_is_busy(station);
+
+	if ((disconnected && state > STATION_STATE_AUTOCONNECT_FULL) ||
+			(!disconnected && state != station->state))
+		l_dbus_property_changed(dbus, netdev_get_path(station->netdev),
+					IWD_STATION_INTERFACE, "State");
+
+	station->state = state;
+
+	station_radio_budget_update(station,
+					state == STATION_STATE_CONNECTED &&
+					!station->signal_low);
+
+	switch (state) {
+	case STATION_STATE_AUTOCONNECT_QUICK:
+		/*
+		 * Try the previous BSS first, once the state change is
+		 * complete.  The quick scan is started if that fails
+		 */
+		if (station_fast_reconnect_bss(station)) {
+			if (!station->fast_reconnect_idle)
+				station->fast_reconnect_idle = l_idle_create(
+							station_fast_reconnect,
+							station, NULL);
+			break;
+		}
+
+		if (!station_quick_scan_trigger(station))
+			break;
+
+		station->state = STATION_STATE_AUTOCONNECT_FULL;
+		/* Fall through */
+	case STATION_STATE_AUTOCONNECT_FULL:
+		scan_periodic_start(id, periodic_scan_trigger,
+					new_scan_results, station);
+		break;
+	case STATION_STATE_CONNECTING:
 	case STATION_STATE_CONNECTING_AUTO:
 		/* Refresh the ordered network list */
 		network_rank_update(station->connected_network, true);
@@ -1477,9 +2543,12 @@ static void station_enter_state(struct station *station,
 		l_queue_insert(station->networks_sorted,
 					station->connected_network,
 					network_rank_compare, NULL);
+		station->networks_seq++;
 
 		l_dbus_property_changed(dbus, netdev_get_path(station->netdev),
 				IWD_STATION_INTERFACE, "ConnectedNetwork");
+		l_dbus_property_changed(dbus, netdev_get_path(station->netdev),
+				IWD_STATION_INTERFACE, "DSCPMap");
 		l_dbus_property_changed(dbus,
 				network_get_path(station->connected_network),
 				IWD_NETWORK_INTERFACE, "Connected");
@@ -1492,6 +2561,7 @@ static void station_enter_state(struct station *station,
 					IWD_STATION_DIAGNOSTIC_INTERFACE,
 					station);
 		periodic_scan_stop(station);
+		station_telemetry_start(station);
 
 		station_set_evict_nocarrier(station, true);
 
@@ -1514,6 +2584,8 @@ static void station_enter_state(struct station *station,
 		if (station->connected_bss->hs20_dgaf_disable)
 			station_set_drop_unicast_l2_multicast(station, true);
 
+		memset(station->fast_reconnect_addr, 0, 6);
+		station_roam_candidates_start(station);
 		break;
 	case STATION_STATE_DISCONNECTED:
 		periodic_scan_stop(station);
@@ -1529,6 +2601,9 @@ static void station_enter_state(struct station *station,
 		break;
 	}
 
+	station_wowlan_update(station);
+	station_power_save_update(station);
+
 	WATCHLIST_NOTIFY(&station->state_watches,
 				station_state_watch_func_t, station->state);
 }
@@ -1584,25 +2659,162 @@ bool station_set_autoconnect(struct station *station, bool autoconnect)
 	return true;
 }
 
+static void station_roam_scan_slices_clear(struct station *station)
+{
+	l_timeout_remove(station->roam_slice_timeout);
+	station->roam_slice_timeout = NULL;
+
+	l_free(station->roam_slice_freqs);
+	station->roam_slice_freqs = NULL;
+	station->roam_slice_freqs_len = 0;
+	station->roam_slice_idx = 0;
+
+	l_queue_destroy(station->roam_slice_results, bss_free);
+	station->roam_slice_results = NULL;
+}
+
+static void station_roam_trace_start(struct station *station,
+					const char *trigger)
+{
+	struct diagnostic_roam *roam;
+
+	roam = diagnostic_roam_trace_add(&station->roam_trace);
+	roam->trigger = trigger;
+	memcpy(roam->from, station->connected_bss->addr, 6);
+	roam->rssi = station->connected_bss->signal_strength / 100;
+
+	station->roam_current = roam;
+}
+
+static void station_roam_trace_candidate(struct station *station,
+						struct scan_bss *bss,
+						double rank)
+{
+	if (!station->roam_current)
+		return;
+
+	diagnostic_roam_add_candidate(station->roam_current, bss->addr,
+					bss->signal_strength / 100, rank);
+}
+
+static void station_roam_trace_target(struct station *station,
+					struct scan_bss *bss,
+					const char *method)
+{
+	if (!station->roam_current)
+		return;
+
+	memcpy(station->roam_current->target, bss->addr, 6);
+	station->roam_current->have_target = true;
+	station->roam_current->method = method;
+}
+
+static void station_roam_trace_end(struct station *station,
+					const char *result)
+{
+	struct diagnostic_roam *roam = station->roam_current;
+	uint64_t ms;
+
+	if (!roam)
+		return;
+
+	ms = l_time_diff(roam->start_time, l_time_now()) / L_USEC_PER_MSEC;
+
+	roam->duration_ms = ms > UINT32_MAX ? UINT32_MAX : ms;
+	roam->result = result;
+	station->roam_current = NULL;
+}
+
 static void station_roam_state_clear(struct station *station)
 {
 	l_debug("%u", netdev_get_ifindex(station->netdev));
 
+	station_roam_trace_end(station, "aborted");
+
 	l_timeout_remove(station->roam_trigger_timeout);
 	station->roam_trigger_timeout = NULL;
 	station->preparing_roam = false;
 	station->roam_scan_full = false;
 	station->signal_low = false;
+	station->roam_predicted = false;
+	station_radio_budget_update(station,
+				station->state == STATION_STATE_CONNECTED);
+	station->btm_response_pending = false;
 	station->roam_min_time.tv_sec = 0;
 
 	if (station->roam_scan_id)
 		scan_cancel(netdev_get_wdev_id(station->netdev),
 						station->roam_scan_id);
 
+	station_roam_scan_slices_clear(station);
+
 	if (station->roam_freqs) {
 		scan_freq_set_free(station->roam_freqs);
 		station->roam_freqs = NULL;
 	}
+
+	l_idle_remove(station->ft_precompute_idle);
+	station->ft_precompute_idle = NULL;
+	station->n_ft_candidates = 0;
+
+	l_timeout_remove(station->roam_candidate_timeout);
+	station->roam_candidate_timeout = NULL;
+
+	if (station->roam_candidate_scan_id)
+		scan_cancel(netdev_get_wdev_id(station->netdev),
+					station->roam_candidate_scan_id);
+
+	l_queue_clear(station->roam_candidates, bss_free);
+	station->roam_candidate_freq_idx = 0;
+}
+
+#define STATION_HISTORY_SAMPLE_INTERVAL	60	/* Seconds */
+
+static void station_history_sample_cb(
+				const struct diagnostic_station_info *info,
+				void *user_data)
+{
+	if (!info)
+		return;
+
+	if (info->have_expected_throughput)
+		bss_history_throughput(info->addr, info->expected_throughput);
+	else if (info->have_tx_bitrate)
+		bss_history_throughput(info->addr, info->tx_bitrate * 100);
+}
+
+static void station_history_sample(struct l_timeout *timeout, void *user_data)
+{
+	struct station *station = user_data;
+
+	netdev_get_current_station(station->netdev, station_history_sample_cb,
+					NULL, NULL);
+
+	l_timeout_modify(timeout, STATION_HISTORY_SAMPLE_INTERVAL);
+}
+
+static void station_history_end(struct station *station)
+{
+	if (l_memeqzero(station->history_addr, 6))
+		return;
+
+	bss_history_session_end(station->history_addr);
+	memset(station->history_addr, 0, 6);
+
+	l_timeout_remove(station->history_timeout);
+	station->history_timeout = NULL;
+}
+
+static void station_history_start(struct station *station, bool roamed)
+{
+	station_history_end(station);
+
+	memcpy(station->history_addr, station->connected_bss->addr, 6);
+	bss_history_session_start(station->history_addr, roamed);
+
+	station->history_timeout =
+		l_timeout_create(STATION_HISTORY_SAMPLE_INTERVAL,
+					station_history_sample, station, NULL);
 }
 
 static void station_reset_connection_state(struct station *station)
@@ -1612,6 +2824,9 @@ static void station_reset_connection_state(struct station *station)
 
 	l_debug("%u", netdev_get_ifindex(station->netdev));
 
+	station->netconfig_keep = false;
+	station_history_end(station);
+
 	if (!network)
 		return;
 
@@ -1628,16 +2843,20 @@ static void station_reset_connection_state(struct station *station)
 	l_queue_remove(station->networks_sorted, station->connected_network);
 	l_queue_insert(station->networks_sorted, station->connected_network,
 				network_rank_compare, NULL);
+	station->networks_seq++;
 
 	station->connected_bss = NULL;
 	station->connected_network = NULL;
 
 	l_dbus_property_changed(dbus, netdev_get_path(station->netdev),
 				IWD_STATION_INTERFACE, "ConnectedNetwork");
+	l_dbus_property_changed(dbus, netdev_get_path(station->netdev),
+				IWD_STATION_INTERFACE, "DSCPMap");
 	l_dbus_property_changed(dbus, network_get_path(network),
 				IWD_NETWORK_INTERFACE, "Connected");
 	l_dbus_object_remove_interface(dbus, netdev_get_path(station->netdev),
 				IWD_STATION_DIAGNOSTIC_INTERFACE);
+	station_telemetry_stop(station);
 }
 
 static void station_disassociated(struct station *station)
@@ -1815,6 +3034,68 @@ static void parse_neighbor_report(struct station *station,
 	}
 }
 
+static const uint16_t *station_get_mdid(struct station *station,
+					uint16_t *out_mdid)
+{
+	struct handshake_state *hs = netdev_get_handshake(station->netdev);
+
+	if (!hs || !hs->mde)
+		return NULL;
+
+	if (ie_parse_mobility_domain_from_data(hs->mde, hs->mde[1] + 2,
+						out_mdid, NULL, NULL) < 0)
+		return NULL;
+
+	return out_mdid;
+}
+
+/* Remembers a neighbor report for the next time we connect to this ESS */
+static void station_neighbor_cache_store(struct station *station,
+					const struct scan_freq_set *freqs)
+{
+	const struct network_info *info =
+			network_get_info(station->connected_network);
+	uint16_t mdid;
+	const uint16_t *mdidp;
+
+	if (!freqs)
+		return;
+
+	mdidp = station_get_mdid(station, &mdid);
+	known_network_set_neighbor_frequencies((struct network_info *) info,
+						freqs, mdidp);
+}
+
+/*
+ * Seeds the roam frequencies with the neighbor report cached for this
+ * ESS, if recent enough, so that a roam attempt made before the report
+ * we request on connection arrives can still use a targeted scan.
+ */
+static void station_neighbor_cache_load(struct station *station)
+{
+	const struct network_info *info =
+			network_get_info(station->connected_network);
+	struct scan_freq_set *freqs;
+	uint16_t mdid;
+
+	freqs = known_network_get_neighbor_frequencies(info,
+					station_get_mdid(station, &mdid));
+	if (!freqs)
+		return;
+
+	wiphy_constrain_freq_set(station->wiphy, freqs);
+
+	if (scan_freq_set_isempty(freqs)) {
+		scan_freq_set_free(freqs);
+		return;
+	}
+
+	l_debug("Using cached neighbor report for roam frequencies");
+
+	scan_freq_set_free(station->roam_freqs);
+	station->roam_freqs = freqs;
+}
+
 static void station_early_neighbor_report_cb(struct netdev *netdev, int err,
 						const uint8_t *reports,
 						size_t reports_len,
@@ -1832,8 +3113,15 @@ static void station_early_neighbor_report_cb(struct netdev *netdev, int err,
 	if (!reports || err)
 		return;
 
+	/* A fresh report supersedes the cached one */
+	if (station->roam_freqs) {
+		scan_freq_set_free(station->roam_freqs);
+		station->roam_freqs = NULL;
+	}
+
 	parse_neighbor_report(station, reports, reports_len,
 				&station->roam_freqs);
+	station_neighbor_cache_store(station, station->roam_freqs);
 }
 
 static bool station_can_fast_transition(struct handshake_state *hs,
@@ -1867,13 +3155,39 @@ static bool station_can_fast_transition(struct handshake_state *hs,
 	return true;
 }
 
+static int station_ft_ds_action_bss(struct station *station, uint16_t mdid,
+					struct scan_bss *bss)
+{
+	struct ie_rsn_info rsn_info;
+
+	if (scan_bss_addr_eq(bss, station->connected_bss))
+		return 0;
+
+	if (!bss->mde_present || mdid != l_get_le16(bss->mde))
+		return 0;
+
+	if (scan_bss_get_rsn_info(bss, &rsn_info) < 0)
+		return 0;
+
+	if (!IE_AKM_IS_FT(rsn_info.akm_suites))
+		return 0;
+
+	/*
+	 * Fire and forget. Netdev will maintain a pool of responses
+	 * and when the time comes these can be referenced for a roam
+	 */
+	return netdev_fast_transition_over_ds_action(station->netdev, bss);
+}
+
+/*
+ * Fill the netdev FT-over-DS pool with the best ranked BSSes of the network,
+ * followed by the background roam candidates, until the pool is full.
+ */
 static void station_ft_ds_action_start(struct station *station)
 {
 	struct handshake_state *hs = netdev_get_handshake(station->netdev);
 	uint16_t mdid;
 	const struct l_queue_entry *entry;
-	struct scan_bss *bss;
-	struct ie_rsn_info rsn_info;
 
 	if (!station_can_fast_transition(hs, station->connected_bss) ||
 						!(hs->mde[4] & 1))
@@ -1884,32 +3198,78 @@ static void station_ft_ds_action_start(struct station *station)
 		return;
 
 	for (entry = network_bss_list_get_entries(station->connected_network);
-						entry; entry = entry->next) {
-		bss = entry->data;
-
-		if (bss == station->connected_bss)
-			continue;
+						entry; entry = entry->next)
+		if (station_ft_ds_action_bss(station, mdid,
+						entry->data) == -ENOSPC)
+			return;
 
-		if (mdid != l_get_le16(bss->mde))
-			continue;
+	for (entry = l_queue_get_entries(station->roam_candidates); entry;
+						entry = entry->next)
+		if (station_ft_ds_action_bss(station, mdid,
+						entry->data) == -ENOSPC)
+			return;
+}
 
-		if (scan_bss_get_rsn_info(bss, &rsn_info) < 0)
-			continue;
+static bool station_fils_ip_resp(struct handshake_state *hs,
+				struct ie_fils_ip_addr_response_info *info)
+{
+	struct ie_tlv_iter iter;
+	int r;
 
-		if (!IE_AKM_IS_FT(rsn_info.akm_suites))
-			continue;
+	if (!hs->fils_ip_req_ie || !hs->fils_ip_resp_ie)
+		return false;
 
-		/*
-		 * Fire and forget. Netdev will maintain a cache of responses
-		 * and when the time comes these can be referenced for a roam
-		 */
-		netdev_fast_transition_over_ds_action(station->netdev, bss);
+	ie_tlv_iter_init(&iter, hs->fils_ip_resp_ie,
+				hs->fils_ip_resp_ie[1] + 2);
+	if (!L_WARN_ON(unlikely(!ie_tlv_iter_next(&iter))))
+		r = ie_parse_fils_ip_addr_response(&iter, info);
+	else
+		r = -ENOMSG;
+
+	if (r != 0)
+		l_debug("Error parsing the FILS IP Address "
+			"Assignment response: %s (%i)",
+			strerror(-r), -r);
+	else if (info->response_pending && info->response_timeout)
+		l_debug("FILS IP Address Assignment response "
+			"is pending (unsupported)");
+	else if (info->response_pending)
+		l_debug("FILS IP Address Assignment failed");
+	else {
+		l_debug("FILS IP Address Assignment response OK");
+		return true;
 	}
+
+	return false;
+}
+
+/*
+ * The connection moved to another BSS of the same network.  The addresses
+ * and routes are kept, only the FILS IP Address Assignment response, if
+ * any, is applied and the gateway is put back in the ARP cache.
+ */
+static void station_netconfig_continue(struct station *station)
+{
+	struct handshake_state *hs = netdev_get_handshake(station->netdev);
+	struct ie_fils_ip_addr_response_info info;
+
+	if (!station->netconfig)
+		return;
+
+	netconfig_reconfigure(station->netconfig,
+				!supports_arp_evict_nocarrier,
+				hs && station_fils_ip_resp(hs, &info) ?
+				&info : NULL);
 }
 
 static void station_roamed(struct station *station)
 {
+	station_roam_trace_end(station, "success");
+
 	station->roam_scan_full = false;
+	station->roam_predicted = false;
+
+	station_history_start(station, true);
 
 	/*
 	 * Schedule another roaming attempt in case the signal continues to
@@ -1918,15 +3278,15 @@ static void station_roamed(struct station *station)
 	if (station->signal_low)
 		station_roam_timeout_rearm(station, roam_retry_interval);
 
-	if (station->netconfig)
-		netconfig_reconfigure(station->netconfig,
-					!supports_arp_evict_nocarrier);
+	station_netconfig_continue(station);
 
 	if (station->roam_freqs) {
 		scan_freq_set_free(station->roam_freqs);
 		station->roam_freqs = NULL;
 	}
 
+	station_neighbor_cache_load(station);
+
 	if (station->connected_bss->cap_rm_neighbor_report) {
 		if (netdev_neighbor_report_req(station->netdev,
 					station_early_neighbor_report_cb) < 0)
@@ -1938,6 +3298,26 @@ static void station_roamed(struct station *station)
 	station_enter_state(station, STATION_STATE_CONNECTED);
 }
 
+#define WNM_BTM_STATUS_ACCEPT				0
+#define WNM_BTM_STATUS_REJECT_UNSPECIFIED		1
+#define WNM_BTM_STATUS_REJECT_NO_CANDIDATES		7
+
+static void station_btm_respond(struct station *station, uint8_t status,
+					const uint8_t *target)
+{
+	if (!station->btm_response_pending)
+		return;
+
+	station->btm_response_pending = false;
+
+	l_debug("roam: BSS transition response status %u", status);
+
+	if (netdev_bss_transition_response(station->netdev,
+						station->btm_dialog_token,
+						status, target) < 0)
+		l_warn("Could not send BSS transition response");
+}
+
 static void station_roam_retry(struct station *station)
 {
 	/*
@@ -1947,8 +3327,16 @@ static void station_roam_retry(struct station *station)
 	 */
 	station->preparing_roam = false;
 	station->roam_scan_full = false;
+
+	if (station->ap_directed_roaming)
+		station_btm_respond(station,
+					WNM_BTM_STATUS_REJECT_NO_CANDIDATES,
+					NULL);
+
 	station->ap_directed_roaming = false;
 
+	station_roam_trace_end(station, "retry");
+
 	if (station->signal_low)
 		station_roam_timeout_rearm(station, roam_retry_interval);
 }
@@ -1957,11 +3345,18 @@ static void station_roam_failed(struct station *station)
 {
 	l_debug("%u", netdev_get_ifindex(station->netdev));
 
+	station_roam_trace_end(station, "failed");
+
+	station_roam_scan_slices_clear(station);
+
 	/*
 	 * If we attempted a reassociation or a fast transition, and ended up
 	 * here then we are now disconnected.
 	 */
 	if (station->state == STATION_STATE_ROAMING) {
+		bss_history_roam_failed(station->connected_bss->addr);
+		blacklist_add_bss(station->connected_bss->addr,
+					BLACKLIST_REASON_ROAM_FAILED);
 		station_disassociated(station);
 		return;
 	}
@@ -2001,6 +3396,12 @@ static void station_netconfig_event_handler(enum netconfig_event event,
 
 	switch (event) {
 	case NETCONFIG_EVENT_CONNECTED:
+		if (station->netconfig_start) {
+			diagnostic_latency_add(&station->netconfig_latency,
+					l_time_now() - station->netconfig_start);
+			station->netconfig_start = 0;
+		}
+
 		station_enter_state(station, STATION_STATE_CONNECTED);
 
 		break;
@@ -2053,6 +3454,10 @@ static void station_transition_reassociate(struct station *station,
 						struct scan_bss *bss,
 						struct handshake_state *new_hs)
 {
+	/* Keep the method if this follows preauthentication */
+	if (!station->roam_current || !station->roam_current->method)
+		station_roam_trace_target(station, bss, "reassociation");
+
 	if (netdev_reassociate(station->netdev, bss, station->connected_bss,
 				new_hs, station_netdev_event,
 				station_reassociate_cb, station) < 0) {
@@ -2066,14 +3471,6 @@ static void station_transition_reassociate(struct station *station,
 	station_enter_state(station, STATION_STATE_ROAMING);
 }
 
-static bool bss_match_bssid(const void *a, const void *b)
-{
-	const struct scan_bss *bss = a;
-	const uint8_t *bssid = b;
-
-	return !memcmp(bss->addr, bssid, sizeof(bss->addr));
-}
-
 static void station_preauthenticate_cb(struct netdev *netdev,
 					enum netdev_result result,
 					const uint8_t *pmk, void *user_data)
@@ -2088,8 +3485,7 @@ static void station_preauthenticate_cb(struct netdev *netdev,
 	if (!station->preparing_roam || result == NETDEV_RESULT_ABORTED)
 		return;
 
-	bss = l_queue_find(station->bss_list, bss_match_bssid,
-				station->preauth_bssid);
+	bss = station_bss_find_by_addr(station, station->preauth_bssid);
 	if (!bss) {
 		l_error("Roam target BSS not found");
 		station_roam_failed(station);
@@ -2151,6 +3547,9 @@ static void station_transition_start(struct station *station,
 	l_debug("%u, target %s", netdev_get_ifindex(station->netdev),
 			util_address_to_string(bss->addr));
 
+	if (station->ap_directed_roaming)
+		station_btm_respond(station, WNM_BTM_STATUS_ACCEPT, bss->addr);
+
 	/* Reset AP roam flag, at this point the roaming behaves the same */
 	station->ap_directed_roaming = false;
 
@@ -2173,6 +3572,8 @@ static void station_transition_start(struct station *station,
 		handshake_state_set_vendor_ies(hs, vendor_ies, iov_elems);
 
 		if ((hs->mde[4] & 1)) {
+			station_roam_trace_target(station, bss, "ft-over-ds");
+
 			ret = netdev_fast_transition_over_ds(station->netdev,
 					bss, station->connected_bss,
 					station_fast_transition_cb);
@@ -2189,6 +3590,8 @@ static void station_transition_start(struct station *station,
 			}
 		} else {
 try_over_air:
+			station_roam_trace_target(station, bss, "ft-over-air");
+
 			if (netdev_fast_transition(station->netdev, bss,
 					station->connected_bss,
 					station_fast_transition_cb) < 0) {
@@ -2228,6 +3631,7 @@ try_over_air:
 		 * Remain in the preparing_roam state.
 		 */
 		memcpy(station->preauth_bssid, bss->addr, ETH_ALEN);
+		station_roam_trace_target(station, bss, "preauthentication");
 
 		if (netdev_preauthenticate(station->netdev, bss,
 						station_preauthenticate_cb,
@@ -2245,6 +3649,75 @@ try_over_air:
 	station_transition_reassociate(station, bss, new_hs);
 }
 
+static void station_ft_precompute_idle(struct l_idle *idle, void *user_data)
+{
+	struct station *station = user_data;
+	struct handshake_state *hs = netdev_get_handshake(station->netdev);
+	unsigned int i;
+
+	l_idle_remove(station->ft_precompute_idle);
+	station->ft_precompute_idle = NULL;
+
+	if (!hs)
+		goto done;
+
+	/*
+	 * The R1KH-ID is only learned from the target's FTE but is the
+	 * BSSID in practice.  A wrong guess just means the PMK-R1 is
+	 * derived after the FT Authentication response as before.
+	 */
+	for (i = 0; i < station->n_ft_candidates; i++)
+		if (!handshake_state_precompute_pmk_r1(hs,
+						station->ft_candidates[i]))
+			break;
+
+done:
+	station->n_ft_candidates = 0;
+}
+
+/*
+ * Keep the addresses of the HANDSHAKE_PMK_R1_CACHE_SIZE best ranked FT
+ * capable BSSes, most preferred first
+ */
+static void station_ft_candidate_add(uint8_t addrs[][6], double *ranks,
+					unsigned int *n_addrs,
+					const uint8_t *addr, double rank)
+{
+	unsigned int i = *n_addrs;
+
+	if (i == HANDSHAKE_PMK_R1_CACHE_SIZE) {
+		if (rank <= ranks[i - 1])
+			return;
+
+		i -= 1;
+	} else
+		*n_addrs += 1;
+
+	for (; i > 0 && ranks[i - 1] < rank; i--) {
+		memcpy(addrs[i], addrs[i - 1], 6);
+		ranks[i] = ranks[i - 1];
+	}
+
+	memcpy(addrs[i], addr, 6);
+	ranks[i] = rank;
+}
+
+/* Is this BSS part of the ESS we're connected to, with the same security */
+static bool station_roam_bss_in_ess(struct station *station,
+					struct scan_bss *bss)
+{
+	struct handshake_state *hs = netdev_get_handshake(station->netdev);
+
+	return scan_bss_roam_in_ess(bss, hs->ssid, hs->ssid_len,
+			network_get_security(station->connected_network));
+}
+
+static double station_roam_bss_rank(struct handshake_state *hs,
+					struct scan_bss *bss)
+{
+	return scan_bss_roam_rank(bss, hs->mde ? hs->mde + 2 : NULL);
+}
+
 static void station_roam_scan_triggered(int err, void *user_data)
 {
 	struct station *station = user_data;
@@ -2272,35 +3745,22 @@ static bool station_roam_scan_notify(int err, struct l_queue *bss_list,
 	struct scan_bss *bss;
 	struct scan_bss *best_bss = NULL;
 	double best_bss_rank = 0.0;
-	static const double RANK_FT_FACTOR = 1.3;
-	uint16_t mdid;
-	enum security orig_security, security;
 	bool seen = false;
+	double ft_ranks[HANDSHAKE_PMK_R1_CACHE_SIZE];
 
 	if (err) {
 		station_roam_failed(station);
 		return false;
 	}
 
+	station->n_ft_candidates = 0;
+
 	/*
 	 * Do not call station_set_scan_results because this may have been
 	 * a partial scan.  We could at most update the current networks' BSS
 	 * list in its station->networks entry.
 	 */
 
-	orig_security = network_get_security(network);
-
-	if (hs->mde)
-		ie_parse_mobility_domain_from_data(hs->mde, hs->mde[1] + 2,
-							&mdid, NULL, NULL);
-
-	/*
-	 * BSSes in the bss_list come already ranked with their initial
-	 * association preference rank value.  We only need to add preference
-	 * for BSSes that are within the FT Mobility Domain so as to favor
-	 * Fast Roaming, if it is supported.
-	 */
-
 	while ((bss = l_queue_pop_head(bss_list))) {
 		double rank;
 
@@ -2310,15 +3770,7 @@ static bool station_roam_scan_notify(int err, struct l_queue *bss_list,
 			goto next;
 
 		/* Skip result if it is not part of the ESS */
-
-		if (bss->ssid_len != hs->ssid_len ||
-				memcmp(bss->ssid, hs->ssid, hs->ssid_len))
-			goto next;
-
-		if (station_parse_bss_security(station, bss, &security) < 0)
-			goto next;
-
-		if (security != orig_security)
+		if (!station_roam_bss_in_ess(station, bss))
 			goto next;
 
 		seen = true;
@@ -2329,10 +3781,14 @@ static bool station_roam_scan_notify(int err, struct l_queue *bss_list,
 		if (blacklist_contains_bss(bss->addr))
 			goto next;
 
-		rank = bss->rank;
+		rank = station_roam_bss_rank(hs, bss);
+		station_roam_trace_candidate(station, bss, rank);
 
-		if (hs->mde && bss->mde_present && l_get_le16(bss->mde) == mdid)
-			rank *= RANK_FT_FACTOR;
+		if (station_can_fast_transition(hs, bss))
+			station_ft_candidate_add(station->ft_candidates,
+						ft_ranks,
+						&station->n_ft_candidates,
+						bss->addr, rank);
 
 		if (rank > best_bss_rank) {
 			if (best_bss)
@@ -2356,6 +3812,7 @@ next:
 	/* See if we have anywhere to roam to */
 	if (!best_bss || scan_bss_addr_eq(best_bss, station->connected_bss)) {
 		station_debug_event(station, "no-roam-candidates");
+		station_roam_trace_end(station, "no-candidates");
 		goto fail_free_bss;
 	}
 
@@ -2365,117 +3822,489 @@ next:
 		best_bss = bss;
 	} else {
 		network_bss_add(network, best_bss);
-		l_queue_push_tail(station->bss_list, best_bss);
+		station_bss_list_add(station, best_bss);
 	}
 
 	station_transition_start(station, best_bss);
 
-	return true;
+	/*
+	 * Derive the PMK-R1s for the best FT candidates, starting with the
+	 * one being roamed to, once the FT Authentication request is out
+	 */
+	if (station->n_ft_candidates && !station->ft_precompute_idle &&
+			station->state == STATION_STATE_ROAMING)
+		station->ft_precompute_idle = l_idle_create(
+						station_ft_precompute_idle,
+						station, NULL);
+
+	return true;
+
+fail_free_bss:
+	if (best_bss)
+		scan_bss_free(best_bss);
+
+	station_roam_failed(station);
+
+	return true;
+}
+
+static void station_roam_scan_destroy(void *userdata)
+{
+	struct station *station = userdata;
+
+	station->roam_scan_id = 0;
+}
+
+static int station_roam_scan_start(struct station *station,
+					struct scan_freq_set *freq_set,
+					scan_notify_func_t notify)
+{
+	struct scan_parameters params = { .freqs = freq_set, .flush = true };
+
+	if (station->connected_network) {
+		const char *ssid = network_get_ssid(station->connected_network);
+		/* Use direct probe request */
+		params.ssid = (const uint8_t *)ssid;
+		params.ssid_len = strlen(ssid);
+	}
+
+	station->roam_scan_id =
+		scan_active_full(netdev_get_wdev_id(station->netdev), &params,
+					station_roam_scan_triggered,
+					notify, station,
+					station_roam_scan_destroy);
+
+	if (!station->roam_scan_id)
+		return -EIO;
+
+	return 0;
+}
+
+static bool station_roam_scan_slice_notify(int err, struct l_queue *bss_list,
+					const struct scan_freq_set *freqs,
+					void *userdata);
+
+static int station_roam_scan_next_slice(struct station *station)
+{
+	struct scan_freq_set *freqs = scan_freq_set_new();
+	unsigned int i;
+	int r;
+
+	for (i = 0; i < roam_scan_slice_size &&
+			station->roam_slice_idx < station->roam_slice_freqs_len;
+			i++)
+		scan_freq_set_add(freqs,
+			station->roam_slice_freqs[station->roam_slice_idx++]);
+
+	r = station_roam_scan_start(station, freqs,
+					station_roam_scan_slice_notify);
+	scan_freq_set_free(freqs);
+
+	return r;
+}
+
+static void station_roam_slice_timeout(struct l_timeout *timeout,
+					void *user_data)
+{
+	struct station *station = user_data;
+
+	l_timeout_remove(station->roam_slice_timeout);
+	station->roam_slice_timeout = NULL;
+
+	if (station_roam_scan_next_slice(station) < 0)
+		station_roam_failed(station);
+}
+
+static bool station_roam_scan_slice_notify(int err, struct l_queue *bss_list,
+					const struct scan_freq_set *freqs,
+					void *userdata)
+{
+	struct station *station = userdata;
+	struct l_queue *results;
+	struct scan_bss *bss;
+
+	if (err) {
+		station_roam_failed(station);
+		return false;
+	}
+
+	while ((bss = l_queue_pop_head(bss_list)))
+		l_queue_push_tail(station->roam_slice_results, bss);
+
+	l_queue_destroy(bss_list, NULL);
+
+	/* Give the traffic on the operating channel a chance in between */
+	if (station->roam_slice_idx < station->roam_slice_freqs_len) {
+		station->roam_slice_timeout =
+			l_timeout_create_ms(roam_scan_slice_gap,
+						station_roam_slice_timeout,
+						station, NULL);
+		return true;
+	}
+
+	results = l_steal_ptr(station->roam_slice_results);
+	station_roam_scan_slices_clear(station);
+
+	return station_roam_scan_notify(0, results, NULL, station);
+}
+
+/*
+ * With [Scan].RoamScanChannelsPerSlice set, a roam scan of a known set of
+ * frequencies is split into scans of that many channels, separated by
+ * [Scan].RoamScanSliceInterval milliseconds on the operating channel, and
+ * the roam decision is made once all the slices are done.
+ */
+static int station_roam_scan(struct station *station,
+				struct scan_freq_set *freq_set)
+{
+	l_debug("ifindex: %u", netdev_get_ifindex(station->netdev));
+
+	if (!freq_set)
+		station->roam_scan_full = true;
+
+	if (!freq_set || !roam_scan_slice_size ||
+			scan_freq_set_count(freq_set) <= roam_scan_slice_size)
+		return station_roam_scan_start(station, freq_set,
+						station_roam_scan_notify);
+
+	station_roam_scan_slices_clear(station);
+
+	station->roam_slice_freqs = scan_freq_set_to_fixed_array(freq_set,
+					&station->roam_slice_freqs_len);
+	station->roam_slice_results = l_queue_new();
+
+	return station_roam_scan_next_slice(station);
+}
+
+static int station_roam_scan_known_freqs(struct station *station)
+{
+	const struct network_info *info = network_get_info(
+						station->connected_network);
+	struct scan_freq_set *freqs = network_info_get_roam_frequencies(info,
+					station->connected_bss->frequency, 5);
+	int r;
+
+	if (!freqs)
+		return -ENODATA;
+
+	r = station_roam_scan(station, freqs);
+	scan_freq_set_free(freqs);
+	return r;
+}
+
+static void station_neighbor_report_cb(struct netdev *netdev, int err,
+					const uint8_t *reports,
+					size_t reports_len, void *user_data)
+{
+	struct station *station = user_data;
+	struct scan_freq_set *freq_set;
+	int r;
+
+	if (err == -ENODEV)
+		return;
+
+	l_debug("ifindex: %u, error: %d(%s)",
+			netdev_get_ifindex(station->netdev),
+			err, err < 0 ? strerror(-err) : "");
+
+	/*
+	 * Check if we're still attempting to roam -- if dbus Disconnect
+	 * had been called in the meantime we just abort the attempt.
+	 */
+	if (!station->preparing_roam || err == -ENODEV)
+		return;
+
+	if (!reports || err) {
+		r = station_roam_scan_known_freqs(station);
+
+		if (r == -ENODATA)
+			l_debug("no neighbor report results or known freqs");
+
+		if (r < 0)
+			station_roam_failed(station);
+
+		return;
+	}
+
+	parse_neighbor_report(station, reports, reports_len, &freq_set);
+	station_neighbor_cache_store(station, freq_set);
+
+	r = station_roam_scan(station, freq_set);
+
+	if (freq_set)
+		scan_freq_set_free(freq_set);
+
+	if (r < 0)
+		station_roam_failed(station);
+}
+
+static bool roam_candidate_expired(void *data, void *user_data)
+{
+	struct scan_bss *bss = data;
+	const uint64_t *now = user_data;
+
+	if (l_time_offset(bss->time_stamp, *now) < ROAM_CANDIDATE_MAX_AGE)
+		return false;
+
+	scan_bss_free(bss);
+	return true;
+}
+
+static void station_roam_candidates_prune(struct station *station)
+{
+	uint64_t now = l_time_now();
+
+	l_queue_foreach_remove(station->roam_candidates,
+				roam_candidate_expired, &now);
+}
+
+/*
+ * Feed scan results obtained while connected, e.g. from the background
+ * scans or from Beacon Report measurements, into the roam candidate table.
+ * Takes ownership of the BSSes in bss_list.
+ */
+void station_roam_candidates_update(struct station *station,
+					struct l_queue *bss_list)
+{
+	struct scan_bss *bss;
+	struct scan_bss *old;
+
+	while ((bss = l_queue_pop_head(bss_list))) {
+		if (!station->connected_bss ||
+				scan_bss_addr_eq(bss, station->connected_bss) ||
+				!station_roam_bss_in_ess(station, bss))
+			goto drop;
+
+		old = l_queue_find(station->roam_candidates, bss_match_bssid,
+					bss->addr);
+		if (old) {
+			/* Result from the kernel's cache older than ours */
+			if (old->time_stamp > bss->time_stamp)
+				goto drop;
+
+			l_queue_remove(station->roam_candidates, old);
+			scan_bss_free(old);
+		}
+
+		l_queue_push_tail(station->roam_candidates, bss);
+		continue;
+
+drop:
+		scan_bss_free(bss);
+	}
+
+	l_queue_destroy(bss_list, NULL);
+
+	station_roam_candidates_prune(station);
+}
+
+/* Derive the PMK-R1s for the best FT capable candidates ahead of a roam */
+static void station_roam_candidates_precompute(struct station *station)
+{
+	struct handshake_state *hs = netdev_get_handshake(station->netdev);
+	const struct l_queue_entry *entry;
+	double ft_ranks[HANDSHAKE_PMK_R1_CACHE_SIZE];
+
+	if (!hs->mde || station->ft_precompute_idle)
+		return;
+
+	station->n_ft_candidates = 0;
+
+	for (entry = l_queue_get_entries(station->roam_candidates); entry;
+						entry = entry->next) {
+		struct scan_bss *bss = entry->data;
+
+		if (!station_can_fast_transition(hs, bss) ||
+				blacklist_contains_bss(bss->addr))
+			continue;
+
+		station_ft_candidate_add(station->ft_candidates, ft_ranks,
+					&station->n_ft_candidates, bss->addr,
+					station_roam_bss_rank(hs, bss));
+	}
+
+	if (station->n_ft_candidates)
+		station->ft_precompute_idle = l_idle_create(
+						station_ft_precompute_idle,
+						station, NULL);
+}
+
+static bool station_roam_candidate_scan_notify(int err,
+					struct l_queue *bss_list,
+					const struct scan_freq_set *freqs,
+					void *userdata)
+{
+	struct station *station = userdata;
+
+	if (err)
+		return false;
+
+	l_debug("%u, %u results", netdev_get_ifindex(station->netdev),
+			l_queue_length(bss_list));
+
+	station_roam_candidates_update(station, bss_list);
+
+	if (station->roam_predicted)
+		station_roam_candidates_precompute(station);
+
+	if (station->state == STATION_STATE_CONNECTED)
+		station_ft_ds_action_start(station);
+
+	return true;
+}
+
+static void station_roam_candidate_scan_destroy(void *userdata)
+{
+	struct station *station = userdata;
+
+	station->roam_candidate_scan_id = 0;
+}
+
+/*
+ * Scan a single channel out of the neighbor report frequencies, or the
+ * frequencies the network is known to use, per interval so as to keep the
+ * time spent off-channel short.
+ */
+static void station_roam_candidate_scan(struct station *station)
+{
+	const char *ssid = network_get_ssid(station->connected_network);
+	struct scan_parameters params = {
+		.ssid = (const uint8_t *) ssid,
+		.ssid_len = strlen(ssid),
+	};
+	struct scan_freq_set *known = NULL;
+	const struct scan_freq_set *set = station->roam_freqs;
+	uint32_t *freqs;
+	size_t num_freqs;
+	unsigned int idx;
+
+	if (!set) {
+		known = network_info_get_roam_frequencies(
+				network_get_info(station->connected_network),
+				station->connected_bss->frequency, 5);
+		if (!known)
+			return;
+
+		set = known;
+	}
+
+	freqs = scan_freq_set_to_fixed_array(set, &num_freqs);
+
+	if (known)
+		scan_freq_set_free(known);
+
+	if (!freqs)
+		return;
+
+	idx = station->roam_candidate_freq_idx++ % num_freqs;
 
-fail_free_bss:
-	if (best_bss)
-		scan_bss_free(best_bss);
+	params.freqs = scan_freq_set_new();
+	scan_freq_set_add(params.freqs, freqs[idx]);
+	l_free(freqs);
 
-	station_roam_failed(station);
+	station->roam_candidate_scan_id =
+		scan_active_full(netdev_get_wdev_id(station->netdev), &params,
+				NULL, station_roam_candidate_scan_notify,
+				station, station_roam_candidate_scan_destroy);
 
-	return true;
+	scan_freq_set_free(params.freqs);
 }
 
-static void station_roam_scan_destroy(void *userdata)
+static void station_roam_candidate_timeout(struct l_timeout *timeout,
+						void *user_data)
 {
-	struct station *station = userdata;
-
-	station->roam_scan_id = 0;
-}
+	struct station *station = user_data;
 
-static int station_roam_scan(struct station *station,
-				struct scan_freq_set *freq_set)
-{
-	struct scan_parameters params = { .freqs = freq_set, .flush = true };
+	l_timeout_modify(timeout, roam_candidate_scan_interval);
 
-	l_debug("ifindex: %u", netdev_get_ifindex(station->netdev));
+	/* Only while idle, a low signal means a roam is being handled */
+	if (station->state != STATION_STATE_CONNECTED ||
+			station->preparing_roam || station->signal_low ||
+			station->roam_candidate_scan_id)
+		return;
 
-	if (station->connected_network) {
-		const char *ssid = network_get_ssid(station->connected_network);
-		/* Use direct probe request */
-		params.ssid = (const uint8_t *)ssid;
-		params.ssid_len = strlen(ssid);
-	}
+	station_roam_candidate_scan(station);
+}
 
-	if (!freq_set)
-		station->roam_scan_full = true;
+static bool station_cannot_roam(struct station *station);
 
-	station->roam_scan_id =
-		scan_active_full(netdev_get_wdev_id(station->netdev), &params,
-					station_roam_scan_triggered,
-					station_roam_scan_notify, station,
-					station_roam_scan_destroy);
+static void station_roam_candidates_start(struct station *station)
+{
+	if (!roam_candidate_scan_interval || station->roam_candidate_timeout)
+		return;
 
-	if (!station->roam_scan_id)
-		return -EIO;
+	if (station_cannot_roam(station))
+		return;
 
-	return 0;
+	station->roam_candidate_timeout =
+		l_timeout_create(roam_candidate_scan_interval,
+					station_roam_candidate_timeout,
+					station, NULL);
 }
 
-static int station_roam_scan_known_freqs(struct station *station)
+/*
+ * Pick the best recently seen candidate that is preferred over the current
+ * BSS and start the transition right away, without a roam scan.
+ */
+static bool station_roam_from_candidates(struct station *station)
 {
-	const struct network_info *info = network_get_info(
-						station->connected_network);
-	struct scan_freq_set *freqs = network_info_get_roam_frequencies(info,
-					station->connected_bss->frequency, 5);
-	int r;
+	struct network *network = station->connected_network;
+	struct handshake_state *hs = netdev_get_handshake(station->netdev);
+	const struct l_queue_entry *entry;
+	struct scan_bss *best_bss = NULL;
+	struct scan_bss *bss;
+	double best_bss_rank;
 
-	if (!freqs)
-		return -ENODATA;
+	station_roam_candidates_prune(station);
 
-	r = station_roam_scan(station, freqs);
-	scan_freq_set_free(freqs);
-	return r;
-}
+	if (l_queue_isempty(station->roam_candidates))
+		return false;
 
-static void station_neighbor_report_cb(struct netdev *netdev, int err,
-					const uint8_t *reports,
-					size_t reports_len, void *user_data)
-{
-	struct station *station = user_data;
-	struct scan_freq_set *freq_set;
-	int r;
+	best_bss_rank = station_roam_bss_rank(hs, station->connected_bss);
 
-	if (err == -ENODEV)
-		return;
+	for (entry = l_queue_get_entries(station->roam_candidates); entry;
+						entry = entry->next) {
+		double rank;
 
-	l_debug("ifindex: %u, error: %d(%s)",
-			netdev_get_ifindex(station->netdev),
-			err, err < 0 ? strerror(-err) : "");
+		bss = entry->data;
 
-	/*
-	 * Check if we're still attempting to roam -- if dbus Disconnect
-	 * had been called in the meantime we just abort the attempt.
-	 */
-	if (!station->preparing_roam || err == -ENODEV)
-		return;
+		if (network_can_connect_bss(network, bss) < 0)
+			continue;
 
-	if (!reports || err) {
-		r = station_roam_scan_known_freqs(station);
+		if (blacklist_contains_bss(bss->addr))
+			continue;
 
-		if (r == -ENODATA)
-			l_debug("no neighbor report results or known freqs");
+		rank = station_roam_bss_rank(hs, bss);
+		station_roam_trace_candidate(station, bss, rank);
 
-		if (r < 0)
-			station_roam_failed(station);
+		if (rank <= best_bss_rank)
+			continue;
 
-		return;
+		best_bss = bss;
+		best_bss_rank = rank;
 	}
 
-	parse_neighbor_report(station, reports, reports_len, &freq_set);
+	if (!best_bss)
+		return false;
 
-	r = station_roam_scan(station, freq_set);
+	l_debug("Roaming to cached candidate %s",
+				util_address_to_string(best_bss->addr));
+	station_debug_event(station, "roam-candidate-cached");
 
-	if (freq_set)
-		scan_freq_set_free(freq_set);
+	l_queue_remove(station->roam_candidates, best_bss);
 
-	if (r < 0)
-		station_roam_failed(station);
+	bss = network_bss_find_by_addr(network, best_bss->addr);
+	if (bss) {
+		scan_bss_free(best_bss);
+		best_bss = bss;
+	} else {
+		network_bss_add(network, best_bss);
+		station_bss_list_add(station, best_bss);
+	}
+
+	station_transition_start(station, best_bss);
+
+	return true;
 }
 
 static void station_roam_trigger_cb(struct l_timeout *timeout, void *user_data)
@@ -2489,6 +4318,12 @@ static void station_roam_trigger_cb(struct l_timeout *timeout, void *user_data)
 	station->roam_trigger_timeout = NULL;
 	station->preparing_roam = true;
 
+	station_roam_trace_start(station, station->roam_predicted ?
+						"predicted" : "low-signal");
+
+	if (station_roam_from_candidates(station))
+		return;
+
 	/*
 	 * If current BSS supports Neighbor Reports, narrow the scan down
 	 * to channels occupied by known neighbors in the ESS. If no neighbor
@@ -2567,6 +4402,74 @@ static bool station_cannot_roam(struct station *station)
 #define WNM_REQUEST_MODE_TERMINATION_IMMINENT		(1 << 3)
 #define WNM_REQUEST_MODE_ESS_DISASSOCIATION_IMMINENT	(1 << 4)
 
+/* How recently a candidate must have been seen to skip the roam scan */
+#define STATION_BTM_CANDIDATE_MAX_AGE	(10 * L_USEC_PER_SEC)
+
+/*
+ * Picks the candidate the AP prefers most among those we saw recently
+ * enough to trust, breaking ties with our own roam ranking.  Candidates
+ * with a preference of 0 are excluded by the AP, 802.11-2020 9.4.2.36.
+ */
+static struct scan_bss *station_btm_candidate_select(struct station *station,
+						const uint8_t *list,
+						size_t list_len)
+{
+	struct handshake_state *hs = netdev_get_handshake(station->netdev);
+	struct network *network = station->connected_network;
+	uint64_t now = l_time_now();
+	struct ie_tlv_iter iter;
+	struct scan_bss *best = NULL;
+	unsigned int best_pref = 0;
+	double best_rank = 0.0;
+
+	ie_tlv_iter_init(&iter, list, list_len);
+
+	while (ie_tlv_iter_next(&iter)) {
+		struct ie_neighbor_report_info info;
+		struct scan_bss *bss;
+		unsigned int pref;
+		double rank;
+
+		if (ie_tlv_iter_get_tag(&iter) != IE_TYPE_NEIGHBOR_REPORT)
+			continue;
+
+		if (ie_parse_neighbor_report(&iter, &info) < 0)
+			continue;
+
+		pref = info.bss_transition_pref_present ?
+						info.bss_transition_pref : 1;
+		if (!pref)
+			continue;
+
+		if (!memcmp(info.addr, station->connected_bss->addr, 6))
+			continue;
+
+		bss = network_bss_find_by_addr(network, info.addr);
+		if (!bss)
+			continue;
+
+		if (l_time_after(now, bss->time_stamp +
+					STATION_BTM_CANDIDATE_MAX_AGE))
+			continue;
+
+		if (network_can_connect_bss(network, bss) < 0 ||
+				blacklist_contains_bss(bss->addr))
+			continue;
+
+		rank = station_roam_bss_rank(hs, bss);
+
+		if (pref < best_pref ||
+				(pref == best_pref && rank <= best_rank))
+			continue;
+
+		best = bss;
+		best_pref = pref;
+		best_rank = rank;
+	}
+
+	return best;
+}
+
 static void station_ap_directed_roam(struct station *station,
 					const struct mmpdu_header *hdr,
 					const void *body, size_t body_len)
@@ -2575,23 +4478,28 @@ static void station_ap_directed_roam(struct station *station,
 	uint8_t req_mode;
 	uint16_t dtimer;
 	uint8_t valid_interval;
+	struct scan_bss *target;
 
 	l_debug("ifindex: %u", netdev_get_ifindex(station->netdev));
 
-	if (station_cannot_roam(station))
-		return;
-
 	if (body_len < 7)
 		goto format_error;
 
 	/*
 	 * First two bytes are checked by the frame watch (WNM category and
-	 * WNM action). The third is the dialog token which is not relevant
-	 * because we did not send a BSS transition query -- so skip these
-	 * first three bytes.
+	 * WNM action). The third is the dialog token, echoed back in our
+	 * BSS transition response.
 	 */
+	station->btm_dialog_token = l_get_u8(body + 2);
+	station->btm_response_pending = true;
 	pos += 3;
 
+	if (station_cannot_roam(station)) {
+		station_btm_respond(station, WNM_BTM_STATUS_REJECT_UNSPECIFIED,
+					NULL);
+		return;
+	}
+
 	req_mode = l_get_u8(body + pos);
 	pos++;
 
@@ -2633,12 +4541,24 @@ static void station_ap_directed_roam(struct station *station,
 
 	station->ap_directed_roaming = true;
 	station->preparing_roam = true;
+	station_roam_trace_start(station, "ap-directed");
 
 	l_timeout_remove(station->roam_trigger_timeout);
 	station->roam_trigger_timeout = NULL;
 
 	if (req_mode & WNM_REQUEST_MODE_PREFERRED_CANDIDATE_LIST) {
 		l_debug("roam: AP sent a preferred candidate list");
+
+		/* A recently seen candidate needs no roam scan */
+		target = station_btm_candidate_select(station, body + pos,
+							body_len - pos);
+		if (target) {
+			l_debug("roam: using cached candidate %s",
+					util_address_to_string(target->addr));
+			station_transition_start(station, target);
+			return;
+		}
+
 		station_neighbor_report_cb(station->netdev, 0, body + pos,
 				body_len - pos, station);
 	} else {
@@ -2651,6 +4571,7 @@ static void station_ap_directed_roam(struct station *station,
 
 format_error:
 	l_debug("bad AP roam frame formatting");
+	station_btm_respond(station, WNM_BTM_STATUS_REJECT_UNSPECIFIED, NULL);
 }
 
 static void station_low_rssi(struct station *station)
@@ -2659,6 +4580,7 @@ static void station_low_rssi(struct station *station)
 		return;
 
 	station->signal_low = true;
+	station_radio_budget_update(station, false);
 
 	if (station_cannot_roam(station))
 		return;
@@ -2667,6 +4589,29 @@ static void station_low_rssi(struct station *station)
 	station_roam_timeout_rearm(station, 5);
 }
 
+/*
+ * The signal is predicted to cross the roam threshold soon.  Get ready so
+ * that the roam itself is quick: refresh the roam candidates and derive the
+ * PMK-R1s for the FT capable ones ahead of time.
+ */
+static void station_rssi_trend_low(struct station *station)
+{
+	if (station->state != STATION_STATE_CONNECTED || station->signal_low)
+		return;
+
+	if (station_cannot_roam(station))
+		return;
+
+	l_debug("%u", netdev_get_ifindex(station->netdev));
+	station_debug_event(station, "rssi-trend-low");
+
+	station->roam_predicted = true;
+	station_roam_candidates_precompute(station);
+
+	if (!station->roam_candidate_scan_id)
+		station_roam_candidate_scan(station);
+}
+
 static void station_ok_rssi(struct station *station)
 {
 	l_timeout_remove(station->roam_trigger_timeout);
@@ -2674,6 +4619,8 @@ static void station_ok_rssi(struct station *station)
 
 	station->signal_low = false;
 	station->roam_min_time.tv_sec = 0;
+	station_radio_budget_update(station,
+				station->state == STATION_STATE_CONNECTED);
 }
 
 static void station_event_roamed(struct station *station, struct scan_bss *new)
@@ -2683,14 +4630,20 @@ static void station_event_roamed(struct station *station, struct scan_bss *new)
 	network_bss_update(station->connected_network, new);
 
 	/* Remove new BSS if it exists in past scan results */
-	stale = l_queue_remove_if(station->bss_list, bss_match_bssid,
-					new->addr);
+	stale = station_bss_list_remove(station, new->addr);
 	if (stale)
 		scan_bss_free(stale);
 
+	/* Roams done by the firmware are only seen once complete */
+	if (!station->roam_current)
+		station_roam_trace_start(station, "firmware");
+
+	station_roam_trace_target(station, new, "firmware");
+
 	station->connected_bss = new;
 
 	l_queue_insert(station->bss_list, new, scan_bss_rank_compare, NULL);
+	l_hashmap_replace(station->bss_index, new, new, NULL);
 
 	station_roamed(station);
 }
@@ -2700,6 +4653,15 @@ static void station_event_channel_switched(struct station *station,
 {
 	struct network *network = station->connected_network;
 
+	/*
+	 * The switch is followed in place.  The BSS keeps its position in the
+	 * BSS lists and the known frequencies of the network pick up the new
+	 * channel, the connection and netconfig are left alone.
+	 */
+	if (!station->connected_bss ||
+			station->connected_bss->frequency == freq)
+		return;
+
 	station->connected_bss->frequency = freq;
 
 	network_bss_update(network, station->connected_bss);
@@ -2742,7 +4704,9 @@ static bool station_retry_with_reason(struct station *station,
 			reason_code == MMPDU_REASON_CODE_IEEE8021X_FAILED)
 		return false;
 
-	blacklist_add_bss(station->connected_bss->addr);
+	blacklist_add_bss(station->connected_bss->addr,
+				BLACKLIST_REASON_CONNECT_FAILED);
+	bss_history_connect_failed(station->connected_bss->addr);
 
 	return station_try_next_bss(station);
 }
@@ -2771,17 +4735,57 @@ static bool station_retry_with_status(struct station *station,
 		network_blacklist_add(station->connected_network,
 						station->connected_bss);
 	else
-		blacklist_add_bss(station->connected_bss->addr);
+		blacklist_add_bss(station->connected_bss->addr,
+					BLACKLIST_REASON_CONNECT_FAILED);
+
+	bss_history_connect_failed(station->connected_bss->addr);
 
 	return station_try_next_bss(station);
 }
 
+/*
+ * Records how long each phase of the connection that just completed took:
+ * the last scan preceding it, authentication when driven by iwd (SAE, FT,
+ * FILS, OWE), association and the handshake.  Netconfig is recorded once
+ * it reports the connection as ready.
+ */
+static void station_connect_latency_update(struct station *station)
+{
+	const struct netdev_connect_times *times =
+				netdev_get_connect_times(station->netdev);
+	uint64_t assoc_start = times->start;
+
+	if (station->last_scan_duration) {
+		diagnostic_latency_add(&station->scan_latency,
+					station->last_scan_duration);
+		station->last_scan_duration = 0;
+	}
+
+	if (times->authenticated) {
+		diagnostic_latency_add(&station->auth_latency,
+					times->authenticated - times->start);
+		assoc_start = times->authenticated;
+	}
+
+	if (times->associated) {
+		diagnostic_latency_add(&station->assoc_latency,
+					times->associated - assoc_start);
+		diagnostic_latency_add(&station->handshake_latency,
+					times->completed - times->associated);
+	}
+
+	station->netconfig_start = times->completed;
+}
+
 static void station_connect_ok(struct station *station)
 {
 	struct handshake_state *hs = netdev_get_handshake(station->netdev);
 
 	l_debug("");
 
+	station_connect_latency_update(station);
+	station_history_start(station, false);
+
 	if (station->connect_pending) {
 		struct l_dbus_message *reply =
 			l_dbus_message_new_method_return(
@@ -2803,38 +4807,20 @@ static void station_connect_ok(struct station *station)
 
 	network_connected(station->connected_network);
 
-	if (station->netconfig) {
-		if (hs->fils_ip_req_ie && hs->fils_ip_resp_ie) {
-			struct ie_fils_ip_addr_response_info info;
-			struct ie_tlv_iter iter;
-			int r;
-
-			ie_tlv_iter_init(&iter, hs->fils_ip_resp_ie,
-						hs->fils_ip_resp_ie[1] + 2);
-			if (!L_WARN_ON(unlikely(!ie_tlv_iter_next(&iter))))
-				r = ie_parse_fils_ip_addr_response(&iter,
-									&info);
-			else
-				r = -ENOMSG;
-
-			if (r != 0)
-				l_debug("Error parsing the FILS IP Address "
-					"Assignment response: %s (%i)",
-					strerror(-r), -r);
-			else if (info.response_pending &&
-					info.response_timeout)
-				l_debug("FILS IP Address Assignment response "
-					"is pending (unsupported)");
-			else if (info.response_pending)
-				l_debug("FILS IP Address Assignment failed");
-			else {
-				l_debug("FILS IP Address Assignment response "
-					"OK");
-				netconfig_handle_fils_ip_resp(
-							station->netconfig,
+	/* network_connected may have created the network_info */
+	station_neighbor_cache_load(station);
+
+	if (station->netconfig_keep) {
+		/* Reconnected to the same network, keep the IP configuration */
+		station->netconfig_keep = false;
+		station_netconfig_continue(station);
+		station_enter_state(station, STATION_STATE_CONNECTED);
+	} else if (station->netconfig) {
+		struct ie_fils_ip_addr_response_info info;
+
+		if (station_fils_ip_resp(hs, &info))
+			netconfig_handle_fils_ip_resp(station->netconfig,
 							&info);
-			}
-		}
 
 		if (L_WARN_ON(!netconfig_configure(station->netconfig,
 						station_netconfig_event_handler,
@@ -2913,7 +4899,9 @@ static void station_connect_cb(struct netdev *netdev, enum netdev_result result,
 		station_enter_state(station, STATION_STATE_AUTOCONNECT_QUICK);
 }
 
-static void station_disconnect_event(struct station *station, void *event_data)
+static void station_disconnect_event(struct station *station,
+					enum netdev_event event,
+					void *event_data)
 {
 	l_debug("%u", netdev_get_ifindex(station->netdev));
 
@@ -2930,6 +4918,12 @@ static void station_disconnect_event(struct station *station, void *event_data)
 					event_data, station);
 		return;
 	case STATION_STATE_CONNECTED:
+		if (event == NETDEV_EVENT_DISCONNECT_BY_AP)
+			blacklist_add_bss(station->connected_bss->addr,
+					BLACKLIST_REASON_AP_DISCONNECT);
+		else
+			station_fast_reconnect_save(station);
+
 		station_disassociated(station);
 		return;
 	default:
@@ -2953,7 +4947,7 @@ static void station_netdev_event(struct netdev *netdev, enum netdev_event event,
 		break;
 	case NETDEV_EVENT_DISCONNECT_BY_AP:
 	case NETDEV_EVENT_DISCONNECT_BY_SME:
-		station_disconnect_event(station, event_data);
+		station_disconnect_event(station, event, event_data);
 		break;
 	case NETDEV_EVENT_RSSI_THRESHOLD_LOW:
 		station_low_rssi(station);
@@ -2964,6 +4958,9 @@ static void station_netdev_event(struct netdev *netdev, enum netdev_event event,
 	case NETDEV_EVENT_RSSI_LEVEL_NOTIFY:
 		station_rssi_level_changed(station, l_get_u8(event_data));
 		break;
+	case NETDEV_EVENT_RSSI_TREND_LOW:
+		station_rssi_trend_low(station);
+		break;
 	case NETDEV_EVENT_ROAMING:
 		station_enter_state(station, STATION_STATE_ROAMING);
 		break;
@@ -2973,19 +4970,39 @@ static void station_netdev_event(struct netdev *netdev, enum netdev_event event,
 	case NETDEV_EVENT_CHANNEL_SWITCHED:
 		station_event_channel_switched(station, l_get_u32(event_data));
 		break;
+	case NETDEV_EVENT_QOS_MAP_CHANGED:
+		l_dbus_property_changed(dbus_get_bus(),
+					netdev_get_path(station->netdev),
+					IWD_STATION_INTERFACE, "DSCPMap");
+		break;
 	}
 }
 
+/* Only known networks get their DHCP leases cached */
+static const char *station_network_lease_id(struct network *network)
+{
+	const struct network_info *info = network_get_info(network);
+
+	if (!info)
+		return NULL;
+
+	return strrchr(network_info_get_path(info), '/') + 1;
+}
+
 int __station_connect_network(struct station *station, struct network *network,
 				struct scan_bss *bss)
 {
 	struct handshake_state *hs;
 	int r;
 
-	if (station->netconfig && !netconfig_load_settings(
-					station->netconfig,
-					network_get_settings(network)))
-		return -EINVAL;
+	if (station->netconfig && !station->netconfig_keep) {
+		if (!netconfig_load_settings(station->netconfig,
+						network_get_settings(network)))
+			return -EINVAL;
+
+		netconfig_set_lease_id(station->netconfig,
+					station_network_lease_id(network));
+	}
 
 	hs = station_handshake_setup(station, network, bss);
 	if (!hs)
@@ -3167,7 +5184,7 @@ static bool station_hidden_network_scan_results(int err,
 		bss->time_stamp = 0;
 
 		if (station_add_seen_bss(station, bss)) {
-			l_queue_push_tail(station->bss_list, bss);
+			station_bss_list_add(station, bss);
 
 			continue;
 		}
@@ -3222,6 +5239,7 @@ static struct l_dbus_message *station_dbus_connect_hidden_network(
 	};
 	const char *ssid;
 	struct network *network;
+	PROFILE_CALLBACK();
 
 	l_debug("");
 
@@ -3309,6 +5327,9 @@ static void station_reconnect(struct station *station)
 	 */
 	station_enter_state(station, STATION_STATE_ROAMING);
 
+	/* Same network, the addresses and routes can stay in place */
+	station->netconfig_keep = station->netconfig != NULL;
+
 	netdev_disconnect(station->netdev, station_disconnect_reconnect_cb,
 				station);
 }
@@ -3373,6 +5394,7 @@ static struct l_dbus_message *station_dbus_disconnect(struct l_dbus *dbus,
 {
 	struct station *station = user_data;
 	int result;
+	PROFILE_CALLBACK();
 
 	l_debug("");
 
@@ -3398,37 +5420,163 @@ static struct l_dbus_message *station_dbus_disconnect(struct l_dbus *dbus,
 	if (result < 0)
 		return dbus_error_from_errno(result, message);
 
-	station->disconnect_pending = l_dbus_message_ref(message);
+	station->disconnect_pending = l_dbus_message_ref(message);
+
+	return NULL;
+}
+
+static void station_append_network(struct l_dbus_message_builder *builder,
+					const struct network *network)
+{
+	int16_t signal_strength = network_get_signal_strength(network);
+
+	l_dbus_message_builder_enter_struct(builder, "on");
+	l_dbus_message_builder_append_basic(builder, 'o',
+						network_get_path(network));
+	l_dbus_message_builder_append_basic(builder, 'n', &signal_strength);
+	l_dbus_message_builder_leave_struct(builder);
+}
+
+static struct l_dbus_message *station_dbus_get_networks(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct station *station = user_data;
+	struct l_dbus_message *reply =
+				l_dbus_message_new_method_return(message);
+	struct l_dbus_message_builder *builder =
+				l_dbus_message_builder_new(reply);
+	struct l_queue *sorted = station->networks_sorted;
+	const struct l_queue_entry *entry;
+	PROFILE_CALLBACK();
+
+	l_dbus_message_builder_enter_array(builder, "(on)");
+
+	for (entry = l_queue_get_entries(sorted); entry; entry = entry->next)
+		station_append_network(builder, entry->data);
+
+	l_dbus_message_builder_leave_array(builder);
+
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
+struct network_filter {
+	uint32_t offset;
+	uint32_t limit;
+	bool have_security : 1;
+	bool known_only : 1;
+	enum security security;
+	int16_t min_signal;
+};
+
+static bool network_filter_match(const struct network_filter *filter,
+					const struct network *network)
+{
+	if (filter->have_security &&
+			network_get_security(network) != filter->security)
+		return false;
+
+	if (filter->known_only && !network_get_info(network))
+		return false;
 
-	return NULL;
+	return network_get_signal_strength(network) >= filter->min_signal;
 }
 
-static struct l_dbus_message *station_dbus_get_networks(struct l_dbus *dbus,
+static struct l_dbus_message *station_dbus_get_filtered_networks(
+						struct l_dbus *dbus,
 						struct l_dbus_message *message,
 						void *user_data)
 {
 	struct station *station = user_data;
-	struct l_dbus_message *reply =
-				l_dbus_message_new_method_return(message);
-	struct l_dbus_message_builder *builder =
-				l_dbus_message_builder_new(reply);
-	struct l_queue *sorted = station->networks_sorted;
+	struct l_dbus_message *reply;
+	struct l_dbus_message_builder *builder;
+	struct l_dbus_message_iter dict;
+	struct l_dbus_message_iter variant;
+	const char *key;
+	const char *str;
+	struct network_filter filter = {
+		.limit = UINT32_MAX,
+		.min_signal = INT16_MIN,
+	};
+	uint32_t since;
+	bool have_since = false;
 	const struct l_queue_entry *entry;
+	uint32_t skipped = 0;
+	uint32_t count = 0;
+	PROFILE_CALLBACK();
+
+	if (!l_dbus_message_get_arguments(message, "a{sv}", &dict))
+		return dbus_error_invalid_args(message);
 
+	while (l_dbus_message_iter_next_entry(&dict, &key, &variant)) {
+		bool known_only;
+
+		if (!strcmp(key, "Since")) {
+			if (!l_dbus_message_iter_get_variant(&variant, "u",
+								&since))
+				return dbus_error_invalid_args(message);
+
+			have_since = true;
+		} else if (!strcmp(key, "Offset")) {
+			if (!l_dbus_message_iter_get_variant(&variant, "u",
+								&filter.offset))
+				return dbus_error_invalid_args(message);
+		} else if (!strcmp(key, "Limit")) {
+			if (!l_dbus_message_iter_get_variant(&variant, "u",
+								&filter.limit))
+				return dbus_error_invalid_args(message);
+		} else if (!strcmp(key, "Security")) {
+			if (!l_dbus_message_iter_get_variant(&variant, "s",
+								&str) ||
+					!security_from_str(str,
+							&filter.security))
+				return dbus_error_invalid_args(message);
+
+			filter.have_security = true;
+		} else if (!strcmp(key, "KnownOnly")) {
+			if (!l_dbus_message_iter_get_variant(&variant, "b",
+								&known_only))
+				return dbus_error_invalid_args(message);
+
+			filter.known_only = known_only;
+		} else if (!strcmp(key, "MinSignal")) {
+			if (!l_dbus_message_iter_get_variant(&variant, "n",
+							&filter.min_signal))
+				return dbus_error_invalid_args(message);
+		} else
+			return dbus_error_invalid_args(message);
+	}
+
+	reply = l_dbus_message_new_method_return(message);
+	builder = l_dbus_message_builder_new(reply);
+
+	l_dbus_message_builder_append_basic(builder, 'u',
+						&station->networks_seq);
 	l_dbus_message_builder_enter_array(builder, "(on)");
 
-	for (entry = l_queue_get_entries(sorted); entry; entry = entry->next) {
-		const struct network *network = entry->data;
-		int16_t signal_strength = network_get_signal_strength(network);
+	/* The caller's copy is still current, spare it the list */
+	if (have_since && since == station->networks_seq)
+		goto done;
 
-		l_dbus_message_builder_enter_struct(builder, "on");
-		l_dbus_message_builder_append_basic(builder, 'o',
-						network_get_path(network));
-		l_dbus_message_builder_append_basic(builder, 'n',
-							&signal_strength);
-		l_dbus_message_builder_leave_struct(builder);
+	for (entry = l_queue_get_entries(station->networks_sorted);
+				entry && count < filter.limit;
+				entry = entry->next) {
+		if (!network_filter_match(&filter, entry->data))
+			continue;
+
+		if (skipped < filter.offset) {
+			skipped++;
+			continue;
+		}
+
+		station_append_network(builder, entry->data);
+		count++;
 	}
 
+done:
 	l_dbus_message_builder_leave_array(builder);
 
 	l_dbus_message_builder_finalize(builder);
@@ -3568,6 +5716,7 @@ static struct l_dbus_message *station_dbus_scan(struct l_dbus *dbus,
 						void *user_data)
 {
 	struct station *station = user_data;
+	PROFILE_CALLBACK();
 
 	l_debug("Scan called from DBus");
 
@@ -3592,6 +5741,10 @@ struct signal_agent {
 	char *owner;
 	char *path;
 	unsigned int disconnect_watch;
+	struct l_idle *notify_idle;
+	uint8_t pending_level;
+	uint8_t level;
+	bool level_sent : 1;
 };
 
 static void station_signal_agent_notify(struct signal_agent *agent,
@@ -3609,16 +5762,43 @@ static void station_signal_agent_notify(struct signal_agent *agent,
 	l_dbus_send(dbus_get_bus(), msg);
 }
 
+static void station_signal_agent_notify_idle(struct l_idle *idle,
+						void *user_data)
+{
+	struct station *station = user_data;
+	struct signal_agent *agent = station->signal_agent;
+
+	l_idle_remove(l_steal_ptr(agent->notify_idle));
+
+	if (agent->level_sent && agent->level == agent->pending_level)
+		return;
+
+	agent->level = agent->pending_level;
+	agent->level_sent = true;
+
+	station_signal_agent_notify(agent, netdev_get_path(station->netdev),
+					agent->level);
+}
+
+/*
+ * RSSI level changes tend to come in bursts, e.g. while the signal hovers
+ * around a threshold or during a roam, so only the level the station has
+ * settled on by the time the main loop goes idle is sent to the agent.
+ */
 static void station_rssi_level_changed(struct station *station,
 					uint8_t level_idx)
 {
-	struct netdev *netdev = station->netdev;
+	struct signal_agent *agent = station->signal_agent;
 
-	if (!station->signal_agent)
+	if (!agent)
 		return;
 
-	station_signal_agent_notify(station->signal_agent,
-					netdev_get_path(netdev), level_idx);
+	agent->pending_level = level_idx;
+
+	if (!agent->notify_idle)
+		agent->notify_idle = l_idle_create(
+					station_signal_agent_notify_idle,
+					station, NULL);
 }
 
 static void station_signal_agent_release(struct signal_agent *agent,
@@ -3640,6 +5820,7 @@ static void signal_agent_free(void *data)
 {
 	struct signal_agent *agent = data;
 
+	l_idle_remove(agent->notify_idle);
 	l_free(agent->owner);
 	l_free(agent->path);
 	l_dbus_remove_watch(dbus_get_bus(), agent->disconnect_watch);
@@ -3652,6 +5833,7 @@ static void signal_agent_disconnect(struct l_dbus *dbus, void *user_data)
 
 	l_debug("signal_agent %s disconnected", station->signal_agent->owner);
 
+	l_idle_remove(l_steal_ptr(station->signal_agent->notify_idle));
 	l_idle_oneshot(signal_agent_free, station->signal_agent, NULL);
 	station->signal_agent = NULL;
 
@@ -3747,6 +5929,288 @@ static struct l_dbus_message *station_dbus_signal_agent_unregister(
 	return l_dbus_message_new_method_return(message);
 }
 
+#define TELEMETRY_MIN_INTERVAL	100	/* ms */
+#define TELEMETRY_MAX_BATCH	64
+
+struct telemetry_sample {
+	uint64_t time;
+	struct diagnostic_station_info info;
+};
+
+struct telemetry_agent {
+	struct station *station;
+	char *owner;
+	char *path;
+	unsigned int disconnect_watch;
+	struct l_timeout *timeout;
+	uint32_t interval;
+	uint32_t batch;
+	uint32_t n_samples;
+	bool sample_pending : 1;
+	bool freed : 1;
+	struct telemetry_sample samples[];
+};
+
+static void station_telemetry_send(struct telemetry_agent *agent)
+{
+	struct l_dbus_message *msg;
+	struct l_dbus_message_builder *builder;
+	uint32_t i;
+
+	if (!agent->n_samples)
+		return;
+
+	msg = l_dbus_message_new_method_call(dbus_get_bus(),
+						agent->owner, agent->path,
+						IWD_TELEMETRY_AGENT_INTERFACE,
+						"Samples");
+
+	builder = l_dbus_message_builder_new(msg);
+
+	l_dbus_message_builder_append_basic(builder, 'o',
+				netdev_get_path(agent->station->netdev));
+	l_dbus_message_builder_enter_array(builder, "a{sv}");
+
+	for (i = 0; i < agent->n_samples; i++) {
+		const struct telemetry_sample *sample = &agent->samples[i];
+
+		l_dbus_message_builder_enter_array(builder, "{sv}");
+		dbus_append_dict_basic(builder, "Timestamp", 't',
+					&sample->time);
+		dbus_append_dict_basic(builder, "ConnectedBss", 's',
+				util_address_to_string(sample->info.addr));
+		diagnostic_info_to_dict(&sample->info, builder);
+		l_dbus_message_builder_leave_array(builder);
+	}
+
+	l_dbus_message_builder_leave_array(builder);
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	l_dbus_message_set_no_reply(msg, true);
+	l_dbus_send(dbus_get_bus(), msg);
+
+	agent->n_samples = 0;
+}
+
+static void station_telemetry_sample_cb(
+				const struct diagnostic_station_info *info,
+				void *user_data)
+{
+	struct telemetry_agent *agent = user_data;
+	struct telemetry_sample *sample;
+
+	/* Agent went away while the request was in flight */
+	if (!info || !agent->station)
+		return;
+
+	sample = &agent->samples[agent->n_samples++];
+	sample->time = l_time_now();
+	memcpy(&sample->info, info, sizeof(*info));
+
+	if (agent->n_samples == agent->batch)
+		station_telemetry_send(agent);
+}
+
+static void station_telemetry_sample_destroy(void *user_data)
+{
+	struct telemetry_agent *agent = user_data;
+
+	agent->sample_pending = false;
+
+	if (agent->freed)
+		l_free(agent);
+}
+
+static void station_telemetry_timeout(struct l_timeout *timeout,
+					void *user_data)
+{
+	struct telemetry_agent *agent = user_data;
+
+	l_timeout_modify_ms(timeout, agent->interval);
+
+	/* The previous sample is still queued behind other requests */
+	if (agent->sample_pending)
+		return;
+
+	if (netdev_get_current_station(agent->station->netdev,
+					station_telemetry_sample_cb, agent,
+					station_telemetry_sample_destroy) == 0)
+		agent->sample_pending = true;
+}
+
+static void station_telemetry_start(struct station *station)
+{
+	struct telemetry_agent *agent = station->telemetry_agent;
+
+	if (!agent || agent->timeout)
+		return;
+
+	agent->timeout = l_timeout_create_ms(agent->interval,
+						station_telemetry_timeout,
+						agent, NULL);
+}
+
+/* Flushes the samples collected so far, e.g. of a connection just lost */
+static void station_telemetry_stop(struct station *station)
+{
+	struct telemetry_agent *agent = station->telemetry_agent;
+
+	if (!agent)
+		return;
+
+	l_timeout_remove(l_steal_ptr(agent->timeout));
+	station_telemetry_send(agent);
+}
+
+static void station_telemetry_agent_release(struct telemetry_agent *agent)
+{
+	struct l_dbus_message *msg;
+
+	msg = l_dbus_message_new_method_call(dbus_get_bus(),
+						agent->owner, agent->path,
+						IWD_TELEMETRY_AGENT_INTERFACE,
+						"Release");
+	l_dbus_message_set_arguments(msg, "o",
+				netdev_get_path(agent->station->netdev));
+	l_dbus_message_set_no_reply(msg, true);
+
+	l_dbus_send(dbus_get_bus(), msg);
+}
+
+static void telemetry_agent_free(void *data)
+{
+	struct telemetry_agent *agent = data;
+
+	agent->station = NULL;
+
+	l_timeout_remove(agent->timeout);
+	l_free(agent->owner);
+	l_free(agent->path);
+	l_dbus_remove_watch(dbus_get_bus(), agent->disconnect_watch);
+
+	/* Freed by station_telemetry_sample_destroy instead */
+	if (agent->sample_pending) {
+		agent->freed = true;
+		return;
+	}
+
+	l_free(agent);
+}
+
+static void telemetry_agent_disconnect(struct l_dbus *dbus, void *user_data)
+{
+	struct station *station = user_data;
+	struct telemetry_agent *agent = l_steal_ptr(station->telemetry_agent);
+
+	l_debug("telemetry agent %s disconnected", agent->owner);
+
+	agent->station = NULL;
+	l_timeout_remove(l_steal_ptr(agent->timeout));
+	l_idle_oneshot(telemetry_agent_free, agent, NULL);
+}
+
+static struct l_dbus_message *station_dbus_telemetry_agent_register(
+						struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct station *station = user_data;
+	struct telemetry_agent *agent;
+	const char *path, *sender;
+	uint32_t interval, batch;
+
+	if (station->telemetry_agent)
+		return dbus_error_already_exists(message);
+
+	if (!l_dbus_message_get_arguments(message, "ouu", &path,
+						&interval, &batch))
+		return dbus_error_invalid_args(message);
+
+	if (interval < TELEMETRY_MIN_INTERVAL || !batch ||
+			batch > TELEMETRY_MAX_BATCH)
+		return dbus_error_invalid_args(message);
+
+	sender = l_dbus_message_get_sender(message);
+
+	agent = l_malloc(sizeof(struct telemetry_agent) +
+				batch * sizeof(struct telemetry_sample));
+	memset(agent, 0, sizeof(struct telemetry_agent));
+	agent->station = station;
+	agent->owner = l_strdup(sender);
+	agent->path = l_strdup(path);
+	agent->interval = interval;
+	agent->batch = batch;
+	agent->disconnect_watch = l_dbus_add_disconnect_watch(dbus, sender,
+						telemetry_agent_disconnect,
+						station, NULL);
+	station->telemetry_agent = agent;
+
+	l_debug("agent %s path %s interval %u batch %u", sender, path,
+			interval, batch);
+
+	if (station->state == STATION_STATE_CONNECTED)
+		station_telemetry_start(station);
+
+	return l_dbus_message_new_method_return(message);
+}
+
+static struct l_dbus_message *station_dbus_telemetry_agent_unregister(
+						struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct station *station = user_data;
+	struct telemetry_agent *agent = station->telemetry_agent;
+	const char *path, *sender;
+
+	if (!l_dbus_message_get_arguments(message, "o", &path))
+		return dbus_error_invalid_args(message);
+
+	sender = l_dbus_message_get_sender(message);
+
+	if (!agent || strcmp(agent->path, path) || strcmp(agent->owner, sender))
+		return dbus_error_not_found(message);
+
+	station_telemetry_stop(station);
+	telemetry_agent_free(l_steal_ptr(station->telemetry_agent));
+
+	return l_dbus_message_new_method_return(message);
+}
+
+static struct l_dbus_message *station_dbus_set_dscp_policy(
+						struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct station *station = user_data;
+	struct l_dbus_message_iter iter;
+	uint8_t policy[42];
+	uint8_t dscp;
+	uint8_t up;
+	size_t len = 0;
+	int err;
+
+	if (!l_dbus_message_get_arguments(message, "a(yy)", &iter))
+		return dbus_error_invalid_args(message);
+
+	while (l_dbus_message_iter_next_entry(&iter, &dscp, &up)) {
+		if (len == sizeof(policy))
+			return dbus_error_invalid_args(message);
+
+		policy[len++] = dscp;
+		policy[len++] = up;
+	}
+
+	err = netdev_set_dscp_policy(station->netdev, policy, len);
+	if (err == -ENOTSUP)
+		return dbus_error_not_supported(message);
+	else if (err < 0)
+		return dbus_error_invalid_args(message);
+
+	return l_dbus_message_new_method_return(message);
+}
+
 static bool station_property_get_connected_network(struct l_dbus *dbus,
 					struct l_dbus_message *message,
 					struct l_dbus_message_builder *builder,
@@ -3763,6 +6227,32 @@ static bool station_property_get_connected_network(struct l_dbus *dbus,
 	return true;
 }
 
+static bool station_property_get_dscp_map(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	struct station *station = user_data;
+	uint8_t map[64];
+	uint8_t dscp;
+
+	if (!netdev_get_dscp_map(station->netdev, map))
+		return false;
+
+	l_dbus_message_builder_enter_array(builder, "{yy}");
+
+	for (dscp = 0; dscp < L_ARRAY_SIZE(map); dscp++) {
+		l_dbus_message_builder_enter_dict(builder, "yy");
+		l_dbus_message_builder_append_basic(builder, 'y', &dscp);
+		l_dbus_message_builder_append_basic(builder, 'y', &map[dscp]);
+		l_dbus_message_builder_leave_dict(builder);
+	}
+
+	l_dbus_message_builder_leave_array(builder);
+
+	return true;
+}
+
 static bool station_property_get_scanning(struct l_dbus *dbus,
 					struct l_dbus_message *message,
 					struct l_dbus_message_builder *builder,
@@ -3886,6 +6376,7 @@ int station_hide_network(struct station *station, struct network *network)
 
 	l_queue_remove(station->networks_sorted, network);
 	l_hashmap_remove(station->networks, path);
+	station->networks_seq++;
 
 	while ((bss = network_bss_list_pop(network))) {
 		memset(bss->ssid, 0, bss->ssid_len);
@@ -3945,6 +6436,7 @@ static struct station *station_create(struct netdev *netdev)
 	watchlist_init(&station->state_watches, NULL);
 
 	station->bss_list = l_queue_new();
+	station->bss_index = bss_index_new();
 	station->hidden_bss_list_sorted = l_queue_new();
 	station->networks = l_hashmap_new();
 	l_hashmap_set_hash_function(station->networks, l_str_hash);
@@ -3964,8 +6456,10 @@ static struct station *station_create(struct netdev *netdev)
 		station->netconfig = netconfig_new(netdev_get_ifindex(netdev));
 
 	station->anqp_pending = l_queue_new();
+	station->roam_candidates = l_queue_new();
 
 	station_fill_scan_freq_subsets(station);
+	station_fast_reconnect_restore(station);
 
 	if (iwd_is_developer_mode()) {
 		l_dbus_object_add_interface(dbus,
@@ -4000,14 +6494,24 @@ static void station_free(struct station *station)
 		station->netconfig = NULL;
 	}
 
+	station_radio_budget_update(station, false);
 	periodic_scan_stop(station);
 
+	if (station->wowlan_triggers)
+		netdev_set_wowlan(station->netdev, 0);
+
 	if (station->signal_agent) {
 		station_signal_agent_release(station->signal_agent,
 					netdev_get_path(station->netdev));
 		signal_agent_free(station->signal_agent);
 	}
 
+	if (station->telemetry_agent) {
+		station_telemetry_stop(station);
+		station_telemetry_agent_release(station->telemetry_agent);
+		telemetry_agent_free(station->telemetry_agent);
+	}
+
 	if (station->connect_pending)
 		dbus_pending_reply(&station->connect_pending,
 				dbus_error_aborted(station->connect_pending));
@@ -4046,10 +6550,18 @@ static void station_free(struct station *station)
 		l_queue_destroy(station->owe_hidden_scan_ids, NULL);
 	}
 
+	l_queue_destroy(station->owe_pairs, l_free);
+
 	station_roam_state_clear(station);
+	station_history_end(station);
+	station_fast_reconnect_stash(station);
+
+	if (station->fast_reconnect_idle)
+		l_idle_remove(station->fast_reconnect_idle);
 
 	l_queue_destroy(station->networks_sorted, NULL);
 	l_hashmap_destroy(station->networks, network_free);
+	l_hashmap_destroy(station->bss_index, NULL);
 	l_queue_destroy(station->bss_list, bss_free);
 	l_queue_destroy(station->hidden_bss_list_sorted, NULL);
 	l_queue_destroy(station->autoconnect_list, NULL);
@@ -4057,6 +6569,7 @@ static void station_free(struct station *station)
 	watchlist_destroy(&station->state_watches);
 
 	l_queue_destroy(station->anqp_pending, remove_anqp);
+	l_queue_destroy(station->roam_candidates, NULL);
 
 	scan_freq_set_free(station->scan_freqs_order[0]);
 	scan_freq_set_free(station->scan_freqs_order[1]);
@@ -4077,6 +6590,10 @@ static void station_setup_interface(struct l_dbus_interface *interface)
 	l_dbus_interface_method(interface, "GetOrderedNetworks", 0,
 				station_dbus_get_networks, "a(on)", "",
 				"networks");
+	l_dbus_interface_method(interface, "GetFilteredNetworks", 0,
+				station_dbus_get_filtered_networks,
+				"ua(on)", "a{sv}", "sequence", "networks",
+				"filter");
 	l_dbus_interface_method(interface, "GetHiddenAccessPoints", 0,
 				station_dbus_get_hidden_access_points,
 				"a(sns)", "",
@@ -4089,6 +6606,18 @@ static void station_setup_interface(struct l_dbus_interface *interface)
 	l_dbus_interface_method(interface, "UnregisterSignalLevelAgent", 0,
 				station_dbus_signal_agent_unregister,
 				"", "o", "path");
+	l_dbus_interface_method(interface, "RegisterTelemetryAgent", 0,
+				station_dbus_telemetry_agent_register,
+				"", "ouu", "path", "interval", "batch");
+	l_dbus_interface_method(interface, "UnregisterTelemetryAgent", 0,
+				station_dbus_telemetry_agent_unregister,
+				"", "o", "path");
+	l_dbus_interface_method(interface, "SetDSCPPolicy", 0,
+				station_dbus_set_dscp_policy,
+				"", "a(yy)", "policy");
+
+	l_dbus_interface_signal(interface, "NetworksChanged", 0,
+				"a(on)a(on)ao", "added", "changed", "removed");
 
 	l_dbus_interface_property(interface, "ConnectedNetwork", 0, "o",
 					station_property_get_connected_network,
@@ -4097,6 +6626,8 @@ static void station_setup_interface(struct l_dbus_interface *interface)
 					station_property_get_scanning, NULL);
 	l_dbus_interface_property(interface, "State", 0, "s",
 					station_property_get_state, NULL);
+	l_dbus_interface_property(interface, "DSCPMap", 0, "a{yy}",
+					station_property_get_dscp_map, NULL);
 }
 
 static void station_destroy_interface(void *user_data)
@@ -4136,6 +6667,16 @@ static void station_get_diagnostic_cb(
 
 	diagnostic_info_to_dict(info, builder);
 
+	diagnostic_latency_to_dict(&station->scan_latency, "Scan", builder);
+	diagnostic_latency_to_dict(&station->auth_latency, "Authentication",
+					builder);
+	diagnostic_latency_to_dict(&station->assoc_latency, "Association",
+					builder);
+	diagnostic_latency_to_dict(&station->handshake_latency, "Handshake",
+					builder);
+	diagnostic_latency_to_dict(&station->netconfig_latency, "Netconfig",
+					builder);
+
 	l_dbus_message_builder_leave_array(builder);
 	l_dbus_message_builder_finalize(builder);
 	l_dbus_message_builder_destroy(builder);
@@ -4206,6 +6747,7 @@ static struct l_dbus_message *station_force_roam(struct l_dbus *dbus,
 
 	/* The various roam routines expect this to be set from scanning */
 	station->preparing_roam = true;
+	station_roam_trace_start(station, "forced");
 
 	station_transition_start(station, target);
 
@@ -4230,12 +6772,34 @@ static struct network *station_find_network_from_bss(struct station *station,
 	return station_network_find(station, ssid, security);
 }
 
+static struct l_dbus_message *station_get_roam_history(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct station *station = user_data;
+	struct l_dbus_message *reply;
+	struct l_dbus_message_builder *builder;
+
+	reply = l_dbus_message_new_method_return(message);
+	builder = l_dbus_message_builder_new(reply);
+
+	diagnostic_roam_trace_to_dbus(&station->roam_trace, builder);
+
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
 static void station_setup_diagnostic_interface(
 					struct l_dbus_interface *interface)
 {
 	l_dbus_interface_method(interface, "GetDiagnostics", 0,
 				station_get_diagnostics, "a{sv}", "",
 				"diagnostics");
+	l_dbus_interface_method(interface, "GetRoamHistory", 0,
+				station_get_roam_history, "aa{sv}", "",
+				"roams");
 }
 
 static void station_destroy_diagnostic_interface(void *user_data)
@@ -4247,7 +6811,6 @@ static struct l_dbus_message *station_force_connect_bssid(struct l_dbus *dbus,
 						void *user_data)
 {
 	struct station *station = user_data;
-	struct l_queue *bss_list;
 	struct scan_bss *target;
 	struct network *network;
 	struct l_dbus_message_iter iter;
@@ -4263,9 +6826,7 @@ static struct l_dbus_message *station_force_connect_bssid(struct l_dbus *dbus,
 	if (mac_len != 6)
 		return dbus_error_invalid_args(message);
 
-	bss_list = station_get_bss_list(station);
-
-	target = l_queue_find(bss_list, bss_match_bssid, mac);
+	target = station_bss_find_by_addr(station, mac);
 	if (!target)
 		return dbus_error_invalid_args(message);
 
@@ -4435,6 +6996,10 @@ static void station_setup_debug_interface(
 					station_debug_scan, "", "aq",
 					"frequencies");
 
+	l_dbus_interface_method(interface, "GetRoamHistory", 0,
+					station_get_roam_history, "aa{sv}", "",
+					"roams");
+
 	l_dbus_interface_signal(interface, "Event", 0, "sav", "name", "data");
 
 	l_dbus_interface_property(interface, "AutoConnect", 0, "b",
@@ -4539,10 +7104,43 @@ static int station_init(void)
 	if (roam_retry_interval > INT_MAX)
 		roam_retry_interval = INT_MAX;
 
+	if (!l_settings_get_uint(iwd_get_config(), "Scan",
+				"RoamCandidateScanInterval",
+				&roam_candidate_scan_interval))
+		roam_candidate_scan_interval = 30;
+
+	if (!l_settings_get_uint(iwd_get_config(), "Scan",
+				"RoamScanChannelsPerSlice",
+				&roam_scan_slice_size))
+		roam_scan_slice_size = 0;
+
+	if (!l_settings_get_uint(iwd_get_config(), "Scan",
+				"RoamScanSliceInterval",
+				&roam_scan_slice_gap))
+		roam_scan_slice_gap = 100;
+
+	if (!l_settings_get_uint(iwd_get_config(), "General",
+				"FastReconnectMaxAge",
+				&fast_reconnect_max_age))
+		fast_reconnect_max_age = 3600;
+
 	if (!l_settings_get_bool(iwd_get_config(), "General", "DisableANQP",
 				&anqp_disabled))
 		anqp_disabled = true;
 
+	if (!l_settings_get_bool(iwd_get_config(), "General",
+				"DisableOpportunisticKeyCaching",
+				&okc_disabled))
+		okc_disabled = false;
+
+	if (!l_settings_get_bool(iwd_get_config(), "General",
+				"EnableWakeOnWLAN", &wowlan_enabled))
+		wowlan_enabled = false;
+
+	if (!l_settings_get_bool(iwd_get_config(), "General",
+				"ManagePowerSave", &power_save_managed))
+		power_save_managed = false;
+
 	if (!netconfig_enabled())
 		l_info("station: Network configuration is disabled.");
 
@@ -4568,6 +7166,10 @@ static void station_exit(void)
 	l_queue_destroy(station_list, NULL);
 	station_list = NULL;
 	watchlist_destroy(&event_watches);
+	l_queue_destroy(anqp_cache, anqp_cache_entry_free);
+	anqp_cache = NULL;
+	l_queue_destroy(fast_reconnect_cache, fast_reconnect_entry_free);
+	fast_reconnect_cache = NULL;
 }
 
 IWD_MODULE(station, station_init, station_exit)
@@ -101,5 +101,7 @@ void station_network_foreach(struct station *station,
 				void *user_data);
 struct l_queue *station_get_bss_list(struct station *station);
 struct scan_bss *station_get_connected_bss(struct station *station);
+void station_roam_candidates_update(struct station *station,
+					struct l_queue *bss_list);
 
 int station_hide_network(struct station *station, struct network *network);
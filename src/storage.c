@@ -52,11 +52,59 @@
 #define STORAGE_FILE_MODE (S_IRUSR | S_IWUSR)
 
 #define KNOWN_FREQ_FILENAME ".known_network.freq"
+#define BSS_HISTORY_FILENAME ".bss_history"
+#define DHCP_LEASES_FILENAME ".dhcp_leases"
+#define AP_LEASES_FILENAME ".ap_leases"
+#define EAP_TLS_CACHE_FILENAME ".eap_tls_cache"
+#define ERP_CACHE_FILENAME ".erp_cache"
+#define P2P_GROUPS_FILENAME ".p2p_groups"
+
+#define STORAGE_SYNC_DELAY 2
+#define STORAGE_PROFILE_CACHE_SIZE 16
 
 static char *storage_path = NULL;
 static char *storage_hotspot_path = NULL;
 static uint8_t system_key[32];
-static bool system_key_set = false;
+
+/*
+ * Profile writes are queued and written out together STORAGE_SYNC_DELAY
+ * seconds after the first one, with a single fsync of the storage
+ * directory per batch, so that e.g. a connection doesn't wait for the
+ * disk.  Reads of a profile with a pending write return the new contents.
+ */
+struct pending_write {
+	char *path;
+	char *data;
+	size_t len;
+	bool preserve_times;
+};
+
+static struct l_queue *pending_writes;
+static struct l_timeout *pending_writes_timeout;
+
+/*
+ * Recently opened network profiles, already decrypted, in a compact form:
+ * the group, key and value strings back to back, each NUL terminated and
+ * an empty key closing each group.  An entry is only used while the size
+ * and modification time of its file still match, so that the profile
+ * loads done during autoconnect and roaming skip reading, parsing and
+ * decrypting the file.
+ */
+struct profile_cache_entry {
+	char *path;
+	off_t size;
+	struct timespec mtime;
+	char *data;
+	size_t len;
+};
+
+static struct l_queue *profile_cache;
+
+/*
+ * The profile encryption key is derived once in storage_init and kept set
+ * up for the lifetime of the daemon, only the raw key bytes are wiped.
+ */
+static struct aes_siv_key *profile_key;
 
 static int create_dirs(const char *filename)
 {
@@ -189,6 +237,241 @@ error_create_dirs:
 	return r;
 }
 
+static bool pending_write_match(const void *a, const void *b)
+{
+	const struct pending_write *pending = a;
+	const char *path = b;
+
+	return !strcmp(pending->path, path);
+}
+
+static void pending_write_free(void *data)
+{
+	struct pending_write *pending = data;
+
+	explicit_bzero(pending->data, pending->len);
+	l_free(pending->data);
+	l_free(pending->path);
+	l_free(pending);
+}
+
+static void storage_flush(void)
+{
+	struct pending_write *pending;
+	int fd;
+
+	l_timeout_remove(l_steal_ptr(pending_writes_timeout));
+
+	if (l_queue_isempty(pending_writes))
+		return;
+
+	while ((pending = l_queue_pop_head(pending_writes))) {
+		if (write_file(pending->data, pending->len,
+				pending->preserve_times, "%s",
+				pending->path) < 0)
+			l_error("Failed to write %s", pending->path);
+
+		pending_write_free(pending);
+	}
+
+	fd = L_TFR(open(storage_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+	if (fd < 0)
+		return;
+
+	if (L_TFR(fsync(fd)) < 0)
+		l_error("fsync(%s) failed: %s", storage_path, strerror(errno));
+
+	L_TFR(close(fd));
+}
+
+static void storage_flush_cb(struct l_timeout *timeout, void *user_data)
+{
+	storage_flush();
+}
+
+/* Takes ownership of @path and @data */
+static void storage_write_deferred(char *path, char *data, size_t len,
+					bool preserve_times)
+{
+	struct pending_write *pending;
+
+	if (!pending_writes)
+		pending_writes = l_queue_new();
+
+	pending = l_queue_find(pending_writes, pending_write_match, path);
+	if (pending) {
+		explicit_bzero(pending->data, pending->len);
+		l_free(pending->data);
+		l_free(path);
+	} else {
+		pending = l_new(struct pending_write, 1);
+		pending->path = path;
+		pending->preserve_times = preserve_times;
+		l_queue_push_tail(pending_writes, pending);
+	}
+
+	pending->data = data;
+	pending->len = len;
+
+	if (!pending_writes_timeout)
+		pending_writes_timeout = l_timeout_create(STORAGE_SYNC_DELAY,
+							storage_flush_cb,
+							NULL, NULL);
+}
+
+static bool profile_cache_match(const void *a, const void *b)
+{
+	const struct profile_cache_entry *entry = a;
+	const char *path = b;
+
+	return !strcmp(entry->path, path);
+}
+
+static void profile_cache_entry_free(void *data)
+{
+	struct profile_cache_entry *entry = data;
+
+	explicit_bzero(entry->data, entry->len);
+	l_free(entry->data);
+	l_free(entry->path);
+	l_free(entry);
+}
+
+static void profile_cache_remove(const char *path)
+{
+	struct profile_cache_entry *entry;
+
+	entry = l_queue_remove_if(profile_cache, profile_cache_match, path);
+	if (entry)
+		profile_cache_entry_free(entry);
+}
+
+static bool profile_cache_is_current(const struct profile_cache_entry *entry,
+					const struct stat *st)
+{
+	return entry->size == st->st_size &&
+		entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+		entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static struct l_settings *profile_cache_get(const char *path)
+{
+	struct profile_cache_entry *entry;
+	struct l_settings *settings;
+	struct stat st;
+	const char *group = NULL;
+	const char *pos;
+	const char *end;
+
+	entry = l_queue_find(profile_cache, profile_cache_match, path);
+	if (!entry)
+		return NULL;
+
+	if (stat(path, &st) < 0 || !profile_cache_is_current(entry, &st)) {
+		profile_cache_remove(path);
+		return NULL;
+	}
+
+	/* Keep the most recently opened profiles at the head */
+	l_queue_remove(profile_cache, entry);
+	l_queue_push_head(profile_cache, entry);
+
+	settings = l_settings_new();
+	pos = entry->data;
+	end = entry->data + entry->len;
+
+	while (pos < end) {
+		const char *key;
+
+		if (!group) {
+			group = pos;
+			pos += strlen(pos) + 1;
+			continue;
+		}
+
+		key = pos;
+		pos += strlen(pos) + 1;
+
+		if (!*key) {
+			group = NULL;
+			continue;
+		}
+
+		l_settings_set_value(settings, group, key, pos);
+		pos += strlen(pos) + 1;
+	}
+
+	return settings;
+}
+
+static size_t profile_cache_append(char *buf, size_t pos, const char *str)
+{
+	size_t len = strlen(str) + 1;
+
+	if (buf)
+		memcpy(buf + pos, str, len);
+
+	return pos + len;
+}
+
+/* Run twice, first without @buf to find the length */
+static size_t profile_cache_serialize(const struct l_settings *settings,
+					char *buf)
+{
+	_auto_(l_strv_free) char **groups = l_settings_get_groups(settings);
+	size_t pos = 0;
+	unsigned int i;
+	unsigned int j;
+
+	for (i = 0; groups && groups[i]; i++) {
+		_auto_(l_strv_free) char **keys =
+				l_settings_get_keys(settings, groups[i]);
+
+		pos = profile_cache_append(buf, pos, groups[i]);
+
+		for (j = 0; keys && keys[j]; j++) {
+			const char *value = l_settings_get_value(settings,
+								groups[i],
+								keys[j]);
+
+			pos = profile_cache_append(buf, pos, keys[j]);
+			pos = profile_cache_append(buf, pos, value);
+		}
+
+		pos = profile_cache_append(buf, pos, "");
+	}
+
+	return pos;
+}
+
+static void profile_cache_add(const char *path,
+				const struct l_settings *settings)
+{
+	struct profile_cache_entry *entry;
+	struct stat st;
+
+	profile_cache_remove(path);
+
+	if (stat(path, &st) < 0)
+		return;
+
+	if (!profile_cache)
+		profile_cache = l_queue_new();
+
+	if (l_queue_length(profile_cache) >= STORAGE_PROFILE_CACHE_SIZE)
+		profile_cache_entry_free(l_queue_pop_tail(profile_cache));
+
+	entry = l_new(struct profile_cache_entry, 1);
+	entry->path = l_strdup(path);
+	entry->size = st.st_size;
+	entry->mtime = st.st_mtim;
+	entry->len = profile_cache_serialize(settings, NULL);
+	entry->data = l_malloc(entry->len);
+	profile_cache_serialize(settings, entry->data);
+
+	l_queue_push_head(profile_cache, entry);
+}
+
 bool storage_create_dirs(void)
 {
 	const char *state_dir;
@@ -370,6 +653,41 @@ static bool encrypt_group(const char *group)
 	return false;
 }
 
+/*
+ * Encrypt 'plaintext' with the profile key and store the result, along with
+ * the salt used, in the [Security] group of 'out'.  'name' is authenticated
+ * as additional data.
+ */
+static bool storage_encrypt_into(struct l_settings *out, const char *plaintext,
+					size_t len, const char *name)
+{
+	struct iovec ad[2];
+	uint8_t salt[32];
+	_auto_(l_free) uint8_t *enc = NULL;
+
+	l_getrandom(salt, 32);
+
+	ad[0].iov_base = (void *) salt;
+	ad[0].iov_len = 32;
+	ad[1].iov_base = (void *) name;
+	ad[1].iov_len = strlen(name);
+
+	/*
+	 * AES-SIV automatically prepends the IV (16 bytes) to the encrypted
+	 * data.
+	 */
+	enc = l_malloc(len + 16);
+
+	if (!aes_siv_key_encrypt(profile_key, plaintext, len, ad, 2, enc))
+		return false;
+
+	l_settings_set_bytes(out, "Security", "EncryptedSalt", salt, 32);
+	l_settings_set_bytes(out, "Security", "EncryptedSecurity",
+				enc, len + 16);
+
+	return true;
+}
+
 /*
  * Encrypt needed groups of 'settings' without modifying the object. Returns
  * the entire settings object as data, with encrypted groups as a bytestring
@@ -382,17 +700,14 @@ static bool encrypt_group(const char *group)
 char *__storage_encrypt(const struct l_settings *settings, const char *name,
 				size_t *out_len)
 {
-	struct iovec ad[2];
-	uint8_t salt[32];
 	size_t len;
 	_auto_(l_settings_free) struct l_settings *to_encrypt = NULL;
 	_auto_(l_settings_free) struct l_settings *original = NULL;
 	_auto_(l_free) char *plaintext = NULL;
-	_auto_(l_free) uint8_t *enc = NULL;
 	_auto_(l_strv_free) char **groups = NULL;
 	char **i;
 
-	if (!system_key_set || !l_settings_has_group(settings, "Security"))
+	if (!profile_key || !l_settings_has_group(settings, "Security"))
 		return l_settings_to_data(settings, out_len);
 
 	/*
@@ -418,29 +733,11 @@ char *__storage_encrypt(const struct l_settings *settings, const char *name,
 	if (!plaintext)
 		return NULL;
 
-	l_getrandom(salt, 32);
-
-	ad[0].iov_base = (void *) salt;
-	ad[0].iov_len = 32;
-	ad[1].iov_base = (void *) name;
-	ad[1].iov_len = strlen(name);
-
-	/*
-	 * AES-SIV automatically prepends the IV (16 bytes) to the encrypted
-	 * data.
-	 */
-	enc = l_malloc(len + 16);
-
-	if (!aes_siv_encrypt(system_key, sizeof(system_key), plaintext, len,
-				ad, 2, enc)) {
+	if (!storage_encrypt_into(original, plaintext, len, name)) {
 		l_error("Could not encrypt [Security] group");
 		return NULL;
 	}
 
-	l_settings_set_bytes(original, "Security", "EncryptedSalt", salt, 32);
-	l_settings_set_bytes(original, "Security", "EncryptedSecurity",
-				enc, len + 16);
-
 	return l_settings_to_data(original, out_len);
 }
 
@@ -457,7 +754,6 @@ int __storage_decrypt(struct l_settings *settings, const char *ssid,
 {
 	_auto_(l_settings_free) struct l_settings *security = NULL;
 	_auto_(l_free) uint8_t *encrypted = NULL;
-	_auto_(l_free) uint8_t *decrypted = NULL;
 	_auto_(l_free) uint8_t *salt = NULL;
 	_auto_(l_strv_free) char **embedded = NULL;
 	_auto_(l_strv_free) char **groups = NULL;
@@ -465,7 +761,7 @@ int __storage_decrypt(struct l_settings *settings, const char *ssid,
 	size_t elen, slen;
 	struct iovec ad[2];
 
-	if (!system_key_set)
+	if (!profile_key)
 		goto done;
 
 	if (!l_settings_has_group(settings, "Security"))
@@ -495,27 +791,23 @@ int __storage_decrypt(struct l_settings *settings, const char *ssid,
 		return 0;
 	}
 
-	/*
-	 * AES-SIV automatically verifies the IV (16 bytes) and returns only
-	 * the decrypted data portion. We add one here for the NULL terminator
-	 * since this is always going to be textual data after decryption.
-	 */
-	decrypted = l_malloc(elen - 16 + 1);
-
 	ad[0].iov_base = (void *)salt;
 	ad[0].iov_len = slen;
 	ad[1].iov_base = (void *)ssid;
 	ad[1].iov_len = strlen(ssid);
 
-	if (!aes_siv_decrypt(system_key, sizeof(system_key), encrypted, elen,
-				ad, 2, decrypted)) {
+	/*
+	 * AES-SIV automatically verifies the IV (16 bytes) and returns only
+	 * the decrypted data portion, which is written in place right after
+	 * the IV.
+	 */
+	if (!aes_siv_key_decrypt(profile_key, encrypted, elen, ad, 2,
+					encrypted + 16)) {
 		l_error("Could not decrypt %s profile, did the secret change?",
 				ssid);
 		return -ENOKEY;
 	}
 
-	decrypted[elen - 16] = '\0';
-
 	/*
 	 * Remove any groups that are marked as encrypted (plus embedded),
 	 * and copy the decrypted groups back into settings.
@@ -534,7 +826,8 @@ int __storage_decrypt(struct l_settings *settings, const char *ssid,
 	 * but since the Security group was just removed and EncryptedSecurity
 	 * should only contain a Security group its safe to use it this way.
 	 */
-	if (!l_settings_load_from_data(settings, (const char *) decrypted,
+	if (!l_settings_load_from_data(settings,
+					(const char *) encrypted + 16,
 					elen - 16)) {
 		l_error("Could not load decrypted security group");
 		return -EBADMSG;
@@ -590,20 +883,40 @@ struct l_settings *storage_network_open(enum security type, const char *ssid)
 {
 	struct l_settings *settings;
 	_auto_(l_free) char *path = NULL;
+	struct pending_write *pending;
 
 	if (ssid == NULL)
 		return NULL;
 
 	path = storage_get_network_file_path(type, ssid);
 
+	pending = l_queue_find(pending_writes, pending_write_match, path);
+
+	/*
+	 * 802.1X profiles may contain embedded groups, those are not
+	 * enumerable through l_settings and so can't be cached.
+	 */
+	if (!pending && type != SECURITY_8021X) {
+		settings = profile_cache_get(path);
+		if (settings)
+			return settings;
+	}
+
 	settings = l_settings_new();
 
-	if (!l_settings_load_from_file(settings, path))
+	if (pending) {
+		if (!l_settings_load_from_data(settings, pending->data,
+						pending->len))
+			goto error;
+	} else if (!l_settings_load_from_file(settings, path))
 		goto error;
 
 	if (type != SECURITY_NONE && !storage_decrypt(settings, path, ssid))
 		goto error;
 
+	if (!pending && type != SECURITY_8021X)
+		profile_cache_add(path, settings);
+
 	return settings;
 
 error:
@@ -611,32 +924,165 @@ error:
 	return NULL;
 }
 
+static bool storage_peek_bool(const char *value, size_t len, bool *out)
+{
+	if ((len == 4 && !strncasecmp(value, "true", 4)) ||
+			(len == 1 && *value == '1'))
+		*out = true;
+	else if ((len == 5 && !strncasecmp(value, "false", 5)) ||
+			(len == 1 && *value == '0'))
+		*out = false;
+	else
+		return false;
+
+	return true;
+}
+
+static void storage_peek_flags(const char *data, size_t len, bool *hidden,
+				bool *autoconnect)
+{
+	const char *end = data + len;
+	bool in_settings = false;
+
+	while (data < end) {
+		const char *eol = memchr(data, '\n', end - data) ?: end;
+		const char *line = data;
+		const char *eq;
+		const char *key_end;
+		const char *value;
+		const char *value_end = eol;
+
+		data = eol + 1;
+
+		while (line < eol && isspace(*line))
+			line++;
+
+		if (line < eol && *line == '[') {
+			in_settings = eol - line >= 10 &&
+					!memcmp(line, "[Settings]", 10);
+			continue;
+		}
+
+		if (!in_settings)
+			continue;
+
+		eq = memchr(line, '=', eol - line);
+		if (!eq)
+			continue;
+
+		for (key_end = eq; key_end > line && isspace(key_end[-1]);)
+			key_end--;
+
+		for (value = eq + 1; value < eol && isspace(*value);)
+			value++;
+
+		while (value_end > value && isspace(value_end[-1]))
+			value_end--;
+
+		if (key_end - line == 6 && !memcmp(line, "Hidden", 6))
+			storage_peek_bool(value, value_end - value, hidden);
+		else if (key_end - line == 11 &&
+				!memcmp(line, "AutoConnect", 11))
+			storage_peek_bool(value, value_end - value,
+						autoconnect);
+	}
+}
+
+/*
+ * Looks up only the [Settings] Hidden and AutoConnect values of a profile,
+ * without parsing or decrypting the rest, so that the known networks can
+ * be indexed at startup without loading every profile.  [Settings] is
+ * never encrypted.  The values are left alone if not set.
+ */
+bool storage_network_peek_flags(enum security type, const char *ssid,
+				bool *hidden, bool *autoconnect)
+{
+	_auto_(l_free) char *path = storage_get_network_file_path(type, ssid);
+	struct pending_write *pending;
+	struct stat st;
+	void *data;
+	int fd;
+
+	pending = l_queue_find(pending_writes, pending_write_match, path);
+	if (pending) {
+		storage_peek_flags(pending->data, pending->len, hidden,
+					autoconnect);
+		return true;
+	}
+
+	fd = L_TFR(open(path, O_RDONLY));
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0) {
+		L_TFR(close(fd));
+		return false;
+	}
+
+	if (!st.st_size) {
+		L_TFR(close(fd));
+		return true;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	L_TFR(close(fd));
+
+	if (data == MAP_FAILED)
+		return false;
+
+	storage_peek_flags(data, st.st_size, hidden, autoconnect);
+	munmap(data, st.st_size);
+
+	return true;
+}
+
 int storage_network_touch(enum security type, const char *ssid)
 {
 	char *path;
+	struct pending_write *pending;
+	struct profile_cache_entry *entry;
+	struct stat st;
 	int ret;
 
 	if (ssid == NULL)
 		return -EINVAL;
 
 	path = storage_get_network_file_path(type, ssid);
-	ret = utimensat(0, path, NULL, 0);
-	l_free(path);
 
-	if (!ret)
+	/* The file will get the current time when written */
+	pending = l_queue_find(pending_writes, pending_write_match, path);
+	if (pending) {
+		pending->preserve_times = false;
+		l_free(path);
 		return 0;
+	}
+
+	ret = utimensat(0, path, NULL, 0);
+	if (ret < 0) {
+		ret = -errno;
+		profile_cache_remove(path);
+		l_free(path);
+		return ret;
+	}
+
+	/* Only the times changed, keep a cached copy usable */
+	entry = l_queue_find(profile_cache, profile_cache_match, path);
+	if (entry && stat(path, &st) == 0 && entry->size == st.st_size)
+		entry->mtime = st.st_mtim;
+	else if (entry)
+		profile_cache_remove(path);
 
-	return -errno;
+	l_free(path);
+	return 0;
 }
 
 void storage_network_sync(enum security type, const char *ssid,
 				struct l_settings *settings)
 {
-	_auto_(l_free) char *data = NULL;
-	_auto_(l_free) char *path = NULL;
+	char *data;
+	char *path;
 	size_t length = 0;
 
-	path = storage_get_network_file_path(type, ssid);
 	data = __storage_encrypt(settings, ssid, &length);
 
 	if (!data) {
@@ -644,18 +1090,31 @@ void storage_network_sync(enum security type, const char *ssid,
 		return;
 	}
 
-	write_file(data, length, true, "%s", path);
+	path = storage_get_network_file_path(type, ssid);
+	profile_cache_remove(path);
+	storage_write_deferred(path, data, length, true);
 }
 
 int storage_network_remove(enum security type, const char *ssid)
 {
 	char *path;
+	struct pending_write *pending;
 	int ret;
 
 	path = storage_get_network_file_path(type, ssid);
+	profile_cache_remove(path);
+
+	pending = l_queue_remove_if(pending_writes, pending_write_match, path);
+	if (pending)
+		pending_write_free(pending);
+
 	ret = unlink(path);
 	l_free(path);
 
+	/* The profile may not have been written out yet */
+	if (ret < 0 && errno == ENOENT && pending)
+		return 0;
+
 	return ret < 0 ? -errno : 0;
 }
 
@@ -696,6 +1155,229 @@ void storage_known_frequencies_sync(struct l_settings *known_freqs)
 	l_free(known_freq_file_path);
 }
 
+struct l_settings *storage_eap_tls_cache_load(void)
+{
+	struct l_settings *cache = l_settings_new();
+	_auto_(l_free) char *path = storage_get_path("/%s",
+						EAP_TLS_CACHE_FILENAME);
+
+	if (!l_settings_load_from_file(cache, path)) {
+		l_settings_free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+/*
+ * The session cache holds TLS master secrets, write_file creates it
+ * with 0600 permissions.
+ */
+void storage_eap_tls_cache_sync(const struct l_settings *cache)
+{
+	_auto_(l_free) char *path = storage_get_path("/%s",
+						EAP_TLS_CACHE_FILENAME);
+	_auto_(l_free) char *data = NULL;
+	size_t len;
+
+	if (!cache)
+		return;
+
+	data = l_settings_to_data(cache, &len);
+	write_file(data, len, false, "%s", path);
+}
+
+static struct l_settings *storage_secret_cache_load(const char *filename)
+{
+	struct l_settings *cache = l_settings_new();
+	_auto_(l_free) char *path = storage_get_path("/%s", filename);
+
+	if (!l_settings_load_from_file(cache, path))
+		goto failed;
+
+	if (__storage_decrypt(cache, filename, NULL) < 0)
+		goto failed;
+
+	return cache;
+
+failed:
+	l_settings_free(cache);
+	return NULL;
+}
+
+/*
+ * Like the TLS session cache, caches holding key material are only
+ * readable by the owner, and when profile encryption is enabled the whole
+ * contents are also encrypted with the profile key.
+ */
+static void storage_secret_cache_sync(const struct l_settings *cache,
+					const char *filename)
+{
+	_auto_(l_free) char *path = storage_get_path("/%s", filename);
+	_auto_(l_settings_free) struct l_settings *encrypted = NULL;
+	_auto_(l_free) char *data = NULL;
+	size_t len;
+
+	if (!cache)
+		return;
+
+	data = l_settings_to_data(cache, &len);
+	if (!data)
+		return;
+
+	if (profile_key) {
+		encrypted = l_settings_new();
+
+		if (!storage_encrypt_into(encrypted, data, len, filename)) {
+			l_error("Could not encrypt %s", filename);
+			return;
+		}
+
+		explicit_bzero(data, len);
+		l_free(data);
+
+		data = l_settings_to_data(encrypted, &len);
+		if (!data)
+			return;
+	}
+
+	write_file(data, len, false, "%s", path);
+	explicit_bzero(data, len);
+}
+
+struct l_settings *storage_erp_cache_load(void)
+{
+	return storage_secret_cache_load(ERP_CACHE_FILENAME);
+}
+
+/* The ERP cache holds EMSKs */
+void storage_erp_cache_sync(const struct l_settings *cache)
+{
+	storage_secret_cache_sync(cache, ERP_CACHE_FILENAME);
+}
+
+struct l_settings *storage_p2p_groups_load(void)
+{
+	return storage_secret_cache_load(P2P_GROUPS_FILENAME);
+}
+
+/* The persistent P2P group list holds the groups' PSKs */
+void storage_p2p_groups_sync(const struct l_settings *groups)
+{
+	storage_secret_cache_sync(groups, P2P_GROUPS_FILENAME);
+}
+
+struct l_settings *storage_bss_history_load(void)
+{
+	struct l_settings *history;
+	char *path;
+
+	history = l_settings_new();
+
+	path = storage_get_path("/%s", BSS_HISTORY_FILENAME);
+
+	if (!l_settings_load_from_file(history, path)) {
+		l_settings_free(history);
+		history = NULL;
+	}
+
+	l_free(path);
+
+	return history;
+}
+
+void storage_bss_history_sync(struct l_settings *history)
+{
+	char *path;
+	char *data;
+	size_t len;
+
+	if (!history)
+		return;
+
+	path = storage_get_path("/%s", BSS_HISTORY_FILENAME);
+
+	data = l_settings_to_data(history, &len);
+	write_file(data, len, false, "%s", path);
+	l_free(data);
+
+	l_free(path);
+}
+
+struct l_settings *storage_dhcp_leases_load(void)
+{
+	struct l_settings *leases;
+	char *path;
+
+	leases = l_settings_new();
+
+	path = storage_get_path("/%s", DHCP_LEASES_FILENAME);
+
+	if (!l_settings_load_from_file(leases, path)) {
+		l_settings_free(leases);
+		leases = NULL;
+	}
+
+	l_free(path);
+
+	return leases;
+}
+
+void storage_dhcp_leases_sync(struct l_settings *leases)
+{
+	char *path;
+	char *data;
+	size_t len;
+
+	if (!leases)
+		return;
+
+	path = storage_get_path("/%s", DHCP_LEASES_FILENAME);
+
+	data = l_settings_to_data(leases, &len);
+	write_file(data, len, false, "%s", path);
+	l_free(data);
+
+	l_free(path);
+}
+
+struct l_settings *storage_ap_leases_load(void)
+{
+	struct l_settings *leases;
+	char *path;
+
+	leases = l_settings_new();
+
+	path = storage_get_path("/%s", AP_LEASES_FILENAME);
+
+	if (!l_settings_load_from_file(leases, path)) {
+		l_settings_free(leases);
+		leases = NULL;
+	}
+
+	l_free(path);
+
+	return leases;
+}
+
+void storage_ap_leases_sync(struct l_settings *leases)
+{
+	char *path;
+	char *data;
+	size_t len;
+
+	if (!leases)
+		return;
+
+	path = storage_get_path("/%s", AP_LEASES_FILENAME);
+
+	data = l_settings_to_data(leases, &len);
+	write_file(data, len, false, "%s", path);
+	l_free(data);
+
+	l_free(path);
+}
+
 bool storage_is_file(const char *filename)
 {
 	char *path;
@@ -738,18 +1420,26 @@ bool storage_init(const uint8_t *key, size_t key_len)
 	if (!hkdf_extract(L_CHECKSUM_SHA256, NULL, 0, 1, tmp, key, key_len))
 		return false;
 
-	system_key_set = hkdf_expand(L_CHECKSUM_SHA256, tmp, sizeof(tmp),
-					"System Key",
-					system_key, sizeof(system_key));
+	if (hkdf_expand(L_CHECKSUM_SHA256, tmp, sizeof(tmp), "System Key",
+				system_key, sizeof(system_key)))
+		profile_key = aes_siv_key_new(system_key, sizeof(system_key));
 
 	explicit_bzero(tmp, sizeof(tmp));
-	return system_key_set;
+	explicit_bzero(system_key, sizeof(system_key));
+	munlock(system_key, sizeof(system_key));
+
+	return profile_key != NULL;
 }
 
 void storage_exit(void)
 {
-	if (system_key_set) {
-		explicit_bzero(system_key, sizeof(system_key));
-		munlock(system_key, sizeof(system_key));
-	}
+	storage_flush();
+	l_queue_destroy(pending_writes, NULL);
+	pending_writes = NULL;
+
+	l_queue_destroy(profile_cache, profile_cache_entry_free);
+	profile_cache = NULL;
+
+	aes_siv_key_free(profile_key);
+	profile_key = NULL;
 }
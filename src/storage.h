@@ -43,6 +43,8 @@ const char *storage_network_ssid_from_path(const char *path,
 char *storage_get_network_file_path(enum security type, const char *ssid);
 
 struct l_settings *storage_network_open(enum security type, const char *ssid);
+bool storage_network_peek_flags(enum security type, const char *ssid,
+				bool *hidden, bool *autoconnect);
 int storage_network_touch(enum security type, const char *ssid);
 void storage_network_sync(enum security type, const char *ssid,
 				struct l_settings *settings);
@@ -51,6 +53,24 @@ int storage_network_remove(enum security type, const char *ssid);
 struct l_settings *storage_known_frequencies_load(void);
 void storage_known_frequencies_sync(struct l_settings *known_freqs);
 
+struct l_settings *storage_eap_tls_cache_load(void);
+void storage_eap_tls_cache_sync(const struct l_settings *cache);
+
+struct l_settings *storage_erp_cache_load(void);
+void storage_erp_cache_sync(const struct l_settings *cache);
+
+struct l_settings *storage_p2p_groups_load(void);
+void storage_p2p_groups_sync(const struct l_settings *groups);
+
+struct l_settings *storage_bss_history_load(void);
+void storage_bss_history_sync(struct l_settings *history);
+
+struct l_settings *storage_dhcp_leases_load(void);
+void storage_dhcp_leases_sync(struct l_settings *leases);
+
+struct l_settings *storage_ap_leases_load(void);
+void storage_ap_leases_sync(struct l_settings *leases);
+
 int __storage_decrypt(struct l_settings *settings, const char *ssid,
 				bool *changed);
 char *__storage_encrypt(const struct l_settings *settings, const char *ssid,
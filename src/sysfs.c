@@ -27,6 +27,7 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #include <ell/ell.h>
@@ -107,3 +108,36 @@ int sysfs_write_ipv4_setting(const char *ifname, const char *setting,
 
 	return r;
 }
+
+int sysfs_read_netdev_statistic(const char *ifname, const char *stat,
+					uint64_t *out_value)
+{
+	char buf[32];
+	char *endp;
+	ssize_t len;
+	int fd;
+	int r;
+	L_AUTO_FREE_VAR(char *, file) =
+		l_strdup_printf("/sys/class/net/%s/statistics/%s",
+							ifname, stat);
+
+	fd = L_TFR(open(file, O_RDONLY));
+	if (fd < 0)
+		return -errno;
+
+	len = L_TFR(read(fd, buf, sizeof(buf) - 1));
+	r = len < 0 ? -errno : 0;
+	L_TFR(close(fd));
+
+	if (r < 0)
+		return r;
+
+	buf[len] = '\0';
+	errno = 0;
+	*out_value = strtoull(buf, &endp, 10);
+
+	if (endp == buf || errno)
+		return -EINVAL;
+
+	return 0;
+}
@@ -26,3 +26,5 @@ int sysfs_write_ipv6_setting(const char *ifname, const char *setting,
 bool sysfs_supports_ipv4_setting(const char *ifname, const char *setting);
 int sysfs_write_ipv4_setting(const char *ifname, const char *setting,
 					const char *value);
+int sysfs_read_netdev_statistic(const char *ifname, const char *stat,
+					uint64_t *out_value);
@@ -311,27 +311,78 @@ bool util_ip_prefix_tohl(const char *ip, uint8_t *prefix_out,
 	return true;
 }
 
+/*
+ * 802.11-2012, 8.4.2.10 hints that 200 is the largest channel number for
+ * 5GHz, 6GHz channels go up to 233.  Both fit in 256 bit wide bitmaps
+ * indexed directly by the channel number.
+ */
+#define FREQ_SET_WORDS 4
+
 struct scan_freq_set {
 	uint16_t channels_2ghz;
-	struct l_uintset *channels_5ghz;
-	struct l_uintset *channels_6ghz;
+	uint64_t channels_5ghz[FREQ_SET_WORDS];
+	uint64_t channels_6ghz[FREQ_SET_WORDS];
 };
 
-struct scan_freq_set *scan_freq_set_new(void)
+static inline void channel_bitmap_set(uint64_t *bitmap, uint8_t channel)
 {
-	struct scan_freq_set *ret = l_new(struct scan_freq_set, 1);
+	bitmap[channel / 64] |= 1ULL << (channel % 64);
+}
+
+static inline bool channel_bitmap_test(const uint64_t *bitmap,
+					uint8_t channel)
+{
+	return bitmap[channel / 64] & (1ULL << (channel % 64));
+}
+
+static unsigned int channel_bitmap_count(const uint64_t *bitmap)
+{
+	unsigned int i;
+	unsigned int count = 0;
+
+	for (i = 0; i < FREQ_SET_WORDS; i++)
+		count += __builtin_popcountll(bitmap[i]);
+
+	return count;
+}
+
+static bool channel_bitmap_isempty(const uint64_t *bitmap)
+{
+	unsigned int i;
+	uint64_t bits = 0;
 
-	/* 802.11-2012, 8.4.2.10 hints that 200 is the largest channel number */
-	ret->channels_5ghz = l_uintset_new_from_range(1, 200);
-	ret->channels_6ghz = l_uintset_new_from_range(1, 233);
+	for (i = 0; i < FREQ_SET_WORDS; i++)
+		bits |= bitmap[i];
 
-	return ret;
+	return bits == 0;
+}
+
+static void channel_bitmap_foreach(const uint64_t *bitmap,
+					enum band_freq band,
+					scan_freq_set_func_t func,
+					void *user_data)
+{
+	unsigned int i;
+
+	for (i = 0; i < FREQ_SET_WORDS; i++) {
+		uint64_t bits = bitmap[i];
+
+		while (bits) {
+			unsigned int channel = i * 64 + __builtin_ctzll(bits);
+
+			func(band_channel_to_freq(channel, band), user_data);
+			bits &= bits - 1;
+		}
+	}
+}
+
+struct scan_freq_set *scan_freq_set_new(void)
+{
+	return l_new(struct scan_freq_set, 1);
 }
 
 void scan_freq_set_free(struct scan_freq_set *freqs)
 {
-	l_uintset_free(freqs->channels_5ghz);
-	l_uintset_free(freqs->channels_6ghz);
 	l_free(freqs);
 }
 
@@ -349,9 +400,17 @@ bool scan_freq_set_add(struct scan_freq_set *freqs, uint32_t freq)
 		freqs->channels_2ghz |= 1 << (channel - 1);
 		return true;
 	case BAND_FREQ_5_GHZ:
-		return l_uintset_put(freqs->channels_5ghz, channel);
+		if (channel > 200)
+			return false;
+
+		channel_bitmap_set(freqs->channels_5ghz, channel);
+		return true;
 	case BAND_FREQ_6_GHZ:
-		return l_uintset_put(freqs->channels_6ghz, channel);
+		if (channel > 233)
+			return false;
+
+		channel_bitmap_set(freqs->channels_6ghz, channel);
+		return true;
 	}
 
 	return false;
@@ -370,9 +429,9 @@ bool scan_freq_set_contains(const struct scan_freq_set *freqs, uint32_t freq)
 	case BAND_FREQ_2_4_GHZ:
 		return freqs->channels_2ghz & (1 << (channel - 1));
 	case BAND_FREQ_5_GHZ:
-		return l_uintset_contains(freqs->channels_5ghz, channel);
+		return channel_bitmap_test(freqs->channels_5ghz, channel);
 	case BAND_FREQ_6_GHZ:
-		return l_uintset_contains(freqs->channels_6ghz, channel);
+		return channel_bitmap_test(freqs->channels_6ghz, channel);
 	}
 
 	return false;
@@ -381,86 +440,62 @@ bool scan_freq_set_contains(const struct scan_freq_set *freqs, uint32_t freq)
 uint32_t scan_freq_set_get_bands(struct scan_freq_set *freqs)
 {
 	uint32_t bands = 0;
-	uint32_t max;
 
 	if (freqs->channels_2ghz)
 		bands |= BAND_FREQ_2_4_GHZ;
 
-	max = l_uintset_get_max(freqs->channels_5ghz);
-
-	if (l_uintset_find_min(freqs->channels_5ghz) <= max)
+	if (!channel_bitmap_isempty(freqs->channels_5ghz))
 		bands |= BAND_FREQ_5_GHZ;
 
-	max = l_uintset_get_max(freqs->channels_6ghz);
-
-	if (l_uintset_find_min(freqs->channels_6ghz) <= max)
+	if (!channel_bitmap_isempty(freqs->channels_6ghz))
 		bands |= BAND_FREQ_6_GHZ;
 
 	return bands;
 }
 
-static void scan_channels_add(uint32_t channel, void *user_data)
-{
-	struct l_uintset *to = user_data;
-
-	l_uintset_put(to, channel);
-}
-
 void scan_freq_set_merge(struct scan_freq_set *to,
 					const struct scan_freq_set *from)
 {
+	unsigned int i;
+
 	to->channels_2ghz |= from->channels_2ghz;
 
-	l_uintset_foreach(from->channels_5ghz, scan_channels_add,
-							to->channels_5ghz);
-	l_uintset_foreach(from->channels_6ghz, scan_channels_add,
-							to->channels_6ghz);
+	for (i = 0; i < FREQ_SET_WORDS; i++) {
+		to->channels_5ghz[i] |= from->channels_5ghz[i];
+		to->channels_6ghz[i] |= from->channels_6ghz[i];
+	}
 }
 
 bool scan_freq_set_isempty(const struct scan_freq_set *set)
 {
-	if (set->channels_2ghz == 0 && l_uintset_isempty(set->channels_5ghz) &&
-					l_uintset_isempty(set->channels_6ghz))
+	if (set->channels_2ghz == 0 &&
+			channel_bitmap_isempty(set->channels_5ghz) &&
+			channel_bitmap_isempty(set->channels_6ghz))
 		return true;
 
 	return false;
 }
 
-struct channels_foreach_data {
-	scan_freq_set_func_t func;
-	enum band_freq band;
-	void *user_data;
-};
-
-static void scan_channels_foreach(uint32_t channel, void *user_data)
+unsigned int scan_freq_set_count(const struct scan_freq_set *set)
 {
-	const struct channels_foreach_data *channels_data = user_data;
-	uint32_t freq;
-
-	freq = band_channel_to_freq(channel, channels_data->band);
-
-	channels_data->func(freq, channels_data->user_data);
+	return __builtin_popcount(set->channels_2ghz) +
+				channel_bitmap_count(set->channels_5ghz) +
+				channel_bitmap_count(set->channels_6ghz);
 }
 
 void scan_freq_set_foreach(const struct scan_freq_set *freqs,
 				scan_freq_set_func_t func, void *user_data)
 {
-	struct channels_foreach_data data = { };
 	uint8_t channel;
 	uint32_t freq;
 
 	if (unlikely(!freqs || !func))
 		return;
 
-	data.func = func;
-	data.band = BAND_FREQ_5_GHZ;
-	data.user_data = user_data;
-
-	l_uintset_foreach(freqs->channels_5ghz, scan_channels_foreach, &data);
-
-	data.band = BAND_FREQ_6_GHZ;
-
-	l_uintset_foreach(freqs->channels_6ghz, scan_channels_foreach, &data);
+	channel_bitmap_foreach(freqs->channels_5ghz, BAND_FREQ_5_GHZ,
+				func, user_data);
+	channel_bitmap_foreach(freqs->channels_6ghz, BAND_FREQ_6_GHZ,
+				func, user_data);
 
 	if (!freqs->channels_2ghz)
 		return;
@@ -477,26 +512,27 @@ void scan_freq_set_foreach(const struct scan_freq_set *freqs,
 void scan_freq_set_constrain(struct scan_freq_set *set,
 					const struct scan_freq_set *constraint)
 {
-	struct l_uintset *intersection;
+	unsigned int i;
 
-	intersection = l_uintset_intersect(constraint->channels_5ghz,
-							set->channels_5ghz);
-	if (!intersection)
-		/* This shouldn't ever be the case. */
-		return;
+	set->channels_2ghz &= constraint->channels_2ghz;
 
-	l_uintset_free(set->channels_5ghz);
-	set->channels_5ghz = intersection;
+	for (i = 0; i < FREQ_SET_WORDS; i++) {
+		set->channels_5ghz[i] &= constraint->channels_5ghz[i];
+		set->channels_6ghz[i] &= constraint->channels_6ghz[i];
+	}
+}
 
-	intersection = l_uintset_intersect(constraint->channels_6ghz,
-							set->channels_6ghz);
-	if (!intersection)
-		return;
+void scan_freq_set_subtract(struct scan_freq_set *set,
+					const struct scan_freq_set *subtract)
+{
+	unsigned int i;
 
-	l_uintset_free(set->channels_6ghz);
-	set->channels_6ghz = intersection;
+	set->channels_2ghz &= ~subtract->channels_2ghz;
 
-	set->channels_2ghz &= constraint->channels_2ghz;
+	for (i = 0; i < FREQ_SET_WORDS; i++) {
+		set->channels_5ghz[i] &= ~subtract->channels_5ghz[i];
+		set->channels_6ghz[i] &= ~subtract->channels_6ghz[i];
+	}
 }
 
 static void add_foreach(uint32_t freq, void *user_data)
@@ -511,13 +547,10 @@ static void add_foreach(uint32_t freq, void *user_data)
 uint32_t *scan_freq_set_to_fixed_array(const struct scan_freq_set *set,
 					size_t *len_out)
 {
-	uint8_t count = 0;
+	unsigned int count;
 	uint32_t *freqs;
 
-	count = __builtin_popcount(set->channels_2ghz) +
-				l_uintset_size(set->channels_5ghz) +
-				l_uintset_size(set->channels_6ghz);
-
+	count = scan_freq_set_count(set);
 	if (!count)
 		return NULL;
 
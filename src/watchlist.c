@@ -24,16 +24,153 @@
 #include <config.h>
 #endif
 
+#include <limits.h>
+#include <string.h>
 #include <ell/ell.h>
 
 #include "src/watchlist.h"
 
-static bool watchlist_item_match(const void *a, const void *b)
+#define WATCHLIST_SLOT_BITS	16
+#define WATCHLIST_SLOT_MASK	((1U << WATCHLIST_SLOT_BITS) - 1)
+#define WATCHLIST_GENERATION_MAX	(UINT_MAX >> WATCHLIST_SLOT_BITS)
+
+static unsigned int watchlist_slot_id(struct watchlist *watchlist,
+					unsigned int slot)
+{
+	unsigned int generation = watchlist->slots[slot].generation;
+
+	return (generation << WATCHLIST_SLOT_BITS) | (slot + 1);
+}
+
+static struct watchlist_item *watchlist_item_find(struct watchlist *watchlist,
+							unsigned int id)
+{
+	unsigned int slot = (id & WATCHLIST_SLOT_MASK) - 1;
+	struct watchlist_item *item;
+
+	if (!id || slot >= watchlist->slots_len)
+		return NULL;
+
+	item = watchlist->slots[slot].item;
+	if (!item || item->id != id)
+		return NULL;
+
+	return item;
+}
+
+static void watchlist_slot_push_free(struct watchlist *watchlist,
+					unsigned int slot)
+{
+	watchlist->slots[slot].next_free = 0;
+
+	if (watchlist->free_slot_tail)
+		watchlist->slots[watchlist->free_slot_tail - 1].next_free =
+								slot + 1;
+	else
+		watchlist->free_slot = slot + 1;
+
+	watchlist->free_slot_tail = slot + 1;
+}
+
+/*
+ * Once the slot array can't grow any more, put the retired slots back
+ * into use.  By then their IDs were last given out a very long time ago.
+ */
+static void watchlist_slot_reclaim(struct watchlist *watchlist)
+{
+	unsigned int i;
+
+	for (i = 0; i < watchlist->slots_len; i++)
+		if (!watchlist->slots[i].item)
+			watchlist_slot_push_free(watchlist, i);
+}
+
+static unsigned int watchlist_slot_alloc(struct watchlist *watchlist)
+{
+	unsigned int slot;
+
+	if (!watchlist->free_slot &&
+			watchlist->slots_len == WATCHLIST_SLOT_MASK)
+		watchlist_slot_reclaim(watchlist);
+
+	if (watchlist->free_slot) {
+		slot = watchlist->free_slot - 1;
+		watchlist->free_slot = watchlist->slots[slot].next_free;
+
+		if (!watchlist->free_slot)
+			watchlist->free_slot_tail = 0;
+
+		return slot;
+	}
+
+	/* Only reached with WATCHLIST_SLOT_MASK items on the list */
+	if (L_WARN_ON(watchlist->slots_len == WATCHLIST_SLOT_MASK))
+		return UINT_MAX;
+
+	if (watchlist->slots_len == watchlist->slots_size) {
+		watchlist->slots_size = watchlist->slots_size * 2 ?: 8;
+		watchlist->slots = l_realloc(watchlist->slots,
+					watchlist->slots_size *
+					sizeof(struct watchlist_slot));
+	}
+
+	slot = watchlist->slots_len++;
+	watchlist->slots[slot].generation = 0;
+	return slot;
+}
+
+static void watchlist_slot_release(struct watchlist *watchlist,
+					unsigned int slot)
+{
+	struct watchlist_slot *s = &watchlist->slots[slot];
+
+	s->item = NULL;
+
+	/* Retire the slot rather than start over with its first ID */
+	if (s->generation == WATCHLIST_GENERATION_MAX) {
+		s->generation = 0;
+		return;
+	}
+
+	s->generation++;
+	watchlist_slot_push_free(watchlist, slot);
+}
+
+static void watchlist_compact(struct watchlist *watchlist)
+{
+	unsigned int i;
+	unsigned int len = 0;
+
+	for (i = 0; i < watchlist->items_len; i++) {
+		struct watchlist_item *item = watchlist->items[i];
+
+		if (!item)
+			continue;
+
+		item->pos = len;
+		watchlist->items[len++] = item;
+	}
+
+	watchlist->items_len = len;
+	watchlist->holes = 0;
+}
+
+/* Take the item out of the arrays, leaving a hole in its place */
+static void watchlist_unlink(struct watchlist *watchlist,
+				struct watchlist_item *item)
+{
+	watchlist->items[item->pos] = NULL;
+	watchlist->holes++;
+	watchlist_slot_release(watchlist, item->slot);
+}
+
+static void watchlist_maybe_compact(struct watchlist *watchlist)
 {
-	const struct watchlist_item *item = a;
-	uint32_t id = L_PTR_TO_UINT(b);
+	if (watchlist->in_notify)
+		return;
 
-	return item->id == id;
+	if (watchlist->holes * 2 > watchlist->items_len)
+		watchlist_compact(watchlist);
 }
 
 static void watchlist_item_free(struct watchlist *watchlist,
@@ -53,7 +190,6 @@ struct watchlist *watchlist_new(const struct watchlist_ops *ops)
 	struct watchlist *watchlist;
 
 	watchlist = l_new(struct watchlist, 1);
-	watchlist->items = l_queue_new();
 	watchlist->ops = ops;
 	return watchlist;
 }
@@ -61,8 +197,7 @@ struct watchlist *watchlist_new(const struct watchlist_ops *ops)
 void watchlist_init(struct watchlist *watchlist,
 					const struct watchlist_ops *ops)
 {
-	watchlist->next_id = 0;
-	watchlist->items = l_queue_new();
+	memset(watchlist, 0, sizeof(*watchlist));
 	watchlist->ops = ops;
 }
 
@@ -71,12 +206,28 @@ unsigned int watchlist_link(struct watchlist *watchlist,
 					void *notify, void *notify_data,
 					watchlist_item_destroy_func_t destroy)
 {
-	item->id = ++watchlist->next_id;
+	unsigned int slot = watchlist_slot_alloc(watchlist);
+
+	if (slot == UINT_MAX)
+		return 0;
+
+	if (watchlist->items_len == watchlist->items_size) {
+		watchlist->items_size = watchlist->items_size * 2 ?: 8;
+		watchlist->items = l_realloc(watchlist->items,
+					watchlist->items_size *
+					sizeof(struct watchlist_item *));
+	}
+
+	watchlist->slots[slot].item = item;
+
+	item->id = watchlist_slot_id(watchlist, slot);
 	item->notify = notify;
 	item->notify_data = notify_data;
 	item->destroy = destroy;
+	item->slot = slot;
+	item->pos = watchlist->items_len;
 
-	l_queue_push_tail(watchlist->items, item);
+	watchlist->items[watchlist->items_len++] = item;
 
 	return item->id;
 }
@@ -86,43 +237,106 @@ unsigned int watchlist_add(struct watchlist *watchlist, void *notify,
 					watchlist_item_destroy_func_t destroy)
 {
 	struct watchlist_item *item;
+	unsigned int id;
 
 	item = l_new(struct watchlist_item, 1);
-	return watchlist_link(watchlist, item, notify, notify_data, destroy);
+	id = watchlist_link(watchlist, item, notify, notify_data, destroy);
+
+	if (!id)
+		l_free(item);
+
+	return id;
 }
 
-bool watchlist_remove(struct watchlist *watchlist, unsigned int id)
+/*
+ * Mark the item to be removed once the current notify loop is over.  It
+ * is not notified anymore but keeps its place in the arrays until then.
+ */
+void watchlist_mark_stale(struct watchlist *watchlist,
+				struct watchlist_item *item)
 {
-	struct watchlist_item *item;
+	item->id = 0;
+	watchlist->stale_items = true;
+}
 
-	if (watchlist->in_notify) {
-		item = l_queue_find(watchlist->items, watchlist_item_match,
-							L_UINT_TO_PTR(id));
-		if (!item)
-			return false;
+bool watchlist_remove(struct watchlist *watchlist, unsigned int id)
+{
+	struct watchlist_item *item = watchlist_item_find(watchlist, id);
 
-		item->id = 0;	/* Mark stale */
-		watchlist->stale_items = true;
+	if (!item)
+		return false;
 
+	if (watchlist->in_notify) {
+		watchlist_mark_stale(watchlist, item);
 		return true;
 	}
 
-	item = l_queue_remove_if(watchlist->items, watchlist_item_match,
-							L_UINT_TO_PTR(id));
-	if (!item)
-		return false;
-
+	watchlist_unlink(watchlist, item);
+	watchlist_maybe_compact(watchlist);
 	watchlist_item_free(watchlist, item);
 
 	return true;
 }
 
+/*
+ * Like l_queue_foreach_remove, @function is responsible for freeing the
+ * items for which it returns true.
+ */
+unsigned int watchlist_foreach_remove(struct watchlist *watchlist,
+					watchlist_remove_func_t function,
+					void *user_data)
+{
+	unsigned int i;
+	unsigned int count = 0;
+
+	for (i = 0; i < watchlist->items_len; i++) {
+		struct watchlist_item *item = watchlist->items[i];
+		unsigned int slot;
+
+		if (!item)
+			continue;
+
+		slot = item->slot;
+
+		if (!function(item, user_data))
+			continue;
+
+		watchlist->items[i] = NULL;
+		watchlist->holes++;
+		watchlist_slot_release(watchlist, slot);
+		count++;
+	}
+
+	watchlist_maybe_compact(watchlist);
+	return count;
+}
+
 static void watchlist_clear(struct watchlist *watchlist)
 {
-	struct watchlist_item *item;
+	unsigned int i;
+
+	for (i = 0; i < watchlist->items_len; i++) {
+		struct watchlist_item *item = watchlist->items[i];
+
+		if (!item)
+			continue;
 
-	while ((item = l_queue_pop_head(watchlist->items)))
+		watchlist->items[i] = NULL;
+		watchlist_slot_release(watchlist, item->slot);
 		watchlist_item_free(watchlist, item);
+	}
+
+	l_free(watchlist->items);
+	watchlist->items = NULL;
+	watchlist->items_len = 0;
+	watchlist->items_size = 0;
+	watchlist->holes = 0;
+	l_free(watchlist->slots);
+	watchlist->slots = NULL;
+	watchlist->slots_len = 0;
+	watchlist->slots_size = 0;
+	watchlist->free_slot = 0;
+	watchlist->free_slot_tail = 0;
 }
 
 void watchlist_destroy(struct watchlist *watchlist)
@@ -133,24 +347,43 @@ void watchlist_destroy(struct watchlist *watchlist)
 	}
 
 	watchlist_clear(watchlist);
-	l_queue_destroy(watchlist->items, NULL);
-	watchlist->items = NULL;
 }
 
 void watchlist_free(struct watchlist *watchlist)
 {
 	watchlist_clear(watchlist);
-	l_queue_destroy(watchlist->items, NULL);
 	l_free(watchlist);
 }
 
 void __watchlist_prune_stale(struct watchlist *watchlist)
 {
+	unsigned int i;
+	struct l_queue *stale = NULL;
 	struct watchlist_item *item;
 
-	while ((item = l_queue_remove_if(watchlist->items, watchlist_item_match,
-							L_UINT_TO_PTR(0))))
-		watchlist_item_free(watchlist, item);
+	/*
+	 * Unlink everything first so that the list is consistent by the
+	 * time the destroy callbacks run, these may modify the watchlist.
+	 */
+	for (i = 0; i < watchlist->items_len; i++) {
+		item = watchlist->items[i];
+
+		if (!item || item->id != 0)
+			continue;
+
+		watchlist_unlink(watchlist, item);
+
+		if (!stale)
+			stale = l_queue_new();
+
+		l_queue_push_tail(stale, item);
+	}
 
 	watchlist->stale_items = false;
+	watchlist_maybe_compact(watchlist);
+
+	while ((item = l_queue_pop_head(stale)))
+		watchlist_item_free(watchlist, item);
+
+	l_queue_destroy(stale, NULL);
 }
@@ -27,21 +27,50 @@ struct watchlist_item {
 	void *notify;
 	void *notify_data;
 	watchlist_item_destroy_func_t destroy;
+	unsigned int slot;	/* Index in watchlist.slots */
+	unsigned int pos;	/* Index in watchlist.items */
 };
 
 struct watchlist_ops {
 	void (*item_free)(struct watchlist_item *item);
 };
 
+/*
+ * The items are kept in an array in the order they were added, which is
+ * the order they are notified in.  Removed items leave a NULL hole that
+ * is compacted away later, never while in a notify loop, so that removal
+ * is O(1) and iterating by index is safe against removals and additions.
+ * The IDs are the index in a separate slot array plus a generation
+ * counter so that looking items up by ID is O(1) too.  Free slots are
+ * reused oldest first and retired once their generation runs out, so an
+ * ID is only given out again after about as many additions as with a
+ * plain 32-bit counter.
+ */
+struct watchlist_slot {
+	struct watchlist_item *item;
+	unsigned int generation;
+	unsigned int next_free;
+};
+
 struct watchlist {
-	int next_id;
-	struct l_queue *items;
+	struct watchlist_item **items;
+	unsigned int items_len;
+	unsigned int items_size;
+	unsigned int holes;
+	struct watchlist_slot *slots;
+	unsigned int slots_len;
+	unsigned int slots_size;
+	unsigned int free_slot;		/* 1-based, 0 means none */
+	unsigned int free_slot_tail;
 	bool in_notify : 1;
 	bool stale_items : 1;
 	bool pending_destroy : 1;
 	const struct watchlist_ops *ops;
 };
 
+typedef bool (*watchlist_remove_func_t)(struct watchlist_item *item,
+					void *user_data);
+
 struct watchlist *watchlist_new(const struct watchlist_ops *ops);
 void watchlist_init(struct watchlist *watchlist,
 					const struct watchlist_ops *ops);
@@ -53,6 +82,11 @@ unsigned int watchlist_link(struct watchlist *watchlist,
 					void *notify, void *notify_data,
 					watchlist_item_destroy_func_t destroy);
 bool watchlist_remove(struct watchlist *watchlist, unsigned int id);
+void watchlist_mark_stale(struct watchlist *watchlist,
+					struct watchlist_item *item);
+unsigned int watchlist_foreach_remove(struct watchlist *watchlist,
+					watchlist_remove_func_t function,
+					void *user_data);
 void watchlist_destroy(struct watchlist *watchlist);
 void watchlist_free(struct watchlist *watchlist);
 
@@ -61,15 +95,15 @@ void __watchlist_prune_stale(struct watchlist *watchlist);
 #define WATCHLIST_NOTIFY(list, type, args...)				\
 	do {								\
 		struct watchlist *watchlist = (list);			\
-		const struct l_queue_entry *entry =			\
-				l_queue_get_entries(watchlist->items);	\
+		unsigned int _i;					\
 									\
 		watchlist->in_notify = true;				\
-		for (; entry; entry = entry->next) {			\
-			struct watchlist_item *item = entry->data;	\
-			type t = item->notify;				\
-			if (item->id == 0)				\
+		for (_i = 0; _i < watchlist->items_len; _i++) {		\
+			struct watchlist_item *item = watchlist->items[_i]; \
+			type t;						\
+			if (!item || item->id == 0)			\
 				continue;				\
+			t = item->notify;				\
 			t(args, item->notify_data);			\
 			if (watchlist->pending_destroy)			\
 				break;					\
@@ -84,16 +118,16 @@ void __watchlist_prune_stale(struct watchlist *watchlist);
 #define WATCHLIST_NOTIFY_MATCHES(list, match, match_data, type, args...) \
 	do {								\
 		struct watchlist *watchlist = (list);			\
-		const struct l_queue_entry *entry =			\
-				l_queue_get_entries(watchlist->items);	\
+		unsigned int _i;					\
 									\
 		watchlist->in_notify = true;				\
-		for (; entry; entry = entry->next) {			\
-			struct watchlist_item *item = entry->data;	\
-			type t = item->notify;				\
+		for (_i = 0; _i < watchlist->items_len; _i++) {		\
+			struct watchlist_item *item = watchlist->items[_i]; \
+			type t;						\
 									\
-			if (item->id == 0)				\
+			if (!item || item->id == 0)			\
 				continue;				\
+			t = item->notify;				\
 			if (!match(item, match_data))			\
 				continue;				\
 									\
@@ -112,15 +146,15 @@ void __watchlist_prune_stale(struct watchlist *watchlist);
 #define WATCHLIST_NOTIFY_NO_ARGS(list, type)				\
 	do {								\
 		struct watchlist *watchlist = (list);			\
-		const struct l_queue_entry *entry =			\
-				l_queue_get_entries(watchlist->items);	\
+		unsigned int _i;					\
 									\
 		watchlist->in_notify = true;				\
-		for (; entry; entry = entry->next) {			\
-			struct watchlist_item *item = entry->data;	\
-			type t = item->notify;				\
-			if (item->id == 0)				\
+		for (_i = 0; _i < watchlist->items_len; _i++) {		\
+			struct watchlist_item *item = watchlist->items[_i]; \
+			type t;						\
+			if (!item || item->id == 0)			\
 				continue;				\
+			t = item->notify;				\
 			t(item->notify_data);				\
 			if (watchlist->pending_destroy)			\
 				break;					\
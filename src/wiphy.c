@@ -56,8 +56,12 @@
 #include "src/nl80211util.h"
 #include "src/nl80211cmd.h"
 #include "src/band.h"
+#include "src/profile.h"
 
-#define EXT_CAP_LEN 10
+#define EXT_CAP_LEN 11
+
+/* Completed work items per type the wait and run time percentiles cover */
+#define WIPHY_WORK_SAMPLES 64
 
 static struct l_genl_family *nl80211 = NULL;
 static struct l_hwdb *hwdb;
@@ -66,6 +70,7 @@ static char **blacklist_filter;
 static int mac_randomize_bytes = 6;
 static char regdom_country[2];
 static uint32_t work_ids;
+static unsigned int radio_duty_cycle;
 
 enum driver_flag {
 	DEFAULT_IF = 0x1,
@@ -92,6 +97,12 @@ static const struct driver_info driver_infos[] = {
 	{ "bcmsdh_sdmmc",    DEFAULT_IF },
 };
 
+struct wiphy_work_stats {
+	uint32_t count;
+	uint32_t wait_ms[WIPHY_WORK_SAMPLES];
+	uint32_t run_ms[WIPHY_WORK_SAMPLES];
+};
+
 struct wiphy {
 	uint32_t id;
 	char name[20];
@@ -99,7 +110,15 @@ struct wiphy {
 	uint32_t feature_flags;
 	uint8_t ext_features[(NUM_NL80211_EXT_FEATURES + 7) / 8];
 	uint8_t max_num_ssids_per_scan;
+	uint8_t max_num_sched_ssids;
+	uint8_t max_match_sets;
+	uint32_t max_sched_scan_plans;
+	uint32_t max_scan_plan_interval;
+	uint32_t max_scan_plan_iterations;
+	uint32_t wowlan_triggers;
+	uint32_t wowlan_max_nd_match_sets;
 	uint32_t max_roc_duration;
+	uint32_t probe_resp_offload;
 	uint16_t max_scan_ie_len;
 	uint16_t supported_iftypes;
 	uint16_t supported_ciphers;
@@ -120,6 +139,13 @@ struct wiphy {
 	/* Work queue for this radio */
 	struct l_queue *work;
 	bool work_in_callback;
+	/* Duty cycle budget, see wiphy_budget_refill */
+	unsigned int budget_users;
+	int64_t budget_us;
+	uint64_t budget_time;
+	uint64_t budget_work_start;
+	struct l_timeout *budget_timeout;
+	struct wiphy_work_stats work_stats[__WIPHY_WORK_TYPE_MAX];
 
 	bool support_scheduled_scan:1;
 	bool support_rekey_offload:1;
@@ -135,6 +161,8 @@ struct wiphy {
 };
 
 static struct l_queue *wiphy_list = NULL;
+/* wiphy_list indexed by wiphy id, wiphy_find runs for every NEW_WIPHY part */
+static struct l_hashmap *wiphy_index;
 
 enum ie_rsn_cipher_suite wiphy_select_cipher(struct wiphy *wiphy, uint16_t mask)
 {
@@ -363,20 +391,13 @@ static void wiphy_free(void *data)
 	l_free(wiphy->driver_str);
 	l_genl_family_free(wiphy->nl80211);
 	l_queue_destroy(wiphy->work, destroy_work);
+	l_timeout_remove(wiphy->budget_timeout);
 	l_free(wiphy);
 }
 
-static bool wiphy_match(const void *a, const void *b)
-{
-	const struct wiphy *wiphy = a;
-	uint32_t id = L_PTR_TO_UINT(b);
-
-	return (wiphy->id == id);
-}
-
 struct wiphy *wiphy_find(int wiphy_id)
 {
-	return l_queue_find(wiphy_list, wiphy_match, L_UINT_TO_PTR(wiphy_id));
+	return l_hashmap_lookup(wiphy_index, L_UINT_TO_PTR(wiphy_id));
 }
 
 bool wiphy_is_blacklisted(const struct wiphy *wiphy)
@@ -528,11 +549,56 @@ uint16_t wiphy_get_max_scan_ie_len(struct wiphy *wiphy)
 	return wiphy->max_scan_ie_len;
 }
 
+bool wiphy_supports_sched_scan(struct wiphy *wiphy)
+{
+	return wiphy->support_scheduled_scan && wiphy->max_match_sets &&
+		wiphy->max_sched_scan_plans;
+}
+
+uint8_t wiphy_get_max_num_sched_ssids(struct wiphy *wiphy)
+{
+	return wiphy->max_num_sched_ssids;
+}
+
+uint8_t wiphy_get_max_match_sets(struct wiphy *wiphy)
+{
+	return wiphy->max_match_sets;
+}
+
+void wiphy_get_sched_scan_plan_limits(struct wiphy *wiphy,
+					uint32_t *max_plans,
+					uint32_t *max_interval,
+					uint32_t *max_iterations)
+{
+	*max_plans = wiphy->max_sched_scan_plans;
+	*max_interval = wiphy->max_scan_plan_interval;
+	*max_iterations = wiphy->max_scan_plan_iterations;
+}
+
+bool wiphy_supports_wowlan_trigger(struct wiphy *wiphy,
+					uint32_t trigger)
+{
+	if (trigger >= 32)
+		return false;
+
+	return wiphy->wowlan_triggers & (1U << trigger);
+}
+
+uint32_t wiphy_get_wowlan_max_nd_match_sets(struct wiphy *wiphy)
+{
+	return wiphy->wowlan_max_nd_match_sets;
+}
+
 uint32_t wiphy_get_max_roc_duration(struct wiphy *wiphy)
 {
 	return wiphy->max_roc_duration;
 }
 
+uint32_t wiphy_get_probe_resp_offload(struct wiphy *wiphy)
+{
+	return wiphy->probe_resp_offload;
+}
+
 bool wiphy_supports_adhoc_rsn(struct wiphy *wiphy)
 {
 	return wiphy->support_adhoc_rsn;
@@ -784,6 +850,8 @@ int wiphy_estimate_data_rate(struct wiphy *wiphy,
 	struct ie_tlv_iter iter;
 	const void *supported_rates = NULL;
 	const void *ext_supported_rates = NULL;
+	const void *he_capabilities = NULL;
+	const void *he_operation = NULL;
 	const void *vht_capabilities = NULL;
 	const void *vht_operation = NULL;
 	const void *ht_capabilities = NULL;
@@ -811,7 +879,7 @@ int wiphy_estimate_data_rate(struct wiphy *wiphy,
 	ie_tlv_iter_init(&iter, ies, ies_len);
 
 	while (ie_tlv_iter_next(&iter)) {
-		uint8_t tag = ie_tlv_iter_get_tag(&iter);
+		unsigned int tag = ie_tlv_iter_get_tag(&iter);
 
 		switch (tag) {
 		case IE_TYPE_SUPPORTED_RATES:
@@ -847,11 +915,23 @@ int wiphy_estimate_data_rate(struct wiphy *wiphy,
 
 			vht_operation = iter.data - 2;
 			break;
+		case IE_TYPE_HE_CAPABILITIES:
+			he_capabilities = iter.data - 3;
+			break;
+		case IE_TYPE_HE_OPERATION:
+			he_operation = iter.data - 3;
+			break;
 		default:
 			break;
 		}
 	}
 
+	if (!band_estimate_he_rx_rate(bandp, he_capabilities, he_operation,
+					vht_operation, ht_operation,
+					bss->signal_strength / 100,
+					out_data_rate))
+		return 0;
+
 	if (!band_estimate_vht_rx_rate(bandp, vht_capabilities, vht_operation,
 					ht_capabilities, ht_operation,
 					bss->signal_strength / 100,
@@ -1188,10 +1268,68 @@ static struct band *band_new_from_message(struct l_genl_attr *band)
 	ret = l_malloc(toalloc);
 	memset(ret, 0, toalloc);
 	memset(ret->vht_mcs_set, 0xff, sizeof(ret->vht_mcs_set));
+	memset(ret->he_mcs_set, 0xff, sizeof(ret->he_mcs_set));
 
 	return ret;
 }
 
+static void parse_band_iftype_data(struct band *band,
+					struct l_genl_attr *array)
+{
+	struct l_genl_attr entry;
+	struct l_genl_attr iftypes;
+	uint16_t type;
+	uint16_t len;
+	const void *data;
+
+	while (l_genl_attr_next(array, NULL, NULL, NULL)) {
+		const void *phy = NULL;
+		const void *mcs = NULL;
+		uint16_t mcs_len = 0;
+		bool station = false;
+
+		if (!l_genl_attr_recurse(array, &entry))
+			continue;
+
+		while (l_genl_attr_next(&entry, &type, &len, &data)) {
+			switch (type) {
+			case NL80211_BAND_IFTYPE_ATTR_IFTYPES:
+				if (!l_genl_attr_recurse(&entry, &iftypes))
+					break;
+
+				while (l_genl_attr_next(&iftypes, &type,
+								NULL, NULL))
+					if (type == NL80211_IFTYPE_STATION)
+						station = true;
+
+				break;
+			case NL80211_BAND_IFTYPE_ATTR_HE_CAP_PHY:
+				if (L_WARN_ON(len != sizeof(band->he_phy_capa)))
+					break;
+
+				phy = data;
+				break;
+			case NL80211_BAND_IFTYPE_ATTR_HE_CAP_MCS_SET:
+				if (L_WARN_ON(len < 4 ||
+						len > sizeof(band->he_mcs_set)))
+					break;
+
+				mcs = data;
+				mcs_len = len;
+				break;
+			}
+		}
+
+		/* Rate estimation is only done for station mode */
+		if (!station || !phy || !mcs)
+			continue;
+
+		memcpy(band->he_phy_capa, phy, sizeof(band->he_phy_capa));
+		memcpy(band->he_mcs_set, mcs, mcs_len);
+		band->he_supported = true;
+	}
+}
+
 static void parse_supported_bands(struct wiphy *wiphy,
 						struct l_genl_attr *bands)
 {
@@ -1236,6 +1374,7 @@ static void parse_supported_bands(struct wiphy *wiphy,
 
 		while (l_genl_attr_next(&attr, &type, &len, &data)) {
 			struct l_genl_attr freqs;
+			struct l_genl_attr nested;
 
 			switch (type) {
 			case NL80211_BAND_ATTR_FREQS:
@@ -1282,6 +1421,12 @@ static void parse_supported_bands(struct wiphy *wiphy,
 				memcpy(band->ht_capabilities, data, len);
 				band->ht_supported = true;
 				break;
+			case NL80211_BAND_ATTR_IFTYPE_DATA:
+				if (!l_genl_attr_recurse(&attr, &nested))
+					continue;
+
+				parse_band_iftype_data(band, &nested);
+				break;
 			}
 		}
 
@@ -1310,6 +1455,30 @@ static void parse_supported_iftypes(struct wiphy *wiphy,
 	}
 }
 
+static void parse_wowlan_triggers(struct wiphy *wiphy,
+					struct l_genl_attr *attr)
+{
+	uint16_t type, len;
+	const void *data;
+
+	while (l_genl_attr_next(attr, &type, &len, &data)) {
+		if (type >= 32)
+			continue;
+
+		if (type == NL80211_WOWLAN_TRIG_NET_DETECT) {
+			if (len != sizeof(uint32_t)) {
+				l_warn("Invalid WOWLAN_TRIG_NET_DETECT "
+					"attribute");
+				continue;
+			}
+
+			wiphy->wowlan_max_nd_match_sets = *((uint32_t *) data);
+		}
+
+		wiphy->wowlan_triggers |= 1U << type;
+	}
+}
+
 static void parse_iftype_extended_capabilities(struct wiphy *wiphy,
 						struct l_genl_attr *attr)
 {
@@ -1401,6 +1570,48 @@ static void wiphy_parse_attributes(struct wiphy *wiphy,
 			else
 				wiphy->max_scan_ie_len = *((uint16_t *) data);
 			break;
+		case NL80211_ATTR_MAX_NUM_SCHED_SCAN_SSIDS:
+			if (len != sizeof(uint8_t))
+				l_warn("Invalid MAX_NUM_SCHED_SCAN_SSIDS "
+					"attribute");
+			else
+				wiphy->max_num_sched_ssids =
+							*((uint8_t *) data);
+			break;
+		case NL80211_ATTR_MAX_MATCH_SETS:
+			if (len != sizeof(uint8_t))
+				l_warn("Invalid MAX_MATCH_SETS attribute");
+			else
+				wiphy->max_match_sets = *((uint8_t *) data);
+			break;
+		case NL80211_ATTR_MAX_NUM_SCHED_SCAN_PLANS:
+			if (len != sizeof(uint32_t))
+				l_warn("Invalid MAX_NUM_SCHED_SCAN_PLANS "
+					"attribute");
+			else
+				wiphy->max_sched_scan_plans =
+							*((uint32_t *) data);
+			break;
+		case NL80211_ATTR_MAX_SCAN_PLAN_INTERVAL:
+			if (len != sizeof(uint32_t))
+				l_warn("Invalid MAX_SCAN_PLAN_INTERVAL "
+					"attribute");
+			else
+				wiphy->max_scan_plan_interval =
+							*((uint32_t *) data);
+			break;
+		case NL80211_ATTR_MAX_SCAN_PLAN_ITERATIONS:
+			if (len != sizeof(uint32_t))
+				l_warn("Invalid MAX_SCAN_PLAN_ITERATIONS "
+					"attribute");
+			else
+				wiphy->max_scan_plan_iterations =
+							*((uint32_t *) data);
+			break;
+		case NL80211_ATTR_WOWLAN_TRIGGERS_SUPPORTED:
+			if (l_genl_attr_recurse(&attr, &nested))
+				parse_wowlan_triggers(wiphy, &nested);
+			break;
 		case NL80211_ATTR_SUPPORT_IBSS_RSN:
 			wiphy->support_adhoc_rsn = true;
 			break;
@@ -1427,6 +1638,13 @@ static void wiphy_parse_attributes(struct wiphy *wiphy,
 			else
 				wiphy->max_roc_duration = *((uint32_t *) data);
 			break;
+		case NL80211_ATTR_PROBE_RESP_OFFLOAD:
+			if (len != 4)
+				l_warn("Invalid PROBE_RESP_OFFLOAD attribute");
+			else
+				wiphy->probe_resp_offload =
+							*((uint32_t *) data);
+			break;
 		case NL80211_ATTR_ROAM_SUPPORT:
 			wiphy->support_fw_roam = true;
 			break;
@@ -1548,6 +1766,7 @@ struct wiphy *wiphy_create(uint32_t wiphy_id, const char *name)
 	l_strlcpy(wiphy->name, name, sizeof(wiphy->name));
 	wiphy->nl80211 = l_genl_family_new(genl, NL80211_GENL_NAME);
 	l_queue_push_head(wiphy_list, wiphy);
+	l_hashmap_replace(wiphy_index, L_UINT_TO_PTR(wiphy_id), wiphy, NULL);
 
 	if (!wiphy_is_managed(name))
 		wiphy->blacklisted = true;
@@ -1617,6 +1836,11 @@ static void wiphy_set_station_capability_bits(struct wiphy *wiphy)
 
 	/* Set FILS */
 	set_bit(ext_capa + 2, 72);
+
+	/* Set Beacon Protection Enabled, the AP then sends us the BIGTK */
+	if (wiphy_has_ext_feature(wiphy,
+				NL80211_EXT_FEATURE_BEACON_PROTECTION_CLIENT))
+		set_bit(ext_capa + 2, 84);
 }
 
 static void wiphy_setup_rm_enabled_capabilities(struct wiphy *wiphy)
@@ -1726,6 +1950,8 @@ bool wiphy_destroy(struct wiphy *wiphy)
 	if (!l_queue_remove(wiphy_list, wiphy))
 		return false;
 
+	l_hashmap_remove(wiphy_index, L_UINT_TO_PTR(wiphy->id));
+
 	if (wiphy->registered)
 		l_dbus_unregister_object(dbus_get_bus(), wiphy_get_path(wiphy));
 
@@ -1885,8 +2111,113 @@ static bool wiphy_property_get_supported_modes(struct l_dbus *dbus,
 	return true;
 }
 
+static const char *wiphy_work_type_to_str(enum wiphy_radio_work_type type)
+{
+	switch (type) {
+	case WIPHY_WORK_TYPE_OTHER:
+		return "other";
+	case WIPHY_WORK_TYPE_SCAN:
+		return "scan";
+	case WIPHY_WORK_TYPE_CONNECT:
+		return "connect";
+	case WIPHY_WORK_TYPE_FT:
+		return "ft";
+	case WIPHY_WORK_TYPE_FRAME_XCHG:
+		return "frame-xchg";
+	case WIPHY_WORK_TYPE_OFFCHANNEL:
+		return "offchannel";
+	case __WIPHY_WORK_TYPE_MAX:
+		break;
+	}
+
+	return NULL;
+}
+
+static int wiphy_work_sample_compare(const void *a, const void *b)
+{
+	uint32_t sa = *(const uint32_t *) a;
+	uint32_t sb = *(const uint32_t *) b;
+
+	if (sa != sb)
+		return sa < sb ? -1 : 1;
+
+	return 0;
+}
+
+static void wiphy_work_stats_append(struct l_dbus_message_builder *builder,
+					const char *prefix,
+					const uint32_t *samples,
+					unsigned int n)
+{
+	static const struct {
+		const char *suffix;
+		unsigned int percentile;
+	} points[] = {
+		{ "Median", 50 },
+		{ "90th", 90 },
+		{ "99th", 99 },
+		{ "Max", 100 },
+	};
+	uint32_t sorted[WIPHY_WORK_SAMPLES];
+	char key[32];
+	unsigned int i;
+
+	memcpy(sorted, samples, n * sizeof(uint32_t));
+	qsort(sorted, n, sizeof(uint32_t), wiphy_work_sample_compare);
+
+	for (i = 0; i < L_ARRAY_SIZE(points); i++) {
+		snprintf(key, sizeof(key), "%s%s", prefix, points[i].suffix);
+		dbus_append_dict_basic(builder, key, 'u',
+				&sorted[(n - 1) * points[i].percentile / 100]);
+	}
+}
+
+static struct l_dbus_message *wiphy_get_work_statistics(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct wiphy *wiphy = user_data;
+	struct l_dbus_message *reply;
+	struct l_dbus_message_builder *builder;
+	unsigned int type;
+
+	reply = l_dbus_message_new_method_return(message);
+	builder = l_dbus_message_builder_new(reply);
+	l_dbus_message_builder_enter_array(builder, "{sa{sv}}");
+
+	for (type = 0; type < __WIPHY_WORK_TYPE_MAX; type++) {
+		const struct wiphy_work_stats *stats = &wiphy->work_stats[type];
+		unsigned int n = L_MIN(stats->count, WIPHY_WORK_SAMPLES);
+
+		if (!n)
+			continue;
+
+		l_dbus_message_builder_enter_dict(builder, "sa{sv}");
+		l_dbus_message_builder_append_basic(builder, 's',
+						wiphy_work_type_to_str(type));
+		l_dbus_message_builder_enter_array(builder, "{sv}");
+
+		dbus_append_dict_basic(builder, "Count", 'u', &stats->count);
+		wiphy_work_stats_append(builder, "Wait", stats->wait_ms, n);
+		wiphy_work_stats_append(builder, "Run", stats->run_ms, n);
+
+		l_dbus_message_builder_leave_array(builder);
+		l_dbus_message_builder_leave_dict(builder);
+	}
+
+	l_dbus_message_builder_leave_array(builder);
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
 static void setup_wiphy_interface(struct l_dbus_interface *interface)
 {
+	l_dbus_interface_method(interface, "GetWorkStatistics", 0,
+				wiphy_get_work_statistics, "a{sa{sv}}", "",
+				"statistics");
+
 	l_dbus_interface_property(interface, "Powered", 0, "b",
 					wiphy_property_get_powered,
 					wiphy_property_set_powered);
@@ -1904,6 +2235,7 @@ static void setup_wiphy_interface(struct l_dbus_interface *interface)
 static void wiphy_reg_notify(struct l_genl_msg *msg, void *user_data)
 {
 	uint8_t cmd = l_genl_msg_get_command(msg);
+	PROFILE_CALLBACK();
 
 	l_debug("Notification of command %s(%u)",
 		nl80211cmd_to_string(cmd), cmd);
@@ -1931,6 +2263,143 @@ static void wiphy_reg_notify(struct l_genl_msg *msg, void *user_data)
 	}
 }
 
+/*
+ * While a station is connected with a good signal, work items at
+ * WIPHY_WORK_PRIORITY_BUDGET or less urgent, i.e. scans, may only keep the
+ * radio busy [Scan].MaxDutyCycle percent of the time.  The budget is a
+ * token bucket refilled at that rate, holding up to WIPHY_BUDGET_BURST
+ * worth of radio time, and charged with the duration of every budgeted
+ * item.  While it is exhausted the next budgeted item waits at the head of
+ * the queue.  More urgent work still goes first and scan requests made in
+ * the meantime get coalesced with the waiting one.
+ */
+#define WIPHY_BUDGET_BURST	(1 * L_USEC_PER_SEC)
+
+static void wiphy_radio_work_next(struct wiphy *wiphy);
+
+/*
+ * Records how long a finished item waited in the queue before first
+ * getting the radio, and how long it held it from then on, including
+ * any time spent preempted.
+ */
+static void wiphy_radio_work_account(struct wiphy *wiphy,
+				const struct wiphy_radio_work_item *item)
+{
+	struct wiphy_work_stats *stats = &wiphy->work_stats[item->ops->type];
+	unsigned int idx;
+	uint64_t wait;
+	uint64_t run;
+
+	/* Cancelled before it was ever started */
+	if (!item->start_time)
+		return;
+
+	wait = l_time_diff(item->insert_time, item->start_time);
+	run = l_time_diff(item->start_time, l_time_now());
+
+	idx = stats->count++ % WIPHY_WORK_SAMPLES;
+	stats->wait_ms[idx] = L_MIN(wait / L_USEC_PER_MSEC, UINT32_MAX);
+	stats->run_ms[idx] = L_MIN(run / L_USEC_PER_MSEC, UINT32_MAX);
+
+	l_debug("Work item %u (%s) waited %u ms, ran %u ms", item->id,
+			wiphy_work_type_to_str(item->ops->type),
+			stats->wait_ms[idx], stats->run_ms[idx]);
+}
+
+static bool wiphy_budget_applies(struct wiphy *wiphy,
+				const struct wiphy_radio_work_item *work)
+{
+	return radio_duty_cycle && wiphy->budget_users && work->budgeted;
+}
+
+static void wiphy_budget_refill(struct wiphy *wiphy)
+{
+	int64_t max = WIPHY_BUDGET_BURST * radio_duty_cycle / 100;
+	uint64_t now = l_time_now();
+
+	if (wiphy->budget_time)
+		wiphy->budget_us += l_time_diff(wiphy->budget_time, now) *
+						radio_duty_cycle / 100;
+	else
+		wiphy->budget_us = max;
+
+	if (wiphy->budget_us > max)
+		wiphy->budget_us = max;
+
+	wiphy->budget_time = now;
+}
+
+/* Called once the budgeted item at the head stops using the radio */
+static void wiphy_budget_charge(struct wiphy *wiphy)
+{
+	uint64_t busy;
+
+	if (!wiphy->budget_work_start)
+		return;
+
+	wiphy_budget_refill(wiphy);
+	busy = l_time_diff(wiphy->budget_work_start, l_time_now());
+	wiphy->budget_us -= (int64_t) busy;
+	wiphy->budget_work_start = 0;
+}
+
+static bool wiphy_radio_work_head_waiting(struct wiphy *wiphy)
+{
+	struct wiphy_radio_work_item *work = l_queue_peek_head(wiphy->work);
+
+	return work && work->priority != INT_MIN && !wiphy->work_in_callback;
+}
+
+static void wiphy_budget_timeout(struct l_timeout *timeout, void *user_data)
+{
+	struct wiphy *wiphy = user_data;
+
+	l_timeout_remove(l_steal_ptr(wiphy->budget_timeout));
+
+	if (wiphy_radio_work_head_waiting(wiphy))
+		wiphy_radio_work_next(wiphy);
+}
+
+static void wiphy_budget_defer(struct wiphy *wiphy)
+{
+	unsigned int ms;
+
+	if (wiphy->budget_timeout)
+		return;
+
+	ms = -wiphy->budget_us * 100 / radio_duty_cycle / L_USEC_PER_MSEC + 1;
+
+	l_debug("Radio budget exhausted, deferring work for %u ms", ms);
+
+	wiphy->budget_timeout = l_timeout_create_ms(ms, wiphy_budget_timeout,
+							wiphy, NULL);
+}
+
+/*
+ * Called by station with @enforce set while a connection with a good
+ * signal should be protected from background work, and cleared again
+ * otherwise, e.g. when it needs to roam.
+ */
+void wiphy_radio_work_set_budget(struct wiphy *wiphy, bool enforce)
+{
+	if (enforce) {
+		wiphy->budget_users++;
+		return;
+	}
+
+	if (L_WARN_ON(!wiphy->budget_users) || --wiphy->budget_users)
+		return;
+
+	/* Release work waiting for the budget */
+	if (!wiphy->budget_timeout)
+		return;
+
+	l_timeout_remove(l_steal_ptr(wiphy->budget_timeout));
+
+	if (wiphy_radio_work_head_waiting(wiphy))
+		wiphy_radio_work_next(wiphy);
+}
+
 static void wiphy_radio_work_next(struct wiphy *wiphy)
 {
 	struct wiphy_radio_work_item *work;
@@ -1940,12 +2409,27 @@ static void wiphy_radio_work_next(struct wiphy *wiphy)
 	if (!work)
 		return;
 
+	if (wiphy_budget_applies(wiphy, work)) {
+		wiphy_budget_refill(wiphy);
+
+		if (wiphy->budget_us < 0) {
+			wiphy_budget_defer(wiphy);
+			return;
+		}
+
+		wiphy->budget_work_start = l_time_now();
+	}
+
 	/*
 	 * Ensures no other work item will get inserted before this one while
 	 * the work is being done.
 	 */
+	work->start_priority = work->priority;
 	work->priority = INT_MIN;
 
+	if (!work->start_time)
+		work->start_time = l_time_now();
+
 	l_debug("Starting work item %u", work->id);
 
 	wiphy->work_in_callback = true;
@@ -1953,8 +2437,10 @@ static void wiphy_radio_work_next(struct wiphy *wiphy)
 	wiphy->work_in_callback = false;
 
 	if (done) {
+		wiphy_radio_work_account(wiphy, work);
 		work->id = 0;
 
+		wiphy_budget_charge(wiphy);
 		l_queue_remove(wiphy->work, work);
 
 		wiphy->work_in_callback = true;
@@ -1976,20 +2462,81 @@ static int insert_by_priority(const void *a, const void *b, void *user_data)
 	return -1;
 }
 
+static bool wiphy_radio_work_preempt(struct wiphy *wiphy, int priority)
+{
+	struct wiphy_radio_work_item *work = l_queue_peek_head(wiphy->work);
+
+	if (!work || work->priority != INT_MIN || wiphy->work_in_callback)
+		return false;
+
+	if (priority != WIPHY_WORK_PRIORITY_PREEMPT ||
+			priority >= work->start_priority)
+		return false;
+
+	if (!work->ops->preempt || !work->ops->preempt(work))
+		return false;
+
+	l_debug("Preempted work item %u", work->id);
+
+	wiphy_budget_charge(wiphy);
+
+	/* Requeue behind the new item, ahead of anything less urgent */
+	l_queue_pop_head(wiphy->work);
+	work->priority = work->start_priority;
+	l_queue_insert(wiphy->work, work, insert_by_priority, NULL);
+
+	return true;
+}
+
+/*
+ * Every time a waiting item gets overtaken by a more urgent one, bump
+ * its priority by one so that a steady stream of urgent work cannot
+ * starve background work forever.  This keeps the queue ordered since
+ * everything behind the new item is strictly less urgent than it.
+ */
+static void wiphy_radio_work_age(struct wiphy *wiphy,
+					struct wiphy_radio_work_item *item)
+{
+	const struct l_queue_entry *entry;
+	bool behind = false;
+
+	for (entry = l_queue_get_entries(wiphy->work); entry;
+							entry = entry->next) {
+		struct wiphy_radio_work_item *work = entry->data;
+
+		if (work == item) {
+			behind = true;
+			continue;
+		}
+
+		if (behind && work->priority > item->priority)
+			work->priority--;
+	}
+}
+
 uint32_t wiphy_radio_work_insert(struct wiphy *wiphy,
 				struct wiphy_radio_work_item *item,
 				int priority,
 				const struct wiphy_radio_work_item_ops *ops)
 {
+	bool preempted;
+
 	item->priority = priority;
+	item->budgeted = priority >= WIPHY_WORK_PRIORITY_BUDGET;
 	item->ops = ops;
 	item->id = ++work_ids;
+	item->insert_time = l_time_now();
+	item->start_time = 0;
 
 	l_debug("Inserting work item %u", item->id);
 
+	preempted = wiphy_radio_work_preempt(wiphy, priority);
+
 	l_queue_insert(wiphy->work, item, insert_by_priority, NULL);
+	wiphy_radio_work_age(wiphy, item);
 
-	if (l_queue_length(wiphy->work) == 1 && !wiphy->work_in_callback)
+	/* The head may also be an item waiting for the budget */
+	if (preempted || wiphy_radio_work_head_waiting(wiphy))
 		wiphy_radio_work_next(wiphy);
 
 	return item->id;
@@ -2017,6 +2564,7 @@ void wiphy_radio_work_done(struct wiphy *wiphy, uint32_t id)
 	if (item->id == id) {
 		next = true;
 		l_queue_pop_head(wiphy->work);
+		wiphy_budget_charge(wiphy);
 	} else
 		item = l_queue_remove_if(wiphy->work, match_id,
 						L_UINT_TO_PTR(id));
@@ -2025,6 +2573,7 @@ void wiphy_radio_work_done(struct wiphy *wiphy, uint32_t id)
 
 	l_debug("Work item %u done", id);
 
+	wiphy_radio_work_account(wiphy, item);
 	item->id = 0;
 
 	wiphy->work_in_callback = true;
@@ -2062,9 +2611,11 @@ static int wiphy_init(void)
 	if (wiphy_list) {
 		l_warn("Destroying existing list of wiphy devices");
 		l_queue_destroy(wiphy_list, NULL);
+		l_hashmap_destroy(wiphy_index, NULL);
 	}
 
 	wiphy_list = l_queue_new();
+	wiphy_index = l_hashmap_new();
 
 	rfkill_watch_add(wiphy_rfkill_cb, NULL);
 
@@ -2083,6 +2634,14 @@ static int wiphy_init(void)
 	if (blacklist)
 		blacklist_filter = l_strsplit(blacklist, ',');
 
+	if (!l_settings_get_uint(config, "Scan", "MaxDutyCycle",
+					&radio_duty_cycle))
+		radio_duty_cycle = 0;
+	else if (radio_duty_cycle >= 100) {
+		l_warn("[Scan].MaxDutyCycle must be below 100, ignoring");
+		radio_duty_cycle = 0;
+	}
+
 	s = l_settings_get_value(config, "General",
 						"AddressRandomizationRange");
 	if (s) {
@@ -2109,6 +2668,8 @@ static void wiphy_exit(void)
 
 	l_queue_destroy(wiphy_list, wiphy_free);
 	wiphy_list = NULL;
+	l_hashmap_destroy(wiphy_index, NULL);
+	wiphy_index = NULL;
 
 	l_genl_family_free(nl80211);
 	nl80211 = NULL;
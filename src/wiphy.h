@@ -30,6 +30,17 @@ struct wiphy_radio_work_item;
 struct ie_rsn_info;
 enum security;
 
+/* Used to keep queue wait and run time statistics per kind of work */
+enum wiphy_radio_work_type {
+	WIPHY_WORK_TYPE_OTHER = 0,
+	WIPHY_WORK_TYPE_SCAN,
+	WIPHY_WORK_TYPE_CONNECT,
+	WIPHY_WORK_TYPE_FT,
+	WIPHY_WORK_TYPE_FRAME_XCHG,
+	WIPHY_WORK_TYPE_OFFCHANNEL,
+	__WIPHY_WORK_TYPE_MAX,
+};
+
 typedef bool (*wiphy_radio_work_func_t)(struct wiphy_radio_work_item *item);
 typedef void (*wiphy_radio_work_destroy_func_t)(
 					struct wiphy_radio_work_item *item);
@@ -37,11 +48,22 @@ typedef void (*wiphy_radio_work_destroy_func_t)(
 struct wiphy_radio_work_item_ops {
 	wiphy_radio_work_func_t do_work;
 	wiphy_radio_work_destroy_func_t destroy;
+	/*
+	 * Optional, called on a running item when more urgent work is
+	 * inserted.  Return true if the work was stopped, do_work will be
+	 * called again once the item gets back to the head of the queue.
+	 */
+	wiphy_radio_work_func_t preempt;
+	enum wiphy_radio_work_type type;
 };
 
 struct wiphy_radio_work_item {
 	uint32_t id;
 	int priority;
+	int start_priority;	/* Priority the running item started with */
+	bool budgeted;		/* Subject to the duty cycle budget */
+	uint64_t insert_time;
+	uint64_t start_time;	/* First time do_work was called */
 	const struct wiphy_radio_work_item_ops *ops;
 };
 
@@ -51,6 +73,16 @@ struct wiphy_radio_work_item {
 #define WIPHY_WORK_PRIORITY_SCAN		2
 #define WIPHY_WORK_PRIORITY_PERIODIC_SCAN	3
 
+/*
+ * Only work inserted at exactly this priority, i.e. connect and FT, may
+ * preempt running work items.  Frame exchanges and offchannel work are
+ * more urgent to start but not worth aborting a scan for.
+ */
+#define WIPHY_WORK_PRIORITY_PREEMPT		WIPHY_WORK_PRIORITY_CONNECT
+
+/* Work at this priority or less urgent counts against the duty cycle */
+#define WIPHY_WORK_PRIORITY_BUDGET		WIPHY_WORK_PRIORITY_SCAN
+
 enum wiphy_state_watch_event {
 	WIPHY_STATE_WATCH_EVENT_POWERED,
 	WIPHY_STATE_WATCH_EVENT_RFKILLED,
@@ -98,7 +130,18 @@ bool wiphy_has_feature(struct wiphy *wiphy, uint32_t feature);
 bool wiphy_has_ext_feature(struct wiphy *wiphy, uint32_t feature);
 uint8_t wiphy_get_max_num_ssids_per_scan(struct wiphy *wiphy);
 uint16_t wiphy_get_max_scan_ie_len(struct wiphy *wiphy);
+bool wiphy_supports_sched_scan(struct wiphy *wiphy);
+uint8_t wiphy_get_max_num_sched_ssids(struct wiphy *wiphy);
+uint8_t wiphy_get_max_match_sets(struct wiphy *wiphy);
+void wiphy_get_sched_scan_plan_limits(struct wiphy *wiphy,
+					uint32_t *max_plans,
+					uint32_t *max_interval,
+					uint32_t *max_iterations);
+bool wiphy_supports_wowlan_trigger(struct wiphy *wiphy,
+					uint32_t trigger);
+uint32_t wiphy_get_wowlan_max_nd_match_sets(struct wiphy *wiphy);
 uint32_t wiphy_get_max_roc_duration(struct wiphy *wiphy);
+uint32_t wiphy_get_probe_resp_offload(struct wiphy *wiphy);
 bool wiphy_supports_iftype(struct wiphy *wiphy, uint32_t iftype);
 const uint8_t *wiphy_get_supported_rates(struct wiphy *wiphy, unsigned int band,
 						unsigned int *out_num);
@@ -137,3 +180,4 @@ uint32_t wiphy_radio_work_insert(struct wiphy *wiphy,
 				const struct wiphy_radio_work_item_ops *ops);
 void wiphy_radio_work_done(struct wiphy *wiphy, uint32_t id);
 int wiphy_radio_work_is_running(struct wiphy *wiphy, uint32_t id);
+void wiphy_radio_work_set_budget(struct wiphy *wiphy, bool enforce);
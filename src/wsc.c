@@ -256,6 +256,7 @@ static void wsc_enrollee_netdev_event(struct netdev *netdev,
 		break;
 	case NETDEV_EVENT_RSSI_THRESHOLD_LOW:
 	case NETDEV_EVENT_RSSI_THRESHOLD_HIGH:
+	case NETDEV_EVENT_RSSI_TREND_LOW:
 		break;
 	default:
 		l_debug("Unexpected event: %d", event);
@@ -459,6 +460,11 @@ struct wsc_station_dbus {
 	struct l_timeout *walk_timer;
 	uint32_t scan_id;
 	uint32_t station_state_watch;
+	/* UUID-Es of the PBC APs seen so far during the walk time */
+	struct l_queue *pbc_uuids;
+	uint8_t pbc_target[6];
+	bool pbc_2g : 1;
+	bool pbc_5g : 1;
 };
 
 #define CONNECT_REPLY(wsc, message)					\
@@ -687,6 +693,11 @@ static void wsc_cancel_scan(struct wsc_station_dbus *wsc)
 		l_timeout_remove(wsc->walk_timer);
 		wsc->walk_timer = NULL;
 	}
+
+	l_queue_destroy(wsc->pbc_uuids, l_free);
+	wsc->pbc_uuids = NULL;
+	wsc->pbc_2g = false;
+	wsc->pbc_5g = false;
 }
 
 static void walk_timeout(struct l_timeout *timeout, void *user_data)
@@ -705,108 +716,136 @@ static void pin_timeout(struct l_timeout *timeout, void *user_data)
 	CONNECT_REPLY(wsc, wsc_error_time_expired);
 }
 
-static bool push_button_scan_results(int err, struct l_queue *bss_list,
-					const struct scan_freq_set *freqs,
-					void *userdata)
+static bool wsc_pbc_uuid_match(const void *a, const void *b)
+{
+	return !memcmp(a, b, 16);
+}
+
+static bool wsc_bss_match_addr(const void *a, const void *b)
+{
+	const struct scan_bss *bss = a;
+
+	return !memcmp(bss->addr, b, 6);
+}
+
+/*
+ * PBC APs are evaluated as the scan results stream in.  Every PBC AP seen
+ * during the walk time counts towards session overlap, even when seen in
+ * an earlier scan pass, and the scan is abandoned as soon as a second one
+ * shows up.
+ */
+static void push_button_scan_bss(const struct scan_bss *bss, void *userdata)
 {
 	struct wsc_station_dbus *wsc = userdata;
-	struct scan_bss *bss_2g;
-	struct scan_bss *bss_5g;
-	struct scan_bss *target;
-	uint8_t uuid_2g[16];
-	uint8_t uuid_5g[16];
-	const struct l_queue_entry *bss_entry;
 	struct wsc_probe_response probe_response;
+	enum band_freq band;
+	int err;
 
-	if (err) {
-		wsc_cancel_scan(wsc);
-		CONNECT_REPLY(wsc, dbus_error_failed);
+	l_debug("bss '%s' with SSID: %s, freq: %u",
+		util_address_to_string(bss->addr),
+		util_ssid_to_utf8(bss->ssid_len, bss->ssid),
+		bss->frequency);
 
-		return false;
+	l_debug("bss->wsc: %p, %zu", bss->wsc, bss->wsc_size);
+
+	if (!bss->wsc)
+		return;
+
+	err = wsc_parse_probe_response(bss->wsc, bss->wsc_size,
+					&probe_response);
+	if (err < 0) {
+		l_debug("ProbeResponse parse failed: %s", strerror(-err));
+		return;
 	}
 
-	bss_2g = NULL;
-	bss_5g = NULL;
+	l_debug("SelectedRegistar: %s",
+		probe_response.selected_registrar ? "true" : "false");
 
-	wsc->scan_id = 0;
+	if (!probe_response.selected_registrar)
+		return;
 
-	for (bss_entry = l_queue_get_entries(bss_list); bss_entry;
-				bss_entry = bss_entry->next) {
-		struct scan_bss *bss = bss_entry->data;
-		enum band_freq band;
-		int err;
+	if (probe_response.device_password_id !=
+			WSC_DEVICE_PASSWORD_ID_PUSH_BUTTON)
+		return;
 
-		l_debug("bss '%s' with SSID: %s, freq: %u",
-			util_address_to_string(bss->addr),
-			util_ssid_to_utf8(bss->ssid_len, bss->ssid),
-			bss->frequency);
+	band_freq_to_channel(bss->frequency, &band);
 
-		l_debug("bss->wsc: %p, %zu", bss->wsc, bss->wsc_size);
+	switch (band) {
+	case BAND_FREQ_2_4_GHZ:
+		if (wsc->pbc_2g) {
+			l_debug("2G Session overlap error");
+			goto session_overlap;
+		}
 
-		if (!bss->wsc)
-			continue;
+		wsc->pbc_2g = true;
 
-		err = wsc_parse_probe_response(bss->wsc, bss->wsc_size,
-						&probe_response);
-		if (err < 0) {
-			l_debug("ProbeResponse parse failed: %s",
-							strerror(-err));
-			continue;
+		if (!wsc->pbc_5g)
+			memcpy(wsc->pbc_target, bss->addr, 6);
+
+		break;
+
+	case BAND_FREQ_5_GHZ:
+		if (wsc->pbc_5g) {
+			l_debug("5G Session overlap error");
+			goto session_overlap;
 		}
 
-		l_debug("SelectedRegistar: %s",
-			probe_response.selected_registrar ? "true" : "false");
+		wsc->pbc_5g = true;
+		memcpy(wsc->pbc_target, bss->addr, 6);
+		break;
 
-		if (!probe_response.selected_registrar)
-			continue;
+	default:
+		return;
+	}
 
-		if (probe_response.device_password_id !=
-				WSC_DEVICE_PASSWORD_ID_PUSH_BUTTON)
-			continue;
+	if (!l_queue_find(wsc->pbc_uuids, wsc_pbc_uuid_match,
+				probe_response.uuid_e))
+		l_queue_push_tail(wsc->pbc_uuids,
+					l_memdup(probe_response.uuid_e, 16));
 
-		band_freq_to_channel(bss->frequency, &band);
+	if (l_queue_length(wsc->pbc_uuids) > 1) {
+		l_debug("Found more than one PBC AP during the walk time");
+		goto session_overlap;
+	}
 
-		switch (band) {
-		case BAND_FREQ_2_4_GHZ:
-			if (bss_2g) {
-				l_debug("2G Session overlap error");
-				goto session_overlap;
-			}
+	return;
 
-			bss_2g = bss;
-			memcpy(uuid_2g, probe_response.uuid_e, 16);
-			break;
+session_overlap:
+	wsc_cancel_scan(wsc);
+	CONNECT_REPLY(wsc, wsc_error_session_overlap);
+}
 
-		case BAND_FREQ_5_GHZ:
-			if (bss_5g) {
-				l_debug("5G Session overlap error");
-				goto session_overlap;
-			}
+static bool push_button_scan_results(int err, struct l_queue *bss_list,
+					const struct scan_freq_set *freqs,
+					void *userdata)
+{
+	struct wsc_station_dbus *wsc = userdata;
+	struct scan_bss *target = NULL;
+	uint64_t wdev_id = netdev_get_wdev_id(wsc->netdev);
 
-			bss_5g = bss;
-			memcpy(uuid_5g, probe_response.uuid_e, 16);
-			break;
+	if (err) {
+		wsc_cancel_scan(wsc);
+		CONNECT_REPLY(wsc, dbus_error_failed);
 
-		default:
-			return false;
-		}
+		return false;
 	}
 
-	if (bss_2g && bss_5g && memcmp(uuid_2g, uuid_5g, 16)) {
-		l_debug("Found two PBC APs on different bands");
-		goto session_overlap;
-	}
+	wsc->scan_id = 0;
+
+	if (wsc->pbc_2g || wsc->pbc_5g)
+		target = l_queue_find(bss_list, wsc_bss_match_addr,
+					wsc->pbc_target);
 
-	if (bss_5g)
-		target = bss_5g;
-	else if (bss_2g)
-		target = bss_2g;
-	else {
+	if (!target) {
 		l_debug("No PBC APs found, running the scan again");
-		wsc->scan_id = scan_active(netdev_get_wdev_id(wsc->netdev),
+		wsc->scan_id = scan_active(wdev_id,
 						wsc->wsc_ies, wsc->wsc_ies_size,
 						NULL, push_button_scan_results,
 						wsc, NULL);
+		scan_set_bss_callback(wdev_id, wsc->scan_id,
+					push_button_scan_bss);
+		wsc->pbc_2g = false;
+		wsc->pbc_5g = false;
 		return false;
 	}
 
@@ -818,12 +857,6 @@ static bool push_button_scan_results(int err, struct l_queue *bss_list,
 	wsc_check_can_connect(wsc, target);
 
 	return true;
-
-session_overlap:
-	wsc_cancel_scan(wsc);
-	CONNECT_REPLY(wsc, wsc_error_session_overlap);
-
-	return false;
 }
 
 static const char *authorized_macs_to_string(const uint8_t *authorized_macs)
@@ -1027,6 +1060,12 @@ static bool wsc_initiate_scan(struct wsc_station_dbus *wsc,
 		return false;
 	}
 
+	if (dpid == WSC_DEVICE_PASSWORD_ID_PUSH_BUTTON) {
+		wsc->pbc_uuids = l_queue_new();
+		scan_set_bss_callback(netdev_get_wdev_id(wsc->netdev),
+					wsc->scan_id, push_button_scan_bss);
+	}
+
 	return true;
 }
 
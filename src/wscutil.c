@@ -28,9 +28,11 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <ell/ell.h>
 
+#include "src/missing.h"
 #include "src/util.h"
 #include "src/ie.h"
 #include "src/wscutil.h"
@@ -1614,12 +1616,37 @@ struct wsc_attr_builder {
 	uint8_t *buf;
 	size_t offset;
 	uint16_t curlen;
+	bool borrowed_buf : 1;	/* buf is not owned by the builder */
 };
 
+/*
+ * Messages are assembled in a preallocated arena and copied out at their
+ * final size, so building one costs a single allocation.  The arena serves
+ * one builder at a time, a message bigger than the arena or a builder
+ * created while the arena is busy falls back to a growing heap buffer.
+ */
+#define WSC_ARENA_SIZE 2048
+
+static uint8_t wsc_arena[WSC_ARENA_SIZE];
+static struct wsc_attr_builder wsc_arena_builder;
+
 static void wsc_attr_builder_grow(struct wsc_attr_builder *builder)
 {
-	builder->buf = l_realloc(builder->buf, builder->capacity * 2);
+	uint8_t *buf;
+
+	if (!builder->borrowed_buf) {
+		builder->buf = l_realloc(builder->buf, builder->capacity * 2);
+		builder->capacity *= 2;
+		return;
+	}
+
+	buf = l_malloc(builder->capacity * 2);
+	memcpy(buf, builder->buf, builder->capacity);
+	explicit_bzero(builder->buf, builder->capacity);
+
+	builder->buf = buf;
 	builder->capacity *= 2;
+	builder->borrowed_buf = false;
 }
 
 static bool wsc_attr_builder_start_attr(struct wsc_attr_builder *builder,
@@ -1729,6 +1756,10 @@ static bool wsc_attr_builder_put_string(struct wsc_attr_builder *builder,
 	return true;
 }
 
+/*
+ * initial_capacity is the expected size of the message, it only matters
+ * when the message won't fit the arena.
+ */
 static struct wsc_attr_builder *wsc_attr_builder_new(size_t initial_capacity)
 {
 	struct wsc_attr_builder *builder;
@@ -1736,6 +1767,15 @@ static struct wsc_attr_builder *wsc_attr_builder_new(size_t initial_capacity)
 	if (initial_capacity == 0)
 		return NULL;
 
+	if (!wsc_arena_builder.buf && initial_capacity <= WSC_ARENA_SIZE) {
+		builder = &wsc_arena_builder;
+		builder->buf = wsc_arena;
+		builder->capacity = WSC_ARENA_SIZE;
+		builder->borrowed_buf = true;
+
+		return builder;
+	}
+
 	builder = l_new(struct wsc_attr_builder, 1);
 	builder->buf = l_malloc(initial_capacity);
 	builder->capacity = initial_capacity;
@@ -1743,12 +1783,9 @@ static struct wsc_attr_builder *wsc_attr_builder_new(size_t initial_capacity)
 	return builder;
 }
 
-static uint8_t *wsc_attr_builder_free(struct wsc_attr_builder *builder,
-					bool free_contents,
-					size_t *out_size)
+/* Records the length of the last attribute */
+static void wsc_attr_builder_finish(struct wsc_attr_builder *builder)
 {
-	uint8_t *ret;
-
 	if (builder->curlen > 0) {
 		uint8_t *bytes = builder->buf + builder->offset;
 
@@ -1756,18 +1793,33 @@ static uint8_t *wsc_attr_builder_free(struct wsc_attr_builder *builder,
 		builder->offset += builder->curlen;
 		builder->curlen = 0;
 	}
+}
 
-	if (free_contents) {
-		l_free(builder->buf);
-		builder->buf = NULL;
-	}
+static uint8_t *wsc_attr_builder_free(struct wsc_attr_builder *builder,
+					bool free_contents,
+					size_t *out_size)
+{
+	uint8_t *ret;
+
+	wsc_attr_builder_finish(builder);
 
-	ret = builder->buf;
+	if (builder->borrowed_buf) {
+		ret = free_contents ? NULL :
+				l_memdup(builder->buf, builder->offset);
+		explicit_bzero(builder->buf, builder->offset);
+	} else if (free_contents) {
+		l_free(builder->buf);
+		ret = NULL;
+	} else
+		ret = builder->buf;
 
 	if (out_size)
 		*out_size = builder->offset;
 
-	l_free(builder);
+	if (builder == &wsc_arena_builder)
+		memset(builder, 0, sizeof(*builder));
+	else
+		l_free(builder);
 
 	return ret;
 }
@@ -2109,12 +2161,9 @@ static void wfa_build_authorized_macs(struct wsc_attr_builder *builder,
 	wsc_attr_builder_put_bytes(builder, authorized_macs, count * 6);
 }
 
-uint8_t *wsc_build_credential(const struct wsc_credential *in, size_t *out_len)
+static void build_credential_attrs(struct wsc_attr_builder *builder,
+					const struct wsc_credential *in)
 {
-	struct wsc_attr_builder *builder;
-	uint8_t *ret;
-
-	builder = wsc_attr_builder_new(128);
 	build_network_index(builder, 1);
 	build_ssid(builder, in->ssid, in->ssid_len);
 	build_authentication_type(builder, in->auth_type);
@@ -2123,20 +2172,42 @@ uint8_t *wsc_build_credential(const struct wsc_credential *in, size_t *out_len)
 	build_mac_address(builder, in->addr);
 
 	/* TODO: Append EAP attrs & Network Key Shareable inside WFA EXT */
+}
 
-	ret = wsc_attr_builder_free(builder, false, out_len);
-	return ret;
+uint8_t *wsc_build_credential(const struct wsc_credential *in, size_t *out_len)
+{
+	struct wsc_attr_builder *builder;
+
+	builder = wsc_attr_builder_new(128);
+	build_credential_attrs(builder, in);
+
+	return wsc_attr_builder_free(builder, false, out_len);
 }
 
+/*
+ * The credential is nested inside a message being built, assemble it on the
+ * stack rather than taking another allocation.
+ */
 static void build_credential(struct wsc_attr_builder *builder,
 					const struct wsc_credential *cred)
 {
-	size_t data_len;
-	uint8_t *data = wsc_build_credential(cred, &data_len);
+	uint8_t buf[256];
+	struct wsc_attr_builder sub = {
+		.buf = buf,
+		.capacity = sizeof(buf),
+		.borrowed_buf = true,
+	};
+
+	build_credential_attrs(&sub, cred);
+	wsc_attr_builder_finish(&sub);
 
 	wsc_attr_builder_start_attr(builder, WSC_ATTR_CREDENTIAL);
-	wsc_attr_builder_put_bytes(builder, data, data_len);
-	l_free(data);
+	wsc_attr_builder_put_bytes(builder, sub.buf, sub.offset);
+
+	if (sub.borrowed_buf)
+		explicit_bzero(buf, sub.offset);
+	else
+		l_free(sub.buf);
 }
 
 uint8_t *wsc_build_beacon(const struct wsc_beacon *beacon, size_t *out_len)
@@ -0,0 +1,764 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <ell/ell.h>
+
+#include "src/eap.h"
+#include "src/eap-private.h"
+#include "src/mschaputil.h"
+
+/*
+ * l_malloc is wrapped at link time so that the allocations made by the
+ * supplicant side while it processes each request can be counted.
+ */
+void *__wrap_l_malloc(size_t size);
+void *__real_l_malloc(size_t size);
+
+static unsigned long alloc_count;
+
+void *__wrap_l_malloc(size_t size)
+{
+	alloc_count++;
+
+	return __real_l_malloc(size);
+}
+
+#define BENCH_MAX_ROUNDS 64
+
+/*
+ * The server side runs in-process: a TLS server from ell plus a scripted
+ * Phase 2 peer.  Only the time spent in eap_rx_packet(), i.e. in the
+ * supplicant's EAP state machines, is measured.
+ */
+struct bench_server {
+	const struct bench_method *method;
+	struct l_tls *tls;
+	uint8_t id;
+	unsigned int stage;
+	bool tunnel_ready:1;
+	bool done:1;
+	bool failed:1;
+
+	uint8_t tx_buf[16384];
+	size_t tx_len;
+	size_t tx_offset;
+
+	uint8_t rx_buf[16384];
+	size_t rx_len;
+
+	uint8_t resp[4096];
+	size_t resp_len;
+	bool have_resp;
+
+	bool completed;
+	enum eap_result result;
+	bool have_msk;
+
+	uint8_t mschap_challenge[16];
+};
+
+struct bench_method {
+	const char *name;
+	uint8_t type;
+	const char *config;
+	bool client_auth;
+	void (*app_data)(struct bench_server *srv, const uint8_t *data,
+				size_t len);
+	bool (*idle)(struct bench_server *srv);
+};
+
+struct bench_stat {
+	unsigned int runs;
+	unsigned int rounds;
+	uint64_t cpu_nsecs;
+	unsigned long allocs;
+};
+
+static const char *password = "testpasswd";
+static size_t server_frag_size = 1024;
+
+static uint64_t cpu_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void tls_server_write(const uint8_t *data, size_t len, void *user_data)
+{
+	struct bench_server *srv = user_data;
+
+	if (srv->tx_len + len > sizeof(srv->tx_buf)) {
+		srv->failed = true;
+		return;
+	}
+
+	memcpy(srv->tx_buf + srv->tx_len, data, len);
+	srv->tx_len += len;
+}
+
+static void tls_server_app_data(const uint8_t *data, size_t len,
+				void *user_data)
+{
+	struct bench_server *srv = user_data;
+
+	if (!srv->method->app_data) {
+		srv->failed = true;
+		return;
+	}
+
+	srv->method->app_data(srv, data, len);
+}
+
+static void tls_server_ready(const char *peer_identity, void *user_data)
+{
+	struct bench_server *srv = user_data;
+
+	srv->tunnel_ready = true;
+
+	/* There is no Phase 2 for EAP-TLS */
+	if (!srv->method->app_data)
+		srv->done = true;
+}
+
+static void tls_server_disconnected(enum l_tls_alert_desc reason,
+					bool remote, void *user_data)
+{
+	struct bench_server *srv = user_data;
+
+	fprintf(stderr, "TLS alert: %s\n", l_tls_alert_to_str(reason));
+	srv->failed = true;
+}
+
+/* Recorded EAP-TTLS Phase 2 exchange: EAP-Identity and EAP-MD5 in AVPs */
+static const uint8_t ttls_identity_avp[] = {
+	0x00, 0x00, 0x00, 0x4f, 0x40, 0x00, 0x00, 0x1c, 0x02, 0x00, 0x00, 0x14,
+	0x01, 0x61, 0x62, 0x63, 0x40, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65,
+	0x2e, 0x63, 0x6f, 0x6d
+};
+
+static const uint8_t ttls_md5_challenge_avp[] = {
+	0x00, 0x00, 0x00, 0x4f, 0x40, 0x00, 0x00, 0x1e, 0x01, 0xbb, 0x00, 0x16,
+	0x04, 0x10, 0x3a, 0x34, 0x58, 0xc4, 0xf1, 0xa3, 0xdc, 0x45, 0xd0, 0xca,
+	0x96, 0x33, 0x9b, 0x95, 0xb8, 0xd6, 0x00, 0x00
+};
+
+static const uint8_t ttls_md5_response_avp[] = {
+	0x00, 0x00, 0x00, 0x4f, 0x40, 0x00, 0x00, 0x1e, 0x02, 0xbb, 0x00, 0x16,
+	0x04, 0x10, 0x10, 0xcc, 0x62, 0x4c, 0x98, 0x2b, 0x82, 0xbd, 0x13, 0x4a,
+	0x81, 0xcb, 0x70, 0x78, 0xcd, 0xc2,
+};
+
+static void ttls_app_data(struct bench_server *srv, const uint8_t *data,
+				size_t len)
+{
+	switch (srv->stage++) {
+	case 0:
+		if (len != sizeof(ttls_identity_avp) ||
+				memcmp(data, ttls_identity_avp, len))
+			break;
+
+		l_tls_write(srv->tls, ttls_md5_challenge_avp,
+				sizeof(ttls_md5_challenge_avp));
+		return;
+	case 1:
+		if (len != sizeof(ttls_md5_response_avp) ||
+				memcmp(data, ttls_md5_response_avp, len))
+			break;
+
+		srv->done = true;
+		return;
+	}
+
+	srv->failed = true;
+}
+
+/*
+ * PEAPv0 with EAP-MSCHAPv2.  The Phase 2 packets other than EAP-TLV are
+ * headerless.  The peer challenge is random so the MSCHAPv2 server side
+ * has to be computed rather than replayed.
+ */
+static const char *mschap_server_name = "bench";
+
+static bool peap_idle(struct bench_server *srv)
+{
+	static const uint8_t identity_req[] = { EAP_TYPE_IDENTITY };
+
+	if (!srv->tunnel_ready || srv->stage)
+		return false;
+
+	srv->stage++;
+	l_tls_write(srv->tls, identity_req, sizeof(identity_req));
+
+	return true;
+}
+
+static void peap_send_mschap_challenge(struct bench_server *srv)
+{
+	size_t name_len = strlen(mschap_server_name);
+	size_t len = 5 + 1 + 16 + name_len;
+	uint8_t buf[len];
+
+	l_getrandom(srv->mschap_challenge, 16);
+
+	buf[0] = EAP_TYPE_MSCHAPV2;
+	buf[1] = 1;			/* Challenge */
+	buf[2] = 0x42;			/* MSCHAPv2 ID */
+	l_put_be16(len - 1, buf + 3);
+	buf[5] = 16;
+	memcpy(buf + 6, srv->mschap_challenge, 16);
+	memcpy(buf + 22, mschap_server_name, name_len);
+
+	l_tls_write(srv->tls, buf, len);
+}
+
+static bool peap_send_mschap_success(struct bench_server *srv,
+					const uint8_t *data, size_t len)
+{
+	uint8_t password_hash[16];
+	uint8_t password_hash_hash[16];
+	uint8_t nt_response[24];
+	const uint8_t *peer_challenge;
+	char user[256];
+	uint8_t buf[5 + 42];
+
+	/* Type, header, value size, peer challenge, reserved, NT response */
+	if (len < 5 + 1 + 16 + 8 + 24 + 1 || len - 55 >= sizeof(user))
+		return false;
+
+	if (data[1] != 2 || data[5] != 49)
+		return false;
+
+	peer_challenge = data + 6;
+	memcpy(user, data + 55, len - 55);
+	user[len - 55] = '\0';
+
+	if (!mschap_nt_password_hash(password, password_hash) ||
+			!mschapv2_hash_nt_password_hash(password_hash,
+							password_hash_hash))
+		return false;
+
+	if (!mschapv2_generate_nt_response(password_hash, peer_challenge,
+						srv->mschap_challenge, user,
+						nt_response) ||
+			memcmp(nt_response, data + 30, 24))
+		return false;
+
+	buf[0] = EAP_TYPE_MSCHAPV2;
+	buf[1] = 3;			/* Success */
+	buf[2] = data[2];
+	l_put_be16(sizeof(buf) - 1, buf + 3);
+
+	if (!mschapv2_generate_authenticator_response(password_hash_hash,
+						nt_response, peer_challenge,
+						srv->mschap_challenge, user,
+						(char *) buf + 5))
+		return false;
+
+	l_tls_write(srv->tls, buf, sizeof(buf));
+
+	return true;
+}
+
+static void peap_app_data(struct bench_server *srv, const uint8_t *data,
+				size_t len)
+{
+	static const uint8_t result_tlv[] = {
+		0x80, 0x03, 0x00, 0x02, 0x00, 0x01,
+	};
+	uint8_t buf[5 + sizeof(result_tlv)];
+
+	switch (srv->stage++) {
+	case 1:
+		if (len < 1 || data[0] != EAP_TYPE_IDENTITY)
+			break;
+
+		peap_send_mschap_challenge(srv);
+		return;
+	case 2:
+		if (len < 1 || data[0] != EAP_TYPE_MSCHAPV2)
+			break;
+
+		if (!peap_send_mschap_success(srv, data, len))
+			break;
+
+		return;
+	case 3:
+		if (len != 2 || data[0] != EAP_TYPE_MSCHAPV2 || data[1] != 3)
+			break;
+
+		/* EAP-TLV packets keep their header in PEAPv0 */
+		buf[0] = EAP_CODE_REQUEST;
+		buf[1] = srv->id + 1;
+		l_put_be16(sizeof(buf), buf + 2);
+		buf[4] = EAP_TYPE_EXTENSIONS;
+		memcpy(buf + 5, result_tlv, sizeof(result_tlv));
+
+		l_tls_write(srv->tls, buf, sizeof(buf));
+		return;
+	case 4:
+		if (len != sizeof(buf) || data[0] != EAP_CODE_RESPONSE ||
+				data[4] != EAP_TYPE_EXTENSIONS ||
+				memcmp(data + 5, result_tlv,
+					sizeof(result_tlv)))
+			break;
+
+		srv->done = true;
+		return;
+	}
+
+	srv->failed = true;
+}
+
+static const struct bench_method methods[] = {
+	{
+		.name = "TLS",
+		.type = EAP_TYPE_TLS,
+		.config = "[Security]\n"
+			"EAP-Method=TLS\n"
+			"EAP-Identity=abc@example.com\n"
+			"EAP-TLS-CACert=" CERTDIR "cert-ca.pem\n"
+			"EAP-TLS-ClientCert=" CERTDIR "cert-client.pem\n"
+			"EAP-TLS-ClientKey=" CERTDIR
+					"cert-client-key-pkcs8.pem\n",
+		.client_auth = true,
+	},
+	{
+		.name = "TTLS-MD5",
+		.type = EAP_TYPE_TTLS,
+		.config = "[Security]\n"
+			"EAP-Method=TTLS\n"
+			"EAP-Identity=abc@example.com\n"
+			"EAP-TTLS-CACert=" CERTDIR "cert-ca.pem\n"
+			"EAP-TTLS-Phase2-Method=MD5\n"
+			"EAP-TTLS-Phase2-Identity=abc@example.com\n"
+			"EAP-TTLS-Phase2-Password=testpasswd\n",
+		.app_data = ttls_app_data,
+	},
+	{
+		.name = "PEAP-MSCHAPV2",
+		.type = EAP_TYPE_PEAP,
+		.config = "[Security]\n"
+			"EAP-Method=PEAP\n"
+			"EAP-Identity=abc@example.com\n"
+			"EAP-PEAP-CACert=" CERTDIR "cert-ca.pem\n"
+			"EAP-PEAP-Phase2-Method=MSCHAPV2\n"
+			"EAP-PEAP-Phase2-Identity=abc@example.com\n"
+			"EAP-PEAP-Phase2-Password=testpasswd\n",
+		.app_data = peap_app_data,
+		.idle = peap_idle,
+	},
+};
+
+static struct bench_server server;
+static struct bench_stat stat;
+
+static void bench_tx_packet(const uint8_t *eap_data, size_t len,
+				void *user_data)
+{
+	struct bench_server *srv = user_data;
+
+	if (len > sizeof(srv->resp) || srv->have_resp) {
+		srv->failed = true;
+		return;
+	}
+
+	memcpy(srv->resp, eap_data, len);
+	srv->resp_len = len;
+	srv->have_resp = true;
+}
+
+static void bench_complete(enum eap_result result, void *user_data)
+{
+	struct bench_server *srv = user_data;
+
+	srv->completed = true;
+	srv->result = result;
+}
+
+static void bench_key_material(const uint8_t *msk_data, size_t msk_len,
+				const uint8_t *emsk_data, size_t emsk_len,
+				const uint8_t *iv, size_t iv_len,
+				const uint8_t *session_id, size_t session_len,
+				void *user_data)
+{
+	struct bench_server *srv = user_data;
+
+	srv->have_msk = msk_len > 0;
+}
+
+static void bench_deliver(struct eap_state *eap, const uint8_t *pkt,
+				size_t len)
+{
+	unsigned long start_allocs = alloc_count;
+	uint64_t start = cpu_time_ns();
+
+	eap_rx_packet(eap, pkt, len);
+
+	stat.cpu_nsecs += cpu_time_ns() - start;
+	stat.allocs += alloc_count - start_allocs;
+
+	if (pkt[0] == EAP_CODE_REQUEST)
+		stat.rounds++;
+}
+
+static size_t bench_build_request(struct bench_server *srv, uint8_t *buf,
+					uint8_t flags)
+{
+	size_t remaining = srv->tx_len - srv->tx_offset;
+	size_t data_len = L_MIN(remaining, server_frag_size);
+	size_t len = 6;
+
+	buf[0] = EAP_CODE_REQUEST;
+	buf[1] = ++srv->id;
+	buf[4] = srv->method->type;
+	buf[5] = flags;
+
+	if (data_len < remaining) {
+		buf[5] |= 0x40;				/* M flag */
+
+		if (!srv->tx_offset) {
+			buf[5] |= 0x80;			/* L flag */
+			l_put_be32(srv->tx_len, buf + len);
+			len += 4;
+		}
+	}
+
+	memcpy(buf + len, srv->tx_buf + srv->tx_offset, data_len);
+	len += data_len;
+	l_put_be16(len, buf + 2);
+
+	srv->tx_offset += data_len;
+
+	if (srv->tx_offset == srv->tx_len)
+		srv->tx_offset = srv->tx_len = 0;
+
+	return len;
+}
+
+/*
+ * Handle the supplicant's last response and build the next packet to
+ * send, returns 0 on failure.
+ */
+static size_t bench_server_next(struct bench_server *srv, uint8_t *buf)
+{
+	const uint8_t *resp = srv->resp;
+	size_t len = srv->resp_len;
+	uint8_t flags;
+	size_t header_len = 6;
+
+	srv->have_resp = false;
+
+	if (len < 5 || resp[0] != EAP_CODE_RESPONSE || resp[1] != srv->id)
+		return 0;
+
+	if (resp[4] == EAP_TYPE_IDENTITY)
+		/* Start */
+		return bench_build_request(srv, buf, 0x20);
+
+	if (resp[4] != srv->method->type || len < 6)
+		return 0;
+
+	flags = resp[5];
+
+	if (flags & 0x80)				/* L flag */
+		header_len += 4;
+
+	if (len < header_len)
+		return 0;
+
+	if (len > header_len) {
+		if (srv->rx_len + len - header_len > sizeof(srv->rx_buf))
+			return 0;
+
+		memcpy(srv->rx_buf + srv->rx_len, resp + header_len,
+			len - header_len);
+		srv->rx_len += len - header_len;
+	}
+
+	/* Acknowledge the fragment */
+	if (flags & 0x40)
+		return bench_build_request(srv, buf, 0);
+
+	if (srv->rx_len) {
+		l_tls_handle_rx(srv->tls, srv->rx_buf, srv->rx_len);
+		srv->rx_len = 0;
+	}
+
+	if (srv->failed)
+		return 0;
+
+	if (!srv->tx_len && !srv->done && srv->method->idle &&
+			!srv->method->idle(srv))
+		return 0;
+
+	if (srv->tx_len)
+		return bench_build_request(srv, buf, 0);
+
+	if (!srv->done)
+		return 0;
+
+	buf[0] = EAP_CODE_SUCCESS;
+	buf[1] = srv->id;
+	l_put_be16(4, buf + 2);
+
+	return 4;
+}
+
+static bool bench_server_init(struct bench_server *srv,
+				const struct bench_method *method)
+{
+	struct l_certchain *cert;
+	struct l_key *key;
+
+	memset(srv, 0, sizeof(*srv));
+	srv->method = method;
+
+	srv->tls = l_tls_new(true, tls_server_app_data, tls_server_write,
+				tls_server_ready, tls_server_disconnected,
+				srv);
+	if (!srv->tls)
+		return false;
+
+	cert = l_pem_load_certificate_chain(CERTDIR "cert-server.pem");
+	key = l_pem_load_private_key(CERTDIR "cert-server-key-pkcs8.pem",
+					NULL, NULL);
+
+	if (!cert || !key || !l_tls_set_auth_data(srv->tls, cert, key)) {
+		fprintf(stderr, "Can't load the server certificate, run "
+				"make check first to generate the test "
+				"certificates\n");
+		l_certchain_free(cert);
+		l_key_free(key);
+		return false;
+	}
+
+	if (method->client_auth) {
+		struct l_queue *ca;
+
+		ca = l_pem_load_certificate_list(CERTDIR "cert-ca.pem");
+		if (!ca || !l_tls_set_cacert(srv->tls, ca))
+			return false;
+	}
+
+	return l_tls_start(srv->tls);
+}
+
+static bool bench_run(const struct bench_method *method,
+			struct l_settings *settings)
+{
+	static const uint8_t identity_req[] = {
+		EAP_CODE_REQUEST, 0x00, 0x00, 0x05, EAP_TYPE_IDENTITY,
+	};
+	struct eap_state *eap;
+	uint8_t buf[5 + 4 + 4096];
+	size_t len;
+	unsigned int i;
+	bool ok = false;
+
+	if (!bench_server_init(&server, method))
+		goto done;
+
+	eap = eap_new(bench_tx_packet, bench_complete, &server);
+	eap_set_key_material_func(eap, bench_key_material);
+
+	if (!eap_load_settings(eap, settings, "EAP-")) {
+		fprintf(stderr, "%s: failed to load settings\n", method->name);
+		eap_free(eap);
+		goto done;
+	}
+
+	bench_deliver(eap, identity_req, sizeof(identity_req));
+
+	for (i = 0; i < BENCH_MAX_ROUNDS && !server.completed; i++) {
+		if (!server.have_resp || server.failed)
+			break;
+
+		len = bench_server_next(&server, buf);
+		if (!len)
+			break;
+
+		bench_deliver(eap, buf, len);
+	}
+
+	ok = server.completed && server.result == EAP_RESULT_SUCCESS &&
+		server.have_msk;
+	eap_free(eap);
+
+done:
+	l_tls_free(server.tls);
+	server.tls = NULL;
+
+	return ok;
+}
+
+static int bench_method(const struct bench_method *method,
+			unsigned int iterations)
+{
+	struct l_settings *settings = l_settings_new();
+	unsigned int i;
+	double msecs;
+	int ret = 0;
+
+	memset(&stat, 0, sizeof(stat));
+
+	if (!l_settings_load_from_data(settings, method->config,
+					strlen(method->config))) {
+		ret = -EINVAL;
+		goto done;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		if (!bench_run(method, settings)) {
+			fprintf(stderr, "%s: authentication %u failed\n",
+					method->name, i);
+			ret = -EIO;
+			goto done;
+		}
+
+		stat.runs++;
+	}
+
+	msecs = (double) stat.cpu_nsecs / 1000000 / stat.runs;
+
+	printf("%-16s %6u runs %8.3f ms CPU/run %8.1f allocs/run "
+		"%5.1f round trips/run\n", method->name, stat.runs, msecs,
+		(double) stat.allocs / stat.runs,
+		(double) stat.rounds / stat.runs);
+
+done:
+	l_settings_free(settings);
+	return ret;
+}
+
+static void usage(void)
+{
+	unsigned int i;
+
+	printf("eap-bench - Benchmark the supplicant EAP methods\n"
+		"Usage:\n");
+	printf("\teap-bench [OPTIONS]\n");
+	printf("\nOptions:\n"
+		"\t-m, --method           Only benchmark the given method\n"
+		"\t-n, --iterations       Number of runs per method\n"
+		"\t                       (default: 20)\n"
+		"\t-f, --fragment-size    Server fragment size\n"
+		"\t                       (default: 1024)\n"
+		"\t-h, --help             Show help options\n");
+	printf("\nMethods:\n");
+
+	for (i = 0; i < L_ARRAY_SIZE(methods); i++)
+		printf("\t%s\n", methods[i].name);
+
+	printf("\n");
+}
+
+static const struct option main_options[] = {
+	{ "method", required_argument,        NULL, 'm' },
+	{ "iterations", required_argument,    NULL, 'n' },
+	{ "fragment-size", required_argument, NULL, 'f' },
+	{ "help", no_argument,                NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	const char *method = NULL;
+	unsigned int iterations = 20;
+	struct l_settings *config;
+	unsigned int i;
+	bool found = false;
+	int ret = EXIT_SUCCESS;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "m:n:f:h", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'm':
+			method = optarg;
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			server_frag_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!iterations || server_frag_size < 64 || server_frag_size > 4096) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	if (!l_main_init())
+		return EXIT_FAILURE;
+
+	/* Use the same EAP MTU as the daemon would by default */
+	config = l_settings_new();
+	__eap_set_config(config);
+	l_settings_free(config);
+
+	eap_init();
+
+	for (i = 0; i < L_ARRAY_SIZE(methods); i++) {
+		if (method && strcasecmp(method, methods[i].name))
+			continue;
+
+		found = true;
+
+		if (bench_method(&methods[i], iterations) < 0)
+			ret = EXIT_FAILURE;
+	}
+
+	if (!found) {
+		fprintf(stderr, "Unknown method %s\n", method);
+		ret = EXIT_FAILURE;
+	}
+
+	eap_exit();
+	l_main_exit();
+
+	return ret;
+}
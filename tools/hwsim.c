@@ -53,6 +53,7 @@
 #define HWSIM_INTERFACE_INTERFACE HWSIM_SERVICE ".Interface"
 #define HWSIM_RULE_MANAGER_INTERFACE HWSIM_SERVICE ".RuleManager"
 #define HWSIM_RULE_INTERFACE HWSIM_SERVICE ".Rule"
+#define HWSIM_LINK_MODEL_INTERFACE HWSIM_SERVICE ".LinkModel"
 
 enum {
 	HWSIM_CMD_UNSPEC,
@@ -141,6 +142,15 @@ struct hwsim_rule {
 	int match_times; /* negative value indicates unused */
 };
 
+/* Directional link between two radios, applied before any rules */
+struct hwsim_link {
+	int32_t src_id;
+	int32_t dst_id;
+	int signal;
+	double loss;
+	uint32_t latency;
+};
+
 struct hwsim_support {
 	const char *name;
 	uint32_t value;
@@ -168,6 +178,7 @@ static const char *radio_name_attr;
 static struct l_dbus *dbus;
 static struct l_queue *rules;
 static unsigned int next_rule_id;
+static struct l_hashmap *links;
 
 static uint32_t hwsim_iftypes = HWSIM_DEFAULT_IFTYPES;
 static const uint32_t hwsim_supported_ciphers[] = {
@@ -431,10 +442,148 @@ struct interface_info_rec {
 static struct l_queue *radio_info;
 static struct l_queue *interface_info;
 
+/*
+ * Address lookups done for every forwarded frame.  They are rebuilt from
+ * radio_info and interface_info on first use after any change to either,
+ * the keys point straight at the addresses stored in the records.
+ */
+static struct addr_index {
+	struct l_hashmap *radios;	/* Radio address -> radio */
+	struct l_hashmap *interfaces;	/* Interface address -> record */
+	bool interface_dups;
+	bool stale;
+} addr_index = { .stale = true };
+
+static void addr_index_invalidate(void)
+{
+	addr_index.stale = true;
+}
+
+static unsigned int addr_hash(const void *p)
+{
+	const uint8_t *addr = p;
+
+	return l_get_le32(addr + 2) ^ l_get_le16(addr);
+}
+
+static int addr_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, ETH_ALEN);
+}
+
+static struct l_hashmap *addr_index_new(void)
+{
+	struct l_hashmap *map = l_hashmap_new();
+
+	l_hashmap_set_hash_function(map, addr_hash);
+	l_hashmap_set_compare_function(map, addr_compare);
+
+	return map;
+}
+
+/* First match wins, same as l_queue_find() over the records did */
+static bool addr_index_add(struct l_hashmap *map, const uint8_t *addr,
+				void *value)
+{
+	if (l_hashmap_lookup(map, addr))
+		return false;
+
+	l_hashmap_insert(map, addr, value);
+	return true;
+}
+
+static void addr_index_update(void)
+{
+	const struct l_queue_entry *entry;
+
+	if (!addr_index.stale)
+		return;
+
+	l_hashmap_destroy(addr_index.radios, NULL);
+	l_hashmap_destroy(addr_index.interfaces, NULL);
+	addr_index.radios = addr_index_new();
+	addr_index.interfaces = addr_index_new();
+	addr_index.interface_dups = false;
+
+	for (entry = l_queue_get_entries(radio_info); entry;
+						entry = entry->next) {
+		struct radio_info_rec *rec = entry->data;
+
+		addr_index_add(addr_index.radios, rec->addrs[0], rec);
+		addr_index_add(addr_index.radios, rec->addrs[1], rec);
+	}
+
+	for (entry = l_queue_get_entries(interface_info); entry;
+						entry = entry->next) {
+		struct interface_info_rec *rec = entry->data;
+
+		if (!addr_index_add(addr_index.interfaces, rec->addr, rec))
+			addr_index.interface_dups = true;
+	}
+
+	addr_index.stale = false;
+}
+
+static void addr_index_cleanup(void)
+{
+	l_hashmap_destroy(addr_index.radios, NULL);
+	l_hashmap_destroy(addr_index.interfaces, NULL);
+	addr_index.radios = NULL;
+	addr_index.interfaces = NULL;
+	addr_index.stale = true;
+}
+
+static struct radio_info_rec *radio_find_by_addr(const uint8_t *addr)
+{
+	addr_index_update();
+
+	return l_hashmap_lookup(addr_index.radios, addr);
+}
+
+static void *link_key(int32_t src_id, int32_t dst_id)
+{
+	return L_UINT_TO_PTR(((uint32_t) src_id << 16) | (uint16_t) dst_id);
+}
+
+static struct hwsim_link *link_find(const struct radio_info_rec *src,
+					const struct radio_info_rec *dst)
+{
+	if (!links || !src || !dst)
+		return NULL;
+
+	return l_hashmap_lookup(links, link_key(src->id, dst->id));
+}
+
+static bool link_match_radio(const void *key, void *value, void *user_data)
+{
+	struct hwsim_link *link = value;
+	int32_t id = L_PTR_TO_INT(user_data);
+
+	if (link->src_id != id && link->dst_id != id)
+		return false;
+
+	l_free(link);
+	return true;
+}
+
+static bool link_lose_frame(const struct hwsim_link *link)
+{
+	if (!link || link->loss <= 0)
+		return false;
+
+	return l_getrandom_uint32() < link->loss * UINT32_MAX;
+}
+
 static void radio_free(void *user_data)
 {
 	struct radio_info_rec *rec = user_data;
 
+	addr_index_invalidate();
+
+	if (links && rec->id >= 0)
+		l_hashmap_foreach_remove(links, link_match_radio,
+						L_INT_TO_PTR(rec->id));
+
 	if (rec->cmd_id)
 		l_genl_family_cancel(nl80211, rec->cmd_id);
 
@@ -449,6 +598,8 @@ static void interface_free(void *user_data)
 {
 	struct interface_info_rec *rec = user_data;
 
+	addr_index_invalidate();
+
 	l_free(rec->name);
 	l_free(rec);
 }
@@ -459,6 +610,8 @@ static void hwsim_radio_cache_cleanup(void)
 	l_queue_destroy(interface_info, interface_free);
 	radio_info = NULL;
 	interface_info = NULL;
+
+	addr_index_cleanup();
 }
 
 static bool radio_info_match_id(const void *a, const void *b)
@@ -477,22 +630,6 @@ static bool radio_info_match_wiphy_id(const void *a, const void *b)
 	return rec->wiphy_id == id;
 }
 
-static bool radio_info_match_addr0(const void *a, const void *b)
-{
-	const struct radio_info_rec *rec = a;
-	const uint8_t *addr0 = b;
-
-	return !memcmp(rec->addrs[0], addr0, ETH_ALEN);
-}
-
-static bool radio_info_match_addr1(const void *a, const void *b)
-{
-	const struct radio_info_rec *rec = a;
-	const uint8_t *addr1 = b;
-
-	return !memcmp(rec->addrs[1], addr1, ETH_ALEN);
-}
-
 static bool interface_info_match_id(const void *a, const void *b)
 {
 	const struct interface_info_rec *rec = a;
@@ -755,6 +892,8 @@ static void get_radio_callback(struct l_genl_msg *msg, void *user_data)
 	if (new)
 		l_queue_push_tail(radio_info, rec);
 
+	addr_index_invalidate();
+
 	path = radio_get_path(rec);
 
 	if (!changed) {
@@ -909,6 +1048,8 @@ static void get_interface_callback(struct l_genl_msg *msg, void *user_data)
 	if (!old)
 		l_queue_push_tail(interface_info, rec);
 
+	addr_index_invalidate();
+
 	path = interface_get_path(rec);
 
 	if (!old) {
@@ -1129,6 +1270,9 @@ static void rtnl_newlink_notify(const struct ifinfomsg *ifi, int bytes)
 	if (!addr_change && !name_change)
 		return;
 
+	if (addr_change)
+		addr_index_invalidate();
+
 	path = interface_get_path(rec);
 
 	if (addr_change)
@@ -1192,14 +1336,39 @@ static bool radio_match_addr(const struct radio_info_rec *radio,
 		!memcmp(addr, radio->addrs[1], ETH_ALEN);
 }
 
-static void process_rules(const struct radio_info_rec *src_radio,
+/* The parts of a rule's match that only depend on the frame itself */
+static bool rule_match_frame(const struct hwsim_rule *rule,
+				const struct hwsim_frame *frame)
+{
+	if (rule->frequency && rule->frequency != frame->frequency)
+		return false;
+
+	if (rule->prefix && frame->payload_len >= rule->prefix_len) {
+		if (memcmp(rule->prefix, frame->payload,
+				rule->prefix_len) != 0)
+			return false;
+	}
+
+	if (rule->match && frame->payload_len >=
+				rule->match_len + rule->match_offset) {
+		if (memcmp(rule->match,
+				frame->payload + rule->match_offset,
+				rule->match_len))
+			return false;
+	}
+
+	return true;
+}
+
+static void process_rules(struct l_queue *rule_list,
+				const struct radio_info_rec *src_radio,
 				const struct radio_info_rec *dst_radio,
 				struct hwsim_frame *frame, bool ack, bool *drop,
 				uint32_t *delay)
 {
 	const struct l_queue_entry *rule_entry;
 
-	for (rule_entry = l_queue_get_entries(rules); rule_entry;
+	for (rule_entry = l_queue_get_entries(rule_list); rule_entry;
 			rule_entry = rule_entry->next) {
 		struct hwsim_rule *rule = rule_entry->data;
 
@@ -1232,23 +1401,9 @@ static void process_rules(const struct radio_info_rec *src_radio,
 							rule->destination))
 				continue;
 
-		if (rule->frequency && rule->frequency != frame->frequency)
+		if (!rule_match_frame(rule, frame))
 			continue;
 
-		if (rule->prefix && frame->payload_len >= rule->prefix_len) {
-			if (memcmp(rule->prefix, frame->payload,
-					rule->prefix_len) != 0)
-				continue;
-		}
-
-		if (rule->match && frame->payload_len >=
-					rule->match_len + rule->match_offset) {
-			if (memcmp(rule->match,
-					frame->payload + rule->match_offset,
-					rule->match_len))
-				continue;
-		}
-
 		/* Rule deemed to match frame, apply any changes */
 		if (rule->match_times == 0)
 			continue;
@@ -1268,9 +1423,46 @@ static void process_rules(const struct radio_info_rec *src_radio,
 	}
 }
 
+/*
+ * The rules that may apply to @frame on its way to any destination: the
+ * ones whose frame criteria match and whose source is either "any", the
+ * transmitting radio or may match the destination through bidirectional.
+ * Computed once per frame so that each destination radio only checks
+ * these, in the same priority order, instead of the full rule list.
+ */
+static struct l_queue *frame_rules_new(const struct hwsim_frame *frame)
+{
+	const struct l_queue_entry *entry;
+	struct l_queue *frame_rules = NULL;
+
+	for (entry = l_queue_get_entries(rules); entry; entry = entry->next) {
+		struct hwsim_rule *rule = entry->data;
+
+		/* process_rules() stops at the first disabled rule */
+		if (!rule->enabled)
+			break;
+
+		if (!rule->source_any && !rule->bidirectional &&
+				!radio_match_addr(frame->src_radio,
+							rule->source))
+			continue;
+
+		if (!rule_match_frame(rule, frame))
+			continue;
+
+		if (!frame_rules)
+			frame_rules = l_queue_new();
+
+		l_queue_push_tail(frame_rules, rule);
+	}
+
+	return frame_rules;
+}
+
 struct send_frame_info {
 	struct hwsim_frame *frame;
 	struct radio_info_rec *radio;
+	int32_t signal;
 	void *user_data;
 };
 
@@ -1312,8 +1504,7 @@ static bool send_frame(struct send_frame_info *info,
 				info->frame->payload);
 	l_genl_msg_append_attr(msg, HWSIM_ATTR_RX_RATE, 4,
 				&rx_rate);
-	l_genl_msg_append_attr(msg, HWSIM_ATTR_SIGNAL, 4,
-				&info->frame->signal);
+	l_genl_msg_append_attr(msg, HWSIM_ATTR_SIGNAL, 4, &info->signal);
 	l_genl_msg_append_attr(msg, HWSIM_ATTR_FREQ, 4,
 				&info->frame->frequency);
 
@@ -1347,8 +1538,13 @@ static void hwsim_frame_unref(struct hwsim_frame *frame)
 		if (!(frame->flags & HWSIM_TX_CTL_NO_ACK) && frame->acked) {
 			bool drop = false;
 
-			process_rules(frame->ack_radio, frame->src_radio,
-					frame, true, &drop, NULL);
+			process_rules(rules, frame->ack_radio,
+					frame->src_radio, frame, true, &drop,
+					NULL);
+
+			if (link_lose_frame(link_find(frame->ack_radio,
+							frame->src_radio)))
+				drop = true;
 
 			if (!drop)
 				frame->flags |= HWSIM_TX_STAT_ACK;
@@ -1428,10 +1624,10 @@ static bool send_custom_frame(const uint8_t *addr, uint32_t freq,
 	frame->payload = payload;
 
 	info->frame = frame;
+	info->signal = signal;
 	info->user_data = user_data;
 
-	info->radio = l_queue_find(radio_info, radio_info_match_addr0, addr) ?:
-		l_queue_find(radio_info, radio_info_match_addr1, addr);
+	info->radio = radio_find_by_addr(addr);
 	if (!info->radio)
 		goto error;
 
@@ -1471,11 +1667,14 @@ static void frame_delay_callback(struct l_timeout *timeout, void *user_data)
 static void process_frame(struct hwsim_frame *frame)
 {
 	const struct l_queue_entry *entry;
+	struct l_queue *frame_rules = frame_rules_new(frame);
+	const struct interface_info_rec *dst_interface = NULL;
+	bool unicast = !util_is_broadcast_address(frame->dst_ether_addr);
 	bool drop_mcast = false;
 	bool beacon = false;
 
-	if (util_is_broadcast_address(frame->dst_ether_addr))
-		process_rules(frame->src_radio, NULL, frame, false,
+	if (!unicast)
+		process_rules(frame_rules, frame->src_radio, NULL, frame, false,
 				&drop_mcast, NULL);
 
 	if (frame->payload_len >= 2 &&
@@ -1483,6 +1682,23 @@ static void process_frame(struct hwsim_frame *frame)
 			frame->payload[1] == 0x00)
 		beacon = true;
 
+	/*
+	 * A unicast frame only goes to the radio owning the interface with
+	 * that address.  In the unlikely case of several interfaces sharing
+	 * an address fall back to checking every radio below.
+	 */
+	if (unicast) {
+		addr_index_update();
+
+		dst_interface = l_hashmap_lookup(addr_index.interfaces,
+						frame->dst_ether_addr);
+		if (!dst_interface && !addr_index.interface_dups)
+			goto done;
+
+		if (addr_index.interface_dups)
+			dst_interface = NULL;
+	}
+
 	for (entry = l_queue_get_entries(radio_info); entry;
 			entry = entry->next) {
 		struct radio_info_rec *radio = entry->data;
@@ -1490,10 +1706,16 @@ static void process_frame(struct hwsim_frame *frame)
 		bool drop = drop_mcast;
 		uint32_t delay = 0;
 		const struct l_queue_entry *i;
+		const struct hwsim_link *link;
+		int32_t frame_signal = frame->signal;
+		int32_t signal;
 
 		if (radio == frame->src_radio)
 			continue;
 
+		if (dst_interface && dst_interface->radio_rec != radio)
+			continue;
+
 		/*
 		 * The kernel hwsim medium passes multicast frames to all
 		 * radios that are on the same frequency as this frame but
@@ -1508,7 +1730,7 @@ static void process_frame(struct hwsim_frame *frame)
 		 * by only forwarding the frame to the radios that have
 		 * at least one interface with this specific address.
 		 */
-		if (!util_is_broadcast_address(frame->dst_ether_addr)) {
+		if (unicast && !dst_interface) {
 			for (i = l_queue_get_entries(interface_info);
 					i; i = i->next) {
 				struct interface_info_rec *interface = i->data;
@@ -1526,10 +1748,22 @@ static void process_frame(struct hwsim_frame *frame)
 				continue;
 		}
 
-		process_rules(frame->src_radio, radio, frame, false,
-				&drop, &delay);
+		/* Rules can still override the link's signal and latency */
+		link = link_find(frame->src_radio, radio);
+		if (link) {
+			frame->signal = link->signal;
+			delay = link->latency;
+		}
+
+		process_rules(frame_rules, frame->src_radio, radio, frame,
+				false, &drop, &delay);
 
-		if (drop)
+		signal = frame->signal;
+
+		if (link)
+			frame->signal = frame_signal;
+
+		if (drop || link_lose_frame(link))
 			continue;
 
 		/*
@@ -1541,6 +1775,7 @@ static void process_frame(struct hwsim_frame *frame)
 
 		send_info = l_new(struct send_frame_info, 1);
 		send_info->radio = radio;
+		send_info->signal = signal;
 		send_info->frame = hwsim_frame_ref(frame);
 
 		if (delay) {
@@ -1555,6 +1790,8 @@ static void process_frame(struct hwsim_frame *frame)
 
 	}
 
+done:
+	l_queue_destroy(frame_rules, NULL);
 	hwsim_frame_unref(frame);
 }
 
@@ -1648,9 +1885,11 @@ static void unicast_handler(struct l_genl_msg *msg, void *user_data)
 	frame->msg = l_genl_msg_ref(msg);
 	frame->refcount = 1;
 
-	frame->src_radio = l_queue_find(radio_info, radio_info_match_addr1,
-					transmitter);
-	if (!frame->src_radio) {
+	frame->src_radio = radio_find_by_addr(transmitter);
+	if (!frame->src_radio ||
+			memcmp(frame->src_radio->addrs[1], transmitter,
+				ETH_ALEN)) {
+		frame->src_radio = NULL;
 		l_error("Unknown transmitter address %s, probably need to "
 			"update radio dump code for this kernel",
 			util_address_to_string(transmitter));
@@ -1774,6 +2013,7 @@ static struct l_dbus_message *radio_manager_create(struct l_dbus *dbus,
 		radio_info = l_queue_new();
 
 	l_queue_push_tail(radio_info, radio);
+	addr_index_invalidate();
 
 	radio->cmd_id = l_genl_family_send(hwsim, new_msg,
 						radio_manager_create_callback,
@@ -2072,6 +2312,99 @@ static void setup_rule_manager_interface(struct l_dbus_interface *interface)
 				rule_add, "o", "", "path");
 }
 
+static struct radio_info_rec *radio_find_by_path(const char *path)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(radio_info); entry;
+						entry = entry->next) {
+		struct radio_info_rec *rec = entry->data;
+
+		if (rec->id >= 0 && !strcmp(radio_get_path(rec), path))
+			return rec;
+	}
+
+	return NULL;
+}
+
+static struct l_dbus_message *link_set(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					void *user_data)
+{
+	const char *src_path;
+	const char *dst_path;
+	const struct radio_info_rec *src;
+	const struct radio_info_rec *dst;
+	int16_t signal;
+	double loss;
+	uint32_t latency;
+	struct hwsim_link *link;
+	void *key;
+
+	if (!l_dbus_message_get_arguments(message, "oonud", &src_path,
+						&dst_path, &signal, &latency,
+						&loss))
+		return dbus_error_invalid_args(message);
+
+	src = radio_find_by_path(src_path);
+	dst = radio_find_by_path(dst_path);
+
+	if (!src || !dst || src == dst || loss < 0 || loss > 1)
+		return dbus_error_invalid_args(message);
+
+	if (!links)
+		links = l_hashmap_new();
+
+	key = link_key(src->id, dst->id);
+
+	link = l_hashmap_lookup(links, key);
+	if (!link) {
+		link = l_new(struct hwsim_link, 1);
+		link->src_id = src->id;
+		link->dst_id = dst->id;
+		l_hashmap_insert(links, key, link);
+	}
+
+	link->signal = signal / 100;
+	link->latency = latency;
+	link->loss = loss;
+
+	return l_dbus_message_new_method_return(message);
+}
+
+static struct l_dbus_message *link_remove(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					void *user_data)
+{
+	const char *src_path;
+	const char *dst_path;
+	const struct radio_info_rec *src;
+	const struct radio_info_rec *dst;
+
+	if (!l_dbus_message_get_arguments(message, "oo", &src_path,
+						&dst_path))
+		return dbus_error_invalid_args(message);
+
+	src = radio_find_by_path(src_path);
+	dst = radio_find_by_path(dst_path);
+
+	if (!src || !dst || !links)
+		return dbus_error_invalid_args(message);
+
+	l_free(l_hashmap_remove(links, link_key(src->id, dst->id)));
+
+	return l_dbus_message_new_method_return(message);
+}
+
+static void setup_link_model_interface(struct l_dbus_interface *interface)
+{
+	l_dbus_interface_method(interface, "SetLink", 0, link_set, "",
+				"oonud", "source", "destination", "signal",
+				"latency", "loss");
+	l_dbus_interface_method(interface, "RemoveLink", 0, link_remove, "",
+				"oo", "source", "destination");
+}
+
 static struct l_dbus_message *rule_remove(struct l_dbus *dbus,
 						struct l_dbus_message *message,
 						void *user_data)
@@ -2726,6 +3059,14 @@ static bool setup_dbus_hwsim(void)
 		return false;
 	}
 
+	if (!l_dbus_register_interface(dbus, HWSIM_LINK_MODEL_INTERFACE,
+					setup_link_model_interface,
+					NULL, false)) {
+		l_error("Unable to register the %s interface",
+			HWSIM_LINK_MODEL_INTERFACE);
+		return false;
+	}
+
 	if (!l_dbus_object_add_interface(dbus, "/",
 						HWSIM_RADIO_MANAGER_INTERFACE,
 						NULL)) {
@@ -2742,6 +3083,14 @@ static bool setup_dbus_hwsim(void)
 		return false;
 	}
 
+	if (!l_dbus_object_add_interface(dbus, "/",
+						HWSIM_LINK_MODEL_INTERFACE,
+						NULL)) {
+		l_info("Unable to add the %s interface to /",
+			HWSIM_LINK_MODEL_INTERFACE);
+		return false;
+	}
+
 	l_dbus_set_ready_handler(dbus, ready_callback, dbus, NULL);
 	l_dbus_set_disconnect_handler(dbus, disconnect_callback, NULL, NULL);
 
@@ -3112,6 +3461,7 @@ int main(int argc, char *argv[])
 	l_dbus_destroy(dbus);
 	hwsim_radio_cache_cleanup();
 	l_queue_destroy(rules, l_free);
+	l_hashmap_destroy(links, l_free);
 
 	l_netlink_destroy(rtnl);
 
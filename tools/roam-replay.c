@@ -0,0 +1,968 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/time.h>
+#include <linux/if_arp.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+
+#include <ell/ell.h>
+
+#include "linux/nl80211.h"
+#include "src/iwd.h"
+#include "src/ie.h"
+#include "src/util.h"
+#include "src/common.h"
+#include "src/band.h"
+#include "src/wiphy.h"
+#include "src/netdev.h"
+#include "src/knownnetworks.h"
+#include "src/bss-history.h"
+#include "src/scan.h"
+#include "monitor/pcap.h"
+
+/*
+ * scan.c is linked on its own, as in scan-bench, so that BSSes are parsed
+ * and ranked by the same code as in the daemon.  The local capabilities
+ * used for the data rate estimation are those of a typical 2x2 HT/VHT
+ * station since the capture does not record the wiphy.
+ */
+static struct band *local_band;
+
+int wiphy_estimate_data_rate(struct wiphy *wiphy,
+				const void *ies, uint16_t ies_len,
+				const struct scan_bss *bss,
+				uint64_t *out_data_rate)
+{
+	struct ie_tlv_iter iter;
+	const void *supported_rates = NULL;
+	const void *ext_supported_rates = NULL;
+	const void *vht_capabilities = NULL;
+	const void *vht_operation = NULL;
+	const void *ht_capabilities = NULL;
+	const void *ht_operation = NULL;
+	int32_t rssi = bss->signal_strength / 100;
+
+	ie_tlv_iter_init(&iter, ies, ies_len);
+
+	while (ie_tlv_iter_next(&iter)) {
+		switch (ie_tlv_iter_get_tag(&iter)) {
+		case IE_TYPE_SUPPORTED_RATES:
+			if (iter.len > 8)
+				return -EBADMSG;
+
+			supported_rates = iter.data - 2;
+			break;
+		case IE_TYPE_EXTENDED_SUPPORTED_RATES:
+			ext_supported_rates = iter.data - 2;
+			break;
+		case IE_TYPE_HT_CAPABILITIES:
+			if (iter.len != 26)
+				return -EBADMSG;
+
+			ht_capabilities = iter.data - 2;
+			break;
+		case IE_TYPE_HT_OPERATION:
+			if (iter.len != 22)
+				return -EBADMSG;
+
+			ht_operation = iter.data - 2;
+			break;
+		case IE_TYPE_VHT_CAPABILITIES:
+			if (iter.len != 12)
+				return -EBADMSG;
+
+			vht_capabilities = iter.data - 2;
+			break;
+		case IE_TYPE_VHT_OPERATION:
+			if (iter.len != 5)
+				return -EBADMSG;
+
+			vht_operation = iter.data - 2;
+			break;
+		}
+	}
+
+	if (!band_estimate_vht_rx_rate(local_band, vht_capabilities,
+					vht_operation, ht_capabilities,
+					ht_operation, rssi, out_data_rate))
+		return 0;
+
+	if (!band_estimate_ht_rx_rate(local_band, ht_capabilities,
+					ht_operation, rssi, out_data_rate))
+		return 0;
+
+	return band_estimate_nonht_rate(local_band, supported_rates,
+					ext_supported_rates, rssi,
+					out_data_rate);
+}
+
+static struct band *local_band_new(void)
+{
+	static const uint8_t rates[] = {
+		2, 4, 11, 22, 12, 18, 24, 36, 48, 72, 96, 108
+	};
+	/* MCS 0-9 for two spatial streams, in both directions */
+	static const uint8_t vht_mcs_set[8] = {
+		0xfa, 0xff, 0x00, 0x00, 0xfa, 0xff, 0x00, 0x00
+	};
+	struct band *band = l_malloc(sizeof(struct band) + sizeof(rates));
+
+	memset(band, 0, sizeof(struct band));
+
+	band->supported_rates_len = sizeof(rates);
+	memcpy(band->supported_rates, rates, sizeof(rates));
+
+	/* MCS 0-15, 40 MHz with Short GI */
+	band->ht_supported = true;
+	band->ht_mcs_set[0] = 0xff;
+	band->ht_mcs_set[1] = 0xff;
+	band->ht_capabilities[0] = 0x62;
+
+	/* 80 MHz with Short GI */
+	band->vht_supported = true;
+	memcpy(band->vht_mcs_set, vht_mcs_set, sizeof(vht_mcs_set));
+	band->vht_capabilities[0] = 0x20;
+
+	return band;
+}
+
+/* No history is available for the BSSes of a capture */
+double bss_history_rank_factor(const struct scan_bss *bss)
+{
+	return 1.0;
+}
+
+const struct l_settings *iwd_get_config(void)
+{
+	return NULL;
+}
+
+struct l_genl *iwd_get_genl(void)
+{
+	return NULL;
+}
+
+void iwd_startup_trace(const char *format, ...)
+{
+}
+
+void iwd_startup_trace_end(void)
+{
+}
+
+bool known_networks_foreach(known_networks_foreach_func_t function,
+				void *user_data)
+{
+	return false;
+}
+
+bool known_networks_has_hidden(void)
+{
+	return false;
+}
+
+struct wiphy *wiphy_find(int wiphy_id)
+{
+	return NULL;
+}
+
+uint32_t wiphy_get_id(struct wiphy *wiphy)
+{
+	return 0;
+}
+
+const struct scan_freq_set *wiphy_get_supported_freqs(
+						const struct wiphy *wiphy)
+{
+	return NULL;
+}
+
+bool wiphy_can_randomize_mac_addr(struct wiphy *wiphy)
+{
+	return false;
+}
+
+bool wiphy_has_ext_feature(struct wiphy *wiphy, uint32_t feature)
+{
+	return false;
+}
+
+uint32_t wiphy_get_supported_bands(struct wiphy *wiphy)
+{
+	return 0;
+}
+
+bool wiphy_has_feature(struct wiphy *wiphy, uint32_t feature)
+{
+	return false;
+}
+
+bool wiphy_supports_sched_scan(struct wiphy *wiphy)
+{
+	return false;
+}
+
+uint8_t wiphy_get_max_num_sched_ssids(struct wiphy *wiphy)
+{
+	return 0;
+}
+
+uint8_t wiphy_get_max_match_sets(struct wiphy *wiphy)
+{
+	return 0;
+}
+
+uint32_t wiphy_get_wowlan_max_nd_match_sets(struct wiphy *wiphy)
+{
+	return 0;
+}
+
+void wiphy_get_sched_scan_plan_limits(struct wiphy *wiphy,
+					uint32_t *max_plans,
+					uint32_t *max_interval,
+					uint32_t *max_iterations)
+{
+	*max_plans = 0;
+	*max_interval = 0;
+	*max_iterations = 0;
+}
+
+uint8_t wiphy_get_max_num_ssids_per_scan(struct wiphy *wiphy)
+{
+	return 1;
+}
+
+uint16_t wiphy_get_max_scan_ie_len(struct wiphy *wiphy)
+{
+	return 0;
+}
+
+const uint8_t *wiphy_get_supported_rates(struct wiphy *wiphy,
+						unsigned int band,
+						unsigned int *out_num)
+{
+	return NULL;
+}
+
+const uint8_t *wiphy_get_extended_capabilities(struct wiphy *wiphy,
+							uint32_t iftype)
+{
+	return NULL;
+}
+
+uint32_t wiphy_radio_work_insert(struct wiphy *wiphy,
+				struct wiphy_radio_work_item *item,
+				int priority,
+				const struct wiphy_radio_work_item_ops *ops)
+{
+	return 0;
+}
+
+void wiphy_radio_work_done(struct wiphy *wiphy, uint32_t id)
+{
+}
+
+int wiphy_radio_work_is_running(struct wiphy *wiphy, uint32_t id)
+{
+	return -ENOENT;
+}
+
+struct netdev *netdev_find(int ifindex)
+{
+	return NULL;
+}
+
+uint64_t netdev_get_wdev_id(struct netdev *netdev)
+{
+	return 0;
+}
+
+/* An nl80211 message of the capture with its time, in us from the start */
+struct replay_msg {
+	uint64_t time;
+	uint16_t flags;
+	uint32_t seq;
+	uint8_t cmd;
+	struct l_genl_msg *msg;
+};
+
+/* CPU time spent replaying one kind of event */
+struct replay_handler {
+	const char *name;
+	unsigned long calls;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+enum replay_handler_id {
+	HANDLER_SCAN_RESULTS,
+	HANDLER_ROAM_EVALUATE,
+	HANDLER_CONNECTION,
+	HANDLER_CQM,
+	__HANDLER_MAX,
+};
+
+static struct replay_handler handlers[__HANDLER_MAX] = {
+	[HANDLER_SCAN_RESULTS] = { .name = "scan results" },
+	[HANDLER_ROAM_EVALUATE] = { .name = "roam evaluation" },
+	[HANDLER_CONNECTION] = { .name = "connection events" },
+	[HANDLER_CQM] = { .name = "cqm events" },
+};
+
+struct replay {
+	bool all_scans;
+	bool quiet;
+
+	/* The latest sighting of every BSS, by address */
+	struct l_hashmap *bsses;
+	struct l_queue *scan;
+	uint32_t scan_seq;
+	uint64_t scan_time;
+
+	bool connected;
+	uint8_t connected_addr[6];
+	bool roam_triggered;
+
+	/* Last decision, compared against what the trace did next */
+	bool decision_pending;
+	bool decision_roam;
+	uint8_t decision_addr[6];
+
+	unsigned int n_scans;
+	unsigned int n_triggers;
+	unsigned int n_evaluations;
+	unsigned int n_roams;
+	unsigned int n_no_candidates;
+	unsigned int n_agree;
+	unsigned int n_disagree;
+};
+
+static uint64_t cpu_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void handler_account(enum replay_handler_id id, uint64_t start)
+{
+	struct replay_handler *handler = &handlers[id];
+	uint64_t ns = cpu_time_ns() - start;
+
+	handler->calls++;
+	handler->total_ns += ns;
+
+	if (ns > handler->max_ns)
+		handler->max_ns = ns;
+}
+
+static void replay_log(struct replay *replay, uint64_t time,
+						const char *format, ...)
+{
+	va_list args;
+
+	if (replay->quiet)
+		return;
+
+	printf("%6" PRIu64 ".%03" PRIu64 " ", time / L_USEC_PER_SEC,
+			time % L_USEC_PER_SEC / L_USEC_PER_MSEC);
+
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+
+	printf("\n");
+}
+
+static bool msg_get_bss_attr(struct l_genl_msg *msg, struct l_genl_attr *bss)
+{
+	struct l_genl_attr attr;
+	uint16_t type, len;
+	const void *data;
+
+	if (!l_genl_attr_init(&attr, msg))
+		return false;
+
+	while (l_genl_attr_next(&attr, &type, &len, &data))
+		if (type == NL80211_ATTR_BSS)
+			return l_genl_attr_recurse(&attr, bss);
+
+	return false;
+}
+
+static const void *msg_get_attr(struct l_genl_msg *msg, uint16_t want,
+						uint16_t *out_len)
+{
+	struct l_genl_attr attr;
+	uint16_t type, len;
+	const void *data;
+
+	if (!l_genl_attr_init(&attr, msg))
+		return NULL;
+
+	while (l_genl_attr_next(&attr, &type, &len, &data)) {
+		if (type != want)
+			continue;
+
+		if (out_len)
+			*out_len = len;
+
+		return data;
+	}
+
+	return NULL;
+}
+
+/*
+ * All the nl80211 traffic of captures recorded with iwmon -w, in the order
+ * it was seen.  The times are made relative to the first message.
+ */
+static int load_pcap(const char *pathname, struct l_queue *msgs)
+{
+	struct pcap *pcap;
+	struct timeval tv;
+	const uint8_t *buf;
+	uint32_t len, real_len;
+	uint64_t first = 0;
+	int count = 0;
+
+	pcap = pcap_open(pathname);
+	if (!pcap)
+		return -ENOENT;
+
+	if (pcap_get_type(pcap) != PCAP_TYPE_LINUX_SLL) {
+		pcap_close(pcap);
+		return -EINVAL;
+	}
+
+	while (pcap_read_ref(pcap, &tv, (const void **) &buf,
+						&len, &real_len)) {
+		uint64_t time = tv.tv_sec * L_USEC_PER_SEC + tv.tv_usec;
+		struct nlmsghdr *nlmsg;
+		uint32_t aligned_len;
+
+		if (len < 16 || len < real_len)
+			continue;
+
+		if (l_get_be16(buf + 2) != ARPHRD_NETLINK ||
+				l_get_be16(buf + 14) != NETLINK_GENERIC)
+			continue;
+
+		if (!first)
+			first = time;
+
+		aligned_len = NLMSG_ALIGN(len - 16);
+
+		for (nlmsg = (struct nlmsghdr *) (buf + 16);
+				NLMSG_OK(nlmsg, aligned_len);
+				nlmsg = NLMSG_NEXT(nlmsg, aligned_len)) {
+			const struct genlmsghdr *genlmsg = NLMSG_DATA(nlmsg);
+			struct replay_msg *rmsg;
+			struct l_genl_msg *msg;
+
+			if (nlmsg->nlmsg_type < NLMSG_MIN_TYPE ||
+					nlmsg->nlmsg_len < NLMSG_HDRLEN +
+								GENL_HDRLEN)
+				continue;
+
+			msg = l_genl_msg_new_from_data(nlmsg,
+							nlmsg->nlmsg_len);
+			if (!msg)
+				continue;
+
+			rmsg = l_new(struct replay_msg, 1);
+			rmsg->time = time - first;
+			rmsg->flags = nlmsg->nlmsg_flags;
+			rmsg->seq = nlmsg->nlmsg_seq;
+			rmsg->cmd = genlmsg->cmd;
+			rmsg->msg = msg;
+
+			l_queue_push_tail(msgs, rmsg);
+			count++;
+		}
+	}
+
+	pcap_close(pcap);
+
+	return count;
+}
+
+static void replay_msg_free(void *data)
+{
+	struct replay_msg *rmsg = data;
+
+	l_genl_msg_unref(rmsg->msg);
+	l_free(rmsg);
+}
+
+static unsigned int bss_addr_hash(const void *key)
+{
+	const uint8_t *addr = key;
+
+	return l_get_le32(addr + 2);
+}
+
+static int bss_addr_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, 6);
+}
+
+/*
+ * Uses the same candidate predicate and ranking as station's roam scan
+ * handling.  The blacklist and the network's connect restrictions are not
+ * known from a capture.
+ */
+static void replay_roam_evaluate(struct replay *replay)
+{
+	struct scan_bss *connected;
+	const uint8_t *mdid;
+	struct scan_bss *best = NULL;
+	double best_rank = 0.0;
+	enum security security;
+	const struct l_queue_entry *entry;
+	bool seen = false;
+
+	connected = l_hashmap_lookup(replay->bsses, replay->connected_addr);
+	if (!connected || scan_bss_get_security(connected, &security) < 0)
+		return;
+
+	mdid = connected->mde_present ? connected->mde : NULL;
+
+	replay->n_evaluations++;
+
+	for (entry = l_queue_get_entries(replay->scan); entry;
+						entry = entry->next) {
+		struct scan_bss *bss = entry->data;
+		double rank;
+
+		if (!scan_bss_roam_in_ess(bss, connected->ssid,
+						connected->ssid_len, security))
+			continue;
+
+		seen = true;
+		rank = scan_bss_roam_rank(bss, mdid);
+
+		if (rank > best_rank) {
+			best = bss;
+			best_rank = rank;
+		}
+	}
+
+	if (!seen)
+		return;
+
+	replay->decision_pending = true;
+
+	if (!best || !memcmp(best->addr, replay->connected_addr, 6)) {
+		replay->n_no_candidates++;
+		replay->decision_roam = false;
+		replay_log(replay, replay->scan_time, "  no roam candidates, "
+				"staying on %s rank %u",
+				util_address_to_string(replay->connected_addr),
+				connected->rank);
+		return;
+	}
+
+	replay->n_roams++;
+	replay->decision_roam = true;
+	memcpy(replay->decision_addr, best->addr, 6);
+	replay_log(replay, replay->scan_time, "  roam %s rank %u -> %s "
+			"rank %.0f %d dBm",
+			util_address_to_string(replay->connected_addr),
+			connected->rank, util_address_to_string(best->addr),
+			best_rank, best->signal_strength / 100);
+}
+
+static void replay_scan_done(struct replay *replay)
+{
+	uint64_t start;
+
+	if (!replay->scan)
+		return;
+
+	replay->n_scans++;
+	replay_log(replay, replay->scan_time, "scan results, %u BSSes",
+			l_queue_length(replay->scan));
+
+	if (replay->connected && (replay->roam_triggered ||
+					replay->all_scans)) {
+		start = cpu_time_ns();
+		replay_roam_evaluate(replay);
+		handler_account(HANDLER_ROAM_EVALUATE, start);
+		replay->roam_triggered = false;
+	}
+
+	l_queue_destroy(replay->scan, NULL);
+	replay->scan = NULL;
+}
+
+static void replay_scan_result(struct replay *replay,
+					const struct replay_msg *rmsg)
+{
+	struct l_genl_attr attr;
+	struct scan_bss *bss;
+	struct scan_bss *old;
+	uint32_t seen_ms_ago = 0;
+	uint64_t start;
+
+	if (!msg_get_bss_attr(rmsg->msg, &attr))
+		return;
+
+	/* A new dump, the previous one is complete */
+	if (replay->scan && rmsg->seq != replay->scan_seq)
+		replay_scan_done(replay);
+
+	start = cpu_time_ns();
+
+	bss = scan_parse_attr_bss(&attr, NULL, &seen_ms_ago);
+	if (!bss)
+		goto done;
+
+	scan_bss_compute_rank(bss);
+
+	if (!replay->scan) {
+		replay->scan = l_queue_new();
+		replay->scan_seq = rmsg->seq;
+		replay->scan_time = rmsg->time;
+	}
+
+	l_queue_insert(replay->scan, bss, scan_bss_rank_compare, NULL);
+
+	old = l_hashmap_remove(replay->bsses, bss->addr);
+	if (old) {
+		/* Seen twice in the same dump, e.g. on another channel */
+		l_queue_remove(replay->scan, old);
+		scan_bss_free(old);
+	}
+
+	l_hashmap_insert(replay->bsses, bss->addr, bss);
+
+done:
+	handler_account(HANDLER_SCAN_RESULTS, start);
+}
+
+static void replay_connected(struct replay *replay, uint64_t time,
+					const uint8_t *addr)
+{
+	if (replay->decision_pending) {
+		bool agree;
+
+		if (replay->decision_roam)
+			agree = !memcmp(replay->decision_addr, addr, 6);
+		else
+			agree = !memcmp(replay->connected_addr, addr, 6);
+
+		if (agree)
+			replay->n_agree++;
+		else
+			replay->n_disagree++;
+
+		replay->decision_pending = false;
+	}
+
+	replay->connected = true;
+	memcpy(replay->connected_addr, addr, 6);
+	replay->roam_triggered = false;
+
+	replay_log(replay, time, "connected to %s",
+			util_address_to_string(addr));
+}
+
+static void replay_connection_event(struct replay *replay,
+					const struct replay_msg *rmsg)
+{
+	const uint8_t *addr;
+	const uint8_t *frame;
+	const void *status;
+	uint16_t len;
+
+	switch (rmsg->cmd) {
+	case NL80211_CMD_CONNECT:
+	case NL80211_CMD_ROAM:
+		status = msg_get_attr(rmsg->msg, NL80211_ATTR_STATUS_CODE,
+					&len);
+		addr = msg_get_attr(rmsg->msg, NL80211_ATTR_MAC, &len);
+
+		if (!addr || len != 6 || (status && l_get_u16(status)))
+			return;
+
+		replay_connected(replay, rmsg->time, addr);
+		break;
+	case NL80211_CMD_ASSOCIATE:
+		/* SoftMAC, the Association Response frame is reported */
+		frame = msg_get_attr(rmsg->msg, NL80211_ATTR_FRAME, &len);
+		if (!frame || len < 24 + 6 ||
+				l_get_le16(frame + 24 + 2) != 0)
+			return;
+
+		replay_connected(replay, rmsg->time, frame + 16);
+		break;
+	case NL80211_CMD_DISCONNECT:
+	case NL80211_CMD_DEAUTHENTICATE:
+	case NL80211_CMD_DISASSOCIATE:
+		if (!replay->connected)
+			return;
+
+		replay->connected = false;
+		replay->roam_triggered = false;
+		replay_log(replay, rmsg->time, "disconnected from %s",
+				util_address_to_string(replay->connected_addr));
+		break;
+	}
+}
+
+static void replay_cqm_event(struct replay *replay,
+				const struct replay_msg *rmsg)
+{
+	struct l_genl_attr attr;
+	struct l_genl_attr nested;
+	uint16_t type, len;
+	const void *data;
+	bool low = false;
+	int32_t level = 0;
+
+	if (!msg_get_attr(rmsg->msg, NL80211_ATTR_CQM, NULL))
+		return;
+
+	l_genl_attr_init(&attr, rmsg->msg);
+
+	while (l_genl_attr_next(&attr, &type, &len, &data))
+		if (type == NL80211_ATTR_CQM)
+			break;
+
+	if (!l_genl_attr_recurse(&attr, &nested))
+		return;
+
+	while (l_genl_attr_next(&nested, &type, &len, &data)) {
+		switch (type) {
+		case NL80211_ATTR_CQM_RSSI_THRESHOLD_EVENT:
+			if (len == 4 && l_get_u32(data) ==
+					NL80211_CQM_RSSI_THRESHOLD_EVENT_LOW)
+				low = true;
+			break;
+		case NL80211_ATTR_CQM_RSSI_LEVEL:
+			if (len == 4)
+				level = (int32_t) l_get_u32(data);
+			break;
+		case NL80211_ATTR_CQM_BEACON_LOSS_EVENT:
+			low = true;
+			break;
+		}
+	}
+
+	if (!low || !replay->connected)
+		return;
+
+	replay->n_triggers++;
+	replay->roam_triggered = true;
+
+	if (level)
+		replay_log(replay, rmsg->time, "signal low, %d dBm", level);
+	else
+		replay_log(replay, rmsg->time, "signal low");
+}
+
+static void replay_msg(struct replay *replay, const struct replay_msg *rmsg)
+{
+	uint64_t start;
+
+	if (rmsg->cmd == NL80211_CMD_NEW_SCAN_RESULTS) {
+		replay_scan_result(replay, rmsg);
+		return;
+	}
+
+	/* Only the kernel's side of the conversation is replayed */
+	if (rmsg->flags & NLM_F_REQUEST)
+		return;
+
+	switch (rmsg->cmd) {
+	case NL80211_CMD_CONNECT:
+	case NL80211_CMD_ROAM:
+	case NL80211_CMD_ASSOCIATE:
+	case NL80211_CMD_DISCONNECT:
+	case NL80211_CMD_DEAUTHENTICATE:
+	case NL80211_CMD_DISASSOCIATE:
+		replay_scan_done(replay);
+
+		start = cpu_time_ns();
+		replay_connection_event(replay, rmsg);
+		handler_account(HANDLER_CONNECTION, start);
+		break;
+	case NL80211_CMD_NOTIFY_CQM:
+		replay_scan_done(replay);
+
+		start = cpu_time_ns();
+		replay_cqm_event(replay, rmsg);
+		handler_account(HANDLER_CQM, start);
+		break;
+	}
+}
+
+static void usage(void)
+{
+	printf("roam-replay - Replay roaming decisions from captures\n"
+		"Usage:\n");
+	printf("\troam-replay [OPTIONS] capture.pcap ...\n");
+	printf("\nCaptures are recorded with iwmon -w.  The scan results "
+		"are ranked as by\niwd and the roam candidate selection "
+		"is run after every low signal\nevent, the decisions are "
+		"compared with the connections in the capture.\n");
+	printf("\nOptions:\n"
+		"\t-a, --all-scans        Evaluate roaming after every scan\n"
+		"\t-q, --quiet            Only print the summary\n"
+		"\t-h, --help             Show help options\n\n");
+}
+
+static const struct option main_options[] = {
+	{ "all-scans", no_argument,   NULL, 'a' },
+	{ "quiet", no_argument,       NULL, 'q' },
+	{ "help", no_argument,        NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	struct replay replay;
+	struct l_queue *msgs;
+	const struct l_queue_entry *entry;
+	struct replay_msg *last;
+	uint64_t start;
+	uint64_t total_ns;
+	unsigned int i;
+	int ret = EXIT_FAILURE;
+
+	memset(&replay, 0, sizeof(replay));
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "aqh", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'a':
+			replay.all_scans = true;
+			break;
+		case 'q':
+			replay.quiet = true;
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind == argc) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	local_band = local_band_new();
+	msgs = l_queue_new();
+
+	replay.bsses = l_hashmap_new();
+	l_hashmap_set_hash_function(replay.bsses, bss_addr_hash);
+	l_hashmap_set_compare_function(replay.bsses, bss_addr_compare);
+
+	for (i = optind; i < (unsigned int) argc; i++) {
+		int r = load_pcap(argv[i], msgs);
+
+		if (r < 0) {
+			fprintf(stderr, "%s: %s\n", argv[i], strerror(-r));
+			goto done;
+		}
+
+		printf("%s: %d nl80211 messages\n", argv[i], r);
+	}
+
+	if (l_queue_isempty(msgs)) {
+		fprintf(stderr, "No nl80211 messages to replay\n");
+		goto done;
+	}
+
+	start = cpu_time_ns();
+
+	for (entry = l_queue_get_entries(msgs); entry; entry = entry->next)
+		replay_msg(&replay, entry->data);
+
+	replay_scan_done(&replay);
+	total_ns = cpu_time_ns() - start;
+
+	last = l_queue_peek_tail(msgs);
+
+	printf("\n%u scans, %u low signal events, %u roam evaluations\n",
+		replay.n_scans, replay.n_triggers, replay.n_evaluations);
+	printf("%u roams decided, %u times no better candidate\n",
+		replay.n_roams, replay.n_no_candidates);
+	printf("%u decisions matched the capture, %u differed\n",
+		replay.n_agree, replay.n_disagree);
+
+	printf("\n%-20s %8s %12s %12s\n", "handler", "calls", "mean ns",
+		"max ns");
+
+	for (i = 0; i < __HANDLER_MAX; i++) {
+		struct replay_handler *handler = &handlers[i];
+
+		if (!handler->calls)
+			continue;
+
+		printf("%-20s %8lu %12.1f %12" PRIu64 "\n", handler->name,
+			handler->calls,
+			(double) handler->total_ns / handler->calls,
+			handler->max_ns);
+	}
+
+	if (total_ns)
+		printf("\n%.3f s of capture replayed in %.3f ms, %.0fx "
+			"real time\n", (double) last->time / L_USEC_PER_SEC,
+			(double) total_ns / 1000000,
+			(double) last->time * 1000 / total_ns);
+
+	ret = EXIT_SUCCESS;
+
+done:
+	l_queue_destroy(replay.scan, NULL);
+	l_hashmap_destroy(replay.bsses,
+				(l_hashmap_destroy_func_t) scan_bss_free);
+	l_queue_destroy(msgs, replay_msg_free);
+	l_free(local_band);
+
+	return ret;
+}
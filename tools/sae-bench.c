@@ -0,0 +1,412 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+
+#include <ell/ell.h>
+
+#include "src/util.h"
+#include "src/ie.h"
+#include "src/handshake.h"
+#include "src/mpdu.h"
+#include "src/sae.h"
+#include "src/auth-proto.h"
+
+/*
+ * Both the supported group list and l_malloc are wrapped at link time so
+ * that a single group can be forced and allocations made while driving
+ * the state machines can be counted.
+ */
+const unsigned int *__wrap_l_ecc_supported_ike_groups(void);
+void *__wrap_l_malloc(size_t size);
+void *__real_l_malloc(size_t size);
+
+static unsigned int bench_groups[2];
+static unsigned long alloc_count;
+
+const unsigned int *__wrap_l_ecc_supported_ike_groups(void)
+{
+	return bench_groups;
+}
+
+void *__wrap_l_malloc(size_t size)
+{
+	alloc_count++;
+
+	return __real_l_malloc(size);
+}
+
+enum bench_op {
+	BENCH_OP_BUILD_COMMIT,
+	BENCH_OP_ANTI_CLOGGING,
+	BENCH_OP_PROCESS_COMMIT,
+	BENCH_OP_PROCESS_CONFIRM,
+	__BENCH_OP_COUNT,
+};
+
+static const char *bench_op_names[] = {
+	[BENCH_OP_BUILD_COMMIT] = "build commit",
+	[BENCH_OP_ANTI_CLOGGING] = "anti-clogging",
+	[BENCH_OP_PROCESS_COMMIT] = "process commit",
+	[BENCH_OP_PROCESS_CONFIRM] = "process confirm",
+};
+
+struct bench_stat {
+	unsigned int ops;
+	uint64_t usecs;
+	unsigned long allocs;
+};
+
+struct bench_peer {
+	struct handshake_state *hs;
+	struct auth_proto *ap;
+	uint8_t tx_packet[512];
+	size_t tx_packet_len;
+};
+
+struct authenticate_frame {
+	struct mmpdu_header hdr;
+	struct mmpdu_authentication auth;
+} __attribute__ ((packed));
+
+struct bench_handshake_state {
+	struct handshake_state super;
+};
+
+static const uint8_t spa[] = { 2, 0, 0, 0, 0, 0 };
+static const uint8_t aa[] = { 2, 0, 0, 0, 0, 1 };
+static const char *passphrase = "secret123";
+
+static struct bench_stat stats[__BENCH_OP_COUNT];
+static uint64_t op_start;
+static unsigned long op_start_allocs;
+
+static void bench_op_begin(void)
+{
+	op_start_allocs = alloc_count;
+	op_start = l_time_now();
+}
+
+static void bench_op_end(enum bench_op op)
+{
+	stats[op].usecs += l_time_diff(op_start, l_time_now());
+	stats[op].allocs += alloc_count - op_start_allocs;
+	stats[op].ops++;
+}
+
+static void bench_handshake_state_free(struct handshake_state *hs)
+{
+	struct bench_handshake_state *bhs =
+			l_container_of(hs, struct bench_handshake_state, super);
+
+	l_free(bhs);
+}
+
+static void bench_tx_auth(const uint8_t *frame, size_t len, void *user_data)
+{
+	struct bench_peer *peer = user_data;
+
+	if (len > sizeof(peer->tx_packet))
+		len = sizeof(peer->tx_packet);
+
+	memcpy(peer->tx_packet, frame, len);
+	peer->tx_packet_len = len;
+}
+
+static void bench_tx_assoc(void *user_data)
+{
+}
+
+static void bench_peer_init(struct bench_peer *peer, uint32_t ifindex,
+				const uint8_t *own, const uint8_t *other,
+				bool authenticator)
+{
+	struct bench_handshake_state *bhs =
+				l_new(struct bench_handshake_state, 1);
+
+	bhs->super.ifindex = ifindex;
+	bhs->super.free = bench_handshake_state_free;
+
+	memset(peer, 0, sizeof(*peer));
+	peer->hs = &bhs->super;
+
+	handshake_state_set_supplicant_address(peer->hs, own);
+	handshake_state_set_authenticator_address(peer->hs, other);
+	handshake_state_set_passphrase(peer->hs, passphrase);
+	handshake_state_set_authenticator(peer->hs, authenticator);
+
+	peer->ap = sae_sm_new(peer->hs, bench_tx_auth, bench_tx_assoc, peer);
+}
+
+static void bench_peer_free(struct bench_peer *peer)
+{
+	handshake_state_free(peer->hs);
+	auth_proto_free(peer->ap);
+}
+
+static size_t setup_auth_frame(struct authenticate_frame *frame,
+				const uint8_t *addr,
+				uint16_t trans, uint16_t status,
+				const uint8_t *data, size_t len)
+{
+	memset(frame, 0, sizeof(struct authenticate_frame));
+	memcpy(frame->hdr.address_2, addr, 6);
+
+	frame->hdr.fc.type = MPDU_TYPE_MANAGEMENT;
+	frame->hdr.fc.subtype = MPDU_MANAGEMENT_SUBTYPE_AUTHENTICATION;
+	frame->hdr.fc.order = 1;
+
+	l_put_le16(MMPDU_AUTH_ALGO_SAE, &frame->auth.algorithm);
+	l_put_le16(trans, &frame->auth.transaction_sequence);
+	l_put_le16(status, &frame->auth.status);
+
+	if (data)
+		memcpy(frame->auth.ies, data, len);
+
+	return sizeof(frame->hdr) + sizeof(frame->auth) + len;
+}
+
+/* Feed a frame sent by the other peer, minus transaction and status */
+static bool bench_rx(struct bench_peer *peer, struct authenticate_frame *frame,
+			const uint8_t *from, uint16_t trans,
+			const uint8_t *packet, size_t packet_len,
+			enum bench_op op)
+{
+	size_t len = setup_auth_frame(frame, from, trans, 0, packet + 4,
+					packet_len - 4);
+	int r;
+
+	bench_op_begin();
+	r = auth_proto_rx_authenticate(peer->ap, (uint8_t *) frame, len);
+	bench_op_end(op);
+
+	return r == 0;
+}
+
+/*
+ * Run a full commit/confirm exchange between a station and an AP, plus an
+ * anti-clogging round trip on a separate station, as seen during a
+ * reconnect storm.
+ */
+static bool bench_iteration(unsigned int group,
+				struct authenticate_frame *frame)
+{
+	struct bench_peer sta;
+	struct bench_peer ap;
+	struct bench_peer clogged;
+	uint8_t sta_commit[512];
+	size_t sta_commit_len;
+	uint8_t token_req[34];
+	size_t len;
+	int r;
+	bool ok = false;
+
+	bench_peer_init(&sta, 1, spa, aa, false);
+	bench_peer_init(&ap, 2, aa, spa, true);
+	bench_peer_init(&clogged, 3, spa, aa, false);
+
+	bench_op_begin();
+	auth_proto_start(sta.ap);
+	bench_op_end(BENCH_OP_BUILD_COMMIT);
+
+	bench_op_begin();
+	auth_proto_start(ap.ap);
+	bench_op_end(BENCH_OP_BUILD_COMMIT);
+
+	/* Commit with anti-clogging token requested by the AP */
+	auth_proto_start(clogged.ap);
+
+	l_put_le16(group, token_req);
+	memset(token_req + 2, 0xde, 32);
+	len = setup_auth_frame(frame, aa, 1,
+				MMPDU_STATUS_CODE_ANTI_CLOGGING_TOKEN_REQ,
+				token_req, sizeof(token_req));
+
+	bench_op_begin();
+	r = auth_proto_rx_authenticate(clogged.ap, (uint8_t *) frame, len);
+	bench_op_end(BENCH_OP_ANTI_CLOGGING);
+
+	if (r != -EAGAIN)
+		goto done;
+
+	/* tx_packet gets overwritten with the confirm */
+	memcpy(sta_commit, sta.tx_packet, sta.tx_packet_len);
+	sta_commit_len = sta.tx_packet_len;
+
+	if (!bench_rx(&sta, frame, aa, 1, ap.tx_packet, ap.tx_packet_len,
+					BENCH_OP_PROCESS_COMMIT))
+		goto done;
+
+	if (!bench_rx(&ap, frame, spa, 1, sta_commit, sta_commit_len,
+					BENCH_OP_PROCESS_COMMIT))
+		goto done;
+
+	if (!bench_rx(&sta, frame, aa, 2, ap.tx_packet, ap.tx_packet_len,
+					BENCH_OP_PROCESS_CONFIRM))
+		goto done;
+
+	if (!bench_rx(&ap, frame, spa, 2, sta.tx_packet, sta.tx_packet_len,
+					BENCH_OP_PROCESS_CONFIRM))
+		goto done;
+
+	ok = true;
+
+done:
+	bench_peer_free(&sta);
+	bench_peer_free(&ap);
+	bench_peer_free(&clogged);
+
+	return ok;
+}
+
+static void bench_report(unsigned int group, unsigned int iterations)
+{
+	unsigned int i;
+
+	printf("Group %u (%u exchanges)\n", group, iterations);
+
+	for (i = 0; i < __BENCH_OP_COUNT; i++) {
+		const struct bench_stat *stat = &stats[i];
+		double secs = (double) stat->usecs / L_USEC_PER_SEC;
+
+		if (!stat->ops)
+			continue;
+
+		printf("\t%-16s %8u ops %10.1f ops/sec %8.1f allocs/op\n",
+			bench_op_names[i], stat->ops,
+			secs > 0 ? stat->ops / secs : 0.0,
+			(double) stat->allocs / stat->ops);
+	}
+}
+
+static int bench_group(unsigned int group, unsigned int iterations)
+{
+	struct authenticate_frame *frame =
+		l_malloc(sizeof(struct authenticate_frame) + 512);
+	unsigned int i;
+	int ret = 0;
+
+	if (!l_ecc_curve_from_ike_group(group)) {
+		fprintf(stderr, "Group %u not supported, skipping\n", group);
+		goto done;
+	}
+
+	bench_groups[0] = group;
+	bench_groups[1] = 0;
+	memset(stats, 0, sizeof(stats));
+
+	for (i = 0; i < iterations; i++) {
+		if (!bench_iteration(group, frame)) {
+			fprintf(stderr, "Group %u: exchange %u failed\n",
+					group, i);
+			ret = -EIO;
+			goto done;
+		}
+	}
+
+	bench_report(group, iterations);
+
+done:
+	l_free(frame);
+	return ret;
+}
+
+static void usage(void)
+{
+	printf("sae-bench - Benchmark SAE commit and confirm processing\n"
+		"Usage:\n");
+	printf("\tsae-bench [OPTIONS]\n");
+	printf("\nOptions:\n"
+		"\t-g, --group            Only benchmark the given group\n"
+		"\t                       (default: 19, 20 and 21)\n"
+		"\t-n, --iterations       Number of exchanges per group\n"
+		"\t                       (default: 100)\n"
+		"\t-h, --help             Show help options\n");
+	printf("\n");
+}
+
+static const struct option main_options[] = {
+	{ "group", required_argument,      NULL, 'g' },
+	{ "iterations", required_argument, NULL, 'n' },
+	{ "help", no_argument,             NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	static const unsigned int default_groups[] = { 19, 20, 21 };
+	unsigned int group = 0;
+	unsigned int iterations = 100;
+	unsigned int i;
+	int ret = EXIT_SUCCESS;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "g:n:h", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'g':
+			group = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!iterations) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	if (!l_getrandom_is_supported()) {
+		fprintf(stderr, "l_getrandom not supported\n");
+		return EXIT_FAILURE;
+	}
+
+	if (group)
+		return bench_group(group, iterations) < 0 ?
+						EXIT_FAILURE : EXIT_SUCCESS;
+
+	for (i = 0; i < L_ARRAY_SIZE(default_groups); i++)
+		if (bench_group(default_groups[i], iterations) < 0)
+			ret = EXIT_FAILURE;
+
+	return ret;
+}
@@ -0,0 +1,704 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <linux/if_arp.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+
+#include <ell/ell.h>
+
+#include "linux/nl80211.h"
+#include "src/iwd.h"
+#include "src/ie.h"
+#include "src/util.h"
+#include "src/common.h"
+#include "src/wiphy.h"
+#include "src/netdev.h"
+#include "src/knownnetworks.h"
+#include "src/bss-history.h"
+#include "src/scan.h"
+#include "monitor/pcap.h"
+
+/*
+ * l_malloc is wrapped at link time so that the allocations made while
+ * parsing each BSS can be counted.
+ */
+void *__wrap_l_malloc(size_t size);
+void *__real_l_malloc(size_t size);
+
+static unsigned long alloc_count;
+
+void *__wrap_l_malloc(size_t size)
+{
+	alloc_count++;
+
+	return __real_l_malloc(size);
+}
+
+/*
+ * scan.c is linked on its own, the few daemon functions on the BSS parsing
+ * path are stubbed.  Data rate estimation depends on the capabilities of
+ * the local wiphy and is left out of the measurement.
+ */
+int wiphy_estimate_data_rate(struct wiphy *wiphy,
+				const void *ies, uint16_t ies_len,
+				const struct scan_bss *bss,
+				uint64_t *out_data_rate)
+{
+	return -ENETUNREACH;
+}
+
+double bss_history_rank_factor(const struct scan_bss *bss)
+{
+	return 1.0;
+}
+
+const struct l_settings *iwd_get_config(void)
+{
+	return NULL;
+}
+
+struct l_genl *iwd_get_genl(void)
+{
+	return NULL;
+}
+
+void iwd_startup_trace(const char *format, ...)
+{
+}
+
+void iwd_startup_trace_end(void)
+{
+}
+
+bool known_networks_foreach(known_networks_foreach_func_t function,
+				void *user_data)
+{
+	return false;
+}
+
+bool known_networks_has_hidden(void)
+{
+	return false;
+}
+
+struct wiphy *wiphy_find(int wiphy_id)
+{
+	return NULL;
+}
+
+uint32_t wiphy_get_id(struct wiphy *wiphy)
+{
+	return 0;
+}
+
+const struct scan_freq_set *wiphy_get_supported_freqs(
+						const struct wiphy *wiphy)
+{
+	return NULL;
+}
+
+bool wiphy_can_randomize_mac_addr(struct wiphy *wiphy)
+{
+	return false;
+}
+
+bool wiphy_has_ext_feature(struct wiphy *wiphy, uint32_t feature)
+{
+	return false;
+}
+
+uint32_t wiphy_get_supported_bands(struct wiphy *wiphy)
+{
+	return 0;
+}
+
+bool wiphy_has_feature(struct wiphy *wiphy, uint32_t feature)
+{
+	return false;
+}
+
+bool wiphy_supports_sched_scan(struct wiphy *wiphy)
+{
+	return false;
+}
+
+uint8_t wiphy_get_max_num_sched_ssids(struct wiphy *wiphy)
+{
+	return 0;
+}
+
+uint8_t wiphy_get_max_match_sets(struct wiphy *wiphy)
+{
+	return 0;
+}
+
+uint32_t wiphy_get_wowlan_max_nd_match_sets(struct wiphy *wiphy)
+{
+	return 0;
+}
+
+void wiphy_get_sched_scan_plan_limits(struct wiphy *wiphy,
+					uint32_t *max_plans,
+					uint32_t *max_interval,
+					uint32_t *max_iterations)
+{
+	*max_plans = 0;
+	*max_interval = 0;
+	*max_iterations = 0;
+}
+
+uint8_t wiphy_get_max_num_ssids_per_scan(struct wiphy *wiphy)
+{
+	return 1;
+}
+
+uint16_t wiphy_get_max_scan_ie_len(struct wiphy *wiphy)
+{
+	return 0;
+}
+
+const uint8_t *wiphy_get_supported_rates(struct wiphy *wiphy,
+						unsigned int band,
+						unsigned int *out_num)
+{
+	return NULL;
+}
+
+const uint8_t *wiphy_get_extended_capabilities(struct wiphy *wiphy,
+							uint32_t iftype)
+{
+	return NULL;
+}
+
+uint32_t wiphy_radio_work_insert(struct wiphy *wiphy,
+				struct wiphy_radio_work_item *item,
+				int priority,
+				const struct wiphy_radio_work_item_ops *ops)
+{
+	return 0;
+}
+
+void wiphy_radio_work_done(struct wiphy *wiphy, uint32_t id)
+{
+}
+
+int wiphy_radio_work_is_running(struct wiphy *wiphy, uint32_t id)
+{
+	return -ENOENT;
+}
+
+struct netdev *netdev_find(int ifindex)
+{
+	return NULL;
+}
+
+uint64_t netdev_get_wdev_id(struct netdev *netdev)
+{
+	return 0;
+}
+
+struct bench_stat {
+	unsigned int bss_count;
+	unsigned int failed;
+	size_t ie_bytes;
+	uint64_t attr_nsecs;
+	unsigned long attr_allocs;
+	uint64_t ie_nsecs;
+	unsigned long ie_allocs;
+};
+
+static uint64_t cpu_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool msg_get_bss_attr(struct l_genl_msg *msg, struct l_genl_attr *bss)
+{
+	struct l_genl_attr attr;
+	uint16_t type, len;
+	const void *data;
+
+	if (!l_genl_attr_init(&attr, msg))
+		return false;
+
+	while (l_genl_attr_next(&attr, &type, &len, &data))
+		if (type == NL80211_ATTR_BSS)
+			return l_genl_attr_recurse(&attr, bss);
+
+	return false;
+}
+
+static const uint8_t *bss_get_ies(struct l_genl_attr *bss, uint16_t *out_len)
+{
+	uint16_t type, len;
+	const void *data;
+
+	while (l_genl_attr_next(bss, &type, &len, &data)) {
+		if (type != NL80211_BSS_INFORMATION_ELEMENTS)
+			continue;
+
+		*out_len = len;
+		return data;
+	}
+
+	return NULL;
+}
+
+/*
+ * Scan result dumps recorded with iwmon -w: Linux cooked capture records
+ * carrying the netlink traffic.  Only the nl80211 NEW_SCAN_RESULTS dump
+ * replies, those with a BSS attribute, are kept.
+ */
+static int load_pcap(const char *pathname, struct l_queue *msgs)
+{
+	struct pcap *pcap;
+	const uint8_t *buf;
+	uint32_t len, real_len;
+	int count = 0;
+
+	pcap = pcap_open(pathname);
+	if (!pcap)
+		return -ENOENT;
+
+	if (pcap_get_type(pcap) != PCAP_TYPE_LINUX_SLL) {
+		pcap_close(pcap);
+		return -EINVAL;
+	}
+
+	while (pcap_read_ref(pcap, NULL, (const void **) &buf,
+						&len, &real_len)) {
+		struct nlmsghdr *nlmsg;
+		uint32_t aligned_len;
+
+		if (len < 16 || len < real_len)
+			continue;
+
+		if (l_get_be16(buf + 2) != ARPHRD_NETLINK ||
+				l_get_be16(buf + 14) != NETLINK_GENERIC)
+			continue;
+
+		aligned_len = NLMSG_ALIGN(len - 16);
+
+		for (nlmsg = (struct nlmsghdr *) (buf + 16);
+				NLMSG_OK(nlmsg, aligned_len);
+				nlmsg = NLMSG_NEXT(nlmsg, aligned_len)) {
+			const struct genlmsghdr *genlmsg = NLMSG_DATA(nlmsg);
+			struct l_genl_msg *msg;
+			struct l_genl_attr bss;
+
+			if (nlmsg->nlmsg_type < NLMSG_MIN_TYPE ||
+					nlmsg->nlmsg_len < NLMSG_HDRLEN +
+								GENL_HDRLEN ||
+					genlmsg->cmd !=
+						NL80211_CMD_NEW_SCAN_RESULTS)
+				continue;
+
+			msg = l_genl_msg_new_from_data(nlmsg,
+							nlmsg->nlmsg_len);
+			if (!msg)
+				continue;
+
+			if (!msg_get_bss_attr(msg, &bss)) {
+				l_genl_msg_unref(msg);
+				continue;
+			}
+
+			l_queue_push_tail(msgs, msg);
+			count++;
+		}
+	}
+
+	pcap_close(pcap);
+
+	return count;
+}
+
+static size_t ie_append(uint8_t *buf, size_t pos, uint8_t tag,
+			const void *data, size_t len)
+{
+	buf[pos++] = tag;
+	buf[pos++] = len;
+	memcpy(buf + pos, data, len);
+
+	return pos + len;
+}
+
+/*
+ * A dense environment for when no recordings are at hand: every BSS has
+ * the elements of a typical 802.11n/ac/ax AP, with WSC, P2P and Hotspot
+ * 2.0 elements on a share of them.
+ */
+static size_t synthetic_ies(unsigned int i, const uint8_t *addr,
+				uint8_t *buf)
+{
+	static const uint8_t rates[] = {
+		0x82, 0x84, 0x8b, 0x96, 0x0c, 0x12, 0x18, 0x24,
+	};
+	static const uint8_t ext_rates[] = { 0x30, 0x48, 0x60, 0x6c };
+	static const uint8_t tim[] = { 0x00, 0x01, 0x00, 0x00 };
+	static const uint8_t country[] = { 'U', 'S', 0x20, 0x01, 0x0b, 0x1e };
+	static const uint8_t bss_load[] = { 0x03, 0x00, 0x40, 0x00, 0x00 };
+	static const uint8_t rsn[] = {
+		0x01, 0x00, 0x00, 0x0f, 0xac, 0x04, 0x01, 0x00,
+		0x00, 0x0f, 0xac, 0x04, 0x01, 0x00, 0x00, 0x0f,
+		0xac, 0x02, 0x0c, 0x00,
+	};
+	static const uint8_t ht_capa[26] = {
+		0xef, 0x19, 0x1b, 0xff, 0xff, 0xff, 0x00, 0x00,
+	};
+	static const uint8_t ht_oper[22] = { 0x01, 0x05 };
+	static const uint8_t rm_capa[] = { 0x72, 0x00, 0x00, 0x00, 0x00 };
+	static const uint8_t ext_capa[] = {
+		0x04, 0x00, 0x0a, 0x82, 0x21, 0x40, 0x00, 0x40,
+	};
+	static const uint8_t vht_capa[12] = {
+		0xb2, 0x01, 0x80, 0x33, 0xfa, 0xff, 0x00, 0x00,
+		0xfa, 0xff, 0x00, 0x00,
+	};
+	static const uint8_t vht_oper[] = { 0x01, 0x2a, 0x00, 0xfc, 0xff };
+	static const uint8_t he_capa[22] = {
+		0x23, 0x05, 0x00, 0x18, 0x12, 0x00, 0x10, 0x22,
+		0x20, 0x02, 0xc0, 0x0f, 0x03, 0x95, 0x18, 0x00,
+		0xcc, 0x00, 0xfa, 0xff, 0xfa, 0xff,
+	};
+	static const uint8_t he_oper[] = {
+		0x24, 0xf4, 0x3f, 0x00, 0x19, 0xfc, 0xff,
+	};
+	static const uint8_t wmm[] = {
+		0x00, 0x50, 0xf2, 0x02, 0x01, 0x01, 0x80, 0x00,
+		0x03, 0xa4, 0x00, 0x00, 0x27, 0xa4, 0x00, 0x00,
+		0x42, 0x43, 0x5e, 0x00, 0x62, 0x32, 0x2f, 0x00,
+	};
+	static const uint8_t wsc[] = {
+		0x00, 0x50, 0xf2, 0x04, 0x10, 0x4a, 0x00, 0x01,
+		0x10, 0x10, 0x44, 0x00, 0x01, 0x02,
+	};
+	static const uint8_t hs20[] = { 0x50, 0x6f, 0x9a, 0x10, 0x10 };
+	static const uint8_t interworking[] = {
+		0x30, 0x02, 0x00, 0x12, 0x00, 0x00, 0x00, 0x00, 0x01,
+	};
+	static const uint8_t roaming_consortium[] = {
+		0x00, 0x03, 0x50, 0x6f, 0x9a,
+	};
+	uint8_t p2p[18] = {
+		0x50, 0x6f, 0x9a, 0x09, 0x02, 0x02, 0x00, 0x25,
+		0x00, 0x03, 0x06, 0x00,
+	};
+	char ssid[32];
+	uint8_t channel = 1 + i % 11;
+	size_t pos = 0;
+
+	snprintf(ssid, sizeof(ssid), "bench-%04u", i);
+
+	pos = ie_append(buf, pos, IE_TYPE_SSID, ssid, strlen(ssid));
+	pos = ie_append(buf, pos, IE_TYPE_SUPPORTED_RATES, rates,
+			sizeof(rates));
+	pos = ie_append(buf, pos, IE_TYPE_DSSS_PARAMETER_SET, &channel, 1);
+	pos = ie_append(buf, pos, IE_TYPE_TIM, tim, sizeof(tim));
+	pos = ie_append(buf, pos, IE_TYPE_COUNTRY, country, sizeof(country));
+	pos = ie_append(buf, pos, IE_TYPE_BSS_LOAD, bss_load,
+			sizeof(bss_load));
+
+	if (i % 5)
+		pos = ie_append(buf, pos, IE_TYPE_RSN, rsn, sizeof(rsn));
+
+	pos = ie_append(buf, pos, IE_TYPE_HT_CAPABILITIES, ht_capa,
+			sizeof(ht_capa));
+	pos = ie_append(buf, pos, IE_TYPE_EXTENDED_SUPPORTED_RATES, ext_rates,
+			sizeof(ext_rates));
+	pos = ie_append(buf, pos, IE_TYPE_HT_OPERATION, ht_oper,
+			sizeof(ht_oper));
+	pos = ie_append(buf, pos, IE_TYPE_RM_ENABLED_CAPABILITIES, rm_capa,
+			sizeof(rm_capa));
+
+	if (i % 4 == 0) {
+		pos = ie_append(buf, pos, IE_TYPE_INTERWORKING, interworking,
+				sizeof(interworking));
+		pos = ie_append(buf, pos, IE_TYPE_ROAMING_CONSORTIUM,
+				roaming_consortium,
+				sizeof(roaming_consortium));
+	}
+
+	pos = ie_append(buf, pos, IE_TYPE_EXTENDED_CAPABILITIES, ext_capa,
+			sizeof(ext_capa));
+
+	if (i % 2 == 0) {
+		pos = ie_append(buf, pos, IE_TYPE_VHT_CAPABILITIES, vht_capa,
+				sizeof(vht_capa));
+		pos = ie_append(buf, pos, IE_TYPE_VHT_OPERATION, vht_oper,
+				sizeof(vht_oper));
+	}
+
+	if (i % 3 == 0) {
+		pos = ie_append(buf, pos, IE_TYPE_EXTENSION, he_capa,
+				sizeof(he_capa));
+		pos = ie_append(buf, pos, IE_TYPE_EXTENSION, he_oper,
+				sizeof(he_oper));
+	}
+
+	pos = ie_append(buf, pos, IE_TYPE_VENDOR_SPECIFIC, wmm, sizeof(wmm));
+
+	if (i % 3 == 1)
+		pos = ie_append(buf, pos, IE_TYPE_VENDOR_SPECIFIC, wsc,
+				sizeof(wsc));
+
+	if (i % 7 == 0) {
+		memcpy(p2p + 12, addr, 6);
+		pos = ie_append(buf, pos, IE_TYPE_VENDOR_SPECIFIC, p2p,
+				sizeof(p2p));
+	}
+
+	if (i % 4 == 0)
+		pos = ie_append(buf, pos, IE_TYPE_VENDOR_SPECIFIC, hs20,
+				sizeof(hs20));
+
+	return pos;
+}
+
+static void load_synthetic(unsigned int count, struct l_queue *msgs)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		uint8_t addr[6] = { 0x02, 0x00, 0x00, 0x00, i >> 8, i };
+		uint8_t ies[512];
+		size_t ies_len = synthetic_ies(i, addr, ies);
+		uint32_t ifindex = 3;
+		uint32_t freq = 2407 + 5 * (1 + i % 11);
+		uint16_t capability = 0x0411;
+		int32_t signal = -3000 - (i % 60) * 100;
+		uint32_t seen_ms_ago = i % 1000;
+		uint64_t tsf = i * 102400ULL;
+		struct l_genl_msg *msg;
+		const void *data;
+		size_t size;
+
+		msg = l_genl_msg_new_sized(NL80211_CMD_NEW_SCAN_RESULTS,
+						256 + ies_len * 2);
+		l_genl_msg_append_attr(msg, NL80211_ATTR_IFINDEX, 4, &ifindex);
+		l_genl_msg_enter_nested(msg, NL80211_ATTR_BSS);
+		l_genl_msg_append_attr(msg, NL80211_BSS_BSSID, 6, addr);
+		l_genl_msg_append_attr(msg, NL80211_BSS_FREQUENCY, 4, &freq);
+		l_genl_msg_append_attr(msg, NL80211_BSS_TSF, 8, &tsf);
+		l_genl_msg_append_attr(msg, NL80211_BSS_CAPABILITY, 2,
+					&capability);
+		l_genl_msg_append_attr(msg, NL80211_BSS_INFORMATION_ELEMENTS,
+					ies_len, ies);
+		l_genl_msg_append_attr(msg, NL80211_BSS_BEACON_IES,
+					ies_len, ies);
+		l_genl_msg_append_attr(msg, NL80211_BSS_SIGNAL_MBM, 4, &signal);
+		l_genl_msg_append_attr(msg, NL80211_BSS_SEEN_MS_AGO, 4,
+					&seen_ms_ago);
+		l_genl_msg_leave_nested(msg);
+
+		/* Round trip so the message looks like one from the kernel */
+		data = l_genl_msg_to_data(msg, GENL_MIN_ID, NLM_F_MULTI, i + 1,
+						0, &size);
+		l_queue_push_tail(msgs, l_genl_msg_new_from_data(data, size));
+		l_genl_msg_unref(msg);
+	}
+}
+
+static bool bench_round(struct l_queue *msgs, struct bench_stat *stat)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(msgs); entry; entry = entry->next) {
+		struct l_genl_attr attr;
+		struct scan_bss *bss;
+		const uint8_t *ies;
+		uint16_t ies_len;
+		uint32_t seen_ms_ago;
+		unsigned long allocs;
+		uint64_t start;
+
+		/* The full path, as for each BSS of a scan results dump */
+		if (!msg_get_bss_attr(entry->data, &attr))
+			return false;
+
+		allocs = alloc_count;
+		start = cpu_time_ns();
+		bss = scan_parse_attr_bss(&attr, NULL, &seen_ms_ago);
+		stat->attr_nsecs += cpu_time_ns() - start;
+		stat->attr_allocs += alloc_count - allocs;
+
+		stat->bss_count++;
+
+		if (!bss) {
+			stat->failed++;
+			continue;
+		}
+
+		scan_bss_free(bss);
+
+		/* The element parsing alone */
+		msg_get_bss_attr(entry->data, &attr);
+
+		ies = bss_get_ies(&attr, &ies_len);
+		if (!ies)
+			continue;
+
+		stat->ie_bytes += ies_len;
+
+		bss = l_new(struct scan_bss, 1);
+
+		allocs = alloc_count;
+		start = cpu_time_ns();
+		scan_parse_bss_information_elements(bss, ies, ies_len);
+		stat->ie_nsecs += cpu_time_ns() - start;
+		stat->ie_allocs += alloc_count - allocs;
+
+		scan_bss_free(bss);
+	}
+
+	return true;
+}
+
+static void usage(void)
+{
+	printf("scan-bench - Benchmark scan result parsing\n"
+		"Usage:\n");
+	printf("\tscan-bench [OPTIONS] [capture.pcap ...]\n");
+	printf("\nCaptures are recorded with iwmon -w while a scan "
+		"completes.  Without\ncaptures, a synthetic dense "
+		"environment is used.\n");
+	printf("\nOptions:\n"
+		"\t-n, --iterations       Number of passes over all BSSes\n"
+		"\t                       (default: 100)\n"
+		"\t-s, --synthetic        Number of synthetic BSSes\n"
+		"\t                       (default: 400)\n"
+		"\t-h, --help             Show help options\n\n");
+}
+
+static const struct option main_options[] = {
+	{ "iterations", required_argument,    NULL, 'n' },
+	{ "synthetic", required_argument,     NULL, 's' },
+	{ "help", no_argument,                NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	unsigned int iterations = 100;
+	unsigned int synthetic = 400;
+	struct l_queue *msgs;
+	struct bench_stat stat;
+	unsigned int i;
+	int ret = EXIT_FAILURE;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "n:s:h", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			synthetic = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!iterations) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	msgs = l_queue_new();
+
+	for (i = optind; i < (unsigned int) argc; i++) {
+		int r = load_pcap(argv[i], msgs);
+
+		if (r < 0) {
+			fprintf(stderr, "%s: %s\n", argv[i], strerror(-r));
+			goto done;
+		}
+
+		printf("%s: %d scan results\n", argv[i], r);
+	}
+
+	if (optind == argc) {
+		if (!synthetic) {
+			usage();
+			goto done;
+		}
+
+		load_synthetic(synthetic, msgs);
+		printf("synthetic: %u scan results\n", synthetic);
+	}
+
+	if (l_queue_isempty(msgs)) {
+		fprintf(stderr, "No scan results to parse\n");
+		goto done;
+	}
+
+	memset(&stat, 0, sizeof(stat));
+
+	for (i = 0; i < iterations; i++)
+		if (!bench_round(msgs, &stat)) {
+			fprintf(stderr, "Malformed scan result\n");
+			goto done;
+		}
+
+	printf("%8u BSSes parsed, %u rejected, %.1f IE bytes/BSS\n",
+		stat.bss_count, stat.failed,
+		(double) stat.ie_bytes / stat.bss_count);
+	printf("scan_parse_attr_bss                  %8.1f ns/BSS "
+		"%6.2f allocs/BSS\n",
+		(double) stat.attr_nsecs / stat.bss_count,
+		(double) stat.attr_allocs / stat.bss_count);
+	printf("scan_parse_bss_information_elements  %8.1f ns/BSS "
+		"%6.2f allocs/BSS\n",
+		(double) stat.ie_nsecs / stat.bss_count,
+		(double) stat.ie_allocs / stat.bss_count);
+
+	ret = EXIT_SUCCESS;
+
+done:
+	l_queue_destroy(msgs, (l_queue_destroy_func_t) l_genl_msg_unref);
+
+	return ret;
+}
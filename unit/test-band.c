@@ -29,6 +29,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <ell/ell.h>
 
 #include "src/band.h"
@@ -64,6 +65,7 @@ static struct band *new_band()
 
 	band->ht_supported = true;
 	band->vht_supported = true;
+	band->he_supported = false;
 
 	memcpy(band->vht_mcs_set, vht_mcs_set, sizeof(band->vht_mcs_set));
 	memcpy(band->vht_capabilities, vht_capabilities,
@@ -75,6 +77,23 @@ static struct band *new_band()
 	return band;
 }
 
+static struct band *new_he_band()
+{
+	/* HE 80/160 Mhz, NSS:2 and HE MCS 0-11 for all widths */
+	static const uint8_t he_mcs_set[] = {
+		0xfa, 0xff, 0xfa, 0xff, 0xfa, 0xff, 0xfa, 0xff,
+		0xff, 0xff, 0xff, 0xff,
+	};
+	struct band *band = new_band();
+
+	memset(band->he_phy_capa, 0, sizeof(band->he_phy_capa));
+	band->he_phy_capa[0] = 0x0c;
+	memcpy(band->he_mcs_set, he_mcs_set, sizeof(band->he_mcs_set));
+	band->he_supported = true;
+
+	return band;
+}
+
 static void band_test_nonht_1(const void *data)
 {
 	uint8_t supported_rates[] = { 1, 8,
@@ -282,6 +301,89 @@ static void band_test_vht_1(const void *data)
 	band_free(band);
 }
 
+static void band_test_he_1(const void *data)
+{
+	/* HE80, NSS:4, MCS 0-11 */
+	uint8_t hec[] = { 255, 22, 35,
+				0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				0x00, 0x00, 0x00,
+				0xaa, 0xff, 0xaa, 0xff };
+	uint8_t heo[] = { 255, 7, 36, 0x00, 0x00, 0x00, 0x01, 0xfc, 0xff };
+	/* VHT operating on 80 Mhz */
+	uint8_t vhto[] = { 192, 5, 0x01, 0x9b, 0x00, 0x00, 0x00 };
+	struct band *band = new_he_band();
+	uint64_t data_rate;
+	int ret;
+
+	ret = band_estimate_he_rx_rate(band, hec, heo, vhto, NULL,
+					-40, &data_rate);
+	assert(ret == 0);
+	assert(data_rate == 1200980000);
+
+	ret = band_estimate_he_rx_rate(band, hec, heo, vhto, NULL,
+					-50, &data_rate);
+	assert(ret == 0);
+	assert(data_rate == 960784000);
+
+	/* Without HT40 operation we can only fall back to 20 Mhz */
+	ret = band_estimate_he_rx_rate(band, hec, heo, vhto, NULL,
+					-80, &data_rate);
+	assert(ret == 0);
+	assert(data_rate == 17204000);
+
+	ret = band_estimate_he_rx_rate(band, hec, heo, vhto, NULL,
+					-83, &data_rate);
+	assert(ret < 0);
+
+	/* Truncated HE capabilities */
+	hec[1] = 21;
+	ret = band_estimate_he_rx_rate(band, hec, heo, vhto, NULL,
+					-40, &data_rate);
+	assert(ret == -EBADMSG);
+
+	band->he_supported = false;
+	ret = band_estimate_he_rx_rate(band, hec, heo, vhto, NULL,
+					-40, &data_rate);
+	assert(ret == -ENOTSUP);
+
+	band_free(band);
+}
+
+static void band_test_he_6ghz(const void *data)
+{
+	/* HE160, NSS:2, MCS 0-11 */
+	uint8_t hec[] = { 255, 26, 35,
+				0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				0x0c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				0x00, 0x00, 0x00,
+				0xfa, 0xff, 0xfa, 0xff, 0xfa, 0xff, 0xfa, 0xff };
+	/* 6 GHz Operation Information, 160 Mhz */
+	uint8_t heo[] = { 255, 12, 36, 0x00, 0x00, 0x02, 0x01, 0xfc, 0xff,
+				37, 0x03, 39, 47, 0x00 };
+	struct band *band = new_he_band();
+	uint64_t data_rate;
+	int ret;
+
+	ret = band_estimate_he_rx_rate(band, hec, heo, NULL, NULL,
+					-40, &data_rate);
+	assert(ret == 0);
+	assert(data_rate == 2401960000);
+
+	ret = band_estimate_he_rx_rate(band, hec, heo, NULL, NULL,
+					-45, &data_rate);
+	assert(ret == 0);
+	assert(data_rate == 2161764000);
+
+	/* Not enough for 160 Mhz MCS 0, falls back to 80 Mhz */
+	ret = band_estimate_he_rx_rate(band, hec, heo, NULL, NULL,
+					-74, &data_rate);
+	assert(ret == 0);
+	assert(data_rate == 72058000);
+
+	band_free(band);
+}
+
 struct oci2freq_data {
 	unsigned int op;
 	unsigned int chan;
@@ -424,6 +526,189 @@ static void test_6ghz_freqs(const void *data)
 	}
 }
 
+/* The arithmetic band_freq_to_channel used before the lookup tables */
+static uint8_t reference_freq_to_channel(uint32_t freq,
+						enum band_freq *out_band)
+{
+	if (freq >= 2412 && freq <= 2484) {
+		if (freq == 2484) {
+			*out_band = BAND_FREQ_2_4_GHZ;
+			return 14;
+		}
+
+		if ((freq - 2407) % 5)
+			return 0;
+
+		*out_band = BAND_FREQ_2_4_GHZ;
+		return (freq - 2407) / 5;
+	}
+
+	if (freq % 5)
+		return 0;
+
+	if (freq >= 5005 && freq < 5900) {
+		*out_band = BAND_FREQ_5_GHZ;
+		return (freq - 5000) / 5;
+	}
+
+	if (freq >= 4905 && freq < 5000) {
+		*out_band = BAND_FREQ_5_GHZ;
+		return (freq - 4000) / 5;
+	}
+
+	if (freq > 5950 && freq <= 7115) {
+		*out_band = BAND_FREQ_6_GHZ;
+		return (freq - 5950) / 5;
+	}
+
+	if (freq == 5935) {
+		*out_band = BAND_FREQ_6_GHZ;
+		return 2;
+	}
+
+	return 0;
+}
+
+static uint32_t reference_channel_to_freq(uint8_t channel,
+						enum band_freq band)
+{
+	if (band == BAND_FREQ_2_4_GHZ) {
+		if (channel >= 1 && channel <= 13)
+			return 2407 + 5 * channel;
+
+		if (channel == 14)
+			return 2484;
+	}
+
+	if (band == BAND_FREQ_5_GHZ) {
+		if (channel >= 1 && channel <= 179)
+			return 5000 + 5 * channel;
+
+		if (channel >= 181 && channel <= 199)
+			return 4000 + 5 * channel;
+	}
+
+	if (band == BAND_FREQ_6_GHZ) {
+		if (channel == 2)
+			return 5935;
+
+		if (channel % 4 == 1 && channel <= 233)
+			return 5950 + 5 * channel;
+	}
+
+	return 0;
+}
+
+static const enum band_freq all_bands[] = {
+	BAND_FREQ_2_4_GHZ, BAND_FREQ_5_GHZ, BAND_FREQ_6_GHZ,
+};
+
+static void test_freq_channel_tables(const void *data)
+{
+	uint32_t freq;
+	unsigned int i;
+	unsigned int channel;
+
+	for (freq = 0; freq < 8000; freq++) {
+		enum band_freq band = 0;
+		enum band_freq expected_band = 0;
+		uint8_t expected = reference_freq_to_channel(freq,
+							&expected_band);
+
+		assert(band_freq_to_channel(freq, &band) == expected);
+		assert(band == expected_band);
+	}
+
+	for (i = 0; i < L_ARRAY_SIZE(all_bands); i++)
+		for (channel = 0; channel < 256; channel++)
+			assert(band_channel_to_freq(channel, all_bands[i]) ==
+				reference_channel_to_freq(channel,
+								all_bands[i]));
+
+	assert(band_channel_to_freq(1, 0) == 0);
+	assert(band_channel_to_freq(1, BAND_FREQ_2_4_GHZ |
+						BAND_FREQ_5_GHZ) == 0);
+}
+
+static void test_oper_class_lookup(const void *data)
+{
+	unsigned int opclass;
+	unsigned int channel;
+
+	for (opclass = 0; opclass < 256; opclass++) {
+		bool listed = (opclass >= 81 && opclass <= 84) ||
+				(opclass >= 115 && opclass <= 136);
+		bool found = false;
+
+		for (channel = 0; channel < 256; channel++) {
+			int r = oci_to_frequency(opclass, channel);
+
+			if (!listed)
+				assert(r == -ENOENT);
+			else
+				assert(r != -ENOENT);
+
+			if (r > 0)
+				found = true;
+		}
+
+		assert(found == listed);
+	}
+}
+
+#define BENCH_ROUNDS 2000
+
+static void test_freq_channel_bench(const void *data)
+{
+	uint64_t start;
+	uint64_t table_time;
+	uint64_t reference_time;
+	volatile uint32_t sink = 0;
+	enum band_freq band;
+	unsigned int round;
+	uint32_t freq;
+
+	start = l_time_now();
+
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		for (freq = 2400; freq < 7200; freq += 5)
+			sink += band_freq_to_channel(freq, &band);
+
+	table_time = l_time_diff(start, l_time_now());
+	start = l_time_now();
+
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		for (freq = 2400; freq < 7200; freq += 5)
+			sink += reference_freq_to_channel(freq, &band);
+
+	reference_time = l_time_diff(start, l_time_now());
+
+	printf("freq to channel x%u: tables %" PRIu64 " us, arithmetic %"
+			PRIu64 " us\n", BENCH_ROUNDS * 960, table_time,
+			reference_time);
+
+	start = l_time_now();
+
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		for (freq = 0; freq < 256 * 3; freq++)
+			sink += band_channel_to_freq(freq & 0xff,
+							all_bands[freq >> 8]);
+
+	table_time = l_time_diff(start, l_time_now());
+	start = l_time_now();
+
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		for (freq = 0; freq < 256 * 3; freq++)
+			sink += reference_channel_to_freq(freq & 0xff,
+							all_bands[freq >> 8]);
+
+	reference_time = l_time_diff(start, l_time_now());
+
+	printf("channel to freq x%u: tables %" PRIu64 " us, arithmetic %"
+			PRIu64 " us\n", BENCH_ROUNDS * 768, table_time,
+			reference_time);
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -434,6 +719,9 @@ int main(int argc, char *argv[])
 
 	l_test_add("/band/VHT/test1", band_test_vht_1, NULL);
 
+	l_test_add("/band/HE/test1", band_test_he_1, NULL);
+	l_test_add("/band/HE/6ghz", band_test_he_6ghz, NULL);
+
 	l_test_add("/band/oci2freq 1", test_oci2freq, &oci2freq_data_1);
 	l_test_add("/band/oci2freq 2", test_oci2freq, &oci2freq_data_2);
 	l_test_add("/band/oci2freq 3", test_oci2freq, &oci2freq_data_3);
@@ -470,5 +758,10 @@ int main(int argc, char *argv[])
 	l_test_add("/band/6ghz/channels", test_6ghz_channels, NULL);
 	l_test_add("/band/6ghz/freq", test_6ghz_freqs, NULL);
 
+	l_test_add("/band/tables/freq-channel", test_freq_channel_tables,
+							NULL);
+	l_test_add("/band/tables/oper-class", test_oper_class_lookup, NULL);
+	l_test_add("/band/tables/benchmark", test_freq_channel_bench, NULL);
+
 	return l_test_run();
 }
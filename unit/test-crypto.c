@@ -25,6 +25,8 @@
 #endif
 
 #include <stdio.h>
+#include <errno.h>
+#include <inttypes.h>
 #include <string.h>
 #include <assert.h>
 #include <ell/ell.h>
@@ -102,6 +104,98 @@ static void psk_test(const void *data)
 	assert(strcmp(test->psk, psk) == 0);
 }
 
+static void psk_async_cb(int err, const uint8_t *psk, void *user_data)
+{
+	const struct psk_data *test = user_data;
+	char result[65];
+	unsigned int i;
+
+	assert(err == 0);
+
+	for (i = 0; i < 32; i++)
+		sprintf(result + (i * 2), "%02x", psk[i]);
+
+	assert(strcmp(test->psk, result) == 0);
+}
+
+static void psk_async_test(const void *data)
+{
+	const struct psk_data *test = data;
+	struct crypto_psk_work *work;
+
+	assert(l_main_init());
+
+	work = crypto_psk_from_passphrase_async(test->passphrase,
+						test->ssid, test->ssid_len,
+						psk_async_cb, (void *) test);
+	assert(work);
+
+	/* One slice on the main loop, then the rest synchronously */
+	l_main_iterate(0);
+	crypto_psk_work_finish(work);
+
+	assert(!crypto_psk_from_passphrase_async("short", test->ssid,
+						test->ssid_len, psk_async_cb,
+						NULL));
+
+	l_main_exit();
+}
+
+static void psk_batch_test(const void *data)
+{
+	static const struct psk_data *tests[] = {
+		&psk_test_case_1, &psk_test_case_2, &psk_test_case_3,
+		&psk_test_case_2, &psk_test_case_1, &psk_test_case_3,
+		&psk_test_case_1, &psk_test_case_2, &psk_test_case_3,
+	};
+	struct crypto_psk_request reqs[L_ARRAY_SIZE(tests) + 1];
+	unsigned int n = L_ARRAY_SIZE(tests);
+	unsigned char output[32];
+	char psk[65];
+	uint64_t start;
+	uint64_t batch_time;
+	unsigned int i;
+	unsigned int j;
+
+	memset(reqs, 0, sizeof(reqs));
+
+	for (i = 0; i < n; i++) {
+		reqs[i].passphrase = tests[i]->passphrase;
+		reqs[i].ssid = tests[i]->ssid;
+		reqs[i].ssid_len = tests[i]->ssid_len;
+	}
+
+	/* An invalid entry must not affect the others */
+	reqs[n].passphrase = "short";
+	reqs[n].ssid = psk_test_case_1_ssid;
+	reqs[n].ssid_len = sizeof(psk_test_case_1_ssid);
+
+	start = l_time_now();
+	crypto_psk_from_passphrase_batch(reqs, n + 1);
+	batch_time = l_time_diff(start, l_time_now());
+
+	for (i = 0; i < n; i++) {
+		assert(reqs[i].result == 0);
+
+		for (j = 0; j < sizeof(reqs[i].psk); j++)
+			sprintf(psk + (j * 2), "%02x", reqs[i].psk[j]);
+
+		assert(strcmp(tests[i]->psk, psk) == 0);
+	}
+
+	assert(reqs[n].result == -ERANGE);
+
+	start = l_time_now();
+
+	for (i = 0; i < n; i++)
+		crypto_psk_from_passphrase(tests[i]->passphrase,
+						tests[i]->ssid,
+						tests[i]->ssid_len, output);
+
+	printf("%u PSKs: batch %" PRIu64 " us, serial %" PRIu64 " us\n", n,
+			batch_time, l_time_diff(start, l_time_now()));
+}
+
 struct ptk_data {
 	const unsigned char *pmk;
 	const unsigned char *aa;
@@ -403,6 +497,61 @@ static void aes_siv_test(const void *data)
 	assert(memcmp(decrypted, plaintext, sizeof(decrypted)) == 0);
 }
 
+static void aes_siv_key_test(const void *data)
+{
+	/* RFC5297 Appendix A.1 Test Vectors */
+	const uint8_t key[] = {
+		0xff, 0xfe, 0xfd, 0xfc, 0xfb, 0xfa, 0xf9, 0xf8, 0xf7, 0xf6,
+		0xf5, 0xf4, 0xf3, 0xf2, 0xf1, 0xf0, 0xf0, 0xf1, 0xf2, 0xf3,
+		0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd,
+		0xfe, 0xff
+	};
+	const uint8_t ad[] = {
+		0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
+		0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23,
+		0x24, 0x25, 0x26, 0x27
+	};
+	const uint8_t plaintext[] = {
+		0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa,
+		0xbb, 0xcc, 0xdd, 0xee
+	};
+	const uint8_t encrypted[] = {
+		0x85, 0x63, 0x2d, 0x07, 0xc6, 0xe8, 0xf3, 0x7f, 0x95, 0x0a,
+		0xcd, 0x32, 0x0a, 0x2e, 0xcc, 0x93, 0x40, 0xc0, 0x2b, 0x96,
+		0x90, 0xc4, 0xdc, 0x04, 0xda, 0xef, 0x7f, 0x6a, 0xfe, 0x5c
+	};
+	struct aes_siv_key *siv;
+	struct iovec iov[1];
+	uint8_t outbuf[sizeof(plaintext) + 16];
+	unsigned int i;
+
+	iov[0].iov_base = (void *)ad;
+	iov[0].iov_len = sizeof(ad);
+
+	siv = aes_siv_key_new(key, sizeof(key));
+	assert(siv);
+
+	/* The same key must be usable for any number of operations */
+	for (i = 0; i < 3; i++) {
+		assert(aes_siv_key_encrypt(siv, plaintext, sizeof(plaintext),
+						iov, 1, outbuf));
+		assert(memcmp(outbuf, encrypted, sizeof(outbuf)) == 0);
+
+		/* Decrypt in place, right after the IV */
+		assert(aes_siv_key_decrypt(siv, outbuf, sizeof(outbuf),
+						iov, 1, outbuf + 16));
+		assert(memcmp(outbuf + 16, plaintext, sizeof(plaintext)) == 0);
+	}
+
+	/* A tampered IV must be rejected */
+	memcpy(outbuf, encrypted, sizeof(outbuf));
+	outbuf[0] ^= 0x01;
+	assert(!aes_siv_key_decrypt(siv, outbuf, sizeof(outbuf),
+					iov, 1, outbuf + 16));
+
+	aes_siv_key_free(siv);
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -423,6 +572,9 @@ int main(int argc, char *argv[])
 			psk_test, &psk_test_case_2);
 	l_test_add("/Passphrase Generator/PSK Test Case 3",
 			psk_test, &psk_test_case_3);
+	l_test_add("/Passphrase Generator/Async PSK Test Case 1",
+			psk_async_test, &psk_test_case_1);
+	l_test_add("/Passphrase Generator/PSK Batch", psk_batch_test, NULL);
 
 	l_test_add("/PTK Derivation/PTK Test Case 1",
 			ptk_test, &ptk_test_1);
@@ -436,6 +588,7 @@ int main(int argc, char *argv[])
 	l_test_add("/AES Key-wrap/Wrap & unwrap",
 			aes_wrap_test, NULL);
 	l_test_add("/AES-SIV", aes_siv_test, NULL);
+	l_test_add("/AES-SIV/Cached key", aes_siv_key_test, NULL);
 
 done:
 	return l_test_run();
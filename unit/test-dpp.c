@@ -264,6 +264,55 @@ static void test_key_derivation(const void *data)
 	CHECK_FROM_STR(i_auth_bytes, i_auth, 32);
 }
 
+static void test_key_pool(const void *data)
+{
+	const struct l_ecc_curve *curve = l_ecc_curve_from_ike_group(19);
+	struct dpp_key_pool *pool = dpp_key_pool_new(curve, 2);
+	struct l_ecc_scalar *private;
+	struct l_ecc_point *public;
+	_auto_(l_ecc_scalar_free) struct l_ecc_scalar *peer_private = NULL;
+	_auto_(l_ecc_point_free) struct l_ecc_point *peer_public = NULL;
+	_auto_(l_ecc_scalar_free) struct l_ecc_scalar *s1 = NULL;
+	_auto_(l_ecc_scalar_free) struct l_ecc_scalar *s2 = NULL;
+	uint64_t s1_bytes[L_ECC_MAX_DIGITS];
+	uint64_t s2_bytes[L_ECC_MAX_DIGITS];
+
+	assert(pool);
+	assert(dpp_key_pool_count(pool) == 0);
+
+	assert(dpp_key_pool_refill(pool));
+	assert(!dpp_key_pool_refill(pool));
+	assert(!dpp_key_pool_refill(pool));
+	assert(dpp_key_pool_count(pool) == 2);
+
+	/* Pooled keys must be a matching pair */
+	assert(dpp_key_pool_get(pool, &private, &public));
+	assert(dpp_key_pool_count(pool) == 1);
+
+	assert(l_ecdh_generate_key_pair(curve, &peer_private, &peer_public));
+	assert(l_ecdh_generate_shared_secret(private, peer_public, &s1));
+	assert(l_ecdh_generate_shared_secret(peer_private, public, &s2));
+	assert(l_ecc_scalar_get_data(s1, s1_bytes, sizeof(s1_bytes)) == 32);
+	assert(l_ecc_scalar_get_data(s2, s2_bytes, sizeof(s2_bytes)) == 32);
+	assert(!memcmp(s1_bytes, s2_bytes, 32));
+
+	l_ecc_scalar_free(private);
+	l_ecc_point_free(public);
+
+	/* An empty pool still hands out keys */
+	assert(dpp_key_pool_get(pool, &private, &public));
+	l_ecc_scalar_free(private);
+	l_ecc_point_free(public);
+
+	assert(dpp_key_pool_get(pool, &private, &public));
+	assert(dpp_key_pool_count(pool) == 0);
+	l_ecc_scalar_free(private);
+	l_ecc_point_free(public);
+
+	assert(dpp_key_pool_refill(pool));
+	dpp_key_pool_free(pool);
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -273,6 +322,9 @@ int main(int argc, char *argv[])
 		l_test_add("DPP test key derivation",
 						test_key_derivation, NULL);
 
+	if (l_getrandom_is_supported())
+		l_test_add("DPP key pool", test_key_pool, NULL);
+
 	l_test_add("DPP URI parse", test_uri_parse, &all_values);
 	l_test_add("DPP URI no type", test_uri_parse, &no_type);
 	l_test_add("DPP URI empty", test_uri_parse, &empty);
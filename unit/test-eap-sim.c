@@ -354,6 +354,81 @@ static void test_aka_prf_prime(const void *data)
 	assert(memcmp(emsk, vals->emsk, EAP_SIM_EMSK_LEN) == 0);
 }
 
+static void test_encr_attributes(const void *data)
+{
+	static const uint8_t k_encr[16] = {
+		0x53, 0x6e, 0x5e, 0xbc, 0x44, 0x65, 0x58, 0x2a,
+		0xa6, 0xa8, 0xec, 0x99, 0x86, 0xeb, 0xb6, 0x20,
+	};
+	static const uint8_t iv[16] = {
+		0x9e, 0x18, 0xb0, 0xc2, 0x9a, 0x65, 0x22, 0x63,
+		0xc0, 0x6e, 0xfb, 0x54, 0xdd, 0x00, 0xa8, 0x95,
+	};
+	static const uint8_t nonce_s[16] = {
+		0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef,
+		0xfe, 0xdc, 0xba, 0x98, 0x76, 0x54, 0x32, 0x10,
+	};
+	const char *id = "reauth@example.org";
+	uint16_t counter = L_CPU_TO_BE16(5);
+	uint8_t plain[48];
+	uint8_t pkt[3 + 20 + 4 + sizeof(plain)];
+	uint8_t *pos = plain;
+	struct l_cipher *cipher;
+	struct eap_sim_encr_attrs encr;
+	struct eap_sim_reauth *reauth;
+
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_COUNTER,
+			EAP_SIM_PAD_NONE, (uint8_t *) &counter, 2);
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_NONCE_S,
+			EAP_SIM_PAD_ZERO, nonce_s, sizeof(nonce_s));
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_NEXT_REAUTH_ID,
+			EAP_SIM_PAD_LENGTH, (const uint8_t *) id, strlen(id));
+	assert(pos - plain == (int) sizeof(plain));
+
+	pos = pkt;
+	*pos++ = EAP_SIM_ST_REAUTHENTICATION;
+	*pos++ = 0;
+	*pos++ = 0;
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_IV, EAP_SIM_PAD_ZERO,
+			iv, sizeof(iv));
+	pos += eap_sim_add_attribute(pos, EAP_SIM_AT_ENCR_DATA,
+			EAP_SIM_PAD_ZERO, NULL, sizeof(plain));
+
+	cipher = l_cipher_new(L_CIPHER_AES_CBC, k_encr, sizeof(k_encr));
+	assert(cipher);
+	assert(l_cipher_set_iv(cipher, iv, sizeof(iv)));
+	assert(l_cipher_encrypt(cipher, plain, pos - sizeof(plain),
+				sizeof(plain)));
+	l_cipher_free(cipher);
+
+	assert(eap_sim_decrypt_attributes(k_encr, pkt, sizeof(pkt), &encr));
+	assert(encr.have_counter && encr.counter == 5);
+	assert(encr.have_nonce_s);
+	assert(!memcmp(encr.nonce_s, nonce_s, sizeof(nonce_s)));
+	assert(encr.next_reauth_id && !strcmp(encr.next_reauth_id, id));
+
+	/* Hand the identity over to the cache and take it back out */
+	reauth = l_new(struct eap_sim_reauth, 1);
+	reauth->type = EAP_TYPE_AKA;
+	reauth->permanent_id = l_strdup("0user@example.org");
+	reauth->reauth_id = encr.next_reauth_id;
+	eap_sim_reauth_store(reauth);
+
+	assert(!eap_sim_reauth_take(EAP_TYPE_AKA_PRIME, "0user@example.org"));
+	reauth = eap_sim_reauth_take(EAP_TYPE_AKA, "0user@example.org");
+	assert(reauth && !strcmp(reauth->reauth_id, id));
+	assert(!eap_sim_reauth_take(EAP_TYPE_AKA, "0user@example.org"));
+	eap_sim_reauth_free(reauth);
+
+	/* AT_ENCR_DATA without AT_IV can't be decrypted */
+	memset(pkt + 3, 0, 20);
+	pkt[3] = EAP_SIM_AT_PADDING;
+	pkt[4] = 5;
+	assert(!eap_sim_decrypt_attributes(k_encr, pkt, sizeof(pkt), &encr));
+
+	eap_sim_reauth_flush();
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -365,5 +440,9 @@ int main(int argc, char *argv[])
 	l_test_add("EAP-AKA' Test Case 1", test_aka_prf_prime, &test_case_1);
 	l_test_add("EAP-AKA' Test Case 2", test_aka_prf_prime, &test_case_2);
 
+	if (l_cipher_is_supported(L_CIPHER_AES_CBC))
+		l_test_add("EAP-SIM encrypted attributes test",
+				test_encr_attributes, NULL);
+
 	return l_test_run();
 }
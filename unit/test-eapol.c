@@ -1764,6 +1764,8 @@ static void eapol_4way_test(const void *data)
 	const struct eapol_key *step4;
 	uint8_t *decrypted_key_data;
 	size_t decrypted_key_data_len;
+	uint8_t key_data_buf[256];
+	size_t key_data_buf_len;
 
 	step1 = eapol_key_validate(eapol_key_data_3,
 					sizeof(eapol_key_data_3), 16);
@@ -1812,6 +1814,12 @@ static void eapol_4way_test(const void *data)
 						ptk + 16, step3,
 						&decrypted_key_data_len, 16);
 	assert(decrypted_key_data[0] == 48);  // RSNE
+
+	assert(eapol_decrypt_key_data_buf(IE_RSN_AKM_SUITE_PSK, ptk + 16,
+						step3, key_data_buf,
+						&key_data_buf_len, 16));
+	assert(key_data_buf_len == decrypted_key_data_len);
+	assert(!memcmp(key_data_buf, decrypted_key_data, key_data_buf_len));
 	l_free(decrypted_key_data);
 
 	step4 = eapol_key_validate(eapol_key_data_6,
@@ -3463,7 +3471,10 @@ static void eapol_ft_handshake_test(const void *data)
 	const uint8_t r1khid[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00 };
 	const uint8_t ap_address[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00 };
 	const uint8_t sta_address[] = { 0x02, 0x00, 0x00, 0x00, 0x02, 0x00 };
+	const uint8_t r1khid2[] = { 0x02, 0x00, 0x00, 0x00, 0x01, 0x00 };
 	const char *ssid = "TestFT";
+	uint8_t pmk_r1[48];
+	uint8_t pmk_r1_name[16];
 	struct handshake_state *hs;
 	struct eapol_sm *sm;
 
@@ -3509,6 +3520,18 @@ static void eapol_ft_handshake_test(const void *data)
 				false);
 	assert(verify_step4_called);
 
+	/* With PMK-R0 known, a speculative PMK-R1 must match a fresh one */
+	assert(handshake_state_precompute_pmk_r1(hs, r1khid2));
+	assert(crypto_derive_pmk_r1(hs->ft->pmk_r0, r1khid2, spa,
+					hs->ft->pmk_r0_name, false,
+					pmk_r1, pmk_r1_name));
+
+	handshake_state_set_kh_ids(hs, r0khid, strlen((void *) r0khid),
+					r1khid2);
+	assert(handshake_state_derive_ptk(hs));
+	assert(!memcmp(hs->ft->pmk_r1, pmk_r1, 32));
+	assert(!memcmp(hs->ft->pmk_r1_name, pmk_r1_name, 16));
+
 	eapol_sm_free(sm);
 	handshake_state_free(hs);
 	eapol_exit();
@@ -3530,6 +3553,15 @@ struct test_ap_sta_data {
 	int to_ap_msg_cnt;
 	struct eapol_sm *ap_sm;
 	struct eapol_sm *sta_sm;
+	uint8_t sta_gtk[32];
+	uint16_t sta_gtk_index;
+	uint8_t sta_igtk[16];
+	uint16_t sta_igtk_index;
+	uint8_t sta_igtk_ipn[6];
+	const uint8_t *ap_group_rekey_kde;
+	size_t ap_group_rekey_kde_len;
+	const uint8_t *ap_group_rekey_rsc;
+	bool ap_group_rekey_done;
 };
 
 static int test_ap_sta_eapol_tx(uint32_t ifindex,
@@ -3561,6 +3593,16 @@ static int test_ap_sta_eapol_tx(uint32_t ifindex,
 	return 0;
 }
 
+static void test_ap_sta_flush(struct test_ap_sta_data *s)
+{
+	while (s->to_sta_data_len) {
+		int len = s->to_sta_data_len;
+		s->to_sta_data_len = 0;
+		__eapol_rx_packet(s->sta_hs->ifindex, s->ap_address, ETH_P_PAE,
+					s->to_sta_data, len, false);
+	}
+}
+
 static void test_ap_sta_run(struct test_ap_sta_data *s)
 {
 	eap_init();
@@ -3583,11 +3625,15 @@ static void test_ap_sta_run(struct test_ap_sta_data *s)
 	eapol_start(s->sta_sm);
 	eapol_start(s->ap_sm);
 
-	while (s->to_sta_data_len) {
-		int len = s->to_sta_data_len;
-		s->to_sta_data_len = 0;
-		__eapol_rx_packet(s->sta_hs->ifindex, s->ap_address, ETH_P_PAE,
-					s->to_sta_data, len, false);
+	test_ap_sta_flush(s);
+
+	if (s->ap_group_rekey_kde) {
+		assert(eapol_start_group_handshake(s->ap_sm,
+						s->ap_group_rekey_kde,
+						s->ap_group_rekey_kde_len ?:
+						s->ap_group_rekey_kde[1] + 2,
+						s->ap_group_rekey_rsc));
+		test_ap_sta_flush(s);
 	}
 
 	eapol_sm_free(s->ap_sm);
@@ -3623,7 +3669,15 @@ static void test_ap_sta_hs_event(struct handshake_state *hs,
 				enum handshake_event event,
 				void *user_data, ...)
 {
+	struct test_ap_sta_data *s = user_data;
+
 	assert(event != HANDSHAKE_EVENT_FAILED);
+
+	if (event == HANDSHAKE_EVENT_GROUP_REKEY_COMPLETE) {
+		assert(hs == s->ap_hs);
+		assert(!s->ap_group_rekey_done);
+		s->ap_group_rekey_done = true;
+	}
 }
 
 static void test_ap_sta_install_tk(struct handshake_state *hs, uint8_t key_idx,
@@ -3645,6 +3699,40 @@ static void test_ap_sta_install_tk(struct handshake_state *hs, uint8_t key_idx,
 	}
 }
 
+static void test_ap_sta_install_gtk(struct handshake_state *hs,
+					uint16_t key_index,
+					const uint8_t *gtk, uint8_t gtk_len,
+					const uint8_t *rsc, uint8_t rsc_len,
+					uint32_t cipher)
+{
+	struct test_ap_sta_hs *ths =
+		l_container_of(hs, struct test_ap_sta_hs, super);
+
+	assert(hs == ths->s->sta_hs);
+	assert(cipher == CRYPTO_CIPHER_CCMP && gtk_len == 16);
+
+	memcpy(ths->s->sta_gtk, gtk, gtk_len);
+	ths->s->sta_gtk_index = key_index;
+}
+
+static void test_ap_sta_install_igtk(struct handshake_state *hs,
+					uint16_t key_index,
+					const uint8_t *igtk, uint8_t igtk_len,
+					const uint8_t *ipn, uint8_t ipn_len,
+					uint32_t cipher)
+{
+	struct test_ap_sta_hs *ths =
+		l_container_of(hs, struct test_ap_sta_hs, super);
+
+	assert(hs == ths->s->sta_hs);
+	assert(cipher == CRYPTO_CIPHER_BIP && igtk_len == 16);
+	assert(ipn_len == 6);
+
+	memcpy(ths->s->sta_igtk, igtk, igtk_len);
+	ths->s->sta_igtk_index = key_index;
+	memcpy(ths->s->sta_igtk_ipn, ipn, ipn_len);
+}
+
 static void eapol_ap_sta_handshake_test(const void *data)
 {
 	static const unsigned char ap_rsne[] = {
@@ -3898,6 +3986,201 @@ static void eapol_ap_sta_handshake_ip_alloc_no_req_test(const void *data)
 	assert(!memcmp(s.ap_tk, s.sta_tk, 16));
 }
 
+static void eapol_ap_sta_group_rekey_test(const void *data)
+{
+	static const unsigned char ap_rsne[] = {
+		0x30, 0x14, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x04,
+		0x01, 0x00, 0x00, 0x0f, 0xac, 0x04, 0x01, 0x00,
+		0x00, 0x0f, 0xac, 0x02, 0x81, 0x00 };
+	static const unsigned char sta_rsne[] = {
+		0x30, 0x12, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x04,
+		0x01, 0x00, 0x00, 0x0f, 0xac, 0x04, 0x01, 0x00,
+		0x00, 0x0f, 0xac, 0x02 };
+	static const char *ssid = "TestWPA2PSK";
+	static const uint8_t psk[32] = {	/* secretsecret */
+		0x6a, 0xa3, 0xf0, 0x0b, 0x68, 0xbd, 0x8b, 0x46,
+		0x69, 0x83, 0xa5, 0x29, 0xa3, 0xfa, 0x57, 0x1c,
+		0x6c, 0x7b, 0x72, 0x41, 0x1d, 0xce, 0x33, 0x02,
+		0xa2, 0x2d, 0xdf, 0x77, 0xd1, 0x93, 0xdb, 0x5f };
+	static const uint8_t gtk1[16] = {
+		0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11 };
+	static const uint8_t gtk2[16] = {
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22 };
+	static const uint8_t rsc[6];
+	uint8_t gtk_kde[CRYPTO_MAX_GTK_LEN + 8];
+	struct test_ap_sta_data s = {
+		.ap_hs = test_ap_sta_hs_new(&s, 1),
+		.sta_hs = test_ap_sta_hs_new(&s, 2),
+		.ap_address = { 0x02, 0x03, 0x04, 0x05, 0x06, 0x07 },
+		.sta_address = { 0x02, 0x03, 0x04, 0x05, 0x06, 0x08 },
+		.ap_group_rekey_kde = gtk_kde,
+		.ap_group_rekey_rsc = rsc,
+	};
+
+	handshake_util_build_gtk_kde(CRYPTO_CIPHER_CCMP, gtk2, 2, gtk_kde);
+
+	__handshake_set_get_nonce_func(random_nonce);
+	__handshake_set_install_tk_func(test_ap_sta_install_tk);
+	__handshake_set_install_gtk_func(test_ap_sta_install_gtk);
+
+	handshake_state_set_authenticator(s.ap_hs, true);
+	handshake_state_set_event_func(s.ap_hs, test_ap_sta_hs_event, &s);
+	handshake_state_set_authenticator_address(s.ap_hs, s.ap_address);
+	handshake_state_set_supplicant_address(s.ap_hs, s.sta_address);
+	handshake_state_set_supplicant_ie(s.ap_hs, sta_rsne);
+	handshake_state_set_authenticator_ie(s.ap_hs, ap_rsne);
+	handshake_state_set_ssid(s.ap_hs, (void *) ssid, strlen(ssid));
+	handshake_state_set_pmk(s.ap_hs, psk, 32);
+	handshake_state_set_gtk(s.ap_hs, gtk1, 1, rsc);
+
+	handshake_state_set_authenticator(s.sta_hs, false);
+	handshake_state_set_event_func(s.sta_hs, test_ap_sta_hs_event, &s);
+	handshake_state_set_authenticator_address(s.sta_hs, s.ap_address);
+	handshake_state_set_supplicant_address(s.sta_hs, s.sta_address);
+	handshake_state_set_supplicant_ie(s.sta_hs, sta_rsne);
+	handshake_state_set_authenticator_ie(s.sta_hs, ap_rsne);
+	handshake_state_set_ssid(s.sta_hs, (void *) ssid, strlen(ssid));
+	handshake_state_set_pmk(s.sta_hs, psk, 32);
+
+	test_ap_sta_run(&s);
+
+	handshake_state_free(s.ap_hs);
+	handshake_state_free(s.sta_hs);
+	__handshake_set_install_tk_func(NULL);
+	__handshake_set_install_gtk_func(NULL);
+
+	assert(s.ap_success && s.sta_success);
+	assert(s.ap_group_rekey_done);
+	assert(s.to_ap_msg_cnt == 3 && s.to_sta_msg_cnt == 3);
+	assert(s.sta_gtk_index == 2);
+	assert(!memcmp(s.sta_gtk, gtk2, 16));
+}
+
+static const unsigned char ap_sta_mfp_rsne[] = {
+	0x30, 0x1a, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x04,
+	0x01, 0x00, 0x00, 0x0f, 0xac, 0x04, 0x01, 0x00,
+	0x00, 0x0f, 0xac, 0x02, 0x80, 0x00, 0x00, 0x00,
+	0x00, 0x0f, 0xac, 0x06 };
+static const uint8_t ap_sta_mfp_psk[32] = {	/* secretsecret */
+	0x6a, 0xa3, 0xf0, 0x0b, 0x68, 0xbd, 0x8b, 0x46,
+	0x69, 0x83, 0xa5, 0x29, 0xa3, 0xfa, 0x57, 0x1c,
+	0x6c, 0x7b, 0x72, 0x41, 0x1d, 0xce, 0x33, 0x02,
+	0xa2, 0x2d, 0xdf, 0x77, 0xd1, 0x93, 0xdb, 0x5f };
+static const uint8_t ap_sta_mfp_gtk[16] = {
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11 };
+static const uint8_t ap_sta_mfp_igtk[16] = {
+	0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33,
+	0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33 };
+static const uint8_t ap_sta_mfp_ipn[6] = { 0x05, 0x01, 0x00, 0x00, 0x00, 0x00 };
+
+static void test_ap_sta_mfp_setup(struct test_ap_sta_data *s)
+{
+	static const char *ssid = "TestWPA2PSK";
+	static const uint8_t rsc[6];
+
+	__handshake_set_get_nonce_func(random_nonce);
+	__handshake_set_install_tk_func(test_ap_sta_install_tk);
+	__handshake_set_install_gtk_func(test_ap_sta_install_gtk);
+	__handshake_set_install_igtk_func(test_ap_sta_install_igtk);
+
+	handshake_state_set_authenticator(s->ap_hs, true);
+	handshake_state_set_event_func(s->ap_hs, test_ap_sta_hs_event, s);
+	handshake_state_set_authenticator_address(s->ap_hs, s->ap_address);
+	handshake_state_set_supplicant_address(s->ap_hs, s->sta_address);
+	handshake_state_set_supplicant_ie(s->ap_hs, ap_sta_mfp_rsne);
+	handshake_state_set_authenticator_ie(s->ap_hs, ap_sta_mfp_rsne);
+	handshake_state_set_ssid(s->ap_hs, (void *) ssid, strlen(ssid));
+	handshake_state_set_pmk(s->ap_hs, ap_sta_mfp_psk, 32);
+	handshake_state_set_gtk(s->ap_hs, ap_sta_mfp_gtk, 1, rsc);
+	handshake_state_set_igtk(s->ap_hs, ap_sta_mfp_igtk, 4,
+					ap_sta_mfp_ipn);
+
+	handshake_state_set_authenticator(s->sta_hs, false);
+	handshake_state_set_event_func(s->sta_hs, test_ap_sta_hs_event, s);
+	handshake_state_set_authenticator_address(s->sta_hs, s->ap_address);
+	handshake_state_set_supplicant_address(s->sta_hs, s->sta_address);
+	handshake_state_set_supplicant_ie(s->sta_hs, ap_sta_mfp_rsne);
+	handshake_state_set_authenticator_ie(s->sta_hs, ap_sta_mfp_rsne);
+	handshake_state_set_ssid(s->sta_hs, (void *) ssid, strlen(ssid));
+	handshake_state_set_pmk(s->sta_hs, ap_sta_mfp_psk, 32);
+
+	assert(s->ap_hs->mfp && s->sta_hs->mfp);
+}
+
+static void test_ap_sta_mfp_cleanup(struct test_ap_sta_data *s)
+{
+	handshake_state_free(s->ap_hs);
+	handshake_state_free(s->sta_hs);
+	__handshake_set_install_tk_func(NULL);
+	__handshake_set_install_gtk_func(NULL);
+	__handshake_set_install_igtk_func(NULL);
+}
+
+static void eapol_ap_sta_mfp_handshake_test(const void *data)
+{
+	struct test_ap_sta_data s = {
+		.ap_hs = test_ap_sta_hs_new(&s, 1),
+		.sta_hs = test_ap_sta_hs_new(&s, 2),
+		.ap_address = { 0x02, 0x03, 0x04, 0x05, 0x06, 0x07 },
+		.sta_address = { 0x02, 0x03, 0x04, 0x05, 0x06, 0x08 },
+	};
+
+	test_ap_sta_mfp_setup(&s);
+	test_ap_sta_run(&s);
+	test_ap_sta_mfp_cleanup(&s);
+
+	assert(s.ap_success && s.sta_success);
+	assert(s.to_ap_msg_cnt == 2 && s.to_sta_msg_cnt == 2);
+	assert(!memcmp(s.ap_tk, s.sta_tk, 16));
+	assert(s.sta_gtk_index == 1);
+	assert(!memcmp(s.sta_gtk, ap_sta_mfp_gtk, 16));
+	assert(s.sta_igtk_index == 4);
+	assert(!memcmp(s.sta_igtk, ap_sta_mfp_igtk, 16));
+	assert(!memcmp(s.sta_igtk_ipn, ap_sta_mfp_ipn, 6));
+}
+
+static void eapol_ap_sta_mfp_group_rekey_test(const void *data)
+{
+	static const uint8_t gtk2[16] = {
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22 };
+	static const uint8_t igtk2[16] = {
+		0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44,
+		0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44 };
+	static const uint8_t rsc[6];
+	uint8_t kde[CRYPTO_MAX_GTK_LEN + 8 + CRYPTO_MAX_IGTK_LEN + 14];
+	struct test_ap_sta_data s = {
+		.ap_hs = test_ap_sta_hs_new(&s, 1),
+		.sta_hs = test_ap_sta_hs_new(&s, 2),
+		.ap_address = { 0x02, 0x03, 0x04, 0x05, 0x06, 0x07 },
+		.sta_address = { 0x02, 0x03, 0x04, 0x05, 0x06, 0x08 },
+		.ap_group_rekey_kde = kde,
+		.ap_group_rekey_rsc = rsc,
+	};
+
+	handshake_util_build_gtk_kde(CRYPTO_CIPHER_CCMP, gtk2, 2, kde);
+	s.ap_group_rekey_kde_len = kde[1] + 2;
+	handshake_util_build_igtk_kde(CRYPTO_CIPHER_BIP, igtk2, 5, rsc,
+					kde + s.ap_group_rekey_kde_len);
+	s.ap_group_rekey_kde_len += kde[s.ap_group_rekey_kde_len + 1] + 2;
+
+	test_ap_sta_mfp_setup(&s);
+	test_ap_sta_run(&s);
+	test_ap_sta_mfp_cleanup(&s);
+
+	assert(s.ap_success && s.sta_success);
+	assert(s.ap_group_rekey_done);
+	assert(s.to_ap_msg_cnt == 3 && s.to_sta_msg_cnt == 3);
+	assert(s.sta_gtk_index == 2);
+	assert(!memcmp(s.sta_gtk, gtk2, 16));
+	assert(s.sta_igtk_index == 5);
+	assert(!memcmp(s.sta_igtk, igtk2, 16));
+	assert(!memcmp(s.sta_igtk_ipn, rsc, 6));
+}
+
 #define IS_ENABLED(config_macro) _IS_ENABLED1(config_macro)
 #define _IS_ENABLED1(config_macro) _IS_ENABLED2(_XXXX##config_macro)
 #define _XXXX1 _YYYY,
@@ -4046,6 +4329,12 @@ int main(int argc, char *argv[])
 			&eapol_ap_sta_handshake_ip_alloc_ok_test, NULL);
 	l_test_add("EAPoL/Supplicant+Authenticator IP Allocation no request",
 			&eapol_ap_sta_handshake_ip_alloc_no_req_test, NULL);
+	l_test_add("EAPoL/Supplicant+Authenticator Group Key Handshake",
+			&eapol_ap_sta_group_rekey_test, NULL);
+	l_test_add("EAPoL/Supplicant+Authenticator MFP 4-Way Handshake",
+			&eapol_ap_sta_mfp_handshake_test, NULL);
+	l_test_add("EAPoL/Supplicant+Authenticator MFP Group Key Handshake",
+			&eapol_ap_sta_mfp_group_rekey_test, NULL);
 
 done:
 	return l_test_run();
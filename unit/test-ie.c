@@ -311,6 +311,52 @@ static void ie_test_writer_extended(const void *data)
 	assert(!memcmp(builder.buf, expected, builder_len));
 }
 
+static void ie_test_index(const void *data)
+{
+	struct ie_index index;
+	struct ie_tlv_iter iter;
+	uint8_t *payload;
+	ssize_t payload_len;
+	static const uint8_t test_buf[] = {
+		0x00, 0x03, 'i', 'w', 'd',			/* SSID */
+		0xdd, 0x06, 0x00, 0x50, 0xf2, 0x04, 0x10, 0x4a,	/* WSC */
+		0x01, 0x01, 0x82,				/* Rates */
+		0xff, 0x05, 0x0a, 0xff, 0x01, 0x02, 0x03,	/* Ext Req */
+		0xdd, 0x05, 0x00, 0x50, 0xf2, 0x04, 0x00,	/* WSC */
+		0x00, 0x01, 'x',				/* SSID */
+	};
+
+	ie_index_init(&index, test_buf, L_ARRAY_SIZE(test_buf));
+
+	assert(ie_index_get(&index, IE_TYPE_SSID, &iter));
+	assert(ie_tlv_iter_get_length(&iter) == 3);
+	assert(ie_tlv_iter_get_data(&iter) == test_buf + 2);
+
+	/* Continuing the iterator reaches the following elements */
+	assert(ie_tlv_iter_next(&iter));
+	assert(ie_tlv_iter_get_tag(&iter) == IE_TYPE_VENDOR_SPECIFIC);
+
+	assert(ie_index_get(&index, IE_TYPE_EXTENDED_REQUEST, &iter));
+	assert(ie_tlv_iter_get_length(&iter) == 4);
+	assert(ie_tlv_iter_get_data(&iter) == test_buf + 19);
+
+	assert(ie_index_get(&index, IE_TYPE_SUPPORTED_RATES, &iter));
+	assert(!ie_index_get(&index, IE_TYPE_RSN, &iter));
+
+	assert(index.n_vendor == 2);
+	assert(ie_index_has_vendor(&index, microsoft_oui, 0x04));
+	assert(!ie_index_has_vendor(&index, wifi_alliance_oui, 0x09));
+
+	payload = ie_index_extract_wsc_payload(&index, &payload_len);
+	assert(payload);
+	assert(payload_len == 3);
+	assert(!memcmp(payload, "\x10\x4a\x00", 3));
+	l_free(payload);
+
+	assert(!ie_index_extract_p2p_payload(&index, &payload_len));
+	assert(payload_len == -ENOENT);
+}
+
 struct ie_rsne_info_test {
 	const unsigned char *data;
 	size_t data_len;
@@ -694,6 +740,87 @@ static void ie_test_encapsulate_wsc(const void *data)
 	l_free(packed);
 }
 
+static const unsigned char rnr_ie[] = {
+	0xc9, 0x30,
+	/* Type 0, 2 TBTT Information fields of 13 bytes, 6GHz channel 37 */
+	0x10, 0x0d, 0x83, 0x25,
+	0x00, 0x02, 0x00, 0x00, 0x00, 0x01, 0x00, 0x12, 0x34, 0x56, 0x78,
+	0x42, 0x00,
+	0xff, 0x02, 0x00, 0x00, 0x00, 0x02, 0x00, 0xaa, 0xbb, 0xcc, 0xdd,
+	0x00, 0x10,
+	/* Reserved type, skipped */
+	0x01, 0x02, 0x51, 0x06, 0x00, 0x00,
+	/* Type 0, 1 TBTT Information field of 8 bytes, channel 1 */
+	0x00, 0x08, 0x51, 0x01,
+	0x00, 0x02, 0x00, 0x00, 0x00, 0x03, 0x00, 0x02,
+};
+
+struct rnr_test_state {
+	struct ie_rnr_info infos[4];
+	unsigned int count;
+	unsigned int max;
+};
+
+static bool rnr_test_cb(const struct ie_rnr_info *info, void *user_data)
+{
+	struct rnr_test_state *state = user_data;
+
+	assert(state->count < L_ARRAY_SIZE(state->infos));
+	state->infos[state->count++] = *info;
+
+	return state->count < state->max;
+}
+
+static void ie_test_rnr(const void *data)
+{
+	static const uint8_t bssid1[6] = { 0x02, 0x00, 0x00, 0x00, 0x01, 0x00 };
+	static const uint8_t bssid3[6] = { 0x02, 0x00, 0x00, 0x00, 0x03, 0x00 };
+	struct rnr_test_state state = { .max = 4 };
+	struct ie_tlv_iter iter;
+
+	ie_tlv_iter_init(&iter, rnr_ie, sizeof(rnr_ie));
+	assert(ie_tlv_iter_next(&iter));
+	assert(!ie_parse_reduced_neighbor_report(&iter, rnr_test_cb, &state));
+	assert(state.count == 3);
+
+	assert(state.infos[0].oper_class == 131);
+	assert(state.infos[0].channel_num == 37);
+	assert(state.infos[0].bssid_present);
+	assert(!memcmp(state.infos[0].bssid, bssid1, 6));
+	assert(state.infos[0].short_ssid_present);
+	assert(state.infos[0].short_ssid == 0x78563412);
+	assert(state.infos[0].bss_params_present);
+	assert(state.infos[0].bss_params == (IE_RNR_BSS_PARAMS_SAME_SSID |
+					IE_RNR_BSS_PARAMS_COLOCATED_AP));
+
+	assert(state.infos[1].channel_num == 37);
+	assert(state.infos[1].short_ssid == 0xddccbbaa);
+	assert(state.infos[1].bss_params == 0);
+
+	assert(state.infos[2].oper_class == 81);
+	assert(state.infos[2].channel_num == 1);
+	assert(state.infos[2].bssid_present);
+	assert(!memcmp(state.infos[2].bssid, bssid3, 6));
+	assert(!state.infos[2].short_ssid_present);
+	assert(state.infos[2].bss_params_present);
+	assert(state.infos[2].bss_params == IE_RNR_BSS_PARAMS_SAME_SSID);
+
+	/* Stops once the callback returns false */
+	memset(&state, 0, sizeof(state));
+	state.max = 1;
+	assert(!ie_parse_reduced_neighbor_report(&iter, rnr_test_cb, &state));
+	assert(state.count == 1);
+
+	/* Truncated in the last TBTT Information field */
+	memset(&state, 0, sizeof(state));
+	state.max = 4;
+	ie_tlv_iter_init(&iter, rnr_ie, sizeof(rnr_ie));
+	assert(ie_tlv_iter_next(&iter));
+	iter.len -= 1;
+	assert(ie_parse_reduced_neighbor_report(&iter, rnr_test_cb,
+						&state) == -EINVAL);
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -708,6 +835,8 @@ int main(int argc, char *argv[])
 	l_test_add("/ie/reader/extended", ie_test_reader_extended, NULL);
 	l_test_add("/ie/writer/extended", ie_test_writer_extended, NULL);
 
+	l_test_add("/ie/index", ie_test_index, NULL);
+
 	l_test_add("/ie/RSN Info Parser/Test Case 1",
 				ie_test_rsne_info, &ie_rsne_info_test_1);
 	l_test_add("/ie/RSN Info Parser/Test Case 2",
@@ -755,5 +884,7 @@ int main(int argc, char *argv[])
 				ie_test_encapsulate_wsc,
 				&ie_tlv_concat_test_data_1);
 
+	l_test_add("/ie/Reduced Neighbor Report", ie_test_rnr, NULL);
+
 	return l_test_run();
 }
@@ -212,6 +212,50 @@ static void test_json_larger_object(const void *data)
 	json_contents_free(c);
 }
 
+/*
+ * Tests objects needing more than the initial token array, with a nested
+ * object holding more keys than its parent.
+ */
+static void test_json_many_tokens(const void *data)
+{
+	struct l_string *str = l_string_new(1024);
+	_auto_(l_free) char *json = NULL;
+	_auto_(l_free) char *value = NULL;
+	struct json_iter iter;
+	struct json_iter inner;
+	struct json_contents *c;
+	unsigned int i;
+
+	l_string_append(str, "{\"inner\":{");
+
+	for (i = 0; i < 100; i++)
+		l_string_append_printf(str, "%s\"key%u\":[%u,{\"v\":%u}]",
+					i ? "," : "", i, i, i);
+
+	l_string_append(str, ",\"last\":\"value\"},\"after\":{}}");
+	json = l_string_unwrap(str);
+
+	c = json_contents_new(json, strlen(json));
+	assert(c);
+
+	json_iter_init(&iter, c);
+	assert(json_iter_parse(&iter,
+				JSON_MANDATORY("after", JSON_OBJECT, NULL),
+				JSON_MANDATORY("inner", JSON_OBJECT, &inner),
+				JSON_UNDEFINED));
+	assert(json_iter_parse(&inner,
+				JSON_MANDATORY("key99", JSON_ARRAY, NULL),
+				JSON_MANDATORY("last", JSON_STRING, &value),
+				JSON_OPTIONAL("v", JSON_PRIMITIVE, NULL),
+				JSON_UNDEFINED));
+	assert(!strcmp(value, "value"));
+	assert(!json_iter_parse(&inner,
+				JSON_MANDATORY("v", JSON_PRIMITIVE, NULL),
+				JSON_UNDEFINED));
+
+	json_contents_free(c);
+}
+
 static void check_primitives(struct json_iter *i, struct json_iter *ui,
 				struct json_iter *t, struct json_iter *f,
 				struct json_iter *null, struct json_iter *obj)
@@ -525,6 +569,7 @@ int main(int argc, char *argv[])
 	l_test_add("json empty objects", test_json_empty_objects, NULL);
 	l_test_add("json parse out of order", test_json_out_of_order, NULL);
 	l_test_add("json larger object", test_json_larger_object, NULL);
+	l_test_add("json many tokens", test_json_many_tokens, NULL);
 	l_test_add("json test primitives", test_json_primitives, NULL);
 	l_test_add("json test arrays", test_json_arrays, NULL);
 	l_test_add("json test nested arrays", test_json_nested_arrays, NULL);
@@ -175,6 +175,20 @@ static void ie_order_test(const void *data)
 	assert(!!mpdu_validate(frame->data, frame->len) == frame->good);
 }
 
+static void header_only_test(const void *data)
+{
+	const uint8_t *frame = probe_req_ie_duplicate1;
+
+	/* The IEs aren't looked at, only the header and frame type */
+	assert(mpdu_validate_header(frame, sizeof(probe_req_ie_duplicate1)));
+	assert(!mpdu_validate(frame, sizeof(probe_req_ie_duplicate1)));
+
+	assert(mpdu_validate_header(frame, 24));
+	assert(!mpdu_validate_header(frame, 23));
+	assert(!mpdu_validate_header(frame, 1));
+	assert(!mpdu_validate_header(NULL, 0));
+}
+
 static void ie_sort_test(const void *data)
 {
 	static uint8_t ie_fils_session[] = { IE_TYPE_EXTENSION, 1, 4 };
@@ -232,5 +246,7 @@ int main(int argc, char *argv[])
 
 	l_test_add("/IE order/Sorting", ie_sort_test, NULL);
 
+	l_test_add("/Management Frame/Header only", header_only_test, NULL);
+
 	return l_test_run();
 }
@@ -656,6 +656,60 @@ static const uint8_t p2p_association_req_ies_1[] = {
 	0x08, 0x74, 0x65, 0x73, 0x74, 0x64, 0x65, 0x76, 0x31,
 };
 
+static void p2p_test_discovery_beacon(const void *data)
+{
+	const struct p2p_beacon_data *test = data;
+	struct p2p_discovery_info info;
+
+	assert(p2p_parse_discovery_info(test->ies, test->ies_len, &info) == 0);
+
+	assert(info.capability.device_caps ==
+		test->data.capability.device_caps);
+	assert(info.capability.group_caps == test->data.capability.group_caps);
+	assert(info.have_device_id && !info.have_device_info);
+	assert(!memcmp(info.device_id, test->data.device_addr, 6));
+}
+
+static void p2p_test_discovery_probe_req(const void *data)
+{
+	const struct p2p_probe_req_data *test = data;
+	struct p2p_discovery_info info;
+
+	assert(p2p_parse_discovery_info(test->ies, test->ies_len, &info) == 0);
+
+	assert(info.capability.device_caps ==
+		test->data.capability.device_caps);
+	assert(info.capability.group_caps == test->data.capability.group_caps);
+	assert(!info.have_device_id && !info.have_device_info);
+	assert(!memcmp(&info.listen_channel, &test->data.listen_channel,
+			sizeof(info.listen_channel)));
+	assert(!info.operating_channel.country[0]);
+}
+
+static void p2p_test_discovery_probe_resp(const void *data)
+{
+	const struct p2p_probe_resp_data *test = data;
+	const struct p2p_device_info_attr *expected = &test->data.device_info;
+	struct p2p_discovery_info info;
+
+	assert(p2p_parse_discovery_info(test->ies, test->ies_len, &info) == 0);
+
+	assert(info.capability.device_caps ==
+		test->data.capability.device_caps);
+	assert(info.capability.group_caps == test->data.capability.group_caps);
+	assert(!info.have_device_id && info.have_device_info);
+
+	assert(!memcmp(info.device_info.device_addr, expected->device_addr, 6));
+	assert(info.device_info.wsc_config_methods ==
+		expected->wsc_config_methods);
+	assert(info.device_info.primary_device_type.category ==
+		expected->primary_device_type.category);
+	assert(info.device_info.primary_device_type.subcategory ==
+		expected->primary_device_type.subcategory);
+	assert(!info.device_info.secondary_device_types);
+	assert(!strcmp(info.device_info.device_name, expected->device_name));
+}
+
 struct p2p_association_req_data {
 	const uint8_t *ies;
 	size_t ies_len;
@@ -1146,6 +1200,15 @@ int main(int argc, char *argv[])
 	l_test_add("/p2p/build/Probe Response IEs 2", p2p_test_build_probe_resp,
 			&p2p_probe_resp_data_2);
 
+	l_test_add("/p2p/discovery/Beacon IEs 1", p2p_test_discovery_beacon,
+			&p2p_beacon_data_1);
+	l_test_add("/p2p/discovery/Probe Request IEs 1",
+			p2p_test_discovery_probe_req, &p2p_probe_req_data_1);
+	l_test_add("/p2p/discovery/Probe Response IEs 1",
+			p2p_test_discovery_probe_resp, &p2p_probe_resp_data_1);
+	l_test_add("/p2p/discovery/Probe Response IEs 2",
+			p2p_test_discovery_probe_resp, &p2p_probe_resp_data_2);
+
 	l_test_add("/p2p/parse/Association Request IEs 1",
 			p2p_test_parse_association_req,
 			&p2p_association_req_data_1);
@@ -0,0 +1,215 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include <ell/ell.h>
+
+#include "src/ie.h"
+#include "src/crypto.h"
+#include "src/pmksa.h"
+
+static const uint8_t spa[6] = { 0x02, 0x00, 0x00, 0x00, 0x01, 0x00 };
+static const uint8_t aa1[6] = { 0x02, 0x00, 0x00, 0x00, 0x02, 0x00 };
+static const uint8_t aa2[6] = { 0x02, 0x00, 0x00, 0x00, 0x03, 0x00 };
+static const uint8_t aa3[6] = { 0x02, 0x00, 0x00, 0x00, 0x04, 0x00 };
+static const char *ssid = "TestPMKSA";
+
+static unsigned int n_driver_add;
+static unsigned int n_driver_remove;
+static unsigned int n_driver_flush;
+
+static void driver_add(const struct pmksa *pmksa)
+{
+	n_driver_add++;
+}
+
+static void driver_remove(const struct pmksa *pmksa)
+{
+	n_driver_remove++;
+}
+
+static void driver_flush(void)
+{
+	n_driver_flush++;
+}
+
+static struct pmksa *pmksa_new(const uint8_t *aa, uint32_t akm,
+				uint64_t expiration, uint8_t fill)
+{
+	struct pmksa *pmksa = l_new(struct pmksa, 1);
+
+	pmksa->expiration = expiration;
+	memcpy(pmksa->spa, spa, 6);
+	memcpy(pmksa->aa, aa, 6);
+	pmksa->ssid_len = strlen(ssid);
+	memcpy(pmksa->ssid, ssid, pmksa->ssid_len);
+	pmksa->akm = akm;
+	memset(pmksa->pmkid, fill, sizeof(pmksa->pmkid));
+	memset(pmksa->pmk, fill, 32);
+	pmksa->pmk_len = 32;
+
+	return pmksa;
+}
+
+static struct pmksa *cache_get(const uint8_t *aa, uint32_t akm)
+{
+	return pmksa_cache_get(spa, aa, (const uint8_t *) ssid, strlen(ssid),
+				akm);
+}
+
+static void test_pmksa_get_put(const void *data)
+{
+	uint64_t later = l_time_offset(l_time_now(), pmksa_lifetime());
+	struct pmksa *pmksa;
+
+	assert(l_main_init());
+
+	n_driver_add = n_driver_remove = n_driver_flush = 0;
+	__pmksa_set_driver_callbacks(driver_add, driver_remove, driver_flush);
+
+	assert(!pmksa_cache_put(pmksa_new(aa1, IE_RSN_AKM_SUITE_8021X,
+						later, 1)));
+	assert(!pmksa_cache_put(pmksa_new(aa2, IE_RSN_AKM_SUITE_SAE_SHA256,
+						later, 2)));
+	assert(n_driver_add == 2);
+
+	/* Wrong AKM or BSSID */
+	assert(!cache_get(aa1, IE_RSN_AKM_SUITE_SAE_SHA256));
+	assert(!cache_get(spa, IE_RSN_AKM_SUITE_8021X));
+
+	pmksa = cache_get(aa1, IE_RSN_AKM_SUITE_8021X |
+				IE_RSN_AKM_SUITE_8021X_SHA256);
+	assert(pmksa);
+	assert(pmksa->pmkid[0] == 1);
+
+	/* Entries are handed out, not copied */
+	assert(!cache_get(aa1, IE_RSN_AKM_SUITE_8021X));
+
+	/* Putting it back makes it available again */
+	assert(!pmksa_cache_put(pmksa));
+	assert(cache_get(aa1, IE_RSN_AKM_SUITE_8021X) == pmksa);
+	pmksa_free(pmksa);
+
+	/* A newer entry for the same BSS and AKM replaces the old one */
+	assert(!pmksa_cache_put(pmksa_new(aa2, IE_RSN_AKM_SUITE_SAE_SHA256,
+						later, 3)));
+	assert(n_driver_remove == 1);
+
+	pmksa = cache_get(aa2, IE_RSN_AKM_SUITE_SAE_SHA256);
+	assert(pmksa);
+	assert(pmksa->pmkid[0] == 3);
+	assert(!cache_get(aa2, IE_RSN_AKM_SUITE_SAE_SHA256));
+	pmksa_free(pmksa);
+
+	assert(!pmksa_cache_flush());
+	assert(n_driver_flush == 1);
+
+	__pmksa_set_driver_callbacks(NULL, NULL, NULL);
+	l_main_exit();
+}
+
+static void test_pmksa_expire(const void *data)
+{
+	uint64_t now = l_time_now();
+	uint64_t later = l_time_offset(now, pmksa_lifetime());
+
+	assert(l_main_init());
+
+	assert(!pmksa_cache_put(pmksa_new(aa1, IE_RSN_AKM_SUITE_8021X,
+						now + 10, 1)));
+	assert(!pmksa_cache_put(pmksa_new(aa2, IE_RSN_AKM_SUITE_8021X,
+						later, 2)));
+
+	/* Only entries expiring at or before the cutoff are removed */
+	assert(pmksa_cache_expire(now + 10) == 1);
+	assert(!cache_get(aa1, IE_RSN_AKM_SUITE_8021X));
+
+	assert(pmksa_cache_expire(later) == 1);
+	assert(!cache_get(aa2, IE_RSN_AKM_SUITE_8021X));
+
+	assert(!pmksa_cache_flush());
+	l_main_exit();
+}
+
+static void test_pmksa_derive(const void *data)
+{
+	uint64_t now = l_time_now();
+	uint64_t later = l_time_offset(now, pmksa_lifetime());
+	struct pmksa *pmksa;
+	uint8_t pmkid[16];
+
+	assert(l_main_init());
+
+	assert(!pmksa_cache_put(pmksa_new(aa1, IE_RSN_AKM_SUITE_8021X,
+						now + 1000000, 1)));
+	assert(!pmksa_cache_put(pmksa_new(aa2, IE_RSN_AKM_SUITE_8021X,
+						later, 2)));
+
+	/* The newest PMKSA is bound to the new BSSID with a new PMKID */
+	pmksa = pmksa_cache_derive(spa, aa3, (const uint8_t *) ssid,
+					strlen(ssid), IE_RSN_AKM_SUITE_8021X);
+	assert(pmksa);
+	assert(!memcmp(pmksa->aa, aa3, 6));
+	assert(pmksa->pmk[0] == 2);
+	assert(crypto_derive_pmkid(pmksa->pmk, spa, aa3, pmkid, false));
+	assert(!memcmp(pmksa->pmkid, pmkid, 16));
+	pmksa_free(pmksa);
+
+	/* The cache itself is not modified */
+	pmksa = cache_get(aa1, IE_RSN_AKM_SUITE_8021X);
+	assert(pmksa);
+	assert(pmksa->pmkid[0] == 1);
+	pmksa_free(pmksa);
+
+	/* A BSS's own PMKSA is skipped, it is found with pmksa_cache_get */
+	pmksa = pmksa_cache_derive(spa, aa2, (const uint8_t *) ssid,
+					strlen(ssid), IE_RSN_AKM_SUITE_8021X);
+	assert(pmksa);
+	assert(pmksa->pmk[0] == 1);
+	pmksa_free(pmksa);
+
+	/* No OKC for SAE, its PMKID is not derived from the PMK */
+	assert(!pmksa_cache_put(pmksa_new(aa1, IE_RSN_AKM_SUITE_SAE_SHA256,
+						later, 3)));
+	assert(!pmksa_cache_derive(spa, aa3, (const uint8_t *) ssid,
+					strlen(ssid),
+					IE_RSN_AKM_SUITE_SAE_SHA256));
+
+	assert(!pmksa_cache_flush());
+	l_main_exit();
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/pmksa/get and put", test_pmksa_get_put, NULL);
+	l_test_add("/pmksa/expire", test_pmksa_expire, NULL);
+	l_test_add("/pmksa/derive", test_pmksa_derive, NULL);
+
+	return l_test_run();
+}
@@ -24,7 +24,9 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include <assert.h>
 #include <ell/ell.h>
 
@@ -873,6 +875,55 @@ static void test_pt_pwe(const void *data)
 	l_ecc_point_free(pt);
 }
 
+static void test_pt_cache(const void *data)
+{
+	static const char *ssid = "byteme";
+	static const char *password = "mekmitasdigoat";
+	struct l_ecc_point *pt;
+	struct l_ecc_point *cached;
+	uint64_t start;
+	uint64_t derive_time;
+	uint64_t cached_time;
+
+	assert(l_main_init());
+
+	start = l_time_now();
+	pt = crypto_derive_sae_pt_ecc(19, ssid, password, NULL);
+	derive_time = l_time_diff(start, l_time_now());
+	assert(pt);
+
+	/* Derive in the background, then expect a cache hit */
+	assert(crypto_sae_pt_precompute(19, ssid, password));
+	assert(!crypto_sae_pt_precompute(19, ssid, password));
+	l_main_iterate(0);
+	assert(!crypto_sae_pt_precompute(19, ssid, password));
+
+	start = l_time_now();
+	cached = crypto_sae_pt_cache_get(19, ssid, password);
+	cached_time = l_time_diff(start, l_time_now());
+	assert(cached);
+	assert(l_ecc_points_are_equal(pt, cached));
+	l_ecc_point_free(cached);
+
+	printf("PT derivation: %" PRIu64 " us, cached: %" PRIu64 " us\n",
+			derive_time, cached_time);
+
+	/* A different password must not hit the same entry */
+	cached = crypto_sae_pt_cache_get(19, ssid, "differentpassword");
+	assert(cached);
+	assert(!l_ecc_points_are_equal(pt, cached));
+	l_ecc_point_free(cached);
+
+	/* Flushing drops pending work as well */
+	assert(crypto_sae_pt_precompute(19, "otherssid", password));
+	crypto_sae_pt_cache_flush();
+	assert(crypto_sae_pt_precompute(19, ssid, password));
+	crypto_sae_pt_cache_flush();
+
+	l_ecc_point_free(pt);
+	l_main_exit();
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -898,6 +949,7 @@ int main(int argc, char *argv[])
 	l_test_add("SAE end-to-end", test_end_to_end, NULL);
 
 	l_test_add("SAE pt-pwe", test_pt_pwe, NULL);
+	l_test_add("SAE pt cache", test_pt_cache, NULL);
 
 done:
 	return l_test_run();
@@ -0,0 +1,254 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/uio.h>
+#include <ell/ell.h>
+
+#include "src/softcrypto.h"
+
+static const enum l_checksum_type hash_types[] = {
+	L_CHECKSUM_SHA1,
+	L_CHECKSUM_SHA256,
+	L_CHECKSUM_SHA384,
+};
+
+static const size_t msg_lens[] = {
+	0, 1, 55, 56, 63, 64, 65, 111, 112, 127, 128, 129, 300,
+};
+
+static uint8_t msg[300];
+
+static void hash_test(const void *data)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < L_ARRAY_SIZE(hash_types); i++) {
+		struct l_checksum *checksum;
+
+		if (!l_checksum_is_supported(hash_types[i], false))
+			continue;
+
+		checksum = l_checksum_new(hash_types[i]);
+		assert(checksum);
+
+		for (j = 0; j < L_ARRAY_SIZE(msg_lens); j++) {
+			struct soft_hash hash;
+			size_t len = msg_lens[j];
+			uint8_t expected[48];
+			uint8_t digest[48];
+			ssize_t r;
+			struct iovec iov[2] = {
+				[0] = { .iov_base = msg, .iov_len = len / 3 },
+				[1] = {
+					.iov_base = msg + len / 3,
+					.iov_len = len - len / 3,
+				},
+			};
+
+			l_checksum_update(checksum, msg, len);
+			r = l_checksum_get_digest(checksum, expected,
+							sizeof(expected));
+			assert(r > 0);
+
+			assert(soft_hash_init(&hash, hash_types[i]));
+			soft_hash_updatev(&hash, iov, 2);
+			assert(soft_hash_final(&hash, digest,
+						sizeof(digest)) == (size_t) r);
+
+			assert(!memcmp(digest, expected, r));
+			l_checksum_reset(checksum);
+		}
+
+		l_checksum_free(checksum);
+	}
+}
+
+static void hmac_test(const void *data)
+{
+	static const size_t key_lens[] = { 0, 5, 32, 64, 129 };
+	unsigned int i, j, k;
+
+	for (i = 0; i < L_ARRAY_SIZE(hash_types); i++) {
+		if (!l_checksum_is_supported(hash_types[i], true))
+			continue;
+
+		for (j = 0; j < L_ARRAY_SIZE(key_lens); j++) {
+			struct l_checksum *checksum;
+			struct soft_hmac hmac;
+
+			checksum = l_checksum_new_hmac(hash_types[i], msg,
+							key_lens[j]);
+			assert(checksum);
+			assert(soft_hmac_init(&hmac, hash_types[i], msg,
+						key_lens[j]));
+
+			/* The soft context must be reusable after final */
+			for (k = 0; k < L_ARRAY_SIZE(msg_lens); k++) {
+				uint8_t expected[48];
+				uint8_t digest[48];
+				ssize_t r;
+
+				l_checksum_update(checksum, msg, msg_lens[k]);
+				r = l_checksum_get_digest(checksum, expected,
+							sizeof(expected));
+				assert(r > 0);
+
+				soft_hmac_update(&hmac, msg, msg_lens[k]);
+				assert(soft_hmac_final(&hmac, digest,
+						sizeof(digest)) == (size_t) r);
+
+				assert(!memcmp(digest, expected, r));
+				l_checksum_reset(checksum);
+			}
+
+			soft_hmac_clear(&hmac);
+			l_checksum_free(checksum);
+		}
+	}
+}
+
+/* FIPS 197, Appendix C */
+static void aes_fips197_test(const void *data)
+{
+	static const uint8_t plaintext[16] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+		0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff,
+	};
+	static const uint8_t ciphertext[3][16] = {
+		{
+			0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+			0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a,
+		},
+		{
+			0xdd, 0xa9, 0x7c, 0xa4, 0x86, 0x4c, 0xdf, 0xe0,
+			0x6e, 0xaf, 0x70, 0xa0, 0xec, 0x0d, 0x71, 0x91,
+		},
+		{
+			0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf,
+			0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89,
+		},
+	};
+	uint8_t key[32];
+	unsigned int i;
+
+	for (i = 0; i < sizeof(key); i++)
+		key[i] = i;
+
+	for (i = 0; i < 3; i++) {
+		struct soft_aes aes;
+		uint8_t out[16];
+
+		assert(soft_aes_init(&aes, key, 16 + i * 8));
+
+		soft_aes_encrypt(&aes, plaintext, out);
+		assert(!memcmp(out, ciphertext[i], 16));
+
+		soft_aes_decrypt(&aes, out, out);
+		assert(!memcmp(out, plaintext, 16));
+
+		soft_aes_clear(&aes);
+	}
+}
+
+static void aes_test(const void *data)
+{
+	static const size_t key_lens[] = { 16, 24, 32 };
+	unsigned int i;
+
+	if (!l_cipher_is_supported(L_CIPHER_AES)) {
+		printf("AES support missing, skipping...\n");
+		return;
+	}
+
+	for (i = 0; i < L_ARRAY_SIZE(key_lens); i++) {
+		struct l_cipher *cipher;
+		struct soft_aes aes;
+		uint8_t expected[16];
+		uint8_t out[16];
+
+		cipher = l_cipher_new(L_CIPHER_AES, msg + i, key_lens[i]);
+		assert(cipher);
+		assert(soft_aes_init(&aes, msg + i, key_lens[i]));
+
+		assert(l_cipher_encrypt(cipher, msg + 64, expected, 16));
+		soft_aes_encrypt(&aes, msg + 64, out);
+		assert(!memcmp(out, expected, 16));
+
+		soft_aes_decrypt(&aes, expected, out);
+		assert(!memcmp(out, msg + 64, 16));
+
+		soft_aes_clear(&aes);
+		l_cipher_free(cipher);
+	}
+}
+
+static void cmac_test(const void *data)
+{
+	unsigned int i;
+
+	if (!l_checksum_cmac_aes_supported()) {
+		printf("AES-CMAC support missing, skipping...\n");
+		return;
+	}
+
+	for (i = 0; i < L_ARRAY_SIZE(msg_lens); i++) {
+		struct l_checksum *checksum;
+		uint8_t expected[16];
+		uint8_t tag[16];
+
+		checksum = l_checksum_new_cmac_aes(msg + 7, 16);
+		assert(checksum);
+
+		l_checksum_update(checksum, msg, msg_lens[i]);
+		l_checksum_get_digest(checksum, expected, sizeof(expected));
+		l_checksum_free(checksum);
+
+		assert(soft_cmac_aes(msg + 7, 16, msg, msg_lens[i],
+					tag, sizeof(tag)));
+		assert(!memcmp(tag, expected, sizeof(tag)));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+
+	l_test_init(&argc, &argv);
+
+	for (i = 0; i < sizeof(msg); i++)
+		msg[i] = i * 7 + 3;
+
+	l_test_add("/softcrypto/SHA", hash_test, NULL);
+	l_test_add("/softcrypto/HMAC", hmac_test, NULL);
+	l_test_add("/softcrypto/AES FIPS-197", aes_fips197_test, NULL);
+	l_test_add("/softcrypto/AES", aes_test, NULL);
+	l_test_add("/softcrypto/CMAC-AES", cmac_test, NULL);
+
+	return l_test_run();
+}
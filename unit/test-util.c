@@ -32,6 +32,7 @@
 #include <ell/ell.h>
 
 #include "src/util.h"
+#include "src/band.h"
 
 struct ssid_test_data {
 	size_t len;
@@ -183,6 +184,65 @@ static void ip_prefix_test(const void *data)
 	}
 }
 
+static void scan_freq_set_test(const void *data)
+{
+	struct scan_freq_set *set = scan_freq_set_new();
+	struct scan_freq_set *other = scan_freq_set_new();
+	uint32_t *freqs;
+	size_t len;
+
+	assert(scan_freq_set_isempty(set));
+	assert(scan_freq_set_count(set) == 0);
+
+	assert(scan_freq_set_add(set, 2412));
+	assert(scan_freq_set_add(set, 5180));
+	assert(scan_freq_set_add(set, 5825));
+	assert(scan_freq_set_add(set, 5955));
+	assert(!scan_freq_set_add(set, 1000));
+
+	assert(scan_freq_set_count(set) == 4);
+	assert(scan_freq_set_contains(set, 2412));
+	assert(scan_freq_set_contains(set, 5825));
+	assert(scan_freq_set_contains(set, 5955));
+	assert(!scan_freq_set_contains(set, 2437));
+	assert(!scan_freq_set_contains(set, 5200));
+	assert(scan_freq_set_get_bands(set) == (BAND_FREQ_2_4_GHZ |
+				BAND_FREQ_5_GHZ | BAND_FREQ_6_GHZ));
+
+	assert(scan_freq_set_add(other, 2437));
+	assert(scan_freq_set_add(other, 5180));
+
+	scan_freq_set_merge(other, set);
+	assert(scan_freq_set_count(other) == 5);
+
+	scan_freq_set_subtract(other, set);
+	assert(scan_freq_set_count(other) == 1);
+	assert(scan_freq_set_contains(other, 2437));
+
+	scan_freq_set_merge(other, set);
+	scan_freq_set_constrain(set, other);
+	assert(scan_freq_set_count(set) == 4);
+
+	scan_freq_set_subtract(other, other);
+	assert(scan_freq_set_isempty(other));
+
+	scan_freq_set_constrain(set, other);
+	assert(scan_freq_set_isempty(set));
+
+	assert(scan_freq_set_add(set, 5955));
+	assert(scan_freq_set_add(set, 2484));
+
+	freqs = scan_freq_set_to_fixed_array(set, &len);
+	assert(freqs);
+	assert(len == 2);
+	assert(freqs[0] == 5955);
+	assert(freqs[1] == 2484);
+	l_free(freqs);
+
+	scan_freq_set_free(set);
+	scan_freq_set_free(other);
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -191,6 +251,7 @@ int main(int argc, char *argv[])
 	l_test_add("/util/get_domain/", get_domain_test, NULL);
 	l_test_add("/util/get_username/", get_username_test, NULL);
 	l_test_add("/util/ip_prefix/", ip_prefix_test, NULL);
+	l_test_add("/util/scan_freq_set/", scan_freq_set_test, NULL);
 
 	return l_test_run();
 }
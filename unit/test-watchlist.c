@@ -0,0 +1,263 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2026  agent. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+#include <ell/ell.h>
+
+#include "src/watchlist.h"
+
+typedef void (*test_notify_func_t)(int value, void *user_data);
+
+struct test_watch {
+	struct watchlist *watchlist;
+	char name;
+	unsigned int id;
+	unsigned int remove_id;
+	bool destroy_list;
+	unsigned int destroyed;
+};
+
+static char notified[64];
+static unsigned int n_notified;
+
+static void test_notify(int value, void *user_data)
+{
+	struct test_watch *watch = user_data;
+
+	assert(value == 42);
+	notified[n_notified++] = watch->name;
+
+	if (watch->remove_id)
+		assert(watchlist_remove(watch->watchlist, watch->remove_id));
+
+	if (watch->destroy_list)
+		watchlist_destroy(watch->watchlist);
+}
+
+static void test_destroy(void *user_data)
+{
+	struct test_watch *watch = user_data;
+
+	watch->destroyed++;
+}
+
+static void notify(struct watchlist *list)
+{
+	memset(notified, 0, sizeof(notified));
+	n_notified = 0;
+
+	WATCHLIST_NOTIFY(list, test_notify_func_t, 42);
+}
+
+static void watch_add(struct watchlist *watchlist, struct test_watch *watch,
+			char name)
+{
+	memset(watch, 0, sizeof(*watch));
+	watch->watchlist = watchlist;
+	watch->name = name;
+	watch->id = watchlist_add(watchlist, test_notify, watch, test_destroy);
+	assert(watch->id);
+}
+
+static void test_add_remove(const void *data)
+{
+	struct watchlist watchlist;
+	struct test_watch w[4];
+	unsigned int old_id;
+
+	watchlist_init(&watchlist, NULL);
+
+	watch_add(&watchlist, &w[0], 'a');
+	watch_add(&watchlist, &w[1], 'b');
+	watch_add(&watchlist, &w[2], 'c');
+	assert(w[0].id != w[1].id && w[1].id != w[2].id);
+
+	notify(&watchlist);
+	assert(!strcmp(notified, "abc"));
+
+	old_id = w[1].id;
+	assert(watchlist_remove(&watchlist, old_id));
+	assert(w[1].destroyed == 1);
+	assert(!watchlist_remove(&watchlist, old_id));
+	assert(!watchlist_remove(&watchlist, 0));
+	assert(!watchlist_remove(&watchlist, 12345));
+
+	/* The freed slot gets reused but with a new ID */
+	watch_add(&watchlist, &w[3], 'd');
+	assert(w[3].id != old_id);
+	assert(!watchlist_remove(&watchlist, old_id));
+
+	/* New items always go last */
+	notify(&watchlist);
+	assert(!strcmp(notified, "acd"));
+
+	assert(watchlist_remove(&watchlist, w[0].id));
+	assert(watchlist_remove(&watchlist, w[2].id));
+	notify(&watchlist);
+	assert(!strcmp(notified, "d"));
+
+	watchlist_destroy(&watchlist);
+	assert(w[0].destroyed == 1 && w[2].destroyed == 1);
+	assert(w[3].destroyed == 1);
+}
+
+static void test_remove_in_notify(const void *data)
+{
+	struct watchlist watchlist;
+	struct test_watch w[4];
+
+	watchlist_init(&watchlist, NULL);
+
+	watch_add(&watchlist, &w[0], 'a');
+	watch_add(&watchlist, &w[1], 'b');
+	watch_add(&watchlist, &w[2], 'c');
+	watch_add(&watchlist, &w[3], 'd');
+
+	/* Remove an item not yet notified and the current item */
+	w[0].remove_id = w[2].id;
+	w[1].remove_id = w[1].id;
+
+	notify(&watchlist);
+	assert(!strcmp(notified, "abd"));
+	assert(w[1].destroyed == 1 && w[2].destroyed == 1);
+	assert(!watchlist.stale_items);
+
+	w[0].remove_id = 0;
+	notify(&watchlist);
+	assert(!strcmp(notified, "ad"));
+
+	watchlist_destroy(&watchlist);
+	assert(w[0].destroyed == 1 && w[3].destroyed == 1);
+}
+
+static void test_destroy_in_notify(const void *data)
+{
+	struct watchlist watchlist;
+	struct test_watch w[2];
+
+	watchlist_init(&watchlist, NULL);
+
+	watch_add(&watchlist, &w[0], 'a');
+	watch_add(&watchlist, &w[1], 'b');
+	w[0].destroy_list = true;
+
+	notify(&watchlist);
+	assert(!strcmp(notified, "a"));
+	assert(watchlist.pending_destroy);
+	assert(w[0].destroyed == 1 && w[1].destroyed == 1);
+}
+
+static bool remove_odd(struct watchlist_item *item, void *user_data)
+{
+	struct test_watch *watch = item->notify_data;
+
+	if (!(watch->name & 1))
+		return false;
+
+	test_destroy(watch);
+	l_free(item);
+	return true;
+}
+
+static void test_many(const void *data)
+{
+	struct watchlist watchlist;
+	struct test_watch w[40];
+	unsigned int i;
+
+	watchlist_init(&watchlist, NULL);
+
+	for (i = 0; i < L_ARRAY_SIZE(w); i++)
+		watch_add(&watchlist, &w[i], '0' + i);
+
+	assert(watchlist_foreach_remove(&watchlist, remove_odd, NULL) == 20);
+
+	notify(&watchlist);
+	assert(n_notified == 20);
+
+	for (i = 0; i < n_notified; i++)
+		assert(notified[i] == '0' + i * 2);
+
+	for (i = 0; i < L_ARRAY_SIZE(w); i += 2)
+		assert(watchlist_remove(&watchlist, w[i].id));
+
+	for (i = 0; i < L_ARRAY_SIZE(w); i++)
+		assert(w[i].destroyed == 1);
+
+	notify(&watchlist);
+	assert(n_notified == 0);
+
+	watchlist_destroy(&watchlist);
+}
+
+static void test_id_reuse(const void *data)
+{
+	struct watchlist watchlist;
+	struct test_watch w[3];
+	unsigned int old_id;
+	unsigned int i;
+
+	watchlist_init(&watchlist, NULL);
+
+	watch_add(&watchlist, &w[0], 'a');
+	watch_add(&watchlist, &w[1], 'b');
+	old_id = w[0].id;
+	assert(watchlist_remove(&watchlist, old_id));
+
+	/*
+	 * Even with a single free slot being reused over and over a stale
+	 * ID must not match a newer watch for much longer than the
+	 * generation counter lasts.
+	 */
+	for (i = 0; i < 3 * 65536; i++) {
+		watch_add(&watchlist, &w[2], 'c');
+		assert(w[2].id != old_id);
+		assert(watchlist_remove(&watchlist, w[2].id));
+	}
+
+	assert(!watchlist_remove(&watchlist, old_id));
+
+	notify(&watchlist);
+	assert(!strcmp(notified, "b"));
+
+	watchlist_destroy(&watchlist);
+	assert(w[1].destroyed == 1);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/watchlist/add and remove", test_add_remove, NULL);
+	l_test_add("/watchlist/remove in notify", test_remove_in_notify, NULL);
+	l_test_add("/watchlist/destroy in notify", test_destroy_in_notify,
+			NULL);
+	l_test_add("/watchlist/many items", test_many, NULL);
+	l_test_add("/watchlist/ID reuse", test_id_reuse, NULL);
+
+	return l_test_run();
+}
@@ -24,6 +24,7 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
@@ -35,6 +36,7 @@
 #include <linux/if_packet.h>
 #include <linux/filter.h>
 #include <arpa/inet.h>
+#include <sys/socket.h>
 #include <ell/ell.h>
 
 #include "src/module.h"
@@ -52,6 +54,18 @@
 #define PROP_CONNECTED		"Connected"
 #define PROP_AUTHENTICATED	"Authenticated"
 
+/* Frames read from the PAE socket per wakeup */
+#define PAE_RX_BATCH		16
+
+/*
+ * Each port may receive a burst of PAE_RX_BURST frames, refilled at
+ * PAE_RX_RATE frames per second, so that a single misbehaving port can't
+ * starve the others.  PAE_MAX_SESSIONS limits the peers per port.
+ */
+#define PAE_RX_RATE		20
+#define PAE_RX_BURST		40
+#define PAE_MAX_SESSIONS	64
+
 struct ethdev {
 	uint32_t index;
 	char ifname[IFNAMSIZ];
@@ -59,8 +73,11 @@ struct ethdev {
 	bool active;
 	bool lower_up;
 	bool auth_done;
-	struct l_queue *eapol_sessions;
+	struct l_hashmap *eapol_sessions;
 	char *path;
+	uint32_t rx_tokens;
+	uint64_t rx_refill_time;
+	uint32_t rx_dropped;
 };
 
 struct eapol {
@@ -71,7 +88,7 @@ struct eapol {
 };
 
 static struct l_netlink *rtnl = NULL;
-static struct l_queue *ethdev_list = NULL;
+static struct l_hashmap *ethdev_list = NULL;
 static char **whitelist_filter = NULL;
 static char **blacklist_filter = NULL;
 
@@ -119,29 +136,61 @@ static void eapol_free(void *data)
 	l_free(eapol);
 }
 
-static bool eapol_match(const void *a, const void *b)
+static bool eapol_free_session(const void *key, void *value,
+							void *user_data)
 {
-	const struct eapol *eapol = a;
-
-	return !memcmp(eapol->addr, b, ETH_ALEN);
+	eapol_free(value);
+	return true;
 }
 
-static struct eapol *eapol_lookup(struct ethdev *dev, const uint8_t *addr)
+/* Sessions are keyed by the peer address stored in struct eapol itself */
+static unsigned int eapol_addr_hash(const void *p)
 {
-	return l_queue_find(dev->eapol_sessions, eapol_match, addr);
+	const uint8_t *addr = p;
+
+	/* The low bytes are the most likely to differ between peers */
+	return l_get_be32(addr + 2) ^ (l_get_be16(addr) << 16);
 }
 
-static bool ethdev_match(const void *a, const void *b)
+static int eapol_addr_compare(const void *a, const void *b)
 {
-	const struct ethdev *dev = a;
-	uint32_t index = L_PTR_TO_UINT(b);
+	return memcmp(a, b, ETH_ALEN);
+}
 
-	return (dev->index == index);
+static struct eapol *eapol_lookup(struct ethdev *dev, const uint8_t *addr)
+{
+	return l_hashmap_lookup(dev->eapol_sessions, addr);
 }
 
 static struct ethdev *ethdev_lookup(uint32_t index)
 {
-	return l_queue_find(ethdev_list, ethdev_match, L_UINT_TO_PTR(index));
+	return l_hashmap_lookup(ethdev_list, L_UINT_TO_PTR(index));
+}
+
+static bool ethdev_rx_allowed(struct ethdev *dev)
+{
+	uint64_t now = l_time_now();
+	uint64_t elapsed = l_time_diff(dev->rx_refill_time, now);
+	uint64_t refill = elapsed * PAE_RX_RATE / L_USEC_PER_SEC;
+
+	if (refill) {
+		if (refill > PAE_RX_BURST - dev->rx_tokens)
+			dev->rx_tokens = PAE_RX_BURST;
+		else
+			dev->rx_tokens += refill;
+
+		dev->rx_refill_time = now;
+	}
+
+	if (dev->rx_tokens) {
+		dev->rx_tokens -= 1;
+		return true;
+	}
+
+	if (!dev->rx_dropped++)
+		l_debug("%s: rate limiting PAE frames", dev->ifname);
+
+	return false;
 }
 
 static void eap_tx_packet(const uint8_t *eap_data, size_t len, void *user_data)
@@ -177,7 +226,7 @@ static void eap_complete(enum eap_result result, void *user_data)
 		}
 	}
 
-	l_queue_remove(dev->eapol_sessions, eapol);
+	l_hashmap_remove(dev->eapol_sessions, eapol->addr);
 	eapol_free(eapol);
 }
 
@@ -225,6 +274,13 @@ static void rx_packet(struct ethdev *dev, const uint8_t *addr,
 	case 0x00:	/* EAP-Packet */
 		eapol = eapol_lookup(dev, addr);
 		if (!eapol) {
+			if (l_hashmap_size(dev->eapol_sessions) >=
+							PAE_MAX_SESSIONS) {
+				l_debug("%s: too many EAPoL sessions",
+							dev->ifname);
+				return;
+			}
+
 			eapol = l_new(struct eapol, 1);
 			eapol->dev = dev;
 			memcpy(eapol->addr, addr, ETH_ALEN);
@@ -238,7 +294,8 @@ static void rx_packet(struct ethdev *dev, const uint8_t *addr,
 
 			l_debug("Created new EAPoL session");
 
-			l_queue_push_tail(dev->eapol_sessions, eapol);
+			l_hashmap_insert(dev->eapol_sessions, eapol->addr,
+							eapol);
 
 			eapol->cred = network_lookup_security("default");
 			eap_load_settings(eapol->eap, eapol->cred, "EAP-");
@@ -266,43 +323,69 @@ static struct sock_filter pae_filter[] = {
 
 static const struct sock_fprog pae_fprog = { .len = 6, .filter = pae_filter };
 
-static bool pae_read(struct l_io *io, void *user_data)
+static void pae_rx_frame(const struct sockaddr_ll *sll, const uint8_t *frame,
+								size_t len)
 {
-	int fd = l_io_get_fd(io);
 	struct ethdev *dev;
-	struct sockaddr_ll sll;
-	socklen_t sll_len;
-	ssize_t bytes;
-	uint8_t frame[1500];
 
-	memset(&sll, 0, sizeof(sll));
-	sll_len = sizeof(sll);
+	if (sll->sll_hatype != ARPHRD_ETHER)
+		return;
 
-	bytes = recvfrom(fd, frame, sizeof(frame), 0,
-					(struct sockaddr *) &sll, &sll_len);
-	if (bytes <= 0) {
-		l_error("Reading from PAE socket failed: %s", strerror(errno));
-		return false;
-	}
+	if (sll->sll_halen != ETH_ALEN)
+		return;
 
-	if (sll.sll_hatype != ARPHRD_ETHER)
-		return true;
+	if (ntohs(sll->sll_protocol) != ETH_P_PAE)
+		return;
 
-	if (sll.sll_halen != ETH_ALEN)
-		return true;
+	if (sll->sll_pkttype != PACKET_HOST &&
+					sll->sll_pkttype != PACKET_MULTICAST)
+		return;
 
-	if (ntohs(sll.sll_protocol) != ETH_P_PAE)
-		return true;
+	dev = ethdev_lookup(sll->sll_ifindex);
+	if (!dev)
+		return;
 
-	if (sll.sll_pkttype != PACKET_HOST &&
-					sll.sll_pkttype != PACKET_MULTICAST)
-		return true;
+	if (!ethdev_rx_allowed(dev))
+		return;
 
-	dev = ethdev_lookup(sll.sll_ifindex);
-	if (!dev)
-		return true;
+	rx_packet(dev, sll->sll_addr, frame, len);
+}
+
+static bool pae_read(struct l_io *io, void *user_data)
+{
+	static uint8_t frames[PAE_RX_BATCH][1500];
+	struct sockaddr_ll sll[PAE_RX_BATCH];
+	struct iovec iov[PAE_RX_BATCH];
+	struct mmsghdr msgs[PAE_RX_BATCH];
+	int fd = l_io_get_fd(io);
+	int i, n;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < PAE_RX_BATCH; i++) {
+		iov[i].iov_base = frames[i];
+		iov[i].iov_len = sizeof(frames[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &sll[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(sll[i]);
+	}
 
-	rx_packet(dev, sll.sll_addr, frame, bytes);
+	n = recvmmsg(fd, msgs, PAE_RX_BATCH, MSG_DONTWAIT, NULL);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return true;
+
+		l_error("Reading from PAE socket failed: %s", strerror(errno));
+		return false;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!msgs[i].msg_len)
+			continue;
+
+		pae_rx_frame(&sll[i], frames[i], msgs[i].msg_len);
+	}
 
 	return true;
 }
@@ -412,7 +495,8 @@ static void ethdev_free(void *data)
 
 	modify_membership(dev, PACKET_DROP_MEMBERSHIP);
 
-	l_queue_destroy(dev->eapol_sessions, eapol_free);
+	l_hashmap_foreach_remove(dev->eapol_sessions, eapol_free_session, NULL);
+	l_hashmap_destroy(dev->eapol_sessions, NULL);
 
 	l_dbus_object_remove_interface(dbus_app_get(), dev->path,
 							ADAPTER_INTERFACE);
@@ -509,7 +593,7 @@ static void newlink_notify(const struct ifinfomsg *ifi, int bytes)
 			return;
 		}
 
-		if (l_queue_isempty(ethdev_list)) {
+		if (l_hashmap_isempty(ethdev_list)) {
 			if (!pae_open()) {
 				l_error("Failed to open PAE port");
 				return;
@@ -521,7 +605,13 @@ static void newlink_notify(const struct ifinfomsg *ifi, int bytes)
 		dev->active = active;
 		dev->lower_up = lower_up;
 		dev->auth_done = false;
-		dev->eapol_sessions = l_queue_new();
+		dev->eapol_sessions = l_hashmap_new();
+		l_hashmap_set_hash_function(dev->eapol_sessions,
+							eapol_addr_hash);
+		l_hashmap_set_compare_function(dev->eapol_sessions,
+							eapol_addr_compare);
+		dev->rx_tokens = PAE_RX_BURST;
+		dev->rx_refill_time = l_time_now();
 		dev->path = l_strdup_printf("%s/%u", ADAPTER_BASEPATH,
 								dev->index);
 
@@ -535,7 +625,7 @@ static void newlink_notify(const struct ifinfomsg *ifi, int bytes)
 		l_dbus_object_add_interface(dbus_app_get(), dev->path,
 					L_DBUS_INTERFACE_PROPERTIES, NULL);
 
-		l_queue_push_tail(ethdev_list, dev);
+		l_hashmap_insert(ethdev_list, L_UINT_TO_PTR(index), dev);
 
 		lower_changed = true;
 	}
@@ -570,7 +660,8 @@ static void newlink_notify(const struct ifinfomsg *ifi, int bytes)
 			pae_write(dev, pae_group_addr,
 					eapol_start, sizeof(eapol_start));
 		else
-			l_queue_clear(dev->eapol_sessions, eapol_free);
+			l_hashmap_foreach_remove(dev->eapol_sessions,
+						eapol_free_session, NULL);
 	}
 }
 
@@ -582,8 +673,7 @@ static void dellink_notify(const struct ifinfomsg *ifi, int bytes)
 	if (ifi->ifi_type != ARPHRD_ETHER)
 		return;
 
-	dev = l_queue_remove_if(ethdev_list, ethdev_match,
-						L_UINT_TO_PTR(index));
+	dev = l_hashmap_remove(ethdev_list, L_UINT_TO_PTR(index));
 	if (!dev)
 		return;
 
@@ -591,7 +681,7 @@ static void dellink_notify(const struct ifinfomsg *ifi, int bytes)
 
 	ethdev_free(dev);
 
-	if (l_queue_isempty(ethdev_list))
+	if (l_hashmap_isempty(ethdev_list))
 		pae_close();
 }
 
@@ -736,7 +826,7 @@ bool ethdev_init(const char *whitelist, const char *blacklist)
 		return false;
 	}
 
-	ethdev_list = l_queue_new();
+	ethdev_list = l_hashmap_new();
 
 	if (!l_dbus_register_interface(dbus_app_get(), ADAPTER_INTERFACE,
 					setup_adapter_interface, NULL, false)) {
@@ -775,6 +865,6 @@ void ethdev_exit(void)
 	l_netlink_destroy(rtnl);
 	rtnl = NULL;
 
-	l_queue_destroy(ethdev_list, ethdev_free);
+	l_hashmap_destroy(ethdev_list, ethdev_free);
 	ethdev_list = NULL;
 }